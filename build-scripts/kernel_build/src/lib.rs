@@ -7,6 +7,7 @@ mod cfiles;
 mod constant;
 mod kconfig;
 mod utils;
+mod vdso;
 
 /// 运行构建
 pub fn run() {
@@ -14,5 +15,6 @@ pub fn run() {
 
     crate::bindgen::generate_bindings();
     crate::cfiles::CFilesBuilder::build();
+    crate::vdso::VdsoBuilder::build();
     crate::kconfig::KConfigBuilder::build();
 }
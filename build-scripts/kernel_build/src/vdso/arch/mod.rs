@@ -0,0 +1,27 @@
+use std::{path::PathBuf, process::Command};
+
+use crate::utils::cargo_handler::{CargoHandler, TargetArch};
+
+use self::x86_64::X86_64VdsoArch;
+
+pub mod x86_64;
+
+pub(super) trait VdsoArch {
+    /// vDSO的源文件
+    fn sources(&self) -> Vec<PathBuf>;
+    /// vDSO的源文件包含的头文件（只用于监听文件的更改）
+    fn headers(&self) -> Vec<PathBuf>;
+    /// vDSO的链接脚本
+    fn linker_script(&self) -> PathBuf;
+    /// 设置架构相关的编译标志
+    fn setup_flags(&self, cmd: &mut Command);
+}
+
+/// 获取当前的vDSO架构
+pub(super) fn current_vdso_arch() -> &'static dyn VdsoArch {
+    let arch = CargoHandler::target_arch();
+    match arch {
+        TargetArch::X86_64 => &X86_64VdsoArch,
+        _ => panic!("Unsupported arch: {:?}", arch),
+    }
+}
@@ -0,0 +1,29 @@
+use std::{path::PathBuf, process::Command};
+
+use crate::constant::ARCH_DIR_X86_64;
+
+use super::VdsoArch;
+
+pub(super) struct X86_64VdsoArch;
+
+impl VdsoArch for X86_64VdsoArch {
+    fn sources(&self) -> Vec<PathBuf> {
+        vec![vdso_path("vdso.c")]
+    }
+
+    fn headers(&self) -> Vec<PathBuf> {
+        vec![vdso_path("vdso_data.h")]
+    }
+
+    fn linker_script(&self) -> PathBuf {
+        vdso_path("vdso.lds")
+    }
+
+    fn setup_flags(&self, cmd: &mut Command) {
+        cmd.args(["-m64", "-mcmodel=small"]);
+    }
+}
+
+fn vdso_path(relative_path: &str) -> PathBuf {
+    PathBuf::from(format!("{}/vdso/{}", ARCH_DIR_X86_64, relative_path))
+}
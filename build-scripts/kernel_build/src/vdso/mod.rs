@@ -0,0 +1,64 @@
+use std::{path::PathBuf, process::Command};
+
+use crate::utils::cargo_handler::CargoHandler;
+
+use self::arch::current_vdso_arch;
+
+mod arch;
+
+/// 构建vDSO镜像
+///
+/// vDSO是一个独立链接的用户态共享库，不能与内核的C文件一起编译。
+/// 构建完成后，通过环境变量`DRAGONOS_VDSO_IMAGE`把镜像的路径告诉内核，内核使用`include_bytes!`把它嵌入。
+pub struct VdsoBuilder;
+
+impl VdsoBuilder {
+    pub fn build() {
+        let arch = current_vdso_arch();
+        let sources = arch.sources();
+        let lds = arch.linker_script();
+
+        let mut files = sources.clone();
+        files.push(lds.clone());
+        files.append(&mut arch.headers());
+        CargoHandler::emit_rerun_if_files_changed(&files);
+
+        let out_dir = PathBuf::from(std::env::var("OUT_DIR").expect("OUT_DIR not set"));
+        let image = out_dir.join("vdso.so");
+
+        // 复用cc的编译器探测逻辑（会读取CC等环境变量），但是不使用它的编译流程：
+        // vDSO需要作为位置无关的共享库链接，而不是静态库
+        let compiler = cc::Build::new().get_compiler();
+        let mut cmd: Command = compiler.to_command();
+        cmd.args([
+            "-fPIC",
+            "-O2",
+            "-ffreestanding",
+            "-fno-builtin",
+            "-fno-stack-protector",
+            "-nostdlib",
+            "-shared",
+            "-Wl,-soname=linux-vdso.so.1",
+            "-Wl,--hash-style=both",
+            "-Wl,-Bsymbolic",
+            "-Wl,--no-undefined",
+            "-Wl,--eh-frame-hdr",
+            "-Wl,--build-id=none",
+            "-Wl,-z,max-page-size=4096",
+        ]);
+        arch.setup_flags(&mut cmd);
+        cmd.arg(format!("-Wl,-T,{}", lds.to_str().unwrap()));
+        cmd.args(sources.iter());
+        cmd.arg("-o").arg(&image);
+
+        let status = cmd.status().expect("Failed to run the compiler for vDSO");
+        if !status.success() {
+            panic!("Failed to build vDSO: {:?}", cmd);
+        }
+
+        println!(
+            "cargo:rustc-env=DRAGONOS_VDSO_IMAGE={}",
+            image.to_str().unwrap()
+        );
+    }
+}
@@ -0,0 +1,159 @@
+//! CRC32C（Castagnoli）
+//!
+//! 多项式为 x^32 + x^28 + x^27 + x^26 + x^25 + x^23 + x^22 + x^20 + x^19 + x^18 +
+//! x^14 + x^13 + x^11 + x^10 + x^9 + x^8 + x^6 + 1（低位在前的表示为0x82F63B78），
+//! iSCSI、ext4、btrfs等使用这个多项式。
+//!
+//! 支持SSE4.2的x86_64 cpu上使用crc32指令计算（每条指令处理8个字节），
+//! 否则使用slicing-by-8的查表法。crc32指令只使用通用寄存器，因此在内核中使用不需要保存浮点状态。
+
+use crate::tables::crc32c::CRC32C_TABLE;
+
+/// crc32c_le - Calculate bitwise little-endian CRC32C
+///
+/// 与Linux的`__crc32c_le`相同：不对输入的crc和结果取反。
+/// 计算标准的CRC32C时，种子为!0，并且对结果取反
+///
+/// ## 参数
+///
+/// - `crc`: seed value for computation, or the previous crc32c value if computing incrementally.
+/// - `buf`: pointer to buffer over which CRC32C is run
+pub fn crc32c_le(crc: u32, buf: &[u8]) -> u32 {
+    #[cfg(target_arch = "x86_64")]
+    {
+        if x86_64::has_sse42() {
+            return unsafe { x86_64::crc32c_le_sse42(crc, buf) };
+        }
+    }
+    return crc32c_le_generic(crc, buf);
+}
+
+/// crc32c_le_generic - Calculate CRC32C with slicing-by-8 tables
+///
+/// 结果与[`crc32c_le`]相同
+pub fn crc32c_le_generic(mut crc: u32, buf: &[u8]) -> u32 {
+    let mut chunks = buf.chunks_exact(8);
+    for chunk in &mut chunks {
+        let lo = crc ^ u32::from_le_bytes([chunk[0], chunk[1], chunk[2], chunk[3]]);
+        let hi = u32::from_le_bytes([chunk[4], chunk[5], chunk[6], chunk[7]]);
+        crc = CRC32C_TABLE[7][(lo & 0xff) as usize]
+            ^ CRC32C_TABLE[6][((lo >> 8) & 0xff) as usize]
+            ^ CRC32C_TABLE[5][((lo >> 16) & 0xff) as usize]
+            ^ CRC32C_TABLE[4][(lo >> 24) as usize]
+            ^ CRC32C_TABLE[3][(hi & 0xff) as usize]
+            ^ CRC32C_TABLE[2][((hi >> 8) & 0xff) as usize]
+            ^ CRC32C_TABLE[1][((hi >> 16) & 0xff) as usize]
+            ^ CRC32C_TABLE[0][(hi >> 24) as usize];
+    }
+    for &byte in chunks.remainder() {
+        crc = (crc >> 8) ^ CRC32C_TABLE[0][((crc as u8) ^ byte) as usize];
+    }
+    return crc;
+}
+
+#[cfg(target_arch = "x86_64")]
+mod x86_64 {
+    use core::{
+        arch::{asm, x86_64::__cpuid},
+        sync::atomic::{AtomicU8, Ordering},
+    };
+
+    const SSE42_UNKNOWN: u8 = 0;
+    const SSE42_ABSENT: u8 = 1;
+    const SSE42_PRESENT: u8 = 2;
+
+    /// 第一次计算时通过CPUID检测，之后使用缓存的结果
+    static SSE42: AtomicU8 = AtomicU8::new(SSE42_UNKNOWN);
+
+    #[inline]
+    pub fn has_sse42() -> bool {
+        let mut state = SSE42.load(Ordering::Relaxed);
+        if state == SSE42_UNKNOWN {
+            // CPUID.01H:ECX[bit 20]
+            let leaf1 = unsafe { __cpuid(1) };
+            state = if leaf1.ecx & (1 << 20) != 0 {
+                SSE42_PRESENT
+            } else {
+                SSE42_ABSENT
+            };
+            SSE42.store(state, Ordering::Relaxed);
+        }
+        return state == SSE42_PRESENT;
+    }
+
+    /// 使用crc32指令计算CRC32C
+    ///
+    /// ## Safety
+    ///
+    /// cpu必须支持SSE4.2
+    pub unsafe fn crc32c_le_sse42(crc: u32, buf: &[u8]) -> u32 {
+        let mut crc = crc as u64;
+        // 先按字节处理到8字节对齐，对齐的读取更快
+        let (head, body, tail) = buf.align_to::<u64>();
+        for &byte in head {
+            crc = crc32_u8(crc, byte);
+        }
+        for &qword in body {
+            asm!(
+                "crc32 {crc}, {data}",
+                crc = inout(reg) crc,
+                data = in(reg) qword,
+                options(pure, nomem, nostack, preserves_flags)
+            );
+        }
+        for &byte in tail {
+            crc = crc32_u8(crc, byte);
+        }
+        return crc as u32;
+    }
+
+    #[inline(always)]
+    unsafe fn crc32_u8(crc: u64, byte: u8) -> u64 {
+        let mut crc = crc as u32;
+        asm!(
+            "crc32 {crc:e}, {data}",
+            crc = inout(reg) crc,
+            data = in(reg_byte) byte,
+            options(pure, nomem, nostack, preserves_flags)
+        );
+        return crc as u64;
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn crc32c_check_value() {
+        // CRC-32C的标准校验值
+        let buf = b"123456789";
+        assert_eq!(!crc32c_le(!0, buf), 0xe3069283);
+        assert_eq!(!crc32c_le_generic(!0, buf), 0xe3069283);
+    }
+
+    #[test]
+    fn crc32c_hw_matches_generic() {
+        let mut buf = [0u8; 1031];
+        for (i, b) in buf.iter_mut().enumerate() {
+            *b = (i as u32).wrapping_mul(2654435761).rotate_right(13) as u8;
+        }
+        for start in 0..9 {
+            for len in [0, 1, 7, 8, 9, 15, 16, 63, 64, 100, 1000] {
+                let data = &buf[start..start + len];
+                assert_eq!(
+                    crc32c_le(0x1234_5678, data),
+                    crc32c_le_generic(0x1234_5678, data)
+                );
+            }
+        }
+    }
+
+    #[test]
+    fn crc32c_incremental() {
+        let buf = b"The quick brown fox jumps over the lazy dog";
+        let whole = crc32c_le(!0, buf);
+        let part = crc32c_le(crc32c_le(!0, &buf[..10]), &buf[10..]);
+        assert_eq!(whole, part);
+    }
+}
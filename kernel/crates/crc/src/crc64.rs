@@ -29,7 +29,9 @@
 //! x^46 + x^44 + x^41 + x^37 + x^36 + x^34 + x^32 + x^31 + x^28 + x^26 + x^23 +
 //! x^22 + x^19 + x^16 + x^13 + x^12 + x^10 + x^9 + x^6 + x^4 + x^3 + 1
 
-use crate::tables::crc64::{CRC64_ROCKSOFT_TABLE, CRC64_TABLE};
+use crate::tables::crc64::{
+    CRC64_ROCKSOFT_SLICE8_TABLE, CRC64_ROCKSOFT_TABLE, CRC64_SLICE8_TABLE, CRC64_TABLE,
+};
 
 /// crc64_be - Calculate bitwise big-endian ECMA-182 CRC64
 ///
@@ -39,7 +41,21 @@ use crate::tables::crc64::{CRC64_ROCKSOFT_TABLE, CRC64_TABLE};
 ///             or the previous crc64 value if computing incrementally.
 /// - `buf`: pointer to buffer over which CRC64 is run
 pub fn crc64_be(mut crc: u64, buf: &[u8]) -> u64 {
-    for &byte in buf {
+    // 每次处理8个字节（slicing-by-8）
+    let t = &CRC64_SLICE8_TABLE;
+    let mut chunks = buf.chunks_exact(8);
+    for chunk in &mut chunks {
+        let v = crc ^ u64::from_be_bytes(chunk.try_into().unwrap());
+        crc = t[7][(v >> 56) as usize]
+            ^ t[6][((v >> 48) & 0xff) as usize]
+            ^ t[5][((v >> 40) & 0xff) as usize]
+            ^ t[4][((v >> 32) & 0xff) as usize]
+            ^ t[3][((v >> 24) & 0xff) as usize]
+            ^ t[2][((v >> 16) & 0xff) as usize]
+            ^ t[1][((v >> 8) & 0xff) as usize]
+            ^ t[0][(v & 0xff) as usize];
+    }
+    for &byte in chunks.remainder() {
         let t = ((crc >> 56) ^ (byte as u64)) & 0xff;
         crc = CRC64_TABLE[t as usize] ^ (crc << 8);
     }
@@ -57,7 +73,21 @@ pub fn crc64_be(mut crc: u64, buf: &[u8]) -> u64 {
 pub fn crc64_rocksoft_generic(mut crc: u64, buf: &[u8]) -> u64 {
     crc = !crc;
 
-    for &byte in buf {
+    // 每次处理8个字节（slicing-by-8）
+    let t = &CRC64_ROCKSOFT_SLICE8_TABLE;
+    let mut chunks = buf.chunks_exact(8);
+    for chunk in &mut chunks {
+        let v = crc ^ u64::from_le_bytes(chunk.try_into().unwrap());
+        crc = t[7][(v & 0xff) as usize]
+            ^ t[6][((v >> 8) & 0xff) as usize]
+            ^ t[5][((v >> 16) & 0xff) as usize]
+            ^ t[4][((v >> 24) & 0xff) as usize]
+            ^ t[3][((v >> 32) & 0xff) as usize]
+            ^ t[2][((v >> 40) & 0xff) as usize]
+            ^ t[1][((v >> 48) & 0xff) as usize]
+            ^ t[0][(v >> 56) as usize];
+    }
+    for &byte in chunks.remainder() {
         crc = (crc >> 8) ^ CRC64_ROCKSOFT_TABLE[(((crc & 0xff) as u8) ^ (byte)) as usize];
     }
 
@@ -82,4 +112,43 @@ mod tests {
         let crc = crc64_be(0, buf);
         assert_eq!(crc, 0x2a71ab4164c3bbe8);
     }
+
+    /// 逐字节查表的实现，用于检查slicing-by-8的结果
+    fn crc64_be_bytewise(mut crc: u64, buf: &[u8]) -> u64 {
+        for &byte in buf {
+            let t = ((crc >> 56) ^ (byte as u64)) & 0xff;
+            crc = CRC64_TABLE[t as usize] ^ (crc << 8);
+        }
+        crc
+    }
+
+    fn crc64_rocksoft_bytewise(mut crc: u64, buf: &[u8]) -> u64 {
+        crc = !crc;
+        for &byte in buf {
+            crc = (crc >> 8) ^ CRC64_ROCKSOFT_TABLE[(((crc & 0xff) as u8) ^ (byte)) as usize];
+        }
+        !crc
+    }
+
+    #[test]
+    fn crc64_slice8_matches_bytewise() {
+        let mut buf = [0u8; 300];
+        for (i, b) in buf.iter_mut().enumerate() {
+            *b = (i as u32).wrapping_mul(2654435761).rotate_right(7) as u8;
+        }
+        for len in [0, 1, 7, 8, 9, 16, 17, 255, 300] {
+            let data = &buf[..len];
+            assert_eq!(crc64_be(0x55, data), crc64_be_bytewise(0x55, data));
+            assert_eq!(
+                crc64_rocksoft_generic(0x55, data),
+                crc64_rocksoft_bytewise(0x55, data)
+            );
+        }
+    }
+
+    #[test]
+    fn crc64_rocksoft_check_value() {
+        // CRC-64/NVME（Rocksoft）的标准校验值
+        assert_eq!(crc64_rocksoft_generic(0, b"123456789"), 0xae8b14860a799888);
+    }
 }
@@ -5,5 +5,6 @@
 #[cfg(test)]
 extern crate std;
 
+pub mod crc32c;
 pub mod crc64;
 pub mod tables;
@@ -0,0 +1,37 @@
+/// CRC32C（Castagnoli）的多项式（低位在前的表示）
+pub const CRC32C_POLY_LE: u32 = 0x82F63B78;
+
+/// 生成CRC32C的slicing-by-8的表
+///
+/// 第0张表是普通的单字节表，第k张表是一个字节后面跟着k个0字节时的crc
+const fn crc32c_slice8() -> [[u32; 256]; 8] {
+    let mut r = [[0u32; 256]; 8];
+    let mut i = 0;
+    while i < 256 {
+        let mut crc = i as u32;
+        let mut j = 0;
+        while j < 8 {
+            crc = if crc & 1 != 0 {
+                (crc >> 1) ^ CRC32C_POLY_LE
+            } else {
+                crc >> 1
+            };
+            j += 1;
+        }
+        r[0][i] = crc;
+        i += 1;
+    }
+    let mut k = 1;
+    while k < 8 {
+        let mut i = 0;
+        while i < 256 {
+            let prev = r[k - 1][i];
+            r[k][i] = (prev >> 8) ^ r[0][(prev & 0xff) as usize];
+            i += 1;
+        }
+        k += 1;
+    }
+    r
+}
+
+pub static CRC32C_TABLE: [[u32; 256]; 8] = crc32c_slice8();
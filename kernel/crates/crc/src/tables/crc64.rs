@@ -543,3 +543,53 @@ pub const CRC64_ROCKSOFT_TABLE: Crc64Table = Crc64Table::new(
         0x2ada5047efec8728,
     ],
 );
+
+/// 由单字节的表生成slicing-by-8的表（高位在前的CRC，例如ECMA-182）
+///
+/// 第k张表是一个字节后面跟着k个0字节时的crc
+const fn slice8_be(table: &[u64; 256]) -> [[u64; 256]; 8] {
+    let mut r = [[0u64; 256]; 8];
+    let mut i = 0;
+    while i < 256 {
+        r[0][i] = table[i];
+        i += 1;
+    }
+    let mut k = 1;
+    while k < 8 {
+        let mut i = 0;
+        while i < 256 {
+            let prev = r[k - 1][i];
+            r[k][i] = (prev << 8) ^ table[(prev >> 56) as usize];
+            i += 1;
+        }
+        k += 1;
+    }
+    r
+}
+
+/// 由单字节的表生成slicing-by-8的表（低位在前的CRC，例如Rocksoft）
+const fn slice8_le(table: &[u64; 256]) -> [[u64; 256]; 8] {
+    let mut r = [[0u64; 256]; 8];
+    let mut i = 0;
+    while i < 256 {
+        r[0][i] = table[i];
+        i += 1;
+    }
+    let mut k = 1;
+    while k < 8 {
+        let mut i = 0;
+        while i < 256 {
+            let prev = r[k - 1][i];
+            r[k][i] = (prev >> 8) ^ table[(prev & 0xff) as usize];
+            i += 1;
+        }
+        k += 1;
+    }
+    r
+}
+
+/// CRC64_TABLE的slicing-by-8版本，每次处理8个字节
+pub static CRC64_SLICE8_TABLE: [[u64; 256]; 8] = slice8_be(&CRC64_TABLE.table);
+
+/// CRC64_ROCKSOFT_TABLE的slicing-by-8版本，每次处理8个字节
+pub static CRC64_ROCKSOFT_SLICE8_TABLE: [[u64; 256]; 8] = slice8_le(&CRC64_ROCKSOFT_TABLE.table);
@@ -1 +1,2 @@
+pub mod crc32c;
 pub mod crc64;
@@ -1,12 +1,16 @@
 #![no_std]
 #![feature(const_refs_to_cell)]
-#![feature(const_size_of_val)]
 
 extern crate alloc;
-use core::{fmt::Debug, mem::size_of_val};
+use core::{
+    cell::UnsafeCell,
+    fmt::Debug,
+    mem::size_of,
+    sync::atomic::{AtomicU64, Ordering},
+};
 
 use alloc::format;
-use kdepends::{memoffset::offset_of, thingbuf::StaticThingBuf};
+use kdepends::memoffset::offset_of;
 
 #[repr(C)]
 #[derive(Debug, Copy, Clone, PartialEq, Eq)]
@@ -165,25 +169,26 @@ pub enum LogSource {
     Slab = 3,
 }
 
-pub struct MMLogCycle;
+/// 日志通道中环形缓冲区的数量
+///
+/// 每个CPU只向编号为`cpu_id % MM_LOG_CHANNEL_RINGS`的环形缓冲区写入日志
+pub const MM_LOG_CHANNEL_RINGS: usize = 16;
 
-impl MMLogCycle {
-    pub const fn new() -> Self {
-        Self {}
-    }
-}
-
-impl kdepends::thingbuf::Recycle<AllocatorLog> for MMLogCycle {
-    fn new_element(&self) -> AllocatorLog {
-        AllocatorLog::zeroed()
-    }
+/// 日志通道中的一个槽
+#[repr(C)]
+pub struct MMLogSlot(UnsafeCell<AllocatorLog>);
 
-    fn recycle(&self, element: &mut AllocatorLog) {
-        *element = AllocatorLog::zeroed();
+impl MMLogSlot {
+    pub const fn zeroed() -> Self {
+        return Self(UnsafeCell::new(AllocatorLog::zeroed()));
     }
 }
 
 /// 内存分配器日志通道
+///
+/// 所有的槽被平均划分给[`MM_LOG_CHANNEL_RINGS`]个环形缓冲区。写入者只推进自己的环形缓冲区的写指针，
+/// 因此不同CPU之间不会竞争同一个缓存行。通道没有内核内的读者：外部的监视器直接读取所有的槽，
+/// 并通过校验和过滤掉无效的、或者正在被写入的日志。环形缓冲区写满之后，新的日志会覆盖最早的日志。
 #[repr(C)]
 pub struct MMLogChannel<const CAP: usize> {
     pub magic: u32,
@@ -193,9 +198,13 @@ pub struct MMLogChannel<const CAP: usize> {
     pub slot_size: u32,
     pub capacity: u64,
     pub slots_offset: u64,
-    pub buf: StaticThingBuf<AllocatorLog, CAP, MMLogCycle>,
+    /// 每个环形缓冲区下一次写入的序号
+    heads: [AtomicU64; MM_LOG_CHANNEL_RINGS],
+    slots: [MMLogSlot; CAP],
 }
 
+unsafe impl<const CAP: usize> Sync for MMLogChannel<CAP> {}
+
 impl<const CAP: usize> Debug for MMLogChannel<CAP> {
     fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
         f.debug_struct("MMLogChannel")
@@ -203,13 +212,7 @@ impl<const CAP: usize> Debug for MMLogChannel<CAP> {
             .field("element_size", &self.element_size)
             .field("capacity", &self.capacity)
             .field("slots_offset", &self.slots_offset)
-            .field(
-                "buf",
-                &format!(
-                    "StaticThingBuf<AllocatorLog, {}, MMLogCycle>",
-                    self.capacity
-                ),
-            )
+            .field("rings", &MM_LOG_CHANNEL_RINGS)
             .finish()
     }
 }
@@ -218,24 +221,188 @@ impl<const CAP: usize> MMLogChannel<CAP> {
     /// 日志通道的魔数
     pub const MM_LOG_CHANNEL_MAGIC: u32 = 0x4d4c4348;
 
+    /// 每个环形缓冲区的槽的数量
+    const RING_SIZE: usize = CAP / MM_LOG_CHANNEL_RINGS;
+
     /// 创建一个大小为`capacity`日志通道
     pub const fn new(capacity: usize) -> Self {
-        let buffer = StaticThingBuf::with_recycle(MMLogCycle::new());
-        assert!(buffer.offset_of_slots() != 0);
-        let slot_total_size = size_of_val(&buffer) - buffer.offset_of_slots();
-        let slot_size = slot_total_size / capacity;
-        assert!(slot_size != 0);
-        assert!(slot_size > size_of_val(&AllocatorLog::zeroed()));
+        assert!(capacity == CAP);
+        assert!(Self::RING_SIZE != 0);
+        // 序号从1开始，因为0是无效的id
+        const FIRST_SEQ: AtomicU64 = AtomicU64::new(1);
+        const EMPTY: MMLogSlot = MMLogSlot::zeroed();
+
+        let slot_size = size_of::<MMLogSlot>();
+        assert!(slot_size >= size_of::<AllocatorLog>());
 
         let r = Self {
             magic: Self::MM_LOG_CHANNEL_MAGIC,
-            element_size: core::mem::size_of::<AllocatorLog>() as u32,
+            element_size: size_of::<AllocatorLog>() as u32,
             capacity: capacity as u64,
             slot_size: slot_size as u32,
-            slots_offset: (offset_of!(MMLogChannel<CAP>, buf) + buffer.offset_of_slots()) as u64,
-            buf: buffer,
+            slots_offset: offset_of!(MMLogChannel<CAP>, slots) as u64,
+            heads: [FIRST_SEQ; MM_LOG_CHANNEL_RINGS],
+            slots: [EMPTY; CAP],
         };
 
         return r;
     }
+
+    /// 向指定的环形缓冲区写入一条日志
+    ///
+    /// ## 参数
+    ///
+    /// - `ring`：环形缓冲区的编号（通常是当前CPU的id）
+    /// - `make_log`：根据日志的id生成日志的闭包。id的高16位是环形缓冲区的编号，低48位是环形缓冲区内的序号，
+    ///   因此id在整个通道内唯一，且不会为0
+    #[inline]
+    pub fn push_with(&self, ring: usize, make_log: impl FnOnce(u64) -> AllocatorLog) {
+        let ring = ring % MM_LOG_CHANNEL_RINGS;
+        // 写指针只会被同一个CPU（以及在它上面嵌套的中断）修改，这里的原子操作不会产生跨CPU的竞争
+        let seq = self.heads[ring].fetch_add(1, Ordering::Relaxed);
+        let id = ((ring as u64) << 48) | (seq & ((1 << 48) - 1));
+        let log = make_log(id);
+
+        let index = ring * Self::RING_SIZE + (seq as usize) % Self::RING_SIZE;
+        unsafe { core::ptr::write_volatile(self.slots[index].0.get(), log) };
+    }
+}
+
+/// 跟踪事件的类别，用于分别打开、关闭一类跟踪点
+pub mod trace_class {
+    /// 进程切换、唤醒
+    pub const SCHED: u32 = 1 << 0;
+    /// 硬中断的进入、退出
+    pub const IRQ: u32 = 1 << 1;
+    /// 软中断的进入、退出
+    pub const SOFTIRQ: u32 = 1 << 2;
+    /// 缺页异常
+    pub const MM: u32 = 1 << 3;
+    /// 块设备请求
+    pub const BLOCK: u32 = 1 << 4;
+    /// 网卡收发
+    pub const NET: u32 = 1 << 5;
+    /// 系统调用的进入、退出
+    pub const SYSCALL: u32 = 1 << 6;
+    /// 所有的类别
+    pub const ALL: u32 = (1 << 7) - 1;
+
+    /// 类别的名字（第i个名字对应第i位）
+    pub const NAMES: [&str; 7] = ["sched", "irq", "softirq", "mm", "block", "net", "syscall"];
+}
+
+/// 跟踪事件的类型
+///
+/// 每种事件的两个参数的含义见各个成员的注释
+#[repr(u16)]
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub enum TraceEventType {
+    Undefined = 0,
+    /// 上一个进程的pid，下一个进程的pid
+    SchedSwitch = 1,
+    /// 被唤醒的进程的pid
+    SchedWakeup = 2,
+    /// 中断向量号
+    IrqEntry = 3,
+    /// 中断向量号
+    IrqExit = 4,
+    /// 软中断号
+    SoftirqEntry = 5,
+    /// 软中断号
+    SoftirqExit = 6,
+    /// 触发缺页异常的地址，缺页的原因
+    PageFault = 7,
+    /// 起始的lba，块数（第63位为1表示写）
+    BlockRqIssue = 8,
+    /// 起始的lba，块数（第63位为1表示写）
+    BlockRqComplete = 9,
+    /// 帧的长度，以太网类型
+    NetRx = 10,
+    /// 帧的长度，以太网类型
+    NetTx = 11,
+    /// 系统调用号，第一个参数
+    SyscallEnter = 12,
+    /// 系统调用号，返回值（出错时为负的错误码）
+    SyscallExit = 13,
+}
+
+impl TraceEventType {
+    /// 事件所属的类别（[`trace_class`]中的一位）
+    #[inline(always)]
+    pub const fn class(self) -> u32 {
+        return match self {
+            Self::Undefined => 0,
+            Self::SchedSwitch | Self::SchedWakeup => trace_class::SCHED,
+            Self::IrqEntry | Self::IrqExit => trace_class::IRQ,
+            Self::SoftirqEntry | Self::SoftirqExit => trace_class::SOFTIRQ,
+            Self::PageFault => trace_class::MM,
+            Self::BlockRqIssue | Self::BlockRqComplete => trace_class::BLOCK,
+            Self::NetRx | Self::NetTx => trace_class::NET,
+            Self::SyscallEnter | Self::SyscallExit => trace_class::SYSCALL,
+        };
+    }
+}
+
+/// 一条跟踪记录（32字节）
+#[repr(C)]
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub struct TraceRecord {
+    /// 事件发生时的TSC
+    pub time: u64,
+    /// 事件类型（[`TraceEventType`]）
+    pub event: u16,
+    /// 事件发生的cpu
+    pub cpu: u16,
+    /// 事件发生时正在运行的进程的pid
+    pub pid: u32,
+    /// 事件的参数
+    pub args: [u64; 2],
+}
+
+impl TraceRecord {
+    pub const fn zeroed() -> Self {
+        return Self {
+            time: 0,
+            event: TraceEventType::Undefined as u16,
+            cpu: 0,
+            pid: 0,
+            args: [0; 2],
+        };
+    }
+}
+
+/// 跟踪文件的头部
+///
+/// 跟踪文件的格式（小端序）：一个[`TraceFileHeader`]，之后是`nr_cpus`个cpu的数据。
+/// 每个cpu的数据是一个[`TraceCpuHeader`]，之后是`nr_records`条[`TraceRecord`]（按时间顺序）
+#[repr(C)]
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub struct TraceFileHeader {
+    /// [`TraceFileHeader::MAGIC`]
+    pub magic: u32,
+    pub version: u16,
+    /// 每条记录的大小
+    pub record_size: u16,
+    pub nr_cpus: u32,
+    /// 打开的事件类别
+    pub enabled: u32,
+    /// TSC的频率，用于把时间换算为纳秒
+    pub tsc_khz: u64,
+}
+
+impl TraceFileHeader {
+    /// "DTRC"
+    pub const MAGIC: u32 = 0x43525444;
+    pub const VERSION: u16 = 1;
+}
+
+/// 跟踪文件中每个cpu的数据的头部
+#[repr(C)]
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub struct TraceCpuHeader {
+    pub cpu: u32,
+    /// 之后的记录数
+    pub nr_records: u32,
+    /// 由于环形缓冲区被写满而被覆盖的记录数
+    pub lost: u64,
 }
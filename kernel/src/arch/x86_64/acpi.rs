@@ -1,4 +1,14 @@
-use crate::{driver::acpi::acpi_manager, kinfo, mm::percpu::PerCpu, syscall::SystemError};
+use alloc::vec::Vec;
+
+use crate::{
+    driver::acpi::acpi_manager,
+    kinfo,
+    mm::{
+        numa::{numa_register, NumaTopology},
+        percpu::PerCpu,
+    },
+    syscall::SystemError,
+};
 
 use super::smp::SMP_BOOT_DATA;
 
@@ -29,3 +39,27 @@ pub(super) fn early_acpi_boot_init() -> Result<(), SystemError> {
     // todo!("early_acpi_boot_init")
     return Ok(());
 }
+
+/// 解析SRAT/SLIT，注册NUMA拓扑（需要在SMP boot data初始化之后调用）
+pub(super) fn acpi_numa_init() {
+    let info = match acpi_manager().numa_info() {
+        Some(info) => info,
+        None => return,
+    };
+    // 把APIC ID转换为cpu号
+    let cpus: Vec<(usize, usize)> = (0..SMP_BOOT_DATA.cpu_count())
+        .filter_map(|cpu| {
+            let apic_id = SMP_BOOT_DATA.phys_id(cpu) as u32;
+            info.cpus
+                .iter()
+                .find(|(id, _)| *id == apic_id)
+                .map(|(_, node)| (cpu, *node))
+        })
+        .collect();
+    numa_register(&NumaTopology {
+        nr_nodes: info.nr_nodes,
+        memblks: info.memblks,
+        cpus,
+        distance: info.distance,
+    });
+}
@@ -0,0 +1,225 @@
+//! 内存拷贝、填充、比较函数
+//!
+//! 这里的函数是强符号，替代compiler_builtins中的同名弱符号；C代码中的memcpy、memset、memmove、memcmp也链接到这里。
+//!
+//! 启动时（[`mem_init`]）根据cpu的特性选择实现：
+//! - 支持FSRM（快速的短rep movsb）的cpu上，所有长度的拷贝都使用rep movsb
+//! - 支持ERMS（增强的rep movsb/stosb）的cpu上，较长的拷贝、填充使用rep movsb/stosb
+//! - 其他cpu上，使用rep movsq/stosq处理8字节的部分，剩余的字节使用rep movsb/stosb
+//!
+//! 不超过16字节的操作不使用rep前缀的指令（它们的启动开销比操作本身还大），而是直接用两次可能重叠的读写完成。
+//!
+//! 注意：这里不能使用会被编译器识别为memcpy/memset的循环，否则会变成对自身的递归调用。
+
+use core::{
+    arch::{asm, x86_64::__cpuid_count},
+    ptr::{read_unaligned, write_unaligned},
+    sync::atomic::{AtomicU8, Ordering},
+};
+
+/// 支持ERMS
+const MEM_FEATURE_ERMS: u8 = 1 << 0;
+/// 支持FSRM
+const MEM_FEATURE_FSRM: u8 = 1 << 1;
+
+/// 当前cpu支持的与字符串指令相关的特性
+static MEM_FEATURES: AtomicU8 = AtomicU8::new(0);
+
+/// 只有ERMS时，不短于这个长度的操作才使用rep movsb/stosb
+const REP_BYTE_THRESHOLD: usize = 256;
+
+/// 检测cpu特性，选择内存操作的实现（BSP在启动早期调用）
+pub fn mem_init() {
+    let leaf7 = unsafe { __cpuid_count(7, 0) };
+    let mut features = 0;
+    // CPUID.(EAX=07H, ECX=0):EBX[bit 9]
+    if leaf7.ebx & (1 << 9) != 0 {
+        features |= MEM_FEATURE_ERMS;
+    }
+    // CPUID.(EAX=07H, ECX=0):EDX[bit 4]
+    if leaf7.edx & (1 << 4) != 0 {
+        features |= MEM_FEATURE_FSRM;
+    }
+    MEM_FEATURES.store(features, Ordering::Relaxed);
+    kinfo!(
+        "mem: rep movsb/stosb: ERMS {}, FSRM {}",
+        features & MEM_FEATURE_ERMS != 0,
+        features & MEM_FEATURE_FSRM != 0
+    );
+}
+
+/// 长度为`n`的拷贝是否使用rep movsb
+#[inline(always)]
+fn use_rep_movsb(n: usize) -> bool {
+    let features = MEM_FEATURES.load(Ordering::Relaxed);
+    return features & MEM_FEATURE_FSRM != 0
+        || (features & MEM_FEATURE_ERMS != 0 && n >= REP_BYTE_THRESHOLD);
+}
+
+/// 长度为`n`的填充是否使用rep stosb
+#[inline(always)]
+fn use_rep_stosb(n: usize) -> bool {
+    return MEM_FEATURES.load(Ordering::Relaxed) & MEM_FEATURE_ERMS != 0 && n >= REP_BYTE_THRESHOLD;
+}
+
+/// 拷贝不超过16字节的数据。先读出所有数据再写入，因此源和目标重叠时也是正确的
+#[inline(always)]
+unsafe fn copy_small(dst: *mut u8, src: *const u8, n: usize) {
+    if n >= 8 {
+        let head = read_unaligned(src as *const u64);
+        let tail = read_unaligned(src.add(n - 8) as *const u64);
+        write_unaligned(dst as *mut u64, head);
+        write_unaligned(dst.add(n - 8) as *mut u64, tail);
+    } else if n >= 4 {
+        let head = read_unaligned(src as *const u32);
+        let tail = read_unaligned(src.add(n - 4) as *const u32);
+        write_unaligned(dst as *mut u32, head);
+        write_unaligned(dst.add(n - 4) as *mut u32, tail);
+    } else if n != 0 {
+        let head = *src;
+        let mid = *src.add(n / 2);
+        let tail = *src.add(n - 1);
+        *dst = head;
+        *dst.add(n / 2) = mid;
+        *dst.add(n - 1) = tail;
+    }
+}
+
+/// 从前往后拷贝（目标地址不大于源地址时，重叠也是正确的）
+#[inline(always)]
+unsafe fn copy_forward(dst: *mut u8, src: *const u8, n: usize) {
+    if n <= 16 {
+        copy_small(dst, src, n);
+    } else if use_rep_movsb(n) {
+        asm!(
+            "rep movsb",
+            inout("rcx") n => _,
+            inout("rdi") dst => _,
+            inout("rsi") src => _,
+            options(nostack, preserves_flags)
+        );
+    } else {
+        asm!(
+            "rep movsq",
+            "mov ecx, {rem:e}",
+            "rep movsb",
+            rem = in(reg) n & 7,
+            inout("rcx") n / 8 => _,
+            inout("rdi") dst => _,
+            inout("rsi") src => _,
+            options(nostack, preserves_flags)
+        );
+    }
+}
+
+/// 从后往前拷贝（目标地址大于源地址并且重叠时使用）
+#[inline(always)]
+unsafe fn copy_backward(dst: *mut u8, src: *const u8, n: usize) {
+    if n <= 16 {
+        copy_small(dst, src, n);
+        return;
+    }
+    // 先从后往前拷贝8字节的部分，再拷贝开头剩余的字节
+    asm!(
+        "std",
+        "rep movsq",
+        "add rdi, 7",
+        "add rsi, 7",
+        "mov ecx, {rem:e}",
+        "rep movsb",
+        "cld",
+        rem = in(reg) n & 7,
+        inout("rcx") n / 8 => _,
+        inout("rdi") dst.add(n - 8) => _,
+        inout("rsi") src.add(n - 8) => _,
+        options(nostack)
+    );
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn memcpy(dst: *mut u8, src: *const u8, n: usize) -> *mut u8 {
+    copy_forward(dst, src, n);
+    return dst;
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn memmove(dst: *mut u8, src: *const u8, n: usize) -> *mut u8 {
+    if (dst as usize).wrapping_sub(src as usize) >= n {
+        // 目标地址不大于源地址，或者两块内存不重叠
+        copy_forward(dst, src, n);
+    } else {
+        copy_backward(dst, src, n);
+    }
+    return dst;
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn memset(dst: *mut u8, c: i32, n: usize) -> *mut u8 {
+    let byte = c as u8;
+    if n <= 16 {
+        let qword = 0x0101010101010101u64 * byte as u64;
+        if n >= 8 {
+            write_unaligned(dst as *mut u64, qword);
+            write_unaligned(dst.add(n - 8) as *mut u64, qword);
+        } else if n >= 4 {
+            write_unaligned(dst as *mut u32, qword as u32);
+            write_unaligned(dst.add(n - 4) as *mut u32, qword as u32);
+        } else if n != 0 {
+            *dst = byte;
+            *dst.add(n / 2) = byte;
+            *dst.add(n - 1) = byte;
+        }
+    } else if use_rep_stosb(n) {
+        asm!(
+            "rep stosb",
+            inout("rcx") n => _,
+            inout("rdi") dst => _,
+            in("al") byte,
+            options(nostack, preserves_flags)
+        );
+    } else {
+        asm!(
+            "rep stosq",
+            "mov ecx, {rem:e}",
+            "rep stosb",
+            rem = in(reg) n & 7,
+            inout("rcx") n / 8 => _,
+            inout("rdi") dst => _,
+            in("rax") 0x0101010101010101u64 * byte as u64,
+            options(nostack, preserves_flags)
+        );
+    }
+    return dst;
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn memcmp(s1: *const u8, s2: *const u8, n: usize) -> i32 {
+    let mut i = 0;
+    // 每次比较8字节，不相等时按照大端序比较，得到第一个不相等的字节的大小关系
+    while i + 8 <= n {
+        let a = read_unaligned(s1.add(i) as *const u64);
+        let b = read_unaligned(s2.add(i) as *const u64);
+        if a != b {
+            return if a.swap_bytes() < b.swap_bytes() {
+                -1
+            } else {
+                1
+            };
+        }
+        i += 8;
+    }
+    while i < n {
+        let a = *s1.add(i);
+        let b = *s2.add(i);
+        if a != b {
+            return a as i32 - b as i32;
+        }
+        i += 1;
+    }
+    return 0;
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn bcmp(s1: *const u8, s2: *const u8, n: usize) -> i32 {
+    return memcmp(s1, s2, n);
+}
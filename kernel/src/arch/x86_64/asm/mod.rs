@@ -1,3 +1,4 @@
 pub mod bitops;
 pub mod irqflags;
+pub mod mem;
 pub mod pio;
@@ -14,3 +14,53 @@ pub fn cpu_reset() -> ! {
     unsafe { x86::io::outb(0x64, 0xfe) };
     loop {}
 }
+
+/// cpu是否支持MONITOR/MWAIT指令（CPUID.01H:ECX[3]）
+pub fn cpu_has_mwait() -> bool {
+    let cpuid_res: CpuIdResult = cpuid!(0x1);
+    return cpuid_res.ecx & (1 << 3) != 0;
+}
+
+/// 监视`addr`所在的缓存行。之后执行的mwait会在这个缓存行被写入时返回
+///
+/// ## Safety
+///
+/// `addr`必须是有效的内存地址
+#[inline(always)]
+pub unsafe fn cpu_monitor(addr: *const u8) {
+    core::arch::asm!("monitor", in("rax") addr, in("ecx") 0, in("edx") 0, options(nostack));
+}
+
+/// 开中断，并进入C1状态等待，直到被监视的缓存行被写入、或者中断到来
+///
+/// sti的下一条指令执行完之前不会响应中断，因此在关中断时调用，不会错过开中断前到来的中断
+///
+/// ## Safety
+///
+/// 调用之前需要关中断，并且已经通过[`cpu_monitor`]设置了监视的地址
+#[inline(always)]
+pub unsafe fn cpu_sti_mwait() {
+    core::arch::asm!("sti", "mwait", in("eax") 0, in("ecx") 0, options(nostack));
+}
+
+/// cpu是否支持RDTSCP指令（CPUID.80000001H:EDX[27]）
+pub fn cpu_has_rdtscp() -> bool {
+    let cpuid_res: CpuIdResult = cpuid!(0x8000_0001);
+    return cpuid_res.edx & (1 << 27) != 0;
+}
+
+/// cpu是否支持不变的TSC（CPUID.80000007H:EDX[8]）：TSC以固定的频率递增，不受变频和C-state的影响
+pub fn cpu_has_invariant_tsc() -> bool {
+    let max_leaf: CpuIdResult = cpuid!(0x8000_0000);
+    if max_leaf.eax < 0x8000_0007 {
+        return false;
+    }
+    let cpuid_res: CpuIdResult = cpuid!(0x8000_0007);
+    return cpuid_res.edx & (1 << 8) != 0;
+}
+
+/// 是否运行在虚拟机中（CPUID.01H:ECX[31]）
+pub fn cpu_has_hypervisor() -> bool {
+    let cpuid_res: CpuIdResult = cpuid!(0x1);
+    return cpuid_res.ecx & (1 << 31) != 0;
+}
@@ -13,13 +13,23 @@
 #pragma GCC push_options
 #pragma GCC optimize("O0")
 // 导出定义在irq.c中的中段门表
-extern void (*interrupt_table[26])(void);
+extern void (*interrupt_table[IRQ_NUM])(void);
 extern uint32_t rs_current_pcb_preempt_count();
 extern uint32_t rs_current_pcb_pid();
 extern uint32_t rs_current_pcb_flags();
+extern bool rs_preempt_full();
 extern void rs_apic_init_bsp();
 
 extern void rs_apic_local_apic_edge_ack(uint8_t irq_num);
+extern void rs_irq_stat_inc(uint8_t vector);
+// 中断处理时间的统计（定义在sched/cputime.rs中）
+extern uint8_t rs_cputime_irq_enter();
+extern void rs_cputime_irq_exit(uint8_t prev);
+
+// 静态跟踪点（定义在debug/trace.rs中）
+#define TRACE_CLASS_IRQ 2
+extern uint32_t __TRACE_EVENTS_ENABLED;
+extern void rs_trace_irq(uint8_t vector, bool entry);
 
 extern int rs_ioapic_install(uint8_t vector, uint8_t dest, bool level_triggered, bool active_high, bool dest_logical);
 extern void rs_ioapic_uninstall(uint8_t irq_num);
@@ -35,7 +45,7 @@ int apic_init()
     cli();
     kinfo("Initializing APIC...");
     // 初始化中断门， 中断使用rsp0防止在软中断时发生嵌套，然后处理器重新加载导致数据被抹掉
-    for (int i = 32; i <= 57; ++i)
+    for (int i = 32; i < 32 + IRQ_NUM; ++i)
         set_intr_gate(i, 0, interrupt_table[i - 32]);
 
     // 设置local apic中断门
@@ -61,6 +71,11 @@ void do_IRQ(struct pt_regs *rsp, ul number)
     {
         asm volatile("swapgs":::"memory");
     }
+    // 统计每个cpu上各个中断发生的次数（/proc/interrupts）
+    rs_irq_stat_inc(number);
+    uint8_t prev_cputime_ctx = rs_cputime_irq_enter();
+    if (unlikely(__TRACE_EVENTS_ENABLED & TRACE_CLASS_IRQ))
+        rs_trace_irq(number, true);
     if (number < 0x80 && number >= 32) // 以0x80为界限，低于0x80的是外部中断控制器，高于0x80的是Local APIC
     {
         // ==========外部中断控制器========
@@ -108,10 +123,15 @@ void do_IRQ(struct pt_regs *rsp, ul number)
     {
 
         kwarn("do IRQ receive: %d", number);
+        rs_cputime_irq_exit(prev_cputime_ctx);
         // 忽略未知中断
         return;
     }
 
+    if (unlikely(__TRACE_EVENTS_ENABLED & TRACE_CLASS_IRQ))
+        rs_trace_irq(number, false);
+    rs_cputime_irq_exit(prev_cputime_ctx);
+
     // kdebug("before softirq");
     // 进入软中断处理程序
     rs_do_softirq();
@@ -125,8 +145,8 @@ void do_IRQ(struct pt_regs *rsp, ul number)
     else if ((int32_t)rs_current_pcb_preempt_count() < 0)
         kBUG("current_pcb->preempt_count<0! pid=%d", rs_current_pcb_pid()); // should not be here
 
-    // 检测当前进程是否可被调度
-    if ((rs_current_pcb_flags() & PF_NEED_SCHED) && number == APIC_TIMER_IRQ_NUM)
+    // 检测当前进程是否可被调度（启用完全抢占时，任何中断返回时都可以抢占）
+    if ((rs_current_pcb_flags() & PF_NEED_SCHED) && (number == APIC_TIMER_IRQ_NUM || rs_preempt_full()))
     {
         io_mfence();
         sched();
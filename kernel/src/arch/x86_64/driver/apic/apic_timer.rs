@@ -1,4 +1,5 @@
 use core::cell::RefCell;
+use core::sync::atomic::{AtomicU8, Ordering};
 
 use crate::arch::driver::tsc::TSCManager;
 use crate::include::bindings::bindings::APIC_TIMER_IRQ_NUM;
@@ -6,9 +7,12 @@ use crate::include::bindings::bindings::APIC_TIMER_IRQ_NUM;
 use crate::kdebug;
 use crate::mm::percpu::PerCpu;
 use crate::sched::core::sched_update_jiffies;
+use crate::sched::isolation::tick_nohz_full_tick;
 use crate::smp::core::smp_get_processor_id;
 use crate::syscall::SystemError;
 use crate::time::clocksource::HZ;
+use crate::time::hrtimer::hrtimer_interrupt;
+use crate::time::timer::timer_tick;
 pub use drop;
 use x86::cpuid::cpuid;
 use x86::msr::{wrmsr, IA32_X2APIC_DIV_CONF, IA32_X2APIC_INIT_COUNT};
@@ -16,6 +20,16 @@ use x86::msr::{wrmsr, IA32_X2APIC_DIV_CONF, IA32_X2APIC_INIT_COUNT};
 use super::xapic::XApicOffset;
 use super::{CurrentApic, LVTRegister, LocalAPIC, LVT};
 
+/// IA32_TSC_DEADLINE MSR
+const IA32_TSC_DEADLINE: u32 = 0x6e0;
+
+/// 还没有检测CPU是否支持TSC-Deadline模式
+const DEADLINE_UNKNOWN: u8 = 0;
+const DEADLINE_UNSUPPORTED: u8 = 1;
+const DEADLINE_SUPPORTED: u8 = 2;
+
+static TSC_DEADLINE_MODE: AtomicU8 = AtomicU8::new(DEADLINE_UNKNOWN);
+
 static mut LOCAL_APIC_TIMERS: [RefCell<LocalApicTimer>; PerCpu::MAX_CPU_NUM] =
     [const { RefCell::new(LocalApicTimer::new()) }; PerCpu::MAX_CPU_NUM];
 
@@ -59,6 +73,33 @@ fn init_ap_apic_timer() {
     kdebug!("init_ap_apic_timer done");
 }
 
+/// 停止当前cpu的周期性时钟中断，改为只在`delta_us`微秒之后触发一次（用于NO_HZ idle）
+///
+/// 支持TSC-Deadline模式时，使用TSC-Deadline模式，否则使用one-shot模式。
+///
+/// 请注意，调用者需要关中断
+pub fn apic_timer_stop_tick(delta_us: u64) {
+    let mut local_apic_timer = local_apic_timer_instance_mut(smp_get_processor_id());
+    if LocalApicTimer::tsc_deadline_usable() {
+        let delta_tsc = delta_us * TSCManager::tsc_khz() / 1000;
+        let deadline = unsafe { core::arch::x86_64::_rdtsc() } + delta_tsc;
+        local_apic_timer.install_deadline_mode(deadline);
+    } else {
+        // 周期模式下，initial_count对应INTERVAL_MS毫秒
+        let count =
+            local_apic_timer.initial_count * delta_us / (LocalApicTimer::INTERVAL_MS * 1000);
+        local_apic_timer.install_oneshot_mode(count.clamp(1, u32::MAX as u64));
+    }
+}
+
+/// 恢复当前cpu的周期性时钟中断
+///
+/// 请注意，调用者需要关中断
+pub fn apic_timer_restart_tick() {
+    let mut local_apic_timer = local_apic_timer_instance_mut(smp_get_processor_id());
+    local_apic_timer.restore_periodic_mode();
+}
+
 pub(super) struct LocalApicTimerIntrController;
 
 impl LocalApicTimerIntrController {
@@ -160,6 +201,64 @@ impl LocalApicTimer {
         self.setup_lvt(APIC_TIMER_IRQ_NUM as u8, true, LocalApicTimerMode::Periodic);
     }
 
+    /// 在`initial_count`个计数之后触发一次中断。不会修改周期模式下的初始值
+    fn install_oneshot_mode(&mut self, initial_count: u64) {
+        self.mode = LocalApicTimerMode::Oneshot;
+        self.setup_lvt(APIC_TIMER_IRQ_NUM as u8, false, LocalApicTimerMode::Oneshot);
+        CurrentApic.set_timer_initial_count(initial_count);
+    }
+
+    /// 在TSC的值达到`deadline`时触发一次中断
+    fn install_deadline_mode(&mut self, deadline: u64) {
+        self.mode = LocalApicTimerMode::Deadline;
+        self.setup_lvt(
+            APIC_TIMER_IRQ_NUM as u8,
+            false,
+            LocalApicTimerMode::Deadline,
+        );
+        // 写入IA32_TSC_DEADLINE之前，需要保证LVT已经切换到TSC-Deadline模式
+        unsafe {
+            core::arch::x86_64::_mm_mfence();
+            wrmsr(IA32_TSC_DEADLINE, deadline);
+        }
+    }
+
+    /// 从one-shot或TSC-Deadline模式恢复到周期模式
+    fn restore_periodic_mode(&mut self) {
+        match self.mode {
+            LocalApicTimerMode::Periodic => return,
+            // 清零IA32_TSC_DEADLINE，取消还没有触发的中断
+            LocalApicTimerMode::Deadline => unsafe { wrmsr(IA32_TSC_DEADLINE, 0) },
+            LocalApicTimerMode::Oneshot => {}
+        }
+        self.mode = LocalApicTimerMode::Periodic;
+        self.setup_lvt(
+            APIC_TIMER_IRQ_NUM as u8,
+            false,
+            LocalApicTimerMode::Periodic,
+        );
+        CurrentApic.set_timer_divisor(self.divisor);
+        CurrentApic.set_timer_initial_count(self.initial_count);
+    }
+
+    /// 是否可以使用TSC-Deadline模式（结果会被缓存）
+    fn tsc_deadline_usable() -> bool {
+        let mode = TSC_DEADLINE_MODE.load(Ordering::Relaxed);
+        if mode != DEADLINE_UNKNOWN {
+            return mode == DEADLINE_SUPPORTED;
+        }
+        let supported = cpuid!(1).ecx & (1 << 24) != 0 && TSCManager::tsc_khz() != 0;
+        TSC_DEADLINE_MODE.store(
+            if supported {
+                DEADLINE_SUPPORTED
+            } else {
+                DEADLINE_UNSUPPORTED
+            },
+            Ordering::Relaxed,
+        );
+        return supported;
+    }
+
     fn setup_lvt(&mut self, vector: u8, mask: bool, mode: LocalApicTimerMode) {
         let mode: u32 = mode as u32;
         let data = (mode << 17) | (vector as u32) | (if mask { 1 << 16 } else { 0 });
@@ -201,7 +300,12 @@ impl LocalApicTimer {
     }
 
     pub(super) fn handle_irq() -> Result<(), SystemError> {
+        hrtimer_interrupt();
+        // 每个cpu在自己的时钟中断中处理自己的时间轮
+        timer_tick();
         sched_update_jiffies();
+        // 最后再决定nohz_full的cpu是否可以停止时钟中断
+        tick_nohz_full_tick();
         return Ok(());
     }
 }
@@ -1,11 +1,13 @@
 use core::ptr::NonNull;
 
 use acpi::madt::Madt;
+use alloc::sync::Arc;
 use bit_field::BitField;
 use bitflags::bitflags;
 
 use crate::{
     driver::acpi::acpi_manager,
+    exception::irqdesc::{irq_affinity_register, irq_affinity_unregister, IrqAffinityChip},
     kdebug, kinfo,
     libs::{
         once::Once,
@@ -151,6 +153,11 @@ impl IoApic {
         }
     }
 
+    /// 修改中断投递的目标cpu（物理模式下为目标cpu的APIC ID），不改变RTE中的其他配置
+    pub fn set_dest(&mut self, rte_index: u8, dest: u8) {
+        unsafe { self.write(REG_TABLE + 2 * rte_index + 1, (dest as u32) << 24) };
+    }
+
     /// 标记中断边沿触发、高电平有效、
     /// 启用并路由到给定的 cpunum，即是是该 cpu 的 APIC ID（不是cpuid）
     pub fn enable(&mut self, rte_index: u8) {
@@ -334,7 +341,7 @@ pub(super) fn ioapic_install(
     dest_logic: bool,
 ) -> Result<(), SystemError> {
     let rte_index = IoApic::vector_rte_index(vector);
-    return IOAPIC().lock_irqsave().install(
+    IOAPIC().lock_irqsave().install(
         rte_index,
         vector,
         dest,
@@ -342,13 +349,37 @@ pub(super) fn ioapic_install(
         active_high,
         dest_logic,
         true,
-    );
+    )?;
+    // 逻辑模式下dest不是单个cpu，不支持修改亲和性。
+    // 经过IO APIC的都是时钟、键盘等低频的传统中断，不参与中断均衡，只允许通过procfs手动设置
+    if !dest_logic {
+        irq_affinity_register(vector, Arc::new(IoApicAffinityChip), dest as u32, false);
+    }
+    return Ok(());
 }
 
 /// 卸载中断
 pub(super) fn ioapic_uninstall(vector: u8) {
     let rte_index = IoApic::vector_rte_index(vector);
     IOAPIC().lock_irqsave().disable(rte_index);
+    irq_affinity_unregister(vector);
+}
+
+/// 通过IO APIC的RTE修改中断的目标cpu
+#[derive(Debug)]
+struct IoApicAffinityChip;
+
+impl IrqAffinityChip for IoApicAffinityChip {
+    fn name(&self) -> &str {
+        "IO-APIC"
+    }
+
+    fn set_target(&self, vector: u8, cpu: u32) -> Result<(), SystemError> {
+        // 这里假设cpu id与APIC ID相同
+        let rte_index = IoApic::vector_rte_index(vector);
+        IOAPIC().lock_irqsave().set_dest(rte_index, cpu as u8);
+        return Ok(());
+    }
 }
 
 /// 使能中断
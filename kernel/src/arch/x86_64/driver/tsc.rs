@@ -1,15 +1,33 @@
 use core::{
     cmp::{max, min},
     intrinsics::unlikely,
+    sync::atomic::{AtomicBool, Ordering},
 };
 
+use alloc::{
+    string::ToString,
+    sync::{Arc, Weak},
+};
+use x86::cpuid::{cpuid, CpuIdResult};
+
 use crate::{
-    arch::{io::PortIOArch, CurrentIrqArch, CurrentPortIOArch, CurrentTimeArch},
+    arch::{
+        cpu::{cpu_has_hypervisor, cpu_has_invariant_tsc},
+        io::PortIOArch,
+        CurrentIrqArch, CurrentPortIOArch, CurrentTimeArch,
+    },
     driver::acpi::pmtmr::{ACPI_PM_OVERRUN, PMTMR_TICKS_PER_SEC},
     exception::InterruptArch,
     kdebug, kerror, kinfo, kwarn,
+    libs::spinlock::SpinLock,
     syscall::SystemError,
-    time::TimeArch,
+    time::{
+        clocksource::{
+            clocks_calc_mult_shift, Clocksource, ClocksourceData, ClocksourceFlags,
+            ClocksourceMask, CycleNum,
+        },
+        TimeArch, NSEC_PER_SEC,
+    },
 };
 
 use super::hpet::hpet_instance;
@@ -17,11 +35,20 @@ use super::hpet::hpet_instance;
 /// The clock frequency of the i8253/i8254 PIT
 const PIT_TICK_RATE: u64 = 1193182;
 
+/// TSC是不变的时候，作为时钟源的精度（高于其他所有的时钟源）
+const TSC_RATING: i32 = 300;
+/// TSC会随着变频、C-state变化的时候，作为时钟源的精度
+const TSC_UNRELIABLE_RATING: i32 = 100;
+/// 计算TSC的mult和shift时，要求换算在这么长的时间（单位：秒）内不溢出
+const TSC_MAX_CONVERSION_SEC: u32 = 600;
+
 #[derive(Debug)]
 pub struct TSCManager;
 
 static mut TSC_KHZ: u64 = 0;
 static mut CPU_KHZ: u64 = 0;
+/// TSC是否是不变的（Invariant TSC）
+static TSC_INVARIANT: AtomicBool = AtomicBool::new(false);
 
 impl TSCManager {
     const DEFAULT_THRESHOLD: u64 = 0x20000;
@@ -39,19 +66,30 @@ impl TSCManager {
             return Err(SystemError::ENODEV);
         }
 
+        TSC_INVARIANT.store(cpu_has_invariant_tsc(), Ordering::SeqCst);
+        if !Self::invariant() {
+            kwarn!("TSC is not invariant, it may drift with frequency and C-state changes");
+        }
+
         if unsafe { TSC_KHZ == 0 } {
             if let Err(e) = Self::determine_cpu_tsc_frequency(false) {
                 kerror!("Failed to determine CPU TSC frequency: {:?}", e);
-                // todo: mark TSC as unstable clock source
                 return Err(e);
             }
         }
 
-        // todo: register TSC as clock source and deal with unstable clock source
+        // 注册为时钟源。即使TSC是不变的，也交给watchdog检查，发现误差过大时降级
+        let tsc = ClocksourceTsc::new(Self::tsc_khz()) as Arc<dyn Clocksource>;
+        tsc.register()?;
 
         return Ok(());
     }
 
+    /// TSC是否是不变的（以固定频率递增，不受变频和C-state的影响）
+    pub fn invariant() -> bool {
+        return TSC_INVARIANT.load(Ordering::SeqCst);
+    }
+
     /// 获取TSC和CPU总线的频率
     ///
     /// ## 参数
@@ -64,9 +102,13 @@ impl TSCManager {
             kwarn!("TSC and CPU frequency already determined");
         }
 
-        if early {
-            // todo: 先根据cpuid或者读取msr或者pit来测量TSC和CPU总线的频率
-            todo!("detect TSC and CPU frequency by cpuid or msr or pit");
+        if let Some(tsc_khz) = Self::native_calibrate_tsc() {
+            // cpu直接报告了TSC的频率，不需要花几十毫秒对着PIT测量
+            Self::set_tsc_khz(tsc_khz);
+            Self::set_cpu_khz(tsc_khz);
+        } else if early {
+            // todo: 读取msr或者使用pit来测量TSC和CPU总线的频率
+            todo!("detect TSC and CPU frequency by msr or pit");
         } else {
             // 使用pit来测量TSC和CPU总线的频率
             Self::set_cpu_khz(Self::calibrate_cpu_by_pit_hpet_ptimer()?);
@@ -101,6 +143,55 @@ impl TSCManager {
         return Ok(());
     }
 
+    /// 从cpuid获取TSC的频率（单位：kHz），获取不到时返回None
+    ///
+    /// 依次尝试：
+    /// - 虚拟机监视器报告的TSC频率（CPUID.40000010H:EAX，VMware、KVM等支持）
+    /// - TSC与晶振频率的比值（CPUID.15H），晶振频率未报告时根据CPUID.16H的基准频率推算
+    /// - cpu的基准频率（CPUID.16H:EAX），不变的TSC按照这个频率递增
+    ///
+    /// 参考 https://opengrok.ringotek.cn/xref/linux-6.1.9/arch/x86/kernel/tsc.c#661
+    fn native_calibrate_tsc() -> Option<u64> {
+        if cpu_has_hypervisor() {
+            let max_leaf: CpuIdResult = cpuid!(0x4000_0000);
+            if max_leaf.eax >= 0x4000_0010 {
+                let timing: CpuIdResult = cpuid!(0x4000_0010);
+                if timing.eax != 0 {
+                    kinfo!("TSC frequency reported by hypervisor");
+                    return Some(timing.eax as u64);
+                }
+            }
+        }
+
+        let max_leaf = cpuid!(0x0).eax;
+        if max_leaf >= 0x15 {
+            let tsc_info: CpuIdResult = cpuid!(0x15);
+            let (denominator, numerator) = (tsc_info.eax as u64, tsc_info.ebx as u64);
+            if denominator != 0 && numerator != 0 {
+                let mut crystal_khz = tsc_info.ecx as u64 / 1000;
+                // 部分cpu不报告晶振的频率，根据基准频率推算
+                if crystal_khz == 0 && max_leaf >= 0x16 {
+                    let base_mhz = (cpuid!(0x16).eax & 0xffff) as u64;
+                    crystal_khz = base_mhz * 1000 * denominator / numerator;
+                }
+                if crystal_khz != 0 {
+                    kinfo!("TSC frequency reported by CPUID.15H");
+                    return Some(crystal_khz * numerator / denominator);
+                }
+            }
+        }
+
+        if max_leaf >= 0x16 && Self::invariant() {
+            let base_mhz = (cpuid!(0x16).eax & 0xffff) as u64;
+            if base_mhz != 0 {
+                kinfo!("TSC frequency derived from CPUID.16H");
+                return Some(base_mhz * 1000);
+            }
+        }
+
+        return None;
+    }
+
     /// 测量CPU总线的频率
     ///
     /// 使用pit、hpet、ptimer来测量CPU总线的频率
@@ -382,3 +473,66 @@ impl TSCManager {
         }
     }
 }
+
+/// 以TSC为时钟源：读取只需要一条rdtsc指令，而读取HPET需要访问MMIO（约1微秒）
+#[derive(Debug)]
+pub struct ClocksourceTsc(SpinLock<InnerTsc>);
+
+#[derive(Debug)]
+pub struct InnerTsc {
+    data: ClocksourceData,
+    self_ref: Weak<ClocksourceTsc>,
+}
+
+impl Clocksource for ClocksourceTsc {
+    fn read(&self) -> CycleNum {
+        return CycleNum(CurrentTimeArch::get_cycles() as u64);
+    }
+
+    fn clocksource_data(&self) -> ClocksourceData {
+        return self.0.lock_irqsave().data.clone();
+    }
+
+    fn clocksource(&self) -> Arc<dyn Clocksource> {
+        return self.0.lock_irqsave().self_ref.upgrade().unwrap();
+    }
+
+    fn update_clocksource_data(&self, data: ClocksourceData) -> Result<(), SystemError> {
+        self.0.lock_irqsave().data = data;
+        return Ok(());
+    }
+
+    fn enable(&self) -> Result<i32, SystemError> {
+        return Ok(0);
+    }
+}
+
+impl ClocksourceTsc {
+    pub fn new(tsc_khz: u64) -> Arc<Self> {
+        let (mult, shift) =
+            clocks_calc_mult_shift(tsc_khz * 1000, NSEC_PER_SEC as u64, TSC_MAX_CONVERSION_SEC);
+        let rating = if TSCManager::invariant() {
+            TSC_RATING
+        } else {
+            TSC_UNRELIABLE_RATING
+        };
+        let data = ClocksourceData {
+            name: "tsc".to_string(),
+            rating,
+            mask: ClocksourceMask::new(u64::MAX),
+            mult,
+            shift,
+            max_idle_ns: Default::default(),
+            flags: ClocksourceFlags::CLOCK_SOURCE_IS_CONTINUOUS
+                | ClocksourceFlags::CLOCK_SOURCE_MUST_VERIFY,
+            watchdog_last: CycleNum(0),
+        };
+        let tsc = Arc::new(ClocksourceTsc(SpinLock::new(InnerTsc {
+            data,
+            self_ref: Default::default(),
+        })));
+        tsc.0.lock().self_ref = Arc::downgrade(&tsc);
+
+        return tsc;
+    }
+}
@@ -1,69 +1,366 @@
-use core::arch::x86_64::{_fxrstor64, _fxsave64};
+//! 浮点/扩展寄存器状态的保存与恢复
+//!
+//! CPU支持XSAVE时，使用XSAVES/XSAVEOPT/XSAVE（按这个顺序选择可用的指令）保存x87、SSE、AVX和AVX-512的状态，
+//! 以利用处理器的init和modified优化；否则退回到只能保存x87和SSE状态的FXSAVE。
+//!
+//! 内核本身不使用浮点和SIMD指令，扩展状态只属于用户程序。切换进程时，如果XINUSE表明
+//! 所有扩展状态都处于初始状态（进程从未使用过浮点/SIMD，或者已经恢复为初始值），就不保存，
+//! 恢复时如果寄存器本来就处于初始状态也不需要恢复，从而使不使用浮点的进程几乎不产生额外开销
 
-/// https://www.felixcloutier.com/x86/fxsave#tbl-3-47
-#[repr(C, align(16))]
+use core::{
+    arch::{
+        asm,
+        x86_64::{_fxrstor64, _fxsave64},
+    },
+    sync::atomic::{AtomicBool, AtomicU32, AtomicU64, AtomicU8, Ordering},
+};
+
+use x86::{
+    controlregs::{cr4, cr4_write, Cr4},
+    cpuid::cpuid,
+};
+
+use crate::kinfo;
+
+/// 保存区的容量。内核只开启不超过AVX-512的状态分量，它们在标准格式下最多需要2688字节
+const FP_AREA_SIZE: usize = 3072;
+/// 传统（FXSAVE）区域的大小，XSAVE头部紧随其后
+const FXSAVE_AREA_SIZE: usize = 512;
+
+const XFEATURE_X87: u64 = 1 << 0;
+const XFEATURE_SSE: u64 = 1 << 1;
+const XFEATURE_AVX: u64 = 1 << 2;
+const XFEATURE_OPMASK: u64 = 1 << 5;
+const XFEATURE_ZMM_HI256: u64 = 1 << 6;
+const XFEATURE_HI16_ZMM: u64 = 1 << 7;
+/// AVX-512的三个状态分量，必须同时开启
+const XFEATURE_AVX512: u64 = XFEATURE_OPMASK | XFEATURE_ZMM_HI256 | XFEATURE_HI16_ZMM;
+/// 内核愿意开启的用户态状态分量
+const XFEATURE_SUPPORTED: u64 = XFEATURE_X87 | XFEATURE_SSE | XFEATURE_AVX | XFEATURE_AVX512;
+/// XCOMP_BV中表示压缩格式的位
+const XCOMP_BV_COMPACTED: u64 = 1 << 63;
+
+const IA32_XSS: u32 = 0xda0;
+
+const FCW_DEFAULT: u16 = 0x037f;
+const MXCSR_DEFAULT: u32 = 0x1f80;
+/// FXSAVE保存的MXCSR_MASK为0时，使用这个值
+const MXCSR_MASK_DEFAULT: u32 = 0xffbf;
+
+const FPU_MODE_FXSAVE: u8 = 0;
+const FPU_MODE_XSAVE: u8 = 1;
+const FPU_MODE_XSAVEOPT: u8 = 2;
+const FPU_MODE_XSAVES: u8 = 3;
+
+/// 使用的保存/恢复指令
+static FPU_MODE: AtomicU8 = AtomicU8::new(FPU_MODE_FXSAVE);
+/// 写入XCR0的状态分量
+static XFEATURES: AtomicU64 = AtomicU64::new(XFEATURE_X87 | XFEATURE_SSE);
+/// CPU是否支持通过XGETBV(1)读取XINUSE
+static XINUSE_SUPPORTED: AtomicBool = AtomicBool::new(false);
+/// MXCSR中允许设置的位
+static MXCSR_MASK: AtomicU32 = AtomicU32::new(MXCSR_MASK_DEFAULT);
+
+/// 所有状态分量都处于初始状态的保存区，用来把寄存器恢复为初始值
+static mut FP_INIT_STATE: FpState = FpState::zeroed();
+
+#[inline(always)]
+fn fpu_mode() -> u8 {
+    return FPU_MODE.load(Ordering::Relaxed);
+}
+
+#[inline(always)]
+fn xfeatures() -> u64 {
+    return XFEATURES.load(Ordering::Relaxed);
+}
+
+#[inline(always)]
+unsafe fn xgetbv(index: u32) -> u64 {
+    let (lo, hi): (u32, u32);
+    asm!(
+        "xgetbv",
+        in("ecx") index,
+        out("eax") lo,
+        out("edx") hi,
+        options(nomem, nostack, preserves_flags),
+    );
+    return ((hi as u64) << 32) | lo as u64;
+}
+
+#[inline(always)]
+unsafe fn xsetbv(index: u32, value: u64) {
+    asm!(
+        "xsetbv",
+        in("ecx") index,
+        in("eax") value as u32,
+        in("edx") (value >> 32) as u32,
+        options(nostack, preserves_flags),
+    );
+}
+
+/// 当前CPU上不处于初始状态的分量
+#[inline(always)]
+fn xinuse() -> u64 {
+    return unsafe { xgetbv(1) } & xfeatures();
+}
+
+/// 在当前CPU上开启XSAVE
+///
+/// BSP在进程管理初始化之前调用，根据CPUID选择保存指令并计算保存区的大小；AP启动时调用，与BSP保持一致
+pub fn fpu_init_current_cpu(is_bsp: bool) {
+    if is_bsp {
+        let mut tmp = FpState::zeroed();
+        unsafe { _fxsave64(tmp.area.as_mut_ptr()) };
+        let mask = u32::from_le_bytes(tmp.area[28..32].try_into().unwrap());
+        if mask != 0 {
+            MXCSR_MASK.store(mask, Ordering::Relaxed);
+        }
+
+        if !fpu_detect() {
+            kinfo!("XSAVE is not supported, using FXSAVE for the FPU context.");
+            return;
+        }
+    } else if fpu_mode() == FPU_MODE_FXSAVE {
+        return;
+    }
+
+    unsafe {
+        cr4_write(cr4() | Cr4::CR4_ENABLE_OS_XSAVE);
+        xsetbv(0, xfeatures());
+        if fpu_mode() == FPU_MODE_XSAVES {
+            // 不使用任何supervisor状态
+            x86::msr::wrmsr(IA32_XSS, 0);
+        }
+    }
+
+    if is_bsp {
+        unsafe { FP_INIT_STATE = FpState::new() };
+        kinfo!(
+            "FPU: xfeatures={:#x}, mode={}, xinuse={}",
+            xfeatures(),
+            ["fxsave", "xsave", "xsaveopt", "xsaves"][fpu_mode() as usize],
+            XINUSE_SUPPORTED.load(Ordering::Relaxed)
+        );
+    }
+}
+
+/// 检测XSAVE的支持情况，决定开启的状态分量和使用的指令
+fn fpu_detect() -> bool {
+    let has_xsave = cpuid!(1).ecx & (1 << 26) != 0;
+    if !has_xsave {
+        return false;
+    }
+
+    let leaf0 = cpuid!(0xd, 0);
+    let mut features = (leaf0.eax as u64 | (leaf0.edx as u64) << 32) & XFEATURE_SUPPORTED;
+    if features & XFEATURE_AVX512 != XFEATURE_AVX512 {
+        features &= !XFEATURE_AVX512;
+    }
+
+    let leaf1 = cpuid!(0xd, 1);
+    let mode = if leaf1.eax & (1 << 3) != 0 {
+        FPU_MODE_XSAVES
+    } else if leaf1.eax & 1 != 0 {
+        FPU_MODE_XSAVEOPT
+    } else {
+        FPU_MODE_XSAVE
+    };
+
+    // 临时开启这些分量，读出它们实际需要的保存区大小
+    unsafe {
+        cr4_write(cr4() | Cr4::CR4_ENABLE_OS_XSAVE);
+        xsetbv(0, features);
+    }
+    let size = if mode == FPU_MODE_XSAVES {
+        cpuid!(0xd, 1).ebx
+    } else {
+        cpuid!(0xd, 0).ebx
+    } as usize;
+    if size > FP_AREA_SIZE {
+        // 不会发生：AVX-512的状态在标准格式下也只需要2688字节
+        features &= !XFEATURE_AVX512;
+        unsafe { xsetbv(0, features) };
+    }
+
+    XFEATURES.store(features, Ordering::Relaxed);
+    XINUSE_SUPPORTED.store(leaf1.eax & (1 << 2) != 0, Ordering::Relaxed);
+    FPU_MODE.store(mode, Ordering::Relaxed);
+    return true;
+}
+
+/// 浮点/扩展寄存器的保存区
+///
+/// 前512字节与FXSAVE的格式相同（https://www.felixcloutier.com/x86/fxsave#tbl-3-47），
+/// 使用XSAVE时紧接着64字节的XSAVE头部和扩展区域
+#[repr(C, align(64))]
 #[derive(Debug, Copy, Clone)]
 pub struct FpState {
-    //0
-    fcw: u16,
-    fsw: u16,
-    ftw: u16,
-    fop: u16,
-    word2: u64,
-    //16
-    word3: u64,
-    mxcsr: u32,
-    mxcsr_mask: u32,
-    //32
-    mm: [u64; 16],
-    //160
-    xmm: [u64; 32],
-    //416
-    rest: [u64; 12],
+    area: [u8; FP_AREA_SIZE],
+    /// 保存时是否有不处于初始状态的分量。为false时area中的内容无意义，恢复时使用初始状态
+    in_use: bool,
 }
 
 impl Default for FpState {
     fn default() -> Self {
-        Self {
-            fcw: 0x037f,
-            fsw: Default::default(),
-            ftw: Default::default(),
-            fop: Default::default(),
-            word2: Default::default(),
-            word3: Default::default(),
-            mxcsr: 0x1f80,
-            mxcsr_mask: Default::default(),
-            mm: Default::default(),
-            xmm: Default::default(),
-            rest: Default::default(),
-        }
+        return Self::new();
     }
 }
+
 impl FpState {
+    const fn zeroed() -> Self {
+        return Self {
+            area: [0; FP_AREA_SIZE],
+            in_use: false,
+        };
+    }
+
     #[inline]
     pub fn new() -> Self {
-        assert!(core::mem::size_of::<Self>() == 512);
-        return Self::default();
+        let mut state = Self::zeroed();
+        state.area[0..2].copy_from_slice(&FCW_DEFAULT.to_le_bytes());
+        state.area[24..28].copy_from_slice(&MXCSR_DEFAULT.to_le_bytes());
+        if fpu_mode() == FPU_MODE_XSAVES {
+            state.set_xcomp_bv(XCOMP_BV_COMPACTED | xfeatures());
+        }
+        // FXSAVE无法判断寄存器是否处于初始状态，总是保存和恢复
+        state.in_use = fpu_mode() == FPU_MODE_FXSAVE;
+        return state;
+    }
+
+    fn header_u64(&self, offset: usize) -> u64 {
+        let start = FXSAVE_AREA_SIZE + offset;
+        return u64::from_le_bytes(self.area[start..start + 8].try_into().unwrap());
+    }
+
+    fn set_header_u64(&mut self, offset: usize, value: u64) {
+        let start = FXSAVE_AREA_SIZE + offset;
+        self.area[start..start + 8].copy_from_slice(&value.to_le_bytes());
+    }
+
+    fn set_xcomp_bv(&mut self, value: u64) {
+        self.set_header_u64(8, value);
     }
 
     #[inline]
     pub fn save(&mut self) {
+        let mode = fpu_mode();
+        if mode == FPU_MODE_FXSAVE {
+            unsafe { _fxsave64(self.area.as_mut_ptr()) };
+            self.in_use = true;
+            return;
+        }
+
+        if XINUSE_SUPPORTED.load(Ordering::Relaxed) && xinuse() == 0 {
+            self.in_use = false;
+            return;
+        }
+
+        let ptr = self.area.as_mut_ptr();
+        let mask = xfeatures();
+        let (lo, hi) = (mask as u32, (mask >> 32) as u32);
         unsafe {
-            _fxsave64(self as *mut FpState as *mut u8);
+            match mode {
+                FPU_MODE_XSAVES => {
+                    asm!(
+                        "xsaves64 [{}]",
+                        in(reg) ptr,
+                        in("eax") lo,
+                        in("edx") hi,
+                        options(nostack, preserves_flags),
+                    )
+                }
+                FPU_MODE_XSAVEOPT => {
+                    asm!(
+                        "xsaveopt64 [{}]",
+                        in(reg) ptr,
+                        in("eax") lo,
+                        in("edx") hi,
+                        options(nostack, preserves_flags),
+                    )
+                }
+                _ => {
+                    asm!(
+                        "xsave64 [{}]",
+                        in(reg) ptr,
+                        in("eax") lo,
+                        in("edx") hi,
+                        options(nostack, preserves_flags),
+                    )
+                }
+            }
         }
+        self.in_use = true;
     }
 
     #[inline]
     pub fn restore(&self) {
+        let mode = fpu_mode();
+        if mode == FPU_MODE_FXSAVE {
+            unsafe { _fxrstor64(self.area.as_ptr()) };
+            return;
+        }
+
+        let state = if self.in_use {
+            self
+        } else {
+            // 寄存器已经处于初始状态时不需要恢复
+            if XINUSE_SUPPORTED.load(Ordering::Relaxed) && xinuse() == 0 {
+                return;
+            }
+            unsafe { &*core::ptr::addr_of!(FP_INIT_STATE) }
+        };
+
+        let ptr = state.area.as_ptr();
+        let mask = xfeatures();
+        let (lo, hi) = (mask as u32, (mask >> 32) as u32);
         unsafe {
-            _fxrstor64(self as *const FpState as *const u8);
+            if mode == FPU_MODE_XSAVES {
+                asm!(
+                    "xrstors64 [{}]",
+                    in(reg) ptr,
+                    in("eax") lo,
+                    in("edx") hi,
+                    options(nostack, preserves_flags),
+                );
+            } else {
+                asm!(
+                    "xrstor64 [{}]",
+                    in(reg) ptr,
+                    in("eax") lo,
+                    in("edx") hi,
+                    options(nostack, preserves_flags),
+                );
+            }
         }
     }
 
     /// 清空浮点寄存器
     #[allow(dead_code)]
     pub fn clear(&mut self) {
-        *self = Self::default();
+        *self = Self::new();
         self.restore();
     }
+
+    /// 修正来自用户空间的保存区（例如sigreturn时的信号栈帧），使得恢复它时不会产生#GP
+    pub fn sanitize(&mut self) {
+        let mxcsr = u32::from_le_bytes(self.area[24..28].try_into().unwrap())
+            & MXCSR_MASK.load(Ordering::Relaxed);
+        self.area[24..28].copy_from_slice(&mxcsr.to_le_bytes());
+
+        let mode = fpu_mode();
+        if mode == FPU_MODE_FXSAVE {
+            self.in_use = true;
+            return;
+        }
+        // XSTATE_BV只能包含开启的分量，XCOMP_BV必须与使用的格式一致，头部的其余部分必须为0
+        let xstate_bv = self.header_u64(0) & xfeatures();
+        for offset in (0..64).step_by(8) {
+            self.set_header_u64(offset, 0);
+        }
+        self.set_header_u64(0, xstate_bv);
+        if mode == FPU_MODE_XSAVES {
+            self.set_xcomp_bv(XCOMP_BV_COMPACTED | xfeatures());
+        }
+        self.in_use = true;
+    }
 }
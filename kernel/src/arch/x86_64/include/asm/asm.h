@@ -174,29 +174,15 @@ uint64_t get_rflags()
     return tmp;
 }
 
-void *memset(void *dst, unsigned char C, ul size)
-{
-
-    int d0, d1;
-    unsigned long tmp = C * 0x0101010101010101UL;
-    __asm__ __volatile__("cld	\n\t"
-                         "rep	\n\t"
-                         "stosq	\n\t"
-                         "testb	$4, %b3	\n\t"
-                         "je	1f	\n\t"
-                         "stosl	\n\t"
-                         "1:\ttestb	$2, %b3	\n\t"
-                         "je	2f\n\t"
-                         "stosw	\n\t"
-                         "2:\ttestb	$1, %b3	\n\t"
-                         "je	3f	\n\t"
-                         "stosb	\n\t"
-                         "3:	\n\t"
-                         : "=&c"(d0), "=&D"(d1)
-                         : "a"(tmp), "q"(size), "0"(size / 8), "1"(dst)
-                         : "memory");
-    return dst;
-}
+/**
+ * @brief 内存填充函数（在arch/x86_64/asm/mem.rs中实现，启动时根据cpu特性选择实现）
+ *
+ * @param dst 目标地址
+ * @param C 填充的字节
+ * @param size 字节数
+ * @return void*
+ */
+void *memset(void *dst, int C, ul size);
 
 void *memset_c(void *dst, uint8_t c, size_t count)
 {
@@ -209,34 +195,14 @@ void *memset_c(void *dst, uint8_t c, size_t count)
 }
 
 /**
- * @brief 内存拷贝函数
+ * @brief 内存拷贝函数（在arch/x86_64/asm/mem.rs中实现，启动时根据cpu特性选择实现）
  *
  * @param dst 目标数组
  * @param src 源数组
  * @param Num 字节数
  * @return void*
  */
-static void *memcpy(void *dst, const void *src, long Num)
-{
-    int d0 = 0, d1 = 0, d2 = 0;
-    __asm__ __volatile__("cld	\n\t"
-                         "rep	\n\t"
-                         "movsq	\n\t"
-                         "testb	$4,%b4	\n\t"
-                         "je	1f	\n\t"
-                         "movsl	\n\t"
-                         "1:\ttestb	$2,%b4	\n\t"
-                         "je	2f	\n\t"
-                         "movsw	\n\t"
-                         "2:\ttestb	$1,%b4	\n\t"
-                         "je	3f	\n\t"
-                         "movsb	\n\t"
-                         "3:	\n\t"
-                         : "=&c"(d0), "=&D"(d1), "=&S"(d2)
-                         : "0"(Num / 8), "q"(Num), "1"(dst), "2"(src)
-                         : "memory");
-    return dst;
-}
+void *memcpy(void *dst, const void *src, ul Num);
 
 // 从io口读入8个bit
 unsigned char io_in8(unsigned short port)
@@ -48,6 +48,23 @@ extern void rs_timekeeping_init();
 extern void rs_process_init();
 extern void rs_textui_init();
 extern void rs_pci_init();
+extern void rs_sched_balance_init();
+extern void rs_rcu_init();
+extern void rs_vdso_init();
+extern void rs_idle_loop();
+extern uint64_t rs_boot_phase_begin();
+extern void rs_boot_phase_end(const char *name, uint64_t start);
+
+/**
+ * @brief 执行call，并把它的耗时记录为一个启动阶段（见init/bootstat.rs）
+ */
+#define BOOT_PHASE(call)                                                                                               \
+  do                                                                                                                   \
+  {                                                                                                                    \
+    uint64_t __bp_start = rs_boot_phase_begin();                                                                       \
+    call;                                                                                                              \
+    rs_boot_phase_end(#call, __bp_start);                                                                              \
+  } while (0)
 
 ul bsp_idt_size, bsp_gdt_size;
 
@@ -79,7 +96,7 @@ void reload_idt()
 // 初始化系统各模块
 void system_initialize()
 {
-  rs_init_before_mem_init();
+  BOOT_PHASE(rs_init_before_mem_init());
 
   _stack_start =
       head_stack_start; // 保存init
@@ -92,85 +109,92 @@ void system_initialize()
   cpu_core_info[0].stack_start = _stack_start;
 
   // 初始化中断描述符表
-  sys_vector_init();
+  BOOT_PHASE(sys_vector_init());
   //  初始化内存管理单元
   // mm_init();
-  rs_mm_init();
+  BOOT_PHASE(rs_mm_init());
   // 内存管理单元初始化完毕后，需要立即重新初始化显示驱动。
   // 原因是，系统启动初期，framebuffer被映射到48M地址处，
   // mm初始化完毕后，若不重新初始化显示驱动，将会导致错误的数据写入内存，从而造成其他模块崩溃
   // 对显示模块进行低级初始化，不启用double buffer
 
   io_mfence();
-  scm_reinit();
-  rs_textui_init();
+  BOOT_PHASE(scm_reinit());
+  BOOT_PHASE(rs_textui_init());
 
-  rs_init_intertrait();
+  BOOT_PHASE(rs_init_intertrait());
   // kinfo("vaddr:%#018lx", video_frame_buffer_info.vaddr);
   io_mfence();
-  vfs_init();
+  BOOT_PHASE(vfs_init());
 
-  rs_driver_init();
+  BOOT_PHASE(rs_driver_init());
 
-  acpi_init();
+  BOOT_PHASE(acpi_init());
 
-  rs_setup_arch();
+  BOOT_PHASE(rs_setup_arch());
   io_mfence();
-  irq_init();
-  rs_process_init();
-  sched_init();
+  BOOT_PHASE(irq_init());
+  BOOT_PHASE(rs_process_init());
+  BOOT_PHASE(sched_init());
 
   sti();
   io_mfence();
 
-  rs_softirq_init();
+  BOOT_PHASE(rs_softirq_init());
 
-  syscall_init();
+  BOOT_PHASE(syscall_init());
   io_mfence();
 
-  rs_timekeeping_init();
+  BOOT_PHASE(rs_timekeeping_init());
   io_mfence();
 
-  rs_timer_init();
+  BOOT_PHASE(rs_timer_init());
   io_mfence();
 
-  rs_jiffies_init();
+  BOOT_PHASE(rs_sched_balance_init());
   io_mfence();
 
-  rs_kthread_init();
+  BOOT_PHASE(rs_rcu_init());
   io_mfence();
 
+  BOOT_PHASE(rs_jiffies_init());
   io_mfence();
-  rs_clocksource_boot_finish();
 
+  BOOT_PHASE(rs_kthread_init());
   io_mfence();
 
-  cpu_init();
+  io_mfence();
+  BOOT_PHASE(rs_clocksource_boot_finish());
 
-  ps2_keyboard_init();
   io_mfence();
 
-  rs_pci_init();
+  BOOT_PHASE(cpu_init());
+
+  BOOT_PHASE(ps2_keyboard_init());
+  io_mfence();
+
+  BOOT_PHASE(rs_pci_init());
 
   // 这里必须加内存屏障，否则会出错
   io_mfence();
-  smp_init();
+  BOOT_PHASE(smp_init());
 
   io_mfence();
-  rs_futex_init();
+  BOOT_PHASE(rs_futex_init());
   cli();
-  rs_hpet_init();
-  rs_hpet_enable();
-  rs_tsc_init();
+  BOOT_PHASE(rs_hpet_init());
+  BOOT_PHASE(rs_hpet_enable());
+  BOOT_PHASE(rs_tsc_init());
+  BOOT_PHASE(rs_vdso_init());
 
   io_mfence();
 
-  kvm_init();
+  BOOT_PHASE(kvm_init());
 
   io_mfence();
   // 系统初始化到此结束，剩下的初始化功能应当放在初始内核线程中执行
 
-  apic_timer_init();
+  BOOT_PHASE(apic_timer_init());
   // while(1);
   io_mfence();
   sti();
@@ -201,19 +225,6 @@ void Start_Kernel(void)
   io_mfence();
 
   // idle
-  while (1)
-  {
-    // 如果调用的时候，启用了中断，则hlt。否则认为是bug
-    if (get_rflags() & 0x200)
-    {
-      // kdebug("hlt");
-      hlt();
-    }
-    else
-    {
-      BUG_ON(1);
-      pause();
-    }
-  }
+  rs_idle_loop();
 }
 #pragma GCC pop_options
\ No newline at end of file
@@ -6,6 +6,8 @@ use crate::{
         smp::SMP_BOOT_DATA,
     },
     exception::ipi::{IpiKind, IpiTarget},
+    mm::percpu::PerCpu,
+    smp::{core::smp_get_processor_id, cpu::CPU_MASK_WORDS},
     syscall::SystemError,
 };
 
@@ -15,6 +17,7 @@ use crate::{
 pub enum ArchIpiKind {
     KickCpu = 200,
     FlushTLB = 201,
+    CallFunction = 202,
 }
 
 impl From<IpiKind> for ArchIpiKind {
@@ -22,6 +25,7 @@ impl From<IpiKind> for ArchIpiKind {
         match kind {
             IpiKind::KickCpu => ArchIpiKind::KickCpu,
             IpiKind::FlushTLB => ArchIpiKind::FlushTLB,
+            IpiKind::CallFunction => ArchIpiKind::CallFunction,
         }
     }
 }
@@ -97,43 +101,125 @@ impl Into<x86::apic::DestinationShorthand> for ArchIpiTarget {
     }
 }
 
+/// 构造一个Fixed投递模式的ICR
 #[inline(always)]
-pub fn send_ipi(kind: IpiKind, target: IpiTarget) {
-    // kdebug!("send_ipi: {:?} {:?}", kind, target);
-
-    let ipi_vec = ArchIpiKind::from(kind) as u8;
-    let target = ArchIpiTarget::from(target);
-    let shorthand: x86::apic::DestinationShorthand = target.into();
-    let destination: x86::apic::ApicId = target.into();
-    let icr = if CurrentApic.x2apic_enabled() {
-        // kdebug!("send_ipi: x2apic");
-        x86::apic::Icr::for_x2apic(
-            ipi_vec,
+fn fixed_icr(
+    vector: u8,
+    destination: ApicId,
+    shorthand: x86::apic::DestinationShorthand,
+    dest_mode: x86::apic::DestinationMode,
+) -> x86::apic::Icr {
+    if CurrentApic.x2apic_enabled() {
+        return x86::apic::Icr::for_x2apic(
+            vector,
             destination,
             shorthand,
             x86::apic::DeliveryMode::Fixed,
-            x86::apic::DestinationMode::Physical,
+            dest_mode,
             x86::apic::DeliveryStatus::Idle,
             x86::apic::Level::Assert,
             x86::apic::TriggerMode::Edge,
-        )
+        );
     } else {
-        // kdebug!("send_ipi: xapic");
-        x86::apic::Icr::for_xapic(
-            ipi_vec,
+        return x86::apic::Icr::for_xapic(
+            vector,
             destination,
             shorthand,
             x86::apic::DeliveryMode::Fixed,
-            x86::apic::DestinationMode::Physical,
+            dest_mode,
             x86::apic::DeliveryStatus::Idle,
             x86::apic::Level::Assert,
             x86::apic::TriggerMode::Edge,
-        )
-    };
+        );
+    }
+}
+
+#[inline(always)]
+pub fn send_ipi(kind: IpiKind, target: IpiTarget) {
+    // kdebug!("send_ipi: {:?} {:?}", kind, target);
+
+    let ipi_vec = ArchIpiKind::from(kind) as u8;
+    let target = ArchIpiTarget::from(target);
+    let icr = fixed_icr(
+        ipi_vec,
+        target.into(),
+        target.into(),
+        x86::apic::DestinationMode::Physical,
+    );
 
     CurrentApic.write_icr(icr);
 }
 
+/// 向掩码中除当前CPU以外的所有CPU发送IPI
+///
+/// 尽量减少写ICR的次数：
+/// - 掩码包含了除当前CPU以外的所有CPU时，使用“除自己以外的所有CPU”的简写，只写一次ICR
+/// - x2APIC模式下使用cluster逻辑目标：同一个cluster（x2APIC ID的高位相同）中的最多16个CPU只需要写一次ICR
+/// - xAPIC模式下逐个发送
+///
+/// ## 参数
+///
+/// - `mask`：目标CPU的掩码，第i个字的第j位对应第i*64+j个CPU
+pub fn send_ipi_mask(kind: IpiKind, mask: &[u64; CPU_MASK_WORDS]) {
+    let current = smp_get_processor_id() as usize;
+    let nr_cpus = SMP_BOOT_DATA.cpu_count();
+    let targets = mask
+        .iter()
+        .enumerate()
+        .flat_map(|(i, w)| {
+            (0..64)
+                .filter(move |b| w & (1 << b) != 0)
+                .map(move |b| i * 64 + b)
+        })
+        .filter(move |cpu| *cpu != current && *cpu < nr_cpus);
+
+    let count = targets.clone().count();
+    if count == 0 {
+        return;
+    }
+    if count + 1 == nr_cpus {
+        send_ipi(kind, IpiTarget::Other);
+        return;
+    }
+
+    if !CurrentApic.x2apic_enabled() {
+        for cpu in targets {
+            send_ipi(kind, IpiTarget::Specified(cpu));
+        }
+        return;
+    }
+
+    // x2APIC的逻辑ID由硬件根据APIC ID得出：cluster为ID[19:4]，cluster内的位为1 << ID[3:0]
+    let mut clusters = [(0u32, 0u32); PerCpu::MAX_CPU_NUM];
+    let mut nr_clusters = 0;
+    for cpu in targets {
+        let apic_id = SMP_BOOT_DATA.phys_id(cpu) as u32;
+        let cluster = apic_id >> 4;
+        let bit = 1 << (apic_id & 0xf);
+        match clusters[..nr_clusters]
+            .iter_mut()
+            .find(|(c, _)| *c == cluster)
+        {
+            Some((_, bits)) => *bits |= bit,
+            None => {
+                clusters[nr_clusters] = (cluster, bit);
+                nr_clusters += 1;
+            }
+        }
+    }
+
+    let ipi_vec = ArchIpiKind::from(kind) as u8;
+    for (cluster, bits) in clusters[..nr_clusters].iter() {
+        let icr = fixed_icr(
+            ipi_vec,
+            ApicId::X2Apic((cluster << 16) | bits),
+            x86::apic::DestinationShorthand::NoShorthand,
+            x86::apic::DestinationMode::Logical,
+        );
+        CurrentApic.write_icr(icr);
+    }
+}
+
 /// 发送smp初始化IPI
 pub fn ipi_send_smp_init() -> Result<(), SystemError> {
     let target = ArchIpiTarget::Other;
@@ -1,4 +1,8 @@
-use core::{ffi::c_void, intrinsics::unlikely, mem::size_of};
+use core::{
+    ffi::c_void,
+    intrinsics::{likely, unlikely},
+    mem::size_of,
+};
 
 use crate::{
     arch::{
@@ -10,12 +14,15 @@ use crate::{
     },
     exception::InterruptArch,
     ipc::{
-        signal::set_current_sig_blocked,
+        signal::{recalc_sigpending, set_current_sig_blocked},
         signal_types::{SaHandlerType, SigInfo, Sigaction, SigactionType, SignalArch},
     },
     kerror,
     mm::MemoryManagementArch,
-    process::ProcessManager,
+    process::{
+        rseq::{rseq_exit_to_user, rseq_signal_deliver},
+        ProcessManager,
+    },
     syscall::{user_access::UserBufferWriter, Syscall, SystemError},
 };
 
@@ -389,6 +396,10 @@ impl SigContext {
         // (*current_thread).err_code = (*context).err_code;
         // 如果当前进程有fpstate，则将其恢复到pcb的fp_state中
         *arch_info.fp_state_mut() = self.reserved_for_x87_state.clone();
+        // 信号栈帧中的浮点状态可能被用户程序修改过，恢复前先修正其中的非法值
+        if let Some(fp_state) = arch_info.fp_state_mut().as_mut() {
+            fp_state.sanitize();
+        }
         arch_info.restore_fp_state();
         return true;
     }
@@ -405,6 +416,11 @@ pub struct SigStack {
 #[no_mangle]
 unsafe extern "C" fn do_signal(frame: &mut TrapFrame) {
     X86_64SignalArch::do_signal(frame);
+    if frame.from_user() {
+        // 处理信号时可能开了中断
+        CurrentIrqArch::interrupt_disable();
+        rseq_exit_to_user(frame);
+    }
     return;
 }
 
@@ -413,21 +429,20 @@ pub struct X86_64SignalArch;
 impl SignalArch for X86_64SignalArch {
     unsafe fn do_signal(frame: &mut TrapFrame) {
         let pcb = ProcessManager::current_pcb();
-        let siginfo = pcb.try_siginfo(5);
 
-        if unlikely(siginfo.is_none()) {
+        // 每次从中断、系统调用返回时都会执行到这里。先不加锁地检查待处理信号的位图，
+        // 若没有正在等待处理的信号，或者将要返回到的是内核态，则返回
+        if likely(!pcb.has_pending_signal()) || !frame.from_user() {
             return;
         }
 
-        let siginfo_read_guard = siginfo.unwrap();
+        let siginfo = pcb.try_siginfo(5);
 
-        // 检查sigpending是否为0
-        if siginfo_read_guard.sig_pending().signal().bits() == 0 || !frame.from_user() {
-            // 若没有正在等待处理的信号，或者将要返回到的是内核态，则返回
+        if unlikely(siginfo.is_none()) {
             return;
         }
 
-        let pcb = ProcessManager::current_pcb();
+        let siginfo_read_guard = siginfo.unwrap();
 
         let mut sig_number: Signal;
         let mut info: Option<SigInfo>;
@@ -448,6 +463,7 @@ impl SignalArch for X86_64SignalArch {
         let mut siginfo_mut_guard = siginfo_mut.unwrap();
         loop {
             (sig_number, info) = siginfo_mut_guard.dequeue_signal(&sig_block);
+            recalc_sigpending(&pcb, &siginfo_mut_guard);
             // 如果信号非法，则直接返回
             if sig_number == Signal::INVALID {
                 return;
@@ -536,6 +552,8 @@ fn handle_signal(
 ) -> Result<i32, SystemError> {
     // TODO 这里要补充一段逻辑，好像是为了保证引入线程之后的地址空间不会出问题。详见https://opengrok.ringotek.cn/xref/linux-6.1.9/arch/mips/kernel/signal.c#830
 
+    // 信号处理函数返回后回到被打断的位置，因此先中止被打断的rseq临界区
+    rseq_signal_deliver(frame);
     // 设置栈帧
     return setup_frame(sig, sigaction, info, oldset, frame);
 }
@@ -12,8 +12,10 @@ use alloc::sync::Arc;
 use core::arch::asm;
 use raw_cpuid::CpuId;
 // use crate::virt::kvm::guest_code;
+use self::vmx::halt::vmx_set_current_halt;
 use self::vmx::mmu::{kvm_mmu_setup, kvm_vcpu_mtrr_init};
 use self::vmx::vcpu::VmxVcpu;
+use self::vmx::vmexit::vmx_set_current_exit_stats;
 pub mod vmx;
 
 #[derive(Default, Debug, Clone)]
@@ -72,7 +74,14 @@ impl X86_64KVMArch {
         kvm_mmu_setup(vcpu);
         Ok(())
     }
-    pub fn kvm_arch_vcpu_ioctl_run(_vcpu: &Mutex<VmxVcpu>) -> Result<(), SystemError> {
+    pub fn kvm_arch_vcpu_ioctl_run(vcpu: &Mutex<VmxVcpu>) -> Result<(), SystemError> {
+        // 退出处理时不再持有vcpu的锁，提前告诉它当前运行的是哪个vcpu
+        let (exit_stats, halt) = {
+            let vcpu = vcpu.lock();
+            (vcpu.exit_stats.clone(), vcpu.halt.clone())
+        };
+        vmx_set_current_exit_stats(&exit_stats);
+        vmx_set_current_halt(&halt);
         match vmx_vmlaunch() {
             Ok(_) => {}
             Err(e) => {
@@ -17,6 +17,23 @@ pub fn check_ept_features() -> Result<(), SystemError> {
     Ok(())
 }
 
+/// IA32_VMX_EPT_VPID_CAP中表示支持2M大页的位
+const EPT_CAP_2M_PAGE: u64 = 1 << 16;
+/// IA32_VMX_EPT_VPID_CAP中表示支持1G大页的位
+const EPT_CAP_1G_PAGE: u64 = 1 << 17;
+
+/// 获取EPT能够使用的最大页面层级：1表示只能使用4K页，2表示支持2M大页，3表示支持1G大页
+pub fn ept_max_page_level() -> i32 {
+    let cap = unsafe { msr::rdmsr(msr::IA32_VMX_EPT_VPID_CAP) };
+    if cap & EPT_CAP_1G_PAGE != 0 && cap & EPT_CAP_2M_PAGE != 0 {
+        return 3;
+    }
+    if cap & EPT_CAP_2M_PAGE != 0 {
+        return 2;
+    }
+    return 1;
+}
+
 // pub fn ept_build_mtrr_map() -> Result<(), SystemError> {
 // let ia32_mtrr_cap = unsafe { msr::rdmsr(msr::IA32_MTRRCAP) };
 // Ok(())
@@ -105,6 +122,42 @@ impl EptMapper {
         return Ok(());
     }
 
+    /// 使用一个大页，映射guest physical addr(gpa)到指定的host physical addr(hpa)。
+    ///
+    /// ## 参数
+    ///
+    /// - `gpa`: 要映射的guest physical addr，需要按照大页的大小对齐
+    /// - `hpa`: 要映射的host physical addr，需要按照大页的大小对齐
+    /// - `flags`: 页面标志
+    /// - `level`: 大页的层级，2表示2M的大页，3表示1G的大页
+    ///
+    /// ## 返回
+    ///
+    /// - 成功：返回Ok(())
+    /// - 失败：如果当前映射器为只读，则返回EAGAIN_OR_EWOULDBLOCK；
+    ///   如果这个范围内已经有更小的页面被映射，则返回EEXIST
+    pub unsafe fn walk_huge(
+        &mut self,
+        gpa: u64,
+        hpa: u64,
+        flags: PageFlags<MMArch>,
+        level: usize,
+    ) -> Result<(), SystemError> {
+        if self.readonly {
+            return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
+        }
+        self.mapper
+            .map_huge_phys(
+                VirtAddr::new(gpa as usize),
+                PhysAddr::new(hpa as usize),
+                flags,
+                level - 1,
+            )
+            .ok_or(SystemError::EEXIST)?
+            .flush();
+        return Ok(());
+    }
+
     // fn get_ept_index(addr: u64, level: usize) -> u64 {
     //     let pt64_level_shift = PAGE_SHIFT + (level - 1) * PT64_LEVEL_BITS;
     //     (addr >> pt64_level_shift) & ((1 << PT64_LEVEL_BITS) - 1)
@@ -0,0 +1,153 @@
+//! vcpu执行HLT时的阻塞与halt-polling
+//!
+//! guest执行HLT后，vcpu线程先在一个自适应的时间窗口内轮询是否有待注入的中断，
+//! 窗口内没有等到时，再在等待队列上睡眠，直到通过`KVM_INTERRUPT`向vcpu注入中断。
+//! 窗口的调整方式与Linux KVM的halt_poll_ns相同：短暂的等待没有被轮询覆盖时扩大窗口，
+//! 等待时间超过窗口的上限时把窗口清零，避免空闲的guest长时间占用host CPU
+
+use core::sync::atomic::{AtomicPtr, AtomicU64, Ordering};
+
+use alloc::sync::Arc;
+
+use crate::{
+    arch::kvm::vmx::{
+        vmcs::VmcsFields,
+        vmx_asm_wrapper::{vmx_vmread, vmx_vmwrite},
+    },
+    libs::{spinlock::SpinLock, wait_queue::WaitQueue},
+    mm::percpu::PerCpu,
+    process::ProcessState,
+    smp::core::smp_get_processor_id,
+    time::hrtimer::hrtimer_now,
+};
+
+/// 轮询窗口的上限（纳秒）
+const HALT_POLL_NS_MAX: u64 = 200_000;
+/// 窗口从0开始扩大时的初始值（纳秒）
+const HALT_POLL_NS_START: u64 = 10_000;
+/// 每次扩大窗口时乘以的倍数
+const HALT_POLL_NS_GROW: u64 = 2;
+
+/// RFLAGS中的中断允许位
+const RFLAGS_IF: u64 = 1 << 9;
+/// VM-entry interruption-information中的有效位
+const INTR_INFO_VALID: u64 = 1 << 31;
+
+/// 一个vcpu的halt状态
+#[derive(Debug)]
+pub struct VcpuHalt {
+    /// 等待注入guest的外部中断向量
+    pending_irq: SpinLock<Option<u8>>,
+    /// 当前的轮询窗口（纳秒）
+    poll_ns: AtomicU64,
+    /// 在HLT上睡眠的vcpu线程
+    wait_queue: WaitQueue,
+}
+
+impl VcpuHalt {
+    pub fn new() -> Self {
+        return Self {
+            pending_irq: SpinLock::new(None),
+            poll_ns: AtomicU64::new(0),
+            wait_queue: WaitQueue::INIT,
+        };
+    }
+
+    /// 记录一个要注入guest的外部中断，并唤醒在HLT上睡眠的vcpu线程
+    pub fn kick(&self, vector: u8) {
+        *self.pending_irq.lock_irqsave() = Some(vector);
+        self.wait_queue
+            .wakeup_all(Some(ProcessState::Blocked(true)));
+    }
+
+    fn has_pending_irq(&self) -> bool {
+        return self.pending_irq.lock_irqsave().is_some();
+    }
+
+    /// guest执行了HLT：先轮询，再睡眠，直到有待注入的中断或者被信号唤醒
+    pub fn block(&self) {
+        let start = hrtimer_now();
+        let poll_ns = self.poll_ns.load(Ordering::Relaxed);
+        while hrtimer_now() - start < poll_ns {
+            if self.has_pending_irq() {
+                return;
+            }
+            core::hint::spin_loop();
+        }
+
+        let pending = self.pending_irq.lock();
+        if pending.is_none() {
+            self.wait_queue.sleep_unlock_spinlock(pending);
+        } else {
+            drop(pending);
+        }
+        self.adjust_poll_ns(hrtimer_now() - start, poll_ns);
+    }
+
+    /// 轮询没有等到中断时，根据这次阻塞的总时长调整轮询窗口
+    fn adjust_poll_ns(&self, block_ns: u64, poll_ns: u64) {
+        let new = if block_ns > HALT_POLL_NS_MAX {
+            // 等待很长，轮询只会白白占用CPU
+            0
+        } else if poll_ns < block_ns {
+            // 短暂的等待没能被轮询覆盖，扩大窗口
+            (poll_ns * HALT_POLL_NS_GROW)
+                .max(HALT_POLL_NS_START)
+                .min(HALT_POLL_NS_MAX)
+        } else {
+            poll_ns
+        };
+        self.poll_ns.store(new, Ordering::Relaxed);
+    }
+
+    /// 在进入guest之前注入待处理的中断。guest关中断时继续保留，等到之后的某次退出再注入
+    fn inject_pending_irq(&self) {
+        let mut pending = self.pending_irq.lock_irqsave();
+        let vector = match *pending {
+            Some(vector) => vector,
+            None => return,
+        };
+        let rflags = vmx_vmread(VmcsFields::GUEST_RFLAGS as u32).unwrap_or(0);
+        let interruptibility =
+            vmx_vmread(VmcsFields::GUEST_INTERRUPTIBILITY_STATE as u32).unwrap_or(0);
+        if rflags & RFLAGS_IF == 0 || interruptibility & 0x3 != 0 {
+            return;
+        }
+        // 中断类型0：外部中断
+        let info = INTR_INFO_VALID | vector as u64;
+        if vmx_vmwrite(VmcsFields::CTRL_VM_ENTRY_INTR_INFO_FIELD as u32, info).is_ok() {
+            *pending = None;
+        }
+    }
+}
+
+/// 每个CPU上正在运行的vcpu的halt状态
+static CURRENT_HALT: [AtomicPtr<VcpuHalt>; PerCpu::MAX_CPU_NUM] =
+    [const { AtomicPtr::new(core::ptr::null_mut()) }; PerCpu::MAX_CPU_NUM];
+
+/// 在当前CPU上进入guest之前，设置正在运行的vcpu的halt状态
+///
+/// vcpu保存在VM_LIST中，在它能运行的期间，`halt`不会被释放
+pub fn vmx_set_current_halt(halt: &Arc<VcpuHalt>) {
+    let cpu = smp_get_processor_id() as usize;
+    CURRENT_HALT[cpu].store(Arc::as_ptr(halt) as *mut _, Ordering::Release);
+}
+
+fn current_halt() -> Option<&'static VcpuHalt> {
+    let halt = CURRENT_HALT[smp_get_processor_id() as usize].load(Ordering::Acquire);
+    return unsafe { halt.as_ref() };
+}
+
+/// 处理HLT退出：阻塞当前的vcpu线程，直到有中断要注入
+pub fn vmx_halt() {
+    if let Some(halt) = current_halt() {
+        halt.block();
+    }
+}
+
+/// 在vmresume之前调用，注入待处理的中断
+pub fn vmx_inject_pending_irq() {
+    if let Some(halt) = current_halt() {
+        halt.inject_pending_irq();
+    }
+}
@@ -4,18 +4,26 @@ use crate::{
     libs::mutex::Mutex,
     mm::{page::PageFlags, syscall::ProtFlags},
     syscall::SystemError,
-    virt::kvm::host_mem::{__gfn_to_pfn, kvm_vcpu_gfn_to_memslot, PAGE_MASK, PAGE_SHIFT},
+    virt::kvm::host_mem::{
+        __gfn_to_hva, __gfn_to_pfn, hva_range_to_pfn, kvm_vcpu_gfn_to_memslot, kvm_vcpu_memslots,
+        KvmMemorySlot, KVM_MEM_LOG_DIRTY_PAGES, PAGE_MASK, PAGE_SHIFT,
+    },
 };
 use bitfield_struct::bitfield;
 
 use super::{
-    ept::check_ept_features,
+    ept::{check_ept_features, ept_max_page_level},
     vcpu::VmxVcpu,
     vmcs::VmcsFields,
     vmx_asm_wrapper::{vmx_vmread, vmx_vmwrite},
 };
 use crate::arch::kvm::vmx::mmu::VmcsFields::CTRL_EPTP_PTR;
 
+/// 4K页所在的层级，2M和1G的大页分别位于第2、3级
+pub const PT_PAGE_TABLE_LEVEL: i32 = 1;
+/// 每一级页表索引的地址位数
+const PT64_LEVEL_BITS: u32 = 9;
+
 // pub const PT64_ROOT_LEVEL: u32 = 4;
 // pub const PT32_ROOT_LEVEL: u32 = 2;
 // pub const PT32E_ROOT_LEVEL: u32 = 3;
@@ -115,19 +123,79 @@ fn tdp_page_fault(
     let gfn = gpa >> PAGE_SHIFT; // 物理地址右移12位得到物理页框号(相对于虚拟机而言)
                                  // 分配缓存池，为了避免在运行时分配空间失败，这里提前分配/填充足额的空间
     mmu_topup_memory_caches(vcpu)?;
-    // TODO：获取gfn使用的level，处理hugepage的问题
-    let level = 1; // 4KB page
-                   // TODO: 快速处理由读写操作引起violation，即present同时有写权限的非mmio page fault
-                   // fast_page_fault(vcpu, gpa, level, error_code)
-                   // gfn->pfn
+    // TODO: 快速处理由读写操作引起violation，即present同时有写权限的非mmio page fault
+    // fast_page_fault(vcpu, gpa, level, error_code)
     let mut map_writable = false;
     let write = error_code & ((1 as u32) << 1);
-    let pfn = mmu_gfn_to_pfn_fast(vcpu, gpa, prefault, gfn, write == 0, &mut map_writable)?;
+    // host上的内存允许时用大页映射，否则退回到4K页。gfn->pfn
+    let slot = kvm_vcpu_gfn_to_memslot(vcpu, gfn);
+    let (level, pfn) = match slot.and_then(|slot| mapping_level(&slot, gfn)) {
+        Some(r) => r,
+        None => (
+            PT_PAGE_TABLE_LEVEL,
+            mmu_gfn_to_pfn_fast(vcpu, gpa, prefault, gfn, write == 0, &mut map_writable)?,
+        ),
+    };
     // direct map就是映射ept页表的过程
     __direct_map(vcpu, gpa, write, map_writable, level, gfn, pfn, prefault)?;
     Ok(())
 }
 
+/// 一个`level`层级的页面包含的4K页面数
+fn kvm_pages_per_hpage(level: i32) -> u64 {
+    return 1 << ((level - PT_PAGE_TABLE_LEVEL) as u32 * PT64_LEVEL_BITS);
+}
+
+/// 计算能用来映射gfn的最大的大页层级，返回层级以及这个大页的起始pfn。不能使用大页时返回None
+///
+/// 只有当整个大页都落在同一个memslot内、gpa与hva在大页内的偏移相同，并且host上对应的物理内存连续时，
+/// 才能使用大页。开启了脏页记录的memslot需要按4K页记录，不使用大页
+fn mapping_level(slot: &KvmMemorySlot, gfn: u64) -> Option<(i32, u64)> {
+    if slot.flags & KVM_MEM_LOG_DIRTY_PAGES != 0 {
+        return None;
+    }
+    let mut level = ept_max_page_level();
+    while level > PT_PAGE_TABLE_LEVEL {
+        let npages = kvm_pages_per_hpage(level);
+        let base_gfn = gfn & !(npages - 1);
+        if base_gfn >= slot.base_gfn && base_gfn + npages <= slot.base_gfn + slot.npages {
+            let hva = __gfn_to_hva(*slot, base_gfn);
+            if (hva >> PAGE_SHIFT) & (npages - 1) == 0 {
+                if let Some(pfn) = hva_range_to_pfn(hva, npages) {
+                    return Some((level, pfn));
+                }
+            }
+        }
+        level -= 1;
+    }
+    return None;
+}
+
+/// 预先在EPT中映射虚拟机的全部内存，使guest运行时不再逐页触发EPT violation。能使用大页的地方使用大页
+///
+/// 需要在vcpu的EPTP设置好之后调用
+pub fn kvm_mmu_prefault(vcpu: &mut VmxVcpu) -> Result<(), SystemError> {
+    let slots = kvm_vcpu_memslots(vcpu);
+    for slot in slots.memslots.iter().filter(|slot| slot.npages != 0) {
+        let mut gfn = slot.base_gfn;
+        while gfn < slot.base_gfn + slot.npages {
+            let (level, pfn) = match mapping_level(slot, gfn) {
+                Some(r) => r,
+                None => {
+                    let mut writable = false;
+                    let pfn = __gfn_to_pfn(Some(*slot), gfn, false, true, &mut writable)?;
+                    (PT_PAGE_TABLE_LEVEL, pfn)
+                }
+            };
+            let write = (1 as u32) << 1;
+            __direct_map(vcpu, gfn << PAGE_SHIFT, write, true, level, gfn, pfn, true)?;
+            let npages = kvm_pages_per_hpage(level);
+            gfn = (gfn & !(npages - 1)) + npages;
+        }
+    }
+    Ok(())
+}
+
 /*
  * Caculate mmu pages needed for kvm.
  */
@@ -211,9 +279,9 @@ pub fn __direct_map(
     gpa: u64,
     _write: u32,
     _map_writable: bool,
-    _level: i32,
-    _gfn: u64,
-    pfn: u64,
+    level: i32,
+    gfn: u64,
+    mut pfn: u64,
     _prefault: bool,
 ) -> Result<u32, SystemError> {
     kdebug!("gpa={}, pfn={}, root_hpa={:x}", gpa, pfn, vcpu.mmu.root_hpa);
@@ -224,8 +292,23 @@ pub fn __direct_map(
     // 把gpa映射到hpa
     let mut ept_mapper = EptMapper::lock();
     let page_flags = PageFlags::from_prot_flags(ProtFlags::from_bits_truncate(0x7 as u64), false);
+    if level > PT_PAGE_TABLE_LEVEL {
+        // pfn是大页的起始pfn
+        let npages = kvm_pages_per_hpage(level);
+        let base_gpa = (gfn & !(npages - 1)) << PAGE_SHIFT;
+        match unsafe {
+            ept_mapper.walk_huge(base_gpa, pfn << PAGE_SHIFT, page_flags, level as usize)
+        } {
+            Ok(_) => return Ok(0),
+            // 这个范围内已经有4K页的映射，退回到只映射gfn所在的页
+            Err(SystemError::EEXIST) => pfn += gfn & (npages - 1),
+            Err(e) => return Err(e),
+        }
+    }
     unsafe {
-        assert!(ept_mapper.walk(gpa, pfn << PAGE_SHIFT, page_flags).is_ok());
+        assert!(ept_mapper
+            .walk(gfn << PAGE_SHIFT, pfn << PAGE_SHIFT, page_flags)
+            .is_ok());
     }
     drop(ept_mapper);
     return Ok(0);
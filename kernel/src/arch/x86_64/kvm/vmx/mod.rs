@@ -1,4 +1,5 @@
 pub mod ept;
+pub mod halt;
 pub mod kvm_emulation;
 pub mod mmu;
 pub mod seg;
@@ -3,8 +3,10 @@ use super::vmcs::{
     VmxSecondaryProcessBasedExecuteCtrl,
 };
 use super::vmx_asm_wrapper::{vmx_vmclear, vmx_vmptrld, vmx_vmread, vmx_vmwrite, vmxoff, vmxon};
-use crate::arch::kvm::vmx::mmu::KvmMmu;
+use crate::arch::kvm::vmx::halt::VcpuHalt;
+use crate::arch::kvm::vmx::mmu::{kvm_mmu_prefault, KvmMmu};
 use crate::arch::kvm::vmx::seg::{seg_setup, Sreg};
+use crate::arch::kvm::vmx::vmexit::VmxExitStats;
 use crate::arch::kvm::vmx::{VcpuRegIndex, X86_CR0};
 use crate::arch::mm::{LockedFrameAllocator, PageMapper};
 use crate::arch::x86_64::mm::X86_64MMArch;
@@ -14,9 +16,11 @@ use crate::mm::{phys_2_virt, VirtAddr};
 use crate::mm::{MemoryManagementArch, PageTableKind};
 use crate::syscall::SystemError;
 use crate::virt::kvm::vcpu::Vcpu;
+use crate::virt::kvm::vm;
 use crate::virt::kvm::vm::Vm;
 use alloc::alloc::Global;
 use alloc::boxed::Box;
+use alloc::sync::Arc;
 use core::slice;
 use raw_cpuid::CpuId;
 use x86;
@@ -80,6 +84,8 @@ pub struct VmxVcpu {
     pub mmu: KvmMmu,                // vcpu的内存管理单元
     pub data: VcpuData,             // vcpu的数据
     pub parent_vm: Vm,              // parent KVM
+    pub exit_stats: Arc<VmxExitStats>, // 按退出原因分类的VM退出统计
+    pub halt: Arc<VcpuHalt>,        // 执行HLT时的阻塞状态和待注入的中断
 }
 
 impl VcpuData {
@@ -162,6 +168,8 @@ impl VmxVcpu {
             mmu: KvmMmu::default(),
             data: VcpuData::alloc()?,
             parent_vm,
+            exit_stats: Arc::new(VmxExitStats::new()),
+            halt: Arc::new(VcpuHalt::new()),
         };
         Ok(instance)
     }
@@ -401,6 +409,11 @@ impl VmxVcpu {
         self.mmu.root_hpa = ept_root_hpa.data() as u64;
         kdebug!("ept_root_hpa:{:x}!", ept_root_hpa.data() as u64);
 
+        // 新的EPT页表是空的，按需在这里一次性映射虚拟机的全部内存
+        if vm(0).map_or(false, |vm| vm.prefault) {
+            kvm_mmu_prefault(self)?;
+        }
+
         return Ok(());
     }
 
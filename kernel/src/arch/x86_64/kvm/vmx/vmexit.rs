@@ -1,8 +1,15 @@
+use super::halt::{vmx_halt, vmx_inject_pending_irq};
 use super::vmcs::{VmcsFields, VmxExitReason};
 use super::vmx_asm_wrapper::{vmx_vmread, vmx_vmwrite};
 use crate::kdebug;
+use crate::mm::percpu::PerCpu;
+use crate::smp::core::smp_get_processor_id;
 use crate::{syscall::SystemError, virt::kvm::vm};
+use alloc::sync::Arc;
 use core::arch::asm;
+use core::arch::x86_64::{__cpuid_count, _rdtsc};
+use core::sync::atomic::{AtomicPtr, AtomicU64, Ordering};
+use x86::msr;
 use x86::vmx::vmcs::ro::GUEST_PHYSICAL_ADDR_FULL;
 
 #[derive(FromPrimitive)]
@@ -71,59 +78,56 @@ pub fn vmexit_vmx_instruction_executed() -> Result<(), SystemError> {
     Ok(())
 }
 
-// pub fn vmexit_cpuid_handler(guest_cpu_context: &mut GuestCpuContext) -> Result<(), SystemError>{
-//     let rax = guest_cpu_context.rax;
-//     let rcx = guest_cpu_context.rcx;
-//     // let rdx = guest_cpu_context.rdx;
-//     // let rbx = guest_cpu_context.rbx;
-//     cpuid!(rax, rcx);
-//     unsafe{asm!("mov {}, rax", out(reg) guest_cpu_context.rax)};
-//     unsafe{asm!("mov {}, rcx", out(reg) guest_cpu_context.rcx)};
-//     unsafe{asm!("mov {}, rdx", out(reg) guest_cpu_context.rdx)};
-//     unsafe{asm!("mov {}, rbx", out(reg) guest_cpu_context.rbx)};
-//     Ok(())
-// }
+/// CPUID.1:ECX中的VMX位
+const CPUID_1_ECX_VMX: u32 = 1 << 5;
+/// CPUID.1:ECX中表示运行在hypervisor中的位
+const CPUID_1_ECX_HYPERVISOR: u32 = 1 << 31;
 
-unsafe fn save_rpg() {
-    asm!(
-        "push    rax",
-        "push    rcx",
-        "push    rdx",
-        "push    rbx",
-        "push    rbp",
-        "push    rsi",
-        "push    rdi",
-        "push    r8",
-        "push    r9",
-        "push    r10",
-        "push    r11",
-        "push    r12",
-        "push    r13",
-        "push    r14",
-        "push    r15",
-    );
+/// 在host上执行cpuid，把结果返回给guest。不向guest暴露VMX，并告诉guest它运行在hypervisor中
+fn vmexit_cpuid_handler(ctx: &mut GuestCpuContext) {
+    let leaf = ctx.rax as u32;
+    let res = unsafe { __cpuid_count(leaf, ctx.rcx as u32) };
+    let mut ecx = res.ecx;
+    if leaf == 1 {
+        ecx = (ecx & !CPUID_1_ECX_VMX) | CPUID_1_ECX_HYPERVISOR;
+    }
+    ctx.rax = res.eax as u64;
+    ctx.rbx = res.ebx as u64;
+    ctx.rcx = ecx as u64;
+    ctx.rdx = res.edx as u64;
 }
 
-unsafe fn restore_rpg() {
-    asm!(
-        "pop    r15",
-        "pop    r14",
-        "pop    r13",
-        "pop    r12",
-        "pop    r11",
-        "pop    r10",
-        "pop    r9",
-        "pop    r8",
-        "pop    rdi",
-        "pop    rsi",
-        "pop    rbp",
-        "pop    rbx",
-        "pop    rdx",
-        "pop    rcx",
-        "pop    rax",
-    );
+/// 获取保存在VMCS的guest状态区中的MSR对应的字段
+fn guest_msr_field(msr_index: u32) -> Option<VmcsFields> {
+    match msr_index {
+        msr::IA32_EFER => Some(VmcsFields::GUEST_EFER),
+        msr::IA32_FS_BASE => Some(VmcsFields::GUEST_FS_BASE),
+        msr::IA32_GS_BASE => Some(VmcsFields::GUEST_GS_BASE),
+        msr::IA32_SYSENTER_CS => Some(VmcsFields::GUEST_SYSENTER_CS),
+        msr::IA32_SYSENTER_ESP => Some(VmcsFields::GUEST_SYSENTER_ESP),
+        msr::IA32_SYSENTER_EIP => Some(VmcsFields::GUEST_SYSENTER_EIP),
+        _ => None,
+    }
+}
+
+/// guest读取MSR：保存在VMCS中的MSR从VMCS读取，其余的MSR读作0
+fn vmexit_rdmsr_handler(ctx: &mut GuestCpuContext) {
+    let value = guest_msr_field(ctx.rcx as u32)
+        .and_then(|field| vmx_vmread(field as u32).ok())
+        .unwrap_or(0);
+    ctx.rax = value & 0xffff_ffff;
+    ctx.rdx = value >> 32;
 }
 
+/// guest写入MSR：保存在VMCS中的MSR写入VMCS，其余的写入被忽略
+fn vmexit_wrmsr_handler(ctx: &mut GuestCpuContext) {
+    if let Some(field) = guest_msr_field(ctx.rcx as u32) {
+        let value = (ctx.rdx << 32) | (ctx.rax & 0xffff_ffff);
+        vmx_vmwrite(field as u32, value).ok();
+    }
+}
+
+/// 退出时保存在host栈上的guest通用寄存器，顺序与`vmx_return`中压栈的顺序相反
 #[repr(C)]
 #[allow(dead_code)]
 pub struct GuestCpuContext {
@@ -144,52 +148,165 @@ pub struct GuestCpuContext {
     pub rax: u64,
 }
 
-#[no_mangle]
-pub extern "C" fn vmx_return() {
-    kdebug!("vmx_return!");
-    unsafe { save_rpg() };
-    vmexit_handler();
-    // XMM registers are vector registers. They're renamed onto the FP/SIMD register file
-    // unsafe {asm!(
-    //     "sub     rsp, 60h",
-    //     "movaps  xmmword ptr [rsp +  0h], xmm0",
-    //     "movaps  xmmword ptr [rsp + 10h], xmm1",
-    //     "movaps  xmmword ptr [rsp + 20h], xmm2",
-    //     "movaps  xmmword ptr [rsp + 30h], xmm3",
-    //     "movaps  xmmword ptr [rsp + 40h], xmm4",
-    //     "movaps  xmmword ptr [rsp + 50h], xmm5",
+/// 基本退出原因的数量
+pub const VMX_EXIT_REASON_NUM: usize = VmxExitReason::XRSTORS as usize + 1;
+
+/// 一种退出原因的统计，与导出给用户态的格式一致
+#[repr(C)]
+#[derive(Debug, Default, Clone, Copy)]
+pub struct VmxExitStat {
+    /// 退出的次数
+    pub count: u64,
+    /// 在`vmexit_handler`中处理这些退出花费的TSC周期数之和
+    pub cycles: u64,
+}
+
+/// 一个vcpu按照基本退出原因分类的退出统计
+#[derive(Debug)]
+pub struct VmxExitStats {
+    count: [AtomicU64; VMX_EXIT_REASON_NUM],
+    cycles: [AtomicU64; VMX_EXIT_REASON_NUM],
+}
+
+impl VmxExitStats {
+    pub fn new() -> Self {
+        return Self {
+            count: [const { AtomicU64::new(0) }; VMX_EXIT_REASON_NUM],
+            cycles: [const { AtomicU64::new(0) }; VMX_EXIT_REASON_NUM],
+        };
+    }
+
+    fn record(&self, reason: usize, cycles: u64) {
+        if reason < VMX_EXIT_REASON_NUM {
+            self.count[reason].fetch_add(1, Ordering::Relaxed);
+            self.cycles[reason].fetch_add(cycles, Ordering::Relaxed);
+        }
+    }
+
+    /// 获取各个退出原因的统计，下标为基本退出原因
+    pub fn snapshot(&self) -> [VmxExitStat; VMX_EXIT_REASON_NUM] {
+        let mut ret = [VmxExitStat::default(); VMX_EXIT_REASON_NUM];
+        for (i, stat) in ret.iter_mut().enumerate() {
+            stat.count = self.count[i].load(Ordering::Relaxed);
+            stat.cycles = self.cycles[i].load(Ordering::Relaxed);
+        }
+        return ret;
+    }
+}
 
-    //     "mov     rdi, rsp",
-    //     "sub     rsp, 20h",
-    //     "call vmexit_handler",
-    //     "add     rsp, 20h",
+/// 每个CPU上正在运行的vcpu的退出统计，由`vmexit_handler`更新，避免在每次退出时查找vcpu
+static CURRENT_EXIT_STATS: [AtomicPtr<VmxExitStats>; PerCpu::MAX_CPU_NUM] =
+    [const { AtomicPtr::new(core::ptr::null_mut()) }; PerCpu::MAX_CPU_NUM];
 
-    //     "movaps  xmm0, xmmword ptr [rsp +  0h]",
-    //     "movaps  xmm1, xmmword ptr [rsp + 10h]",
-    //     "movaps  xmm2, xmmword ptr [rsp + 20h]",
-    //     "movaps  xmm3, xmmword ptr [rsp + 30h]",
-    //     "movaps  xmm4, xmmword ptr [rsp + 40h]",
-    //     "movaps  xmm5, xmmword ptr [rsp + 50h]",
-    //     "add     rsp, 60h",
-    // clobber_abi("C"),
-    // )};
-    unsafe { restore_rpg() };
-    unsafe { asm!("vmresume",) };
+/// 在当前CPU上进入guest之前，设置接下来的退出计入哪个vcpu的统计
+///
+/// vcpu保存在VM_LIST中，在它能运行的期间，`stats`不会被释放
+pub fn vmx_set_current_exit_stats(stats: &Arc<VmxExitStats>) {
+    let cpu = smp_get_processor_id() as usize;
+    CURRENT_EXIT_STATS[cpu].store(Arc::as_ptr(stats) as *mut _, Ordering::Release);
 }
 
+/// VM退出时的入口（VMCS中的HOST_RIP）
+///
+/// 退出时除了RSP和RIP之外，通用寄存器中仍然是guest的值，这里把它们保存到栈上，
+/// 作为`GuestCpuContext`传给`vmexit_handler`，处理完之后恢复，然后直接vmresume回到guest
+#[naked]
 #[no_mangle]
-extern "C" fn vmexit_handler() {
-    // let guest_cpu_context = unsafe { guest_cpu_context_ptr.as_mut().unwrap() };
-    // kdebug!("guest_cpu_context_ptr={:p}",guest_cpu_context_ptr);
-    kdebug!("vmexit handler!");
+pub unsafe extern "C" fn vmx_return() {
+    asm!(
+        "push    rax",
+        "push    rcx",
+        "push    rdx",
+        "push    rbx",
+        "push    rbp",
+        "push    rsi",
+        "push    rdi",
+        "push    r8",
+        "push    r9",
+        "push    r10",
+        "push    r11",
+        "push    r12",
+        "push    r13",
+        "push    r14",
+        "push    r15",
+        "mov     rdi, rsp",
+        // rbp是callee-saved的，用它保存对齐之前的栈指针
+        "mov     rbp, rsp",
+        "and     rsp, -16",
+        "call    {handler}",
+        "mov     rsp, rbp",
+        "pop     r15",
+        "pop     r14",
+        "pop     r13",
+        "pop     r12",
+        "pop     r11",
+        "pop     r10",
+        "pop     r9",
+        "pop     r8",
+        "pop     rdi",
+        "pop     rsi",
+        "pop     rbp",
+        "pop     rbx",
+        "pop     rdx",
+        "pop     rcx",
+        "pop     rax",
+        "vmresume",
+        // 只有vmresume失败才会执行到这里
+        "call    {fail}",
+        handler = sym vmexit_handler,
+        fail = sym vmx_resume_failed,
+        options(noreturn)
+    )
+}
+
+extern "C" fn vmx_resume_failed() -> ! {
+    let vmx_err = vmx_vmread(VmcsFields::VMEXIT_INSTR_ERR as u32).unwrap_or(0);
+    panic!("vmresume failed: {:?}", vmx_err);
+}
 
+extern "C" fn vmexit_handler(ctx: &mut GuestCpuContext) {
+    let start = unsafe { _rdtsc() };
     let exit_reason = vmx_vmread(VmcsFields::VMEXIT_EXIT_REASON as u32).unwrap() as u32;
     let exit_basic_reason = exit_reason & 0x0000_ffff;
     let guest_rip = vmx_vmread(VmcsFields::GUEST_RIP as u32).unwrap();
-    // let guest_rsp = vmx_vmread(VmcsFields::GUEST_RSP as u32).unwrap();
-    kdebug!("guest_rip={:x}", guest_rip);
-    let _guest_rflags = vmx_vmread(VmcsFields::GUEST_RFLAGS as u32).unwrap();
 
+    vmexit_dispatch(ctx, exit_basic_reason, guest_rip);
+    vmx_inject_pending_irq();
+
+    let stats = CURRENT_EXIT_STATS[smp_get_processor_id() as usize].load(Ordering::Acquire);
+    if let Some(stats) = unsafe { stats.as_ref() } {
+        stats.record(exit_basic_reason as usize, unsafe { _rdtsc() } - start);
+    }
+}
+
+fn vmexit_dispatch(ctx: &mut GuestCpuContext, exit_basic_reason: u32, guest_rip: u64) {
+    // 最常见的退出只需要读写guest的通用寄存器和RIP，在这里直接处理，不打印日志，也不查找vcpu
+    match VmxExitReason::from(exit_basic_reason as i32) {
+        VmxExitReason::CPUID => {
+            vmexit_cpuid_handler(ctx);
+            adjust_rip(guest_rip).unwrap();
+            return;
+        }
+        VmxExitReason::RDMSR => {
+            vmexit_rdmsr_handler(ctx);
+            adjust_rip(guest_rip).unwrap();
+            return;
+        }
+        VmxExitReason::WRMSR => {
+            vmexit_wrmsr_handler(ctx);
+            adjust_rip(guest_rip).unwrap();
+            return;
+        }
+        VmxExitReason::HLT => {
+            adjust_rip(guest_rip).unwrap();
+            vmx_halt();
+            return;
+        }
+        _ => {}
+    }
+
+    kdebug!("vmexit handler!");
+    kdebug!("guest_rip={:x}", guest_rip);
     match VmxExitReason::from(exit_basic_reason as i32) {
         VmxExitReason::VMCALL
         | VmxExitReason::VMCLEAR
@@ -207,19 +324,6 @@ extern "C" fn vmexit_handler() {
             kdebug!("vmexit handler: vmx instruction!");
             vmexit_vmx_instruction_executed().expect("previledge instruction handle error");
         }
-        VmxExitReason::CPUID => {
-            kdebug!("vmexit handler: cpuid instruction!");
-            // vmexit_cpuid_handler(guest_cpu_context);
-            adjust_rip(guest_rip).unwrap();
-        }
-        VmxExitReason::RDMSR => {
-            kdebug!("vmexit handler: rdmsr instruction!");
-            adjust_rip(guest_rip).unwrap();
-        }
-        VmxExitReason::WRMSR => {
-            kdebug!("vmexit handler: wrmsr instruction!");
-            adjust_rip(guest_rip).unwrap();
-        }
         VmxExitReason::TRIPLE_FAULT => {
             kdebug!("vmexit handler: triple fault!");
             adjust_rip(guest_rip).unwrap();
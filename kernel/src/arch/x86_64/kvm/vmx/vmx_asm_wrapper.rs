@@ -1,4 +1,5 @@
 use super::vmcs::VmcsFields;
+use super::vmexit::vmx_return;
 use crate::kdebug;
 use crate::syscall::SystemError;
 use core::arch::asm;
@@ -52,9 +53,11 @@ pub fn vmx_vmptrld(vmcs_pa: u64) -> Result<(), SystemError> {
     }
 }
 
+/// 进入guest。VM退出时从`vmx_return`继续执行，它处理完退出后直接vmresume，因此只有vmlaunch失败时才会返回
 pub fn vmx_vmlaunch() -> Result<(), SystemError> {
     let host_rsp = VmcsFields::HOST_RSP as u32;
     let host_rip = VmcsFields::HOST_RIP as u32;
+    let failed: u8;
     unsafe {
         asm!(
             "push    rbp",
@@ -63,21 +66,27 @@ pub fn vmx_vmlaunch() -> Result<(), SystemError> {
             "push    rsi",
             "push    rdi",
             "vmwrite {0:r}, rsp",
-            "lea rax, 1f[rip]",
+            "lea rax, [rip + {2}]",
             "vmwrite {1:r}, rax",
             "vmlaunch",
-            "1:",
             "pop    rdi",
             "pop    rsi",
             "pop    rdx",
             "pop    rcx",
             "pop    rbp",
-            "call vmx_return",
+            // pop不影响标志位，CF或ZF被置位表示vmlaunch失败
+            "setbe {3}",
             in(reg) host_rsp,
             in(reg) host_rip,
+            sym vmx_return,
+            out(reg_byte) failed,
+            out("rax") _,
             clobber_abi("C"),
         )
     }
+    if failed != 0 {
+        return Err(SystemError::EVMLAUNCHFailed);
+    }
     Ok(())
     // match unsafe { x86::bits64::vmx::vmlaunch() } {
     //     Ok(_) => Ok(()),
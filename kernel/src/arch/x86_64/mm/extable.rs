@@ -0,0 +1,55 @@
+//! 内核异常表
+//!
+//! 内核中少数可能会访问非法地址的指令（例如访问用户空间的拷贝函数），会把指令的地址、
+//! 以及发生异常之后应该跳转到的修复代码的地址，记录在`__ex_table`段中。
+//! 发生无法处理的缺页异常时，如果触发异常的指令在异常表中，就跳转到修复代码继续执行，
+//! 而不是把它当作内核的错误。
+
+use crate::arch::interrupt::TrapFrame;
+
+/// 异常表的表项（与汇编中的`.quad insn, fixup`对应）
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+struct ExceptionTableEntry {
+    /// 可能触发异常的指令的地址
+    insn: usize,
+    /// 修复代码的地址
+    fixup: usize,
+}
+
+extern "C" {
+    static __start___ex_table: ExceptionTableEntry;
+    static __stop___ex_table: ExceptionTableEntry;
+}
+
+fn exception_table() -> &'static [ExceptionTableEntry] {
+    unsafe {
+        let start = &__start___ex_table as *const ExceptionTableEntry;
+        let stop = &__stop___ex_table as *const ExceptionTableEntry;
+        let len = (stop as usize - start as usize) / core::mem::size_of::<ExceptionTableEntry>();
+        return core::slice::from_raw_parts(start, len);
+    }
+}
+
+/// 查找指令对应的修复代码
+///
+/// 异常表的表项很少，因此直接线性查找
+pub fn search_exception_table(ip: usize) -> Option<usize> {
+    return exception_table()
+        .iter()
+        .find(|e| e.insn == ip)
+        .map(|e| e.fixup);
+}
+
+/// 如果触发异常的指令在异常表中，则把返回地址修改为修复代码的地址
+///
+/// ## 返回值
+///
+/// 如果异常已经被修复，返回true
+pub fn fixup_exception(regs: &mut TrapFrame) -> bool {
+    if let Some(fixup) = search_exception_table(regs.rip as usize) {
+        regs.rip = fixup as u64;
+        return true;
+    }
+    return false;
+}
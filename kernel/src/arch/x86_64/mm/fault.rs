@@ -0,0 +1,79 @@
+use crate::{
+    arch::{interrupt::TrapFrame, mm::extable::fixup_exception},
+    mm::{
+        fault::{FaultFlags, PageFaultHandler},
+        VirtAddr,
+    },
+    sched::cputime::{cputime_switch, CpuTimeContext},
+};
+
+bitflags! {
+    /// x86_64架构下，缺页异常的错误码
+    pub struct X86PfErrorCode: u64 {
+        /// 0：页面不存在，1：页保护错误
+        const X86_PF_PROT = 1 << 0;
+        /// 由写操作引起
+        const X86_PF_WRITE = 1 << 1;
+        /// 发生在用户态
+        const X86_PF_USER = 1 << 2;
+        /// 页表项的保留位被置位
+        const X86_PF_RSVD = 1 << 3;
+        /// 由取指引起
+        const X86_PF_INSTR = 1 << 4;
+    }
+}
+
+/// 缺页异常的Rust处理入口（由C语言的do_page_fault调用）
+///
+/// ## 参数
+///
+/// - `regs`：中断栈帧
+/// - `error_code`：缺页异常的错误码
+/// - `address`：触发缺页异常的地址（cr2）
+///
+/// ## 返回值
+///
+/// 如果缺页异常已经被处理（或者已经通过异常表修复），返回0，否则返回-1
+#[no_mangle]
+pub unsafe extern "C" fn rs_do_page_fault(
+    regs: *mut TrapFrame,
+    error_code: u64,
+    address: u64,
+) -> i32 {
+    let error_code = X86PfErrorCode::from_bits_truncate(error_code);
+    if error_code.contains(X86PfErrorCode::X86_PF_RSVD) {
+        return -1;
+    }
+
+    // 用户态的缺页异常：处理缺页的时间记为内核态时间
+    if error_code.contains(X86PfErrorCode::X86_PF_USER) {
+        let prev = cputime_switch(CpuTimeContext::System);
+        let r = do_page_fault(regs, error_code, address);
+        cputime_switch(prev);
+        return r;
+    }
+    return do_page_fault(regs, error_code, address);
+}
+
+unsafe fn do_page_fault(regs: *mut TrapFrame, error_code: X86PfErrorCode, address: u64) -> i32 {
+    let mut flags = FaultFlags::empty();
+    if error_code.contains(X86PfErrorCode::X86_PF_WRITE) {
+        flags |= FaultFlags::FAULT_FLAG_WRITE;
+    }
+    if error_code.contains(X86PfErrorCode::X86_PF_USER) {
+        flags |= FaultFlags::FAULT_FLAG_USER;
+    }
+    if error_code.contains(X86PfErrorCode::X86_PF_INSTR) {
+        flags |= FaultFlags::FAULT_FLAG_INSTRUCTION;
+    }
+
+    if PageFaultHandler::handle_mm_fault(VirtAddr::new(address as usize), flags).is_ok() {
+        return 0;
+    }
+
+    // 内核在访问用户空间时遇到了非法地址，跳转到拷贝函数的修复代码，由它返回错误
+    if !flags.contains(FaultFlags::FAULT_FLAG_USER) && fixup_exception(&mut *regs) {
+        return 0;
+    }
+    return -1;
+}
@@ -1,5 +1,11 @@
 pub mod barrier;
 pub mod bump;
+pub mod extable;
+pub mod fault;
+pub mod pat;
+pub mod pcid;
+pub mod smap;
+pub mod usercopy;
 
 use alloc::vec::Vec;
 use hashbrown::HashSet;
@@ -8,19 +14,27 @@ use x86_64::registers::model_specific::EferFlags;
 
 use crate::driver::tty::serial::serial8250::send_to_default_serial8250_port;
 use crate::include::bindings::bindings::{
-    multiboot2_get_load_base, multiboot2_get_memory, multiboot2_iter, multiboot_mmap_entry_t,
-    multiboot_tag_load_base_addr_t,
+    multiboot2_get_load_base, multiboot2_get_memory, multiboot2_get_modules, multiboot2_iter,
+    multiboot_mmap_entry_t, multiboot_tag_load_base_addr_t, multiboot_tag_module_t,
+    MULTIBOOT2_MAX_MODULES,
 };
-use crate::libs::align::page_align_up;
+use crate::libs::align::{page_align_down, page_align_up};
 use crate::libs::lib_ui::screen_manager::scm_disable_put_to_window;
 use crate::libs::printk::PrintkWriter;
+use crate::libs::qspinlock::QueuedSpinLock;
 use crate::libs::spinlock::SpinLock;
 
 use crate::mm::allocator::page_frame::{FrameAllocator, PageFrameCount, PageFrameUsage};
+use crate::mm::allocator::per_cpu_pages::PerCpuPages;
 use crate::mm::mmio_buddy::mmio_init;
+use crate::mm::percpu::{PerCpu, PerCpuVar};
+use crate::mm::{numa, reclaim};
 use crate::{
     arch::MMArch,
-    mm::allocator::{buddy::BuddyAllocator, bump::BumpAllocator},
+    mm::allocator::{
+        buddy::{BuddyAllocator, ZoneType},
+        bump::BumpAllocator,
+    },
 };
 
 use crate::mm::kernel_mapper::KernelMapper;
@@ -48,6 +62,17 @@ static mut PHYS_MEMORY_AREAS: [PhysMemoryArea; 512] = [PhysMemoryArea {
     size: 0,
 }; 512];
 
+/// bootloader加载的模块（例如initramfs）所在的物理内存区域（按页对齐）
+///
+/// 这些内存不会加入PHYS_MEMORY_AREAS，因此不会被分配器覆盖，但是仍然会被映射到内核的地址空间中
+static mut BOOT_MODULES: [PhysMemoryArea; BOOT_MODULES_MAX] = [PhysMemoryArea {
+    base: PhysAddr::new(0),
+    size: 0,
+}; BOOT_MODULES_MAX];
+const BOOT_MODULES_MAX: usize = MULTIBOOT2_MAX_MODULES as usize;
+/// BOOT_MODULES中有效的模块数量
+static mut BOOT_MODULES_COUNT: usize = 0;
+
 /// 初始的CR3寄存器的值，用于内存管理初始化时，创建的第一个内核页表的位置
 static mut INITIAL_CR3_VALUE: PhysAddr = PhysAddr::new(0);
 
@@ -55,7 +80,10 @@ static mut INITIAL_CR3_VALUE: PhysAddr = PhysAddr::new(0);
 /// 顶级页表的[256, 512)项是内核的页表
 static KERNEL_PML4E_NO: usize = (X86_64MMArch::PHYS_OFFSET & ((1 << 48) - 1)) >> 39;
 
-static INNER_ALLOCATOR: SpinLock<Option<BuddyAllocator<MMArch>>> = SpinLock::new(None);
+static INNER_ALLOCATOR: QueuedSpinLock<Option<BuddyAllocator<MMArch>>> = QueuedSpinLock::new(None);
+
+/// 每个CPU的页帧缓存，位于buddy分配器前面（在buddy分配器初始化完成后才会被初始化）
+static mut PER_CPU_PAGES: Option<PerCpuVar<SpinLock<PerCpuPages>>> = None;
 
 #[derive(Clone, Copy, Debug)]
 pub struct X86_64MMBootstrapInfo {
@@ -76,6 +104,11 @@ pub struct X86_64MMArch;
 /// XD标志位是否被保留
 static XD_RESERVED: AtomicBool = AtomicBool::new(false);
 
+/// 2M大页的大小
+pub const HUGE_PAGE_2M_SIZE: usize = 1 << 21;
+/// 1G大页的大小
+pub const HUGE_PAGE_1G_SIZE: usize = 1 << 30;
+
 impl MemoryManagementArch for X86_64MMArch {
     /// 4K页
     const PAGE_SHIFT: usize = 12;
@@ -107,10 +140,25 @@ impl MemoryManagementArch for X86_64MMArch {
 
     const ENTRY_FLAG_CACHE_DISABLE: usize = 1 << 4;
 
+    /// 只设置PWT位时，选择IA32_PAT的第1项，它被设置为写合并（见[`pat`]）
+    const ENTRY_FLAG_WRITE_COMBINING: usize = Self::ENTRY_FLAG_WRITE_THROUGH;
+
     const ENTRY_FLAG_NO_EXEC: usize = 1 << 63;
     /// x86_64不存在EXEC标志位，只有NO_EXEC（XD）标志位
     const ENTRY_FLAG_EXEC: usize = 0;
 
+    /// PDPTE/PDE中的PS位，置位时映射1G/2M的大页
+    const ENTRY_FLAG_HUGE_PAGE: usize = 1 << 7;
+
+    /// 页表项中的A位，CPU访问页面时置位
+    const ENTRY_FLAG_ACCESSED: usize = 1 << 5;
+
+    /// 页表项中的D位，CPU写入页面时置位
+    const ENTRY_FLAG_DIRTY: usize = 1 << 6;
+
+    /// present位为0时，页表项的其他位都由软件使用。这里使用第9位（AVL）
+    const ENTRY_FLAG_SWAP: usize = 1 << 9;
+
     /// 物理地址与虚拟地址的偏移量
     /// 0xffff_8000_0000_0000
     const PHYS_OFFSET: usize = Self::PAGE_NEGATIVE_MASK + (Self::PAGE_ADDRESS_SIZE >> 1);
@@ -156,27 +204,29 @@ impl MemoryManagementArch for X86_64MMArch {
 
     /// @brief 刷新TLB中，关于指定虚拟地址的条目
     unsafe fn invalidate_page(address: VirtAddr) {
+        if !address.check_user() {
+            pcid::note_kernel_invalidate();
+        }
         compiler_fence(Ordering::SeqCst);
         asm!("invlpg [{0}]", in(reg) address.data(), options(nostack, preserves_flags));
         compiler_fence(Ordering::SeqCst);
     }
 
-    /// @brief 刷新TLB中，所有的条目
+    /// @brief 刷新TLB中，当前地址空间的所有条目
+    ///
+    /// 开启PCID时只刷新当前PCID下的条目，其他地址空间保留在各自PCID下的条目不受影响。
+    /// 内核映射的修改通过invalidate_page刷新，由它记录内核TLB代数
     unsafe fn invalidate_all() {
-        compiler_fence(Ordering::SeqCst);
-        // 通过设置cr3寄存器，来刷新整个TLB
-        Self::set_table(PageTableKind::User, Self::table(PageTableKind::User));
-        compiler_fence(Ordering::SeqCst);
+        // 通过设置cr3寄存器（保留其中的PCID），来刷新当前PCID下的TLB
+        pcid::flush_current_context();
     }
 
     /// @brief 获取顶级页表的物理地址
     unsafe fn table(table_kind: PageTableKind) -> PhysAddr {
         match table_kind {
             PageTableKind::Kernel | PageTableKind::User => {
-                let paddr: usize;
-                compiler_fence(Ordering::SeqCst);
-                asm!("mov {}, cr3", out(reg) paddr, options(nomem, nostack, preserves_flags));
-                compiler_fence(Ordering::SeqCst);
+                // 开启PCID之后，cr3的低12位是PCID，需要去掉
+                let paddr = pcid::read_cr3() & pcid::CR3_ADDR_MASK;
                 return PhysAddr::new(paddr);
             }
             PageTableKind::EPT => {
@@ -258,6 +308,68 @@ impl X86_64MMArch {
 
         return PhysAddr::new(phys);
     }
+
+    /// 获取bootloader加载的模块（例如initramfs）所在的物理内存区域
+    pub fn boot_modules() -> &'static [PhysMemoryArea] {
+        return unsafe { &BOOT_MODULES[0..BOOT_MODULES_COUNT] };
+    }
+
+    /// 从multiboot2中获取bootloader加载的模块，按起始地址排序后存入BOOT_MODULES
+    unsafe fn init_boot_modules_from_multiboot2() {
+        let mut mb2_modules: [multiboot_tag_module_t; BOOT_MODULES_MAX] = mem::zeroed();
+        let mut mb2_count: u32 = 0;
+        multiboot2_iter(
+            Some(multiboot2_get_modules),
+            &mut mb2_modules as *mut [multiboot_tag_module_t; BOOT_MODULES_MAX] as usize
+                as *mut c_void,
+            &mut mb2_count,
+        );
+
+        let mut count = 0;
+        for module in mb2_modules.iter().take(mb2_count as usize) {
+            if module.mod_end <= module.mod_start {
+                continue;
+            }
+            let base = page_align_down(module.mod_start as usize);
+            let end = page_align_up(module.mod_end as usize);
+            // 插入排序，模块的数量很少
+            let mut i = count;
+            while i > 0 && BOOT_MODULES[i - 1].base.data() > base {
+                BOOT_MODULES[i] = BOOT_MODULES[i - 1];
+                i -= 1;
+            }
+            BOOT_MODULES[i] = PhysMemoryArea::new(PhysAddr::new(base), end - base);
+            count += 1;
+        }
+        BOOT_MODULES_COUNT = count;
+    }
+
+    /// 把物理内存区域[start, end)中，不被模块占用的部分加入PHYS_MEMORY_AREAS
+    unsafe fn add_memory_area_excluding_modules(areas_count: &mut usize, start: usize, end: usize) {
+        let mut push = |base: usize, end: usize| {
+            if *areas_count < PHYS_MEMORY_AREAS.len() {
+                PHYS_MEMORY_AREAS[*areas_count] =
+                    PhysMemoryArea::new(PhysAddr::new(base), end - base);
+                *areas_count += 1;
+            }
+        };
+
+        let mut cur = start;
+        for module in Self::boot_modules() {
+            let (mod_start, mod_end) = (module.base.data(), module.base.data() + module.size);
+            if mod_end <= cur || mod_start >= end {
+                continue;
+            }
+            if mod_start > cur {
+                push(cur, mod_start);
+            }
+            cur = mod_end;
+        }
+        if cur < end {
+            push(cur, end);
+        }
+    }
+
     unsafe fn init_memory_area_from_multiboot2() -> Result<usize, SystemError> {
         // 这个数组用来存放内存区域的信息（从C获取）
         let mut mb2_mem_info: [multiboot_mmap_entry_t; 512] = mem::zeroed();
@@ -271,6 +383,9 @@ impl X86_64MMArch {
         );
         send_to_default_serial8250_port("init_memory_area_from_multiboot2 2\n\0".as_bytes());
 
+        // bootloader加载的模块位于可用内存中，需要从可用内存中剔除
+        Self::init_boot_modules_from_multiboot2();
+
         let mb2_count = mb2_count as usize;
         let mut areas_count = 0usize;
         let mut total_mem_size = 0usize;
@@ -282,9 +397,12 @@ impl X86_64MMArch {
                     continue;
                 }
                 total_mem_size += mb2_mem_info[i].len as usize;
-                PHYS_MEMORY_AREAS[areas_count].base = PhysAddr::new(mb2_mem_info[i].addr as usize);
-                PHYS_MEMORY_AREAS[areas_count].size = mb2_mem_info[i].len as usize;
-                areas_count += 1;
+                let start = mb2_mem_info[i].addr as usize;
+                Self::add_memory_area_excluding_modules(
+                    &mut areas_count,
+                    start,
+                    start + mb2_mem_info[i].len as usize,
+                );
             }
         }
         send_to_default_serial8250_port("init_memory_area_from_multiboot2 end\n\0".as_bytes());
@@ -348,6 +466,12 @@ pub fn mm_init() {
 
     // 初始化内存管理器
     unsafe { allocator_init() };
+    // 设置PAT，使得之后的映射可以使用写合并
+    unsafe { pat::pat_init_current_cpu(true) };
+    // 此时cr3中的PCID为0，可以开启PCID
+    unsafe { pcid::pcid_init_current_cpu(true) };
+    // 检测SMAP，开启了smap特性时设置CR4.SMAP
+    unsafe { smap::smap_init_current_cpu(true) };
     // enable mmio
     mmio_init();
 }
@@ -395,18 +519,57 @@ unsafe fn allocator_init() {
         }
         kdebug!("Successfully emptied page table");
 
-        for area in PHYS_MEMORY_AREAS.iter() {
+        // CPU支持时，使用1G的大页来映射大块的物理内存
+        let gb_pages = x86::cpuid::CpuId::new()
+            .get_extended_processor_and_feature_identifiers()
+            .map(|f| f.has_1gib_pages())
+            .unwrap_or(false);
+        kdebug!("1G pages supported: {}", gb_pages);
+
+        // 模块所在的内存不在PHYS_MEMORY_AREAS中，但是也需要映射，以便之后读取（例如解压initramfs）
+        for area in PHYS_MEMORY_AREAS.iter().chain(X86_64MMArch::boot_modules()) {
             // kdebug!("area: base={:?}, size={:#x}, end={:?}", area.base, area.size, area.base + area.size);
-            for i in 0..((area.size + MMArch::PAGE_SIZE - 1) / MMArch::PAGE_SIZE) {
-                let paddr = area.base.add(i * MMArch::PAGE_SIZE);
+            let end = area.base.add(page_align_up(area.size));
+            let mut paddr = area.base;
+            while paddr < end {
                 let vaddr = unsafe { MMArch::phys_2_virt(paddr) }.unwrap();
-                let flags = kernel_page_flags::<MMArch>(vaddr);
 
+                if gb_pages
+                    && paddr.check_aligned(HUGE_PAGE_1G_SIZE)
+                    && paddr.add(HUGE_PAGE_1G_SIZE) <= end
+                {
+                    if let Some(flags) = kernel_huge_page_flags::<MMArch>(vaddr, HUGE_PAGE_1G_SIZE)
+                    {
+                        let flusher = mapper
+                            .map_huge_phys(vaddr, paddr, flags, 2)
+                            .expect("Failed to map huge frame");
+                        flusher.ignore();
+                        paddr = paddr.add(HUGE_PAGE_1G_SIZE);
+                        continue;
+                    }
+                }
+
+                // 尽量使用2M的大页来映射，以减少页表的内存占用以及TLB缺失
+                if paddr.check_aligned(HUGE_PAGE_2M_SIZE) && paddr.add(HUGE_PAGE_2M_SIZE) <= end {
+                    if let Some(flags) = kernel_huge_page_flags::<MMArch>(vaddr, HUGE_PAGE_2M_SIZE)
+                    {
+                        let flusher = mapper
+                            .map_huge_phys(vaddr, paddr, flags, 1)
+                            .expect("Failed to map huge frame");
+                        // 暂时不刷新TLB
+                        flusher.ignore();
+                        paddr = paddr.add(HUGE_PAGE_2M_SIZE);
+                        continue;
+                    }
+                }
+
+                let flags = kernel_page_flags::<MMArch>(vaddr);
                 let flusher = mapper
                     .map_phys(vaddr, paddr, flags)
                     .expect("Failed to map frame");
                 // 暂时不刷新TLB
                 flusher.ignore();
+                paddr = paddr.add(MMArch::PAGE_SIZE);
             }
         }
 
@@ -447,6 +610,20 @@ unsafe fn allocator_init() {
         kdebug!("New page table enabled");
     }
     kdebug!("Successfully enabled new page table");
+
+    init_per_cpu_pages();
+}
+
+/// 初始化每个CPU的页帧缓存
+///
+/// 由于初始化过程需要使用堆内存，因此需要在buddy分配器初始化之后调用
+unsafe fn init_per_cpu_pages() {
+    let mut v: Vec<SpinLock<PerCpuPages>> = Vec::with_capacity(PerCpu::MAX_CPU_NUM);
+    for _ in 0..PerCpu::MAX_CPU_NUM {
+        v.push(SpinLock::new(PerCpuPages::new()));
+    }
+    PER_CPU_PAGES = Some(PerCpuVar::new(v).unwrap());
+    kinfo!("Per-cpu page frame caches initialized");
 }
 
 #[no_mangle]
@@ -548,8 +725,26 @@ pub struct LockedFrameAllocator;
 
 impl FrameAllocator for LockedFrameAllocator {
     unsafe fn allocate(&mut self, count: PageFrameCount) -> Option<(PhysAddr, PageFrameCount)> {
+        // 低阶的页帧优先从当前CPU的缓存中分配
+        if let (Some(order), Some(pcp)) = (PerCpuPages::order_of(count), PER_CPU_PAGES.as_ref()) {
+            let mut pcp = pcp.get().lock_irqsave();
+            if let Some(r) = pcp.try_allocate(order) {
+                return Some(r);
+            }
+            // 缓存为空，持有一次buddy的锁，批量补充缓存
+            if let Some(ref mut allocator) = *INNER_ALLOCATOR.lock_irqsave() {
+                let r = pcp.allocate(order, allocator);
+                reclaim::set_free_pages_hint(allocator.free_pages());
+                return r;
+            } else {
+                return None;
+            }
+        }
+
         if let Some(ref mut allocator) = *INNER_ALLOCATOR.lock_irqsave() {
-            return allocator.allocate(count);
+            let r = allocator.allocate(count);
+            reclaim::set_free_pages_hint(allocator.free_pages());
+            return r;
         } else {
             return None;
         }
@@ -557,14 +752,41 @@ impl FrameAllocator for LockedFrameAllocator {
 
     unsafe fn free(&mut self, address: crate::mm::PhysAddr, count: PageFrameCount) {
         assert!(count.data().is_power_of_two());
+        // 其他节点的页帧直接归还给buddy，以免被当前cpu的缓存当作本地内存分配出去
+        let local = numa::nr_nodes() == 1 || numa::paddr_to_node(address) == numa::numa_node_id();
+        if let (Some(order), Some(pcp), true) =
+            (PerCpuPages::order_of(count), PER_CPU_PAGES.as_ref(), local)
+        {
+            let mut pcp = pcp.get().lock_irqsave();
+            if pcp.try_free(order, address) {
+                return;
+            }
+            // 缓存已满，持有一次buddy的锁，批量归还页帧
+            if let Some(ref mut allocator) = *INNER_ALLOCATOR.lock_irqsave() {
+                pcp.free(order, address, allocator);
+                reclaim::set_free_pages_hint(allocator.free_pages());
+            }
+            return;
+        }
+
         if let Some(ref mut allocator) = *INNER_ALLOCATOR.lock_irqsave() {
-            return allocator.free(address, count);
+            allocator.free(address, count);
+            reclaim::set_free_pages_hint(allocator.free_pages());
         }
     }
 
     unsafe fn usage(&self) -> PageFrameUsage {
+        // 缓存在per-cpu链表中的页帧，对于buddy来说是已分配的，但实际上是空闲的
+        let mut cached = PageFrameCount::new(0);
+        if let Some(pcp) = PER_CPU_PAGES.as_ref() {
+            for p in pcp.iter() {
+                cached += p.lock_irqsave().cached_pages();
+            }
+        }
+
         if let Some(ref mut allocator) = *INNER_ALLOCATOR.lock_irqsave() {
-            return allocator.usage();
+            let usage = allocator.usage();
+            return PageFrameUsage::new(usage.used() - cached, usage.total());
         } else {
             panic!("usage error");
         }
@@ -575,6 +797,57 @@ impl LockedFrameAllocator {
     pub fn get_usage(&self) -> PageFrameUsage {
         unsafe { self.usage() }
     }
+
+    /// 只从指定的区域及更低的区域中分配页帧
+    ///
+    /// 不经过per-cpu缓存：缓存中的页帧可能来自任意区域
+    pub unsafe fn allocate_in_zone(
+        &mut self,
+        count: PageFrameCount,
+        zone: ZoneType,
+    ) -> Option<(PhysAddr, PageFrameCount)> {
+        if let Some(ref mut allocator) = *INNER_ALLOCATOR.lock_irqsave() {
+            let r = allocator.allocate_in_zone(count, zone);
+            reclaim::set_free_pages_hint(allocator.free_pages());
+            return r;
+        }
+        return None;
+    }
+
+    /// 把页帧直接归还给buddy，不经过per-cpu缓存（以便它们能立即与伙伴合并）
+    pub unsafe fn free_to_buddy(&mut self, address: PhysAddr, count: PageFrameCount) {
+        if let Some(ref mut allocator) = *INNER_ALLOCATOR.lock_irqsave() {
+            allocator.free(address, count);
+            reclaim::set_free_pages_hint(allocator.free_pages());
+        }
+    }
+
+    /// 把所有CPU的per-cpu缓存中的页帧归还给buddy
+    pub fn drain_per_cpu_pages(&self) {
+        if let Some(pcp) = unsafe { PER_CPU_PAGES.as_ref() } {
+            for p in pcp.iter() {
+                let mut p = p.lock_irqsave();
+                if let Some(ref mut allocator) = *INNER_ALLOCATOR.lock_irqsave() {
+                    unsafe { p.drain_all(allocator) };
+                    reclaim::set_free_pages_hint(allocator.free_pages());
+                }
+            }
+        }
+    }
+
+    /// 使NUMA节点的内存范围生效，并让buddy按照节点重新放置空闲块（见[`BuddyAllocator::rebuild_numa_nodes`]）
+    pub fn rebuild_numa_nodes(&self, publish: impl FnOnce()) {
+        self.drain_per_cpu_pages();
+        if let Some(ref mut allocator) = *INNER_ALLOCATOR.lock_irqsave() {
+            unsafe { allocator.rebuild_numa_nodes(publish) };
+            reclaim::set_free_pages_hint(allocator.free_pages());
+        }
+    }
+
+    /// 访问buddy分配器（只用于查询，调用者不能在闭包中分配内存）
+    pub fn with_buddy<R>(&self, f: impl FnOnce(&BuddyAllocator<MMArch>) -> R) -> Option<R> {
+        return INNER_ALLOCATOR.lock_irqsave().as_ref().map(f);
+    }
 }
 
 /// 获取内核地址默认的页面标志
@@ -592,6 +865,27 @@ pub unsafe fn kernel_page_flags<A: MemoryManagementArch>(virt: VirtAddr) -> Page
     }
 }
 
+/// 如果[virt, virt+size)范围内的所有内核页面的标志位都相同，则返回这个标志位，否则返回None
+///
+/// 用于判断这段范围能否使用一个大页来映射
+unsafe fn kernel_huge_page_flags<A: MemoryManagementArch>(
+    virt: VirtAddr,
+    size: usize,
+) -> Option<PageFlags<A>> {
+    let info: X86_64MMBootstrapInfo = BOOTSTRAP_MM_INFO.clone().unwrap();
+    let boundaries = [
+        info.kernel_code_start,
+        info.kernel_code_end,
+        info.kernel_data_end,
+        info.kernel_rodata_end,
+    ];
+    let end = virt.data() + size;
+    if boundaries.iter().any(|b| *b > virt.data() && *b < end) {
+        return None;
+    }
+    return Some(kernel_page_flags::<A>(virt));
+}
+
 unsafe fn set_inner_allocator(allocator: BuddyAllocator<MMArch>) {
     static FLAG: AtomicBool = AtomicBool::new(false);
     if FLAG
@@ -0,0 +1,78 @@
+//! PAT（Page Attribute Table）
+//!
+//! 4K页表项中的PAT、PCD、PWT三位组成一个索引，选择IA32_PAT中的一项作为页面的内存类型。
+//! 上电时IA32_PAT中没有写合并（WC）类型，这里把第1项（只有PWT置位）改为WC，其余各项保持默认值的含义
+//! （与Linux相同）：
+//!
+//! | 索引 | PAT PCD PWT | 默认值 | 修改后 |
+//! |------|-------------|--------|--------|
+//! | 0    | 0   0   0   | WB     | WB     |
+//! | 1    | 0   0   1   | WT     | WC     |
+//! | 2    | 0   1   0   | UC-    | UC-    |
+//! | 3    | 0   1   1   | UC     | UC     |
+//! | 4-7  | 1   x   x   | 同0-3  | WB WP UC- WT |
+//!
+//! 内核不使用PAT位（它在大页的页表项中与PS位是同一位），因此修改之后，只设置PWT的页面是写合并的，
+//! 同时设置PCD和PWT的页面（MMIO）仍然是不可缓存的。
+//!
+//! 写合并的页面适合帧缓冲区这类只写、顺序写入的设备内存：多次写入在写合并缓冲区中合并成整个缓存行的突发传输，
+//! 而不是每次写入都单独访问总线。写合并的写入之间没有顺序保证，需要保证顺序时（例如写入数据之后再写门铃寄存器）
+//! 必须先执行`sfence`。
+//!
+//! 所有cpu的IA32_PAT必须相同：BSP在内存管理初始化时设置，AP在启动时设置。
+
+use core::arch::asm;
+
+use x86::msr::{rdmsr, wrmsr, IA32_PAT};
+
+use crate::kinfo;
+
+/// 内存类型的编码
+const PAT_UC: u64 = 0x00;
+const PAT_WC: u64 = 0x01;
+const PAT_WT: u64 = 0x04;
+const PAT_WP: u64 = 0x05;
+const PAT_WB: u64 = 0x06;
+const PAT_UC_MINUS: u64 = 0x07;
+
+/// IA32_PAT的第`index`项
+const fn pat_entry(index: usize, ty: u64) -> u64 {
+    return ty << (index * 8);
+}
+
+/// 修改之后的IA32_PAT
+const PAT_VALUE: u64 = pat_entry(0, PAT_WB)
+    | pat_entry(1, PAT_WC)
+    | pat_entry(2, PAT_UC_MINUS)
+    | pat_entry(3, PAT_UC)
+    | pat_entry(4, PAT_WB)
+    | pat_entry(5, PAT_WP)
+    | pat_entry(6, PAT_UC_MINUS)
+    | pat_entry(7, PAT_WT);
+
+/// 设置当前cpu的IA32_PAT
+///
+/// x86_64的cpu都支持PAT，不需要检查cpuid。
+///
+/// ## Safety
+///
+/// 所有cpu都需要在使用写合并的映射之前调用
+pub unsafe fn pat_init_current_cpu(is_bsp: bool) {
+    let old = rdmsr(IA32_PAT);
+    if old == PAT_VALUE {
+        return;
+    }
+    // 修改内存类型前后，写回并作废缓存和TLB中按照旧的内存类型缓存的内容（Intel SDM 11.12.4）
+    asm!("wbinvd", options(nostack, preserves_flags));
+    wrmsr(IA32_PAT, PAT_VALUE);
+    asm!("wbinvd", options(nostack, preserves_flags));
+    x86::tlb::flush_all();
+
+    if is_bsp {
+        kinfo!(
+            "PAT: {:#018x} -> {:#018x}, write-combining enabled.",
+            old,
+            PAT_VALUE
+        );
+    }
+}
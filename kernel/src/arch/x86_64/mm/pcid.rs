@@ -0,0 +1,230 @@
+//! PCID（Process-Context Identifier）支持
+//!
+//! 开启PCID之后，TLB中的每个条目都会带上加载它时的PCID，切换CR3时可以通过设置no-flush位，
+//! 保留其他地址空间的TLB条目。这样，在少数几个进程之间频繁切换时，就不会每次都从冷的TLB开始。
+//!
+//! 每个CPU有少量动态分配的PCID槽（PCID 1~[`PCID_NR_DYNAMIC`]），槽里记录了它最近分配给了哪个地址空间，
+//! 以及当时地址空间的TLB代数。切换到某个地址空间时：
+//! - 如果找到了它的槽，并且它的TLB代数、内核TLB代数都没有变化，说明这个PCID下的TLB条目仍然有效，带no-flush位加载CR3
+//! - 否则复用（或者淘汰）一个槽，并且不带no-flush位加载CR3，刷新这个PCID下的所有条目
+//!
+//! PCID 0保留给内核页表、以及没有通过[`switch_user_table`]加载的页表使用。
+
+use core::{
+    arch::asm,
+    sync::atomic::{compiler_fence, AtomicBool, AtomicU64, Ordering},
+};
+
+use x86::controlregs::{cr4, cr4_write, Cr4};
+
+use crate::{
+    kinfo,
+    mm::{percpu::PerCpu, tlb::TlbState, PhysAddr},
+};
+
+/// 每个CPU上动态分配的PCID数量
+const PCID_NR_DYNAMIC: usize = 6;
+
+/// CR3中PCID所在的位
+const CR3_PCID_MASK: usize = 0xfff;
+/// CR3中顶级页表物理地址所在的位
+pub const CR3_ADDR_MASK: usize = 0x000f_ffff_ffff_f000;
+/// 加载CR3时，不刷新新的PCID下的TLB条目
+const CR3_NOFLUSH: usize = 1 << 63;
+
+/// 是否开启了PCID
+static PCID_ENABLED: AtomicBool = AtomicBool::new(false);
+
+/// 内核空间的TLB代数
+///
+/// 内核页表没有设置全局位，因此内核映射的TLB条目也会被各个PCID分别缓存。
+/// 每次刷新内核地址时，增加这个代数，使得各个CPU上其他PCID下缓存的条目在下次使用前被刷新
+static KERNEL_TLB_GEN: AtomicU64 = AtomicU64::new(1);
+
+/// 每个CPU的PCID缓存（只会在关中断的情况下被所属的CPU访问）
+static mut PCID_CPU_STATE: [PcidCpuState; PerCpu::MAX_CPU_NUM] =
+    [const { PcidCpuState::new() }; PerCpu::MAX_CPU_NUM];
+
+#[derive(Debug, Clone, Copy)]
+struct PcidSlot {
+    /// 使用这个槽的地址空间的id，0表示空闲
+    ctx_id: u64,
+    /// 上次刷新这个PCID时，地址空间的TLB代数
+    tlb_gen: u64,
+    /// 上次刷新这个PCID时，内核空间的TLB代数
+    kernel_gen: u64,
+}
+
+impl PcidSlot {
+    const fn new() -> Self {
+        return Self {
+            ctx_id: 0,
+            tlb_gen: 0,
+            kernel_gen: 0,
+        };
+    }
+}
+
+#[derive(Debug)]
+struct PcidCpuState {
+    slots: [PcidSlot; PCID_NR_DYNAMIC],
+    /// 下一个被淘汰的槽
+    next_victim: usize,
+}
+
+impl PcidCpuState {
+    const fn new() -> Self {
+        return Self {
+            slots: [PcidSlot::new(); PCID_NR_DYNAMIC],
+            next_victim: 0,
+        };
+    }
+}
+
+/// 判断是否开启了PCID
+#[inline(always)]
+pub fn pcid_enabled() -> bool {
+    return PCID_ENABLED.load(Ordering::Relaxed);
+}
+
+/// 在当前CPU上开启PCID
+///
+/// BSP在内存管理初始化完成后调用，决定是否开启PCID；AP启动时调用，与BSP保持一致。
+///
+/// ## Safety
+///
+/// 调用时，CR3中的PCID必须为0
+pub unsafe fn pcid_init_current_cpu(is_bsp: bool) {
+    if is_bsp {
+        let supported = x86::cpuid::CpuId::new()
+            .get_feature_info()
+            .map(|f| f.has_pcid())
+            .unwrap_or(false);
+        if !supported {
+            kinfo!("PCID is not supported, context switches will flush the TLB.");
+            return;
+        }
+        PCID_ENABLED.store(true, Ordering::SeqCst);
+        kinfo!("PCID enabled.");
+    } else if !pcid_enabled() {
+        return;
+    }
+
+    cr4_write(cr4() | Cr4::CR4_ENABLE_PCID);
+}
+
+/// 读取CR3寄存器的原始值
+#[inline(always)]
+pub unsafe fn read_cr3() -> usize {
+    let cr3: usize;
+    compiler_fence(Ordering::SeqCst);
+    asm!("mov {}, cr3", out(reg) cr3, options(nomem, nostack, preserves_flags));
+    compiler_fence(Ordering::SeqCst);
+    return cr3;
+}
+
+#[inline(always)]
+unsafe fn write_cr3(cr3: usize) {
+    compiler_fence(Ordering::SeqCst);
+    asm!("mov cr3, {}", in(reg) cr3, options(nostack, preserves_flags));
+    compiler_fence(Ordering::SeqCst);
+}
+
+/// 刷新当前PCID下所有的TLB条目（不影响其他PCID）
+#[inline(always)]
+pub unsafe fn flush_current_context() {
+    write_cr3(read_cr3() & !CR3_NOFLUSH);
+}
+
+/// 内核空间的映射被修改之后调用，使得所有PCID下缓存的内核TLB条目在下次使用前被刷新
+#[inline(always)]
+pub fn note_kernel_invalidate() {
+    if pcid_enabled() {
+        KERNEL_TLB_GEN.fetch_add(1, Ordering::SeqCst);
+    }
+}
+
+/// 在当前CPU上加载用户页表
+///
+/// ## 参数
+///
+/// - `cpu`：当前CPU的id
+/// - `table`：顶级页表的物理地址
+/// - `state`：地址空间的TLB状态
+///
+/// ## Safety
+///
+/// 调用者需要保证已经关闭了中断，并且在读取TLB代数之前，已经把当前CPU加入到了地址空间的CPU掩码中
+pub unsafe fn switch_user_table(cpu: usize, table: PhysAddr, state: &TlbState) {
+    if !pcid_enabled() {
+        write_cr3(table.data());
+        return;
+    }
+
+    let kernel_gen = KERNEL_TLB_GEN.load(Ordering::SeqCst);
+    let tlb_gen = state.tlb_gen();
+    let pcpu = &mut PCID_CPU_STATE[cpu];
+
+    let (index, need_flush) = match pcpu.slots.iter().position(|s| s.ctx_id == state.ctx_id()) {
+        Some(i) => {
+            let slot = &pcpu.slots[i];
+            (i, slot.tlb_gen != tlb_gen || slot.kernel_gen != kernel_gen)
+        }
+        None => {
+            let i = pcpu.next_victim;
+            pcpu.next_victim = (i + 1) % PCID_NR_DYNAMIC;
+            (i, true)
+        }
+    };
+
+    pcpu.slots[index] = PcidSlot {
+        ctx_id: state.ctx_id(),
+        tlb_gen,
+        kernel_gen,
+    };
+
+    let mut cr3 = table.data() | (index + 1);
+    if !need_flush {
+        cr3 |= CR3_NOFLUSH;
+    }
+    write_cr3(cr3);
+}
+
+/// 丢弃当前CPU上所有PCID槽的记录，使得之后切换到任何地址空间时都会刷新它的PCID
+///
+/// 用于不知道需要刷新哪个地址空间的场合。与[`note_kernel_invalidate`]不同，它只影响当前CPU
+///
+/// ## Safety
+///
+/// 调用者需要保证已经关闭了中断
+pub unsafe fn forget_contexts(cpu: usize) {
+    if !pcid_enabled() {
+        return;
+    }
+    let pcpu = &mut PCID_CPU_STATE[cpu];
+    for slot in pcpu.slots.iter_mut() {
+        *slot = PcidSlot::new();
+    }
+}
+
+/// 当前CPU已经处理完地址空间的某一次TLB刷新之后调用
+///
+/// 如果当前PCID属于这个地址空间，并且在此之前它的TLB条目是最新的，那么刷新之后仍然是最新的，
+/// 更新槽中记录的TLB代数，以免下次切换回来时进行不必要的刷新。
+///
+/// ## Safety
+///
+/// 调用者需要保证已经关闭了中断
+pub unsafe fn note_context_flushed(cpu: usize, ctx_id: u64, old_gen: u64, new_gen: u64) {
+    if !pcid_enabled() {
+        return;
+    }
+    let pcid = read_cr3() & CR3_PCID_MASK;
+    if pcid == 0 {
+        return;
+    }
+    let slot = &mut PCID_CPU_STATE[cpu].slots[pcid - 1];
+    if slot.ctx_id == ctx_id && slot.tlb_gen == old_gen {
+        slot.tlb_gen = new_gen;
+    }
+}
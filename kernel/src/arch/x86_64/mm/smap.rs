@@ -0,0 +1,101 @@
+//! SMAP（Supervisor Mode Access Prevention）支持
+//!
+//! 开启SMAP之后，内核态访问用户页面会触发缺页异常，除非RFLAGS.AC被置位。
+//! 内核有意访问用户空间的代码（[`super::usercopy`]中的拷贝函数）需要用[`UserAccessGuard`]包裹：
+//! 进入时执行`stac`，离开时执行`clac`。
+//!
+//! CPU支持SMAP时，拷贝函数总是执行`stac`/`clac`；但是只有开启了`smap`特性时，才会设置CR4.SMAP。
+//! 这是因为内核中仍然有一些地方（例如`UserBufferReader`/`UserBufferWriter`）直接解引用用户空间的指针，
+//! 在它们全部改为通过拷贝函数访问用户空间之前，开启SMAP会让这些访问触发异常。
+
+use core::{
+    arch::asm,
+    sync::atomic::{compiler_fence, AtomicBool, Ordering},
+};
+
+use x86::controlregs::{cr4, cr4_write, Cr4};
+
+use crate::kinfo;
+
+/// CPU是否支持SMAP（支持时才能执行`stac`/`clac`，否则会触发#UD）
+static SMAP_SUPPORTED: AtomicBool = AtomicBool::new(false);
+
+/// 判断CPU是否支持SMAP
+#[inline(always)]
+pub fn smap_supported() -> bool {
+    return SMAP_SUPPORTED.load(Ordering::Relaxed);
+}
+
+/// 在当前CPU上初始化SMAP
+///
+/// BSP调用时检测CPU是否支持SMAP；AP启动时调用，与BSP保持一致。
+pub unsafe fn smap_init_current_cpu(is_bsp: bool) {
+    if is_bsp {
+        let supported = x86::cpuid::CpuId::new()
+            .get_extended_feature_info()
+            .map(|f| f.has_smap())
+            .unwrap_or(false);
+        if !supported {
+            kinfo!("SMAP is not supported.");
+            return;
+        }
+        SMAP_SUPPORTED.store(true, Ordering::SeqCst);
+        if cfg!(feature = "smap") {
+            kinfo!("SMAP enabled.");
+        } else {
+            kinfo!("SMAP is supported, but not enabled (feature `smap` is off).");
+        }
+    } else if !smap_supported() {
+        return;
+    }
+
+    if cfg!(feature = "smap") {
+        // 进入内核时RFLAGS.AC可能仍然是用户态的值，这里先清除它
+        clac();
+        cr4_write(cr4() | Cr4::CR4_ENABLE_SMAP);
+    }
+}
+
+/// 允许内核态访问用户页面（置位RFLAGS.AC）
+#[inline(always)]
+fn stac() {
+    if smap_supported() {
+        compiler_fence(Ordering::SeqCst);
+        unsafe { asm!("stac", options(nomem, nostack)) };
+        compiler_fence(Ordering::SeqCst);
+    }
+}
+
+/// 禁止内核态访问用户页面（清除RFLAGS.AC）
+#[inline(always)]
+fn clac() {
+    if smap_supported() {
+        compiler_fence(Ordering::SeqCst);
+        unsafe { asm!("clac", options(nomem, nostack)) };
+        compiler_fence(Ordering::SeqCst);
+    }
+}
+
+/// 在它的生命周期内允许内核态访问用户页面
+///
+/// 被包裹的代码应当尽量短，只包含对已经检查过的用户地址的访问。
+/// 系统调用入口会清除RFLAGS.AC（见IA32_FMASK的设置），因此用户态无法把它带入内核
+#[derive(Debug)]
+pub struct UserAccessGuard {
+    _private: (),
+}
+
+impl UserAccessGuard {
+    #[inline(always)]
+    pub fn new() -> Self {
+        stac();
+        return Self { _private: () };
+    }
+}
+
+impl Drop for UserAccessGuard {
+    #[inline(always)]
+    fn drop(&mut self) {
+        clac();
+    }
+}
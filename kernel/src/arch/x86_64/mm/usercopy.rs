@@ -0,0 +1,183 @@
+//! 访问用户空间内存的拷贝函数
+//!
+//! 这些函数不会预先检查用户空间的每一个页面是否已经映射，而是直接进行拷贝。
+//! 如果拷贝的过程中发生了无法处理的缺页异常，异常表（见[`super::extable`]）会让拷贝提前结束，
+//! 并且返回还没有被拷贝的字节数。
+//!
+//! 如果CPU支持ERMS（Enhanced REP MOVSB/STOSB），则使用`rep movsb`/`rep stosb`完成整个拷贝；
+//! 否则，先使用`rep movsq`/`rep stosq`按8字节拷贝，再拷贝剩下的字节。
+//!
+//! 拷贝期间通过[`UserAccessGuard`]临时允许访问用户页面（见[`super::smap`]）。
+
+use core::{
+    arch::{global_asm, x86_64::__cpuid_count},
+    intrinsics::unlikely,
+    sync::atomic::{AtomicU8, Ordering},
+};
+
+use super::smap::UserAccessGuard;
+
+/// 还没有检测CPU的特性
+const COPY_MODE_UNKNOWN: u8 = 0;
+/// 不支持ERMS，使用`rep movsq`
+const COPY_MODE_MOVSQ: u8 = 1;
+/// 支持ERMS，但是短的`rep movsb`较慢，短拷贝仍然使用`rep movsq`
+const COPY_MODE_ERMS: u8 = 2;
+/// 支持FSRM（Fast Short REP MOV），任意长度都使用`rep movsb`
+const COPY_MODE_FSRM: u8 = 3;
+
+/// 只支持ERMS时，长度不小于这个值的拷贝才使用`rep movsb`
+const ERMS_MIN_LEN: usize = 64;
+
+static COPY_MODE: AtomicU8 = AtomicU8::new(COPY_MODE_UNKNOWN);
+
+extern "C" {
+    fn __copy_user_erms(dst: *mut u8, src: *const u8, len: usize) -> usize;
+    fn __copy_user_movsq(dst: *mut u8, src: *const u8, len: usize) -> usize;
+    fn __clear_user_erms(dst: *mut u8, len: usize) -> usize;
+    fn __clear_user_stosq(dst: *mut u8, len: usize) -> usize;
+}
+
+// 所有的函数都在rax中返回还没有被处理的字节数。
+// 触发缺页异常时，rep指令的rcx中正好是剩余的次数，因此修复代码只需要根据rcx计算剩余的字节数
+global_asm!(
+    ".pushsection .text.__dragonos_usercopy, \"ax\"",
+    ".balign 16",
+    ".global __copy_user_erms",
+    "__copy_user_erms:",
+    "    mov rcx, rdx",
+    ".Lcopy_erms_insn:",
+    "    rep movsb",
+    ".Lcopy_erms_done:",
+    "    mov rax, rcx",
+    "    ret",
+    "",
+    ".balign 16",
+    ".global __copy_user_movsq",
+    "__copy_user_movsq:",
+    "    mov rcx, rdx",
+    "    shr rcx, 3",
+    "    and edx, 7",
+    ".Lcopy_movsq_insn:",
+    "    rep movsq",
+    "    mov ecx, edx",
+    ".Lcopy_movsq_tail:",
+    "    rep movsb",
+    ".Lcopy_movsq_done:",
+    "    mov rax, rcx",
+    "    ret",
+    // 按8字节拷贝时发生了异常：改为逐字节拷贝剩下的部分，以便准确地停在出错的字节上
+    ".Lcopy_movsq_fixup:",
+    "    lea rcx, [rdx + rcx * 8]",
+    "    jmp .Lcopy_movsq_tail",
+    "",
+    ".balign 16",
+    ".global __clear_user_erms",
+    "__clear_user_erms:",
+    "    xor eax, eax",
+    "    mov rcx, rsi",
+    ".Lclear_erms_insn:",
+    "    rep stosb",
+    ".Lclear_erms_done:",
+    "    mov rax, rcx",
+    "    ret",
+    "",
+    ".balign 16",
+    ".global __clear_user_stosq",
+    "__clear_user_stosq:",
+    "    xor eax, eax",
+    "    mov rcx, rsi",
+    "    shr rcx, 3",
+    "    and esi, 7",
+    ".Lclear_stosq_insn:",
+    "    rep stosq",
+    "    mov ecx, esi",
+    ".Lclear_stosq_tail:",
+    "    rep stosb",
+    ".Lclear_stosq_done:",
+    "    mov rax, rcx",
+    "    ret",
+    ".Lclear_stosq_fixup:",
+    "    lea rcx, [rsi + rcx * 8]",
+    "    jmp .Lclear_stosq_tail",
+    ".popsection",
+    "",
+    ".pushsection __ex_table, \"a\"",
+    ".balign 8",
+    ".quad .Lcopy_erms_insn, .Lcopy_erms_done",
+    ".quad .Lcopy_movsq_insn, .Lcopy_movsq_fixup",
+    ".quad .Lcopy_movsq_tail, .Lcopy_movsq_done",
+    ".quad .Lclear_erms_insn, .Lclear_erms_done",
+    ".quad .Lclear_stosq_insn, .Lclear_stosq_fixup",
+    ".quad .Lclear_stosq_tail, .Lclear_stosq_done",
+    ".popsection",
+);
+
+#[inline(always)]
+fn copy_mode() -> u8 {
+    let mode = COPY_MODE.load(Ordering::Relaxed);
+    if unlikely(mode == COPY_MODE_UNKNOWN) {
+        return detect_copy_mode();
+    }
+    return mode;
+}
+
+#[inline(never)]
+fn detect_copy_mode() -> u8 {
+    let max_leaf = unsafe { __cpuid_count(0, 0) }.eax;
+    let mode = if max_leaf < 7 {
+        COPY_MODE_MOVSQ
+    } else {
+        let r = unsafe { __cpuid_count(7, 0) };
+        // CPUID.(EAX=07H,ECX=0):EDX[4] FSRM, EBX[9] ERMS
+        if r.edx & (1 << 4) != 0 {
+            COPY_MODE_FSRM
+        } else if r.ebx & (1 << 9) != 0 {
+            COPY_MODE_ERMS
+        } else {
+            COPY_MODE_MOVSQ
+        }
+    };
+    COPY_MODE.store(mode, Ordering::Relaxed);
+    return mode;
+}
+
+#[inline(always)]
+fn use_erms(len: usize) -> bool {
+    let mode = copy_mode();
+    return mode == COPY_MODE_FSRM || (mode == COPY_MODE_ERMS && len >= ERMS_MIN_LEN);
+}
+
+/// 在内核空间与用户空间之间拷贝数据
+///
+/// ## 返回值
+///
+/// 返回没有被拷贝的字节数，0表示全部拷贝成功
+///
+/// ## Safety
+///
+/// 调用者需要保证内核空间的那一侧是合法的，并且已经检查过用户空间的地址范围
+pub unsafe fn copy_user_generic(dst: *mut u8, src: *const u8, len: usize) -> usize {
+    let _guard = UserAccessGuard::new();
+    if use_erms(len) {
+        return __copy_user_erms(dst, src, len);
+    }
+    return __copy_user_movsq(dst, src, len);
+}
+
+/// 清空用户空间的数据
+///
+/// ## 返回值
+///
+/// 返回没有被清空的字节数，0表示全部清空成功
+///
+/// ## Safety
+///
+/// 调用者需要保证已经检查过用户空间的地址范围
+pub unsafe fn clear_user_generic(dst: *mut u8, len: usize) -> usize {
+    let _guard = UserAccessGuard::new();
+    if use_erms(len) {
+        return __clear_user_erms(dst, len);
+    }
+    return __clear_user_stosq(dst, len);
+}
@@ -12,6 +12,7 @@ pub mod libs;
 pub mod mm;
 pub mod msi;
 pub mod pci;
+pub mod pmu;
 pub mod process;
 pub mod rand;
 pub mod sched;
@@ -19,6 +20,7 @@ pub mod setup;
 pub mod smp;
 pub mod syscall;
 pub mod time;
+pub mod vdso;
 
 pub use self::pci::pci::X86_64PciArch as PciArch;
 
@@ -0,0 +1,179 @@
+//! x86_64的性能监控单元（PMU）
+//!
+//! 只支持Intel的架构性能监控（CPUID.0AH，版本2及以上）的通用计数器。计数器溢出时，
+//! Local APIC通过LVT性能监控计数器寄存器向当前cpu投递NMI，因此关中断的代码也能被采样。
+//!
+//! 这里的函数都只操作当前cpu的PMU，调用者需要保证执行期间不会被迁移到其他cpu
+
+use x86::{
+    cpuid::{cpuid, CpuIdResult},
+    msr::{rdmsr, wrmsr},
+};
+
+use crate::arch::driver::apic::{CurrentApic, DeliveryMode, LVTRegister, LocalAPIC, LVT};
+
+/// 支持的通用计数器的最大数量
+pub const PMU_MAX_COUNTERS: usize = 8;
+
+const MSR_IA32_PMC0: u32 = 0xc1;
+const MSR_IA32_PERFEVTSEL0: u32 = 0x186;
+const MSR_IA32_PERF_GLOBAL_STATUS: u32 = 0x38e;
+const MSR_IA32_PERF_GLOBAL_CTRL: u32 = 0x38f;
+const MSR_IA32_PERF_GLOBAL_OVF_CTRL: u32 = 0x390;
+
+/// 在用户态计数
+pub const EVTSEL_USR: u64 = 1 << 16;
+/// 在内核态计数
+pub const EVTSEL_OS: u64 = 1 << 17;
+/// 溢出时产生中断
+const EVTSEL_INT: u64 = 1 << 20;
+const EVTSEL_EN: u64 = 1 << 22;
+/// 事件选择寄存器中，由用户（PERF_TYPE_RAW）指定的部分：事件号、umask、edge、inv、cmask
+pub const EVTSEL_RAW_MASK: u64 = 0xff00_ffff | (1 << 18) | (1 << 23);
+
+/// PMU的能力
+#[derive(Debug, Clone, Copy)]
+pub struct PmuInfo {
+    /// 架构性能监控的版本
+    pub version: u8,
+    /// 通用计数器的数量（不超过[`PMU_MAX_COUNTERS`]）
+    pub nr_counters: usize,
+    /// 通用计数器的位宽
+    pub counter_width: u32,
+    /// CPUID.0AH:EBX，第i位为1表示第i个架构事件不可用
+    unavailable: u32,
+}
+
+impl PmuInfo {
+    /// 计数器可以表示的最大值
+    #[inline]
+    pub fn counter_mask(&self) -> u64 {
+        return (1u64 << self.counter_width) - 1;
+    }
+}
+
+/// 读取当前cpu的PMU的能力，不支持架构性能监控（版本2及以上）时返回None
+pub fn pmu_info() -> Option<PmuInfo> {
+    let max_leaf: CpuIdResult = cpuid!(0x0);
+    if max_leaf.eax < 0xa {
+        return None;
+    }
+    let res: CpuIdResult = cpuid!(0xa);
+    let version = (res.eax & 0xff) as u8;
+    let nr_counters = ((res.eax >> 8) & 0xff) as usize;
+    let counter_width = (res.eax >> 16) & 0xff;
+    let ebx_len = (res.eax >> 24) & 0xff;
+    // 版本1没有全局控制寄存器
+    if version < 2 || nr_counters == 0 || counter_width < 32 {
+        return None;
+    }
+    // EBX中只有前ebx_len位有效，其余的事件视为不可用
+    let valid = if ebx_len >= 32 {
+        u32::MAX
+    } else {
+        (1u32 << ebx_len) - 1
+    };
+    return Some(PmuInfo {
+        version,
+        nr_counters: nr_counters.min(PMU_MAX_COUNTERS),
+        counter_width: counter_width.min(63),
+        unavailable: res.ebx | !valid,
+    });
+}
+
+/// 把perf的硬件事件（PERF_COUNT_HW_*）转换为事件选择寄存器中的事件号和umask
+///
+/// 只支持CPUID.0AH中定义的架构事件
+pub fn pmu_hw_event(info: &PmuInfo, config: u64) -> Option<u64> {
+    // (事件号 | umask << 8, CPUID.0AH:EBX中的位)
+    let (evtsel, bit) = match config {
+        // cpu-cycles：UnHalted Core Cycles
+        0 => (0x003c, 0),
+        // instructions：Instructions Retired
+        1 => (0x00c0, 1),
+        // cache-references：LLC Reference
+        2 => (0x4f2e, 3),
+        // cache-misses：LLC Misses
+        3 => (0x412e, 4),
+        // branch-instructions：Branch Instruction Retired
+        4 => (0x00c4, 5),
+        // branch-misses：Branch Misses Retired
+        5 => (0x00c5, 6),
+        _ => return None,
+    };
+    if info.unavailable & (1 << bit) != 0 {
+        return None;
+    }
+    return Some(evtsel);
+}
+
+/// 把当前cpu的LVT性能监控计数器寄存器设置为投递NMI
+///
+/// 每次投递之后，LVT会被硬件自动屏蔽，因此每次处理完溢出之后都需要重新调用
+pub fn pmu_lvt_unmask() {
+    let lvt = LVT::new(
+        LVTRegister::PerformanceMonitor,
+        (DeliveryMode::NMI as u32) << 8,
+    )
+    .unwrap();
+    CurrentApic.set_lvt(lvt);
+}
+
+/// 启动当前cpu的第`idx`个计数器
+///
+/// ## 参数
+///
+/// - `evtsel`：事件选择寄存器的值（事件号、umask、USR/OS），使能位和中断位由这里设置
+/// - `start`：计数器的初值。计数器从这个值开始递增，越过最大值时溢出
+pub fn pmu_counter_start(idx: usize, evtsel: u64, start: u64) {
+    unsafe {
+        wrmsr(MSR_IA32_PERFEVTSEL0 + idx as u32, 0);
+        wrmsr(MSR_IA32_PMC0 + idx as u32, start);
+        wrmsr(
+            MSR_IA32_PERFEVTSEL0 + idx as u32,
+            evtsel | EVTSEL_INT | EVTSEL_EN,
+        );
+        let ctrl = rdmsr(MSR_IA32_PERF_GLOBAL_CTRL);
+        wrmsr(MSR_IA32_PERF_GLOBAL_CTRL, ctrl | (1 << idx));
+    }
+}
+
+/// 停止当前cpu的第`idx`个计数器，返回计数器的值
+pub fn pmu_counter_stop(idx: usize) -> u64 {
+    unsafe {
+        let ctrl = rdmsr(MSR_IA32_PERF_GLOBAL_CTRL);
+        wrmsr(MSR_IA32_PERF_GLOBAL_CTRL, ctrl & !(1 << idx));
+        wrmsr(MSR_IA32_PERFEVTSEL0 + idx as u32, 0);
+        let value = rdmsr(MSR_IA32_PMC0 + idx as u32);
+        wrmsr(MSR_IA32_PERF_GLOBAL_OVF_CTRL, 1 << idx);
+        return value;
+    }
+}
+
+/// 读取当前cpu的第`idx`个计数器
+#[inline]
+pub fn pmu_counter_read(idx: usize) -> u64 {
+    return unsafe { rdmsr(MSR_IA32_PMC0 + idx as u32) };
+}
+
+/// 重新设置当前cpu的第`idx`个计数器的值（溢出之后重新开始计数）
+#[inline]
+pub fn pmu_counter_write(idx: usize, value: u64) {
+    unsafe { wrmsr(MSR_IA32_PMC0 + idx as u32, value) };
+}
+
+/// 读取并清除当前cpu上通用计数器的溢出标志
+///
+/// ## 返回值
+///
+/// 第i位为1表示第i个计数器溢出了
+pub fn pmu_ack_overflow() -> u64 {
+    let mask = (1u64 << PMU_MAX_COUNTERS) - 1;
+    unsafe {
+        let status = rdmsr(MSR_IA32_PERF_GLOBAL_STATUS) & mask;
+        if status != 0 {
+            wrmsr(MSR_IA32_PERF_GLOBAL_OVF_CTRL, status);
+        }
+        return status;
+    }
+}
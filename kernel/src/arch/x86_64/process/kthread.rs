@@ -29,17 +29,7 @@ impl KernelThreadMechanism {
         let create_info: *const KernelThreadCreateInfo =
             KernelThreadCreateInfo::generate_unsafe_arc_ptr(info.clone());
 
-        let mut frame = TrapFrame::new();
-        frame.rbx = create_info as usize as u64;
-        frame.ds = KERNEL_DS.bits() as u64;
-        frame.es = KERNEL_DS.bits() as u64;
-        frame.cs = KERNEL_CS.bits() as u64;
-        frame.ss = KERNEL_DS.bits() as u64;
-
-        // 使能中断
-        frame.rflags |= 1 << 9;
-
-        frame.rip = kernel_thread_bootstrap_stage1 as usize as u64;
+        let mut frame = Self::bootstrap_trapframe(create_info);
 
         // fork失败的话，子线程不会执行。否则将导致内存安全问题。
         let pid = ProcessManager::fork(&mut frame, clone_flags).map_err(|e| {
@@ -53,6 +43,23 @@ impl KernelThreadMechanism {
 
         return Ok(pid);
     }
+
+    /// 伪造内核线程开始执行时的trapframe：新线程从`kernel_thread_bootstrap_stage1`开始执行，
+    /// 然后运行`create_info`中的闭包
+    pub fn bootstrap_trapframe(create_info: *const KernelThreadCreateInfo) -> TrapFrame {
+        let mut frame = TrapFrame::new();
+        frame.rbx = create_info as usize as u64;
+        frame.ds = KERNEL_DS.bits() as u64;
+        frame.es = KERNEL_DS.bits() as u64;
+        frame.cs = KERNEL_CS.bits() as u64;
+        frame.ss = KERNEL_DS.bits() as u64;
+
+        // 使能中断
+        frame.rflags |= 1 << 9;
+
+        frame.rip = kernel_thread_bootstrap_stage1 as usize as u64;
+        return frame;
+    }
 }
 
 /// 内核线程引导函数的第一阶段
@@ -271,20 +271,30 @@ impl ArchPCBInfo {
 }
 
 impl ProcessControlBlock {
-    /// 获取当前进程的pcb
-    pub fn arch_current_pcb() -> Arc<Self> {
+    /// 获取当前进程的pcb的地址，不改变引用计数
+    ///
+    /// 内核栈的最低地址处保存着pcb的Weak指针（即pcb的地址）。内核栈按`KernelStack::ALIGN`对齐，
+    /// 因此只需要把栈指针向下对齐，就能得到它。进程在自己的内核栈上运行期间，pcb一定不会被释放
+    #[inline(always)]
+    pub fn arch_current_pcb_ptr() -> *const Self {
         // 获取栈指针
         let ptr = VirtAddr::new(x86::current::registers::rsp() as usize);
         let stack_base = VirtAddr::new(ptr.data() & (!(KernelStack::ALIGN - 1)));
         // 从内核栈的最低地址处取出pcb的地址
-        let p = stack_base.data() as *const *const ProcessControlBlock;
-        if unlikely((unsafe { *p }).is_null()) {
+        let p = unsafe { *(stack_base.data() as *const *const ProcessControlBlock) };
+        if unlikely(p.is_null()) {
             panic!("current_pcb is null");
         }
+        return p;
+    }
+
+    /// 获取当前进程的pcb
+    pub fn arch_current_pcb() -> Arc<Self> {
+        let p = Self::arch_current_pcb_ptr();
         unsafe {
             // 为了防止内核栈的pcb weak 指针被释放，这里需要将其包装一下
             let weak_wrapper: ManuallyDrop<Weak<ProcessControlBlock>> =
-                ManuallyDrop::new(Weak::from_raw(*p));
+                ManuallyDrop::new(Weak::from_raw(p));
 
             let new_arc: Arc<ProcessControlBlock> = weak_wrapper.upgrade().unwrap();
             return new_arc;
@@ -392,11 +402,13 @@ impl ProcessManager {
         // 切换gsbase
         Self::switch_gsbase(&prev, &next);
 
-        // 切换地址空间
+        // 切换地址空间（不获取地址空间的锁，以免与持有锁并正在等待TLB shootdown的cpu发生死锁）
+        let prev_addr_space = prev.basic().user_vm();
         let next_addr_space = next.basic().user_vm().as_ref().unwrap().clone();
         compiler_fence(Ordering::SeqCst);
 
-        next_addr_space.read().user_mapper.utable.make_current();
+        next_addr_space.activate(prev_addr_space.as_deref());
+        drop(prev_addr_space);
         drop(next_addr_space);
         compiler_fence(Ordering::SeqCst);
         // 切换内核栈
@@ -408,8 +420,8 @@ impl ProcessManager {
         (*prev_arch).rip = switch_back as usize;
 
         // 恢复当前的 preempt count*2
-        ProcessManager::current_pcb().preempt_enable();
-        ProcessManager::current_pcb().preempt_enable();
+        ProcessManager::current().preempt_enable();
+        ProcessManager::current().preempt_enable();
 
         // 切换tss
         TSSManager::current_tss().set_rsp(
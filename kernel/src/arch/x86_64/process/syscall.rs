@@ -33,6 +33,9 @@ impl Syscall {
         //     envp
         // );
 
+        // 原来的rseq注册在新的地址空间中没有意义
+        pcb.rseq().on_exec();
+
         let mut basic_info = pcb.basic_mut();
         // 暂存原本的用户地址空间的引用(因为如果在切换页表之前释放了它，可能会造成内存use after free)
         let old_address_space = basic_info.user_vm();
@@ -57,10 +60,12 @@ impl Syscall {
         // kdebug!("Switch to new address space");
 
         // 切换到新的用户地址空间
-        unsafe { address_space.read().user_mapper.utable.make_current() };
+        unsafe { address_space.activate(old_address_space.as_deref()) };
 
         drop(old_address_space);
         drop(irq_guard);
+        // 已经切换到新的地址空间，vfork的父进程可以继续运行了
+        ProcessManager::vfork_release(&pcb);
         // kdebug!("to load binary file");
         let mut param = ExecParam::new(path.as_str(), address_space.clone(), ExecParamFlags::EXEC);
 
@@ -73,18 +78,28 @@ impl Syscall {
         param.init_info_mut().envs = envp;
 
         // 把proc_init_info写到用户栈上
-
+        // 用户栈的页面在缺页时才分配，而缺页处理需要获取地址空间的锁，
+        // 因此写入用户栈的时候不能持有地址空间的锁
+        let mut ustack = unsafe {
+            address_space
+                .write()
+                .user_stack_mut()
+                .expect("No user stack found")
+                .clone_info_only()
+        };
         let (user_sp, argv_ptr) = unsafe {
             param
                 .init_info()
-                .push_at(
-                    address_space
-                        .write()
-                        .user_stack_mut()
-                        .expect("No user stack found"),
-                )
+                .push_at(&mut ustack)
                 .expect("Failed to push proc_init_info to user stack")
         };
+        unsafe {
+            address_space
+                .write()
+                .user_stack_mut()
+                .expect("No user stack found")
+                .set_sp(user_sp)
+        };
 
         // kdebug!("write proc_init_info to user stack done");
 
@@ -1,38 +1,98 @@
-use core::arch::x86_64::_rdtsc;
-
-use alloc::vec::Vec;
+use core::{
+    arch::x86_64::_rdtsc,
+    sync::atomic::{AtomicU8, Ordering},
+};
 
 use crate::{
-    libs::rand::GRandFlags,
+    libs::rand::{get_random_bytes, get_random_u64, GRandFlags},
     syscall::{user_access::UserBufferWriter, Syscall, SystemError},
 };
 
+/// 获取一个随机数，由当前CPU的ChaCha20生成器产生
 pub fn rand() -> usize {
-    return unsafe { (_rdtsc() * _rdtsc() + 998244353_u64 * _rdtsc()) as usize };
+    return get_random_u64() as usize;
+}
+
+const HWRNG_UNKNOWN: u8 = 0;
+const HWRNG_NONE: u8 = 1;
+const HWRNG_RDRAND: u8 = 2;
+const HWRNG_RDSEED: u8 = 3;
+
+/// CPU支持的硬件随机数指令，第一次使用时通过cpuid检测（在虚拟机中cpuid会导致VM exit，因此只检测一次）
+static HWRNG: AtomicU8 = AtomicU8::new(HWRNG_UNKNOWN);
+
+fn hwrng() -> u8 {
+    let mut kind = HWRNG.load(Ordering::Relaxed);
+    if kind == HWRNG_UNKNOWN {
+        kind = if x86::random::has_rdseed() {
+            HWRNG_RDSEED
+        } else if x86::random::has_rdrand() {
+            HWRNG_RDRAND
+        } else {
+            HWRNG_NONE
+        };
+        HWRNG.store(kind, Ordering::Relaxed);
+    }
+    return kind;
+}
+
+/// 从RDSEED（不可用时用RDRAND）读取一个64位的随机数，指令暂时没有数据时重试
+fn hw_random_u64() -> Option<u64> {
+    let kind = hwrng();
+    let mut value = 0u64;
+    for _ in 0..10 {
+        let ok = match kind {
+            HWRNG_RDSEED => unsafe {
+                x86::random::rdseed64(&mut value) || x86::random::rdrand64(&mut value)
+            },
+            HWRNG_RDRAND => unsafe { x86::random::rdrand64(&mut value) },
+            _ => return None,
+        };
+        if ok {
+            return Some(value);
+        }
+        core::hint::spin_loop();
+    }
+    return None;
+}
+
+/// 收集TSC的抖动：反复读取TSC，把相邻两次读数之差混合起来
+fn tsc_jitter() -> u64 {
+    let mut acc = unsafe { _rdtsc() };
+    for _ in 0..64 {
+        let t1 = unsafe { _rdtsc() };
+        core::hint::spin_loop();
+        let t2 = unsafe { _rdtsc() };
+        acc = (acc ^ t2.wrapping_sub(t1))
+            .rotate_left(7)
+            .wrapping_mul(0x9e37_79b9_7f4a_7c15);
+    }
+    return acc;
+}
+
+/// 为内核的随机数生成器收集熵
+///
+/// 每个字都混合了硬件随机数（如果CPU支持）和TSC抖动
+pub fn arch_entropy(out: &mut [u64; 4]) {
+    for word in out.iter_mut() {
+        *word = hw_random_u64().unwrap_or(0) ^ tsc_jitter();
+    }
 }
 
 impl Syscall {
     /// ## 将随机字节填入buf
     ///
-    /// ### 该系统调用与linux不一致，因为目前没有其他随机源
+    /// 内核的生成器在第一次使用时就已经播种，因此不会阻塞，`GRND_NONBLOCK`和`GRND_RANDOM`不影响结果
     pub fn get_random(buf: *mut u8, len: usize, flags: GRandFlags) -> Result<usize, SystemError> {
         if flags.bits() == (GRandFlags::GRND_INSECURE.bits() | GRandFlags::GRND_RANDOM.bits()) {
             return Err(SystemError::EINVAL);
         }
-
-        let mut writer = UserBufferWriter::new(buf, len, true)?;
-
-        let mut ret = Vec::new();
-        let mut count = 0;
-        while count < len {
-            let rand = rand();
-            for offset in 0..4 {
-                ret.push((rand >> offset * 2) as u8);
-                count += 1;
-            }
+        if len == 0 {
+            return Ok(0);
         }
 
-        writer.copy_to_user(&ret, 0)?;
-        Ok(len)
+        let mut writer = UserBufferWriter::new(buf, len, true)?;
+        get_random_bytes(writer.buffer::<u8>(0)?);
+        return Ok(len);
     }
 }
@@ -1,10 +1,43 @@
-use crate::syscall::SystemError;
+use core::ffi::c_void;
 
-use super::{acpi::early_acpi_boot_init, smp::X86_64_SMP_MANAGER};
+use alloc::string::String;
+
+use crate::{
+    include::bindings::bindings::{
+        multiboot2_get_cmdline, multiboot2_iter, MULTIBOOT2_CMDLINE_MAX,
+    },
+    syscall::SystemError,
+};
+
+use super::{
+    acpi::{acpi_numa_init, early_acpi_boot_init},
+    asm::mem::mem_init,
+    fpu::fpu_init_current_cpu,
+    smp::X86_64_SMP_MANAGER,
+};
 
 /// 进行架构相关的初始化工作
 pub fn setup_arch() -> Result<(), SystemError> {
+    mem_init();
     early_acpi_boot_init()?;
+    acpi_numa_init();
     X86_64_SMP_MANAGER.build_cpu_map()?;
+    // 在第一次切换进程之前选择浮点状态的保存方式
+    fpu_init_current_cpu(true);
     return Ok(());
 }
+
+/// 获取bootloader传递的内核命令行。没有命令行时返回空字符串
+pub fn boot_cmdline() -> String {
+    let mut buf = [0u8; MULTIBOOT2_CMDLINE_MAX as usize];
+    let mut len: u32 = 0;
+    unsafe {
+        multiboot2_iter(
+            Some(multiboot2_get_cmdline),
+            buf.as_mut_ptr() as *mut c_void,
+            &mut len,
+        )
+    };
+    let len = (len as usize).min(buf.len());
+    return String::from_utf8_lossy(&buf[..len]).into_owned();
+}
@@ -12,7 +12,12 @@ use crate::{
     process::ProcessManager, smp::core::smp_get_processor_id, syscall::SystemError,
 };
 
-use super::CurrentIrqArch;
+use super::{
+    fpu::fpu_init_current_cpu,
+    mm::{pat::pat_init_current_cpu, pcid::pcid_init_current_cpu, smap::smap_init_current_cpu},
+    vdso::vdso_init_current_cpu,
+    CurrentIrqArch,
+};
 
 extern "C" {
     fn smp_ap_start_stage2();
@@ -60,6 +65,13 @@ unsafe extern "C" fn smp_ap_start_stage1() -> ! {
     );
     TSSManager::load_tr();
 
+    // 与BSP保持一致，设置PAT、开启PCID和SMAP
+    pat_init_current_cpu(false);
+    pcid_init_current_cpu(false);
+    smap_init_current_cpu(false);
+    vdso_init_current_cpu();
+    fpu_init_current_cpu(false);
+
     smp_ap_start_stage2();
     loop {
         spin_loop();
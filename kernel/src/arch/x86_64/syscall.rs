@@ -7,7 +7,8 @@ use crate::{
     ipc::signal_types::SignalArch,
     libs::align::SafeForZero,
     mm::VirtAddr,
-    process::ProcessManager,
+    process::{rseq::rseq_exit_to_user, ProcessManager},
+    sched::cputime::{cputime_switch, CpuTimeContext},
     syscall::{Syscall, SystemError, SYS_RT_SIGRETURN},
 };
 use alloc::string::String;
@@ -67,12 +68,19 @@ macro_rules! syscall_return {
         unsafe {
             CurrentIrqArch::interrupt_disable();
         }
+        rseq_exit_to_user($regs);
+        if $regs.from_user() {
+            cputime_switch(CpuTimeContext::User);
+        }
         return;
     }};
 }
 
 #[no_mangle]
 pub extern "sysv64" fn syscall_handler(frame: &mut TrapFrame) -> () {
+    if frame.from_user() {
+        cputime_switch(CpuTimeContext::System);
+    }
     unsafe {
         CurrentIrqArch::interrupt_enable();
     }
@@ -0,0 +1,318 @@
+//! vDSO（virtual dynamic shared object）
+//!
+//! vDSO是内核提供给每个用户进程的一个很小的共享库（源代码位于本目录下的`vdso.c`，由构建脚本单独编译、链接），
+//! 其中的`clock_gettime`、`gettimeofday`、`time`、`getcpu`可以直接在用户态完成，不需要陷入内核。
+//!
+//! 每个进程的地址空间中会映射两个区域：
+//!
+//! - vvar页（只读）：保存着内核每个时钟周期更新一次的时间数据，使用顺序锁保护
+//! - vDSO镜像（只读、可执行）：紧跟在vvar页之后，镜像通过相对于自身的地址访问vvar页
+//!
+//! 这些物理页由所有进程共享，永远不会被释放（参见[`VmFlags::VM_SPECIAL`]）。
+//! 程序加载时，通过辅助向量中的`AT_SYSINFO_EHDR`告诉用户程序vDSO的地址。
+
+use core::sync::atomic::{fence, AtomicU32, Ordering};
+
+use x86::msr::{wrmsr, IA32_TSC_AUX};
+
+use crate::{
+    arch::{cpu::cpu_has_rdtscp, driver::tsc::TSCManager, mm::LockedFrameAllocator, MMArch},
+    kinfo,
+    libs::{align::page_align_up, lazy_init::Lazy, spinlock::SpinLock},
+    mm::{
+        allocator::page_frame::{FrameAllocator, PageFrameCount, PhysPageFrame},
+        numa::cpu_to_node,
+        syscall::{MapFlags, ProtFlags},
+        ucontext::{InnerAddressSpace, VmFlags, VMA},
+        MemoryManagementArch, PhysAddr, VirtAddr,
+    },
+    smp::core::smp_get_processor_id,
+    syscall::SystemError,
+    time::{syscall::SYS_TIMEZONE, timekeeping::getnstimeofday, TimeArch, TimeSpec, NSEC_PER_SEC},
+};
+
+use super::CurrentTimeArch;
+
+/// 由构建脚本编译出来的vDSO镜像
+static VDSO_IMAGE: &[u8] = include_bytes!(env!("DRAGONOS_VDSO_IMAGE"));
+
+/// vDSO默认映射在用户栈的上方，与用户栈的起始地址之间的距离。如果被占用了，就另外找一个空闲的区域
+const VDSO_STACK_GAP: usize = 2 << 20;
+
+/// 把TSC的增量换算为纳秒时使用的移位
+const VDSO_MULT_SHIFT: u32 = 32;
+/// vvar页中的墙上时间与RTC的偏差超过这个值时，才重新设置（RTC的精度只有1秒）
+const VDSO_WALL_RESYNC_NS: i64 = NSEC_PER_SEC as i64;
+
+/// 不能在用户态读取时钟，需要回退到系统调用
+const VDSO_CLOCKMODE_NONE: u32 = 0;
+/// 使用TSC计时
+const VDSO_CLOCKMODE_TSC: u32 = 1;
+/// 不能在用户态获取cpu号
+const VDSO_GETCPU_NONE: u32 = 0;
+/// 使用rdtscp指令读取IA32_TSC_AUX中的cpu号和节点号
+const VDSO_GETCPU_RDTSCP: u32 = 1;
+
+/// vvar页中的数据
+///
+/// 内存布局必须与`vdso_data.h`中的`struct vdso_data`保持一致
+#[repr(C)]
+#[derive(Debug)]
+struct VdsoData {
+    /// 顺序锁的序号，为奇数时表示内核正在更新
+    seq: AtomicU32,
+    clock_mode: u32,
+    /// 上次更新时的TSC读数
+    cycle_last: u64,
+    /// 把TSC的增量换算为纳秒：ns = delta * mult >> shift
+    mult: u64,
+    shift: u32,
+    getcpu_mode: u32,
+    /// 上次更新时的单调时间（纳秒，与[`crate::time::hrtimer::hrtimer_now`]相同）
+    mono_ns: u64,
+    /// 墙上时间与单调时间的差（纳秒）
+    wall_offset_ns: i64,
+    tz_minuteswest: i32,
+    tz_dsttime: i32,
+}
+
+/// vDSO使用的物理页
+#[derive(Debug)]
+struct VdsoPages {
+    /// vvar页的物理地址
+    vvar: PhysAddr,
+    /// vvar页在内核中的虚拟地址
+    vvar_vaddr: VirtAddr,
+    /// vDSO镜像的起始物理地址
+    image: PhysAddr,
+    /// vDSO镜像占用的页数
+    image_pages: PageFrameCount,
+}
+
+static VDSO_PAGES: Lazy<VdsoPages> = Lazy::new();
+/// 保证同一时刻只有一个写者更新vvar页
+static VVAR_WRITE_LOCK: SpinLock<()> = SpinLock::new(());
+
+impl VdsoPages {
+    fn data(&self) -> &'static mut VdsoData {
+        return unsafe { &mut *(self.vvar_vaddr.data() as *mut VdsoData) };
+    }
+}
+
+/// 在顺序锁的保护下更新vvar页
+fn vvar_write<F: FnOnce(&mut VdsoData)>(f: F) {
+    let pages = match VDSO_PAGES.try_get() {
+        Some(pages) => pages,
+        None => return,
+    };
+    let _guard = VVAR_WRITE_LOCK.lock_irqsave();
+    let data = pages.data();
+    let seq = data.seq.load(Ordering::Relaxed);
+    data.seq.store(seq.wrapping_add(1), Ordering::Relaxed);
+    fence(Ordering::Release);
+    f(data);
+    data.seq.store(seq.wrapping_add(2), Ordering::Release);
+}
+
+/// 读取TSC，以及与之对应的单调时间（纳秒）
+fn tsc_now(tsc_khz: u64) -> (u64, u64) {
+    let cycles = CurrentTimeArch::get_cycles() as u64;
+    return (
+        cycles,
+        (cycles as u128 * 1_000_000 / tsc_khz as u128) as u64,
+    );
+}
+
+fn timespec_to_ns(ts: &TimeSpec) -> i64 {
+    return ts.tv_sec * NSEC_PER_SEC as i64 + ts.tv_nsec;
+}
+
+/// 更新vvar页中的时间基准。在`update_wall_time`中调用
+///
+/// 更新得越频繁，用户态需要外推的TSC增量就越小
+pub fn vdso_update_time() {
+    let tsc_khz = TSCManager::tsc_khz();
+    if tsc_khz == 0 {
+        return;
+    }
+    vvar_write(|data| {
+        if data.clock_mode != VDSO_CLOCKMODE_TSC {
+            return;
+        }
+        let (cycles, mono_ns) = tsc_now(tsc_khz);
+        data.cycle_last = cycles;
+        data.mono_ns = mono_ns;
+    });
+}
+
+/// 内核的墙上时间被重新同步之后调用
+///
+/// 用户态的墙上时间等于单调时间加上一个固定的偏移量，在两次同步之间由TSC推进。
+/// 只有当它与内核的墙上时间相差超过RTC的精度时，才调整偏移量，避免用户态的时间来回跳动。
+pub fn vdso_sync_wall_time(wall: TimeSpec) {
+    let tsc_khz = TSCManager::tsc_khz();
+    if tsc_khz == 0 {
+        return;
+    }
+    vvar_write(|data| {
+        let (_, mono_ns) = tsc_now(tsc_khz);
+        let offset = timespec_to_ns(&wall) - mono_ns as i64;
+        if (offset - data.wall_offset_ns).abs() > VDSO_WALL_RESYNC_NS {
+            data.wall_offset_ns = offset;
+        }
+    });
+}
+
+/// IA32_TSC_AUX中节点号的偏移（低12位为cpu号，与Linux相同）
+const TSC_AUX_NODE_SHIFT: u64 = 12;
+
+/// 设置当前cpu的IA32_TSC_AUX，使得vDSO能通过rdtscp获取cpu号和NUMA节点号
+///
+/// 每个cpu启动时都需要调用一次
+pub fn vdso_init_current_cpu() {
+    if cpu_has_rdtscp() {
+        let cpu = smp_get_processor_id() as usize;
+        let aux = cpu as u64 | (cpu_to_node(cpu) as u64) << TSC_AUX_NODE_SHIFT;
+        unsafe { wrmsr(IA32_TSC_AUX, aux) };
+    }
+}
+
+/// 初始化vDSO：把镜像复制到新分配的物理页中，并初始化vvar页
+///
+/// 需要在TSC校准之后调用，否则vDSO的时钟会一直回退到系统调用
+pub fn vdso_init() {
+    let image_pages = PageFrameCount::new(page_align_up(VDSO_IMAGE.len()) / MMArch::PAGE_SIZE);
+    let (vvar, image) = unsafe {
+        let vvar = LockedFrameAllocator
+            .allocate_one()
+            .expect("Failed to allocate vvar page");
+        let (image, _) = LockedFrameAllocator
+            .allocate(image_pages)
+            .expect("Failed to allocate vDSO pages");
+        (vvar, image)
+    };
+
+    let vvar_vaddr = unsafe { MMArch::phys_2_virt(vvar).unwrap() };
+    unsafe {
+        MMArch::write_bytes(vvar_vaddr, 0, MMArch::PAGE_SIZE);
+        let image_vaddr = MMArch::phys_2_virt(image).unwrap();
+        MMArch::write_bytes(image_vaddr, 0, image_pages.bytes());
+        core::ptr::copy_nonoverlapping(
+            VDSO_IMAGE.as_ptr(),
+            image_vaddr.data() as *mut u8,
+            VDSO_IMAGE.len(),
+        );
+    }
+
+    VDSO_PAGES.init(VdsoPages {
+        vvar,
+        vvar_vaddr,
+        image,
+        image_pages,
+    });
+
+    vdso_init_current_cpu();
+
+    let tsc_khz = TSCManager::tsc_khz();
+    let wall = getnstimeofday();
+    vvar_write(|data| {
+        if tsc_khz != 0 {
+            let (cycles, mono_ns) = tsc_now(tsc_khz);
+            // 向下取整，使得外推出来的时间不会超过下一次更新时的时间，保证单调
+            data.mult = ((1_000_000u128 << VDSO_MULT_SHIFT) / tsc_khz as u128) as u64;
+            data.shift = VDSO_MULT_SHIFT;
+            data.cycle_last = cycles;
+            data.mono_ns = mono_ns;
+            data.wall_offset_ns = timespec_to_ns(&wall) - mono_ns as i64;
+            data.clock_mode = VDSO_CLOCKMODE_TSC;
+        } else {
+            data.clock_mode = VDSO_CLOCKMODE_NONE;
+        }
+        data.getcpu_mode = if cpu_has_rdtscp() {
+            VDSO_GETCPU_RDTSCP
+        } else {
+            VDSO_GETCPU_NONE
+        };
+        data.tz_minuteswest = SYS_TIMEZONE.tz_minuteswest;
+        data.tz_dsttime = SYS_TIMEZONE.tz_dsttime;
+    });
+
+    kinfo!(
+        "vDSO initialized, image size: {} bytes, clock mode: {}",
+        VDSO_IMAGE.len(),
+        if tsc_khz != 0 { "tsc" } else { "none" }
+    );
+}
+
+/// 把vvar页和vDSO镜像映射到用户地址空间中
+///
+/// ## 返回值
+///
+/// - `Ok(Some(vaddr))`：vDSO镜像的起始地址
+/// - `Ok(None)`：vDSO还没有初始化
+pub fn map_vdso(vm: &mut InnerAddressSpace) -> Result<Option<VirtAddr>, SystemError> {
+    let pages = match VDSO_PAGES.try_get() {
+        Some(pages) => pages,
+        None => return Ok(None),
+    };
+
+    let total = PageFrameCount::new(1 + pages.image_pages.data());
+    let region = vm.mappings.find_free_at(
+        vm.mmap_min,
+        MMArch::USER_STACK_START + VDSO_STACK_GAP,
+        total.bytes(),
+        MapFlags::empty(),
+    )?;
+
+    vdso_mmap(
+        vm,
+        region.start(),
+        pages.vvar,
+        PageFrameCount::new(1),
+        ProtFlags::PROT_READ,
+    )?;
+    let vdso_base = region.start() + MMArch::PAGE_SIZE;
+    vdso_mmap(
+        vm,
+        vdso_base,
+        pages.image,
+        pages.image_pages,
+        ProtFlags::PROT_READ | ProtFlags::PROT_EXEC,
+    )?;
+    vm.vdso_base = vdso_base;
+    return Ok(Some(vdso_base));
+}
+
+/// 把共享的物理页映射到用户地址空间中的指定位置
+fn vdso_mmap(
+    vm: &mut InnerAddressSpace,
+    vaddr: VirtAddr,
+    phys: PhysAddr,
+    count: PageFrameCount,
+    prot_flags: ProtFlags,
+) -> Result<(), SystemError> {
+    vm.mmap(
+        Some(vaddr),
+        count,
+        prot_flags,
+        MapFlags::MAP_PRIVATE | MapFlags::MAP_FIXED_NOREPLACE,
+        |page, count, flags, mapper, flusher| {
+            let vma = VMA::physmap(
+                PhysPageFrame::new(phys),
+                page,
+                count,
+                flags,
+                mapper,
+                flusher,
+            )?;
+            vma.lock().set_vm_flags(VmFlags::VM_SPECIAL);
+            Ok(vma)
+        },
+    )?;
+    return Ok(());
+}
+
+#[no_mangle]
+pub extern "C" fn rs_vdso_init() {
+    vdso_init();
+}
@@ -0,0 +1,227 @@
+/**
+ * @file vdso.c
+ * @brief vDSO：在用户态读取时间、获取当前的cpu号，不需要陷入内核
+ *
+ * 内核把vDSO映射到每个进程的地址空间中，并通过AT_SYSINFO_EHDR告诉用户程序它的地址。
+ * vDSO前面的一页是vvar页，内核在时钟中断中更新其中的时间数据，这里使用顺序锁读取。
+ * 不能在用户态完成时（例如TSC不可用、不支持的时钟），回退到系统调用。
+ *
+ * 请注意，这个文件被编译为独立的用户态共享库，不能引用内核的任何符号，也不能有可写的数据。
+ */
+
+#include "vdso_data.h"
+
+#define __NR_gettimeofday 96
+#define __NR_clock_gettime 228
+#define __NR_getcpu 309
+
+#define CLOCK_REALTIME 0
+#define CLOCK_MONOTONIC 1
+#define CLOCK_MONOTONIC_RAW 4
+#define CLOCK_REALTIME_COARSE 5
+#define CLOCK_MONOTONIC_COARSE 6
+#define CLOCK_BOOTTIME 7
+
+#define NSEC_PER_SEC 1000000000LL
+#define EFAULT 14
+
+struct timespec
+{
+    int64_t tv_sec;
+    int64_t tv_nsec;
+};
+
+struct timeval
+{
+    int64_t tv_sec;
+    int64_t tv_usec;
+};
+
+struct timezone
+{
+    int32_t tz_minuteswest;
+    int32_t tz_dsttime;
+};
+
+// vvar页的地址由链接脚本定义
+extern const struct vdso_data vvar_page __attribute__((visibility("hidden")));
+
+#define barrier() __asm__ __volatile__("" ::: "memory")
+#define READ_ONCE(x) (*(const volatile __typeof__(x) *)&(x))
+
+static inline long vdso_syscall2(long nr, long arg0, long arg1)
+{
+    long ret;
+    __asm__ __volatile__("syscall"
+                         : "=a"(ret)
+                         : "0"(nr), "D"(arg0), "S"(arg1)
+                         : "rcx", "r11", "memory");
+    return ret;
+}
+
+static inline long vdso_syscall3(long nr, long arg0, long arg1, long arg2)
+{
+    long ret;
+    __asm__ __volatile__("syscall"
+                         : "=a"(ret)
+                         : "0"(nr), "D"(arg0), "S"(arg1), "d"(arg2)
+                         : "rcx", "r11", "memory");
+    return ret;
+}
+
+static inline uint64_t rdtsc_ordered(void)
+{
+    uint32_t lo, hi;
+    // lfence保证rdtsc不会在读取vvar之前执行
+    __asm__ __volatile__("lfence\n\trdtsc" : "=a"(lo), "=d"(hi)::"memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint32_t vdso_read_begin(const struct vdso_data *vd)
+{
+    uint32_t seq;
+    while ((seq = READ_ONCE(vd->seq)) & 1)
+        __asm__ __volatile__("pause");
+    barrier();
+    return seq;
+}
+
+static inline int vdso_read_retry(const struct vdso_data *vd, uint32_t start)
+{
+    barrier();
+    return READ_ONCE(vd->seq) != start;
+}
+
+/**
+ * @brief 读取单调时间与墙上时间的差
+ *
+ * @param coarse 是否只需要时钟周期的精度（不读取TSC）
+ * @return 成功返回0，需要回退到系统调用时返回-1
+ */
+static inline int do_read_clock(int coarse, uint64_t *mono_ns, int64_t *wall_offset_ns)
+{
+    const struct vdso_data *vd = &vvar_page;
+    uint32_t seq;
+    uint64_t ns;
+    int64_t offset;
+
+    do
+    {
+        seq = vdso_read_begin(vd);
+        if (READ_ONCE(vd->clock_mode) == VDSO_CLOCKMODE_NONE)
+            return -1;
+        ns = READ_ONCE(vd->mono_ns);
+        offset = READ_ONCE(vd->wall_offset_ns);
+        if (!coarse)
+        {
+            uint64_t cycles = rdtsc_ordered();
+            uint64_t last = READ_ONCE(vd->cycle_last);
+            // 不同cpu的TSC可能有微小的偏差，不能让时间倒退
+            uint64_t delta = cycles > last ? cycles - last : 0;
+            ns += (uint64_t)(((unsigned __int128)delta * READ_ONCE(vd->mult)) >> READ_ONCE(vd->shift));
+        }
+    } while (vdso_read_retry(vd, seq));
+
+    *mono_ns = ns;
+    *wall_offset_ns = offset;
+    return 0;
+}
+
+static inline void ns_to_timespec(int64_t ns, struct timespec *ts)
+{
+    ts->tv_sec = ns / NSEC_PER_SEC;
+    ts->tv_nsec = ns % NSEC_PER_SEC;
+}
+
+int __vdso_clock_gettime(int clock_id, struct timespec *ts)
+{
+    uint64_t mono;
+    int64_t offset;
+    int coarse = 0;
+    int realtime = 0;
+
+    switch (clock_id)
+    {
+    case CLOCK_REALTIME_COARSE:
+        coarse = 1;
+        // fallthrough
+    case CLOCK_REALTIME:
+        realtime = 1;
+        break;
+    case CLOCK_MONOTONIC_COARSE:
+        coarse = 1;
+        // fallthrough
+    case CLOCK_MONOTONIC:
+    case CLOCK_MONOTONIC_RAW:
+    case CLOCK_BOOTTIME:
+        break;
+    default:
+        return vdso_syscall2(__NR_clock_gettime, clock_id, (long)ts);
+    }
+
+    if (ts == 0 || do_read_clock(coarse, &mono, &offset) != 0)
+        return vdso_syscall2(__NR_clock_gettime, clock_id, (long)ts);
+
+    ns_to_timespec(realtime ? (int64_t)mono + offset : (int64_t)mono, ts);
+    return 0;
+}
+int clock_gettime(int clock_id, struct timespec *ts) __attribute__((weak, alias("__vdso_clock_gettime")));
+
+int __vdso_gettimeofday(struct timeval *tv, struct timezone *tz)
+{
+    uint64_t mono;
+    int64_t offset;
+
+    if (tv == 0 || do_read_clock(0, &mono, &offset) != 0)
+        return vdso_syscall2(__NR_gettimeofday, (long)tv, (long)tz);
+
+    int64_t ns = (int64_t)mono + offset;
+    tv->tv_sec = ns / NSEC_PER_SEC;
+    tv->tv_usec = (ns % NSEC_PER_SEC) / 1000;
+    if (tz != 0)
+    {
+        tz->tz_minuteswest = READ_ONCE(vvar_page.tz_minuteswest);
+        tz->tz_dsttime = READ_ONCE(vvar_page.tz_dsttime);
+    }
+    return 0;
+}
+int gettimeofday(struct timeval *tv, struct timezone *tz) __attribute__((weak, alias("__vdso_gettimeofday")));
+
+int64_t __vdso_time(int64_t *t)
+{
+    uint64_t mono;
+    int64_t offset;
+    int64_t sec;
+
+    if (do_read_clock(1, &mono, &offset) != 0)
+    {
+        struct timespec ts;
+        long ret = vdso_syscall2(__NR_clock_gettime, CLOCK_REALTIME, (long)&ts);
+        if (ret < 0)
+            return ret;
+        sec = ts.tv_sec;
+    }
+    else
+        sec = ((int64_t)mono + offset) / NSEC_PER_SEC;
+
+    if (t != 0)
+        *t = sec;
+    return sec;
+}
+int64_t time(int64_t *t) __attribute__((weak, alias("__vdso_time")));
+
+long __vdso_getcpu(unsigned int *cpu, unsigned int *node, void *unused)
+{
+    if (READ_ONCE(vvar_page.getcpu_mode) != VDSO_GETCPU_RDTSCP)
+        return vdso_syscall3(__NR_getcpu, (long)cpu, (long)node, (long)unused);
+
+    uint32_t lo, hi, aux;
+    // 内核把每个cpu的IA32_TSC_AUX设置为(节点号 << 12) | cpu号
+    __asm__ __volatile__("rdtscp" : "=a"(lo), "=d"(hi), "=c"(aux));
+    if (cpu != 0)
+        *cpu = aux & 0xfff;
+    if (node != 0)
+        *node = aux >> 12;
+    return 0;
+}
+long getcpu(unsigned int *cpu, unsigned int *node, void *unused) __attribute__((weak, alias("__vdso_getcpu")));
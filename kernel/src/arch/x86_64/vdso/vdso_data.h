@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief vvar页中的数据，内核每个时钟周期更新一次，vDSO只读
+ *
+ * 内存布局必须与内核中的`VdsoData`保持一致
+ */
+
+// 不能在用户态读取时钟，需要回退到系统调用
+#define VDSO_CLOCKMODE_NONE 0
+// 使用TSC计时
+#define VDSO_CLOCKMODE_TSC 1
+
+// 不能在用户态获取cpu号
+#define VDSO_GETCPU_NONE 0
+// 使用rdtscp指令读取IA32_TSC_AUX中的cpu号和节点号
+#define VDSO_GETCPU_RDTSCP 1
+
+struct vdso_data
+{
+    // 顺序锁的序号，为奇数时表示内核正在更新
+    uint32_t seq;
+    uint32_t clock_mode;
+    // 上次更新时的TSC读数
+    uint64_t cycle_last;
+    // 把TSC的增量换算为纳秒：ns = delta * mult >> shift
+    uint64_t mult;
+    uint32_t shift;
+    uint32_t getcpu_mode;
+    // 上次更新时的单调时间（纳秒）
+    uint64_t mono_ns;
+    // 墙上时间与单调时间的差（纳秒）
+    int64_t wall_offset_ns;
+    // 时区信息
+    int32_t tz_minuteswest;
+    int32_t tz_dsttime;
+};
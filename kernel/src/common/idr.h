@@ -3,6 +3,7 @@
 
 #include <common/errno.h>
 #include <common/spinlock.h>
+#include <common/rcupdate.h>
 
 #if ARCH(I386) || ARCH(X86_64)
 #include <arch/x86_64/math/bitcount.h>
@@ -14,17 +15,22 @@
 /**
  * idr: 基于radix-tree的ID-pointer的数据结构
  * 主要功能:
- * 1. 获取一个ID, 并且将该ID与一个指针绑定  - 需要外部加锁
- * 2. 删除一个已分配的ID                  - 需要外部加锁
- * 3. 根据ID查找对应的指针                (读操作,看情况加锁)
- * 4. 根据ID使用新的ptr替换旧的ptr        - 需要外部加锁
+ * 1. 获取一个ID(或者指定的ID), 并且将该ID与一个指针绑定  - 写操作
+ * 2. 删除一个已分配的ID                               - 写操作
+ * 3. 根据ID查找对应的指针                             - 读操作
+ * 4. 根据ID使用新的ptr替换旧的ptr                     - 写操作
  *
  * 附加功能:
  * 1. 给定starting_id, 查询下一个已分配的next_id  (即:next_id>starting_id)
  * 2. 销毁整个idr
  *
- *
- * .... 待实现
+ * 并发:
+ * - 写操作之间由idr内部的自旋锁互斥, 不需要外部加锁
+ * - 读操作不加锁, 在RCU读临界区内遍历树: 写者先初始化好新的节点再通过rcu_assign_pointer发布,
+ *   被删除的节点通过call_rcu在宽限期结束之后才释放, 因此读者永远不会访问到已经被释放的节点
+ * - 读操作返回的数据指针本身不受idr保护: 调用者需要在自己的RCU读临界区内使用它,
+ *   并且在删除ID之后, 等待宽限期结束再释放数据; 或者通过其它方式保证数据的生命周期
+ * - idr_destroy/ida_destroy不能与其它操作并发
  */
 
 // 默认64位机器
@@ -84,6 +90,7 @@ struct idr
  **/
 int idr_preload(struct idr *idp, gfp_t gfp_mask);
 int idr_alloc(struct idr *idp, void *ptr, int *id);
+int idr_alloc_at(struct idr *idp, void *ptr, int id);
 void *idr_remove(struct idr *idp, int id);
 void idr_remove_all(struct idr *idp);
 void idr_destroy(struct idr *idp);
@@ -0,0 +1,31 @@
+#pragma once
+
+/**
+ * RCU的C语言接口（实现位于libs/rcu.rs）
+ *
+ * 读者在rcu_read_lock()与rcu_read_unlock()之间通过rcu_dereference()读取被保护的指针，
+ * 写者初始化好新的数据之后通过rcu_assign_pointer()发布它，被替换或者被删除的旧数据通过call_rcu()在宽限期结束之后释放。
+ * 读临界区内不能睡眠。
+ */
+
+extern void rs_rcu_read_lock();
+extern void rs_rcu_read_unlock();
+extern void rs_call_rcu(void (*func)(void *), void *data);
+
+#define rcu_read_lock() rs_rcu_read_lock()
+#define rcu_read_unlock() rs_rcu_read_unlock()
+
+/**
+ * @brief 在宽限期结束之后调用func(data)（在软中断上下文中执行，不能睡眠）
+ */
+#define call_rcu(func, data) rs_call_rcu((func), (data))
+
+/**
+ * @brief 读取被RCU保护的指针
+ */
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+
+/**
+ * @brief 发布被RCU保护的指针：在这之前对指向的数据的初始化，对之后读到这个指针的读者可见
+ */
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
@@ -61,21 +61,7 @@ long strnlen_user(const char *src, unsigned long maxlen);
  * @param len 要比较的内存区域长度
  * @return int s1、s2的第一个不相等的字节i处的差值（s1[i]-s2[i])。若两块内存区域的内容相同，则返回0
  */
-static inline int memcmp(const void *s1, const void *s2, size_t len)
-{
-    int diff;
-
-    asm("cld \n\t"  // 复位DF，确保s1、s2指针是自增的
-        "repz; cmpsb\n\t" CC_SET(nz)
-        : CC_OUT(nz)(diff), "+D"(s1), "+S"(s2)
-        : "c"(len)
-        : "memory");
-
-    if (diff)
-        diff = *(const unsigned char *)(s1 - 1) - *(const unsigned char *)(s2 - 1);
-
-    return diff;
-}
+int memcmp(const void *s1, const void *s2, size_t len);
 
 /**
  * @brief 拼接两个字符串（将src接到dest末尾）
@@ -20,6 +20,13 @@
 #define symbol_to_write(vaddr, tv, etv) \
     ((vaddr < tv || vaddr > etv) ? 0 : 1)
 
+// 符号名的最大长度（含结束符），与traceback.h中的KSYM_NAME_LEN一致
+#define KSYM_NAME_LEN 512
+// 每隔这么多个符号，名字完整保存一次（不与前一个名字共享前缀），并在kallsyms_markers中记录它的位置
+#define KALLSYMS_MARKER_STRIDE 16
+// 与前一个名字共享的前缀长度用一个字节保存
+#define KALLSYMS_MAX_PREFIX 255
+
 /**
  * @brief 使用nm命令提取出来的信息存到这个结构体之中
  *
@@ -72,20 +79,14 @@ int read_symbol(FILE *filp, struct kernel_symbol_entry_t *entry)
         symbol_name[len - 1] = '\0';
         len--;
     }
-    // 转义双引号
-    for (int i = 0; i < len; i++)
+    // 过长的名字（通常是展开后的泛型）被截断
+    if (len > KSYM_NAME_LEN - 1)
     {
-        if (symbol_name[i] == '"')
-        {
-            char temp[len - i];
-            memcpy(temp, symbol_name + i, len - i);
-            symbol_name[i] = '\\';
-            memcpy(symbol_name + i + 1, temp, len - i);
-            i++;
-        }
+        symbol_name[KSYM_NAME_LEN - 1] = '\0';
+        len = KSYM_NAME_LEN - 1;
     }
     entry->symbol = strdup(symbol_name);
-    entry->symbol_length = len + 1; // +1的原因是.asciz指令会在字符串末尾自动添加结束符\0
+    entry->symbol_length = len;
     return 0;
 }
 
@@ -124,93 +125,120 @@ void read_map(FILE *filp)
     }
 }
 
+int compare_symbol(const void *a, const void *b)
+{
+    const struct kernel_symbol_entry_t *x = a, *y = b;
+    if (x->vaddr != y->vaddr)
+        return x->vaddr < y->vaddr ? -1 : 1;
+    return strcmp(x->symbol, y->symbol);
+}
+
 /**
- * @brief 输出最终的kallsyms汇编代码文件
- * 直接输出到stdout，通过命令行的 > 命令，写入文件
+ * @brief 按地址排序，只保留text段内的符号，同一地址只保留一个符号
+ *
+ * @return uint64_t 保留的符号数量
  */
-void generate_result()
+uint64_t filter_symbols()
 {
-    printf(".section .rodata\n\n");
-    printf(".global kallsyms_address\n");
-    printf(".align 8\n\n");
-
-    printf("kallsyms_address:\n"); // 地址数组
-
-    uint64_t last_vaddr = 0;
-    uint64_t total_syms_to_write = 0; // 真正输出的符号的数量
-
-    // 循环写入地址数组
+    qsort(symbol_table, entry_count, sizeof(struct kernel_symbol_entry_t), compare_symbol);
+    uint64_t n = 0;
     for (uint64_t i = 0; i < entry_count; ++i)
     {
-        // 判断是否为text段的符号
         if (!symbol_to_write(symbol_table[i].vaddr, text_vaddr, etext_vaddr))
             continue;
-
-        if (symbol_table[i].vaddr == last_vaddr)
+        if (n > 0 && symbol_table[n - 1].vaddr == symbol_table[i].vaddr)
             continue;
+        symbol_table[n++] = symbol_table[i];
+    }
+    return n;
+}
 
-        // 输出符号地址
-        printf("\t.quad\t%#llx\n", symbol_table[i].vaddr);
-        ++total_syms_to_write;
-
-        last_vaddr = symbol_table[i].vaddr;
+/**
+ * @brief 输出一个字符串的一部分（.ascii），转义其中的双引号和反斜杠
+ */
+void print_ascii(const char *str, int len)
+{
+    printf("\t.ascii\t\"");
+    for (int i = 0; i < len; ++i)
+    {
+        if (str[i] == '"' || str[i] == '\\')
+            putchar('\\');
+        putchar(str[i]);
     }
+    printf("\"\n");
+}
 
-    putchar('\n');
+/**
+ * @brief 输出最终的kallsyms汇编代码文件
+ * 直接输出到stdout，通过命令行的 > 命令，写入文件
+ *
+ * 生成的符号表：
+ * - kallsyms_num：符号的数量
+ * - kallsyms_relative_base：_text的地址。kallsyms_offsets[i]是第i个符号相对于它的偏移量，按地址升序排列
+ * - kallsyms_text_end：_etext的地址，最后一个符号的结束地址
+ * - kallsyms_names：每个符号依次保存为 与前一个名字共享的前缀长度（1字节）+ 剩余部分 + '\0'
+ * - kallsyms_markers：第i项是第i*KALLSYMS_MARKER_STRIDE个符号在kallsyms_names中的偏移量，这些符号不共享前缀
+ */
+void generate_result()
+{
+    uint64_t num = filter_symbols();
+
+    printf(".section .rodata\n\n");
 
-    // 写入符号表的表项数量
     printf(".global kallsyms_num\n");
     printf(".align 8\n");
     printf("kallsyms_num:\n");
-    printf("\t.quad\t%lld\n", total_syms_to_write);
-
-    putchar('\n');
+    printf("\t.quad\t%lld\n\n", num);
 
-    // 循环写入符号名称的下标索引
-    printf(".global kallsyms_names_index\n");
+    printf(".global kallsyms_relative_base\n");
     printf(".align 8\n");
-    printf("kallsyms_names_index:\n");
-    uint64_t position = 0;
-    last_vaddr = 0;
-    for (uint64_t i = 0; i < entry_count; ++i)
-    {
-        // 判断是否为text段的符号
-        if (!symbol_to_write(symbol_table[i].vaddr, text_vaddr, etext_vaddr))
-            continue;
-
-        if (symbol_table[i].vaddr == last_vaddr)
-            continue;
+    printf("kallsyms_relative_base:\n");
+    printf("\t.quad\t%#llx\n\n", text_vaddr);
 
-        // 输出符号名称的偏移量
-        printf("\t.quad\t%lld\n", position);
-        position += symbol_table[i].symbol_length;
-        last_vaddr = symbol_table[i].vaddr;
-    }
+    printf(".global kallsyms_text_end\n");
+    printf(".align 8\n");
+    printf("kallsyms_text_end:\n");
+    printf("\t.quad\t%#llx\n\n", etext_vaddr);
 
+    // 地址数组（相对于_text的偏移量）
+    printf(".global kallsyms_offsets\n");
+    printf(".align 8\n");
+    printf("kallsyms_offsets:\n");
+    for (uint64_t i = 0; i < num; ++i)
+        printf("\t.long\t%#llx\n", symbol_table[i].vaddr - text_vaddr);
     putchar('\n');
 
-    // 输出符号名
+    // 前缀压缩的符号名，同时记录每个标记点的偏移量
+    uint64_t *markers = malloc(sizeof(uint64_t) * (num / KALLSYMS_MARKER_STRIDE + 1));
+    uint64_t position = 0;
     printf(".global kallsyms_names\n");
-    printf(".align 8\n");
     printf("kallsyms_names:\n");
-
-    last_vaddr = 0;
-    for (uint64_t i = 0; i < entry_count; ++i)
+    for (uint64_t i = 0; i < num; ++i)
     {
-        // 判断是否为text段的符号
-        if (!symbol_to_write(symbol_table[i].vaddr, text_vaddr, etext_vaddr))
-            continue;
-
-        if (symbol_table[i].vaddr == last_vaddr)
-            continue;
-
-        // 输出符号名称
-        printf("\t.asciz\t\"%s\"\n", symbol_table[i].symbol);
-
-        last_vaddr = symbol_table[i].vaddr;
+        int prefix = 0;
+        if (i % KALLSYMS_MARKER_STRIDE == 0)
+            markers[i / KALLSYMS_MARKER_STRIDE] = position;
+        else
+        {
+            const char *prev = symbol_table[i - 1].symbol;
+            const char *cur = symbol_table[i].symbol;
+            while (prefix < KALLSYMS_MAX_PREFIX && prev[prefix] != '\0' && prev[prefix] == cur[prefix])
+                ++prefix;
+        }
+        printf("\t.byte\t%d\n", prefix);
+        print_ascii(symbol_table[i].symbol + prefix, symbol_table[i].symbol_length - prefix);
+        printf("\t.byte\t0\n");
+        position += 1 + symbol_table[i].symbol_length - prefix + 1;
     }
+    putchar('\n');
 
+    printf(".global kallsyms_markers\n");
+    printf(".align 8\n");
+    printf("kallsyms_markers:\n");
+    for (uint64_t i = 0; i < (num + KALLSYMS_MARKER_STRIDE - 1) / KALLSYMS_MARKER_STRIDE; ++i)
+        printf("\t.long\t%lld\n", markers[i]);
     putchar('\n');
+    free(markers);
 }
 int main(int argc, char **argv)
 {
@@ -0,0 +1,89 @@
+//! 内核符号表
+//!
+//! 符号表在链接时由debug/kallsyms.c生成（按地址排序、名字前缀压缩），查找由traceback.c中的
+//! `kallsyms_lookup`二分完成。这里的函数不加锁、不分配内存，可以在中断和NMI中调用。
+//!
+//! `/proc/kallsyms`按照Linux的格式列出所有符号，用户程序可以用它解析性能采样中的内核地址
+
+use core::fmt::Write;
+
+use crate::{
+    filesystem::vfs::seq_file::{SeqBuf, SeqOperations},
+    syscall::SystemError,
+};
+
+/// 符号名的最大长度（含结束符），与traceback.h中的定义一致
+pub const KSYM_NAME_LEN: usize = 512;
+
+extern "C" {
+    fn kallsyms_lookup(addr: u64, name: *mut u8, offset: *mut u64, size: *mut u64) -> i32;
+    fn kallsyms_get_symbol(index: u64, name: *mut u8, addr: *mut u64) -> i32;
+}
+
+/// 一个内核符号
+pub struct KernelSymbol {
+    name: [u8; KSYM_NAME_LEN],
+    /// 符号的起始地址
+    pub addr: u64,
+    /// 被查找的地址相对于起始地址的偏移量
+    pub offset: u64,
+    /// 符号的大小（到下一个符号为止）
+    pub size: u64,
+}
+
+impl KernelSymbol {
+    const fn empty() -> Self {
+        return Self {
+            name: [0; KSYM_NAME_LEN],
+            addr: 0,
+            offset: 0,
+            size: 0,
+        };
+    }
+
+    pub fn name(&self) -> &str {
+        let len = self.name.iter().position(|c| *c == 0).unwrap_or(0);
+        return core::str::from_utf8(&self.name[..len]).unwrap_or("?");
+    }
+}
+
+/// 查找地址所在的函数，地址不在内核代码段内时返回None
+pub fn kallsyms_lookup_symbol(addr: u64) -> Option<KernelSymbol> {
+    let mut sym = KernelSymbol::empty();
+    let r = unsafe { kallsyms_lookup(addr, sym.name.as_mut_ptr(), &mut sym.offset, &mut sym.size) };
+    if r != 0 {
+        return None;
+    }
+    sym.addr = addr - sym.offset;
+    return Some(sym);
+}
+
+/// 获取第`index`个符号（按地址升序），超出范围时返回None
+pub fn kallsyms_symbol(index: usize) -> Option<KernelSymbol> {
+    let mut sym = KernelSymbol::empty();
+    let r = unsafe { kallsyms_get_symbol(index as u64, sym.name.as_mut_ptr(), &mut sym.addr) };
+    if r != 0 {
+        return None;
+    }
+    return Some(sym);
+}
+
+/// `/proc/kallsyms`：每行一个符号
+#[derive(Debug)]
+pub struct KallsymsSeq;
+
+impl SeqOperations for KallsymsSeq {
+    type Cursor = usize;
+
+    fn start(&self, pos: usize) -> Option<usize> {
+        return kallsyms_symbol(pos).map(|_| pos);
+    }
+
+    fn show(&self, pos: &usize, s: &mut SeqBuf) -> Result<(), SystemError> {
+        if let Some(sym) = kallsyms_symbol(*pos) {
+            // 符号表中只有代码段的符号
+            writeln!(s, "{:016x} T {}", sym.addr, sym.name()).ok();
+        }
+        return Ok(());
+    }
+}
@@ -0,0 +1,488 @@
+//! 内核日志缓冲区（kmsg）
+//!
+//! printk不再在调用者的cpu上同步渲染：日志被格式化成带序号、日志级别的记录，写入当前cpu的环形缓冲区后立即返回。
+//! 写入只需要关闭本cpu的中断，不需要任何锁，不同cpu之间只共享一个序号计数器。
+//!
+//! 后台的kmsgd线程按照序号合并各个cpu的记录，把它们追加到日志历史（供`syslog`系统调用读取），
+//! 并输出到textui以及串口。环形缓冲区满时，新的日志被丢弃，kmsgd随后输出丢弃的数量。
+//!
+//! kmsgd启动之前（启动早期）以及panic之后，printk仍然同步输出。
+
+use core::{
+    fmt,
+    ptr::null_mut,
+    sync::atomic::{AtomicBool, AtomicPtr, AtomicU64, AtomicU8, Ordering},
+};
+
+use alloc::{boxed::Box, string::ToString, sync::Arc};
+
+use crate::{
+    arch::CurrentIrqArch,
+    exception::{
+        softirq::{softirq_vectors, SoftirqNumber, SoftirqVec},
+        InterruptArch,
+    },
+    include::bindings::bindings::smp_get_total_cpu,
+    kinfo,
+    libs::{
+        lib_ui::textui::{textui_putstr, FontColor},
+        ringbuf::SpscRing,
+        spinlock::SpinLock,
+        wait_queue::WaitQueue,
+    },
+    mm::percpu::PerCpu,
+    process::{
+        kthread::{KernelThreadClosure, KernelThreadMechanism},
+        ProcessManager,
+    },
+    smp::core::smp_get_processor_id,
+    syscall::SystemError,
+};
+
+/// 日志级别（与Linux的取值相同）
+#[allow(dead_code)]
+#[repr(u8)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord)]
+pub enum LogLevel {
+    EMERG = 0,
+    ALERT = 1,
+    CRIT = 2,
+    ERR = 3,
+    WARNING = 4,
+    NOTICE = 5,
+    INFO = 6,
+    DEBUG = 7,
+}
+
+impl LogLevel {
+    /// 没有指定级别的日志（print!、println!）的级别
+    pub const DEFAULT: LogLevel = LogLevel::WARNING;
+}
+
+/// 一条记录中文本的最大长度（字节）。更长的日志被拆分成多条记录
+pub const KMSG_TEXT_MAX: usize = 224;
+/// 每个cpu的环形缓冲区中的记录数
+const KMSG_RING_SLOTS: usize = 64;
+/// 日志历史的大小（字节）
+pub const KMSG_HISTORY_SIZE: usize = 64 * 1024;
+/// 控制台默认的日志级别：级别的数值小于它的日志才会输出到控制台
+const KMSG_DEFAULT_CONSOLE_LEVEL: u8 = 8;
+
+/// 环形缓冲区中的一条记录
+#[derive(Clone, Copy)]
+struct KmsgRecord {
+    seq: u64,
+    level: LogLevel,
+    fr_color: FontColor,
+    bk_color: FontColor,
+    len: u16,
+    text: [u8; KMSG_TEXT_MAX],
+}
+
+impl KmsgRecord {
+    fn text(&self) -> &str {
+        return unsafe { core::str::from_utf8_unchecked(&self.text[..self.len as usize]) };
+    }
+}
+
+/// 一个cpu的环形缓冲区
+///
+/// 只有所属的cpu（在关中断的情况下）写入记录；只有持有消费权的一方（见[`KMSG_CONSUMING`]）取走记录
+type KmsgRing = SpscRing<KmsgRecord>;
+
+static KMSG_RINGS: [AtomicPtr<KmsgRing>; PerCpu::MAX_CPU_NUM] =
+    [const { AtomicPtr::new(null_mut()) }; PerCpu::MAX_CPU_NUM];
+
+/// 日志的序号
+static KMSG_SEQ: AtomicU64 = AtomicU64::new(0);
+/// 因为环形缓冲区满而丢弃的记录数
+static KMSG_DROPPED: AtomicU64 = AtomicU64::new(0);
+/// 是否异步输出日志（kmsgd启动之后为true，panic之后为false）
+static KMSG_ASYNC: AtomicBool = AtomicBool::new(false);
+/// 是否有一方正在从环形缓冲区中取走记录
+static KMSG_CONSUMING: AtomicBool = AtomicBool::new(false);
+/// 控制台的日志级别
+static KMSG_CONSOLE_LEVEL: AtomicU8 = AtomicU8::new(KMSG_DEFAULT_CONSOLE_LEVEL);
+/// 关闭控制台之前的日志级别
+static KMSG_SAVED_CONSOLE_LEVEL: AtomicU8 = AtomicU8::new(KMSG_DEFAULT_CONSOLE_LEVEL);
+
+/// 保护kmsgd的等待：检查缓冲区是否为空与进入睡眠之间，不会错过唤醒
+static KMSGD_WAIT_LOCK: SpinLock<()> = SpinLock::new(());
+static KMSGD_WAIT: WaitQueue = WaitQueue::INIT;
+
+/// 日志历史，`syslog`从这里读取
+static KMSG_HISTORY: SpinLock<KmsgHistory> = SpinLock::new(KmsgHistory::new());
+/// 等待新的日志的`syslog`读者
+static KMSG_READ_WAIT: WaitQueue = WaitQueue::INIT;
+
+/// 日志历史：保存最近的[`KMSG_HISTORY_SIZE`]字节日志，每行以`<级别>`开头
+struct KmsgHistory {
+    buf: [u8; KMSG_HISTORY_SIZE],
+    /// 写入的总字节数
+    head: usize,
+    /// `SYSLOG_ACTION_READ`读到的位置
+    read: usize,
+    /// 上一次清空时的位置
+    clear: usize,
+    /// 下一个字节是否位于行首
+    line_start: bool,
+}
+
+impl KmsgHistory {
+    const fn new() -> Self {
+        return Self {
+            buf: [0; KMSG_HISTORY_SIZE],
+            head: 0,
+            read: 0,
+            clear: 0,
+            line_start: true,
+        };
+    }
+
+    /// 最早的仍然保存着的字节的位置
+    fn first(&self) -> usize {
+        return self.head.saturating_sub(KMSG_HISTORY_SIZE);
+    }
+
+    fn push_byte(&mut self, b: u8) {
+        self.buf[self.head % KMSG_HISTORY_SIZE] = b;
+        self.head += 1;
+    }
+
+    fn append(&mut self, level: LogLevel, text: &str) {
+        for b in text.bytes() {
+            if self.line_start {
+                self.push_byte(b'<');
+                self.push_byte(b'0' + level as u8);
+                self.push_byte(b'>');
+                self.line_start = false;
+            }
+            self.push_byte(b);
+            if b == b'\n' {
+                self.line_start = true;
+            }
+        }
+    }
+
+    /// 把`[from, head)`中最后`buf.len()`个字节拷贝到`buf`，返回拷贝的字节数
+    fn copy_tail(&self, from: usize, buf: &mut [u8]) -> usize {
+        let from = core::cmp::max(from, self.first());
+        let from = core::cmp::max(from, self.head.saturating_sub(buf.len()));
+        return self.copy(from, buf);
+    }
+
+    /// 从`from`开始拷贝最多`buf.len()`个字节，返回拷贝的字节数
+    fn copy(&self, from: usize, buf: &mut [u8]) -> usize {
+        let from = core::cmp::max(from, self.first());
+        let n = core::cmp::min(self.head - from, buf.len());
+        for (i, b) in buf[..n].iter_mut().enumerate() {
+            *b = self.buf[(from + i) % KMSG_HISTORY_SIZE];
+        }
+        return n;
+    }
+}
+
+/// 把一条记录输出到日志历史和控制台
+fn kmsg_output(level: LogLevel, fr_color: FontColor, bk_color: FontColor, text: &str) {
+    // panic时日志历史的锁可能已经被持有，此时只输出到控制台
+    if let Ok(mut history) = KMSG_HISTORY.try_lock_irqsave() {
+        history.append(level, text);
+    }
+    if (level as u8) < KMSG_CONSOLE_LEVEL.load(Ordering::Relaxed) {
+        textui_putstr(text, fr_color, bk_color).ok();
+    }
+}
+
+/// 写入一条日志（`text`不超过[`KMSG_TEXT_MAX`]字节）
+pub fn kmsg_emit(level: LogLevel, fr_color: FontColor, bk_color: FontColor, text: &str) {
+    if !KMSG_ASYNC.load(Ordering::Acquire) {
+        kmsg_output(level, fr_color, bk_color, text);
+        return;
+    }
+
+    let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+    let ring = KMSG_RINGS[smp_get_processor_id() as usize].load(Ordering::Acquire);
+    if ring.is_null() {
+        drop(irq_guard);
+        kmsg_output(level, fr_color, bk_color, text);
+        return;
+    }
+    let ring = unsafe { &*ring };
+
+    if ring.is_full() {
+        KMSG_DROPPED.fetch_add(1, Ordering::Relaxed);
+    } else {
+        let len = core::cmp::min(text.len(), KMSG_TEXT_MAX);
+        let mut record = KmsgRecord {
+            seq: KMSG_SEQ.fetch_add(1, Ordering::Relaxed),
+            level,
+            fr_color,
+            bk_color,
+            len: len as u16,
+            text: [0; KMSG_TEXT_MAX],
+        };
+        record.text[..len].copy_from_slice(&text.as_bytes()[..len]);
+        // 关中断之后只有当前cpu写入这个缓冲区，上面检查过有空位，这里不会失败
+        ring.push(record).ok();
+    }
+    // 不能在这里直接唤醒kmsgd：调用者可能持有调度器的锁。由软中断完成唤醒
+    softirq_vectors().raise_softirq(SoftirqNumber::Kmsg);
+    drop(irq_guard);
+}
+
+/// 是否有还没有被取走的记录
+fn kmsg_pending() -> bool {
+    return KMSG_RINGS.iter().any(|ring| {
+        let ring = ring.load(Ordering::Acquire);
+        !ring.is_null() && !unsafe { (*ring).is_empty() }
+    }) || KMSG_DROPPED.load(Ordering::Relaxed) != 0;
+}
+
+/// 按照序号取走所有cpu上的记录，并输出它们
+///
+/// @return 是否输出了记录
+fn kmsg_drain() -> bool {
+    if KMSG_CONSUMING
+        .compare_exchange(false, true, Ordering::Acquire, Ordering::Relaxed)
+        .is_err()
+    {
+        return false;
+    }
+
+    let mut drained = false;
+    loop {
+        let mut oldest: Option<(u64, &KmsgRing)> = None;
+        for ring in KMSG_RINGS.iter() {
+            let ring = ring.load(Ordering::Acquire);
+            if ring.is_null() {
+                continue;
+            }
+            let ring = unsafe { &*ring };
+            if let Some(seq) = ring.peek_with(|r| r.seq) {
+                if oldest.map_or(true, |(s, _)| seq < s) {
+                    oldest = Some((seq, ring));
+                }
+            }
+        }
+        let ring = match oldest {
+            Some((_, ring)) => ring,
+            None => break,
+        };
+        let record = match ring.pop() {
+            Some(record) => record,
+            None => break,
+        };
+        kmsg_output(
+            record.level,
+            record.fr_color,
+            record.bk_color,
+            record.text(),
+        );
+        drained = true;
+    }
+
+    let dropped = KMSG_DROPPED.swap(0, Ordering::Relaxed);
+    if dropped != 0 {
+        kmsg_output(
+            LogLevel::WARNING,
+            FontColor::YELLOW,
+            FontColor::BLACK,
+            &format!("kmsg: {} messages dropped\n", dropped),
+        );
+        drained = true;
+    }
+
+    KMSG_CONSUMING.store(false, Ordering::Release);
+    return drained;
+}
+
+fn kmsgd_thread() -> i32 {
+    loop {
+        if kmsg_drain() {
+            KMSG_READ_WAIT.wakeup_all(None);
+        }
+        let guard = KMSGD_WAIT_LOCK.lock_irqsave();
+        if kmsg_pending() {
+            continue;
+        }
+        KMSGD_WAIT.sleep_uninterruptible_unlock_spinlock(guard);
+    }
+}
+
+#[derive(Debug)]
+struct KmsgSoftirq;
+
+impl SoftirqVec for KmsgSoftirq {
+    fn run(&self) {
+        let _guard = KMSGD_WAIT_LOCK.lock_irqsave();
+        KMSGD_WAIT.wakeup(None);
+    }
+}
+
+/// 启动kmsgd，之后printk异步输出（需要在软中断以及内核线程机制初始化完成之后调用）
+pub fn kmsg_init() {
+    let nr_cpus = (unsafe { smp_get_total_cpu() } as usize).clamp(1, PerCpu::MAX_CPU_NUM);
+    for ring in KMSG_RINGS.iter().take(nr_cpus) {
+        let ptr = Box::into_raw(Box::new(KmsgRing::new(KMSG_RING_SLOTS)));
+        ring.store(ptr, Ordering::Release);
+    }
+
+    softirq_vectors()
+        .register_softirq(SoftirqNumber::Kmsg, Arc::new(KmsgSoftirq))
+        .expect("Failed to register kmsg softirq");
+    let closure = KernelThreadClosure::EmptyClosure((Box::new(kmsgd_thread), ()));
+    KernelThreadMechanism::create_and_run(closure, "kmsgd".to_string())
+        .expect("Failed to create kmsgd");
+    KMSG_ASYNC.store(true, Ordering::Release);
+    kinfo!("kmsgd started");
+}
+
+/// panic时调用：输出还没有被kmsgd取走的日志，之后的日志同步输出
+pub fn kmsg_panic_flush() {
+    KMSG_ASYNC.store(false, Ordering::Release);
+    kmsg_drain();
+}
+
+/// 把格式化的日志拆分成记录写入kmsg
+pub struct KmsgWriter {
+    level: LogLevel,
+    fr_color: FontColor,
+    bk_color: FontColor,
+    buf: [u8; KMSG_TEXT_MAX],
+    len: usize,
+}
+
+impl KmsgWriter {
+    pub fn new(level: LogLevel, fr_color: FontColor, bk_color: FontColor) -> Self {
+        return Self {
+            level,
+            fr_color,
+            bk_color,
+            buf: [0; KMSG_TEXT_MAX],
+            len: 0,
+        };
+    }
+
+    /// 把缓冲区中的内容作为一条记录写入
+    pub fn flush(&mut self) {
+        if self.len == 0 {
+            return;
+        }
+        let text = unsafe { core::str::from_utf8_unchecked(&self.buf[..self.len]) };
+        kmsg_emit(self.level, self.fr_color, self.bk_color, text);
+        self.len = 0;
+    }
+}
+
+impl fmt::Write for KmsgWriter {
+    fn write_str(&mut self, mut s: &str) -> fmt::Result {
+        while !s.is_empty() {
+            // 在字符的边界处拆分
+            let mut n = core::cmp::min(s.len(), KMSG_TEXT_MAX - self.len);
+            while !s.is_char_boundary(n) {
+                n -= 1;
+            }
+            if n == 0 {
+                self.flush();
+                continue;
+            }
+            self.buf[self.len..self.len + n].copy_from_slice(&s.as_bytes()[..n]);
+            self.len += n;
+            s = &s[n..];
+            if self.len == KMSG_TEXT_MAX {
+                self.flush();
+            }
+        }
+        return Ok(());
+    }
+}
+
+impl Drop for KmsgWriter {
+    fn drop(&mut self) {
+        self.flush();
+    }
+}
+
+/// syslog的操作（与Linux的取值相同）
+const SYSLOG_ACTION_CLOSE: usize = 0;
+const SYSLOG_ACTION_OPEN: usize = 1;
+const SYSLOG_ACTION_READ: usize = 2;
+const SYSLOG_ACTION_READ_ALL: usize = 3;
+const SYSLOG_ACTION_READ_CLEAR: usize = 4;
+const SYSLOG_ACTION_CLEAR: usize = 5;
+const SYSLOG_ACTION_CONSOLE_OFF: usize = 6;
+const SYSLOG_ACTION_CONSOLE_ON: usize = 7;
+const SYSLOG_ACTION_CONSOLE_LEVEL: usize = 8;
+const SYSLOG_ACTION_SIZE_UNREAD: usize = 9;
+const SYSLOG_ACTION_SIZE_BUFFER: usize = 10;
+
+/// syslog系统调用的实现
+///
+/// ## 参数
+///
+/// - `action`：操作
+/// - `buf`：读取日志的缓冲区（只有读取操作使用）
+/// - `level`：SYSLOG_ACTION_CONSOLE_LEVEL设置的控制台日志级别
+///
+/// ## 返回值
+///
+/// 读取操作返回读到的字节数，SIZE_*返回对应的大小，其余操作返回0
+pub fn do_syslog(action: usize, buf: &mut [u8], level: usize) -> Result<usize, SystemError> {
+    match action {
+        SYSLOG_ACTION_CLOSE | SYSLOG_ACTION_OPEN => return Ok(0),
+        SYSLOG_ACTION_READ => {
+            if buf.is_empty() {
+                return Ok(0);
+            }
+            loop {
+                let mut history = KMSG_HISTORY.lock_irqsave();
+                if history.read < history.head {
+                    let read = history.read;
+                    let n = history.copy(read, buf);
+                    history.read = core::cmp::max(read, history.first()) + n;
+                    return Ok(n);
+                }
+                KMSG_READ_WAIT.sleep_unlock_spinlock(history);
+                if ProcessManager::current_pcb().has_pending_signal() {
+                    return Err(SystemError::ERESTARTSYS);
+                }
+            }
+        }
+        SYSLOG_ACTION_READ_ALL | SYSLOG_ACTION_READ_CLEAR => {
+            let mut history = KMSG_HISTORY.lock_irqsave();
+            let n = history.copy_tail(history.clear, buf);
+            if action == SYSLOG_ACTION_READ_CLEAR {
+                history.clear = history.head;
+            }
+            return Ok(n);
+        }
+        SYSLOG_ACTION_CLEAR => {
+            let mut history = KMSG_HISTORY.lock_irqsave();
+            history.clear = history.head;
+            return Ok(0);
+        }
+        SYSLOG_ACTION_CONSOLE_OFF => {
+            let prev = KMSG_CONSOLE_LEVEL.swap(1, Ordering::Relaxed);
+            KMSG_SAVED_CONSOLE_LEVEL.store(prev, Ordering::Relaxed);
+            return Ok(0);
+        }
+        SYSLOG_ACTION_CONSOLE_ON => {
+            let saved = KMSG_SAVED_CONSOLE_LEVEL.load(Ordering::Relaxed);
+            KMSG_CONSOLE_LEVEL.store(saved, Ordering::Relaxed);
+            return Ok(0);
+        }
+        SYSLOG_ACTION_CONSOLE_LEVEL => {
+            if !(1..=8).contains(&level) {
+                return Err(SystemError::EINVAL);
+            }
+            KMSG_CONSOLE_LEVEL.store(level as u8, Ordering::Relaxed);
+            return Ok(0);
+        }
+        SYSLOG_ACTION_SIZE_UNREAD => {
+            let history = KMSG_HISTORY.lock_irqsave();
+            return Ok(history.head - core::cmp::max(history.read, history.first()));
+        }
+        SYSLOG_ACTION_SIZE_BUFFER => return Ok(KMSG_HISTORY_SIZE),
+        _ => return Err(SystemError::EINVAL),
+    }
+}
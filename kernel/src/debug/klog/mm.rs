@@ -1,12 +1,16 @@
 extern crate klog_types;
 
-use core::intrinsics::unlikely;
+use core::{
+    intrinsics::unlikely,
+    sync::atomic::{AtomicBool, Ordering},
+};
 
 use klog_types::{AllocatorLog, AllocatorLogType, LogSource, MMLogChannel};
 
 use crate::{
     arch::CurrentTimeArch,
     process::{Pid, ProcessManager},
+    smp::core::smp_get_processor_id,
     time::TimeArch,
 };
 
@@ -17,62 +21,76 @@ use crate::{
 static __MM_ALLOCATOR_LOG_CHANNEL: MMLogChannel<{ MMDebugLogManager::MAX_ALLOC_LOG_NUM }> =
     MMLogChannel::new(MMDebugLogManager::MAX_ALLOC_LOG_NUM);
 
-/// 全局的内存分配器日志id分配器
+/// 是否记录内存分配器的日志
 ///
-/// id从1开始, 因为0是无效的id
-static __MM_DEBUG_LOG_IDA: ida::IdAllocator = ida::IdAllocator::new(1, usize::MAX);
+/// 标记为`no_mangle`是为了让调试器能够在运行时修改这个变量
+#[no_mangle]
+static __MM_ALLOCATOR_LOG_ENABLED: AtomicBool = AtomicBool::new(true);
 
 /// 记录内存分配器的日志
 ///
+/// 当日志被关闭时，这个函数只有一次分支判断的开销
+///
 /// ## 参数
 ///
 /// - `log_type`：日志类型
 /// - `source`：日志来源
+#[inline(always)]
 pub fn mm_debug_log(log_type: AllocatorLogType, source: LogSource) {
-    let pid = if unlikely(!ProcessManager::initialized()) {
-        Some(Pid::new(0))
-    } else {
-        Some(ProcessManager::current_pcb().pid())
-    };
-    MMDebugLogManager::log(log_type, source, pid);
+    if !MMDebugLogManager::enabled() {
+        return;
+    }
+    MMDebugLogManager::log_slow(log_type, source);
 }
 
 #[derive(Debug)]
-pub(super) struct MMDebugLogManager;
+pub struct MMDebugLogManager;
 
 impl MMDebugLogManager {
     /// 最大的内存分配器日志数量
     pub const MAX_ALLOC_LOG_NUM: usize = 100000;
 
+    /// 是否记录内存分配器的日志
+    #[inline(always)]
+    pub fn enabled() -> bool {
+        return __MM_ALLOCATOR_LOG_ENABLED.load(Ordering::Relaxed);
+    }
+
+    /// 打开或者关闭内存分配器的日志
+    #[allow(dead_code)]
+    pub fn set_enabled(enabled: bool) {
+        __MM_ALLOCATOR_LOG_ENABLED.store(enabled, Ordering::Relaxed);
+    }
+
+    #[inline(never)]
+    fn log_slow(log_type: AllocatorLogType, source: LogSource) {
+        let pid = if unlikely(!ProcessManager::initialized()) {
+            Some(Pid::new(0))
+        } else {
+            Some(ProcessManager::current_pcb().pid())
+        };
+        Self::log(log_type, source, pid);
+    }
+
     /// 记录内存分配器的日志
     ///
+    /// 日志被写入当前CPU的环形缓冲区，日志的id由环形缓冲区内的序号生成，不需要全局的id分配器
+    ///
     /// ## 参数
     ///
     /// - `log_type`：日志类型
     /// - `source`：日志来源
     /// - `pid`：日志来源的pid
     pub fn log(log_type: AllocatorLogType, source: LogSource, pid: Option<Pid>) {
-        let id = __MM_DEBUG_LOG_IDA.alloc().unwrap();
-        let log = AllocatorLog::new(
-            id as u64,
-            log_type,
-            source,
-            pid.map(|p| p.data()),
-            CurrentTimeArch::get_cycles() as u64,
-        );
-
-        let mut log = log;
-        loop {
-            let r = __MM_ALLOCATOR_LOG_CHANNEL.buf.push(log);
-            if let Err(r) = r {
-                // 如果日志通道满了，就把最早的日志丢弃
-                if __MM_ALLOCATOR_LOG_CHANNEL.buf.remaining() == 0 {
-                    __MM_ALLOCATOR_LOG_CHANNEL.buf.pop();
-                }
-                log = r.into_inner();
-            } else {
-                break;
-            }
-        }
+        let cpu = smp_get_processor_id() as usize;
+        __MM_ALLOCATOR_LOG_CHANNEL.push_with(cpu, |id| {
+            AllocatorLog::new(
+                id,
+                log_type,
+                source,
+                pid.map(|p| p.data()),
+                CurrentTimeArch::get_cycles() as u64,
+            )
+        });
     }
 }
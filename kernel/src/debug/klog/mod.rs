@@ -1 +1,2 @@
+pub mod kmsg;
 pub mod mm;
@@ -1 +1,5 @@
+pub mod kallsyms;
 pub mod klog;
+#[macro_use]
+pub mod trace;
+pub mod traceback;
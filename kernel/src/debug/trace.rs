@@ -0,0 +1,294 @@
+//! 静态跟踪点
+//!
+//! 内核中的关键路径（进程切换、唤醒、中断、软中断、缺页异常、块设备请求、网卡收发、系统调用）上放置了
+//! [`tracepoint!`]。跟踪点所属的类别没有被打开时，跟踪点只有一次内存读取和一次不太可能成立的分支，
+//! 参数也不会被求值。
+//!
+//! 被打开的跟踪点把事件写入当前cpu的环形缓冲区。写入者通过原子加法预留槽位，不需要加锁，也不需要关中断，
+//! 嵌套的中断会得到下一个槽位。缓冲区满之后，新的事件覆盖最旧的事件。
+//!
+//! `/proc/trace`：
+//! - 写入`all`、`none`，或者以逗号分隔的类别名（见[`trace_class::NAMES`]）来选择打开的类别；写入`reset`清空缓冲区
+//! - 读取得到二进制格式的所有事件（格式见[`TraceFileHeader`]），由主机上的`tools/debugging/trace_decode.py`解析
+
+use core::{
+    cell::UnsafeCell,
+    intrinsics::unlikely,
+    mem::size_of,
+    sync::atomic::{fence, AtomicU32, AtomicU64, Ordering},
+};
+
+use alloc::{boxed::Box, vec::Vec};
+use klog_types::{trace_class, TraceCpuHeader, TraceEventType, TraceFileHeader, TraceRecord};
+
+use crate::{
+    arch::{driver::tsc::TSCManager, CurrentTimeArch},
+    filesystem::vfs::seq_file::{SeqBuf, SeqOperations},
+    include::bindings::bindings::smp_get_total_cpu,
+    libs::{lazy_init::Lazy, spinlock::SpinLock},
+    mm::percpu::PerCpu,
+    process::ProcessManager,
+    smp::core::smp_get_processor_id,
+    syscall::SystemError,
+    time::TimeArch,
+};
+
+/// 每个cpu的环形缓冲区的记录数（必须是2的幂）
+const TRACE_RING_SIZE: usize = 8192;
+
+/// 块设备请求事件的第二个参数是块数，写请求会额外置上这一位
+pub const TRACE_BLOCK_WRITE: u64 = 1 << 63;
+
+/// 打开的跟踪事件类别（[`trace_class`]中的位）
+///
+/// 标记为`no_mangle`，使C代码（例如do_IRQ）也能直接检查
+#[no_mangle]
+pub static __TRACE_EVENTS_ENABLED: AtomicU32 = AtomicU32::new(0);
+
+/// 每个cpu的环形缓冲区，第一次打开跟踪时才分配
+static TRACE_RINGS: Lazy<Box<[TraceRing]>> = Lazy::new();
+static TRACE_RINGS_INIT_LOCK: SpinLock<()> = SpinLock::new(());
+
+/// 在内核中放置一个跟踪点
+///
+/// ## 用法
+///
+/// `tracepoint!(SchedSwitch, prev_pid, next_pid)`，第一个参数是[`TraceEventType`]的成员，
+/// 之后是两个可以被转换为u64的参数
+#[macro_export]
+macro_rules! tracepoint {
+    ($event:ident, $arg0:expr, $arg1:expr) => {
+        if $crate::debug::trace::trace_enabled(::klog_types::TraceEventType::$event.class()) {
+            $crate::debug::trace::trace_record(
+                ::klog_types::TraceEventType::$event,
+                ($arg0) as u64,
+                ($arg1) as u64,
+            );
+        }
+    };
+}
+
+/// `class`类别的跟踪点是否被打开
+#[inline(always)]
+pub fn trace_enabled(class: u32) -> bool {
+    return unlikely(__TRACE_EVENTS_ENABLED.load(Ordering::Relaxed) & class != 0);
+}
+
+/// 记录一个事件（由[`tracepoint!`]调用）
+#[inline(never)]
+pub fn trace_record(event: TraceEventType, arg0: u64, arg1: u64) {
+    let rings = match TRACE_RINGS.try_get() {
+        Some(rings) => rings,
+        None => return,
+    };
+    let cpu = smp_get_processor_id() as usize;
+    let ring = match rings.get(cpu) {
+        Some(ring) => ring,
+        None => return,
+    };
+    let pid = if unlikely(!ProcessManager::initialized()) {
+        0
+    } else {
+        ProcessManager::current_pcb().pid().data() as u32
+    };
+    ring.push(TraceRecord {
+        time: CurrentTimeArch::get_cycles() as u64,
+        event: event as u16,
+        cpu: cpu as u16,
+        pid,
+        args: [arg0, arg1],
+    });
+}
+
+/// do_IRQ中的跟踪点（C代码先检查了[`__TRACE_EVENTS_ENABLED`]）
+#[no_mangle]
+extern "C" fn rs_trace_irq(vector: u8, entry: bool) {
+    if entry {
+        tracepoint!(IrqEntry, vector, 0);
+    } else {
+        tracepoint!(IrqExit, vector, 0);
+    }
+}
+
+/// 设置打开的跟踪事件类别
+pub fn trace_set_enabled(mask: u32) {
+    if mask != 0 {
+        trace_rings_init();
+    }
+    __TRACE_EVENTS_ENABLED.store(mask & trace_class::ALL, Ordering::Relaxed);
+}
+
+fn trace_rings_init() {
+    let _guard = TRACE_RINGS_INIT_LOCK.lock();
+    if TRACE_RINGS.initialized() {
+        return;
+    }
+    let nr_cpus = (unsafe { smp_get_total_cpu() } as usize).clamp(1, PerCpu::MAX_CPU_NUM);
+    let rings: Vec<TraceRing> = (0..nr_cpus).map(|_| TraceRing::new()).collect();
+    TRACE_RINGS.init(rings.into_boxed_slice());
+}
+
+/// 一个槽位
+///
+/// `seq`为写入这个槽位的事件的序号加一，正在被写入时为0。读者在复制记录前后各读一次`seq`，
+/// 两次相同并且等于预期的序号时，复制的记录才是完整的
+struct TraceSlot {
+    seq: AtomicU64,
+    record: UnsafeCell<TraceRecord>,
+}
+
+/// 一个cpu的环形缓冲区
+struct TraceRing {
+    /// 下一个事件的序号
+    head: AtomicU64,
+    slots: Box<[TraceSlot]>,
+}
+
+unsafe impl Sync for TraceRing {}
+
+impl TraceRing {
+    fn new() -> Self {
+        let slots: Vec<TraceSlot> = (0..TRACE_RING_SIZE)
+            .map(|_| TraceSlot {
+                seq: AtomicU64::new(0),
+                record: UnsafeCell::new(TraceRecord::zeroed()),
+            })
+            .collect();
+        return Self {
+            head: AtomicU64::new(0),
+            slots: slots.into_boxed_slice(),
+        };
+    }
+
+    #[inline]
+    fn push(&self, record: TraceRecord) {
+        // 写者通常只有当前cpu（以及在它上面嵌套的中断），这里的原子操作不会产生跨cpu的竞争
+        let seq = self.head.fetch_add(1, Ordering::Relaxed);
+        let slot = &self.slots[seq as usize & (TRACE_RING_SIZE - 1)];
+        slot.seq.store(0, Ordering::Relaxed);
+        fence(Ordering::Release);
+        unsafe { core::ptr::write_volatile(slot.record.get(), record) };
+        slot.seq.store(seq + 1, Ordering::Release);
+    }
+
+    /// 复制出缓冲区中所有完整的记录（按时间顺序）
+    ///
+    /// ## 返回值
+    ///
+    /// (记录, 被覆盖或者在复制过程中被覆盖的记录数)
+    fn snapshot(&self) -> (Vec<TraceRecord>, u64) {
+        let head = self.head.load(Ordering::Acquire);
+        let start = head.saturating_sub(TRACE_RING_SIZE as u64);
+        let mut records = Vec::with_capacity((head - start) as usize);
+        for seq in start..head {
+            let slot = &self.slots[seq as usize & (TRACE_RING_SIZE - 1)];
+            if slot.seq.load(Ordering::Acquire) != seq + 1 {
+                continue;
+            }
+            let record = unsafe { core::ptr::read_volatile(slot.record.get()) };
+            fence(Ordering::Acquire);
+            if slot.seq.load(Ordering::Relaxed) != seq + 1 {
+                continue;
+            }
+            records.push(record);
+        }
+        let lost = head - records.len() as u64;
+        return (records, lost);
+    }
+
+    fn reset(&self) {
+        for slot in self.slots.iter() {
+            slot.seq.store(0, Ordering::Relaxed);
+        }
+        self.head.store(0, Ordering::Release);
+    }
+}
+
+/// 处理对`/proc/trace`的写入
+pub fn trace_store(buf: &[u8]) -> Result<(), SystemError> {
+    let s = core::str::from_utf8(buf).map_err(|_| SystemError::EINVAL)?;
+    let s = s.trim_matches(|c: char| c.is_whitespace() || c == '\0');
+    match s {
+        "all" => trace_set_enabled(trace_class::ALL),
+        "none" => trace_set_enabled(0),
+        "reset" => {
+            if let Some(rings) = TRACE_RINGS.try_get() {
+                rings.iter().for_each(|r| r.reset());
+            }
+        }
+        _ => {
+            let mut mask = 0;
+            for name in s.split(',').map(|n| n.trim()) {
+                let bit = trace_class::NAMES
+                    .iter()
+                    .position(|n| *n == name)
+                    .ok_or(SystemError::EINVAL)?;
+                mask |= 1 << bit;
+            }
+            trace_set_enabled(mask);
+        }
+    }
+    return Ok(());
+}
+
+/// `/proc/trace`：第0个记录是文件头部，第n+1个记录是第n个cpu的数据
+#[derive(Debug)]
+pub struct TraceSeq {
+    pub nr_cpus: u32,
+}
+
+impl TraceSeq {
+    pub fn new() -> Self {
+        return Self {
+            nr_cpus: unsafe { smp_get_total_cpu() },
+        };
+    }
+}
+
+impl SeqOperations for TraceSeq {
+    type Cursor = usize;
+
+    fn start(&self, pos: usize) -> Option<usize> {
+        return if pos <= self.nr_cpus as usize {
+            Some(pos)
+        } else {
+            None
+        };
+    }
+
+    fn show(&self, pos: &usize, s: &mut SeqBuf) -> Result<(), SystemError> {
+        if *pos == 0 {
+            let header = TraceFileHeader {
+                magic: TraceFileHeader::MAGIC,
+                version: TraceFileHeader::VERSION,
+                record_size: size_of::<TraceRecord>() as u16,
+                nr_cpus: self.nr_cpus,
+                enabled: __TRACE_EVENTS_ENABLED.load(Ordering::Relaxed),
+                tsc_khz: TSCManager::tsc_khz(),
+            };
+            s.extend_from_slice(as_bytes(&header));
+            return Ok(());
+        }
+
+        let cpu = *pos - 1;
+        let (records, lost) = match TRACE_RINGS.try_get().and_then(|rings| rings.get(cpu)) {
+            Some(ring) => ring.snapshot(),
+            None => (Vec::new(), 0),
+        };
+        let header = TraceCpuHeader {
+            cpu: cpu as u32,
+            nr_records: records.len() as u32,
+            lost,
+        };
+        s.extend_from_slice(as_bytes(&header));
+        for record in records.iter() {
+            s.extend_from_slice(as_bytes(record));
+        }
+        return Ok(());
+    }
+}
+
+/// 把`#[repr(C)]`、没有填充字节的结构体视为字节数组
+fn as_bytes<T: Copy>(value: &T) -> &[u8] {
+    return unsafe { core::slice::from_raw_parts(value as *const T as *const u8, size_of::<T>()) };
+}
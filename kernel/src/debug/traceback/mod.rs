@@ -0,0 +1,119 @@
+//! 基于帧指针（rbp）的调用栈回溯
+//!
+//! 与traceback.c相同，依赖函数序言中保存的rbp：`[rbp]`是上一层的rbp，`[rbp + 8]`是返回地址。
+//! 这里的函数只收集返回地址，不加锁、不触发缺页，可以在NMI中调用（性能采样）
+
+use core::mem::size_of;
+
+use crate::{
+    arch::{
+        interrupt::TrapFrame,
+        mm::{LockedFrameAllocator, PageMapper},
+        MMArch,
+    },
+    mm::{MemoryManagementArch, PageTableKind, VirtAddr},
+    process::{KernelStack, ProcessFlags, ProcessManager},
+};
+
+/// 收集被中断的内核代码的调用栈（第一项是`regs.rip`），返回收集到的地址数量
+///
+/// 只在被中断时所在的内核栈内回溯，帧指针离开这个栈时停止
+pub fn unwind_kernel(regs: &TrapFrame, out: &mut [u64]) -> usize {
+    if out.is_empty() || regs.from_user() {
+        return 0;
+    }
+    out[0] = regs.rip;
+    let mut n = 1;
+    let stack_low = regs.rsp as usize;
+    let stack_high = (stack_low & !(KernelStack::ALIGN - 1)) + KernelStack::SIZE;
+    let mut fp = regs.rbp as usize;
+    while n < out.len() {
+        if fp < stack_low || fp % size_of::<u64>() != 0 || fp + 2 * size_of::<u64>() > stack_high {
+            break;
+        }
+        let (next, ret) = unsafe { (*(fp as *const usize), *((fp + 8) as *const u64)) };
+        if ret == 0 {
+            break;
+        }
+        out[n] = ret;
+        n += 1;
+        // 栈向低地址增长，上一层的帧一定在更高的地址
+        if next <= fp {
+            break;
+        }
+        fp = next;
+    }
+    return n;
+}
+
+/// 收集被中断的用户程序的调用栈（第一项是用户态的rip），返回收集到的地址数量
+///
+/// `regs`是被中断时的现场。被中断的是内核代码时，使用进程从用户态进入内核时保存在内核栈顶部的现场。
+/// 用户栈通过查询当前页表来读取，没有映射的页不会被换入，遇到时停止回溯
+pub fn unwind_user(regs: &TrapFrame, out: &mut [u64]) -> usize {
+    if out.is_empty() {
+        return 0;
+    }
+    let regs = match user_regs(regs) {
+        Some(regs) => regs,
+        None => return 0,
+    };
+    out[0] = regs.rip;
+    let mut n = 1;
+    let mut fp = regs.rbp as usize;
+    while n < out.len() {
+        if fp < regs.rsp as usize || fp % size_of::<u64>() != 0 {
+            break;
+        }
+        let (next, ret) = match (read_user_u64(fp), read_user_u64(fp + 8)) {
+            (Some(next), Some(ret)) => (next as usize, ret),
+            _ => break,
+        };
+        if ret == 0 {
+            break;
+        }
+        out[n] = ret;
+        n += 1;
+        if next <= fp {
+            break;
+        }
+        fp = next;
+    }
+    return n;
+}
+
+/// 当前进程从用户态进入内核时保存的现场，内核线程没有这个现场
+fn user_regs(regs: &TrapFrame) -> Option<&TrapFrame> {
+    if regs.from_user() {
+        return Some(regs);
+    }
+    if !ProcessManager::initialized()
+        || ProcessManager::current_pcb()
+            .flags()
+            .contains(ProcessFlags::KTHREAD)
+    {
+        return None;
+    }
+    let stack_top = (regs.rsp as usize & !(KernelStack::ALIGN - 1)) + KernelStack::SIZE;
+    let frame = unsafe { &*((stack_top - size_of::<TrapFrame>()) as *const TrapFrame) };
+    if !frame.from_user() {
+        return None;
+    }
+    return Some(frame);
+}
+
+/// 通过当前页表读取用户地址`addr`处的u64（`addr`按8字节对齐，不会跨页），页没有映射时返回None
+fn read_user_u64(addr: usize) -> Option<u64> {
+    let vaddr = VirtAddr::new(addr);
+    if !vaddr.check_user() {
+        return None;
+    }
+    let mapper = unsafe { PageMapper::current(PageTableKind::User, LockedFrameAllocator) };
+    let (paddr, flags) = mapper.translate(vaddr)?;
+    if !flags.has_user() {
+        return None;
+    }
+    let kaddr = unsafe { MMArch::phys_2_virt(paddr) }?;
+    let offset = addr & MMArch::PAGE_OFFSET_MASK;
+    return Some(unsafe { *((kaddr.data() + offset) as *const u64) });
+}
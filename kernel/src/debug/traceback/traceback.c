@@ -2,28 +2,95 @@
 #include <common/printk.h>
 #include <process/process.h>
 
-int lookup_kallsyms(uint64_t addr, int level)
+// 与debug/kallsyms.c中的定义一致
+#define KALLSYMS_MARKER_STRIDE 16
+
+static inline uint64_t kallsyms_symbol_addr(uint64_t index)
 {
-    const char *str = (const char *)&kallsyms_names;
+    return kallsyms_relative_base + kallsyms_offsets[index];
+}
 
-    // 暴力查找符合要求的symbol
-    // todo: 改用二分搜索。
-    // 由于符号表使用nm -n生成，因此是按照地址升序排列的，因此可以二分
-    uint64_t index = 0;
-    for (index = 0; index < kallsyms_num - 1; ++index)
+/**
+ * @brief 二分查找地址所在的函数
+ *
+ * @return int64_t 起始地址不大于addr的最后一个符号的下标，addr不在内核代码段内时返回-1
+ */
+static int64_t kallsyms_lookup_index(uint64_t addr)
+{
+    if (&kallsyms_num == NULL || kallsyms_num == 0)
+        return -1;
+    if (addr < kallsyms_symbol_addr(0) || addr >= kallsyms_text_end)
+        return -1;
+
+    uint64_t lo = 0, hi = kallsyms_num;
+    while (hi - lo > 1)
     {
-        if (addr > kallsyms_address[index] && addr <= kallsyms_address[index + 1])
-            break;
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (kallsyms_symbol_addr(mid) <= addr)
+            lo = mid;
+        else
+            hi = mid;
     }
+    return lo;
+}
 
-    if (index < kallsyms_num) // 找到对应的函数
+/**
+ * @brief 解压第index个符号的名字
+ *
+ * 从它之前最近的标记点开始，依次还原每个名字：保留前一个名字的前缀，再接上这个名字剩余的部分
+ */
+static void kallsyms_expand_name(uint64_t index, char *name)
+{
+    const uint8_t *p = kallsyms_names + kallsyms_markers[index / KALLSYMS_MARKER_STRIDE];
+    uint64_t len = 0;
+    for (uint64_t i = index - index % KALLSYMS_MARKER_STRIDE; i <= index; ++i)
     {
-        // 依次输出函数名称、rip离函数起始处的偏移量、函数执行的rip
-        printk("function:%s() \t(+) %04d address:%#018lx\n", &str[kallsyms_names_index[index]], addr - kallsyms_address[index], addr);
-        return 0;
+        uint64_t prefix = *p++;
+        len = prefix < len ? prefix : len;
+        while (*p != '\0')
+        {
+            if (len < KSYM_NAME_LEN - 1)
+                name[len++] = *p;
+            ++p;
+        }
+        ++p;
     }
-    else
+    name[len] = '\0';
+}
+
+int kallsyms_lookup(uint64_t addr, char *name, uint64_t *offset, uint64_t *size)
+{
+    int64_t index = kallsyms_lookup_index(addr);
+    if (index < 0)
         return -1;
+
+    uint64_t start = kallsyms_symbol_addr(index);
+    uint64_t end = (uint64_t)index + 1 < kallsyms_num ? kallsyms_symbol_addr(index + 1) : kallsyms_text_end;
+    kallsyms_expand_name(index, name);
+    *offset = addr - start;
+    *size = end - start;
+    return 0;
+}
+
+int kallsyms_get_symbol(uint64_t index, char *name, uint64_t *addr)
+{
+    if (&kallsyms_num == NULL || index >= kallsyms_num)
+        return -1;
+    kallsyms_expand_name(index, name);
+    *addr = kallsyms_symbol_addr(index);
+    return 0;
+}
+
+int lookup_kallsyms(uint64_t addr, int level)
+{
+    char name[KSYM_NAME_LEN];
+    uint64_t offset, size;
+    if (kallsyms_lookup(addr, name, &offset, &size) != 0)
+        return -1;
+
+    // 依次输出函数名称、rip离函数起始处的偏移量、函数执行的rip
+    printk("function:%s() \t(+) %04d address:%#018lx\n", name, offset, addr);
+    return 0;
 }
 
 /**
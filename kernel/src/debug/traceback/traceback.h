@@ -2,12 +2,40 @@
 #include <common/glib.h>
 #include <process/ptrace.h>
 
-// 使用弱引用属性导出kallsyms中的符号表。
+// 使用弱引用属性导出kallsyms中的符号表（格式见debug/kallsyms.c）。
 // 采用weak属性是由于第一次编译时，kallsyms还未链接进来，若不使用weak属性则会报错
-extern const uint64_t kallsyms_address[] __attribute__((weak));
 extern const uint64_t kallsyms_num __attribute__((weak));
-extern const uint64_t kallsyms_names_index[] __attribute__((weak));
-extern const char *kallsyms_names __attribute__((weak));
+extern const uint64_t kallsyms_relative_base __attribute__((weak));
+extern const uint64_t kallsyms_text_end __attribute__((weak));
+extern const uint32_t kallsyms_offsets[] __attribute__((weak));
+extern const uint8_t kallsyms_names[] __attribute__((weak));
+extern const uint32_t kallsyms_markers[] __attribute__((weak));
+
+// 符号名的最大长度（含结束符）
+#define KSYM_NAME_LEN 512
+
+/**
+ * @brief 查找地址所在的函数
+ *
+ * 符号表按地址排序，使用二分查找。不加锁、不分配内存，可以在中断和NMI中调用
+ *
+ * @param addr 要查找的地址
+ * @param name 保存函数名的缓冲区，至少KSYM_NAME_LEN字节
+ * @param offset 返回addr相对于函数起始地址的偏移量
+ * @param size 返回函数的大小（到下一个符号为止）
+ * @return int 找到时返回0，addr不在内核代码段内（或者符号表还没有链接进来）时返回-1
+ */
+int kallsyms_lookup(uint64_t addr, char *name, uint64_t *offset, uint64_t *size);
+
+/**
+ * @brief 获取第index个符号（按地址升序）
+ *
+ * @param index 符号的下标
+ * @param name 保存函数名的缓冲区，至少KSYM_NAME_LEN字节
+ * @param addr 返回符号的地址
+ * @return int 成功时返回0，index超出范围时返回-1
+ */
+int kallsyms_get_symbol(uint64_t index, char *name, uint64_t *addr);
 
 /**
  * @brief 追溯内核栈调用情况
@@ -21,6 +21,7 @@ extern crate acpi;
 pub mod bus;
 mod c_adapter;
 pub mod glue;
+pub mod numa;
 pub mod pmtmr;
 mod sysfs;
 
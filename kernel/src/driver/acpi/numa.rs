@@ -0,0 +1,168 @@
+//! 解析SRAT（System Resource Affinity Table）和SLIT（System Locality Information Table）
+//!
+//! SRAT描述每个处理器（以APIC ID标识）和每段物理内存所属的邻近域（proximity domain），
+//! SLIT给出邻近域之间的相对访问延迟。这里把出现过的邻近域按照出现的顺序编号为节点0,1,...
+
+use acpi::sdt::SdtHeader;
+use alloc::vec::Vec;
+
+use crate::{kwarn, mm::PhysAddr};
+
+use super::AcpiManager;
+
+#[repr(transparent)]
+struct Srat {
+    header: SdtHeader,
+}
+
+unsafe impl acpi::AcpiTable for Srat {
+    const SIGNATURE: acpi::sdt::Signature = acpi::sdt::Signature::SRAT;
+    fn header(&self) -> &acpi::sdt::SdtHeader {
+        return &self.header;
+    }
+}
+
+#[repr(transparent)]
+struct Slit {
+    header: SdtHeader,
+}
+
+unsafe impl acpi::AcpiTable for Slit {
+    const SIGNATURE: acpi::sdt::Signature = acpi::sdt::Signature::SLIT;
+    fn header(&self) -> &acpi::sdt::SdtHeader {
+        return &self.header;
+    }
+}
+
+/// SRAT的表头之后有12字节的保留字段
+const SRAT_ENTRIES_OFFSET: usize = 48;
+/// SLIT中邻近域数量字段的偏移
+const SLIT_LOCALITIES_OFFSET: usize = 36;
+
+const SRAT_TYPE_CPU_AFFINITY: u8 = 0;
+const SRAT_TYPE_MEMORY_AFFINITY: u8 = 1;
+const SRAT_TYPE_X2APIC_CPU_AFFINITY: u8 = 2;
+
+/// 表项中的“已启用”标志
+const SRAT_FLAG_ENABLED: u32 = 1;
+
+/// 从ACPI表中得到的NUMA拓扑
+#[derive(Debug, Default)]
+pub struct AcpiNumaInfo {
+    /// 节点的数量
+    pub nr_nodes: usize,
+    /// (APIC ID, 节点)
+    pub cpus: Vec<(u32, usize)>,
+    /// (起始地址, 结束地址, 节点)
+    pub memblks: Vec<(PhysAddr, PhysAddr, usize)>,
+    /// nr_nodes*nr_nodes的距离矩阵（没有SLIT表时为空）
+    pub distance: Vec<u8>,
+}
+
+fn read_u32(data: &[u8], offset: usize) -> u32 {
+    return u32::from_le_bytes(data[offset..offset + 4].try_into().unwrap());
+}
+
+fn read_u64(data: &[u8], offset: usize) -> u64 {
+    return u64::from_le_bytes(data[offset..offset + 8].try_into().unwrap());
+}
+
+impl AcpiManager {
+    /// 解析SRAT和SLIT，获取NUMA拓扑。没有SRAT表时返回None
+    pub fn numa_info(&self) -> Option<AcpiNumaInfo> {
+        let tables = self.tables()?;
+        let srat = tables.find_entire_table::<Srat>().ok()?;
+        let srat = unsafe {
+            core::slice::from_raw_parts(
+                srat.virtual_start().as_ptr() as *const u8,
+                srat.region_length(),
+            )
+        };
+        let len = (read_u32(srat, 4) as usize).min(srat.len());
+
+        // 出现过的邻近域，下标即为节点号
+        let mut domains: Vec<u32> = Vec::new();
+        let mut node_of = |pxm: u32| -> usize {
+            match domains.iter().position(|d| *d == pxm) {
+                Some(node) => node,
+                None => {
+                    domains.push(pxm);
+                    domains.len() - 1
+                }
+            }
+        };
+
+        let mut info = AcpiNumaInfo::default();
+        let mut offset = SRAT_ENTRIES_OFFSET;
+        while offset + 2 <= len {
+            let entry_type = srat[offset];
+            let entry_len = srat[offset + 1] as usize;
+            if entry_len < 2 || offset + entry_len > len {
+                kwarn!("acpi: malformed SRAT entry at offset {}", offset);
+                break;
+            }
+            let entry = &srat[offset..offset + entry_len];
+            match entry_type {
+                SRAT_TYPE_CPU_AFFINITY if entry_len >= 16 => {
+                    if read_u32(entry, 4) & SRAT_FLAG_ENABLED != 0 {
+                        let pxm = entry[2] as u32
+                            | (entry[9] as u32) << 8
+                            | (entry[10] as u32) << 16
+                            | (entry[11] as u32) << 24;
+                        info.cpus.push((entry[3] as u32, node_of(pxm)));
+                    }
+                }
+                SRAT_TYPE_MEMORY_AFFINITY if entry_len >= 40 => {
+                    let size = read_u64(entry, 16) as usize;
+                    if read_u32(entry, 28) & SRAT_FLAG_ENABLED != 0 && size != 0 {
+                        let base = read_u64(entry, 8) as usize;
+                        let node = node_of(read_u32(entry, 2));
+                        info.memblks
+                            .push((PhysAddr::new(base), PhysAddr::new(base + size), node));
+                    }
+                }
+                SRAT_TYPE_X2APIC_CPU_AFFINITY if entry_len >= 24 => {
+                    if read_u32(entry, 12) & SRAT_FLAG_ENABLED != 0 {
+                        let node = node_of(read_u32(entry, 4));
+                        info.cpus.push((read_u32(entry, 8), node));
+                    }
+                }
+                _ => {}
+            }
+            offset += entry_len;
+        }
+        info.nr_nodes = domains.len();
+
+        if let Ok(slit) = tables.find_entire_table::<Slit>() {
+            let slit = unsafe {
+                core::slice::from_raw_parts(
+                    slit.virtual_start().as_ptr() as *const u8,
+                    slit.region_length(),
+                )
+            };
+            info.distance = Self::parse_slit(slit, &domains);
+        }
+
+        return Some(info);
+    }
+
+    /// 按照节点号重排SLIT的距离矩阵（SLIT按照邻近域编号）
+    fn parse_slit(slit: &[u8], domains: &[u32]) -> Vec<u8> {
+        let nr_localities = read_u64(slit, SLIT_LOCALITIES_OFFSET) as usize;
+        let matrix = SLIT_LOCALITIES_OFFSET + 8;
+        if domains.iter().any(|d| *d as usize >= nr_localities)
+            || matrix + nr_localities * nr_localities > slit.len()
+        {
+            kwarn!("acpi: SLIT does not match SRAT, ignored");
+            return Vec::new();
+        }
+        let nr = domains.len();
+        let mut distance = Vec::with_capacity(nr * nr);
+        for from in domains.iter() {
+            for to in domains.iter() {
+                distance.push(slit[matrix + *from as usize * nr_localities + *to as usize]);
+            }
+        }
+        return distance;
+    }
+}
@@ -1,5 +1,6 @@
 /// 引入Module
 use crate::{
+    debug::trace::TRACE_BLOCK_WRITE,
     driver::base::{
         device::{mkdev, Device, DeviceError, DeviceNumber, IdTable, BLOCKDEVS},
         map::{
@@ -13,7 +14,11 @@ use crate::{
 use alloc::{sync::Arc, vec::Vec};
 use core::any::Any;
 
-use super::disk_info::Partition;
+use super::{
+    disk_info::Partition,
+    request_queue::BlockRequestQueue,
+    stats::{BlkIoAcct, BlkOp},
+};
 
 /// 该文件定义了 Device 和 BlockDevice 的接口
 /// Notice 设备错误码使用 Posix 规定的 int32_t 的错误码表示，而不是自己定义错误enum
@@ -235,6 +240,91 @@ pub trait BlockDevice: Device {
     /// @brief 返回当前磁盘上的所有分区的Arc指针数组
     fn partitions(&self) -> Vec<Arc<Partition>>;
 
+    /// @brief 返回块设备的请求队列。没有请求队列的设备，读写直接交给驱动
+    fn request_queue(&self) -> Option<Arc<BlockRequestQueue>> {
+        return None;
+    }
+
+    /// @brief 通过请求队列读取块设备，参数与返回值同read_at
+    ///
+    /// 队列中还没有写入设备的、与读取范围重叠的写请求，会先被写入设备
+    fn submit_read(
+        &self,
+        lba_id_start: BlockId,
+        count: usize,
+        buf: &mut [u8],
+    ) -> Result<usize, SystemError> {
+        if let Some(queue) = self.request_queue() {
+            queue.prepare_read(lba_id_start, count);
+        }
+        tracepoint!(BlockRqIssue, lba_id_start, count);
+        let acct = BlkIoAcct::start(self, BlkOp::Read, lba_id_start);
+        let r = self.read_at(lba_id_start, count, buf);
+        acct.done(self, BlkOp::Read, count, 0);
+        tracepoint!(BlockRqComplete, lba_id_start, count);
+        return r;
+    }
+
+    /// @brief 通过请求队列写入块设备，参数与返回值同write_at
+    ///
+    /// 请求可能只是被放入了队列，与相邻的请求合并之后再写入设备。派发时发生的错误由sync返回
+    fn submit_write(
+        &self,
+        lba_id_start: BlockId,
+        count: usize,
+        buf: &[u8],
+    ) -> Result<usize, SystemError> {
+        if let Some(queue) = self.request_queue() {
+            return queue.submit_write(lba_id_start, count, buf);
+        }
+        tracepoint!(BlockRqIssue, lba_id_start, count as u64 | TRACE_BLOCK_WRITE);
+        let acct = BlkIoAcct::start(self, BlkOp::Write, lba_id_start);
+        let r = self.write_at(lba_id_start, count, buf);
+        acct.done(self, BlkOp::Write, count, 0);
+        tracepoint!(
+            BlockRqComplete,
+            lba_id_start,
+            count as u64 | TRACE_BLOCK_WRITE
+        );
+        return r;
+    }
+
+    /// @brief 绕过请求队列，把buf直接交给驱动写入设备（O_DIRECT），返回时数据已经写入设备
+    ///
+    /// 队列中与写入范围重叠的写请求先被派发，保证它们不会在之后覆盖这次写入的数据。
+    /// buf原样交给驱动，它是用户缓冲区时，AHCI等驱动会固定它的物理页（见[`crate::mm::pin::PinnedUserPages`]）并直接DMA
+    ///
+    /// @param offset 写入位置在设备上的字节偏移量，必须按块对齐
+    /// @param len 写入的字节数，必须是块大小的整数倍
+    fn write_at_bytes_direct(
+        &self,
+        offset: usize,
+        len: usize,
+        buf: &[u8],
+    ) -> Result<usize, SystemError> {
+        let blk_mask = (1usize << self.blk_size_log2()) - 1;
+        if (offset | len) & blk_mask != 0 {
+            return Err(SystemError::EINVAL);
+        } else if len > buf.len() {
+            return Err(SystemError::E2BIG);
+        }
+        let lba_id_start = offset >> self.blk_size_log2();
+        let count = len >> self.blk_size_log2();
+        if let Some(queue) = self.request_queue() {
+            queue.prepare_read(lba_id_start, count);
+        }
+        tracepoint!(BlockRqIssue, lba_id_start, count as u64 | TRACE_BLOCK_WRITE);
+        let acct = BlkIoAcct::start(self, BlkOp::Write, lba_id_start);
+        let r = self.write_at(lba_id_start, count, &buf[..len]);
+        acct.done(self, BlkOp::Write, count, 0);
+        tracepoint!(
+            BlockRqComplete,
+            lba_id_start,
+            count as u64 | TRACE_BLOCK_WRITE
+        );
+        return r;
+    }
+
     fn write_at_bytes(&self, offset: usize, len: usize, buf: &[u8]) -> Result<usize, SystemError> {
         // assert!(len <= buf.len());
         if len > buf.len() {
@@ -252,7 +342,7 @@ pub trait BlockDevice: Device {
             let full = multi && range.is_multi() || !multi && range.is_full();
 
             if full {
-                self.write_at(range.lba_start, count, buf_slice)?;
+                self.submit_write(range.lba_start, count, buf_slice)?;
             } else {
                 if self.blk_size_log2() > BLK_SIZE_LOG2_LIMIT {
                     return Err(SystemError::E2BIG);
@@ -261,10 +351,10 @@ pub trait BlockDevice: Device {
                 let mut temp = Vec::new();
                 temp.resize(1usize << self.blk_size_log2(), 0);
                 // 由于块设备每次读写都是整块的，在不完整写入之前，必须把不完整的地方补全
-                self.read_at(range.lba_start, 1, &mut temp[..])?;
+                self.submit_read(range.lba_start, 1, &mut temp[..])?;
                 // 把数据从临时buffer复制到目标buffer
                 temp[range.begin..range.end].copy_from_slice(&buf_slice);
-                self.write_at(range.lba_start, 1, &temp[..])?;
+                self.submit_write(range.lba_start, 1, &temp[..])?;
             }
         }
         return Ok(len);
@@ -294,8 +384,8 @@ pub trait BlockDevice: Device {
 
             // 读取整个block作为有效数据
             if full {
-                // 调用 BlockDevice::read_at() 直接把引用传进去，不是把整个数组move进去
-                self.read_at(range.lba_start, count, buf_slice)?;
+                // 调用 BlockDevice::submit_read() 直接把引用传进去，不是把整个数组move进去
+                self.submit_read(range.lba_start, count, buf_slice)?;
             } else {
                 // 判断块的长度不能超过最大值
                 if self.blk_size_log2() > BLK_SIZE_LOG2_LIMIT {
@@ -304,7 +394,7 @@ pub trait BlockDevice: Device {
 
                 let mut temp = Vec::new();
                 temp.resize(1usize << self.blk_size_log2(), 0);
-                self.read_at(range.lba_start, 1, &mut temp[..])?;
+                self.submit_read(range.lba_start, 1, &mut temp[..])?;
 
                 // 把数据从临时buffer复制到目标buffer
                 buf_slice.copy_from_slice(&temp[range.begin..range.end]);
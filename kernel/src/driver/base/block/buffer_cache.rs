@@ -0,0 +1,283 @@
+//! 块设备的缓冲区缓存
+//!
+//! 文件系统的元数据（目录项、FAT表、FsInfo等）以块为单位读写，并且同一个块往往被反复访问。
+//! 缓冲区缓存以块号为键缓存这些块：
+//!
+//! - 读：缓存命中时直接拷贝，连续的未命中块通过一次请求读入
+//! - 写：只修改缓存中的块并把它标记为脏块（内容没有变化时不标记），由[`BufferCache::flush`]批量写回。
+//!   写回时按照块号的顺序，把连续的脏块合并为一个请求
+//! - 缓存满时，按照LRU的顺序淘汰干净的块；脏块数量超过阈值时，写入者先写回所有的脏块
+//!
+//! 缓存不拦截绕过它的数据读写。文件系统直接写入设备时，需要调用[`BufferCache::invalidate`]
+//! 丢弃被覆盖的块，避免之后读到（或者写回）旧的内容。
+
+use alloc::{
+    collections::BTreeMap,
+    sync::{Arc, Weak},
+    vec,
+    vec::Vec,
+};
+
+use crate::{libs::spinlock::SpinLock, syscall::SystemError};
+
+use super::{
+    block_device::{BlockDevice, BlockId},
+    request_queue::BlkPlug,
+};
+
+/// 最多缓存的块数量
+const BUFFER_CACHE_MAX_BLOCKS: usize = 2048;
+/// 脏块数量达到这个值时，写入者写回所有的脏块
+const BUFFER_CACHE_DIRTY_THRESHOLD: usize = 256;
+/// 写回时，一个请求最多包含的块数量
+const BUFFER_CACHE_MAX_RUN: usize = 256;
+
+#[derive(Debug)]
+struct CachedBlock {
+    data: Vec<u8>,
+    dirty: bool,
+    /// 最近一次被访问时的时间戳，即它在LRU链表中的键
+    stamp: u64,
+}
+
+#[derive(Debug)]
+struct InnerBufferCache {
+    blocks: BTreeMap<BlockId, CachedBlock>,
+    /// LRU链表：访问时间戳 -> 块号，时间戳越小越久没有被访问
+    lru: BTreeMap<u64, BlockId>,
+    next_stamp: u64,
+    nr_dirty: usize,
+}
+
+impl InnerBufferCache {
+    /// 把块移动到LRU链表的末尾
+    fn touch(&mut self, lba: BlockId) {
+        let stamp = self.next_stamp;
+        if let Some(block) = self.blocks.get_mut(&lba) {
+            self.lru.remove(&block.stamp);
+            block.stamp = stamp;
+            self.lru.insert(stamp, lba);
+            self.next_stamp += 1;
+        }
+    }
+
+    /// 加入一个块。块已经存在时什么都不做
+    fn insert(&mut self, lba: BlockId, data: Vec<u8>, dirty: bool) {
+        if self.blocks.contains_key(&lba) {
+            return;
+        }
+        self.shrink();
+        let stamp = self.next_stamp;
+        self.next_stamp += 1;
+        self.blocks.insert(lba, CachedBlock { data, dirty, stamp });
+        self.lru.insert(stamp, lba);
+        if dirty {
+            self.nr_dirty += 1;
+        }
+    }
+
+    /// 缓存已满时，淘汰最久没有被访问的干净块。脏块需要先写回，因此跳过
+    fn shrink(&mut self) {
+        while self.blocks.len() >= BUFFER_CACHE_MAX_BLOCKS {
+            let victim = self
+                .lru
+                .iter()
+                .find(|(_, lba)| !self.blocks[*lba].dirty)
+                .map(|(stamp, lba)| (*stamp, *lba));
+            match victim {
+                Some((stamp, lba)) => {
+                    self.lru.remove(&stamp);
+                    self.blocks.remove(&lba);
+                }
+                None => return,
+            }
+        }
+    }
+
+    fn set_dirty(&mut self, lba: BlockId) {
+        if let Some(block) = self.blocks.get_mut(&lba) {
+            if !block.dirty {
+                block.dirty = true;
+                self.nr_dirty += 1;
+            }
+        }
+    }
+}
+
+/// 一个块设备的缓冲区缓存
+#[derive(Debug)]
+pub struct BufferCache {
+    dev: Weak<dyn BlockDevice>,
+    /// 块的大小（字节）
+    blk_size: usize,
+    inner: SpinLock<InnerBufferCache>,
+}
+
+impl BufferCache {
+    pub fn new(dev: &Arc<dyn BlockDevice>) -> Self {
+        return Self {
+            dev: Arc::downgrade(dev),
+            blk_size: 1 << dev.blk_size_log2(),
+            inner: SpinLock::new(InnerBufferCache {
+                blocks: BTreeMap::new(),
+                lru: BTreeMap::new(),
+                next_stamp: 0,
+                nr_dirty: 0,
+            }),
+        };
+    }
+
+    fn dev(&self) -> Result<Arc<dyn BlockDevice>, SystemError> {
+        return self.dev.upgrade().ok_or(SystemError::ENODEV);
+    }
+
+    /// @brief 读取从`lba`开始的`count`个块到`buf`中
+    pub fn read(&self, lba: BlockId, count: usize, buf: &mut [u8]) -> Result<(), SystemError> {
+        let bs = self.blk_size;
+        if buf.len() < count * bs {
+            return Err(SystemError::E2BIG);
+        }
+
+        // 拷贝命中的块，记录连续的未命中块（起始块号, 数量）
+        let mut missing: Vec<(BlockId, usize)> = Vec::new();
+        let mut inner = self.inner.lock();
+        for i in 0..count {
+            match inner.blocks.get(&(lba + i)) {
+                Some(block) => {
+                    buf[i * bs..(i + 1) * bs].copy_from_slice(&block.data);
+                    inner.touch(lba + i);
+                }
+                None => match missing.last_mut() {
+                    Some((start, n)) if *start + *n == lba + i => *n += 1,
+                    _ => missing.push((lba + i, 1)),
+                },
+            }
+        }
+        drop(inner);
+        if missing.is_empty() {
+            return Ok(());
+        }
+
+        // 读入时不持有锁。其他进程可能同时写入了其中的块，此时以缓存中的内容为准
+        let dev = self.dev()?;
+        for (start, n) in missing {
+            let off = (start - lba) * bs;
+            let data = &mut buf[off..off + n * bs];
+            dev.submit_read(start, n, data)?;
+            let mut inner = self.inner.lock();
+            for i in 0..n {
+                let block = &mut data[i * bs..(i + 1) * bs];
+                match inner.blocks.get(&(start + i)) {
+                    Some(cached) => block.copy_from_slice(&cached.data),
+                    None => inner.insert(start + i, block.to_vec(), false),
+                }
+            }
+        }
+        return Ok(());
+    }
+
+    /// @brief 把`buf`写入从`lba`开始的`count`个块
+    ///
+    /// 数据只写入缓存，由flush写回设备
+    pub fn write(&self, lba: BlockId, count: usize, buf: &[u8]) -> Result<(), SystemError> {
+        let bs = self.blk_size;
+        if buf.len() < count * bs {
+            return Err(SystemError::E2BIG);
+        }
+
+        let mut inner = self.inner.lock();
+        for i in 0..count {
+            let data = &buf[i * bs..(i + 1) * bs];
+            match inner.blocks.get_mut(&(lba + i)) {
+                Some(block) => {
+                    // 内容没有变化时，不需要写回
+                    if block.data != data {
+                        block.data.copy_from_slice(data);
+                        inner.set_dirty(lba + i);
+                    }
+                    inner.touch(lba + i);
+                }
+                None => inner.insert(lba + i, data.to_vec(), true),
+            }
+        }
+        let need_flush = inner.nr_dirty >= BUFFER_CACHE_DIRTY_THRESHOLD;
+        drop(inner);
+
+        if need_flush {
+            self.flush()?;
+        }
+        return Ok(());
+    }
+
+    /// @brief 按照块号的顺序写回所有的脏块，连续的脏块合并为一个请求
+    pub fn flush(&self) -> Result<(), SystemError> {
+        let dev = self.dev()?;
+        let bs = self.blk_size;
+
+        // 先清除脏块标志，写回期间再次被写入的块会重新被标记
+        let mut runs: Vec<(BlockId, Vec<u8>)> = Vec::new();
+        let mut inner = self.inner.lock();
+        if inner.nr_dirty == 0 {
+            return Ok(());
+        }
+        for (lba, block) in inner.blocks.iter_mut().filter(|(_, b)| b.dirty) {
+            block.dirty = false;
+            match runs.last_mut() {
+                Some((start, data))
+                    if *start + data.len() / bs == *lba
+                        && data.len() / bs < BUFFER_CACHE_MAX_RUN =>
+                {
+                    data.extend_from_slice(&block.data)
+                }
+                _ => runs.push((*lba, block.data.clone())),
+            }
+        }
+        inner.nr_dirty = 0;
+        drop(inner);
+
+        let plug = BlkPlug::start();
+        let mut result = Ok(());
+        for (i, (lba, data)) in runs.iter().enumerate() {
+            if let Err(e) = dev.submit_write(*lba, data.len() / bs, data) {
+                // 没有写回的块重新标记为脏块
+                let mut inner = self.inner.lock();
+                for (lba, data) in runs[i..].iter() {
+                    for j in 0..data.len() / bs {
+                        inner.set_dirty(lba + j);
+                    }
+                }
+                result = Err(e);
+                break;
+            }
+        }
+        let r = plug.finish();
+        return result.and(r);
+    }
+
+    /// @brief 丢弃从`lba`开始的`count`个块（包括脏块）。绕过缓存直接写入设备之前调用
+    pub fn invalidate(&self, lba: BlockId, count: usize) {
+        let mut inner = self.inner.lock();
+        let victims: Vec<BlockId> = inner
+            .blocks
+            .range(lba..lba + count)
+            .map(|(lba, _)| *lba)
+            .collect();
+        for lba in victims {
+            let block = inner.blocks.remove(&lba).unwrap();
+            inner.lru.remove(&block.stamp);
+            if block.dirty {
+                inner.nr_dirty -= 1;
+            }
+        }
+    }
+
+    /// @brief 丢弃设备上`[offset, offset + len)`字节所在的块
+    pub fn invalidate_bytes(&self, offset: usize, len: usize) {
+        if len == 0 {
+            return;
+        }
+        let first = offset / self.blk_size;
+        let last = (offset + len - 1) / self.blk_size;
+        self.invalidate(first, last - first + 1);
+    }
+}
@@ -1,7 +1,7 @@
 #![allow(dead_code)]
 use alloc::sync::{Arc, Weak};
 
-use super::block_device::BlockDevice;
+use super::{block_device::BlockDevice, stats::DiskStats};
 
 pub type SectorT = u64;
 
@@ -17,6 +17,7 @@ pub struct Partition {
     pub sectors_num: u64,        // 该分区的扇区数
     disk: Weak<dyn BlockDevice>, // 当前分区所属的磁盘
     pub partno: u16,             // 在磁盘上的分区号
+    pub stats: Arc<DiskStats>,   // 分区的I/O统计
 }
 
 /// @brief: 分区信息 - 成员函数
@@ -35,6 +36,7 @@ impl Partition {
             sectors_num,
             disk,
             partno,
+            stats: Arc::new(DiskStats::new()),
         });
     }
 
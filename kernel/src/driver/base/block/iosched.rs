@@ -0,0 +1,252 @@
+//! 块设备的I/O调度器
+//!
+//! 调度器保存请求队列中还没有被派发给驱动的写请求，负责把相邻的请求合并为一个大请求，并决定派发的顺序：
+//! - `none`：按照提交的顺序派发，只尝试把新的请求合并到最后一个请求的后面
+//! - `deadline`：按照LBA排序，新的请求可以与前后相邻的请求合并；派发时按照单向电梯的顺序扫描，
+//!   等待超过截止时间的请求优先派发，避免远处的请求被饿死
+//! - `mq-deadline`：与`deadline`相同。目前的驱动每个设备只有一个硬件队列，两者没有区别
+
+use alloc::{
+    boxed::Box,
+    collections::{BTreeMap, VecDeque},
+    vec::Vec,
+};
+use core::fmt::Debug;
+
+use crate::time::clocksource::HZ;
+
+use super::{block_device::BlockId, stats::BlkIoAcct};
+
+/// 合并之后，一个请求最多包含的字节数
+const BLK_MAX_REQUEST_BYTES: usize = 1 << 20;
+/// deadline调度器中写请求的截止时间（jiffies）
+const DEADLINE_WRITE_EXPIRE: u64 = 5 * HZ;
+
+/// 一个写请求
+#[derive(Debug)]
+pub struct BlockRequest {
+    /// 起始块号
+    pub lba: BlockId,
+    /// 块的数量
+    pub count: usize,
+    /// 要写入的数据
+    pub data: Vec<u8>,
+    /// 请求被加入队列的时间（jiffies）
+    pub start_time: u64,
+    /// I/O统计的上下文。合并时取最早的开始时间
+    pub acct: BlkIoAcct,
+    /// 被合并到这个请求中的请求数
+    pub nr_merged: usize,
+}
+
+impl BlockRequest {
+    /// 请求之后的第一个块号
+    pub fn end(&self) -> BlockId {
+        return self.lba + self.count as BlockId;
+    }
+
+    pub fn overlaps(&self, lba: BlockId, count: usize) -> bool {
+        return self.lba < lba + count as BlockId && lba < self.end();
+    }
+
+    /// 能否把`next`合并到这个请求的后面。不同分区的请求不合并，保证每个请求只属于一个分区
+    fn can_append(&self, next: &BlockRequest) -> bool {
+        return self.end() == next.lba
+            && self.data.len() + next.data.len() <= BLK_MAX_REQUEST_BYTES
+            && self.acct.partno == next.acct.partno;
+    }
+
+    /// 把`next`合并到这个请求的后面
+    fn append(&mut self, next: BlockRequest) {
+        self.count += next.count;
+        self.data.extend_from_slice(&next.data);
+        self.start_time = self.start_time.min(next.start_time);
+        self.acct.start = self.acct.start.min(next.acct.start);
+        self.nr_merged += next.nr_merged + 1;
+    }
+}
+
+/// I/O调度器
+pub trait IoScheduler: Debug + Send + Sync {
+    fn name(&self) -> &'static str;
+
+    /// 加入一个请求，能合并时与已有的请求合并。调用者保证它与队列中的请求没有重叠
+    fn insert(&mut self, req: BlockRequest);
+
+    /// 取出下一个要派发的请求
+    ///
+    /// ## 参数
+    ///
+    /// - `now`：当前时间（jiffies）
+    fn dispatch(&mut self, now: u64) -> Option<BlockRequest>;
+
+    /// 队列中是否有与`[lba, lba + count)`重叠的请求
+    fn overlaps(&self, lba: BlockId, count: usize) -> bool;
+
+    fn is_empty(&self) -> bool;
+}
+
+/// 根据名字创建调度器。名字无效时返回None
+pub fn iosched_new(name: &str) -> Option<Box<dyn IoScheduler>> {
+    match name {
+        "none" => Some(Box::new(NoopScheduler::new())),
+        "deadline" => Some(Box::new(DeadlineScheduler::new("deadline"))),
+        "mq-deadline" => Some(Box::new(DeadlineScheduler::new("mq-deadline"))),
+        _ => None,
+    }
+}
+
+/// `none`调度器：先进先出
+#[derive(Debug)]
+pub struct NoopScheduler {
+    fifo: VecDeque<BlockRequest>,
+}
+
+impl NoopScheduler {
+    pub fn new() -> Self {
+        return Self {
+            fifo: VecDeque::new(),
+        };
+    }
+}
+
+impl IoScheduler for NoopScheduler {
+    fn name(&self) -> &'static str {
+        return "none";
+    }
+
+    fn insert(&mut self, req: BlockRequest) {
+        if let Some(last) = self.fifo.back_mut() {
+            if last.can_append(&req) {
+                last.append(req);
+                return;
+            }
+        }
+        self.fifo.push_back(req);
+    }
+
+    fn dispatch(&mut self, _now: u64) -> Option<BlockRequest> {
+        return self.fifo.pop_front();
+    }
+
+    fn overlaps(&self, lba: BlockId, count: usize) -> bool {
+        return self.fifo.iter().any(|req| req.overlaps(lba, count));
+    }
+
+    fn is_empty(&self) -> bool {
+        return self.fifo.is_empty();
+    }
+}
+
+/// `deadline`调度器
+#[derive(Debug)]
+pub struct DeadlineScheduler {
+    name: &'static str,
+    /// 按照起始块号排序的请求
+    sorted: BTreeMap<BlockId, BlockRequest>,
+    /// 按照加入的顺序排列的（加入时间, 起始块号）。请求被合并之后，旧的项会失效，取出时跳过即可
+    fifo: VecDeque<(u64, BlockId)>,
+    /// 电梯的位置：上一个被派发的请求之后的第一个块号
+    next_lba: BlockId,
+}
+
+impl DeadlineScheduler {
+    pub fn new(name: &'static str) -> Self {
+        return Self {
+            name,
+            sorted: BTreeMap::new(),
+            fifo: VecDeque::new(),
+            next_lba: 0,
+        };
+    }
+
+    fn take(&mut self, lba: BlockId) -> Option<BlockRequest> {
+        let req = self.sorted.remove(&lba)?;
+        self.next_lba = req.end();
+        if self.sorted.is_empty() {
+            self.fifo.clear();
+        }
+        return Some(req);
+    }
+}
+
+impl IoScheduler for DeadlineScheduler {
+    fn name(&self) -> &'static str {
+        return self.name;
+    }
+
+    fn insert(&mut self, req: BlockRequest) {
+        // 与前面的请求合并
+        let prev = self
+            .sorted
+            .range(..req.lba)
+            .next_back()
+            .filter(|(_, prev)| prev.can_append(&req))
+            .map(|(lba, _)| *lba);
+        let mut req = match prev {
+            Some(lba) => {
+                let mut prev = self.sorted.remove(&lba).unwrap();
+                prev.append(req);
+                prev
+            }
+            None => req,
+        };
+
+        // 与后面的请求合并
+        if let Some(next) = self.sorted.remove(&req.end()) {
+            if req.can_append(&next) {
+                req.append(next);
+            } else {
+                self.sorted.insert(next.lba, next);
+            }
+        }
+
+        self.fifo.push_back((req.start_time, req.lba));
+        self.sorted.insert(req.lba, req);
+    }
+
+    fn dispatch(&mut self, now: u64) -> Option<BlockRequest> {
+        // 优先派发已经超过截止时间的请求
+        while let Some(&(start_time, lba)) = self.fifo.front() {
+            let valid = self
+                .sorted
+                .get(&lba)
+                .is_some_and(|req| req.start_time == start_time);
+            if !valid {
+                self.fifo.pop_front();
+                continue;
+            }
+            if start_time + DEADLINE_WRITE_EXPIRE <= now {
+                self.fifo.pop_front();
+                return self.take(lba);
+            }
+            break;
+        }
+
+        // 单向电梯：从上一次派发的位置继续向后扫描，到达末尾之后回到最前面
+        let lba = self
+            .sorted
+            .range(self.next_lba..)
+            .next()
+            .or_else(|| self.sorted.iter().next())
+            .map(|(lba, _)| *lba)?;
+        return self.take(lba);
+    }
+
+    fn overlaps(&self, lba: BlockId, count: usize) -> bool {
+        if let Some((_, prev)) = self.sorted.range(..=lba).next_back() {
+            if prev.overlaps(lba, count) {
+                return true;
+            }
+        }
+        return self
+            .sorted
+            .range(lba..lba + count as BlockId)
+            .next()
+            .is_some();
+    }
+
+    fn is_empty(&self) -> bool {
+        return self.sorted.is_empty();
+    }
+}
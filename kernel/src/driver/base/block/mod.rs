@@ -1,5 +1,10 @@
 pub mod block_device;
+pub mod buffer_cache;
 pub mod disk_info;
+pub mod iosched;
+pub mod request_queue;
+pub mod stats;
+pub mod sysfs;
 
 #[derive(Debug)]
 #[allow(dead_code)]
@@ -0,0 +1,325 @@
+//! 块设备的请求队列
+//!
+//! 文件系统写入块设备时，写请求先被复制到请求队列中，由I/O调度器（见[`super::iosched`]）与队列中相邻的
+//! 请求合并，之后再按照调度器决定的顺序派发给驱动。
+//!
+//! 进程可以通过[`BlkPlug`]“塞住”请求队列：塞住期间提交的写请求只会留在队列中，等到进程拔掉塞子
+//! 的时候一起派发。这样，一次writeback或者一次大的写操作产生的许多小请求可以被合并成少量大请求。
+//! 没有被塞住的队列，提交写请求之后立即派发。
+//!
+//! 读请求不经过队列，直接交给驱动。读之前如果队列中有与它重叠的写请求，先把队列中的请求派发出去，
+//! 保证读到的是最新的数据。
+//!
+//! 驱动的读写接口是同步的，因此同一时刻只有一个进程在派发请求。
+
+use alloc::{
+    boxed::Box,
+    string::{String, ToString},
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+
+use crate::{
+    debug::trace::TRACE_BLOCK_WRITE,
+    kerror,
+    libs::{spinlock::SpinLock, wait_queue::WaitQueue},
+    process::ProcessManager,
+    syscall::SystemError,
+    time::timer::clock,
+};
+
+use super::{
+    block_device::{BlockDevice, BlockId},
+    iosched::{iosched_new, BlockRequest, IoScheduler},
+    stats::{BlkIoAcct, BlkOp, DiskStats},
+};
+
+/// 队列中积压的字节数超过这个值时，即使队列被塞住，也立即派发
+const BLK_QUEUE_MAX_PENDING_BYTES: usize = 4 << 20;
+
+/// 新的请求队列默认使用的调度器
+pub const BLK_DEFAULT_IOSCHED: &str = "mq-deadline";
+
+#[derive(Debug)]
+pub struct BlockRequestQueue {
+    dev: Weak<dyn BlockDevice>,
+    inner: SpinLock<InnerBlockRequestQueue>,
+    /// 等待其他进程派发完成
+    dispatch_wait: WaitQueue,
+    /// 磁盘的I/O统计
+    stats: Arc<DiskStats>,
+}
+
+#[derive(Debug)]
+struct InnerBlockRequestQueue {
+    sched: Box<dyn IoScheduler>,
+    /// 是否有进程正在派发请求
+    dispatching: bool,
+    /// 队列中积压的字节数
+    pending_bytes: usize,
+    /// 派发时发生的错误，由下一次sync返回
+    error: Option<SystemError>,
+}
+
+impl BlockRequestQueue {
+    pub fn new(dev: Weak<dyn BlockDevice>, sched: &str) -> Arc<Self> {
+        let sched = iosched_new(sched).unwrap_or_else(|| iosched_new("none").unwrap());
+        return Arc::new(Self {
+            dev,
+            inner: SpinLock::new(InnerBlockRequestQueue {
+                sched,
+                dispatching: false,
+                pending_bytes: 0,
+                error: None,
+            }),
+            dispatch_wait: WaitQueue::INIT,
+            stats: Arc::new(DiskStats::new()),
+        });
+    }
+
+    /// @brief 提交一个写请求
+    ///
+    /// 请求被放入队列时，数据被复制一份，函数返回后调用者可以立即重用buf。
+    /// 放入队列的请求在派发时发生的错误，由sync返回
+    ///
+    /// @return 成功时返回写入的字节数
+    pub fn submit_write(
+        self: &Arc<Self>,
+        lba_id_start: BlockId,
+        count: usize,
+        buf: &[u8],
+    ) -> Result<usize, SystemError> {
+        let dev = self.dev.upgrade().ok_or(SystemError::ENODEV)?;
+        let len = count << dev.blk_size_log2();
+        if buf.len() < len {
+            return Err(SystemError::E2BIG);
+        }
+        let plugged = BlkPlug::plugged(self);
+        let acct = BlkIoAcct::start(dev.as_ref(), BlkOp::Write, lba_id_start);
+
+        let mut inner = self.inner.lock();
+        if !plugged && !inner.dispatching && inner.sched.is_empty() {
+            // 队列是空的，也没有被塞住，直接交给驱动，省掉一次复制
+            drop(inner);
+            tracepoint!(BlockRqIssue, lba_id_start, count as u64 | TRACE_BLOCK_WRITE);
+            let r = dev.write_at(lba_id_start, count, &buf[..len]);
+            acct.done(dev.as_ref(), BlkOp::Write, count, 0);
+            tracepoint!(
+                BlockRqComplete,
+                lba_id_start,
+                count as u64 | TRACE_BLOCK_WRITE
+            );
+            return r;
+        }
+
+        if inner.sched.overlaps(lba_id_start, count) {
+            // 调度器只合并不重叠的请求，先把旧的请求写下去，保证写入的顺序
+            drop(inner);
+            if let Err(e) = self.run() {
+                // 这个请求没有被写入，也要结束它的统计
+                acct.done(dev.as_ref(), BlkOp::Write, 0, 0);
+                return Err(e);
+            }
+            inner = self.inner.lock();
+        }
+
+        inner.sched.insert(BlockRequest {
+            lba: lba_id_start,
+            count,
+            data: buf[..len].to_vec(),
+            start_time: clock(),
+            acct,
+            nr_merged: 0,
+        });
+        inner.pending_bytes += len;
+        let need_run = !plugged || inner.pending_bytes >= BLK_QUEUE_MAX_PENDING_BYTES;
+        drop(inner);
+
+        if need_run {
+            self.run()?;
+        }
+        return Ok(len);
+    }
+
+    /// @brief 读取`[lba_id_start, lba_id_start + count)`之前调用。队列中有与它重叠的写请求时，先派发队列
+    pub fn prepare_read(self: &Arc<Self>, lba_id_start: BlockId, count: usize) {
+        let inner = self.inner.lock();
+        let need_run = inner.dispatching || inner.sched.overlaps(lba_id_start, count);
+        drop(inner);
+        if need_run {
+            // 派发的错误留给sync返回，不影响这次读
+            self.run().ok();
+        }
+    }
+
+    /// @brief 派发队列中的所有请求，返回时队列中原有的请求都已经写入设备
+    ///
+    /// @return 这次派发中发生的第一个错误
+    pub fn run(self: &Arc<Self>) -> Result<(), SystemError> {
+        let can_sleep = ProcessManager::current().preempt_count() == 0;
+        let mut inner = loop {
+            let inner = self.inner.lock();
+            if !inner.dispatching {
+                break inner;
+            }
+            // 其他进程正在派发，它会派发完队列中所有的请求
+            if can_sleep {
+                self.dispatch_wait
+                    .sleep_uninterruptible_unlock_spinlock(inner);
+            } else {
+                drop(inner);
+                core::hint::spin_loop();
+            }
+        };
+        if inner.sched.is_empty() {
+            return Ok(());
+        }
+
+        let dev = match self.dev.upgrade() {
+            Some(dev) => dev,
+            None => return Err(SystemError::ENODEV),
+        };
+        inner.dispatching = true;
+        let mut result = Ok(());
+        while let Some(req) = inner.sched.dispatch(clock()) {
+            inner.pending_bytes -= req.data.len();
+            drop(inner);
+            tracepoint!(BlockRqIssue, req.lba, req.count as u64 | TRACE_BLOCK_WRITE);
+            let r = dev.write_at(req.lba, req.count, &req.data);
+            req.acct
+                .done(dev.as_ref(), BlkOp::Write, req.count, req.nr_merged);
+            tracepoint!(
+                BlockRqComplete,
+                req.lba,
+                req.count as u64 | TRACE_BLOCK_WRITE
+            );
+            inner = self.inner.lock();
+            if let Err(e) = r {
+                kerror!(
+                    "block request queue: failed to write {} blocks at lba {}: {:?}",
+                    req.count,
+                    req.lba,
+                    e
+                );
+                if result.is_ok() {
+                    result = Err(e.clone());
+                }
+                inner.error.get_or_insert(e);
+            }
+        }
+        inner.dispatching = false;
+        drop(inner);
+        self.dispatch_wait.wakeup_all(None);
+        return result;
+    }
+
+    /// @brief 把队列中的请求全部写入设备，返回此前派发时发生的错误
+    pub fn sync(self: &Arc<Self>) -> Result<(), SystemError> {
+        self.run().ok();
+        return match self.inner.lock().error.take() {
+            Some(e) => Err(e),
+            None => Ok(()),
+        };
+    }
+
+    /// @brief 更换I/O调度器。队列中的请求会先被派发
+    #[allow(dead_code)]
+    pub fn set_scheduler(self: &Arc<Self>, name: &str) -> Result<(), SystemError> {
+        let mut sched = iosched_new(name.trim()).ok_or(SystemError::EINVAL)?;
+        loop {
+            self.run().ok();
+            let mut inner = self.inner.lock();
+            if inner.dispatching || !inner.sched.is_empty() {
+                continue;
+            }
+            core::mem::swap(&mut inner.sched, &mut sched);
+            return Ok(());
+        }
+    }
+
+    #[allow(dead_code)]
+    pub fn scheduler_name(&self) -> String {
+        return self.inner.lock().sched.name().to_string();
+    }
+
+    /// 磁盘的I/O统计
+    #[inline]
+    pub fn stats(&self) -> &Arc<DiskStats> {
+        return &self.stats;
+    }
+}
+
+/// 进程塞住的请求队列
+#[derive(Debug, Default)]
+pub struct BlkPlugState {
+    /// BlkPlug的嵌套深度。只有最外层的BlkPlug结束时才拔掉塞子
+    depth: usize,
+    queues: Vec<Arc<BlockRequestQueue>>,
+}
+
+/// @brief 塞住当前进程接下来提交写请求的队列，直到这个结构体被销毁或者调用finish
+///
+/// 可以嵌套使用，只有最外层的BlkPlug结束时才派发请求
+#[derive(Debug)]
+pub struct BlkPlug {
+    finished: bool,
+}
+
+impl BlkPlug {
+    pub fn start() -> Self {
+        ProcessManager::current_pcb().blk_plug().depth += 1;
+        return Self { finished: false };
+    }
+
+    /// @brief 结束塞住，派发塞住期间提交的写请求
+    ///
+    /// @return 派发时发生的第一个错误
+    pub fn finish(mut self) -> Result<(), SystemError> {
+        self.finished = true;
+        return Self::do_finish();
+    }
+
+    fn do_finish() -> Result<(), SystemError> {
+        let pcb = ProcessManager::current_pcb();
+        let mut state = pcb.blk_plug();
+        state.depth -= 1;
+        if state.depth != 0 {
+            return Ok(());
+        }
+        let queues = core::mem::take(&mut state.queues);
+        drop(state);
+
+        let mut result = Ok(());
+        for queue in queues {
+            let r = queue.run();
+            if result.is_ok() {
+                result = r;
+            }
+        }
+        return result;
+    }
+
+    /// 当前进程是否塞住了这个队列。进程在BlkPlug中第一次向队列提交写请求时，塞住这个队列
+    fn plugged(queue: &Arc<BlockRequestQueue>) -> bool {
+        let pcb = ProcessManager::current_pcb();
+        let mut state = pcb.blk_plug();
+        if state.depth == 0 {
+            return false;
+        }
+        if !state.queues.iter().any(|q| Arc::ptr_eq(q, queue)) {
+            state.queues.push(queue.clone());
+        }
+        return true;
+    }
+}
+
+impl Drop for BlkPlug {
+    fn drop(&mut self) {
+        if self.finished {
+            return;
+        }
+        if let Err(e) = Self::do_finish() {
+            kerror!("BlkPlug: failed to dispatch plugged requests: {:?}", e);
+        }
+    }
+}
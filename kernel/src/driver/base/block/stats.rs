@@ -0,0 +1,385 @@
+//! 块设备的I/O统计
+//!
+//! 每个磁盘和每个分区分别统计读、写请求的数量、扇区数、合并次数、耗时，以及正在处理的请求数量和设备忙碌的时间，
+//! 并按照操作类型记录请求延迟的直方图。统计在块设备层完成，驱动不需要关心：
+//! - 读请求：提交时开始，驱动返回时完成
+//! - 写请求：提交时开始（进入请求队列，或者直接交给驱动），写入设备时完成。被合并到其他请求中的写请求
+//!   记为一次合并，随着合并之后的请求一起完成
+//!
+//! 与Linux相同，不同分区的请求不会被合并，因此一个请求总是只属于一个分区。
+//! 只有带请求队列的磁盘（见[`super::block_device::BlockDevice::request_queue`]）才有统计信息。
+//!
+//! 时间以TSC周期为单位记录，读取时换算为纳秒。统计信息通过`/proc/diskstats`（格式与Linux相同）
+//! 以及`/sys/block/<磁盘>/`导出（见[`super::sysfs`]）。
+
+use core::{
+    fmt::Write,
+    sync::atomic::{AtomicU64, Ordering},
+};
+
+use alloc::{
+    format,
+    string::String,
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+
+use crate::{
+    arch::CurrentTimeArch, filesystem::vfs::seq_file::SeqBuf, libs::spinlock::SpinLock,
+    sched::cputime::cycles_to_ns, syscall::SystemError, time::TimeArch,
+};
+
+use super::{
+    block_device::{BlockDevice, BlockId, LBA_SIZE},
+    disk_info::Partition,
+};
+
+/// 延迟直方图的桶数。第0个桶是小于1us的请求，第i个桶是`[2^(i-1), 2^i)`us的请求，最后一个桶包括更慢的请求
+pub const BLK_LAT_BUCKETS: usize = 24;
+
+/// `/proc/diskstats`中磁盘的主设备号（这些磁盘没有分配设备号，次设备号按照注册的顺序分配）
+const DISKSTATS_MAJOR: usize = 259;
+/// 每个磁盘占用的次设备号数量（磁盘本身和它的分区）
+const DISKSTATS_MINORS: usize = 16;
+
+/// 请求的操作类型
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum BlkOp {
+    Read = 0,
+    Write = 1,
+}
+
+const NR_BLK_OPS: usize = 2;
+
+/// 一种操作的计数器
+#[derive(Debug)]
+struct BlkOpStats {
+    /// 完成的请求数（合并之后）
+    ios: AtomicU64,
+    /// 被合并到其他请求中的请求数
+    merges: AtomicU64,
+    /// 扇区数（512字节）
+    sectors: AtomicU64,
+    /// 所有请求从提交到完成的时间之和（TSC周期）
+    ticks: AtomicU64,
+    /// 延迟直方图
+    hist: [AtomicU64; BLK_LAT_BUCKETS],
+}
+
+impl BlkOpStats {
+    const fn new() -> Self {
+        return Self {
+            ios: AtomicU64::new(0),
+            merges: AtomicU64::new(0),
+            sectors: AtomicU64::new(0),
+            ticks: AtomicU64::new(0),
+            hist: [const { AtomicU64::new(0) }; BLK_LAT_BUCKETS],
+        };
+    }
+}
+
+/// 一个磁盘或者分区的统计信息
+#[derive(Debug)]
+pub struct DiskStats {
+    ops: [BlkOpStats; NR_BLK_OPS],
+    /// 正在处理（已经提交、还没有完成）的请求数，按照操作类型分开
+    in_flight: [AtomicU64; NR_BLK_OPS],
+    /// 有请求正在处理的时间之和（TSC周期）
+    io_ticks: AtomicU64,
+    /// 上一次更新io_ticks的时间
+    stamp: AtomicU64,
+}
+
+/// 读取统计信息时得到的快照，时间的单位是纳秒
+#[derive(Debug, Clone, Copy, Default)]
+pub struct DiskStatsSnapshot {
+    pub ios: [u64; NR_BLK_OPS],
+    pub merges: [u64; NR_BLK_OPS],
+    pub sectors: [u64; NR_BLK_OPS],
+    pub ticks: [u64; NR_BLK_OPS],
+    pub in_flight: [u64; NR_BLK_OPS],
+    pub io_ticks: u64,
+    /// 所有已经完成的请求从提交到完成的时间之和
+    pub time_in_queue: u64,
+}
+
+impl DiskStats {
+    pub const fn new() -> Self {
+        return Self {
+            ops: [const { BlkOpStats::new() }; NR_BLK_OPS],
+            in_flight: [const { AtomicU64::new(0) }; NR_BLK_OPS],
+            io_ticks: AtomicU64::new(0),
+            stamp: AtomicU64::new(0),
+        };
+    }
+
+    /// 如果设备在上一次更新之后一直忙碌，把这段时间记到io_ticks上（与Linux的update_io_ticks相同）
+    fn update_io_ticks(&self, now: u64, busy: bool) {
+        let stamp = self.stamp.load(Ordering::Relaxed);
+        if stamp == now {
+            return;
+        }
+        // 同时更新的cpu中只有一个会成功，避免重复计算
+        if self
+            .stamp
+            .compare_exchange(stamp, now, Ordering::Relaxed, Ordering::Relaxed)
+            .is_ok()
+            && busy
+        {
+            self.io_ticks
+                .fetch_add(now.saturating_sub(stamp), Ordering::Relaxed);
+        }
+    }
+
+    fn busy(&self) -> bool {
+        return self
+            .in_flight
+            .iter()
+            .any(|x| x.load(Ordering::Relaxed) != 0);
+    }
+
+    fn start(&self, op: BlkOp, now: u64) {
+        self.update_io_ticks(now, self.busy());
+        self.in_flight[op as usize].fetch_add(1, Ordering::Relaxed);
+    }
+
+    /// 一个请求完成。`nr_merged`个被合并到这个请求中的请求同时完成
+    fn done(&self, op: BlkOp, sectors: u64, nr_merged: u64, start: u64, now: u64) {
+        self.update_io_ticks(now, true);
+        let stats = &self.ops[op as usize];
+        let lat = now.saturating_sub(start);
+        stats.ios.fetch_add(1, Ordering::Relaxed);
+        stats.merges.fetch_add(nr_merged, Ordering::Relaxed);
+        stats.sectors.fetch_add(sectors, Ordering::Relaxed);
+        stats.ticks.fetch_add(lat, Ordering::Relaxed);
+        stats.hist[lat_bucket(cycles_to_ns(lat))].fetch_add(1, Ordering::Relaxed);
+        self.in_flight[op as usize].fetch_sub(1 + nr_merged, Ordering::Relaxed);
+    }
+
+    pub fn snapshot(&self) -> DiskStatsSnapshot {
+        let mut r = DiskStatsSnapshot::default();
+        for (i, stats) in self.ops.iter().enumerate() {
+            r.ios[i] = stats.ios.load(Ordering::Relaxed);
+            r.merges[i] = stats.merges.load(Ordering::Relaxed);
+            r.sectors[i] = stats.sectors.load(Ordering::Relaxed);
+            r.ticks[i] = cycles_to_ns(stats.ticks.load(Ordering::Relaxed));
+            r.in_flight[i] = self.in_flight[i].load(Ordering::Relaxed);
+        }
+        // 加上从上一次更新到现在的忙碌时间
+        let now = CurrentTimeArch::get_cycles() as u64;
+        self.update_io_ticks(now, self.busy());
+        r.io_ticks = cycles_to_ns(self.io_ticks.load(Ordering::Relaxed));
+        r.time_in_queue = r.ticks.iter().sum();
+        return r;
+    }
+
+    /// 延迟直方图，单位见[`BLK_LAT_BUCKETS`]
+    pub fn latency_hist(&self, op: BlkOp) -> [u64; BLK_LAT_BUCKETS] {
+        let mut r = [0; BLK_LAT_BUCKETS];
+        for (i, v) in r.iter_mut().enumerate() {
+            *v = self.ops[op as usize].hist[i].load(Ordering::Relaxed);
+        }
+        return r;
+    }
+}
+
+impl Default for DiskStats {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// 延迟`ns`所在的直方图的桶
+#[inline]
+fn lat_bucket(ns: u64) -> usize {
+    let us = ns / 1000;
+    let bucket = (u64::BITS - us.leading_zeros()) as usize;
+    return bucket.min(BLK_LAT_BUCKETS - 1);
+}
+
+/// 一个请求的统计上下文：开始的时间和所属的分区
+#[derive(Debug, Clone, Copy)]
+pub struct BlkIoAcct {
+    /// 开始的时间（TSC周期）
+    pub start: u64,
+    /// 所属分区的分区号
+    pub partno: Option<u16>,
+}
+
+impl BlkIoAcct {
+    /// 开始统计一个从`lba`开始的请求
+    pub fn start<D: BlockDevice + ?Sized>(dev: &D, op: BlkOp, lba: BlockId) -> Self {
+        let now = CurrentTimeArch::get_cycles() as u64;
+        let part = lba_partition(dev, lba);
+        if let Some(queue) = dev.request_queue() {
+            queue.stats().start(op, now);
+        }
+        if let Some(part) = part.as_ref() {
+            part.stats.start(op, now);
+        }
+        return Self {
+            start: now,
+            partno: part.map(|p| p.partno),
+        };
+    }
+
+    /// 请求完成
+    ///
+    /// ## 参数
+    ///
+    /// - `count`：块的数量
+    /// - `nr_merged`：被合并到这个请求中的请求数
+    pub fn done<D: BlockDevice + ?Sized>(
+        &self,
+        dev: &D,
+        op: BlkOp,
+        count: usize,
+        nr_merged: usize,
+    ) {
+        let now = CurrentTimeArch::get_cycles() as u64;
+        let sectors = ((count << dev.blk_size_log2()) / LBA_SIZE) as u64;
+        let nr_merged = nr_merged as u64;
+        if let Some(queue) = dev.request_queue() {
+            queue.stats().done(op, sectors, nr_merged, self.start, now);
+        }
+        if let Some(partno) = self.partno {
+            if let Some(part) = dev.partitions().iter().find(|p| p.partno == partno) {
+                part.stats.done(op, sectors, nr_merged, self.start, now);
+            }
+        }
+    }
+}
+
+/// `lba`所在的分区
+fn lba_partition<D: BlockDevice + ?Sized>(dev: &D, lba: BlockId) -> Option<Arc<Partition>> {
+    let sector = ((lba << dev.blk_size_log2()) / LBA_SIZE) as u64;
+    return dev
+        .partitions()
+        .into_iter()
+        .find(|p| p.lba_start <= sector && sector < p.lba_start + p.sectors_num);
+}
+
+/// 导出统计信息的磁盘：(名字, 磁盘)，按照注册的顺序排列
+static BLOCK_STAT_DISKS: SpinLock<Vec<(String, Weak<dyn BlockDevice>)>> = SpinLock::new(Vec::new());
+
+/// 分区的名字：磁盘的名字以数字结尾时，中间加上`p`（与Linux相同）
+pub fn partition_name(disk: &str, partno: u16) -> String {
+    let sep = if disk.ends_with(|c: char| c.is_ascii_digit()) {
+        "p"
+    } else {
+        ""
+    };
+    return format!("{}{}{}", disk, sep, partno + 1);
+}
+
+/// 导出磁盘`dev`（以及它当前的分区）的统计信息。需要在读取分区表之后调用
+pub fn blk_stats_register(name: &str, dev: &Arc<dyn BlockDevice>) {
+    BLOCK_STAT_DISKS
+        .lock()
+        .push((String::from(name), Arc::downgrade(dev)));
+    super::sysfs::blkdev_sysfs_register(name, dev);
+}
+
+/// 一个导出统计信息的磁盘或者分区
+pub struct BlkStatEntry {
+    pub major: usize,
+    pub minor: usize,
+    pub name: String,
+    pub stats: Arc<DiskStats>,
+}
+
+/// 所有导出统计信息的磁盘和分区，每个磁盘后面是它的分区
+pub fn blk_stat_entries() -> Vec<BlkStatEntry> {
+    let disks = BLOCK_STAT_DISKS.lock().clone();
+    let mut entries = Vec::new();
+    for (idx, (name, dev)) in disks.iter().enumerate() {
+        let dev = match dev.upgrade() {
+            Some(dev) => dev,
+            None => continue,
+        };
+        let queue = match dev.request_queue() {
+            Some(queue) => queue,
+            None => continue,
+        };
+        entries.push(BlkStatEntry {
+            major: DISKSTATS_MAJOR,
+            minor: idx * DISKSTATS_MINORS,
+            name: name.clone(),
+            stats: queue.stats().clone(),
+        });
+        for part in dev.partitions() {
+            entries.push(BlkStatEntry {
+                major: DISKSTATS_MAJOR,
+                minor: idx * DISKSTATS_MINORS + part.partno as usize + 1,
+                name: partition_name(name, part.partno),
+                stats: part.stats.clone(),
+            });
+        }
+    }
+    return entries;
+}
+
+/// 根据名字查找磁盘或者分区的统计信息
+pub fn blk_stats_by_name(name: &str) -> Option<Arc<DiskStats>> {
+    return blk_stat_entries()
+        .into_iter()
+        .find(|e| e.name == name)
+        .map(|e| e.stats);
+}
+
+#[inline]
+fn ns_to_ms(ns: u64) -> u64 {
+    return ns / 1_000_000;
+}
+
+/// 生成`/sys/block/<磁盘>/stat`的内容（与`/proc/diskstats`中设备名之后的前11个字段相同）
+pub fn disk_stat_line(stats: &DiskStats) -> String {
+    let r = stats.snapshot();
+    let (rd, wr) = (BlkOp::Read as usize, BlkOp::Write as usize);
+    return format!(
+        "{:8} {:8} {:8} {:8} {:8} {:8} {:8} {:8} {:8} {:8} {:8}\n",
+        r.ios[rd],
+        r.merges[rd],
+        r.sectors[rd],
+        ns_to_ms(r.ticks[rd]),
+        r.ios[wr],
+        r.merges[wr],
+        r.sectors[wr],
+        ns_to_ms(r.ticks[wr]),
+        r.in_flight.iter().sum::<u64>(),
+        ns_to_ms(r.io_ticks),
+        ns_to_ms(r.time_in_queue)
+    );
+}
+
+/// 生成延迟直方图：每种操作一行，依次是各个桶中的请求数
+pub fn latency_hist_show(stats: &DiskStats) -> String {
+    let mut s = String::new();
+    for (name, op) in [("read", BlkOp::Read), ("write", BlkOp::Write)] {
+        s.push_str(name);
+        for v in stats.latency_hist(op) {
+            write!(s, " {}", v).ok();
+        }
+        s.push('\n');
+    }
+    return s;
+}
+
+/// 生成`/proc/diskstats`的内容，每个磁盘或者分区一行，格式与Linux相同
+///
+/// 主设备号 次设备号 名字 读完成数 读合并数 读扇区数 读耗时(ms) 写完成数 写合并数 写扇区数 写耗时(ms)
+/// 正在处理的请求数 忙碌时间(ms) 加权的等待时间(ms)
+pub fn diskstats_show(s: &mut SeqBuf) -> Result<(), SystemError> {
+    for e in blk_stat_entries() {
+        write!(
+            s,
+            "{:4} {:7} {} {}",
+            e.major,
+            e.minor,
+            e.name,
+            disk_stat_line(&e.stats)
+        )
+        .ok();
+    }
+    return Ok(());
+}
@@ -0,0 +1,144 @@
+//! 块设备在sysfs中的目录：`/sys/block/<磁盘>/`，每个分区是磁盘目录下的子目录
+//!
+//! 磁盘和分区的目录中都有`stat`（格式与Linux相同）和`inflight`（正在处理的读、写请求数），
+//! 磁盘的目录中还有`latency_hist`：读、写各一行，依次是延迟直方图每个桶中的请求数（桶的范围见[`super::stats::BLK_LAT_BUCKETS`]）
+
+use alloc::{string::ToString, sync::Arc};
+
+use crate::{
+    driver::base::{kobject::KObject, kset::KSet},
+    filesystem::{
+        sysfs::{file::sysfs_emit_str, sysfs_instance, Attribute, AttributeGroup, SysFSOpsSupport},
+        vfs::syscall::ModeType,
+    },
+    kwarn,
+    libs::spinlock::SpinLock,
+    syscall::SystemError,
+};
+
+use super::{
+    block_device::BlockDevice,
+    stats::{blk_stats_by_name, disk_stat_line, latency_hist_show, partition_name},
+};
+
+/// `/sys/block`的kset，第一个磁盘注册时创建
+static BLOCK_KSET: SpinLock<Option<Arc<KSet>>> = SpinLock::new(None);
+
+fn block_kset() -> Result<Arc<KSet>, SystemError> {
+    let mut guard = BLOCK_KSET.lock();
+    if let Some(kset) = guard.as_ref() {
+        return Ok(kset.clone());
+    }
+    let kset = KSet::new("block".to_string());
+    kset.register(None)?;
+    *guard = Some(kset.clone());
+    return Ok(kset);
+}
+
+/// 在sysfs中为名为`name`的磁盘以及它的分区创建目录和统计信息的属性文件
+///
+/// 失败时只打印警告，不影响磁盘的使用
+pub fn blkdev_sysfs_register(name: &str, dev: &Arc<dyn BlockDevice>) {
+    let r = block_kset().and_then(|block| {
+        let disk = KSet::new(name.to_string());
+        disk.register(Some(block))?;
+        let kobj = disk.clone() as Arc<dyn KObject>;
+        sysfs_instance().create_groups(&kobj, &[&BlockDiskStatGroup])?;
+
+        for part in dev.partitions() {
+            let kset = KSet::new(partition_name(name, part.partno));
+            kset.register(Some(disk.clone()))?;
+            let kobj = kset as Arc<dyn KObject>;
+            sysfs_instance().create_groups(&kobj, &[&BlockPartStatGroup])?;
+        }
+        return Ok(());
+    });
+    if let Err(e) = r {
+        kwarn!("Failed to create sysfs entries for block device '{name}': {e:?}");
+    }
+}
+
+#[derive(Debug)]
+struct BlockDiskStatGroup;
+
+impl AttributeGroup for BlockDiskStatGroup {
+    fn name(&self) -> Option<&str> {
+        None
+    }
+
+    fn attrs(&self) -> &[&'static dyn Attribute] {
+        return &[
+            &BlockStatAttr::Stat,
+            &BlockStatAttr::Inflight,
+            &BlockStatAttr::LatencyHist,
+        ];
+    }
+
+    fn is_visible(
+        &self,
+        _kobj: Arc<dyn KObject>,
+        attr: &'static dyn Attribute,
+    ) -> Option<ModeType> {
+        return Some(attr.mode());
+    }
+}
+
+#[derive(Debug)]
+struct BlockPartStatGroup;
+
+impl AttributeGroup for BlockPartStatGroup {
+    fn name(&self) -> Option<&str> {
+        None
+    }
+
+    fn attrs(&self) -> &[&'static dyn Attribute] {
+        return &[&BlockStatAttr::Stat, &BlockStatAttr::Inflight];
+    }
+
+    fn is_visible(
+        &self,
+        _kobj: Arc<dyn KObject>,
+        attr: &'static dyn Attribute,
+    ) -> Option<ModeType> {
+        return Some(attr.mode());
+    }
+}
+
+#[derive(Debug)]
+enum BlockStatAttr {
+    Stat,
+    Inflight,
+    LatencyHist,
+}
+
+impl Attribute for BlockStatAttr {
+    fn name(&self) -> &str {
+        match self {
+            BlockStatAttr::Stat => "stat",
+            BlockStatAttr::Inflight => "inflight",
+            BlockStatAttr::LatencyHist => "latency_hist",
+        }
+    }
+
+    fn mode(&self) -> ModeType {
+        return ModeType::from_bits_truncate(0o444);
+    }
+
+    fn support(&self) -> SysFSOpsSupport {
+        return SysFSOpsSupport::SHOW;
+    }
+
+    /// `kobj`是磁盘或者分区的目录，它的名字就是磁盘或者分区的名字
+    fn show(&self, kobj: Arc<dyn KObject>, buf: &mut [u8]) -> Result<usize, SystemError> {
+        let stats = blk_stats_by_name(&kobj.name()).ok_or(SystemError::ENODEV)?;
+        let s = match self {
+            BlockStatAttr::Stat => disk_stat_line(&stats),
+            BlockStatAttr::Inflight => {
+                let r = stats.snapshot();
+                format!("{:8} {:8}\n", r.in_flight[0], r.in_flight[1])
+            }
+            BlockStatAttr::LatencyHist => latency_hist_show(&stats),
+        };
+        return sysfs_emit_str(buf, &s);
+    }
+}
@@ -22,6 +22,7 @@ use crate::{
 use alloc::{
     string::{String, ToString},
     sync::{Arc, Weak},
+    vec::Vec,
 };
 use core::{ffi::CStr, fmt::Debug, intrinsics::unlikely};
 use hashbrown::HashMap;
@@ -165,6 +166,27 @@ pub trait Bus: Debug + Send + Sync {
         driver: &Arc<dyn Driver>,
     ) -> Result<bool, SystemError>;
 
+    /// 设备的匹配键，用于为设备和驱动建立匹配索引
+    ///
+    /// 总线只对至少有一个相同匹配键的设备和驱动调用`match_device`，
+    /// 因此对于这两个函数返回的键没有交集的设备和驱动，`match_device`必须返回`Ok(false)`。
+    ///
+    /// ## 默认实现
+    ///
+    /// 返回None：设备不参与索引，总线上的每个驱动都会与它匹配一次
+    fn device_match_keys(&self, _device: &Arc<dyn Device>) -> Option<Vec<String>> {
+        None
+    }
+
+    /// 驱动的匹配键，见[`Bus::device_match_keys`]
+    ///
+    /// ## 默认实现
+    ///
+    /// 返回None：驱动不参与索引，总线上的每个设备都会与它匹配一次
+    fn driver_match_keys(&self, _driver: &Arc<dyn Driver>) -> Option<Vec<String>> {
+        None
+    }
+
     fn subsystem(&self) -> &SubSysPrivate;
 
     /// 对当前总线操作的时候需要获取父级总线的锁
@@ -81,13 +81,12 @@ impl DeviceManager {
             let bus = dev.bus().ok_or(SystemError::EINVAL)?;
             let mut data = DeviceAttachData::new(dev.clone(), allow_async, false);
             let mut flag = true;
-            for driver in bus.subsystem().drivers().iter() {
-                if let Some(driver) = driver.upgrade() {
-                    let r = self.do_device_attach_driver(&driver, &mut data);
-                    if unlikely(r.is_err()) {
-                        flag = false;
-                        break;
-                    }
+            // 只尝试与设备有相同匹配键的驱动
+            for driver in bus.subsystem().driver_candidates(dev).iter() {
+                let r = self.do_device_attach_driver(driver, &mut data);
+                if unlikely(r.is_err()) {
+                    flag = false;
+                    break;
                 }
             }
 
@@ -230,16 +229,14 @@ impl DeviceAttachData {
 impl DriverManager {
     /// 尝试把驱动绑定到现有的设备上
     ///
-    /// 这个函数会遍历驱动现有的全部设备，然后尝试把他们匹配。
+    /// 这个函数会遍历总线上可能与驱动匹配的设备（与驱动有相同匹配键的设备），然后尝试把他们匹配。
     /// 一旦有一个设备匹配成功，就会返回，并且设备的driver字段会被设置。
     pub fn driver_attach(&self, driver: &Arc<dyn Driver>) -> Result<(), SystemError> {
         let bus = driver.bus().ok_or(SystemError::EINVAL)?;
-        for dev in bus.subsystem().devices().iter() {
-            if let Some(dev) = dev.upgrade() {
-                if self.do_driver_attach(&dev, &driver) {
-                    // 匹配成功
-                    return Ok(());
-                }
+        for dev in bus.subsystem().device_candidates(driver).iter() {
+            if self.do_driver_attach(dev, &driver) {
+                // 匹配成功
+                return Ok(());
             }
         }
 
@@ -11,5 +11,6 @@ pub mod kobject;
 pub mod kset;
 pub mod map;
 pub mod platform;
+pub mod probe;
 pub mod subsys;
 pub mod swnode;
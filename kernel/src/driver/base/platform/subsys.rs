@@ -1,6 +1,7 @@
 use alloc::{
     string::{String, ToString},
     sync::{Arc, Weak},
+    vec::Vec,
 };
 use intertrait::cast::CastArc;
 
@@ -141,6 +142,21 @@ impl Bus for PlatformBus {
         // 尝试根据设备名称匹配
         return Ok(device.name().eq(&driver.name()));
     }
+
+    /// 平台设备按名称与驱动的ID table或者驱动名称匹配，因此设备名称就是它的匹配键
+    ///
+    /// todo: 实现ACPI匹配之后，带有ACPI匹配表的驱动应当返回None
+    fn device_match_keys(&self, device: &Arc<dyn Device>) -> Option<Vec<String>> {
+        return Some(vec![device.name()]);
+    }
+
+    fn driver_match_keys(&self, driver: &Arc<dyn Driver>) -> Option<Vec<String>> {
+        let mut keys = vec![driver.name()];
+        if let Some(id_table) = driver.id_table() {
+            keys.push(id_table.name());
+        }
+        return Some(keys);
+    }
 }
 
 #[derive(Debug)]
@@ -0,0 +1,72 @@
+//! 并行的设备探测
+//!
+//! 设备的探测（复位控制器、等待链路建立、读取分区表等）大部分时间在等待硬件。
+//! 互不依赖的探测（例如同一个AHCI控制器的各个端口）可以放入同一个[`ProbeGroup`]，
+//! 由不绑定cpu的工作队列并行执行；依赖它们的步骤（例如挂载根文件系统）在[`ProbeGroup::wait`]之后执行。
+
+use alloc::{boxed::Box, sync::Arc};
+
+use crate::{
+    libs::{spinlock::SpinLock, wait_queue::WaitQueue},
+    process::workqueue::{system_unbound_wq, Work},
+};
+
+/// 一组并行执行的探测
+#[derive(Debug, Clone)]
+pub struct ProbeGroup {
+    inner: Arc<InnerProbeGroup>,
+}
+
+#[derive(Debug)]
+struct InnerProbeGroup {
+    /// 还没有完成的探测的数量
+    pending: SpinLock<usize>,
+    /// 等待所有探测完成
+    wait: WaitQueue,
+}
+
+impl ProbeGroup {
+    pub fn new() -> Self {
+        return Self {
+            inner: Arc::new(InnerProbeGroup {
+                pending: SpinLock::new(0),
+                wait: WaitQueue::INIT,
+            }),
+        };
+    }
+
+    /// 把一个探测交给工作队列执行
+    pub fn spawn<F: FnOnce() + Send + 'static>(&self, probe: F) {
+        *self.inner.pending.lock_irqsave() += 1;
+
+        let inner = self.inner.clone();
+        let probe: SpinLock<Option<Box<dyn FnOnce() + Send>>> =
+            SpinLock::new(Some(Box::new(probe)));
+        let work = Work::new(move || {
+            let probe = probe.lock().take();
+            if let Some(probe) = probe {
+                probe();
+            }
+            let mut pending = inner.pending.lock_irqsave();
+            *pending -= 1;
+            if *pending == 0 {
+                drop(pending);
+                inner.wait.wakeup_all(None);
+            }
+        });
+        system_unbound_wq().queue_work(&work);
+    }
+
+    /// 等待组内所有的探测完成
+    pub fn wait(&self) {
+        loop {
+            let pending = self.inner.pending.lock_irqsave();
+            if *pending == 0 {
+                return;
+            }
+            self.inner
+                .wait
+                .sleep_uninterruptible_unlock_spinlock(pending);
+        }
+    }
+}
@@ -8,6 +8,7 @@ use alloc::{
     sync::{Arc, Weak},
     vec::Vec,
 };
+use hashbrown::HashMap;
 
 use crate::{
     libs::{
@@ -40,6 +41,8 @@ pub struct SubSysPrivate {
     devices: RwLock<Vec<Weak<dyn Device>>>,
     /// 当前总线上的所有驱动
     drivers: RwLock<Vec<Weak<dyn Driver>>>,
+    /// 按总线给出的匹配键建立的设备/驱动索引，见[`Bus::device_match_keys`]
+    match_index: RwLock<MatchIndex>,
     interfaces: &'static [&'static dyn SubSysInterface],
     bus_notifier: AtomicNotifierChain<BusNotifyEvent, Arc<dyn Device>>,
 }
@@ -61,6 +64,87 @@ impl SubSysKSets {
     }
 }
 
+/// 设备与驱动的匹配索引
+///
+/// 总线为设备和驱动给出匹配键，只有至少有一个相同的键的设备和驱动才可能匹配。
+/// 这样为新设备寻找驱动（或者为新驱动寻找设备）时，只需要与索引中同一个键下的对象匹配，
+/// 不需要遍历总线上的全部驱动（设备）。没有匹配键的对象放在unkeyed列表中，与所有对象都要匹配一次
+#[derive(Debug)]
+struct MatchIndex {
+    devices: HashMap<String, Vec<Weak<dyn Device>>>,
+    unkeyed_devices: Vec<Weak<dyn Device>>,
+    drivers: HashMap<String, Vec<Weak<dyn Driver>>>,
+    unkeyed_drivers: Vec<Weak<dyn Driver>>,
+}
+
+impl MatchIndex {
+    fn new() -> Self {
+        return Self {
+            devices: HashMap::new(),
+            unkeyed_devices: Vec::new(),
+            drivers: HashMap::new(),
+            unkeyed_drivers: Vec::new(),
+        };
+    }
+
+    /// 把对象按keys加入索引。keys为None时，加入unkeyed列表
+    fn insert<T: ?Sized>(
+        map: &mut HashMap<String, Vec<Weak<T>>>,
+        unkeyed: &mut Vec<Weak<T>>,
+        keys: Option<Vec<String>>,
+        obj: Weak<T>,
+    ) {
+        match keys {
+            Some(keys) => {
+                for key in keys {
+                    let list = map.entry(key).or_insert_with(Vec::new);
+                    if !list.iter().any(|o| o.ptr_eq(&obj)) {
+                        list.push(obj.clone());
+                    }
+                }
+            }
+            None => unkeyed.push(obj),
+        }
+    }
+
+    fn remove<T: ?Sized>(
+        map: &mut HashMap<String, Vec<Weak<T>>>,
+        unkeyed: &mut Vec<Weak<T>>,
+        obj: &Weak<T>,
+    ) {
+        map.retain(|_, list| {
+            list.retain(|o| !o.ptr_eq(obj));
+            !list.is_empty()
+        });
+        unkeyed.retain(|o| !o.ptr_eq(obj));
+    }
+
+    /// 可能与keys匹配的对象：keys为None时是全部对象，否则是这些键下的对象以及没有匹配键的对象
+    fn candidates<T: ?Sized>(
+        map: &HashMap<String, Vec<Weak<T>>>,
+        unkeyed: &[Weak<T>],
+        all: &[Weak<T>],
+        keys: Option<&[String]>,
+    ) -> Vec<Arc<T>> {
+        let keys = match keys {
+            Some(keys) => keys,
+            None => return all.iter().filter_map(|o| o.upgrade()).collect(),
+        };
+        let mut result: Vec<Weak<T>> = Vec::new();
+        for o in keys
+            .iter()
+            .filter_map(|k| map.get(k))
+            .flatten()
+            .chain(unkeyed.iter())
+        {
+            if !result.iter().any(|r| r.ptr_eq(o)) {
+                result.push(o.clone());
+            }
+        }
+        return result.iter().filter_map(|o| o.upgrade()).collect();
+    }
+}
+
 impl SubSysPrivate {
     pub fn new(
         name: String,
@@ -75,6 +159,7 @@ impl SubSysPrivate {
             bus: SpinLock::new(bus),
             devices: RwLock::new(Vec::new()),
             drivers: RwLock::new(Vec::new()),
+            match_index: RwLock::new(MatchIndex::new()),
             interfaces,
             bus_notifier: AtomicNotifierChain::new(),
         };
@@ -142,12 +227,25 @@ impl SubSysPrivate {
     }
 
     pub fn add_driver_to_vec(&self, driver: &Arc<dyn Driver>) -> Result<(), SystemError> {
+        // 先计算匹配键，避免在持有锁的时候回调总线
+        let keys = self
+            .bus()
+            .upgrade()
+            .and_then(|bus| bus.driver_match_keys(driver));
         let mut drivers = self.drivers.write();
         let driver_weak = Arc::downgrade(driver);
         if drivers.iter().any(|d| d.ptr_eq(&driver_weak)) {
             return Err(SystemError::EEXIST);
         }
-        drivers.push(driver_weak);
+        drivers.push(driver_weak.clone());
+        let mut index = self.match_index.write();
+        let index = &mut *index;
+        MatchIndex::insert(
+            &mut index.drivers,
+            &mut index.unkeyed_drivers,
+            keys,
+            driver_weak,
+        );
         return Ok(());
     }
 
@@ -158,15 +256,30 @@ impl SubSysPrivate {
         if let Some(index) = index {
             drivers.remove(index);
         }
+        let mut index = self.match_index.write();
+        let index = &mut *index;
+        MatchIndex::remove(&mut index.drivers, &mut index.unkeyed_drivers, &driver_weak);
     }
 
     pub fn add_device_to_vec(&self, device: &Arc<dyn Device>) -> Result<(), SystemError> {
+        let keys = self
+            .bus()
+            .upgrade()
+            .and_then(|bus| bus.device_match_keys(device));
         let mut devices = self.devices.write();
         let device_weak = Arc::downgrade(device);
         if devices.iter().any(|d| d.ptr_eq(&device_weak)) {
             return Err(SystemError::EEXIST);
         }
-        devices.push(device_weak);
+        devices.push(device_weak.clone());
+        let mut index = self.match_index.write();
+        let index = &mut *index;
+        MatchIndex::insert(
+            &mut index.devices,
+            &mut index.unkeyed_devices,
+            keys,
+            device_weak,
+        );
         return Ok(());
     }
 
@@ -178,6 +291,43 @@ impl SubSysPrivate {
         if let Some(index) = index {
             devices.remove(index);
         }
+        let mut index = self.match_index.write();
+        let index = &mut *index;
+        MatchIndex::remove(&mut index.devices, &mut index.unkeyed_devices, &device_weak);
+    }
+
+    /// 总线上可能与设备匹配的驱动
+    ///
+    /// 只返回与设备有相同匹配键的驱动，以及没有匹配键的驱动。设备没有匹配键时，返回全部驱动
+    pub fn driver_candidates(&self, device: &Arc<dyn Device>) -> Vec<Arc<dyn Driver>> {
+        let keys = self
+            .bus()
+            .upgrade()
+            .and_then(|bus| bus.device_match_keys(device));
+        let drivers = self.drivers.read();
+        let index = self.match_index.read();
+        return MatchIndex::candidates(
+            &index.drivers,
+            &index.unkeyed_drivers,
+            &drivers,
+            keys.as_deref(),
+        );
+    }
+
+    /// 总线上可能与驱动匹配的设备，见[`Self::driver_candidates`]
+    pub fn device_candidates(&self, driver: &Arc<dyn Driver>) -> Vec<Arc<dyn Device>> {
+        let keys = self
+            .bus()
+            .upgrade()
+            .and_then(|bus| bus.driver_match_keys(driver));
+        let devices = self.devices.read();
+        let index = self.match_index.read();
+        return MatchIndex::candidates(
+            &index.devices,
+            &index.unkeyed_devices,
+            &devices,
+            keys.as_deref(),
+        );
     }
 }
 
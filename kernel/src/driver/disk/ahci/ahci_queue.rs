@@ -0,0 +1,603 @@
+//! AHCI端口的命令队列
+//!
+//! 每个端口有最多32个命令槽，每个命令槽可以同时挂着一个命令。提交命令的进程先分配一个空闲的命令槽
+//! （没有空闲的命令槽时在等待队列上睡眠），填写命令之后设置PxCI，然后在这个命令槽的完成量上睡眠。
+//! 端口中断到来时，中断处理函数根据PxCI/PxSACT找出已经完成的命令槽，唤醒等待它们的进程。
+//!
+//! 如果控制器和磁盘都支持NCQ，读写命令使用READ/WRITE FPDMA QUEUED，磁盘可以同时处理多个命令，
+//! 并且自行决定执行的顺序；否则使用READ/WRITE DMA EXT，控制器按顺序逐个执行已经提交的命令。
+//!
+//! 控制器的中断不可用时（例如设备不支持MSI），或者提交命令的进程持有自旋锁而不能睡眠时，
+//! 提交命令的进程轮询端口的状态。
+
+use alloc::{sync::Arc, vec::Vec};
+use core::{
+    mem::size_of,
+    ptr::write_bytes,
+    sync::atomic::{compiler_fence, AtomicBool, AtomicU32, Ordering},
+};
+
+use crate::{
+    arch::MMArch,
+    driver::base::block::block_device::BlockId,
+    include::bindings::bindings::{pt_regs, verify_area},
+    kerror, kinfo,
+    libs::{spinlock::SpinLock, wait_queue::WaitQueue},
+    mm::{phys_2_virt, pin::PinnedUserPages, virt_2_phys, MemoryManagementArch, VirtAddr},
+    process::ProcessManager,
+    sched::completion::Completion,
+    syscall::SystemError,
+    time::clocksource::HZ,
+};
+
+use super::hba::{
+    FisRegH2D, FisType, HbaCmdHeader, HbaCmdTable, HbaMem, HbaPort, ATA_CMD_IDENTIFY,
+    ATA_CMD_READ_DMA_EXT, ATA_CMD_READ_FPDMA_QUEUED, ATA_CMD_WRITE_DMA_EXT,
+    ATA_CMD_WRITE_FPDMA_QUEUED, HBA_CAP_NCS_MASK, HBA_CAP_NCS_SHIFT, HBA_CAP_SNCQ, HBA_MAX_PRDT,
+    HBA_PORT_IE_DEFAULT, HBA_PORT_IS_ERR, HBA_PRDT_MAX_BYTES,
+};
+
+/// 所有端口的命令队列，中断处理函数通过它找到需要处理的端口
+static AHCI_CMD_QUEUES: SpinLock<Vec<Arc<AhciCmdQueue>>> = SpinLock::new(Vec::new());
+
+/// 等待一个命令完成的超时时间（jiffies）。超时之后主动检查一次端口的状态，防止丢失中断时一直睡眠
+const AHCI_CMD_TIMEOUT: i64 = HZ as i64;
+
+/// 一个命令最多传输的扇区数量（count寄存器只有16位）
+const AHCI_MAX_SECTORS: usize = u16::MAX as usize;
+
+/// 一个命令
+enum AhciCmd {
+    Read,
+    Write,
+    Identify,
+}
+
+/// 命令的数据缓冲区
+enum AhciBuf<'a> {
+    /// 内核缓冲区的虚拟地址（位于线性映射区域，物理地址连续）
+    Kernel(usize),
+    /// 被固定的用户缓冲区
+    User(&'a PinnedUserPages),
+}
+
+impl AhciBuf<'_> {
+    /// 获取缓冲区中第`offset`个字节的物理地址
+    fn paddr(&self, offset: usize) -> usize {
+        match self {
+            AhciBuf::Kernel(vaddr) => virt_2_phys(vaddr + offset),
+            AhciBuf::User(pages) => pages.paddr(offset).data(),
+        }
+    }
+}
+
+/// 一个端口的命令队列
+pub struct AhciCmdQueue {
+    ctrl_num: u8,
+    port_num: u8,
+    /// 端口寄存器的虚拟地址
+    port_vaddr: usize,
+    /// 控制器寄存器的虚拟地址
+    hba_vaddr: usize,
+    /// 可以使用的命令槽的掩码
+    slot_mask: AtomicU32,
+    /// 读写是否使用NCQ
+    ncq: AtomicBool,
+    /// 控制器的中断是否可用
+    irq: bool,
+    inner: SpinLock<InnerAhciCmdQueue>,
+    /// 等待空闲命令槽的进程
+    slot_wait: WaitQueue,
+    /// 每个命令槽的完成量
+    done: [Completion; 32],
+}
+
+#[derive(Debug)]
+struct InnerAhciCmdQueue {
+    /// 已经被分配的命令槽
+    busy: u32,
+    /// 已经提交给控制器、还没有完成的命令槽
+    issued: u32,
+    /// 执行出错的命令槽
+    failed: u32,
+}
+
+impl core::fmt::Debug for AhciCmdQueue {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        f.debug_struct("AhciCmdQueue")
+            .field("ctrl_num", &self.ctrl_num)
+            .field("port_num", &self.port_num)
+            .field("slot_mask", &self.slot_mask)
+            .field("ncq", &self.ncq)
+            .field("irq", &self.irq)
+            .finish()
+    }
+}
+
+impl AhciCmdQueue {
+    /// @brief 为一个已经初始化（见[`HbaPort::init`]）的端口创建命令队列，并且检测磁盘是否支持NCQ
+    /// @param hba_vaddr 控制器寄存器的虚拟地址
+    /// @param irq 控制器的中断是否已经安装
+    pub fn new(ctrl_num: u8, port_num: u8, hba_vaddr: usize, irq: bool) -> Arc<AhciCmdQueue> {
+        let hba = unsafe { (hba_vaddr as *mut HbaMem).as_mut().unwrap() };
+        let cap = volatile_read!(hba.cap);
+        let nr_slots = ((cap >> HBA_CAP_NCS_SHIFT) & HBA_CAP_NCS_MASK) + 1;
+        let port_vaddr = &hba.ports[port_num as usize] as *const HbaPort as usize;
+
+        const DONE: Completion = Completion::new();
+        let queue = Arc::new(AhciCmdQueue {
+            ctrl_num,
+            port_num,
+            port_vaddr,
+            hba_vaddr,
+            slot_mask: AtomicU32::new(Self::mask_of(nr_slots)),
+            ncq: AtomicBool::new(false),
+            irq,
+            inner: SpinLock::new(InnerAhciCmdQueue {
+                busy: 0,
+                issued: 0,
+                failed: 0,
+            }),
+            slot_wait: WaitQueue::INIT,
+            done: [DONE; 32],
+        });
+        AHCI_CMD_QUEUES.lock_irqsave().push(queue.clone());
+
+        if irq {
+            let port = queue.port();
+            volatile_write!(port.is, u32::MAX);
+            volatile_write!(port.ie, HBA_PORT_IE_DEFAULT);
+        }
+
+        if cap & HBA_CAP_SNCQ != 0 {
+            queue.probe_ncq();
+        }
+        return queue;
+    }
+
+    fn mask_of(nr_slots: u32) -> u32 {
+        if nr_slots >= 32 {
+            return u32::MAX;
+        }
+        return (1 << nr_slots) - 1;
+    }
+
+    fn port(&self) -> &'static mut HbaPort {
+        return unsafe { (self.port_vaddr as *mut HbaPort).as_mut().unwrap() };
+    }
+
+    fn hba(&self) -> &'static mut HbaMem {
+        return unsafe { (self.hba_vaddr as *mut HbaMem).as_mut().unwrap() };
+    }
+
+    /// @brief 通过IDENTIFY DEVICE命令检测磁盘是否支持NCQ，以及支持的队列深度
+    fn probe_ncq(&self) {
+        let mut buf: Vec<u8> = Vec::new();
+        buf.resize(512, 0);
+        if let Err(err) = self.transfer(
+            AhciCmd::Identify,
+            0,
+            1,
+            &AhciBuf::Kernel(buf.as_mut_ptr() as usize),
+        ) {
+            kerror!(
+                "ahci ctrl = {}, port = {}: IDENTIFY failed: {:?}",
+                self.ctrl_num,
+                self.port_num,
+                err
+            );
+            return;
+        }
+        let word = |i: usize| u16::from_le_bytes([buf[i * 2], buf[i * 2 + 1]]);
+        // word 76 bit 8: 支持NCQ; word 75 bit 4:0: 队列深度-1
+        if word(76) & (1 << 8) == 0 {
+            return;
+        }
+        let depth = (word(75) & 0x1f) as u32 + 1;
+        let mask = self.slot_mask.load(Ordering::SeqCst) & Self::mask_of(depth);
+        self.slot_mask.store(mask, Ordering::SeqCst);
+        self.ncq.store(true, Ordering::SeqCst);
+        kinfo!(
+            "ahci ctrl = {}, port = {}: NCQ enabled, queue depth = {}",
+            self.ctrl_num,
+            self.port_num,
+            mask.count_ones()
+        );
+    }
+
+    pub fn read_at(
+        &self,
+        lba_id_start: BlockId, // 起始lba编号
+        count: usize,          // 读取lba的数量
+        buf: &mut [u8],
+    ) -> Result<usize, SystemError> {
+        assert!((buf.len() & 511) == 0);
+        if count == 0 {
+            return Ok(0);
+        } else if count * 512 > buf.len() {
+            kerror!("ahci read: e2big");
+            // 不可能的操作
+            return Err(SystemError::E2BIG);
+        }
+
+        let len = count * 512;
+        let buf_ptr = buf.as_mut_ptr() as usize;
+        if buf_ptr & 1 != 0 {
+            // PRDT要求数据的地址按照2字节对齐，只能先读到对齐的内核缓冲区中
+            let mut kbuf: Vec<u8> = Vec::new();
+            kbuf.resize(len, 0);
+            let kbuf_ptr = kbuf.as_mut_ptr() as usize;
+            self.transfer(
+                AhciCmd::Read,
+                lba_id_start,
+                count,
+                &AhciBuf::Kernel(kbuf_ptr),
+            )?;
+            buf[..len].copy_from_slice(&kbuf);
+        } else if unsafe { verify_area(buf_ptr as u64, len as u64) } {
+            // 用户缓冲区：固定它的物理页，设备直接写入
+            let pages = PinnedUserPages::pin(VirtAddr::new(buf_ptr), len, true)?;
+            self.transfer(AhciCmd::Read, lba_id_start, count, &AhciBuf::User(&pages))?;
+        } else {
+            self.transfer(
+                AhciCmd::Read,
+                lba_id_start,
+                count,
+                &AhciBuf::Kernel(buf_ptr),
+            )?;
+        }
+        return Ok(len);
+    }
+
+    pub fn write_at(
+        &self,
+        lba_id_start: BlockId,
+        count: usize,
+        buf: &[u8],
+    ) -> Result<usize, SystemError> {
+        assert!((buf.len() & 511) == 0);
+        if count == 0 {
+            return Ok(0);
+        } else if count * 512 > buf.len() {
+            // 不可能的操作
+            return Err(SystemError::E2BIG);
+        }
+
+        let len = count * 512;
+        let buf_ptr = buf.as_ptr() as usize;
+        if buf_ptr & 1 != 0 {
+            // PRDT要求数据的地址按照2字节对齐，只能先拷贝到对齐的内核缓冲区中
+            let kbuf: Vec<u8> = buf[..len].to_vec();
+            let kbuf_ptr = kbuf.as_ptr() as usize;
+            self.transfer(
+                AhciCmd::Write,
+                lba_id_start,
+                count,
+                &AhciBuf::Kernel(kbuf_ptr),
+            )?;
+        } else if unsafe { verify_area(buf_ptr as u64, len as u64) } {
+            // 用户缓冲区：固定它的物理页，设备直接读取
+            let pages = PinnedUserPages::pin(VirtAddr::new(buf_ptr), len, false)?;
+            self.transfer(AhciCmd::Write, lba_id_start, count, &AhciBuf::User(&pages))?;
+        } else {
+            self.transfer(
+                AhciCmd::Write,
+                lba_id_start,
+                count,
+                &AhciBuf::Kernel(buf_ptr),
+            )?;
+        }
+        return Ok(len);
+    }
+
+    /// @brief 传输count个扇区。一个命令的PRDT放不下的部分，拆分为多个命令
+    fn transfer(
+        &self,
+        cmd: AhciCmd,
+        lba_id_start: BlockId,
+        count: usize,
+        buf: &AhciBuf,
+    ) -> Result<(), SystemError> {
+        let mut done = 0;
+        while done < count {
+            done += self.execute(
+                &cmd,
+                lba_id_start + done as BlockId,
+                count - done,
+                buf,
+                done * 512,
+            )?;
+        }
+        return Ok(());
+    }
+
+    /// @brief 分配一个命令槽，填写并提交命令，然后等待命令完成
+    /// @param buf 数据缓冲区
+    /// @param buf_offset 本次传输的数据在缓冲区中的起始位置
+    /// @return 成功则返回这个命令传输的扇区数量（可能少于count）
+    fn execute(
+        &self,
+        cmd: &AhciCmd,
+        lba_id_start: BlockId,
+        count: usize,
+        buf: &AhciBuf,
+        buf_offset: usize,
+    ) -> Result<usize, SystemError> {
+        let slot = self.alloc_slot();
+        let count = self.fill(slot, cmd, lba_id_start, count, buf, buf_offset);
+        let ncq = self.ncq.load(Ordering::SeqCst) && !matches!(cmd, AhciCmd::Identify);
+        self.issue(slot, ncq);
+        self.wait(slot);
+
+        let failed = {
+            let mut inner = self.inner.lock_irqsave();
+            let failed = inner.failed & (1 << slot) != 0;
+            inner.failed &= !(1 << slot);
+            failed
+        };
+        self.free_slot(slot);
+
+        if failed {
+            kerror!(
+                "ahci ctrl = {}, port = {}: disk error, lba = {}, count = {}",
+                self.ctrl_num,
+                self.port_num,
+                lba_id_start,
+                count
+            );
+            return Err(SystemError::EIO);
+        }
+        return Ok(count);
+    }
+
+    fn alloc_slot(&self) -> u32 {
+        let can_sleep = Self::can_sleep();
+        loop {
+            let mut inner = self.inner.lock_irqsave();
+            let free = !inner.busy & self.slot_mask.load(Ordering::SeqCst);
+            if free != 0 {
+                let slot = free.trailing_zeros();
+                inner.busy |= 1 << slot;
+                return slot;
+            }
+            if can_sleep {
+                self.slot_wait.sleep_uninterruptible_unlock_spinlock(inner);
+            } else {
+                drop(inner);
+                self.handle_irq();
+                core::hint::spin_loop();
+            }
+        }
+    }
+
+    /// 调用者持有自旋锁时不能睡眠，只能轮询端口的状态
+    fn can_sleep() -> bool {
+        return ProcessManager::current().preempt_count() == 0;
+    }
+
+    fn free_slot(&self, slot: u32) {
+        self.inner.lock_irqsave().busy &= !(1 << slot);
+        self.slot_wait.wakeup(None);
+    }
+
+    /// @brief 填写命令槽对应的command header、command table和命令FIS
+    /// @return 这个命令传输的扇区数量。PRDT放不下所有的数据时，少于count
+    fn fill(
+        &self,
+        slot: u32,
+        cmd: &AhciCmd,
+        lba_id_start: BlockId,
+        count: usize,
+        buf: &AhciBuf,
+        buf_offset: usize,
+    ) -> usize {
+        let port = self.port();
+        compiler_fence(Ordering::SeqCst);
+        #[allow(unused_unsafe)]
+        let cmdheader: &mut HbaCmdHeader = unsafe {
+            (phys_2_virt(
+                volatile_read!(port.clb) as usize + slot as usize * size_of::<HbaCmdHeader>(),
+            ) as *mut HbaCmdHeader)
+                .as_mut()
+                .unwrap()
+        };
+        #[allow(unused_unsafe)]
+        let cmdtbl = unsafe {
+            (phys_2_virt(volatile_read!(cmdheader.ctba) as usize) as *mut HbaCmdTable)
+                .as_mut()
+                .unwrap() // 必须使用 as_mut ，得到的才是原来的变量
+        };
+
+        // 按照物理页拆分缓冲区，物理地址连续的部分合并为一个PRDT项
+        let max_len = count.min(AHCI_MAX_SECTORS) * 512;
+        let mut prdtl = 0;
+        let mut len = 0;
+        let mut entry_base = 0;
+        let mut entry_len = 0;
+        while len < max_len {
+            let paddr = buf.paddr(buf_offset + len);
+            let chunk = (MMArch::PAGE_SIZE - (paddr & MMArch::PAGE_OFFSET_MASK)).min(max_len - len);
+            if prdtl > 0
+                && entry_base + entry_len == paddr
+                && entry_len + chunk <= HBA_PRDT_MAX_BYTES
+            {
+                entry_len += chunk;
+            } else if prdtl == HBA_MAX_PRDT {
+                break;
+            } else {
+                if prdtl > 0 {
+                    Self::set_prdt(cmdtbl, prdtl - 1, entry_base, entry_len);
+                }
+                prdtl += 1;
+                entry_base = paddr;
+                entry_len = chunk;
+            }
+            len += chunk;
+        }
+
+        // 命令只能传输整数个扇区，去掉最后不足一个扇区的部分
+        let count = len / 512;
+        let mut trim = len - count * 512;
+        while trim >= entry_len {
+            trim -= entry_len;
+            prdtl -= 1;
+            entry_base = volatile_read!(cmdtbl.prdt_entry[prdtl - 1].dba) as usize;
+            entry_len = (volatile_read!(cmdtbl.prdt_entry[prdtl - 1].dbc)
+                & (HBA_PRDT_MAX_BYTES as u32 - 1)) as usize
+                + 1;
+        }
+        Self::set_prdt(cmdtbl, prdtl - 1, entry_base, entry_len - trim);
+
+        let mut cfl = (size_of::<FisRegH2D>() / size_of::<u32>()) as u8; // Command FIS size
+        if let AhciCmd::Write = cmd {
+            cfl |= 1 << 6; // Write: host to device
+        }
+        volatile_write!(cmdheader.cfl, cfl);
+        volatile_write!(cmdheader.prdtl, prdtl as u16); // PRDT entries count
+        volatile_write!(cmdheader._prdbc, 0);
+
+        unsafe {
+            // 清空旧的命令FIS
+            write_bytes(&mut cmdtbl.cfis as *mut [u8; 64] as *mut u8, 0, 64);
+        }
+
+        // 设置命令
+        let cmdfis = unsafe {
+            ((&mut cmdtbl.cfis) as *mut [u8] as *mut usize as *mut FisRegH2D)
+                .as_mut()
+                .unwrap()
+        };
+        volatile_write!(cmdfis.fis_type, FisType::RegH2D as u8);
+        volatile_set_bit!(cmdfis.pm, 1 << 7, true); // command_bit set
+
+        if let AhciCmd::Identify = cmd {
+            volatile_write!(cmdfis.command, ATA_CMD_IDENTIFY);
+            volatile_write!(cmdfis.device, 0);
+            compiler_fence(Ordering::SeqCst);
+            return count;
+        }
+
+        volatile_write!(cmdfis.lba0, (lba_id_start & 0xFF) as u8);
+        volatile_write!(cmdfis.lba1, ((lba_id_start >> 8) & 0xFF) as u8);
+        volatile_write!(cmdfis.lba2, ((lba_id_start >> 16) & 0xFF) as u8);
+        volatile_write!(cmdfis.lba3, ((lba_id_start >> 24) & 0xFF) as u8);
+        volatile_write!(cmdfis.lba4, ((lba_id_start >> 32) & 0xFF) as u8);
+        volatile_write!(cmdfis.lba5, ((lba_id_start >> 40) & 0xFF) as u8);
+        volatile_write!(cmdfis.device, 1 << 6); // LBA Mode
+
+        if self.ncq.load(Ordering::SeqCst) {
+            // FPDMA QUEUED: 扇区数放在feature寄存器中，count寄存器的bit 7:3是命令的tag
+            let command = match cmd {
+                AhciCmd::Write => ATA_CMD_WRITE_FPDMA_QUEUED,
+                _ => ATA_CMD_READ_FPDMA_QUEUED,
+            };
+            volatile_write!(cmdfis.command, command);
+            volatile_write!(cmdfis.featurel, (count & 0xFF) as u8);
+            volatile_write!(cmdfis.featureh, ((count >> 8) & 0xFF) as u8);
+            volatile_write!(cmdfis.countl, (slot << 3) as u8);
+        } else {
+            let command = match cmd {
+                AhciCmd::Write => ATA_CMD_WRITE_DMA_EXT,
+                _ => ATA_CMD_READ_DMA_EXT,
+            };
+            volatile_write!(cmdfis.command, command);
+            volatile_write!(cmdfis.countl, (count & 0xFF) as u8);
+            volatile_write!(cmdfis.counth, ((count >> 8) & 0xFF) as u8);
+        }
+        compiler_fence(Ordering::SeqCst);
+        return count;
+    }
+
+    fn set_prdt(cmdtbl: &mut HbaCmdTable, index: usize, paddr: usize, len: usize) {
+        volatile_write!(cmdtbl.prdt_entry[index].dba, paddr as u64);
+        volatile_write!(cmdtbl.prdt_entry[index].dbc, (len - 1) as u32); // 数据长度
+    }
+
+    /// @brief 把命令槽提交给控制器
+    fn issue(&self, slot: u32, ncq: bool) {
+        let port = self.port();
+        let mut inner = self.inner.lock_irqsave();
+        inner.issued |= 1 << slot;
+        inner.failed &= !(1 << slot);
+        // 写0的位不受影响，因此只需要写入这个命令槽对应的位
+        if ncq {
+            volatile_write!(port.sact, 1 << slot);
+        }
+        volatile_write!(port.ci, 1 << slot); // Issue command
+        drop(inner);
+    }
+
+    /// @brief 等待命令槽上的命令完成
+    fn wait(&self, slot: u32) {
+        let done = &self.done[slot as usize];
+        if !self.irq || !Self::can_sleep() {
+            while !done.completion_done() {
+                self.handle_irq();
+                core::hint::spin_loop();
+            }
+            done.wait_for_completion().ok();
+            return;
+        }
+
+        loop {
+            match done.wait_for_completion_timeout(AHCI_CMD_TIMEOUT) {
+                Ok(remain) if remain > 0 => return,
+                // 超时：可能丢失了中断，主动检查一次端口的状态
+                _ => self.handle_irq(),
+            }
+        }
+    }
+
+    /// @brief 处理端口的中断：找出已经完成的命令槽，唤醒等待它们的进程
+    ///
+    /// 在中断上下文中调用；中断不可用时，由等待命令完成的进程轮询调用
+    pub fn handle_irq(&self) {
+        let port = self.port();
+        let mut inner = self.inner.lock_irqsave();
+        let is = volatile_read!(port.is);
+        volatile_write!(port.is, is);
+        volatile_write!(self.hba().is, 1 << self.port_num);
+
+        let finished = if is & HBA_PORT_IS_ERR != 0 {
+            // 端口在出错之后停止处理命令，让所有已经提交的命令失败，然后重启端口
+            kerror!(
+                "ahci ctrl = {}, port = {}: error, is = {:#x}, tfd = {:#x}",
+                self.ctrl_num,
+                self.port_num,
+                is,
+                volatile_read!(port.tfd)
+            );
+            port.stop();
+            volatile_write!(port.serr, volatile_read!(port.serr));
+            volatile_write!(port.is, u32::MAX);
+            port.start();
+            inner.failed |= inner.issued;
+            inner.issued
+        } else {
+            let running = volatile_read!(port.ci) | volatile_read!(port.sact);
+            inner.issued & !running
+        };
+        inner.issued &= !finished;
+        drop(inner);
+
+        let mut finished = finished;
+        while finished != 0 {
+            let slot = finished.trailing_zeros();
+            finished &= !(1 << slot);
+            self.done[slot as usize].complete();
+        }
+    }
+}
+
+/// @brief AHCI控制器的中断处理函数
+/// @param ctrl_num 控制器的编号
+pub unsafe extern "C" fn ahci_irq_handler(_irq_num: u64, ctrl_num: u64, _regs: *mut pt_regs) {
+    let queues = AHCI_CMD_QUEUES.lock_irqsave();
+    for queue in queues.iter() {
+        if queue.ctrl_num as u64 == ctrl_num
+            && volatile_read!(queue.hba().is) & (1 << queue.port_num) != 0
+        {
+            queue.handle_irq();
+        }
+    }
+}
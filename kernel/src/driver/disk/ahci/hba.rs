@@ -10,7 +10,8 @@ use crate::mm::phys_2_virt;
 /// 根据 AHCI 写出 HBA 的 Command
 pub const ATA_CMD_READ_DMA_EXT: u8 = 0x25; // 读操作，并且退出
 pub const ATA_CMD_WRITE_DMA_EXT: u8 = 0x35; // 写操作，并且退出
-#[allow(dead_code)]
+pub const ATA_CMD_READ_FPDMA_QUEUED: u8 = 0x60; // NCQ读操作
+pub const ATA_CMD_WRITE_FPDMA_QUEUED: u8 = 0x61; // NCQ写操作
 pub const ATA_CMD_IDENTIFY: u8 = 0xEC;
 #[allow(dead_code)]
 pub const ATA_CMD_IDENTIFY_PACKET: u8 = 0xA1;
@@ -23,14 +24,27 @@ pub const HBA_PORT_CMD_CR: u32 = 1 << 15;
 pub const HBA_PORT_CMD_FR: u32 = 1 << 14;
 pub const HBA_PORT_CMD_FRE: u32 = 1 << 4;
 pub const HBA_PORT_CMD_ST: u32 = 1;
-#[allow(dead_code)]
 pub const HBA_PORT_IS_ERR: u32 = 1 << 30 | 1 << 29 | 1 << 28 | 1 << 27;
+/// 端口默认开启的中断：D2H Register FIS、PIO Setup FIS、DMA Setup FIS、Set Device Bits FIS，以及所有错误
+pub const HBA_PORT_IE_DEFAULT: u32 = 1 << 3 | 1 << 2 | 1 << 1 | 1 | HBA_PORT_IS_ERR;
+/// CAP.SNCQ: 控制器支持NCQ
+pub const HBA_CAP_SNCQ: u32 = 1 << 30;
+/// CAP.NCS: 每个端口的命令槽数量-1
+pub const HBA_CAP_NCS_SHIFT: u32 = 8;
+pub const HBA_CAP_NCS_MASK: u32 = 0x1f;
+/// GHC.IE: 控制器中断使能
+pub const HBA_GHC_IE: u32 = 1 << 1;
 pub const HBA_SSTS_PRESENT: u32 = 0x3;
 pub const HBA_SIG_ATA: u32 = 0x00000101;
 pub const HBA_SIG_ATAPI: u32 = 0xEB140101;
 pub const HBA_SIG_PM: u32 = 0x96690101;
 pub const HBA_SIG_SEMB: u32 = 0xC33C0101;
 
+/// 每个命令表中的PRDT项数量，使命令表正好占一页
+pub const HBA_MAX_PRDT: usize = 248;
+/// 一个PRDT项最多描述的字节数
+pub const HBA_PRDT_MAX_BYTES: usize = 1 << 22;
+
 /// 接入 Port 的 不同设备类型
 #[derive(Debug)]
 pub enum HbaPortType {
@@ -93,7 +107,7 @@ pub struct HbaPrdtEntry {
 }
 
 /// HAB Command Table
-/// 每个 Port 一个 Table，主机和设备的交互都靠这个数据结构
+/// 每个命令槽一个 Table，主机和设备的交互都靠这个数据结构
 #[repr(packed)]
 pub struct HbaCmdTable {
     // 0x00
@@ -103,7 +117,7 @@ pub struct HbaCmdTable {
     // 0x50
     _rsv: [u8; 48], // Reserved
     // 0x80
-    pub prdt_entry: [HbaPrdtEntry; 8], // Physical region descriptor table entries, 0 ~ 65535, 需要注意不要越界 这里设置8的原因是，目前CmdTable只预留了8个PRDT项的空间
+    pub prdt_entry: [HbaPrdtEntry; HBA_MAX_PRDT], // Physical region descriptor table entries, 0 ~ 65535, 需要注意不要越界
 }
 
 /// HBA Command Header
@@ -214,24 +228,22 @@ impl HbaPort {
         }
 
         // 赋值 command table base address
-        // Command table offset: 40K + 8K*portno
-        // Command table size = 256*32 = 8K per port
+        // Command table size = 4K*32 = 128K per port
         let mut cmdheaders = phys_2_virt(clb as usize) as *mut u64 as *mut HbaCmdHeader;
         for i in 0..32 as usize {
-            volatile_write!((*cmdheaders).prdtl, 0); // 一开始没有询问，prdtl = 0（预留了8个PRDT项的空间）
+            volatile_write!((*cmdheaders).prdtl, 0); // 一开始没有询问，prdtl = 0（预留了HBA_MAX_PRDT个PRDT项的空间）
             volatile_write!((*cmdheaders).ctba, ctbas[i]);
-            // 这里限制了 prdtl <= 8, 所以一共用了256bytes，如果需要修改，可以修改这里
             compiler_fence(core::sync::atomic::Ordering::SeqCst);
             unsafe {
-                ptr::write_bytes(phys_2_virt(ctbas[i] as usize) as *mut u64, 0, 256);
+                ptr::write_bytes(phys_2_virt(ctbas[i] as usize) as *mut HbaCmdTable, 0, 1);
             }
             cmdheaders = (cmdheaders as usize + size_of::<HbaCmdHeader>()) as *mut HbaCmdHeader;
         }
 
         #[allow(unused_unsafe)]
         {
-            // 启动中断
-            volatile_write!(self.ie, 0 /*TODO: Enable interrupts: 0b10111*/);
+            // 先关闭中断，控制器的中断可用时，由命令队列开启（见AhciCmdQueue::new）
+            volatile_write!(self.ie, 0);
 
             // 错误码
             volatile_write!(self.serr, volatile_read!(self.serr));
@@ -1,30 +1,41 @@
 // 导出 ahci 相关的 module
 pub mod ahci_inode;
+pub mod ahci_queue;
 pub mod ahcidisk;
 pub mod hba;
 
+use crate::arch::MMArch;
 use crate::driver::base::block::block_device::BlockDevice;
 use crate::driver::base::block::disk_info::BLK_GF_AHCI;
+use crate::driver::base::block::stats::blk_stats_register;
+use crate::driver::base::probe::ProbeGroup;
 // 依赖的rust工具包
 use crate::driver::pci::pci::{
-    get_pci_device_structure_mut, PciDeviceStructure, PCI_DEVICE_LINKEDLIST,
+    get_pci_device_structure_mut, PciDeviceStructure, PciDeviceStructureGeneralDevice, PciError,
+    PCI_DEVICE_LINKEDLIST,
+};
+use crate::driver::pci::pci_irq::{
+    pci_irq_affinity, pci_irq_vector_alloc, IrqCommonMsg, IrqMsg, IrqSpecificMsg, IrqType,
+    PciInterrupt, PciIrqError, IRQ,
 };
 use crate::filesystem::devfs::devfs_register;
 use crate::kerror;
 use crate::libs::rwlock::RwLockWriteGuard;
 use crate::libs::spinlock::{SpinLock, SpinLockGuard};
-use crate::mm::virt_2_phys;
+use crate::mm::{virt_2_phys, MemoryManagementArch};
 use crate::syscall::SystemError;
 use crate::{
     driver::disk::ahci::{
+        ahci_queue::{ahci_irq_handler, AhciCmdQueue},
         ahcidisk::LockedAhciDisk,
         hba::HbaMem,
-        hba::{HbaPort, HbaPortType},
+        hba::{HbaCmdTable, HbaPortType, HBA_GHC_IE},
     },
     kdebug,
 };
 use ahci_inode::LockedAhciInode;
 use alloc::{
+    alloc::alloc_zeroed,
     boxed::Box,
     collections::LinkedList,
     format,
@@ -32,6 +43,8 @@ use alloc::{
     sync::Arc,
     vec::Vec,
 };
+use core::alloc::Layout;
+use core::mem::size_of;
 use core::sync::atomic::compiler_fence;
 
 // 仅module内可见 全局数据区  hbr_port, disks
@@ -60,19 +73,58 @@ fn ahci_device_search<'a>(
     return Ok(result);
 }
 
-/// @brief: 初始化 ahci
-pub fn ahci_init() -> Result<(), SystemError> {
+/// @brief 为ahci控制器安装MSI中断
+/// @param ctrl_num 控制器的编号，作为参数传给中断处理函数
+fn ahci_irq_init(
+    device: &mut PciDeviceStructureGeneralDevice,
+    ctrl_num: u16,
+) -> Result<(), PciError> {
+    if !matches!(device.irq_init(IRQ::PCI_IRQ_MSI), Some(IrqType::Msi { .. })) {
+        return Err(PciError::PciIrqError(PciIrqError::IrqTypeNotSupported));
+    }
+    let vectors =
+        pci_irq_vector_alloc(1).ok_or(PciError::PciIrqError(PciIrqError::DeviceIrqOverflow))?;
+    device.irq_vector_mut().unwrap().extend(vectors);
+    let msg = IrqMsg {
+        irq_common_message: IrqCommonMsg::init_from(
+            0,
+            "AHCI_IRQ",
+            ctrl_num,
+            ahci_irq_handler,
+            None,
+        ),
+        irq_specific_message: IrqSpecificMsg::msi_affinity(pci_irq_affinity(ctrl_num)),
+    };
+    device.irq_install(msg)?;
+    device.irq_enable(true)?;
+    return Ok(());
+}
+
+/// 一个已经初始化的ahci控制器，各个端口的探测需要的信息
+#[derive(Debug, Clone, Copy)]
+struct AhciCtrl {
+    /// 控制器的编号（在LOCKED_HBA_MEM_LIST中的下标）
+    index: usize,
+    /// HbaMem的虚拟地址
+    hba_vaddr: usize,
+    /// 存放32个端口的command list和FIS的内存
+    port_base_vaddr: usize,
+    /// 控制器的中断是否可用
+    irq: bool,
+}
+
+/// 初始化所有的ahci控制器（需要持有PCI设备链表的锁），返回各个控制器的信息
+fn ahci_ctrl_init() -> Result<Vec<AhciCtrl>, SystemError> {
     let mut list = PCI_DEVICE_LINKEDLIST.write();
     let ahci_device = ahci_device_search(&mut list)?;
-    // 全局数据 - 列表
-    let mut disks_list = LOCKED_DISKS_LIST.lock();
+    let mut ctrls = Vec::new();
 
     for device in ahci_device {
         let standard_device = device.as_standard_device_mut().unwrap();
         standard_device.bar_ioremap();
-        // 对于每一个ahci控制器分配一块空间
+        // 对于每一个ahci控制器分配一块空间，存放32个端口的command list（每个1K）和FIS（每个256字节）
         let ahci_port_base_vaddr =
-            Box::leak(Box::new([0u8; (1 << 20) as usize])) as *mut u8 as usize;
+            Box::leak(Box::new([0u8; (40 << 10) as usize])) as *mut u8 as usize;
         let virtaddr = standard_device
             .bar()
             .ok_or(SystemError::EACCES)?
@@ -85,71 +137,136 @@ pub fn ahci_init() -> Result<(), SystemError> {
         //这里两次unsafe转引用规避rust只能有一个可变引用的检查，提高运行速度
         let hba_mem = unsafe { (virtaddr.data() as *mut HbaMem).as_mut().unwrap() };
         hba_mem_list.push(unsafe { (virtaddr.data() as *mut HbaMem).as_mut().unwrap() });
-        let pi = volatile_read!(hba_mem.pi);
         let hba_mem_index = hba_mem_list.len() - 1;
         drop(hba_mem_list);
-        // 初始化所有的port
-        let mut id = 0;
+
+        // 命令的完成通过中断通知；中断不可用时，提交命令的进程轮询端口的状态
+        let irq = match ahci_irq_init(standard_device, hba_mem_index as u16) {
+            Ok(()) => {
+                volatile_write!(hba_mem.is, u32::MAX);
+                volatile_write!(hba_mem.ghc, volatile_read!(hba_mem.ghc) | HBA_GHC_IE);
+                true
+            }
+            Err(err) => {
+                kerror!(
+                    "ahci ctrl = {}: failed to install irq: {:?}, fall back to polling",
+                    hba_mem_index,
+                    err
+                );
+                false
+            }
+        };
+        ctrls.push(AhciCtrl {
+            index: hba_mem_index,
+            hba_vaddr: virtaddr.data(),
+            port_base_vaddr: ahci_port_base_vaddr,
+            irq,
+        });
+    }
+    return Ok(ctrls);
+}
+
+/// 初始化控制器的第`port`个端口，并为它创建磁盘（会读取分区表）
+fn ahci_port_probe(ctrl: AhciCtrl, port: usize) -> Result<Arc<LockedAhciDisk>, SystemError> {
+    let hba_mem = unsafe { (ctrl.hba_vaddr as *mut HbaMem).as_mut().unwrap() };
+    let hba_mem_port = &mut hba_mem.ports[port];
+
+    // 计算地址
+    let fb = virt_2_phys(ctrl.port_base_vaddr + (32 << 10) + (port << 8));
+    let clb = virt_2_phys(ctrl.port_base_vaddr + (port << 10));
+    // 每个命令槽的命令表占一页，可以容纳HBA_MAX_PRDT个PRDT项
+    let ctba_base = unsafe {
+        alloc_zeroed(
+            Layout::from_size_align(32 * size_of::<HbaCmdTable>(), MMArch::PAGE_SIZE).unwrap(),
+        )
+    } as usize;
+    if ctba_base == 0 {
+        return Err(SystemError::ENOMEM);
+    }
+    let ctbas = (0..32)
+        .map(|x| virt_2_phys(ctba_base + x * size_of::<HbaCmdTable>()) as u64)
+        .collect::<Vec<_>>();
+
+    // 初始化 port
+    hba_mem_port.init(clb as u64, fb as u64, &ctbas);
+    compiler_fence(core::sync::atomic::Ordering::SeqCst);
+    // 创建 disk。名字在所有端口探测完成之后按照端口的顺序分配
+    let queue = AhciCmdQueue::new(ctrl.index as u8, port as u8, ctrl.hba_vaddr, ctrl.irq);
+    return LockedAhciDisk::new(
+        String::new(),
+        BLK_GF_AHCI,
+        ctrl.index as u8,
+        port as u8,
+        queue,
+    );
+}
+
+/// @brief: 初始化 ahci
+///
+/// 各个端口互不依赖，它们的初始化（等待端口的命令引擎停止、读取分区表）并行执行。
+/// 所有端口探测完成之后，再按照控制器和端口的顺序为磁盘命名并注册，保证磁盘的名字与串行探测时相同
+pub fn ahci_init() -> Result<(), SystemError> {
+    let ctrls = ahci_ctrl_init()?;
+
+    let probes = ProbeGroup::new();
+    let results: Arc<SpinLock<Vec<(usize, usize, Result<Arc<LockedAhciDisk>, SystemError>)>>> =
+        Arc::new(SpinLock::new(Vec::new()));
+    for ctrl in ctrls {
+        let hba_mem = unsafe { (ctrl.hba_vaddr as *mut HbaMem).as_mut().unwrap() };
+        let pi = volatile_read!(hba_mem.pi);
         for j in 0..32 {
-            if (pi >> j) & 1 > 0 {
-                let hba_mem_list = LOCKED_HBA_MEM_LIST.lock();
-                let hba_mem_port = &mut hba_mem.ports[j];
-                let tp = hba_mem_port.check_type();
-                match tp {
-                    HbaPortType::None => {
-                        kdebug!("<ahci_rust_init> Find a None type Disk.");
-                    }
-                    HbaPortType::Unknown(err) => {
-                        kdebug!("<ahci_rust_init> Find a Unknown({:?}) type Disk.", err);
-                    }
-                    _ => {
-                        kdebug!("<ahci_rust_init> Find a {:?} type Disk.", tp);
-
-                        // 计算地址
-                        let fb = virt_2_phys(ahci_port_base_vaddr + (32 << 10) + (j << 8));
-                        let clb = virt_2_phys(ahci_port_base_vaddr + (j << 10));
-                        let ctbas = (0..32)
-                            .map(|x| {
-                                virt_2_phys(
-                                    ahci_port_base_vaddr + (40 << 10) + (j << 13) + (x << 8),
-                                ) as u64
-                            })
-                            .collect::<Vec<_>>();
-
-                        // 初始化 port
-                        hba_mem_port.init(clb as u64, fb as u64, &ctbas);
-                        drop(hba_mem_list);
-                        compiler_fence(core::sync::atomic::Ordering::SeqCst);
-                        // 创建 disk
-                        disks_list.push(LockedAhciDisk::new(
-                            format!("ahci_disk_{}", id),
-                            BLK_GF_AHCI,
-                            hba_mem_index as u8,
-                            j as u8,
-                        )?);
-                        id += 1; // ID 从0开始
-
-                        kdebug!("start register ahci device");
-
-                        // 挂载到devfs上面去
-                        let ret = devfs_register(
-                            format!("ahci_{}", id).as_str(),
-                            LockedAhciInode::new(disks_list.last().unwrap().clone()),
-                        );
-                        if let Err(err) = ret {
-                            kerror!(
-                                "Ahci_{} ctrl = {}, port = {} failed to register, error code = {:?}",
-                                id,
-                                hba_mem_index as u8,
-                                j,
-                                err
-                            );
-                        }
-                    }
+            if (pi >> j) & 1 == 0 {
+                continue;
+            }
+            let tp = hba_mem.ports[j].check_type();
+            match tp {
+                HbaPortType::None => {
+                    kdebug!("<ahci_rust_init> Find a None type Disk.");
+                }
+                HbaPortType::Unknown(err) => {
+                    kdebug!("<ahci_rust_init> Find a Unknown({:?}) type Disk.", err);
+                }
+                _ => {
+                    kdebug!("<ahci_rust_init> Find a {:?} type Disk.", tp);
+                    let results = results.clone();
+                    probes.spawn(move || {
+                        let r = ahci_port_probe(ctrl, j);
+                        results.lock().push((ctrl.index, j, r));
+                    });
                 }
             }
         }
     }
+    probes.wait();
+
+    let mut results = core::mem::take(&mut *results.lock());
+    results.sort_by_key(|(ctrl, port, _)| (*ctrl, *port));
+
+    // 全局数据 - 列表
+    let mut disks_list = LOCKED_DISKS_LIST.lock();
+    let mut id = 0;
+    for (ctrl, port, disk) in results {
+        let disk = disk?;
+        let name = format!("ahci_disk_{}", id);
+        disk.0.lock().name = name.clone();
+        disks_list.push(disk.clone());
+        blk_stats_register(&name, &(disk.clone() as Arc<dyn BlockDevice>));
+        id += 1; // ID 从0开始
+
+        kdebug!("start register ahci device");
+
+        // 挂载到devfs上面去
+        let ret = devfs_register(format!("ahci_{}", id).as_str(), LockedAhciInode::new(disk));
+        if let Err(err) = ret {
+            kerror!(
+                "Ahci_{} ctrl = {}, port = {} failed to register, error code = {:?}",
+                id,
+                ctrl as u8,
+                port,
+                err
+            );
+        }
+    }
 
     compiler_fence(core::sync::atomic::Ordering::SeqCst);
     return Ok(());
@@ -173,14 +290,6 @@ pub fn get_disks_by_name(name: String) -> Result<Arc<LockedAhciDisk>, SystemErro
     return Ok(result);
 }
 
-/// @brief: 通过 ctrl_num 和 port_num 获取 port
-fn _port(ctrl_num: u8, port_num: u8) -> &'static mut HbaPort {
-    let list: SpinLockGuard<Vec<&mut HbaMem>> = LOCKED_HBA_MEM_LIST.lock();
-    let port: &HbaPort = &list[ctrl_num as usize].ports[port_num as usize];
-
-    return unsafe { (port as *const HbaPort as *mut HbaPort).as_mut().unwrap() };
-}
-
 /// @brief: 测试函数
 pub fn __test_ahci() {
     let _res = ahci_init();
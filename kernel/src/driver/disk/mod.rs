@@ -1 +1,3 @@
 pub mod ahci;
+pub mod nvme;
+pub mod virtio_blk;
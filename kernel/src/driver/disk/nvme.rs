@@ -0,0 +1,1086 @@
+//! NVMe 块设备驱动
+//!
+//! 控制器初始化时创建管理队列，然后为每个cpu创建一对I/O提交队列和完成队列（不超过控制器支持的
+//! 队列数和MSI-X中断数）。第i个完成队列使用第i个MSI-X中断，并且投递到第i个cpu上，
+//! 管理队列与第0个I/O队列共用第0个中断。提交请求的进程使用当前cpu的队列，不同cpu上的请求之间
+//! 不需要竞争同一把锁。
+//!
+//! 内核缓冲区位于线性映射区域，物理地址连续。控制器支持SGL时，每个请求只使用一个SGL数据块描述符；
+//! 否则使用PRP，跨越两页以上时使用这个命令槽自己的PRP列表页。
+//!
+//! 提交请求的进程在命令槽对应的完成量上睡眠，由完成队列的中断唤醒；持有自旋锁而不能睡眠时，
+//! 轮询完成队列。I/O完成队列启用了中断合并，减少高负载时的中断次数。
+
+use alloc::{
+    format,
+    string::String,
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+use core::{
+    any::Any,
+    fmt::Debug,
+    mem::size_of,
+    ptr::{read_unaligned, read_volatile, write_volatile},
+    sync::atomic::{fence, AtomicU16, AtomicU32, Ordering},
+};
+
+use virtio_drivers::{BufferDirection, Hal, PAGE_SIZE};
+
+use crate::{
+    driver::{
+        base::{
+            block::{
+                block_device::{BlockDevice, BlockId},
+                disk_info::Partition,
+                request_queue::{BlockRequestQueue, BLK_DEFAULT_IOSCHED},
+                stats::blk_stats_register,
+            },
+            device::{bus::Bus, driver::Driver, Device, DeviceType, IdTable},
+            kobject::{KObjType, KObject, KObjectState},
+            kset::KSet,
+        },
+        pci::{
+            pci::{PciDeviceStructure, PciDeviceStructureGeneralDevice, PCI_DEVICE_LINKEDLIST},
+            pci_irq::{
+                pci_irq_affinity, pci_irq_vector_alloc, IrqCommonMsg, IrqMsg, IrqSpecificMsg,
+                IrqType, PciInterrupt, IRQ,
+            },
+        },
+        virtio::virtio_impl::HalImpl,
+    },
+    filesystem::{kernfs::KernFSInode, mbr::MbrDiskPartionTable},
+    include::bindings::bindings::{pt_regs, smp_get_total_cpu},
+    kerror, kinfo, kwarn,
+    libs::{
+        rwlock::{RwLockReadGuard, RwLockWriteGuard},
+        spinlock::SpinLock,
+        wait_queue::WaitQueue,
+    },
+    mm::virt_2_phys,
+    process::ProcessManager,
+    sched::completion::Completion,
+    smp::core::smp_get_processor_id,
+    syscall::SystemError,
+    time::{
+        clocksource::HZ,
+        timer::{clock, next_n_ms_timer_jiffies},
+    },
+};
+
+const NVME_CLASS: u8 = 0x1;
+const NVME_SUBCLASS: u8 = 0x8;
+const NVME_PROG_IF: u8 = 0x2;
+
+/// 控制器寄存器的偏移量
+const NVME_REG_CAP: usize = 0x00;
+const NVME_REG_VS: usize = 0x08;
+const NVME_REG_CC: usize = 0x14;
+const NVME_REG_CSTS: usize = 0x1c;
+const NVME_REG_AQA: usize = 0x24;
+const NVME_REG_ASQ: usize = 0x28;
+const NVME_REG_ACQ: usize = 0x30;
+/// 第一个门铃寄存器的偏移量
+const NVME_REG_DBS: usize = 0x1000;
+
+const NVME_CC_ENABLE: u32 = 1 << 0;
+/// 提交队列项的大小为2^6字节，完成队列项的大小为2^4字节
+const NVME_CC_IOSQES: u32 = 6 << 16;
+const NVME_CC_IOCQES: u32 = 4 << 20;
+const NVME_CSTS_RDY: u32 = 1 << 0;
+const NVME_CSTS_CFS: u32 = 1 << 1;
+
+/// 管理命令
+const NVME_ADMIN_CREATE_SQ: u8 = 0x01;
+const NVME_ADMIN_DELETE_CQ: u8 = 0x04;
+const NVME_ADMIN_CREATE_CQ: u8 = 0x05;
+const NVME_ADMIN_IDENTIFY: u8 = 0x06;
+const NVME_ADMIN_SET_FEATURES: u8 = 0x09;
+
+/// I/O命令
+const NVME_CMD_FLUSH: u8 = 0x00;
+const NVME_CMD_WRITE: u8 = 0x01;
+const NVME_CMD_READ: u8 = 0x02;
+
+const NVME_ID_CNS_NS: u32 = 0x00;
+const NVME_ID_CNS_CTRL: u32 = 0x01;
+
+const NVME_FEAT_NUM_QUEUES: u32 = 0x07;
+const NVME_FEAT_IRQ_COALESCE: u32 = 0x08;
+
+/// 创建队列时的标志：队列的内存物理连续、启用中断
+const NVME_QUEUE_PHYS_CONTIG: u32 = 1 << 0;
+const NVME_CQ_IRQ_ENABLED: u32 = 1 << 1;
+
+/// 命令的flags字段：数据指针是一个SGL描述符
+const NVME_CMD_SGL_METABUF: u8 = 1 << 6;
+/// 数据块类型的SGL描述符
+const NVME_SGL_FMT_DATA_DESC: u64 = 0x00;
+
+/// 每个队列的深度（不超过控制器支持的深度）。队列满的判定需要空出一项，
+/// 因此可以同时在途的命令数是深度减一
+const NVME_QUEUE_DEPTH: usize = 64;
+/// 每个PRP列表页中使用的项数。只使用一个列表页，最后一项（链接到下一个列表页）不使用
+const NVME_PRP_LIST_ENTRIES: usize = PAGE_SIZE / size_of::<u64>() - 1;
+/// 中断合并：完成队列中积累了这么多项（0表示1项）之后才发送中断
+const NVME_IRQ_COALESCE_THRESHOLD: u32 = 7;
+/// 中断合并：最长的延迟（单位：100us）
+const NVME_IRQ_COALESCE_TIME: u32 = 1;
+/// 等待请求完成的超时时间（jiffies），超时后主动检查一次完成队列，防止丢失中断
+const NVME_TIMEOUT: i64 = HZ as i64;
+
+/// 所有NVMe磁盘，中断处理函数通过它找到需要处理的队列
+static NVME_DISKS: SpinLock<Vec<Arc<NvmeDisk>>> = SpinLock::new(Vec::new());
+
+/// 提交队列项
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+struct NvmeCommand {
+    opcode: u8,
+    flags: u8,
+    cid: u16,
+    nsid: u32,
+    cdw2: u32,
+    cdw3: u32,
+    metadata: u64,
+    /// 数据指针：PRP1、PRP2，或者一个SGL描述符
+    prp1: u64,
+    prp2: u64,
+    cdw10: u32,
+    cdw11: u32,
+    cdw12: u32,
+    cdw13: u32,
+    cdw14: u32,
+    cdw15: u32,
+}
+
+const _: () = assert!(size_of::<NvmeCommand>() == 64);
+
+/// 完成队列项
+#[allow(dead_code)]
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+struct NvmeCompletion {
+    result: u32,
+    reserved: u32,
+    sq_head: u16,
+    sq_id: u16,
+    cid: u16,
+    /// 第0位是相位，其余是状态码
+    status: u16,
+}
+
+const _: () = assert!(size_of::<NvmeCompletion>() == 16);
+
+/// 控制器的寄存器
+#[derive(Debug, Clone, Copy)]
+struct NvmeRegs {
+    /// BAR0的虚拟地址
+    base: usize,
+    /// 门铃寄存器之间的间隔
+    doorbell_stride: usize,
+}
+
+impl NvmeRegs {
+    fn read32(&self, offset: usize) -> u32 {
+        return unsafe { read_volatile((self.base + offset) as *const u32) };
+    }
+
+    fn write32(&self, offset: usize, val: u32) {
+        unsafe { write_volatile((self.base + offset) as *mut u32, val) };
+    }
+
+    fn read64(&self, offset: usize) -> u64 {
+        return self.read32(offset) as u64 | (self.read32(offset + 4) as u64) << 32;
+    }
+
+    fn write64(&self, offset: usize, val: u64) {
+        self.write32(offset, val as u32);
+        self.write32(offset + 4, (val >> 32) as u32);
+    }
+
+    /// 第qid个提交队列的尾门铃的虚拟地址
+    fn sq_doorbell(&self, qid: u16) -> usize {
+        return self.base + NVME_REG_DBS + 2 * qid as usize * self.doorbell_stride;
+    }
+
+    /// 第qid个完成队列的头门铃的虚拟地址
+    fn cq_doorbell(&self, qid: u16) -> usize {
+        return self.base + NVME_REG_DBS + (2 * qid as usize + 1) * self.doorbell_stride;
+    }
+
+    /// @brief 等待CSTS.RDY变为`ready`
+    /// @param timeout_ms 控制器报告的超时时间
+    fn wait_ready(&self, ready: bool, timeout_ms: u64) -> Result<(), SystemError> {
+        let deadline = next_n_ms_timer_jiffies(timeout_ms);
+        loop {
+            let csts = self.read32(NVME_REG_CSTS);
+            if csts & NVME_CSTS_CFS != 0 {
+                return Err(SystemError::EIO);
+            }
+            if (csts & NVME_CSTS_RDY != 0) == ready {
+                return Ok(());
+            }
+            if clock() > deadline {
+                return Err(SystemError::ETIMEDOUT);
+            }
+            core::hint::spin_loop();
+        }
+    }
+}
+
+/// 一对提交队列和完成队列
+struct NvmeQueue {
+    qid: u16,
+    depth: usize,
+    sq_vaddr: usize,
+    sq_paddr: usize,
+    cq_vaddr: usize,
+    cq_paddr: usize,
+    /// 每个命令槽的PRP列表页
+    prp_vaddr: usize,
+    prp_paddr: usize,
+    sq_doorbell: usize,
+    cq_doorbell: usize,
+    inner: SpinLock<InnerNvmeQueue>,
+    /// 等待空闲命令槽的进程
+    slot_wait: WaitQueue,
+    /// 每个命令槽的完成量、完成状态和结果。命令号就是命令槽的编号
+    done: [Completion; NVME_QUEUE_DEPTH],
+    status: [AtomicU16; NVME_QUEUE_DEPTH],
+    result: [AtomicU32; NVME_QUEUE_DEPTH],
+}
+
+#[derive(Debug)]
+struct InnerNvmeQueue {
+    /// 空闲的命令槽
+    free: u64,
+    sq_tail: u16,
+    cq_head: u16,
+    /// 完成队列中新的项的相位
+    cq_phase: u16,
+}
+
+impl NvmeQueue {
+    fn new(qid: u16, depth: usize, regs: &NvmeRegs) -> Self {
+        let (sq_paddr, sq) = HalImpl::dma_alloc(
+            (depth * size_of::<NvmeCommand>() + PAGE_SIZE - 1) / PAGE_SIZE,
+            BufferDirection::DriverToDevice,
+        );
+        let (cq_paddr, cq) = HalImpl::dma_alloc(
+            (depth * size_of::<NvmeCompletion>() + PAGE_SIZE - 1) / PAGE_SIZE,
+            BufferDirection::DeviceToDriver,
+        );
+        let (prp_paddr, prp) = HalImpl::dma_alloc(depth - 1, BufferDirection::DriverToDevice);
+
+        const DONE: Completion = Completion::new();
+        const STATUS: AtomicU16 = AtomicU16::new(0);
+        const RESULT: AtomicU32 = AtomicU32::new(0);
+        return NvmeQueue {
+            qid,
+            depth,
+            sq_vaddr: sq.as_ptr() as usize,
+            sq_paddr,
+            cq_vaddr: cq.as_ptr() as usize,
+            cq_paddr,
+            prp_vaddr: prp.as_ptr() as usize,
+            prp_paddr,
+            sq_doorbell: regs.sq_doorbell(qid),
+            cq_doorbell: regs.cq_doorbell(qid),
+            inner: SpinLock::new(InnerNvmeQueue {
+                free: u64::MAX >> (64 - (depth - 1)),
+                sq_tail: 0,
+                cq_head: 0,
+                cq_phase: 1,
+            }),
+            slot_wait: WaitQueue::INIT,
+            done: [DONE; NVME_QUEUE_DEPTH],
+            status: [STATUS; NVME_QUEUE_DEPTH],
+            result: [RESULT; NVME_QUEUE_DEPTH],
+        };
+    }
+
+    fn alloc_slot(&self, can_sleep: bool) -> usize {
+        loop {
+            let mut inner = self.inner.lock_irqsave();
+            if inner.free != 0 {
+                let slot = inner.free.trailing_zeros() as usize;
+                inner.free &= !(1 << slot);
+                return slot;
+            }
+            if can_sleep {
+                self.slot_wait.sleep_uninterruptible_unlock_spinlock(inner);
+            } else {
+                drop(inner);
+                self.handle_irq();
+                core::hint::spin_loop();
+            }
+        }
+    }
+
+    fn free_slot(&self, slot: usize) {
+        self.inner.lock_irqsave().free |= 1 << slot;
+        self.slot_wait.wakeup(None);
+    }
+
+    /// @brief 使用PRP描述物理地址连续的数据缓冲区
+    /// @return (PRP1, PRP2)
+    fn build_prp(&self, slot: usize, paddr: usize, len: usize) -> (u64, u64) {
+        let first = (PAGE_SIZE - paddr % PAGE_SIZE).min(len);
+        if len == first {
+            return (paddr as u64, 0);
+        }
+        let next = paddr + first;
+        if len - first <= PAGE_SIZE {
+            return (paddr as u64, next as u64);
+        }
+        let list = (self.prp_vaddr + slot * PAGE_SIZE) as *mut u64;
+        for (i, off) in (0..len - first).step_by(PAGE_SIZE).enumerate() {
+            unsafe { write_volatile(list.add(i), (next + off) as u64) };
+        }
+        return (paddr as u64, (self.prp_paddr + slot * PAGE_SIZE) as u64);
+    }
+
+    /// @brief 把命令写入提交队列，然后通知控制器
+    fn submit(&self, slot: usize, mut cmd: NvmeCommand) {
+        cmd.cid = slot as u16;
+        let mut inner = self.inner.lock_irqsave();
+        let tail = inner.sq_tail as usize;
+        unsafe { write_volatile((self.sq_vaddr as *mut NvmeCommand).add(tail), cmd) };
+        inner.sq_tail = ((tail + 1) % self.depth) as u16;
+        // 控制器看到新的尾指针之前，必须能看到命令的内容
+        fence(Ordering::SeqCst);
+        unsafe { write_volatile(self.sq_doorbell as *mut u32, inner.sq_tail as u32) };
+    }
+
+    /// @brief 等待命令槽上的命令完成
+    fn wait(&self, slot: usize, can_sleep: bool) {
+        let done = &self.done[slot];
+        if !can_sleep {
+            while !done.completion_done() {
+                self.handle_irq();
+                core::hint::spin_loop();
+            }
+            done.wait_for_completion().ok();
+            return;
+        }
+
+        loop {
+            match done.wait_for_completion_timeout(NVME_TIMEOUT) {
+                Ok(remain) if remain > 0 => return,
+                // 超时：可能丢失了中断，主动检查一次完成队列
+                _ => self.handle_irq(),
+            }
+        }
+    }
+
+    /// @brief 执行一个命令，并且等待它完成
+    /// @return 完成队列项中的结果
+    fn execute(&self, cmd: NvmeCommand, can_sleep: bool) -> Result<u32, SystemError> {
+        let slot = self.alloc_slot(can_sleep);
+        self.submit(slot, cmd);
+        self.wait(slot, can_sleep);
+        let status = self.status[slot].load(Ordering::Acquire) >> 1;
+        let result = self.result[slot].load(Ordering::Relaxed);
+        self.free_slot(slot);
+
+        if status != 0 {
+            kerror!(
+                "nvme queue {}: command {:#x} failed, status = {:#x}",
+                self.qid,
+                cmd.opcode,
+                status
+            );
+            return Err(SystemError::EIO);
+        }
+        return Ok(result);
+    }
+
+    /// @brief 处理完成队列中的新项，唤醒等待它们的进程
+    ///
+    /// 在中断上下文中调用；不能睡眠的进程也会轮询调用
+    fn handle_irq(&self) {
+        let mut inner = self.inner.lock_irqsave();
+        let head = inner.cq_head;
+        loop {
+            let entry = unsafe {
+                read_volatile((self.cq_vaddr as *const NvmeCompletion).add(inner.cq_head as usize))
+            };
+            if entry.status & 1 != inner.cq_phase {
+                break;
+            }
+            // 读取完成队列项的其他字段之前，必须先看到相位
+            fence(Ordering::SeqCst);
+            let slot = entry.cid as usize;
+            if slot < self.depth - 1 {
+                self.result[slot].store(entry.result, Ordering::Relaxed);
+                self.status[slot].store(entry.status, Ordering::Release);
+                self.done[slot].complete();
+            } else {
+                kerror!("nvme queue {}: invalid command id {}", self.qid, slot);
+            }
+
+            inner.cq_head += 1;
+            if inner.cq_head as usize == self.depth {
+                inner.cq_head = 0;
+                inner.cq_phase ^= 1;
+            }
+        }
+        if inner.cq_head != head {
+            unsafe { write_volatile(self.cq_doorbell as *mut u32, inner.cq_head as u32) };
+        }
+    }
+}
+
+/// NVMe磁盘（控制器的第一个命名空间）
+pub struct NvmeDisk {
+    name: String,
+    admin: NvmeQueue,
+    /// 第i个I/O队列的队列号是i + 1，使用第i个中断
+    io_queues: Vec<NvmeQueue>,
+    nsid: u32,
+    /// 命名空间的块数
+    capacity: u64,
+    /// 块大小的log2
+    lba_shift: u8,
+    /// 每个请求最多传输的字节数
+    max_transfer: usize,
+    /// 控制器是否支持SGL，以及是否要求SGL的数据地址按照4字节对齐
+    sgl: bool,
+    sgl_dword_aligned: bool,
+    /// 控制器是否有易失性写缓存（此时需要FLUSH）
+    volatile_cache: bool,
+    partitions: SpinLock<Vec<Arc<Partition>>>,
+    request_queue: Arc<BlockRequestQueue>,
+    self_ref: Weak<NvmeDisk>,
+}
+
+// 队列中的地址指向设备的BAR空间和DMA内存，由队列的锁保护
+unsafe impl Send for NvmeDisk {}
+unsafe impl Sync for NvmeDisk {}
+
+impl Debug for NvmeDisk {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        f.debug_struct("NvmeDisk")
+            .field("name", &self.name)
+            .field("capacity", &self.capacity)
+            .field("lba_shift", &self.lba_shift)
+            .field("nr_queues", &self.io_queues.len())
+            .field("sgl", &self.sgl)
+            .finish()
+    }
+}
+
+impl NvmeDisk {
+    /// @brief 初始化控制器和管理队列，读取控制器和命名空间的信息，为每个cpu创建一对I/O队列
+    fn new(
+        name: String,
+        device: &mut PciDeviceStructureGeneralDevice,
+    ) -> Result<Arc<Self>, SystemError> {
+        device
+            .bar_ioremap()
+            .unwrap()
+            .map_err(|_| SystemError::ENODEV)?;
+        device.enable_master();
+        let base = device
+            .standard_device_bar
+            .get_bar(0)
+            .ok()
+            .and_then(|bar| bar.virtual_address())
+            .ok_or(SystemError::ENODEV)?
+            .data();
+
+        let mut regs = NvmeRegs {
+            base,
+            doorbell_stride: 4,
+        };
+        let cap = regs.read64(NVME_REG_CAP);
+        let mqes = (cap & 0xffff) as usize + 1;
+        let timeout_ms = ((cap >> 24) & 0xff).max(1) * 500;
+        regs.doorbell_stride = 4 << ((cap >> 32) & 0xf);
+        // 只支持4K的内存页
+        if (cap >> 48) & 0xf != 0 {
+            kerror!("{}: unsupported minimum page size, cap = {:#x}", name, cap);
+            return Err(SystemError::ENODEV);
+        }
+        let depth = mqes.min(NVME_QUEUE_DEPTH);
+        if depth < 2 {
+            return Err(SystemError::ENODEV);
+        }
+
+        // 关闭控制器，设置管理队列之后重新启用
+        regs.write32(NVME_REG_CC, 0);
+        regs.wait_ready(false, timeout_ms)?;
+        let admin = NvmeQueue::new(0, depth, &regs);
+        regs.write32(NVME_REG_AQA, ((depth - 1) << 16 | (depth - 1)) as u32);
+        regs.write64(NVME_REG_ASQ, admin.sq_paddr as u64);
+        regs.write64(NVME_REG_ACQ, admin.cq_paddr as u64);
+        regs.write32(
+            NVME_REG_CC,
+            NVME_CC_ENABLE | NVME_CC_IOSQES | NVME_CC_IOCQES,
+        );
+        regs.wait_ready(true, timeout_ms)?;
+
+        let nr_vectors = nvme_irq_init(device)?;
+
+        // 读取控制器和命名空间的信息。此时磁盘还没有加入NVME_DISKS，管理命令只能轮询
+        let (id_paddr, id) = HalImpl::dma_alloc(1, BufferDirection::DeviceToDriver);
+        let id_vaddr = id.as_ptr() as usize;
+        let read_id =
+            |offset: usize| -> u32 { unsafe { read_unaligned((id_vaddr + offset) as *const u32) } };
+        let identify = |nsid: u32, cns: u32| {
+            admin.execute(
+                NvmeCommand {
+                    opcode: NVME_ADMIN_IDENTIFY,
+                    nsid,
+                    prp1: id_paddr as u64,
+                    cdw10: cns,
+                    ..Default::default()
+                },
+                false,
+            )
+        };
+
+        let r = identify(0, NVME_ID_CNS_CTRL).map(|_| {
+            // MDTS（字节77）以最小内存页为单位，0表示不限制
+            let mdts = (read_id(76) >> 8) & 0xff;
+            let vwc = (read_id(524) >> 8) & 1 != 0;
+            let sgls = read_id(536) & 0x3;
+            (mdts, vwc, sgls)
+        });
+        let (mdts, volatile_cache, sgls) = match r {
+            Ok(v) => v,
+            Err(e) => {
+                unsafe { HalImpl::dma_dealloc(id_paddr, id, 1) };
+                return Err(e);
+            }
+        };
+        let nsid = 1;
+        let r = identify(nsid, NVME_ID_CNS_NS).map(|_| {
+            let nsze = read_id(0) as u64 | (read_id(4) as u64) << 32;
+            let flbas = (read_id(24) >> 16) & 0xf;
+            let lbaf = read_id(128 + 4 * flbas as usize);
+            (nsze, ((lbaf >> 16) & 0xff) as u8)
+        });
+        unsafe { HalImpl::dma_dealloc(id_paddr, id, 1) };
+        let (capacity, lba_shift) = r?;
+        if capacity == 0 || !(9..=12).contains(&lba_shift) {
+            kerror!(
+                "{}: unsupported namespace, nsze = {}, lba_shift = {}",
+                name,
+                capacity,
+                lba_shift
+            );
+            return Err(SystemError::ENODEV);
+        }
+
+        // 设置I/O队列的数量，控制器可能只分配一部分
+        let nr_cpus = unsafe { smp_get_total_cpu() }.max(1) as usize;
+        let wanted = nr_cpus.min(nr_vectors).max(1) as u32;
+        let allocated = admin.execute(
+            NvmeCommand {
+                opcode: NVME_ADMIN_SET_FEATURES,
+                cdw10: NVME_FEAT_NUM_QUEUES,
+                cdw11: (wanted - 1) << 16 | (wanted - 1),
+                ..Default::default()
+            },
+            false,
+        )?;
+        let nr_queues = (wanted as usize)
+            .min((allocated & 0xffff) as usize + 1)
+            .min((allocated >> 16) as usize + 1);
+
+        // 中断合并只作用于I/O完成队列，控制器不支持时不影响使用
+        if admin
+            .execute(
+                NvmeCommand {
+                    opcode: NVME_ADMIN_SET_FEATURES,
+                    cdw10: NVME_FEAT_IRQ_COALESCE,
+                    cdw11: NVME_IRQ_COALESCE_TIME << 8 | NVME_IRQ_COALESCE_THRESHOLD,
+                    ..Default::default()
+                },
+                false,
+            )
+            .is_err()
+        {
+            kwarn!("{}: interrupt coalescing is not supported", name);
+        }
+
+        let mut io_queues: Vec<NvmeQueue> = Vec::with_capacity(nr_queues);
+        for i in 0..nr_queues {
+            let queue = NvmeQueue::new(i as u16 + 1, depth, &regs);
+            let cq_flags = NVME_QUEUE_PHYS_CONTIG | NVME_CQ_IRQ_ENABLED;
+            let r = admin
+                .execute(
+                    NvmeCommand {
+                        opcode: NVME_ADMIN_CREATE_CQ,
+                        prp1: queue.cq_paddr as u64,
+                        cdw10: ((depth - 1) << 16) as u32 | queue.qid as u32,
+                        cdw11: (i as u32) << 16 | cq_flags,
+                        ..Default::default()
+                    },
+                    false,
+                )
+                .and_then(|_| {
+                    admin.execute(
+                        NvmeCommand {
+                            opcode: NVME_ADMIN_CREATE_SQ,
+                            prp1: queue.sq_paddr as u64,
+                            cdw10: ((depth - 1) << 16) as u32 | queue.qid as u32,
+                            cdw11: (queue.qid as u32) << 16 | NVME_QUEUE_PHYS_CONTIG,
+                            ..Default::default()
+                        },
+                        false,
+                    )
+                });
+            if let Err(e) = r {
+                if io_queues.is_empty() {
+                    return Err(e);
+                }
+                // 删除可能已经创建的完成队列，使用已经创建好的队列
+                admin
+                    .execute(
+                        NvmeCommand {
+                            opcode: NVME_ADMIN_DELETE_CQ,
+                            cdw10: queue.qid as u32,
+                            ..Default::default()
+                        },
+                        false,
+                    )
+                    .ok();
+                break;
+            }
+            io_queues.push(queue);
+        }
+
+        let page_limit = NVME_PRP_LIST_ENTRIES * PAGE_SIZE;
+        let max_transfer = match mdts {
+            0 => page_limit,
+            _ => page_limit.min(PAGE_SIZE << mdts),
+        };
+        let vs = regs.read32(NVME_REG_VS);
+        kinfo!(
+            "{}: NVMe {}.{}, {} blocks of {} bytes, {} io queues, max transfer {}K, sgl = {}",
+            name,
+            vs >> 16,
+            (vs >> 8) & 0xff,
+            capacity,
+            1 << lba_shift,
+            io_queues.len(),
+            max_transfer / 1024,
+            sgls != 0
+        );
+
+        let disk = Arc::new_cyclic(|self_ref: &Weak<NvmeDisk>| NvmeDisk {
+            name,
+            admin,
+            io_queues,
+            nsid,
+            capacity,
+            lba_shift,
+            max_transfer,
+            sgl: sgls != 0,
+            sgl_dword_aligned: sgls == 0x2,
+            volatile_cache,
+            partitions: SpinLock::new(Vec::new()),
+            request_queue: BlockRequestQueue::new(self_ref.clone(), BLK_DEFAULT_IOSCHED),
+            self_ref: self_ref.clone(),
+        });
+        return Ok(disk);
+    }
+
+    /// @brief 读取MBR分区表，创建磁盘的分区
+    fn init_partitions(self: &Arc<Self>) -> Result<(), SystemError> {
+        let mut buf: Vec<u8> = Vec::new();
+        buf.resize(self.block_size(), 0);
+        self.read_at(0, 1, &mut buf)?;
+        let table: MbrDiskPartionTable =
+            unsafe { read_unaligned(buf.as_ptr() as *const MbrDiskPartionTable) };
+
+        let mut partitions = self.partitions.lock();
+        for i in 0..4 {
+            let entry = table.dpte[i];
+            if entry.part_type != 0 {
+                partitions.push(Partition::new(
+                    entry.starting_sector() as u64,
+                    entry.starting_lba as u64,
+                    entry.total_sectors as u64,
+                    self.self_ref.clone(),
+                    i as u16,
+                ));
+            }
+        }
+        return Ok(());
+    }
+
+    /// @brief 传输count个块。一个请求放不下的部分，拆分为多个请求
+    ///
+    /// 数据地址不满足对齐要求（PRP总是要求4字节对齐）时，经过一个对齐的缓冲区中转
+    fn transfer(
+        &self,
+        opcode: u8,
+        lba_id_start: BlockId,
+        count: usize,
+        buf_vaddr: usize,
+    ) -> Result<(), SystemError> {
+        if lba_id_start as u64 + count as u64 > self.capacity {
+            return Err(SystemError::EINVAL);
+        }
+        let len = count << self.lba_shift;
+        if buf_vaddr % 4 != 0 && (!self.sgl || self.sgl_dword_aligned) {
+            let mut bounce: Vec<u64> = Vec::new();
+            bounce.resize(len / size_of::<u64>(), 0);
+            let bounce_vaddr = bounce.as_mut_ptr() as usize;
+            if opcode == NVME_CMD_WRITE {
+                unsafe {
+                    core::ptr::copy_nonoverlapping(
+                        buf_vaddr as *const u8,
+                        bounce_vaddr as *mut u8,
+                        len,
+                    )
+                };
+            }
+            self.transfer(opcode, lba_id_start, count, bounce_vaddr)?;
+            if opcode == NVME_CMD_READ {
+                unsafe {
+                    core::ptr::copy_nonoverlapping(
+                        bounce_vaddr as *const u8,
+                        buf_vaddr as *mut u8,
+                        len,
+                    )
+                };
+            }
+            return Ok(());
+        }
+
+        let max_blocks = self.max_transfer >> self.lba_shift;
+        let mut done = 0;
+        while done < count {
+            let n = (count - done).min(max_blocks);
+            let vaddr = buf_vaddr + (done << self.lba_shift);
+            self.execute_rw(opcode, (lba_id_start + done) as u64, n, virt_2_phys(vaddr))?;
+            done += n;
+        }
+        return Ok(());
+    }
+
+    /// @brief 在当前cpu的队列上提交一个读写请求，并且等待它完成
+    fn execute_rw(
+        &self,
+        opcode: u8,
+        lba: u64,
+        nr_blocks: usize,
+        paddr: usize,
+    ) -> Result<(), SystemError> {
+        let queue = self.current_queue();
+        // 调用者持有自旋锁时不能睡眠，只能轮询完成队列
+        let can_sleep = ProcessManager::current().preempt_count() == 0;
+        let len = nr_blocks << self.lba_shift;
+
+        let mut cmd = NvmeCommand {
+            opcode,
+            nsid: self.nsid,
+            cdw10: lba as u32,
+            cdw11: (lba >> 32) as u32,
+            cdw12: (nr_blocks - 1) as u32,
+            ..Default::default()
+        };
+        let slot = queue.alloc_slot(can_sleep);
+        if self.sgl {
+            // 数据缓冲区物理连续，一个数据块描述符就可以描述
+            cmd.flags = NVME_CMD_SGL_METABUF;
+            cmd.prp1 = paddr as u64;
+            cmd.prp2 = len as u64 | NVME_SGL_FMT_DATA_DESC << 60;
+        } else {
+            (cmd.prp1, cmd.prp2) = queue.build_prp(slot, paddr, len);
+        }
+        queue.submit(slot, cmd);
+        queue.wait(slot, can_sleep);
+        let status = queue.status[slot].load(Ordering::Acquire) >> 1;
+        queue.free_slot(slot);
+
+        if status != 0 {
+            kerror!(
+                "{}: request failed, opcode = {:#x}, lba = {}, blocks = {}, status = {:#x}",
+                self.name,
+                opcode,
+                lba,
+                nr_blocks,
+                status
+            );
+            return Err(SystemError::EIO);
+        }
+        return Ok(());
+    }
+
+    fn current_queue(&self) -> &NvmeQueue {
+        return &self.io_queues[smp_get_processor_id() as usize % self.io_queues.len()];
+    }
+
+    fn handle_irq(&self, vector: usize) {
+        if vector == 0 {
+            self.admin.handle_irq();
+        }
+        if let Some(queue) = self.io_queues.get(vector) {
+            queue.handle_irq();
+        }
+    }
+}
+
+/// @brief 为控制器安装MSI-X中断，每个cpu一个
+/// @return 中断的数量
+fn nvme_irq_init(device: &mut PciDeviceStructureGeneralDevice) -> Result<usize, SystemError> {
+    let nr_cpus = unsafe { smp_get_total_cpu() }.max(1) as u16;
+    let nr_vectors = match device.irq_init(IRQ::PCI_IRQ_MSIX) {
+        Some(IrqType::Msix { irq_max_num, .. }) => irq_max_num.min(nr_cpus),
+        _ => return Err(SystemError::ENODEV),
+    };
+    let vectors = pci_irq_vector_alloc(nr_vectors).ok_or(SystemError::ENOSPC)?;
+    device.irq_vector_mut().unwrap().extend(vectors);
+    for index in 0..nr_vectors {
+        let msg = IrqMsg {
+            irq_common_message: IrqCommonMsg::init_from(
+                index,
+                "NVMe_Queue_IRQ",
+                index,
+                nvme_irq_handler,
+                None,
+            ),
+            irq_specific_message: IrqSpecificMsg::msi_affinity(pci_irq_affinity(index)),
+        };
+        device.irq_install(msg).map_err(|_| SystemError::EIO)?;
+    }
+    device.irq_enable(true).map_err(|_| SystemError::EIO)?;
+    return Ok(nr_vectors as usize);
+}
+
+/// @brief NVMe完成队列的中断处理函数
+/// @param irq_paramer 中断的序号
+pub unsafe extern "C" fn nvme_irq_handler(_irq_num: u64, irq_paramer: u64, _regs: *mut pt_regs) {
+    for disk in NVME_DISKS.lock_irqsave().iter() {
+        disk.handle_irq(irq_paramer as usize);
+    }
+}
+
+/// @brief 初始化所有的NVMe控制器（需要持有PCI设备链表的锁）
+pub fn nvme_init() {
+    let mut list = PCI_DEVICE_LINKEDLIST.write();
+    for device in list.iter_mut() {
+        let device = match device.as_standard_device_mut() {
+            Some(device) => device,
+            None => continue,
+        };
+        let header = &device.common_header;
+        if header.class_code != NVME_CLASS
+            || header.subclass != NVME_SUBCLASS
+            || header.prog_if != NVME_PROG_IF
+        {
+            continue;
+        }
+
+        let name = format!("nvme{}n1", NVME_DISKS.lock_irqsave().len());
+        let disk = match NvmeDisk::new(name.clone(), device) {
+            Ok(disk) => disk,
+            Err(e) => {
+                kerror!("{}: failed to initialize: {:?}", name, e);
+                continue;
+            }
+        };
+        NVME_DISKS.lock_irqsave().push(disk.clone());
+
+        if let Err(e) = disk.init_partitions() {
+            kerror!("{}: failed to read partition table: {:?}", name, e);
+        }
+        blk_stats_register(&name, &(disk as Arc<dyn BlockDevice>));
+    }
+}
+
+/// @brief 通过 name 获取 NVMe 磁盘
+pub fn get_nvme_disk_by_name(name: &str) -> Result<Arc<NvmeDisk>, SystemError> {
+    return NVME_DISKS
+        .lock_irqsave()
+        .iter()
+        .find(|disk| disk.name == name)
+        .cloned()
+        .ok_or(SystemError::ENXIO);
+}
+
+impl KObject for NvmeDisk {
+    fn as_any_ref(&self) -> &dyn Any {
+        self
+    }
+
+    fn inode(&self) -> Option<Arc<KernFSInode>> {
+        todo!()
+    }
+
+    fn kobj_type(&self) -> Option<&'static dyn KObjType> {
+        todo!()
+    }
+
+    fn kset(&self) -> Option<Arc<KSet>> {
+        todo!()
+    }
+
+    fn parent(&self) -> Option<Weak<dyn KObject>> {
+        todo!()
+    }
+
+    fn set_inode(&self, _inode: Option<Arc<KernFSInode>>) {
+        todo!()
+    }
+
+    fn kobj_state(&self) -> RwLockReadGuard<KObjectState> {
+        todo!()
+    }
+
+    fn kobj_state_mut(&self) -> RwLockWriteGuard<KObjectState> {
+        todo!()
+    }
+
+    fn set_kobj_state(&self, _state: KObjectState) {
+        todo!()
+    }
+
+    fn name(&self) -> String {
+        return self.name.clone();
+    }
+
+    fn set_name(&self, _name: String) {
+        todo!()
+    }
+
+    fn set_kset(&self, _kset: Option<Arc<KSet>>) {
+        todo!()
+    }
+
+    fn set_parent(&self, _parent: Option<Weak<dyn KObject>>) {
+        todo!()
+    }
+
+    fn set_kobj_type(&self, _ktype: Option<&'static dyn KObjType>) {
+        todo!()
+    }
+}
+
+impl Device for NvmeDisk {
+    fn dev_type(&self) -> DeviceType {
+        return DeviceType::Block;
+    }
+
+    fn id_table(&self) -> IdTable {
+        todo!()
+    }
+
+    fn bus(&self) -> Option<Arc<dyn Bus>> {
+        todo!("NvmeDisk::bus()")
+    }
+
+    fn set_bus(&self, _bus: Option<Arc<dyn Bus>>) {
+        todo!("NvmeDisk::set_bus()")
+    }
+
+    fn driver(&self) -> Option<Arc<dyn Driver>> {
+        todo!("NvmeDisk::driver()")
+    }
+
+    fn is_dead(&self) -> bool {
+        false
+    }
+
+    fn set_driver(&self, _driver: Option<Weak<dyn Driver>>) {
+        todo!("NvmeDisk::set_driver()")
+    }
+
+    fn can_match(&self) -> bool {
+        todo!()
+    }
+
+    fn set_can_match(&self, _can_match: bool) {
+        todo!()
+    }
+
+    fn state_synced(&self) -> bool {
+        todo!()
+    }
+}
+
+impl BlockDevice for NvmeDisk {
+    #[inline]
+    fn as_any_ref(&self) -> &dyn Any {
+        self
+    }
+
+    #[inline]
+    fn blk_size_log2(&self) -> u8 {
+        self.lba_shift
+    }
+
+    fn sync(&self) -> Result<(), SystemError> {
+        self.request_queue.sync()?;
+        if self.volatile_cache {
+            let can_sleep = ProcessManager::current().preempt_count() == 0;
+            let cmd = NvmeCommand {
+                opcode: NVME_CMD_FLUSH,
+                nsid: self.nsid,
+                ..Default::default()
+            };
+            self.current_queue().execute(cmd, can_sleep)?;
+        }
+        return Ok(());
+    }
+
+    #[inline]
+    fn device(&self) -> Arc<dyn Device> {
+        return self.self_ref.upgrade().unwrap();
+    }
+
+    fn block_size(&self) -> usize {
+        return 1 << self.lba_shift;
+    }
+
+    fn partitions(&self) -> Vec<Arc<Partition>> {
+        return self.partitions.lock().clone();
+    }
+
+    fn request_queue(&self) -> Option<Arc<BlockRequestQueue>> {
+        return Some(self.request_queue.clone());
+    }
+
+    fn read_at(
+        &self,
+        lba_id_start: BlockId,
+        count: usize,
+        buf: &mut [u8],
+    ) -> Result<usize, SystemError> {
+        let len = count << self.lba_shift;
+        if count == 0 {
+            return Ok(0);
+        } else if len > buf.len() {
+            return Err(SystemError::E2BIG);
+        }
+        self.transfer(
+            NVME_CMD_READ,
+            lba_id_start,
+            count,
+            buf.as_mut_ptr() as usize,
+        )?;
+        return Ok(len);
+    }
+
+    fn write_at(
+        &self,
+        lba_id_start: BlockId,
+        count: usize,
+        buf: &[u8],
+    ) -> Result<usize, SystemError> {
+        let len = count << self.lba_shift;
+        if count == 0 {
+            return Ok(0);
+        } else if len > buf.len() {
+            return Err(SystemError::E2BIG);
+        }
+        self.transfer(NVME_CMD_WRITE, lba_id_start, count, buf.as_ptr() as usize)?;
+        return Ok(len);
+    }
+}
@@ -0,0 +1,844 @@
+//! virtio-blk 块设备驱动
+//!
+//! 每个cpu使用一个virtqueue（设备支持VIRTIO_BLK_F_MQ时），提交请求的进程使用当前cpu的队列，
+//! 队列的MSI-X中断也投递到这个cpu上，不同cpu上的请求之间不需要竞争同一把锁。
+//!
+//! 每个请求只占用可用环中的一个描述符：它指向这个请求自己的间接描述符表，表中依次是请求头、
+//! 数据段和状态字节。因此队列的深度就是可以同时在途的请求数，与请求包含多少个数据段无关。
+//!
+//! 提交请求的进程在请求对应的完成量上睡眠，由队列的中断唤醒；持有自旋锁而不能睡眠时，轮询已用环。
+
+use alloc::{
+    format,
+    string::String,
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+use core::{
+    any::Any,
+    fmt::Debug,
+    mem::size_of,
+    ptr::{addr_of, addr_of_mut, read_unaligned, read_volatile, write_volatile},
+    sync::atomic::{fence, Ordering},
+};
+
+use virtio_drivers::{
+    transport::{DeviceStatus, Transport},
+    BufferDirection, Hal, PAGE_SIZE,
+};
+
+use crate::{
+    driver::{
+        base::{
+            block::{
+                block_device::{BlockDevice, BlockId},
+                disk_info::Partition,
+                request_queue::{BlockRequestQueue, BLK_DEFAULT_IOSCHED},
+                stats::blk_stats_register,
+            },
+            device::{bus::Bus, driver::Driver, Device, DeviceType, IdTable},
+            kobject::{KObjType, KObject, KObjectState},
+            kset::KSet,
+        },
+        virtio::{transport_pci::PciTransport, virtio_impl::HalImpl},
+    },
+    filesystem::{kernfs::KernFSInode, mbr::MbrDiskPartionTable},
+    include::bindings::bindings::{pt_regs, smp_get_total_cpu},
+    kerror, kinfo,
+    libs::{
+        rwlock::{RwLockReadGuard, RwLockWriteGuard},
+        spinlock::SpinLock,
+        wait_queue::WaitQueue,
+    },
+    mm::virt_2_phys,
+    process::ProcessManager,
+    sched::completion::Completion,
+    smp::core::smp_get_processor_id,
+    syscall::SystemError,
+    time::clocksource::HZ,
+};
+
+const VIRTIO_BLK_F_SIZE_MAX: u64 = 1 << 1;
+const VIRTIO_BLK_F_SEG_MAX: u64 = 1 << 2;
+const VIRTIO_BLK_F_RO: u64 = 1 << 5;
+const VIRTIO_BLK_F_FLUSH: u64 = 1 << 9;
+const VIRTIO_BLK_F_MQ: u64 = 1 << 12;
+const VIRTIO_RING_F_INDIRECT_DESC: u64 = 1 << 28;
+const VIRTIO_F_VERSION_1: u64 = 1 << 32;
+/// 驱动支持的特性
+const VIRTIO_BLK_SUPPORTED_FEATURES: u64 = VIRTIO_BLK_F_SIZE_MAX
+    | VIRTIO_BLK_F_SEG_MAX
+    | VIRTIO_BLK_F_RO
+    | VIRTIO_BLK_F_FLUSH
+    | VIRTIO_BLK_F_MQ
+    | VIRTIO_RING_F_INDIRECT_DESC
+    | VIRTIO_F_VERSION_1;
+
+const VIRTIO_BLK_T_IN: u32 = 0;
+const VIRTIO_BLK_T_OUT: u32 = 1;
+const VIRTIO_BLK_T_FLUSH: u32 = 4;
+
+const VIRTIO_BLK_S_OK: u8 = 0;
+const VIRTIO_BLK_S_UNSUPP: u8 = 2;
+
+const VIRTQ_DESC_F_NEXT: u16 = 1;
+const VIRTQ_DESC_F_WRITE: u16 = 2;
+const VIRTQ_DESC_F_INDIRECT: u16 = 4;
+const VIRTQ_USED_F_NO_NOTIFY: u16 = 1;
+
+/// 扇区大小。virtio-blk的请求总是以512字节为单位
+const VIRTIO_BLK_SECTOR_SIZE: usize = 512;
+/// 每个队列的深度，也是每个队列可以同时在途的请求数
+const VIRTIO_BLK_QUEUE_SIZE: usize = 64;
+/// 每个请求最多的数据段数。间接描述符表还需要放下请求头和状态，
+/// 此时每个命令槽（见[`VirtioBlkSlot`]）正好是1K
+const VIRTIO_BLK_MAX_SEGS: usize = 60;
+/// 设备没有限制数据段大小时，每个数据段最多的字节数
+const VIRTIO_BLK_DEFAULT_SEG_SIZE: usize = 1 << 20;
+/// 等待请求完成的超时时间（jiffies），超时后主动检查一次已用环，防止丢失中断
+const VIRTIO_BLK_TIMEOUT: i64 = HZ as i64;
+
+/// 所有virtio-blk磁盘，中断处理函数通过它找到需要处理的队列
+static VIRTIO_BLK_DISKS: SpinLock<Vec<Arc<VirtioBlkDisk>>> = SpinLock::new(Vec::new());
+
+#[repr(C, align(16))]
+#[derive(Debug, Clone, Copy)]
+struct VirtqDesc {
+    addr: u64,
+    len: u32,
+    flags: u16,
+    next: u16,
+}
+
+#[allow(dead_code)]
+#[repr(C)]
+struct VirtqAvail {
+    flags: u16,
+    idx: u16,
+    ring: [u16; VIRTIO_BLK_QUEUE_SIZE],
+    used_event: u16,
+}
+
+#[allow(dead_code)]
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+struct VirtqUsedElem {
+    id: u32,
+    len: u32,
+}
+
+#[allow(dead_code)]
+#[repr(C)]
+struct VirtqUsed {
+    flags: u16,
+    idx: u16,
+    ring: [VirtqUsedElem; VIRTIO_BLK_QUEUE_SIZE],
+    avail_event: u16,
+}
+
+/// 一个virtqueue的描述符表、可用环和已用环，放在同一页中
+#[repr(C)]
+struct VirtqRings {
+    desc: [VirtqDesc; VIRTIO_BLK_QUEUE_SIZE],
+    avail: VirtqAvail,
+    used: VirtqUsed,
+}
+
+const _: () = assert!(size_of::<VirtqRings>() <= PAGE_SIZE);
+
+#[allow(dead_code)]
+#[repr(C)]
+struct VirtioBlkReqHeader {
+    req_type: u32,
+    reserved: u32,
+    sector: u64,
+}
+
+/// 命令槽：一个在途请求使用的间接描述符表、请求头和状态。第i个命令槽对应描述符表的第i项
+#[repr(C, align(16))]
+struct VirtioBlkSlot {
+    indirect: [VirtqDesc; VIRTIO_BLK_MAX_SEGS + 2],
+    header: VirtioBlkReqHeader,
+    status: u8,
+}
+
+/// 设备配置空间。virtio只保证配置空间按照4字节对齐，因此64位的字段拆成两半
+#[allow(dead_code)]
+#[repr(C)]
+struct VirtioBlkConfig {
+    capacity_low: u32,
+    capacity_high: u32,
+    size_max: u32,
+    seg_max: u32,
+    geometry: u32,
+    blk_size: u32,
+    topology: [u32; 2],
+    /// writeback(u8), unused0(u8), num_queues(u16)
+    writeback_num_queues: u32,
+}
+
+/// 一个virtqueue
+struct VirtioBlkQueue {
+    index: u16,
+    /// VirtqRings的虚拟地址和物理地址
+    rings_vaddr: usize,
+    rings_paddr: usize,
+    /// 命令槽数组的虚拟地址和物理地址
+    slots_vaddr: usize,
+    slots_paddr: usize,
+    inner: SpinLock<InnerVirtioBlkQueue>,
+    /// 等待空闲命令槽的进程
+    slot_wait: WaitQueue,
+    /// 每个命令槽的完成量
+    done: [Completion; VIRTIO_BLK_QUEUE_SIZE],
+}
+
+#[derive(Debug)]
+struct InnerVirtioBlkQueue {
+    /// 空闲的命令槽
+    free: u64,
+    /// 下一个要写入可用环的位置
+    avail_idx: u16,
+    /// 下一个要处理的已用环的位置
+    last_used: u16,
+}
+
+impl VirtioBlkQueue {
+    /// @brief 分配队列的内存，并且告诉设备队列的地址
+    fn new(index: u16, transport: &mut PciTransport) -> Result<Self, SystemError> {
+        if (transport.max_queue_size() as usize) < VIRTIO_BLK_QUEUE_SIZE {
+            return Err(SystemError::ENODEV);
+        }
+        let (rings_paddr, rings) = HalImpl::dma_alloc(1, BufferDirection::Both);
+        let slots_pages =
+            (VIRTIO_BLK_QUEUE_SIZE * size_of::<VirtioBlkSlot>() + PAGE_SIZE - 1) / PAGE_SIZE;
+        let (slots_paddr, slots) = HalImpl::dma_alloc(slots_pages, BufferDirection::Both);
+
+        const DONE: Completion = Completion::new();
+        let queue = VirtioBlkQueue {
+            index,
+            rings_vaddr: rings.as_ptr() as usize,
+            rings_paddr,
+            slots_vaddr: slots.as_ptr() as usize,
+            slots_paddr,
+            inner: SpinLock::new(InnerVirtioBlkQueue {
+                free: u64::MAX >> (64 - VIRTIO_BLK_QUEUE_SIZE),
+                avail_idx: 0,
+                last_used: 0,
+            }),
+            slot_wait: WaitQueue::INIT,
+            done: [DONE; VIRTIO_BLK_QUEUE_SIZE],
+        };
+
+        // 描述符表的每一项固定指向对应命令槽的间接描述符表，提交请求时只需要填写长度
+        let rings = queue.rings();
+        for slot in 0..VIRTIO_BLK_QUEUE_SIZE {
+            rings.desc[slot] = VirtqDesc {
+                addr: queue.paddr_of(addr_of!(queue.slot(slot).indirect) as usize) as u64,
+                len: 0,
+                flags: VIRTQ_DESC_F_INDIRECT,
+                next: 0,
+            };
+        }
+
+        let desc_paddr = queue.rings_paddr;
+        let avail_paddr = desc_paddr + (addr_of!(rings.avail) as usize - queue.rings_vaddr);
+        let used_paddr = desc_paddr + (addr_of!(rings.used) as usize - queue.rings_vaddr);
+        transport.queue_set(
+            index,
+            VIRTIO_BLK_QUEUE_SIZE as u32,
+            desc_paddr,
+            avail_paddr,
+            used_paddr,
+        );
+        return Ok(queue);
+    }
+
+    fn rings(&self) -> &'static mut VirtqRings {
+        return unsafe { (self.rings_vaddr as *mut VirtqRings).as_mut().unwrap() };
+    }
+
+    fn slot(&self, slot: usize) -> &'static mut VirtioBlkSlot {
+        return unsafe {
+            (self.slots_vaddr as *mut VirtioBlkSlot)
+                .add(slot)
+                .as_mut()
+                .unwrap()
+        };
+    }
+
+    /// 命令槽中的虚拟地址转换为物理地址
+    fn paddr_of(&self, vaddr: usize) -> usize {
+        return self.slots_paddr + (vaddr - self.slots_vaddr);
+    }
+
+    fn alloc_slot(&self, can_sleep: bool) -> usize {
+        loop {
+            let mut inner = self.inner.lock_irqsave();
+            if inner.free != 0 {
+                let slot = inner.free.trailing_zeros() as usize;
+                inner.free &= !(1 << slot);
+                return slot;
+            }
+            if can_sleep {
+                self.slot_wait.sleep_uninterruptible_unlock_spinlock(inner);
+            } else {
+                drop(inner);
+                self.handle_irq();
+                core::hint::spin_loop();
+            }
+        }
+    }
+
+    fn free_slot(&self, slot: usize) {
+        self.inner.lock_irqsave().free |= 1 << slot;
+        self.slot_wait.wakeup(None);
+    }
+
+    /// @brief 填写命令槽的间接描述符表
+    /// @param data 数据段的（物理地址，长度）
+    fn fill(&self, slot: usize, req_type: u32, sector: u64, data: &[(usize, usize)]) {
+        let s = self.slot(slot);
+        unsafe {
+            write_volatile(
+                addr_of_mut!(s.header),
+                VirtioBlkReqHeader {
+                    req_type,
+                    reserved: 0,
+                    sector,
+                },
+            );
+            write_volatile(addr_of_mut!(s.status), 0xff);
+        }
+
+        let data_flags = if req_type == VIRTIO_BLK_T_IN {
+            VIRTQ_DESC_F_NEXT | VIRTQ_DESC_F_WRITE
+        } else {
+            VIRTQ_DESC_F_NEXT
+        };
+        let header_paddr = self.paddr_of(addr_of!(s.header) as usize);
+        let status_paddr = self.paddr_of(addr_of!(s.status) as usize);
+        s.indirect[0] = VirtqDesc {
+            addr: header_paddr as u64,
+            len: size_of::<VirtioBlkReqHeader>() as u32,
+            flags: VIRTQ_DESC_F_NEXT,
+            next: 1,
+        };
+        for (i, (paddr, len)) in data.iter().enumerate() {
+            s.indirect[i + 1] = VirtqDesc {
+                addr: *paddr as u64,
+                len: *len as u32,
+                flags: data_flags,
+                next: (i + 2) as u16,
+            };
+        }
+        s.indirect[data.len() + 1] = VirtqDesc {
+            addr: status_paddr as u64,
+            len: 1,
+            flags: VIRTQ_DESC_F_WRITE,
+            next: 0,
+        };
+    }
+
+    /// @brief 把命令槽放入可用环
+    /// @param nr_desc 命令槽的间接描述符表使用的项数
+    /// @return 设备是否需要通知
+    fn push(&self, slot: usize, nr_desc: usize) -> bool {
+        let rings = self.rings();
+        let mut inner = self.inner.lock_irqsave();
+        rings.desc[slot].len = (nr_desc * size_of::<VirtqDesc>()) as u32;
+        let idx = inner.avail_idx;
+        unsafe {
+            write_volatile(
+                addr_of_mut!(rings.avail.ring[idx as usize % VIRTIO_BLK_QUEUE_SIZE]),
+                slot as u16,
+            );
+            // 设备看到新的idx之前，必须能看到描述符和环中的内容
+            fence(Ordering::SeqCst);
+            write_volatile(addr_of_mut!(rings.avail.idx), idx.wrapping_add(1));
+        }
+        inner.avail_idx = idx.wrapping_add(1);
+        drop(inner);
+
+        fence(Ordering::SeqCst);
+        return unsafe { read_volatile(addr_of!(rings.used.flags)) } & VIRTQ_USED_F_NO_NOTIFY == 0;
+    }
+
+    /// @brief 等待命令槽上的请求完成
+    fn wait(&self, slot: usize, can_sleep: bool) {
+        let done = &self.done[slot];
+        if !can_sleep {
+            while !done.completion_done() {
+                self.handle_irq();
+                core::hint::spin_loop();
+            }
+            done.wait_for_completion().ok();
+            return;
+        }
+
+        loop {
+            match done.wait_for_completion_timeout(VIRTIO_BLK_TIMEOUT) {
+                Ok(remain) if remain > 0 => return,
+                // 超时：可能丢失了中断，主动检查一次已用环
+                _ => self.handle_irq(),
+            }
+        }
+    }
+
+    /// @brief 处理已用环中的请求，唤醒等待它们的进程
+    ///
+    /// 在中断上下文中调用；不能睡眠的进程也会轮询调用
+    fn handle_irq(&self) {
+        let rings = self.rings();
+        let mut inner = self.inner.lock_irqsave();
+        let used_idx = unsafe { read_volatile(addr_of!(rings.used.idx)) };
+        // 读取已用环的元素之前，必须先读到idx
+        fence(Ordering::SeqCst);
+        while inner.last_used != used_idx {
+            let pos = inner.last_used as usize % VIRTIO_BLK_QUEUE_SIZE;
+            let elem = unsafe { read_volatile(addr_of!(rings.used.ring[pos])) };
+            let slot = elem.id as usize;
+            if slot < VIRTIO_BLK_QUEUE_SIZE {
+                self.done[slot].complete();
+            } else {
+                kerror!("virtio-blk queue {}: invalid used id {}", self.index, slot);
+            }
+            inner.last_used = inner.last_used.wrapping_add(1);
+        }
+    }
+}
+
+/// virtio-blk磁盘
+pub struct VirtioBlkDisk {
+    name: String,
+    transport: SpinLock<PciTransport>,
+    queues: Vec<VirtioBlkQueue>,
+    /// 磁盘的扇区数
+    capacity: u64,
+    readonly: bool,
+    /// 设备是否支持FLUSH请求
+    flush: bool,
+    /// 每个数据段最多的字节数
+    seg_size: usize,
+    /// 每个请求最多的数据段数
+    seg_max: usize,
+    partitions: SpinLock<Vec<Arc<Partition>>>,
+    request_queue: Arc<BlockRequestQueue>,
+    self_ref: Weak<VirtioBlkDisk>,
+}
+
+// transport中的指针指向设备的BAR空间，由transport的锁保护
+unsafe impl Send for VirtioBlkDisk {}
+unsafe impl Sync for VirtioBlkDisk {}
+
+impl Debug for VirtioBlkDisk {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        f.debug_struct("VirtioBlkDisk")
+            .field("name", &self.name)
+            .field("capacity", &self.capacity)
+            .field("readonly", &self.readonly)
+            .field("nr_queues", &self.queues.len())
+            .finish()
+    }
+}
+
+impl VirtioBlkDisk {
+    /// @brief 初始化设备，为每个cpu创建一个队列（不超过设备支持的队列数和中断数）
+    fn new(name: String, mut transport: PciTransport) -> Result<Arc<Self>, SystemError> {
+        transport.set_status(DeviceStatus::empty());
+        transport.set_status(DeviceStatus::ACKNOWLEDGE | DeviceStatus::DRIVER);
+        let features = transport.read_device_features() & VIRTIO_BLK_SUPPORTED_FEATURES;
+        if features & VIRTIO_F_VERSION_1 == 0 || features & VIRTIO_RING_F_INDIRECT_DESC == 0 {
+            kerror!(
+                "{}: device does not support VERSION_1 or INDIRECT_DESC, features = {:#x}",
+                name,
+                features
+            );
+            transport.set_status(DeviceStatus::FAILED);
+            return Err(SystemError::ENODEV);
+        }
+        transport.write_driver_features(features);
+        transport.set_status(
+            DeviceStatus::ACKNOWLEDGE | DeviceStatus::DRIVER | DeviceStatus::FEATURES_OK,
+        );
+
+        let config = transport
+            .config_space::<VirtioBlkConfig>()
+            .map_err(|_| SystemError::ENODEV)?;
+        let read_config = |field: *const u32| unsafe { read_volatile(field) };
+        let config = config.as_ptr();
+        let capacity = unsafe {
+            read_config(addr_of!((*config).capacity_low)) as u64
+                | (read_config(addr_of!((*config).capacity_high)) as u64) << 32
+        };
+        let seg_size = match features & VIRTIO_BLK_F_SIZE_MAX {
+            0 => VIRTIO_BLK_DEFAULT_SEG_SIZE,
+            _ => unsafe { read_config(addr_of!((*config).size_max)) as usize }
+                .clamp(PAGE_SIZE, VIRTIO_BLK_DEFAULT_SEG_SIZE),
+        };
+        let seg_max = match features & VIRTIO_BLK_F_SEG_MAX {
+            0 => VIRTIO_BLK_MAX_SEGS,
+            _ => unsafe { read_config(addr_of!((*config).seg_max)) as usize }
+                .clamp(1, VIRTIO_BLK_MAX_SEGS),
+        };
+        let num_queues = match features & VIRTIO_BLK_F_MQ {
+            0 => 1,
+            _ => (unsafe { read_config(addr_of!((*config).writeback_num_queues)) } >> 16) as usize,
+        };
+        let nr_cpus = unsafe { smp_get_total_cpu() }.max(1) as usize;
+        let nr_queues = num_queues
+            .min(nr_cpus)
+            .min(transport.nr_queue_vectors() as usize)
+            .max(1);
+
+        let mut queues = Vec::with_capacity(nr_queues);
+        for index in 0..nr_queues {
+            match VirtioBlkQueue::new(index as u16, &mut transport) {
+                Ok(queue) => queues.push(queue),
+                Err(e) => {
+                    transport.set_status(DeviceStatus::FAILED);
+                    return Err(e);
+                }
+            }
+        }
+        transport.set_status(
+            DeviceStatus::ACKNOWLEDGE
+                | DeviceStatus::DRIVER
+                | DeviceStatus::FEATURES_OK
+                | DeviceStatus::DRIVER_OK,
+        );
+
+        kinfo!(
+            "{}: {} sectors, {} queues, features = {:#x}",
+            name,
+            capacity,
+            nr_queues,
+            features
+        );
+
+        let disk = Arc::new_cyclic(|self_ref: &Weak<VirtioBlkDisk>| VirtioBlkDisk {
+            name,
+            transport: SpinLock::new(transport),
+            queues,
+            capacity,
+            readonly: features & VIRTIO_BLK_F_RO != 0,
+            flush: features & VIRTIO_BLK_F_FLUSH != 0,
+            seg_size,
+            seg_max,
+            partitions: SpinLock::new(Vec::new()),
+            request_queue: BlockRequestQueue::new(self_ref.clone(), BLK_DEFAULT_IOSCHED),
+            self_ref: self_ref.clone(),
+        });
+        return Ok(disk);
+    }
+
+    /// @brief 读取MBR分区表，创建磁盘的分区
+    fn init_partitions(self: &Arc<Self>) -> Result<(), SystemError> {
+        let mut buf: Vec<u8> = Vec::new();
+        buf.resize(VIRTIO_BLK_SECTOR_SIZE, 0);
+        self.read_at(0, 1, &mut buf)?;
+        let table: MbrDiskPartionTable =
+            unsafe { read_unaligned(buf.as_ptr() as *const MbrDiskPartionTable) };
+
+        let mut partitions = self.partitions.lock();
+        for i in 0..4 {
+            let entry = table.dpte[i];
+            if entry.part_type != 0 {
+                partitions.push(Partition::new(
+                    entry.starting_sector() as u64,
+                    entry.starting_lba as u64,
+                    entry.total_sectors as u64,
+                    self.self_ref.clone(),
+                    i as u16,
+                ));
+            }
+        }
+        return Ok(());
+    }
+
+    /// @brief 传输count个扇区。一个请求放不下的部分，拆分为多个请求
+    fn transfer(
+        &self,
+        req_type: u32,
+        lba_id_start: BlockId,
+        count: usize,
+        buf_vaddr: usize,
+    ) -> Result<(), SystemError> {
+        if lba_id_start as u64 + count as u64 > self.capacity {
+            return Err(SystemError::EINVAL);
+        }
+        let max_sectors = self.seg_size * self.seg_max / VIRTIO_BLK_SECTOR_SIZE;
+        let mut done = 0;
+        while done < count {
+            let n = (count - done).min(max_sectors);
+            let vaddr = buf_vaddr + done * VIRTIO_BLK_SECTOR_SIZE;
+            let len = n * VIRTIO_BLK_SECTOR_SIZE;
+            // 内核缓冲区位于线性映射区域，物理地址连续，只需要按照数据段的大小切分
+            let data: Vec<(usize, usize)> = (0..len)
+                .step_by(self.seg_size)
+                .map(|off| (virt_2_phys(vaddr + off), (len - off).min(self.seg_size)))
+                .collect();
+            self.execute(req_type, (lba_id_start + done) as u64, &data)?;
+            done += n;
+        }
+        return Ok(());
+    }
+
+    /// @brief 在当前cpu的队列上提交一个请求，并且等待它完成
+    fn execute(
+        &self,
+        req_type: u32,
+        sector: u64,
+        data: &[(usize, usize)],
+    ) -> Result<(), SystemError> {
+        let queue = &self.queues[smp_get_processor_id() as usize % self.queues.len()];
+        // 调用者持有自旋锁时不能睡眠，只能轮询已用环
+        let can_sleep = ProcessManager::current().preempt_count() == 0;
+
+        let slot = queue.alloc_slot(can_sleep);
+        queue.fill(slot, req_type, sector, data);
+        if queue.push(slot, data.len() + 2) {
+            self.transport.lock_irqsave().notify(queue.index);
+        }
+        queue.wait(slot, can_sleep);
+        let status = unsafe { read_volatile(addr_of!(queue.slot(slot).status)) };
+        queue.free_slot(slot);
+
+        match status {
+            VIRTIO_BLK_S_OK => return Ok(()),
+            VIRTIO_BLK_S_UNSUPP => return Err(SystemError::EOPNOTSUPP_OR_ENOTSUP),
+            _ => {
+                kerror!(
+                    "{}: request failed, type = {}, sector = {}, status = {}",
+                    self.name,
+                    req_type,
+                    sector,
+                    status
+                );
+                return Err(SystemError::EIO);
+            }
+        }
+    }
+
+    fn handle_irq(&self, queue: usize) {
+        if let Some(queue) = self.queues.get(queue) {
+            queue.handle_irq();
+        }
+    }
+}
+
+/// @brief virtio-blk队列的中断处理函数
+/// @param irq_paramer 队列号
+pub unsafe extern "C" fn virtio_blk_irq_handler(
+    _irq_num: u64,
+    irq_paramer: u64,
+    _regs: *mut pt_regs,
+) {
+    for disk in VIRTIO_BLK_DISKS.lock_irqsave().iter() {
+        disk.handle_irq(irq_paramer as usize);
+    }
+}
+
+/// @brief 初始化一个virtio-blk设备
+pub fn virtio_blk(transport: PciTransport) {
+    let name = format!("virtio_blk_{}", VIRTIO_BLK_DISKS.lock_irqsave().len());
+    let disk = match VirtioBlkDisk::new(name.clone(), transport) {
+        Ok(disk) => disk,
+        Err(e) => {
+            kerror!("{}: failed to initialize: {:?}", name, e);
+            return;
+        }
+    };
+    VIRTIO_BLK_DISKS.lock_irqsave().push(disk.clone());
+
+    if let Err(e) = disk.init_partitions() {
+        kerror!("{}: failed to read partition table: {:?}", name, e);
+    }
+    blk_stats_register(&name, &(disk as Arc<dyn BlockDevice>));
+}
+
+/// @brief 通过 name 获取 virtio-blk 磁盘
+pub fn get_virtio_blk_disk_by_name(name: &str) -> Result<Arc<VirtioBlkDisk>, SystemError> {
+    return VIRTIO_BLK_DISKS
+        .lock_irqsave()
+        .iter()
+        .find(|disk| disk.name == name)
+        .cloned()
+        .ok_or(SystemError::ENXIO);
+}
+
+impl KObject for VirtioBlkDisk {
+    fn as_any_ref(&self) -> &dyn Any {
+        self
+    }
+
+    fn inode(&self) -> Option<Arc<KernFSInode>> {
+        todo!()
+    }
+
+    fn kobj_type(&self) -> Option<&'static dyn KObjType> {
+        todo!()
+    }
+
+    fn kset(&self) -> Option<Arc<KSet>> {
+        todo!()
+    }
+
+    fn parent(&self) -> Option<Weak<dyn KObject>> {
+        todo!()
+    }
+
+    fn set_inode(&self, _inode: Option<Arc<KernFSInode>>) {
+        todo!()
+    }
+
+    fn kobj_state(&self) -> RwLockReadGuard<KObjectState> {
+        todo!()
+    }
+
+    fn kobj_state_mut(&self) -> RwLockWriteGuard<KObjectState> {
+        todo!()
+    }
+
+    fn set_kobj_state(&self, _state: KObjectState) {
+        todo!()
+    }
+
+    fn name(&self) -> String {
+        return self.name.clone();
+    }
+
+    fn set_name(&self, _name: String) {
+        todo!()
+    }
+
+    fn set_kset(&self, _kset: Option<Arc<KSet>>) {
+        todo!()
+    }
+
+    fn set_parent(&self, _parent: Option<Weak<dyn KObject>>) {
+        todo!()
+    }
+
+    fn set_kobj_type(&self, _ktype: Option<&'static dyn KObjType>) {
+        todo!()
+    }
+}
+
+impl Device for VirtioBlkDisk {
+    fn dev_type(&self) -> DeviceType {
+        return DeviceType::Block;
+    }
+
+    fn id_table(&self) -> IdTable {
+        todo!()
+    }
+
+    fn bus(&self) -> Option<Arc<dyn Bus>> {
+        todo!("VirtioBlkDisk::bus()")
+    }
+
+    fn set_bus(&self, _bus: Option<Arc<dyn Bus>>) {
+        todo!("VirtioBlkDisk::set_bus()")
+    }
+
+    fn driver(&self) -> Option<Arc<dyn Driver>> {
+        todo!("VirtioBlkDisk::driver()")
+    }
+
+    fn is_dead(&self) -> bool {
+        false
+    }
+
+    fn set_driver(&self, _driver: Option<Weak<dyn Driver>>) {
+        todo!("VirtioBlkDisk::set_driver()")
+    }
+
+    fn can_match(&self) -> bool {
+        todo!()
+    }
+
+    fn set_can_match(&self, _can_match: bool) {
+        todo!()
+    }
+
+    fn state_synced(&self) -> bool {
+        todo!()
+    }
+}
+
+impl BlockDevice for VirtioBlkDisk {
+    #[inline]
+    fn as_any_ref(&self) -> &dyn Any {
+        self
+    }
+
+    #[inline]
+    fn blk_size_log2(&self) -> u8 {
+        9
+    }
+
+    fn sync(&self) -> Result<(), SystemError> {
+        self.request_queue.sync()?;
+        if self.flush {
+            self.execute(VIRTIO_BLK_T_FLUSH, 0, &[])?;
+        }
+        return Ok(());
+    }
+
+    #[inline]
+    fn device(&self) -> Arc<dyn Device> {
+        return self.self_ref.upgrade().unwrap();
+    }
+
+    fn block_size(&self) -> usize {
+        return VIRTIO_BLK_SECTOR_SIZE;
+    }
+
+    fn partitions(&self) -> Vec<Arc<Partition>> {
+        return self.partitions.lock().clone();
+    }
+
+    fn request_queue(&self) -> Option<Arc<BlockRequestQueue>> {
+        return Some(self.request_queue.clone());
+    }
+
+    fn read_at(
+        &self,
+        lba_id_start: BlockId,
+        count: usize,
+        buf: &mut [u8],
+    ) -> Result<usize, SystemError> {
+        let len = count * VIRTIO_BLK_SECTOR_SIZE;
+        if count == 0 {
+            return Ok(0);
+        } else if len > buf.len() {
+            return Err(SystemError::E2BIG);
+        }
+        self.transfer(
+            VIRTIO_BLK_T_IN,
+            lba_id_start,
+            count,
+            buf.as_mut_ptr() as usize,
+        )?;
+        return Ok(len);
+    }
+
+    fn write_at(
+        &self,
+        lba_id_start: BlockId,
+        count: usize,
+        buf: &[u8],
+    ) -> Result<usize, SystemError> {
+        let len = count * VIRTIO_BLK_SECTOR_SIZE;
+        if count == 0 {
+            return Ok(0);
+        } else if len > buf.len() {
+            return Err(SystemError::E2BIG);
+        } else if self.readonly {
+            return Err(SystemError::EROFS);
+        }
+        self.transfer(VIRTIO_BLK_T_OUT, lba_id_start, count, buf.as_ptr() as usize)?;
+        return Ok(len);
+    }
+}
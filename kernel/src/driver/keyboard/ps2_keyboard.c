@@ -4,27 +4,12 @@
 #include <mm/slab.h>
 #include <common/printk.h>
 #include <filesystem/vfs/VFS.h>
-#include <common/spinlock.h>
-#include <common/kfifo.h>
-
-// 键盘输入缓冲区
-static struct kfifo_t kb_buf;
 
 extern void ps2_keyboard_register(struct vfs_file_operations_t *);
 extern void ps2_keyboard_parse_keycode(uint8_t input);
-
-// 缓冲区读写锁
-static spinlock_t ps2_kb_buf_rw_lock;
-
-/**
- * @brief 重置ps2键盘输入缓冲区
- *
- * @param kbp 缓冲区对象指针
- */
-static void ps2_keyboard_reset_buffer(struct kfifo_t *kbp)
-{
-    kfifo_reset(kbp);
-}
+// 键盘输入缓冲区（Rust实现的无锁环形缓冲区，中断处理程序写入扫描码）
+extern void ps2_keyboard_buf_reset();
+extern uint64_t ps2_keyboard_buf_read(char *buf, uint64_t count);
 struct apic_IO_APIC_RTE_entry entry;
 
 hardware_intr_controller ps2_keyboard_intr_controller =
@@ -46,7 +31,7 @@ hardware_intr_controller ps2_keyboard_intr_controller =
  */
 long ps2_keyboard_open(void *inode, void *filp)
 {
-    ps2_keyboard_reset_buffer(&kb_buf);
+    ps2_keyboard_buf_reset();
     return 0;
 }
 
@@ -59,7 +44,7 @@ long ps2_keyboard_open(void *inode, void *filp)
  */
 long ps2_keyboard_close(void *inode, void *filp)
 {
-    ps2_keyboard_reset_buffer(&kb_buf);
+    ps2_keyboard_buf_reset();
     return 0;
 }
 
@@ -77,7 +62,7 @@ long ps2_keyboard_ioctl(void *inode, void *filp, uint64_t cmd, uint64_t arg)
     switch (cmd)
     {
     case KEYBOARD_CMD_RESET_BUFFER:
-        ps2_keyboard_reset_buffer(&kb_buf);
+        ps2_keyboard_buf_reset();
         break;
 
     default:
@@ -97,12 +82,9 @@ long ps2_keyboard_ioctl(void *inode, void *filp, uint64_t cmd, uint64_t arg)
  */
 long ps2_keyboard_read(void *filp, char *buf, int64_t count, long *position)
 {
-    // 缓冲区为空则等待
-    while (kfifo_empty(&kb_buf))
-        ;
-
-    count = (count > kb_buf.size) ? kb_buf.size : count;
-    return kfifo_out(&kb_buf, buf, count);
+    if (count <= 0)
+        return 0;
+    return ps2_keyboard_buf_read(buf, count);
 }
 
 /**
@@ -150,11 +132,6 @@ void ps2_keyboard_handler(ul irq_num, ul buf_vaddr, struct pt_regs *regs)
 void ps2_keyboard_init()
 {
 
-    // ======= 初始化键盘循环队列缓冲区 ===========
-
-    // 初始化键盘循环队列缓冲区
-    kfifo_alloc(&kb_buf, ps2_keyboard_buffer_size, 0);
-
     // ======== 初始化中断RTE entry ==========
 
     entry.vector = PS2_KEYBOARD_INTR_VECTOR; // 设置中断向量号
@@ -183,12 +160,8 @@ void ps2_keyboard_init()
         for (int j = 0; j < 1000; ++j)
             nop();
 
-
-    // 初始化键盘缓冲区的读写锁
-    spin_init(&ps2_kb_buf_rw_lock);
-
     // 注册中断处理程序
-    irq_register(PS2_KEYBOARD_INTR_VECTOR, &entry, &ps2_keyboard_handler, (ul)&kb_buf, &ps2_keyboard_intr_controller, "ps/2 keyboard");
+    irq_register(PS2_KEYBOARD_INTR_VECTOR, &entry, &ps2_keyboard_handler, 0, &ps2_keyboard_intr_controller, "ps/2 keyboard");
 
     // 先读一下键盘的数据，防止由于在键盘初始化之前，由于按键被按下从而导致接收不到中断。
     io_in8(PORT_PS2_KEYBOARD_DATA);
@@ -205,5 +178,4 @@ void ps2_keyboard_init()
 void ps2_keyboard_exit()
 {
     irq_unregister(PS2_KEYBOARD_INTR_VECTOR);
-    kfifo_free_alloc(&kb_buf);
 }
@@ -4,9 +4,6 @@
 
 #define PS2_KEYBOARD_INTR_VECTOR 0x21 // 键盘的中断向量号
 
-// 定义键盘循环队列缓冲区大小为100bytes
-#define ps2_keyboard_buffer_size 8
-
 #define KEYBOARD_CMD_RESET_BUFFER 1
 
 #define PORT_PS2_KEYBOARD_DATA 0x60
@@ -1,4 +1,4 @@
-use core::{ffi::c_void, sync::atomic::AtomicI32};
+use core::{ffi::c_void, hint::spin_loop, sync::atomic::AtomicI32};
 
 use alloc::sync::{Arc, Weak};
 
@@ -12,11 +12,22 @@ use crate::{
         },
     },
     include::bindings::bindings::vfs_file_operations_t,
-    libs::{keyboard_parser::TypeOneFSM, rwlock::RwLock, spinlock::SpinLock},
+    libs::{
+        keyboard_parser::TypeOneFSM, lazy_init::Lazy, ringbuf::SpscRing, rwlock::RwLock,
+        spinlock::SpinLock,
+    },
     syscall::SystemError,
     time::TimeSpec,
 };
 
+/// 键盘原始扫描码缓冲区的大小
+const PS2_KEYBOARD_BUF_SIZE: usize = 64;
+
+/// 键盘的原始扫描码：中断处理程序（只在BSP上运行）是唯一的生产者，`/dev/ps2_keyboard`的读者是消费者
+static PS2_KEYBOARD_BUF: Lazy<SpscRing<u8>> = Lazy::new();
+/// 读者之间的互斥锁（环形缓冲区同一时刻只能有一个消费者）
+static PS2_KEYBOARD_READ_LOCK: SpinLock<()> = SpinLock::new(());
+
 #[derive(Debug)]
 pub struct LockedPS2KeyBoardInode(RwLock<PS2KeyBoardInode>, AtomicI32); // self.1 用来记录有多少个文件打开了这个inode
 
@@ -88,6 +99,9 @@ impl DeviceINode for LockedPS2KeyBoardInode {
 
 #[no_mangle] // 不重命名
 pub extern "C" fn ps2_keyboard_register(f_ops: &vfs_file_operations_t) {
+    if !PS2_KEYBOARD_BUF.initialized() {
+        PS2_KEYBOARD_BUF.init(SpscRing::new(PS2_KEYBOARD_BUF_SIZE));
+    }
     devfs_register("ps2_keyboard", LockedPS2KeyBoardInode::new(f_ops))
         .expect("Failed to register ps/2 keyboard");
 }
@@ -189,5 +203,39 @@ impl IndexNode for LockedPS2KeyBoardInode {
 #[no_mangle]
 /// for test
 pub extern "C" fn ps2_keyboard_parse_keycode(input: u8) {
+    if let Some(buf) = PS2_KEYBOARD_BUF.try_get() {
+        // 缓冲区满时丢弃新的扫描码
+        buf.push(input).ok();
+    }
     PS2_KEYBOARD_FSM.lock().parse(input);
 }
+
+/// 从扫描码缓冲区中读取最多`count`个字节。缓冲区为空时等待
+#[no_mangle]
+pub extern "C" fn ps2_keyboard_buf_read(buf: *mut u8, count: u64) -> u64 {
+    let ring = match PS2_KEYBOARD_BUF.try_get() {
+        Some(ring) => ring,
+        None => return 0,
+    };
+    let out = unsafe { core::slice::from_raw_parts_mut(buf, count as usize) };
+    loop {
+        // 等待时不持有锁，中断处理程序也不需要这个锁
+        while ring.is_empty() {
+            spin_loop();
+        }
+        let _guard = PS2_KEYBOARD_READ_LOCK.lock_irqsave();
+        let n = ring.pop_slice(out);
+        if n != 0 {
+            return n as u64;
+        }
+    }
+}
+
+/// 清空扫描码缓冲区
+#[no_mangle]
+pub extern "C" fn ps2_keyboard_buf_reset() {
+    if let Some(ring) = PS2_KEYBOARD_BUF.try_get() {
+        let _guard = PS2_KEYBOARD_READ_LOCK.lock_irqsave();
+        ring.clear();
+    }
+}
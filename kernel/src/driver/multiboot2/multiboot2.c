@@ -116,6 +116,50 @@ bool multiboot2_get_load_base(const struct iter_data_t *_iter_data, void *data,
   return true;
 }
 
+/**
+ * @brief 获取bootloader加载的模块（例如initramfs）的物理地址范围
+ *
+ * @param _iter_data 要被迭代的信息的结构体
+ * @param data 返回信息的数组（struct multiboot_tag_module_t，不包含cmdline）
+ * @param count 数组中已有的模块数量，每找到一个模块就加一
+ * @return 数组已满时返回true，停止迭代
+ */
+bool multiboot2_get_modules(const struct iter_data_t *_iter_data, void *data, unsigned int *count)
+{
+  if (_iter_data->type != MULTIBOOT_TAG_TYPE_MODULE)
+    return false;
+  struct multiboot_tag_module_t *modules = (struct multiboot_tag_module_t *)data;
+  modules[*count] = *(struct multiboot_tag_module_t *)_iter_data;
+  ++(*count);
+  return *count >= MULTIBOOT2_MAX_MODULES;
+}
+
+/**
+ * @brief 获取bootloader传递的内核命令行
+ *
+ * @param _iter_data 要被迭代的信息的结构体
+ * @param data 返回命令行的缓冲区，长度至少为MULTIBOOT2_CMDLINE_MAX
+ * @param count 返回命令行的长度
+ * @return 找到命令行时返回true，停止迭代
+ */
+bool multiboot2_get_cmdline(const struct iter_data_t *_iter_data, void *data, unsigned int *count)
+{
+  if (_iter_data->type != MULTIBOOT_TAG_TYPE_CMDLINE)
+    return false;
+  const char *src = ((struct multiboot_tag_string_t *)_iter_data)->string;
+  const char *end = (const char *)_iter_data + _iter_data->size;
+  char *dst = (char *)data;
+  unsigned int len = 0;
+  while (src + len < end && src[len] != '\0' && len < MULTIBOOT2_CMDLINE_MAX - 1)
+  {
+    dst[len] = src[len];
+    ++len;
+  }
+  dst[len] = '\0';
+  *count = len;
+  return true;
+}
+
 /**
  * @brief 获取帧缓冲区信息
  *
@@ -436,6 +436,30 @@ bool multiboot2_get_memory(const struct iter_data_t *_iter_data, void *_data, un
 
 bool multiboot2_get_load_base(const struct iter_data_t *_iter_data, void *data, unsigned int *reserved);
 
+// multiboot2_get_modules最多返回的模块数量
+#define MULTIBOOT2_MAX_MODULES 8
+
+/**
+ * @brief 获取bootloader加载的模块（例如initramfs）的物理地址范围
+ *
+ * @param _iter_data 要被迭代的信息的结构体
+ * @param data 返回信息的数组，长度至少为MULTIBOOT2_MAX_MODULES
+ * @param count 返回的模块数量（调用前需要置为0）
+ */
+bool multiboot2_get_modules(const struct iter_data_t *_iter_data, void *data, unsigned int *count);
+
+// multiboot2_get_cmdline返回的内核命令行的最大长度（包括结尾的'\0'）
+#define MULTIBOOT2_CMDLINE_MAX 1024
+
+/**
+ * @brief 获取bootloader传递的内核命令行
+ *
+ * @param _iter_data 要被迭代的信息的结构体
+ * @param data 返回命令行的缓冲区，长度至少为MULTIBOOT2_CMDLINE_MAX，结果以'\0'结尾
+ * @param count 返回命令行的长度（不包括结尾的'\0'）
+ */
+bool multiboot2_get_cmdline(const struct iter_data_t *_iter_data, void *data, unsigned int *count);
+
 /**
  * @brief 获取VBE信息
  *
@@ -2,14 +2,16 @@ use crate::arch::mm::kernel_page_flags;
 
 use crate::arch::MMArch;
 
+use crate::libs::spinlock::SpinLock;
 use crate::mm::kernel_mapper::KernelMapper;
 use crate::mm::page::PageFlags;
 use crate::mm::{
     allocator::page_frame::{
-        allocate_page_frames, deallocate_page_frames, PageFrameCount, PhysPageFrame,
+        allocate_dma32_page_frames, deallocate_page_frames, PageFrameCount, PhysPageFrame,
     },
     MemoryManagementArch, PhysAddr, VirtAddr,
 };
+use alloc::vec::Vec;
 use core::ptr::NonNull;
 const PAGE_SIZE: usize = 4096;
 /// @brief 申请用于DMA的内存页
@@ -20,7 +22,8 @@ pub fn dma_alloc(pages: usize) -> (usize, NonNull<u8>) {
         ((pages * PAGE_SIZE + MMArch::PAGE_SIZE - 1) / MMArch::PAGE_SIZE).next_power_of_two(),
     );
     unsafe {
-        let (paddr, count) = allocate_page_frames(page_num).expect("e1000e: alloc page failed");
+        let (paddr, count) =
+            allocate_dma32_page_frames(page_num).expect("e1000e: alloc page failed");
         let virt = MMArch::phys_2_virt(paddr).unwrap();
         // 清空这块区域，防止出现脏数据
         core::ptr::write_bytes(virt.data() as *mut u8, 0, count.data() * MMArch::PAGE_SIZE);
@@ -61,3 +64,85 @@ pub unsafe fn dma_dealloc(paddr: usize, vaddr: NonNull<u8>, pages: usize) -> i32
     }
     return 0;
 }
+
+/// @brief 可以回收的DMA缓冲区池
+///
+/// 预先申请若干个DMA页，并把每一页切分为大小相同的缓冲区（例如标准MTU下的2KiB），
+/// 收发包时从池中取出缓冲区、用完后放回，而不是每个分组都通过dma_alloc/dma_dealloc
+/// 申请、释放一页（每次都要获取全局的页分配器的锁，并且修改内核页表、刷新TLB）。
+///
+/// 池中的缓冲区永远不会跨越页的边界，因此在物理地址上是连续的
+pub struct DmaBufferPool {
+    /// 每个缓冲区的大小
+    buf_size: usize,
+    /// 申请的DMA块（起始物理地址，起始虚拟地址），池被释放时归还
+    blocks: Vec<(usize, NonNull<u8>)>,
+    /// 空闲的缓冲区（物理地址，虚拟地址）
+    free: SpinLock<Vec<(usize, NonNull<u8>)>>,
+    /// 缓冲区的总数
+    total: usize,
+}
+
+/// 缓冲区只会被持有它的一方访问，空闲链表由自旋锁保护
+unsafe impl Send for DmaBufferPool {}
+unsafe impl Sync for DmaBufferPool {}
+
+impl DmaBufferPool {
+    /// 每次向页分配器申请的页数
+    const BLOCK_PAGES: usize = 16;
+
+    /// @brief 创建一个缓冲区池
+    /// @param buf_size 每个缓冲区的大小，必须是2的幂，并且不超过一页
+    /// @param count 缓冲区的个数（向上取整到一个DMA块能容纳的个数的倍数）
+    pub fn new(buf_size: usize, count: usize) -> Self {
+        assert!(buf_size.is_power_of_two() && buf_size <= PAGE_SIZE);
+        let per_block = Self::BLOCK_PAGES * PAGE_SIZE / buf_size;
+        let nblocks = (count + per_block - 1) / per_block;
+        let mut blocks = Vec::with_capacity(nblocks);
+        let mut free = Vec::with_capacity(nblocks * per_block);
+        for _ in 0..nblocks {
+            let (paddr, vaddr) = dma_alloc(Self::BLOCK_PAGES);
+            for i in 0..per_block {
+                let offset = i * buf_size;
+                free.push((paddr + offset, unsafe {
+                    NonNull::new_unchecked(vaddr.as_ptr().add(offset))
+                }));
+            }
+            blocks.push((paddr, vaddr));
+        }
+        let total = free.len();
+        return Self {
+            buf_size,
+            blocks,
+            free: SpinLock::new(free),
+            total,
+        };
+    }
+
+    /// @brief 每个缓冲区的大小
+    pub fn buf_size(&self) -> usize {
+        return self.buf_size;
+    }
+
+    /// @brief 从池中取出一个缓冲区
+    /// @return (物理地址, 虚拟地址)，池中没有空闲的缓冲区时返回None
+    pub fn alloc(&self) -> Option<(usize, NonNull<u8>)> {
+        return self.free.lock_irqsave().pop();
+    }
+
+    /// @brief 把缓冲区放回池中
+    /// @param paddr vaddr 缓冲区的地址，必须是从这个池中取出的，并且不能再被使用
+    pub unsafe fn free(&self, paddr: usize, vaddr: NonNull<u8>) {
+        let mut free = self.free.lock_irqsave();
+        debug_assert!(free.len() < self.total);
+        free.push((paddr, vaddr));
+    }
+}
+
+impl Drop for DmaBufferPool {
+    fn drop(&mut self) {
+        for (paddr, vaddr) in self.blocks.drain(..) {
+            unsafe { dma_dealloc(paddr, vaddr, Self::BLOCK_PAGES) };
+        }
+    }
+}
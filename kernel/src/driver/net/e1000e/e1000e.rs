@@ -1,23 +1,28 @@
 // 参考手册: PCIe* GbE Controllers Open Source Software Developer’s Manual
 // Refernce: PCIe* GbE Controllers Open Source Software Developer’s Manual
 
+use alloc::sync::Arc;
 use alloc::vec::Vec;
 use core::intrinsics::unlikely;
 use core::mem::size_of;
-use core::ptr::NonNull;
+use core::ptr::{null_mut, NonNull};
 use core::slice::{from_raw_parts, from_raw_parts_mut};
-use core::sync::atomic::{compiler_fence, Ordering};
+use core::sync::atomic::{compiler_fence, AtomicPtr, AtomicU32, Ordering};
 
 use super::e1000e_driver::e1000e_driver_init;
-use crate::driver::net::dma::{dma_alloc, dma_dealloc};
+use crate::driver::net::dma::{dma_alloc, dma_dealloc, DmaBufferPool};
 use crate::driver::pci::pci::{
     get_pci_device_structure_mut, PciDeviceStructure, PciDeviceStructureGeneralDevice, PciError,
     PCI_DEVICE_LINKEDLIST,
 };
-use crate::driver::pci::pci_irq::{IrqCommonMsg, IrqMsg, IrqSpecificMsg, PciInterrupt, IRQ};
+use crate::driver::pci::pci_irq::{
+    pci_irq_affinity, pci_irq_vector_alloc, IrqCommonMsg, IrqMsg, IrqSpecificMsg, IrqType,
+    PciInterrupt, PciIrqError, IRQ,
+};
 use crate::include::bindings::bindings::pt_regs;
 use crate::libs::volatile::{ReadOnly, Volatile, WriteOnly};
-use crate::net::net_core::poll_ifaces_try_lock_onetime;
+use crate::net::net_core::net_rx_schedule;
+use crate::net::stats::{snmp_count_csum_error, snmp_inc, NetDevCounter, NetDevStats, SnmpCounter};
 use crate::{kdebug, kinfo};
 
 const PAGE_SIZE: usize = 4096;
@@ -51,11 +56,27 @@ const E1000E_BAR_REG_ALIGN: u8 = 64;
 #[allow(dead_code)]
 const E1000E_REG_SIZE: u8 = 4;
 
-// TxBuffer和RxBuffer的大小(DMA页)
+// descriptor环形队列的大小(DMA页)
 const E1000E_DMA_PAGES: usize = 1;
 
-// 中断相关
-const E1000E_RECV_VECTOR: u16 = 57;
+// 收/发包缓冲区的大小。网卡最多接收1536字节的分组，因此标准MTU下把一页切分为两个缓冲区
+// size of receive/transmit buffers. packets larger than 1536 bytes are discarded by the nic, so one page is split into two buffers
+const E1000E_BUFFER_SIZE: usize = 2048;
+// 缓冲区池的大小：两个环形队列中的缓冲区，加上已经收到、还没有被协议栈处理完的缓冲区
+// pool size: buffers owned by both rings plus received buffers still being processed by the stack
+const E1000E_POOL_BUFFERS: usize =
+    PAGE_SIZE / size_of::<E1000ERecvDesc>() + PAGE_SIZE / size_of::<E1000ETransDesc>() + 128;
+
+// 中断相关。MSI-X模式下收包、发包和其他原因（链路状态变化）各使用一个中断，分别是MSI-X表中的第0、1、2项
+// interrupt related. in MSI-X mode rx, tx and other causes (link status change) use MSI-X table entries 0, 1 and 2
+const E1000E_MSIX_VECTOR_RX: u32 = 0;
+const E1000E_MSIX_VECTOR_TX: u32 = 1;
+const E1000E_MSIX_VECTOR_OTHER: u32 = 2;
+const E1000E_MSIX_VECTORS: u16 = 3;
+
+// 积累多少个分组之后写入一次TDT寄存器
+// number of queued packets after which TDT is written
+const E1000E_TX_BATCH: usize = 32;
 
 // napi队列中暂时存储的buffer个数
 const E1000E_RECV_NAPI: usize = 1024;
@@ -149,7 +170,27 @@ impl E1000EBuffer {
     pub fn len(&self) -> usize {
         return self.length;
     }
+    // 从缓冲区池中取出一个缓冲区，池中没有空闲的缓冲区时返回None
+    // take a buffer from the pool, returns None if the pool is exhausted
+    pub fn from_pool(pool: &DmaBufferPool) -> Option<Self> {
+        let (paddr, vaddr) = pool.alloc()?;
+        return Some(E1000EBuffer {
+            buffer: vaddr,
+            paddr,
+            length: pool.buf_size(),
+        });
+    }
+
+    // 把从缓冲区池中取出的buffer放回池中，之后不能再使用这个buffer（包括它的副本）
+    // return a buffer taken from the pool. neither it nor its copies may be used afterwards
+    pub fn recycle(self, pool: &DmaBufferPool) {
+        if self.length != 0 {
+            unsafe { pool.free(self.paddr, self.buffer) };
+        }
+    }
+
     // 释放buffer内部的dma_pages，需要小心使用
+    #[allow(dead_code)]
     pub fn free_buffer(self) -> () {
         if self.length != 0 {
             unsafe { dma_dealloc(self.paddr, self.buffer, E1000E_DMA_PAGES) };
@@ -157,10 +198,53 @@ impl E1000EBuffer {
     }
 }
 
-// 中断处理函数, 调用协议栈的poll函数，未来可能会用napi来替换这里
-// Interrupt handler
+// 网卡的中断寄存器。中断处理函数通过它屏蔽收包中断，不需要获取设备的锁
+// 中断处理函数只能通过这个指针找到网卡，因此目前只支持一块网卡
+// interrupt registers of the nic, used by the interrupt handler to mask receive interrupts without locking the device
+static E1000E_INTERRUPT_REGS: AtomicPtr<InterruptRegs> = AtomicPtr::new(null_mut());
+
+// 收包相关的中断
+// receive interrupts
+const E1000E_IMS_RX: u32 = E1000E_IMS_RXT0 | E1000E_IMS_RXDMT0;
+// MSI-X模式下收包中断还需要包含RXQ0，它决定是否产生收包队列的MSI-X中断
+// in MSI-X mode the rx cause RXQ0 selects the rx queue vector, so it is masked as well
+const E1000E_IMS_RX_MSIX: u32 = E1000E_IMS_RX | E1000E_IMS_RXQ0;
+// 中断处理函数屏蔽的收包中断，取决于使用MSI还是MSI-X
+// receive interrupts masked by the interrupt handler, depends on MSI or MSI-X
+static E1000E_RX_INTR_MASK: AtomicU32 = AtomicU32::new(E1000E_IMS_RX);
+
+// 收包的中断处理函数（NAPI）：屏蔽收包中断，由NET_RX软中断轮询网卡，轮询结束后再打开收包中断
+// 使用MSI时所有原因的中断都由这个函数处理
+// Rx interrupt handler (NAPI): mask receive interrupts and poll the nic in the NET_RX softirq, which unmasks them when done
+// all interrupt causes are handled here when MSI is used
 unsafe extern "C" fn e1000e_irq_handler(_irq_num: u64, _irq_paramer: u64, _regs: *mut pt_regs) {
-    poll_ifaces_try_lock_onetime().ok();
+    if let Some(interrupt_regs) = NonNull::new(E1000E_INTERRUPT_REGS.load(Ordering::Acquire)) {
+        volwrite!(
+            interrupt_regs,
+            imc,
+            E1000E_RX_INTR_MASK.load(Ordering::Relaxed)
+        );
+    }
+    net_rx_schedule();
+}
+
+// 发包的中断处理函数（MSI-X）：由NET_RX软中断回收已经发送完毕的descriptor
+// Tx interrupt handler (MSI-X): transmitted descriptors are reclaimed in the NET_RX softirq
+unsafe extern "C" fn e1000e_tx_irq_handler(_irq_num: u64, _irq_paramer: u64, _regs: *mut pt_regs) {
+    net_rx_schedule();
+}
+
+// 其他原因的中断处理函数（MSI-X），目前只有链路状态变化：清除ICR中的LSC，重新打开这个中断
+// Other-cause interrupt handler (MSI-X), currently only link status change: clear LSC in ICR and re-enable the interrupt
+unsafe extern "C" fn e1000e_other_irq_handler(
+    _irq_num: u64,
+    _irq_paramer: u64,
+    _regs: *mut pt_regs,
+) {
+    if let Some(interrupt_regs) = NonNull::new(E1000E_INTERRUPT_REGS.load(Ordering::Acquire)) {
+        volwrite!(interrupt_regs, icr, E1000E_IMS_LSC);
+        volwrite!(interrupt_regs, ims, E1000E_IMS_LSC | E1000E_IMS_OTHER);
+    }
 }
 
 #[allow(dead_code)]
@@ -174,6 +258,9 @@ pub struct E1000EDevice {
     tctl_regs: NonNull<TransmitCtrlRegs>,
     transimit_regs: NonNull<TransimitRegs>,
     pcie_regs: NonNull<PCIeRegs>,
+    // 屏蔽、打开收包中断时使用的IMS位
+    // IMS bits used to mask/unmask receive interrupts
+    rx_intr_mask: u32,
 
     // descriptor环形队列，在操作系统与设备之间共享
     // descriptor rings are shared between os and device
@@ -186,8 +273,22 @@ pub struct E1000EDevice {
     // buffers of receive/transmit packets
     recv_buffers: Vec<E1000EBuffer>,
     trans_buffers: Vec<E1000EBuffer>,
+    // 收发包缓冲区从这个池中取出，用完后放回，不需要为每个分组申请、释放DMA页
+    // receive/transmit buffers are recycled through this pool instead of allocating dma pages per packet
+    buffer_pool: Arc<DmaBufferPool>,
+    // 收发包的统计信息
+    // rx/tx statistics
+    stats: Arc<NetDevStats>,
     mac: [u8; 6],
     first_trans: bool,
+    // 发包队列的软件状态：下一个要使用的descriptor（即将写入TDT的值），最早的还没有回收的descriptor，
+    // 正在使用（已经放入队列、还没有回收）的descriptor数，以及其中还没有写入TDT的descriptor数
+    // software state of the transmit ring: next descriptor to use (the value TDT will get), oldest unreclaimed descriptor,
+    // descriptors in use (queued and not yet reclaimed), and how many of them have not been submitted through TDT
+    trans_tail: usize,
+    trans_clean: usize,
+    trans_used: usize,
+    trans_pending: usize,
     // napi队列，用于存放在中断关闭期间通过轮询收取的buffer
     // the napi queue is designed to save buffer/packet when the interrupt is close
     // NOTE: this feature is not completely implemented and not used in the current version
@@ -222,23 +323,39 @@ impl E1000EDevice {
             .ok_or(E1000EPciError::BarGetVaddrFailed)?
             .data() as u64;
 
-        // 初始化msi中断
-        // initialize msi interupt
-        let irq_vector = device.irq_vector_mut().unwrap();
-        irq_vector.push(E1000E_RECV_VECTOR);
-        device.irq_init(IRQ::PCI_IRQ_MSI).expect("IRQ Init Failed");
-        let msg = IrqMsg {
-            irq_common_message: IrqCommonMsg::init_from(
-                0,
-                "E1000E_RECV_IRQ",
-                0,
-                e1000e_irq_handler,
-                None,
-            ),
-            irq_specific_message: IrqSpecificMsg::msi_default(),
+        // 初始化中断：优先使用MSI-X，收包、发包和其他原因的中断投递到不同的cpu；否则使用一个MSI中断
+        // initialize interrupts: prefer MSI-X with rx, tx and other vectors on distinct cpus, fall back to a single MSI vector
+        let msix = matches!(
+            device.irq_init(IRQ::PCI_IRQ_MSIX),
+            Some(IrqType::Msix { irq_max_num, .. }) if irq_max_num >= E1000E_MSIX_VECTORS
+        );
+        let handlers: &[(&str, unsafe extern "C" fn(u64, u64, *mut pt_regs))] = if msix {
+            &[
+                ("E1000E_RX_IRQ", e1000e_irq_handler),
+                ("E1000E_TX_IRQ", e1000e_tx_irq_handler),
+                ("E1000E_OTHER_IRQ", e1000e_other_irq_handler),
+            ]
+        } else {
+            device.irq_init(IRQ::PCI_IRQ_MSI).expect("IRQ Init Failed");
+            &[("E1000E_RECV_IRQ", e1000e_irq_handler)]
         };
-        device.irq_install(msg)?;
+        let vectors = pci_irq_vector_alloc(handlers.len() as u16)
+            .ok_or(PciError::PciIrqError(PciIrqError::DeviceIrqOverflow))?;
+        device.irq_vector_mut().unwrap().extend(vectors);
+        for (index, (name, handler)) in handlers.iter().enumerate() {
+            let msg = IrqMsg {
+                irq_common_message: IrqCommonMsg::init_from(index as u16, name, 0, *handler, None),
+                irq_specific_message: IrqSpecificMsg::msi_affinity(pci_irq_affinity(index as u16)),
+            };
+            device.irq_install(msg)?;
+        }
         device.irq_enable(true)?;
+        let rx_intr_mask = if msix {
+            E1000E_IMS_RX_MSIX
+        } else {
+            E1000E_IMS_RX
+        };
+        E1000E_RX_INTR_MASK.store(rx_intr_mask, Ordering::Relaxed);
 
         let general_regs: NonNull<GeneralRegs> =
             get_register_ptr(vaddress, E1000E_GENERAL_REGS_OFFSET);
@@ -253,6 +370,8 @@ impl E1000EDevice {
         let transimit_regs: NonNull<TransimitRegs> =
             get_register_ptr(vaddress, E1000E_TRANSMIT_REGS_OFFSET);
         let pcie_regs: NonNull<PCIeRegs> = get_register_ptr(vaddress, E1000E_PCIE_REGS_OFFSET);
+        let rxcsum_regs: NonNull<ReceiveCsumRegs> =
+            get_register_ptr(vaddress, E1000E_RECEIVE_CSUM_REGS_OFFSET);
         let ra_regs: NonNull<ReceiveAddressRegs> =
             get_register_ptr(vaddress, E1000E_RECEIVE_ADDRESS_REGS_OFFSET);
         // 开始设备初始化 14.3
@@ -313,23 +432,24 @@ impl E1000EDevice {
 
         // 初始化receive和transmit packet的缓冲区
         // initialzie receive and transmit buffers
+        let buffer_pool = Arc::new(DmaBufferPool::new(E1000E_BUFFER_SIZE, E1000E_POOL_BUFFERS));
         let mut recv_buffers: Vec<E1000EBuffer> = Vec::with_capacity(recv_ring_length);
         let mut trans_buffers: Vec<E1000EBuffer> = Vec::with_capacity(trans_ring_length);
 
         // 初始化缓冲区与descriptor，descriptor 中的addr字典应当指向buffer的物理地址
         // Receive buffers of appropriate size should be allocated and pointers to these buffers should be stored in the descriptor ring.
         for i in 0..recv_ring_length {
-            let buffer = E1000EBuffer::new(PAGE_SIZE);
+            let buffer = E1000EBuffer::from_pool(&buffer_pool).unwrap();
             recv_desc_ring[i].addr = buffer.as_paddr() as u64;
             recv_desc_ring[i].status = 0;
             recv_buffers.push(buffer);
         }
-        // Same as receive buffers
+        // 发包的descriptor在发送时才指向buffer，初始时标记为已完成
+        // transmit descriptors get their buffers when a packet is sent, mark them as done initially
         for i in 0..trans_ring_length {
-            let buffer = E1000EBuffer::new(PAGE_SIZE);
-            trans_desc_ring[i].addr = buffer.as_paddr() as u64;
+            trans_desc_ring[i].addr = 0;
             trans_desc_ring[i].status = 1;
-            trans_buffers.push(buffer);
+            trans_buffers.push(E1000EBuffer::new(0));
         }
 
         // Receive Initialization 14.6
@@ -354,16 +474,19 @@ impl E1000EDevice {
             // Program the head and tail registers
             volwrite!(receive_regs, rdh0, 0);
             volwrite!(receive_regs, rdt0, (recv_ring_length - 1) as u32);
+            // 由网卡校验收到的IPv4首部以及TCP/UDP校验和
+            // let the nic verify ipv4 header and tcp/udp checksums of received packets
+            volwrite!(
+                rxcsum_regs,
+                rxcsum,
+                E1000E_RXCSUM_IPOFL | E1000E_RXCSUM_TUOFL
+            );
             // 设置控制寄存器的相关功能 14.6.1
             // Set the receive control register
             volwrite!(
                 rctl_regs,
                 rctl,
-                E1000E_RCTL_EN
-                    | E1000E_RCTL_BAM
-                    | E1000E_RCTL_BSIZE_4K
-                    | E1000E_RCTL_BSEX
-                    | E1000E_RCTL_SECRC
+                E1000E_RCTL_EN | E1000E_RCTL_BAM | E1000E_RCTL_BSIZE_2K | E1000E_RCTL_SECRC
             );
 
             // Transmit Initialization 14.7
@@ -396,14 +519,33 @@ impl E1000EDevice {
                 E1000E_TCTL_EN | E1000E_TCTL_PSP | E1000E_TCTL_CT_VAL | E1000E_TCTL_COLD_VAL
             );
 
+            if msix {
+                // 把收包队列0、发包队列0和其他原因分别映射到MSI-X表中的对应项 pp.309 IVAR
+                // map rx queue 0, tx queue 0 and other causes to their MSI-X table entries
+                volwrite!(
+                    interrupt_regs,
+                    ivar,
+                    (E1000E_IVAR_VALID | E1000E_MSIX_VECTOR_RX)
+                        | (E1000E_IVAR_VALID | E1000E_MSIX_VECTOR_TX) << 8
+                        | (E1000E_IVAR_VALID | E1000E_MSIX_VECTOR_OTHER) << 16
+                );
+                // 收发包队列的中断原因在产生MSI-X中断时自动清除
+                // rx/tx queue causes are cleared automatically when the MSI-X message is sent
+                volwrite!(interrupt_regs, eiac, E1000E_IMS_RXQ0 | E1000E_IMS_TXQ0);
+                let ctrl_ext = volread!(general_regs, ctrl_ext);
+                volwrite!(general_regs, ctrl_ext, ctrl_ext | E1000E_CTRL_EXT_PBA_CLR);
+            }
             let icr = volread!(interrupt_regs, icr);
             volwrite!(interrupt_regs, icr, icr);
-            // 开启收包相关的中断
-            // Enable receive interrupts
-            let mut ims = volread!(interrupt_regs, ims);
-            ims = E1000E_IMS_LSC | E1000E_IMS_RXT0 | E1000E_IMS_RXDMT0 | E1000E_IMS_OTHER;
+            // 开启收包相关的中断，MSI-X模式下还有发包中断
+            // Enable receive interrupts, and transmit interrupts in MSI-X mode
+            let mut ims = E1000E_IMS_LSC | E1000E_IMS_RXT0 | E1000E_IMS_RXDMT0 | E1000E_IMS_OTHER;
+            if msix {
+                ims |= E1000E_IMS_RXQ0 | E1000E_IMS_TXQ0;
+            }
             volwrite!(interrupt_regs, ims, ims);
         }
+        E1000E_INTERRUPT_REGS.store(interrupt_regs.as_ptr(), Ordering::Release);
         return Ok(E1000EDevice {
             general_regs,
             interrupt_regs,
@@ -412,14 +554,21 @@ impl E1000EDevice {
             tctl_regs,
             transimit_regs,
             pcie_regs,
+            rx_intr_mask,
             recv_desc_ring,
             trans_desc_ring,
             recv_ring_pa,
             trans_ring_pa,
             recv_buffers,
             trans_buffers,
+            buffer_pool,
+            stats: NetDevStats::new(),
             mac,
             first_trans: true,
+            trans_tail: 0,
+            trans_clean: 0,
+            trans_used: 0,
+            trans_pending: 0,
             napi_buffers: vec![E1000EBuffer::new(0); E1000E_RECV_NAPI],
             napi_buffer_head: 0,
             napi_buffer_tail: 0,
@@ -428,49 +577,149 @@ impl E1000EDevice {
     }
     pub fn e1000e_receive(&mut self) -> Option<E1000EBuffer> {
         self.e1000e_intr();
-        let mut rdt = unsafe { volread!(self.receive_regs, rdt0) } as usize;
-        let index = (rdt + 1) % self.recv_desc_ring.len();
-        let desc = &mut self.recv_desc_ring[index];
-        if (desc.status & E1000E_RXD_STATUS_DD) == 0 {
-            return None;
+        loop {
+            let rdt = unsafe { volread!(self.receive_regs, rdt0) } as usize;
+            let index = (rdt + 1) % self.recv_desc_ring.len();
+            let desc = &mut self.recv_desc_ring[index];
+            if (desc.status & E1000E_RXD_STATUS_DD) == 0 {
+                return None;
+            }
+            // 清除DD位，否则descriptor再次被检查时（网卡还没有写回）会被误认为收到了分组
+            // clear DD, otherwise the descriptor looks done again before the nic writes it back
+            let status = desc.status;
+            desc.status = 0;
+            // 网卡校验IP/TCP/UDP校验和失败：丢弃这个分组（协议栈不再检查这些校验和）
+            // the nic reports a bad ip/tcp/udp checksum: drop the packet (the stack no longer verifies these checksums)
+            if (status & E1000E_RXD_STATUS_IXSM) == 0
+                && (status & (E1000E_RXD_ERR_IPE | E1000E_RXD_ERR_TCPE)) != 0
+            {
+                self.stats.inc(NetDevCounter::RxErrors);
+                if (status & E1000E_RXD_ERR_IPE) != 0 {
+                    snmp_inc(SnmpCounter::IpInHdrErrors);
+                } else {
+                    let len = (desc.len as usize).min(self.recv_buffers[index].len());
+                    snmp_count_csum_error(&self.recv_buffers[index].as_slice()[..len]);
+                }
+                unsafe { volwrite!(self.receive_regs, rdt0, index as u32) };
+                continue;
+            }
+            let new_buffer = match E1000EBuffer::from_pool(&self.buffer_pool) {
+                Some(new_buffer) => new_buffer,
+                None => {
+                    // 池中没有空闲的缓冲区：丢弃这个分组，把原来的缓冲区还给网卡
+                    // the pool is exhausted: drop the packet and give the buffer back to the nic
+                    self.stats.inc(NetDevCounter::RxFifoErrors);
+                    unsafe { volwrite!(self.receive_regs, rdt0, index as u32) };
+                    continue;
+                }
+            };
+            let mut buffer = self.recv_buffers[index];
+            self.recv_buffers[index] = new_buffer;
+            desc.addr = new_buffer.as_paddr() as u64;
+            buffer.set_length(desc.len as usize);
+            self.stats.rx(buffer.as_slice());
+            unsafe { volwrite!(self.receive_regs, rdt0, index as u32) };
+            // kdebug!("e1000e: receive packet");
+            return Some(buffer);
         }
-        let mut buffer = self.recv_buffers[index];
-        let new_buffer = E1000EBuffer::new(PAGE_SIZE);
-        self.recv_buffers[index] = new_buffer;
-        desc.addr = new_buffer.as_paddr() as u64;
-        buffer.set_length(desc.len as usize);
-        rdt = index;
-        unsafe { volwrite!(self.receive_regs, rdt0, rdt as u32) };
-        // kdebug!("e1000e: receive packet");
-        return Some(buffer);
-    }
-
-    pub fn e1000e_can_transmit(&self) -> bool {
-        let tdt = unsafe { volread!(self.transimit_regs, tdt0) } as usize;
-        let index = tdt % self.trans_desc_ring.len();
-        let desc = &self.trans_desc_ring[index];
-        if (desc.status & E1000E_TXD_STATUS_DD) == 0 {
-            return false;
+    }
+
+    // 收发包缓冲区池。收到的buffer用完之后需要通过E1000EBuffer::recycle放回池中
+    // the buffer pool. received buffers must be returned with E1000EBuffer::recycle
+    pub fn buffer_pool(&self) -> Arc<DmaBufferPool> {
+        return self.buffer_pool.clone();
+    }
+
+    // 网卡的统计信息
+    // statistics of the nic
+    pub fn stats(&self) -> Arc<NetDevStats> {
+        return self.stats.clone();
+    }
+
+    // 发包队列中是否还有空闲的descriptor。队列看起来已满时，先批量回收已经发送完毕的descriptor
+    // 不读取网卡的寄存器，只检查内存中的descriptor
+    // whether a free transmit descriptor is available. reclaims completed descriptors in bulk when the ring looks full
+    // only descriptors in memory are checked, no register is read
+    pub fn e1000e_can_transmit(&mut self) -> bool {
+        // TDT == TDH表示队列为空，因此最多只能使用len - 1个descriptor
+        // TDT == TDH means an empty ring, so at most len - 1 descriptors can be used
+        if self.trans_used + 1 >= self.trans_desc_ring.len() {
+            self.e1000e_tx_reclaim();
         }
-        true
+        return self.trans_used + 1 < self.trans_desc_ring.len();
     }
 
-    pub fn e1000e_transmit(&mut self, packet: E1000EBuffer) {
-        let mut tdt = unsafe { volread!(self.transimit_regs, tdt0) } as usize;
-        let index = tdt % self.trans_desc_ring.len();
+    // 把一个分组放入发包队列。调用者需要先通过e1000e_can_transmit确认有空闲的descriptor
+    // 只有积累了E1000E_TX_BATCH个分组时才写入TDT寄存器，其余的由e1000e_tx_flush一次性提交
+    // queue a packet. the caller must check e1000e_can_transmit first
+    // TDT is written only once E1000E_TX_BATCH packets are pending, the rest are submitted together by e1000e_tx_flush
+    pub fn e1000e_transmit(&mut self, mut packet: E1000EBuffer) {
+        // 收包时一并交给协议栈的发包令牌没有检查过队列，队列已满时只能丢弃分组
+        // tx tokens handed out together with rx tokens were never checked, drop the packet if the ring is full
+        if unlikely(!self.e1000e_can_transmit()) {
+            self.stats.inc(NetDevCounter::TxFifoErrors);
+            packet.recycle(&self.buffer_pool);
+            return;
+        }
+        self.stats.tx(packet.as_slice());
+        let csum = e1000e_tx_csum_prepare(packet.as_mut_slice());
+        let index = self.trans_tail;
         let desc = &mut self.trans_desc_ring[index];
-        let buffer = self.trans_buffers[index];
         self.trans_buffers[index] = packet;
-        // recycle unused transmit buffer
-        buffer.free_buffer();
         // Set the transmit descriptor
         desc.addr = packet.as_paddr() as u64;
         desc.len = packet.len() as u16;
         desc.status = 0;
         desc.cmd = E1000E_TXD_CMD_EOP | E1000E_TXD_CMD_RS | E1000E_TXD_CMD_IFCS;
-        tdt = (tdt + 1) % self.trans_desc_ring.len();
-        unsafe { volwrite!(self.transimit_regs, tdt0, tdt as u32) };
+        match csum {
+            Some((css, cso)) => {
+                desc.css = css;
+                desc.cso = cso;
+                desc.cmd |= E1000E_TXD_CMD_IC;
+            }
+            None => {
+                desc.css = 0;
+                desc.cso = 0;
+            }
+        }
+        self.trans_tail = (index + 1) % self.trans_desc_ring.len();
+        self.trans_used += 1;
+        self.trans_pending += 1;
         self.first_trans = false;
+        if self.trans_pending >= E1000E_TX_BATCH {
+            self.e1000e_tx_flush();
+        }
+    }
+
+    // 把已经放入发包队列、还没有提交给网卡的分组一次性提交（只写一次TDT寄存器）
+    // submit all queued packets to the nic with a single TDT write
+    pub fn e1000e_tx_flush(&mut self) {
+        if self.trans_pending == 0 {
+            return;
+        }
+        // 网卡读取descriptor之前，对descriptor的写入必须已经完成
+        // descriptor writes must be complete before the nic is told to read them
+        compiler_fence(Ordering::Release);
+        unsafe { volwrite!(self.transimit_regs, tdt0, self.trans_tail as u32) };
+        self.trans_pending = 0;
+    }
+
+    // 从最早提交的descriptor开始，回收所有DD位已经被网卡置位的descriptor的buffer
+    // reclaim buffers of all descriptors whose DD bit has been set by the nic, starting from the oldest
+    pub fn e1000e_tx_reclaim(&mut self) -> usize {
+        let mut reclaimed = 0;
+        while self.trans_used > self.trans_pending {
+            let index = self.trans_clean;
+            if (self.trans_desc_ring[index].status & E1000E_TXD_STATUS_DD) == 0 {
+                break;
+            }
+            let buffer = core::mem::replace(&mut self.trans_buffers[index], E1000EBuffer::new(0));
+            buffer.recycle(&self.buffer_pool);
+            self.trans_clean = (index + 1) % self.trans_desc_ring.len();
+            self.trans_used -= 1;
+            reclaimed += 1;
+        }
+        return reclaimed;
     }
     pub fn mac_address(&self) -> [u8; 6] {
         return self.mac;
@@ -483,6 +732,14 @@ impl E1000EDevice {
         unsafe { volwrite!(self.interrupt_regs, icr, icr) };
     }
 
+    // 打开收包中断。IMS寄存器写入1b的位被置位，写入0b的位不变，因此不需要读取
+    // 如果屏蔽期间又有分组到达（ICR中对应的位被置位），网卡会立即产生一次中断
+    // unmask receive interrupts. writing 1b to IMS sets the bit and 0b has no effect.
+    // if packets arrived while masked, the nic raises an interrupt immediately
+    pub fn e1000e_rx_intr_enable(&mut self) {
+        unsafe { volwrite!(self.interrupt_regs, ims, self.rx_intr_mask) };
+    }
+
     // 切换是否接受分组到达的中断
     // change whether the receive timer interrupt is enabled
     // Note: this method is not completely implemented and not used in the current version
@@ -563,13 +820,13 @@ impl Drop for E1000EDevice {
         let recv_ring_length = PAGE_SIZE / size_of::<E1000ERecvDesc>();
         let trans_ring_length = PAGE_SIZE / size_of::<E1000ETransDesc>();
         unsafe {
-            // 释放所有buffer中的dma页
-            // free all dma pages in buffers
+            // 把所有buffer放回池中，池被释放时归还dma页
+            // return all buffers to the pool, which frees the dma pages when dropped
             for i in 0..recv_ring_length {
-                self.recv_buffers[i].free_buffer();
+                self.recv_buffers[i].recycle(&self.buffer_pool);
             }
             for i in 0..trans_ring_length {
-                self.trans_buffers[i].free_buffer();
+                self.trans_buffers[i].recycle(&self.buffer_pool);
             }
             // 释放descriptor ring
             // free descriptor ring
@@ -649,6 +906,9 @@ struct InterruptRegs {
     ims: Volatile<u32>, //0x000d0
     ims_align: ReadOnly<u32>, //0x000d4
     imc: WriteOnly<u32>, //0x000d8
+    eiac: Volatile<u32>, //0x000dc
+    iam: Volatile<u32>, //0x000e0
+    ivar: Volatile<u32>, //0x000e4
 }
 // 收包功能控制
 struct ReceiveCtrlRegs {
@@ -699,6 +959,11 @@ struct ReceiveAddressRegs {
     ral0: Volatile<u32>, //0x05400
     rah0: Volatile<u32>, //0x05404
 }
+// 收包校验和控制
+// receive checksum control
+struct ReceiveCsumRegs {
+    rxcsum: Volatile<u32>, //0x05000
+}
 // PCIe 通用控制
 struct PCIeRegs {
     gcr: Volatile<u32>, //0x05b00
@@ -720,6 +985,7 @@ const E1000E_RECEIVE_REGS_OFFSET: u64 = 0x02800;
 const E1000E_TRANSMIT_CTRL_REG_OFFSET: u64 = 0x00400;
 const E1000E_TRANSMIT_REGS_OFFSET: u64 = 0x03800;
 const E1000E_RECEIVE_ADDRESS_REGS_OFFSET: u64 = 0x05400;
+const E1000E_RECEIVE_CSUM_REGS_OFFSET: u64 = 0x05000;
 const E1000E_PCIE_REGS_OFFSET: u64 = 0x05b00;
 const E1000E_MTA_REGS_START_OFFSET: u64 = 0x05200;
 const E1000E_MTA_REGS_END_OFFSET: u64 = 0x053fc;
@@ -741,17 +1007,26 @@ const E1000E_IMS_RXDMT0: u32 = 1 << 4;
 #[allow(dead_code)]
 const E1000E_IMS_RXO: u32 = 1 << 6;
 const E1000E_IMS_RXT0: u32 = 1 << 7;
-#[allow(dead_code)]
 const E1000E_IMS_RXQ0: u32 = 1 << 20;
+const E1000E_IMS_TXQ0: u32 = 1 << 22;
 const E1000E_IMS_OTHER: u32 = 1 << 24; // qemu use this bit to set msi-x interrupt
 
+// IVAR
+const E1000E_IVAR_VALID: u32 = 1 << 3;
+
+// CTRL_EXT
+const E1000E_CTRL_EXT_PBA_CLR: u32 = 1 << 31;
+
 // IMC
 const E1000E_IMC_CLEAR: u32 = 0xffffffff;
 
 // RCTL
 const E1000E_RCTL_EN: u32 = 1 << 1;
 const E1000E_RCTL_BAM: u32 = 1 << 15;
+#[allow(dead_code)]
 const E1000E_RCTL_BSIZE_4K: u32 = 3 << 16;
+const E1000E_RCTL_BSIZE_2K: u32 = 0 << 16;
+#[allow(dead_code)]
 const E1000E_RCTL_BSEX: u32 = 1 << 25;
 const E1000E_RCTL_SECRC: u32 = 1 << 26;
 
@@ -769,14 +1044,102 @@ const E1000E_TIPG_IPGR1: u32 = 2 << 10;
 const E1000E_TIPG_IPGR2: u32 = 10 << 20;
 
 // RxDescriptorStatus
+// E1000ERecvDesc的status字段的高8位是descriptor的errors字段
+// the high byte of the status field of E1000ERecvDesc is the errors field of the descriptor
 const E1000E_RXD_STATUS_DD: u16 = 1 << 0;
+const E1000E_RXD_STATUS_IXSM: u16 = 1 << 2;
+const E1000E_RXD_ERR_TCPE: u16 = 1 << (8 + 5);
+const E1000E_RXD_ERR_IPE: u16 = 1 << (8 + 6);
+
+// RXCSUM 13.3.32
+const E1000E_RXCSUM_IPOFL: u32 = 1 << 8;
+const E1000E_RXCSUM_TUOFL: u32 = 1 << 9;
 
 // TxDescriptorStatus
 const E1000E_TXD_STATUS_DD: u8 = 1 << 0;
 const E1000E_TXD_CMD_EOP: u8 = 1 << 0;
 const E1000E_TXD_CMD_IFCS: u8 = 1 << 1;
+const E1000E_TXD_CMD_IC: u8 = 1 << 2;
 const E1000E_TXD_CMD_RS: u8 = 1 << 3;
 
+const ETHERNET_HEADER_LEN: usize = 14;
+const ETHERTYPE_IPV4: u16 = 0x0800;
+const ETHERTYPE_IPV6: u16 = 0x86dd;
+const IP_PROTOCOL_TCP: u8 = 6;
+// TCP头部中校验和字段的偏移
+// offset of the checksum field in the tcp header
+const TCP_CHECKSUM_OFFSET: usize = 16;
+
+// 把data按照大端序的16位字累加到反码和sum中（不折叠进位）
+// add data to the ones' complement sum as big-endian 16-bit words (carries are not folded)
+fn csum_add(mut sum: u32, data: &[u8]) -> u32 {
+    let mut chunks = data.chunks_exact(2);
+    for word in &mut chunks {
+        sum += u16::from_be_bytes([word[0], word[1]]) as u32;
+    }
+    if let [last] = chunks.remainder() {
+        sum += (*last as u32) << 8;
+    }
+    return sum;
+}
+
+fn csum_fold(mut sum: u32) -> u16 {
+    while (sum >> 16) != 0 {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return sum as u16;
+}
+
+// 为TCP校验和卸载做准备：协议栈不计算TCP校验和，这里把伪首部的反码和写入TCP的校验和字段，
+// 网卡从CSS开始计算到分组末尾的反码和，取反后写入CSO处，得到完整的校验和
+// 返回(CSS, CSO)，不是TCP分组时返回None（其他协议的校验和仍然由协议栈计算）
+// prepare tcp checksum offload: the stack leaves the tcp checksum zero, so the pseudo-header sum is written to the
+// checksum field. the nic sums from CSS to the end of the packet and inserts the complement at CSO.
+// returns (CSS, CSO), or None if this is not a tcp packet (checksums of other protocols are still computed by the stack)
+fn e1000e_tx_csum_prepare(packet: &mut [u8]) -> Option<(u8, u8)> {
+    if packet.len() < ETHERNET_HEADER_LEN {
+        return None;
+    }
+    let ethertype = u16::from_be_bytes([packet[12], packet[13]]);
+    let ip = &packet[ETHERNET_HEADER_LEN..];
+    let (l4_offset, pseudo_sum) = match ethertype {
+        ETHERTYPE_IPV4 => {
+            if ip.len() < 20 || ip[9] != IP_PROTOCOL_TCP {
+                return None;
+            }
+            let ihl = ((ip[0] & 0x0f) as usize) * 4;
+            let total_len = u16::from_be_bytes([ip[2], ip[3]]) as usize;
+            if ihl < 20 || total_len < ihl || total_len > ip.len() {
+                return None;
+            }
+            let sum = csum_add(0, &ip[12..20]);
+            let sum = sum + IP_PROTOCOL_TCP as u32 + (total_len - ihl) as u32;
+            (ETHERNET_HEADER_LEN + ihl, sum)
+        }
+        ETHERTYPE_IPV6 => {
+            // 协议栈发出的TCP分组不带扩展首部
+            // tcp packets from the stack carry no extension headers
+            if ip.len() < 40 || ip[6] != IP_PROTOCOL_TCP {
+                return None;
+            }
+            let payload_len = u16::from_be_bytes([ip[4], ip[5]]) as usize;
+            if 40 + payload_len > ip.len() {
+                return None;
+            }
+            let sum = csum_add(0, &ip[8..40]);
+            let sum = sum + IP_PROTOCOL_TCP as u32 + payload_len as u32;
+            (ETHERNET_HEADER_LEN + 40, sum)
+        }
+        _ => return None,
+    };
+    let csum_offset = l4_offset + TCP_CHECKSUM_OFFSET;
+    if csum_offset + 2 > packet.len() {
+        return None;
+    }
+    packet[csum_offset..csum_offset + 2].copy_from_slice(&csum_fold(pseudo_sum).to_be_bytes());
+    return Some((l4_offset as u8, csum_offset as u8));
+}
+
 // E1000E驱动初始化过程中可能的错误
 pub enum E1000EPciError {
     // 获取到错误类型的BAR（IO BAR）
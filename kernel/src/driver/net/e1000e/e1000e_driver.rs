@@ -6,11 +6,16 @@ use crate::{
             device::{bus::Bus, driver::Driver, Device, IdTable},
             kobject::{KObjType, KObject, KObjectState},
         },
-        net::NetDriver,
+        net::{dma::DmaBufferPool, sysfs::netdev_sysfs_register, transmit_raw_frame, NetDriver},
     },
     kinfo,
-    libs::spinlock::SpinLock,
-    net::{generate_iface_id, NET_DRIVERS},
+    libs::{rand::get_random_u64, spinlock::SpinLock},
+    net::{
+        generate_iface_id,
+        packet::PacketTap,
+        stats::{NetDevCounter, NetDevStats},
+        NET_DRIVERS,
+    },
     syscall::SystemError,
     time::Instant,
 };
@@ -24,7 +29,8 @@ use smoltcp::{phy, wire};
 
 use super::e1000e::{E1000EBuffer, E1000EDevice};
 
-pub struct E1000ERxToken(E1000EBuffer);
+/// 收到的分组。被使用或者被丢弃时，buffer都会被放回网卡的缓冲区池
+pub struct E1000ERxToken(E1000EBuffer, Arc<DmaBufferPool>);
 pub struct E1000ETxToken {
     driver: E1000EDriver,
 }
@@ -66,6 +72,7 @@ pub struct E1000EInterface {
     driver: E1000EDriverWrapper,
     iface_id: usize,
     iface: SpinLock<smoltcp::iface::Interface>,
+    stats: Arc<NetDevStats>,
     name: String,
 }
 impl phy::RxToken for E1000ERxToken {
@@ -74,21 +81,44 @@ impl phy::RxToken for E1000ERxToken {
         F: FnOnce(&mut [u8]) -> R,
     {
         let result = f(&mut self.0.as_mut_slice());
-        self.0.free_buffer();
         return result;
     }
 }
 
+impl Drop for E1000ERxToken {
+    fn drop(&mut self) {
+        self.0.recycle(&self.1);
+    }
+}
+
 impl phy::TxToken for E1000ETxToken {
-    fn consume<R, F>(self, _len: usize, f: F) -> R
+    fn consume<R, F>(self, len: usize, f: F) -> R
     where
         F: FnOnce(&mut [u8]) -> R,
     {
-        let mut buffer = E1000EBuffer::new(4096);
+        let pool = self.driver.inner.lock().buffer_pool();
+        let mut buffer = match E1000EBuffer::from_pool(&pool) {
+            Some(buffer) if len <= buffer.len() => buffer,
+            other => {
+                // 池中没有空闲的缓冲区（或者分组过长）：仍然需要调用f，但是丢弃这个分组
+                // the pool is exhausted (or the packet is too long): f must still be called, but the packet is dropped
+                if let Some(buffer) = other {
+                    buffer.recycle(&pool);
+                }
+                self.driver
+                    .inner
+                    .lock()
+                    .stats()
+                    .inc(NetDevCounter::TxDropped);
+                let mut scratch = vec![0u8; len];
+                return f(&mut scratch);
+            }
+        };
+        buffer.set_length(len);
         let result = f(buffer.as_mut_slice());
-        let mut device = self.driver.inner.lock();
-        device.e1000e_transmit(buffer);
-        buffer.free_buffer();
+        // 发送完毕之后，buffer由网卡在复用这个descriptor时放回池中
+        // the buffer is returned to the pool when its descriptor is reused
+        self.driver.inner.lock().e1000e_transmit(buffer);
         return result;
     }
 }
@@ -97,9 +127,8 @@ impl E1000EDriver {
     pub fn new(device: E1000EDevice) -> Self {
         let mut iface_config = smoltcp::iface::Config::new();
 
-        // todo: 随机设定这个值。
         // 参见 https://docs.rs/smoltcp/latest/smoltcp/iface/struct.Config.html#structfield.random_seed
-        iface_config.random_seed = 12345;
+        iface_config.random_seed = get_random_u64();
 
         iface_config.hardware_addr = Some(wire::HardwareAddress::Ethernet(
             smoltcp::wire::EthernetAddress(device.mac_address()),
@@ -127,9 +156,10 @@ impl phy::Device for E1000EDriver {
         &mut self,
         _timestamp: smoltcp::time::Instant,
     ) -> Option<(Self::RxToken<'_>, Self::TxToken<'_>)> {
-        match self.inner.lock().e1000e_receive() {
+        let mut device = self.inner.lock();
+        match device.e1000e_receive() {
             Some(buffer) => Some((
-                E1000ERxToken(buffer),
+                E1000ERxToken(buffer, device.buffer_pool()),
                 E1000ETxToken {
                     driver: self.clone(),
                 },
@@ -161,6 +191,12 @@ impl phy::Device for E1000EDriver {
            If None, there is no fixed limit on burst size, e.g. if network buffers are dynamically allocated.
         */
         caps.max_burst_size = Some(1);
+        // 网卡校验收到的IPv4/TCP/UDP校验和（校验失败的分组在驱动中丢弃），并为发出的TCP分组插入校验和
+        // the nic verifies ipv4/tcp/udp checksums on receive (bad packets are dropped by the driver)
+        // and inserts the checksum of outgoing tcp packets
+        caps.checksum.ipv4 = phy::Checksum::Tx;
+        caps.checksum.tcp = phy::Checksum::None;
+        caps.checksum.udp = phy::Checksum::Tx;
         return caps;
     }
 }
@@ -170,20 +206,21 @@ impl E1000EInterface {
         let iface_id = generate_iface_id();
         let mut iface_config = smoltcp::iface::Config::new();
 
-        // todo: 随机设定这个值。
         // 参见 https://docs.rs/smoltcp/latest/smoltcp/iface/struct.Config.html#structfield.random_seed
-        iface_config.random_seed = 12345;
+        iface_config.random_seed = get_random_u64();
 
         iface_config.hardware_addr = Some(wire::HardwareAddress::Ethernet(
             smoltcp::wire::EthernetAddress(driver.inner.lock().mac_address()),
         ));
         let iface = smoltcp::iface::Interface::new(iface_config, &mut driver);
 
+        let stats = driver.inner.lock().stats();
         let driver: E1000EDriverWrapper = E1000EDriverWrapper(UnsafeCell::new(driver));
         let result = Arc::new(E1000EInterface {
             driver,
             iface_id,
             iface: SpinLock::new(iface),
+            stats,
             name: format!("eth{}", iface_id),
         });
 
@@ -266,7 +303,19 @@ impl NetDriver for E1000EInterface {
     ) -> Result<(), crate::syscall::SystemError> {
         let timestamp: smoltcp::time::Instant = Instant::now().into();
         let mut guard = self.iface.lock();
-        let poll_res = guard.poll(timestamp, self.driver.force_get_mut(), sockets);
+        let poll_res = guard.poll(
+            timestamp,
+            &mut PacketTap::new(self.driver.force_get_mut(), self.iface_id),
+            sockets,
+        );
+        drop(guard);
+        let mut device = self.driver.inner.lock();
+        // 一次性提交这一轮轮询中放入发包队列的分组，并批量回收已经发送完毕的descriptor
+        device.e1000e_tx_flush();
+        device.e1000e_tx_reclaim();
+        // 收包队列已经处理完，重新打开在中断处理函数中屏蔽的收包中断
+        device.e1000e_rx_intr_enable();
+        drop(device);
         if poll_res {
             return Ok(());
         }
@@ -277,6 +326,20 @@ impl NetDriver for E1000EInterface {
     fn inner_iface(&self) -> &SpinLock<smoltcp::iface::Interface> {
         return &self.iface;
     }
+
+    fn transmit_frame(&self, frame: &[u8]) -> Result<(), SystemError> {
+        let guard = self.iface.lock();
+        let res = transmit_raw_frame(self.driver.force_get_mut(), frame);
+        drop(guard);
+        let mut device = self.driver.inner.lock();
+        device.e1000e_tx_flush();
+        device.e1000e_tx_reclaim();
+        return res;
+    }
+
+    fn stats(&self) -> Option<Arc<NetDevStats>> {
+        return Some(self.stats.clone());
+    }
 }
 
 impl KObject for E1000EInterface {
@@ -347,5 +410,6 @@ pub fn e1000e_driver_init(device: E1000EDevice) {
     let iface = E1000EInterface::new(driver);
     // 将网卡的接口信息注册到全局的网卡接口信息表中
     NET_DRIVERS.write().insert(iface.nic_id(), iface.clone());
+    netdev_sysfs_register(&iface.name);
     kinfo!("e1000e driver init successfully!\tMAC: [{}]", mac);
 }
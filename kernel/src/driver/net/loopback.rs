@@ -0,0 +1,283 @@
+//! 环回网络接口（lo）
+//!
+//! 发出的分组不经过任何硬件，直接放入接口自己的接收队列：发包令牌生成的缓冲区原样交给收包令牌，
+//! 不需要DMA，也不需要复制。所有网卡共用同一个SocketSet，smoltcp在轮询某个接口时会尝试发出所有socket的分组，
+//! 因此环回接口总是最先被轮询：发往127.0.0.0/8、::1的分组在这里发出，
+//! 发往其他地址的分组在环回接口上没有路由，会留在socket中，由之后轮询的网卡发出。
+
+use alloc::{collections::VecDeque, string::String, sync::Arc, vec::Vec};
+use smoltcp::{
+    phy,
+    wire::{self, EthernetAddress},
+};
+
+use crate::{
+    driver::base::{
+        device::{bus::Bus, driver::Driver, Device, IdTable},
+        kobject::{KObjType, KObject, KObjectState},
+    },
+    libs::spinlock::SpinLock,
+    net::stats::NetDevStats,
+    syscall::SystemError,
+    time::Instant,
+};
+
+use super::NetDriver;
+
+/// 环回接口的最大传输单元（包括以太网头部）
+const LOOPBACK_MTU: usize = 65535;
+/// 接收队列中最多积压的分组数量，超过时smoltcp会暂停发送
+const LOOPBACK_QUEUE_LEN: usize = 256;
+
+lazy_static! {
+    /// 环回接口。它不在NET_DRIVERS中，由poll_ifaces在轮询其他网卡之前单独轮询
+    pub static ref LOOPBACK_IFACE: Arc<LoopbackInterface> = LoopbackInterface::new();
+}
+
+/// 环回设备：发出的分组进入接收队列的末尾
+#[derive(Debug)]
+struct LoopbackDevice {
+    queue: VecDeque<Vec<u8>>,
+    /// 每个分组在发出的同时也被收到，因此收发的计数总是相同
+    stats: Arc<NetDevStats>,
+}
+
+struct LoopbackRxToken(Vec<u8>);
+
+struct LoopbackTxToken<'a>(&'a mut VecDeque<Vec<u8>>, &'a NetDevStats);
+
+impl phy::RxToken for LoopbackRxToken {
+    fn consume<R, F>(mut self, f: F) -> R
+    where
+        F: FnOnce(&mut [u8]) -> R,
+    {
+        return f(&mut self.0);
+    }
+}
+
+impl<'a> phy::TxToken for LoopbackTxToken<'a> {
+    fn consume<R, F>(self, len: usize, f: F) -> R
+    where
+        F: FnOnce(&mut [u8]) -> R,
+    {
+        let mut buffer = vec![0u8; len];
+        let result = f(&mut buffer);
+        self.1.tx(&buffer);
+        self.1.rx(&buffer);
+        self.0.push_back(buffer);
+        return result;
+    }
+}
+
+impl phy::Device for LoopbackDevice {
+    type RxToken<'a>
+        = LoopbackRxToken
+    where
+        Self: 'a;
+    type TxToken<'a>
+        = LoopbackTxToken<'a>
+    where
+        Self: 'a;
+
+    fn receive(
+        &mut self,
+        _timestamp: smoltcp::time::Instant,
+    ) -> Option<(Self::RxToken<'_>, Self::TxToken<'_>)> {
+        let buffer = self.queue.pop_front()?;
+        return Some((
+            LoopbackRxToken(buffer),
+            LoopbackTxToken(&mut self.queue, &self.stats),
+        ));
+    }
+
+    fn transmit(&mut self, _timestamp: smoltcp::time::Instant) -> Option<Self::TxToken<'_>> {
+        if self.queue.len() >= LOOPBACK_QUEUE_LEN {
+            return None;
+        }
+        return Some(LoopbackTxToken(&mut self.queue, &self.stats));
+    }
+
+    fn capabilities(&self) -> phy::DeviceCapabilities {
+        let mut caps = phy::DeviceCapabilities::default();
+        caps.max_transmission_unit = LOOPBACK_MTU;
+        caps.max_burst_size = Some(LOOPBACK_QUEUE_LEN);
+        // 分组只在内存中传递，不会损坏，因此不计算也不检查校验和
+        caps.checksum.ipv4 = phy::Checksum::None;
+        caps.checksum.udp = phy::Checksum::None;
+        caps.checksum.tcp = phy::Checksum::None;
+        caps.checksum.icmpv4 = phy::Checksum::None;
+        caps.checksum.icmpv6 = phy::Checksum::None;
+        return caps;
+    }
+}
+
+pub struct LoopbackInterface {
+    iface: SpinLock<smoltcp::iface::Interface>,
+    device: SpinLock<LoopbackDevice>,
+    stats: Arc<NetDevStats>,
+    name: String,
+}
+
+impl core::fmt::Debug for LoopbackInterface {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        f.debug_struct("LoopbackInterface")
+            .field("iface", &"smoltcp::iface::Interface")
+            .field("name", &self.name)
+            .finish()
+    }
+}
+
+impl LoopbackInterface {
+    fn new() -> Arc<Self> {
+        let mut device = LoopbackDevice {
+            queue: VecDeque::new(),
+            stats: NetDevStats::new(),
+        };
+        let mut iface_config = smoltcp::iface::Config::new();
+        iface_config.hardware_addr = Some(wire::HardwareAddress::Ethernet(EthernetAddress([
+            0x02, 0x00, 0x00, 0x00, 0x00, 0x01,
+        ])));
+        let mut iface = smoltcp::iface::Interface::new(iface_config, &mut device);
+        iface.update_ip_addrs(|addrs| {
+            addrs
+                .push(wire::IpCidr::new(wire::IpAddress::v4(127, 0, 0, 1), 8))
+                .expect("Push ipCidr failed: full");
+            addrs
+                .push(wire::IpCidr::new(
+                    wire::IpAddress::v6(0, 0, 0, 0, 0, 0, 0, 1),
+                    128,
+                ))
+                .expect("Push ipCidr failed: full");
+        });
+        return Arc::new(Self {
+            iface: SpinLock::new(iface),
+            stats: device.stats.clone(),
+            device: SpinLock::new(device),
+            name: String::from("lo"),
+        });
+    }
+}
+
+impl Driver for LoopbackInterface {
+    fn id_table(&self) -> Option<IdTable> {
+        todo!()
+    }
+
+    fn add_device(&self, _device: Arc<dyn Device>) {
+        todo!()
+    }
+
+    fn delete_device(&self, _device: &Arc<dyn Device>) {
+        todo!()
+    }
+
+    fn devices(&self) -> alloc::vec::Vec<Arc<dyn Device>> {
+        todo!()
+    }
+
+    fn bus(&self) -> Option<Arc<dyn Bus>> {
+        todo!()
+    }
+
+    fn set_bus(&self, _bus: Option<Arc<dyn Bus>>) {
+        todo!()
+    }
+}
+
+impl NetDriver for LoopbackInterface {
+    fn mac(&self) -> EthernetAddress {
+        return EthernetAddress([0x02, 0x00, 0x00, 0x00, 0x00, 0x01]);
+    }
+
+    #[inline]
+    fn nic_id(&self) -> usize {
+        return usize::MAX;
+    }
+
+    #[inline]
+    fn name(&self) -> String {
+        return self.name.clone();
+    }
+
+    /// 环回接口的地址是固定的
+    fn update_ip_addrs(&self, _ip_addrs: &[wire::IpCidr]) -> Result<(), SystemError> {
+        return Err(SystemError::EPERM);
+    }
+
+    fn poll(&self, sockets: &mut smoltcp::iface::SocketSet) -> Result<(), SystemError> {
+        let timestamp: smoltcp::time::Instant = Instant::now().into();
+        let mut iface = self.iface.lock();
+        let mut device = self.device.lock();
+        if iface.poll(timestamp, &mut *device, sockets) {
+            return Ok(());
+        }
+        return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
+    }
+
+    #[inline(always)]
+    fn inner_iface(&self) -> &SpinLock<smoltcp::iface::Interface> {
+        return &self.iface;
+    }
+
+    fn stats(&self) -> Option<Arc<NetDevStats>> {
+        return Some(self.stats.clone());
+    }
+}
+
+impl KObject for LoopbackInterface {
+    fn as_any_ref(&self) -> &dyn core::any::Any {
+        self
+    }
+
+    fn set_inode(&self, _inode: Option<Arc<crate::filesystem::kernfs::KernFSInode>>) {
+        todo!()
+    }
+
+    fn inode(&self) -> Option<Arc<crate::filesystem::kernfs::KernFSInode>> {
+        todo!()
+    }
+
+    fn parent(&self) -> Option<alloc::sync::Weak<dyn KObject>> {
+        todo!()
+    }
+
+    fn set_parent(&self, _parent: Option<alloc::sync::Weak<dyn KObject>>) {
+        todo!()
+    }
+
+    fn kset(&self) -> Option<Arc<crate::driver::base::kset::KSet>> {
+        todo!()
+    }
+
+    fn set_kset(&self, _kset: Option<Arc<crate::driver::base::kset::KSet>>) {
+        todo!()
+    }
+
+    fn kobj_type(&self) -> Option<&'static dyn KObjType> {
+        todo!()
+    }
+
+    fn name(&self) -> String {
+        self.name.clone()
+    }
+
+    fn set_name(&self, _name: String) {
+        todo!()
+    }
+
+    fn kobj_state(&self) -> crate::libs::rwlock::RwLockReadGuard<KObjectState> {
+        todo!()
+    }
+
+    fn kobj_state_mut(&self) -> crate::libs::rwlock::RwLockWriteGuard<KObjectState> {
+        todo!()
+    }
+
+    fn set_kobj_state(&self, _state: KObjectState) {
+        todo!()
+    }
+
+    fn set_kobj_type(&self, _ktype: Option<&'static dyn KObjType>) {
+        todo!()
+    }
+}
@@ -1,15 +1,20 @@
-use alloc::string::String;
+use alloc::{string::String, sync::Arc};
 use smoltcp::{
     iface,
+    phy::{self, TxToken},
     wire::{self, EthernetAddress},
 };
 
-use crate::{libs::spinlock::SpinLock, syscall::SystemError};
+use crate::{
+    libs::spinlock::SpinLock, net::stats::NetDevStats, syscall::SystemError, time::Instant,
+};
 
 use super::base::device::driver::Driver;
 
 mod dma;
 pub mod e1000e;
+pub mod loopback;
+pub mod sysfs;
 pub mod virtio_net;
 
 pub trait NetDriver: Driver {
@@ -28,4 +33,29 @@ pub trait NetDriver: Driver {
     /// @brief 获取smoltcp的网卡接口类型
     fn inner_iface(&self) -> &SpinLock<smoltcp::iface::Interface>;
     // fn as_any_ref(&'static self) -> &'static dyn core::any::Any;
+
+    /// @brief 绕过协议栈，直接发送一个完整的以太网帧（供AF_PACKET socket使用）
+    fn transmit_frame(&self, _frame: &[u8]) -> Result<(), SystemError> {
+        return Err(SystemError::EOPNOTSUPP_OR_ENOTSUP);
+    }
+
+    /// @brief 获取网卡的统计信息，不统计的网卡返回None
+    fn stats(&self) -> Option<Arc<NetDevStats>> {
+        return None;
+    }
+}
+
+/// @brief 通过smoltcp设备`device`发送一个完整的以太网帧
+///
+/// 调用者需要持有网卡接口的锁，避免与协议栈同时使用设备
+pub fn transmit_raw_frame<D: phy::Device>(device: &mut D, frame: &[u8]) -> Result<(), SystemError> {
+    let caps = device.capabilities();
+    if frame.len() > caps.max_transmission_unit {
+        return Err(SystemError::EMSGSIZE);
+    }
+    let token = device
+        .transmit(Instant::now().into())
+        .ok_or(SystemError::ENOBUFS)?;
+    token.consume(frame.len(), |buffer| buffer.copy_from_slice(frame));
+    return Ok(());
 }
@@ -0,0 +1,105 @@
+//! 网卡在sysfs中的目录：`/sys/class/net/<网卡>/statistics/`
+//!
+//! 每个属性文件对应[`NetDevCounter`]中的一个计数器，名字与Linux相同
+
+use alloc::{string::ToString, sync::Arc};
+
+use crate::{
+    driver::base::{class::sys_class_kset, kobject::KObject, kset::KSet},
+    filesystem::{
+        sysfs::{file::sysfs_emit_str, sysfs_instance, Attribute, AttributeGroup, SysFSOpsSupport},
+        vfs::syscall::ModeType,
+    },
+    kwarn,
+    libs::spinlock::SpinLock,
+    net::stats::{net_device_by_name, NetDevCounter},
+    syscall::SystemError,
+};
+
+/// `/sys/class/net`的kset，第一个网卡注册时创建
+static NET_CLASS_KSET: SpinLock<Option<Arc<KSet>>> = SpinLock::new(None);
+
+fn net_class_kset() -> Result<Arc<KSet>, SystemError> {
+    let mut guard = NET_CLASS_KSET.lock();
+    if let Some(kset) = guard.as_ref() {
+        return Ok(kset.clone());
+    }
+    let kset = KSet::new("net".to_string());
+    kset.register(Some(sys_class_kset()))?;
+    *guard = Some(kset.clone());
+    return Ok(kset);
+}
+
+/// 在sysfs中为名为`name`的网卡创建目录以及统计信息的属性文件
+///
+/// 失败时只打印警告，不影响网卡的使用
+pub fn netdev_sysfs_register(name: &str) {
+    let r = net_class_kset().and_then(|class| {
+        let kset = KSet::new(name.to_string());
+        kset.register(Some(class))?;
+        let kobj = kset as Arc<dyn KObject>;
+        return sysfs_instance().create_groups(&kobj, &[&NetDevStatisticsGroup]);
+    });
+    if let Err(e) = r {
+        kwarn!("Failed to create sysfs entries for net device '{name}': {e:?}");
+    }
+}
+
+#[derive(Debug)]
+struct NetDevStatisticsGroup;
+
+impl AttributeGroup for NetDevStatisticsGroup {
+    fn name(&self) -> Option<&str> {
+        Some("statistics")
+    }
+
+    fn attrs(&self) -> &[&'static dyn Attribute] {
+        return &[
+            &NetDevStatAttr("rx_packets", NetDevCounter::RxPackets),
+            &NetDevStatAttr("rx_bytes", NetDevCounter::RxBytes),
+            &NetDevStatAttr("rx_errors", NetDevCounter::RxErrors),
+            &NetDevStatAttr("rx_dropped", NetDevCounter::RxDropped),
+            &NetDevStatAttr("rx_fifo_errors", NetDevCounter::RxFifoErrors),
+            &NetDevStatAttr("multicast", NetDevCounter::RxMulticast),
+            &NetDevStatAttr("tx_packets", NetDevCounter::TxPackets),
+            &NetDevStatAttr("tx_bytes", NetDevCounter::TxBytes),
+            &NetDevStatAttr("tx_errors", NetDevCounter::TxErrors),
+            &NetDevStatAttr("tx_dropped", NetDevCounter::TxDropped),
+            &NetDevStatAttr("tx_fifo_errors", NetDevCounter::TxFifoErrors),
+        ];
+    }
+
+    fn is_visible(
+        &self,
+        _kobj: Arc<dyn KObject>,
+        attr: &'static dyn Attribute,
+    ) -> Option<ModeType> {
+        return Some(attr.mode());
+    }
+}
+
+/// `statistics`目录下的一个属性文件：(文件名, 计数器)
+#[derive(Debug)]
+struct NetDevStatAttr(&'static str, NetDevCounter);
+
+impl Attribute for NetDevStatAttr {
+    fn name(&self) -> &str {
+        self.0
+    }
+
+    fn mode(&self) -> ModeType {
+        return ModeType::from_bits_truncate(0o444);
+    }
+
+    fn support(&self) -> SysFSOpsSupport {
+        return SysFSOpsSupport::SHOW;
+    }
+
+    /// `kobj`是网卡的目录，它的名字就是网卡的名字
+    fn show(&self, kobj: Arc<dyn KObject>, buf: &mut [u8]) -> Result<usize, SystemError> {
+        let stats = net_device_by_name(&kobj.name())
+            .and_then(|dev| dev.stats())
+            .ok_or(SystemError::ENODEV)?;
+        return sysfs_emit_str(buf, &format!("{}\n", stats.get(self.1)));
+    }
+}
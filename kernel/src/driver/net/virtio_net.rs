@@ -17,23 +17,40 @@ use crate::{
         virtio::virtio_impl::HalImpl,
     },
     kerror, kinfo,
-    libs::spinlock::SpinLock,
-    net::{generate_iface_id, NET_DRIVERS},
+    libs::{rand::get_random_u64, spinlock::SpinLock},
+    net::{
+        generate_iface_id,
+        packet::PacketTap,
+        stats::{NetDevCounter, NetDevStats},
+        NET_DRIVERS,
+    },
     syscall::SystemError,
     time::Instant,
 };
 
-use super::NetDriver;
+use super::{sysfs::netdev_sysfs_register, transmit_raw_frame, NetDriver};
+
+/// virtio-net 收发队列的深度（必须是2的幂，并且不超过设备支持的最大深度）
+///
+/// 队列过浅时，每次只能有很少的报文在途，吞吐量会被往返延迟限制住
+const VIRTIO_NET_QUEUE_SIZE: usize = 256;
+/// 每个接收缓冲区的大小，需要能够容纳virtio-net头部以及一个完整的以太网帧
+const VIRTIO_NET_RX_BUFFER_SIZE: usize = 2048;
+
+type VirtIONetDevice<T> = VirtIONet<HalImpl, T, VIRTIO_NET_QUEUE_SIZE>;
 
 /// @brief Virtio网络设备驱动(加锁)
 pub struct VirtioNICDriver<T: Transport> {
-    pub inner: Arc<SpinLock<VirtIONet<HalImpl, T, 2>>>,
+    pub inner: Arc<SpinLock<VirtIONetDevice<T>>>,
+    /// 收发包的统计信息
+    stats: Arc<NetDevStats>,
 }
 
 impl<T: Transport> Clone for VirtioNICDriver<T> {
     fn clone(&self) -> Self {
         return VirtioNICDriver {
             inner: self.inner.clone(),
+            stats: self.stats.clone(),
         };
     }
 }
@@ -92,9 +109,8 @@ impl<T: Transport> VirtioInterface<T> {
         let iface_id = generate_iface_id();
         let mut iface_config = smoltcp::iface::Config::new();
 
-        // todo: 随机设定这个值。
         // 参见 https://docs.rs/smoltcp/latest/smoltcp/iface/struct.Config.html#structfield.random_seed
-        iface_config.random_seed = 12345;
+        iface_config.random_seed = get_random_u64();
 
         iface_config.hardware_addr = Some(wire::HardwareAddress::Ethernet(
             smoltcp::wire::EthernetAddress(driver.inner.lock().mac_address()),
@@ -114,19 +130,21 @@ impl<T: Transport> VirtioInterface<T> {
 }
 
 impl<T: 'static + Transport> VirtioNICDriver<T> {
-    pub fn new(driver_net: VirtIONet<HalImpl, T, 2>) -> Self {
+    pub fn new(driver_net: VirtIONetDevice<T>) -> Self {
         let mut iface_config = smoltcp::iface::Config::new();
 
-        // todo: 随机设定这个值。
         // 参见 https://docs.rs/smoltcp/latest/smoltcp/iface/struct.Config.html#structfield.random_seed
-        iface_config.random_seed = 12345;
+        iface_config.random_seed = get_random_u64();
 
         iface_config.hardware_addr = Some(wire::HardwareAddress::Ethernet(
             smoltcp::wire::EthernetAddress(driver_net.mac_address()),
         ));
 
-        let inner: Arc<SpinLock<VirtIONet<HalImpl, T, 2>>> = Arc::new(SpinLock::new(driver_net));
-        let result = VirtioNICDriver { inner };
+        let inner: Arc<SpinLock<VirtIONetDevice<T>>> = Arc::new(SpinLock::new(driver_net));
+        let result = VirtioNICDriver {
+            inner,
+            stats: NetDevStats::new(),
+        };
         return result;
     }
 }
@@ -170,6 +188,7 @@ impl<T: Transport> phy::Device for VirtioNICDriver<T> {
             return Some(VirtioNetToken::new(self.clone(), None));
         } else {
             // kdebug!("VirtioNet: can not send");
+            self.stats.inc(NetDevCounter::TxFifoErrors);
             return None;
         }
     }
@@ -183,7 +202,7 @@ impl<T: Transport> phy::Device for VirtioNICDriver<T> {
            The network device is unable to send or receive bursts large than the value returned by this function.
            If None, there is no fixed limit on burst size, e.g. if network buffers are dynamically allocated.
         */
-        caps.max_burst_size = Some(1);
+        caps.max_burst_size = Some(VIRTIO_NET_QUEUE_SIZE);
         return caps;
     }
 }
@@ -198,6 +217,7 @@ impl<T: Transport> phy::TxToken for VirtioNetToken<T> {
         let mut driver_net = self.driver.inner.lock();
         let mut tx_buf = driver_net.new_tx_buffer(len);
         let result = f(tx_buf.packet_mut());
+        self.driver.stats.tx(tx_buf.packet_mut());
         driver_net.send(tx_buf).expect("virtio_net send failed");
         return result;
     }
@@ -210,6 +230,7 @@ impl<T: Transport> phy::RxToken for VirtioNetToken<T> {
     {
         // 为了线程安全，这里需要对VirtioNet进行加【写锁】，以保证对设备的互斥访问。
         let mut rx_buf = self.rx_buffer.unwrap();
+        self.driver.stats.rx(rx_buf.packet_mut());
         let result = f(rx_buf.packet_mut());
         self.driver
             .inner
@@ -222,8 +243,8 @@ impl<T: Transport> phy::RxToken for VirtioNetToken<T> {
 
 /// @brief virtio-net 驱动的初始化与测试
 pub fn virtio_net<T: Transport + 'static>(transport: T) {
-    let driver_net: VirtIONet<HalImpl, T, 2> =
-        match VirtIONet::<HalImpl, T, 2>::new(transport, 4096) {
+    let driver_net: VirtIONetDevice<T> =
+        match VirtIONetDevice::<T>::new(transport, VIRTIO_NET_RX_BUFFER_SIZE) {
             Ok(net) => net,
             Err(_) => {
                 kerror!("VirtIONet init failed");
@@ -236,6 +257,7 @@ pub fn virtio_net<T: Transport + 'static>(transport: T) {
     let name = iface.name.clone();
     // 将网卡的接口信息注册到全局的网卡接口信息表中
     NET_DRIVERS.write().insert(iface.nic_id(), iface.clone());
+    netdev_sysfs_register(&name);
     kinfo!(
         "Virtio-net driver init successfully!\tNetDevID: [{}], MAC: [{}]",
         name,
@@ -308,7 +330,11 @@ impl<T: Transport + 'static> NetDriver for VirtioInterface<T> {
     ) -> Result<(), crate::syscall::SystemError> {
         let timestamp: smoltcp::time::Instant = Instant::now().into();
         let mut guard = self.iface.lock();
-        let poll_res = guard.poll(timestamp, self.driver.force_get_mut(), sockets);
+        let poll_res = guard.poll(
+            timestamp,
+            &mut PacketTap::new(self.driver.force_get_mut(), self.iface_id),
+            sockets,
+        );
         // todo: notify!!!
         // kdebug!("Virtio Interface poll:{poll_res}");
         if poll_res {
@@ -321,6 +347,15 @@ impl<T: Transport + 'static> NetDriver for VirtioInterface<T> {
     fn inner_iface(&self) -> &SpinLock<smoltcp::iface::Interface> {
         return &self.iface;
     }
+
+    fn transmit_frame(&self, frame: &[u8]) -> Result<(), SystemError> {
+        let _guard = self.iface.lock();
+        return transmit_raw_frame(self.driver.force_get_mut(), frame);
+    }
+
+    fn stats(&self) -> Option<Arc<NetDevStats>> {
+        return Some(self.driver.stats.clone());
+    }
     // fn as_any_ref(&'static self) -> &'static dyn core::any::Any {
     //     return self;
     // }
@@ -29,7 +29,7 @@ uint16_t c_irq_install(ul irq_num, void (*pci_irq_handler)(ul irq_num, ul parame
     // 由于为I/O APIC分配的中断向量号是从32开始的，因此要减去32才是对应的interrupt_desc的元素
     irq_desc_t *p = NULL;
     hardware_intr_controller *pci_interrupt_controller = NULL;
-    if (irq_num >= 32 && irq_num < 0x80)
+    if (irq_num >= 32 && irq_num < 32 + IRQ_NUM)
         p = &interrupt_desc[irq_num - 32];
     else if (irq_num >= 150 && irq_num < 200)
         p = &local_apic_interrupt_desc[irq_num - 150];
@@ -72,7 +72,7 @@ void c_irq_uninstall(ul irq_num)
 {
     // 由于为I/O APIC分配的中断向量号是从32开始的，因此要减去32才是对应的interrupt_desc的元素
     irq_desc_t *p = NULL;
-    if (irq_num >= 32 && irq_num < 0x80)
+    if (irq_num >= 32 && irq_num < 32 + IRQ_NUM)
         p = &interrupt_desc[irq_num - 32];
     else if (irq_num >= 150 && irq_num < 200)
         p = &local_apic_interrupt_desc[irq_num - 150];
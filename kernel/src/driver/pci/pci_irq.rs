@@ -2,18 +2,83 @@
 
 use core::mem::size_of;
 use core::ptr::NonNull;
+use core::sync::atomic::{AtomicU32, Ordering};
 
 use alloc::ffi::CString;
+use alloc::sync::Arc;
 use alloc::vec::Vec;
 
-use super::pci::{PciDeviceStructure, PciDeviceStructureGeneralDevice, PciError};
+use super::pci::{
+    BusDeviceFunction, PciDeviceStructure, PciDeviceStructureGeneralDevice, PciError,
+};
 use crate::arch::msi::{ia64_pci_get_arch_msi_message_address, ia64_pci_get_arch_msi_message_data};
 use crate::arch::{PciArch, TraitPciArch};
+use crate::exception::irqdesc::{irq_affinity_register, irq_affinity_unregister, IrqAffinityChip};
 use crate::include::bindings::bindings::{
-    c_irq_install, c_irq_uninstall, pt_regs, ul, EAGAIN, EINVAL,
+    c_irq_install, c_irq_uninstall, pt_regs, smp_get_total_cpu, ul, EAGAIN, EINVAL,
 };
 
 use crate::libs::volatile::{volread, volwrite, Volatile};
+use crate::syscall::SystemError;
+
+/// 动态分配给PCI设备MSI/MSI-X中断的向量号范围：[PCI_IRQ_VECTOR_BASE, PCI_IRQ_VECTOR_END)
+///
+/// 与exception/irq.h中的中断向量表保持一致
+pub const PCI_IRQ_VECTOR_BASE: u16 = 56;
+pub const PCI_IRQ_VECTOR_END: u16 = 80;
+
+/// 已经分配的中断向量号，第i位对应向量号PCI_IRQ_VECTOR_BASE + i
+static PCI_IRQ_VECTOR_BITMAP: AtomicU32 = AtomicU32::new(0);
+
+/// @brief 分配num个连续的中断向量号，起始向量号相对于PCI_IRQ_VECTOR_BASE按num向上取整到2的幂对齐
+///
+/// MSI的多个中断必须连续且对齐，MSI-X没有这个要求，但是连续分配也不影响使用
+/// @return 成功返回分配的向量号，没有足够的空闲向量号时返回None
+pub fn pci_irq_vector_alloc(num: u16) -> Option<Vec<u16>> {
+    let total = (PCI_IRQ_VECTOR_END - PCI_IRQ_VECTOR_BASE) as u32;
+    if num == 0 || num as u32 > total {
+        return None;
+    }
+    let align = (num as u32).next_power_of_two();
+    let mask = (1u32 << num) - 1;
+    let mut bitmap = PCI_IRQ_VECTOR_BITMAP.load(Ordering::Relaxed);
+    loop {
+        let start = (0..=total - num as u32)
+            .step_by(align as usize)
+            .find(|start| bitmap & (mask << start) == 0)?;
+        match PCI_IRQ_VECTOR_BITMAP.compare_exchange_weak(
+            bitmap,
+            bitmap | (mask << start),
+            Ordering::AcqRel,
+            Ordering::Relaxed,
+        ) {
+            Ok(_) => {
+                return Some(
+                    (0..num)
+                        .map(|i| PCI_IRQ_VECTOR_BASE + start as u16 + i)
+                        .collect(),
+                )
+            }
+            Err(current) => bitmap = current,
+        }
+    }
+}
+
+/// @brief 释放pci_irq_vector_alloc分配的中断向量号
+pub fn pci_irq_vector_free(vectors: &[u16]) {
+    for &vector in vectors {
+        if (PCI_IRQ_VECTOR_BASE..PCI_IRQ_VECTOR_END).contains(&vector) {
+            PCI_IRQ_VECTOR_BITMAP
+                .fetch_and(!(1u32 << (vector - PCI_IRQ_VECTOR_BASE)), Ordering::AcqRel);
+        }
+    }
+}
+
+/// @brief 第index个中断应当投递到的cpu：按照中断的序号轮流分配到各个cpu上，使多个队列的中断分散到不同的核心
+pub fn pci_irq_affinity(index: u16) -> u16 {
+    let nr_cpus = unsafe { smp_get_total_cpu() }.max(1);
+    return (index as u32 % nr_cpus) as u16;
+}
 
 /// MSIX表的一项
 #[repr(C)]
@@ -24,6 +89,59 @@ struct MsixEntry {
     vector_control: Volatile<u32>,
 }
 
+/// 通过MSI Capability中的Message Address修改中断的目标cpu
+///
+/// 同一个设备的多个MSI中断共用一个Message Address，修改其中一个会同时迁移全部中断
+#[derive(Debug)]
+struct PciMsiAffinityChip {
+    bus_device_function: BusDeviceFunction,
+    cap_offset: u8,
+}
+
+impl IrqAffinityChip for PciMsiAffinityChip {
+    fn name(&self) -> &str {
+        "PCI-MSI"
+    }
+
+    fn set_target(&self, _vector: u8, cpu: u32) -> Result<(), SystemError> {
+        PciArch::write_config(
+            &self.bus_device_function,
+            self.cap_offset + 4,
+            ia64_pci_get_arch_msi_message_address(cpu as u16),
+        );
+        return Ok(());
+    }
+}
+
+/// 通过MSI-X表项中的Message Address修改中断的目标cpu
+#[derive(Debug)]
+struct PciMsixAffinityChip {
+    /// MSI-X表项的虚拟地址
+    entry: usize,
+}
+
+impl IrqAffinityChip for PciMsixAffinityChip {
+    fn name(&self) -> &str {
+        "PCI-MSIX"
+    }
+
+    fn set_target(&self, _vector: u8, cpu: u32) -> Result<(), SystemError> {
+        let msix_entry = NonNull::new(self.entry as *mut MsixEntry).unwrap();
+        // 修改地址期间屏蔽这个中断，之后恢复原来的屏蔽状态
+        unsafe {
+            let control = volread!(msix_entry, vector_control);
+            volwrite!(msix_entry, vector_control, control | 1);
+            volwrite!(
+                msix_entry,
+                msg_addr,
+                ia64_pci_get_arch_msi_message_address(cpu as u16)
+            );
+            volwrite!(msix_entry, vector_control, control);
+        }
+        return Ok(());
+    }
+}
+
 /// Pending表的一项
 #[repr(C)]
 struct PendingEntry {
@@ -119,6 +237,14 @@ impl IrqSpecificMsg {
             trigger_mode: TriggerMode::EdgeTrigger,
         }
     }
+
+    /// 投递到指定cpu的边沿触发MSI/MSI-X中断
+    pub fn msi_affinity(processor: u16) -> Self {
+        IrqSpecificMsg::Msi {
+            processor,
+            trigger_mode: TriggerMode::EdgeTrigger,
+        }
+    }
 }
 
 // 申请中断的触发模式，MSI默认为边沿触发
@@ -293,9 +419,9 @@ pub trait PciInterrupt: PciDeviceStructure {
         }
         return Err(PciError::PciIrqError(PciIrqError::PciDeviceNotSupportIrq));
     }
-    /// @brief 获取指定数量的中断号 todo 需要中断重构支持
-    fn irq_alloc(_num: u16) -> Option<Vec<u16>> {
-        None
+    /// @brief 获取指定数量的中断号，分配的中断号需要由设备放入irq_vector中
+    fn irq_alloc(num: u16) -> Option<Vec<u16>> {
+        pci_irq_vector_alloc(num)
     }
     /// @brief 进行PCI设备中断的安装
     /// @param self PCI设备的可变引用
@@ -303,7 +429,7 @@ pub trait PciInterrupt: PciDeviceStructure {
     /// @return 一切正常返回Ok(0),有错误返回对应错误原因
     fn irq_install(&mut self, msg: IrqMsg) -> Result<u8, PciError> {
         if let Some(irq_vector) = self.irq_vector_mut() {
-            if msg.irq_common_message.irq_index as usize > irq_vector.len() {
+            if msg.irq_common_message.irq_index as usize >= irq_vector.len() {
                 return Err(PciError::PciIrqError(PciIrqError::InvalidIrqIndex(
                     msg.irq_common_message.irq_index,
                 )));
@@ -370,14 +496,18 @@ pub trait PciInterrupt: PciDeviceStructure {
                     }
                     //MSI中断只需配置一次PCI寄存器
                     if common_msg.irq_index == 0 {
-                        let msg_address = ia64_pci_get_arch_msi_message_address(0);
-                        let trigger = match msg.irq_specific_message {
+                        let (processor, trigger) = match msg.irq_specific_message {
                             IrqSpecificMsg::Legacy => {
                                 return Err(PciError::PciIrqError(PciIrqError::IrqTypeUnmatch));
                             }
-                            IrqSpecificMsg::Msi { trigger_mode, .. } => trigger_mode,
+                            IrqSpecificMsg::Msi {
+                                processor,
+                                trigger_mode,
+                            } => (processor, trigger_mode),
                         };
-                        let msg_data = ia64_pci_get_arch_msi_message_data(irq_num, 0, trigger);
+                        let msg_address = ia64_pci_get_arch_msi_message_address(processor);
+                        let msg_data =
+                            ia64_pci_get_arch_msi_message_data(irq_num, processor, trigger);
                         //写入Message Data和Message Address
                         if address_64 {
                             PciArch::write_config(
@@ -466,6 +596,20 @@ pub trait PciInterrupt: PciDeviceStructure {
                             }
                         }
                     }
+                    // 多个MSI中断共用同一个目标cpu，只有单个中断时才参与中断均衡
+                    let bus_device_function = self.common_header().bus_device_function;
+                    let target =
+                        (PciArch::read_config(&bus_device_function, cap_offset + 4) >> 12) & 0xff;
+                    let balance = self.irq_vector_mut().unwrap().len() == 1;
+                    irq_affinity_register(
+                        irq_num as u8,
+                        Arc::new(PciMsiAffinityChip {
+                            bus_device_function,
+                            cap_offset,
+                        }),
+                        target,
+                        balance,
+                    );
                     return Ok(0);
                 }
                 IrqType::Unused => {
@@ -518,14 +662,18 @@ pub trait PciInterrupt: PciDeviceStructure {
                         _ => {}
                     }
 
-                    let msg_address = ia64_pci_get_arch_msi_message_address(0);
-                    let trigger = match msg.irq_specific_message {
+                    // 每个MSI-X中断可以投递到不同的cpu
+                    let (processor, trigger) = match msg.irq_specific_message {
                         IrqSpecificMsg::Legacy => {
                             return Err(PciError::PciIrqError(PciIrqError::IrqTypeUnmatch));
                         }
-                        IrqSpecificMsg::Msi { trigger_mode, .. } => trigger_mode,
+                        IrqSpecificMsg::Msi {
+                            processor,
+                            trigger_mode,
+                        } => (processor, trigger_mode),
                     };
-                    let msg_data = ia64_pci_get_arch_msi_message_data(irq_num, 0, trigger);
+                    let msg_address = ia64_pci_get_arch_msi_message_address(processor);
+                    let msg_data = ia64_pci_get_arch_msi_message_data(irq_num, processor, trigger);
                     //写入Message Data和Message Address
                     let pcistandardbar = self
                         .bar()
@@ -538,12 +686,22 @@ pub trait PciInterrupt: PciDeviceStructure {
                         + msg.irq_common_message.irq_index as usize * size_of::<MsixEntry>();
                     let msix_entry = NonNull::new(vaddr.data() as *mut MsixEntry).unwrap();
                     // 这里的操作并不适用于所有架构，需要再优化，msg_upper_data并不一定为0
+                    // 修改表项期间屏蔽这个中断，避免设备使用只写了一半的地址和数据
                     unsafe {
-                        volwrite!(msix_entry, vector_control, 0);
+                        volwrite!(msix_entry, vector_control, 1);
                         volwrite!(msix_entry, msg_data, msg_data);
                         volwrite!(msix_entry, msg_upper_addr, 0);
                         volwrite!(msix_entry, msg_addr, msg_address);
+                        volwrite!(msix_entry, vector_control, 0);
                     }
+                    irq_affinity_register(
+                        irq_num as u8,
+                        Arc::new(PciMsixAffinityChip {
+                            entry: vaddr.data(),
+                        }),
+                        processor as u32,
+                        true,
+                    );
                     return Ok(0);
                 }
                 IrqType::Unused => {
@@ -589,10 +747,13 @@ pub trait PciInterrupt: PciDeviceStructure {
                     ..
                 } => {
                     for vector in self.irq_vector_mut().unwrap() {
+                        irq_affinity_unregister(*vector as u8);
                         unsafe {
                             c_irq_uninstall(vector.clone() as u64);
                         }
                     }
+                    pci_irq_vector_free(self.irq_vector_mut().unwrap());
+                    self.irq_vector_mut().unwrap().clear();
                     PciArch::write_config(&self.common_header().bus_device_function, cap_offset, 0);
                     PciArch::write_config(
                         &self.common_header().bus_device_function,
@@ -636,10 +797,13 @@ pub trait PciInterrupt: PciDeviceStructure {
                     ..
                 } => {
                     for vector in self.irq_vector_mut().unwrap() {
+                        irq_affinity_unregister(*vector as u8);
                         unsafe {
                             c_irq_uninstall(vector.clone() as u64);
                         }
                     }
+                    pci_irq_vector_free(self.irq_vector_mut().unwrap());
+                    self.irq_vector_mut().unwrap().clear();
                     PciArch::write_config(&self.common_header().bus_device_function, cap_offset, 0);
                     let pcistandardbar = self
                         .bar()
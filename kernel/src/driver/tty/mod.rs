@@ -1,16 +1,18 @@
-use core::intrinsics::unlikely;
-
-use alloc::string::String;
+use alloc::{string::String, sync::Arc, vec::Vec};
 
 use kdepends::thingbuf::mpsc::{
     self,
     errors::{TryRecvError, TrySendError},
 };
 
-use crate::libs::rwlock::RwLock;
+use crate::libs::{rwlock::RwLock, wait_queue::WaitQueue};
+
+use self::n_tty::{NTty, N_TTY_BUF_SIZE};
 
 pub mod init;
+pub mod n_tty;
 pub mod serial;
+pub mod tty_buffer;
 pub mod tty_device;
 pub mod tty_driver;
 
@@ -45,16 +47,15 @@ pub struct TtyFilePrivateData {
 /// - stdin：连接到一个活动进程的stdin文件描述符
 /// - stdout：连接到多个进程的stdout文件描述符
 /// - stderr：连接到多个进程的stdout文件描述符
-/// - 输入端口：向tty设备输入数据的接口。输入到该接口的数据，将被导向stdin接口。
+/// - 输入端口：向tty设备输入数据的接口。输入到该接口的数据，经过线路规程（N_TTY）处理后导向stdin接口。
 ///     如果开启了回显，那么，数据也将同时被导向输出端
 /// - 输出端口：tty设备对外输出数据的端口。从stdout、stderr输入的数据，将会被导向此端口。
 ///             此端口可以连接到屏幕、文件、或者是另一个tty core的输入端口。如果开启了
 ///             输入数据回显，那么，输入端口的数据，将会被同时导向此端口，以及stdin端口
 #[derive(Debug)]
 struct TtyCore {
-    /// stdin的mpsc队列输入输出端
-    stdin_rx: mpsc::Receiver<u8>,
-    stdin_tx: mpsc::Sender<u8>,
+    /// 线路规程，它的读缓冲区就是stdin
+    ldisc: NTty,
     /// 输出的mpsc队列输入输出端
     output_rx: mpsc::Receiver<u8>,
     output_tx: mpsc::Sender<u8>,
@@ -82,39 +83,45 @@ pub enum TtyError {
 
 impl TtyCore {
     // 各个缓冲区的大小
-    pub const STDIN_BUF_SIZE: usize = 4096;
+    pub const STDIN_BUF_SIZE: usize = N_TTY_BUF_SIZE;
     pub const OUTPUT_BUF_SIZE: usize = 4096;
 
     /// @brief 创建一个TTY核心组件
     pub fn new() -> TtyCore {
-        let (stdin_tx, stdin_rx) = mpsc::channel::<u8>(Self::STDIN_BUF_SIZE);
         let (output_tx, output_rx) = mpsc::channel::<u8>(Self::OUTPUT_BUF_SIZE);
         let state: RwLock<TtyCoreState> = RwLock::new(TtyCoreState { bits: 0 });
 
         return TtyCore {
-            stdin_rx,
-            stdin_tx,
+            ldisc: NTty::new(),
             output_rx,
             output_tx,
             state,
         };
     }
 
-    /// @brief 向tty的输入端口输入数据
+    /// @brief 把一批输入数据交给线路规程处理
     ///
     /// @param buf 输入数据
     ///
-    /// @param block 是否允许阻塞
-    ///
-    /// @return Ok(成功传送的字节数)
+    /// @return Ok((线路规程接收的字节数, 是否有数据被回显到输出缓冲区))
     /// @return Err(TtyError) 内部错误信息
-    pub fn input(&self, buf: &[u8], block: bool) -> Result<usize, TtyError> {
-        let val = self.write_stdin(buf, block)?;
+    pub fn receive_buf(&self, buf: &[u8]) -> Result<(usize, bool), TtyError> {
         // 如果开启了输入回显，那么就写一份到输出缓冲区
         if self.echo_enabled() {
-            self.write_output(&buf[0..val], true)?;
+            let mut echo = Vec::new();
+            let val = self.ldisc.receive_buf(buf, Some(&mut echo));
+            if !echo.is_empty() {
+                self.write_output(&echo, true)?;
+            }
+            return Ok((val, !echo.is_empty()));
         }
-        return Ok(val);
+        return Ok((self.ldisc.receive_buf(buf, None), false));
+    }
+
+    /// 线路规程还可以接收的字节数
+    #[inline]
+    pub fn receive_room(&self) -> usize {
+        return self.ldisc.receive_room();
     }
 
     /// @brief 从tty的输出端口读出数据
@@ -157,73 +164,21 @@ impl TtyCore {
     ///
     /// @return Ok(成功读取的字节数)
     /// @return Err(TtyError) 内部错误信息
+    #[inline]
     pub fn read_stdin(&self, buf: &mut [u8], block: bool) -> Result<usize, TtyError> {
-        // TODO: 增加对EOF的处理
-        let mut cnt = 0;
-        while cnt < buf.len() {
-            let val: Result<mpsc::RecvRef<u8>, TryRecvError> = self.stdin_rx.try_recv_ref();
-            if let Err(err) = val {
-                match err {
-                    TryRecvError::Closed => return Err(TtyError::Closed),
-                    TryRecvError::Empty => {
-                        if block {
-                            continue;
-                        } else {
-                            return Ok(cnt);
-                        }
-                    }
-                    _ => return Err(TtyError::Unknown(format!("{err:?}"))),
-                }
-            } else {
-                let x = *val.unwrap();
-                buf[cnt] = x;
-                cnt += 1;
-
-                if unlikely(self.stdin_should_return(x)) {
-                    return Ok(cnt);
-                }
-            }
-        }
-        return Ok(cnt);
+        return self.ldisc.read(buf, block);
     }
 
-    fn stdin_should_return(&self, c: u8) -> bool {
-        // 如果是换行符或者是ctrl+d，那么就应该返回
-        return c == b'\n' || c == 4;
+    /// stdin缓冲区中是否有数据可以读取
+    #[inline]
+    pub fn stdin_readable(&self) -> bool {
+        return self.ldisc.readable();
     }
 
-    /// @brief 向stdin缓冲区内写入数据
-    ///
-    /// @param buf 输入缓冲区
-    ///
-    /// @param block 当缓冲区满的时候，是否阻塞
-    ///
-    /// @return Ok(成功传送的字节数)
-    /// @return Err(BufferFull(成功传送的字节数)) 缓冲区满，成功传送的字节数
-    /// @return Err(TtyError) 内部错误信息
-    fn write_stdin(&self, buf: &[u8], block: bool) -> Result<usize, TtyError> {
-        let mut cnt = 0;
-        while cnt < buf.len() {
-            let r: Result<mpsc::SendRef<u8>, TrySendError> = self.stdin_tx.try_send_ref();
-            if let Err(e) = r {
-                match e {
-                    TrySendError::Closed(_) => return Err(TtyError::Closed),
-                    TrySendError::Full(_) => {
-                        if block {
-                            continue;
-                        } else {
-                            return Err(TtyError::BufferFull(cnt));
-                        }
-                    }
-                    _ => return Err(TtyError::Unknown(format!("{e:?}"))),
-                }
-            } else {
-                *r.unwrap() = buf[cnt];
-                cnt += 1;
-            }
-        }
-
-        return Ok(cnt);
+    /// 等待stdin有数据可读的等待队列
+    #[inline]
+    pub fn stdin_wait_queue(&self) -> &Arc<WaitQueue> {
+        return self.ldisc.read_wait_queue();
     }
 
     /// @brief 读取TTY的output缓冲区
@@ -0,0 +1,240 @@
+//! N_TTY线路规程
+//!
+//! 从flip缓冲区成批地接收数据：在一次加锁中完成换行符转换、规范模式（行编辑）的处理以及回显数据的收集，
+//! 每一批数据只唤醒一次读者。
+
+use core::fmt::Debug;
+
+use alloc::{collections::VecDeque, sync::Arc, vec::Vec};
+
+use crate::{
+    libs::{spinlock::SpinLock, wait_queue::WaitQueue},
+    process::ProcessManager,
+};
+
+use super::TtyError;
+
+/// 读缓冲区的大小
+pub const N_TTY_BUF_SIZE: usize = 4096;
+
+// 规范模式下的控制字符（与Linux termios的默认值相同）
+/// 删除一个字符（DEL）
+const VERASE: u8 = 0x7f;
+/// 删除一个字符（退格）
+const VERASE_BS: u8 = 0x08;
+/// 删除整行（ctrl+u）
+const VKILL: u8 = 0x15;
+/// 文件结束（ctrl+d）
+const VEOF: u8 = 0x04;
+
+pub struct NTty {
+    data: SpinLock<NTtyData>,
+    /// 等待有数据可读的读者（read、poll、epoll）
+    read_wait: Arc<WaitQueue>,
+}
+
+struct NTtyData {
+    /// 可以被读取的数据。规范模式下只包含已经结束的行
+    read_buf: VecDeque<u8>,
+    /// 规范模式下正在编辑、还没有结束的行
+    line: Vec<u8>,
+    /// 规范模式（ICANON）
+    icanon: bool,
+    /// 把输入的'\r'转换为'\n'（ICRNL）
+    icrnl: bool,
+}
+
+impl NTty {
+    pub fn new() -> Self {
+        return Self {
+            data: SpinLock::new(NTtyData {
+                read_buf: VecDeque::with_capacity(N_TTY_BUF_SIZE),
+                line: Vec::new(),
+                icanon: false,
+                icrnl: true,
+            }),
+            read_wait: Arc::new(WaitQueue::INIT),
+        };
+    }
+
+    /// 还可以接收的字节数
+    pub fn receive_room(&self) -> usize {
+        return self.data.lock_irqsave().room();
+    }
+
+    /// 接收一批数据
+    ///
+    /// ## 参数
+    ///
+    /// - `buf`：接收的数据
+    /// - `echo`：需要回显时，回显的数据追加到这里
+    ///
+    /// ## 返回值
+    ///
+    /// 接收的字节数。读缓冲区满时，剩余的数据没有被接收
+    pub fn receive_buf(&self, buf: &[u8], mut echo: Option<&mut Vec<u8>>) -> usize {
+        let mut data = self.data.lock_irqsave();
+        let readable = data.read_buf.len();
+        let mut cnt = 0;
+        for c in buf {
+            if data.room() == 0 {
+                break;
+            }
+            let mut c = *c;
+            if c == b'\r' && data.icrnl {
+                c = b'\n';
+            }
+            if data.icanon {
+                data.receive_canon(c, echo.as_deref_mut());
+            } else {
+                data.read_buf.push_back(c);
+                if let Some(echo) = echo.as_deref_mut() {
+                    echo.push(c);
+                }
+            }
+            cnt += 1;
+        }
+        let woken = data.read_buf.len() > readable;
+        drop(data);
+
+        if woken {
+            self.read_wait.wakeup_all(None);
+        }
+        return cnt;
+    }
+
+    /// 读取数据
+    ///
+    /// 规范模式下每次最多读取一行，行尾的ctrl+d不会被读出（行首的ctrl+d表示文件结束，返回0）。
+    /// 非规范模式下读到换行符或者ctrl+d时返回。
+    ///
+    /// ## 返回值
+    ///
+    /// - Ok(读取的字节数)：非阻塞读并且没有数据时返回0
+    /// - Err(TtyError::Stopped(0))：阻塞读的过程中收到了信号
+    pub fn read(&self, buf: &mut [u8], block: bool) -> Result<usize, TtyError> {
+        if buf.is_empty() {
+            return Ok(0);
+        }
+        loop {
+            let mut data = self.data.lock_irqsave();
+            if !data.read_buf.is_empty() {
+                return Ok(data.copy_out(buf));
+            }
+            if !block {
+                return Ok(0);
+            }
+            self.read_wait.sleep_unlock_spinlock(data);
+            if ProcessManager::current_pcb().has_pending_signal() {
+                return Err(TtyError::Stopped(0));
+            }
+        }
+    }
+
+    /// 是否有数据可以读取
+    pub fn readable(&self) -> bool {
+        return !self.data.lock_irqsave().read_buf.is_empty();
+    }
+
+    /// 等待有数据可读的等待队列
+    pub fn read_wait_queue(&self) -> &Arc<WaitQueue> {
+        return &self.read_wait;
+    }
+
+    /// 开启或者关闭规范模式。关闭时，正在编辑的行立即可以被读取
+    #[allow(dead_code)]
+    pub fn set_canonical(&self, icanon: bool) {
+        let mut data = self.data.lock_irqsave();
+        data.icanon = icanon;
+        if !icanon && !data.line.is_empty() {
+            data.commit_line();
+            drop(data);
+            self.read_wait.wakeup_all(None);
+        }
+    }
+}
+
+impl NTtyData {
+    #[inline]
+    fn room(&self) -> usize {
+        N_TTY_BUF_SIZE - self.read_buf.len() - self.line.len()
+    }
+
+    /// 规范模式下处理一个字符
+    fn receive_canon(&mut self, c: u8, echo: Option<&mut Vec<u8>>) {
+        match c {
+            VERASE | VERASE_BS => {
+                if self.line.pop().is_some() {
+                    if let Some(echo) = echo {
+                        echo.extend_from_slice(b"\x08 \x08");
+                    }
+                }
+            }
+            VKILL => {
+                let n = self.line.len();
+                self.line.clear();
+                if let Some(echo) = echo {
+                    for _ in 0..n {
+                        echo.extend_from_slice(b"\x08 \x08");
+                    }
+                }
+            }
+            b'\n' | VEOF => {
+                self.line.push(c);
+                self.commit_line();
+                if c == b'\n' {
+                    if let Some(echo) = echo {
+                        echo.push(c);
+                    }
+                }
+            }
+            _ => {
+                self.line.push(c);
+                if let Some(echo) = echo {
+                    echo.push(c);
+                }
+                // 缓冲区已经被这一行占满，只能强制结束这一行，否则读者永远等不到行尾
+                if self.room() == 0 {
+                    self.commit_line();
+                }
+            }
+        }
+    }
+
+    /// 结束正在编辑的行，使它可以被读取
+    fn commit_line(&mut self) {
+        let Self { read_buf, line, .. } = self;
+        read_buf.extend(line.drain(..));
+    }
+
+    /// 把读缓冲区中的数据复制给读者
+    fn copy_out(&mut self, buf: &mut [u8]) -> usize {
+        let mut cnt = 0;
+        while cnt < buf.len() {
+            let c = match self.read_buf.pop_front() {
+                Some(c) => c,
+                None => break,
+            };
+            if self.icanon && c == VEOF {
+                break;
+            }
+            buf[cnt] = c;
+            cnt += 1;
+            if c == b'\n' || c == VEOF {
+                break;
+            }
+        }
+        return cnt;
+    }
+}
+
+impl Debug for NTty {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        let data = self.data.lock_irqsave();
+        f.debug_struct("NTty")
+            .field("readable", &data.read_buf.len())
+            .field("line", &data.line.len())
+            .field("icanon", &data.icanon)
+            .finish()
+    }
+}
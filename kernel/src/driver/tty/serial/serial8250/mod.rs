@@ -33,7 +33,9 @@ use crate::{
     syscall::SystemError,
 };
 
-use self::serial8250_pio::{send_to_serial8250_pio_com1, serial8250_pio_port_early_init};
+use self::serial8250_pio::{
+    send_to_serial8250_pio_com1, serial8250_pio_panic_flush, serial8250_pio_port_early_init,
+};
 
 use super::{uart_manager, UartDriver, UartPort};
 
@@ -105,6 +107,9 @@ impl Serial8250Manager {
         platform_driver_manager()
             .register(serial8250_isa_driver.clone() as Arc<dyn PlatformDriver>)?;
 
+        // 注册中断，此后串口的收发由中断驱动
+        self.pio_ports_startup();
+
         return Ok(());
     }
 
@@ -541,3 +546,8 @@ impl KObject for Serial8250ISADriver {
 pub fn send_to_default_serial8250_port(s: &[u8]) {
     send_to_serial8250_pio_com1(s);
 }
+
+/// panic时调用：把发送缓冲区中的数据以轮询的方式发送出去，此后的输出也不再依赖中断
+pub fn serial8250_panic_flush() {
+    serial8250_pio_panic_flush();
+}
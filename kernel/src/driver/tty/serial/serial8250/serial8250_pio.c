@@ -0,0 +1,32 @@
+#include <common/glib.h>
+#include <common/kprint.h>
+#include <arch/x86_64/driver/apic/apic.h>
+
+extern void rs_serial8250_pio_handle_irq(uint64_t irq_num);
+
+hardware_intr_controller serial8250_pio_intr_controller =
+    {
+        .enable = apic_ioapic_enable,
+        .disable = apic_ioapic_disable,
+        .install = apic_ioapic_install,
+        .uninstall = apic_ioapic_uninstall,
+        .ack = apic_ioapic_edge_ack,
+};
+
+void serial8250_pio_handler(uint64_t number, uint64_t param, struct pt_regs *regs)
+{
+    rs_serial8250_pio_handle_irq(number);
+}
+
+/**
+ * @brief 注册PIO串口的中断（同一个中断号上的所有端口共用）
+ *
+ * @param irq_num 中断向量号
+ * @return int 错误码
+ */
+int c_serial8250_pio_register_irq(uint64_t irq_num)
+{
+    struct apic_IO_APIC_RTE_entry entry;
+    apic_make_rte_entry(&entry, irq_num, IO_APIC_FIXED, DEST_PHYSICAL, IDLE, POLARITY_HIGH, IRR_RESET, EDGE_TRIGGER, MASKED, 0);
+    return irq_register(irq_num, &entry, &serial8250_pio_handler, 0, &serial8250_pio_intr_controller, "serial8250");
+}
@@ -1,6 +1,11 @@
 //! PIO的串口驱动
+//!
+//! 注册中断之前（以及panic之后），输出以轮询的方式进行：每等到一次发送FIFO为空，写入一批（最多16个）字节。
+//! 注册中断之后，输出的字节先写入端口的发送环形缓冲区，由THRE（发送保持寄存器空）中断每次取出一批写入FIFO，
+//! 写日志的cpu不需要等待串口发送完成；接收到的数据由中断送入tty。
 
 use core::{
+    fmt::Debug,
     hint::spin_loop,
     sync::atomic::{AtomicBool, Ordering},
 };
@@ -9,8 +14,11 @@ use alloc::sync::{Arc, Weak};
 
 use crate::{
     arch::{io::PortIOArch, CurrentPortIOArch},
-    driver::tty::serial::{AtomicBaudRate, BaudRate, DivisorFraction, UartPort},
-    libs::rwlock::RwLock,
+    driver::tty::{
+        serial::{AtomicBaudRate, BaudRate, DivisorFraction, UartPort},
+        tty_device::TTY_DEVICES,
+    },
+    libs::{rwlock::RwLock, spinlock::SpinLock},
     syscall::SystemError,
 };
 
@@ -19,6 +27,38 @@ use super::{Serial8250ISADevices, Serial8250ISADriver, Serial8250Manager, Serial
 static mut PIO_PORTS: [Option<Serial8250PIOPort>; 8] =
     [None, None, None, None, None, None, None, None];
 
+/// 为true时，所有端口都以轮询的方式输出（panic之后，中断不一定还能到来）
+static SERIAL8250_PIO_POLLED: AtomicBool = AtomicBool::new(false);
+
+extern "C" {
+    fn c_serial8250_pio_register_irq(irq_num: u64) -> i32;
+}
+
+/// 发送环形缓冲区的大小（必须是2的幂）
+const SERIAL8250_TX_RING_SIZE: usize = 4096;
+/// 16550的FIFO深度。发送保持寄存器空的时候，FIFO可以一次写入这么多字节
+const SERIAL8250_FIFO_SIZE: usize = 16;
+/// 一次中断中最多处理的事件数，防止出错的硬件让中断处理程序无法退出
+const SERIAL8250_PASS_LIMIT: usize = 256;
+
+// 寄存器偏移以及寄存器中的位，命名与Linux的serial_reg.h相同
+const UART_RX: u32 = 0;
+const UART_TX: u32 = 0;
+const UART_IER: u32 = 1;
+const UART_IER_RDI: u8 = 0x01;
+const UART_IER_THRI: u8 = 0x02;
+const UART_IIR: u32 = 2;
+const UART_IIR_NO_INT: u32 = 0x01;
+const UART_IIR_ID: u32 = 0x0e;
+const UART_IIR_THRI: u32 = 0x02;
+const UART_IIR_RDI: u32 = 0x04;
+const UART_IIR_RLSI: u32 = 0x06;
+const UART_IIR_RX_TIMEOUT: u32 = 0x0c;
+const UART_LSR: u32 = 5;
+const UART_LSR_DR: u32 = 0x01;
+const UART_LSR_THRE: u32 = 0x20;
+const UART_MSR: u32 = 6;
+
 impl Serial8250Manager {
     pub(super) fn bind_pio_ports(
         &self,
@@ -32,6 +72,36 @@ impl Serial8250Manager {
             }
         }
     }
+
+    /// 注册PIO串口的中断，并且让端口切换到中断驱动的收发
+    pub(super) fn pio_ports_startup(&self) {
+        // 同一个中断号只注册一次（COM1与COM3、COM2与COM4共用中断）
+        let mut registered: [Option<u8>; 8] = [None; 8];
+        for i in 0..8 {
+            let port = match unsafe { PIO_PORTS[i].as_ref() } {
+                Some(port) => port,
+                None => continue,
+            };
+            let irq = match port.iobase.irq() {
+                Some(irq) => irq,
+                None => continue,
+            };
+            if !registered.contains(&Some(irq)) {
+                let r = unsafe { c_serial8250_pio_register_irq(irq as u64) };
+                if r != 0 {
+                    kwarn!(
+                        "serial8250: failed to register irq {:#x} for port {:?}, error: {}",
+                        irq,
+                        port.iobase,
+                        r
+                    );
+                    continue;
+                }
+                registered[i] = Some(irq);
+            }
+            port.startup().ok();
+        }
+    }
 }
 
 macro_rules! init_port {
@@ -73,6 +143,9 @@ pub struct Serial8250PIOPort {
     iobase: Serial8250PortBase,
     baudrate: AtomicBaudRate,
     initialized: AtomicBool,
+    /// 是否已经切换到中断驱动的收发
+    irq_enabled: AtomicBool,
+    tx: SpinLock<Serial8250TxRing>,
     inner: RwLock<Serial8250PIOPortInner>,
 }
 
@@ -83,6 +156,8 @@ impl Serial8250PIOPort {
             iobase,
             baudrate: AtomicBaudRate::new(baudrate),
             initialized: AtomicBool::new(false),
+            irq_enabled: AtomicBool::new(false),
+            tx: SpinLock::new(Serial8250TxRing::new()),
             inner: RwLock::new(Serial8250PIOPortInner::new()),
         };
 
@@ -149,7 +224,7 @@ impl Serial8250PIOPort {
 
     #[allow(dead_code)]
     fn serial_received(&self) -> bool {
-        if self.serial_in(5) & 1 != 0 {
+        if self.serial_in(UART_LSR) & UART_LSR_DR != 0 {
             true
         } else {
             false
@@ -157,7 +232,7 @@ impl Serial8250PIOPort {
     }
 
     fn is_transmit_empty(&self) -> bool {
-        if self.serial_in(5) & 0x20 != 0 {
+        if self.serial_in(UART_LSR) & UART_LSR_THRE != 0 {
             true
         } else {
             false
@@ -166,16 +241,115 @@ impl Serial8250PIOPort {
 
     /// 发送字节
     ///
+    /// 端口切换到中断驱动的发送之后，字节被放入发送缓冲区，由THRE中断发送。
+    /// 缓冲区满的时候，在这里等待FIFO为空并且直接写入，而不是丢弃日志。
+    ///
     /// ## 参数
     ///
     /// - `s`：待发送的字节
     fn send_bytes(&self, s: &[u8]) {
+        if !self.irq_enabled.load(Ordering::Acquire)
+            || SERIAL8250_PIO_POLLED.load(Ordering::Relaxed)
+        {
+            self.send_bytes_polled(s);
+            return;
+        }
+
+        let mut tx = self.tx.lock_irqsave();
+        for c in s {
+            while tx.is_full() {
+                self.wait_transmit_empty();
+                self.tx_burst(&mut tx);
+            }
+            tx.push(*c);
+        }
+
+        // 发送器空闲的时候不会再有THRE中断，因此先直接写入一批，剩余的交给中断
+        if self.is_transmit_empty() {
+            self.tx_burst(&mut tx);
+        }
+        if !tx.is_empty() {
+            let ier = tx.ier | UART_IER_THRI;
+            self.set_ier(&mut tx, ier);
+        }
+    }
+
+    /// 以轮询的方式发送字节：每等到一次FIFO为空，写入一批
+    fn send_bytes_polled(&self, s: &[u8]) {
+        for chunk in s.chunks(SERIAL8250_FIFO_SIZE) {
+            self.wait_transmit_empty();
+            for c in chunk {
+                self.serial_out(UART_TX, (*c).into());
+            }
+        }
+    }
+
+    fn wait_transmit_empty(&self) {
         while self.is_transmit_empty() == false {
             spin_loop();
         }
+    }
 
-        for c in s {
-            self.serial_out(0, (*c).into());
+    /// 从发送缓冲区中取出最多一个FIFO深度的字节写入FIFO
+    ///
+    /// 调用者需要保证发送保持寄存器为空
+    fn tx_burst(&self, tx: &mut Serial8250TxRing) {
+        for _ in 0..SERIAL8250_FIFO_SIZE {
+            match tx.pop() {
+                Some(c) => self.serial_out(UART_TX, c.into()),
+                None => break,
+            }
+        }
+    }
+
+    fn set_ier(&self, tx: &mut Serial8250TxRing, ier: u8) {
+        if tx.ier != ier {
+            tx.ier = ier;
+            self.serial_out(UART_IER, ier.into());
+        }
+    }
+
+    /// 读出接收FIFO中的所有数据，送到tty
+    fn receive_chars(&self) {
+        let mut buf = [0u8; SERIAL8250_FIFO_SIZE * 4];
+        let mut len = 0;
+        while len < buf.len() && self.serial_received() {
+            buf[len] = self.serial_in(UART_RX) as u8;
+            len += 1;
+        }
+        if len == 0 {
+            return;
+        }
+
+        // todo: 为每个端口创建自己的tty设备。目前只有默认的串口（COM1）作为控制台，接收的数据送到tty0
+        if self.iobase as u16 != Serial8250PortBase::COM1 as u16 {
+            return;
+        }
+        let tty = TTY_DEVICES.read().get("tty0").cloned();
+        if let Some(tty) = tty {
+            tty.input(&buf[..len]).ok();
+        }
+    }
+
+    /// 中断处理程序对THRE中断的处理：写入下一批数据，缓冲区为空时关闭THRE中断
+    fn transmit_chars(&self) {
+        let mut tx = self.tx.lock_irqsave();
+        self.tx_burst(&mut tx);
+        if tx.is_empty() {
+            let ier = tx.ier & !UART_IER_THRI;
+            self.set_ier(&mut tx, ier);
+        }
+    }
+
+    /// 切换到轮询的方式，并且把发送缓冲区中剩余的数据发送出去
+    ///
+    /// 如果缓冲区正在被当前cpu上被打断的代码使用，那么放弃剩余的数据，避免死锁
+    fn flush_polled(&self) {
+        if let Ok(mut tx) = self.tx.try_lock_irqsave() {
+            while !tx.is_empty() {
+                self.wait_transmit_empty();
+                self.tx_burst(&mut tx);
+            }
         }
     }
 
@@ -185,7 +359,7 @@ impl Serial8250PIOPort {
         while self.serial_received() == false {
             spin_loop();
         }
-        return self.serial_in(0) as u8;
+        return self.serial_in(UART_RX) as u8;
     }
 }
 
@@ -234,11 +408,30 @@ impl UartPort for Serial8250PIOPort {
     }
 
     fn startup(&self) -> Result<(), SystemError> {
-        todo!("serial8250_pio::startup")
+        if self.iobase.irq().is_none() {
+            return Err(SystemError::ENODEV);
+        }
+        if self.irq_enabled.swap(true, Ordering::AcqRel) {
+            return Ok(());
+        }
+
+        // 清空接收FIFO中残留的数据，然后打开接收中断。发送中断在有数据要发送时才打开
+        while self.serial_received() {
+            self.serial_in(UART_RX);
+        }
+        let mut tx = self.tx.lock_irqsave();
+        self.set_ier(&mut tx, UART_IER_RDI);
+        return Ok(());
     }
 
     fn shutdown(&self) {
-        todo!("serial8250_pio::shutdown")
+        let mut tx = self.tx.lock_irqsave();
+        self.set_ier(&mut tx, 0);
+        self.irq_enabled.store(false, Ordering::Release);
+        while !tx.is_empty() {
+            self.wait_transmit_empty();
+            self.tx_burst(&mut tx);
+        }
     }
 
     fn baud_rate(&self) -> Option<BaudRate> {
@@ -246,7 +439,88 @@ impl UartPort for Serial8250PIOPort {
     }
 
     fn handle_irq(&self) -> Result<(), SystemError> {
-        todo!("serial8250_pio::handle_irq")
+        for _ in 0..SERIAL8250_PASS_LIMIT {
+            let iir = self.serial_in(UART_IIR);
+            if iir & UART_IIR_NO_INT != 0 {
+                return Ok(());
+            }
+            match iir & UART_IIR_ID {
+                UART_IIR_RDI | UART_IIR_RX_TIMEOUT | UART_IIR_RLSI => {
+                    // 读LSR会清除线路状态中断
+                    self.receive_chars();
+                }
+                UART_IIR_THRI => self.transmit_chars(),
+                _ => {
+                    // modem状态中断：读MSR以清除
+                    self.serial_in(UART_MSR);
+                }
+            }
+        }
+        return Err(SystemError::EBUSY);
+    }
+}
+
+/// 发送环形缓冲区
+///
+/// 在内存管理初始化之前就需要可用，因此是定长的数组
+struct Serial8250TxRing {
+    buf: [u8; SERIAL8250_TX_RING_SIZE],
+    /// 下一个写入的位置（不回绕，取模后才是下标）
+    head: usize,
+    /// 下一个发送的位置（不回绕，取模后才是下标）
+    tail: usize,
+    /// 当前写入中断使能寄存器的值
+    ier: u8,
+}
+
+impl Serial8250TxRing {
+    const fn new() -> Self {
+        Self {
+            buf: [0; SERIAL8250_TX_RING_SIZE],
+            head: 0,
+            tail: 0,
+            ier: 0,
+        }
+    }
+
+    #[inline]
+    fn len(&self) -> usize {
+        self.head.wrapping_sub(self.tail)
+    }
+
+    #[inline]
+    fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    #[inline]
+    fn is_full(&self) -> bool {
+        self.len() == SERIAL8250_TX_RING_SIZE
+    }
+
+    #[inline]
+    fn push(&mut self, c: u8) {
+        self.buf[self.head & (SERIAL8250_TX_RING_SIZE - 1)] = c;
+        self.head = self.head.wrapping_add(1);
+    }
+
+    #[inline]
+    fn pop(&mut self) -> Option<u8> {
+        if self.is_empty() {
+            return None;
+        }
+        let c = self.buf[self.tail & (SERIAL8250_TX_RING_SIZE - 1)];
+        self.tail = self.tail.wrapping_add(1);
+        return Some(c);
+    }
+}
+
+impl Debug for Serial8250TxRing {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        f.debug_struct("Serial8250TxRing")
+            .field("len", &self.len())
+            .field("ier", &self.ier)
+            .finish()
     }
 }
 
@@ -289,9 +563,45 @@ pub enum Serial8250PortBase {
     COM8 = 0x4e8,
 }
 
+impl Serial8250PortBase {
+    /// 端口使用的中断向量号（ISA的IRQ4、IRQ3，经过IO APIC之后是0x24、0x23）
+    ///
+    /// COM5~COM8没有标准的中断号，只能以轮询的方式工作
+    pub const fn irq(&self) -> Option<u8> {
+        match self {
+            Self::COM1 | Self::COM3 => Some(0x24),
+            Self::COM2 | Self::COM4 => Some(0x23),
+            _ => None,
+        }
+    }
+}
+
 /// 临时函数，用于向COM1发送数据
 pub fn send_to_serial8250_pio_com1(s: &[u8]) {
     if let Some(port) = unsafe { PIO_PORTS[0].as_ref() } {
         port.send_bytes(s);
     }
 }
+
+/// panic时调用：此后所有端口都以轮询的方式输出，并且发送缓冲区中剩余的数据
+pub fn serial8250_pio_panic_flush() {
+    SERIAL8250_PIO_POLLED.store(true, Ordering::SeqCst);
+    for i in 0..8 {
+        if let Some(port) = unsafe { PIO_PORTS[i].as_ref() } {
+            port.flush_polled();
+        }
+    }
+}
+
+/// PIO串口的中断处理函数，由C的中断入口调用
+#[no_mangle]
+unsafe extern "C" fn rs_serial8250_pio_handle_irq(irq_num: u64) {
+    for i in 0..8 {
+        if let Some(port) = PIO_PORTS[i].as_ref() {
+            if port.irq_enabled.load(Ordering::Acquire) && port.iobase.irq() == Some(irq_num as u8)
+            {
+                port.handle_irq().ok();
+            }
+        }
+    }
+}
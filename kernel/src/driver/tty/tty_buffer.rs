@@ -0,0 +1,70 @@
+//! tty的flip缓冲区
+//!
+//! 驱动在中断上下文中把接收到的数据放入flip缓冲区：这里只复制字节，不加锁，不做任何处理，也不唤醒读者。
+//! 缓冲区中的数据由工作队列成批地交给线路规程处理（参见[`super::n_tty`]）。
+//! 线路规程的读缓冲区满的时候，数据留在flip缓冲区中，等读者读走数据之后再交给线路规程。
+
+use core::{
+    fmt::Debug,
+    sync::atomic::{AtomicUsize, Ordering},
+};
+
+use crate::libs::{ringbuf::MpscRing, spinlock::SpinLock};
+
+/// flip缓冲区的大小（必须是2的幂）
+pub const TTY_FLIP_BUF_SIZE: usize = 4096;
+
+pub struct TtyFlipBuffer {
+    /// 多个驱动（例如键盘和串口）可能在不同cpu的中断中同时写入同一个tty
+    ring: MpscRing<u8>,
+    /// 读出数据的一方（工作队列）之间的互斥锁，写入者不需要获取它
+    reader: SpinLock<()>,
+    /// 由于缓冲区满而丢弃的字节数
+    dropped: AtomicUsize,
+}
+
+impl TtyFlipBuffer {
+    pub fn new() -> Self {
+        return Self {
+            ring: MpscRing::new(TTY_FLIP_BUF_SIZE),
+            reader: SpinLock::new(()),
+            dropped: AtomicUsize::new(0),
+        };
+    }
+
+    /// 把数据放入缓冲区（可以在中断上下文中调用，不加锁）
+    ///
+    /// ## 返回值
+    ///
+    /// 放入的字节数。缓冲区满时，放不下的数据被丢弃
+    pub fn insert(&self, data: &[u8]) -> usize {
+        let n = self.ring.push_slice(data);
+        if n != data.len() {
+            self.dropped.fetch_add(data.len() - n, Ordering::Relaxed);
+        }
+        return n;
+    }
+
+    /// 从缓冲区中取出数据
+    ///
+    /// ## 返回值
+    ///
+    /// 取出的字节数
+    pub fn take(&self, out: &mut [u8]) -> usize {
+        let _guard = self.reader.lock_irqsave();
+        return self.ring.pop_slice(out);
+    }
+
+    pub fn is_empty(&self) -> bool {
+        return self.ring.is_empty();
+    }
+}
+
+impl Debug for TtyFlipBuffer {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        f.debug_struct("TtyFlipBuffer")
+            .field("len", &self.ring.len())
+            .field("dropped", &self.dropped.load(Ordering::Relaxed))
+            .finish()
+    }
+}
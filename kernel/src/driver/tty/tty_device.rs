@@ -8,8 +8,8 @@ use crate::{
     filesystem::{
         devfs::{devfs_register, DevFS, DeviceINode},
         vfs::{
-            file::FileMode, syscall::ModeType, FilePrivateData, FileType, IndexNode, Metadata,
-            ROOT_INODE,
+            file::FileMode, poll::PollTable, syscall::ModeType, FilePrivateData, FileType,
+            IndexNode, Metadata, PollStatus, ROOT_INODE,
         },
     },
     kerror,
@@ -17,10 +17,14 @@ use crate::{
         lib_ui::textui::{textui_putchar, FontColor},
         rwlock::RwLock,
     },
+    process::workqueue::{schedule_work, Work},
     syscall::SystemError,
 };
 
-use super::{serial::serial_init, TtyCore, TtyError, TtyFileFlag, TtyFilePrivateData};
+use super::{
+    serial::serial_init, tty_buffer::TtyFlipBuffer, TtyCore, TtyError, TtyFileFlag,
+    TtyFilePrivateData,
+};
 
 lazy_static! {
     /// 所有TTY设备的B树。用于根据名字，找到Arc<TtyDevice>
@@ -33,6 +37,9 @@ lazy_static! {
 pub struct TtyDevice {
     /// TTY核心
     core: TtyCore,
+    /// 驱动输入的数据先放在这里，再由flush_work成批地交给线路规程
+    flip: TtyFlipBuffer,
+    flush_work: Arc<Work>,
     /// TTY所属的文件系统
     fs: RwLock<Weak<DevFS>>,
     /// TTY设备私有信息
@@ -50,10 +57,19 @@ struct TtyDevicePrivateData {
 
 impl TtyDevice {
     pub fn new(name: &str) -> Arc<TtyDevice> {
-        let result = Arc::new(TtyDevice {
-            core: TtyCore::new(),
-            fs: RwLock::new(Weak::default()),
-            private_data: TtyDevicePrivateData::new(name),
+        let result = Arc::new_cyclic(|self_ref: &Weak<TtyDevice>| {
+            let self_ref = self_ref.clone();
+            TtyDevice {
+                core: TtyCore::new(),
+                flip: TtyFlipBuffer::new(),
+                flush_work: Work::new(move || {
+                    if let Some(tty) = self_ref.upgrade() {
+                        tty.flush_to_ldisc();
+                    }
+                }),
+                fs: RwLock::new(Weak::default()),
+                private_data: TtyDevicePrivateData::new(name),
+            }
         });
         // 默认开启输入回显
         result.core.enable_echo();
@@ -88,20 +104,44 @@ impl TtyDevice {
     }
 
     /// @brief 向TTY的输入端口导入数据
+    ///
+    /// 可以在中断上下文中调用：数据只被放入flip缓冲区，由工作队列交给线路规程处理
+    ///
+    /// @return Ok(成功导入的字节数) flip缓冲区满时，放不下的数据被丢弃
     pub fn input(&self, buf: &[u8]) -> Result<usize, SystemError> {
-        let r: Result<usize, TtyError> = self.core.input(buf, false);
-        if r.is_ok() {
-            return Ok(r.unwrap());
+        let n = self.flip.insert(buf);
+        if n != 0 {
+            schedule_work(&self.flush_work);
         }
+        return Ok(n);
+    }
 
-        let r = r.unwrap_err();
-        match r {
-            TtyError::BufferFull(x) => return Ok(x),
-            TtyError::Closed => return Err(SystemError::ENODEV),
-            e => {
-                kerror!("tty error occurred while writing data to its input port, msg={e:?}");
-                return Err(SystemError::EBUSY);
+    /// 把flip缓冲区中的数据成批地交给线路规程，直到flip缓冲区为空或者线路规程的缓冲区已满
+    fn flush_to_ldisc(&self) {
+        let mut buf = [0u8; 256];
+        let mut echoed = false;
+        loop {
+            let room = self.core.receive_room();
+            if room == 0 {
+                // 剩余的数据留在flip缓冲区中，读者读走数据之后再继续
+                break;
+            }
+            let len = core::cmp::min(room, buf.len());
+            let n = self.flip.take(&mut buf[..len]);
+            if n == 0 {
+                break;
             }
+            match self.core.receive_buf(&buf[..n]) {
+                Ok((_, echo)) => echoed |= echo,
+                Err(e) => {
+                    kerror!("tty error occurred while flushing its input to ldisc, msg={e:?}");
+                    break;
+                }
+            }
+        }
+
+        if echoed {
+            self.sync().ok();
         }
     }
 }
@@ -162,6 +202,10 @@ impl IndexNode for TtyDevice {
 
         // 读取stdin队列
         let r: Result<usize, TtyError> = self.core.read_stdin(&mut buf[0..len], true);
+        // 线路规程的缓冲区有了空位，继续处理留在flip缓冲区中的数据
+        if !self.flip.is_empty() {
+            schedule_work(&self.flush_work);
+        }
         if r.is_ok() {
             return Ok(r.unwrap());
         }
@@ -171,6 +215,10 @@ impl IndexNode for TtyDevice {
                 return Ok(n);
             }
 
+            TtyError::Stopped(_) => {
+                return Err(SystemError::ERESTARTSYS);
+            }
+
             x => {
                 kerror!("Error occurred when reading tty, msg={x:?}");
                 return Err(SystemError::ECONNABORTED);
@@ -215,7 +263,16 @@ impl IndexNode for TtyDevice {
     }
 
     fn poll(&self) -> Result<crate::filesystem::vfs::PollStatus, SystemError> {
-        return Err(SystemError::EOPNOTSUPP_OR_ENOTSUP);
+        // 输出缓冲区满时写入会等待，因此总是可写的
+        let mut status = PollStatus::WRITE;
+        if self.core.stdin_readable() {
+            status |= PollStatus::READ;
+        }
+        return Ok(status);
+    }
+
+    fn poll_wait(&self, table: &mut PollTable) {
+        table.wait(self.core.stdin_wait_queue());
     }
 
     fn fs(&self) -> Arc<dyn crate::filesystem::vfs::FileSystem> {
@@ -16,13 +16,16 @@ use crate::{
     kinfo,
     libs::{
         align::page_align_up,
-        lib_ui::screen_manager::{ScmBuffer, ScmBufferFlag, ScmBufferInfo},
+        lib_ui::screen_manager::{
+            scm_mark_dirty, scm_take_dirty, ScmBuffer, ScmBufferFlag, ScmBufferInfo,
+        },
         rwlock::{RwLock, RwLockReadGuard},
         spinlock::SpinLock,
     },
     mm::{
         allocator::page_frame::PageFrameCount, kernel_mapper::KernelMapper,
-        no_init::pseudo_map_phys, page::PageFlags, MemoryManagementArch, PhysAddr, VirtAddr,
+        no_init::pseudo_map_phys_with_flags, page::PageFlags, MemoryManagementArch, PhysAddr,
+        VirtAddr,
     },
     syscall::SystemError,
     time::timer::{Timer, TimerFunction},
@@ -104,7 +107,8 @@ impl VideoRefreshManager {
         let count = PageFrameCount::new(
             page_align_up(frame_buffer_info_graud.buf_size()) / MMArch::PAGE_SIZE,
         );
-        let page_flags: PageFlags<MMArch> = PageFlags::new().set_execute(true).set_write(true);
+        // 帧缓冲区只会被顺序写入，使用写合并，而不是每个像素单独写一次总线
+        let page_flags: PageFlags<MMArch> = PageFlags::wc_flags();
 
         let mut kernel_mapper = KernelMapper::lock();
         let mut kernel_mapper = kernel_mapper.as_mut();
@@ -154,6 +158,8 @@ impl VideoRefreshManager {
         let mut refresh_target = self.refresh_target.write_irqsave();
         if let ScmBuffer::DoubleBuffer(double_buffer) = &buf_info.buf {
             *refresh_target = Some(double_buffer.clone());
+            // 新的刷新目标需要完整地刷新一次
+            scm_mark_dirty(0, buf_info.height());
             return Ok(());
         }
         return Err(SystemError::EINVAL);
@@ -232,7 +238,8 @@ impl VideoRefreshManager {
         let count = PageFrameCount::new(
             page_align_up(device_buffer.buf_size() as usize) / MMArch::PAGE_SIZE,
         );
-        pseudo_map_phys(buf_vaddr, paddr, count);
+        // 此时还没有设置PAT，写合并的页表项暂时是写穿的，设置PAT之后自动变为写合并
+        pseudo_map_phys_with_flags(buf_vaddr, paddr, count, PageFlags::wc_flags());
 
         let result = Self {
             fb_info,
@@ -308,12 +315,22 @@ impl TimerFunction for VideoRefreshExecutor {
                 start_next_refresh();
                 return Ok(());
             }
-            let mut target_guard = target_guard.unwrap();
-            unsafe {
-                p.copy_from_nonoverlapping(
-                    target_guard.as_mut_ptr() as *mut u8,
-                    manager.device_buffer().buf_size() as usize,
-                )
+            let target_guard = target_guard.unwrap();
+            // 只把上一次刷新之后被修改过的像素行拷贝到显存
+            if let Some(rows) = scm_take_dirty() {
+                let device_buffer = manager.device_buffer();
+                let height = device_buffer.height() as usize;
+                let row_size = device_buffer.buf_size() / height.max(1);
+                let start = (rows.start as usize).min(height) * row_size;
+                let end = (rows.end as usize).min(height) * row_size;
+                if start < end {
+                    unsafe {
+                        p.add(start).copy_from_nonoverlapping(
+                            (target_guard.as_ptr() as *const u8).add(start),
+                            end - start,
+                        )
+                    }
+                }
             }
         }
 
@@ -5,13 +5,17 @@ use crate::driver::pci::pci::{
     PciStandardDeviceBar, PCI_CAP_ID_VNDR,
 };
 
-use crate::driver::pci::pci_irq::{IrqCommonMsg, IrqMsg, IrqSpecificMsg, PciInterrupt, IRQ};
-use crate::include::bindings::bindings::pt_regs;
+use crate::driver::disk::virtio_blk::virtio_blk_irq_handler;
+use crate::driver::pci::pci_irq::{
+    pci_irq_affinity, pci_irq_vector_alloc, IrqCommonMsg, IrqMsg, IrqSpecificMsg, IrqType,
+    PciInterrupt, PciIrqError, IRQ,
+};
+use crate::include::bindings::bindings::{pt_regs, smp_get_total_cpu};
 use crate::libs::volatile::{
     volread, volwrite, ReadOnly, Volatile, VolatileReadable, VolatileWritable, WriteOnly,
 };
 use crate::mm::VirtAddr;
-use crate::net::net_core::poll_ifaces_try_lock_onetime;
+use crate::net::net_core::net_rx_schedule;
 use core::{
     fmt::{self, Display, Formatter},
     mem::{align_of, size_of},
@@ -56,12 +60,11 @@ const VIRTIO_PCI_CAP_ISR_CFG: u8 = 3;
 /// Device specific configuration.
 const VIRTIO_PCI_CAP_DEVICE_CFG: u8 = 4;
 
-/// Virtio设备接收中断的设备号
-const VIRTIO_RECV_VECTOR: u16 = 56;
-/// Virtio设备接收中断的设备号的表项号
-const VIRTIO_RECV_VECTOR_INDEX: u16 = 0;
-// 接收的queue号
-const QUEUE_RECEIVE: u16 = 0;
+/// 最多为网卡的前几个队列各分配一个MSI-X中断（接收队列和发送队列），其余的队列不产生中断。
+/// 块设备的每个cpu一个队列，最多为每个cpu分配一个中断
+const VIRTIO_MAX_QUEUE_VECTORS: u16 = 2;
+/// 不使用中断的队列或者配置变更通知
+const VIRTIO_MSI_NO_VECTOR: u16 = 0xffff;
 ///@brief device id 转换为设备类型
 ///@param pci_device_id，device_id
 ///@return DeviceType 对应的设备类型
@@ -79,6 +82,9 @@ fn device_type(pci_device_id: u16) -> DeviceType {
     }
 }
 
+/// 队列中断的处理函数
+type IrqHandler = unsafe extern "C" fn(irq_num: u64, irq_paramer: u64, regs: *mut pt_regs);
+
 /// PCI transport for VirtIO.
 ///
 /// Ref: 4.1 Virtio Over PCI Bus
@@ -96,11 +102,13 @@ pub struct PciTransport {
     isr_status: NonNull<Volatile<u8>>,
     /// The VirtIO device-specific configuration within some BAR.
     config_space: Option<NonNull<[u32]>>,
+    /// 分配了MSI-X中断的队列数，第i个队列使用MSI-X表中的第i项
+    nr_queue_vectors: u16,
 }
 
 unsafe extern "C" fn virtio_irq_hander(_irq_num: u64, _irq_paramer: u64, _regs: *mut pt_regs) {
-    // kdebug!("12345");
-    poll_ifaces_try_lock_onetime().ok();
+    // virtio网卡的中断，由NET_RX软中断轮询网卡（发送队列的中断用于回收已经发送的缓冲区）
+    net_rx_schedule();
 }
 
 impl PciTransport {
@@ -126,24 +134,35 @@ impl PciTransport {
         device.bar_ioremap().unwrap()?;
         device.enable_master();
         let standard_device = device.as_standard_device_mut().unwrap();
-        // 目前缺少对PCI设备中断号的统一管理，所以这里需要指定一个中断号。不能与其他中断重复
-        let irq_vector = standard_device.irq_vector_mut().unwrap();
-        irq_vector.push(VIRTIO_RECV_VECTOR);
-        standard_device
-            .irq_init(IRQ::PCI_IRQ_MSIX)
-            .expect("IRQ init failed");
-        // 中断相关信息
-        let msg = IrqMsg {
-            irq_common_message: IrqCommonMsg::init_from(
-                0,
-                "Virtio_Recv_IRQ",
-                0,
-                virtio_irq_hander,
-                None,
+        // 每个队列使用单独的MSI-X中断，并且投递到不同的cpu上。中断的参数是队列号
+        let (max_queue_vectors, irq_handler): (u16, IrqHandler) = match device_type {
+            DeviceType::Block => (
+                unsafe { smp_get_total_cpu() }.max(1) as u16,
+                virtio_blk_irq_handler,
             ),
-            irq_specific_message: IrqSpecificMsg::msi_default(),
+            _ => (VIRTIO_MAX_QUEUE_VECTORS, virtio_irq_hander),
         };
-        standard_device.irq_install(msg)?;
+        let nr_queue_vectors = match standard_device.irq_init(IRQ::PCI_IRQ_MSIX) {
+            Some(IrqType::Msix { irq_max_num, .. }) => irq_max_num.min(max_queue_vectors),
+            _ => panic!("IRQ init failed"),
+        };
+        let vectors = pci_irq_vector_alloc(nr_queue_vectors).ok_or(VirtioPciError::Pci(
+            PciError::PciIrqError(PciIrqError::DeviceIrqOverflow),
+        ))?;
+        standard_device.irq_vector_mut().unwrap().extend(vectors);
+        for index in 0..nr_queue_vectors {
+            let msg = IrqMsg {
+                irq_common_message: IrqCommonMsg::init_from(
+                    index,
+                    "Virtio_Queue_IRQ",
+                    index,
+                    irq_handler,
+                    None,
+                ),
+                irq_specific_message: IrqSpecificMsg::msi_affinity(pci_irq_affinity(index)),
+            };
+            standard_device.irq_install(msg)?;
+        }
         standard_device.irq_enable(true)?;
         //device_capability为迭代器，遍历其相当于遍历所有的cap空间
         for capability in device.capabilities().unwrap() {
@@ -222,10 +241,18 @@ impl PciTransport {
             notify_off_multiplier,
             isr_status,
             config_space,
+            nr_queue_vectors,
         })
     }
 }
 
+impl PciTransport {
+    /// 分配了MSI-X中断的队列数。队列号小于它的队列，完成时产生中断
+    pub fn nr_queue_vectors(&self) -> u16 {
+        return self.nr_queue_vectors;
+    }
+}
+
 impl Transport for PciTransport {
     fn device_type(&self) -> DeviceType {
         self.device_type
@@ -309,12 +336,15 @@ impl Transport for PciTransport {
             volwrite!(self.common_cfg, queue_driver, driver_area as u64);
             volwrite!(self.common_cfg, queue_device, device_area as u64);
             // 这里设置队列中断对应的中断项
-            if queue == QUEUE_RECEIVE {
-                volwrite!(self.common_cfg, queue_msix_vector, VIRTIO_RECV_VECTOR_INDEX);
-                let vector = volread!(self.common_cfg, queue_msix_vector);
-                if vector != VIRTIO_RECV_VECTOR_INDEX {
-                    panic!("Vector set failed");
-                }
+            let index = if queue < self.nr_queue_vectors {
+                queue
+            } else {
+                VIRTIO_MSI_NO_VECTOR
+            };
+            volwrite!(self.common_cfg, queue_msix_vector, index);
+            let vector = volread!(self.common_cfg, queue_msix_vector);
+            if vector != index {
+                panic!("Vector set failed");
             }
             volwrite!(self.common_cfg, queue_enable, 1);
         }
@@ -1,9 +1,9 @@
 use super::transport_pci::PciTransport;
 use super::virtio_impl::HalImpl;
+use crate::driver::disk::virtio_blk::virtio_blk;
 use crate::driver::net::virtio_net::virtio_net;
 use crate::driver::pci::pci::{
-    get_pci_device_structure_mut, PciDeviceStructure, PciDeviceStructureGeneralDevice,
-    PCI_DEVICE_LINKEDLIST,
+    PciDeviceStructure, PciDeviceStructureGeneralDevice, PCI_DEVICE_LINKEDLIST,
 };
 use crate::libs::rwlock::RwLockWriteGuard;
 use crate::{kdebug, kerror, kwarn};
@@ -11,14 +11,16 @@ use alloc::{boxed::Box, collections::LinkedList};
 use virtio_drivers::transport::{DeviceType, Transport};
 const NETWORK_CLASS: u8 = 0x2;
 const ETHERNET_SUBCLASS: u8 = 0x0;
+const STORAGE_CLASS: u8 = 0x1;
+const SCSI_SUBCLASS: u8 = 0x0;
+const VIRTIO_VENDOR_ID: u16 = 0x1AF4;
 
 //Virtio设备寻找过程中出现的问题
 enum VirtioError {
-    VirtioNetNotFound,
-    NetDeviceNotFound,
+    VirtioDeviceNotFound,
 }
 
-///@brief 寻找并加载所有virtio设备的驱动（目前只有virtio-net，但其他virtio设备也可添加）
+///@brief 寻找并加载所有virtio设备的驱动（目前支持virtio-net和virtio-blk，其他virtio设备也可添加）
 pub fn virtio_probe() {
     let mut list = PCI_DEVICE_LINKEDLIST.write();
     if let Ok(virtio_list) = virtio_device_search(&mut list) {
@@ -43,11 +45,9 @@ pub fn virtio_probe() {
 }
 
 ///@brief 为virtio设备寻找对应的驱动进行初始化
-fn virtio_device_init(transport: impl Transport + 'static) {
+fn virtio_device_init(transport: PciTransport) {
     match transport.device_type() {
-        DeviceType::Block => {
-            kwarn!("Not support virtio_block device for now");
-        }
+        DeviceType::Block => virtio_blk(transport),
         DeviceType::GPU => {
             kwarn!("Not support virtio_gpu device for now");
         }
@@ -64,36 +64,32 @@ fn virtio_device_init(transport: impl Transport + 'static) {
 /// @brief 寻找所有的virtio设备
 /// @param list 链表的写锁
 /// @return Result<LinkedList<&'a mut Pci_Device_Structure_General_Device>, VirtioError>  成功则返回包含所有virtio设备结构体的可变引用的链表，失败则返回err
-/// 该函数主要是为其他virtio设备预留支持
+/// 目前只寻找virtio-net和virtio-blk设备，其他virtio设备可以在这里添加
 fn virtio_device_search<'a>(
     list: &'a mut RwLockWriteGuard<'_, LinkedList<Box<dyn PciDeviceStructure>>>,
 ) -> Result<LinkedList<&'a mut PciDeviceStructureGeneralDevice>, VirtioError> {
     let mut virtio_list: LinkedList<&mut PciDeviceStructureGeneralDevice> = LinkedList::new();
-    let virtio_net_device = get_virtio_net_device(list)?;
-    virtio_list.push_back(virtio_net_device);
-    Ok(virtio_list)
-}
-
-/// @brief 寻找virtio-net设备
-/// @param list 链表的写锁
-/// @return Result<&'a mut Pci_Device_Structure_General_Device, VirtioError> 成功则返回virtio设备结构体的可变引用，失败则返回err
-fn get_virtio_net_device<'a>(
-    list: &'a mut RwLockWriteGuard<'_, LinkedList<Box<dyn PciDeviceStructure>>>,
-) -> Result<&'a mut PciDeviceStructureGeneralDevice, VirtioError> {
-    let result = get_pci_device_structure_mut(list, NETWORK_CLASS, ETHERNET_SUBCLASS);
-    if result.is_empty() {
-        return Err(VirtioError::NetDeviceNotFound);
-    }
-    for device in result {
-        let standard_device = device.as_standard_device_mut().unwrap();
+    for device in list.iter_mut() {
+        let standard_device = match device.as_standard_device_mut() {
+            Some(standard_device) => standard_device,
+            None => continue,
+        };
         let header = &standard_device.common_header;
-        if header.vendor_id == 0x1AF4
-            && header.device_id >= 0x1000
-            && header.device_id <= 0x103F
-            && standard_device.subsystem_id == 1
+        if header.vendor_id != VIRTIO_VENDOR_ID
+            || header.device_id < 0x1000
+            || header.device_id > 0x107F
         {
-            return Ok(standard_device);
+            continue;
+        }
+        match (header.class_code, header.subclass) {
+            (NETWORK_CLASS, ETHERNET_SUBCLASS) | (STORAGE_CLASS, SCSI_SUBCLASS) => {
+                virtio_list.push_back(standard_device);
+            }
+            _ => {}
         }
     }
-    Err(VirtioError::VirtioNetNotFound)
+    if virtio_list.is_empty() {
+        return Err(VirtioError::VirtioDeviceNotFound);
+    }
+    Ok(virtio_list)
 }
@@ -6,7 +6,7 @@ use crate::mm::kernel_mapper::KernelMapper;
 use crate::mm::page::PageFlags;
 use crate::mm::{
     allocator::page_frame::{
-        allocate_page_frames, deallocate_page_frames, PageFrameCount, PhysPageFrame,
+        allocate_dma32_page_frames, deallocate_page_frames, PageFrameCount, PhysPageFrame,
     },
     MemoryManagementArch, PhysAddr, VirtAddr,
 };
@@ -27,7 +27,7 @@ unsafe impl Hal for HalImpl {
         );
         unsafe {
             let (paddr, count) =
-                allocate_page_frames(page_num).expect("VirtIO Impl: alloc page failed");
+                allocate_dma32_page_frames(page_num).expect("VirtIO Impl: alloc page failed");
             let virt = MMArch::phys_2_virt(paddr).unwrap();
             // 清空这块区域，防止出现脏数据
             core::ptr::write_bytes(virt.data() as *mut u8, 0, count.data() * MMArch::PAGE_SIZE);
@@ -4,6 +4,8 @@
 pub enum IpiKind {
     KickCpu,
     FlushTLB,
+    /// 执行其他CPU通过smp_call_function发来的请求
+    CallFunction,
 }
 
 /// IPI投递目标
@@ -88,6 +88,28 @@ Build_IRQ(0x36);
 Build_IRQ(0x37);
 Build_IRQ(0x38);
 Build_IRQ(0x39);
+Build_IRQ(0x3a);
+Build_IRQ(0x3b);
+Build_IRQ(0x3c);
+Build_IRQ(0x3d);
+Build_IRQ(0x3e);
+Build_IRQ(0x3f);
+Build_IRQ(0x40);
+Build_IRQ(0x41);
+Build_IRQ(0x42);
+Build_IRQ(0x43);
+Build_IRQ(0x44);
+Build_IRQ(0x45);
+Build_IRQ(0x46);
+Build_IRQ(0x47);
+Build_IRQ(0x48);
+Build_IRQ(0x49);
+Build_IRQ(0x4a);
+Build_IRQ(0x4b);
+Build_IRQ(0x4c);
+Build_IRQ(0x4d);
+Build_IRQ(0x4e);
+Build_IRQ(0x4f);
 
 // 初始化中断数组
 void (*interrupt_table[IRQ_NUM])(void) = {
@@ -117,6 +139,28 @@ void (*interrupt_table[IRQ_NUM])(void) = {
     IRQ0x37interrupt,
     IRQ0x38interrupt,
     IRQ0x39interrupt,
+    IRQ0x3ainterrupt,
+    IRQ0x3binterrupt,
+    IRQ0x3cinterrupt,
+    IRQ0x3dinterrupt,
+    IRQ0x3einterrupt,
+    IRQ0x3finterrupt,
+    IRQ0x40interrupt,
+    IRQ0x41interrupt,
+    IRQ0x42interrupt,
+    IRQ0x43interrupt,
+    IRQ0x44interrupt,
+    IRQ0x45interrupt,
+    IRQ0x46interrupt,
+    IRQ0x47interrupt,
+    IRQ0x48interrupt,
+    IRQ0x49interrupt,
+    IRQ0x4ainterrupt,
+    IRQ0x4binterrupt,
+    IRQ0x4cinterrupt,
+    IRQ0x4dinterrupt,
+    IRQ0x4einterrupt,
+    IRQ0x4finterrupt,
 };
 
 /**
@@ -206,7 +250,7 @@ int irq_register(ul irq_num, void *arg, void (*handler)(ul irq_num, ul parameter
     p->controller = controller;
     if (p->irq_name == NULL)
     {
-        int namelen = sizeof(strlen(irq_name) + 1);
+        int namelen = strlen(irq_name) + 1;
         p->irq_name = (char *)kmalloc(namelen, 0);
         memset(p->irq_name, 0, namelen);
         strncpy(p->irq_name, irq_name, namelen);
@@ -247,6 +291,29 @@ int irq_unregister(ul irq_num)
     return 0;
 }
 
+/**
+ * @brief 获取中断向量的名字
+ *
+ * @param irq_num 中断向量号
+ * @return const char* 中断名，该向量没有注册中断处理函数时返回NULL
+ */
+const char *irq_desc_name(ul irq_num)
+{
+    irq_desc_t *p = NULL;
+    if (irq_num >= 32 && irq_num < 32 + IRQ_NUM)
+        p = &interrupt_desc[irq_num - 32];
+    else if (irq_num >= 150 && irq_num < 150 + LOCAL_APIC_IRQ_NUM)
+        p = &local_apic_interrupt_desc[irq_num - 150];
+    else if (irq_num >= 200 && irq_num < 200 + SMP_IRQ_NUM)
+        p = &SMP_IPI_desc[irq_num - 200];
+    else
+        return NULL;
+
+    if (p->handler == NULL)
+        return NULL;
+    return p->irq_name;
+}
+
 /**
  * @brief 初始化中断模块
  */
@@ -16,7 +16,7 @@
 #pragma GCC push_options
 #pragma GCC optimize ("O0")
 
-#define IRQ_NUM 26
+#define IRQ_NUM 48
 #define SMP_IRQ_NUM 10
 #define LOCAL_APIC_IRQ_NUM 50
 
@@ -82,8 +82,7 @@ extern void (*local_apic_interrupt_table[LOCAL_APIC_IRQ_NUM])(void);
 	53	PIRQF
 	54	PIRQG
 	55	PIRQH
-	56  VIRTIO_RECV
-	57  E1000E_RECV
+56  ~   79	PCI MSI/MSI-X（由pci_irq_vector_alloc动态分配）
 	
 	
 0x80		system call
@@ -168,6 +167,14 @@ int irq_register(ul irq_num, void *arg, void (*handler)(ul irq_num, ul parameter
  */
 int irq_unregister(ul irq_num);
 
+/**
+ * @brief 获取中断向量的名字
+ *
+ * @param irq_num 中断向量号
+ * @return const char* 中断名，该向量没有注册中断处理函数时返回NULL
+ */
+const char *irq_desc_name(ul irq_num);
+
 /**
  * @brief 初始化中断模块
  */
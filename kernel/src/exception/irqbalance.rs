@@ -0,0 +1,158 @@
+//! 中断均衡
+//!
+//! 后台的irqbalance线程每隔一段时间统计各个外部中断的发生频率，以及每个cpu因此承担的中断负载。
+//! 当最忙的cpu与最闲的cpu之间的差距过大时，把最忙的cpu上的热点中断迁移到它允许投递的、
+//! 负载最低的cpu上。
+//!
+//! 为了保持缓存局部性，迁移是保守的：负载差距超过一定比例才会迁移，每一轮迁移的中断数量有上限，
+//! 刚被迁移过的中断在一段时间内不会再次迁移。中断的消费者（例如网卡队列对应的线程）与中断
+//! 之间的对应关系目前无法得知，因此不会主动把中断与消费者放到同一个cpu上；需要这种绑定时，
+//! 请通过`/proc/irq/<n>/smp_affinity`固定中断的亲和性。
+
+use alloc::{boxed::Box, collections::BTreeMap, string::ToString, vec::Vec};
+
+use crate::{
+    include::bindings::bindings::smp_get_total_cpu,
+    kdebug, kinfo,
+    mm::percpu::PerCpu,
+    process::kthread::{KernelThreadClosure, KernelThreadMechanism},
+    time::timer::schedule_timeout,
+};
+
+use super::irqdesc::{irq_affinity_snapshot, irq_migrate, irq_stat_sum, mask_test};
+
+/// 均衡的间隔（单位：jiffies，即微秒）
+const IRQBALANCE_INTERVAL: i64 = 1000000;
+/// 所有外部中断的总频率低于这个值（次/间隔）时，不进行均衡
+const IRQBALANCE_MIN_LOAD: u64 = 1000;
+/// 最忙与最闲的cpu的负载差距超过最忙cpu负载的 1/IRQBALANCE_IMBALANCE_DIV 时，才进行迁移
+const IRQBALANCE_IMBALANCE_DIV: u64 = 4;
+/// 每一轮最多迁移的中断数量
+const IRQBALANCE_MAX_MOVES: usize = 2;
+/// 中断被迁移之后，至少经过这么多轮才会再次被迁移
+const IRQBALANCE_HOLD_ROUNDS: u64 = 10;
+
+/// 中断均衡线程的状态
+struct IrqBalancer {
+    /// 上一轮统计时，各个中断发生的总次数
+    last_count: BTreeMap<u8, u64>,
+    /// 各个中断上一次被迁移的轮次
+    last_moved: BTreeMap<u8, u64>,
+    round: u64,
+}
+
+impl IrqBalancer {
+    fn new() -> Self {
+        return Self {
+            last_count: BTreeMap::new(),
+            last_moved: BTreeMap::new(),
+            round: 0,
+        };
+    }
+
+    /// 进行一轮均衡
+    fn balance(&mut self) {
+        self.round += 1;
+        let nr_cpus = (unsafe { smp_get_total_cpu() } as usize).clamp(1, PerCpu::MAX_CPU_NUM);
+        let infos = irq_affinity_snapshot();
+
+        // 计算每个中断在这一轮中发生的次数，以及每个cpu的中断负载
+        let mut load = [0u64; PerCpu::MAX_CPU_NUM];
+        let mut irqs: Vec<(u8, u64)> = Vec::with_capacity(infos.len());
+        let mut counts = BTreeMap::new();
+        for info in infos.iter() {
+            let count = irq_stat_sum(info.vector);
+            let delta = count.saturating_sub(*self.last_count.get(&info.vector).unwrap_or(&count));
+            counts.insert(info.vector, count);
+            if (info.target as usize) < nr_cpus {
+                load[info.target as usize] += delta;
+            }
+            irqs.push((info.vector, delta));
+        }
+        self.last_count = counts;
+        self.last_moved
+            .retain(|vector, _| self.last_count.contains_key(vector));
+
+        if load.iter().sum::<u64>() < IRQBALANCE_MIN_LOAD || nr_cpus == 1 {
+            return;
+        }
+
+        // 先尝试迁移最热的中断
+        irqs.sort_unstable_by(|a, b| b.1.cmp(&a.1));
+        let mut targets: BTreeMap<u8, usize> = infos
+            .iter()
+            .map(|info| (info.vector, info.target as usize))
+            .collect();
+
+        let mut moves = 0;
+        while moves < IRQBALANCE_MAX_MOVES {
+            let busiest = (0..nr_cpus).max_by_key(|cpu| load[*cpu]).unwrap();
+            let idlest = (0..nr_cpus).min_by_key(|cpu| load[*cpu]).unwrap();
+            let gap = load[busiest] - load[idlest];
+            if gap == 0 || gap < load[busiest] / IRQBALANCE_IMBALANCE_DIV {
+                break;
+            }
+
+            // 在最忙的cpu上，找一个迁移之后能够缩小差距的热点中断
+            let candidate = irqs.iter().find_map(|(vector, delta)| {
+                let info = infos.iter().find(|info| info.vector == *vector)?;
+                if !info.balance
+                    || *delta == 0
+                    || targets[vector] != busiest
+                    || self
+                        .last_moved
+                        .get(vector)
+                        .is_some_and(|r| self.round - *r < IRQBALANCE_HOLD_ROUNDS)
+                {
+                    return None;
+                }
+                let dest = (0..nr_cpus)
+                    .filter(|cpu| *cpu != busiest && mask_test(&info.allowed, *cpu))
+                    .min_by_key(|cpu| load[*cpu])?;
+                // 迁移之后，目标cpu的负载不能超过原来最忙的cpu
+                if load[dest] + *delta >= load[busiest] {
+                    return None;
+                }
+                return Some((*vector, *delta, dest));
+            });
+
+            let (vector, delta, dest) = match candidate {
+                Some(c) => c,
+                None => break,
+            };
+            if irq_migrate(vector, dest as u32).is_err() {
+                // 避免在下一次循环中再次选中这个中断
+                self.last_moved.insert(vector, self.round);
+                continue;
+            }
+            kdebug!(
+                "irqbalance: move irq {} from cpu {} to cpu {} ({} irqs)",
+                vector,
+                busiest,
+                dest,
+                delta
+            );
+            load[busiest] -= delta;
+            load[dest] += delta;
+            targets.insert(vector, dest);
+            self.last_moved.insert(vector, self.round);
+            moves += 1;
+        }
+    }
+}
+
+fn irqbalance_thread() -> i32 {
+    let mut balancer = IrqBalancer::new();
+    loop {
+        balancer.balance();
+        schedule_timeout(IRQBALANCE_INTERVAL).ok();
+    }
+}
+
+/// 启动中断均衡线程（需要在内核线程机制初始化完成之后调用）
+pub fn irqbalance_init() {
+    let closure = KernelThreadClosure::EmptyClosure((Box::new(irqbalance_thread), ()));
+    KernelThreadMechanism::create_and_run(closure, "irqbalance".to_string())
+        .expect("Failed to create irqbalance");
+    kinfo!("irqbalance started");
+}
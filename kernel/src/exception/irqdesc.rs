@@ -0,0 +1,383 @@
+//! 中断的统计信息与cpu亲和性
+//!
+//! - 每个cpu上每个中断向量发生的次数，由`do_IRQ`更新，通过`/proc/interrupts`导出
+//! - 外部中断（IO APIC、PCI MSI/MSI-X）允许投递的cpu（smp_affinity）以及当前投递的cpu。
+//!   `/proc/irq/<向量号>/smp_affinity`读写允许的cpu，中断均衡线程（见[`super::irqbalance`]）
+//!   在允许的cpu之间迁移中断
+//!
+//! 被隔离的cpu（见[`crate::sched::isolation`]）不在外部中断默认允许投递的范围内，
+//! 但仍然可以通过smp_affinity显式地把中断绑定到它们上面。
+//!
+//! 目前中断都使用物理目标模式，一个中断同一时刻只会投递到一个cpu上，
+//! 因此smp_affinity中有多个cpu时，由中断均衡线程从中选择一个。
+
+use core::{
+    ffi::CStr,
+    fmt::{Debug, Write},
+    sync::atomic::{AtomicU32, Ordering},
+};
+
+use alloc::{collections::BTreeMap, string::String, sync::Arc, vec::Vec};
+
+use crate::{
+    filesystem::vfs::seq_file::{SeqBuf, SeqOperations},
+    include::bindings::bindings::{irq_desc_name, smp_get_total_cpu},
+    libs::spinlock::SpinLock,
+    mm::percpu::PerCpu,
+    sched::isolation::housekeeping_mask,
+    smp::{core::smp_get_processor_id, cpu::CPU_MASK_WORDS},
+    syscall::SystemError,
+};
+
+/// 中断向量的数量
+pub const IRQ_VECTOR_NR: usize = 256;
+/// 可以设置cpu亲和性的外部中断的向量号范围：[IRQ_EXTERNAL_VECTOR_BASE, IRQ_EXTERNAL_VECTOR_END)
+///
+/// 与exception/irq.h中的`interrupt_desc`保持一致
+pub const IRQ_EXTERNAL_VECTOR_BASE: u8 = 32;
+pub const IRQ_EXTERNAL_VECTOR_END: u8 = 80;
+
+/// 一个cpu上各个中断向量发生的次数
+///
+/// 按缓存行对齐，避免不同cpu的计数器之间的伪共享
+#[repr(align(64))]
+struct IrqCpuStat([AtomicU32; IRQ_VECTOR_NR]);
+
+static IRQ_STATS: [IrqCpuStat; PerCpu::MAX_CPU_NUM] = {
+    const ZERO: AtomicU32 = AtomicU32::new(0);
+    const STAT: IrqCpuStat = IrqCpuStat([ZERO; IRQ_VECTOR_NR]);
+    [STAT; PerCpu::MAX_CPU_NUM]
+};
+
+/// 记录当前cpu上发生了一次中断（由do_IRQ调用）
+#[no_mangle]
+extern "C" fn rs_irq_stat_inc(vector: u8) {
+    let cpu = smp_get_processor_id() as usize;
+    IRQ_STATS[cpu].0[vector as usize].fetch_add(1, Ordering::Relaxed);
+}
+
+/// 获取中断`vector`在`cpu`上发生的次数
+#[inline]
+pub fn irq_stat_cpu(vector: u8, cpu: usize) -> u32 {
+    return IRQ_STATS[cpu].0[vector as usize].load(Ordering::Relaxed);
+}
+
+/// 获取中断`vector`在所有cpu上发生的次数之和
+pub fn irq_stat_sum(vector: u8) -> u64 {
+    return (0..nr_cpus())
+        .map(|cpu| irq_stat_cpu(vector, cpu) as u64)
+        .sum();
+}
+
+/// 可以修改中断目标cpu的中断控制器
+pub trait IrqAffinityChip: Send + Sync + Debug {
+    /// 中断控制器的名字，显示在/proc/interrupts中
+    fn name(&self) -> &str;
+
+    /// 把中断`vector`投递到`cpu`上
+    fn set_target(&self, vector: u8, cpu: u32) -> Result<(), SystemError>;
+}
+
+/// 一个外部中断的亲和性信息
+#[derive(Debug, Clone)]
+pub struct IrqAffinityInfo {
+    pub vector: u8,
+    /// 允许投递的cpu
+    pub allowed: [u64; CPU_MASK_WORDS],
+    /// 当前投递的cpu
+    pub target: u32,
+    /// 是否允许中断均衡线程迁移这个中断
+    pub balance: bool,
+}
+
+#[derive(Debug)]
+struct IrqAffinityDesc {
+    chip: Option<Arc<dyn IrqAffinityChip>>,
+    allowed: [u64; CPU_MASK_WORDS],
+    target: u32,
+    balance: bool,
+}
+
+impl IrqAffinityDesc {
+    fn new() -> Self {
+        return Self {
+            chip: None,
+            allowed: default_mask(),
+            target: 0,
+            balance: false,
+        };
+    }
+
+    /// 如果当前投递的cpu不在允许的范围内，就把中断迁移到允许的第一个cpu上
+    fn fixup_target(&mut self, vector: u8) -> Result<(), SystemError> {
+        if mask_test(&self.allowed, self.target as usize) {
+            return Ok(());
+        }
+        let cpu = mask_first(&self.allowed).ok_or(SystemError::EINVAL)?;
+        if let Some(chip) = self.chip.as_ref() {
+            chip.set_target(vector, cpu as u32)?;
+            self.target = cpu as u32;
+        }
+        return Ok(());
+    }
+}
+
+/// 外部中断的亲和性，以向量号为键
+static IRQ_AFFINITY: SpinLock<BTreeMap<u8, IrqAffinityDesc>> = SpinLock::new(BTreeMap::new());
+
+#[inline]
+fn nr_cpus() -> usize {
+    return (unsafe { smp_get_total_cpu() } as usize).clamp(1, PerCpu::MAX_CPU_NUM);
+}
+
+#[inline]
+fn is_external_vector(vector: u8) -> bool {
+    return (IRQ_EXTERNAL_VECTOR_BASE..IRQ_EXTERNAL_VECTOR_END).contains(&vector);
+}
+
+/// 所有在线cpu组成的掩码
+fn online_mask() -> [u64; CPU_MASK_WORDS] {
+    let mut mask = [0u64; CPU_MASK_WORDS];
+    for cpu in 0..nr_cpus() {
+        mask[cpu / 64] |= 1 << (cpu % 64);
+    }
+    return mask;
+}
+
+/// 外部中断默认允许投递的cpu：在线的、没有被隔离的cpu
+fn default_mask() -> [u64; CPU_MASK_WORDS] {
+    let online = online_mask();
+    let housekeeping = housekeeping_mask();
+    let mut mask = [0u64; CPU_MASK_WORDS];
+    for i in 0..CPU_MASK_WORDS {
+        mask[i] = online[i] & housekeeping[i];
+    }
+    if mask_first(&mask).is_none() {
+        return online;
+    }
+    return mask;
+}
+
+#[inline]
+pub fn mask_test(mask: &[u64; CPU_MASK_WORDS], cpu: usize) -> bool {
+    return cpu < PerCpu::MAX_CPU_NUM && mask[cpu / 64] & (1 << (cpu % 64)) != 0;
+}
+
+fn mask_first(mask: &[u64; CPU_MASK_WORDS]) -> Option<usize> {
+    return mask
+        .iter()
+        .enumerate()
+        .find(|(_, w)| **w != 0)
+        .map(|(i, w)| i * 64 + w.trailing_zeros() as usize);
+}
+
+/// 注册一个外部中断的中断控制器（在中断控制器中设置好目标cpu之后调用）
+///
+/// ## 参数
+///
+/// * `vector` - 中断向量号
+/// * `chip` - 用于修改中断目标cpu的中断控制器
+/// * `target` - 当前投递的cpu
+/// * `balance` - 是否允许中断均衡线程迁移这个中断
+pub fn irq_affinity_register(
+    vector: u8,
+    chip: Arc<dyn IrqAffinityChip>,
+    target: u32,
+    balance: bool,
+) {
+    if !is_external_vector(vector) {
+        return;
+    }
+    let mut table = IRQ_AFFINITY.lock();
+    let desc = table.entry(vector).or_insert_with(IrqAffinityDesc::new);
+    desc.chip = Some(chip);
+    desc.target = target;
+    desc.balance = balance;
+    // 在中断安装之前，就已经通过procfs设置了亲和性
+    desc.fixup_target(vector).ok();
+}
+
+/// 注销一个外部中断（中断卸载时调用），这个向量号再次分配时，亲和性恢复为所有cpu
+pub fn irq_affinity_unregister(vector: u8) {
+    IRQ_AFFINITY.lock().remove(&vector);
+}
+
+/// 设置中断允许投递的cpu。如果当前投递的cpu不在其中，立即迁移中断
+pub fn irq_set_affinity(vector: u8, mask: &[u64; CPU_MASK_WORDS]) -> Result<(), SystemError> {
+    if !is_external_vector(vector) {
+        return Err(SystemError::EINVAL);
+    }
+    let online = online_mask();
+    let mut allowed = [0u64; CPU_MASK_WORDS];
+    for i in 0..CPU_MASK_WORDS {
+        allowed[i] = mask[i] & online[i];
+    }
+    if mask_first(&allowed).is_none() {
+        return Err(SystemError::EINVAL);
+    }
+
+    let mut table = IRQ_AFFINITY.lock();
+    let desc = table.entry(vector).or_insert_with(IrqAffinityDesc::new);
+    desc.allowed = allowed;
+    return desc.fixup_target(vector);
+}
+
+/// 获取中断允许投递的cpu
+pub fn irq_get_affinity(vector: u8) -> [u64; CPU_MASK_WORDS] {
+    return IRQ_AFFINITY
+        .lock()
+        .get(&vector)
+        .map(|desc| desc.allowed)
+        .unwrap_or_else(default_mask);
+}
+
+/// 把`isolated`中的cpu从所有外部中断允许投递的范围内移除，正在投递到这些cpu上的中断被立即迁移走
+///
+/// 只允许投递到被隔离的cpu上的中断（显式绑定的）保持不变
+pub fn irq_affinity_isolate(isolated: &[u64; CPU_MASK_WORDS]) {
+    let mut table = IRQ_AFFINITY.lock();
+    for (vector, desc) in table.iter_mut() {
+        let mut allowed = desc.allowed;
+        for i in 0..CPU_MASK_WORDS {
+            allowed[i] &= !isolated[i];
+        }
+        if mask_first(&allowed).is_none() {
+            continue;
+        }
+        desc.allowed = allowed;
+        desc.fixup_target(*vector).ok();
+    }
+}
+
+/// 把中断迁移到`cpu`上，`cpu`必须在中断允许投递的范围内
+pub fn irq_migrate(vector: u8, cpu: u32) -> Result<(), SystemError> {
+    let mut table = IRQ_AFFINITY.lock();
+    let desc = table.get_mut(&vector).ok_or(SystemError::ENOENT)?;
+    if !mask_test(&desc.allowed, cpu as usize) {
+        return Err(SystemError::EINVAL);
+    }
+    if desc.target == cpu {
+        return Ok(());
+    }
+    let chip = desc.chip.as_ref().ok_or(SystemError::ENOENT)?;
+    chip.set_target(vector, cpu)?;
+    desc.target = cpu;
+    return Ok(());
+}
+
+/// 获取所有已经安装的外部中断的亲和性信息
+pub fn irq_affinity_snapshot() -> Vec<IrqAffinityInfo> {
+    return IRQ_AFFINITY
+        .lock()
+        .iter()
+        .filter(|(_, desc)| desc.chip.is_some())
+        .map(|(vector, desc)| IrqAffinityInfo {
+            vector: *vector,
+            allowed: desc.allowed,
+            target: desc.target,
+            balance: desc.balance,
+        })
+        .collect();
+}
+
+/// 以`/proc/irq/<n>/smp_affinity`的格式输出中断允许投递的cpu：
+/// 十六进制，每32个cpu为一组，高位的组在前，组之间用逗号分隔
+pub fn irq_affinity_show(vector: u8) -> String {
+    let mask = irq_get_affinity(vector);
+    let groups = (nr_cpus() + 31) / 32;
+    let mut s = String::new();
+    for g in (0..groups).rev() {
+        let word = (mask[g / 2] >> ((g % 2) * 32)) as u32;
+        write!(s, "{:08x}", word).ok();
+        if g != 0 {
+            s.push(',');
+        }
+    }
+    s.push('\n');
+    return s;
+}
+
+/// 解析写入`/proc/irq/<n>/smp_affinity`的掩码，并设置中断的亲和性
+pub fn irq_affinity_store(vector: u8, buf: &[u8]) -> Result<(), SystemError> {
+    let s = core::str::from_utf8(buf).map_err(|_| SystemError::EINVAL)?;
+    let s = s.trim_matches(|c: char| c.is_whitespace() || c == '\0');
+    if s.is_empty() {
+        return Err(SystemError::EINVAL);
+    }
+
+    let mut mask = [0u64; CPU_MASK_WORDS];
+    let mut bit = 0;
+    for c in s.chars().rev() {
+        if c == ',' {
+            continue;
+        }
+        let digit = c.to_digit(16).ok_or(SystemError::EINVAL)? as u64;
+        if digit != 0 && bit >= PerCpu::MAX_CPU_NUM {
+            return Err(SystemError::EINVAL);
+        }
+        if bit < PerCpu::MAX_CPU_NUM {
+            mask[bit / 64] |= digit << (bit % 64);
+        }
+        bit += 4;
+    }
+    return irq_set_affinity(vector, &mask);
+}
+
+/// `/proc/interrupts`：每个中断向量在各个cpu上发生的次数、中断控制器以及中断名
+///
+/// 第0个记录是表头，第n+1个记录是向量n。没有名字并且没有发生过的向量不输出
+#[derive(Debug)]
+pub struct InterruptsSeq;
+
+impl SeqOperations for InterruptsSeq {
+    type Cursor = usize;
+
+    fn start(&self, pos: usize) -> Option<usize> {
+        return if pos <= IRQ_VECTOR_NR {
+            Some(pos)
+        } else {
+            None
+        };
+    }
+
+    fn show(&self, pos: &usize, s: &mut SeqBuf) -> Result<(), SystemError> {
+        let nr_cpus = nr_cpus();
+        if *pos == 0 {
+            s.push_str("     ");
+            for cpu in 0..nr_cpus {
+                write!(s, " {:>10}", alloc::format!("CPU{}", cpu)).ok();
+            }
+            s.push('\n');
+            return Ok(());
+        }
+
+        let vector = (*pos - 1) as u8;
+        let name = unsafe { irq_desc_name(vector as u64) };
+        let name = if name.is_null() {
+            None
+        } else {
+            unsafe { CStr::from_ptr(name) }.to_str().ok()
+        };
+        let counts: Vec<u32> = (0..nr_cpus).map(|cpu| irq_stat_cpu(vector, cpu)).collect();
+        if name.is_none() && counts.iter().all(|c| *c == 0) {
+            return Ok(());
+        }
+
+        write!(s, "{:>4}:", vector).ok();
+        for count in counts {
+            write!(s, " {:>10}", count).ok();
+        }
+        let chip = IRQ_AFFINITY
+            .lock()
+            .get(&vector)
+            .and_then(|desc| desc.chip.clone());
+        let chip = match &chip {
+            Some(chip) => chip.name(),
+            None if vector >= 200 => "IPI",
+            None if vector >= 150 => "LAPIC",
+            None => "-",
+        };
+        writeln!(s, "  {:<8} {}", chip, name.unwrap_or("")).ok();
+        return Ok(());
+    }
+}
@@ -1,6 +1,8 @@
 use crate::arch::CurrentIrqArch;
 
 pub mod ipi;
+pub mod irqbalance;
+pub mod irqdesc;
 pub mod softirq;
 
 /// @brief 中断相关的操作
@@ -3,20 +3,47 @@ use core::{
     intrinsics::unlikely,
     mem::{self, MaybeUninit},
     ptr::null_mut,
-    sync::atomic::{compiler_fence, Ordering},
+    sync::atomic::{compiler_fence, AtomicBool, Ordering},
 };
 
-use alloc::{boxed::Box, sync::Arc};
+use alloc::{boxed::Box, format, sync::Arc};
 use num_traits::FromPrimitive;
 
 use crate::{
-    arch::CurrentIrqArch, exception::InterruptArch, kdebug, kinfo, libs::rwlock::RwLock,
-    mm::percpu::PerCpu, process::ProcessManager, smp::core::smp_get_processor_id,
-    syscall::SystemError, time::timer::clock,
+    arch::{sched::sched, CurrentIrqArch},
+    exception::InterruptArch,
+    include::bindings::bindings::smp_get_total_cpu,
+    kdebug, kinfo,
+    libs::{rwlock::RwLock, spinlock::SpinLock, wait_queue::WaitQueue},
+    mm::percpu::PerCpu,
+    process::{
+        kthread::{KernelThreadClosure, KernelThreadMechanism},
+        ProcessManager,
+    },
+    sched::cputime::{cputime_switch, CpuTimeContext},
+    smp::{core::smp_get_processor_id, cpu::CPU_MASK_WORDS},
+    syscall::SystemError,
+    time::hrtimer::hrtimer_now,
 };
 
 const MAX_SOFTIRQ_NUM: u64 = 64;
-const MAX_SOFTIRQ_RESTART: i32 = 20;
+/// 一次处理软中断时，最多重新检查等待的软中断的轮数
+const MAX_SOFTIRQ_RESTART: i32 = 10;
+/// 一次处理软中断的时间预算（纳秒）。超出预算后，剩余的软中断交给ksoftirqd处理
+const SOFTIRQ_TIME_BUDGET_NS: u64 = 2_000_000;
+
+/// 每个cpu是否正在处理软中断（防止中断嵌套时重入）
+static SOFTIRQ_RUNNING: [AtomicBool; PerCpu::MAX_CPU_NUM] =
+    [const { AtomicBool::new(false) }; PerCpu::MAX_CPU_NUM];
+/// 每个cpu的ksoftirqd是否已经创建
+static KSOFTIRQD_STARTED: [AtomicBool; PerCpu::MAX_CPU_NUM] =
+    [const { AtomicBool::new(false) }; PerCpu::MAX_CPU_NUM];
+/// 每个cpu的ksoftirqd是否接管了软中断的处理。接管期间，中断返回时不再处理软中断
+static KSOFTIRQD_ACTIVE: [AtomicBool; PerCpu::MAX_CPU_NUM] =
+    [const { AtomicBool::new(false) }; PerCpu::MAX_CPU_NUM];
+static KSOFTIRQD_WAIT_LOCK: [SpinLock<()>; PerCpu::MAX_CPU_NUM] =
+    [const { SpinLock::new(()) }; PerCpu::MAX_CPU_NUM];
+static KSOFTIRQD_WAIT: [WaitQueue; PerCpu::MAX_CPU_NUM] = [WaitQueue::INIT; PerCpu::MAX_CPU_NUM];
 
 static mut __CPU_PENDING: Option<Box<[VecStatus; PerCpu::MAX_CPU_NUM]>> = None;
 static mut __SORTIRQ_VECTORS: *mut Softirq = null_mut();
@@ -64,6 +91,14 @@ pub enum SoftirqNumber {
     /// 时钟软中断信号
     TIMER = 0,
     VideoRefresh = 1, //帧缓冲区刷新软中断
+    /// 调度器的负载均衡软中断
+    SchedBalance = 2,
+    /// RCU回调函数软中断
+    RCU = 3,
+    /// 网卡收包软中断
+    NetRx = 4,
+    /// 唤醒kmsgd输出日志
+    Kmsg = 5,
 }
 
 impl From<u64> for SoftirqNumber {
@@ -77,6 +112,10 @@ bitflags! {
     pub struct VecStatus: u64 {
         const TIMER = 1 << 0;
         const VIDEO_REFRESH = 1 << 1;
+        const SCHED_BALANCE = 1 << 2;
+        const RCU = 1 << 3;
+        const NET_RX = 1 << 4;
+        const KMSG = 1 << 5;
     }
 }
 
@@ -160,16 +199,42 @@ impl Softirq {
         compiler_fence(Ordering::SeqCst);
     }
 
+    /// 在中断返回前处理当前cpu上等待的软中断（调用时中断是关闭的）
+    ///
+    /// 如果在预算内没有处理完，剩余的工作交给当前cpu的ksoftirqd，以免在大量中断（例如收包风暴）下
+    /// cpu一直处于软中断中，无法回到进程
     pub fn do_softirq(&self) {
+        let cpu_id = smp_get_processor_id() as usize;
+        if cpu_pending(cpu_id).is_empty()
+            || SOFTIRQ_RUNNING[cpu_id].load(Ordering::Relaxed)
+            || KSOFTIRQD_ACTIVE[cpu_id].load(Ordering::Relaxed)
+        {
+            return;
+        }
+        let prev = cputime_switch(CpuTimeContext::Softirq);
+        let remaining = self.handle_pending(cpu_id);
+        cputime_switch(prev);
+        if remaining {
+            wakeup_ksoftirqd(cpu_id);
+        }
+    }
+
+    /// 处理当前cpu上等待的软中断，直到没有等待的软中断，或者用完了轮数、时间预算
+    ///
+    /// 调用者需要保证已经关闭了中断，返回时中断仍然是关闭的
+    ///
+    /// ## 返回值
+    ///
+    /// 如果用完预算时仍有等待处理的软中断，返回true
+    fn handle_pending(&self, cpu_id: usize) -> bool {
         // TODO pcb的flags未修改
-        // todo: 是否需要判断在当前cpu上面，该函数的嵌套层数？（防止爆栈）
-        let end = clock() + 500 * 2;
-        let cpu_id = smp_get_processor_id();
+        let end = hrtimer_now() + SOFTIRQ_TIME_BUDGET_NS;
         let mut max_restart = MAX_SOFTIRQ_RESTART;
-        loop {
+        SOFTIRQ_RUNNING[cpu_id].store(true, Ordering::Relaxed);
+        let remaining = loop {
             compiler_fence(Ordering::SeqCst);
-            let pending = cpu_pending(cpu_id as usize).bits;
-            cpu_pending(cpu_id as usize).bits = 0;
+            let pending = cpu_pending(cpu_id).bits;
+            cpu_pending(cpu_id).bits = 0;
             compiler_fence(Ordering::SeqCst);
 
             unsafe { CurrentIrqArch::interrupt_enable() };
@@ -186,35 +251,34 @@ impl Softirq {
                         continue;
                     }
 
-                    let prev_count: usize = ProcessManager::current_pcb().preempt_count();
+                    let prev_count: usize = ProcessManager::current().preempt_count();
 
+                    tracepoint!(SoftirqEntry, i, 0);
                     softirq_func.as_ref().unwrap().run();
-                    if unlikely(prev_count != ProcessManager::current_pcb().preempt_count()) {
+                    tracepoint!(SoftirqExit, i, 0);
+                    if unlikely(prev_count != ProcessManager::current().preempt_count()) {
                         kdebug!(
                             "entered softirq {:?} with preempt_count {:?},exited with {:?}",
                             i,
                             prev_count,
-                            ProcessManager::current_pcb().preempt_count()
+                            ProcessManager::current().preempt_count()
                         );
-                        unsafe { ProcessManager::current_pcb().set_preempt_count(prev_count) };
+                        unsafe { ProcessManager::current().set_preempt_count(prev_count) };
                     }
                 }
             }
             unsafe { CurrentIrqArch::interrupt_disable() };
             max_restart -= 1;
             compiler_fence(Ordering::SeqCst);
-            if cpu_pending(cpu_id as usize).is_empty() {
-                compiler_fence(Ordering::SeqCst);
-                if clock() < end && max_restart > 0 {
-                    continue;
-                } else {
-                    break;
-                }
-            } else {
-                // TODO：当有softirqd时 唤醒它
-                break;
+            if cpu_pending(cpu_id).is_empty() {
+                break false;
             }
-        }
+            if hrtimer_now() >= end || max_restart <= 0 {
+                break true;
+            }
+        };
+        SOFTIRQ_RUNNING[cpu_id].store(false, Ordering::Relaxed);
+        return remaining;
     }
 
     pub fn raise_softirq(&self, softirq_num: SoftirqNumber) {
@@ -235,6 +299,62 @@ impl Softirq {
     }
 }
 
+/// 唤醒cpu的ksoftirqd，由它接管剩余的软中断
+fn wakeup_ksoftirqd(cpu: usize) {
+    if !KSOFTIRQD_STARTED[cpu].load(Ordering::Acquire) {
+        return;
+    }
+    KSOFTIRQD_ACTIVE[cpu].store(true, Ordering::Relaxed);
+    let _guard = KSOFTIRQD_WAIT_LOCK[cpu].lock_irqsave();
+    KSOFTIRQD_WAIT[cpu].wakeup(None);
+}
+
+/// ksoftirqd的主循环：以普通优先级处理中断返回时没有处理完的软中断，每处理一批就让出一次cpu
+fn ksoftirqd_thread(cpu: usize) -> i32 {
+    loop {
+        // 创建后需要先被迁移到绑定的cpu上
+        if smp_get_processor_id() as usize != cpu {
+            sched();
+            continue;
+        }
+
+        let guard = KSOFTIRQD_WAIT_LOCK[cpu].lock_irqsave();
+        if cpu_pending(cpu).is_empty() {
+            KSOFTIRQD_ACTIVE[cpu].store(false, Ordering::Relaxed);
+            KSOFTIRQD_WAIT[cpu].sleep_uninterruptible_unlock_spinlock(guard);
+            continue;
+        }
+        drop(guard);
+
+        // 与在中断返回时处理一样，处理软中断的过程中不允许抢占
+        ProcessManager::preempt_disable();
+        let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+        if !SOFTIRQ_RUNNING[cpu].load(Ordering::Relaxed) {
+            softirq_vectors().handle_pending(cpu);
+        }
+        drop(irq_guard);
+        ProcessManager::preempt_enable();
+
+        sched();
+    }
+}
+
+/// 为每个cpu创建ksoftirqd（需要在内核线程机制初始化完成之后调用）
+pub fn ksoftirqd_init() {
+    let nr_cpus = unsafe { smp_get_total_cpu() } as usize;
+    for cpu in 0..nr_cpus {
+        let closure = KernelThreadClosure::UsizeClosure((Box::new(ksoftirqd_thread), cpu));
+        let pcb = KernelThreadMechanism::create(closure, format!("ksoftirqd/{}", cpu))
+            .expect("Failed to create ksoftirqd");
+        let mut words = [0u64; CPU_MASK_WORDS];
+        words[cpu / 64] |= 1 << (cpu % 64);
+        pcb.sched_info().cpus_allowed().store_words(&words);
+        KSOFTIRQD_STARTED[cpu].store(true, Ordering::Release);
+        ProcessManager::wakeup(&pcb).ok();
+    }
+    kinfo!("ksoftirqd initialized");
+}
+
 // ======= 以下为给C提供的接口 =======
 #[no_mangle]
 pub extern "C" fn rs_raise_softirq(softirq_num: u32) {
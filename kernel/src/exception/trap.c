@@ -7,6 +7,10 @@
 #include <sched/sched.h>
 
 extern void ignore_int();
+// 缺页异常的Rust处理函数，处理成功时返回0
+extern int rs_do_page_fault(struct pt_regs *regs, uint64_t error_code, uint64_t address);
+// 性能计数器溢出产生的NMI的Rust处理函数，NMI由性能计数器产生时返回true
+extern bool rs_perf_nmi(struct pt_regs *regs);
 
 // 0 #DE 除法错误
 void do_divide_error(struct pt_regs *regs, unsigned long error_code)
@@ -34,6 +38,8 @@ void do_debug(struct pt_regs *regs, unsigned long error_code)
 // 2 不可屏蔽中断
 void do_nmi(struct pt_regs *regs, unsigned long error_code)
 {
+    if (rs_perf_nmi(regs))
+        return;
 
     printk("[ ");
     printk_color(BLUE, BLACK, "INT");
@@ -202,11 +208,16 @@ void do_general_protection(struct pt_regs *regs, unsigned long error_code)
 // 14 #PF 页故障
 void do_page_fault(struct pt_regs *regs, unsigned long error_code)
 {
-    cli();
     unsigned long cr2 = 0;
 
     __asm__ __volatile__("movq	%%cr2,	%0" : "=r"(cr2)::"memory");
 
+    // 写时复制等可以被恢复的缺页异常，由Rust的缺页处理函数处理
+    if (rs_do_page_fault(regs, error_code, cr2) == 0)
+        return;
+
+    cli();
+
     kerror("do_page_fault(14),Error code :%#018lx,RSP:%#018lx, RBP=%#018lx, RIP:%#018lx CPU:%d, pid=%d\n", error_code,
            regs->rsp, regs->rbp, regs->rip, rs_current_pcb_cpuid(), rs_current_pcb_pid());
     kerror("regs->rax = %#018lx\n", regs->rax);
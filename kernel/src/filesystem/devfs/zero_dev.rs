@@ -4,7 +4,14 @@ use crate::filesystem::vfs::syscall::ModeType;
 use crate::filesystem::vfs::{
     core::generate_inode_id, FilePrivateData, FileSystem, FileType, IndexNode, Metadata, PollStatus,
 };
-use crate::{libs::spinlock::SpinLock, syscall::SystemError, time::TimeSpec};
+use crate::ipc::shm::shmem_zero_setup;
+use crate::mm::syscall::{MapFlags, ProtFlags};
+use crate::mm::ucontext::AddressSpace;
+use crate::mm::VirtAddr;
+use crate::{
+    arch::mm::usercopy::clear_user_generic, libs::spinlock::SpinLock, syscall::SystemError,
+    time::TimeSpec,
+};
 use alloc::{
     string::String,
     sync::{Arc, Weak},
@@ -118,13 +125,54 @@ impl IndexNode for LockedZeroInode {
             return Err(SystemError::EINVAL);
         }
 
-        for i in 0..len {
-            buf[i] = 0;
+        // buf可能是用户空间的缓冲区，使用rep stos批量清零，遇到无法访问的页面时返回错误
+        if unsafe { clear_user_generic(buf.as_mut_ptr(), len) } != 0 {
+            return Err(SystemError::EFAULT);
         }
 
         return Ok(len);
     }
 
+    /// 映射/dev/zero
+    ///
+    /// 私有映射是一个普通的匿名映射：映射时不分配物理页，读缺页映射共享的零页，第一次写入时才分配页面。
+    ///
+    /// 与Linux相同，共享映射得到的是共享的匿名内存：它映射一个新建的、内容全为0的内存文件
+    /// （见[`shmem_zero_setup`]），fork之后父子进程能看到彼此的写入
+    fn mmap(
+        &self,
+        start_vaddr: VirtAddr,
+        len: usize,
+        prot_flags: ProtFlags,
+        map_flags: MapFlags,
+        _offset: usize,
+    ) -> Result<usize, SystemError> {
+        if map_flags.contains(MapFlags::MAP_SHARED) {
+            let inode = shmem_zero_setup(len)?;
+            let cache = inode.page_cache().ok_or(SystemError::ENODEV)?;
+            let start_page = AddressSpace::current()?.write().map_file(
+                start_vaddr,
+                len,
+                prot_flags,
+                map_flags,
+                cache,
+                0,
+                true,
+                true,
+            )?;
+            return Ok(start_page.virt_address().data());
+        }
+
+        let start_page = AddressSpace::current()?.write().map_anonymous(
+            start_vaddr,
+            len,
+            prot_flags,
+            map_flags | MapFlags::MAP_ANONYMOUS,
+            true,
+        )?;
+        return Ok(start_page.virt_address().data());
+    }
+
     /// 写设备 - 应该调用设备的函数读写，而不是通过文件系统读写
     fn write_at(
         &self,
@@ -0,0 +1,519 @@
+//! epoll：可扩展的I/O事件通知机制
+//!
+//! 与poll不同，epoll实例保存一个持久的兴趣集合（按照文件描述符排序的红黑树），
+//! 加入兴趣集合时通过[`IndexNode::poll_wait`]在文件的等待队列上注册一个回调。
+//! 文件就绪时，回调把对应的项加入就绪链表，并唤醒在epoll_wait中睡眠的进程。
+//! 因此epoll_wait只需要检查就绪链表中的项，开销与就绪的文件数成正比，而不是与兴趣集合的大小成正比。
+//!
+//! - 水平触发（默认）：报告之后，项会被放回就绪链表，下一次epoll_wait时重新检查，直到文件不再就绪
+//! - 边缘触发（EPOLLET）：报告之后，项离开就绪链表，直到文件的等待队列再次被唤醒
+//! - 单次触发（EPOLLONESHOT）：报告之后，项被禁用，直到通过EPOLL_CTL_MOD重新设置
+
+use core::sync::atomic::{AtomicBool, Ordering};
+
+use alloc::{
+    collections::VecDeque,
+    string::String,
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+
+use crate::{
+    arch::{sched::sched, CurrentIrqArch},
+    exception::InterruptArch,
+    filesystem::vfs::{
+        core::generate_inode_id,
+        file::{File, FileMode},
+        poll::{inode_poll_events, signal_pending, PollTable},
+        syscall::ModeType,
+        FilePrivateData, FileSystem, FileType, IndexNode, Metadata, PollStatus,
+    },
+    libs::{
+        rbtree::RBTree,
+        spinlock::SpinLock,
+        wait_queue::{WaitQueue, WaitQueueCallback},
+    },
+    process::{ProcessManager, ProcessState},
+    syscall::SystemError,
+    time::{
+        hrtimer::{hrtimer_now, HrTimer},
+        timer::{current_timer_slack_ns, WakeUpHelper},
+        TimeSpec,
+    },
+};
+
+pub mod syscall;
+
+/// epoll_ctl的操作：把文件加入兴趣集合
+pub const EPOLL_CTL_ADD: i32 = 1;
+/// epoll_ctl的操作：把文件从兴趣集合中移除
+pub const EPOLL_CTL_DEL: i32 = 2;
+/// epoll_ctl的操作：修改文件关心的事件
+pub const EPOLL_CTL_MOD: i32 = 3;
+
+/// epoll_wait一次最多返回的事件数
+pub const EP_MAX_EVENTS: usize = i32::MAX as usize / core::mem::size_of::<EPollEvent>();
+
+bitflags! {
+    /// epoll的事件（与poll的事件的值相同），以及控制触发方式的标志
+    pub struct EPollEventType: u32 {
+        const EPOLLIN = 0x1;
+        const EPOLLPRI = 0x2;
+        const EPOLLOUT = 0x4;
+        const EPOLLERR = 0x8;
+        const EPOLLHUP = 0x10;
+        const EPOLLNVAL = 0x20;
+        const EPOLLRDNORM = 0x40;
+        const EPOLLRDBAND = 0x80;
+        const EPOLLWRNORM = 0x100;
+        const EPOLLWRBAND = 0x200;
+        const EPOLLMSG = 0x400;
+        const EPOLLRDHUP = 0x2000;
+        /// 多个epoll实例等待同一个文件时，只唤醒其中一个（目前与普通的等待相同）
+        const EPOLLEXCLUSIVE = 1 << 28;
+        /// 在处理事件期间阻止系统休眠（目前忽略）
+        const EPOLLWAKEUP = 1 << 29;
+        /// 报告一次之后禁用，直到通过EPOLL_CTL_MOD重新设置
+        const EPOLLONESHOT = 1 << 30;
+        /// 边缘触发
+        const EPOLLET = 1 << 31;
+
+        /// 控制触发方式的标志
+        const EP_PRIVATE_BITS = Self::EPOLLEXCLUSIVE.bits | Self::EPOLLWAKEUP.bits
+            | Self::EPOLLONESHOT.bits | Self::EPOLLET.bits;
+    }
+}
+
+/// 用户传入的epoll_event结构体（x86_64上是紧凑排列的）
+#[repr(C, packed)]
+#[derive(Debug, Clone, Copy, Default)]
+pub struct EPollEvent {
+    /// 关心的（或者已经就绪的）事件
+    pub events: u32,
+    /// 用户数据，原样返回
+    pub data: u64,
+}
+
+/// 兴趣集合
+#[derive(Debug)]
+struct EPollItems {
+    tree: RBTree<i32, Arc<EPollItem>>,
+}
+
+/// 红黑树中的裸指针只会在兴趣集合的锁的保护下访问
+unsafe impl Send for EPollItems {}
+
+/// epoll实例
+#[derive(Debug)]
+pub struct EventPoll {
+    /// 兴趣集合，按照文件描述符排序
+    items: SpinLock<EPollItems>,
+    ready: Arc<EPollReady>,
+    metadata: Metadata,
+}
+
+/// epoll实例的就绪链表
+///
+/// 回调通过它而不是epoll实例本身通知等待者：回调持有文件的等待队列的锁，
+/// 如果在回调中释放了epoll实例的最后一个引用，注销回调时会在同一个等待队列上死锁
+#[derive(Debug)]
+struct EPollReady {
+    /// 就绪的项。回调可能在中断上下文中执行，因此需要关中断加锁
+    list: SpinLock<VecDeque<Arc<EPollItem>>>,
+    /// 在epoll_wait中睡眠的进程，以及poll这个epoll实例的等待者
+    wait_queue: Arc<WaitQueue>,
+}
+
+/// 兴趣集合中的一项
+#[derive(Debug)]
+struct EPollItem {
+    fd: i32,
+    /// 文件被关闭之后，这一项在下一次被检查时被移除
+    file: Weak<SpinLock<File>>,
+    ready_list: Arc<EPollReady>,
+    event: SpinLock<EPollEvent>,
+    /// 在文件的等待队列上注册的回调。被移除时释放，从而把回调从等待队列中移除
+    table: SpinLock<Option<PollTable>>,
+    /// 是否在就绪链表中
+    ready: AtomicBool,
+    /// 是否已经从兴趣集合中移除
+    removed: AtomicBool,
+    self_ref: Weak<EPollItem>,
+}
+
+impl EPollItem {
+    fn new(
+        fd: i32,
+        file: &Arc<SpinLock<File>>,
+        ready_list: Arc<EPollReady>,
+        event: EPollEvent,
+    ) -> Arc<Self> {
+        return Arc::new_cyclic(|self_ref| Self {
+            fd,
+            file: Arc::downgrade(file),
+            ready_list,
+            event: SpinLock::new(event),
+            table: SpinLock::new(None),
+            ready: AtomicBool::new(false),
+            removed: AtomicBool::new(false),
+            self_ref: self_ref.clone(),
+        });
+    }
+
+    /// 在文件的等待队列上注册回调
+    fn register(self: &Arc<Self>, inode: &Arc<dyn IndexNode>) {
+        let mut table = PollTable::with_callback(self.clone());
+        inode.poll_wait(&mut table);
+        *self.table.lock_irqsave() = Some(table);
+    }
+
+    /// 从兴趣集合中移除之后调用：从文件的等待队列上注销回调
+    fn unregister(&self) {
+        self.removed.store(true, Ordering::SeqCst);
+        let table = self.table.lock_irqsave().take();
+        drop(table);
+    }
+
+    /// 把这一项加入所属的epoll实例的就绪链表，并唤醒等待者
+    fn mark_ready(&self) {
+        if self.removed.load(Ordering::SeqCst) || self.ready.swap(true, Ordering::SeqCst) {
+            return;
+        }
+        let item = match self.self_ref.upgrade() {
+            Some(item) => item,
+            None => return,
+        };
+        self.ready_list.list.lock_irqsave().push_back(item);
+        self.ready_list
+            .wait_queue
+            .wakeup_all(Some(ProcessState::Blocked(true)));
+    }
+}
+
+impl WaitQueueCallback for EPollItem {
+    fn wake(&self, _key: u64) {
+        // 单次触发的项被禁用之后，不再关心任何事件
+        let events = EPollEventType::from_bits_truncate(self.event.lock_irqsave().events);
+        if events
+            .difference(EPollEventType::EP_PRIVATE_BITS)
+            .is_empty()
+        {
+            return;
+        }
+        self.mark_ready();
+    }
+}
+
+impl EventPoll {
+    pub fn new() -> Arc<Self> {
+        let metadata = Metadata {
+            dev_id: 0,
+            inode_id: generate_inode_id(),
+            size: 0,
+            blk_size: 0,
+            blocks: 0,
+            atime: TimeSpec::default(),
+            mtime: TimeSpec::default(),
+            ctime: TimeSpec::default(),
+            file_type: FileType::File,
+            mode: ModeType::from_bits_truncate(0o600),
+            nlinks: 1,
+            uid: 0,
+            gid: 0,
+            raw_dev: 0,
+        };
+        return Arc::new(Self {
+            items: SpinLock::new(EPollItems {
+                tree: RBTree::new(),
+            }),
+            ready: Arc::new(EPollReady {
+                list: SpinLock::new(VecDeque::new()),
+                wait_queue: Arc::new(WaitQueue::INIT),
+            }),
+            metadata,
+        });
+    }
+
+    /// 修改兴趣集合
+    ///
+    /// ## 参数
+    ///
+    /// - `op`：EPOLL_CTL_ADD、EPOLL_CTL_DEL或者EPOLL_CTL_MOD
+    /// - `fd`、`file`：目标文件
+    /// - `event`：关心的事件和用户数据（EPOLL_CTL_DEL时忽略）
+    pub fn ctl(
+        &self,
+        op: i32,
+        fd: i32,
+        file: &Arc<SpinLock<File>>,
+        event: EPollEvent,
+    ) -> Result<(), SystemError> {
+        let inode = file.lock().inode();
+        // 不支持嵌套的epoll：回调会在持有内层的等待队列的锁时唤醒外层，成环时会死锁
+        if inode.as_any_ref().downcast_ref::<EventPoll>().is_some() {
+            return Err(SystemError::EINVAL);
+        }
+        let flags = EPollEventType::from_bits_truncate(event.events);
+        if flags.contains(EPollEventType::EPOLLEXCLUSIVE)
+            && (op == EPOLL_CTL_MOD || flags.contains(EPollEventType::EPOLLONESHOT))
+        {
+            return Err(SystemError::EINVAL);
+        }
+
+        let mut items = self.items.lock_irqsave();
+        // 原来的文件已经被关闭，文件描述符被重新使用时，旧的项已经失效
+        let existing = items
+            .tree
+            .get(&fd)
+            .filter(|item| {
+                item.file
+                    .upgrade()
+                    .map_or(false, |old| Arc::ptr_eq(&old, file))
+            })
+            .cloned();
+        match op {
+            EPOLL_CTL_ADD => {
+                if existing.is_some() {
+                    return Err(SystemError::EEXIST);
+                }
+                if let Some(stale) = items.tree.remove(&fd) {
+                    stale.unregister();
+                }
+                let item = EPollItem::new(fd, file, self.ready.clone(), event);
+                items.tree.insert(fd, item.clone());
+                drop(items);
+                item.register(&inode);
+                Self::check_ready(&item, &inode);
+            }
+            EPOLL_CTL_MOD => {
+                let item = existing.ok_or(SystemError::ENOENT)?;
+                drop(items);
+                let old_exclusive =
+                    EPollEventType::from_bits_truncate(item.event.lock_irqsave().events)
+                        .contains(EPollEventType::EPOLLEXCLUSIVE);
+                if old_exclusive {
+                    return Err(SystemError::EINVAL);
+                }
+                *item.event.lock_irqsave() = event;
+                Self::check_ready(&item, &inode);
+            }
+            EPOLL_CTL_DEL => {
+                existing.ok_or(SystemError::ENOENT)?;
+                let item = items.tree.remove(&fd).unwrap();
+                drop(items);
+                item.unregister();
+            }
+            _ => return Err(SystemError::EINVAL),
+        }
+        return Ok(());
+    }
+
+    /// 文件已经就绪时，立即把项加入就绪链表（否则要等到文件的等待队列下一次被唤醒）
+    fn check_ready(item: &Arc<EPollItem>, inode: &Arc<dyn IndexNode>) {
+        let events = item.event.lock_irqsave().events;
+        if Self::revents(inode, events) != 0 {
+            item.mark_ready();
+        }
+    }
+
+    /// 文件已经就绪的、并且是关心的事件（错误和挂断总是会被报告）
+    fn revents(inode: &Arc<dyn IndexNode>, events: u32) -> u32 {
+        let wanted = EPollEventType::from_bits_truncate(events)
+            .difference(EPollEventType::EP_PRIVATE_BITS)
+            .bits;
+        if wanted == 0 {
+            return 0;
+        }
+        let wanted = wanted | (EPollEventType::EPOLLERR | EPollEventType::EPOLLHUP).bits;
+        return inode_poll_events(inode) as u16 as u32 & wanted;
+    }
+
+    /// 从就绪链表中取出最多`max`个就绪的事件
+    fn collect(&self, max: usize, out: &mut Vec<EPollEvent>) {
+        // 水平触发的项在本轮之后放回就绪链表，避免在本轮中被重复报告
+        let mut requeue: Vec<Arc<EPollItem>> = Vec::new();
+        while out.len() < max {
+            let item = match self.ready.list.lock_irqsave().pop_front() {
+                Some(item) => item,
+                None => break,
+            };
+            // 先清除标志，使得检查期间到来的唤醒可以把项重新加入就绪链表
+            item.ready.store(false, Ordering::SeqCst);
+            if item.removed.load(Ordering::SeqCst) {
+                continue;
+            }
+            let file = match item.file.upgrade() {
+                Some(file) => file,
+                None => {
+                    self.remove_dead(&item);
+                    continue;
+                }
+            };
+            let inode = file.lock().inode();
+            let event = *item.event.lock_irqsave();
+            let revents = Self::revents(&inode, event.events);
+            if revents == 0 {
+                continue;
+            }
+            out.push(EPollEvent {
+                events: revents,
+                data: event.data,
+            });
+
+            let flags = EPollEventType::from_bits_truncate(event.events);
+            if flags.contains(EPollEventType::EPOLLONESHOT) {
+                let mut guard = item.event.lock_irqsave();
+                guard.events = event.events & EPollEventType::EP_PRIVATE_BITS.bits;
+            } else if !flags.contains(EPollEventType::EPOLLET) {
+                requeue.push(item);
+            }
+        }
+        for item in requeue {
+            item.mark_ready();
+        }
+    }
+
+    /// 移除文件已经被关闭的项
+    fn remove_dead(&self, item: &Arc<EPollItem>) {
+        let mut items = self.items.lock_irqsave();
+        let is_same = items
+            .tree
+            .get(&item.fd)
+            .map_or(false, |cur| Arc::ptr_eq(cur, item));
+        if is_same {
+            items.tree.remove(&item.fd);
+        }
+        drop(items);
+        item.unregister();
+    }
+
+    /// 等待就绪的事件
+    ///
+    /// ## 参数
+    ///
+    /// - `max`：最多返回的事件数
+    /// - `timeout_ns`：最长等待的时间，None表示一直等待
+    ///
+    /// ## 返回值
+    ///
+    /// 就绪的事件（超时时为空），收到信号时返回EINTR
+    pub fn wait(
+        &self,
+        max: usize,
+        timeout_ns: Option<u64>,
+    ) -> Result<Vec<EPollEvent>, SystemError> {
+        let mut out = Vec::new();
+        let deadline = timeout_ns.map(|ns| hrtimer_now().saturating_add(ns));
+        let pcb = ProcessManager::current_pcb();
+        loop {
+            self.collect(max, &mut out);
+            if !out.is_empty() || timeout_ns == Some(0) {
+                return Ok(out);
+            }
+            if signal_pending() {
+                return Err(SystemError::EINTR);
+            }
+            if deadline.map_or(false, |deadline| hrtimer_now() >= deadline) {
+                return Ok(out);
+            }
+            let timer = deadline.map(|deadline| {
+                HrTimer::new_range(
+                    WakeUpHelper::new(pcb.clone()),
+                    deadline,
+                    current_timer_slack_ns(),
+                )
+            });
+
+            // 先加入等待队列、标记睡眠，再检查就绪链表，因此检查之后到来的唤醒不会丢失
+            let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+            self.ready.wait_queue.add_waiter(pcb.clone());
+            ProcessManager::mark_sleep(true).ok();
+            if !self.ready.list.lock().is_empty() || signal_pending() {
+                ProcessManager::cancel_sleep();
+                drop(irq_guard);
+                self.ready.wait_queue.remove_waiter(&pcb);
+                continue;
+            }
+            if let Some(timer) = &timer {
+                timer.start();
+            }
+            drop(irq_guard);
+            sched();
+
+            if let Some(timer) = timer {
+                timer.cancel();
+            }
+            self.ready.wait_queue.remove_waiter(&pcb);
+        }
+    }
+}
+
+impl Drop for EventPoll {
+    fn drop(&mut self) {
+        // 注销所有的回调，否则文件的等待队列会一直持有这些项
+        let mut items = self.items.lock_irqsave();
+        while let Some((_, item)) = items.tree.pop_first() {
+            item.unregister();
+        }
+        drop(items);
+        self.ready.list.lock_irqsave().clear();
+    }
+}
+
+impl IndexNode for EventPoll {
+    fn open(&self, _data: &mut FilePrivateData, _mode: &FileMode) -> Result<(), SystemError> {
+        return Ok(());
+    }
+
+    fn close(&self, _data: &mut FilePrivateData) -> Result<(), SystemError> {
+        return Ok(());
+    }
+
+    fn read_at(
+        &self,
+        _offset: usize,
+        _len: usize,
+        _buf: &mut [u8],
+        _data: &mut FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        return Err(SystemError::EINVAL);
+    }
+
+    fn write_at(
+        &self,
+        _offset: usize,
+        _len: usize,
+        _buf: &[u8],
+        _data: &mut FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        return Err(SystemError::EINVAL);
+    }
+
+    /// 就绪链表不为空时可读（就绪链表中的项可能已经不再就绪，与Linux相同，此时只是一次虚假的唤醒）
+    fn poll(&self) -> Result<PollStatus, SystemError> {
+        if self.ready.list.lock_irqsave().is_empty() {
+            return Ok(PollStatus::empty());
+        }
+        return Ok(PollStatus::READ);
+    }
+
+    fn poll_wait(&self, table: &mut PollTable) {
+        table.wait(&self.ready.wait_queue);
+    }
+
+    fn metadata(&self) -> Result<Metadata, SystemError> {
+        return Ok(self.metadata.clone());
+    }
+
+    fn as_any_ref(&self) -> &dyn core::any::Any {
+        self
+    }
+
+    fn fs(&self) -> Arc<dyn FileSystem> {
+        todo!("epoll is not in any filesystem")
+    }
+
+    fn list(&self) -> Result<Vec<String>, SystemError> {
+        return Err(SystemError::ENOTDIR);
+    }
+}
@@ -0,0 +1,124 @@
+use alloc::sync::Arc;
+
+use crate::{
+    arch::ipc::signal::SigSet,
+    filesystem::vfs::{
+        file::{File, FileMode},
+        poll::{restore_sigmask, set_temp_sigmask},
+    },
+    libs::casting::DowncastArc,
+    process::ProcessManager,
+    syscall::{
+        user_access::{UserBufferReader, UserBufferWriter},
+        Syscall, SystemError,
+    },
+};
+
+use super::{EPollEvent, EventPoll, EPOLL_CTL_DEL, EP_MAX_EVENTS};
+
+/// 获取文件描述符对应的epoll实例
+fn get_epoll(epfd: i32) -> Result<Arc<EventPoll>, SystemError> {
+    let file = ProcessManager::current_pcb()
+        .fd_table()
+        .read()
+        .get_file_by_fd(epfd)
+        .ok_or(SystemError::EBADF)?;
+    let inode = file.lock().inode();
+    return inode.downcast_arc::<EventPoll>().ok_or(SystemError::EINVAL);
+}
+
+impl Syscall {
+    /// 创建一个epoll实例。`size`只需要大于0（与Linux相同，不再有实际的作用）
+    pub fn epoll_create(size: i32) -> Result<usize, SystemError> {
+        if size <= 0 {
+            return Err(SystemError::EINVAL);
+        }
+        return Self::epoll_create1(0);
+    }
+
+    /// 创建一个epoll实例，返回它的文件描述符
+    ///
+    /// `flags`只能包含EPOLL_CLOEXEC（与O_CLOEXEC的值相同）
+    pub fn epoll_create1(flags: u32) -> Result<usize, SystemError> {
+        let flags = FileMode::from_bits(flags).ok_or(SystemError::EINVAL)?;
+        if !FileMode::O_CLOEXEC.contains(flags) {
+            return Err(SystemError::EINVAL);
+        }
+        let mut file = File::new(EventPoll::new(), FileMode::O_RDWR)?;
+        if flags.contains(FileMode::O_CLOEXEC) {
+            file.set_close_on_exec(true);
+        }
+        let fd = ProcessManager::current_pcb()
+            .fd_table()
+            .write()
+            .alloc_fd(file, None)?;
+        return Ok(fd as usize);
+    }
+
+    /// 修改epoll实例的兴趣集合
+    pub fn epoll_ctl(
+        epfd: i32,
+        op: i32,
+        fd: i32,
+        event: *const EPollEvent,
+    ) -> Result<usize, SystemError> {
+        let epoll = get_epoll(epfd)?;
+        if fd == epfd {
+            return Err(SystemError::EINVAL);
+        }
+        let file = ProcessManager::current_pcb()
+            .fd_table()
+            .read()
+            .get_file_by_fd(fd)
+            .ok_or(SystemError::EBADF)?;
+        let event = if op == EPOLL_CTL_DEL {
+            EPollEvent::default()
+        } else {
+            let reader = UserBufferReader::new(event, core::mem::size_of::<EPollEvent>(), true)?;
+            *reader.read_one_from_user::<EPollEvent>(0)?
+        };
+        epoll.ctl(op, fd, &file, event)?;
+        return Ok(0);
+    }
+
+    /// 等待epoll实例中的文件就绪
+    ///
+    /// `timeout_ms`为负数时一直等待，为0时只检查一次
+    pub fn epoll_wait(
+        epfd: i32,
+        events: *mut EPollEvent,
+        maxevents: i32,
+        timeout_ms: i32,
+    ) -> Result<usize, SystemError> {
+        if maxevents <= 0 || maxevents as usize > EP_MAX_EVENTS {
+            return Err(SystemError::EINVAL);
+        }
+        let maxevents = maxevents as usize;
+        let mut writer =
+            UserBufferWriter::new(events, maxevents * core::mem::size_of::<EPollEvent>(), true)?;
+        let epoll = get_epoll(epfd)?;
+        let timeout_ns = if timeout_ms < 0 {
+            None
+        } else {
+            Some(timeout_ms as u64 * 1_000_000)
+        };
+        let ready = epoll.wait(maxevents, timeout_ns)?;
+        writer.copy_to_user(&ready, 0)?;
+        return Ok(ready.len());
+    }
+
+    /// 与epoll_wait相同，但是可以在等待期间临时替换信号掩码
+    pub fn epoll_pwait(
+        epfd: i32,
+        events: *mut EPollEvent,
+        maxevents: i32,
+        timeout_ms: i32,
+        sigmask: *const SigSet,
+        sigsetsize: usize,
+    ) -> Result<usize, SystemError> {
+        let old = set_temp_sigmask(sigmask, sigsetsize)?;
+        let r = Self::epoll_wait(epfd, events, maxevents, timeout_ms);
+        restore_sigmask(old);
+        return r;
+    }
+}
@@ -0,0 +1,351 @@
+//! FAT目录的内存索引
+//!
+//! 在FAT目录中按名字查找文件，需要从头遍历目录的所有目录项，并对每个文件解码长文件名。创建文件时还要再遍历一次目录，
+//! 用来检查重名、生成不冲突的短文件名、寻找空闲的目录项。对于包含上万个文件的目录（例如spool、cache目录），
+//! 每一次创建文件的开销都与目录的大小成正比。
+//!
+//! 目录第一次被查找时，读取整个目录建立索引：
+//! - 文件名（大写的长文件名与短文件名）到目录项位置的哈希表
+//! - 按短文件名排序的表，用于生成不冲突的短文件名
+//! - 空闲目录项的区间，用于创建文件时寻找连续的空闲目录项
+//!
+//! 之后的查找、创建、删除、重命名只访问索引以及被操作的目录项，并在修改目录之后同步更新索引。
+//!
+//! 索引只记录目录项的位置，不保存目录项的内容（文件大小、起始簇等会随着写入而改变），命中之后从磁盘重新读取目录项。
+//! FAT12/FAT16的根目录不在数据区中，不建立索引。
+
+use alloc::{collections::BTreeMap, string::String, vec::Vec};
+use hashbrown::HashMap;
+
+use crate::{driver::base::block::block_device::LBA_SIZE, syscall::SystemError};
+
+use super::{
+    entry::{parse_raw_dir_entry, FATDirEntry, FATRawDirEntry, ShortNameGenerator},
+    fs::{Cluster, FATFileSystem},
+};
+
+/// 每个文件系统最多为多少个目录建立索引
+const FAT_DIR_INDEX_MAX_DIRS: usize = 32;
+
+/// 目录中的一个文件在索引中的记录
+#[derive(Debug)]
+struct IndexedEntry {
+    /// 第一个目录项（长目录项或者短目录项）所在的槽位
+    start: u64,
+    short_name: [u8; 11],
+    /// 文件在名字哈希表中的key（大写的长文件名、短文件名）
+    keys: Vec<String>,
+}
+
+/// 一个目录的索引。目录中的每个目录项（32字节）占用一个槽位，槽位按照在目录中的顺序编号
+#[derive(Debug)]
+pub struct FATDirIndex {
+    /// 目录占用的簇
+    clusters: Vec<Cluster>,
+    /// 簇号 -> 它是目录的第几个簇
+    cluster_pos: BTreeMap<u64, u64>,
+    slots_per_cluster: u64,
+    /// 短目录项所在的槽位 -> 文件
+    entries: BTreeMap<u64, IndexedEntry>,
+    /// 大写的文件名 -> 短目录项所在的槽位
+    names: HashMap<String, Vec<u64>>,
+    /// 短文件名 -> 短目录项所在的槽位
+    short_names: BTreeMap<[u8; 11], u64>,
+    /// 空闲槽位的区间：起始槽位 -> 长度
+    free: BTreeMap<u64, u64>,
+    /// 最近一次被使用的时间戳
+    stamp: u64,
+}
+
+impl FATDirIndex {
+    /// @brief 读取以first_cluster开头的目录，建立索引
+    fn build(fs: &FATFileSystem, first_cluster: Cluster) -> Result<Self, SystemError> {
+        let bytes_per_cluster = fs.bytes_per_cluster();
+        let mut index = FATDirIndex {
+            clusters: Vec::new(),
+            cluster_pos: BTreeMap::new(),
+            slots_per_cluster: bytes_per_cluster / FATRawDirEntry::DIR_ENTRY_LEN,
+            entries: BTreeMap::new(),
+            names: HashMap::new(),
+            short_names: BTreeMap::new(),
+            free: BTreeMap::new(),
+            stamp: 0,
+        };
+
+        // 一次读入一个簇，解析出所有的原始目录项
+        let mut raw: Vec<FATRawDirEntry> = Vec::new();
+        let mut buf = vec![0u8; bytes_per_cluster as usize];
+        for cluster in fs.clusters(first_cluster) {
+            index.push_cluster(cluster);
+            fs.bcache.read(
+                fs.cluster_bytes_offset(cluster) as usize / LBA_SIZE,
+                buf.len() / LBA_SIZE,
+                &mut buf,
+            )?;
+            for chunk in buf.chunks_exact(FATRawDirEntry::DIR_ENTRY_LEN as usize) {
+                raw.push(parse_raw_dir_entry(chunk)?);
+            }
+        }
+
+        // 与FATDirIter相同的规则，把原始目录项组合成文件
+        let mut slot: usize = 0;
+        while slot < raw.len() {
+            match &raw[slot] {
+                FATRawDirEntry::Free => {
+                    index.add_free(slot as u64, 1);
+                    slot += 1;
+                }
+                FATRawDirEntry::FreeRest => {
+                    // 在这之后没有被分配过的目录项
+                    index.add_free(slot as u64, (raw.len() - slot) as u64);
+                    break;
+                }
+                FATRawDirEntry::Short(s) => {
+                    let loc = index.slot_loc(slot as u64);
+                    index.insert_entry(slot as u64, slot as u64, &s.to_dir_entry(loc));
+                    slot += 1;
+                }
+                FATRawDirEntry::Long(_) => {
+                    // 长目录项之后，最多有19个长目录项以及1个短目录项
+                    let mut end = slot;
+                    while end + 1 < raw.len() && end - slot < 20 {
+                        match &raw[end + 1] {
+                            FATRawDirEntry::Long(_) => end += 1,
+                            FATRawDirEntry::Short(_) => {
+                                end += 1;
+                                break;
+                            }
+                            _ => break,
+                        }
+                    }
+                    let loc = (index.slot_loc(slot as u64), index.slot_loc(end as u64));
+                    // 孤立的、校验和错误的长目录项不属于任何文件，但是它们占用的槽位也不是空闲的
+                    if let Ok(e) = FATDirEntry::new(raw[slot..=end].to_vec(), loc) {
+                        index.insert_entry(slot as u64, end as u64, &e);
+                    }
+                    slot = end + 1;
+                }
+            }
+        }
+        return Ok(index);
+    }
+
+    /// 目录的槽位总数
+    #[inline]
+    fn nr_slots(&self) -> u64 {
+        return self.clusters.len() as u64 * self.slots_per_cluster;
+    }
+
+    fn push_cluster(&mut self, cluster: Cluster) {
+        self.cluster_pos
+            .insert(cluster.cluster_num, self.clusters.len() as u64);
+        self.clusters.push(cluster);
+    }
+
+    /// @brief 获取槽位对应的目录项位置（簇，簇内偏移量）
+    pub fn slot_loc(&self, slot: u64) -> (Cluster, u64) {
+        return (
+            self.clusters[(slot / self.slots_per_cluster) as usize],
+            (slot % self.slots_per_cluster) * FATRawDirEntry::DIR_ENTRY_LEN,
+        );
+    }
+
+    /// @brief 获取目录项位置（簇，簇内偏移量）对应的槽位
+    fn loc_slot(&self, loc: (Cluster, u64)) -> Option<u64> {
+        let pos = self.cluster_pos.get(&loc.0.cluster_num)?;
+        return Some(pos * self.slots_per_cluster + loc.1 / FATRawDirEntry::DIR_ENTRY_LEN);
+    }
+
+    /// @brief 按名字查找文件（大小写不敏感）
+    ///
+    /// @return Some(loc) 文件的第一个目录项的位置
+    /// @return None 目录中没有这个文件
+    pub fn lookup(&self, name: &str) -> Option<(Cluster, u64)> {
+        // 与遍历目录的结果保持一致：有多个文件匹配时，返回目录中的第一个
+        let end = self.names.get(&name.to_uppercase())?.iter().min()?;
+        return Some(self.slot_loc(self.entries[end].start));
+    }
+
+    /// @brief 把目录中可能与短文件名生成器冲突的短文件名告知生成器
+    pub fn add_short_names(&self, sng: &mut ShortNameGenerator) {
+        // 生成器只关心与它的名字具有相同前缀的短文件名
+        let prefix = sng.conflict_prefix();
+        let mut lo = [0u8; 11];
+        let mut hi = [0xffu8; 11];
+        lo[..prefix.len()].copy_from_slice(prefix);
+        hi[..prefix.len()].copy_from_slice(prefix);
+        for name in self.short_names.range(lo..=hi).map(|(name, _)| *name) {
+            sng.add_name(&name);
+        }
+    }
+
+    /// @brief 把新创建的文件加入索引
+    ///
+    /// @param loc 文件的第一个、最后一个目录项的位置
+    /// @param entry 新创建的文件
+    pub fn insert(&mut self, loc: ((Cluster, u64), (Cluster, u64)), entry: &FATDirEntry) {
+        if let (Some(start), Some(end)) = (self.loc_slot(loc.0), self.loc_slot(loc.1)) {
+            self.take_free(start, end - start + 1);
+            self.insert_entry(start, end, entry);
+        }
+    }
+
+    /// @brief 把位于loc范围内的目录项从索引中移除，并把它们占用的槽位标记为空闲
+    pub fn remove(&mut self, loc: ((Cluster, u64), (Cluster, u64))) {
+        if let (Some(start), Some(end)) = (self.loc_slot(loc.0), self.loc_slot(loc.1)) {
+            let removed: Vec<u64> = self.entries.range(start..=end).map(|(s, _)| *s).collect();
+            for slot in removed {
+                let e = self.entries.remove(&slot).unwrap();
+                for key in e.keys {
+                    if let Some(slots) = self.names.get_mut(&key) {
+                        slots.retain(|s| *s != slot);
+                        if slots.is_empty() {
+                            self.names.remove(&key);
+                        }
+                    }
+                }
+                if self.short_names.get(&e.short_name) == Some(&slot) {
+                    self.short_names.remove(&e.short_name);
+                }
+            }
+            self.add_free(start, end - start + 1);
+        }
+    }
+
+    /// @brief 在目录中寻找num_free个连续的空闲目录项。目录中没有足够的空闲目录项时，为目录分配新的簇
+    ///
+    /// @return Ok((Cluster, u64)) 第一个空闲目录项的位置
+    pub fn find_free(
+        &mut self,
+        fs: &FATFileSystem,
+        num_free: u64,
+    ) -> Result<(Cluster, u64), SystemError> {
+        if let Some((start, _)) = self.free.iter().find(|(_, len)| **len >= num_free) {
+            return Ok(self.slot_loc(*start));
+        }
+
+        // 目录末尾的空闲目录项可以与新分配的簇连在一起使用
+        let nr_slots = self.nr_slots();
+        let (start, tail) = match self.free.iter().next_back() {
+            Some((s, len)) if s + len == nr_slots => (*s, *len),
+            _ => (nr_slots, 0),
+        };
+        let clusters_required =
+            (num_free - tail + self.slots_per_cluster - 1) / self.slots_per_cluster;
+        for _ in 0..clusters_required {
+            let prev = *self.clusters.last().unwrap();
+            let c = fs.allocate_cluster(Some(prev))?;
+            // 新分配的簇已经被清零，其中的目录项都是空闲的
+            let first_slot = self.nr_slots();
+            self.push_cluster(c);
+            self.add_free(first_slot, self.slots_per_cluster);
+        }
+        return Ok(self.slot_loc(start));
+    }
+
+    fn insert_entry(&mut self, start: u64, end: u64, entry: &FATDirEntry) {
+        let short_name = entry.short_name_raw();
+        let mut keys = vec![entry.name().to_uppercase()];
+        let short_key = entry.short_name().to_uppercase();
+        if short_key != keys[0] {
+            keys.push(short_key);
+        }
+        for key in keys.iter() {
+            self.names.entry(key.clone()).or_default().push(end);
+        }
+        self.short_names.insert(short_name, end);
+        self.entries.insert(
+            end,
+            IndexedEntry {
+                start,
+                short_name,
+                keys,
+            },
+        );
+    }
+
+    /// 把[start, start+len)标记为空闲，并与相邻的空闲区间合并
+    fn add_free(&mut self, mut start: u64, mut len: u64) {
+        if let Some((prev, prev_len)) = self.free.range(..start).next_back() {
+            if prev + prev_len == start {
+                let prev = *prev;
+                start = prev;
+                len += self.free.remove(&prev).unwrap();
+            }
+        }
+        if let Some(next_len) = self.free.remove(&(start + len)) {
+            len += next_len;
+        }
+        self.free.insert(start, len);
+    }
+
+    /// 把[start, start+len)从空闲区间中移除
+    fn take_free(&mut self, start: u64, len: u64) {
+        let end = start + len;
+        let overlapping: Vec<(u64, u64)> = self
+            .free
+            .range(..end)
+            .filter(|(s, l)| **s + **l > start)
+            .map(|(s, l)| (*s, *l))
+            .collect();
+        for (s, l) in overlapping {
+            self.free.remove(&s);
+            if s < start {
+                self.free.insert(s, start - s);
+            }
+            if s + l > end {
+                self.free.insert(end, s + l - end);
+            }
+        }
+    }
+}
+
+/// 一个文件系统中所有目录的索引。索引的数量超过上限时，淘汰最久没有被使用的
+#[derive(Debug, Default)]
+pub struct FATDirIndexCache {
+    /// 目录的第一个簇的簇号 -> 目录的索引
+    dirs: BTreeMap<u64, FATDirIndex>,
+    clock: u64,
+}
+
+impl FATDirIndexCache {
+    pub fn new() -> Self {
+        return Self::default();
+    }
+
+    /// @brief 获取以first_cluster开头的目录的索引，索引不存在时读取目录建立索引
+    pub fn get(
+        &mut self,
+        fs: &FATFileSystem,
+        first_cluster: Cluster,
+    ) -> Result<&mut FATDirIndex, SystemError> {
+        let key = first_cluster.cluster_num;
+        if !self.dirs.contains_key(&key) {
+            let index = FATDirIndex::build(fs, first_cluster)?;
+            if self.dirs.len() >= FAT_DIR_INDEX_MAX_DIRS {
+                let oldest = self
+                    .dirs
+                    .iter()
+                    .min_by_key(|(_, index)| index.stamp)
+                    .map(|(k, _)| *k)
+                    .unwrap();
+                self.dirs.remove(&oldest);
+            }
+            self.dirs.insert(key, index);
+        }
+        return Ok(self.get_existing(first_cluster).unwrap());
+    }
+
+    /// @brief 获取以first_cluster开头的目录的索引。索引不存在时返回None（不会建立索引）
+    pub fn get_existing(&mut self, first_cluster: Cluster) -> Option<&mut FATDirIndex> {
+        self.clock += 1;
+        let index = self.dirs.get_mut(&first_cluster.cluster_num)?;
+        index.stamp = self.clock;
+        return Some(index);
+    }
+
+    /// @brief 删除以first_cluster开头的目录的索引（目录被删除，或者索引与磁盘上的目录不一致时调用）
+    pub fn invalidate(&mut self, first_cluster: Cluster) {
+        self.dirs.remove(&first_cluster.cluster_num);
+    }
+}
@@ -15,9 +15,12 @@ use alloc::{
 
 use super::{
     fs::{Cluster, FATFileSystem, MAX_FILE_SIZE},
-    utils::decode_u8_ascii,
+    utils::{decode_u8_ascii, RESERVED_CLUSTERS},
 };
 
+/// 读写文件时，一次磁盘读写的最大字节数（磁盘上连续的簇会被合并成一次读写）
+const FAT_IO_MAX_BYTES: u64 = 1024 * 1024;
+
 #[derive(Debug, Clone, Copy, Default)]
 pub struct FileAttributes {
     value: u8,
@@ -56,6 +59,100 @@ pub struct FATFile {
     pub short_dir_entry: ShortDirEntry,
     /// 文件目录项的起始、终止簇。格式：(簇，簇内偏移量)
     pub loc: ((Cluster, u64), (Cluster, u64)),
+    /// 文件簇链的区段缓存
+    extents: FATExtentCache,
+}
+
+/// 簇链中物理上连续的一段簇
+#[derive(Debug, Clone, Copy)]
+struct FATExtent {
+    /// 区段的第一个簇在文件内的簇号
+    file_cluster: u64,
+    /// 区段的第一个簇的簇号
+    disk_cluster: u64,
+    /// 区段包含的簇的数量
+    len: u64,
+}
+
+/// 文件簇链的区段缓存
+///
+/// 按照文件内的簇号顺序，记录簇链中物理上连续的区段，使得查找文件的第n个簇不需要从第一个簇开始沿着FAT表逐个查找。
+/// 缓存总是覆盖簇链的一个前缀：需要更靠后的簇时，从缓存的最后一个簇开始继续查找FAT表，并把结果加入缓存。
+#[derive(Debug, Default, Clone)]
+struct FATExtentCache {
+    extents: Vec<FATExtent>,
+    /// 已经缓存的簇的数量
+    nr_clusters: u64,
+    /// 是否已经缓存到了簇链的末尾
+    complete: bool,
+}
+
+impl FATExtentCache {
+    /// 在缓存的末尾加入簇链的下一个簇
+    fn push(&mut self, cluster: Cluster) {
+        self.nr_clusters += 1;
+        if let Some(last) = self.extents.last_mut() {
+            if last.disk_cluster + last.len == cluster.cluster_num {
+                last.len += 1;
+                return;
+            }
+        }
+        self.extents.push(FATExtent {
+            file_cluster: self.nr_clusters - 1,
+            disk_cluster: cluster.cluster_num,
+            len: 1,
+        });
+    }
+
+    /// 在缓存的末尾加入簇链中从start开始的len个连续的簇
+    fn push_run(&mut self, start: u64, len: u64) {
+        if len == 0 {
+            return;
+        }
+        self.push(Cluster::new(start));
+        self.extents.last_mut().unwrap().len += len - 1;
+        self.nr_clusters += len - 1;
+    }
+
+    /// 获取文件内的第n个簇。若它不在缓存中，则返回None
+    fn lookup(&self, n: u64) -> Option<Cluster> {
+        if n >= self.nr_clusters {
+            return None;
+        }
+        let idx = self.extents.partition_point(|e| e.file_cluster <= n) - 1;
+        let extent = &self.extents[idx];
+        return Some(Cluster::new(
+            extent.disk_cluster + (n - extent.file_cluster),
+        ));
+    }
+
+    /// 获取缓存中的最后一个簇
+    fn last(&self) -> Option<Cluster> {
+        return self
+            .extents
+            .last()
+            .map(|e| Cluster::new(e.disk_cluster + e.len - 1));
+    }
+
+    /// 簇链被截断为n个簇之后，丢弃多余的缓存
+    fn truncate(&mut self, n: u64) {
+        if n < self.nr_clusters {
+            self.extents.retain(|e| e.file_cluster < n);
+            if let Some(last) = self.extents.last_mut() {
+                last.len = min(last.len, n - last.file_cluster);
+            }
+            self.nr_clusters = n;
+            self.complete = true;
+        } else if n == self.nr_clusters {
+            self.complete = true;
+        }
+    }
+
+    fn clear(&mut self) {
+        self.extents.clear();
+        self.nr_clusters = 0;
+        self.complete = false;
+    }
 }
 
 impl FATFile {
@@ -71,6 +168,92 @@ impl FATFile {
         self.short_dir_entry.file_size = size;
     }
 
+    /// @brief 获取文件的第n个簇（下标从0开始）。优先查询区段缓存，缓存未覆盖时沿着FAT表继续查找
+    ///
+    /// @return None 文件的簇链没有这么长
+    fn cluster_by_relative(&mut self, fs: &Arc<FATFileSystem>, n: u64) -> Option<Cluster> {
+        // 空文件没有分配簇
+        if self.first_cluster.cluster_num < RESERVED_CLUSTERS as u64 {
+            return None;
+        }
+        if self.extents.nr_clusters == 0 {
+            self.extents.push(self.first_cluster);
+        }
+        while n >= self.extents.nr_clusters && !self.extents.complete {
+            match fs.get_fat_entry(self.extents.last().unwrap()) {
+                Ok(FATEntry::Next(c)) => self.extents.push(c),
+                Ok(_) => self.extents.complete = true,
+                Err(_) => break,
+            }
+        }
+        return self.extents.lookup(n);
+    }
+
+    /// @brief 获取文件簇链的最后一个簇
+    fn last_cluster(&mut self, fs: &Arc<FATFileSystem>) -> Option<Cluster> {
+        self.cluster_by_relative(fs, u64::MAX);
+        if !self.extents.complete {
+            return None;
+        }
+        return self.extents.last();
+    }
+
+    /// @brief 从文件的第n个簇（`first`）开始，最多max个簇中，有多少个簇在磁盘上是连续的（至少为1）
+    ///
+    /// 连续的簇合并成一次磁盘读写
+    fn contiguous_clusters(
+        &mut self,
+        fs: &Arc<FATFileSystem>,
+        n: u64,
+        first: Cluster,
+        max: u64,
+    ) -> u64 {
+        let mut k = 1;
+        while k < max {
+            match self.cluster_by_relative(fs, n + k) {
+                Some(c) if c.cluster_num == first.cluster_num + k => k += 1,
+                _ => break,
+            }
+        }
+        return k;
+    }
+
+    /// @brief 在文件的簇链末尾追加n个簇。这些簇一次分配，并尽量在磁盘上连续、紧接着原来的最后一个簇
+    ///
+    /// @param zero 是否清零新的簇
+    fn extend_chain(
+        &mut self,
+        fs: &Arc<FATFileSystem>,
+        n: u64,
+        zero: bool,
+    ) -> Result<(), SystemError> {
+        if n == 0 {
+            return Ok(());
+        }
+        // 空文件还没有分配簇
+        let prev = if self.first_cluster.cluster_num < RESERVED_CLUSTERS as u64 {
+            None
+        } else if let Some(c) = self.last_cluster(fs) {
+            Some(c)
+        } else {
+            kwarn!("FAT: last cluster not found, File = {self:?}");
+            return Err(SystemError::EINVAL);
+        };
+
+        let runs = fs.allocate_clusters(prev, n, zero)?;
+        if prev.is_none() {
+            self.first_cluster = runs[0].0;
+            self.short_dir_entry.set_first_cluster(self.first_cluster);
+            self.extents.clear();
+        }
+        // 区段缓存已经覆盖了整个簇链，新的簇直接加入缓存
+        for (start, len) in runs {
+            self.extents.push_run(start.cluster_num, len);
+        }
+        self.extents.complete = true;
+        return Ok(());
+    }
+
     /// @brief 从文件读取数据。读取的字节数与buf长度相等
     ///
     /// @param buf 输出缓冲区
@@ -79,7 +262,7 @@ impl FATFile {
     /// @return Ok(usize) 成功读取到的字节数
     /// @return Err(SystemError) 读取时出现错误，返回错误码
     pub fn read(
-        &self,
+        &mut self,
         fs: &Arc<FATFileSystem>,
         buf: &mut [u8],
         offset: u64,
@@ -89,11 +272,9 @@ impl FATFile {
         }
 
         // 文件内的簇偏移量
-        let start_cluster_number: u64 = offset / fs.bytes_per_cluster();
+        let mut cluster_index: u64 = offset / fs.bytes_per_cluster();
         // 计算对应在分区内的簇号
-        let mut current_cluster = if let Some(c) =
-            fs.get_cluster_by_relative(self.first_cluster, start_cluster_number as usize)
-        {
+        let mut current_cluster = if let Some(c) = self.cluster_by_relative(fs, cluster_index) {
             c
         } else {
             return Ok(0);
@@ -105,13 +286,13 @@ impl FATFile {
         let mut in_cluster_offset: u64 = offset % fs.bytes_per_cluster();
         let to_read_size: usize = min(buf.len(), bytes_remain as usize);
 
-        let mut start = 0;
         let mut read_ok = 0;
 
         loop {
             // 当前簇已经读取完，尝试读取下一个簇
             if in_cluster_offset >= fs.bytes_per_cluster() {
-                if let Some(FATEntry::Next(c)) = fs.get_fat_entry(current_cluster).ok() {
+                cluster_index += in_cluster_offset / fs.bytes_per_cluster();
+                if let Some(c) = self.cluster_by_relative(fs, cluster_index) {
                     current_cluster = c;
                     in_cluster_offset %= fs.bytes_per_cluster();
                 } else {
@@ -119,26 +300,25 @@ impl FATFile {
                 }
             }
 
-            // 计算下一次读取，能够读多少字节
-            let end_len: usize = min(
+            // 计算下一次读取，能够读多少字节。磁盘上连续的簇一次读取
+            let end_len = self.io_len(
+                fs,
+                cluster_index,
+                current_cluster,
+                in_cluster_offset,
                 to_read_size - read_ok,
-                min(
-                    (fs.bytes_per_cluster() - in_cluster_offset) as usize,
-                    buf.len() - read_ok,
-                ),
             );
 
-            //  从磁盘上读取数据
+            //  从磁盘上读取数据（块对齐的部分直接读入buf）
             let offset = fs.cluster_bytes_offset(current_cluster) + in_cluster_offset;
             let r = fs.partition.disk().read_at_bytes(
                 offset as usize,
                 end_len,
-                &mut buf[start..start + end_len],
+                &mut buf[read_ok..read_ok + end_len],
             )?;
 
             // 更新偏移量计数信息
             read_ok += r;
-            start += r;
             in_cluster_offset += r as u64;
             if read_ok == to_read_size {
                 break;
@@ -148,6 +328,23 @@ impl FATFile {
         return Ok(read_ok);
     }
 
+    /// @brief 计算从文件的第n个簇（`cluster`）的簇内偏移量in_cluster_offset处开始，一次磁盘读写的长度：
+    /// 不超过remain，也不超过磁盘上连续的簇的末尾以及[`FAT_IO_MAX_BYTES`]
+    fn io_len(
+        &mut self,
+        fs: &Arc<FATFileSystem>,
+        n: u64,
+        cluster: Cluster,
+        in_cluster_offset: u64,
+        remain: usize,
+    ) -> usize {
+        let bpc = fs.bytes_per_cluster();
+        let want = min(remain as u64, FAT_IO_MAX_BYTES.max(bpc));
+        let max_clusters = (in_cluster_offset + want + bpc - 1) / bpc;
+        let run = self.contiguous_clusters(fs, n, cluster, max_clusters);
+        return min(run * bpc - in_cluster_offset, want) as usize;
+    }
+
     /// @brief 向文件写入数据。写入的字节数与buf长度相等
     ///
     /// @param buf 输入缓冲区
@@ -160,29 +357,51 @@ impl FATFile {
         fs: &Arc<FATFileSystem>,
         buf: &[u8],
         offset: u64,
+    ) -> Result<usize, SystemError> {
+        return self.do_write(fs, buf, offset, false);
+    }
+
+    /// @brief 向文件写入数据（O_DIRECT）：块对齐的部分绕过请求队列，直接把buf交给驱动写入设备，
+    /// 返回时数据已经到达设备（用户缓冲区由驱动固定物理页后直接DMA）。不对齐的部分与[`Self::write`]相同
+    pub fn write_direct(
+        &mut self,
+        fs: &Arc<FATFileSystem>,
+        buf: &[u8],
+        offset: u64,
+    ) -> Result<usize, SystemError> {
+        return self.do_write(fs, buf, offset, true);
+    }
+
+    fn do_write(
+        &mut self,
+        fs: &Arc<FATFileSystem>,
+        buf: &[u8],
+        offset: u64,
+        direct: bool,
     ) -> Result<usize, SystemError> {
         self.ensure_len(fs, offset, buf.len() as u64)?;
 
         // 要写入的第一个簇的簇号
-        let start_cluster_num = offset / fs.bytes_per_cluster();
+        let mut cluster_index: u64 = offset / fs.bytes_per_cluster();
         // 获取要写入的第一个簇
-        let mut current_cluster: Cluster = if let Some(c) =
-            fs.get_cluster_by_relative(self.first_cluster, start_cluster_num as usize)
-        {
-            c
-        } else {
-            return Ok(0);
-        };
+        let mut current_cluster: Cluster =
+            if let Some(c) = self.cluster_by_relative(fs, cluster_index) {
+                c
+            } else {
+                return Ok(0);
+            };
 
         let mut in_cluster_bytes_offset: u64 = offset % fs.bytes_per_cluster();
 
-        let mut start: usize = 0;
         let mut write_ok: usize = 0;
+        let disk = fs.partition.disk();
+        let blk_mask = (1usize << disk.blk_size_log2()) - 1;
 
         // 循环写入数据
         loop {
             if in_cluster_bytes_offset >= fs.bytes_per_cluster() {
-                if let Some(FATEntry::Next(c)) = fs.get_fat_entry(current_cluster).ok() {
+                cluster_index += in_cluster_bytes_offset / fs.bytes_per_cluster();
+                if let Some(c) = self.cluster_by_relative(fs, cluster_index) {
                     current_cluster = c;
                     in_cluster_bytes_offset = in_cluster_bytes_offset % fs.bytes_per_cluster();
                 } else {
@@ -190,23 +409,28 @@ impl FATFile {
                 }
             }
 
-            let end_len = min(
-                (fs.bytes_per_cluster() - in_cluster_bytes_offset) as usize,
+            // 磁盘上连续的簇一次写入
+            let end_len = self.io_len(
+                fs,
+                cluster_index,
+                current_cluster,
+                in_cluster_bytes_offset,
                 buf.len() - write_ok,
             );
 
             // 计算本次写入位置在磁盘上的偏移量
             let offset = fs.cluster_bytes_offset(current_cluster) + in_cluster_bytes_offset;
-            // 写入磁盘
-            let w: usize = fs.partition.disk().write_at_bytes(
-                offset as usize,
-                end_len,
-                &buf[start..start + end_len],
-            )?;
+            // 写入磁盘。缓冲区缓存中可能还有这个簇之前作为目录时的内容
+            fs.bcache.invalidate_bytes(offset as usize, end_len);
+            let data = &buf[write_ok..write_ok + end_len];
+            let w: usize = if direct && (offset as usize | end_len) & blk_mask == 0 {
+                disk.write_at_bytes_direct(offset as usize, end_len, data)?
+            } else {
+                disk.write_at_bytes(offset as usize, end_len, data)?
+            };
 
             // 更新偏移量数据
             write_ok += w;
-            start += w;
             in_cluster_bytes_offset += w as u64;
 
             if write_ok == buf.len() {
@@ -237,51 +461,26 @@ impl FATFile {
             return Ok(());
         }
 
-        // 计算文件的最后一个簇中有多少空闲空间
-        let in_cluster_offset = self.size() % fs.bytes_per_cluster();
-        let mut bytes_remain_in_cluster = if in_cluster_offset == 0 {
-            0
-        } else {
-            fs.bytes_per_cluster() - in_cluster_offset
-        };
-
         // 计算还需要申请多少空间
         let extra_bytes = min((offset + len) - self.size(), MAX_FILE_SIZE - self.size());
 
-        // 如果文件大小为0,证明它还没有分配簇，因此分配一个簇给它
+        // 如果文件大小为0,证明它还没有分配簇
         if self.size() == 0 {
             // first_cluster应当为0,否则将产生空间泄露的错误
             assert_eq!(self.first_cluster, Cluster::default());
-            self.first_cluster = fs.allocate_cluster(None)?;
-            self.short_dir_entry.set_first_cluster(self.first_cluster);
-            bytes_remain_in_cluster = fs.bytes_per_cluster();
         }
 
-        // 如果还需要更多的簇
-        if bytes_remain_in_cluster < extra_bytes {
-            let clusters_to_allocate =
-                (extra_bytes - bytes_remain_in_cluster + fs.bytes_per_cluster() - 1)
-                    / fs.bytes_per_cluster();
-            let last_cluster = if let Some(c) = fs.get_last_cluster(self.first_cluster) {
-                c
-            } else {
-                kwarn!("FAT: last cluster not found, File = {self:?}");
-                return Err(SystemError::EINVAL);
-            };
-            // 申请簇
-            let mut current_cluster: Cluster = last_cluster;
-            for _ in 0..clusters_to_allocate {
-                current_cluster = fs.allocate_cluster(Some(current_cluster))?;
-            }
-        }
+        // 文件现有的簇数，以及扩展之后需要的簇数。还需要的簇一次申请
+        let bpc = fs.bytes_per_cluster();
+        let have = (self.size() + bpc - 1) / bpc;
+        let need = (self.size() + extra_bytes + bpc - 1) / bpc;
+        self.extend_chain(fs, need - have, true)?;
 
         // 如果文件被扩展，则清空刚刚被扩展的部分的数据
         if offset > self.size() {
             // 文件内的簇偏移
             let start_cluster: u64 = self.size() / fs.bytes_per_cluster();
-            let start_cluster: Cluster = fs
-                .get_cluster_by_relative(self.first_cluster, start_cluster as usize)
-                .unwrap();
+            let start_cluster: Cluster = self.cluster_by_relative(fs, start_cluster).unwrap();
             // 计算当前文件末尾在磁盘上的字节偏移量
             let start_offset: u64 =
                 fs.cluster_bytes_offset(start_cluster) + self.size() % fs.bytes_per_cluster();
@@ -290,9 +489,7 @@ impl FATFile {
             // 计算在扩展之后的最后一个簇内，文件的终止字节
             let cluster_offset_start = offset / fs.bytes_per_cluster();
             // 扩展后，文件的最后
-            let end_cluster: Cluster = fs
-                .get_cluster_by_relative(self.first_cluster, cluster_offset_start as usize)
-                .unwrap();
+            let end_cluster: Cluster = self.cluster_by_relative(fs, cluster_offset_start).unwrap();
 
             if start_cluster != end_cluster {
                 self.zero_range(fs, start_offset, start_offset + bytes_remain)?;
@@ -311,6 +508,47 @@ impl FATFile {
         return Ok(());
     }
 
+    /// @brief 为文件预先分配空间，使文件大小至少为offset + len（fallocate的默认模式）
+    ///
+    /// 需要的簇一次分配，尽量在磁盘上连续，并被清零。之后写入这段范围时不需要再分配簇，
+    /// 文件也不会因为边写边分配而产生碎片
+    ///
+    /// @return Err(SystemError::EFBIG) 文件大小将超过FAT文件系统的上限
+    pub fn fallocate(
+        &mut self,
+        fs: &Arc<FATFileSystem>,
+        offset: u64,
+        len: u64,
+    ) -> Result<(), SystemError> {
+        let end = offset.checked_add(len).ok_or(SystemError::EFBIG)?;
+        if end > MAX_FILE_SIZE {
+            return Err(SystemError::EFBIG);
+        }
+        let size = self.size();
+        if end <= size {
+            return Ok(());
+        }
+
+        let bpc = fs.bytes_per_cluster();
+        // 最后一个簇中，原来的文件末尾之后可能残留着截断之前的数据
+        if size % bpc != 0 {
+            let last = self
+                .cluster_by_relative(fs, size / bpc)
+                .ok_or(SystemError::EINVAL)?;
+            let start = fs.cluster_bytes_offset(last) + size % bpc;
+            self.zero_range(fs, start, start + bpc - size % bpc)?;
+        }
+        let have = (size + bpc - 1) / bpc;
+        let need = (end + bpc - 1) / bpc;
+        self.extend_chain(fs, need - have, true)?;
+
+        self.set_size(end as u32);
+        // 计算短目录项所在的位置，更新短目录项
+        let short_entry_offset = fs.cluster_bytes_offset(self.loc.1 .0) + self.loc.1 .1;
+        self.short_dir_entry.flush(fs, short_entry_offset)?;
+        return Ok(());
+    }
+
     /// @brief 把磁盘上[range_start, range_end)范围的数据清零
     ///
     /// @param range_start 磁盘上起始位置（单位：字节）
@@ -326,9 +564,13 @@ impl FATFile {
         }
 
         let zeroes: Vec<u8> = vec![0u8; (range_end - range_start) as usize];
-        fs.partition
-            .disk()
-            .write_at(range_start as usize, zeroes.len(), zeroes.as_slice())?;
+        fs.bcache
+            .invalidate_bytes(range_start as usize, zeroes.len());
+        fs.partition.disk().write_at_bytes(
+            range_start as usize,
+            zeroes.len(),
+            zeroes.as_slice(),
+        )?;
         return Ok(());
     }
 
@@ -344,16 +586,21 @@ impl FATFile {
         }
 
         let new_last_cluster = (new_size + fs.bytes_per_cluster() - 1) / fs.bytes_per_cluster();
-        if let Some(begin_delete) =
-            fs.get_cluster_by_relative(self.first_cluster, new_last_cluster as usize)
-        {
+        if let Some(begin_delete) = self.cluster_by_relative(fs, new_last_cluster) {
+            // 保留下来的最后一个簇成为簇链的末尾
+            if new_last_cluster > 0 {
+                let new_last = self.cluster_by_relative(fs, new_last_cluster - 1).unwrap();
+                fs.set_entry(new_last, FATEntry::EndOfChain)?;
+            }
             fs.deallocate_cluster_chain(begin_delete)?;
         };
+        self.extents.truncate(new_last_cluster);
 
         if new_size == 0 {
             assert!(new_last_cluster == 0);
             self.short_dir_entry.set_first_cluster(Cluster::new(0));
             self.first_cluster = Cluster::new(0);
+            self.extents.clear();
         }
 
         self.set_size(new_size as u32);
@@ -392,6 +639,18 @@ impl FATDir {
         };
     }
 
+    /// @brief 获得从位置`pos`开始遍历当前目录的迭代器
+    ///
+    /// @param pos 之前的迭代器通过[`FATDirIter::pos`]给出的位置，0表示目录的开头
+    pub fn to_iter_at(&self, fs: Arc<FATFileSystem>, pos: u64) -> FATDirIter {
+        let mut iter = self.to_iter(fs);
+        if pos != 0 {
+            iter.current_cluster = Cluster::new(pos >> 32);
+            iter.offset += pos & 0xffff_ffff;
+        }
+        return iter;
+    }
+
     /// @brief 判断当前目录是否为根目录（仅对FAT12和FAT16生效）
     #[inline]
     pub fn is_root(&self) -> bool {
@@ -415,6 +674,12 @@ impl FATDir {
         num_free: u64,
         fs: Arc<FATFileSystem>,
     ) -> Result<Option<(Cluster, u64)>, SystemError> {
+        if self.indexable() {
+            if let Ok(index) = fs.dir_index.lock().get(&fs, self.first_cluster) {
+                return index.find_free(&fs, num_free).map(Some);
+            }
+        }
+
         let mut free = 0;
         let mut current_cluster: Cluster = self.first_cluster;
         let mut offset = self.root_offset.unwrap_or(0);
@@ -511,19 +776,35 @@ impl FATDir {
         fs: Arc<FATFileSystem>,
     ) -> Result<FATDirEntry, SystemError> {
         LongDirEntry::validate_long_name(name)?;
+        let e: FATDirEntry = match self.find_entry_indexed(name, short_name_gen.as_deref_mut(), &fs)
+        {
+            Some(r) => r?,
+            None => self.find_entry_linear(name, short_name_gen, fs)?,
+        };
+
+        if expect_dir.is_some() && Some(e.is_dir()) != expect_dir {
+            if e.is_dir() {
+                // 期望得到文件，但是是文件夹
+                return Err(SystemError::EISDIR);
+            } else {
+                // 期望得到文件夹，但是是文件
+                return Err(SystemError::ENOTDIR);
+            }
+        }
+        // 找到期望的目录项
+        return Ok(e);
+    }
+
+    /// @brief 遍历当前目录，寻找目录项
+    fn find_entry_linear(
+        &self,
+        name: &str,
+        mut short_name_gen: Option<&mut ShortNameGenerator>,
+        fs: Arc<FATFileSystem>,
+    ) -> Result<FATDirEntry, SystemError> {
         // 迭代当前目录下的文件/文件夹
         for e in self.to_iter(fs) {
             if e.eq_name(name) {
-                if expect_dir.is_some() && Some(e.is_dir()) != expect_dir {
-                    if e.is_dir() {
-                        // 期望得到文件，但是是文件夹
-                        return Err(SystemError::EISDIR);
-                    } else {
-                        // 期望得到文件夹，但是是文件
-                        return Err(SystemError::ENOTDIR);
-                    }
-                }
-                // 找到期望的目录项
                 return Ok(e);
             }
 
@@ -535,6 +816,57 @@ impl FATDir {
         return Err(SystemError::ENOENT);
     }
 
+    /// @brief 通过目录索引寻找目录项
+    ///
+    /// @return Some(Ok(FATDirEntry)) 找到的目录项
+    /// @return Some(Err(SystemError::ENOENT)) 目录中不存在这个目录项。此时，目录中可能与短文件名冲突的名字已经告知了short_name_gen
+    /// @return None 当前目录不能使用索引，需要遍历目录
+    fn find_entry_indexed(
+        &self,
+        name: &str,
+        short_name_gen: Option<&mut ShortNameGenerator>,
+        fs: &Arc<FATFileSystem>,
+    ) -> Option<Result<FATDirEntry, SystemError>> {
+        if !self.indexable() {
+            return None;
+        }
+
+        let mut indexes = fs.dir_index.lock();
+        let index = indexes.get(fs, self.first_cluster).ok()?;
+        let loc = match index.lookup(name) {
+            Some(loc) => loc,
+            None => {
+                if let Some(sng) = short_name_gen {
+                    index.add_short_names(sng);
+                }
+                return Some(Err(SystemError::ENOENT));
+            }
+        };
+
+        // 索引中只有目录项的位置，从磁盘读取目录项的内容
+        let e = FATDirIter {
+            current_cluster: loc.0,
+            offset: loc.1,
+            is_root: false,
+            fs: fs.clone(),
+        }
+        .next();
+        match e {
+            Some(e) if e.eq_name(name) => return Some(Ok(e)),
+            _ => {
+                // 索引与磁盘上的目录不一致，丢弃索引
+                indexes.invalidate(self.first_cluster);
+                return None;
+            }
+        }
+    }
+
+    /// @brief 当前目录是否可以建立目录索引（FAT12/FAT16的根目录不在数据区中，不能建立索引）
+    #[inline]
+    fn indexable(&self) -> bool {
+        return !self.is_root() && self.first_cluster.cluster_num >= RESERVED_CLUSTERS as u64;
+    }
+
     /// @brief 在当前目录下打开文件，获取FATFile结构体
     pub fn open_file(&self, name: &str, fs: Arc<FATFileSystem>) -> Result<FATFile, SystemError> {
         let f: FATFile = self.find_entry(name, Some(false), None, fs)?.to_file()?;
@@ -757,7 +1089,11 @@ impl FATDir {
         let offset = fs.cluster_bytes_offset(end.0) + end.1;
         short_dentry.flush(&fs, offset)?;
 
-        return Ok(short_dentry.to_dir_entry_with_long_name(long_name.to_string(), (start, end)));
+        let entry = short_dentry.to_dir_entry_with_long_name(long_name.to_string(), (start, end));
+        if let Some(index) = fs.dir_index.lock().get_existing(self.first_cluster) {
+            index.insert((start, end), &entry);
+        }
+        return Ok(entry);
     }
 
     /// @brief 判断当前目录是否为空
@@ -798,6 +1134,10 @@ impl FATDir {
         }
 
         if e.first_cluster().cluster_num >= 2 && remove_clusters {
+            // 被删除的文件夹的簇会被重新分配，因此丢弃它的目录索引
+            if e.is_dir() {
+                fs.dir_index.lock().invalidate(e.first_cluster());
+            }
             // 删除与指定的目录项相关联的数据簇
             fs.deallocate_cluster_chain(e.first_cluster())?;
         }
@@ -829,6 +1169,10 @@ impl FATDir {
             short_entry.name[0] = 0xe5;
             short_entry.flush(&fs, disk_bytes_offset)?;
         }
+
+        if let Some(index) = fs.dir_index.lock().get_existing(self.first_cluster) {
+            index.remove(cluster_range);
+        }
         return Ok(());
     }
 
@@ -1087,9 +1431,7 @@ impl LongDirEntry {
         );
         let mut v: Vec<u8> = Vec::new();
         v.resize(1 * fs.lba_per_sector() * LBA_SIZE, 0);
-        fs.partition
-            .disk()
-            .read_at(lba, 1 * fs.lba_per_sector(), &mut v)?;
+        fs.bcache.read(lba, 1 * fs.lba_per_sector(), &mut v)?;
 
         let mut cursor: VecCursor = VecCursor::new(v);
         // 切换游标到对应位置
@@ -1115,11 +1457,9 @@ impl LongDirEntry {
             cursor.write_u16(*b)?;
         }
 
-        // 把修改后的长目录项刷入磁盘
-        fs.partition
-            .disk()
-            .write_at(lba, 1 * fs.lba_per_sector(), cursor.as_slice())?;
-        fs.partition.disk().sync()?;
+        // 把修改后的目录项写入缓冲区缓存，由文件系统的flush写回磁盘
+        fs.bcache
+            .write(lba, 1 * fs.lba_per_sector(), cursor.as_slice())?;
 
         return Ok(());
     }
@@ -1301,9 +1641,7 @@ impl ShortDirEntry {
         );
         let mut v: Vec<u8> = Vec::new();
         v.resize(1 * fs.lba_per_sector() * LBA_SIZE, 0);
-        fs.partition
-            .disk()
-            .read_at(lba, 1 * fs.lba_per_sector(), &mut v)?;
+        fs.bcache.read(lba, 1 * fs.lba_per_sector(), &mut v)?;
 
         let mut cursor: VecCursor = VecCursor::new(v);
         // 切换游标到对应位置
@@ -1321,11 +1659,9 @@ impl ShortDirEntry {
         cursor.write_u16(self.fst_clus_lo)?;
         cursor.write_u32(self.file_size)?;
 
-        // 把修改后的长目录项刷入磁盘
-        fs.partition
-            .disk()
-            .write_at(lba, 1 * fs.lba_per_sector(), cursor.as_slice())?;
-        fs.partition.disk().sync()?;
+        // 把修改后的目录项写入缓冲区缓存，由文件系统的flush写回磁盘
+        fs.bcache
+            .write(lba, 1 * fs.lba_per_sector(), cursor.as_slice())?;
 
         return Ok(());
     }
@@ -1402,6 +1738,18 @@ pub struct FATDirIter {
 }
 
 impl FATDirIter {
+    /// @brief 迭代器的当前位置：高32位是簇号，低32位是相对于目录起始位置的簇内偏移量
+    ///
+    /// 把它传给[`FATDir::to_iter_at`]，可以从下一个目录项继续遍历，而不需要从头读取目录
+    pub fn pos(&self) -> u64 {
+        let base = if self.is_root {
+            self.fs.root_dir_bytes_offset()
+        } else {
+            0
+        };
+        return (self.current_cluster.cluster_num << 32) | (self.offset - base);
+    }
+
     /// @brief 迭代当前inode的目录项(获取下一个目录项)
     ///
     /// @return Ok(Cluster, u64, Option<FATDirEntry>)
@@ -1997,6 +2345,12 @@ impl ShortNameGenerator {
         }
     }
 
+    /// @brief 获取可能与生成的短文件名冲突的短文件名的公共前缀。
+    /// 不以这个前缀开头的短文件名，传给add_name()也不会改变生成器的状态
+    pub fn conflict_prefix(&self) -> &[u8] {
+        return &self.name[..min(self.basename_len, 2) as usize];
+    }
+
     pub fn generate(&self) -> Result<[u8; 11], SystemError> {
         if self.is_dot() || self.is_dotdot() {
             return Ok(self.name);
@@ -2366,11 +2720,18 @@ pub fn get_raw_dir_entry(
     let mut v: Vec<u8> = Vec::new();
     v.resize(1 * LBA_SIZE, 0);
 
-    fs.partition.disk().read_at(lba, 1, &mut v)?;
+    fs.bcache.read(lba, 1, &mut v)?;
 
-    let mut cursor: VecCursor = VecCursor::new(v);
-    // 切换游标到对应位置
-    cursor.seek(SeekFrom::SeekSet(blk_offset as i64))?;
+    return parse_raw_dir_entry(&v[blk_offset as usize..]);
+}
+
+/// @brief 从内存中的目录项数据（至少32字节）生成一个FATRawDirEntry对象
+pub fn parse_raw_dir_entry(buf: &[u8]) -> Result<FATRawDirEntry, SystemError> {
+    if buf.len() < FATRawDirEntry::DIR_ENTRY_LEN as usize {
+        return Err(SystemError::EINVAL);
+    }
+    let mut cursor: VecCursor =
+        VecCursor::new(buf[..FATRawDirEntry::DIR_ENTRY_LEN as usize].to_vec());
 
     let dir_0 = cursor.read_u8()?;
 
@@ -2386,7 +2747,7 @@ pub fn get_raw_dir_entry(
             let file_attr: FileAttributes = FileAttributes::new(cursor.read_u8()?);
 
             // 指针回到目录项的开始处
-            cursor.seek(SeekFrom::SeekSet(blk_offset as i64))?;
+            cursor.seek(SeekFrom::SeekSet(0))?;
 
             if file_attr.contains(FileAttributes::LONG_NAME) {
                 // 当前目录项是一个长目录项
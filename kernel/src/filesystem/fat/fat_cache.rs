@@ -0,0 +1,415 @@
+//! FAT表的内存缓存
+//!
+//! FAT表的扇区在第一次被访问时读入内存，之后对FAT表项的读写都在内存中完成。被修改过的扇区标记为脏扇区，
+//! 在脏扇区数量超过阈值、缓存已满、sync或者卸载文件系统时，批量写入所有需要同步的FAT表副本
+//! （连续的脏扇区合并为一次写入）。FAT表扇区的读写都经过文件系统的缓冲区缓存，
+//! 由它和其他元数据一起按顺序写回磁盘。
+//!
+//! 挂载时扫描一遍FAT表，建立空闲簇位图。分配簇时只需要在位图中查找，不需要再逐个扇区地读取磁盘上的FAT表。
+//! 位图随着每一次对FAT表项的写入一起更新，因此始终与缓存中的FAT表保持一致。
+
+use core::fmt::Debug;
+
+use alloc::{collections::BTreeMap, vec::Vec};
+
+use crate::syscall::SystemError;
+
+use super::{bpb::FATType, fs::FATFileSystem, utils::RESERVED_CLUSTERS};
+
+/// 最多缓存的FAT表扇区数量
+const FAT_CACHE_MAX_SECTORS: usize = 512;
+/// 脏扇区数量达到这个值时，写回所有的脏扇区
+const FAT_CACHE_DIRTY_THRESHOLD: usize = 64;
+/// 建立空闲簇位图时，每次从磁盘读取的扇区数量
+const FAT_SCAN_BATCH_SECTORS: u64 = 64;
+
+struct FATCacheSector {
+    data: Vec<u8>,
+    dirty: bool,
+    /// 最近是否被访问过（用于缓存满时的second chance淘汰）
+    referenced: bool,
+}
+
+pub struct FATCache {
+    /// FAT表内的扇区号 -> 扇区的内容
+    sectors: BTreeMap<u64, FATCacheSector>,
+    nr_dirty: usize,
+    /// 空闲簇位图，第n位为1表示n号簇空闲
+    free_map: Vec<u64>,
+    nr_free: u64,
+}
+
+impl Debug for FATCache {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        f.debug_struct("FATCache")
+            .field("cached_sectors", &self.sectors.len())
+            .field("nr_dirty", &self.nr_dirty)
+            .field("nr_free", &self.nr_free)
+            .finish()
+    }
+}
+
+impl FATCache {
+    pub const fn new() -> Self {
+        return Self {
+            sectors: BTreeMap::new(),
+            nr_dirty: 0,
+            free_map: Vec::new(),
+            nr_free: 0,
+        };
+    }
+
+    /// 空闲簇的数量
+    #[inline]
+    pub fn nr_free(&self) -> u64 {
+        return self.nr_free;
+    }
+
+    /// @brief 扫描活动的FAT表，建立空闲簇位图（挂载时调用）
+    ///
+    /// @return Ok(u64) 空闲簇的数量
+    pub fn build_free_map(&mut self, fs: &FATFileSystem) -> Result<u64, SystemError> {
+        let max_cluster = fs.max_cluster_number().cluster_num;
+        self.free_map = vec![0u64; (max_cluster as usize + 1 + 63) / 64];
+        self.nr_free = 0;
+
+        let bytes_per_sec = fs.bpb.bytes_per_sector as u64;
+        // FAT12的表项可能跨越扇区，而FAT12的FAT表不大，因此一次读入整个FAT表
+        let batch = match fs.bpb.fat_type {
+            FATType::FAT12(_) => fs.fat_size(),
+            _ => FAT_SCAN_BATCH_SECTORS,
+        };
+
+        let mut cluster = RESERVED_CLUSTERS as u64;
+        let mut sector = 0;
+        while cluster <= max_cluster && sector < fs.fat_size() {
+            let nr_sectors = batch.min(fs.fat_size() - sector);
+            let mut buf = vec![0u8; (nr_sectors * bytes_per_sec) as usize];
+            fs.partition.disk().submit_read(
+                fs.get_lba_from_offset(fs.fat_start_sector() + sector),
+                nr_sectors as usize * fs.lba_per_sector(),
+                &mut buf,
+            )?;
+
+            let base = sector * bytes_per_sec;
+            while cluster <= max_cluster {
+                let (offset, size) = Self::entry_pos(fs.bpb.fat_type, cluster);
+                if offset + size > base + buf.len() as u64 {
+                    break;
+                }
+                let start = (offset - base) as usize;
+                let val =
+                    Self::decode(fs.bpb.fat_type, cluster, &buf[start..start + size as usize]);
+                if val == 0 {
+                    self.mark(cluster, true);
+                }
+                cluster += 1;
+            }
+            sector += nr_sectors;
+        }
+        return Ok(self.nr_free);
+    }
+
+    /// @brief 在簇号范围[start, end)内寻找一个空闲簇
+    pub fn find_free(&self, start: u64, end: u64) -> Option<u64> {
+        let end = end.min(self.free_map.len() as u64 * 64);
+        let mut cluster = start;
+        while cluster < end {
+            let word = self.free_map[(cluster / 64) as usize] >> (cluster % 64);
+            if word != 0 {
+                let found = cluster + word.trailing_zeros() as u64;
+                return if found < end { Some(found) } else { None };
+            }
+            cluster = (cluster / 64 + 1) * 64;
+        }
+        return None;
+    }
+
+    /// @brief 在簇号范围[start, end)内寻找一段连续的空闲簇，用于一次分配多个簇
+    ///
+    /// @return Some((第一个簇, 簇数)) 范围内第一段长度不小于want的空闲簇（簇数为want）；
+    ///         没有这样的一段时，返回范围内最长的一段
+    pub fn find_free_run(&self, start: u64, end: u64, want: u64) -> Option<(u64, u64)> {
+        let end = end.min(self.free_map.len() as u64 * 64);
+        let mut best: Option<(u64, u64)> = None;
+        let mut run_start = 0;
+        let mut run_len = 0;
+        let mut cluster = start;
+        while cluster < end {
+            let word = self.free_map[(cluster / 64) as usize] >> (cluster % 64);
+            let bits = (64 - cluster % 64).min(end - cluster);
+            // 这个字中从cluster开始的连续空闲位（或者连续的已分配位）的数量
+            let (free, n) = if word & 1 != 0 {
+                (true, ((!word).trailing_zeros() as u64).min(bits))
+            } else {
+                (false, (word.trailing_zeros() as u64).min(bits))
+            };
+            if free {
+                if run_len == 0 {
+                    run_start = cluster;
+                }
+                run_len += n;
+                if run_len >= want {
+                    return Some((run_start, want));
+                }
+            } else if run_len != 0 {
+                if best.map_or(true, |(_, len)| run_len > len) {
+                    best = Some((run_start, run_len));
+                }
+                run_len = 0;
+            }
+            cluster += n;
+        }
+        if run_len != 0 && best.map_or(true, |(_, len)| run_len > len) {
+            best = Some((run_start, run_len));
+        }
+        return best;
+    }
+
+    /// @brief 读取簇在FAT表中的表项（不加处理的原始值）
+    pub fn read_entry(&mut self, fs: &FATFileSystem, cluster: u64) -> Result<u64, SystemError> {
+        let (offset, size) = Self::entry_pos(fs.bpb.fat_type, cluster);
+        let mut buf = [0u8; 4];
+        self.read_bytes(fs, offset, &mut buf[..size as usize])?;
+        return Ok(Self::decode(
+            fs.bpb.fat_type,
+            cluster,
+            &buf[..size as usize],
+        ));
+    }
+
+    /// @brief 设置簇在FAT表中的表项，并更新空闲簇位图
+    ///
+    /// @param val 要写入的原始值（FAT32表项的高4位保留，不会被修改）
+    pub fn write_entry(
+        &mut self,
+        fs: &FATFileSystem,
+        cluster: u64,
+        val: u64,
+    ) -> Result<(), SystemError> {
+        let (offset, _) = Self::entry_pos(fs.bpb.fat_type, cluster);
+        match fs.bpb.fat_type {
+            FATType::FAT12(_) => {
+                let mut buf = [0u8; 2];
+                self.read_bytes(fs, offset, &mut buf)?;
+                let old = u16::from_le_bytes(buf);
+                let val = (val & 0x0fff) as u16;
+                // 由于FAT12文件系统的FAT表，每个entry占用1.5字节，因此奇数的簇占用高12位
+                let new = if (cluster & 1) > 0 {
+                    (old & 0x000f) | (val << 4)
+                } else {
+                    (old & 0xf000) | val
+                };
+                self.write_bytes(fs, offset, &new.to_le_bytes())?;
+            }
+            FATType::FAT16(_) => {
+                self.write_bytes(fs, offset, &(val as u16).to_le_bytes())?;
+            }
+            FATType::FAT32(_) => {
+                let mut buf = [0u8; 4];
+                self.read_bytes(fs, offset, &mut buf)?;
+                // FAT32的高4位保留
+                let new = (u32::from_le_bytes(buf) & 0xf000_0000) | (val as u32 & 0x0fff_ffff);
+                self.write_bytes(fs, offset, &new.to_le_bytes())?;
+            }
+        }
+
+        if cluster >= RESERVED_CLUSTERS as u64 && cluster < self.free_map.len() as u64 * 64 {
+            self.mark(cluster, val == 0);
+        }
+
+        if self.nr_dirty >= FAT_CACHE_DIRTY_THRESHOLD {
+            self.flush(fs)?;
+        }
+        return Ok(());
+    }
+
+    /// @brief 把所有的脏扇区写回磁盘上需要同步的每一个FAT表副本
+    pub fn flush(&mut self, fs: &FATFileSystem) -> Result<(), SystemError> {
+        if self.nr_dirty == 0 {
+            return Ok(());
+        }
+
+        // 需要写入的FAT表的起始扇区。FAT32可以关闭镜像，此时只写入活动的FAT表
+        let fat_starts: Vec<u64> = if let FATType::FAT32(_) = fs.bpb.fat_type {
+            if !fs.mirroring_enabled() {
+                vec![fs.fat_start_sector()]
+            } else {
+                Self::all_fat_starts(fs)
+            }
+        } else {
+            Self::all_fat_starts(fs)
+        };
+
+        let dirty: Vec<u64> = self
+            .sectors
+            .iter()
+            .filter(|(_, s)| s.dirty)
+            .map(|(idx, _)| *idx)
+            .collect();
+
+        let mut i = 0;
+        while i < dirty.len() {
+            // 合并连续的脏扇区
+            let mut j = i + 1;
+            while j < dirty.len() && dirty[j] == dirty[j - 1] + 1 {
+                j += 1;
+            }
+            let run = &dirty[i..j];
+            let mut buf: Vec<u8> = Vec::with_capacity(run.len() * fs.bpb.bytes_per_sector as usize);
+            for idx in run {
+                buf.extend_from_slice(&self.sectors[idx].data);
+            }
+            for fat_start in fat_starts.iter() {
+                fs.bcache.write(
+                    fs.get_lba_from_offset(fat_start + run[0]),
+                    run.len() * fs.lba_per_sector(),
+                    &buf,
+                )?;
+            }
+            for idx in run {
+                self.sectors.get_mut(idx).unwrap().dirty = false;
+            }
+            self.nr_dirty -= run.len();
+            i = j;
+        }
+        return Ok(());
+    }
+
+    fn all_fat_starts(fs: &FATFileSystem) -> Vec<u64> {
+        return (0..fs.bpb.num_fats as u64)
+            .map(|i| fs.bpb.rsvd_sec_cnt as u64 + i * fs.fat_size())
+            .collect();
+    }
+
+    /// 表项相对于FAT表起始位置的字节偏移量，以及需要读取的字节数
+    fn entry_pos(fat_type: FATType, cluster: u64) -> (u64, u64) {
+        match fat_type {
+            FATType::FAT12(_) => (cluster + cluster / 2, 2),
+            FATType::FAT16(_) => (cluster * 2, 2),
+            FATType::FAT32(_) => (cluster * 4, 4),
+        }
+    }
+
+    fn decode(fat_type: FATType, cluster: u64, bytes: &[u8]) -> u64 {
+        match fat_type {
+            FATType::FAT12(_) => {
+                let val = u16::from_le_bytes([bytes[0], bytes[1]]);
+                if (cluster & 1) > 0 {
+                    (val >> 4) as u64
+                } else {
+                    (val & 0x0fff) as u64
+                }
+            }
+            FATType::FAT16(_) => u16::from_le_bytes([bytes[0], bytes[1]]) as u64,
+            FATType::FAT32(_) => {
+                (u32::from_le_bytes([bytes[0], bytes[1], bytes[2], bytes[3]]) & 0x0fff_ffff) as u64
+            }
+        }
+    }
+
+    fn mark(&mut self, cluster: u64, free: bool) {
+        let word = &mut self.free_map[(cluster / 64) as usize];
+        let bit = 1u64 << (cluster % 64);
+        if free && (*word & bit) == 0 {
+            *word |= bit;
+            self.nr_free += 1;
+        } else if !free && (*word & bit) != 0 {
+            *word &= !bit;
+            self.nr_free -= 1;
+        }
+    }
+
+    /// 读取FAT表中`offset`（相对FAT表起始位置的字节偏移量）处的`buf.len()`个字节
+    fn read_bytes(
+        &mut self,
+        fs: &FATFileSystem,
+        offset: u64,
+        buf: &mut [u8],
+    ) -> Result<(), SystemError> {
+        let bytes_per_sec = fs.bpb.bytes_per_sector as u64;
+        for (i, b) in buf.iter_mut().enumerate() {
+            let pos = offset + i as u64;
+            let sector = self.sector(fs, pos / bytes_per_sec)?;
+            *b = sector.data[(pos % bytes_per_sec) as usize];
+        }
+        return Ok(());
+    }
+
+    fn write_bytes(
+        &mut self,
+        fs: &FATFileSystem,
+        offset: u64,
+        buf: &[u8],
+    ) -> Result<(), SystemError> {
+        let bytes_per_sec = fs.bpb.bytes_per_sector as u64;
+        for (i, b) in buf.iter().enumerate() {
+            let pos = offset + i as u64;
+            let sector = self.sector(fs, pos / bytes_per_sec)?;
+            sector.data[(pos % bytes_per_sec) as usize] = *b;
+            let newly_dirty = !core::mem::replace(&mut sector.dirty, true);
+            if newly_dirty {
+                self.nr_dirty += 1;
+            }
+        }
+        return Ok(());
+    }
+
+    /// 获取FAT表内的第`idx`个扇区，不在缓存中时从磁盘读入
+    fn sector(&mut self, fs: &FATFileSystem, idx: u64) -> Result<&mut FATCacheSector, SystemError> {
+        if !self.sectors.contains_key(&idx) {
+            if idx >= fs.fat_size() {
+                return Err(SystemError::EINVAL);
+            }
+            if self.sectors.len() >= FAT_CACHE_MAX_SECTORS {
+                self.shrink(fs)?;
+            }
+            let mut data = vec![0u8; fs.bpb.bytes_per_sector as usize];
+            fs.bcache.read(
+                fs.get_lba_from_offset(fs.fat_start_sector() + idx),
+                fs.lba_per_sector(),
+                &mut data,
+            )?;
+            self.sectors.insert(
+                idx,
+                FATCacheSector {
+                    data,
+                    dirty: false,
+                    referenced: false,
+                },
+            );
+        }
+        let sector = self.sectors.get_mut(&idx).unwrap();
+        sector.referenced = true;
+        return Ok(sector);
+    }
+
+    /// 缓存已满：写回脏扇区，然后按照second chance算法淘汰最近没有被访问过的扇区，直到缓存剩余1/4的空间
+    fn shrink(&mut self, fs: &FATFileSystem) -> Result<(), SystemError> {
+        self.flush(fs)?;
+        let target = FAT_CACHE_MAX_SECTORS * 3 / 4;
+        // 第一轮清除访问标记，第二轮一定能淘汰足够多的扇区
+        for _ in 0..2 {
+            let mut remain = self.sectors.len();
+            let mut victims = Vec::new();
+            for (idx, sector) in self.sectors.iter_mut() {
+                if remain <= target {
+                    break;
+                }
+                if sector.referenced {
+                    sector.referenced = false;
+                } else {
+                    victims.push(*idx);
+                    remain -= 1;
+                }
+            }
+            for idx in victims {
+                self.sectors.remove(&idx);
+            }
+            if self.sectors.len() <= target {
+                break;
+            }
+        }
+        return Ok(());
+    }
+}
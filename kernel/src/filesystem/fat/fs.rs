@@ -12,15 +12,23 @@ use alloc::{
 use crate::filesystem::vfs::SpecialNodeData;
 use crate::ipc::pipe::LockedPipeInode;
 use crate::{
-    driver::base::block::{block_device::LBA_SIZE, disk_info::Partition, SeekFrom},
+    driver::base::block::{
+        block_device::LBA_SIZE, buffer_cache::BufferCache, disk_info::Partition,
+        request_queue::BlkPlug, SeekFrom,
+    },
     filesystem::vfs::{
         core::generate_inode_id,
+        dcache::DentryCachePolicy,
         file::{FileMode, FilePrivateData},
+        icache::{icache_get, icache_insert, icache_remove},
+        page_cache::PageCache,
         syscall::ModeType,
+        writeback::BackingDevInfo,
         FileSystem, FileType, IndexNode, InodeId, Metadata, PollStatus,
     },
     kerror,
     libs::{
+        casting::DowncastArc,
         spinlock::{SpinLock, SpinLockGuard},
         vec_cursor::VecCursor,
     },
@@ -31,12 +39,16 @@ use crate::{
 use super::entry::FATFile;
 use super::{
     bpb::{BiosParameterBlock, FATType},
+    dir_index::FATDirIndexCache,
     entry::{FATDir, FATDirEntry, FATDirIter, FATEntry},
+    fat_cache::FATCache,
     utils::RESERVED_CLUSTERS,
 };
 
 /// FAT32文件系统的最大的文件大小
 pub const MAX_FILE_SIZE: u64 = 0xffff_ffff;
+/// 清零一段簇时，每次写入磁盘的最大字节数
+const ZERO_CHUNK_BYTES: usize = 1024 * 1024;
 
 /// @brief 表示当前簇和上一个簇的关系的结构体
 /// 定义这样一个结构体的原因是，FAT文件系统的文件中，前后两个簇具有关联关系。
@@ -74,6 +86,14 @@ pub struct FATFileSystem {
     pub fs_info: Arc<LockedFATFsInfo>,
     /// 文件系统的根inode
     root_inode: Arc<LockedFATInode>,
+    /// FAT表的缓存以及空闲簇位图
+    fat_cache: SpinLock<FATCache>,
+    /// 目录的内存索引
+    pub dir_index: SpinLock<FATDirIndexCache>,
+    /// 元数据（目录项、FAT表、FsInfo）的缓冲区缓存。文件数据不经过它
+    pub bcache: BufferCache,
+    /// 文件的页面缓存所在的后备设备，负责写回脏页
+    bdi: Arc<BackingDevInfo>,
 }
 
 /// FAT文件系统的Inode
@@ -92,13 +112,16 @@ impl LockedFATFsInfo {
 
 #[derive(Debug)]
 pub struct FATInode {
-    /// 指向父Inode的弱引用
-    parent: Weak<LockedFATInode>,
+    /// 指向父Inode的指针（根目录为None）。子inode在内存中时，父目录的inode不会被inode缓存淘汰
+    parent: Option<Arc<LockedFATInode>>,
     /// 指向自身的弱引用
     self_ref: Weak<LockedFATInode>,
     /// 子Inode的B树. 该数据结构用作缓存区。其中，它的key表示inode的名称。
     /// 请注意，由于FAT的查询过程对大小写不敏感，因此我们选择让key全部是大写的，方便统一操作。
-    children: BTreeMap<String, Arc<LockedFATInode>>,
+    /// 子inode由inode缓存持有，这里只保存弱引用
+    children: BTreeMap<String, Weak<LockedFATInode>>,
+    /// 通过mknod创建的、不在磁盘上的特殊文件（例如管道）。它们不在inode缓存中，因此由这里持有
+    special_children: BTreeMap<String, Arc<LockedFATInode>>,
     /// 当前inode的元数据
     metadata: Metadata,
     /// 指向inode所在的文件系统对象的指针
@@ -109,6 +132,9 @@ pub struct FATInode {
 
     /// 若该节点是特殊文件节点，该字段则为真正的文件节点
     special_node: Option<SpecialNodeData>,
+
+    /// 普通文件的页面缓存
+    page_cache: Option<Arc<PageCache>>,
 }
 
 impl FATInode {
@@ -132,24 +158,33 @@ impl FATInode {
     fn find(&mut self, name: &str) -> Result<Arc<LockedFATInode>, SystemError> {
         match &self.inode_type {
             FATDirEntry::Dir(d) => {
-                // 尝试在缓存区查找
-                if let Some(entry) = self.children.get(&name.to_uppercase()) {
+                match name {
+                    "" | "." => return Ok(self.self_ref.upgrade().unwrap()),
+                    ".." => {
+                        return Ok(self
+                            .parent
+                            .clone()
+                            .unwrap_or_else(|| self.self_ref.upgrade().unwrap()))
+                    }
+                    _ => {}
+                }
+
+                let key = name.to_uppercase();
+                if let Some(entry) = self.special_children.get(&key) {
                     return Ok(entry.clone());
                 }
+                // 尝试在缓存区查找
+                if let Some(entry) = self.children.get(&key).and_then(|e| e.upgrade()) {
+                    return Ok(entry);
+                }
                 // 在缓存区找不到
                 // 在磁盘查找
                 let fat_entry: FATDirEntry =
                     d.find_entry(name, None, None, self.fs.upgrade().unwrap())?;
                 // kdebug!("find entry from disk ok, entry={fat_entry:?}");
-                // 创建新的inode
-                let entry_inode: Arc<LockedFATInode> = LockedFATInode::new(
-                    self.fs.upgrade().unwrap(),
-                    self.self_ref.clone(),
-                    fat_entry,
-                );
+                let entry_inode: Arc<LockedFATInode> = self.child_inode(fat_entry);
                 // 加入缓存区, 由于FAT文件系统的大小写不敏感问题，因此存入缓存区的key应当是全大写的
-                self.children
-                    .insert(name.to_uppercase(), entry_inode.clone());
+                self.children.insert(key, Arc::downgrade(&entry_inode));
                 return Ok(entry_inode);
             }
             FATDirEntry::UnInit => {
@@ -163,12 +198,45 @@ impl FATInode {
             }
         }
     }
+
+    /// @brief 获取当前目录下的目录项`entry`对应的inode
+    ///
+    /// 同一个文件在内存中只有一个inode：如果inode缓存中已经有这个目录项对应的inode
+    /// （例如之前通过长文件名或者短文件名找到过这个文件），则直接返回它，否则创建一个新的inode
+    fn child_inode(&self, entry: FATDirEntry) -> Arc<LockedFATInode> {
+        let fs = self.fs.upgrade().unwrap();
+        let ino = LockedFATInode::disk_ino(&fs, &entry);
+        if let Some(inode) = ino
+            .and_then(|ino| icache_get(&fs, ino))
+            .and_then(|inode| inode.downcast_arc::<LockedFATInode>())
+        {
+            return inode;
+        }
+
+        let inode = LockedFATInode::new(fs.clone(), self.self_ref.upgrade(), entry);
+        if let Some(ino) = ino {
+            if let Some(cached) =
+                icache_insert(&fs, ino, inode.clone()).downcast_arc::<LockedFATInode>()
+            {
+                return cached;
+            }
+        }
+        return inode;
+    }
 }
 
 impl LockedFATInode {
+    /// @brief 获取目录项在inode缓存中的标识：短目录项在分区中的字节偏移量
+    ///
+    /// 同一个文件的长文件名、短文件名对应同一个短目录项，因此标识相同
+    fn disk_ino(fs: &Arc<FATFileSystem>, entry: &FATDirEntry) -> Option<u64> {
+        let (_, (cluster, offset)) = entry.get_dir_range()?;
+        return Some(fs.cluster_bytes_offset(cluster) + offset);
+    }
+
     pub fn new(
         fs: Arc<FATFileSystem>,
-        parent: Weak<LockedFATInode>,
+        parent: Option<Arc<LockedFATInode>>,
         inode_type: FATDirEntry,
     ) -> Arc<LockedFATInode> {
         let file_type = if let FATDirEntry::Dir(_) = inode_type {
@@ -181,6 +249,7 @@ impl LockedFATInode {
             parent: parent,
             self_ref: Weak::default(),
             children: BTreeMap::new(),
+            special_children: BTreeMap::new(),
             fs: Arc::downgrade(&fs),
             inode_type: inode_type,
             metadata: Metadata {
@@ -204,9 +273,14 @@ impl LockedFATInode {
                 raw_dev: 0,
             },
             special_node: None,
+            page_cache: None,
         })));
 
         inode.0.lock().self_ref = Arc::downgrade(&inode);
+        if file_type == FileType::File {
+            let backend: Weak<LockedFATInode> = Arc::downgrade(&inode);
+            inode.0.lock().page_cache = Some(PageCache::new(backend, fs.bdi.clone()));
+        }
 
         inode.0.lock().update_metadata();
 
@@ -248,6 +322,15 @@ impl FileSystem for FATFileSystem {
     fn as_any_ref(&self) -> &dyn Any {
         self
     }
+
+    fn sync(&self) -> Result<(), SystemError> {
+        return self.flush();
+    }
+
+    /// FAT的目录只会通过VFS修改，文件名大小写不敏感
+    fn dentry_cache_policy(&self) -> DentryCachePolicy {
+        return DentryCachePolicy::CaseInsensitive;
+    }
 }
 
 impl FATFileSystem {
@@ -298,9 +381,10 @@ impl FATFileSystem {
 
         // 创建文件系统的根节点
         let root_inode: Arc<LockedFATInode> = Arc::new(LockedFATInode(SpinLock::new(FATInode {
-            parent: Weak::default(),
+            parent: None,
             self_ref: Weak::default(),
             children: BTreeMap::new(),
+            special_children: BTreeMap::new(),
             fs: Weak::default(),
             inode_type: FATDirEntry::UnInit,
             metadata: Metadata {
@@ -324,25 +408,40 @@ impl FATFileSystem {
                 raw_dev: 0,
             },
             special_node: None,
+            page_cache: None,
         })));
 
+        let bcache = BufferCache::new(&partition.disk());
         let result: Arc<FATFileSystem> = Arc::new(FATFileSystem {
             partition: partition,
             bpb,
             first_data_sector,
             fs_info: Arc::new(LockedFATFsInfo::new(fs_info)),
             root_inode: root_inode,
+            fat_cache: SpinLock::new(FATCache::new()),
+            dir_index: SpinLock::new(FATDirIndexCache::new()),
+            bcache,
+            bdi: BackingDevInfo::new(),
         });
+        let fs: Arc<dyn FileSystem> = result.clone();
+        result.bdi.set_fs(Arc::downgrade(&fs));
 
         // 对root inode加锁，并继续完成初始化工作
         let mut root_guard: SpinLockGuard<FATInode> = result.root_inode.0.lock();
         root_guard.inode_type = FATDirEntry::Dir(result.root_dir());
-        root_guard.parent = Arc::downgrade(&result.root_inode);
         root_guard.self_ref = Arc::downgrade(&result.root_inode);
         root_guard.fs = Arc::downgrade(&result);
         // 释放锁
         drop(root_guard);
 
+        // 扫描FAT表，建立空闲簇位图。FsInfo中的空闲簇数量只是一个参考值，以扫描的结果为准
+        let nr_free = result.fat_cache.lock().build_free_map(&result)?;
+        result
+            .fs_info
+            .0
+            .lock()
+            .update_free_count_abs(nr_free as u32);
+
         return Ok(result);
     }
 
@@ -365,41 +464,10 @@ impl FATFileSystem {
             return Err(SystemError::EINVAL);
         }
 
-        let fat_type: FATType = self.bpb.fat_type;
-        // 获取FAT表的起始扇区（相对分区起始扇区的偏移量）
-        let fat_start_sector = self.fat_start_sector();
-        let bytes_per_sec = self.bpb.bytes_per_sector as u64;
-
-        // cluster对应的FAT表项在分区内的字节偏移量
-        let fat_bytes_offset =
-            fat_type.get_fat_bytes_offset(cluster, fat_start_sector, bytes_per_sec);
-
-        // FAT表项所在的LBA地址
-        // let fat_ent_lba = self.get_lba_from_offset(self.bytes_to_sector(fat_bytes_offset));
-        let fat_ent_lba = self.partition.lba_start + fat_bytes_offset / LBA_SIZE as u64;
-
-        // FAT表项在逻辑块内的字节偏移量
-        let blk_offset = self.get_in_block_offset(fat_bytes_offset);
-
-        let mut v = Vec::<u8>::new();
-        v.resize(self.bpb.bytes_per_sector as usize, 0);
-        self.partition
-            .disk()
-            .read_at(fat_ent_lba as usize, 1 * self.lba_per_sector(), &mut v)?;
-
-        let mut cursor = VecCursor::new(v);
-        cursor.seek(SeekFrom::SeekSet(blk_offset as i64))?;
+        let entry = self.get_fat_entry_raw(cluster)?;
 
         let res: FATEntry = match self.bpb.fat_type {
             FATType::FAT12(_) => {
-                let mut entry = cursor.read_u16()?;
-                // 由于FAT12文件系统的FAT表，每个entry占用1.5字节，因此奇数的簇需要取高12位的值。
-                if (current_cluster & 1) > 0 {
-                    entry >>= 4;
-                } else {
-                    entry &= 0x0fff;
-                }
-
                 if entry == 0 {
                     FATEntry::Unused
                 } else if entry == 0x0ff7 {
@@ -408,14 +476,12 @@ impl FATFileSystem {
                     FATEntry::EndOfChain
                 } else {
                     FATEntry::Next(Cluster {
-                        cluster_num: entry as u64,
+                        cluster_num: entry,
                         parent_cluster: current_cluster,
                     })
                 }
             }
             FATType::FAT16(_) => {
-                let entry = cursor.read_u16()?;
-
                 if entry == 0 {
                     FATEntry::Unused
                 } else if entry == 0xfff7 {
@@ -424,14 +490,12 @@ impl FATFileSystem {
                     FATEntry::EndOfChain
                 } else {
                     FATEntry::Next(Cluster {
-                        cluster_num: entry as u64,
+                        cluster_num: entry,
                         parent_cluster: current_cluster,
                     })
                 }
             }
             FATType::FAT32(_) => {
-                let entry = cursor.read_u32()? & 0x0fffffff;
-
                 match entry {
                     _n if (current_cluster >= 0x0ffffff7 && current_cluster <= 0x0fffffff) => {
                         // 当前簇号不是一个能被获得的簇（可能是文件系统出错了）
@@ -442,7 +506,7 @@ impl FATFileSystem {
                     0x0ffffff7 => FATEntry::Bad,
                     0x0ffffff8..=0x0fffffff => FATEntry::EndOfChain,
                     _n => FATEntry::Next(Cluster {
-                        cluster_num: entry as u64,
+                        cluster_num: entry,
                         parent_cluster: current_cluster,
                     }),
                 }
@@ -458,53 +522,7 @@ impl FATFileSystem {
     /// @return Ok(u64) 当前簇在FAT表中，存储的信息。
     /// @return Err(SystemError) 错误码
     pub fn get_fat_entry_raw(&self, cluster: Cluster) -> Result<u64, SystemError> {
-        let current_cluster = cluster.cluster_num;
-
-        let fat_type: FATType = self.bpb.fat_type;
-        // 获取FAT表的起始扇区（相对分区起始扇区的偏移量）
-        let fat_start_sector = self.fat_start_sector();
-        let bytes_per_sec = self.bpb.bytes_per_sector as u64;
-
-        // cluster对应的FAT表项在分区内的字节偏移量
-        let fat_bytes_offset =
-            fat_type.get_fat_bytes_offset(cluster, fat_start_sector, bytes_per_sec);
-
-        // FAT表项所在的LBA地址
-        let fat_ent_lba = self.get_lba_from_offset(self.bytes_to_sector(fat_bytes_offset));
-
-        // FAT表项在逻辑块内的字节偏移量
-        let blk_offset = self.get_in_block_offset(fat_bytes_offset);
-
-        let mut v = Vec::<u8>::new();
-        v.resize(self.bpb.bytes_per_sector as usize, 0);
-        self.partition
-            .disk()
-            .read_at(fat_ent_lba, 1 * self.lba_per_sector(), &mut v)?;
-
-        let mut cursor = VecCursor::new(v);
-        cursor.seek(SeekFrom::SeekSet(blk_offset as i64))?;
-
-        let res = match self.bpb.fat_type {
-            FATType::FAT12(_) => {
-                let mut entry = cursor.read_u16()?;
-                entry = if (current_cluster & 0x0001) > 0 {
-                    entry >> 4
-                } else {
-                    entry & 0x0fff
-                };
-                entry as u64
-            }
-            FATType::FAT16(_) => {
-                let entry = (cursor.read_u16()?) as u64;
-                entry
-            }
-            FATType::FAT32(_) => {
-                let entry = cursor.read_u32()? & 0x0fff_ffff;
-                entry as u64
-            }
-        };
-
-        return Ok(res);
+        return self.fat_cache.lock().read_entry(self, cluster.cluster_num);
     }
 
     /// @brief 获取当前文件系统的root inode，在磁盘上的字节偏移量
@@ -575,16 +593,21 @@ impl FATFileSystem {
             _ => Cluster::new(RESERVED_CLUSTERS as u64),
         };
 
-        // 寻找一个空的簇
-        let free_cluster: Cluster = match self.get_free_cluster(start_cluster, end_cluster) {
-            Ok(c) => c,
-            Err(_) if start_cluster.cluster_num > RESERVED_CLUSTERS as u64 => {
-                self.get_free_cluster(Cluster::new(RESERVED_CLUSTERS as u64), end_cluster)?
-            }
-            Err(e) => return Err(e),
+        // 在空闲簇位图中寻找一个空的簇，并在同一个临界区内把它标记为簇链的结尾，避免被其他进程同时分配
+        let mut fat_cache = self.fat_cache.lock();
+        let free_cluster: Cluster = match fat_cache
+            .find_free(start_cluster.cluster_num, end_cluster.cluster_num + 1)
+            .or_else(|| fat_cache.find_free(RESERVED_CLUSTERS as u64, start_cluster.cluster_num))
+        {
+            Some(c) => Cluster::new(c),
+            None => return Err(SystemError::ENOSPC),
         };
-
-        self.set_entry(free_cluster, FATEntry::EndOfChain)?;
+        fat_cache.write_entry(
+            self,
+            free_cluster.cluster_num,
+            self.raw_fat_entry(FATEntry::EndOfChain),
+        )?;
+        drop(fat_cache);
         // 减少空闲簇计数
         self.fs_info.0.lock().update_free_count_delta(-1);
         // 更新搜索空闲簇的参考量
@@ -603,6 +626,93 @@ impl FATFileSystem {
         return Ok(free_cluster);
     }
 
+    /// @brief 一次分配count个簇，尽量让它们在磁盘上连续，并连接成簇链
+    ///
+    /// 与逐个调用[`Self::allocate_cluster`]不同，这里在空闲簇位图中直接寻找足够长的一段连续的空闲簇：
+    /// 优先从prev_cluster之后开始找，使新的簇紧接着簇链原有的末尾；找不到足够长的一段时，
+    /// 依次使用最长的几段。空闲簇不足count个时直接返回ENOSPC，不会只分配一部分
+    ///
+    /// @param prev_cluster 簇链原来的最后一个簇，新的簇连接到它的后面。为None时新的簇构成一条新的簇链
+    /// @param zero 是否清零新分配的簇
+    ///
+    /// @return Ok(Vec<(Cluster, u64)>) 按簇链顺序排列的各段连续的簇：(第一个簇, 簇数)
+    pub fn allocate_clusters(
+        &self,
+        prev_cluster: Option<Cluster>,
+        count: u64,
+        zero: bool,
+    ) -> Result<Vec<(Cluster, u64)>, SystemError> {
+        let mut runs: Vec<(Cluster, u64)> = Vec::new();
+        if count == 0 {
+            return Ok(runs);
+        }
+        let end_cluster = self.max_cluster_number().cluster_num + 1;
+        let mut hint = match prev_cluster {
+            Some(c) => c.cluster_num + 1,
+            None => match self.bpb.fat_type {
+                FATType::FAT32(_) => self.fs_info.0.lock().next_free().unwrap_or(0),
+                _ => 0,
+            },
+        };
+        if hint < RESERVED_CLUSTERS as u64 || hint >= end_cluster {
+            hint = RESERVED_CLUSTERS as u64;
+        }
+
+        let mut fat_cache = self.fat_cache.lock();
+        if fat_cache.nr_free() < count {
+            return Err(SystemError::ENOSPC);
+        }
+        let mut prev = prev_cluster.map(|c| c.cluster_num);
+        let mut remain = count;
+        while remain > 0 {
+            let (start, len) = match fat_cache
+                .find_free_run(hint, end_cluster, remain)
+                .filter(|(_, len)| *len == remain || hint == RESERVED_CLUSTERS as u64)
+                .or_else(|| fat_cache.find_free_run(RESERVED_CLUSTERS as u64, end_cluster, remain))
+            {
+                Some(run) => run,
+                None => return Err(SystemError::ENOSPC),
+            };
+            // 段内的簇依次相连，最后一个簇作为簇链的结尾
+            for c in start..start + len - 1 {
+                fat_cache.write_entry(
+                    self,
+                    c,
+                    self.raw_fat_entry(FATEntry::Next(Cluster::new(c + 1))),
+                )?;
+            }
+            fat_cache.write_entry(
+                self,
+                start + len - 1,
+                self.raw_fat_entry(FATEntry::EndOfChain),
+            )?;
+            if let Some(prev) = prev {
+                fat_cache.write_entry(
+                    self,
+                    prev,
+                    self.raw_fat_entry(FATEntry::Next(Cluster::new(start))),
+                )?;
+            }
+            runs.push((Cluster::new(start), len));
+            prev = Some(start + len - 1);
+            hint = start + len;
+            remain -= len;
+        }
+        drop(fat_cache);
+
+        let mut fs_info = self.fs_info.0.lock();
+        fs_info.update_free_count_delta(-(count as i32));
+        fs_info.update_next_free(hint as u32);
+        drop(fs_info);
+
+        if zero {
+            for (start, len) in runs.iter() {
+                self.zero_clusters(*start, *len)?;
+            }
+        }
+        return Ok(runs);
+    }
+
     /// @brief 释放簇链上的所有簇
     ///
     /// @param start_cluster 簇链的第一个簇
@@ -868,12 +978,12 @@ impl FATFileSystem {
 
     /// @brief 执行文件系统卸载前的一些准备工作：设置好对应的标志位，并把缓存中的数据刷入磁盘
     pub fn umount(&mut self) -> Result<(), SystemError> {
-        self.fs_info.0.lock().flush(&self.partition)?;
-
         self.set_shut_bit_ok()?;
 
         self.set_hard_error_bit_ok()?;
 
+        self.flush()?;
+
         self.partition.disk().sync()?;
 
         return Ok(());
@@ -926,122 +1036,15 @@ impl FATFileSystem {
         start_cluster: Cluster,
         end_cluster: Cluster,
     ) -> Result<Cluster, SystemError> {
-        let max_cluster: Cluster = self.max_cluster_number();
-        let mut cluster: u64 = start_cluster.cluster_num;
-
-        let fat_type: FATType = self.bpb.fat_type;
-        let fat_start_sector: u64 = self.fat_start_sector();
-        let bytes_per_sec: u64 = self.bpb.bytes_per_sector as u64;
-
-        match fat_type {
-            FATType::FAT12(_) => {
-                let part_bytes_offset: u64 =
-                    fat_type.get_fat_bytes_offset(start_cluster, fat_start_sector, bytes_per_sec);
-                let in_block_offset = self.get_in_block_offset(part_bytes_offset);
-
-                let lba = self.get_lba_from_offset(self.bytes_to_sector(part_bytes_offset));
-
-                // 由于FAT12的FAT表不大于6K，因此直接读取6K
-                let num_lba = (6 * 1024) / LBA_SIZE;
-                let mut v: Vec<u8> = Vec::new();
-                v.resize(num_lba * LBA_SIZE, 0);
-                self.partition.disk().read_at(lba, num_lba, &mut v)?;
-
-                let mut cursor: VecCursor = VecCursor::new(v);
-                cursor.seek(SeekFrom::SeekSet(in_block_offset as i64))?;
-
-                let mut packed_val: u16 = cursor.read_u16()?;
-                loop {
-                    let val = if (cluster & 0x1) > 0 {
-                        packed_val >> 4
-                    } else {
-                        packed_val & 0x0fff
-                    };
-                    if val == 0 {
-                        return Ok(Cluster::new(cluster as u64));
-                    }
-
-                    cluster += 1;
-
-                    // 磁盘无剩余空间，或者簇号达到给定的最大值
-                    if cluster == end_cluster.cluster_num || cluster == max_cluster.cluster_num {
-                        return Err(SystemError::ENOSPC);
-                    }
-
-                    packed_val = match cluster & 1 {
-                        0 => cursor.read_u16()?,
-                        _ => {
-                            let next_byte = cursor.read_u8()? as u16;
-                            (packed_val >> 8) | (next_byte << 8)
-                        }
-                    };
-                }
-            }
-            FATType::FAT16(_) => {
-                // todo: 优化这里，减少读取磁盘的次数。
-                while cluster < end_cluster.cluster_num && cluster < max_cluster.cluster_num {
-                    let part_bytes_offset: u64 = fat_type.get_fat_bytes_offset(
-                        Cluster::new(cluster),
-                        fat_start_sector,
-                        bytes_per_sec,
-                    );
-                    let in_block_offset = self.get_in_block_offset(part_bytes_offset);
-
-                    let lba = self.get_lba_from_offset(self.bytes_to_sector(part_bytes_offset));
-
-                    let mut v: Vec<u8> = Vec::new();
-                    v.resize(self.lba_per_sector() * LBA_SIZE, 0);
-                    self.partition
-                        .disk()
-                        .read_at(lba, self.lba_per_sector(), &mut v)?;
-
-                    let mut cursor: VecCursor = VecCursor::new(v);
-                    cursor.seek(SeekFrom::SeekSet(in_block_offset as i64))?;
-
-                    let val = cursor.read_u16()?;
-                    // 找到空闲簇
-                    if val == 0 {
-                        return Ok(Cluster::new(val as u64));
-                    }
-                    cluster += 1;
-                }
-
-                // 磁盘无剩余空间，或者簇号达到给定的最大值
-                return Err(SystemError::ENOSPC);
-            }
-            FATType::FAT32(_) => {
-                // todo: 优化这里，减少读取磁盘的次数。
-                while cluster < end_cluster.cluster_num && cluster < max_cluster.cluster_num {
-                    let part_bytes_offset: u64 = fat_type.get_fat_bytes_offset(
-                        Cluster::new(cluster),
-                        fat_start_sector,
-                        bytes_per_sec,
-                    );
-                    let in_block_offset = self.get_in_block_offset(part_bytes_offset);
-
-                    let lba = self.get_lba_from_offset(self.bytes_to_sector(part_bytes_offset));
-
-                    let mut v: Vec<u8> = Vec::new();
-                    v.resize(self.lba_per_sector() * LBA_SIZE, 0);
-                    self.partition
-                        .disk()
-                        .read_at(lba, self.lba_per_sector(), &mut v)?;
-
-                    let mut cursor: VecCursor = VecCursor::new(v);
-                    cursor.seek(SeekFrom::SeekSet(in_block_offset as i64))?;
-
-                    let val = cursor.read_u32()? & 0x0fffffff;
-
-                    if val == 0 {
-                        return Ok(Cluster::new(cluster));
-                    }
-                    cluster += 1;
-                }
-
-                // 磁盘无剩余空间，或者簇号达到给定的最大值
-                return Err(SystemError::ENOSPC);
-            }
-        }
+        let end = end_cluster
+            .cluster_num
+            .min(self.max_cluster_number().cluster_num + 1);
+        return self
+            .fat_cache
+            .lock()
+            .find_free(start_cluster.cluster_num, end)
+            .map(Cluster::new)
+            .ok_or(SystemError::ENOSPC);
     }
 
     /// @brief 在FAT表中，设置指定的簇的信息。
@@ -1049,142 +1052,75 @@ impl FATFileSystem {
     /// @param cluster 目标簇
     /// @param fat_entry 这个簇在FAT表中，存储的信息（下一个簇的簇号）
     pub fn set_entry(&self, cluster: Cluster, fat_entry: FATEntry) -> Result<(), SystemError> {
-        // fat表项在分区上的字节偏移量
-        let fat_part_bytes_offset: u64 = self.bpb.fat_type.get_fat_bytes_offset(
-            cluster,
-            self.fat_start_sector(),
-            self.bpb.bytes_per_sector as u64,
-        );
-
-        match self.bpb.fat_type {
-            FATType::FAT12(_) => {
-                // 计算要写入的值
-                let raw_val: u16 = match fat_entry {
-                    FATEntry::Unused => 0,
-                    FATEntry::Bad => 0xff7,
-                    FATEntry::EndOfChain => 0xfff,
-                    FATEntry::Next(c) => c.cluster_num as u16,
-                };
-
-                let in_block_offset = self.get_in_block_offset(fat_part_bytes_offset);
-
-                let lba = self.get_lba_from_offset(self.bytes_to_sector(fat_part_bytes_offset));
-
-                let mut v: Vec<u8> = Vec::new();
-                v.resize(LBA_SIZE, 0);
-                self.partition.disk().read_at(lba, 1, &mut v)?;
-
-                let mut cursor: VecCursor = VecCursor::new(v);
-                cursor.seek(SeekFrom::SeekSet(in_block_offset as i64))?;
-
-                let old_val: u16 = cursor.read_u16()?;
-                let new_val: u16 = if (cluster.cluster_num & 0x1) > 0 {
-                    (old_val & 0x000f) | (raw_val << 4)
-                } else {
-                    (old_val & 0xf000) | raw_val
-                };
-
-                // 写回数据到磁盘上
-                cursor.seek(SeekFrom::SeekSet(in_block_offset as i64))?;
-                cursor.write_u16(new_val)?;
-                self.partition.disk().write_at(lba, 1, cursor.as_slice())?;
-                return Ok(());
-            }
-            FATType::FAT16(_) => {
-                // 计算要写入的值
-                let raw_val: u16 = match fat_entry {
-                    FATEntry::Unused => 0,
-                    FATEntry::Bad => 0xfff7,
-                    FATEntry::EndOfChain => 0xfdff,
-                    FATEntry::Next(c) => c.cluster_num as u16,
-                };
-
-                let in_block_offset = self.get_in_block_offset(fat_part_bytes_offset);
-
-                let lba = self.get_lba_from_offset(self.bytes_to_sector(fat_part_bytes_offset));
-
-                let mut v: Vec<u8> = Vec::new();
-                v.resize(LBA_SIZE, 0);
-                self.partition.disk().read_at(lba, 1, &mut v)?;
-
-                let mut cursor: VecCursor = VecCursor::new(v);
-                cursor.seek(SeekFrom::SeekSet(in_block_offset as i64))?;
-
-                cursor.write_u16(raw_val)?;
-                self.partition.disk().write_at(lba, 1, cursor.as_slice())?;
-
-                return Ok(());
+        if let FATType::FAT32(_) = self.bpb.fat_type {
+            if fat_entry == FATEntry::Unused
+                && cluster.cluster_num >= 0x0ffffff7
+                && cluster.cluster_num <= 0x0fffffff
+            {
+                kerror!(
+                    "FAT32: Reserved Cluster {:?} cannot be marked as free",
+                    cluster
+                );
+                return Err(SystemError::EPERM);
             }
-            FATType::FAT32(_) => {
-                let fat_size: u64 = self.fat_size();
-                let bound: u64 = if self.mirroring_enabled() {
-                    1
-                } else {
-                    self.bpb.num_fats as u64
-                };
-                // kdebug!("set entry, bound={bound}, fat_size={fat_size}");
-                for i in 0..bound {
-                    // 当前操作的FAT表在磁盘上的字节偏移量
-                    let f_offset: u64 = fat_part_bytes_offset + i * fat_size;
-                    let in_block_offset: u64 = self.get_in_block_offset(f_offset);
-                    let lba = self.get_lba_from_offset(self.bytes_to_sector(f_offset));
-
-                    // kdebug!("set entry, lba={lba}, in_block_offset={in_block_offset}");
-                    let mut v: Vec<u8> = Vec::new();
-                    v.resize(LBA_SIZE, 0);
-                    self.partition.disk().read_at(lba, 1, &mut v)?;
-
-                    let mut cursor: VecCursor = VecCursor::new(v);
-                    cursor.seek(SeekFrom::SeekSet(in_block_offset as i64))?;
-
-                    // FAT32的高4位保留
-                    let old_bits = cursor.read_u32()? & 0xf0000000;
-
-                    if fat_entry == FATEntry::Unused
-                        && cluster.cluster_num >= 0x0ffffff7
-                        && cluster.cluster_num <= 0x0fffffff
-                    {
-                        kerror!(
-                            "FAT32: Reserved Cluster {:?} cannot be marked as free",
-                            cluster
-                        );
-                        return Err(SystemError::EPERM);
-                    }
-
-                    // 计算要写入的值
-                    let mut raw_val: u32 = match fat_entry {
-                        FATEntry::Unused => 0,
-                        FATEntry::Bad => 0x0FFFFFF7,
-                        FATEntry::EndOfChain => 0x0FFFFFFF,
-                        FATEntry::Next(c) => c.cluster_num as u32,
-                    };
-
-                    // 恢复保留位
-                    raw_val |= old_bits;
-
-                    // kdebug!("sent entry, raw_val={raw_val}");
-
-                    cursor.seek(SeekFrom::SeekSet(in_block_offset as i64))?;
-                    cursor.write_u32(raw_val)?;
+        }
 
-                    self.partition.disk().write_at(lba, 1, cursor.as_slice())?;
-                }
+        return self.fat_cache.lock().write_entry(
+            self,
+            cluster.cluster_num,
+            self.raw_fat_entry(fat_entry),
+        );
+    }
 
-                return Ok(());
-            }
+    /// @brief 计算FAT表项在磁盘上存储的值
+    fn raw_fat_entry(&self, fat_entry: FATEntry) -> u64 {
+        let (bad, end_of_chain) = match self.bpb.fat_type {
+            FATType::FAT12(_) => (0xff7, 0xfff),
+            FATType::FAT16(_) => (0xfff7, 0xffff),
+            FATType::FAT32(_) => (0x0fff_fff7, 0x0fff_ffff),
+        };
+        match fat_entry {
+            FATEntry::Unused => 0,
+            FATEntry::Bad => bad,
+            FATEntry::EndOfChain => end_of_chain,
+            FATEntry::Next(c) => c.cluster_num,
         }
     }
 
+    /// @brief 把FAT表缓存中的脏扇区，以及FsInfo结构体写回磁盘
+    pub fn flush(&self) -> Result<(), SystemError> {
+        // FAT表的脏扇区往往是相邻的，塞住请求队列，让它们合并成少量的大请求
+        let plug = BlkPlug::start();
+        self.fat_cache.lock().flush(self)?;
+        self.fs_info.0.lock().flush(&self.bcache)?;
+        // 按照块号的顺序写回所有的元数据
+        self.bcache.flush()?;
+        return plug.finish();
+    }
+
     /// @brief 清空指定的簇
     ///
     /// @param cluster 要被清空的簇
     pub fn zero_cluster(&self, cluster: Cluster) -> Result<(), SystemError> {
+        return self.zero_clusters(cluster, 1);
+    }
+
+    /// @brief 清空从cluster开始的count个连续的簇
+    pub fn zero_clusters(&self, cluster: Cluster, count: u64) -> Result<(), SystemError> {
+        let total = (count * self.bytes_per_cluster()) as usize;
         // 准备数据，用于写入
-        let zeros: Vec<u8> = vec![0u8; self.bytes_per_cluster() as usize];
-        let offset: usize = self.cluster_bytes_offset(cluster) as usize;
-        self.partition
-            .disk()
-            .write_at_bytes(offset, zeros.len(), zeros.as_slice())?;
+        let zeros: Vec<u8> = vec![0u8; total.min(ZERO_CHUNK_BYTES)];
+        let start: usize = self.cluster_bytes_offset(cluster) as usize;
+        // 簇直接写入磁盘，缓冲区缓存中这些簇之前的内容不再有效
+        self.bcache.invalidate_bytes(start, total);
+        let mut done = 0;
+        while done < total {
+            let len = zeros.len().min(total - done);
+            self.partition
+                .disk()
+                .write_at_bytes(start + done, len, &zeros[..len])?;
+            done += len;
+        }
         return Ok(());
     }
 }
@@ -1223,7 +1159,7 @@ impl FATFsInfo {
         // 计算fs_info扇区在磁盘上的字节偏移量，从磁盘读取数据
         partition
             .disk()
-            .read_at(in_disk_fs_info_offset as usize / LBA_SIZE, 1, &mut v)?;
+            .submit_read(in_disk_fs_info_offset as usize / LBA_SIZE, 1, &mut v)?;
         let mut cursor = VecCursor::new(v);
 
         let mut fsinfo = FATFsInfo::default();
@@ -1304,10 +1240,10 @@ impl FATFsInfo {
         };
     }
 
-    /// @brief 把fs info刷入磁盘
+    /// @brief 把fs info写入缓冲区缓存
     ///
-    /// @param partition fs info所在的分区
-    pub fn flush(&self, partition: &Arc<Partition>) -> Result<(), SystemError> {
+    /// @param bcache fs info所在的文件系统的缓冲区缓存
+    pub fn flush(&self, bcache: &BufferCache) -> Result<(), SystemError> {
         if let Some(off) = self.offset {
             let in_block_offset = off % LBA_SIZE as u64;
 
@@ -1315,7 +1251,7 @@ impl FATFsInfo {
 
             let mut v: Vec<u8> = Vec::new();
             v.resize(LBA_SIZE, 0);
-            partition.disk().read_at(lba, 1, &mut v)?;
+            bcache.read(lba, 1, &mut v)?;
 
             let mut cursor: VecCursor = VecCursor::new(v);
             cursor.seek(SeekFrom::SeekSet(in_block_offset as i64))?;
@@ -1328,15 +1264,15 @@ impl FATFsInfo {
             cursor.seek(SeekFrom::SeekCurrent(12))?;
             cursor.write_u32(self.trail_sig)?;
 
-            partition.disk().write_at(lba, 1, cursor.as_slice())?;
+            bcache.write(lba, 1, cursor.as_slice())?;
         }
         return Ok(());
     }
 
     /// @brief 读取磁盘上的Fs Info扇区，将里面的内容更新到结构体中
     ///
-    /// @param partition fs info所在的分区
-    pub fn update(&mut self, partition: Arc<Partition>) -> Result<(), SystemError> {
+    /// @param bcache fs info所在的文件系统的缓冲区缓存
+    pub fn update(&mut self, bcache: &BufferCache) -> Result<(), SystemError> {
         if let Some(off) = self.offset {
             let in_block_offset = off % LBA_SIZE as u64;
 
@@ -1344,7 +1280,7 @@ impl FATFsInfo {
 
             let mut v: Vec<u8> = Vec::new();
             v.resize(LBA_SIZE, 0);
-            partition.disk().read_at(lba, 1, &mut v)?;
+            bcache.read(lba, 1, &mut v)?;
             let mut cursor: VecCursor = VecCursor::new(v);
             cursor.seek(SeekFrom::SeekSet(in_block_offset as i64))?;
             self.lead_sig = cursor.read_u32()?;
@@ -1369,13 +1305,10 @@ impl IndexNode for LockedFATInode {
         _data: &mut FilePrivateData,
     ) -> Result<usize, SystemError> {
         let mut guard: SpinLockGuard<FATInode> = self.0.lock();
-        match &guard.inode_type {
+        let fs: &Arc<FATFileSystem> = &guard.fs.upgrade().unwrap();
+        match &mut guard.inode_type {
             FATDirEntry::File(f) | FATDirEntry::VolId(f) => {
-                let r = f.read(
-                    &guard.fs.upgrade().unwrap(),
-                    &mut buf[0..len],
-                    offset as u64,
-                );
+                let r = f.read(fs, &mut buf[0..len], offset as u64);
                 guard.update_metadata();
                 return r;
             }
@@ -1396,6 +1329,9 @@ impl IndexNode for LockedFATInode {
         buf: &[u8],
         _data: &mut FilePrivateData,
     ) -> Result<usize, SystemError> {
+        // 一次写操作涉及的簇往往是相邻的，塞住请求队列以合并写请求。
+        // 它在guard之后析构，派发请求时不持有inode的锁；派发的错误由sync返回
+        let _plug = BlkPlug::start();
         let mut guard: SpinLockGuard<FATInode> = self.0.lock();
         let fs: &Arc<FATFileSystem> = &guard.fs.upgrade().unwrap();
 
@@ -1415,6 +1351,33 @@ impl IndexNode for LockedFATInode {
         }
     }
 
+    fn direct_write_at(
+        &self,
+        offset: usize,
+        len: usize,
+        buf: &[u8],
+        _data: &mut FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        // 与write_at不同，不塞住请求队列：数据直接交给驱动，返回时已经写入设备
+        let mut guard: SpinLockGuard<FATInode> = self.0.lock();
+        let fs: &Arc<FATFileSystem> = &guard.fs.upgrade().unwrap();
+
+        match &mut guard.inode_type {
+            FATDirEntry::File(f) | FATDirEntry::VolId(f) => {
+                let r = f.write_direct(fs, &buf[0..len], offset as u64);
+                guard.update_metadata();
+                return r;
+            }
+            FATDirEntry::Dir(_) => {
+                return Err(SystemError::EISDIR);
+            }
+            FATDirEntry::UnInit => {
+                kerror!("FATFS: param: Inode_type uninitialized.");
+                return Err(SystemError::EROFS);
+            }
+        }
+    }
+
     fn poll(&self) -> Result<PollStatus, SystemError> {
         // 加锁
         let inode: SpinLockGuard<FATInode> = self.0.lock();
@@ -1470,7 +1433,13 @@ impl IndexNode for LockedFATInode {
     }
 
     fn metadata(&self) -> Result<Metadata, SystemError> {
-        return Ok(self.0.lock().metadata.clone());
+        let guard: SpinLockGuard<FATInode> = self.0.lock();
+        let mut metadata = guard.metadata.clone();
+        // 写入扩展的部分还在页面缓存中，写回时才分配簇
+        if let Some(cache) = &guard.page_cache {
+            metadata.size = metadata.size.max(cache.cached_size() as i64);
+        }
+        return Ok(metadata);
     }
     fn resize(&self, len: usize) -> Result<(), SystemError> {
         let mut guard: SpinLockGuard<FATInode> = self.0.lock();
@@ -1511,6 +1480,24 @@ impl IndexNode for LockedFATInode {
         }
     }
 
+    fn fallocate(&self, offset: usize, len: usize) -> Result<(), SystemError> {
+        let mut guard: SpinLockGuard<FATInode> = self.0.lock();
+        let fs: &Arc<FATFileSystem> = &guard.fs.upgrade().unwrap();
+
+        match &mut guard.inode_type {
+            FATDirEntry::File(file) | FATDirEntry::VolId(file) => {
+                file.fallocate(fs, offset as u64, len as u64)?;
+                guard.update_metadata();
+                return Ok(());
+            }
+            FATDirEntry::Dir(_) => return Err(SystemError::EISDIR),
+            FATDirEntry::UnInit => {
+                kerror!("FATFS: param: Inode_type uninitialized.");
+                return Err(SystemError::EROFS);
+            }
+        }
+    }
+
     fn truncate(&self, len: usize) -> Result<(), SystemError> {
         let guard: SpinLockGuard<FATInode> = self.0.lock();
         let old_size = guard.metadata.size as usize;
@@ -1540,20 +1527,15 @@ impl IndexNode for LockedFATInode {
                     let name: String = ent.name();
                     // kdebug!("name={name}");
 
-                    if guard.children.contains_key(&name.to_uppercase()) == false
-                        && name != "."
+                    let key = name.to_uppercase();
+                    if name != "."
                         && name != ".."
+                        && guard.children.get(&key).and_then(|e| e.upgrade()).is_none()
                     {
-                        // 创建新的inode
-                        let entry_inode: Arc<LockedFATInode> = LockedFATInode::new(
-                            guard.fs.upgrade().unwrap(),
-                            guard.self_ref.clone(),
-                            ent,
-                        );
+                        // 获取（或创建）对应的inode
+                        let entry_inode: Arc<LockedFATInode> = guard.child_inode(ent);
                         // 加入缓存区, 由于FAT文件系统的大小写不敏感问题，因此存入缓存区的key应当是全大写的
-                        guard
-                            .children
-                            .insert(name.to_uppercase(), entry_inode.clone());
+                        guard.children.insert(key, Arc::downgrade(&entry_inode));
                     }
                 }
                 return Ok(ret);
@@ -1565,6 +1547,57 @@ impl IndexNode for LockedFATInode {
         }
     }
 
+    fn readdir(
+        &self,
+        pos: u64,
+        emit: &mut dyn FnMut(&str, InodeId, FileType, u64) -> bool,
+    ) -> Result<(), SystemError> {
+        // 获取父目录的元数据需要锁住父目录，因此在锁住当前目录之前获取".."的inode号
+        let parent = self.0.lock().parent.clone();
+        let parent_ino = match parent {
+            Some(parent) => Some(parent.metadata()?.inode_id),
+            None => None,
+        };
+
+        let mut guard: SpinLockGuard<FATInode> = self.0.lock();
+        let self_ino = guard.metadata.inode_id;
+        let mut dir_iter: FATDirIter = match &guard.inode_type {
+            FATDirEntry::Dir(dir) => dir.to_iter_at(guard.fs.upgrade().unwrap(), pos),
+            FATDirEntry::File(_) | FATDirEntry::VolId(_) => return Err(SystemError::ENOTDIR),
+            FATDirEntry::UnInit => {
+                kerror!("FATFS: param: Inode_type uninitialized.");
+                return Err(SystemError::EROFS);
+            }
+        };
+
+        // 直接从上一次结束的位置继续读取目录，而不是从头遍历
+        while let Some(ent) = dir_iter.next() {
+            let name: String = ent.name();
+            let (ino, file_type) = match name.as_str() {
+                "." => (self_ino, FileType::Dir),
+                ".." => (parent_ino.unwrap_or(self_ino), FileType::Dir),
+                _ => {
+                    let key = name.to_uppercase();
+                    let entry_inode = match guard.children.get(&key).and_then(|e| e.upgrade()) {
+                        Some(inode) => inode,
+                        None => {
+                            // 生成inode缓存，存入B树
+                            let inode: Arc<LockedFATInode> = guard.child_inode(ent);
+                            guard.children.insert(key, Arc::downgrade(&inode));
+                            inode
+                        }
+                    };
+                    let child = entry_inode.0.lock();
+                    (child.metadata.inode_id, child.metadata.file_type)
+                }
+            };
+            if !emit(&name, ino, file_type, dir_iter.pos()) {
+                break;
+            }
+        }
+        return Ok(());
+    }
+
     fn find(&self, name: &str) -> Result<Arc<dyn IndexNode>, SystemError> {
         let mut guard: SpinLockGuard<FATInode> = self.0.lock();
         let target = guard.find(name)?;
@@ -1580,20 +1613,28 @@ impl IndexNode for LockedFATInode {
     }
 
     fn unlink(&self, name: &str) -> Result<(), SystemError> {
+        // 先丢弃目标文件的页面缓存，保证之后不会再把脏页写回到被释放的簇中。
+        // 丢弃时需要等待正在进行的写回，因此不能持有inode的锁
+        let target_cache = self.0.lock().find(name).ok().and_then(|t| t.page_cache());
+        if let Some(cache) = target_cache {
+            cache.invalidate();
+        }
+
         let mut guard: SpinLockGuard<FATInode> = self.0.lock();
         let target: Arc<LockedFATInode> = guard.find(name)?;
         // 对目标inode上锁，以防更改
         let target_guard: SpinLockGuard<FATInode> = target.0.lock();
-        // 先从缓存删除
-        let nod = guard.children.remove(&name.to_uppercase());
-
-        // 若删除缓存中为管道的文件，则不需要再到磁盘删除
-        if let Some(_) = nod {
-            let file_type = target_guard.metadata.file_type;
-            if file_type == FileType::Pipe {
-                return Ok(());
-            }
+        // 若删除的是管道等不在磁盘上的文件，则不需要再到磁盘删除
+        if guard
+            .special_children
+            .remove(&name.to_uppercase())
+            .is_some()
+        {
+            return Ok(());
         }
+        // 先从缓存删除（同一个文件可能同时以长文件名、短文件名被缓存）
+        let target_weak = Arc::downgrade(&target);
+        guard.children.retain(|_, e| !e.ptr_eq(&target_weak));
 
         let dir = match &guard.inode_type {
             FATDirEntry::File(_) | FATDirEntry::VolId(_) => {
@@ -1609,7 +1650,14 @@ impl IndexNode for LockedFATInode {
         dir.check_existence(name, Some(false), guard.fs.upgrade().unwrap())?;
 
         // 再从磁盘删除
-        let r = dir.remove(guard.fs.upgrade().unwrap().clone(), name, true);
+        let fs = guard.fs.upgrade().unwrap();
+        let r = dir.remove(fs.clone(), name, true);
+        if r.is_ok() {
+            // 目录项的位置可能被之后创建的文件复用，因此要把inode从inode缓存中移除
+            if let Some(ino) = LockedFATInode::disk_ino(&fs, &target_guard.inode_type) {
+                icache_remove(&fs, ino);
+            }
+        }
         drop(target_guard);
         return r;
     }
@@ -1619,8 +1667,9 @@ impl IndexNode for LockedFATInode {
         let target: Arc<LockedFATInode> = guard.find(name)?;
         // 对目标inode上锁，以防更改
         let target_guard: SpinLockGuard<FATInode> = target.0.lock();
-        // 先从缓存删除
-        guard.children.remove(&name.to_uppercase());
+        // 先从缓存删除（同一个文件可能同时以长文件名、短文件名被缓存）
+        let target_weak = Arc::downgrade(&target);
+        guard.children.retain(|_, e| !e.ptr_eq(&target_weak));
 
         let dir = match &guard.inode_type {
             FATDirEntry::File(_) | FATDirEntry::VolId(_) => {
@@ -1636,15 +1685,21 @@ impl IndexNode for LockedFATInode {
         dir.check_existence(name, Some(true), guard.fs.upgrade().unwrap())?;
 
         // 再从磁盘删除
-        let r: Result<(), SystemError> =
-            dir.remove(guard.fs.upgrade().unwrap().clone(), name, true);
+        let fs = guard.fs.upgrade().unwrap();
+        let r: Result<(), SystemError> = dir.remove(fs.clone(), name, true);
         if r.is_ok() {
+            // 目录项的位置可能被之后创建的文件复用，因此要把inode从inode缓存中移除
+            if let Some(ino) = LockedFATInode::disk_ino(&fs, &target_guard.inode_type) {
+                icache_remove(&fs, ino);
+            }
             return r;
         } else {
             let r = r.unwrap_err();
             if r == SystemError::ENOTEMPTY {
                 // 如果要删除的是目录，且不为空，则删除动作未发生，重新加入缓存
-                guard.children.insert(name.to_uppercase(), target.clone());
+                guard
+                    .children
+                    .insert(name.to_uppercase(), Arc::downgrade(&target));
                 drop(target_guard);
             }
             return Err(r);
@@ -1668,19 +1723,11 @@ impl IndexNode for LockedFATInode {
                 // TODO: 优化这里，这个地方性能很差！
                 let mut key: Vec<String> = guard
                     .children
-                    .keys()
-                    .filter(|k| {
-                        guard
-                            .children
-                            .get(*k)
-                            .unwrap()
-                            .metadata()
-                            .unwrap()
-                            .inode_id
-                            .into()
-                            == ino
-                    })
-                    .cloned()
+                    .iter()
+                    .filter_map(|(k, v)| Some((k, v.upgrade()?)))
+                    .chain(guard.special_children.iter().map(|(k, v)| (k, v.clone())))
+                    .filter(|(_, v)| v.metadata().unwrap().inode_id.into() == ino)
+                    .map(|(k, _)| k.clone())
                     .collect();
 
                 match key.len() {
@@ -1711,7 +1758,7 @@ impl IndexNode for LockedFATInode {
 
         let nod = LockedFATInode::new(
             inode.fs.upgrade().unwrap(),
-            inode.self_ref.clone(),
+            inode.self_ref.upgrade(),
             FATDirEntry::File(FATFile::default()),
         );
 
@@ -1732,7 +1779,7 @@ impl IndexNode for LockedFATInode {
         }
 
         inode
-            .children
+            .special_children
             .insert(String::from(filename).to_uppercase(), nod.clone());
         Ok(nod)
     }
@@ -1740,6 +1787,36 @@ impl IndexNode for LockedFATInode {
     fn special_node(&self) -> Option<SpecialNodeData> {
         self.0.lock().special_node.clone()
     }
+
+    fn page_cache(&self) -> Option<Arc<PageCache>> {
+        let guard: SpinLockGuard<FATInode> = self.0.lock();
+        if guard.metadata.file_type != FileType::File {
+            return None;
+        }
+        return guard.page_cache.clone();
+    }
+
+    fn sync(&self) -> Result<(), SystemError> {
+        if let Some(cache) = self.page_cache() {
+            cache.writeback()?;
+        }
+        let fs = self.0.lock().fs.upgrade().unwrap();
+        fs.flush()?;
+        return fs.partition.disk().sync();
+    }
+
+    fn datasync(&self) -> Result<(), SystemError> {
+        let fs = self.0.lock().fs.upgrade().unwrap();
+        let old_size = self.0.lock().metadata.size;
+        if let Some(cache) = self.page_cache() {
+            cache.writeback()?;
+        }
+        // 写回时分配了新的簇，FAT表也要写入磁盘，否则读不到新写入的数据
+        if self.0.lock().metadata.size != old_size {
+            fs.flush()?;
+        }
+        return fs.partition.disk().sync();
+    }
 }
 
 impl Default for FATFsInfo {
@@ -1,4 +1,6 @@
 pub mod bpb;
+pub mod dir_index;
 pub mod entry;
+pub mod fat_cache;
 pub mod fs;
 pub mod utils;
@@ -0,0 +1,1171 @@
+//! io_uring：基于共享内存的异步I/O接口
+//!
+//! 每个io_uring实例有一对与用户程序共享的环形队列：用户程序把请求（SQE）放入提交队列（SQ），
+//! 通过一次io_uring_enter提交任意多个请求；内核把结果（CQE）放入完成队列（CQ），用户程序直接从
+//! 共享内存中取出结果。两个队列和SQE数组保存在一个没有后备存储的页面缓存中，用户程序通过mmap映射它们
+//! （偏移量见`IORING_OFF_*`），内核通过[`PageCache::page_vaddr`]直接访问。
+//!
+//! 请求的执行方式：
+//!
+//! - 普通文件、块设备等总是就绪的文件：在io_uring_enter中立即执行（内联完成）
+//! - 管道、socket等可能阻塞的文件：先检查文件是否就绪，没有就绪时在文件的等待队列上注册回调，
+//!   文件就绪之后由提交者在io_uring_enter中重新执行
+//! - fsync：交给io_uring的工作线程执行，完成之后同样由提交者收割
+//!
+//! 读到的数据需要写入提交者的地址空间，因此完成事件只在提交者的io_uring_enter中写入完成队列。
+//! 这与Linux的IORING_SETUP_DEFER_TASKRUN模式相同：用户程序通过带IORING_ENTER_GETEVENTS的
+//! io_uring_enter等待完成事件。
+//!
+//! 一次io_uring_enter提交的请求在同一个[`BlkPlug`]中执行，它们产生的写请求在块设备的请求队列中合并之后
+//! 一起派发，支持NCQ的AHCI磁盘可以同时执行这些请求。
+
+use core::{
+    mem::size_of,
+    sync::atomic::{AtomicBool, AtomicU32, AtomicUsize, Ordering},
+};
+
+use alloc::{
+    boxed::Box,
+    collections::VecDeque,
+    format,
+    string::String,
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+use num_traits::FromPrimitive;
+
+use crate::{
+    arch::{sched::sched, CurrentIrqArch, MMArch},
+    driver::base::block::request_queue::BlkPlug,
+    exception::InterruptArch,
+    filesystem::vfs::{
+        core::generate_inode_id,
+        file::{File, FileMode},
+        page_cache::PageCache,
+        poll::{inode_poll_events, signal_pending, PollTable, POLLERR, POLLHUP, POLLIN, POLLOUT},
+        syscall::ModeType,
+        FilePrivateData, FileSystem, FileType, IndexNode, Metadata, PollStatus,
+    },
+    kwarn,
+    libs::{
+        align::page_align_up,
+        spinlock::SpinLock,
+        wait_queue::{WaitQueue, WaitQueueCallback},
+    },
+    mm::{
+        syscall::{MapFlags, ProtFlags},
+        ucontext::AddressSpace,
+        MemoryManagementArch, VirtAddr,
+    },
+    net::syscall::{MsgHdr, SockAddr},
+    process::{
+        kthread::{KernelThreadClosure, KernelThreadMechanism},
+        ProcessManager, ProcessState,
+    },
+    syscall::{
+        user_access::{UserBufferReader, UserBufferWriter},
+        Syscall, SystemError,
+    },
+    time::TimeSpec,
+};
+
+pub mod syscall;
+
+const PAGE_SIZE: usize = MMArch::PAGE_SIZE;
+
+/// 提交队列最多的项数
+pub const IORING_MAX_ENTRIES: u32 = 32768;
+/// 完成队列最多的项数
+pub const IORING_MAX_CQ_ENTRIES: u32 = 2 * IORING_MAX_ENTRIES;
+
+/// mmap的偏移量：提交队列
+pub const IORING_OFF_SQ_RING: usize = 0;
+/// mmap的偏移量：完成队列
+pub const IORING_OFF_CQ_RING: usize = 0x8000000;
+/// mmap的偏移量：SQE数组
+pub const IORING_OFF_SQES: usize = 0x10000000;
+
+/// 完成队列满时，完成事件被暂存在内核中，而不是被丢弃
+pub const IORING_FEAT_NODROP: u32 = 1 << 1;
+/// 请求的参数在提交时就被读取，提交之后用户程序可以重用SQE和iovec数组
+pub const IORING_FEAT_SUBMIT_STABLE: u32 = 1 << 2;
+
+/// 提交队列的flags：完成队列溢出，暂存的完成事件需要通过io_uring_enter写入完成队列
+pub const IORING_SQ_CQ_OVERFLOW: u32 = 1 << 1;
+
+/// fsync的flags：只同步数据（fdatasync）
+pub const IORING_FSYNC_DATASYNC: u32 = 1 << 0;
+
+/// 暂存的完成事件最多的数量，超过时丢弃完成事件并增加溢出计数
+const IORING_MAX_OVERFLOW: usize = IORING_MAX_CQ_ENTRIES as usize;
+
+/// 提交队列中各个字段的偏移量
+const SQ_HEAD: usize = 0;
+const SQ_TAIL: usize = 4;
+const SQ_RING_MASK: usize = 8;
+const SQ_RING_ENTRIES: usize = 12;
+const SQ_FLAGS: usize = 16;
+const SQ_DROPPED: usize = 20;
+const SQ_ARRAY: usize = 64;
+
+/// 完成队列中各个字段的偏移量
+const CQ_HEAD: usize = 0;
+const CQ_TAIL: usize = 4;
+const CQ_RING_MASK: usize = 8;
+const CQ_RING_ENTRIES: usize = 12;
+const CQ_OVERFLOW: usize = 16;
+const CQ_FLAGS: usize = 20;
+const CQ_CQES: usize = 64;
+
+/// 执行fsync的工作线程的数量
+const IO_WQ_WORKERS: usize = 4;
+
+bitflags! {
+    /// io_uring_setup的flags
+    pub struct IoUringSetupFlags: u32 {
+        const IORING_SETUP_IOPOLL = 1 << 0;
+        const IORING_SETUP_SQPOLL = 1 << 1;
+        const IORING_SETUP_SQ_AFF = 1 << 2;
+        /// 由params.cq_entries指定完成队列的大小
+        const IORING_SETUP_CQSIZE = 1 << 3;
+        /// 队列的大小超过上限时截断，而不是返回错误
+        const IORING_SETUP_CLAMP = 1 << 4;
+    }
+
+    /// io_uring_enter的flags
+    pub struct IoUringEnterFlags: u32 {
+        /// 等待至少min_complete个完成事件
+        const IORING_ENTER_GETEVENTS = 1 << 0;
+        /// 唤醒SQ轮询线程（不支持SQPOLL，因此忽略）
+        const IORING_ENTER_SQ_WAKEUP = 1 << 1;
+        /// 等待提交队列有空间（不支持SQPOLL，因此忽略）
+        const IORING_ENTER_SQ_WAIT = 1 << 2;
+    }
+
+    /// SQE的flags
+    pub struct IoSqeFlags: u8 {
+        const IOSQE_FIXED_FILE = 1 << 0;
+        const IOSQE_IO_DRAIN = 1 << 1;
+        /// 下一个请求在这个请求成功完成之后才执行
+        const IOSQE_IO_LINK = 1 << 2;
+        /// 下一个请求在这个请求完成之后才执行，无论它是否成功
+        const IOSQE_IO_HARDLINK = 1 << 3;
+        /// 总是异步执行（只是提示，目前忽略）
+        const IOSQE_ASYNC = 1 << 4;
+        const IOSQE_BUFFER_SELECT = 1 << 5;
+
+        /// 支持的flags
+        const IOSQE_SUPPORTED = Self::IOSQE_IO_LINK.bits | Self::IOSQE_IO_HARDLINK.bits
+            | Self::IOSQE_ASYNC.bits;
+    }
+}
+
+/// 支持的操作（与Linux的IORING_OP_*的值相同）
+#[repr(u8)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, FromPrimitive)]
+pub enum IoUringOp {
+    Nop = 0,
+    Readv = 1,
+    Writev = 2,
+    Fsync = 3,
+    PollAdd = 6,
+    PollRemove = 7,
+    SendMsg = 9,
+    RecvMsg = 10,
+    Accept = 13,
+    AsyncCancel = 14,
+    Read = 22,
+    Write = 23,
+    Send = 26,
+    Recv = 27,
+}
+
+impl IoUringOp {
+    /// 操作在可能阻塞的文件上执行之前，需要等待的事件
+    fn poll_events(&self, sqe: &IoUringSqe) -> i16 {
+        return match self {
+            Self::Readv | Self::Read | Self::RecvMsg | Self::Recv | Self::Accept => {
+                POLLIN | POLLERR | POLLHUP
+            }
+            Self::Writev | Self::Write | Self::SendMsg | Self::Send => POLLOUT | POLLERR | POLLHUP,
+            Self::PollAdd => sqe.op_flags as u16 as i16 | POLLERR | POLLHUP,
+            _ => 0,
+        };
+    }
+
+    /// 传输的字节数少于请求的长度时，是否视为失败（使链接在它之后的请求被取消）
+    fn short_is_failure(&self) -> bool {
+        return matches!(self, Self::Read | Self::Write | Self::Send | Self::Recv);
+    }
+}
+
+/// 提交队列项（SQE）
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+pub struct IoUringSqe {
+    pub opcode: u8,
+    pub flags: u8,
+    pub ioprio: u16,
+    pub fd: i32,
+    /// 文件偏移量（-1表示使用文件指针），或者第二个地址
+    pub off: u64,
+    /// 缓冲区、iovec数组或者MsgHdr的地址
+    pub addr: u64,
+    pub len: u32,
+    /// 各个操作自己的标志（rw_flags、fsync_flags、poll_events、msg_flags、accept_flags等）
+    pub op_flags: u32,
+    /// 用户数据，原样放入完成事件
+    pub user_data: u64,
+    pub buf_index: u16,
+    pub personality: u16,
+    pub splice_fd_in: i32,
+    pub pad: [u64; 2],
+}
+
+/// 完成队列项（CQE）
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+pub struct IoUringCqe {
+    pub user_data: u64,
+    /// 操作的结果：成功时为非负数，失败时为负的错误码
+    pub res: i32,
+    pub flags: u32,
+}
+
+/// 提交队列中各个字段在映射中的偏移量
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+pub struct IoSqringOffsets {
+    pub head: u32,
+    pub tail: u32,
+    pub ring_mask: u32,
+    pub ring_entries: u32,
+    pub flags: u32,
+    pub dropped: u32,
+    pub array: u32,
+    pub resv1: u32,
+    pub user_addr: u64,
+}
+
+/// 完成队列中各个字段在映射中的偏移量
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+pub struct IoCqringOffsets {
+    pub head: u32,
+    pub tail: u32,
+    pub ring_mask: u32,
+    pub ring_entries: u32,
+    pub overflow: u32,
+    pub cqes: u32,
+    pub flags: u32,
+    pub resv1: u32,
+    pub user_addr: u64,
+}
+
+/// io_uring_setup的参数
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+pub struct IoUringParams {
+    pub sq_entries: u32,
+    pub cq_entries: u32,
+    pub flags: u32,
+    pub sq_thread_cpu: u32,
+    pub sq_thread_idle: u32,
+    pub features: u32,
+    pub wq_fd: u32,
+    pub resv: [u32; 3],
+    pub sq_off: IoSqringOffsets,
+    pub cq_off: IoCqringOffsets,
+}
+
+/// 与用户程序共享的一段内存：页面缓存中连续的若干页（在内核中的地址不一定连续）
+#[derive(Debug, Default)]
+struct RingRegion {
+    pages: Vec<VirtAddr>,
+}
+
+impl RingRegion {
+    /// 分配页面缓存中从`offset`开始、长度为`len`的内存
+    fn new(cache: &PageCache, offset: usize, len: usize) -> Result<Self, SystemError> {
+        let first = offset / PAGE_SIZE;
+        let nr = page_align_up(len) / PAGE_SIZE;
+        let mut pages = Vec::with_capacity(nr);
+        for i in 0..nr {
+            pages.push(cache.page_vaddr(first + i)?);
+        }
+        return Ok(Self { pages });
+    }
+
+    /// 偏移量为`offset`的T。T的大小整除页的大小，并且`offset`按照它对齐，因此不会跨越页的边界
+    fn ptr<T>(&self, offset: usize) -> *mut T {
+        debug_assert!(offset % size_of::<T>() == 0);
+        return (self.pages[offset / PAGE_SIZE].data() + offset % PAGE_SIZE) as *mut T;
+    }
+
+    fn atomic(&self, offset: usize) -> &AtomicU32 {
+        return unsafe { &*self.ptr::<AtomicU32>(offset) };
+    }
+}
+
+/// 内核一侧的队列状态
+#[derive(Debug, Default)]
+struct IoRingState {
+    sq: RingRegion,
+    cq: RingRegion,
+    sqes: RingRegion,
+    /// 提交队列的头部。只有内核修改，共享内存中的值是它的副本
+    sq_head: u32,
+    /// 完成队列的尾部。只有内核修改，共享内存中的值是它的副本
+    cq_tail: u32,
+    /// 完成队列满时暂存的完成事件，完成队列有空间时再写入（IORING_FEAT_NODROP）
+    overflow: VecDeque<IoUringCqe>,
+}
+
+/// 就绪的请求：等待的文件已经就绪，或者工作线程已经执行完成，需要由提交者处理
+///
+/// 回调通过它而不是io_uring实例本身通知提交者，原因与epoll的就绪链表相同
+#[derive(Debug)]
+struct IoReady {
+    /// 回调可能在中断上下文中执行，因此需要关中断加锁
+    list: SpinLock<VecDeque<Arc<IoRequest>>>,
+    /// 在io_uring_enter中等待完成事件的进程，以及poll这个io_uring实例的等待者
+    wait_queue: Arc<WaitQueue>,
+}
+
+/// 正在等待文件就绪、或者正在由工作线程执行的请求
+#[derive(Debug)]
+struct IoRequest {
+    sqe: IoUringSqe,
+    /// 链接在这个请求之后的请求（IOSQE_IO_LINK），这个请求完成之后才执行
+    link: SpinLock<Vec<IoUringSqe>>,
+    /// 是否交给了工作线程执行
+    offloaded: bool,
+    /// 在文件的等待队列上注册的回调
+    table: SpinLock<Option<PollTable>>,
+    /// 是否在就绪链表中
+    queued: AtomicBool,
+    /// 工作线程执行的结果
+    result: SpinLock<Option<i32>>,
+    ready: Weak<IoReady>,
+    self_ref: Weak<IoRequest>,
+}
+
+impl IoRequest {
+    fn new(
+        sqe: IoUringSqe,
+        link: Vec<IoUringSqe>,
+        offloaded: bool,
+        ready: &Arc<IoReady>,
+    ) -> Arc<Self> {
+        return Arc::new_cyclic(|self_ref| Self {
+            sqe,
+            link: SpinLock::new(link),
+            offloaded,
+            table: SpinLock::new(None),
+            queued: AtomicBool::new(false),
+            result: SpinLock::new(None),
+            ready: Arc::downgrade(ready),
+            self_ref: self_ref.clone(),
+        });
+    }
+
+    /// 在文件的等待队列上注册回调。文件已经就绪时，立即加入就绪链表
+    fn arm(self: &Arc<Self>, inode: &Arc<dyn IndexNode>, events: i16) {
+        let mut table = PollTable::with_callback(self.clone());
+        inode.poll_wait(&mut table);
+        *self.table.lock_irqsave() = Some(table);
+        if inode_poll_events(inode) & events != 0 {
+            self.mark_ready();
+        }
+    }
+
+    /// 从文件的等待队列上注销回调
+    fn disarm(&self) {
+        let table = self.table.lock_irqsave().take();
+        drop(table);
+    }
+
+    /// 加入就绪链表，并唤醒提交者
+    fn mark_ready(&self) {
+        if self.queued.swap(true, Ordering::SeqCst) {
+            return;
+        }
+        let (ready, req) = match (self.ready.upgrade(), self.self_ref.upgrade()) {
+            (Some(ready), Some(req)) => (ready, req),
+            _ => return,
+        };
+        ready.list.lock_irqsave().push_back(req);
+        ready
+            .wait_queue
+            .wakeup_all(Some(ProcessState::Blocked(true)));
+    }
+}
+
+impl WaitQueueCallback for IoRequest {
+    fn wake(&self, _key: u64) {
+        self.mark_ready();
+    }
+}
+
+/// 提交一个请求的结果
+enum IoOutcome {
+    /// 已经完成
+    Done(i32),
+    /// 文件没有就绪，需要等待文件的事件
+    Wait(Arc<dyn IndexNode>, i16),
+    /// 交给工作线程执行
+    Offload(Arc<dyn IndexNode>),
+}
+
+#[inline]
+fn to_res(r: Result<usize, SystemError>) -> i32 {
+    return match r {
+        Ok(n) => n as i32,
+        Err(e) => e.to_posix_errno(),
+    };
+}
+
+/// io_uring实例
+#[derive(Debug)]
+pub struct IoUring {
+    sq_entries: u32,
+    cq_entries: u32,
+    /// 保存两个队列和SQE数组的内存
+    cache: Arc<PageCache>,
+    state: SpinLock<IoRingState>,
+    ready: Arc<IoReady>,
+    /// 正在等待文件就绪、或者正在由工作线程执行的请求
+    inflight: SpinLock<Vec<Arc<IoRequest>>>,
+    metadata: Metadata,
+}
+
+impl IoUring {
+    /// 创建一个提交队列有`sq_entries`项、完成队列有`cq_entries`项的实例（都是2的幂）
+    pub fn new(sq_entries: u32, cq_entries: u32) -> Result<Arc<Self>, SystemError> {
+        let metadata = Metadata {
+            dev_id: 0,
+            inode_id: generate_inode_id(),
+            size: 0,
+            blk_size: 0,
+            blocks: 0,
+            atime: TimeSpec::default(),
+            mtime: TimeSpec::default(),
+            ctime: TimeSpec::default(),
+            file_type: FileType::File,
+            mode: ModeType::from_bits_truncate(0o600),
+            nlinks: 1,
+            uid: 0,
+            gid: 0,
+            raw_dev: 0,
+        };
+        let ring = Arc::new_cyclic(|self_ref: &Weak<IoUring>| {
+            let backend: Weak<dyn IndexNode> = self_ref.clone();
+            Self {
+                sq_entries,
+                cq_entries,
+                cache: PageCache::new_memory(backend),
+                state: SpinLock::new(IoRingState::default()),
+                ready: Arc::new(IoReady {
+                    list: SpinLock::new(VecDeque::new()),
+                    wait_queue: Arc::new(WaitQueue::INIT),
+                }),
+                inflight: SpinLock::new(Vec::new()),
+                metadata,
+            }
+        });
+
+        let sq = RingRegion::new(
+            &ring.cache,
+            IORING_OFF_SQ_RING,
+            Self::sq_ring_size(sq_entries),
+        )?;
+        let cq = RingRegion::new(
+            &ring.cache,
+            IORING_OFF_CQ_RING,
+            Self::cq_ring_size(cq_entries),
+        )?;
+        let sqes = RingRegion::new(&ring.cache, IORING_OFF_SQES, Self::sqes_size(sq_entries))?;
+        sq.atomic(SQ_RING_MASK)
+            .store(sq_entries - 1, Ordering::Relaxed);
+        sq.atomic(SQ_RING_ENTRIES)
+            .store(sq_entries, Ordering::Relaxed);
+        cq.atomic(CQ_RING_MASK)
+            .store(cq_entries - 1, Ordering::Relaxed);
+        cq.atomic(CQ_RING_ENTRIES)
+            .store(cq_entries, Ordering::Relaxed);
+
+        let mut state = ring.state.lock();
+        state.sq = sq;
+        state.cq = cq;
+        state.sqes = sqes;
+        drop(state);
+        return Ok(ring);
+    }
+
+    fn sq_ring_size(sq_entries: u32) -> usize {
+        return SQ_ARRAY + sq_entries as usize * size_of::<u32>();
+    }
+
+    fn cq_ring_size(cq_entries: u32) -> usize {
+        return CQ_CQES + cq_entries as usize * size_of::<IoUringCqe>();
+    }
+
+    fn sqes_size(sq_entries: u32) -> usize {
+        return sq_entries as usize * size_of::<IoUringSqe>();
+    }
+
+    pub fn sq_entries(&self) -> u32 {
+        return self.sq_entries;
+    }
+
+    pub fn cq_entries(&self) -> u32 {
+        return self.cq_entries;
+    }
+
+    /// 提交队列中各个字段的偏移量
+    pub fn sq_offsets() -> IoSqringOffsets {
+        return IoSqringOffsets {
+            head: SQ_HEAD as u32,
+            tail: SQ_TAIL as u32,
+            ring_mask: SQ_RING_MASK as u32,
+            ring_entries: SQ_RING_ENTRIES as u32,
+            flags: SQ_FLAGS as u32,
+            dropped: SQ_DROPPED as u32,
+            array: SQ_ARRAY as u32,
+            ..Default::default()
+        };
+    }
+
+    /// 完成队列中各个字段的偏移量
+    pub fn cq_offsets() -> IoCqringOffsets {
+        return IoCqringOffsets {
+            head: CQ_HEAD as u32,
+            tail: CQ_TAIL as u32,
+            ring_mask: CQ_RING_MASK as u32,
+            ring_entries: CQ_RING_ENTRIES as u32,
+            overflow: CQ_OVERFLOW as u32,
+            cqes: CQ_CQES as u32,
+            flags: CQ_FLAGS as u32,
+            ..Default::default()
+        };
+    }
+
+    /// 从提交队列中取出下一个请求。数组中的下标无效的项被丢弃，并计入dropped
+    fn next_sqe(&self) -> Option<IoUringSqe> {
+        let mut state = self.state.lock();
+        loop {
+            let tail = state.sq.atomic(SQ_TAIL).load(Ordering::Acquire);
+            if state.sq_head == tail {
+                return None;
+            }
+            let pos = (state.sq_head & (self.sq_entries - 1)) as usize;
+            let index =
+                unsafe { core::ptr::read_volatile(state.sq.ptr::<u32>(SQ_ARRAY + pos * 4)) };
+            state.sq_head = state.sq_head.wrapping_add(1);
+            state
+                .sq
+                .atomic(SQ_HEAD)
+                .store(state.sq_head, Ordering::Release);
+            if index >= self.sq_entries {
+                state.sq.atomic(SQ_DROPPED).fetch_add(1, Ordering::Relaxed);
+                continue;
+            }
+            let sqe = unsafe {
+                core::ptr::read_volatile(
+                    state
+                        .sqes
+                        .ptr::<IoUringSqe>(index as usize * size_of::<IoUringSqe>()),
+                )
+            };
+            return Some(sqe);
+        }
+    }
+
+    /// 完成队列中是否还有空间
+    fn cq_has_space(&self, state: &IoRingState) -> bool {
+        let head = state.cq.atomic(CQ_HEAD).load(Ordering::Acquire);
+        return state.cq_tail.wrapping_sub(head) < self.cq_entries;
+    }
+
+    /// 完成队列中还没有被用户程序取走的完成事件的数量
+    fn cq_ready(&self, state: &IoRingState) -> u32 {
+        let head = state.cq.atomic(CQ_HEAD).load(Ordering::Acquire);
+        return state.cq_tail.wrapping_sub(head);
+    }
+
+    fn write_cqe(&self, state: &mut IoRingState, cqe: IoUringCqe) {
+        let pos = (state.cq_tail & (self.cq_entries - 1)) as usize;
+        unsafe {
+            core::ptr::write_volatile(
+                state
+                    .cq
+                    .ptr::<IoUringCqe>(CQ_CQES + pos * size_of::<IoUringCqe>()),
+                cqe,
+            )
+        };
+        state.cq_tail = state.cq_tail.wrapping_add(1);
+        state
+            .cq
+            .atomic(CQ_TAIL)
+            .store(state.cq_tail, Ordering::Release);
+    }
+
+    /// 把暂存的完成事件写入完成队列
+    fn flush_overflow(&self, state: &mut IoRingState) {
+        while !state.overflow.is_empty() && self.cq_has_space(state) {
+            let cqe = state.overflow.pop_front().unwrap();
+            self.write_cqe(state, cqe);
+        }
+        if state.overflow.is_empty() {
+            state
+                .sq
+                .atomic(SQ_FLAGS)
+                .fetch_and(!IORING_SQ_CQ_OVERFLOW, Ordering::Release);
+        }
+    }
+
+    /// 写入一个完成事件。完成队列满时暂存在内核中
+    fn post_cqe(&self, user_data: u64, res: i32) {
+        let cqe = IoUringCqe {
+            user_data,
+            res,
+            flags: 0,
+        };
+        let mut state = self.state.lock();
+        self.flush_overflow(&mut state);
+        if state.overflow.is_empty() && self.cq_has_space(&state) {
+            self.write_cqe(&mut state, cqe);
+        } else if state.overflow.len() < IORING_MAX_OVERFLOW {
+            state.overflow.push_back(cqe);
+            state
+                .sq
+                .atomic(SQ_FLAGS)
+                .fetch_or(IORING_SQ_CQ_OVERFLOW, Ordering::Release);
+        } else {
+            state.cq.atomic(CQ_OVERFLOW).fetch_add(1, Ordering::Relaxed);
+        }
+        drop(state);
+        self.ready.wait_queue.wakeup_all(None);
+    }
+
+    /// 提交提交队列中最多`to_submit`个请求
+    ///
+    /// @return 从提交队列中取出的请求数
+    pub fn submit(&self, to_submit: u32) -> usize {
+        // 这一批请求产生的块设备写请求合并之后一起派发
+        let plug = BlkPlug::start();
+        let mut submitted = 0;
+        let mut chain: Vec<IoUringSqe> = Vec::new();
+        while submitted < to_submit as usize {
+            let sqe = match self.next_sqe() {
+                Some(sqe) => sqe,
+                None => break,
+            };
+            submitted += 1;
+            let flags = IoSqeFlags::from_bits_truncate(sqe.flags);
+            chain.push(sqe);
+            if !flags.intersects(IoSqeFlags::IOSQE_IO_LINK | IoSqeFlags::IOSQE_IO_HARDLINK) {
+                self.submit_chain(core::mem::take(&mut chain));
+            }
+        }
+        // 最后一个请求也带有链接标志时，链在这里结束
+        if !chain.is_empty() {
+            self.submit_chain(chain);
+        }
+        drop(plug);
+        return submitted;
+    }
+
+    /// 依次执行一条链上的请求。某个请求需要等待时，链上剩下的请求在它完成之后再执行
+    fn submit_chain(&self, chain: Vec<IoUringSqe>) {
+        let mut chain: VecDeque<IoUringSqe> = chain.into();
+        while let Some(sqe) = chain.pop_front() {
+            match self.issue(&sqe) {
+                IoOutcome::Done(res) => {
+                    self.post_cqe(sqe.user_data, res);
+                    if !chain.is_empty() && Self::link_failed(&sqe, res) {
+                        self.cancel_chain(chain.into());
+                        return;
+                    }
+                }
+                IoOutcome::Wait(inode, events) => {
+                    let req = IoRequest::new(sqe, chain.into(), false, &self.ready);
+                    self.inflight.lock().push(req.clone());
+                    req.arm(&inode, events);
+                    return;
+                }
+                IoOutcome::Offload(inode) => {
+                    let req = IoRequest::new(sqe, chain.into(), true, &self.ready);
+                    self.inflight.lock().push(req.clone());
+                    io_wq_queue(IoWork { req, inode });
+                    return;
+                }
+            }
+        }
+    }
+
+    /// 请求的结果是否使链接在它之后的请求被取消
+    fn link_failed(sqe: &IoUringSqe, res: i32) -> bool {
+        if IoSqeFlags::from_bits_truncate(sqe.flags).contains(IoSqeFlags::IOSQE_IO_HARDLINK) {
+            return false;
+        }
+        if res < 0 {
+            return true;
+        }
+        return IoUringOp::from_u8(sqe.opcode).map_or(false, |op| op.short_is_failure())
+            && (res as u32) < sqe.len;
+    }
+
+    fn cancel_chain(&self, chain: Vec<IoUringSqe>) {
+        for sqe in chain {
+            self.post_cqe(sqe.user_data, SystemError::ECANCELED.to_posix_errno());
+        }
+    }
+
+    /// 请求完成：写入完成事件，然后执行（或者取消）链接在它之后的请求
+    fn complete(&self, sqe: &IoUringSqe, link: Vec<IoUringSqe>, res: i32) {
+        self.post_cqe(sqe.user_data, res);
+        if link.is_empty() {
+            return;
+        }
+        if Self::link_failed(sqe, res) {
+            self.cancel_chain(link);
+        } else {
+            self.submit_chain(link);
+        }
+    }
+
+    /// 尝试执行一个请求，不会因为文件没有就绪而阻塞
+    fn issue(&self, sqe: &IoUringSqe) -> IoOutcome {
+        // 不支持固定文件、IOSQE_IO_DRAIN和缓冲区选择
+        if !IoSqeFlags::from_bits(sqe.flags)
+            .map_or(false, |flags| IoSqeFlags::IOSQE_SUPPORTED.contains(flags))
+        {
+            return IoOutcome::Done(SystemError::EINVAL.to_posix_errno());
+        }
+        let op = match IoUringOp::from_u8(sqe.opcode) {
+            Some(op) => op,
+            None => return IoOutcome::Done(SystemError::EINVAL.to_posix_errno()),
+        };
+        match op {
+            IoUringOp::Nop => return IoOutcome::Done(0),
+            IoUringOp::PollRemove => return IoOutcome::Done(self.cancel(sqe.addr, true)),
+            IoUringOp::AsyncCancel => return IoOutcome::Done(self.cancel(sqe.addr, false)),
+            _ => {}
+        }
+
+        let file = match ProcessManager::current_pcb()
+            .fd_table()
+            .read()
+            .get_file_by_fd(sqe.fd)
+        {
+            Some(file) => file,
+            None => return IoOutcome::Done(SystemError::EBADF.to_posix_errno()),
+        };
+        let (inode, file_type) = {
+            let guard = file.lock();
+            (guard.inode(), guard.file_type())
+        };
+        drop(file);
+
+        let events = op.poll_events(sqe);
+        match op {
+            IoUringOp::Fsync => {
+                if io_wq_start() == 0 {
+                    return IoOutcome::Done(to_res(io_fsync(&inode, sqe.op_flags)));
+                }
+                return IoOutcome::Offload(inode);
+            }
+            IoUringOp::PollAdd => {
+                let revents = inode_poll_events(&inode) & events;
+                if revents != 0 {
+                    return IoOutcome::Done(revents as u16 as i32);
+                }
+                return IoOutcome::Wait(inode, events);
+            }
+            _ => {}
+        }
+
+        // 普通文件总是就绪的，直接执行；可能阻塞的文件先检查是否就绪
+        let may_block = matches!(
+            file_type,
+            FileType::Pipe | FileType::Socket | FileType::CharDevice
+        );
+        if may_block && inode_poll_events(&inode) & events == 0 {
+            return IoOutcome::Wait(inode, events);
+        }
+        match Self::execute(op, sqe) {
+            Err(SystemError::EAGAIN_OR_EWOULDBLOCK) if may_block => {
+                return IoOutcome::Wait(inode, events);
+            }
+            r => return IoOutcome::Done(to_res(r)),
+        }
+    }
+
+    /// 在提交者的上下文中执行读写类的操作
+    fn execute(op: IoUringOp, sqe: &IoUringSqe) -> Result<usize, SystemError> {
+        let fd = sqe.fd;
+        let len = sqe.len as usize;
+        // 偏移量为-1时使用（并更新）文件指针
+        let offset = match sqe.off as i64 {
+            -1 => None,
+            off if off < 0 => return Err(SystemError::EINVAL),
+            off => Some(off),
+        };
+        match op {
+            IoUringOp::Read => {
+                let mut writer = UserBufferWriter::new(sqe.addr as *mut u8, len, true)?;
+                let buf = writer.buffer::<u8>(0)?;
+                return match offset {
+                    None => Syscall::read(fd, buf),
+                    Some(off) => {
+                        positioned_file(fd)?
+                            .lock_no_preempt()
+                            .pread(off as usize, len, buf)
+                    }
+                };
+            }
+            IoUringOp::Write => {
+                let reader = UserBufferReader::new(sqe.addr as *const u8, len, true)?;
+                let buf = reader.read_from_user::<u8>(0)?;
+                return match offset {
+                    None => Syscall::write(fd, buf),
+                    Some(off) => {
+                        positioned_file(fd)?
+                            .lock_no_preempt()
+                            .pwrite(off as usize, len, buf)
+                    }
+                };
+            }
+            IoUringOp::Readv => {
+                return match offset {
+                    None => Syscall::readv(fd, sqe.addr as usize, len),
+                    Some(off) => Syscall::preadv(fd, sqe.addr as usize, len, off),
+                };
+            }
+            IoUringOp::Writev => {
+                return match offset {
+                    None => Syscall::writev(fd, sqe.addr as usize, len),
+                    Some(off) => Syscall::pwritev(fd, sqe.addr as usize, len, off),
+                };
+            }
+            IoUringOp::SendMsg => {
+                let reader =
+                    UserBufferReader::new(sqe.addr as *const MsgHdr, size_of::<MsgHdr>(), true)?;
+                let msg = reader.read_one_from_user::<MsgHdr>(0)?;
+                return Syscall::sendmsg(fd as usize, msg, sqe.op_flags);
+            }
+            IoUringOp::RecvMsg => {
+                let mut writer =
+                    UserBufferWriter::new(sqe.addr as *mut MsgHdr, size_of::<MsgHdr>(), true)?;
+                let msg = &mut writer.buffer::<MsgHdr>(0)?[0];
+                return Syscall::recvmsg(fd as usize, msg, sqe.op_flags);
+            }
+            IoUringOp::Send => {
+                let reader = UserBufferReader::new(sqe.addr as *const u8, len, true)?;
+                let buf = reader.read_from_user::<u8>(0)?;
+                return Syscall::sendto(fd as usize, buf, sqe.op_flags, core::ptr::null(), 0);
+            }
+            IoUringOp::Recv => {
+                let mut writer = UserBufferWriter::new(sqe.addr as *mut u8, len, true)?;
+                let buf = writer.buffer::<u8>(0)?;
+                return Syscall::recvfrom(
+                    fd as usize,
+                    buf,
+                    sqe.op_flags,
+                    core::ptr::null_mut(),
+                    core::ptr::null_mut(),
+                );
+            }
+            IoUringOp::Accept => {
+                // 对端地址写入addr，地址长度的指针放在off中
+                return Syscall::accept4(
+                    fd as usize,
+                    sqe.addr as *mut SockAddr,
+                    sqe.off as *mut u32,
+                    sqe.op_flags,
+                );
+            }
+            _ => return Err(SystemError::EINVAL),
+        }
+    }
+
+    /// 取消一个正在等待的请求（IORING_OP_ASYNC_CANCEL、IORING_OP_POLL_REMOVE）
+    ///
+    /// @param user_data 要取消的请求的用户数据
+    /// @param poll_only 只取消IORING_OP_POLL_ADD请求
+    ///
+    /// @return 取消请求的结果：成功为0，找不到请求为-ENOENT，请求已经在执行为-EALREADY
+    fn cancel(&self, user_data: u64, poll_only: bool) -> i32 {
+        let mut inflight = self.inflight.lock();
+        let pos = inflight.iter().position(|req| {
+            req.sqe.user_data == user_data
+                && (!poll_only || req.sqe.opcode == IoUringOp::PollAdd as u8)
+        });
+        let pos = match pos {
+            Some(pos) => pos,
+            None => return SystemError::ENOENT.to_posix_errno(),
+        };
+        if inflight[pos].offloaded {
+            return SystemError::EALREADY.to_posix_errno();
+        }
+        let req = inflight.remove(pos);
+        drop(inflight);
+
+        req.disarm();
+        let link = core::mem::take(&mut *req.link.lock());
+        self.complete(&req.sqe, link, SystemError::ECANCELED.to_posix_errno());
+        return 0;
+    }
+
+    /// 把请求从正在执行的请求中移除。请求已经被取消时返回false
+    fn take_inflight(&self, req: &Arc<IoRequest>) -> bool {
+        let mut inflight = self.inflight.lock();
+        match inflight.iter().position(|r| Arc::ptr_eq(r, req)) {
+            Some(pos) => {
+                inflight.remove(pos);
+                return true;
+            }
+            None => return false,
+        }
+    }
+
+    /// 处理就绪链表中的请求：重新执行文件已经就绪的请求，收割工作线程执行完成的请求
+    pub fn run_ready(&self) {
+        // 只处理当前的就绪链表，执行期间再次就绪的请求留到下一轮
+        let ready = core::mem::take(&mut *self.ready.list.lock_irqsave());
+        for req in ready {
+            req.queued.store(false, Ordering::SeqCst);
+            if !self.take_inflight(&req) {
+                continue;
+            }
+            req.disarm();
+            let link = core::mem::take(&mut *req.link.lock());
+            if req.offloaded {
+                let res = req.result.lock().take().unwrap_or(0);
+                self.complete(&req.sqe, link, res);
+                continue;
+            }
+            let mut chain = link;
+            chain.insert(0, req.sqe);
+            self.submit_chain(chain);
+        }
+        let mut state = self.state.lock();
+        self.flush_overflow(&mut state);
+    }
+
+    /// 等待，直到完成队列中至少有`min_complete`个完成事件，或者没有正在执行的请求
+    pub fn wait(&self, min_complete: u32) -> Result<(), SystemError> {
+        let min_complete = core::cmp::min(min_complete, self.cq_entries);
+        let pcb = ProcessManager::current_pcb();
+        loop {
+            self.run_ready();
+            if self.cq_ready(&self.state.lock()) >= min_complete {
+                return Ok(());
+            }
+            // 没有正在执行的请求时，不会再有新的完成事件
+            if self.inflight.lock().is_empty() && self.ready.list.lock_irqsave().is_empty() {
+                return Ok(());
+            }
+            if signal_pending() {
+                return Err(SystemError::EINTR);
+            }
+
+            // 先加入等待队列、标记睡眠，再检查就绪链表，因此检查之后到来的唤醒不会丢失
+            let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+            self.ready.wait_queue.add_waiter(pcb.clone());
+            ProcessManager::mark_sleep(true).ok();
+            if !self.ready.list.lock().is_empty() || signal_pending() {
+                ProcessManager::cancel_sleep();
+                drop(irq_guard);
+                self.ready.wait_queue.remove_waiter(&pcb);
+                continue;
+            }
+            drop(irq_guard);
+            sched();
+            self.ready.wait_queue.remove_waiter(&pcb);
+        }
+    }
+}
+
+impl Drop for IoUring {
+    fn drop(&mut self) {
+        // 注销所有的回调，否则文件的等待队列会一直持有这些请求
+        let inflight = core::mem::take(&mut *self.inflight.lock());
+        for req in inflight {
+            req.disarm();
+        }
+        self.ready.list.lock_irqsave().clear();
+    }
+}
+
+impl IndexNode for IoUring {
+    fn open(&self, _data: &mut FilePrivateData, _mode: &FileMode) -> Result<(), SystemError> {
+        return Ok(());
+    }
+
+    fn close(&self, _data: &mut FilePrivateData) -> Result<(), SystemError> {
+        return Ok(());
+    }
+
+    fn read_at(
+        &self,
+        _offset: usize,
+        _len: usize,
+        _buf: &mut [u8],
+        _data: &mut FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        return Err(SystemError::EINVAL);
+    }
+
+    fn write_at(
+        &self,
+        _offset: usize,
+        _len: usize,
+        _buf: &[u8],
+        _data: &mut FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        return Err(SystemError::EINVAL);
+    }
+
+    /// 完成队列中有完成事件、或者有需要提交者处理的请求时可读
+    fn poll(&self) -> Result<PollStatus, SystemError> {
+        let state = self.state.lock();
+        if self.cq_ready(&state) > 0
+            || !state.overflow.is_empty()
+            || !self.ready.list.lock_irqsave().is_empty()
+        {
+            return Ok(PollStatus::READ);
+        }
+        return Ok(PollStatus::empty());
+    }
+
+    fn poll_wait(&self, table: &mut PollTable) {
+        table.wait(&self.ready.wait_queue);
+    }
+
+    /// 映射提交队列、完成队列或者SQE数组（由`offset`指定）
+    fn mmap(
+        &self,
+        start_vaddr: VirtAddr,
+        len: usize,
+        prot_flags: ProtFlags,
+        map_flags: MapFlags,
+        offset: usize,
+    ) -> Result<usize, SystemError> {
+        if !map_flags.contains(MapFlags::MAP_SHARED) {
+            return Err(SystemError::EINVAL);
+        }
+        let size = match offset {
+            IORING_OFF_SQ_RING => Self::sq_ring_size(self.sq_entries),
+            IORING_OFF_CQ_RING => Self::cq_ring_size(self.cq_entries),
+            IORING_OFF_SQES => Self::sqes_size(self.sq_entries),
+            _ => return Err(SystemError::EINVAL),
+        };
+        if len == 0 || len > page_align_up(size) {
+            return Err(SystemError::EINVAL);
+        }
+        let start_page = AddressSpace::current()?.write().map_file(
+            start_vaddr,
+            len,
+            prot_flags,
+            map_flags,
+            self.cache.clone(),
+            offset,
+            true,
+            true,
+        )?;
+        return Ok(start_page.virt_address().data());
+    }
+
+    fn metadata(&self) -> Result<Metadata, SystemError> {
+        return Ok(self.metadata.clone());
+    }
+
+    fn as_any_ref(&self) -> &dyn core::any::Any {
+        self
+    }
+
+    fn fs(&self) -> Arc<dyn FileSystem> {
+        todo!("io_uring is not in any filesystem")
+    }
+
+    fn list(&self) -> Result<Vec<String>, SystemError> {
+        return Err(SystemError::ENOTDIR);
+    }
+}
+
+/// 以`pread`/`pwrite`的方式访问的文件：管道和socket没有偏移量
+fn positioned_file(fd: i32) -> Result<Arc<SpinLock<File>>, SystemError> {
+    let file = ProcessManager::current_pcb()
+        .fd_table()
+        .read()
+        .get_file_by_fd(fd)
+        .ok_or(SystemError::EBADF)?;
+    if matches!(file.lock().file_type(), FileType::Pipe | FileType::Socket) {
+        return Err(SystemError::ESPIPE);
+    }
+    return Ok(file);
+}
+
+fn io_fsync(inode: &Arc<dyn IndexNode>, flags: u32) -> Result<usize, SystemError> {
+    if flags & IORING_FSYNC_DATASYNC != 0 {
+        inode.datasync()?;
+    } else {
+        inode.sync()?;
+    }
+    return Ok(0);
+}
+
+/// 交给工作线程执行的请求
+#[derive(Debug)]
+struct IoWork {
+    req: Arc<IoRequest>,
+    inode: Arc<dyn IndexNode>,
+}
+
+static IO_WQ: SpinLock<Vec<IoWork>> = SpinLock::new(Vec::new());
+static IO_WQ_WAIT: WaitQueue = WaitQueue::INIT;
+static IO_WQ_STARTED: AtomicBool = AtomicBool::new(false);
+/// 成功创建的工作线程的数量
+static IO_WQ_NR_WORKERS: AtomicUsize = AtomicUsize::new(0);
+
+/// 第一次使用时创建工作线程
+///
+/// @return 工作线程的数量
+fn io_wq_start() -> usize {
+    if !IO_WQ_STARTED.swap(true, Ordering::SeqCst) {
+        for i in 0..IO_WQ_WORKERS {
+            let closure = KernelThreadClosure::EmptyClosure((Box::new(io_wq_worker), ()));
+            match KernelThreadMechanism::create_and_run(closure, format!("iou-wrk-{}", i)) {
+                Some(_) => {
+                    IO_WQ_NR_WORKERS.fetch_add(1, Ordering::SeqCst);
+                }
+                None => kwarn!("Failed to create io_uring worker {}", i),
+            }
+        }
+    }
+    return IO_WQ_NR_WORKERS.load(Ordering::SeqCst);
+}
+
+fn io_wq_queue(work: IoWork) {
+    IO_WQ.lock().push(work);
+    IO_WQ_WAIT.wakeup(None);
+}
+
+fn io_wq_worker() -> i32 {
+    loop {
+        let mut queue = IO_WQ.lock();
+        if queue.is_empty() {
+            IO_WQ_WAIT.sleep_uninterruptible_unlock_spinlock(queue);
+            continue;
+        }
+        let work = queue.remove(0);
+        drop(queue);
+
+        // 同一时刻多个工作线程各自写回，块设备可以同时处理它们的请求
+        let res = to_res(io_fsync(&work.inode, work.req.sqe.op_flags));
+        *work.req.result.lock() = Some(res);
+        work.req.mark_ready();
+    }
+}
@@ -0,0 +1,140 @@
+use alloc::sync::Arc;
+
+use crate::{
+    arch::ipc::signal::SigSet,
+    filesystem::vfs::{
+        file::{File, FileMode},
+        poll::{restore_sigmask, set_temp_sigmask},
+    },
+    libs::casting::DowncastArc,
+    process::ProcessManager,
+    syscall::{
+        user_access::{UserBufferReader, UserBufferWriter},
+        Syscall, SystemError,
+    },
+};
+
+use super::{
+    IoUring, IoUringEnterFlags, IoUringParams, IoUringSetupFlags, IORING_FEAT_NODROP,
+    IORING_FEAT_SUBMIT_STABLE, IORING_MAX_CQ_ENTRIES, IORING_MAX_ENTRIES,
+};
+
+/// 获取文件描述符对应的io_uring实例
+fn get_io_uring(fd: i32) -> Result<Arc<IoUring>, SystemError> {
+    let file = ProcessManager::current_pcb()
+        .fd_table()
+        .read()
+        .get_file_by_fd(fd)
+        .ok_or(SystemError::EBADF)?;
+    let inode = file.lock().inode();
+    return inode
+        .downcast_arc::<IoUring>()
+        .ok_or(SystemError::EOPNOTSUPP_OR_ENOTSUP);
+}
+
+impl Syscall {
+    /// 创建一个提交队列至少有`entries`项的io_uring实例，返回它的文件描述符
+    ///
+    /// 队列的实际大小和各个字段在映射中的偏移量写回`params`，用户程序据此mmap两个队列和SQE数组
+    pub fn io_uring_setup(entries: u32, params: *mut IoUringParams) -> Result<usize, SystemError> {
+        let reader = UserBufferReader::new(params, core::mem::size_of::<IoUringParams>(), true)?;
+        let mut p = *reader.read_one_from_user::<IoUringParams>(0)?;
+        if p.resv.iter().any(|x| *x != 0) {
+            return Err(SystemError::EINVAL);
+        }
+        let flags = IoUringSetupFlags::from_bits(p.flags).ok_or(SystemError::EINVAL)?;
+        // 不支持IOPOLL和SQPOLL：请求总是由提交者在io_uring_enter中提交
+        if !(IoUringSetupFlags::IORING_SETUP_CQSIZE | IoUringSetupFlags::IORING_SETUP_CLAMP)
+            .contains(flags)
+        {
+            return Err(SystemError::EINVAL);
+        }
+        let clamp = flags.contains(IoUringSetupFlags::IORING_SETUP_CLAMP);
+
+        let mut entries = entries;
+        if entries == 0 {
+            return Err(SystemError::EINVAL);
+        }
+        if entries > IORING_MAX_ENTRIES {
+            if !clamp {
+                return Err(SystemError::EINVAL);
+            }
+            entries = IORING_MAX_ENTRIES;
+        }
+        let sq_entries = entries.next_power_of_two();
+
+        // 完成队列默认是提交队列的两倍，因为请求可能在提交之后很久才完成
+        let cq_entries = if flags.contains(IoUringSetupFlags::IORING_SETUP_CQSIZE) {
+            let mut cq = p.cq_entries;
+            if cq == 0 {
+                return Err(SystemError::EINVAL);
+            }
+            if cq > IORING_MAX_CQ_ENTRIES {
+                if !clamp {
+                    return Err(SystemError::EINVAL);
+                }
+                cq = IORING_MAX_CQ_ENTRIES;
+            }
+            let cq = cq.next_power_of_two();
+            if cq < sq_entries {
+                return Err(SystemError::EINVAL);
+            }
+            cq
+        } else {
+            2 * sq_entries
+        };
+
+        let ring = IoUring::new(sq_entries, cq_entries)?;
+        p.sq_entries = ring.sq_entries();
+        p.cq_entries = ring.cq_entries();
+        p.features = IORING_FEAT_NODROP | IORING_FEAT_SUBMIT_STABLE;
+        p.sq_off = IoUring::sq_offsets();
+        p.cq_off = IoUring::cq_offsets();
+
+        let mut writer =
+            UserBufferWriter::new(params, core::mem::size_of::<IoUringParams>(), true)?;
+        writer.copy_one_to_user(&p, 0)?;
+
+        let mut file = File::new(ring, FileMode::O_RDWR)?;
+        file.set_close_on_exec(true);
+        let fd = ProcessManager::current_pcb()
+            .fd_table()
+            .write()
+            .alloc_fd(file, None)?;
+        return Ok(fd as usize);
+    }
+
+    /// 提交提交队列中最多`to_submit`个请求。flags带有IORING_ENTER_GETEVENTS时，
+    /// 再等待完成队列中至少有`min_complete`个完成事件
+    ///
+    /// @return 提交的请求数。已经提交了请求时，等待期间的错误（例如被信号打断）不会被返回
+    pub fn io_uring_enter(
+        fd: i32,
+        to_submit: u32,
+        min_complete: u32,
+        flags: u32,
+        sig: *const SigSet,
+        sigsz: usize,
+    ) -> Result<usize, SystemError> {
+        let flags = IoUringEnterFlags::from_bits(flags).ok_or(SystemError::EINVAL)?;
+        let ring = get_io_uring(fd)?;
+
+        // 先处理已经就绪的请求，让出完成队列中的空间
+        ring.run_ready();
+        let submitted = ring.submit(to_submit);
+
+        if flags.contains(IoUringEnterFlags::IORING_ENTER_GETEVENTS) {
+            let old = set_temp_sigmask(sig, sigsz)?;
+            let r = ring.wait(min_complete);
+            restore_sigmask(old);
+            if let Err(e) = r {
+                if submitted == 0 {
+                    return Err(e);
+                }
+            }
+        } else {
+            ring.run_ready();
+        }
+        return Ok(submitted);
+    }
+}
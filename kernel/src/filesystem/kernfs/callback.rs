@@ -89,6 +89,16 @@ pub enum KernInodePrivateData {
 }
 
 impl KernInodePrivateData {
+    /// 文件的内容是否由show一次生成（sysfs的文本属性），这样的文件通过seq_file读取
+    #[inline(always)]
+    pub fn is_show_attribute(&self) -> bool {
+        match self {
+            KernInodePrivateData::SysFS(private_data) => {
+                return private_data.is_show_attribute();
+            }
+        }
+    }
+
     #[inline(always)]
     pub fn callback_read(&self, buf: &mut [u8], offset: usize) -> Result<usize, SystemError> {
         match self {
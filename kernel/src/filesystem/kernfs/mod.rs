@@ -3,9 +3,10 @@ use core::{cmp::min, fmt::Debug, intrinsics::unlikely};
 use alloc::{
     string::String,
     sync::{Arc, Weak},
+    vec,
     vec::Vec,
 };
-use hashbrown::HashMap;
+use hashbrown::{hash_map::Entry, HashMap};
 
 use crate::{
     libs::{
@@ -20,12 +21,15 @@ use crate::{
 use self::callback::{KernCallbackData, KernFSCallback, KernInodePrivateData};
 
 use super::vfs::{
-    core::generate_inode_id, file::FileMode, syscall::ModeType, FilePrivateData, FileSystem,
-    FileType, FsInfo, IndexNode, InodeId, Metadata, PollStatus,
+    core::generate_inode_id, file::FileMode, seq_file::SeqFileHandle, syscall::ModeType,
+    FilePrivateData, FileSystem, FileType, FsInfo, IndexNode, InodeId, Metadata, PollStatus,
 };
 
 pub mod callback;
 
+/// 属性文件的show一次生成的内容的最大长度
+const KERNFS_SHOW_BUF_SIZE: usize = 4096;
+
 #[derive(Debug)]
 pub struct KernFS {
     root_inode: Arc<KernFSInode>,
@@ -117,7 +121,7 @@ pub struct KernFSInode {
     private_data: SpinLock<Option<KernInodePrivateData>>,
     /// 回调函数
     callback: Option<&'static dyn KernFSCallback>,
-    /// 子Inode
+    /// 子Inode，以名称为键的哈希表。查找和创建（包括同名检查）都不需要遍历目录
     children: SpinLock<HashMap<String, Arc<KernFSInode>>>,
     /// Inode类型
     inode_type: KernInodeType,
@@ -141,17 +145,36 @@ impl IndexNode for KernFSInode {
         self
     }
 
-    fn open(&self, _data: &mut FilePrivateData, _mode: &FileMode) -> Result<(), SystemError> {
+    fn open(&self, data: &mut FilePrivateData, _mode: &FileMode) -> Result<(), SystemError> {
         if let Some(callback) = self.callback {
             let callback_data =
                 KernCallbackData::new(self.self_ref.upgrade().unwrap(), self.private_data.lock());
-            return callback.open(callback_data);
+            let show_attribute = self.inode_type == KernInodeType::File
+                && callback_data
+                    .private_data()
+                    .as_ref()
+                    .map_or(false, |p| p.is_show_attribute());
+            callback.open(callback_data)?;
+
+            // 属性文件的内容在第一次读取时生成一次，之后的读取返回同一份内容，
+            // 而不是每次读取都重新生成整个文件再截取offset之后的部分
+            if show_attribute {
+                let inode = self.self_ref.clone();
+                *data = FilePrivateData::Seq(SeqFileHandle::single(move |out| {
+                    let inode = inode.upgrade().ok_or(SystemError::ENOENT)?;
+                    let mut page = vec![0u8; KERNFS_SHOW_BUF_SIZE];
+                    let len = inode.callback_read_at(&mut page, 0)?;
+                    out.extend_from_slice(&page[..len]);
+                    return Ok(());
+                }));
+            }
         }
 
         return Ok(());
     }
 
-    fn close(&self, _data: &mut FilePrivateData) -> Result<(), SystemError> {
+    fn close(&self, data: &mut FilePrivateData) -> Result<(), SystemError> {
+        *data = FilePrivateData::Unused;
         return Ok(());
     }
 
@@ -244,7 +267,7 @@ impl IndexNode for KernFSInode {
         let children = self.children.lock();
         let r = children
             .iter()
-            .find(|(_, v)| v.metadata().unwrap().inode_id == ino)
+            .find(|(_, v)| v.inner.read().metadata.inode_id == ino)
             .map(|(k, _)| k.clone());
 
         return r.ok_or(SystemError::ENOENT);
@@ -303,7 +326,7 @@ impl IndexNode for KernFSInode {
         offset: usize,
         len: usize,
         buf: &mut [u8],
-        _data: &mut FilePrivateData,
+        data: &mut FilePrivateData,
     ) -> Result<usize, SystemError> {
         if self.inode_type == KernInodeType::SymLink {
             let inner = self.inner.read();
@@ -328,18 +351,11 @@ impl IndexNode for KernFSInode {
             return Err(SystemError::EISDIR);
         }
 
-        if self.callback.is_none() {
-            kwarn!("kernfs: callback is none");
-            return Err(SystemError::EOPNOTSUPP_OR_ENOTSUP);
+        if let FilePrivateData::Seq(seq) = data {
+            return seq.read(offset, &mut buf[..len]);
         }
 
-        let callback_data =
-            KernCallbackData::new(self.self_ref.upgrade().unwrap(), self.private_data.lock());
-        return self
-            .callback
-            .as_ref()
-            .unwrap()
-            .read(callback_data, &mut buf[..len], offset);
+        return self.callback_read_at(&mut buf[..len], offset);
     }
 
     fn write_at(
@@ -368,6 +384,22 @@ impl IndexNode for KernFSInode {
 }
 
 impl KernFSInode {
+    /// 通过回调函数读取文件从`offset`开始的内容
+    fn callback_read_at(&self, buf: &mut [u8], offset: usize) -> Result<usize, SystemError> {
+        if self.callback.is_none() {
+            kwarn!("kernfs: callback is none");
+            return Err(SystemError::EOPNOTSUPP_OR_ENOTSUP);
+        }
+
+        let callback_data =
+            KernCallbackData::new(self.self_ref.upgrade().unwrap(), self.private_data.lock());
+        return self
+            .callback
+            .as_ref()
+            .unwrap()
+            .read(callback_data, buf, offset);
+    }
+
     pub fn new(
         parent: Option<Arc<KernFSInode>>,
         name: String,
@@ -425,7 +457,7 @@ impl KernFSInode {
     /// ## 返回值
     ///
     /// - 成功：子目录inode
-    /// - 失败：错误码
+    /// - 失败：错误码。已经存在同名的子项时返回EEXIST
     #[allow(dead_code)]
     #[inline]
     pub fn add_dir(
@@ -456,7 +488,7 @@ impl KernFSInode {
     /// ## 返回值
     ///
     /// - 成功：文件inode
-    /// - 失败：错误码
+    /// - 失败：错误码。已经存在同名的子项时返回EEXIST
     #[allow(dead_code)]
     #[inline]
     pub fn add_file(
@@ -515,16 +547,21 @@ impl KernFSInode {
             raw_dev: 0,
         };
 
+        // 同名检查和插入在同一次加锁中完成，只查找一次哈希表
+        let mut children = self.children.lock();
+        let entry = match children.entry(name) {
+            Entry::Occupied(_) => return Err(SystemError::EEXIST),
+            Entry::Vacant(entry) => entry,
+        };
         let new_inode: Arc<KernFSInode> = Self::new(
             Some(self.self_ref.upgrade().unwrap()),
-            name.clone(),
+            entry.key().clone(),
             metadata,
             file_type,
             private_data,
             callback,
         );
-
-        self.children.lock().insert(name, new_inode.clone());
+        entry.insert(new_inode.clone());
 
         return Ok(new_inode);
     }
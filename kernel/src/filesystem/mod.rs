@@ -1,5 +1,7 @@
 pub mod devfs;
+pub mod epoll;
 pub mod fat;
+pub mod io_uring;
 pub mod kernfs;
 pub mod mbr;
 pub mod procfs;
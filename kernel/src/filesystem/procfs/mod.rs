@@ -1,9 +1,7 @@
-use core::intrinsics::size_of;
+use core::fmt::Write;
 
 use alloc::{
-    borrow::ToOwned,
     collections::BTreeMap,
-    format,
     string::String,
     sync::{Arc, Weak},
     vec::Vec,
@@ -11,17 +9,42 @@ use alloc::{
 
 use crate::{
     arch::mm::LockedFrameAllocator,
+    debug::{
+        kallsyms::KallsymsSeq,
+        trace::{trace_store, TraceSeq},
+    },
+    driver::base::block::stats::diskstats_show,
+    exception::irqdesc::{
+        irq_affinity_show, irq_affinity_store, InterruptsSeq, IRQ_EXTERNAL_VECTOR_BASE,
+        IRQ_EXTERNAL_VECTOR_END,
+    },
     filesystem::vfs::{
         core::{generate_inode_id, ROOT_INODE},
+        seq_file::{SeqBuf, SeqFileHandle},
         FileType,
     },
+    include::bindings::bindings::smp_get_total_cpu,
+    init::bootstat::bootstat_show,
     kerror, kinfo,
     libs::{
+        lockstat::{lock_stat_show, lock_stat_store},
         once::Once,
         spinlock::{SpinLock, SpinLockGuard},
     },
-    process::{Pid, ProcessManager},
-    syscall::SystemError,
+    mm::task_mmu::{statm_show, task_mem_show, MapsSeq},
+    net::stats::{snmp_show, NetDevSeq},
+    process::{Pid, ProcessManager, ProcessState},
+    sched::{
+        cgroup::{task_groups_show, task_groups_store},
+        cputime::{cpu_cputime, cpu_stat_line, ns_to_clock_t, task_cputime},
+        isolation::{isolated_cpus_show, isolated_cpus_store, nohz_full_show, nohz_full_store},
+        stats::{task_sched_show, SchedstatSeq},
+    },
+    syscall::{
+        stats::{syscall_stats_store, SyscallStatsSeq},
+        trace::{syscall_trace_store, SyscallTraceSeq},
+        SystemError,
+    },
     time::TimeSpec,
 };
 
@@ -40,6 +63,48 @@ pub enum ProcFileType {
     ProcStatus = 0,
     /// meminfo
     ProcMeminfo = 1,
+    /// 每个cpu的调度统计信息
+    ProcSchedstat = 2,
+    /// 进程的调度统计信息
+    ProcPidSched = 3,
+    /// 每个网卡的收发统计信息
+    ProcNetDev = 4,
+    /// 各个协议的统计信息
+    ProcNetSnmp = 5,
+    /// 每个cpu上各个中断发生的次数
+    ProcInterrupts = 6,
+    /// 中断允许投递的cpu
+    ProcIrqAffinity = 7,
+    /// 各个系统调用的次数和耗时分布
+    ProcSyscallStats = 8,
+    /// 进程的系统调用事件
+    ProcPidSyscallTrace = 9,
+    /// 静态跟踪点的事件
+    ProcTrace = 10,
+    /// 内核符号表
+    ProcKallsyms = 11,
+    /// 锁的竞争统计
+    ProcLockStat = 12,
+    /// 被隔离的cpu
+    ProcIsolatedCpus = 13,
+    /// 停止时钟中断的cpu
+    ProcNohzFull = 14,
+    /// 任务组的状态和管理命令
+    ProcTaskGroups = 15,
+    /// 进程的状态和cpu时间（与Linux的/proc/<pid>/stat格式相同）
+    ProcPidStat = 16,
+    /// 每个cpu在各个上下文中的时间
+    ProcStat = 17,
+    /// 进程的内存映射
+    ProcPidMaps = 18,
+    /// 进程的每个内存映射的内存使用情况
+    ProcPidSmaps = 19,
+    /// 进程的内存使用情况（单位：页）
+    ProcPidStatm = 20,
+    /// 块设备的I/O统计
+    ProcDiskstats = 21,
+    /// 启动阶段的耗时
+    ProcBootstat = 22,
     //todo: 其他文件类型
     ///默认文件类型
     Default,
@@ -50,6 +115,27 @@ impl From<u8> for ProcFileType {
         match value {
             0 => ProcFileType::ProcStatus,
             1 => ProcFileType::ProcMeminfo,
+            2 => ProcFileType::ProcSchedstat,
+            3 => ProcFileType::ProcPidSched,
+            4 => ProcFileType::ProcNetDev,
+            5 => ProcFileType::ProcNetSnmp,
+            6 => ProcFileType::ProcInterrupts,
+            7 => ProcFileType::ProcIrqAffinity,
+            8 => ProcFileType::ProcSyscallStats,
+            9 => ProcFileType::ProcPidSyscallTrace,
+            10 => ProcFileType::ProcTrace,
+            11 => ProcFileType::ProcKallsyms,
+            12 => ProcFileType::ProcLockStat,
+            13 => ProcFileType::ProcIsolatedCpus,
+            14 => ProcFileType::ProcNohzFull,
+            15 => ProcFileType::ProcTaskGroups,
+            16 => ProcFileType::ProcPidStat,
+            17 => ProcFileType::ProcStat,
+            18 => ProcFileType::ProcPidMaps,
+            19 => ProcFileType::ProcPidSmaps,
+            20 => ProcFileType::ProcPidStatm,
+            21 => ProcFileType::ProcDiskstats,
+            22 => ProcFileType::ProcBootstat,
             _ => ProcFileType::Default,
         }
     }
@@ -62,6 +148,8 @@ pub struct InodeInfo {
     pid: Pid,
     ///文件类型
     ftype: ProcFileType,
+    ///中断向量号（仅用于/proc/irq下的文件）
+    irq: u8,
     //其他需要传入的信息在此定义
 }
 
@@ -79,14 +167,15 @@ pub struct ProcFS {
     root_inode: Arc<LockedProcFSInode>,
 }
 
+/// procfs文件的私有数据：文件的内容在读取时由seq_file逐个记录生成
 #[derive(Debug, Clone)]
 pub struct ProcfsFilePrivateData {
-    data: Vec<u8>,
+    seq: SeqFileHandle,
 }
 
 impl ProcfsFilePrivateData {
-    pub fn new() -> Self {
-        return ProcfsFilePrivateData { data: Vec::new() };
+    pub fn new(seq: SeqFileHandle) -> Self {
+        return ProcfsFilePrivateData { seq };
     }
 }
 
@@ -109,152 +198,195 @@ pub struct ProcFSInode {
     fdata: InodeInfo,
 }
 
-/// 对ProcFSInode实现获取各类文件信息的函数
-impl ProcFSInode {
-    /// @brief 去除Vec中所有的\0,并在结尾添加\0
-    #[inline]
-    fn trim_string(&self, data: &mut Vec<u8>) {
-        data.drain_filter(|x: &mut u8| *x == 0);
-        data.push(0);
-    }
-    // todo:其他数据获取函数实现
+/// 生成进程的status文件的内容
+fn status_show(pid: Pid, s: &mut SeqBuf) -> Result<(), SystemError> {
+    // 获取该pid对应的pcb结构体
+    let pcb = ProcessManager::find(pid).ok_or(SystemError::ESRCH)?;
 
-    /// @brief 打开status文件
-    ///
-    fn open_status(&self, pdata: &mut ProcfsFilePrivateData) -> Result<i64, SystemError> {
-        // 获取该pid对应的pcb结构体
-        let pid = self.fdata.pid;
-        let pcb = ProcessManager::find(pid);
-        let pcb = if pcb.is_none() {
-            kerror!(
-                "ProcFS: Cannot find pcb for pid {:?} when opening its 'status' file.",
-                pid
-            );
-            return Err(SystemError::ESRCH);
-        } else {
-            pcb.unwrap()
-        };
-        // 传入数据
-        let pdata: &mut Vec<u8> = &mut pdata.data;
+    write!(s, "Name:\t{}", pcb.basic().name()).ok();
 
-        pdata.append(
-            &mut format!("Name:\t{}", pcb.basic().name())
-                .as_bytes()
-                .to_owned(),
-        );
+    let sched_info_guard = pcb.sched_info();
+    let state = sched_info_guard.state();
+    let cpu_id = sched_info_guard
+        .on_cpu()
+        .map(|cpu| cpu as i32)
+        .unwrap_or(-1);
 
-        let sched_info_guard = pcb.sched_info();
-        let state = sched_info_guard.state();
-        let cpu_id = sched_info_guard
-            .on_cpu()
-            .map(|cpu| cpu as i32)
-            .unwrap_or(-1);
+    let priority = sched_info_guard.priority();
+    let vrtime = sched_info_guard.virtual_runtime();
 
-        let priority = sched_info_guard.priority();
-        let vrtime = sched_info_guard.virtual_runtime();
+    drop(sched_info_guard);
 
-        drop(sched_info_guard);
+    write!(s, "\nState:\t{:?}", state).ok();
+    write!(s, "\nPid:\t{}", pcb.pid().into()).ok();
+    write!(s, "\nPpid:\t{}", pcb.basic().ppid().into()).ok();
+    write!(s, "\ncpu_id:\t{}", cpu_id).ok();
+    write!(s, "\npriority:\t{}", priority.data()).ok();
+    write!(s, "\npreempt:\t{}", pcb.preempt_count()).ok();
+    write!(s, "\nvrtime:\t{}", vrtime).ok();
 
-        pdata.append(&mut format!("\nState:\t{:?}", state).as_bytes().to_owned());
-        pdata.append(
-            &mut format!("\nPid:\t{}", pcb.pid().into())
-                .as_bytes()
-                .to_owned(),
-        );
-        pdata.append(
-            &mut format!("\nPpid:\t{}", pcb.basic().ppid().into())
-                .as_bytes()
-                .to_owned(),
-        );
-        pdata.append(&mut format!("\ncpu_id:\t{}", cpu_id).as_bytes().to_owned());
-        pdata.append(
-            &mut format!("\npriority:\t{}", priority.data())
-                .as_bytes()
-                .to_owned(),
-        );
-        pdata.append(
-            &mut format!("\npreempt:\t{}", pcb.preempt_count())
-                .as_bytes()
-                .to_owned(),
-        );
-        pdata.append(&mut format!("\nvrtime:\t{}", vrtime).as_bytes().to_owned());
-
-        if let Some(user_vm) = pcb.basic().user_vm() {
-            let address_space_guard = user_vm.read();
-            // todo: 当前进程运行过程中占用内存的峰值
-            let hiwater_vm: u64 = 0;
-            // 进程代码段的大小
-            let text = (address_space_guard.end_code - address_space_guard.start_code) / 1024;
-            // 进程数据段的大小
-            let data = (address_space_guard.end_data - address_space_guard.start_data) / 1024;
-            drop(address_space_guard);
-            pdata.append(
-                &mut format!("\nVmPeak:\t{} kB", hiwater_vm)
-                    .as_bytes()
-                    .to_owned(),
-            );
-            pdata.append(&mut format!("\nVmData:\t{} kB", data).as_bytes().to_owned());
-            pdata.append(&mut format!("\nVmExe:\t{} kB", text).as_bytes().to_owned());
-        }
-
-        pdata.append(
-            &mut format!("\nflags: {:?}\n", pcb.flags().clone())
-                .as_bytes()
-                .to_owned(),
-        );
-
-        // 去除多余的\0
-        self.trim_string(pdata);
-
-        return Ok((pdata.len() * size_of::<u8>()) as i64);
+    if let Some(user_vm) = pcb.basic().user_vm() {
+        task_mem_show(&user_vm.read(), s);
     }
 
-    /// 打开 meminfo 文件
-    fn open_meminfo(&self, pdata: &mut ProcfsFilePrivateData) -> Result<i64, SystemError> {
-        // 获取内存信息
-        let usage = LockedFrameAllocator.get_usage();
-
-        // 传入数据
-        let data: &mut Vec<u8> = &mut pdata.data;
-
-        data.append(
-            &mut format!("MemTotal:\t{} kB\n", usage.total().bytes() >> 10)
-                .as_bytes()
-                .to_owned(),
-        );
-
-        data.append(
-            &mut format!("MemFree:\t{} kB\n", usage.free().bytes() >> 10)
-                .as_bytes()
-                .to_owned(),
-        );
+    write!(s, "\nflags: {:?}\n", pcb.flags().clone()).ok();
+    return Ok(());
+}
 
-        // 去除多余的\0
-        self.trim_string(data);
+/// 生成/proc/<pid>/stat的内容
+///
+/// 只填写了已经统计的字段（状态、父进程、进程组、cpu时间、优先级、所在的cpu），其余字段为0
+fn pid_stat_show(pid: Pid, s: &mut SeqBuf) -> Result<(), SystemError> {
+    let pcb = ProcessManager::find(pid).ok_or(SystemError::ESRCH)?;
+
+    let sched_info_guard = pcb.sched_info();
+    let state = match sched_info_guard.state() {
+        ProcessState::Runnable => 'R',
+        ProcessState::Blocked(true) => 'S',
+        ProcessState::Blocked(false) => 'D',
+        ProcessState::Stopped => 'T',
+        ProcessState::Exited(_) => 'Z',
+    };
+    let priority = sched_info_guard.priority().data();
+    let cpu_id = sched_info_guard
+        .on_cpu()
+        .map(|cpu| cpu as i32)
+        .unwrap_or(-1);
+    drop(sched_info_guard);
+
+    let t = task_cputime(&pcb);
+    let basic = pcb.basic();
+    // pid comm state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt cmajflt
+    write!(
+        s,
+        "{} ({}) {} {} {} 0 0 0 0 0 0 0 0",
+        pid.data(),
+        basic.name(),
+        state,
+        basic.ppid().data(),
+        basic.pgid().data()
+    )
+    .ok();
+    drop(basic);
+    // utime stime cutime cstime priority nice num_threads itrealvalue starttime vsize rss
+    write!(
+        s,
+        " {} {} {} {} {} 0 1 0 0 0 0",
+        ns_to_clock_t(t.utime),
+        ns_to_clock_t(t.stime),
+        ns_to_clock_t(t.cutime),
+        ns_to_clock_t(t.cstime),
+        priority
+    )
+    .ok();
+    // rsslim ... exit_signal（共13个字段），processor
+    writeln!(s, "{} {}", " 0".repeat(13), cpu_id).ok();
+    return Ok(());
+}
 
-        return Ok((data.len() * size_of::<u8>()) as i64);
+/// 生成/proc/stat的内容：所有cpu的时间之和，以及每个cpu的时间
+fn proc_stat_show(s: &mut SeqBuf) -> Result<(), SystemError> {
+    let nr_cpus = unsafe { smp_get_total_cpu() } as usize;
+    let stats: Vec<_> = (0..nr_cpus).map(cpu_cputime).collect();
+    let mut total = [0u64; 5];
+    for stat in stats.iter() {
+        for (t, v) in total.iter_mut().zip(stat.iter()) {
+            *t += v;
+        }
     }
+    s.push_str(&cpu_stat_line("cpu ", &total));
+    for (cpu, stat) in stats.iter().enumerate() {
+        s.push_str(&cpu_stat_line(&alloc::format!("cpu{cpu}"), stat));
+    }
+    return Ok(());
+}
 
-    /// proc文件系统读取函数
-    fn proc_read(
-        &self,
-        offset: usize,
-        len: usize,
-        buf: &mut [u8],
-        _pdata: &mut ProcfsFilePrivateData,
-    ) -> Result<usize, SystemError> {
-        let start = _pdata.data.len().min(offset);
-        let end = _pdata.data.len().min(offset + len);
-
-        // buffer空间不足
-        if buf.len() < (end - start) {
-            return Err(SystemError::ENOBUFS);
-        }
+/// 生成meminfo文件的内容
+fn meminfo_show(s: &mut SeqBuf) -> Result<(), SystemError> {
+    // 获取内存信息
+    let usage = LockedFrameAllocator.get_usage();
+    writeln!(s, "MemTotal:\t{} kB", usage.total().bytes() >> 10).ok();
+    writeln!(s, "MemFree:\t{} kB", usage.free().bytes() >> 10).ok();
+    return Ok(());
+}
 
-        // 拷贝数据
-        let src = &_pdata.data[start..end];
-        buf[0..src.len()].copy_from_slice(src);
-        return Ok(src.len());
+/// 对ProcFSInode实现获取各类文件信息的函数
+impl ProcFSInode {
+    /// @brief 创建读取文件时生成内容的seq_file
+    ///
+    /// 大的表格（中断、网卡、cpu）每行一个记录，读多少生成多少；其余的文件只有一个记录
+    fn open_seq(&self) -> Result<SeqFileHandle, SystemError> {
+        let seq = match self.fdata.ftype {
+            ProcFileType::ProcStatus
+            | ProcFileType::ProcPidSched
+            | ProcFileType::ProcPidSyscallTrace
+            | ProcFileType::ProcPidStat
+            | ProcFileType::ProcPidMaps
+            | ProcFileType::ProcPidSmaps
+            | ProcFileType::ProcPidStatm => {
+                let pid = self.fdata.pid;
+                if ProcessManager::find(pid).is_none() {
+                    kerror!(
+                        "ProcFS: Cannot find pcb for pid {:?} when opening its file.",
+                        pid
+                    );
+                    return Err(SystemError::ESRCH);
+                }
+                match self.fdata.ftype {
+                    ProcFileType::ProcStatus => SeqFileHandle::single(move |s| status_show(pid, s)),
+                    ProcFileType::ProcPidStat => {
+                        SeqFileHandle::single(move |s| pid_stat_show(pid, s))
+                    }
+                    ProcFileType::ProcPidSyscallTrace => {
+                        let pcb = ProcessManager::find(pid).ok_or(SystemError::ESRCH)?;
+                        SeqFileHandle::new(SyscallTraceSeq::new(&pcb))
+                    }
+                    ProcFileType::ProcPidMaps | ProcFileType::ProcPidSmaps => {
+                        let pcb = ProcessManager::find(pid).ok_or(SystemError::ESRCH)?;
+                        let detail = matches!(self.fdata.ftype, ProcFileType::ProcPidSmaps);
+                        SeqFileHandle::new(MapsSeq::new(&pcb, detail))
+                    }
+                    ProcFileType::ProcPidStatm => SeqFileHandle::single(move |s| {
+                        let pcb = ProcessManager::find(pid).ok_or(SystemError::ESRCH)?;
+                        return statm_show(&pcb, s);
+                    }),
+                    _ => SeqFileHandle::single(move |s| {
+                        let pcb = ProcessManager::find(pid).ok_or(SystemError::ESRCH)?;
+                        s.push_str(&task_sched_show(&pcb));
+                        return Ok(());
+                    }),
+                }
+            }
+            ProcFileType::ProcMeminfo => SeqFileHandle::single(meminfo_show),
+            ProcFileType::ProcSchedstat => SeqFileHandle::new(SchedstatSeq {
+                nr_cpus: unsafe { smp_get_total_cpu() },
+            }),
+            ProcFileType::ProcNetDev => SeqFileHandle::new(NetDevSeq),
+            ProcFileType::ProcNetSnmp => SeqFileHandle::single(|s| {
+                s.push_str(&snmp_show());
+                return Ok(());
+            }),
+            ProcFileType::ProcInterrupts => SeqFileHandle::new(InterruptsSeq),
+            ProcFileType::ProcSyscallStats => SeqFileHandle::new(SyscallStatsSeq),
+            ProcFileType::ProcTrace => SeqFileHandle::new(TraceSeq::new()),
+            ProcFileType::ProcKallsyms => SeqFileHandle::new(KallsymsSeq),
+            ProcFileType::ProcLockStat => SeqFileHandle::single(lock_stat_show),
+            ProcFileType::ProcIsolatedCpus => SeqFileHandle::single(isolated_cpus_show),
+            ProcFileType::ProcNohzFull => SeqFileHandle::single(nohz_full_show),
+            ProcFileType::ProcTaskGroups => SeqFileHandle::single(task_groups_show),
+            ProcFileType::ProcStat => SeqFileHandle::single(proc_stat_show),
+            ProcFileType::ProcDiskstats => SeqFileHandle::single(diskstats_show),
+            ProcFileType::ProcBootstat => SeqFileHandle::single(bootstat_show),
+            ProcFileType::ProcIrqAffinity => {
+                let irq = self.fdata.irq;
+                SeqFileHandle::single(move |s| {
+                    s.push_str(&irq_affinity_show(irq));
+                    return Ok(());
+                })
+            }
+            ProcFileType::Default => return Err(SystemError::EOPNOTSUPP_OR_ENOTSUP),
+        };
+        return Ok(seq);
     }
 }
 
@@ -304,6 +436,7 @@ impl ProcFS {
                 fdata: InodeInfo {
                     pid: Pid::new(0),
                     ftype: ProcFileType::Default,
+                    irq: 0,
                 },
             })));
 
@@ -335,6 +468,154 @@ impl ProcFS {
             panic!("create meminfo error");
         }
 
+        // 创建schedstat文件
+        let binding = inode.create(
+            "schedstat",
+            FileType::File,
+            ModeType::from_bits_truncate(0o444),
+        );
+        if let Ok(schedstat) = binding {
+            let schedstat_file = schedstat
+                .as_any_ref()
+                .downcast_ref::<LockedProcFSInode>()
+                .unwrap();
+            schedstat_file.0.lock().fdata.pid = Pid::new(0);
+            schedstat_file.0.lock().fdata.ftype = ProcFileType::ProcSchedstat;
+        } else {
+            panic!("create schedstat error");
+        }
+
+        // 创建net目录，以及其中的dev、snmp文件
+        let net_dir = inode
+            .create("net", FileType::Dir, ModeType::from_bits_truncate(0o555))
+            .expect("create net dir error");
+        for (name, ftype) in [
+            ("dev", ProcFileType::ProcNetDev),
+            ("snmp", ProcFileType::ProcNetSnmp),
+        ] {
+            let binding = net_dir
+                .create(name, FileType::File, ModeType::from_bits_truncate(0o444))
+                .unwrap_or_else(|_| panic!("create net/{name} error"));
+            let net_file = binding
+                .as_any_ref()
+                .downcast_ref::<LockedProcFSInode>()
+                .unwrap();
+            net_file.0.lock().fdata.pid = Pid::new(0);
+            net_file.0.lock().fdata.ftype = ftype;
+        }
+
+        // 创建interrupts文件
+        let binding = inode
+            .create(
+                "interrupts",
+                FileType::File,
+                ModeType::from_bits_truncate(0o444),
+            )
+            .expect("create interrupts error");
+        let interrupts_file = binding
+            .as_any_ref()
+            .downcast_ref::<LockedProcFSInode>()
+            .unwrap();
+        interrupts_file.0.lock().fdata.ftype = ProcFileType::ProcInterrupts;
+
+        // 创建syscall_stats文件
+        let binding = inode
+            .create(
+                "syscall_stats",
+                FileType::File,
+                ModeType::from_bits_truncate(0o644),
+            )
+            .expect("create syscall_stats error");
+        let syscall_stats_file = binding
+            .as_any_ref()
+            .downcast_ref::<LockedProcFSInode>()
+            .unwrap();
+        syscall_stats_file.0.lock().fdata.ftype = ProcFileType::ProcSyscallStats;
+
+        // 创建trace文件
+        let binding = inode
+            .create("trace", FileType::File, ModeType::from_bits_truncate(0o644))
+            .expect("create trace error");
+        let trace_file = binding
+            .as_any_ref()
+            .downcast_ref::<LockedProcFSInode>()
+            .unwrap();
+        trace_file.0.lock().fdata.ftype = ProcFileType::ProcTrace;
+
+        // 创建kallsyms文件
+        let binding = inode
+            .create(
+                "kallsyms",
+                FileType::File,
+                ModeType::from_bits_truncate(0o444),
+            )
+            .expect("create kallsyms error");
+        let kallsyms_file = binding
+            .as_any_ref()
+            .downcast_ref::<LockedProcFSInode>()
+            .unwrap();
+        kallsyms_file.0.lock().fdata.ftype = ProcFileType::ProcKallsyms;
+
+        // 创建lock_stat文件
+        let binding = inode
+            .create(
+                "lock_stat",
+                FileType::File,
+                ModeType::from_bits_truncate(0o644),
+            )
+            .expect("create lock_stat error");
+        let lock_stat_file = binding
+            .as_any_ref()
+            .downcast_ref::<LockedProcFSInode>()
+            .unwrap();
+        lock_stat_file.0.lock().fdata.ftype = ProcFileType::ProcLockStat;
+
+        // 创建isolated_cpus、nohz_full、taskgroups、stat、diskstats、bootstat文件
+        for (name, ftype, mode) in [
+            ("isolated_cpus", ProcFileType::ProcIsolatedCpus, 0o644),
+            ("nohz_full", ProcFileType::ProcNohzFull, 0o644),
+            ("taskgroups", ProcFileType::ProcTaskGroups, 0o644),
+            ("stat", ProcFileType::ProcStat, 0o444),
+            ("diskstats", ProcFileType::ProcDiskstats, 0o444),
+            ("bootstat", ProcFileType::ProcBootstat, 0o444),
+        ] {
+            let binding = inode
+                .create(name, FileType::File, ModeType::from_bits_truncate(mode))
+                .unwrap_or_else(|_| panic!("create {name} error"));
+            let file = binding
+                .as_any_ref()
+                .downcast_ref::<LockedProcFSInode>()
+                .unwrap();
+            file.0.lock().fdata.ftype = ftype;
+        }
+
+        // 创建irq目录，以及每个外部中断的smp_affinity文件
+        let irq_dir = inode
+            .create("irq", FileType::Dir, ModeType::from_bits_truncate(0o555))
+            .expect("create irq dir error");
+        for vector in IRQ_EXTERNAL_VECTOR_BASE..IRQ_EXTERNAL_VECTOR_END {
+            let vector_dir = irq_dir
+                .create(
+                    &vector.to_string(),
+                    FileType::Dir,
+                    ModeType::from_bits_truncate(0o555),
+                )
+                .unwrap_or_else(|_| panic!("create irq/{vector} error"));
+            let binding = vector_dir
+                .create(
+                    "smp_affinity",
+                    FileType::File,
+                    ModeType::from_bits_truncate(0o644),
+                )
+                .unwrap_or_else(|_| panic!("create irq/{vector}/smp_affinity error"));
+            let affinity_file = binding
+                .as_any_ref()
+                .downcast_ref::<LockedProcFSInode>()
+                .unwrap();
+            affinity_file.0.lock().fdata.ftype = ProcFileType::ProcIrqAffinity;
+            affinity_file.0.lock().fdata.irq = vector;
+        }
+
         return result;
     }
 
@@ -363,6 +644,55 @@ impl ProcFS {
         status_file.0.lock().fdata.pid = pid;
         status_file.0.lock().fdata.ftype = ProcFileType::ProcStatus;
 
+        // sched文件
+        let binding: Arc<dyn IndexNode> =
+            pid_dir.create("sched", FileType::File, ModeType::from_bits_truncate(0o444))?;
+        let sched_file: &LockedProcFSInode = binding
+            .as_any_ref()
+            .downcast_ref::<LockedProcFSInode>()
+            .unwrap();
+        sched_file.0.lock().fdata.pid = pid;
+        sched_file.0.lock().fdata.ftype = ProcFileType::ProcPidSched;
+
+        // syscall_trace文件
+        let binding: Arc<dyn IndexNode> = pid_dir.create(
+            "syscall_trace",
+            FileType::File,
+            ModeType::from_bits_truncate(0o644),
+        )?;
+        let trace_file: &LockedProcFSInode = binding
+            .as_any_ref()
+            .downcast_ref::<LockedProcFSInode>()
+            .unwrap();
+        trace_file.0.lock().fdata.pid = pid;
+        trace_file.0.lock().fdata.ftype = ProcFileType::ProcPidSyscallTrace;
+
+        // stat文件
+        let binding: Arc<dyn IndexNode> =
+            pid_dir.create("stat", FileType::File, ModeType::from_bits_truncate(0o444))?;
+        let stat_file: &LockedProcFSInode = binding
+            .as_any_ref()
+            .downcast_ref::<LockedProcFSInode>()
+            .unwrap();
+        stat_file.0.lock().fdata.pid = pid;
+        stat_file.0.lock().fdata.ftype = ProcFileType::ProcPidStat;
+
+        // maps、smaps、statm文件
+        for (name, ftype) in [
+            ("maps", ProcFileType::ProcPidMaps),
+            ("smaps", ProcFileType::ProcPidSmaps),
+            ("statm", ProcFileType::ProcPidStatm),
+        ] {
+            let binding: Arc<dyn IndexNode> =
+                pid_dir.create(name, FileType::File, ModeType::from_bits_truncate(0o444))?;
+            let file: &LockedProcFSInode = binding
+                .as_any_ref()
+                .downcast_ref::<LockedProcFSInode>()
+                .unwrap();
+            file.0.lock().fdata.pid = pid;
+            file.0.lock().fdata.ftype = ftype;
+        }
+
         //todo: 创建其他文件
 
         return Ok(());
@@ -377,6 +707,12 @@ impl ProcFS {
         let pid_dir: Arc<dyn IndexNode> = proc.find(&pid.to_string())?;
         // 删除进程文件夹下文件
         pid_dir.unlink("status")?;
+        pid_dir.unlink("sched")?;
+        pid_dir.unlink("syscall_trace")?;
+        pid_dir.unlink("stat")?;
+        pid_dir.unlink("maps")?;
+        pid_dir.unlink("smaps")?;
+        pid_dir.unlink("statm")?;
 
         // 查看进程文件是否还存在
         // let pf= pid_dir.find("status").expect("Cannot find status");
@@ -391,24 +727,18 @@ impl ProcFS {
 impl IndexNode for LockedProcFSInode {
     fn open(&self, data: &mut FilePrivateData, _mode: &FileMode) -> Result<(), SystemError> {
         // 加锁
-        let mut inode: SpinLockGuard<ProcFSInode> = self.0.lock();
+        let inode: SpinLockGuard<ProcFSInode> = self.0.lock();
 
         // 如果inode类型为文件夹，则直接返回成功
         if let FileType::Dir = inode.metadata.file_type {
             return Ok(());
         }
-        let mut private_data = ProcfsFilePrivateData::new();
-        // 根据文件类型获取相应数据
-        let file_size = match inode.fdata.ftype {
-            ProcFileType::ProcStatus => inode.open_status(&mut private_data)?,
-            ProcFileType::ProcMeminfo => inode.open_meminfo(&mut private_data)?,
-            _ => {
-                todo!()
-            }
-        };
-        *data = FilePrivateData::Procfs(private_data);
-        // 更新metadata里面的文件大小数值
-        inode.metadata.size = file_size;
+        // 普通文件的内容保存在inode中，其余的文件在读取时才生成内容
+        if let ProcFileType::Default = inode.fdata.ftype {
+            return Ok(());
+        }
+        let seq = inode.open_seq()?;
+        *data = FilePrivateData::Procfs(ProcfsFilePrivateData::new(seq));
 
         return Ok(());
     }
@@ -419,15 +749,8 @@ impl IndexNode for LockedProcFSInode {
         if let FileType::Dir = guard.metadata.file_type {
             return Ok(());
         }
-        // 获取数据信息
-        let private_data = match data {
-            FilePrivateData::Procfs(p) => p,
-            _ => {
-                panic!("ProcFS: FilePrivateData mismatch!");
-            }
-        };
-        // 释放资源
-        drop(private_data);
+        // 释放seq_file
+        *data = FilePrivateData::Unused;
         return Ok(());
     }
 
@@ -449,20 +772,12 @@ impl IndexNode for LockedProcFSInode {
             return Err(SystemError::EISDIR);
         }
 
-        // 获取数据信息
-        let private_data = match data {
-            FilePrivateData::Procfs(p) => p,
-            _ => {
-                panic!("ProcFS: FilePrivateData mismatch!");
-            }
-        };
-
-        // 根据文件类型读取相应数据
-        match inode.fdata.ftype {
-            ProcFileType::ProcStatus => return inode.proc_read(offset, len, buf, private_data),
-            ProcFileType::ProcMeminfo => return inode.proc_read(offset, len, buf, private_data),
-            ProcFileType::Default => (),
-        };
+        // 由seq_file生成内容的文件
+        if let FilePrivateData::Procfs(private_data) = data {
+            let seq = private_data.seq.clone();
+            drop(inode);
+            return seq.read(offset, &mut buf[..len]);
+        }
 
         // 默认读取
         let start = inode.data.len().min(offset);
@@ -482,11 +797,57 @@ impl IndexNode for LockedProcFSInode {
     fn write_at(
         &self,
         _offset: usize,
-        _len: usize,
-        _buf: &[u8],
+        len: usize,
+        buf: &[u8],
         _data: &mut FilePrivateData,
     ) -> Result<usize, SystemError> {
-        return Err(SystemError::EOPNOTSUPP_OR_ENOTSUP);
+        if buf.len() < len {
+            return Err(SystemError::EINVAL);
+        }
+        let inode: SpinLockGuard<ProcFSInode> = self.0.lock();
+        match inode.fdata.ftype {
+            ProcFileType::ProcIrqAffinity => {
+                irq_affinity_store(inode.fdata.irq, &buf[..len])?;
+                return Ok(len);
+            }
+            ProcFileType::ProcSyscallStats => {
+                drop(inode);
+                syscall_stats_store(&buf[..len])?;
+                return Ok(len);
+            }
+            ProcFileType::ProcTrace => {
+                drop(inode);
+                trace_store(&buf[..len])?;
+                return Ok(len);
+            }
+            ProcFileType::ProcLockStat => {
+                drop(inode);
+                lock_stat_store(&buf[..len])?;
+                return Ok(len);
+            }
+            ProcFileType::ProcIsolatedCpus => {
+                drop(inode);
+                isolated_cpus_store(&buf[..len])?;
+                return Ok(len);
+            }
+            ProcFileType::ProcNohzFull => {
+                drop(inode);
+                nohz_full_store(&buf[..len])?;
+                return Ok(len);
+            }
+            ProcFileType::ProcTaskGroups => {
+                drop(inode);
+                task_groups_store(&buf[..len])?;
+                return Ok(len);
+            }
+            ProcFileType::ProcPidSyscallTrace => {
+                let pid = inode.fdata.pid;
+                drop(inode);
+                syscall_trace_store(pid, &buf[..len])?;
+                return Ok(len);
+            }
+            _ => return Err(SystemError::EOPNOTSUPP_OR_ENOTSUP),
+        }
     }
 
     fn poll(&self) -> Result<PollStatus, SystemError> {
@@ -583,6 +944,7 @@ impl IndexNode for LockedProcFSInode {
                 fdata: InodeInfo {
                     pid: Pid::new(0),
                     ftype: ProcFileType::Default,
+                    irq: 0,
                 },
             })));
 
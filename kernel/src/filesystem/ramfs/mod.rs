@@ -17,8 +17,10 @@ use crate::{
 };
 
 use super::vfs::{
-    file::FilePrivateData, syscall::ModeType, FileSystem, FsInfo, IndexNode, InodeId, Metadata,
-    PollStatus, SpecialNodeData,
+    file::FilePrivateData,
+    page_cache::{PageCache, ReadaheadState},
+    syscall::ModeType,
+    FileSystem, FsInfo, IndexNode, InodeId, Metadata, PollStatus, SpecialNodeData,
 };
 
 /// RamFS的inode名称的最大长度
@@ -48,8 +50,9 @@ pub struct RamFSInode {
     self_ref: Weak<LockedRamFSInode>,
     /// 子Inode的B树
     children: BTreeMap<String, Arc<LockedRamFSInode>>,
-    /// 当前inode的数据部分
-    data: Vec<u8>,
+    /// 普通文件的数据。数据以页为单位保存在没有后备存储的页面缓存中，文件中的空洞不占用内存，
+    /// 映射文件时直接映射这些页面
+    page_cache: Option<Arc<PageCache>>,
     /// 当前inode的元数据
     metadata: Metadata,
     /// 指向inode所在的文件系统对象的指针
@@ -84,7 +87,7 @@ impl RamFS {
             parent: Weak::default(),
             self_ref: Weak::default(),
             children: BTreeMap::new(),
-            data: Vec::new(),
+            page_cache: None,
             metadata: Metadata {
                 dev_id: 0,
                 inode_id: generate_inode_id(),
@@ -119,9 +122,21 @@ impl RamFS {
     }
 }
 
+impl LockedRamFSInode {
+    /// 获取普通文件保存数据的页面缓存。调用者不能持有inode的锁：缓存会通过metadata获取文件的大小
+    fn data_cache(&self) -> Result<Arc<PageCache>, SystemError> {
+        let inode = self.0.lock();
+        // 检查当前inode是否为一个文件夹，如果是的话，就返回错误
+        if inode.metadata.file_type == FileType::Dir {
+            return Err(SystemError::EISDIR);
+        }
+        return inode.page_cache.clone().ok_or(SystemError::EINVAL);
+    }
+}
+
 impl IndexNode for LockedRamFSInode {
     fn truncate(&self, len: usize) -> Result<(), SystemError> {
-        let mut inode = self.0.lock();
+        let inode = self.0.lock();
 
         //如果是文件夹，则报错
         if inode.metadata.file_type == FileType::Dir {
@@ -129,8 +144,12 @@ impl IndexNode for LockedRamFSInode {
         }
 
         //当前文件长度大于_len才进行截断，否则不操作
-        if inode.data.len() > len {
-            inode.data.resize(len, 0);
+        let cache = inode.page_cache.clone();
+        drop(inode);
+        if let Some(cache) = cache {
+            if cache.cached_size() > len {
+                cache.resize(len)?;
+            }
         }
         return Ok(());
     }
@@ -157,26 +176,8 @@ impl IndexNode for LockedRamFSInode {
         if buf.len() < len {
             return Err(SystemError::EINVAL);
         }
-        // 加锁
-        let inode: SpinLockGuard<RamFSInode> = self.0.lock();
-
-        // 检查当前inode是否为一个文件夹，如果是的话，就返回错误
-        if inode.metadata.file_type == FileType::Dir {
-            return Err(SystemError::EISDIR);
-        }
-
-        let start = inode.data.len().min(offset);
-        let end = inode.data.len().min(offset + len);
-
-        // buffer空间不足
-        if buf.len() < (end - start) {
-            return Err(SystemError::ENOBUFS);
-        }
-
-        // 拷贝数据
-        let src = &inode.data[start..end];
-        buf[0..src.len()].copy_from_slice(src);
-        return Ok(src.len());
+        let cache = self.data_cache()?;
+        return cache.read(offset, &mut buf[..len], &mut ReadaheadState::new());
     }
 
     fn write_at(
@@ -190,24 +191,9 @@ impl IndexNode for LockedRamFSInode {
             return Err(SystemError::EINVAL);
         }
 
-        // 加锁
-        let mut inode: SpinLockGuard<RamFSInode> = self.0.lock();
-
-        // 检查当前inode是否为一个文件夹，如果是的话，就返回错误
-        if inode.metadata.file_type == FileType::Dir {
-            return Err(SystemError::EISDIR);
-        }
-
-        let data: &mut Vec<u8> = &mut inode.data;
-
-        // 如果文件大小比原来的大，那就resize这个数组
-        if offset + len > data.len() {
-            data.resize(offset + len, 0);
-        }
-
-        let target = &mut data[offset..offset + len];
-        target.copy_from_slice(&buf[0..len]);
-        return Ok(len);
+        // 只为被写入的页分配内存，offset之前没有被写过的部分是空洞
+        let cache = self.data_cache()?;
+        return cache.write(offset, &buf[..len], false);
     }
 
     fn poll(&self) -> Result<PollStatus, SystemError> {
@@ -233,7 +219,10 @@ impl IndexNode for LockedRamFSInode {
     fn metadata(&self) -> Result<Metadata, SystemError> {
         let inode = self.0.lock();
         let mut metadata = inode.metadata.clone();
-        metadata.size = inode.data.len() as i64;
+        metadata.size = inode
+            .page_cache
+            .as_ref()
+            .map_or(0, |cache| cache.cached_size() as i64);
 
         return Ok(metadata);
     }
@@ -251,12 +240,10 @@ impl IndexNode for LockedRamFSInode {
     }
 
     fn resize(&self, len: usize) -> Result<(), SystemError> {
-        let mut inode = self.0.lock();
-        if inode.metadata.file_type == FileType::File {
-            inode.data.resize(len, 0);
-            return Ok(());
-        } else {
-            return Err(SystemError::EINVAL);
+        let cache = self.0.lock().page_cache.clone();
+        match cache {
+            Some(cache) => return cache.resize(len),
+            None => return Err(SystemError::EINVAL),
         }
     }
 
@@ -283,7 +270,7 @@ impl IndexNode for LockedRamFSInode {
             parent: inode.self_ref.clone(),
             self_ref: Weak::default(),
             children: BTreeMap::new(),
-            data: Vec::new(),
+            page_cache: None,
             metadata: Metadata {
                 dev_id: 0,
                 inode_id: generate_inode_id(),
@@ -306,6 +293,10 @@ impl IndexNode for LockedRamFSInode {
 
         // 初始化inode的自引用的weak指针
         result.0.lock().self_ref = Arc::downgrade(&result);
+        if file_type == FileType::File {
+            let backend: Weak<LockedRamFSInode> = Arc::downgrade(&result);
+            result.0.lock().page_cache = Some(PageCache::new_memory(backend));
+        }
 
         // 将子inode插入父inode的B树中
         inode.children.insert(String::from(name), result.clone());
@@ -504,7 +495,7 @@ impl IndexNode for LockedRamFSInode {
             parent: inode.self_ref.clone(),
             self_ref: Weak::default(),
             children: BTreeMap::new(),
-            data: Vec::new(),
+            page_cache: None,
             metadata: Metadata {
                 dev_id: 0,
                 inode_id: generate_inode_id(),
@@ -550,4 +541,8 @@ impl IndexNode for LockedRamFSInode {
     fn special_node(&self) -> Option<super::vfs::SpecialNodeData> {
         return self.0.lock().special_node.clone();
     }
+
+    fn page_cache(&self) -> Option<Arc<PageCache>> {
+        return self.0.lock().page_cache.clone();
+    }
 }
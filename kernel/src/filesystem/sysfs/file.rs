@@ -51,7 +51,6 @@ impl SysKernFilePriv {
         };
     }
 
-    #[allow(dead_code)]
     #[inline]
     pub fn attribute(&self) -> Option<&'static dyn Attribute> {
         self.attribute
@@ -65,6 +65,14 @@ pub enum SysFSKernPrivateData {
 }
 
 impl SysFSKernPrivateData {
+    #[inline(always)]
+    pub fn is_show_attribute(&self) -> bool {
+        match self {
+            SysFSKernPrivateData::File(file) => file.attribute().is_some(),
+            _ => false,
+        }
+    }
+
     #[inline(always)]
     pub fn callback_read(&self, buf: &mut [u8], offset: usize) -> Result<usize, SystemError> {
         match self {
@@ -4,8 +4,8 @@ use alloc::{format, string::ToString, sync::Arc};
 
 use crate::{
     driver::{
-        base::block::disk_info::Partition,
-        disk::ahci::{self},
+        base::block::{block_device::BlockDevice, disk_info::Partition},
+        disk::{ahci, nvme::get_nvme_disk_by_name, virtio_blk::get_virtio_blk_disk_by_name},
     },
     filesystem::{
         devfs::devfs_init,
@@ -15,6 +15,7 @@ use crate::{
         sysfs::sysfs_init,
         vfs::{mount::MountFS, syscall::ModeType, AtomicInodeId, FileSystem, FileType},
     },
+    ipc::{mqueue::mqueue_init, shm::dev_shm_init},
     kdebug, kerror, kinfo,
     process::ProcessManager,
     syscall::SystemError,
@@ -74,6 +75,9 @@ pub extern "C" fn vfs_init() -> i32 {
 
     devfs_init().expect("Failed to initialize devfs");
 
+    dev_shm_init().expect("Failed to mount /dev/shm");
+    mqueue_init().expect("Failed to mount /dev/mqueue");
+
     sysfs_init().expect("Failed to initialize sysfs");
 
     let root_entries = ROOT_INODE().list().expect("VFS init failed");
@@ -140,6 +144,9 @@ fn migrate_virtual_filesystem(new_fs: Arc<dyn FileSystem>) -> Result<(), SystemE
         // 设置全局的新的ROOT Inode
         __ROOT_INODE = Some(new_root_inode);
     }
+    // devfs被重新挂载，需要重新挂载它下面的/dev/shm和/dev/mqueue
+    dev_shm_init()?;
+    mqueue_init()?;
 
     kinfo!("VFS: Migrate filesystems done!");
 
@@ -148,12 +155,16 @@ fn migrate_virtual_filesystem(new_fs: Arc<dyn FileSystem>) -> Result<(), SystemE
 
 pub fn mount_root_fs() -> Result<(), SystemError> {
     kinfo!("Try to mount FAT32 as root fs...");
-    let partiton: Arc<Partition> = ahci::get_disks_by_name("ahci_disk_0".to_string())
-        .unwrap()
-        .0
-        .lock()
-        .partitions[0]
-        .clone();
+    // 优先使用AHCI磁盘，其次是virtio-blk磁盘，最后是NVMe磁盘
+    let disk: Arc<dyn BlockDevice> =
+        if let Ok(disk) = ahci::get_disks_by_name("ahci_disk_0".to_string()) {
+            disk
+        } else if let Ok(disk) = get_virtio_blk_disk_by_name("virtio_blk_0") {
+            disk
+        } else {
+            get_nvme_disk_by_name("nvme0n1").unwrap()
+        };
+    let partiton: Arc<Partition> = disk.partitions()[0].clone();
 
     let fatfs: Result<Arc<FATFileSystem>, SystemError> = FATFileSystem::new(partiton);
     if fatfs.is_err() {
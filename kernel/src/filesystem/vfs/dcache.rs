@@ -0,0 +1,211 @@
+//! 目录项缓存（dentry cache）
+//!
+//! 路径查找的每一级都要在父目录中按名字查找子inode。对于FAT这样的文件系统，查找一个不在内存中的名字
+//! （尤其是查找不存在的文件，例如execve在PATH中逐个目录搜索可执行文件）需要扫描父目录的所有簇。
+//!
+//! 目录项缓存以（文件系统, 父目录的inode号, 文件名）为key，缓存查找的结果：找到的inode（正向目录项），
+//! 或者“文件不存在”（负向目录项）。缓存是一个全局的哈希表，每个桶由自己的自旋锁保护；
+//! 桶中的目录项数量有上限，桶满之后按照second chance算法淘汰最近没有被访问过的目录项。
+//!
+//! 缓存中保存的是具体文件系统的inode，而不是MountFSInode。挂载点的替换在查找缓存之后由MountFS完成，
+//! 因此挂载文件系统不会使缓存中的内容过期。
+//!
+//! 只有目录内容只会经由VFS修改的文件系统才能使用目录项缓存（见[`DentryCachePolicy`]）。
+//! MountFSInode在create/link/unlink/rmdir/move_/mknod之后使对应的目录项失效。
+
+use alloc::{
+    borrow::Cow,
+    string::{String, ToString},
+    sync::Arc,
+    vec::Vec,
+};
+
+use crate::libs::spinlock::SpinLock;
+
+use super::{IndexNode, InodeId};
+
+/// 哈希表的桶的数量（必须是2的幂）
+const DCACHE_NR_BUCKETS: usize = 256;
+/// 每个桶中最多缓存的目录项数量
+const DCACHE_BUCKET_CAPACITY: usize = 32;
+
+/// 文件系统使用目录项缓存的方式
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum DentryCachePolicy {
+    /// 不使用目录项缓存。目录内容可能在VFS之外被修改的文件系统（例如procfs、devfs）必须使用这一项
+    Disabled,
+    /// 使用目录项缓存，文件名大小写敏感
+    CaseSensitive,
+    /// 使用目录项缓存，文件名大小写不敏感（缓存的key统一转换为大写）
+    CaseInsensitive,
+}
+
+impl DentryCachePolicy {
+    /// 获取文件名在目录项缓存中对应的key。若不使用目录项缓存，则返回None
+    pub fn key_name<'a>(&self, name: &'a str) -> Option<Cow<'a, str>> {
+        match self {
+            DentryCachePolicy::Disabled => None,
+            DentryCachePolicy::CaseSensitive => Some(Cow::Borrowed(name)),
+            DentryCachePolicy::CaseInsensitive => Some(Cow::Owned(name.to_uppercase())),
+        }
+    }
+}
+
+/// 目录项缓存的key
+#[derive(Debug, PartialEq, Eq)]
+pub struct DentryKey {
+    /// 目录所在的具体文件系统对象的地址
+    fs: usize,
+    /// 父目录在具体文件系统中的inode号
+    parent: InodeId,
+    name: String,
+}
+
+impl DentryKey {
+    pub fn new(fs: usize, parent: InodeId, name: &str) -> Self {
+        return Self {
+            fs,
+            parent,
+            name: name.to_string(),
+        };
+    }
+
+    /// FNV-1a哈希
+    fn hash(&self) -> usize {
+        let mut h: u64 = 0xcbf29ce484222325;
+        let mut feed = |bytes: &[u8]| {
+            for b in bytes {
+                h ^= *b as u64;
+                h = h.wrapping_mul(0x100000001b3);
+            }
+        };
+        feed(&self.fs.to_ne_bytes());
+        feed(&self.parent.data().to_ne_bytes());
+        feed(self.name.as_bytes());
+        return h as usize;
+    }
+
+    fn bucket(&self) -> &'static SpinLock<DentryBucket> {
+        return &DCACHE[self.hash() & (DCACHE_NR_BUCKETS - 1)];
+    }
+}
+
+/// 查询目录项缓存的结果
+pub enum DentryLookup {
+    /// 命中正向目录项
+    Found(Arc<dyn IndexNode>),
+    /// 命中负向目录项：文件不存在
+    Negative,
+    /// 未命中。查找完成后，需要把这个序号传给[`d_insert`]
+    Miss(u64),
+}
+
+#[derive(Debug)]
+struct Dentry {
+    key: DentryKey,
+    /// 为None时，表示这是一个负向目录项
+    inode: Option<Arc<dyn IndexNode>>,
+    /// 最近是否被访问过（用于second chance淘汰）
+    referenced: bool,
+}
+
+#[derive(Debug)]
+struct DentryBucket {
+    entries: Vec<Dentry>,
+    /// second chance算法的时钟指针
+    hand: usize,
+    /// 每次使桶中的目录项失效时递增。未命中之后、插入之前序号发生了变化，
+    /// 说明在查找的过程中目录被修改了，查找的结果可能已经过期，不能插入缓存
+    seq: u64,
+}
+
+impl DentryBucket {
+    const fn new() -> Self {
+        return Self {
+            entries: Vec::new(),
+            hand: 0,
+            seq: 0,
+        };
+    }
+
+    fn position(&self, key: &DentryKey) -> Option<usize> {
+        return self.entries.iter().position(|d| d.key == *key);
+    }
+
+    /// 淘汰一个最近没有被访问过的目录项，并返回它
+    fn evict_one(&mut self) -> Dentry {
+        loop {
+            if self.hand >= self.entries.len() {
+                self.hand = 0;
+            }
+            let dentry = &mut self.entries[self.hand];
+            if dentry.referenced {
+                dentry.referenced = false;
+                self.hand += 1;
+            } else {
+                return self.entries.swap_remove(self.hand);
+            }
+        }
+    }
+}
+
+static DCACHE: [SpinLock<DentryBucket>; DCACHE_NR_BUCKETS] = {
+    const BUCKET: SpinLock<DentryBucket> = SpinLock::new(DentryBucket::new());
+    [BUCKET; DCACHE_NR_BUCKETS]
+};
+
+/// 在目录项缓存中查找
+pub fn d_lookup(key: &DentryKey) -> DentryLookup {
+    let mut bucket = key.bucket().lock();
+    let seq = bucket.seq;
+    match bucket.position(key) {
+        Some(pos) => {
+            let dentry = &mut bucket.entries[pos];
+            dentry.referenced = true;
+            match &dentry.inode {
+                Some(inode) => return DentryLookup::Found(inode.clone()),
+                None => return DentryLookup::Negative,
+            }
+        }
+        None => return DentryLookup::Miss(seq),
+    }
+}
+
+/// 把一次查找的结果加入目录项缓存
+///
+/// ## 参数
+///
+/// - `key` 目录项的key
+/// - `inode` 找到的inode。为None时，插入负向目录项
+/// - `seq` 未命中时[`d_lookup`]返回的序号
+pub fn d_insert(key: DentryKey, inode: Option<Arc<dyn IndexNode>>, seq: u64) {
+    let mut bucket = key.bucket().lock();
+    if bucket.seq != seq || bucket.position(&key).is_some() {
+        return;
+    }
+
+    let evicted = if bucket.entries.len() >= DCACHE_BUCKET_CAPACITY {
+        Some(bucket.evict_one())
+    } else {
+        None
+    };
+    bucket.entries.push(Dentry {
+        key,
+        inode,
+        referenced: false,
+    });
+    drop(bucket);
+    // 被淘汰的目录项可能持有inode的最后一个引用，在释放桶的锁之后再析构
+    drop(evicted);
+}
+
+/// 使目录项失效（目录中名为`key.name`的文件被创建、删除或者重命名之后调用）
+pub fn d_invalidate(key: &DentryKey) {
+    let mut bucket = key.bucket().lock();
+    bucket.seq += 1;
+    let removed = bucket
+        .position(key)
+        .map(|pos| bucket.entries.swap_remove(pos));
+    drop(bucket);
+    drop(removed);
+}
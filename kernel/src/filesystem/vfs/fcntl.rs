@@ -105,3 +105,34 @@ bitflags! {
 
 /// for F_[GET|SET]FL
 pub const FD_CLOEXEC: u32 = 1;
+
+/// posix_fadvise系统调用的建议
+///
+/// 参考：linux-6.1-rc5/include/uapi/linux/fadvise.h
+#[derive(Debug, Copy, Clone, Eq, PartialEq, FromPrimitive)]
+pub enum FadvAdvice {
+    /// POSIX_FADV_NORMAL 没有特殊的建议
+    Normal = 0,
+    /// POSIX_FADV_RANDOM 将会随机访问
+    Random = 1,
+    /// POSIX_FADV_SEQUENTIAL 将会顺序访问
+    Sequential = 2,
+    /// POSIX_FADV_WILLNEED 很快就会访问，预先读入
+    WillNeed = 3,
+    /// POSIX_FADV_DONTNEED 不再需要，丢弃缓存
+    DontNeed = 4,
+    /// POSIX_FADV_NOREUSE 只会访问一次
+    NoReuse = 5,
+}
+
+bitflags! {
+    /// sync_file_range系统调用的标志
+    pub struct SyncFileRangeFlags: u32 {
+        /// 写回之前，等待范围内正在进行的写回完成
+        const SYNC_FILE_RANGE_WAIT_BEFORE = 1;
+        /// 开始写回范围内的脏页
+        const SYNC_FILE_RANGE_WRITE = 2;
+        /// 写回之后，等待写回完成
+        const SYNC_FILE_RANGE_WAIT_AFTER = 4;
+    }
+}
@@ -1,21 +1,30 @@
-use core::mem::MaybeUninit;
-
 use alloc::{string::String, sync::Arc, vec::Vec};
 
 use crate::{
     driver::{
-        base::{block::SeekFrom, device::DevicePrivateData},
+        base::{
+            block::{block_device::LBA_SIZE, SeekFrom},
+            device::DevicePrivateData,
+        },
         tty::TtyFilePrivateData,
     },
     filesystem::procfs::ProcfsFilePrivateData,
     ipc::pipe::PipeFsPrivateData,
     kerror,
     libs::spinlock::SpinLock,
-    process::ProcessManager,
+    process::{
+        resource::{RLimit64, INR_OPEN_CUR, INR_OPEN_MAX, NR_OPEN},
+        ProcessManager,
+    },
     syscall::SystemError,
 };
 
-use super::{Dirent, FileType, IndexNode, InodeId, Metadata, SpecialNodeData};
+use super::{
+    fcntl::FadvAdvice,
+    page_cache::{PageCache, ReadaheadMode, ReadaheadState},
+    seq_file::SeqFileHandle,
+    Dirent, FileType, IndexNode, InodeId, Metadata, SpecialNodeData,
+};
 
 /// 文件私有信息的枚举类型
 #[derive(Debug, Clone)]
@@ -29,6 +38,8 @@ pub enum FilePrivateData {
     DevFS(DevicePrivateData),
     /// tty设备文件的私有信息
     Tty(TtyFilePrivateData),
+    /// 由seq_file生成内容的文件（例如sysfs的属性文件）
+    Seq(SeqFileHandle),
     /// 不需要文件私有信息
     Unused,
 }
@@ -103,15 +114,15 @@ impl FileMode {
 #[derive(Debug)]
 pub struct File {
     inode: Arc<dyn IndexNode>,
-    /// 对于文件，表示字节偏移量；对于文件夹，表示当前操作的子目录项偏移量
+    /// 对于文件，表示字节偏移量；对于文件夹，表示readdir的位置
     offset: usize,
     /// 文件的打开模式
     mode: FileMode,
     /// 文件类型
     file_type: FileType,
-    /// readdir时候用的，暂存的本次循环中，所有子目录项的名字的数组
-    readdir_subdirs_name: Vec<String>,
     pub private_data: FilePrivateData,
+    /// 读取页面缓存时的预读状态
+    ra: ReadaheadState,
 }
 
 impl File {
@@ -136,8 +147,8 @@ impl File {
             offset: 0,
             mode,
             file_type,
-            readdir_subdirs_name: Vec::new(),
             private_data: FilePrivateData::default(),
+            ra: ReadaheadState::new(),
         };
         // kdebug!("inode:{:?}",f.inode);
         f.inode.open(&mut f.private_data, &mode)?;
@@ -153,22 +164,84 @@ impl File {
     /// @return Ok(usize) 成功读取的字节数
     /// @return Err(SystemError) 错误码
     pub fn read(&mut self, len: usize, buf: &mut [u8]) -> Result<usize, SystemError> {
-        // 先检查本文件在权限等规则下，是否可读取。
-        self.readable()?;
+        let len = self.pread(self.offset, len, buf)?;
+        self.offset += len;
+        return Ok(len);
+    }
 
+    /// @brief 从文件的指定偏移量读取指定的字节数到buffer中，不改变文件指针
+    ///
+    /// @param offset 开始读取的偏移量
+    /// @param len 要读取的字节数
+    /// @param buf 目标buffer
+    ///
+    /// @return Ok(usize) 成功读取的字节数
+    /// @return Err(SystemError) 错误码
+    pub fn pread(
+        &mut self,
+        offset: usize,
+        len: usize,
+        buf: &mut [u8],
+    ) -> Result<usize, SystemError> {
         if buf.len() < len {
             return Err(SystemError::ENOBUFS);
         }
+        return self.preadv(offset, &mut [&mut buf[..len]]);
+    }
+
+    /// @brief 从文件中把数据依次读入多个缓冲区（readv）
+    ///
+    /// @return Ok(usize) 成功读取的字节数
+    /// @return Err(SystemError) 错误码
+    pub fn readv(&mut self, bufs: &mut [&mut [u8]]) -> Result<usize, SystemError> {
+        let len = self.preadv(self.offset, bufs)?;
+        self.offset += len;
+        return Ok(len);
+    }
+
+    /// @brief 从文件的指定偏移量把数据依次读入多个缓冲区，不改变文件指针（preadv）
+    ///
+    /// 数据直接读入各个缓冲区，不经过临时缓冲区。前一个缓冲区没有读满时，不再读取后面的缓冲区
+    ///
+    /// @return Ok(usize) 成功读取的字节数
+    /// @return Err(SystemError) 错误码
+    pub fn preadv(&mut self, offset: usize, bufs: &mut [&mut [u8]]) -> Result<usize, SystemError> {
+        // 先检查本文件在权限等规则下，是否可读取。
+        self.readable()?;
+        if bufs.is_empty() {
+            return Ok(0);
+        }
 
-        // 如果文件指针已经超过了文件大小，则返回0
-        if self.offset > self.inode.metadata()?.size as usize {
+        // 如果偏移量已经超过了文件大小，则返回0
+        if offset > self.inode.metadata()?.size as usize {
             return Ok(0);
         }
-        let len = self
+        if let Some(cache) = self.inode.page_cache() {
+            let direct =
+                self.direct_io(&cache, offset, bufs.iter().map(|b| (b.as_ptr(), b.len())))?;
+            let mut total = 0;
+            for buf in bufs.iter_mut() {
+                let r = if direct {
+                    cache.direct_read(offset + total, buf)
+                } else {
+                    cache.read(offset + total, buf, &mut self.ra)
+                };
+                match r {
+                    Ok(len) => {
+                        total += len;
+                        if len < buf.len() {
+                            break;
+                        }
+                    }
+                    Err(e) if total == 0 => return Err(e),
+                    Err(_) => break,
+                }
+            }
+            return Ok(total);
+        }
+        return self
             .inode
-            .read_at(self.offset, len, buf, &mut self.private_data)?;
-        self.offset += len;
-        return Ok(len);
+            .read_vectored_at(offset, bufs, &mut self.private_data);
     }
 
     /// @brief 从buffer向文件写入指定的字节数的数据
@@ -179,22 +252,162 @@ impl File {
     /// @return Ok(usize) 成功写入的字节数
     /// @return Err(SystemError) 错误码
     pub fn write(&mut self, len: usize, buf: &[u8]) -> Result<usize, SystemError> {
-        // 先检查本文件在权限等规则下，是否可写入。
-        self.writeable()?;
+        let len = self.pwrite(self.offset, len, buf)?;
+        self.offset += len;
+        return Ok(len);
+    }
+
+    /// @brief 从buffer向文件的指定偏移量写入指定的字节数的数据，不改变文件指针
+    ///
+    /// @param offset 开始写入的偏移量
+    /// @param len 要写入的字节数
+    /// @param buf 源数据buffer
+    ///
+    /// @return Ok(usize) 成功写入的字节数
+    /// @return Err(SystemError) 错误码
+    pub fn pwrite(&mut self, offset: usize, len: usize, buf: &[u8]) -> Result<usize, SystemError> {
         if buf.len() < len {
             return Err(SystemError::ENOBUFS);
         }
+        return self.pwritev(offset, &[&buf[..len]]);
+    }
+
+    /// @brief 把多个缓冲区中的数据依次写入文件（writev）
+    ///
+    /// @return Ok(usize) 成功写入的字节数
+    /// @return Err(SystemError) 错误码
+    pub fn writev(&mut self, bufs: &[&[u8]]) -> Result<usize, SystemError> {
+        let len = self.pwritev(self.offset, bufs)?;
+        self.offset += len;
+        return Ok(len);
+    }
+
+    /// @brief 把多个缓冲区中的数据依次写入文件的指定偏移量，不改变文件指针（pwritev）
+    ///
+    /// 数据直接从各个缓冲区写入，不经过临时缓冲区。前一个缓冲区没有写完时，不再写入后面的缓冲区
+    ///
+    /// @return Ok(usize) 成功写入的字节数
+    /// @return Err(SystemError) 错误码
+    pub fn pwritev(&mut self, offset: usize, bufs: &[&[u8]]) -> Result<usize, SystemError> {
+        // 先检查本文件在权限等规则下，是否可写入。
+        self.writeable()?;
+        if bufs.is_empty() {
+            return Ok(0);
+        }
 
-        // 如果文件指针已经超过了文件大小，则需要扩展文件大小
+        let cache = self.inode.page_cache();
+        // 如果偏移量已经超过了文件大小，则需要扩展文件大小
         let file_size = self.inode.metadata()?.size as usize;
-        if self.offset > file_size {
-            self.inode.resize(self.offset)?;
+        if offset > file_size {
+            match &cache {
+                Some(cache) => cache.resize(offset)?,
+                None => self.inode.resize(offset)?,
+            }
+        }
+        if let Some(cache) = cache {
+            let direct =
+                self.direct_io(&cache, offset, bufs.iter().map(|b| (b.as_ptr(), b.len())))?;
+            let sync = self.mode.intersects(FileMode::O_SYNC | FileMode::O_DSYNC);
+            let mut total = 0;
+            for buf in bufs.iter() {
+                let r = if direct {
+                    cache.direct_write(offset + total, buf)
+                } else {
+                    cache.write(offset + total, buf, sync)
+                };
+                match r {
+                    Ok(len) => {
+                        total += len;
+                        if len < buf.len() {
+                            break;
+                        }
+                    }
+                    Err(e) if total == 0 => return Err(e),
+                    Err(_) => break,
+                }
+            }
+            return Ok(total);
         }
-        let len = self
+        return self
             .inode
-            .write_at(self.offset, len, buf, &mut self.private_data)?;
-        self.offset += len;
-        return Ok(len);
+            .write_vectored_at(offset, bufs, &mut self.private_data);
+    }
+
+    /// @brief 这次读写是否以O_DIRECT的方式进行（绕过页面缓存）
+    ///
+    /// 以O_DIRECT打开、并且缓存有后备存储时，文件偏移量、每个缓冲区的地址和长度都必须按[`LBA_SIZE`]对齐，
+    /// 否则返回EINVAL（与Linux相同）
+    fn direct_io(
+        &self,
+        cache: &PageCache,
+        offset: usize,
+        mut bufs: impl Iterator<Item = (*const u8, usize)>,
+    ) -> Result<bool, SystemError> {
+        if !self.mode.contains(FileMode::O_DIRECT) || !cache.has_backing_store() {
+            return Ok(false);
+        }
+        let mask = LBA_SIZE - 1;
+        if offset & mask != 0 || bufs.any(|(ptr, len)| (ptr as usize | len) & mask != 0) {
+            return Err(SystemError::EINVAL);
+        }
+        return Ok(true);
+    }
+
+    /// @brief 为文件[offset, offset + len)范围预先分配磁盘空间（fallocate）
+    ///
+    /// 只支持默认模式（mode为0）：文件大小不足offset + len时被扩展，扩展的部分读出0
+    pub fn fallocate(&self, mode: u32, offset: usize, len: usize) -> Result<(), SystemError> {
+        if mode != 0 {
+            return Err(SystemError::EOPNOTSUPP_OR_ENOTSUP);
+        }
+        if len == 0 {
+            return Err(SystemError::EINVAL);
+        }
+        self.writeable()?;
+        match self.file_type {
+            FileType::File => {}
+            FileType::Dir => return Err(SystemError::EISDIR),
+            FileType::Pipe => return Err(SystemError::ESPIPE),
+            _ => return Err(SystemError::ENODEV),
+        }
+        match self.inode.page_cache() {
+            Some(cache) => cache.fallocate(offset, len)?,
+            None => self.inode.fallocate(offset, len)?,
+        }
+        return Ok(());
+    }
+
+    /// @brief 处理posix_fadvise的建议。不支持页面缓存的文件忽略这些建议
+    ///
+    /// @param offset 建议作用的范围的起始偏移量
+    /// @param len 建议作用的范围的长度，为0时表示到文件末尾
+    pub fn fadvise(
+        &mut self,
+        offset: usize,
+        len: usize,
+        advice: FadvAdvice,
+    ) -> Result<(), SystemError> {
+        match self.file_type {
+            FileType::Pipe => return Err(SystemError::ESPIPE),
+            _ => {}
+        }
+        match advice {
+            FadvAdvice::Normal => self.ra.set_mode(ReadaheadMode::Normal),
+            FadvAdvice::Random => self.ra.set_mode(ReadaheadMode::Random),
+            FadvAdvice::Sequential => self.ra.set_mode(ReadaheadMode::Sequential),
+            FadvAdvice::WillNeed => {
+                if let Some(cache) = self.inode.page_cache() {
+                    cache.willneed(offset, len)?;
+                }
+            }
+            FadvAdvice::DontNeed => {
+                if let Some(cache) = self.inode.page_cache() {
+                    cache.dontneed(offset, len);
+                }
+            }
+            FadvAdvice::NoReuse => {}
+        }
+        return Ok(());
     }
 
     /// @brief 获取文件的元数据
@@ -267,59 +480,36 @@ impl File {
         return Ok(());
     }
 
-    /// @biref 充填dirent结构体
-    /// @return 返回dirent结构体的大小
-    pub fn readdir(&mut self, dirent: &mut Dirent) -> Result<u64, SystemError> {
-        let inode: &Arc<dyn IndexNode> = &self.inode;
-
-        // 如果偏移量为0
-        if self.offset == 0 {
-            // 通过list更新readdir_subdirs_name
-            self.readdir_subdirs_name = inode.list()?;
-            self.readdir_subdirs_name.sort();
+    /// @brief 从当前位置开始，把尽可能多的目录项写入`buf`（格式与linux_dirent64相同）
+    ///
+    /// 对于文件夹，偏移量是文件系统的readdir给出的位置，每个目录项的d_off是它之后的位置，
+    /// 因此下一次调用从上一次结束的地方继续，而不需要从头遍历目录
+    ///
+    /// @return 写入的字节数。已经读到末尾时返回0；`buf`放不下一个目录项时返回EINVAL
+    pub fn readdir(&mut self, buf: &mut [u8]) -> Result<usize, SystemError> {
+        if self.file_type != FileType::Dir {
+            return Err(SystemError::ENOTDIR);
         }
-        // kdebug!("sub_entries={sub_entries:?}");
 
-        // 已经读到末尾
-        if self.offset == self.readdir_subdirs_name.len() {
-            self.offset = 0;
-            return Ok(0);
-        }
-        let name = &self.readdir_subdirs_name[self.offset];
-        let sub_inode: Arc<dyn IndexNode> = match inode.find(&name) {
-            Ok(i) => i,
-            Err(e) => {
-                kerror!(
-                    "Readdir error: Failed to find sub inode:{name:?}, file={self:?}, error={e:?}"
-                );
-                return Err(e);
+        // 文件系统可能在持有自旋锁的情况下调用emit，因此先写入内核的缓冲区，最后再拷贝到buf中
+        let limit = buf.len();
+        let mut out: Vec<u8> = Vec::new();
+        let mut pos = self.offset as u64;
+        let mut too_small = false;
+        self.inode.readdir(pos, &mut |name, ino, file_type, next| {
+            if !Dirent::append(&mut out, limit, ino, next, file_type, name) {
+                too_small = out.is_empty();
+                return false;
             }
-        };
-
-        let name_bytes: &[u8] = name.as_bytes();
-
-        // 根据posix的规定，dirent中的d_name是一个不定长的数组，因此需要unsafe来拷贝数据
-        unsafe {
-            let ptr = &mut dirent.d_name as *mut u8;
-
-            let buf: &mut [u8] =
-                ::core::slice::from_raw_parts_mut::<'static, u8>(ptr, name_bytes.len() + 1);
-            buf[0..name_bytes.len()].copy_from_slice(name_bytes);
-            buf[name_bytes.len()] = 0;
+            pos = next;
+            return true;
+        })?;
+        if too_small {
+            return Err(SystemError::EINVAL);
         }
-
-        self.offset += 1;
-        dirent.d_ino = sub_inode.metadata().unwrap().inode_id.into() as u64;
-        dirent.d_type = sub_inode.metadata().unwrap().file_type.get_file_type_num() as u8;
-
-        // 计算dirent结构体的大小
-        let size = (name_bytes.len() + ::core::mem::size_of::<Dirent>()
-            - ::core::mem::size_of_val(&dirent.d_name)) as u64;
-
-        dirent.d_reclen = size as u16;
-        dirent.d_off += dirent.d_reclen as i64;
-
-        return Ok(size);
+        self.offset = pos as usize;
+        buf[..out.len()].copy_from_slice(&out);
+        return Ok(out.len());
     }
 
     pub fn inode(&self) -> Arc<dyn IndexNode> {
@@ -335,8 +525,8 @@ impl File {
             offset: self.offset.clone(),
             mode: self.mode.clone(),
             file_type: self.file_type.clone(),
-            readdir_subdirs_name: self.readdir_subdirs_name.clone(),
             private_data: self.private_data.clone(),
+            ra: self.ra.clone(),
         };
         // 调用inode的open方法，让inode知道有新的文件打开了这个inode
         if self.inode.open(&mut res.private_data, &res.mode).is_err() {
@@ -395,7 +585,10 @@ impl File {
         self.writeable()?;
 
         // 调用inode的truncate方法
-        self.inode.resize(len)?;
+        match self.inode.page_cache() {
+            Some(cache) => cache.resize(len)?,
+            None => self.inode.resize(len)?,
+        }
         return Ok(());
     }
 }
@@ -415,50 +608,132 @@ impl Drop for File {
     }
 }
 
+/// 位图中每个字包含的位数
+const FD_BITS_PER_WORD: usize = u64::BITS as usize;
+
+/// 在位图中，从第`start`位开始查找第一个为0的位。所有的位都为1时，返回位图的总位数（至少为`start`）
+fn find_next_zero_bit(bitmap: &[u64], start: usize) -> usize {
+    let mut word = start / FD_BITS_PER_WORD;
+    if word >= bitmap.len() {
+        return start.max(bitmap.len() * FD_BITS_PER_WORD);
+    }
+    // 忽略start之前的位
+    let mut bits = bitmap[word] | ((1u64 << (start % FD_BITS_PER_WORD)) - 1);
+    loop {
+        if bits != u64::MAX {
+            return word * FD_BITS_PER_WORD + bits.trailing_ones() as usize;
+        }
+        word += 1;
+        if word == bitmap.len() {
+            return word * FD_BITS_PER_WORD;
+        }
+        bits = bitmap[word];
+    }
+}
+
+#[inline]
+fn test_bit(bitmap: &[u64], bit: usize) -> bool {
+    return bitmap[bit / FD_BITS_PER_WORD] & (1 << (bit % FD_BITS_PER_WORD)) != 0;
+}
+
+#[inline]
+fn assign_bit(bitmap: &mut [u64], bit: usize, value: bool) {
+    let mask = 1 << (bit % FD_BITS_PER_WORD);
+    if value {
+        bitmap[bit / FD_BITS_PER_WORD] |= mask;
+    } else {
+        bitmap[bit / FD_BITS_PER_WORD] &= !mask;
+    }
+}
+
+/// 文件描述符表的内容。fork出来的进程写时复制地共享它
+#[derive(Debug, Clone)]
+struct FdTable {
+    /// 文件描述符对应的文件，长度总是FD_BITS_PER_WORD的整数倍
+    fds: Vec<Option<Arc<SpinLock<File>>>>,
+    /// 已经打开的文件描述符的位图
+    open_fds: Vec<u64>,
+    /// execve时需要关闭的文件描述符的位图
+    close_on_exec: Vec<u64>,
+    /// 小于这个值的文件描述符都已经被打开，申请时从这里开始查找
+    next_fd: usize,
+}
+
+impl FdTable {
+    fn new() -> Self {
+        return Self {
+            fds: vec![None; FD_BITS_PER_WORD],
+            open_fds: vec![0; 1],
+            close_on_exec: vec![0; 1],
+            next_fd: 0,
+        };
+    }
+
+    /// 扩展表，使它能够容纳文件描述符`fd`。表的大小按照2的幂增长
+    fn expand(&mut self, fd: usize) {
+        if fd < self.fds.len() {
+            return;
+        }
+        let size = (fd + 1).next_power_of_two().max(FD_BITS_PER_WORD);
+        self.fds.resize(size, None);
+        self.open_fds.resize(size / FD_BITS_PER_WORD, 0);
+        self.close_on_exec.resize(size / FD_BITS_PER_WORD, 0);
+    }
+
+    fn install(&mut self, fd: usize, file: File) {
+        self.expand(fd);
+        let close_on_exec = file.close_on_exec();
+        self.fds[fd] = Some(Arc::new(SpinLock::new(file)));
+        assign_bit(&mut self.open_fds, fd, true);
+        assign_bit(&mut self.close_on_exec, fd, close_on_exec);
+        if fd == self.next_fd {
+            self.next_fd = find_next_zero_bit(&self.open_fds, fd + 1);
+        }
+    }
+}
+
 /// @brief pcb里面的文件描述符数组
+///
+/// 文件描述符表按需增长，空闲的文件描述符通过位图查找。fork时子进程与父进程共享同一张表，
+/// 任何一方第一次修改表的时候才复制它（复制时只增加文件的引用计数，父子进程共享打开的文件，与Linux相同）。
+/// 能够打开的文件描述符的数量受RLIMIT_NOFILE限制
 #[derive(Debug)]
 pub struct FileDescriptorVec {
-    /// 当前进程打开的文件描述符
-    fds: [Option<Arc<SpinLock<File>>>; FileDescriptorVec::PROCESS_MAX_FD],
+    table: Arc<FdTable>,
+    /// RLIMIT_NOFILE
+    nofile: RLimit64,
 }
 
 impl FileDescriptorVec {
-    pub const PROCESS_MAX_FD: usize = 1024;
+    /// 文件描述符的上限（RLIMIT_NOFILE的硬限制最大能设置为这个值）
+    pub const PROCESS_MAX_FD: usize = NR_OPEN as usize;
 
     pub fn new() -> FileDescriptorVec {
-        // 先声明一个未初始化的数组
-        let mut data: [MaybeUninit<Option<Arc<SpinLock<File>>>>;
-            FileDescriptorVec::PROCESS_MAX_FD] = unsafe { MaybeUninit::uninit().assume_init() };
-
-        // 逐个把每个元素初始化为None
-        for i in 0..FileDescriptorVec::PROCESS_MAX_FD {
-            data[i] = MaybeUninit::new(None);
-        }
-        // 由于一切都初始化完毕，因此将未初始化的类型强制转换为已经初始化的类型
-        let data: [Option<Arc<SpinLock<File>>>; FileDescriptorVec::PROCESS_MAX_FD] = unsafe {
-            core::mem::transmute::<
-                _,
-                [Option<Arc<SpinLock<File>>>; FileDescriptorVec::PROCESS_MAX_FD],
-            >(data)
+        return FileDescriptorVec {
+            table: Arc::new(FdTable::new()),
+            nofile: RLimit64 {
+                rlim_cur: INR_OPEN_CUR,
+                rlim_max: INR_OPEN_MAX,
+            },
         };
-
-        // 初始化文件描述符数组结构体
-        return FileDescriptorVec { fds: data };
     }
 
     /// @brief 克隆一个文件描述符数组
     ///
+    /// 克隆出来的数组与原数组共享同一张表，直到其中一方修改它
+    ///
     /// @return FileDescriptorVec 克隆后的文件描述符数组
     pub fn clone(&self) -> FileDescriptorVec {
-        let mut res = FileDescriptorVec::new();
-        for i in 0..FileDescriptorVec::PROCESS_MAX_FD {
-            if let Some(file) = &self.fds[i] {
-                if let Some(file) = file.lock().try_clone() {
-                    res.fds[i] = Some(Arc::new(SpinLock::new(file)));
-                }
-            }
-        }
-        return res;
+        return FileDescriptorVec {
+            table: self.table.clone(),
+            nofile: self.nofile,
+        };
+    }
+
+    /// 获取可以修改的表。表与其他进程共享时，先复制一份
+    #[inline]
+    fn table_mut(&mut self) -> &mut FdTable {
+        return Arc::make_mut(&mut self.table);
     }
 
     /// @brief 判断文件描述符序号是否合法
@@ -468,45 +743,88 @@ impl FileDescriptorVec {
     /// @return false 不合法
     #[inline]
     pub fn validate_fd(fd: i32) -> bool {
-        if fd < 0 || fd as usize > FileDescriptorVec::PROCESS_MAX_FD {
+        if fd < 0 || fd as usize >= FileDescriptorVec::PROCESS_MAX_FD {
             return false;
         } else {
             return true;
         }
     }
 
+    /// 当前能够使用的文件描述符的数量（RLIMIT_NOFILE的软限制）。申请到的文件描述符总是小于这个值
+    #[inline]
+    pub fn max_fds(&self) -> usize {
+        return self
+            .nofile
+            .rlim_cur
+            .min(FileDescriptorVec::PROCESS_MAX_FD as u64) as usize;
+    }
+
+    /// 获取RLIMIT_NOFILE
+    pub fn rlimit_nofile(&self) -> RLimit64 {
+        return self.nofile;
+    }
+
+    /// 设置RLIMIT_NOFILE。已经打开的文件描述符不受影响
+    ///
+    /// ## 错误
+    ///
+    /// - `EINVAL`：软限制大于硬限制
+    /// - `EPERM`：硬限制超过了PROCESS_MAX_FD
+    pub fn set_rlimit_nofile(&mut self, limit: RLimit64) -> Result<(), SystemError> {
+        if limit.rlim_cur > limit.rlim_max {
+            return Err(SystemError::EINVAL);
+        }
+        if limit.rlim_max > FileDescriptorVec::PROCESS_MAX_FD as u64 {
+            return Err(SystemError::EPERM);
+        }
+        self.nofile = limit;
+        return Ok(());
+    }
+
     /// 申请文件描述符，并把文件对象存入其中。
     ///
     /// ## 参数
     ///
     /// - `file` 要存放的文件对象
-    /// - `fd` 如果为Some(i32)，表示指定要申请这个文件描述符，如果这个文件描述符已经被使用，那么返回EBADF
+    /// - `fd` 如果为Some(i32)，表示指定要申请这个文件描述符，如果这个文件描述符已经被使用，
+    ///   或者超出了RLIMIT_NOFILE，那么返回EBADF
     ///
     /// ## 返回值
     ///
     /// - `Ok(i32)` 申请成功，返回申请到的文件描述符
     /// - `Err(SystemError)` 申请失败，返回错误码，并且，file对象将被drop掉
     pub fn alloc_fd(&mut self, file: File, fd: Option<i32>) -> Result<i32, SystemError> {
-        if fd.is_some() {
-            // 指定了要申请的文件描述符编号
-            let new_fd = fd.unwrap();
-            let x = &mut self.fds[new_fd as usize];
-            if x.is_none() {
-                *x = Some(Arc::new(SpinLock::new(file)));
+        match fd {
+            Some(new_fd) => {
+                // 指定了要申请的文件描述符编号
+                if new_fd < 0 || new_fd as usize >= self.max_fds() {
+                    return Err(SystemError::EBADF);
+                }
+                if self.get_file_by_fd(new_fd).is_some() {
+                    return Err(SystemError::EBADF);
+                }
+                self.table_mut().install(new_fd as usize, file);
                 return Ok(new_fd);
-            } else {
-                return Err(SystemError::EBADF);
             }
-        } else {
             // 没有指定要申请的文件描述符编号
-            for i in 0..FileDescriptorVec::PROCESS_MAX_FD {
-                if self.fds[i].is_none() {
-                    self.fds[i] = Some(Arc::new(SpinLock::new(file)));
-                    return Ok(i as i32);
-                }
-            }
+            None => return self.alloc_fd_from(file, 0),
+        }
+    }
+
+    /// 申请不小于`min_fd`的最小的空闲文件描述符，并把文件对象存入其中（F_DUPFD）
+    ///
+    /// ## 返回值
+    ///
+    /// - `Ok(i32)` 申请成功，返回申请到的文件描述符
+    /// - `Err(SystemError::EMFILE)` 没有空闲的文件描述符，file对象将被drop掉
+    pub fn alloc_fd_from(&mut self, file: File, min_fd: usize) -> Result<i32, SystemError> {
+        let start = min_fd.max(self.table.next_fd);
+        let fd = find_next_zero_bit(&self.table.open_fds, start);
+        if fd >= self.max_fds() {
             return Err(SystemError::EMFILE);
         }
+        self.table_mut().install(fd, file);
+        return Ok(fd as i32);
     }
 
     /// 根据文件描述符序号，获取文件结构体的Arc指针
@@ -518,10 +836,10 @@ impl FileDescriptorVec {
         if !FileDescriptorVec::validate_fd(fd) {
             return None;
         }
-        return self.fds[fd as usize].clone();
+        return self.table.fds.get(fd as usize).cloned().flatten();
     }
 
-    /// 释放文件描述符，同时关闭文件。
+    /// 释放文件描述符。没有其他文件描述符（包括其他进程的）引用这个文件时，关闭文件。
     ///
     /// ## 参数
     ///
@@ -535,9 +853,32 @@ impl FileDescriptorVec {
         self.get_file_by_fd(fd).ok_or(SystemError::EBADF)?;
 
         // 把文件描述符数组对应位置设置为空
-        let file = self.fds[fd as usize].take().unwrap();
+        let fd = fd as usize;
+        let table = self.table_mut();
+        let file = table.fds[fd].take();
+        assign_bit(&mut table.open_fds, fd, false);
+        assign_bit(&mut table.close_on_exec, fd, false);
+        table.next_fd = table.next_fd.min(fd);
+        drop(file);
+        return Ok(());
+    }
 
-        assert!(Arc::strong_count(&file) == 1);
+    /// 文件描述符是否设置了FD_CLOEXEC
+    pub fn get_close_on_exec(&self, fd: i32) -> Result<bool, SystemError> {
+        self.get_file_by_fd(fd).ok_or(SystemError::EBADF)?;
+        return Ok(test_bit(&self.table.close_on_exec, fd as usize));
+    }
+
+    /// 设置或清除文件描述符的FD_CLOEXEC。这个标志属于文件描述符，不会影响共享同一个文件的其他文件描述符
+    pub fn set_close_on_exec(&mut self, fd: i32, close_on_exec: bool) -> Result<(), SystemError> {
+        self.get_file_by_fd(fd).ok_or(SystemError::EBADF)?;
+        if test_bit(&self.table.close_on_exec, fd as usize) != close_on_exec {
+            assign_bit(
+                &mut self.table_mut().close_on_exec,
+                fd as usize,
+                close_on_exec,
+            );
+        }
         return Ok(());
     }
 
@@ -547,21 +888,34 @@ impl FileDescriptorVec {
     }
 
     pub fn close_on_exec(&mut self) {
-        for i in 0..FileDescriptorVec::PROCESS_MAX_FD {
-            if let Some(file) = &self.fds[i] {
-                let to_drop = file.lock().close_on_exec();
-                if to_drop {
-                    let r = self.drop_fd(i as i32);
-                    if let Err(r) = r {
-                        kerror!(
-                            "Failed to close file: pid = {:?}, fd = {}, error = {:?}",
-                            ProcessManager::current_pcb().pid(),
-                            i,
-                            r
-                        );
-                    }
+        let mut fd = 0;
+        loop {
+            // 在close_on_exec位图中查找下一个为1的位
+            let words = &self.table.close_on_exec;
+            let mut word = fd / FD_BITS_PER_WORD;
+            if word >= words.len() {
+                return;
+            }
+            let mut bits = words[word] & !((1u64 << (fd % FD_BITS_PER_WORD)) - 1);
+            while bits == 0 {
+                word += 1;
+                if word >= words.len() {
+                    return;
                 }
+                bits = words[word];
+            }
+            fd = word * FD_BITS_PER_WORD + bits.trailing_zeros() as usize;
+
+            let r = self.drop_fd(fd as i32);
+            if let Err(r) = r {
+                kerror!(
+                    "Failed to close file: pid = {:?}, fd = {}, error = {:?}",
+                    ProcessManager::current_pcb().pid(),
+                    fd,
+                    r
+                );
             }
+            fd += 1;
         }
     }
 }
@@ -582,7 +936,7 @@ impl<'a> Iterator for FileDescriptorIterator<'a> {
     type Item = (i32, Arc<SpinLock<File>>);
 
     fn next(&mut self) -> Option<Self::Item> {
-        while self.index < FileDescriptorVec::PROCESS_MAX_FD {
+        while self.index < self.fds.table.fds.len() {
             let fd = self.index as i32;
             self.index += 1;
             if let Some(file) = self.fds.get_file_by_fd(fd) {
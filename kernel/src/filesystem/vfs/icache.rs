@@ -0,0 +1,154 @@
+//! inode缓存
+//!
+//! 具体文件系统从磁盘读到一个目录项之后，先按照（文件系统, 文件在磁盘上的标识）在这里查找已经存在的inode，
+//! 找不到时才创建新的inode。这样同一个文件在内存中只有一个inode对象，元数据、页面缓存等状态都只有一个持有者，
+//! 对热点文件的stat也不需要重新从磁盘构造inode。
+//!
+//! 缓存对每个inode持有一个强引用，按照LRU的顺序淘汰。只有除了缓存之外没有其他人持有、并且没有需要写回的脏页的inode
+//! 才会被淘汰，正在被使用的inode（被打开的文件、挂载点、目录项缓存中的inode、仍有子inode在内存中的目录）
+//! 会一直留在缓存中，因此容量只是一个软上限。
+
+use alloc::{collections::BTreeMap, sync::Arc, vec::Vec};
+
+use crate::libs::spinlock::SpinLock;
+
+use super::IndexNode;
+
+/// 缓存的inode数量超过这个值时，开始淘汰
+const ICACHE_CAPACITY: usize = 4096;
+/// 每次淘汰最多检查的inode数量
+const ICACHE_SCAN_BATCH: usize = 64;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord)]
+struct InodeCacheKey {
+    /// 文件系统对象的地址
+    fs: usize,
+    /// 文件在磁盘上的标识，由具体文件系统定义
+    ino: u64,
+}
+
+impl InodeCacheKey {
+    fn new<F: ?Sized>(fs: &Arc<F>, ino: u64) -> Self {
+        return Self {
+            fs: Arc::as_ptr(fs) as *const () as usize,
+            ino,
+        };
+    }
+}
+
+#[derive(Debug)]
+struct InodeCacheEntry {
+    inode: Arc<dyn IndexNode>,
+    /// 最近一次被使用的时间戳，同时是它在LRU链表中的键
+    stamp: u64,
+}
+
+#[derive(Debug)]
+struct InodeCache {
+    entries: BTreeMap<InodeCacheKey, InodeCacheEntry>,
+    /// LRU链表：时间戳 -> key，时间戳最小的是最久没有被使用的
+    lru: BTreeMap<u64, InodeCacheKey>,
+    clock: u64,
+}
+
+impl InodeCache {
+    const fn new() -> Self {
+        return Self {
+            entries: BTreeMap::new(),
+            lru: BTreeMap::new(),
+            clock: 0,
+        };
+    }
+
+    /// 把inode移动到LRU链表的尾部，并返回它
+    fn touch(&mut self, key: InodeCacheKey) -> Option<Arc<dyn IndexNode>> {
+        let entry = self.entries.get_mut(&key)?;
+        self.lru.remove(&entry.stamp);
+        self.clock += 1;
+        entry.stamp = self.clock;
+        self.lru.insert(self.clock, key);
+        return Some(entry.inode.clone());
+    }
+
+    fn remove(&mut self, key: InodeCacheKey) -> Option<Arc<dyn IndexNode>> {
+        let entry = self.entries.remove(&key)?;
+        self.lru.remove(&entry.stamp);
+        return Some(entry.inode);
+    }
+
+    /// 从LRU链表的头部开始淘汰inode，直到数量不超过容量
+    ///
+    /// 仍在被使用或者有脏页的inode会被移动到链表尾部。被淘汰的inode由调用者在释放锁之后析构
+    fn evict(&mut self) -> Vec<Arc<dyn IndexNode>> {
+        let mut evicted = Vec::new();
+        let candidates: Vec<InodeCacheKey> =
+            self.lru.values().take(ICACHE_SCAN_BATCH).cloned().collect();
+        for key in candidates {
+            if self.entries.len() <= ICACHE_CAPACITY {
+                break;
+            }
+            let inode = &self.entries[&key].inode;
+            let busy = Arc::strong_count(inode) > 1
+                || inode
+                    .page_cache()
+                    .is_some_and(|cache| cache.has_dirty_pages());
+            if busy {
+                self.touch(key);
+            } else {
+                evicted.push(self.remove(key).unwrap());
+            }
+        }
+        return evicted;
+    }
+}
+
+static ICACHE: SpinLock<InodeCache> = SpinLock::new(InodeCache::new());
+
+/// 在inode缓存中查找文件系统`fs`中标识为`ino`的文件的inode
+pub fn icache_get<F: ?Sized>(fs: &Arc<F>, ino: u64) -> Option<Arc<dyn IndexNode>> {
+    return ICACHE.lock().touch(InodeCacheKey::new(fs, ino));
+}
+
+/// 把文件系统`fs`中标识为`ino`的文件的inode加入缓存
+///
+/// ## 返回值
+///
+/// 返回缓存中的inode。如果其他cpu已经加入了同一个文件的inode，则返回先加入的那一个
+pub fn icache_insert<F: ?Sized>(
+    fs: &Arc<F>,
+    ino: u64,
+    inode: Arc<dyn IndexNode>,
+) -> Arc<dyn IndexNode> {
+    let key = InodeCacheKey::new(fs, ino);
+    let mut cache = ICACHE.lock();
+    if let Some(cached) = cache.touch(key) {
+        return cached;
+    }
+
+    cache.clock += 1;
+    let stamp = cache.clock;
+    cache.lru.insert(stamp, key);
+    cache.entries.insert(
+        key,
+        InodeCacheEntry {
+            inode: inode.clone(),
+            stamp,
+        },
+    );
+
+    let evicted = if cache.entries.len() > ICACHE_CAPACITY {
+        cache.evict()
+    } else {
+        Vec::new()
+    };
+    drop(cache);
+    // inode的析构可能会释放页面缓存等资源，在释放锁之后进行
+    drop(evicted);
+    return inode;
+}
+
+/// 把文件系统`fs`中标识为`ino`的文件的inode移出缓存（文件被删除之后调用）
+pub fn icache_remove<F: ?Sized>(fs: &Arc<F>, ino: u64) {
+    let removed = ICACHE.lock().remove(InodeCacheKey::new(fs, ino));
+    drop(removed);
+}
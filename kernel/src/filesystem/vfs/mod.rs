@@ -1,10 +1,17 @@
 pub mod core;
+pub mod dcache;
 pub mod fcntl;
 pub mod file;
+pub mod icache;
 pub mod mount;
 pub mod open;
+pub mod page_cache;
+pub mod poll;
+pub mod seq_file;
+pub mod splice;
 pub mod syscall;
-mod utils;
+pub mod utils;
+pub mod writeback;
 
 use ::core::{any::Any, fmt::Debug, sync::atomic::AtomicUsize};
 
@@ -14,11 +21,18 @@ use crate::{
     driver::base::{block::block_device::BlockDevice, char::CharDevice, device::DeviceNumber},
     ipc::pipe::LockedPipeInode,
     libs::casting::DowncastArc,
+    mm::{
+        syscall::{MapFlags, ProtFlags},
+        VirtAddr,
+    },
     syscall::SystemError,
     time::TimeSpec,
 };
 
-use self::{core::generate_inode_id, file::FileMode, syscall::ModeType};
+use self::{
+    core::generate_inode_id, dcache::DentryCachePolicy, file::FileMode, page_cache::PageCache,
+    poll::PollTable, syscall::ModeType,
+};
 pub use self::{core::ROOT_INODE, file::FilePrivateData, mount::MountFS};
 
 /// vfs容许的最大的路径名称长度
@@ -163,11 +177,75 @@ pub trait IndexNode: Any + Sync + Send + Debug {
         _data: &mut FilePrivateData,
     ) -> Result<usize, SystemError>;
 
+    /// @brief 在inode的指定偏移量开始，把数据依次读入多个缓冲区（readv）
+    ///
+    /// 默认实现在只有一个缓冲区时直接调用read_at，否则先读入临时缓冲区再分散到各个缓冲区，
+    /// 使数据报等需要一次读完的语义保持不变。能直接读入多个缓冲区的inode应该重写这个函数
+    ///
+    /// @return 成功：Ok(读取的字节数)
+    ///         失败：Err(Posix错误码)
+    fn read_vectored_at(
+        &self,
+        offset: usize,
+        bufs: &mut [&mut [u8]],
+        data: &mut FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        if let [buf] = bufs {
+            return self.read_at(offset, buf.len(), buf, data);
+        }
+        let mut tmp = vec![0u8; iov_len(bufs.iter().map(|b| &**b))];
+        let len = self.read_at(offset, tmp.len(), &mut tmp, data)?;
+        scatter_bufs(bufs, &tmp[..len]);
+        return Ok(len);
+    }
+
+    /// @brief 在inode的指定偏移量开始，依次写入多个缓冲区中的数据（writev）
+    ///
+    /// 默认实现在只有一个缓冲区时直接调用write_at，否则先把数据聚合到临时缓冲区，
+    /// 使数据报、原子写入等语义保持不变。能直接写入多个缓冲区的inode应该重写这个函数
+    ///
+    /// @return 成功：Ok(写入的字节数)
+    ///         失败：Err(Posix错误码)
+    fn write_vectored_at(
+        &self,
+        offset: usize,
+        bufs: &[&[u8]],
+        data: &mut FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        if let [buf] = bufs {
+            return self.write_at(offset, buf.len(), buf, data);
+        }
+        let tmp = gather_bufs(bufs);
+        return self.write_at(offset, tmp.len(), &tmp, data);
+    }
+
+    /// @brief 以O_DIRECT的方式写入：绕过文件系统自己的缓冲，返回时数据已经写入设备
+    ///
+    /// 只由页面缓存（[`PageCache::direct_write`]）调用。默认实现与write_at相同
+    ///
+    /// @return 成功：Ok(写入的字节数)
+    ///         失败：Err(Posix错误码)
+    fn direct_write_at(
+        &self,
+        offset: usize,
+        len: usize,
+        buf: &[u8],
+        data: &mut FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        return self.write_at(offset, len, buf, data);
+    }
+
     /// @brief 获取当前inode的状态。
     ///
     /// @return PollStatus结构体
     fn poll(&self) -> Result<PollStatus, SystemError>;
 
+    /// @brief 把等待这个inode的状态发生变化的等待者加入`table`（用于poll、select、epoll）
+    ///
+    /// 状态可能会变化的inode，需要把所有可能使poll的结果发生变化的等待队列都加入`table`，
+    /// 否则poll、select会一直睡眠到超时，epoll也收不到通知。状态不会变化的inode不需要实现这个方法
+    fn poll_wait(&self, _table: &mut PollTable) {}
+
     /// @brief 获取inode的元数据
     ///
     /// @return 成功：Ok(inode的元数据)
@@ -198,6 +276,17 @@ pub trait IndexNode: Any + Sync + Send + Debug {
         return Err(SystemError::EOPNOTSUPP_OR_ENOTSUP);
     }
 
+    /// @brief 为文件[offset, offset + len)范围预先分配磁盘空间（fallocate的默认模式）
+    ///
+    /// 文件大小小于offset + len时被扩展，扩展的部分读出0
+    ///
+    /// @return 成功：Ok()
+    ///         失败：Err(错误码)
+    fn fallocate(&self, _offset: usize, _len: usize) -> Result<(), SystemError> {
+        // 若文件系统没有实现此方法，则返回“不支持”
+        return Err(SystemError::EOPNOTSUPP_OR_ENOTSUP);
+    }
+
     /// @brief 在当前目录下创建一个新的inode
     ///
     /// @param name 目录项的名字
@@ -336,6 +425,27 @@ pub trait IndexNode: Any + Sync + Send + Debug {
         return Err(SystemError::EOPNOTSUPP_OR_ENOTSUP);
     }
 
+    /// @brief 把文件映射到当前进程的地址空间（mmap的文件映射）
+    ///
+    /// 支持页面缓存的文件由内存管理模块直接映射它的页面缓存，不会调用这个函数
+    ///
+    /// @param start_vaddr 用户建议的起始地址
+    /// @param len 映射的长度（字节）
+    /// @param offset 映射从文件中的哪个偏移量开始
+    ///
+    /// @return 成功：Ok(映射的起始地址)
+    ///         失败：Err(错误码)。不支持映射的文件返回ENODEV
+    fn mmap(
+        &self,
+        _start_vaddr: VirtAddr,
+        _len: usize,
+        _prot_flags: ProtFlags,
+        _map_flags: MapFlags,
+        _offset: usize,
+    ) -> Result<usize, SystemError> {
+        return Err(SystemError::ENODEV);
+    }
+
     /// @brief 获取inode所在的文件系统的指针
     fn fs(&self) -> Arc<dyn FileSystem>;
 
@@ -346,6 +456,30 @@ pub trait IndexNode: Any + Sync + Send + Debug {
     /// @brief 列出当前inode下的所有目录项的名字
     fn list(&self) -> Result<Vec<String>, SystemError>;
 
+    /// @brief 从位置`pos`开始遍历当前目录下的目录项
+    ///
+    /// 每遍历到一个目录项，调用一次`emit(名字, inode号, 文件类型, 下一项的位置)`，
+    /// `emit`返回false时停止遍历。位置0表示目录的开头，其余位置的含义由文件系统决定，
+    /// 只保证以`emit`给出的位置再次调用本函数时，从下一个目录项继续遍历
+    ///
+    /// 默认实现以排序后的list中的下标作为位置，每次调用都需要list并且逐个find，
+    /// 如果有条件，请在文件系统中直接从位置处继续遍历目录
+    fn readdir(
+        &self,
+        pos: u64,
+        emit: &mut dyn FnMut(&str, InodeId, FileType, u64) -> bool,
+    ) -> Result<(), SystemError> {
+        let mut names = self.list()?;
+        names.sort();
+        for (i, name) in names.iter().enumerate().skip(pos as usize) {
+            let metadata = self.find(name)?.metadata()?;
+            if !emit(name, metadata.inode_id, metadata.file_type, i as u64 + 1) {
+                break;
+            }
+        }
+        return Ok(());
+    }
+
     /// @brief 在当前Inode下，挂载一个新的文件系统
     /// 请注意！该函数只能被MountFS实现，其他文件系统不应实现这个函数
     fn mount(&self, _fs: Arc<dyn FileSystem>) -> Result<Arc<MountFS>, SystemError> {
@@ -364,6 +498,13 @@ pub trait IndexNode: Any + Sync + Send + Debug {
         return Ok(());
     }
 
+    /// @brief 将当前inode的数据，以及读取这些数据所必需的元数据同步到具体设备上（fdatasync）
+    ///
+    /// 默认与sync相同
+    fn datasync(&self) -> Result<(), SystemError> {
+        return self.sync();
+    }
+
     /// ## 创建一个特殊文件节点
     /// - _filename: 文件名
     /// - _mode: 权限信息
@@ -380,6 +521,14 @@ pub trait IndexNode: Any + Sync + Send + Debug {
     fn special_node(&self) -> Option<SpecialNodeData> {
         None
     }
+
+    /// @brief 获取文件数据的页面缓存
+    ///
+    /// 返回Some时，File的读写、截断会经过页面缓存，此时inode自己的read_at/write_at作为缓存的后端。
+    /// 不支持页面缓存的文件（设备、管道、procfs等）返回None
+    fn page_cache(&self) -> Option<Arc<PageCache>> {
+        None
+    }
 }
 
 impl DowncastArc for dyn IndexNode {
@@ -425,10 +574,10 @@ impl dyn IndexNode {
         // result: 上一个被找到的inode
         // rest_path: 还没有查找的路径
         let (mut result, mut rest_path) = if let Some(rest) = path.strip_prefix('/') {
-            (ROOT_INODE().clone(), String::from(rest))
+            (ROOT_INODE().clone(), rest)
         } else {
             // 是相对路径
-            (self.find(".")?, String::from(path))
+            (self.find(".")?, path)
         };
 
         // 逐级查找文件
@@ -444,13 +593,13 @@ impl dyn IndexNode {
             match rest_path.find('/') {
                 Some(pos) => {
                     // 找到了，设置下一个要查找的名字
-                    name = String::from(&rest_path[0..pos]);
+                    name = &rest_path[0..pos];
                     // 剩余的路径字符串
-                    rest_path = String::from(&rest_path[pos + 1..]);
+                    rest_path = &rest_path[pos + 1..];
                 }
                 None => {
                     name = rest_path;
-                    rest_path = String::new();
+                    rest_path = "";
                 }
             }
 
@@ -459,7 +608,7 @@ impl dyn IndexNode {
                 continue;
             }
 
-            let inode = result.find(&name)?;
+            let inode = result.find(name)?;
 
             // 处理符号链接的问题
             if inode.metadata()?.file_type == FileType::SymLink && max_follow_times > 0 {
@@ -472,7 +621,7 @@ impl dyn IndexNode {
                     ::core::str::from_utf8(&content[..len]).map_err(|_| SystemError::ENOTDIR)?,
                 );
 
-                let new_path = link_path + "/" + &rest_path;
+                let new_path = link_path + "/" + rest_path;
                 // 继续查找符号链接
                 return result.lookup_follow_symlink(&new_path, max_follow_times - 1);
             } else {
@@ -566,6 +715,18 @@ pub trait FileSystem: Any + Sync + Send + Debug {
     /// @brief 本函数用于实现动态转换。
     /// 具体的文件系统在实现本函数时，最简单的方式就是：直接返回self
     fn as_any_ref(&self) -> &dyn Any;
+
+    /// @brief 获取当前文件系统使用目录项缓存的方式
+    ///
+    /// 只有目录内容只会通过VFS的接口修改的文件系统才能启用目录项缓存，默认不启用
+    fn dentry_cache_policy(&self) -> DentryCachePolicy {
+        return DentryCachePolicy::Disabled;
+    }
+
+    /// @brief 把文件系统缓存在内存中的元数据（例如FAT表）写回磁盘
+    fn sync(&self) -> Result<(), SystemError> {
+        return Ok(());
+    }
 }
 
 impl DowncastArc for dyn FileSystem {
@@ -598,6 +759,39 @@ pub struct Dirent {
     d_name: u8,    // 文件entry的名字(是一个零长数组)， 本字段仅用于占位
 }
 
+impl Dirent {
+    /// d_name在结构体中的偏移量
+    const NAME_OFFSET: usize = 19;
+
+    /// @brief 把一个目录项追加到`buf`的末尾。记录的长度（d_reclen）按照8字节对齐
+    ///
+    /// @param limit `buf`的最大长度
+    /// @param off 下一个目录项的位置
+    ///
+    /// @return 追加之后放不下时返回false，并且不修改`buf`
+    pub fn append(
+        buf: &mut Vec<u8>,
+        limit: usize,
+        ino: InodeId,
+        off: u64,
+        file_type: FileType,
+        name: &str,
+    ) -> bool {
+        let reclen = (Self::NAME_OFFSET + name.len() + 1 + 7) & !7;
+        if buf.len() + reclen > limit {
+            return false;
+        }
+        let start = buf.len();
+        buf.extend_from_slice(&(ino.into() as u64).to_ne_bytes());
+        buf.extend_from_slice(&(off as i64).to_ne_bytes());
+        buf.extend_from_slice(&(reclen as u16).to_ne_bytes());
+        buf.push(file_type.get_file_type_num() as u8);
+        buf.extend_from_slice(name.as_bytes());
+        buf.resize(start + reclen, 0);
+        return true;
+    }
+}
+
 impl Metadata {
     pub fn new(file_type: FileType, mode: ModeType) -> Self {
         Metadata {
@@ -618,3 +812,31 @@ impl Metadata {
         }
     }
 }
+
+/// @brief 多个缓冲区的总长度
+pub fn iov_len<'a>(bufs: impl Iterator<Item = &'a [u8]>) -> usize {
+    return bufs.map(|b| b.len()).sum();
+}
+
+/// @brief 把多个缓冲区中的数据聚合到一个新的缓冲区中
+pub fn gather_bufs(bufs: &[&[u8]]) -> Vec<u8> {
+    let mut buf = Vec::with_capacity(iov_len(bufs.iter().copied()));
+    for b in bufs {
+        buf.extend_from_slice(b);
+    }
+    return buf;
+}
+
+/// @brief 把数据依次分散写入多个缓冲区，返回写入的字节数
+pub fn scatter_bufs(bufs: &mut [&mut [u8]], mut data: &[u8]) -> usize {
+    let total = data.len();
+    for b in bufs.iter_mut() {
+        if data.is_empty() {
+            break;
+        }
+        let len = ::core::cmp::min(b.len(), data.len());
+        b[..len].copy_from_slice(&data[..len]);
+        data = &data[len..];
+    }
+    return total - data.len();
+}
@@ -1,27 +1,57 @@
 use core::{
     any::Any,
-    sync::atomic::{compiler_fence, Ordering},
+    sync::atomic::{compiler_fence, AtomicUsize, Ordering},
 };
 
 use alloc::{
-    collections::BTreeMap,
     sync::{Arc, Weak},
+    vec::Vec,
+};
+use hashbrown::HashMap;
+
+use crate::{
+    driver::base::device::DeviceNumber,
+    libs::{
+        rcu::{rcu_read_lock, RcuCell},
+        spinlock::SpinLock,
+    },
+    mm::{
+        syscall::{MapFlags, ProtFlags},
+        VirtAddr,
+    },
+    syscall::SystemError,
 };
-
-use crate::{driver::base::device::DeviceNumber, libs::spinlock::SpinLock, syscall::SystemError};
 
 use super::{
-    file::FileMode, syscall::ModeType, FilePrivateData, FileSystem, FileType, IndexNode, InodeId,
+    dcache::{d_insert, d_invalidate, d_lookup, DentryCachePolicy, DentryKey, DentryLookup},
+    file::FileMode,
+    page_cache::PageCache,
+    syscall::ModeType,
+    FilePrivateData, FileSystem, FileType, IndexNode, InodeId,
 };
 
+/// 挂载哈希表的键：（挂载点所在的MountFS的地址，挂载点的inode号）
+type MountKey = (usize, InodeId);
+
+/// 全局的挂载哈希表：挂载点 -> 挂载到这个挂载点的MountFS
+///
+/// 路径查找向下经过的每一个目录都要查询它，因此通过RCU发布：读者只需要进入读临界区，不写任何共享的缓存行。
+/// 挂载很少发生，写者在`MOUNT_HASH_WRITER`的保护下复制整张表、修改之后再发布新表，旧表在宽限期之后释放。
+/// 表中的子MountFS通过self_mountpoint持有父MountFS，所以键中的父MountFS的地址在表项存在期间不会被复用
+static MOUNT_HASH: RcuCell<HashMap<MountKey, Arc<MountFS>>> = RcuCell::empty();
+/// 串行化`MOUNT_HASH`的写者
+static MOUNT_HASH_WRITER: SpinLock<()> = SpinLock::new(());
+
 /// @brief 挂载文件系统
 /// 挂载文件系统的时候，套了MountFS这一层，以实现文件系统的递归挂载
 #[derive(Debug)]
 pub struct MountFS {
     // MountFS内部的文件系统
     inner_filesystem: Arc<dyn FileSystem>,
-    /// 用来存储InodeID->挂载点的MountFS的B树
-    mountpoints: SpinLock<BTreeMap<InodeId, Arc<MountFS>>>,
+    /// 挂载在当前文件系统中的子文件系统（查找挂载点使用全局的MOUNT_HASH，这里只用于遍历）
+    mountpoints: SpinLock<Vec<Arc<MountFS>>>,
+    /// 当前文件系统中挂载点的数量。为0时路径查找不需要查询挂载哈希表
+    nr_mountpoints: AtomicUsize,
     /// 当前文件系统挂载到的那个挂载点的Inode
     self_mountpoint: Option<Arc<MountFSInode>>,
     /// 指向当前MountFS的弱引用
@@ -46,7 +76,8 @@ impl MountFS {
     ) -> Arc<Self> {
         return MountFS {
             inner_filesystem: inner_fs,
-            mountpoints: SpinLock::new(BTreeMap::new()),
+            mountpoints: SpinLock::new(Vec::new()),
+            nr_mountpoints: AtomicUsize::new(0),
             self_mountpoint: self_mountpoint,
             self_ref: Weak::default(),
         }
@@ -84,6 +115,18 @@ impl MountFS {
     pub fn inner_filesystem(&self) -> Arc<dyn FileSystem> {
         return self.inner_filesystem.clone();
     }
+
+    /// @brief 查找挂载在当前文件系统的`inode_id`处的子文件系统
+    fn lookup_mount(&self, inode_id: InodeId) -> Option<Arc<MountFS>> {
+        if self.nr_mountpoints.load(Ordering::Acquire) == 0 {
+            return None;
+        }
+        let key = (self as *const Self as usize, inode_id);
+        let guard = rcu_read_lock();
+        return MOUNT_HASH
+            .get(&guard)
+            .and_then(|hash| hash.get(&key).cloned());
+    }
 }
 
 impl MountFSInode {
@@ -120,14 +163,57 @@ impl MountFSInode {
     ///
     /// @return Arc<MountFSInode>
     fn overlaid_inode(&self) -> Arc<MountFSInode> {
+        // 大多数文件系统中没有挂载点，此时不需要获取inode的元数据
+        if self.mount_fs.nr_mountpoints.load(Ordering::Acquire) == 0 {
+            return self.self_ref.upgrade().unwrap();
+        }
         let inode_id = self.metadata().unwrap().inode_id;
 
-        if let Some(sub_mountfs) = self.mount_fs.mountpoints.lock().get(&inode_id) {
+        if let Some(sub_mountfs) = self.mount_fs.lookup_mount(inode_id) {
             return sub_mountfs.mountpoint_root_inode();
         } else {
             return self.self_ref.upgrade().unwrap();
         }
     }
+
+    /// @brief 获取目录`dir`下名为`name`的目录项在目录项缓存中的key
+    ///
+    /// @return None 当前文件系统不使用目录项缓存
+    fn dentry_key(&self, dir: &dyn IndexNode, name: &str) -> Option<DentryKey> {
+        let inner_fs = &self.mount_fs.inner_filesystem;
+        let name = inner_fs.dentry_cache_policy().key_name(name)?;
+        let parent = dir.metadata().ok()?.inode_id;
+        let fs = Arc::as_ptr(inner_fs) as *const () as usize;
+        return Some(DentryKey::new(fs, parent, &name));
+    }
+
+    /// @brief 目录`dir`下名为`name`的文件被创建、删除或者重命名之后，使对应的目录项失效
+    fn dentry_invalidate(&self, dir: &dyn IndexNode, name: &str) {
+        if let Some(key) = self.dentry_key(dir, name) {
+            d_invalidate(&key);
+        }
+    }
+
+    /// @brief 在具体文件系统的当前目录下查找名为`name`的inode，优先查询目录项缓存
+    fn find_inner(&self, name: &str) -> Result<Arc<dyn IndexNode>, SystemError> {
+        let key = match self.dentry_key(self.inner_inode.as_ref(), name) {
+            Some(key) => key,
+            None => return self.inner_inode.find(name),
+        };
+        let seq = match d_lookup(&key) {
+            DentryLookup::Found(inode) => return Ok(inode),
+            DentryLookup::Negative => return Err(SystemError::ENOENT),
+            DentryLookup::Miss(seq) => seq,
+        };
+
+        let r = self.inner_inode.find(name);
+        match &r {
+            Ok(inode) => d_insert(key, Some(inode.clone()), seq),
+            Err(SystemError::ENOENT) => d_insert(key, None, seq),
+            Err(_) => {}
+        }
+        return r;
+    }
 }
 
 impl IndexNode for MountFSInode {
@@ -146,10 +232,12 @@ impl IndexNode for MountFSInode {
         mode: ModeType,
         data: usize,
     ) -> Result<Arc<dyn IndexNode>, SystemError> {
+        let inner_inode = self
+            .inner_inode
+            .create_with_data(name, file_type, mode, data);
+        self.dentry_invalidate(self.inner_inode.as_ref(), name);
         return Ok(MountFSInode {
-            inner_inode: self
-                .inner_inode
-                .create_with_data(name, file_type, mode, data)?,
+            inner_inode: inner_inode?,
             mount_fs: self.mount_fs.clone(),
             self_ref: Weak::default(),
         }
@@ -180,6 +268,16 @@ impl IndexNode for MountFSInode {
         return self.inner_inode.write_at(offset, len, buf, data);
     }
 
+    fn direct_write_at(
+        &self,
+        offset: usize,
+        len: usize,
+        buf: &[u8],
+        data: &mut FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        return self.inner_inode.direct_write_at(offset, len, buf, data);
+    }
+
     #[inline]
     fn poll(&self) -> Result<super::PollStatus, SystemError> {
         return self.inner_inode.poll();
@@ -210,6 +308,11 @@ impl IndexNode for MountFSInode {
         return self.inner_inode.resize(len);
     }
 
+    #[inline]
+    fn fallocate(&self, offset: usize, len: usize) -> Result<(), SystemError> {
+        return self.inner_inode.fallocate(offset, len);
+    }
+
     #[inline]
     fn create(
         &self,
@@ -217,8 +320,10 @@ impl IndexNode for MountFSInode {
         file_type: FileType,
         mode: ModeType,
     ) -> Result<Arc<dyn IndexNode>, SystemError> {
+        let inner_inode = self.inner_inode.create(name, file_type, mode);
+        self.dentry_invalidate(self.inner_inode.as_ref(), name);
         return Ok(MountFSInode {
-            inner_inode: self.inner_inode.create(name, file_type, mode)?,
+            inner_inode: inner_inode?,
             mount_fs: self.mount_fs.clone(),
             self_ref: Weak::default(),
         }
@@ -226,7 +331,9 @@ impl IndexNode for MountFSInode {
     }
 
     fn link(&self, name: &str, other: &Arc<dyn IndexNode>) -> Result<(), SystemError> {
-        return self.inner_inode.link(name, other);
+        let r = self.inner_inode.link(name, other);
+        self.dentry_invalidate(self.inner_inode.as_ref(), name);
+        return r;
     }
 
     /// @brief 在挂载文件系统中删除文件/文件夹
@@ -235,11 +342,13 @@ impl IndexNode for MountFSInode {
         let inode_id = self.inner_inode.find(name)?.metadata()?.inode_id;
 
         // 先检查这个inode是否为一个挂载点，如果当前inode是一个挂载点，那么就不能删除这个inode
-        if self.mount_fs.mountpoints.lock().contains_key(&inode_id) {
+        if self.mount_fs.lookup_mount(inode_id).is_some() {
             return Err(SystemError::EBUSY);
         }
         // 调用内层的inode的方法来删除这个inode
-        return self.inner_inode.unlink(name);
+        let r = self.inner_inode.unlink(name);
+        self.dentry_invalidate(self.inner_inode.as_ref(), name);
+        return r;
     }
 
     #[inline]
@@ -247,11 +356,12 @@ impl IndexNode for MountFSInode {
         let inode_id = self.inner_inode.find(name)?.metadata()?.inode_id;
 
         // 先检查这个inode是否为一个挂载点，如果当前inode是一个挂载点，那么就不能删除这个inode
-        if self.mount_fs.mountpoints.lock().contains_key(&inode_id) {
+        if self.mount_fs.lookup_mount(inode_id).is_some() {
             return Err(SystemError::EBUSY);
         }
         // 调用内层的rmdir的方法来删除这个inode
         let r = self.inner_inode.rmdir(name);
+        self.dentry_invalidate(self.inner_inode.as_ref(), name);
 
         return r;
     }
@@ -263,7 +373,10 @@ impl IndexNode for MountFSInode {
         target: &Arc<dyn IndexNode>,
         new_name: &str,
     ) -> Result<(), SystemError> {
-        return self.inner_inode.move_(old_name, target, new_name);
+        let r = self.inner_inode.move_(old_name, target, new_name);
+        self.dentry_invalidate(self.inner_inode.as_ref(), old_name);
+        self.dentry_invalidate(target.as_ref(), new_name);
+        return r;
     }
 
     fn find(&self, name: &str) -> Result<Arc<dyn IndexNode>, SystemError> {
@@ -294,10 +407,10 @@ impl IndexNode for MountFSInode {
             }
             // 在当前目录下查找
             _ => {
-                // 直接调用当前inode所在的文件系统的find方法进行查找
+                // 通过目录项缓存或当前inode所在的文件系统的find方法进行查找
                 // 由于向下查找可能会跨越文件系统的边界，因此需要尝试替换inode
                 return Ok(MountFSInode {
-                    inner_inode: self.inner_inode.find(name)?,
+                    inner_inode: self.find_inner(name)?,
                     mount_fs: self.mount_fs.clone(),
                     self_ref: Weak::default(),
                 }
@@ -325,11 +438,33 @@ impl IndexNode for MountFSInode {
         return self.inner_inode.ioctl(cmd, data);
     }
 
+    fn mmap(
+        &self,
+        start_vaddr: VirtAddr,
+        len: usize,
+        prot_flags: ProtFlags,
+        map_flags: MapFlags,
+        offset: usize,
+    ) -> Result<usize, SystemError> {
+        return self
+            .inner_inode
+            .mmap(start_vaddr, len, prot_flags, map_flags, offset);
+    }
+
     #[inline]
     fn list(&self) -> Result<alloc::vec::Vec<alloc::string::String>, SystemError> {
         return self.inner_inode.list();
     }
 
+    #[inline]
+    fn readdir(
+        &self,
+        pos: u64,
+        emit: &mut dyn FnMut(&str, InodeId, FileType, u64) -> bool,
+    ) -> Result<(), SystemError> {
+        return self.inner_inode.readdir(pos, emit);
+    }
+
     /// @brief 在当前inode下，挂载一个文件系统
     ///
     /// @return Ok(Arc<MountFS>) 挂载成功，返回指向MountFS的指针
@@ -341,11 +476,25 @@ impl IndexNode for MountFSInode {
 
         // 为新的挂载点创建挂载文件系统
         let new_mount_fs: Arc<MountFS> = MountFS::new(fs, Some(self.self_ref.upgrade().unwrap()));
-        // 将新的挂载点-挂载文件系统添加到父级的挂载树
-        self.mount_fs
-            .mountpoints
-            .lock()
-            .insert(metadata.inode_id, new_mount_fs.clone());
+        // 将新的挂载点-挂载文件系统添加到全局的挂载哈希表
+        let key = (Arc::as_ptr(&self.mount_fs) as usize, metadata.inode_id);
+        let writer = MOUNT_HASH_WRITER.lock();
+        let mut hash = MOUNT_HASH
+            .get_arc()
+            .map(|hash| (*hash).clone())
+            .unwrap_or_default();
+        let old = hash.insert(key, new_mount_fs.clone());
+        MOUNT_HASH.replace(Some(Arc::new(hash)));
+        drop(writer);
+        let mut mountpoints = self.mount_fs.mountpoints.lock();
+        match old {
+            // 在同一个挂载点上重新挂载，覆盖原来的文件系统
+            Some(old) => mountpoints.retain(|m| !Arc::ptr_eq(m, &old)),
+            None => {
+                self.mount_fs.nr_mountpoints.fetch_add(1, Ordering::Release);
+            }
+        }
+        mountpoints.push(new_mount_fs.clone());
         return Ok(new_mount_fs);
     }
 
@@ -356,8 +505,10 @@ impl IndexNode for MountFSInode {
         mode: ModeType,
         dev_t: DeviceNumber,
     ) -> Result<Arc<dyn IndexNode>, SystemError> {
+        let inner_inode = self.inner_inode.mknod(filename, mode, dev_t);
+        self.dentry_invalidate(self.inner_inode.as_ref(), filename);
         return Ok(MountFSInode {
-            inner_inode: self.inner_inode.mknod(filename, mode, dev_t)?,
+            inner_inode: inner_inode?,
             mount_fs: self.mount_fs.clone(),
             self_ref: Weak::default(),
         }
@@ -368,6 +519,21 @@ impl IndexNode for MountFSInode {
     fn special_node(&self) -> Option<super::SpecialNodeData> {
         self.inner_inode.special_node()
     }
+
+    #[inline]
+    fn sync(&self) -> Result<(), SystemError> {
+        return self.inner_inode.sync();
+    }
+
+    #[inline]
+    fn datasync(&self) -> Result<(), SystemError> {
+        return self.inner_inode.datasync();
+    }
+
+    #[inline]
+    fn page_cache(&self) -> Option<Arc<PageCache>> {
+        return self.inner_inode.page_cache();
+    }
 }
 
 impl FileSystem for MountFS {
@@ -388,4 +554,18 @@ impl FileSystem for MountFS {
     fn as_any_ref(&self) -> &dyn Any {
         self
     }
+
+    fn dentry_cache_policy(&self) -> DentryCachePolicy {
+        return self.inner_filesystem.dentry_cache_policy();
+    }
+
+    /// @brief 同步当前文件系统，以及挂载在它下面的所有文件系统
+    fn sync(&self) -> Result<(), SystemError> {
+        self.inner_filesystem.sync()?;
+        let mounts: Vec<Arc<MountFS>> = self.mountpoints.lock().clone();
+        for mount in mounts {
+            mount.sync()?;
+        }
+        return Ok(());
+    }
 }
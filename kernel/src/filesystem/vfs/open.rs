@@ -84,6 +84,29 @@ fn do_sys_openat2(
     how: OpenHow,
     follow_symlink: bool,
 ) -> Result<usize, SystemError> {
+    let file = do_open_file(dirfd, path, how, follow_symlink)?;
+    // 把文件对象存入pcb
+    let r = ProcessManager::current_pcb()
+        .fd_table()
+        .write()
+        .alloc_fd(file, None)
+        .map(|fd| fd as usize);
+
+    return r;
+}
+
+/// 以当前进程的身份打开文件，返回文件对象（不分配文件描述符）
+pub fn open_file(path: &str, o_flags: FileMode, mode: ModeType) -> Result<File, SystemError> {
+    let how = OpenHow::new(o_flags, mode, OpenHowResolve::empty());
+    return do_open_file(AtFlags::AT_FDCWD.bits(), path, how, true);
+}
+
+fn do_open_file(
+    dirfd: i32,
+    path: &str,
+    how: OpenHow,
+    follow_symlink: bool,
+) -> Result<File, SystemError> {
     // kdebug!("open: path: {}, mode: {:?}", path, mode);
     // 文件名过长
     if path.len() > MAX_PATHLEN as usize {
@@ -147,12 +170,5 @@ fn do_sys_openat2(
     {
         file.ftruncate(0)?;
     }
-    // 把文件对象存入pcb
-    let r = ProcessManager::current_pcb()
-        .fd_table()
-        .write()
-        .alloc_fd(file, None)
-        .map(|fd| fd as usize);
-
-    return r;
+    return Ok(file);
 }
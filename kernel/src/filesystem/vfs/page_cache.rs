@@ -0,0 +1,1143 @@
+//! 文件数据的页面缓存
+//!
+//! 支持页面缓存的文件（目前是FAT文件系统和ramfs上的普通文件）拥有一个[`PageCache`]，以页为单位缓存文件数据，
+//! 缓存页以页号为键保存在B树中。`read`、`write`以及文件映射（mmap）使用的是同一份缓存页：
+//!
+//! - 读：缓存命中时直接拷贝，否则先从文件系统读入整页。每个打开的文件记录自己的访问模式
+//!   （[`ReadaheadState`]），顺序读的时候预读后面的页面，见[`PageCache::read`]
+//! - 写：只修改缓存页并把它标记为脏页，由后备设备的flusher线程写回（见[`super::writeback`]）。
+//!   以O_SYNC/O_DSYNC打开的文件在每次写入后立即写回。超出文件末尾的写入也只写入缓存页（延迟分配），
+//!   缓存记录扩展后的文件大小，文件系统在写回时才分配空间、更新文件大小
+//! - 截断：丢弃新长度之后的缓存页（包括脏页），并清零边界页中文件末尾之后的部分
+//! - 文件映射（见[`FileMapping`]）在缺页时才映射缓存页：共享映射直接映射缓存页，
+//!   私有映射只读地映射缓存页，写入时复制
+//! - 内存不足时，由shrinker回收干净的、没有被映射的缓存页
+//!
+//! - O_DIRECT：读之前写回范围内的脏页，然后直接从文件系统读入用户的缓冲区；写入直接交给文件系统写入设备，
+//!   之后丢弃缓存中被覆盖的页（被映射的页更新为新的数据），见[`PageCache::direct_read`]、[`PageCache::direct_write`]
+//!
+//! 文件系统自身的`read_at`/`write_at`是缓存的后端，不经过缓存，供缓存读入和写回使用。
+//!
+//! 没有后备存储的文件系统（ramfs）使用[`PageCache::new_memory`]创建的缓存：缓存页就是文件的全部数据，
+//! 不在缓存中的页是文件中的空洞（读出0，写入时才分配）。这样的缓存从不读入、写回，缓存页也不会被回收。
+
+use core::{
+    cmp::{max, min},
+    ops::Range,
+    sync::atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering},
+};
+
+use alloc::{
+    collections::BTreeMap,
+    sync::{Arc, Weak},
+    vec,
+    vec::Vec,
+};
+
+use crate::{
+    arch::{mm::LockedFrameAllocator, MMArch},
+    kinfo,
+    libs::{align::page_align_up, spinlock::SpinLock},
+    mm::{
+        allocator::page_frame::{FrameAllocator, PageFrameCount},
+        reclaim::{register_shrinker, Shrinker},
+        MemoryManagementArch, PhysAddr, VirtAddr,
+    },
+    process::workqueue::{system_unbound_wq, Work},
+    sched::core::cond_resched,
+    syscall::SystemError,
+    time::timer::clock,
+};
+
+use super::{
+    file::FilePrivateData,
+    writeback::{balance_dirty_pages, writeback_init, BackingDevInfo},
+    IndexNode,
+};
+
+const PAGE_SIZE: usize = MMArch::PAGE_SIZE;
+
+/// 预读窗口的初始大小（页）
+const READAHEAD_MIN_PAGES: usize = 4;
+/// 预读窗口的最大大小（页）。以顺序访问为建议的文件（POSIX_FADV_SEQUENTIAL）可以使用两倍的窗口
+const READAHEAD_MAX_PAGES: usize = 32;
+/// 一次从文件系统读入的最大页数
+const POPULATE_BATCH_PAGES: usize = 64;
+/// 等待处理的异步预读请求数量的上限，超过时丢弃新的异步预读请求
+const READAHEAD_QUEUE_MAX: usize = 64;
+/// 文件映射缺页时，连同后面的页面一起读入的页数
+const MMAP_READAROUND_PAGES: usize = 16;
+
+/// 所有缓存页（包括私有映射的副本）占用的页帧数量
+static NR_CACHE_PAGES: AtomicUsize = AtomicUsize::new(0);
+/// 所有的脏页数量（不包括被共享映射写入过、但是没有被标记为脏页的页）
+static NR_DIRTY_PAGES: AtomicUsize = AtomicUsize::new(0);
+/// 所有的页面缓存，供shrinker遍历
+static PAGE_CACHES: SpinLock<Vec<Weak<PageCache>>> = SpinLock::new(Vec::new());
+
+/// 等待处理的异步预读请求
+static READAHEAD_QUEUE: SpinLock<Vec<ReadaheadWork>> = SpinLock::new(Vec::new());
+
+lazy_static! {
+    /// 处理READAHEAD_QUEUE中的请求的work
+    static ref READAHEAD_WORK: Arc<Work> = Work::new(readahead_work);
+}
+
+/// 获取缓存页占用的页帧数量
+pub fn page_cache_nr_pages() -> usize {
+    return NR_CACHE_PAGES.load(Ordering::Relaxed);
+}
+
+/// 获取脏页的数量
+pub fn page_cache_nr_dirty() -> usize {
+    return NR_DIRTY_PAGES.load(Ordering::Relaxed);
+}
+
+/// 一个缓存页
+#[derive(Debug)]
+pub struct CachePage {
+    paddr: PhysAddr,
+    /// 页面被写入之后，还没有写回
+    dirty: AtomicBool,
+    /// 页面变脏的时间（jiffies）
+    dirtied_when: AtomicU64,
+    /// 最近被访问过。shrinker遇到这样的页时只清除标志，下一次才回收（二次机会）
+    referenced: AtomicBool,
+    /// 写入过这一页、并且仍然映射着它的共享文件映射的数量。
+    /// 大于0时，页面随时可能被用户程序修改，因此写回时总是被视为脏页
+    shared_writers: AtomicUsize,
+}
+
+impl CachePage {
+    /// 分配一个清零的缓存页
+    fn new() -> Result<Arc<Self>, SystemError> {
+        let (paddr, _) = unsafe { LockedFrameAllocator.allocate(PageFrameCount::new(1)) }
+            .ok_or(SystemError::ENOMEM)?;
+        unsafe { MMArch::write_bytes(MMArch::phys_2_virt(paddr).unwrap(), 0, PAGE_SIZE) };
+        NR_CACHE_PAGES.fetch_add(1, Ordering::Relaxed);
+        return Ok(Arc::new(Self {
+            paddr,
+            dirty: AtomicBool::new(false),
+            dirtied_when: AtomicU64::new(0),
+            referenced: AtomicBool::new(true),
+            shared_writers: AtomicUsize::new(0),
+        }));
+    }
+
+    #[inline]
+    fn as_ptr(&self) -> *mut u8 {
+        return unsafe { MMArch::phys_2_virt(self.paddr).unwrap().data() as *mut u8 };
+    }
+
+    /// 页面的内容
+    ///
+    /// ## Safety
+    ///
+    /// 页面可能被其他cpu或者用户程序同时修改，调用者只能把它当作一段普通的内存来拷贝
+    #[inline]
+    unsafe fn as_slice_mut(&self) -> &mut [u8] {
+        return core::slice::from_raw_parts_mut(self.as_ptr(), PAGE_SIZE);
+    }
+
+    /// 从页内偏移量`offset`开始，把数据读到`buf`中
+    fn read(&self, offset: usize, buf: &mut [u8]) {
+        self.referenced.store(true, Ordering::Relaxed);
+        buf.copy_from_slice(unsafe { &self.as_slice_mut()[offset..offset + buf.len()] });
+    }
+
+    /// 从页内偏移量`offset`开始，写入`buf`中的数据
+    fn write(&self, offset: usize, buf: &[u8]) {
+        self.referenced.store(true, Ordering::Relaxed);
+        unsafe { self.as_slice_mut()[offset..offset + buf.len()].copy_from_slice(buf) };
+    }
+
+    /// 把页面标记为脏页
+    fn set_dirty(&self) {
+        if !self.dirty.swap(true, Ordering::SeqCst) {
+            self.dirtied_when.store(clock(), Ordering::Relaxed);
+            NR_DIRTY_PAGES.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+
+    /// 清除脏页标志
+    fn clear_dirty(&self) {
+        if self.dirty.swap(false, Ordering::SeqCst) {
+            NR_DIRTY_PAGES.fetch_sub(1, Ordering::Relaxed);
+        }
+    }
+
+    /// 页面是否需要由`expire`时间之前的写回处理
+    fn expired(&self, expire: Option<u64>) -> bool {
+        if !self.need_writeback() {
+            return false;
+        }
+        return match expire {
+            None => true,
+            // 被共享映射写入过的页面随时可能被修改，每次都写回
+            Some(expire) => {
+                self.shared_writers.load(Ordering::SeqCst) > 0
+                    || self.dirtied_when.load(Ordering::Relaxed) <= expire
+            }
+        };
+    }
+
+    #[inline]
+    fn need_writeback(&self) -> bool {
+        return self.dirty.load(Ordering::SeqCst) || self.shared_writers.load(Ordering::SeqCst) > 0;
+    }
+}
+
+impl Drop for CachePage {
+    fn drop(&mut self) {
+        self.clear_dirty();
+        unsafe { LockedFrameAllocator.free(self.paddr, PageFrameCount::new(1)) };
+        NR_CACHE_PAGES.fetch_sub(1, Ordering::Relaxed);
+    }
+}
+
+/// 文件的访问模式，由posix_fadvise设置
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum ReadaheadMode {
+    /// 根据实际的访问自动判断是否顺序读
+    Normal,
+    /// 将会顺序访问：总是预读，并且使用更大的窗口
+    Sequential,
+    /// 将会随机访问：不预读
+    Random,
+}
+
+/// 一个打开的文件的预读状态
+///
+/// 预读窗口`[start, start + size)`中，最后`async_size`页是异步读入的。
+/// 读到异步部分的第一页（标记页）时，说明进程还在顺序读，此时异步读入下一个窗口，窗口大小翻倍，
+/// 直到最大值。出现不连续的读时，窗口被重置，下一次顺序读从最小的窗口重新开始
+#[derive(Debug, Clone)]
+pub struct ReadaheadState {
+    mode: ReadaheadMode,
+    start: usize,
+    size: usize,
+    async_size: usize,
+    /// 上一次读取的最后一页
+    prev_index: Option<usize>,
+}
+
+impl ReadaheadState {
+    pub fn new() -> Self {
+        return Self {
+            mode: ReadaheadMode::Normal,
+            start: 0,
+            size: 0,
+            async_size: 0,
+            prev_index: None,
+        };
+    }
+
+    pub fn set_mode(&mut self, mode: ReadaheadMode) {
+        self.mode = mode;
+        if mode == ReadaheadMode::Random {
+            self.reset();
+        }
+    }
+
+    fn reset(&mut self) {
+        self.start = 0;
+        self.size = 0;
+        self.async_size = 0;
+    }
+
+    fn max_pages(&self) -> usize {
+        if self.mode == ReadaheadMode::Sequential {
+            return READAHEAD_MAX_PAGES * 2;
+        }
+        return READAHEAD_MAX_PAGES;
+    }
+
+    /// 读取`[index, index + nr)`页之前调用，更新预读窗口
+    ///
+    /// @return (同步读入的页范围, 异步读入的页范围)
+    fn on_read(&mut self, index: usize, nr: usize) -> (Range<usize>, Range<usize>) {
+        let sync = index..index + nr;
+        if self.mode == ReadaheadMode::Random {
+            return (sync, 0..0);
+        }
+
+        // 读到了当前窗口的标记页：进程仍在顺序读，异步读入下一个窗口
+        let marker = self.start + self.size - self.async_size;
+        if self.size != 0 && index <= marker && marker < index + nr {
+            self.start += self.size;
+            self.size = min(self.size * 2, self.max_pages());
+            self.async_size = self.size;
+            return (sync, self.start..self.start + self.size);
+        }
+
+        let sequential = match self.prev_index {
+            Some(prev) => index == prev || index == prev + 1,
+            None => index == 0,
+        };
+        if !sequential && self.mode == ReadaheadMode::Normal {
+            // 随机访问，缩小窗口
+            self.reset();
+            return (sync, 0..0);
+        }
+        if self.size != 0 && index + nr <= self.start + self.size {
+            // 请求的页面已经（或者正在）随着当前窗口被读入
+            return (sync, 0..0);
+        }
+
+        // 开始一个新的窗口，整个窗口同步读入。请求之后的第一页成为标记页
+        let size = if self.mode == ReadaheadMode::Sequential {
+            self.max_pages()
+        } else {
+            (nr.next_power_of_two() * 2).clamp(READAHEAD_MIN_PAGES, self.max_pages())
+        };
+        let size = size.max(nr);
+        self.start = index;
+        self.size = size;
+        self.async_size = size - nr;
+        return (index..index + size, 0..0);
+    }
+}
+
+/// 一个异步预读请求
+#[derive(Debug)]
+struct ReadaheadWork {
+    cache: Weak<PageCache>,
+    start: usize,
+    nr: usize,
+}
+
+/// 一个文件的页面缓存
+#[derive(Debug)]
+pub struct PageCache {
+    /// 缓存页，键为页号（文件偏移量 / PAGE_SIZE）
+    pages: SpinLock<BTreeMap<usize, Arc<CachePage>>>,
+    /// 缓存的后端，读入缓存页、写回脏页时直接调用它的read_at/write_at
+    backend: Weak<dyn IndexNode>,
+    /// 串行化写入、截断和写回
+    io_lock: SpinLock<()>,
+    /// 文件已经被删除，缓存页不再写回
+    dead: AtomicBool,
+    /// 文件的大小被写入扩展、但是文件系统还没有分配空间时，扩展之后的大小。
+    /// 文件的实际大小是它与文件系统中的大小中较大的那个
+    size: AtomicUsize,
+    /// 缓存所在的后备设备。没有后备存储的缓存为None
+    bdi: Option<Arc<BackingDevInfo>>,
+    self_ref: Weak<PageCache>,
+}
+
+impl PageCache {
+    /// 为`backend`创建页面缓存，脏页由`bdi`的flusher线程写回
+    pub fn new(backend: Weak<dyn IndexNode>, bdi: Arc<BackingDevInfo>) -> Arc<Self> {
+        let cache = Self::create(backend, Some(bdi));
+        cache.bdi.as_ref().unwrap().register(&cache);
+        return cache;
+    }
+
+    /// 为没有后备存储的文件（ramfs）创建缓存，缓存页保存文件的全部数据
+    ///
+    /// `backend`只用于获取文件的大小，它的metadata需要返回[`PageCache::cached_size`]。
+    /// 它的read_at/write_at/resize不会被缓存调用，应当直接转发给缓存
+    pub fn new_memory(backend: Weak<dyn IndexNode>) -> Arc<Self> {
+        return Self::create(backend, None);
+    }
+
+    fn create(backend: Weak<dyn IndexNode>, bdi: Option<Arc<BackingDevInfo>>) -> Arc<Self> {
+        let cache = Arc::new_cyclic(|self_ref| Self {
+            pages: SpinLock::new(BTreeMap::new()),
+            backend,
+            io_lock: SpinLock::new(()),
+            dead: AtomicBool::new(false),
+            size: AtomicUsize::new(0),
+            bdi,
+            self_ref: self_ref.clone(),
+        });
+        let mut caches = PAGE_CACHES.lock();
+        caches.retain(|c| c.strong_count() > 0);
+        caches.push(Arc::downgrade(&cache));
+        return cache;
+    }
+
+    fn backend(&self) -> Result<Arc<dyn IndexNode>, SystemError> {
+        return self.backend.upgrade().ok_or(SystemError::ENOENT);
+    }
+
+    /// 缓存是否没有后备存储（缓存页就是文件的数据）
+    #[inline]
+    fn is_memory(&self) -> bool {
+        return self.bdi.is_none();
+    }
+
+    /// 文件的大小。支持页面缓存的文件系统在metadata中返回的大小已经考虑了[`PageCache::cached_size`]
+    fn file_size(inode: &Arc<dyn IndexNode>) -> Result<usize, SystemError> {
+        return Ok(inode.metadata()?.size as usize);
+    }
+
+    /// 写入扩展之后、还没有写回的文件大小，文件系统在metadata中用它与自己记录的大小取较大的值
+    pub fn cached_size(&self) -> usize {
+        return self.size.load(Ordering::SeqCst);
+    }
+
+    /// 获取第`index`页在内核中的虚拟地址，页面不在缓存中时分配一个清零的页
+    ///
+    /// 只用于没有后备存储的缓存：这样的缓存页不会被回收，在截断之前地址一直有效。
+    /// 内核可以通过它直接访问与用户程序共享（通过mmap）的内存
+    pub fn page_vaddr(&self, index: usize) -> Result<VirtAddr, SystemError> {
+        if !self.is_memory() {
+            return Err(SystemError::EINVAL);
+        }
+        let page = match self.find_page(index) {
+            Some(page) => page,
+            None => {
+                let page = CachePage::new()?;
+                self.pages.lock().entry(index).or_insert(page).clone()
+            }
+        };
+        return Ok(MMArch::phys_2_virt(page.paddr).unwrap());
+    }
+
+    fn find_page(&self, index: usize) -> Option<Arc<CachePage>> {
+        return self.pages.lock().get(&index).cloned();
+    }
+
+    /// 获取第`index`页，不在缓存中时，从文件系统读入（没有后备存储时分配一个清零的页）
+    fn get_page(
+        &self,
+        inode: &Arc<dyn IndexNode>,
+        index: usize,
+        file_size: usize,
+    ) -> Result<Arc<CachePage>, SystemError> {
+        if let Some(page) = self.find_page(index) {
+            return Ok(page);
+        }
+
+        // 读入时不持有锁，其他cpu可能同时读入了同一页，此时使用先插入的那一页
+        let page = CachePage::new()?;
+        let start = index * PAGE_SIZE;
+        if start < file_size && !self.is_memory() {
+            let len = min(PAGE_SIZE, file_size - start);
+            let buf = unsafe { page.as_slice_mut() };
+            inode.read_at(start, len, buf, &mut FilePrivateData::Unused)?;
+        }
+        return Ok(self.pages.lock().entry(index).or_insert(page).clone());
+    }
+
+    /// 把`range`中不在缓存里的页面读入缓存。连续缺失的页面通过一次read_at读入，
+    /// 使文件系统可以向块设备发出大的请求
+    fn populate(
+        &self,
+        inode: &Arc<dyn IndexNode>,
+        range: Range<usize>,
+        file_size: usize,
+    ) -> Result<(), SystemError> {
+        // 没有后备存储时，不在缓存中的页是空洞，没有可以读入的内容
+        if self.is_memory() {
+            return Ok(());
+        }
+        let end = min(range.end, page_align_up(file_size) / PAGE_SIZE);
+        let mut index = range.start;
+        while index < end {
+            // 找出下一段连续缺失的页面[first, last)
+            let (first, last) = {
+                let pages = self.pages.lock();
+                let mut first = index;
+                while first < end && pages.contains_key(&first) {
+                    first += 1;
+                }
+                let mut last = first;
+                while last < end
+                    && last - first < POPULATE_BATCH_PAGES
+                    && !pages.contains_key(&last)
+                {
+                    last += 1;
+                }
+                (first, last)
+            };
+            if first == last {
+                break;
+            }
+
+            // 读入时不持有锁，其他cpu可能同时读入或者写入了其中的页，此时保留缓存中已有的页
+            let start = first * PAGE_SIZE;
+            let len = min(last * PAGE_SIZE, file_size) - start;
+            let mut buf = vec![0u8; len];
+            inode.read_at(start, len, &mut buf, &mut FilePrivateData::Unused)?;
+            let mut new_pages = Vec::with_capacity(last - first);
+            for chunk in buf.chunks(PAGE_SIZE) {
+                let page = CachePage::new()?;
+                unsafe { page.as_slice_mut()[..chunk.len()].copy_from_slice(chunk) };
+                new_pages.push(page);
+            }
+            let mut pages = self.pages.lock();
+            for (i, page) in new_pages.into_iter().enumerate() {
+                pages.entry(first + i).or_insert(page);
+            }
+            drop(pages);
+            index = last;
+        }
+        return Ok(());
+    }
+
+    /// 把`range`中的页面交给工作队列异步读入。积压的请求过多时，丢弃这个请求
+    fn readahead_async(&self, range: Range<usize>) {
+        if self.is_memory() {
+            return;
+        }
+        let mut queue = READAHEAD_QUEUE.lock();
+        if queue.len() >= READAHEAD_QUEUE_MAX {
+            return;
+        }
+        queue.push(ReadaheadWork {
+            cache: self.self_ref.clone(),
+            start: range.start,
+            nr: range.len(),
+        });
+        drop(queue);
+        system_unbound_wq().queue_work(&READAHEAD_WORK);
+    }
+
+    /// 从文件的`offset`处读取数据到`buf`中
+    ///
+    /// 读取之前根据`ra`记录的访问模式预读：顺序读时，请求的页面连同预读窗口一起同步读入，
+    /// 读到窗口中的标记页时异步读入下一个窗口
+    ///
+    /// @param ra 打开的文件的预读状态
+    ///
+    /// @return 读取的字节数，不会超过文件末尾
+    pub fn read(
+        &self,
+        offset: usize,
+        buf: &mut [u8],
+        ra: &mut ReadaheadState,
+    ) -> Result<usize, SystemError> {
+        let inode = self.backend()?;
+        let file_size = Self::file_size(&inode)?;
+        if offset >= file_size || buf.is_empty() {
+            return Ok(0);
+        }
+        let len = min(buf.len(), file_size - offset);
+
+        let first = offset / PAGE_SIZE;
+        let last = (offset + len - 1) / PAGE_SIZE;
+        let (sync, async_range) = ra.on_read(first, last - first + 1);
+        ra.prev_index = Some(last);
+        self.populate(&inode, sync, file_size)?;
+        if !async_range.is_empty() {
+            self.readahead_async(async_range);
+        }
+
+        let mut pos = offset;
+        while pos < offset + len {
+            let in_page = pos % PAGE_SIZE;
+            let n = min(PAGE_SIZE - in_page, offset + len - pos);
+            let dst = &mut buf[pos - offset..pos - offset + n];
+            match self.find_page(pos / PAGE_SIZE) {
+                Some(page) => page.read(in_page, dst),
+                // 空洞读出0，不分配页面
+                None if self.is_memory() => dst.fill(0),
+                None => self
+                    .get_page(&inode, pos / PAGE_SIZE, file_size)?
+                    .read(in_page, dst),
+            }
+            pos += n;
+            cond_resched();
+        }
+        return Ok(len);
+    }
+
+    /// 把`buf`写入到文件的`offset`处
+    ///
+    /// 数据只写入缓存页。脏页过多时，写入者同步写回这个文件的脏页。
+    /// 没有后备存储时，只为被写入的页分配页面，不产生脏页
+    ///
+    /// @param sync 是否在返回之前把脏页写回
+    ///
+    /// @return 写入的字节数
+    pub fn write(&self, offset: usize, buf: &[u8], sync: bool) -> Result<usize, SystemError> {
+        let inode = self.backend()?;
+        let _guard = self.io_lock.lock();
+        let file_size = Self::file_size(&inode)?;
+        let end = offset + buf.len();
+
+        let mut pos = offset;
+        while pos < end {
+            let index = pos / PAGE_SIZE;
+            let in_page = pos % PAGE_SIZE;
+            let n = min(PAGE_SIZE - in_page, end - pos);
+            let page = if n == PAGE_SIZE || index * PAGE_SIZE >= file_size {
+                // 整页都会被覆盖，或者整页都在文件末尾之后，不需要读入
+                match self.find_page(index) {
+                    Some(page) => page,
+                    None => {
+                        let page = CachePage::new()?;
+                        self.pages.lock().entry(index).or_insert(page).clone()
+                    }
+                }
+            } else {
+                self.get_page(&inode, index, file_size)?
+            };
+            page.write(in_page, &buf[pos - offset..pos - offset + n]);
+            if !self.is_memory() {
+                page.set_dirty();
+            }
+            pos += n;
+        }
+        // 超出文件末尾的部分由文件系统在写回时分配空间
+        self.size.fetch_max(end, Ordering::SeqCst);
+
+        if let Some(bdi) = &self.bdi {
+            if sync || balance_dirty_pages(bdi) {
+                self.writeback_locked(&inode, 0..usize::MAX, None)?;
+            }
+        }
+        return Ok(buf.len());
+    }
+
+    /// POSIX_FADV_WILLNEED：异步读入文件从`offset`开始的`len`字节（`len`为0表示到文件末尾）
+    pub fn willneed(&self, offset: usize, len: usize) -> Result<(), SystemError> {
+        if self.is_memory() {
+            return Ok(());
+        }
+        let file_size = Self::file_size(&self.backend()?)?;
+        let end = if len == 0 {
+            file_size
+        } else {
+            min(offset.saturating_add(len), file_size)
+        };
+        if offset < end {
+            self.readahead_async(offset / PAGE_SIZE..page_align_up(end) / PAGE_SIZE);
+        }
+        return Ok(());
+    }
+
+    /// POSIX_FADV_DONTNEED：丢弃完全落在`[offset, offset + len)`中的干净的、没有被映射的缓存页
+    /// （`len`为0表示到文件末尾）。没有后备存储时，缓存页就是文件的数据，不能丢弃
+    pub fn dontneed(&self, offset: usize, len: usize) {
+        if self.is_memory() {
+            return;
+        }
+        let first = page_align_up(offset) / PAGE_SIZE;
+        let end = if len == 0 {
+            usize::MAX
+        } else {
+            offset.saturating_add(len) / PAGE_SIZE
+        };
+        if first >= end {
+            return;
+        }
+        self.pages.lock().retain(|index, page| {
+            !(first..end).contains(index) || Arc::strong_count(page) > 1 || page.need_writeback()
+        });
+    }
+
+    /// 修改文件的大小：截断时丢弃新长度之后的缓存页，然后调用文件系统的resize（没有后备存储时不调用）
+    pub fn resize(&self, len: usize) -> Result<(), SystemError> {
+        let inode = self.backend()?;
+        let _guard = self.io_lock.lock();
+        let file_size = Self::file_size(&inode)?;
+
+        // 文件末尾所在的页中，末尾之后的部分必须为0：
+        // 截断后再扩展时，文件中间不能出现旧的数据；映射时写到文件末尾之后的数据也不能被写回
+        let boundary = min(len, file_size);
+        {
+            let mut pages = self.pages.lock();
+            pages.retain(|index, _| index * PAGE_SIZE < page_align_up(len));
+            if boundary % PAGE_SIZE != 0 {
+                if let Some(page) = pages.get(&(boundary / PAGE_SIZE)) {
+                    let in_page = boundary % PAGE_SIZE;
+                    unsafe { page.as_slice_mut()[in_page..].fill(0) };
+                }
+            }
+        }
+        if !self.is_memory() {
+            inode.resize(len)?;
+        }
+        self.size.store(len, Ordering::SeqCst);
+        return Ok(());
+    }
+
+    /// 是否有后备存储。只有这样的缓存支持O_DIRECT，没有后备存储时O_DIRECT的读写照常经过缓存
+    #[inline]
+    pub fn has_backing_store(&self) -> bool {
+        return !self.is_memory();
+    }
+
+    /// O_DIRECT读：先写回这段范围内的脏页，然后绕过缓存，直接从文件系统读入`buf`
+    ///
+    /// 块对齐的部分不经过中间缓冲区，用户缓冲区一直传递到驱动，由驱动固定它的物理页后直接DMA
+    ///
+    /// @return 读取的字节数，不会超过文件末尾
+    pub fn direct_read(&self, offset: usize, buf: &mut [u8]) -> Result<usize, SystemError> {
+        let inode = self.backend()?;
+        let file_size = Self::file_size(&inode)?;
+        if offset >= file_size || buf.is_empty() {
+            return Ok(0);
+        }
+        let len = min(buf.len(), file_size - offset);
+        self.writeback_range(offset, len)?;
+        return inode.read_at(offset, len, &mut buf[..len], &mut FilePrivateData::Unused);
+    }
+
+    /// O_DIRECT写：绕过缓存，通过文件系统的[`IndexNode::direct_write_at`]把`buf`直接写入设备
+    ///
+    /// 写入之前先写回这段范围以及它之前的脏页：范围内的脏页随后会被丢弃；
+    /// 之前超出文件系统中文件末尾的脏页必须先分配空间，否则会被文件系统当作扩展出来的部分清零
+    ///
+    /// @return 写入的字节数
+    pub fn direct_write(&self, offset: usize, buf: &[u8]) -> Result<usize, SystemError> {
+        let inode = self.backend()?;
+        let _guard = self.io_lock.lock();
+        let end = offset + buf.len();
+        self.writeback_locked(&inode, 0..page_align_up(end) / PAGE_SIZE, None)?;
+        let len = inode.direct_write_at(offset, buf.len(), buf, &mut FilePrivateData::Unused)?;
+
+        // 缓存中与写入范围重叠的页已经过时：没有被映射的页直接丢弃，被映射的页更新为新的数据
+        let first = offset / PAGE_SIZE;
+        let last = page_align_up(offset + len) / PAGE_SIZE;
+        self.pages.lock().retain(|index, page| {
+            if !(first..last).contains(index) {
+                return true;
+            }
+            if Arc::strong_count(page) == 1 {
+                return false;
+            }
+            let start = max(index * PAGE_SIZE, offset);
+            let stop = min((index + 1) * PAGE_SIZE, offset + len);
+            page.write(
+                start - index * PAGE_SIZE,
+                &buf[start - offset..stop - offset],
+            );
+            return true;
+        });
+        return Ok(len);
+    }
+
+    /// 为文件预先分配空间，见[`IndexNode::fallocate`]。没有后备存储时，只需要扩展文件的大小
+    pub fn fallocate(&self, offset: usize, len: usize) -> Result<(), SystemError> {
+        let inode = self.backend()?;
+        let _guard = self.io_lock.lock();
+        if self.is_memory() {
+            self.size.fetch_max(offset + len, Ordering::SeqCst);
+            return Ok(());
+        }
+        return inode.fallocate(offset, len);
+    }
+
+    /// 缓存中是否有需要写回的页面（包括被共享映射写入过的页面）
+    pub fn has_dirty_pages(&self) -> bool {
+        if self.dead.load(Ordering::SeqCst) {
+            return false;
+        }
+        return self.pages.lock().values().any(|page| page.need_writeback());
+    }
+
+    /// 把脏页写回文件系统
+    pub fn writeback(&self) -> Result<(), SystemError> {
+        return self.do_writeback(0..usize::MAX, None).map(|_| ());
+    }
+
+    /// 把文件从`offset`开始的`len`字节中的脏页写回文件系统（`len`为0表示到文件末尾）
+    pub fn writeback_range(&self, offset: usize, len: usize) -> Result<(), SystemError> {
+        let end = if len == 0 {
+            usize::MAX
+        } else {
+            page_align_up(offset.saturating_add(len)) / PAGE_SIZE
+        };
+        return self.do_writeback(offset / PAGE_SIZE..end, None).map(|_| ());
+    }
+
+    /// 写回在`expire`（jiffies）之前变脏的页面，`expire`为None时写回所有的脏页
+    ///
+    /// @return 写回的页数
+    pub fn writeback_expired(&self, expire: Option<u64>) -> Result<usize, SystemError> {
+        return self.do_writeback(0..usize::MAX, expire);
+    }
+
+    fn do_writeback(&self, range: Range<usize>, expire: Option<u64>) -> Result<usize, SystemError> {
+        if self.dead.load(Ordering::SeqCst) || self.is_memory() {
+            return Ok(0);
+        }
+        let inode = match self.backend.upgrade() {
+            Some(inode) => inode,
+            None => return Ok(0),
+        };
+        let _guard = self.io_lock.lock();
+        return self.writeback_locked(&inode, range, expire);
+    }
+
+    /// 写回`range`中在`expire`之前变脏的页面。页面按照页号从小到大写回，
+    /// 因此超出文件系统中文件末尾的页面写回时，文件系统总是从文件末尾开始连续地分配空间
+    fn writeback_locked(
+        &self,
+        inode: &Arc<dyn IndexNode>,
+        range: Range<usize>,
+        expire: Option<u64>,
+    ) -> Result<usize, SystemError> {
+        let file_size = Self::file_size(inode)?;
+        let dirty: Vec<(usize, Arc<CachePage>)> = self
+            .pages
+            .lock()
+            .range(range)
+            .filter(|(_, page)| page.expired(expire))
+            .map(|(index, page)| (*index, page.clone()))
+            .collect();
+
+        let mut written = 0;
+        for (index, page) in dirty {
+            if self.dead.load(Ordering::SeqCst) {
+                break;
+            }
+            // 先清除脏页标志，写回期间再次被写入的页会重新被标记
+            page.clear_dirty();
+            let start = index * PAGE_SIZE;
+            if start >= file_size {
+                continue;
+            }
+            let len = min(PAGE_SIZE, file_size - start);
+            let buf = unsafe { &page.as_slice_mut()[..len] };
+            if let Err(e) = inode.write_at(start, len, buf, &mut FilePrivateData::Unused) {
+                page.set_dirty();
+                return Err(e);
+            }
+            written += 1;
+        }
+        return Ok(written);
+    }
+
+    /// 文件被删除时调用：等待正在进行的写回结束，然后丢弃所有缓存页（包括脏页），之后不再写回
+    ///
+    /// 仍然被映射的页面随着映射一起释放。调用者不能持有文件系统中inode的锁
+    pub fn invalidate(&self) {
+        let _guard = self.io_lock.lock();
+        self.dead.store(true, Ordering::SeqCst);
+        self.pages.lock().clear();
+    }
+
+    /// 回收最多`nr_to_scan`个干净的、没有被映射的缓存页
+    ///
+    /// @return 释放的页帧数量
+    fn shrink(&self, nr_to_scan: usize) -> usize {
+        // 没有后备存储的页面被回收之后，数据就丢失了
+        if self.is_memory() {
+            return 0;
+        }
+        let mut pages = match self.pages.try_lock() {
+            Ok(pages) => pages,
+            Err(_) => return 0,
+        };
+        let mut scanned = 0;
+        let mut freed = 0;
+        pages.retain(|_, page| {
+            if scanned >= nr_to_scan {
+                return true;
+            }
+            scanned += 1;
+            // 页面正在被读写或者被映射，或者还没有写回
+            if Arc::strong_count(page) > 1 || page.need_writeback() {
+                return true;
+            }
+            if page.referenced.swap(false, Ordering::Relaxed) {
+                return true;
+            }
+            freed += 1;
+            return false;
+        });
+        return freed;
+    }
+}
+
+/// 文件映射中，被页表项映射着的一个缓存页
+#[derive(Debug)]
+struct MappedPage {
+    page: Arc<CachePage>,
+    /// 映射这一页的页表项数量
+    mapcount: usize,
+    /// 是否通过共享映射被写入过
+    written: bool,
+}
+
+impl Drop for MappedPage {
+    fn drop(&mut self) {
+        if self.written {
+            // 映射期间的修改无法被追踪，解除映射时把页面标记为脏页
+            self.page.set_dirty();
+            self.page.shared_writers.fetch_sub(1, Ordering::SeqCst);
+        }
+    }
+}
+
+/// 一个文件映射（mmap的文件映射）
+///
+/// 同一次mmap产生的VMA（包括被munmap、mprotect切分出来的VMA，以及fork时复制的VMA）共享同一个FileMapping。
+/// 映射时不读入也不映射任何页面，页面在第一次被访问时由缺页异常处理函数映射：
+///
+/// - 共享映射直接映射缓存页。页面第一次被写入时才获得写权限并被标记为脏页，由flusher线程或者msync写回
+/// - 私有映射只读地映射缓存页，写入时复制一份匿名页（写时复制）。复制之后的页面与文件无关
+///
+/// FileMapping持有被页表项映射着的缓存页，使它们不会被shrinker回收
+#[derive(Debug)]
+pub struct FileMapping {
+    cache: Arc<PageCache>,
+    /// 页面缓存只持有文件的弱引用，映射期间需要保证文件不被释放
+    _inode: Arc<dyn IndexNode>,
+    /// 映射的起始虚拟地址
+    start: VirtAddr,
+    /// 映射的第一页在文件中的页号
+    pgoff: usize,
+    shared: bool,
+    /// 文件以可写的方式打开，共享映射可以获得写权限
+    may_write: bool,
+    /// 被页表项映射着的缓存页，键为页号
+    pages: SpinLock<BTreeMap<usize, MappedPage>>,
+}
+
+impl FileMapping {
+    pub fn new(
+        cache: Arc<PageCache>,
+        start: VirtAddr,
+        pgoff: usize,
+        shared: bool,
+        may_write: bool,
+    ) -> Result<Arc<Self>, SystemError> {
+        let inode = cache.backend()?;
+        return Ok(Arc::new(Self {
+            cache,
+            _inode: inode,
+            start,
+            pgoff,
+            shared,
+            may_write,
+            pages: SpinLock::new(BTreeMap::new()),
+        }));
+    }
+
+    #[inline]
+    pub fn shared(&self) -> bool {
+        return self.shared;
+    }
+
+    #[inline]
+    pub fn may_write(&self) -> bool {
+        return self.may_write;
+    }
+
+    /// 被映射的文件的页面缓存
+    #[inline]
+    pub fn cache(&self) -> &Arc<PageCache> {
+        return &self.cache;
+    }
+
+    /// 映射的起始虚拟地址
+    #[inline]
+    pub fn start(&self) -> VirtAddr {
+        return self.start;
+    }
+
+    /// 被映射的文件
+    #[inline]
+    pub fn inode(&self) -> &Arc<dyn IndexNode> {
+        return &self._inode;
+    }
+
+    /// 虚拟地址所在的页在文件中的字节偏移量
+    #[inline]
+    pub fn file_offset(&self, vaddr: VirtAddr) -> usize {
+        return self.index(vaddr) * PAGE_SIZE;
+    }
+
+    /// 映射着`vaddr`所在页的缓存页的页表项数量（包括fork得到的子进程中的页表项）
+    pub fn page_mapcount(&self, vaddr: VirtAddr) -> usize {
+        return self
+            .pages
+            .lock()
+            .get(&self.index(vaddr))
+            .map_or(0, |mapped| mapped.mapcount);
+    }
+
+    /// 虚拟地址所在的页在文件中的页号
+    #[inline]
+    fn index(&self, vaddr: VirtAddr) -> usize {
+        return self.pgoff + (vaddr - self.start) / PAGE_SIZE;
+    }
+
+    /// 获取第`index`页。不在缓存中时，连同后面的几页一起读入
+    fn get_page(&self, index: usize) -> Result<Arc<CachePage>, SystemError> {
+        if let Some(page) = self.cache.find_page(index) {
+            page.referenced.store(true, Ordering::Relaxed);
+            return Ok(page);
+        }
+        let inode = self.cache.backend()?;
+        let file_size = PageCache::file_size(&inode)?;
+        // 文件末尾所在的页之后的页面不能访问
+        if index * PAGE_SIZE >= file_size {
+            return Err(SystemError::EFAULT);
+        }
+        self.cache
+            .populate(&inode, index..index + MMAP_READAROUND_PAGES, file_size)?;
+        return self.cache.get_page(&inode, index, file_size);
+    }
+
+    /// 把`vaddr`所在的页映射到缓存页之前调用，记录一个新的页表项映射
+    ///
+    /// @return 缓存页的物理地址
+    pub fn map_page(&self, vaddr: VirtAddr) -> Result<PhysAddr, SystemError> {
+        let index = self.index(vaddr);
+        let page = self.get_page(index)?;
+        let mut pages = self.pages.lock();
+        let mapped = pages.entry(index).or_insert(MappedPage {
+            page,
+            mapcount: 0,
+            written: false,
+        });
+        mapped.mapcount += 1;
+        return Ok(mapped.page.paddr);
+    }
+
+    /// fork时调用：子进程的页表项映射了`vaddr`所在页的缓存页
+    pub fn dup_page(&self, vaddr: VirtAddr) {
+        if let Some(mapped) = self.pages.lock().get_mut(&self.index(vaddr)) {
+            mapped.mapcount += 1;
+        }
+    }
+
+    /// `paddr`是否是`vaddr`所在页映射的缓存页（而不是私有映射写时复制得到的匿名页）
+    pub fn is_cache_page(&self, vaddr: VirtAddr, paddr: PhysAddr) -> bool {
+        return self
+            .pages
+            .lock()
+            .get(&self.index(vaddr))
+            .is_some_and(|mapped| mapped.page.paddr == paddr);
+    }
+
+    /// 共享映射中，页表项获得写权限之前调用：把页面标记为脏页
+    pub fn mkwrite(&self, vaddr: VirtAddr) {
+        // 没有后备存储的页面不需要写回
+        if self.cache.is_memory() {
+            return;
+        }
+        if let Some(mapped) = self.pages.lock().get_mut(&self.index(vaddr)) {
+            if !mapped.written {
+                // 之后的写入无法被追踪，页面被映射期间，每次写回都把它当作脏页
+                mapped.written = true;
+                mapped.page.shared_writers.fetch_add(1, Ordering::SeqCst);
+            }
+            mapped.page.set_dirty();
+        }
+    }
+
+    /// 一个页表项不再映射`vaddr`所在的页（物理地址为`paddr`）时调用
+    ///
+    /// @return `paddr`是缓存页时返回true；返回false时，它是私有映射中的匿名页，由调用者按照匿名页释放
+    pub fn unmap_page(&self, vaddr: VirtAddr, paddr: PhysAddr) -> bool {
+        let index = self.index(vaddr);
+        let mut pages = self.pages.lock();
+        let mapped = match pages.get_mut(&index) {
+            Some(mapped) if mapped.page.paddr == paddr => mapped,
+            _ => return false,
+        };
+        mapped.mapcount -= 1;
+        if mapped.mapcount == 0 {
+            let mapped = pages.remove(&index);
+            drop(pages);
+            drop(mapped);
+        }
+        return true;
+    }
+
+    /// MAP_POPULATE：把`[vaddr, vaddr + len)`对应的文件内容一次性读入缓存
+    pub fn prefetch(&self, vaddr: VirtAddr, len: usize) -> Result<(), SystemError> {
+        let inode = self.cache.backend()?;
+        let file_size = PageCache::file_size(&inode)?;
+        let first = self.index(vaddr);
+        return self.cache.populate(
+            &inode,
+            first..first + page_align_up(len) / PAGE_SIZE,
+            file_size,
+        );
+    }
+
+    /// MADV_WILLNEED：异步读入`[vaddr, vaddr + len)`对应的文件内容
+    pub fn willneed(&self, vaddr: VirtAddr, len: usize) -> Result<(), SystemError> {
+        if len == 0 {
+            return Ok(());
+        }
+        return self.cache.willneed(self.index(vaddr) * PAGE_SIZE, len);
+    }
+
+    /// msync(MS_SYNC)：把共享映射中`[vaddr, vaddr + len)`对应的脏页写回文件
+    pub fn sync(&self, vaddr: VirtAddr, len: usize) -> Result<(), SystemError> {
+        if !self.shared || len == 0 {
+            return Ok(());
+        }
+        self.cache
+            .writeback_range(self.index(vaddr) * PAGE_SIZE, len)?;
+        // 写回时文件系统可能分配了新的空间，同步它的元数据
+        return self.cache.backend()?.fs().sync();
+    }
+}
+
+/// 获取所有仍然存在的页面缓存
+fn page_caches() -> Vec<Arc<PageCache>> {
+    let mut caches = PAGE_CACHES.lock();
+    caches.retain(|c| c.strong_count() > 0);
+    return caches.iter().filter_map(|c| c.upgrade()).collect();
+}
+
+/// 页面缓存的shrinker
+#[derive(Debug)]
+struct PageCacheShrinker;
+
+impl Shrinker for PageCacheShrinker {
+    fn name(&self) -> &str {
+        return "page_cache";
+    }
+
+    fn count_objects(&self) -> usize {
+        return page_cache_nr_pages();
+    }
+
+    fn scan_objects(&self, nr_to_scan: usize) -> usize {
+        let mut freed = 0;
+        for cache in page_caches() {
+            if freed >= nr_to_scan {
+                break;
+            }
+            freed += cache.shrink(nr_to_scan - freed);
+        }
+        return freed;
+    }
+}
+
+/// 处理队列中所有的异步预读请求
+fn readahead_work() {
+    loop {
+        let mut queue = READAHEAD_QUEUE.lock();
+        if queue.is_empty() {
+            return;
+        }
+        let work = queue.remove(0);
+        drop(queue);
+
+        let cache = match work.cache.upgrade() {
+            Some(cache) => cache,
+            None => continue,
+        };
+        if cache.dead.load(Ordering::SeqCst) {
+            continue;
+        }
+        // 预读只是优化，失败时等到真正读取的时候再报告错误
+        if let Ok(inode) = cache.backend() {
+            if let Ok(file_size) = PageCache::file_size(&inode) {
+                cache
+                    .populate(&inode, work.start..work.start + work.nr, file_size)
+                    .ok();
+            }
+        }
+    }
+}
+
+/// 初始化页面缓存：注册shrinker，计算脏页的阈值（需要在内核线程机制初始化完成之后调用）
+pub fn page_cache_init() {
+    register_shrinker(Arc::new(PageCacheShrinker));
+    writeback_init();
+    kinfo!("page cache initialized");
+}
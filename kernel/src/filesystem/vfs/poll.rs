@@ -0,0 +1,512 @@
+//! poll、ppoll、select、pselect6系统调用
+//!
+//! 进程先检查一遍所有的文件，没有就绪的文件时，通过[`IndexNode::poll_wait`]把自己加入每个文件的等待队列，
+//! 标记睡眠之后再检查一遍（在这之后到来的唤醒会把进程重新设置为可运行，不会丢失），仍然没有就绪的文件才发起调度。
+//! 被任意一个等待队列唤醒、超时或者收到信号之后，把自己从所有的等待队列中移除，然后重新检查。
+
+use alloc::{sync::Arc, vec::Vec};
+
+use crate::{
+    arch::{ipc::signal::SigSet, sched::sched, CurrentIrqArch},
+    exception::InterruptArch,
+    ipc::signal::set_current_sig_blocked,
+    libs::wait_queue::{WaitQueue, WaitQueueCallback, WAIT_KEY_ANY},
+    process::{ProcessControlBlock, ProcessManager},
+    syscall::{
+        user_access::{UserBufferReader, UserBufferWriter},
+        Syscall, SystemError,
+    },
+    time::{
+        hrtimer::{hrtimer_now, HrTimer},
+        syscall::PosixTimeval,
+        timer::{current_timer_slack_ns, WakeUpHelper},
+        TimeSpec,
+    },
+};
+
+use super::{IndexNode, PollStatus};
+
+/// 有数据可以读取
+pub const POLLIN: i16 = 0x1;
+/// 有紧急数据可以读取
+pub const POLLPRI: i16 = 0x2;
+/// 可以写入
+pub const POLLOUT: i16 = 0x4;
+/// 发生了错误（总是会被报告）
+pub const POLLERR: i16 = 0x8;
+/// 连接已经挂断（总是会被报告）
+pub const POLLHUP: i16 = 0x10;
+/// 文件描述符无效（总是会被报告）
+pub const POLLNVAL: i16 = 0x20;
+pub const POLLRDNORM: i16 = 0x40;
+pub const POLLRDBAND: i16 = 0x80;
+pub const POLLWRNORM: i16 = 0x100;
+pub const POLLWRBAND: i16 = 0x200;
+
+const POLLIN_SET: i16 = POLLIN | POLLRDNORM | POLLRDBAND | POLLHUP | POLLERR;
+const POLLOUT_SET: i16 = POLLOUT | POLLWRNORM | POLLWRBAND | POLLERR;
+const POLLEX_SET: i16 = POLLPRI;
+
+/// 用户传入的pollfd结构体
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+pub struct PollFd {
+    pub fd: i32,
+    pub events: i16,
+    pub revents: i16,
+}
+
+/// select使用的文件描述符集合中每个元素的位数
+const NFDBITS: usize = u64::BITS as usize;
+
+/// 文件就绪时需要被通知的对象
+#[derive(Debug)]
+enum PollWaiter {
+    /// 在poll/select中睡眠的进程
+    Process(Arc<ProcessControlBlock>),
+    /// 等待队列的回调（例如epoll）
+    Callback(Arc<dyn WaitQueueCallback>),
+}
+
+/// 等待者在poll过程中所在的等待队列
+#[derive(Debug)]
+pub struct PollTable {
+    waiter: PollWaiter,
+    queues: Vec<Arc<WaitQueue>>,
+}
+
+impl PollTable {
+    fn new(pcb: Arc<ProcessControlBlock>) -> Self {
+        return Self {
+            waiter: PollWaiter::Process(pcb),
+            queues: Vec::new(),
+        };
+    }
+
+    /// 创建一个在文件的等待队列被唤醒时执行`callback`的PollTable。
+    /// 回调会一直留在等待队列中，直到PollTable被释放
+    pub fn with_callback(callback: Arc<dyn WaitQueueCallback>) -> Self {
+        return Self {
+            waiter: PollWaiter::Callback(callback),
+            queues: Vec::new(),
+        };
+    }
+
+    /// 在`queue`上等待，`queue`被唤醒时，poll会重新检查所有的文件
+    pub fn wait(&mut self, queue: &Arc<WaitQueue>) {
+        match &self.waiter {
+            PollWaiter::Process(pcb) => queue.add_waiter(pcb.clone()),
+            PollWaiter::Callback(callback) => queue.add_callback(WAIT_KEY_ANY, callback.clone()),
+        }
+        self.queues.push(queue.clone());
+    }
+
+    /// 从所有的等待队列中移除
+    fn clear(&mut self) {
+        for queue in self.queues.drain(..) {
+            match &self.waiter {
+                PollWaiter::Process(pcb) => queue.remove_waiter(pcb),
+                PollWaiter::Callback(callback) => queue.remove_callback(callback),
+            }
+        }
+    }
+}
+
+impl Drop for PollTable {
+    fn drop(&mut self) {
+        self.clear();
+    }
+}
+
+/// 获取文件描述符对应的inode，文件描述符无效时返回None
+fn fd_inode(fd: i32) -> Option<Arc<dyn IndexNode>> {
+    let file = ProcessManager::current_pcb()
+        .fd_table()
+        .read()
+        .get_file_by_fd(fd)?;
+    let inode = file.lock().inode();
+    return Some(inode);
+}
+
+/// 把inode的状态转换为POLL*事件
+///
+/// 没有实现poll的inode总是可以读写（与Linux相同）
+pub fn inode_poll_events(inode: &Arc<dyn IndexNode>) -> i16 {
+    let status = match inode.poll() {
+        Ok(status) => status,
+        Err(_) => return POLLIN | POLLRDNORM | POLLOUT | POLLWRNORM,
+    };
+    let mut events = 0;
+    if status.contains(PollStatus::READ) {
+        events |= POLLIN | POLLRDNORM;
+    }
+    if status.contains(PollStatus::WRITE) {
+        events |= POLLOUT | POLLWRNORM;
+    }
+    if status.contains(PollStatus::ERROR) {
+        events |= POLLERR;
+    }
+    return events;
+}
+
+pub fn signal_pending() -> bool {
+    return ProcessManager::current_pcb().has_pending_signal();
+}
+
+/// 等待，直到`scan`返回的就绪的文件数不为0、超时或者收到信号
+///
+/// ## 参数
+///
+/// - `inodes`：需要等待的文件
+/// - `timeout_ns`：最长等待的时间，None表示一直等待
+/// - `scan`：检查一遍所有的文件，返回就绪的文件数。可能在关中断的情况下调用
+///
+/// ## 返回值
+///
+/// 就绪的文件数（超时时为0），收到信号时返回EINTR
+fn do_poll_wait(
+    inodes: &[Arc<dyn IndexNode>],
+    timeout_ns: Option<u64>,
+    mut scan: impl FnMut() -> usize,
+) -> Result<usize, SystemError> {
+    let n = scan();
+    if n != 0 || timeout_ns == Some(0) {
+        return Ok(n);
+    }
+    let deadline = timeout_ns.map(|ns| hrtimer_now().saturating_add(ns));
+    let pcb = ProcessManager::current_pcb();
+    let mut table = PollTable::new(pcb.clone());
+    loop {
+        if signal_pending() {
+            return Err(SystemError::EINTR);
+        }
+        if deadline.map_or(false, |deadline| hrtimer_now() >= deadline) {
+            return Ok(0);
+        }
+        let timer = deadline.map(|deadline| {
+            HrTimer::new_range(
+                WakeUpHelper::new(pcb.clone()),
+                deadline,
+                current_timer_slack_ns(),
+            )
+        });
+
+        let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+        for inode in inodes {
+            inode.poll_wait(&mut table);
+        }
+        ProcessManager::mark_sleep(true).ok();
+        let n = scan();
+        if n != 0 || signal_pending() {
+            ProcessManager::cancel_sleep();
+            drop(irq_guard);
+            if n == 0 {
+                return Err(SystemError::EINTR);
+            }
+            return Ok(n);
+        }
+        if let Some(timer) = &timer {
+            timer.start();
+        }
+        drop(irq_guard);
+        sched();
+
+        if let Some(timer) = timer {
+            timer.cancel();
+        }
+        table.clear();
+        let n = scan();
+        if n != 0 {
+            return Ok(n);
+        }
+    }
+}
+
+/// 检查pollfd数组中的每个文件，填写revents，返回就绪的文件数
+fn poll_scan(fds: &mut [PollFd], inodes: &[Option<Arc<dyn IndexNode>>]) -> usize {
+    let mut n = 0;
+    for (pollfd, inode) in fds.iter_mut().zip(inodes.iter()) {
+        pollfd.revents = match inode {
+            // 负数的文件描述符被忽略
+            None if pollfd.fd < 0 => 0,
+            None => POLLNVAL,
+            Some(inode) => inode_poll_events(inode) & (pollfd.events | POLLERR | POLLHUP),
+        };
+        if pollfd.revents != 0 {
+            n += 1;
+        }
+    }
+    return n;
+}
+
+fn do_poll(ufds: *mut PollFd, nfds: u32, timeout_ns: Option<u64>) -> Result<usize, SystemError> {
+    let nfds = nfds as usize;
+    if nfds > ProcessManager::current_pcb().fd_table().read().max_fds() {
+        return Err(SystemError::EINVAL);
+    }
+    let size = nfds * core::mem::size_of::<PollFd>();
+    let mut fds: Vec<PollFd> = vec![PollFd::default(); nfds];
+    if nfds != 0 {
+        let reader = UserBufferReader::new(ufds as *const PollFd, size, true)?;
+        reader.copy_from_user(&mut fds, 0)?;
+    }
+
+    let inodes: Vec<Option<Arc<dyn IndexNode>>> =
+        fds.iter().map(|pollfd| fd_inode(pollfd.fd)).collect();
+    let valid: Vec<Arc<dyn IndexNode>> = inodes.iter().flatten().cloned().collect();
+    let r = do_poll_wait(&valid, timeout_ns, || poll_scan(&mut fds, &inodes));
+
+    if nfds != 0 {
+        let mut writer = UserBufferWriter::new(ufds, size, true)?;
+        writer.copy_to_user(&fds, 0)?;
+    }
+    return r;
+}
+
+/// 用户传入的fd_set
+struct FdSet {
+    ptr: *mut u64,
+    bits: Vec<u64>,
+}
+
+impl FdSet {
+    fn from_user(ptr: *mut u64, nfds: usize) -> Result<Option<Self>, SystemError> {
+        if ptr.is_null() {
+            return Ok(None);
+        }
+        let mut bits = vec![0u64; (nfds + NFDBITS - 1) / NFDBITS];
+        if !bits.is_empty() {
+            let reader = UserBufferReader::new(
+                ptr as *const u64,
+                bits.len() * core::mem::size_of::<u64>(),
+                true,
+            )?;
+            reader.copy_from_user(&mut bits, 0)?;
+        }
+        return Ok(Some(Self { ptr, bits }));
+    }
+
+    fn contains(&self, fd: usize) -> bool {
+        return self.bits[fd / NFDBITS] & (1 << (fd % NFDBITS)) != 0;
+    }
+
+    fn to_user(&self) -> Result<(), SystemError> {
+        if self.bits.is_empty() {
+            return Ok(());
+        }
+        let mut writer = UserBufferWriter::new(
+            self.ptr,
+            self.bits.len() * core::mem::size_of::<u64>(),
+            true,
+        )?;
+        writer.copy_to_user(&self.bits, 0)?;
+        return Ok(());
+    }
+}
+
+fn do_select(
+    nfds: i32,
+    readfds: *mut u64,
+    writefds: *mut u64,
+    exceptfds: *mut u64,
+    timeout_ns: Option<u64>,
+) -> Result<usize, SystemError> {
+    if nfds < 0 {
+        return Err(SystemError::EINVAL);
+    }
+    let nfds = (nfds as usize).min(ProcessManager::current_pcb().fd_table().read().max_fds());
+    let mut sets = [
+        FdSet::from_user(readfds, nfds)?,
+        FdSet::from_user(writefds, nfds)?,
+        FdSet::from_user(exceptfds, nfds)?,
+    ];
+    let wanted = [POLLIN_SET, POLLOUT_SET, POLLEX_SET];
+
+    // 需要检查的文件描述符，以及它关心的事件
+    let mut fds: Vec<(usize, Arc<dyn IndexNode>, i16)> = Vec::new();
+    for fd in 0..nfds {
+        let mut events = 0;
+        for (set, wanted) in sets.iter().zip(wanted.iter()) {
+            if set.as_ref().map_or(false, |set| set.contains(fd)) {
+                events |= wanted;
+            }
+        }
+        if events == 0 {
+            continue;
+        }
+        let inode = fd_inode(fd as i32).ok_or(SystemError::EBADF)?;
+        fds.push((fd, inode, events));
+    }
+
+    let inodes: Vec<Arc<dyn IndexNode>> = fds.iter().map(|(_, inode, _)| inode.clone()).collect();
+    let mut result: Vec<i16> = vec![0; fds.len()];
+    let r = do_poll_wait(&inodes, timeout_ns, || {
+        let mut n = 0;
+        for (i, (_, inode, events)) in fds.iter().enumerate() {
+            result[i] = inode_poll_events(inode) & events;
+            // select对每个集合中的每个就绪的文件描述符分别计数
+            for wanted in wanted.iter() {
+                if result[i] & events & wanted != 0 {
+                    n += 1;
+                }
+            }
+        }
+        return n;
+    })?;
+
+    // 只保留就绪的文件描述符
+    for set in sets.iter_mut().flatten() {
+        set.bits.iter_mut().for_each(|bits| *bits = 0);
+    }
+    for (i, (fd, _, events)) in fds.iter().enumerate() {
+        for (set, wanted) in sets.iter_mut().zip(wanted.iter()) {
+            if let Some(set) = set {
+                if result[i] & events & wanted != 0 {
+                    set.bits[fd / NFDBITS] |= 1 << (fd % NFDBITS);
+                }
+            }
+        }
+    }
+    for set in sets.iter().flatten() {
+        set.to_user()?;
+    }
+    return Ok(r);
+}
+
+/// 把时间转换为纳秒，负数或者不合法时返回EINVAL
+fn timespec_to_ns(ts: &TimeSpec) -> Result<u64, SystemError> {
+    if ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1_000_000_000 {
+        return Err(SystemError::EINVAL);
+    }
+    return Ok((ts.tv_sec as u64)
+        .saturating_mul(1_000_000_000)
+        .saturating_add(ts.tv_nsec as u64));
+}
+
+fn read_timespec(tsp: *const TimeSpec) -> Result<Option<u64>, SystemError> {
+    if tsp.is_null() {
+        return Ok(None);
+    }
+    let reader = UserBufferReader::new(tsp, core::mem::size_of::<TimeSpec>(), true)?;
+    let ts: TimeSpec = reader.read_one_from_user::<TimeSpec>(0)?.clone();
+    return Ok(Some(timespec_to_ns(&ts)?));
+}
+
+/// 在等待期间临时替换当前进程的信号掩码，返回原来的掩码
+pub fn set_temp_sigmask(
+    sigmask: *const SigSet,
+    sigsetsize: usize,
+) -> Result<Option<SigSet>, SystemError> {
+    if sigmask.is_null() {
+        return Ok(None);
+    }
+    if sigsetsize != core::mem::size_of::<SigSet>() {
+        return Err(SystemError::EINVAL);
+    }
+    let reader = UserBufferReader::new(sigmask, core::mem::size_of::<SigSet>(), true)?;
+    let mut new_set = *reader.read_one_from_user::<SigSet>(0)?;
+    let old_set = *ProcessManager::current_pcb().sig_info_irqsave().sig_block();
+    set_current_sig_blocked(&mut new_set);
+    return Ok(Some(old_set));
+}
+
+pub fn restore_sigmask(old: Option<SigSet>) {
+    if let Some(mut old) = old {
+        set_current_sig_blocked(&mut old);
+    }
+}
+
+impl Syscall {
+    /// 等待一组文件描述符中的任意一个就绪
+    ///
+    /// `timeout_ms`为负数时一直等待，为0时只检查一次
+    pub fn poll(ufds: *mut PollFd, nfds: u32, timeout_ms: i32) -> Result<usize, SystemError> {
+        let timeout_ns = if timeout_ms < 0 {
+            None
+        } else {
+            Some(timeout_ms as u64 * 1_000_000)
+        };
+        return do_poll(ufds, nfds, timeout_ns);
+    }
+
+    /// 与poll相同，但是超时时间的精度为纳秒，并且可以在等待期间临时替换信号掩码
+    pub fn ppoll(
+        ufds: *mut PollFd,
+        nfds: u32,
+        tsp: *const TimeSpec,
+        sigmask: *const SigSet,
+        sigsetsize: usize,
+    ) -> Result<usize, SystemError> {
+        let timeout_ns = read_timespec(tsp)?;
+        let old = set_temp_sigmask(sigmask, sigsetsize)?;
+        let r = do_poll(ufds, nfds, timeout_ns);
+        restore_sigmask(old);
+        return r;
+    }
+
+    /// 等待fd_set中的任意一个文件描述符就绪。返回时，`timeout`被更新为剩余的时间
+    pub fn select(
+        nfds: i32,
+        readfds: *mut u64,
+        writefds: *mut u64,
+        exceptfds: *mut u64,
+        timeout: *mut PosixTimeval,
+    ) -> Result<usize, SystemError> {
+        let timeout_ns = if timeout.is_null() {
+            None
+        } else {
+            let reader = UserBufferReader::new(
+                timeout as *const PosixTimeval,
+                core::mem::size_of::<PosixTimeval>(),
+                true,
+            )?;
+            let tv = *reader.read_one_from_user::<PosixTimeval>(0)?;
+            if tv.tv_sec < 0 || tv.tv_usec < 0 || tv.tv_usec >= 1_000_000 {
+                return Err(SystemError::EINVAL);
+            }
+            Some(
+                (tv.tv_sec as u64)
+                    .saturating_mul(1_000_000_000)
+                    .saturating_add(tv.tv_usec as u64 * 1000),
+            )
+        };
+        let start = hrtimer_now();
+        let r = do_select(nfds, readfds, writefds, exceptfds, timeout_ns);
+
+        if let Some(timeout_ns) = timeout_ns {
+            let remaining = timeout_ns.saturating_sub(hrtimer_now() - start);
+            let tv = PosixTimeval {
+                tv_sec: (remaining / 1_000_000_000) as i64,
+                tv_usec: ((remaining % 1_000_000_000) / 1000) as i32,
+            };
+            let mut writer =
+                UserBufferWriter::new(timeout, core::mem::size_of::<PosixTimeval>(), true)?;
+            writer.copy_one_to_user(&tv, 0)?;
+        }
+        return r;
+    }
+
+    /// 与select相同，但是超时时间的精度为纳秒，并且可以在等待期间临时替换信号掩码
+    ///
+    /// `sig`指向`{ const sigset_t *ss; size_t ss_len; }`
+    pub fn pselect6(
+        nfds: i32,
+        readfds: *mut u64,
+        writefds: *mut u64,
+        exceptfds: *mut u64,
+        tsp: *const TimeSpec,
+        sig: *const [usize; 2],
+    ) -> Result<usize, SystemError> {
+        let timeout_ns = read_timespec(tsp)?;
+        let old = if sig.is_null() {
+            None
+        } else {
+            let reader = UserBufferReader::new(sig, core::mem::size_of::<[usize; 2]>(), true)?;
+            let [ss, ss_len] = *reader.read_one_from_user::<[usize; 2]>(0)?;
+            set_temp_sigmask(ss as *const SigSet, ss_len)?
+        };
+        let r = do_select(nfds, readfds, writefds, exceptfds, timeout_ns);
+        restore_sigmask(old);
+        return r;
+    }
+}
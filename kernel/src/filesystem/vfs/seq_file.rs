@@ -0,0 +1,221 @@
+//! seq_file：按记录逐步生成内容的虚拟文件
+//!
+//! procfs、sysfs中的文件没有存储的内容，读取时才由内核生成。生成者实现[`SeqOperations`]，
+//! 把文件看作一串记录（例如每个中断、每个网卡、每个cpu一行）：
+//!
+//! - start：开始一次遍历，定位到第pos个记录
+//! - next：前进到下一个记录
+//! - show：把当前记录输出到缓冲区
+//! - stop：结束一次遍历
+//!
+//! 每次read只生成填满用户缓冲区所需的记录，已经生成但没有被读走的部分暂存在[`SeqFile`]中，
+//! 下一次read先返回它。因此顺序读取时每个记录只生成一次，读取开销与读到的数据量成正比，
+//! 而不是在open时就生成整个文件。读取的偏移量与上一次读取结束的位置不同时（例如lseek之后），
+//! 从头重新遍历到这个偏移量。
+
+use core::fmt::{Debug, Write};
+
+use alloc::{boxed::Box, sync::Arc, vec, vec::Vec};
+
+use crate::{libs::spinlock::SpinLock, syscall::SystemError};
+
+/// 逐个记录生成文件内容的操作
+pub trait SeqOperations: Debug + Send + Sync {
+    /// 遍历过程中指向一个记录的游标
+    type Cursor;
+
+    /// 开始一次遍历，返回第`pos`个记录（从0开始）的游标。没有这个记录时返回None
+    fn start(&self, pos: usize) -> Option<Self::Cursor>;
+
+    /// 返回`cursor`之后的记录的游标，`pos`是那个记录的序号。没有更多的记录时返回None
+    ///
+    /// 默认通过start重新定位，记录可以按序号直接找到时不需要实现
+    fn next(&self, _cursor: Self::Cursor, pos: usize) -> Option<Self::Cursor> {
+        return self.start(pos);
+    }
+
+    /// 把游标指向的记录输出到`out`的末尾
+    fn show(&self, cursor: &Self::Cursor, out: &mut SeqBuf) -> Result<(), SystemError>;
+
+    /// 结束一次遍历，释放start中获取的资源
+    fn stop(&self) {}
+}
+
+/// show输出记录的缓冲区。支持`write!`，也可以输出任意的字节
+#[derive(Debug, Default)]
+pub struct SeqBuf(Vec<u8>);
+
+impl SeqBuf {
+    pub fn push_str(&mut self, s: &str) {
+        self.0.extend_from_slice(s.as_bytes());
+    }
+
+    pub fn push(&mut self, c: char) {
+        let mut tmp = [0u8; 4];
+        self.push_str(c.encode_utf8(&mut tmp));
+    }
+
+    pub fn extend_from_slice(&mut self, bytes: &[u8]) {
+        self.0.extend_from_slice(bytes);
+    }
+}
+
+impl Write for SeqBuf {
+    fn write_str(&mut self, s: &str) -> core::fmt::Result {
+        self.push_str(s);
+        return Ok(());
+    }
+}
+
+/// 与具体的[`SeqOperations`]无关的读取接口，文件的私有数据通过它读取seq_file
+pub trait SeqRead: Debug + Send + Sync {
+    /// 从`offset`处读取数据到`buf`中
+    ///
+    /// @return 读取的字节数，读到文件末尾时返回0
+    fn read(&mut self, offset: usize, buf: &mut [u8]) -> Result<usize, SystemError>;
+}
+
+/// 一个打开的seq_file：遍历的位置，以及已经生成但还没有被读走的数据
+#[derive(Debug)]
+pub struct SeqFile<O: SeqOperations> {
+    ops: O,
+    /// 已经生成的最后一个记录中，还没有被读走的部分
+    pending: Vec<u8>,
+    /// pending中下一个要读走的字节
+    pending_off: usize,
+    /// 下一个要生成的记录的序号
+    index: usize,
+    /// 下一次顺序读取的文件偏移量
+    read_pos: usize,
+}
+
+impl<O: SeqOperations> SeqFile<O> {
+    pub fn new(ops: O) -> Self {
+        return Self {
+            ops,
+            pending: Vec::new(),
+            pending_off: 0,
+            index: 0,
+            read_pos: 0,
+        };
+    }
+
+    /// 回到文件的开头
+    fn rewind(&mut self) {
+        self.pending.clear();
+        self.pending_off = 0;
+        self.index = 0;
+        self.read_pos = 0;
+    }
+
+    /// 把pending中的数据拷贝到`buf`中
+    fn drain(&mut self, buf: &mut [u8]) -> usize {
+        let n = core::cmp::min(self.pending.len() - self.pending_off, buf.len());
+        buf[..n].copy_from_slice(&self.pending[self.pending_off..self.pending_off + n]);
+        self.pending_off += n;
+        if self.pending_off == self.pending.len() {
+            self.pending.clear();
+            self.pending_off = 0;
+        }
+        return n;
+    }
+
+    /// 从当前位置顺序读取
+    fn read_next(&mut self, buf: &mut [u8]) -> Result<usize, SystemError> {
+        let mut copied = self.drain(buf);
+        if copied == buf.len() {
+            return Ok(copied);
+        }
+
+        let mut cursor = self.ops.start(self.index);
+        let mut result = Ok(());
+        while let Some(c) = cursor {
+            let mut out = SeqBuf::default();
+            if let Err(e) = self.ops.show(&c, &mut out) {
+                result = Err(e);
+                break;
+            }
+            self.index += 1;
+            self.pending = out.0;
+            self.pending_off = 0;
+            copied += self.drain(&mut buf[copied..]);
+            if copied == buf.len() {
+                break;
+            }
+            cursor = self.ops.next(c, self.index);
+        }
+        self.ops.stop();
+
+        // 已经读到数据时，先返回它们，错误留给下一次读取
+        if copied == 0 {
+            result?;
+        }
+        return Ok(copied);
+    }
+}
+
+impl<O: SeqOperations> SeqRead for SeqFile<O> {
+    fn read(&mut self, offset: usize, buf: &mut [u8]) -> Result<usize, SystemError> {
+        if offset != self.read_pos {
+            // 不是顺序读取：从头生成，丢弃offset之前的数据
+            self.rewind();
+            let mut skip = vec![0u8; core::cmp::min(offset, 4096)];
+            while self.read_pos < offset {
+                let n = core::cmp::min(offset - self.read_pos, skip.len());
+                let n = self.read_next(&mut skip[..n])?;
+                if n == 0 {
+                    return Ok(0);
+                }
+                self.read_pos += n;
+            }
+        }
+        let n = self.read_next(buf)?;
+        self.read_pos += n;
+        return Ok(n);
+    }
+}
+
+/// 只有一个记录的seq_file，用于一次生成全部内容的小文件（相当于Linux的single_open）
+pub struct SingleShow<F: Fn(&mut SeqBuf) -> Result<(), SystemError> + Send + Sync>(pub F);
+
+impl<F: Fn(&mut SeqBuf) -> Result<(), SystemError> + Send + Sync> Debug for SingleShow<F> {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        f.write_str("SingleShow")
+    }
+}
+
+impl<F: Fn(&mut SeqBuf) -> Result<(), SystemError> + Send + Sync> SeqOperations for SingleShow<F> {
+    type Cursor = ();
+
+    fn start(&self, pos: usize) -> Option<()> {
+        return if pos == 0 { Some(()) } else { None };
+    }
+
+    fn show(&self, _cursor: &(), out: &mut SeqBuf) -> Result<(), SystemError> {
+        return (self.0)(out);
+    }
+}
+
+/// 文件私有数据中保存的seq_file
+///
+/// 复制文件描述符得到的文件共享同一个seq_file。它们的偏移量不同时，读取会从头重新遍历，结果仍然正确
+#[derive(Debug, Clone)]
+pub struct SeqFileHandle(Arc<SpinLock<Box<dyn SeqRead>>>);
+
+impl SeqFileHandle {
+    pub fn new<O: SeqOperations + 'static>(ops: O) -> Self {
+        return Self(Arc::new(SpinLock::new(Box::new(SeqFile::new(ops)))));
+    }
+
+    /// 创建只有一个记录的seq_file
+    pub fn single<F>(show: F) -> Self
+    where
+        F: Fn(&mut SeqBuf) -> Result<(), SystemError> + Send + Sync + 'static,
+    {
+        return Self::new(SingleShow(show));
+    }
+
+    pub fn read(&self, offset: usize, buf: &mut [u8]) -> Result<usize, SystemError> {
+        return self.0.lock().read(offset, buf);
+    }
+}
@@ -0,0 +1,265 @@
+//! sendfile与splice：在内核中直接把数据从一个文件转发到另一个文件
+//!
+//! 数据从输入文件的`read_at`读入内核缓冲区之后，直接交给输出文件（例如socket）的`write_at`，
+//! 不需要像read + write那样在内核与用户空间之间复制两次。
+//!
+//! vmsplice在用户缓冲区与管道的环形缓冲区之间直接复制数据，不经过中间缓冲区。
+
+use alloc::{sync::Arc, vec::Vec};
+
+use crate::{
+    driver::base::block::SeekFrom,
+    ipc::pipe::LockedPipeInode,
+    libs::spinlock::SpinLock,
+    process::ProcessManager,
+    syscall::{
+        user_access::{UserBufferReader, UserBufferWriter},
+        Syscall, SystemError,
+    },
+};
+
+use super::{
+    file::{File, FileMode},
+    syscall::{IoVec, IoVecs},
+    FileType,
+};
+
+/// 每次在内核中转发的最大字节数
+const SPLICE_CHUNK_SIZE: usize = 64 * 1024;
+/// vmsplice一次最多接受的iovec数量
+const UIO_MAXIOV: usize = 1024;
+
+/// splice的flags：提示内核移动页而不是复制（目前忽略）
+pub const SPLICE_F_MOVE: u32 = 1;
+/// splice的flags：不阻塞（目前忽略，是否阻塞由文件自身决定）
+pub const SPLICE_F_NONBLOCK: u32 = 2;
+/// splice的flags：后面还有更多数据（目前忽略）
+pub const SPLICE_F_MORE: u32 = 4;
+/// splice的flags：vmsplice使用，把用户页“赠送”给管道（管道的页不与用户空间共享，因此仍然复制）
+pub const SPLICE_F_GIFT: u32 = 8;
+
+fn get_file(fd: i32) -> Result<Arc<SpinLock<File>>, SystemError> {
+    return ProcessManager::current_pcb()
+        .fd_table()
+        .read()
+        .get_file_by_fd(fd)
+        .ok_or(SystemError::EBADF);
+}
+
+/// 从用户空间读取偏移量。`offset`为空指针时返回None
+fn read_user_offset(offset: *mut i64) -> Result<Option<usize>, SystemError> {
+    if offset.is_null() {
+        return Ok(None);
+    }
+    let reader = UserBufferReader::new(offset, core::mem::size_of::<i64>(), true)?;
+    let value = *reader.read_one_from_user::<i64>(0)?;
+    if value < 0 {
+        return Err(SystemError::EINVAL);
+    }
+    return Ok(Some(value as usize));
+}
+
+fn write_user_offset(offset: *mut i64, value: usize) -> Result<(), SystemError> {
+    let mut writer = UserBufferWriter::new(offset, core::mem::size_of::<i64>(), true)?;
+    writer.copy_one_to_user(&(value as i64), 0)?;
+    return Ok(());
+}
+
+/// 把最多`len`字节从`input`转发到`output`
+///
+/// - `in_offset`为Some时，从这个偏移量开始读取（不改变文件指针），并按照实际写出的字节数前进，
+///   因此输出文件只接受了一部分数据时，剩余的数据不会丢失；为None时，输入是管道等流式文件，
+///   读出的数据必须全部写出，写出失败时这部分数据会丢失
+/// - `out_offset`为Some时，写入这个偏移量（不改变文件指针）；为None时使用输出文件的文件指针
+///
+/// @return 转发的字节数。已经转发了一部分数据之后遇到的错误不会返回，与Linux相同
+fn do_splice(
+    input: &Arc<SpinLock<File>>,
+    mut in_offset: Option<&mut usize>,
+    output: &Arc<SpinLock<File>>,
+    mut out_offset: Option<&mut usize>,
+    len: usize,
+) -> Result<usize, SystemError> {
+    let mut buf: Vec<u8> = vec![0; len.min(SPLICE_CHUNK_SIZE)];
+    let mut total = 0;
+    while total < len {
+        let chunk = (len - total).min(buf.len());
+        // 输入与输出可能是同一个文件，因此分别加锁
+        let read_result = match in_offset.as_deref() {
+            Some(offset) => input.lock_no_preempt().pread(*offset, chunk, &mut buf),
+            None => input.lock_no_preempt().read(chunk, &mut buf),
+        };
+        let n = match read_result {
+            Ok(0) => break,
+            Ok(n) => n,
+            Err(e) if total == 0 => return Err(e),
+            Err(_) => break,
+        };
+
+        let mut written = 0;
+        let mut write_error = None;
+        while written < n {
+            let data = &buf[written..n];
+            let write_result = match out_offset.as_deref_mut() {
+                Some(offset) => {
+                    let r = output.lock_no_preempt().pwrite(*offset, data.len(), data);
+                    if let Ok(w) = r {
+                        *offset += w;
+                    }
+                    r
+                }
+                None => output.lock_no_preempt().write(data.len(), data),
+            };
+            match write_result {
+                Ok(0) => break,
+                Ok(w) => written += w,
+                Err(e) => {
+                    write_error = Some(e);
+                    break;
+                }
+            }
+            // 输入可以重新读取时不需要反复重试，剩余的数据留给下一次调用
+            if in_offset.is_some() {
+                break;
+            }
+        }
+
+        if let Some(offset) = in_offset.as_deref_mut() {
+            *offset += written;
+        }
+        total += written;
+        if let Some(e) = write_error {
+            if total == 0 {
+                return Err(e);
+            }
+            break;
+        }
+        if written < n || n < chunk {
+            break;
+        }
+    }
+    return Ok(total);
+}
+
+impl Syscall {
+    /// 把`in_fd`中最多`count`字节的数据直接发送到`out_fd`
+    ///
+    /// `offset`不为空时，从`*offset`开始读取，不改变`in_fd`的文件指针，并把读取结束的位置写回`*offset`；
+    /// 否则从`in_fd`的文件指针开始读取，并更新文件指针。`in_fd`必须是可以定位的文件
+    pub fn sendfile(
+        out_fd: i32,
+        in_fd: i32,
+        offset: *mut i64,
+        count: usize,
+    ) -> Result<usize, SystemError> {
+        let input = get_file(in_fd)?;
+        let output = get_file(out_fd)?;
+        if matches!(
+            input.lock().file_type(),
+            FileType::Pipe | FileType::Socket | FileType::CharDevice | FileType::Dir
+        ) {
+            return Err(SystemError::EINVAL);
+        }
+
+        match read_user_offset(offset)? {
+            Some(mut pos) => {
+                let r = do_splice(&input, Some(&mut pos), &output, None, count)?;
+                write_user_offset(offset, pos)?;
+                return Ok(r);
+            }
+            None => {
+                let mut pos = input.lock().lseek(SeekFrom::SeekCurrent(0))?;
+                let r = do_splice(&input, Some(&mut pos), &output, None, count)?;
+                input.lock().lseek(SeekFrom::SeekSet(pos as i64))?;
+                return Ok(r);
+            }
+        }
+    }
+
+    /// 在两个文件之间转发最多`len`字节的数据，其中至少一个必须是管道
+    ///
+    /// 管道一侧的偏移量必须为空指针。另一侧的偏移量规则与sendfile相同
+    pub fn splice(
+        fd_in: i32,
+        off_in: *mut i64,
+        fd_out: i32,
+        off_out: *mut i64,
+        len: usize,
+        flags: u32,
+    ) -> Result<usize, SystemError> {
+        if flags & !(SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE | SPLICE_F_GIFT) != 0 {
+            return Err(SystemError::EINVAL);
+        }
+        let input = get_file(fd_in)?;
+        let output = get_file(fd_out)?;
+        let in_pipe = input.lock().file_type() == FileType::Pipe;
+        let out_pipe = output.lock().file_type() == FileType::Pipe;
+        if !in_pipe && !out_pipe {
+            return Err(SystemError::EINVAL);
+        }
+        if (in_pipe && !off_in.is_null()) || (out_pipe && !off_out.is_null()) {
+            return Err(SystemError::ESPIPE);
+        }
+        if len == 0 {
+            return Ok(0);
+        }
+
+        // 输入不是管道时，总是按照偏移量读取，使得输出只接受了一部分数据时，剩余的数据不会丢失
+        let user_in_offset = read_user_offset(off_in)?;
+        let mut in_pos = match user_in_offset {
+            Some(pos) => Some(pos),
+            None if !in_pipe => Some(input.lock().lseek(SeekFrom::SeekCurrent(0))?),
+            None => None,
+        };
+        let mut out_pos = read_user_offset(off_out)?;
+
+        let r = do_splice(&input, in_pos.as_mut(), &output, out_pos.as_mut(), len)?;
+
+        if let Some(pos) = in_pos {
+            if user_in_offset.is_some() {
+                write_user_offset(off_in, pos)?;
+            } else {
+                input.lock().lseek(SeekFrom::SeekSet(pos as i64))?;
+            }
+        }
+        if let Some(pos) = out_pos {
+            write_user_offset(off_out, pos)?;
+        }
+        return Ok(r);
+    }
+    /// 在用户缓冲区与管道之间直接传输数据
+    ///
+    /// `fd`是管道的写端时，把`iov`描述的数据写入管道；是读端时，把管道中的数据读入`iov`描述的缓冲区。
+    /// 写入不超过PIPE_BUF字节时是原子的，与write相同
+    pub fn vmsplice(fd: i32, iov: usize, nr_segs: usize, flags: u32) -> Result<usize, SystemError> {
+        if flags & !(SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE | SPLICE_F_GIFT) != 0 {
+            return Err(SystemError::EINVAL);
+        }
+        if nr_segs > UIO_MAXIOV {
+            return Err(SystemError::EINVAL);
+        }
+        let file = get_file(fd)?;
+        let guard = file.lock_no_preempt();
+        if guard.file_type() != FileType::Pipe {
+            return Err(SystemError::EBADF);
+        }
+        let inode = guard.inode();
+        let mode = guard.mode();
+        drop(guard);
+        let pipe = inode
+            .as_any_ref()
+            .downcast_ref::<LockedPipeInode>()
+            .ok_or(SystemError::EBADF)?;
+        let nonblock = flags & SPLICE_F_NONBLOCK != 0 || mode.contains(FileMode::O_NONBLOCK);
+        let to_pipe = mode.accmode() == FileMode::O_WRONLY.bits();
+
+        // IoVecs会进行用户态检验
+        let mut iovecs = unsafe { IoVecs::from_user(iov as *const IoVec, nr_segs, !to_pipe) }?;
+        if to_pipe {
+            let bufs: Vec<&[u8]> = iovecs.iter().collect();
+            return pipe.write_bufs(&bufs, nonblock);
+        }
+        let mut bufs: Vec<&mut [u8]> = iovecs.iter_mut().collect();
+        return pipe.read_bufs(&mut bufs, nonblock);
+    }
+}
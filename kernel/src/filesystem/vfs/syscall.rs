@@ -1,5 +1,7 @@
 use core::ffi::CStr;
 
+use num_traits::FromPrimitive;
+
 use alloc::{
     string::{String, ToString},
     sync::Arc,
@@ -9,13 +11,13 @@ use alloc::{
 use crate::{
     driver::base::{block::SeekFrom, device::DeviceNumber},
     filesystem::vfs::file::FileDescriptorVec,
-    include::bindings::bindings::verify_area,
+    ipc::pipe::LockedPipeInode,
     kerror,
-    libs::rwlock::RwLockWriteGuard,
+    libs::{rwlock::RwLockWriteGuard, spinlock::SpinLock},
     mm::VirtAddr,
     process::ProcessManager,
     syscall::{
-        user_access::{check_and_clone_cstr, UserBufferReader, UserBufferWriter},
+        user_access::{check_and_clone_cstr, UserBufferReader, UserBufferWriter, UserSlice},
         Syscall, SystemError,
     },
     time::TimeSpec,
@@ -23,11 +25,11 @@ use crate::{
 
 use super::{
     core::{do_mkdir, do_remove_dir, do_unlink_at},
-    fcntl::{AtFlags, FcntlCommand, FD_CLOEXEC},
+    fcntl::{AtFlags, FadvAdvice, FcntlCommand, SyncFileRangeFlags, FD_CLOEXEC},
     file::{File, FileMode},
     open::{do_faccessat, do_fchmodat, do_sys_open},
     utils::{rsplit_path, user_path_at},
-    Dirent, FileType, IndexNode, MAX_PATHLEN, ROOT_INODE, VFS_MAX_FOLLOW_SYMLINK_TIMES,
+    FileType, IndexNode, MAX_PATHLEN, ROOT_INODE, VFS_MAX_FOLLOW_SYMLINK_TIMES,
 };
 // use crate::kdebug;
 
@@ -453,18 +455,15 @@ impl Syscall {
         return Ok(VirtAddr::new(buf.as_ptr() as usize));
     }
 
-    /// @brief 获取目录中的数据
+    /// @brief 获取目录中的数据（getdents64）
     ///
-    /// TODO: 这个函数的语义与Linux不一致，需要修改！！！
+    /// 从目录的当前位置开始，把`buf`放得下的所有目录项一次写入`buf`
     ///
     /// @param fd 文件描述符号
     /// @param buf 输出缓冲区
     ///
-    /// @return 成功返回读取的字节数，失败返回错误码
+    /// @return 成功返回读取的字节数（读到目录末尾时为0），失败返回错误码
     pub fn getdents(fd: i32, buf: &mut [u8]) -> Result<usize, SystemError> {
-        let dirent =
-            unsafe { (buf.as_mut_ptr() as *mut Dirent).as_mut() }.ok_or(SystemError::EFAULT)?;
-
         if fd < 0 || fd as usize > FileDescriptorVec::PROCESS_MAX_FD {
             return Err(SystemError::EBADF);
         }
@@ -479,9 +478,7 @@ impl Syscall {
         // drop guard 以避免无法调度的问题
         drop(fd_table_guard);
 
-        let res = file.lock_no_preempt().readdir(dirent).map(|x| x as usize);
-
-        return res;
+        return file.lock_no_preempt().readdir(buf);
     }
 
     /// @brief 创建文件夹
@@ -557,10 +554,12 @@ impl Syscall {
             .get_file_by_fd(oldfd)
             .ok_or(SystemError::EBADF)?;
 
-        let new_file = old_file
+        let mut new_file = old_file
             .lock_no_preempt()
             .try_clone()
             .ok_or(SystemError::EBADF)?;
+        // 新的文件描述符不继承FD_CLOEXEC
+        new_file.set_close_on_exec(false);
         // 申请文件描述符，并把文件对象存入其中
         let res = fd_table_guard.alloc_fd(new_file, None).map(|x| x as usize);
         return res;
@@ -585,7 +584,7 @@ impl Syscall {
         return Self::do_dup2(oldfd, newfd, &mut fd_table_guard);
     }
 
-    fn do_dup2(
+    pub fn do_dup2(
         oldfd: i32,
         newfd: i32,
         fd_table_guard: &mut RwLockWriteGuard<'_, FileDescriptorVec>,
@@ -611,10 +610,12 @@ impl Syscall {
         let old_file = fd_table_guard
             .get_file_by_fd(oldfd)
             .ok_or(SystemError::EBADF)?;
-        let new_file = old_file
+        let mut new_file = old_file
             .lock_no_preempt()
             .try_clone()
             .ok_or(SystemError::EBADF)?;
+        // 新的文件描述符不继承FD_CLOEXEC
+        new_file.set_close_on_exec(false);
         // 申请文件描述符，并把文件对象存入其中
         let res = fd_table_guard
             .alloc_fd(new_file, Some(newfd))
@@ -632,50 +633,40 @@ impl Syscall {
     pub fn fcntl(fd: i32, cmd: FcntlCommand, arg: i32) -> Result<usize, SystemError> {
         match cmd {
             FcntlCommand::DupFd => {
-                if arg < 0 || arg as usize >= FileDescriptorVec::PROCESS_MAX_FD {
-                    return Err(SystemError::EBADF);
-                }
-                let arg = arg as usize;
-                for i in arg..FileDescriptorVec::PROCESS_MAX_FD {
-                    let binding = ProcessManager::current_pcb().fd_table();
-                    let mut fd_table_guard = binding.write();
-                    if fd_table_guard.get_file_by_fd(fd).is_none() {
-                        return Self::do_dup2(fd, i as i32, &mut fd_table_guard);
-                    }
+                let binding = ProcessManager::current_pcb().fd_table();
+                let mut fd_table_guard = binding.write();
+                if arg < 0 || arg as usize >= fd_table_guard.max_fds() {
+                    return Err(SystemError::EINVAL);
                 }
-                return Err(SystemError::EMFILE);
+                let old_file = fd_table_guard
+                    .get_file_by_fd(fd)
+                    .ok_or(SystemError::EBADF)?;
+                let mut new_file = old_file
+                    .lock_no_preempt()
+                    .try_clone()
+                    .ok_or(SystemError::EBADF)?;
+                // 新的文件描述符不继承FD_CLOEXEC
+                new_file.set_close_on_exec(false);
+                return fd_table_guard
+                    .alloc_fd_from(new_file, arg as usize)
+                    .map(|x| x as usize);
             }
             FcntlCommand::GetFd => {
                 // Get file descriptor flags.
                 let binding = ProcessManager::current_pcb().fd_table();
                 let fd_table_guard = binding.read();
-                if let Some(file) = fd_table_guard.get_file_by_fd(fd) {
-                    // drop guard 以避免无法调度的问题
-                    drop(fd_table_guard);
-
-                    if file.lock().close_on_exec() {
-                        return Ok(FD_CLOEXEC as usize);
-                    }
+                if fd_table_guard.get_close_on_exec(fd)? {
+                    return Ok(FD_CLOEXEC as usize);
                 }
-                return Err(SystemError::EBADF);
+                return Ok(0);
             }
             FcntlCommand::SetFd => {
                 // Set file descriptor flags.
                 let binding = ProcessManager::current_pcb().fd_table();
-                let fd_table_guard = binding.write();
-
-                if let Some(file) = fd_table_guard.get_file_by_fd(fd) {
-                    // drop guard 以避免无法调度的问题
-                    drop(fd_table_guard);
-                    let arg = arg as u32;
-                    if arg & FD_CLOEXEC != 0 {
-                        file.lock().set_close_on_exec(true);
-                    } else {
-                        file.lock().set_close_on_exec(false);
-                    }
-                    return Ok(0);
-                }
-                return Err(SystemError::EBADF);
+                let mut fd_table_guard = binding.write();
+                let arg = arg as u32;
+                fd_table_guard.set_close_on_exec(fd, arg & FD_CLOEXEC != 0)?;
+                return Ok(0);
             }
 
             FcntlCommand::GetFlags => {
@@ -707,6 +698,28 @@ impl Syscall {
 
                 return Err(SystemError::EBADF);
             }
+            FcntlCommand::GetPipeSize | FcntlCommand::SetPipeSize => {
+                let binding = ProcessManager::current_pcb().fd_table();
+                let fd_table_guard = binding.read();
+                let file = fd_table_guard
+                    .get_file_by_fd(fd)
+                    .ok_or(SystemError::EBADF)?;
+                // drop guard 以避免无法调度的问题
+                drop(fd_table_guard);
+
+                let inode = file.lock_no_preempt().inode();
+                let pipe = inode
+                    .as_any_ref()
+                    .downcast_ref::<LockedPipeInode>()
+                    .ok_or(SystemError::EBADF)?;
+                if cmd == FcntlCommand::GetPipeSize {
+                    return Ok(pipe.pipe_size());
+                }
+                if arg < 0 {
+                    return Err(SystemError::EINVAL);
+                }
+                return pipe.set_pipe_size(arg as usize);
+            }
             _ => {
                 // TODO: unimplemented
                 // 未实现的命令，返回0，不报错。
@@ -747,6 +760,124 @@ impl Syscall {
         return Err(SystemError::EBADF);
     }
 
+    /// # posix_fadvise - 告诉内核将要怎样访问文件的数据
+    ///
+    /// ## 参数
+    ///
+    /// - `fd`: 文件描述符
+    /// - `offset`: 建议作用的范围的起始偏移量
+    /// - `len`: 范围的长度，为0时表示到文件末尾
+    /// - `advice`: 建议，见[`FadvAdvice`]
+    pub fn fadvise64(fd: i32, offset: i64, len: i64, advice: usize) -> Result<usize, SystemError> {
+        let advice =
+            <FadvAdvice as FromPrimitive>::from_usize(advice).ok_or(SystemError::EINVAL)?;
+        if offset < 0 || len < 0 {
+            return Err(SystemError::EINVAL);
+        }
+        let binding = ProcessManager::current_pcb().fd_table();
+        let fd_table_guard = binding.read();
+        let file = fd_table_guard
+            .get_file_by_fd(fd)
+            .ok_or(SystemError::EBADF)?;
+        // drop guard 以避免无法调度的问题
+        drop(fd_table_guard);
+        file.lock_no_preempt()
+            .fadvise(offset as usize, len as usize, advice)?;
+        return Ok(0);
+    }
+
+    /// # fallocate - 为文件预先分配磁盘空间
+    ///
+    /// 需要写入大文件的程序可以先用它一次分配好空间：文件系统尽量分配连续的空间，
+    /// 之后的写入不需要再分配，文件也不会产生碎片
+    ///
+    /// ## 参数
+    ///
+    /// - `fd`: 文件描述符
+    /// - `mode`: 只支持0（默认模式：文件大小不足offset + len时被扩展，扩展的部分读出0）
+    /// - `offset`: 范围的起始偏移量
+    /// - `len`: 范围的长度
+    pub fn fallocate(fd: i32, mode: u32, offset: i64, len: i64) -> Result<usize, SystemError> {
+        if offset < 0 || len <= 0 {
+            return Err(SystemError::EINVAL);
+        }
+        let binding = ProcessManager::current_pcb().fd_table();
+        let fd_table_guard = binding.read();
+        let file = fd_table_guard
+            .get_file_by_fd(fd)
+            .ok_or(SystemError::EBADF)?;
+        // drop guard 以避免无法调度的问题
+        drop(fd_table_guard);
+        file.lock_no_preempt()
+            .fallocate(mode, offset as usize, len as usize)?;
+        return Ok(0);
+    }
+
+    /// # fsync/fdatasync - 把文件的数据同步到设备上
+    ///
+    /// ## 参数
+    ///
+    /// - `fd`: 文件描述符
+    /// - `datasync`: 为true时（fdatasync），只同步读取数据所必需的元数据
+    pub fn fsync(fd: i32, datasync: bool) -> Result<usize, SystemError> {
+        let binding = ProcessManager::current_pcb().fd_table();
+        let fd_table_guard = binding.read();
+        let file = fd_table_guard
+            .get_file_by_fd(fd)
+            .ok_or(SystemError::EBADF)?;
+        // drop guard 以避免无法调度的问题
+        drop(fd_table_guard);
+        // 写回期间可能需要休眠，因此不持有文件的锁
+        let inode = file.lock().inode();
+        if datasync {
+            inode.datasync()?;
+        } else {
+            inode.sync()?;
+        }
+        return Ok(0);
+    }
+
+    /// # sync_file_range - 写回文件指定范围内的脏页
+    ///
+    /// 页面缓存的写回是同步的，因此指定了`SYNC_FILE_RANGE_WRITE`时，返回前写回已经完成；
+    /// 只有等待标志时，没有需要等待的写回。与Linux相同，不同步文件的元数据，也不刷新设备的缓存
+    ///
+    /// ## 参数
+    ///
+    /// - `fd`: 文件描述符
+    /// - `offset`: 范围的起始偏移量
+    /// - `nbytes`: 范围的长度，为0时表示到文件末尾
+    /// - `flags`: 见[`SyncFileRangeFlags`]
+    pub fn sync_file_range(
+        fd: i32,
+        offset: i64,
+        nbytes: i64,
+        flags: u32,
+    ) -> Result<usize, SystemError> {
+        let flags = SyncFileRangeFlags::from_bits(flags).ok_or(SystemError::EINVAL)?;
+        if offset < 0 || nbytes < 0 || offset.checked_add(nbytes).is_none() {
+            return Err(SystemError::EINVAL);
+        }
+        let binding = ProcessManager::current_pcb().fd_table();
+        let fd_table_guard = binding.read();
+        let file = fd_table_guard
+            .get_file_by_fd(fd)
+            .ok_or(SystemError::EBADF)?;
+        // drop guard 以避免无法调度的问题
+        drop(fd_table_guard);
+        let inode = file.lock().inode();
+        match inode.metadata()?.file_type {
+            FileType::File | FileType::Dir | FileType::BlockDevice | FileType::SymLink => {}
+            _ => return Err(SystemError::ESPIPE),
+        }
+        if flags.contains(SyncFileRangeFlags::SYNC_FILE_RANGE_WRITE) {
+            if let Some(cache) = inode.page_cache() {
+                cache.writeback_range(offset as usize, nbytes as usize)?;
+            }
+        }
+        return Ok(0);
+    }
+
     fn do_fstat(fd: i32) -> Result<PosixKstat, SystemError> {
         let binding = ProcessManager::current_pcb().fd_table();
         let fd_table_guard = binding.read();
@@ -853,24 +984,66 @@ impl Syscall {
     pub fn writev(fd: i32, iov: usize, count: usize) -> Result<usize, SystemError> {
         // IoVecs会进行用户态检验
         let iovecs = unsafe { IoVecs::from_user(iov as *const IoVec, count, false) }?;
+        let bufs: Vec<&[u8]> = iovecs.iter().collect();
 
-        let data = iovecs.gather();
-
-        Self::write(fd, &data)
+        let file = Self::vectored_file(fd)?;
+        return file.lock_no_preempt().writev(&bufs);
     }
 
     pub fn readv(fd: i32, iov: usize, count: usize) -> Result<usize, SystemError> {
         // IoVecs会进行用户态检验
         let mut iovecs = unsafe { IoVecs::from_user(iov as *const IoVec, count, true) }?;
+        let mut bufs: Vec<&mut [u8]> = iovecs.iter_mut().collect();
 
-        let mut data = Vec::new();
-        data.resize(iovecs.0.iter().map(|x| x.len()).sum(), 0);
+        let file = Self::vectored_file(fd)?;
+        return file.lock_no_preempt().readv(&mut bufs);
+    }
 
-        let len = Self::read(fd, &mut data)?;
+    /// @brief 从文件的指定偏移量把数据依次读入多个缓冲区，不改变文件指针
+    ///
+    /// @param offset 开始读取的偏移量
+    ///
+    /// @return Ok(usize) 成功读取的字节数
+    pub fn preadv(fd: i32, iov: usize, count: usize, offset: i64) -> Result<usize, SystemError> {
+        if offset < 0 {
+            return Err(SystemError::EINVAL);
+        }
+        let mut iovecs = unsafe { IoVecs::from_user(iov as *const IoVec, count, true) }?;
+        let mut bufs: Vec<&mut [u8]> = iovecs.iter_mut().collect();
 
-        iovecs.scatter(&data[..len]);
+        let file = Self::vectored_file(fd)?;
+        let mut file = file.lock_no_preempt();
+        if matches!(file.file_type(), FileType::Pipe | FileType::Socket) {
+            return Err(SystemError::ESPIPE);
+        }
+        return file.preadv(offset as usize, &mut bufs);
+    }
 
-        return Ok(len);
+    /// @brief 把多个缓冲区中的数据依次写入文件的指定偏移量，不改变文件指针
+    ///
+    /// @param offset 开始写入的偏移量
+    ///
+    /// @return Ok(usize) 成功写入的字节数
+    pub fn pwritev(fd: i32, iov: usize, count: usize, offset: i64) -> Result<usize, SystemError> {
+        if offset < 0 {
+            return Err(SystemError::EINVAL);
+        }
+        let iovecs = unsafe { IoVecs::from_user(iov as *const IoVec, count, false) }?;
+        let bufs: Vec<&[u8]> = iovecs.iter().collect();
+
+        let file = Self::vectored_file(fd)?;
+        let mut file = file.lock_no_preempt();
+        if matches!(file.file_type(), FileType::Pipe | FileType::Socket) {
+            return Err(SystemError::ESPIPE);
+        }
+        return file.pwritev(offset as usize, &bufs);
+    }
+
+    /// 取出readv等向量读写系统调用操作的文件
+    fn vectored_file(fd: i32) -> Result<Arc<SpinLock<File>>, SystemError> {
+        let binding = ProcessManager::current_pcb().fd_table();
+        let fd_table_guard = binding.read();
+        return fd_table_guard.get_file_by_fd(fd).ok_or(SystemError::EBADF);
     }
 
     pub fn readlink_at(
@@ -975,8 +1148,8 @@ pub struct IoVec {
 
 /// 用于存储多个来自用户空间的IoVec
 ///
-/// 由于目前内核中的文件系统还不支持分散读写，所以暂时只支持将用户空间的IoVec聚合成一个缓冲区，然后进行操作。
-/// TODO：支持分散读写
+/// readv/writev等系统调用通过iter/iter_mut把各个缓冲区直接交给文件，不经过临时缓冲区。
+/// gather/scatter只用于需要一次处理全部数据的场合（例如数据报socket）
 #[derive(Debug)]
 pub struct IoVecs(Vec<&'static mut [u8]>);
 
@@ -993,16 +1166,8 @@ impl IoVecs {
         iovcnt: usize,
         _readv: bool,
     ) -> Result<Self, SystemError> {
-        // 检查iov指针所在空间是否合法
-        if !verify_area(
-            iov as usize as u64,
-            (iovcnt * core::mem::size_of::<IoVec>()) as u64,
-        ) {
-            return Err(SystemError::EFAULT);
-        }
-
-        // 将用户空间的IoVec转换为引用（注意：这里的引用是静态的，因为用户空间的IoVec不会被释放）
-        let iovs: &[IoVec] = core::slice::from_raw_parts(iov, iovcnt);
+        // 把用户空间的IoVec数组一次拷贝到内核中：只检查一次地址范围，之后也不会再读取用户空间中的数组
+        let iovs: Vec<IoVec> = UserSlice::new_array(iov, iovcnt)?.read_array()?;
 
         let mut slices: Vec<&mut [u8]> = vec![];
         slices.reserve(iovs.len());
@@ -1012,16 +1177,26 @@ impl IoVecs {
                 continue;
             }
 
-            if !verify_area(iov.iov_base as usize as u64, iov.iov_len as u64) {
-                return Err(SystemError::EFAULT);
-            }
-
-            slices.push(core::slice::from_raw_parts_mut(iov.iov_base, iov.iov_len));
+            let buf = UserSlice::new(VirtAddr::new(iov.iov_base as usize), iov.iov_len)?;
+            slices.push(core::slice::from_raw_parts_mut(
+                buf.addr().data() as *mut u8,
+                buf.len(),
+            ));
         }
 
         return Ok(Self(slices));
     }
 
+    /// @brief 依次遍历IoVecs中的各个缓冲区
+    pub fn iter(&self) -> impl Iterator<Item = &[u8]> {
+        return self.0.iter().map(|slice| &**slice);
+    }
+
+    /// @brief 依次遍历IoVecs中的各个缓冲区（可写）
+    pub fn iter_mut(&mut self) -> impl Iterator<Item = &mut [u8]> {
+        return self.0.iter_mut().map(|slice| &mut **slice);
+    }
+
     /// @brief 将IoVecs中的数据聚合到一个缓冲区中
     ///
     /// @return 返回聚合后的缓冲区
@@ -0,0 +1,207 @@
+//! 页面缓存中脏页的写回
+//!
+//! 写入支持页面缓存的文件时，数据只写入缓存页（包括超出文件末尾的部分，文件系统在写回时才分配空间），
+//! 脏页由后备设备（[`BackingDevInfo`]，每个文件系统一个）的flusher内核线程在后台写回：
+//!
+//! - flusher线程每隔`DIRTY_WRITEBACK_INTERVAL`醒来一次，写回变脏超过`DIRTY_EXPIRE`的页面
+//! - 全局的脏页数量超过后台阈值（内存的`DIRTY_BACKGROUND_RATIO`%）时，写入者唤醒flusher线程，
+//!   由它写回设备上所有的脏页
+//! - 脏页数量超过阈值（内存的`DIRTY_RATIO`%）时，写入者不能再等待flusher线程，
+//!   需要自己同步地写回文件的脏页，从而限制脏页增长的速度
+//!
+//! 写回文件的数据之后，flusher线程还会同步文件系统的元数据（例如FAT表和目录项），
+//! 因此只修改了元数据的操作（创建、删除文件等）也会被定期写回。
+
+use core::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+
+use alloc::{
+    boxed::Box,
+    format,
+    string::String,
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+
+use crate::{
+    arch::mm::LockedFrameAllocator,
+    driver::base::block::request_queue::BlkPlug,
+    kinfo, kwarn,
+    libs::spinlock::SpinLock,
+    process::{
+        kthread::{KernelThreadClosure, KernelThreadMechanism},
+        ProcessControlBlock, ProcessManager,
+    },
+    time::{
+        clocksource::HZ,
+        timer::{clock, schedule_timeout},
+    },
+};
+
+use super::{
+    page_cache::{page_cache_nr_dirty, PageCache},
+    FileSystem,
+};
+
+/// flusher线程的写回间隔（单位：jiffies，即微秒）
+const DIRTY_WRITEBACK_INTERVAL: i64 = 5000000;
+/// 页面变脏超过这个时间（单位：jiffies）之后，由flusher线程写回
+const DIRTY_EXPIRE: u64 = 30 * HZ;
+/// 脏页占内存的百分比超过这个值时，flusher线程在后台写回所有的脏页
+const DIRTY_BACKGROUND_RATIO: usize = 10;
+/// 脏页占内存的百分比超过这个值时，写入者同步写回自己的脏页
+const DIRTY_RATIO: usize = 20;
+
+static DIRTY_BACKGROUND_THRESH: AtomicUsize = AtomicUsize::new(usize::MAX);
+static DIRTY_THRESH: AtomicUsize = AtomicUsize::new(usize::MAX);
+static NEXT_BDI_ID: AtomicUsize = AtomicUsize::new(0);
+
+/// 后备设备：保存页面缓存数据的设备。每个后备设备有自己的flusher线程
+#[derive(Debug)]
+pub struct BackingDevInfo {
+    name: String,
+    /// 这个设备上的页面缓存
+    caches: SpinLock<Vec<Weak<PageCache>>>,
+    /// 设备上的文件系统，写回文件数据之后同步它的元数据
+    fs: SpinLock<Option<Weak<dyn FileSystem>>>,
+    flusher: SpinLock<Option<Arc<ProcessControlBlock>>>,
+    /// flusher线程是否正在休眠
+    flusher_sleeping: AtomicBool,
+    /// flusher线程下一次醒来时写回所有的脏页，而不只是过期的脏页
+    flush_all: AtomicBool,
+}
+
+impl BackingDevInfo {
+    /// 创建一个后备设备，并启动它的flusher线程（需要在内核线程机制初始化完成之后调用）
+    pub fn new() -> Arc<Self> {
+        let bdi = Arc::new(Self {
+            name: format!("flush-{}", NEXT_BDI_ID.fetch_add(1, Ordering::Relaxed)),
+            caches: SpinLock::new(Vec::new()),
+            fs: SpinLock::new(None),
+            flusher: SpinLock::new(None),
+            flusher_sleeping: AtomicBool::new(false),
+            flush_all: AtomicBool::new(false),
+        });
+
+        // flusher线程只持有弱引用，后备设备被释放之后，线程随之退出
+        let weak = Arc::downgrade(&bdi);
+        let closure =
+            KernelThreadClosure::EmptyClosure((Box::new(move || flusher_thread(weak.clone())), ()));
+        match KernelThreadMechanism::create_and_run(closure, bdi.name.clone()) {
+            Some(pcb) => *bdi.flusher.lock() = Some(pcb),
+            None => kwarn!("Failed to create flusher thread {}", bdi.name),
+        }
+        return bdi;
+    }
+
+    /// 设置设备上的文件系统
+    pub fn set_fs(&self, fs: Weak<dyn FileSystem>) {
+        *self.fs.lock() = Some(fs);
+    }
+
+    /// 把页面缓存加入这个设备，由flusher线程写回它的脏页
+    pub fn register(&self, cache: &Arc<PageCache>) {
+        let mut caches = self.caches.lock();
+        caches.retain(|c| c.strong_count() > 0);
+        caches.push(Arc::downgrade(cache));
+    }
+
+    fn caches(&self) -> Vec<Arc<PageCache>> {
+        let mut caches = self.caches.lock();
+        caches.retain(|c| c.strong_count() > 0);
+        return caches.iter().filter_map(|c| c.upgrade()).collect();
+    }
+
+    /// 唤醒flusher线程，写回设备上所有的脏页
+    fn kick(&self) {
+        self.flush_all.store(true, Ordering::SeqCst);
+        if !self.flusher_sleeping.load(Ordering::SeqCst) {
+            return;
+        }
+        if let Some(pcb) = self.flusher.lock().as_ref() {
+            ProcessManager::wakeup(pcb).ok();
+        }
+    }
+
+    /// 写回设备上的脏页：脏页过多或者被要求写回所有脏页时，写回全部的脏页，否则只写回过期的脏页
+    ///
+    /// @return 写回的页数
+    fn writeback(&self) -> usize {
+        let flush_all =
+            self.flush_all.swap(false, Ordering::SeqCst) || over_dirty_background_thresh();
+        let expire = if flush_all {
+            None
+        } else {
+            Some(clock().saturating_sub(DIRTY_EXPIRE))
+        };
+
+        let mut written = 0;
+        for cache in self.caches() {
+            // 同一个文件相邻的脏页写回时，在块设备的请求队列中合并成大请求
+            let plug = BlkPlug::start();
+            let r = cache.writeback_expired(expire);
+            if let Err(e) = plug.finish() {
+                kwarn!("{}: failed to dispatch writeback: {:?}", self.name, e);
+            }
+            match r {
+                Ok(n) => written += n,
+                Err(e) => kwarn!("{}: page cache writeback failed: {:?}", self.name, e),
+            }
+        }
+
+        let fs = self.fs.lock().as_ref().and_then(|fs| fs.upgrade());
+        if let Some(fs) = fs {
+            if let Err(e) = fs.sync() {
+                kwarn!("{}: failed to sync filesystem: {:?}", self.name, e);
+            }
+        }
+        return written;
+    }
+}
+
+fn flusher_thread(bdi: Weak<BackingDevInfo>) -> i32 {
+    loop {
+        let dev = match bdi.upgrade() {
+            Some(dev) => dev,
+            None => return 0,
+        };
+        dev.flusher_sleeping.store(false, Ordering::SeqCst);
+        let written = dev.writeback();
+        // 写回期间又有写入者要求写回，并且还有脏页可写时，不休眠
+        if written > 0 && dev.flush_all.load(Ordering::SeqCst) {
+            continue;
+        }
+        dev.flusher_sleeping.store(true, Ordering::SeqCst);
+        drop(dev);
+        schedule_timeout(DIRTY_WRITEBACK_INTERVAL).ok();
+    }
+}
+
+#[inline]
+fn over_dirty_background_thresh() -> bool {
+    return page_cache_nr_dirty() > DIRTY_BACKGROUND_THRESH.load(Ordering::Relaxed);
+}
+
+/// 写入者在弄脏页面之后调用，脏页超过后台阈值时唤醒flusher线程
+///
+/// @return 脏页是否超过了阈值。为true时，写入者需要同步写回自己的脏页
+pub fn balance_dirty_pages(bdi: &BackingDevInfo) -> bool {
+    if !over_dirty_background_thresh() {
+        return false;
+    }
+    bdi.kick();
+    return page_cache_nr_dirty() > DIRTY_THRESH.load(Ordering::Relaxed);
+}
+
+/// 根据内存的大小计算脏页的阈值
+pub fn writeback_init() {
+    let total = LockedFrameAllocator.get_usage().total().data();
+    let background = total * DIRTY_BACKGROUND_RATIO / 100;
+    let thresh = total * DIRTY_RATIO / 100;
+    DIRTY_BACKGROUND_THRESH.store(background, Ordering::Relaxed);
+    DIRTY_THRESH.store(thresh, Ordering::Relaxed);
+    kinfo!(
+        "writeback: dirty background thresh={} pages, dirty thresh={} pages",
+        background,
+        thresh
+    );
+}
@@ -0,0 +1,198 @@
+//! 启动阶段的耗时统计
+//!
+//! 记录启动过程中每个初始化阶段（`system_initialize`中的各个初始化函数、初始内核线程中的文件系统挂载、
+//! 设备探测、网络初始化等）开始和结束时的TSC，启动完成时按耗时从大到小输出，并通过`/proc/bootstat`导出。
+//!
+//! 内存管理初始化之前就需要记录，因此记录保存在固定大小的静态表中，记录时只使用原子操作，不分配内存。
+//! TSC的频率在`rs_tsc_init`之后才知道，因此记录的是TSC周期，读取时才换算为微秒。
+//!
+//! 与启动过程并行执行的阶段（例如DHCP）同样会被记录，它们的结束时间可能晚于启动完成的时间。
+
+use core::{
+    cell::UnsafeCell,
+    fmt::Write,
+    sync::atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering},
+};
+
+use alloc::vec::Vec;
+
+use crate::{
+    arch::{driver::tsc::TSCManager, CurrentTimeArch},
+    filesystem::vfs::seq_file::SeqBuf,
+    kinfo,
+    syscall::SystemError,
+    time::TimeArch,
+};
+
+/// 最多记录的阶段数量，超出的阶段不会被记录
+const BOOT_PHASE_MAX: usize = 128;
+/// 启动完成时输出的阶段数量
+const BOOT_REPORT_TOP: usize = 10;
+
+#[derive(Debug, Clone, Copy)]
+struct BootPhaseRecord {
+    name: &'static str,
+    start: u64,
+    end: u64,
+}
+
+struct BootPhaseSlot {
+    ready: AtomicBool,
+    record: UnsafeCell<BootPhaseRecord>,
+}
+
+unsafe impl Sync for BootPhaseSlot {}
+
+impl BootPhaseSlot {
+    const fn new() -> Self {
+        return Self {
+            ready: AtomicBool::new(false),
+            record: UnsafeCell::new(BootPhaseRecord {
+                name: "",
+                start: 0,
+                end: 0,
+            }),
+        };
+    }
+}
+
+static BOOT_PHASES: [BootPhaseSlot; BOOT_PHASE_MAX] = {
+    const SLOT: BootPhaseSlot = BootPhaseSlot::new();
+    [SLOT; BOOT_PHASE_MAX]
+};
+/// 已经分配出去的记录数量
+static BOOT_PHASE_CNT: AtomicUsize = AtomicUsize::new(0);
+/// 第一个阶段开始时的TSC，作为启动的起点
+static BOOT_START: AtomicU64 = AtomicU64::new(0);
+/// 启动完成（即将切换到init进程）时的TSC
+static BOOT_DONE: AtomicU64 = AtomicU64::new(0);
+
+#[inline(always)]
+pub(super) fn now() -> u64 {
+    return CurrentTimeArch::get_cycles() as u64;
+}
+
+/// 记录一个已经结束的阶段
+pub(super) fn boot_phase_record(name: &'static str, start: u64, end: u64) {
+    BOOT_START
+        .compare_exchange(0, start, Ordering::Relaxed, Ordering::Relaxed)
+        .ok();
+    let idx = BOOT_PHASE_CNT.fetch_add(1, Ordering::Relaxed);
+    if idx >= BOOT_PHASE_MAX {
+        return;
+    }
+    let slot = &BOOT_PHASES[idx];
+    unsafe { *slot.record.get() = BootPhaseRecord { name, start, end } };
+    slot.ready.store(true, Ordering::Release);
+}
+
+/// 一个正在进行的启动阶段，被drop时记录它的耗时
+///
+/// 可以跨越`await`，用于记录异步执行的阶段
+#[derive(Debug)]
+pub struct BootPhase {
+    name: &'static str,
+    start: u64,
+}
+
+impl BootPhase {
+    pub fn start(name: &'static str) -> Self {
+        return Self { name, start: now() };
+    }
+}
+
+impl Drop for BootPhase {
+    fn drop(&mut self) {
+        boot_phase_record(self.name, self.start, now());
+    }
+}
+
+/// 执行`f`，并把它的耗时记为名为`name`的启动阶段
+#[inline]
+pub fn boot_phase<R, F: FnOnce() -> R>(name: &'static str, f: F) -> R {
+    let _phase = BootPhase::start(name);
+    return f();
+}
+
+/// 已经记录的所有阶段，按耗时从大到小排序
+fn boot_phases() -> Vec<BootPhaseRecord> {
+    let cnt = BOOT_PHASE_CNT.load(Ordering::Relaxed).min(BOOT_PHASE_MAX);
+    let mut v: Vec<BootPhaseRecord> = BOOT_PHASES[..cnt]
+        .iter()
+        .filter(|slot| slot.ready.load(Ordering::Acquire))
+        .map(|slot| unsafe { *slot.record.get() })
+        .collect();
+    v.sort_by_key(|r| core::cmp::Reverse(r.end.saturating_sub(r.start)));
+    return v;
+}
+
+/// TSC周期换算为微秒。TSC的频率未知时返回None
+fn cycles_to_us(cycles: u64) -> Option<u64> {
+    let khz = TSCManager::tsc_khz();
+    if khz == 0 {
+        return None;
+    }
+    return Some((cycles as u128 * 1000 / khz as u128) as u64);
+}
+
+/// 格式化一段时间：已知TSC频率时以微秒为单位，否则以TSC周期为单位
+struct Duration(u64);
+
+impl core::fmt::Display for Duration {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        let s = match cycles_to_us(self.0) {
+            Some(us) => alloc::format!("{}.{:03}ms", us / 1000, us % 1000),
+            None => alloc::format!("{}cyc", self.0),
+        };
+        return f.pad(&s);
+    }
+}
+
+/// 标记启动完成，输出耗时最长的几个阶段
+pub fn boot_report() {
+    let done = now();
+    BOOT_DONE.store(done, Ordering::Relaxed);
+    let start = BOOT_START.load(Ordering::Relaxed);
+
+    let phases = boot_phases();
+    kinfo!(
+        "Boot finished in {}, slowest phases:",
+        Duration(done.saturating_sub(start))
+    );
+    for r in phases.iter().take(BOOT_REPORT_TOP) {
+        kinfo!(
+            "  {:>12} {}",
+            Duration(r.end.saturating_sub(r.start)),
+            r.name
+        );
+    }
+    let dropped = BOOT_PHASE_CNT
+        .load(Ordering::Relaxed)
+        .saturating_sub(BOOT_PHASE_MAX);
+    if dropped != 0 {
+        kinfo!("  ({} phases not recorded)", dropped);
+    }
+}
+
+/// 输出`/proc/bootstat`：每个阶段相对于启动起点的开始时间、耗时（按耗时从大到小排序）
+pub fn bootstat_show(s: &mut SeqBuf) -> Result<(), SystemError> {
+    let start = BOOT_START.load(Ordering::Relaxed);
+    let done = BOOT_DONE.load(Ordering::Relaxed);
+    if done != 0 {
+        writeln!(s, "total {}", Duration(done.saturating_sub(start))).ok();
+    }
+
+    let phases = boot_phases();
+    writeln!(s, "{:>14} {:>14}  phase", "start", "duration").ok();
+    for r in phases {
+        writeln!(
+            s,
+            "{:>14} {:>14}  {}",
+            Duration(r.start.saturating_sub(start)),
+            Duration(r.end.saturating_sub(r.start)),
+            r.name
+        )
+        .ok();
+    }
+    return Ok(());
+}
@@ -1,4 +1,9 @@
-use super::{init_before_mem_init, init_intertrait};
+use core::ffi::{c_char, CStr};
+
+use super::{
+    bootstat::{boot_phase_record, now},
+    init_before_mem_init, init_intertrait,
+};
 
 #[no_mangle]
 unsafe extern "C" fn rs_init_intertrait() {
@@ -9,3 +14,15 @@ unsafe extern "C" fn rs_init_intertrait() {
 unsafe extern "C" fn rs_init_before_mem_init() {
     init_before_mem_init();
 }
+
+#[no_mangle]
+unsafe extern "C" fn rs_boot_phase_begin() -> u64 {
+    return now();
+}
+
+/// `name`必须是字符串字面量
+#[no_mangle]
+unsafe extern "C" fn rs_boot_phase_end(name: *const c_char, start: u64) {
+    let name: &'static str = CStr::from_ptr(name).to_str().unwrap_or("?");
+    boot_phase_record(name, start, now());
+}
@@ -0,0 +1,219 @@
+//! initramfs
+//!
+//! bootloader可以把一个cpio（newc格式）归档作为multiboot2模块加载，内核启动时把它解包到ramfs的根目录中。
+//! 归档可以使用LZ4压缩（legacy格式，即`lz4 -l`的输出），压缩数据由多个独立的块组成，
+//! 各个块由不绑定cpu的工作队列在所有cpu上并行解压。
+//!
+//! 如果initramfs中包含init程序，则直接使用ramfs作为根文件系统，不再挂载磁盘上的根文件系统。
+
+use alloc::{sync::Arc, vec::Vec};
+
+use crate::{
+    arch::MMArch,
+    driver::base::probe::ProbeGroup,
+    filesystem::vfs::{
+        core::ROOT_INODE, file::FilePrivateData, syscall::ModeType, utils::rsplit_path, FileType,
+        IndexNode,
+    },
+    include::bindings::bindings::LZ4_decompress_safe,
+    kerror, kinfo, kwarn,
+    libs::spinlock::SpinLock,
+    mm::MemoryManagementArch,
+    syscall::SystemError,
+};
+
+/// LZ4 legacy格式的魔数
+const LZ4_LEGACY_MAGIC: u32 = 0x184C2102;
+/// LZ4 legacy格式中，每个块解压后的最大长度
+const LZ4_LEGACY_BLOCK_SIZE: usize = 8 * 1024 * 1024;
+
+/// cpio newc格式的魔数（070702表示带校验和，这里不检查校验和）
+const CPIO_NEWC_MAGIC: &[u8] = b"070701";
+const CPIO_NEWC_CRC_MAGIC: &[u8] = b"070702";
+/// cpio newc格式的头部长度
+const CPIO_NEWC_HEADER_SIZE: usize = 110;
+/// 归档的结束标记
+const CPIO_TRAILER: &str = "TRAILER!!!";
+
+/// 解包bootloader加载的initramfs
+///
+/// ## 返回值
+///
+/// 解包的文件数量。没有initramfs时返回0
+pub fn populate_rootfs() -> usize {
+    let mut total = 0;
+    for module in MMArch::boot_modules() {
+        let vaddr = unsafe { MMArch::phys_2_virt(module.base) }.unwrap();
+        // 模块的内存不会被分配器使用，在整个内核的生命周期中都有效
+        let image: &'static [u8] =
+            unsafe { core::slice::from_raw_parts(vaddr.data() as *const u8, module.size) };
+
+        let r = if image.starts_with(&LZ4_LEGACY_MAGIC.to_le_bytes()) {
+            lz4_legacy_decompress(image).and_then(|archive| unpack_cpio(&archive))
+        } else if image.starts_with(CPIO_NEWC_MAGIC) || image.starts_with(CPIO_NEWC_CRC_MAGIC) {
+            unpack_cpio(image)
+        } else {
+            kwarn!("initramfs: unknown module format at {:?}", module.base);
+            continue;
+        };
+
+        match r {
+            Ok(cnt) => {
+                kinfo!("initramfs: unpacked {} entries from {:?}", cnt, module.base);
+                total += cnt;
+            }
+            Err(e) => {
+                kerror!("initramfs: failed to unpack {:?}: {:?}", module.base, e);
+            }
+        }
+    }
+    return total;
+}
+
+/// 并行解压LZ4 legacy格式的数据
+fn lz4_legacy_decompress(image: &'static [u8]) -> Result<Vec<u8>, SystemError> {
+    // 先找出所有的块，每个块可以独立解压
+    let mut blocks: Vec<&'static [u8]> = Vec::new();
+    let mut pos = 0;
+    while pos + 4 <= image.len() {
+        let word = u32::from_le_bytes(image[pos..pos + 4].try_into().unwrap());
+        pos += 4;
+        // 多个压缩流拼接在一起时，后面的流以魔数开头
+        if word == LZ4_LEGACY_MAGIC {
+            continue;
+        }
+        let size = word as usize;
+        // 模块按页对齐，末尾的填充是0
+        if size == 0 {
+            break;
+        }
+        if pos + size > image.len() {
+            return Err(SystemError::EINVAL);
+        }
+        blocks.push(&image[pos..pos + size]);
+        pos += size;
+    }
+
+    let results: Arc<SpinLock<Vec<Option<Vec<u8>>>>> =
+        Arc::new(SpinLock::new(vec![None; blocks.len()]));
+    let group = ProbeGroup::new();
+    for (i, block) in blocks.iter().enumerate() {
+        let block: &'static [u8] = block;
+        let results = results.clone();
+        group.spawn(move || {
+            let mut out: Vec<u8> = vec![0; LZ4_LEGACY_BLOCK_SIZE];
+            let len = unsafe {
+                LZ4_decompress_safe(
+                    block.as_ptr() as *const _,
+                    out.as_mut_ptr() as *mut _,
+                    block.len() as i32,
+                    LZ4_LEGACY_BLOCK_SIZE as i32,
+                )
+            };
+            if len >= 0 {
+                out.truncate(len as usize);
+                out.shrink_to_fit();
+                results.lock()[i] = Some(out);
+            }
+        });
+    }
+    group.wait();
+
+    let mut results = results.lock();
+    let mut archive: Vec<u8> = Vec::new();
+    for r in results.iter_mut() {
+        let block = r.take().ok_or(SystemError::EINVAL)?;
+        if archive.is_empty() {
+            archive = block;
+        } else {
+            archive.extend_from_slice(&block);
+        }
+    }
+    return Ok(archive);
+}
+
+/// 解析cpio头部中的一个8位十六进制数字段
+fn cpio_field(header: &[u8], index: usize) -> Result<usize, SystemError> {
+    let start = CPIO_NEWC_MAGIC.len() + index * 8;
+    let s = core::str::from_utf8(&header[start..start + 8]).map_err(|_| SystemError::EINVAL)?;
+    return usize::from_str_radix(s, 16).map_err(|_| SystemError::EINVAL);
+}
+
+/// 把cpio newc格式的归档解包到根目录中
+///
+/// ## 返回值
+///
+/// 解包的条目数量
+fn unpack_cpio(archive: &[u8]) -> Result<usize, SystemError> {
+    let mut pos = 0;
+    let mut cnt = 0;
+    loop {
+        if pos + CPIO_NEWC_HEADER_SIZE > archive.len() {
+            return Err(SystemError::EINVAL);
+        }
+        let header = &archive[pos..pos + CPIO_NEWC_HEADER_SIZE];
+        if !header.starts_with(CPIO_NEWC_MAGIC) && !header.starts_with(CPIO_NEWC_CRC_MAGIC) {
+            return Err(SystemError::EINVAL);
+        }
+        let mode = cpio_field(header, 1)?;
+        let filesize = cpio_field(header, 6)?;
+        let namesize = cpio_field(header, 11)?;
+
+        let name_start = pos + CPIO_NEWC_HEADER_SIZE;
+        // 文件名包含结尾的'\0'，文件名和数据都按4字节对齐
+        let data_start = (name_start + namesize + 3) & !3;
+        let data_end = data_start + filesize;
+        if namesize == 0 || data_end > archive.len() {
+            return Err(SystemError::EINVAL);
+        }
+        let name = core::str::from_utf8(&archive[name_start..name_start + namesize - 1])
+            .map_err(|_| SystemError::EINVAL)?;
+        if name == CPIO_TRAILER {
+            return Ok(cnt);
+        }
+
+        let data = &archive[data_start..data_end];
+        match cpio_create(name, ModeType::from_bits_truncate(mode as u32), data) {
+            Ok(true) => cnt += 1,
+            Ok(false) => {}
+            Err(e) => kwarn!("initramfs: failed to create {}: {:?}", name, e),
+        }
+        pos = (data_end + 3) & !3;
+    }
+}
+
+/// 创建cpio中的一个条目
+///
+/// ## 返回值
+///
+/// - Ok(true)：创建成功
+/// - Ok(false)：不支持的条目类型（例如设备文件、符号链接），被忽略
+fn cpio_create(name: &str, mode: ModeType, data: &[u8]) -> Result<bool, SystemError> {
+    let path = name.trim_start_matches("./").trim_matches('/');
+    if path.is_empty() || path == "." {
+        return Ok(false);
+    }
+    let (filename, parent_path) = rsplit_path(path);
+    let parent: Arc<dyn IndexNode> = match parent_path {
+        Some(parent_path) => ROOT_INODE().lookup(parent_path)?,
+        None => ROOT_INODE(),
+    };
+    let perm = mode & ModeType::S_IALLUGO;
+
+    match mode & ModeType::S_IFMT {
+        ModeType::S_IFDIR => match parent.create(filename, FileType::Dir, perm) {
+            Ok(_) => {}
+            // 已经存在的目录（例如/dev）
+            Err(SystemError::EEXIST) => {}
+            Err(e) => return Err(e),
+        },
+        ModeType::S_IFREG => {
+            let inode = parent.create(filename, FileType::File, perm)?;
+            if !data.is_empty() {
+                inode.write_at(0, data.len(), data, &mut FilePrivateData::default())?;
+            }
+        }
+        _ => return Ok(false),
+    }
+    return Ok(true);
+}
@@ -3,7 +3,9 @@ use crate::{
     libs::lib_ui::screen_manager::scm_init,
 };
 
+pub mod bootstat;
 pub mod c_adapter;
+pub mod initramfs;
 
 fn init_intertrait() {
     intertrait::init_caster_map();
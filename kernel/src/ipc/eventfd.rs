@@ -0,0 +1,179 @@
+//! eventfd：以文件描述符的形式提供的事件计数器
+//!
+//! 写入把8字节的值加到计数上，读取返回计数并把它清零（信号量模式下每次只减一并返回1）。
+//! 计数为0时读取会阻塞，计数将要超过`u64::MAX - 1`时写入会阻塞（以非阻塞方式打开时返回EAGAIN）。
+//! poll在计数不为0时报告可读，在还能写入1时报告可写，因此可以用它唤醒在epoll中等待的事件循环
+
+use core::mem::size_of;
+
+use alloc::{string::String, sync::Arc, vec::Vec};
+
+use crate::{
+    filesystem::vfs::{
+        core::generate_inode_id, file::FileMode, poll::PollTable, syscall::ModeType,
+        FilePrivateData, FileSystem, FileType, IndexNode, Metadata, PollStatus,
+    },
+    libs::{spinlock::SpinLock, wait_queue::WaitQueue},
+    process::{ProcessManager, ProcessState},
+    syscall::SystemError,
+    time::TimeSpec,
+};
+
+/// eventfd2的flags：信号量模式
+pub const EFD_SEMAPHORE: u32 = 1;
+/// 计数的最大值
+const EVENTFD_MAX: u64 = u64::MAX - 1;
+
+/// eventfd的inode
+#[derive(Debug)]
+pub struct EventFdInode {
+    /// 计数为0（或者写入会溢出）时，是否直接返回EAGAIN
+    nonblock: bool,
+    semaphore: bool,
+    count: SpinLock<u64>,
+    /// 等待计数变化的读者和写者
+    wait_queue: Arc<WaitQueue>,
+    metadata: Metadata,
+}
+
+impl EventFdInode {
+    pub fn new(initval: u32, semaphore: bool, nonblock: bool) -> Arc<Self> {
+        let metadata = Metadata {
+            dev_id: 0,
+            inode_id: generate_inode_id(),
+            size: 0,
+            blk_size: 0,
+            blocks: 0,
+            atime: TimeSpec::default(),
+            mtime: TimeSpec::default(),
+            ctime: TimeSpec::default(),
+            file_type: FileType::File,
+            mode: ModeType::from_bits_truncate(0o600),
+            nlinks: 1,
+            uid: 0,
+            gid: 0,
+            raw_dev: 0,
+        };
+        return Arc::new(Self {
+            nonblock,
+            semaphore,
+            count: SpinLock::new(initval as u64),
+            wait_queue: Arc::new(WaitQueue::INIT),
+            metadata,
+        });
+    }
+
+    /// 等待之后检查是否被信号打断
+    fn check_signal() -> Result<(), SystemError> {
+        if ProcessManager::current_pcb().has_pending_signal() {
+            return Err(SystemError::ERESTARTSYS);
+        }
+        return Ok(());
+    }
+}
+
+impl IndexNode for EventFdInode {
+    fn open(&self, _data: &mut FilePrivateData, _mode: &FileMode) -> Result<(), SystemError> {
+        return Ok(());
+    }
+
+    fn close(&self, _data: &mut FilePrivateData) -> Result<(), SystemError> {
+        return Ok(());
+    }
+
+    /// 读取计数
+    fn read_at(
+        &self,
+        _offset: usize,
+        len: usize,
+        buf: &mut [u8],
+        _data: &mut FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        if len < size_of::<u64>() || buf.len() < len {
+            return Err(SystemError::EINVAL);
+        }
+        loop {
+            let mut count = self.count.lock_irqsave();
+            if *count != 0 {
+                let value = if self.semaphore { 1 } else { *count };
+                *count -= value;
+                drop(count);
+                buf[..size_of::<u64>()].copy_from_slice(&value.to_ne_bytes());
+                self.wait_queue
+                    .wakeup_all(Some(ProcessState::Blocked(true)));
+                return Ok(size_of::<u64>());
+            }
+            if self.nonblock {
+                return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
+            }
+            self.wait_queue.sleep_unlock_spinlock(count);
+            Self::check_signal()?;
+        }
+    }
+
+    /// 把8字节的值加到计数上
+    fn write_at(
+        &self,
+        _offset: usize,
+        len: usize,
+        buf: &[u8],
+        _data: &mut FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        if len < size_of::<u64>() || buf.len() < len {
+            return Err(SystemError::EINVAL);
+        }
+        let value = u64::from_ne_bytes(buf[..size_of::<u64>()].try_into().unwrap());
+        if value == u64::MAX {
+            return Err(SystemError::EINVAL);
+        }
+        loop {
+            let mut count = self.count.lock_irqsave();
+            if EVENTFD_MAX - *count >= value {
+                *count += value;
+                drop(count);
+                if value != 0 {
+                    self.wait_queue
+                        .wakeup_all(Some(ProcessState::Blocked(true)));
+                }
+                return Ok(size_of::<u64>());
+            }
+            if self.nonblock {
+                return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
+            }
+            self.wait_queue.sleep_unlock_spinlock(count);
+            Self::check_signal()?;
+        }
+    }
+
+    fn poll(&self) -> Result<PollStatus, SystemError> {
+        let count = *self.count.lock_irqsave();
+        let mut status = PollStatus::empty();
+        if count != 0 {
+            status |= PollStatus::READ;
+        }
+        if count < EVENTFD_MAX {
+            status |= PollStatus::WRITE;
+        }
+        return Ok(status);
+    }
+
+    fn poll_wait(&self, table: &mut PollTable) {
+        table.wait(&self.wait_queue);
+    }
+
+    fn metadata(&self) -> Result<Metadata, SystemError> {
+        return Ok(self.metadata.clone());
+    }
+
+    fn as_any_ref(&self) -> &dyn core::any::Any {
+        self
+    }
+
+    fn fs(&self) -> Arc<dyn FileSystem> {
+        todo!("eventfd is not in any filesystem")
+    }
+
+    fn list(&self) -> Result<Vec<String>, SystemError> {
+        return Err(SystemError::ENOTDIR);
+    }
+}
@@ -1,4 +1,8 @@
+pub mod eventfd;
+pub mod mqueue;
 pub mod pipe;
+pub mod shm;
 pub mod signal;
 pub mod signal_types;
+pub mod signalfd;
 pub mod syscall;
@@ -0,0 +1,755 @@
+//! POSIX消息队列（mq_open、mq_timedsend、mq_timedreceive、mq_notify等系统调用）
+//!
+//! 消息队列是mqueue文件系统中的文件，文件系统挂载在/dev/mqueue，可以用ls列出、用rm删除队列。
+//! 队列中的消息按优先级排序，优先级相同的消息先进先出；接收时总是取出优先级最高的消息中最早的一条。
+//!
+//! 读取队列文件得到队列的状态（与Linux的格式相同），poll在队列不为空时报告可读，在队列不满时报告可写。
+//! 通过mq_notify注册的进程在消息到达空队列、并且没有进程正在等待接收时收到通知（只通知一次）
+
+use core::mem::size_of;
+
+use alloc::{
+    collections::{BTreeMap, VecDeque},
+    format,
+    string::{String, ToString},
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+
+use crate::{
+    arch::{
+        ipc::signal::{SigCode, Signal},
+        sched::sched,
+        CurrentIrqArch,
+    },
+    exception::InterruptArch,
+    filesystem::vfs::{
+        core::{generate_inode_id, ROOT_INODE},
+        file::{File, FileMode},
+        poll::PollTable,
+        syscall::ModeType,
+        FilePrivateData, FileSystem, FileType, FsInfo, IndexNode, Metadata, PollStatus,
+    },
+    kinfo,
+    libs::{casting::DowncastArc, spinlock::SpinLock, wait_queue::WaitQueue},
+    process::{Pid, ProcessManager, ProcessState},
+    syscall::{
+        user_access::{check_and_clone_cstr, UserBufferReader, UserBufferWriter},
+        Syscall, SystemError,
+    },
+    time::{
+        hrtimer::{hrtimer_now, HrTimer},
+        posix_timer::{clock_to_monotonic, timespec_to_ns, SigEvent, SIGEV_NONE, SIGEV_SIGNAL},
+        syscall::PosixClockID,
+        timer::{current_timer_slack_ns, WakeUpHelper},
+        TimeSpec,
+    },
+};
+
+use super::signal_types::{SigInfo, SigType};
+
+/// 队列名的最大长度
+const MQ_NAME_MAX: usize = 255;
+/// 消息优先级的上限（不含）
+pub const MQ_PRIO_MAX: u32 = 32768;
+/// 创建队列时没有指定属性时使用的默认值
+const DFLT_MSGMAX: i64 = 10;
+const DFLT_MSGSIZEMAX: i64 = 8192;
+/// 队列属性的上限
+const HARD_MSGMAX: i64 = 65536;
+const HARD_MSGSIZEMAX: i64 = 16 * 1024 * 1024;
+
+/// 与Linux的`struct mq_attr`一致
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+pub struct MqAttr {
+    pub mq_flags: i64,
+    pub mq_maxmsg: i64,
+    pub mq_msgsize: i64,
+    pub mq_curmsgs: i64,
+    _reserved: [i64; 4],
+}
+
+/// 通过mq_notify注册的通知
+#[derive(Debug)]
+struct MqNotify {
+    pid: Pid,
+    notify: i32,
+    signal: Signal,
+}
+
+#[derive(Debug)]
+struct InnerMqueue {
+    maxmsg: usize,
+    msgsize: usize,
+    curmsgs: usize,
+    /// 所有消息的总字节数
+    qsize: usize,
+    /// 优先级到这个优先级的消息（先进先出）
+    msgs: BTreeMap<u32, VecDeque<Vec<u8>>>,
+    notify: Option<MqNotify>,
+}
+
+/// 一个消息队列
+#[derive(Debug)]
+pub struct MqueueInode {
+    inner: SpinLock<InnerMqueue>,
+    /// 等待队列不为空的接收者
+    recv_wait: Arc<WaitQueue>,
+    /// 等待队列不满的发送者
+    send_wait: Arc<WaitQueue>,
+    /// poll的等待者，队列的状态变化时唤醒
+    poll_wait: Arc<WaitQueue>,
+    metadata: Metadata,
+    fs: Weak<MqueueFS>,
+}
+
+impl MqueueInode {
+    fn new(fs: Weak<MqueueFS>, mode: ModeType, maxmsg: usize, msgsize: usize) -> Arc<Self> {
+        return Arc::new(Self {
+            inner: SpinLock::new(InnerMqueue {
+                maxmsg,
+                msgsize,
+                curmsgs: 0,
+                qsize: 0,
+                msgs: BTreeMap::new(),
+                notify: None,
+            }),
+            recv_wait: Arc::new(WaitQueue::INIT),
+            send_wait: Arc::new(WaitQueue::INIT),
+            poll_wait: Arc::new(WaitQueue::INIT),
+            metadata: mqueue_metadata(FileType::File, mode),
+            fs,
+        });
+    }
+
+    fn attr(&self) -> MqAttr {
+        let inner = self.inner.lock_irqsave();
+        return MqAttr {
+            mq_maxmsg: inner.maxmsg as i64,
+            mq_msgsize: inner.msgsize as i64,
+            mq_curmsgs: inner.curmsgs as i64,
+            ..Default::default()
+        };
+    }
+
+    /// 在`wait_queue`上等待，直到`op`返回Some、超时（`deadline`是单调时间）或者收到信号
+    fn wait_event<T>(
+        &self,
+        wait_queue: &WaitQueue,
+        nonblock: bool,
+        deadline: Option<u64>,
+        mut op: impl FnMut(&mut InnerMqueue) -> Option<T>,
+    ) -> Result<T, SystemError> {
+        let pcb = ProcessManager::current_pcb();
+        loop {
+            let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+            let mut inner = self.inner.lock();
+            if let Some(r) = op(&mut inner) {
+                return Ok(r);
+            }
+            if nonblock {
+                return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
+            }
+            if deadline.map_or(false, |deadline| hrtimer_now() >= deadline) {
+                return Err(SystemError::ETIMEDOUT);
+            }
+            let timer = deadline.map(|deadline| {
+                HrTimer::new_range(
+                    WakeUpHelper::new(pcb.clone()),
+                    deadline,
+                    current_timer_slack_ns(),
+                )
+            });
+            unsafe { wait_queue.sleep_without_schedule() };
+            drop(inner);
+            if let Some(timer) = &timer {
+                timer.start();
+            }
+            drop(irq_guard);
+            sched();
+
+            if let Some(timer) = timer {
+                timer.cancel();
+            }
+            // 被定时器唤醒时，进程还在等待队列中
+            wait_queue.remove_waiter(&pcb);
+            if pcb.has_pending_signal() {
+                return Err(SystemError::ERESTARTSYS);
+            }
+        }
+    }
+
+    /// 发送一条消息，队列满时等待
+    fn send(
+        &self,
+        msg: Vec<u8>,
+        prio: u32,
+        nonblock: bool,
+        deadline: Option<u64>,
+    ) -> Result<(), SystemError> {
+        let mut msg = Some(msg);
+        let notify = self.wait_event(&self.send_wait, nonblock, deadline, |inner| {
+            if inner.curmsgs >= inner.maxmsg {
+                return None;
+            }
+            let msg = msg.take().unwrap();
+            inner.curmsgs += 1;
+            inner.qsize += msg.len();
+            inner.msgs.entry(prio).or_default().push_back(msg);
+            // 消息到达空队列并且没有进程在等待接收时，通知注册的进程
+            if inner.curmsgs == 1 && self.recv_wait.len() == 0 {
+                return Some(inner.notify.take());
+            }
+            return Some(None);
+        })?;
+
+        self.recv_wait.wakeup_all(Some(ProcessState::Blocked(true)));
+        self.poll_wait.wakeup_all(Some(ProcessState::Blocked(true)));
+        if let Some(notify) = notify {
+            if notify.notify == SIGEV_SIGNAL {
+                let mut info = SigInfo::new(
+                    notify.signal,
+                    0,
+                    SigCode::Mesgq,
+                    SigType::Kill(ProcessManager::current_pcb().pid()),
+                );
+                notify
+                    .signal
+                    .send_signal_info(Some(&mut info), notify.pid)
+                    .ok();
+            }
+        }
+        return Ok(());
+    }
+
+    /// 取出优先级最高的消息中最早的一条，队列空时等待。`bufsize`小于消息的最大长度时返回EMSGSIZE
+    fn receive(
+        &self,
+        bufsize: usize,
+        nonblock: bool,
+        deadline: Option<u64>,
+    ) -> Result<(Vec<u8>, u32), SystemError> {
+        if bufsize < self.inner.lock_irqsave().msgsize {
+            return Err(SystemError::EMSGSIZE);
+        }
+        let r = self.wait_event(&self.recv_wait, nonblock, deadline, |inner| {
+            let mut entry = inner.msgs.last_entry()?;
+            let prio = *entry.key();
+            let msg = entry.get_mut().pop_front().unwrap();
+            if entry.get().is_empty() {
+                entry.remove();
+            }
+            inner.curmsgs -= 1;
+            inner.qsize -= msg.len();
+            return Some((msg, prio));
+        })?;
+
+        self.send_wait.wakeup_all(Some(ProcessState::Blocked(true)));
+        self.poll_wait.wakeup_all(Some(ProcessState::Blocked(true)));
+        return Ok(r);
+    }
+
+    /// 注册（`sigevent`为Some）或者取消（为None）当前进程的通知
+    fn set_notify(&self, sigevent: Option<SigEvent>) -> Result<(), SystemError> {
+        let pid = ProcessManager::current_pcb().pid();
+        let mut inner = self.inner.lock_irqsave();
+        let sigevent = match sigevent {
+            Some(sigevent) => sigevent,
+            None => {
+                if inner.notify.as_ref().map(|n| n.pid) == Some(pid) {
+                    inner.notify = None;
+                }
+                return Ok(());
+            }
+        };
+        if inner.notify.is_some() {
+            return Err(SystemError::EBUSY);
+        }
+        let signal = match sigevent.sigev_notify {
+            SIGEV_NONE => Signal::INVALID,
+            SIGEV_SIGNAL => {
+                let signal = Signal::from(sigevent.sigev_signo);
+                if signal == Signal::INVALID {
+                    return Err(SystemError::EINVAL);
+                }
+                signal
+            }
+            // SIGEV_THREAD需要netlink socket的支持
+            _ => return Err(SystemError::EINVAL),
+        };
+        inner.notify = Some(MqNotify {
+            pid,
+            notify: sigevent.sigev_notify,
+            signal,
+        });
+        return Ok(());
+    }
+}
+
+impl IndexNode for MqueueInode {
+    fn open(&self, _data: &mut FilePrivateData, _mode: &FileMode) -> Result<(), SystemError> {
+        return Ok(());
+    }
+
+    /// 关闭队列时，取消当前进程注册的通知
+    fn close(&self, _data: &mut FilePrivateData) -> Result<(), SystemError> {
+        return self.set_notify(None);
+    }
+
+    /// 读取队列的状态
+    fn read_at(
+        &self,
+        offset: usize,
+        len: usize,
+        buf: &mut [u8],
+        _data: &mut FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        let status = {
+            let inner = self.inner.lock_irqsave();
+            let (notify, signo, pid) = match &inner.notify {
+                Some(n) => (
+                    n.notify,
+                    if n.notify == SIGEV_SIGNAL {
+                        n.signal as i32
+                    } else {
+                        0
+                    },
+                    n.pid.data(),
+                ),
+                None => (0, 0, 0),
+            };
+            format!(
+                "QSIZE:{:<10} NOTIFY:{:<5} SIGNO:{:<5} NOTIFY_PID:{:<6}\n",
+                inner.qsize, notify, signo, pid
+            )
+        };
+        let bytes = status.as_bytes();
+        if offset >= bytes.len() {
+            return Ok(0);
+        }
+        let n = (bytes.len() - offset).min(len).min(buf.len());
+        buf[..n].copy_from_slice(&bytes[offset..offset + n]);
+        return Ok(n);
+    }
+
+    fn write_at(
+        &self,
+        _offset: usize,
+        _len: usize,
+        _buf: &[u8],
+        _data: &mut FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        return Err(SystemError::EINVAL);
+    }
+
+    fn poll(&self) -> Result<PollStatus, SystemError> {
+        let inner = self.inner.lock_irqsave();
+        let mut status = PollStatus::empty();
+        if inner.curmsgs != 0 {
+            status |= PollStatus::READ;
+        }
+        if inner.curmsgs < inner.maxmsg {
+            status |= PollStatus::WRITE;
+        }
+        return Ok(status);
+    }
+
+    fn poll_wait(&self, table: &mut PollTable) {
+        table.wait(&self.poll_wait);
+    }
+
+    fn metadata(&self) -> Result<Metadata, SystemError> {
+        let mut metadata = self.metadata.clone();
+        metadata.size = self.inner.lock_irqsave().qsize as i64;
+        return Ok(metadata);
+    }
+
+    fn as_any_ref(&self) -> &dyn core::any::Any {
+        self
+    }
+
+    fn fs(&self) -> Arc<dyn FileSystem> {
+        return self.fs.upgrade().unwrap();
+    }
+
+    fn list(&self) -> Result<Vec<String>, SystemError> {
+        return Err(SystemError::ENOTDIR);
+    }
+}
+
+/// mqueue文件系统的根目录，所有的队列都在这个目录下
+#[derive(Debug)]
+pub struct MqueueDir {
+    queues: SpinLock<BTreeMap<String, Arc<MqueueInode>>>,
+    metadata: Metadata,
+    fs: Weak<MqueueFS>,
+}
+
+impl MqueueDir {
+    /// 创建名为`name`的队列
+    fn create_queue(
+        &self,
+        name: &str,
+        mode: ModeType,
+        maxmsg: usize,
+        msgsize: usize,
+    ) -> Result<Arc<MqueueInode>, SystemError> {
+        let mut queues = self.queues.lock();
+        if queues.contains_key(name) {
+            return Err(SystemError::EEXIST);
+        }
+        let queue = MqueueInode::new(self.fs.clone(), mode, maxmsg, msgsize);
+        queues.insert(name.to_string(), queue.clone());
+        return Ok(queue);
+    }
+
+    fn find_queue(&self, name: &str) -> Option<Arc<MqueueInode>> {
+        return self.queues.lock().get(name).cloned();
+    }
+}
+
+impl IndexNode for MqueueDir {
+    fn read_at(
+        &self,
+        _offset: usize,
+        _len: usize,
+        _buf: &mut [u8],
+        _data: &mut FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        return Err(SystemError::EISDIR);
+    }
+
+    fn write_at(
+        &self,
+        _offset: usize,
+        _len: usize,
+        _buf: &[u8],
+        _data: &mut FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        return Err(SystemError::EISDIR);
+    }
+
+    fn poll(&self) -> Result<PollStatus, SystemError> {
+        return Err(SystemError::EISDIR);
+    }
+
+    fn metadata(&self) -> Result<Metadata, SystemError> {
+        return Ok(self.metadata.clone());
+    }
+
+    /// 用open(O_CREAT)创建的队列使用默认的属性
+    fn create(
+        &self,
+        name: &str,
+        file_type: FileType,
+        mode: ModeType,
+    ) -> Result<Arc<dyn IndexNode>, SystemError> {
+        if file_type != FileType::File {
+            return Err(SystemError::EPERM);
+        }
+        return Ok(self.create_queue(
+            name,
+            mode,
+            DFLT_MSGMAX as usize,
+            DFLT_MSGSIZEMAX as usize,
+        )?);
+    }
+
+    fn unlink(&self, name: &str) -> Result<(), SystemError> {
+        // 已经打开的队列在最后一个文件关闭之前仍然可以使用
+        self.queues.lock().remove(name).ok_or(SystemError::ENOENT)?;
+        return Ok(());
+    }
+
+    fn find(&self, name: &str) -> Result<Arc<dyn IndexNode>, SystemError> {
+        match name {
+            "" | "." | ".." => return Ok(self.fs.upgrade().unwrap().root_inode()),
+            name => return Ok(self.find_queue(name).ok_or(SystemError::ENOENT)?),
+        }
+    }
+
+    fn as_any_ref(&self) -> &dyn core::any::Any {
+        self
+    }
+
+    fn fs(&self) -> Arc<dyn FileSystem> {
+        return self.fs.upgrade().unwrap();
+    }
+
+    fn list(&self) -> Result<Vec<String>, SystemError> {
+        return Ok(self.queues.lock().keys().cloned().collect());
+    }
+}
+
+/// mqueue文件系统
+#[derive(Debug)]
+pub struct MqueueFS {
+    root: Arc<MqueueDir>,
+}
+
+impl MqueueFS {
+    fn new() -> Arc<Self> {
+        return Arc::new_cyclic(|fs| Self {
+            root: Arc::new(MqueueDir {
+                queues: SpinLock::new(BTreeMap::new()),
+                metadata: mqueue_metadata(FileType::Dir, ModeType::from_bits_truncate(0o1777)),
+                fs: fs.clone(),
+            }),
+        });
+    }
+}
+
+impl FileSystem for MqueueFS {
+    fn root_inode(&self) -> Arc<dyn IndexNode> {
+        return self.root.clone();
+    }
+
+    fn info(&self) -> FsInfo {
+        return FsInfo {
+            blk_dev_id: 0,
+            max_name_len: MQ_NAME_MAX,
+        };
+    }
+
+    fn as_any_ref(&self) -> &dyn core::any::Any {
+        self
+    }
+}
+
+fn mqueue_metadata(file_type: FileType, mode: ModeType) -> Metadata {
+    return Metadata {
+        dev_id: 0,
+        inode_id: generate_inode_id(),
+        size: 0,
+        blk_size: 0,
+        blocks: 0,
+        atime: TimeSpec::default(),
+        mtime: TimeSpec::default(),
+        ctime: TimeSpec::default(),
+        file_type,
+        mode,
+        nlinks: 1,
+        uid: 0,
+        gid: 0,
+        raw_dev: 0,
+    };
+}
+
+lazy_static! {
+    static ref MQUEUE_FS: Arc<MqueueFS> = MqueueFS::new();
+}
+
+/// 在/dev/mqueue挂载mqueue文件系统
+///
+/// 迁移根文件系统时devfs被重新挂载，它下面的挂载点会丢失，因此迁移之后需要再调用一次
+pub fn mqueue_init() -> Result<(), SystemError> {
+    let dev = ROOT_INODE().find("dev")?;
+    let mqueue = match dev.find("mqueue") {
+        Ok(inode) => inode,
+        Err(SystemError::ENOENT) => dev.create(
+            "mqueue",
+            FileType::Dir,
+            ModeType::from_bits_truncate(0o1777),
+        )?,
+        Err(e) => return Err(e),
+    };
+    mqueue.mount(MQUEUE_FS.clone())?;
+    kinfo!("Mounted mqueue on /dev/mqueue");
+    return Ok(());
+}
+
+/// 检查并复制用户传入的队列名。libc已经去掉了开头的'/'
+fn mq_name(name: *const u8) -> Result<String, SystemError> {
+    let name = check_and_clone_cstr(name, Some(MQ_NAME_MAX + 1))?;
+    if name.is_empty() {
+        return Err(SystemError::ENOENT);
+    }
+    if name.len() > MQ_NAME_MAX {
+        return Err(SystemError::ENAMETOOLONG);
+    }
+    if name.contains('/') || name == "." || name == ".." {
+        return Err(SystemError::EACCES);
+    }
+    return Ok(name);
+}
+
+/// 获取消息队列的描述符对应的文件和队列
+fn mq_file(mqd: i32) -> Result<(Arc<SpinLock<File>>, Arc<MqueueInode>), SystemError> {
+    let file = ProcessManager::current_pcb()
+        .fd_table()
+        .read()
+        .get_file_by_fd(mqd)
+        .ok_or(SystemError::EBADF)?;
+    let inode = file.lock().inode();
+    let queue = inode
+        .downcast_arc::<MqueueInode>()
+        .ok_or(SystemError::EBADF)?;
+    return Ok((file, queue));
+}
+
+/// 读取用户传入的超时时间（CLOCK_REALTIME上的绝对时间），换算为单调时间。为空表示一直等待
+fn mq_deadline(abs_timeout: *const TimeSpec) -> Result<Option<u64>, SystemError> {
+    if abs_timeout.is_null() {
+        return Ok(None);
+    }
+    let reader = UserBufferReader::new(abs_timeout, size_of::<TimeSpec>(), true)?;
+    let ns = timespec_to_ns(reader.read_one_from_user::<TimeSpec>(0)?)?;
+    return Ok(Some(clock_to_monotonic(PosixClockID::Realtime, ns)));
+}
+
+impl Syscall {
+    /// 打开（O_CREAT时创建）名为`name`的消息队列，返回它的描述符
+    ///
+    /// 创建时`attr`为空则使用默认的属性，否则使用其中的mq_maxmsg和mq_msgsize
+    pub fn mq_open(
+        name: *const u8,
+        oflag: u32,
+        mode: u32,
+        attr: *const MqAttr,
+    ) -> Result<usize, SystemError> {
+        let name = mq_name(name)?;
+        let flags = FileMode::from_bits_truncate(oflag);
+        let root = &MQUEUE_FS.root;
+
+        let queue = match root.find_queue(&name) {
+            Some(_) if flags.contains(FileMode::O_CREAT | FileMode::O_EXCL) => {
+                return Err(SystemError::EEXIST);
+            }
+            Some(queue) => queue,
+            None if !flags.contains(FileMode::O_CREAT) => return Err(SystemError::ENOENT),
+            None => {
+                let (maxmsg, msgsize) = if attr.is_null() {
+                    (DFLT_MSGMAX, DFLT_MSGSIZEMAX)
+                } else {
+                    let reader = UserBufferReader::new(attr, size_of::<MqAttr>(), true)?;
+                    let attr = reader.read_one_from_user::<MqAttr>(0)?;
+                    (attr.mq_maxmsg, attr.mq_msgsize)
+                };
+                if maxmsg <= 0 || maxmsg > HARD_MSGMAX || msgsize <= 0 || msgsize > HARD_MSGSIZEMAX
+                {
+                    return Err(SystemError::EINVAL);
+                }
+                let mode = ModeType::from_bits_truncate(mode & 0o777);
+                root.create_queue(&name, mode, maxmsg as usize, msgsize as usize)?
+            }
+        };
+
+        let accmode = FileMode::from_bits_truncate(flags.accmode());
+        let mut file = File::new(queue, accmode | (flags & FileMode::O_NONBLOCK))?;
+        if flags.contains(FileMode::O_CLOEXEC) {
+            file.set_close_on_exec(true);
+        }
+        let fd = ProcessManager::current_pcb()
+            .fd_table()
+            .write()
+            .alloc_fd(file, None)?;
+        return Ok(fd as usize);
+    }
+
+    /// 删除名为`name`的消息队列。已经打开它的进程仍然可以使用它
+    pub fn mq_unlink(name: *const u8) -> Result<usize, SystemError> {
+        let name = mq_name(name)?;
+        MQUEUE_FS.root.unlink(&name)?;
+        return Ok(0);
+    }
+
+    /// 发送一条优先级为`prio`的消息。队列满时等待，直到`abs_timeout`（为空表示一直等待）
+    pub fn mq_timedsend(
+        mqd: i32,
+        msg: *const u8,
+        len: usize,
+        prio: u32,
+        abs_timeout: *const TimeSpec,
+    ) -> Result<usize, SystemError> {
+        if prio >= MQ_PRIO_MAX {
+            return Err(SystemError::EINVAL);
+        }
+        let (file, queue) = mq_file(mqd)?;
+        let mode = file.lock().mode();
+        if mode.accmode() == FileMode::O_RDONLY.bits() {
+            return Err(SystemError::EBADF);
+        }
+        if len > queue.inner.lock_irqsave().msgsize {
+            return Err(SystemError::EMSGSIZE);
+        }
+        let deadline = mq_deadline(abs_timeout)?;
+        let reader = UserBufferReader::new(msg, len, true)?;
+        let data = reader.read_from_user::<u8>(0)?.to_vec();
+        queue.send(data, prio, mode.contains(FileMode::O_NONBLOCK), deadline)?;
+        return Ok(0);
+    }
+
+    /// 接收优先级最高的消息中最早的一条，返回消息的长度。队列空时等待，直到`abs_timeout`
+    pub fn mq_timedreceive(
+        mqd: i32,
+        msg: *mut u8,
+        len: usize,
+        prio: *mut u32,
+        abs_timeout: *const TimeSpec,
+    ) -> Result<usize, SystemError> {
+        let (file, queue) = mq_file(mqd)?;
+        let mode = file.lock().mode();
+        if mode.accmode() == FileMode::O_WRONLY.bits() {
+            return Err(SystemError::EBADF);
+        }
+        let deadline = mq_deadline(abs_timeout)?;
+        let mut writer = UserBufferWriter::new(msg, len, true)?;
+        let (data, msg_prio) = queue.receive(len, mode.contains(FileMode::O_NONBLOCK), deadline)?;
+        writer.copy_to_user(&data, 0)?;
+        if !prio.is_null() {
+            UserBufferWriter::new(prio, size_of::<u32>(), true)?.copy_one_to_user(&msg_prio, 0)?;
+        }
+        return Ok(data.len());
+    }
+
+    /// 注册（`sevp`不为空）或者取消（为空）消息到达空队列时的通知
+    ///
+    /// 支持SIGEV_NONE和SIGEV_SIGNAL
+    pub fn mq_notify(mqd: i32, sevp: *const SigEvent) -> Result<usize, SystemError> {
+        let (_file, queue) = mq_file(mqd)?;
+        let sigevent = if sevp.is_null() {
+            None
+        } else {
+            let reader = UserBufferReader::new(sevp, size_of::<SigEvent>(), true)?;
+            Some(*reader.read_one_from_user::<SigEvent>(0)?)
+        };
+        queue.set_notify(sigevent)?;
+        return Ok(0);
+    }
+
+    /// 获取（`old`不为空）并设置（`new`不为空）队列的属性，只有mq_flags中的O_NONBLOCK可以被设置
+    pub fn mq_getsetattr(
+        mqd: i32,
+        new: *const MqAttr,
+        old: *mut MqAttr,
+    ) -> Result<usize, SystemError> {
+        let (file, queue) = mq_file(mqd)?;
+        let new = if new.is_null() {
+            None
+        } else {
+            let reader = UserBufferReader::new(new, size_of::<MqAttr>(), true)?;
+            Some(*reader.read_one_from_user::<MqAttr>(0)?)
+        };
+        if let Some(new) = &new {
+            if new.mq_flags & !(FileMode::O_NONBLOCK.bits() as i64) != 0 {
+                return Err(SystemError::EINVAL);
+            }
+        }
+
+        let mut file = file.lock();
+        if !old.is_null() {
+            let mut attr = queue.attr();
+            attr.mq_flags = (file.mode() & FileMode::O_NONBLOCK).bits() as i64;
+            UserBufferWriter::new(old, size_of::<MqAttr>(), true)?.copy_one_to_user(&attr, 0)?;
+        }
+        if let Some(new) = new {
+            let mut mode = file.mode() - FileMode::O_NONBLOCK;
+            if new.mq_flags != 0 {
+                mode |= FileMode::O_NONBLOCK;
+            }
+            file.set_mode(mode)?;
+        }
+        return Ok(0);
+    }
+}
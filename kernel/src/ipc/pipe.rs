@@ -1,20 +1,124 @@
 use crate::{
-    arch::{sched::sched, CurrentIrqArch},
+    arch::{sched::sched, CurrentIrqArch, MMArch},
     exception::InterruptArch,
     filesystem::vfs::{
-        core::generate_inode_id, file::FileMode, syscall::ModeType, FilePrivateData, FileSystem,
-        FileType, IndexNode, Metadata, PollStatus,
+        core::generate_inode_id, file::FileMode, poll::PollTable, syscall::ModeType,
+        FilePrivateData, FileSystem, FileType, IndexNode, Metadata, PollStatus,
     },
-    libs::{spinlock::SpinLock, wait_queue::WaitQueue},
+    libs::{align::page_align_up, spinlock::SpinLock, wait_queue::WaitQueue},
+    mm::MemoryManagementArch,
     process::ProcessState,
     syscall::SystemError,
     time::TimeSpec,
 };
 
-use alloc::sync::{Arc, Weak};
+use alloc::{
+    boxed::Box,
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+
+const PAGE_SIZE: usize = MMArch::PAGE_SIZE;
+/// 管道默认的容量
+pub const PIPE_DEF_SIZE: usize = 16 * PAGE_SIZE;
+/// 通过F_SETPIPE_SZ能设置的最大容量（与Linux的pipe-max-size默认值相同）
+pub const PIPE_MAX_SIZE: usize = 1024 * 1024;
+/// 不超过这个长度的写入是原子的：数据一次全部写入，不会与其他写者的数据交错
+pub const PIPE_BUF: usize = PAGE_SIZE;
+
+/// @brief 管道的环形缓冲区
+///
+/// 缓冲区由页组成，页在第一次被写入时才分配，因此容量较大但很少被写满的管道不会占用太多内存
+#[derive(Debug)]
+struct PipeRing {
+    pages: Vec<Option<Box<[u8]>>>,
+    /// 第一个有效字节在环中的位置
+    head: usize,
+    /// 有效字节数
+    len: usize,
+}
+
+impl PipeRing {
+    fn new(nr_pages: usize) -> Self {
+        let mut pages = Vec::new();
+        pages.resize_with(nr_pages, || None);
+        return Self {
+            pages,
+            head: 0,
+            len: 0,
+        };
+    }
+
+    #[inline]
+    fn capacity(&self) -> usize {
+        return self.pages.len() * PAGE_SIZE;
+    }
 
-/// 我们设定pipe_buff的总大小为1024字节
-const PIPE_BUFF_SIZE: usize = 1024;
+    #[inline]
+    fn free(&self) -> usize {
+        return self.capacity() - self.len;
+    }
+
+    /// 从缓冲区的头部取出数据，填入`buf`
+    ///
+    /// @return 取出的字节数
+    fn pop(&mut self, buf: &mut [u8]) -> usize {
+        let n = buf.len().min(self.len);
+        let cap = self.capacity();
+        let mut done = 0;
+        while done < n {
+            let pos = (self.head + done) % cap;
+            let off = pos % PAGE_SIZE;
+            let chunk = (n - done).min(PAGE_SIZE - off);
+            let page = self.pages[pos / PAGE_SIZE].as_ref().unwrap();
+            buf[done..done + chunk].copy_from_slice(&page[off..off + chunk]);
+            done += chunk;
+        }
+        self.len -= n;
+        // 缓冲区空了之后，从头开始写，尽量少用页
+        self.head = if self.len == 0 {
+            0
+        } else {
+            (self.head + n) % cap
+        };
+        return n;
+    }
+
+    /// 把`buf`中的数据追加到缓冲区的尾部，直到缓冲区被写满
+    ///
+    /// @return 写入的字节数
+    fn push(&mut self, buf: &[u8]) -> usize {
+        let n = buf.len().min(self.free());
+        let cap = self.capacity();
+        let mut done = 0;
+        while done < n {
+            let pos = (self.head + self.len + done) % cap;
+            let off = pos % PAGE_SIZE;
+            let chunk = (n - done).min(PAGE_SIZE - off);
+            let page = self.pages[pos / PAGE_SIZE]
+                .get_or_insert_with(|| vec![0u8; PAGE_SIZE].into_boxed_slice());
+            page[off..off + chunk].copy_from_slice(&buf[done..done + chunk]);
+            done += chunk;
+        }
+        self.len += n;
+        return n;
+    }
+
+    /// 把容量改为`nr_pages`页，已有的数据被移动到新缓冲区的开头
+    fn resize(&mut self, nr_pages: usize) -> Result<(), SystemError> {
+        if self.len > nr_pages * PAGE_SIZE {
+            return Err(SystemError::EBUSY);
+        }
+        let mut ring = PipeRing::new(nr_pages);
+        if self.len > 0 {
+            let mut data = vec![0u8; self.len];
+            self.pop(&mut data);
+            ring.push(&data);
+        }
+        *self = ring;
+        return Ok(());
+    }
+}
 
 #[derive(Debug, Clone)]
 pub struct PipeFsPrivateData {
@@ -35,12 +139,9 @@ pub struct LockedPipeInode(SpinLock<InnerPipeInode>);
 #[derive(Debug)]
 pub struct InnerPipeInode {
     self_ref: Weak<LockedPipeInode>,
-    valid_cnt: i32,
-    read_pos: i32,
-    write_pos: i32,
-    read_wait_queue: WaitQueue,
-    write_wait_queue: WaitQueue,
-    data: [u8; PIPE_BUFF_SIZE],
+    read_wait_queue: Arc<WaitQueue>,
+    write_wait_queue: Arc<WaitQueue>,
+    buf: PipeRing,
     /// INode 元数据
     metadata: Metadata,
     reader: u32,
@@ -51,17 +152,14 @@ impl LockedPipeInode {
     pub fn new() -> Arc<Self> {
         let inner = InnerPipeInode {
             self_ref: Weak::default(),
-            valid_cnt: 0,
-            read_pos: 0,
-            write_pos: 0,
-            read_wait_queue: WaitQueue::INIT,
-            write_wait_queue: WaitQueue::INIT,
-            data: [0; PIPE_BUFF_SIZE],
+            read_wait_queue: Arc::new(WaitQueue::INIT),
+            write_wait_queue: Arc::new(WaitQueue::INIT),
+            buf: PipeRing::new(PIPE_DEF_SIZE / PAGE_SIZE),
 
             metadata: Metadata {
                 dev_id: 0,
                 inode_id: generate_inode_id(),
-                size: PIPE_BUFF_SIZE as i64,
+                size: PIPE_DEF_SIZE as i64,
                 blk_size: 0,
                 blocks: 0,
                 atime: TimeSpec::default(),
@@ -84,32 +182,40 @@ impl LockedPipeInode {
         drop(guard); //这一步其实不需要，只要离开作用域，guard生命周期结束，自会解锁
         return result;
     }
-}
 
-impl IndexNode for LockedPipeInode {
-    fn read_at(
-        &self,
-        _offset: usize,
-        len: usize,
-        buf: &mut [u8],
-        data: &mut FilePrivateData,
-    ) -> Result<usize, crate::syscall::SystemError> {
-        // 获取mode
-        let mode: FileMode;
-        if let FilePrivateData::Pipefs(pdata) = data {
-            mode = pdata.mode;
-        } else {
-            return Err(SystemError::EBADF);
-        }
+    /// @brief 获取管道的容量（F_GETPIPE_SZ）
+    pub fn pipe_size(&self) -> usize {
+        return self.0.lock().buf.capacity();
+    }
 
-        if buf.len() < len {
-            return Err(SystemError::EINVAL);
+    /// @brief 设置管道的容量（F_SETPIPE_SZ）。容量向上取整为2的幂个页
+    ///
+    /// @return 设置之后的容量。超过PIPE_MAX_SIZE时返回EPERM，放不下管道中已有的数据时返回EBUSY
+    pub fn set_pipe_size(&self, size: usize) -> Result<usize, SystemError> {
+        if size > PIPE_MAX_SIZE {
+            return Err(SystemError::EPERM);
         }
+        let nr_pages = (page_align_up(size.max(1)) / PAGE_SIZE).next_power_of_two();
+        let mut inode = self.0.lock();
+        inode.buf.resize(nr_pages)?;
+        // 容量变大之后，等待空间的写者可以继续写入
+        inode
+            .write_wait_queue
+            .wakeup_all(Some(ProcessState::Blocked(true)));
+        return Ok(inode.buf.capacity());
+    }
+
+    /// @brief 从管道读取数据，按顺序填入`bufs`中的各个缓冲区
+    ///
+    /// 管道为空时，`nonblock`为false则睡眠等待写者；否则返回EAGAIN。管道中有数据时，读出已有的数据后立即返回
+    ///
+    /// @return 读取的字节数。没有写端并且管道为空时返回0
+    pub fn read_bufs(&self, bufs: &mut [&mut [u8]], nonblock: bool) -> Result<usize, SystemError> {
         // 加锁
         let mut inode = self.0.lock();
 
         // 如果管道里面没有数据，则唤醒写端，
-        while inode.valid_cnt == 0 {
+        while inode.buf.len == 0 {
             // 如果当前管道写者数为0，则返回EOF
             if inode.writer == 0 {
                 return Ok(0);
@@ -117,10 +223,10 @@ impl IndexNode for LockedPipeInode {
 
             inode
                 .write_wait_queue
-                .wakeup(Some(ProcessState::Blocked(true)));
+                .wakeup_all(Some(ProcessState::Blocked(true)));
 
             // 如果为非阻塞管道，直接返回错误
-            if mode.contains(FileMode::O_NONBLOCK) {
+            if nonblock {
                 drop(inode);
                 return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
             }
@@ -138,38 +244,134 @@ impl IndexNode for LockedPipeInode {
             inode = self.0.lock();
         }
 
-        let mut num = inode.valid_cnt as usize;
-        //决定要输出的字节
-        let start = inode.read_pos as usize;
-        //如果读端希望读取的字节数大于有效字节数，则输出有效字节
-        let mut end = (inode.valid_cnt as usize + inode.read_pos as usize) % PIPE_BUFF_SIZE;
-        //如果读端希望读取的字节数少于有效字节数，则输出希望读取的字节
-        if len < inode.valid_cnt as usize {
-            end = (len + inode.read_pos as usize) % PIPE_BUFF_SIZE;
-            num = len;
-        }
-
-        // 从管道拷贝数据到用户的缓冲区
-
-        if end < start {
-            buf[0..(PIPE_BUFF_SIZE - start)].copy_from_slice(&inode.data[start..PIPE_BUFF_SIZE]);
-            buf[(PIPE_BUFF_SIZE - start)..num].copy_from_slice(&inode.data[0..end]);
-        } else {
-            buf[0..num].copy_from_slice(&inode.data[start..end]);
+        // 从管道直接拷贝数据到调用者的缓冲区
+        let mut num = 0;
+        for buf in bufs.iter_mut() {
+            let n = inode.buf.pop(buf);
+            num += n;
+            if n < buf.len() {
+                break;
+            }
         }
 
-        //更新读位置以及valid_cnt
-        inode.read_pos = (inode.read_pos + num as i32) % PIPE_BUFF_SIZE as i32;
-        inode.valid_cnt -= num as i32;
-
         //读完后解锁并唤醒等待在写等待队列中的进程
         inode
             .write_wait_queue
-            .wakeup(Some(ProcessState::Blocked(true)));
+            .wakeup_all(Some(ProcessState::Blocked(true)));
         //返回读取的字节数
         return Ok(num);
     }
 
+    /// @brief 把`bufs`中的数据按顺序写入管道
+    ///
+    /// 总长度不超过PIPE_BUF的写入是原子的，需要等到管道的剩余空间能放下全部数据；更长的写入每次写入能放下的部分。
+    /// 管道满时，`nonblock`为false则睡眠等待读者；否则返回已经写入的字节数，一个字节都没有写入时返回EAGAIN
+    ///
+    /// @return 写入的字节数
+    pub fn write_bufs(&self, bufs: &[&[u8]], nonblock: bool) -> Result<usize, SystemError> {
+        let total: usize = bufs.iter().map(|b| b.len()).sum();
+        // 加锁
+        let mut inode = self.0.lock();
+
+        // TODO: 如果已经没有读端存在了，则向写端进程发送SIGPIPE信号
+        if inode.reader == 0 {}
+
+        let mut written = 0;
+        // 下一个要写入的缓冲区，以及其中已经写入的字节数
+        let mut idx = 0;
+        let mut off = 0;
+        while written < total {
+            let free = inode.buf.free();
+            let writable = if total <= PIPE_BUF {
+                free >= total
+            } else {
+                free > 0
+            };
+
+            // 如果管道空间不够
+            if !writable {
+                // 唤醒读端
+                inode
+                    .read_wait_queue
+                    .wakeup_all(Some(ProcessState::Blocked(true)));
+
+                // 如果为非阻塞管道，返回已经写入的字节数
+                if nonblock {
+                    drop(inode);
+                    if written > 0 {
+                        return Ok(written);
+                    }
+                    return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
+                }
+
+                // 解锁并睡眠
+                unsafe {
+                    let irq_guard = CurrentIrqArch::save_and_disable_irq();
+                    inode.write_wait_queue.sleep_without_schedule();
+                    drop(inode);
+                    drop(irq_guard);
+                }
+                sched();
+                inode = self.0.lock();
+                continue;
+            }
+
+            // 从调用者的缓冲区直接拷贝数据到管道
+            while idx < bufs.len() && inode.buf.free() > 0 {
+                let n = inode.buf.push(&bufs[idx][off..]);
+                written += n;
+                off += n;
+                if off == bufs[idx].len() {
+                    idx += 1;
+                    off = 0;
+                }
+            }
+        }
+
+        // 写完后解锁并唤醒等待在读等待队列中的进程
+        inode
+            .read_wait_queue
+            .wakeup_all(Some(ProcessState::Blocked(true)));
+        // 返回写入的字节数
+        return Ok(written);
+    }
+}
+
+impl IndexNode for LockedPipeInode {
+    fn read_at(
+        &self,
+        _offset: usize,
+        len: usize,
+        buf: &mut [u8],
+        data: &mut FilePrivateData,
+    ) -> Result<usize, crate::syscall::SystemError> {
+        // 获取mode
+        let mode: FileMode;
+        if let FilePrivateData::Pipefs(pdata) = data {
+            mode = pdata.mode;
+        } else {
+            return Err(SystemError::EBADF);
+        }
+
+        if buf.len() < len {
+            return Err(SystemError::EINVAL);
+        }
+        return self.read_bufs(&mut [&mut buf[..len]], mode.contains(FileMode::O_NONBLOCK));
+    }
+
+    fn read_vectored_at(
+        &self,
+        _offset: usize,
+        bufs: &mut [&mut [u8]],
+        data: &mut FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        let mode = match data {
+            FilePrivateData::Pipefs(pdata) => pdata.mode,
+            _ => return Err(SystemError::EBADF),
+        };
+        return self.read_bufs(bufs, mode.contains(FileMode::O_NONBLOCK));
+    }
+
     fn open(
         &self,
         data: &mut FilePrivateData,
@@ -196,7 +398,7 @@ impl IndexNode for LockedPipeInode {
     fn metadata(&self) -> Result<crate::filesystem::vfs::Metadata, SystemError> {
         let inode = self.0.lock();
         let mut metadata = inode.metadata.clone();
-        metadata.size = inode.data.len() as i64;
+        metadata.size = inode.buf.capacity() as i64;
 
         return Ok(metadata);
     }
@@ -252,66 +454,44 @@ impl IndexNode for LockedPipeInode {
             return Err(SystemError::EBADF);
         }
 
-        if buf.len() < len || len > PIPE_BUFF_SIZE {
+        if buf.len() < len {
             return Err(SystemError::EINVAL);
         }
-        // 加锁
-
-        let mut inode = self.0.lock();
-
-        // TODO: 如果已经没有读端存在了，则向写端进程发送SIGPIPE信号
-        if inode.reader == 0 {}
-
-        // 如果管道空间不够
-
-        while len + inode.valid_cnt as usize > PIPE_BUFF_SIZE {
-            // 唤醒读端
-            inode
-                .read_wait_queue
-                .wakeup(Some(ProcessState::Blocked(true)));
+        return self.write_bufs(&[&buf[..len]], mode.contains(FileMode::O_NONBLOCK));
+    }
 
-            // 如果为非阻塞管道，直接返回错误
-            if mode.contains(FileMode::O_NONBLOCK) {
-                drop(inode);
-                return Err(SystemError::ENOMEM);
-            }
+    fn write_vectored_at(
+        &self,
+        _offset: usize,
+        bufs: &[&[u8]],
+        data: &mut FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        let mode = match data {
+            FilePrivateData::Pipefs(pdata) => pdata.mode,
+            _ => return Err(SystemError::EBADF),
+        };
+        return self.write_bufs(bufs, mode.contains(FileMode::O_NONBLOCK));
+    }
 
-            // 解锁并睡眠
-            unsafe {
-                let irq_guard = CurrentIrqArch::save_and_disable_irq();
-                inode.write_wait_queue.sleep_without_schedule();
-                drop(inode);
-                drop(irq_guard);
-            }
-            sched();
-            inode = self.0.lock();
+    fn poll(&self) -> Result<PollStatus, crate::syscall::SystemError> {
+        let inode = self.0.lock();
+        let mut status = PollStatus::empty();
+        // 没有写端时，读取会立即返回EOF，因此也是可读的
+        if inode.buf.len > 0 || inode.writer == 0 {
+            status |= PollStatus::READ;
         }
-
-        // 决定要输入的字节
-        let start = inode.write_pos as usize;
-        let end = (inode.write_pos as usize + len) % PIPE_BUFF_SIZE;
-        // 从用户的缓冲区拷贝数据到管道
-
-        if end < start {
-            inode.data[start..PIPE_BUFF_SIZE].copy_from_slice(&buf[0..(PIPE_BUFF_SIZE - start)]);
-            inode.data[0..end].copy_from_slice(&buf[(PIPE_BUFF_SIZE - start)..len]);
-        } else {
-            inode.data[start..end].copy_from_slice(&buf[0..len]);
+        // 与写入的原子性保持一致：剩余空间能放下PIPE_BUF字节时才可写
+        if inode.buf.free() >= PIPE_BUF || inode.reader == 0 {
+            status |= PollStatus::WRITE;
         }
-        // 更新写位置以及valid_cnt
-        inode.write_pos = (inode.write_pos + len as i32) % PIPE_BUFF_SIZE as i32;
-        inode.valid_cnt += len as i32;
-
-        // 读完后解锁并唤醒等待在读等待队列中的进程
-        inode
-            .read_wait_queue
-            .wakeup(Some(ProcessState::Blocked(true)));
-        // 返回写入的字节数
-        return Ok(len);
+        return Ok(status);
     }
 
-    fn poll(&self) -> Result<PollStatus, crate::syscall::SystemError> {
-        return Ok(PollStatus::READ | PollStatus::WRITE);
+    fn poll_wait(&self, table: &mut PollTable) {
+        // poll时不知道是哪一端，因此同时等待两个队列（poll会按照请求的事件过滤）
+        let inode = self.0.lock();
+        table.wait(&inode.read_wait_queue);
+        table.wait(&inode.write_wait_queue);
     }
 
     fn as_any_ref(&self) -> &dyn core::any::Any {
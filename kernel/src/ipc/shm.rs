@@ -0,0 +1,464 @@
+//! 共享内存
+//!
+//! System V共享内存段（shmget/shmat/shmdt/shmctl）是内部ramfs中的一个匿名文件：shmat把文件的页面缓存以
+//! MAP_SHARED的方式映射到进程的地址空间，连接到同一个段的进程映射的是同一批物理页。ramfs的缓存页就是文件的数据，
+//! 不会被回收。
+//!
+//! POSIX共享内存（shm_open）由libc实现为打开/dev/shm下的文件，因此只需要在/dev/shm挂载一个ramfs。
+//!
+//! 段的连接数（shm_nattch）是映射这个段的[`FileMapping`]的引用计数之和：每个映射它的VMA持有一个引用，
+//! 进程退出时VMA被释放，连接数随之减少。fork和munmap切分VMA也会增加引用，因此连接数是一个近似值
+
+use core::{
+    mem::size_of,
+    sync::atomic::{AtomicUsize, Ordering},
+};
+
+use alloc::{
+    collections::BTreeMap,
+    format,
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+
+use crate::{
+    arch::MMArch,
+    filesystem::{
+        ramfs::RamFS,
+        vfs::{
+            core::ROOT_INODE, page_cache::FileMapping, syscall::ModeType, FileSystem, FileType,
+            IndexNode,
+        },
+    },
+    kinfo,
+    libs::{align::page_align_up, mutex::Mutex, spinlock::SpinLock},
+    mm::{
+        allocator::page_frame::{PageFrameCount, VirtPageFrame},
+        syscall::{MapFlags, ProtFlags},
+        ucontext::AddressSpace,
+        MemoryManagementArch, VirtAddr,
+    },
+    process::ProcessManager,
+    syscall::{
+        user_access::{UserBufferReader, UserBufferWriter},
+        Syscall, SystemError,
+    },
+    time::Instant,
+};
+
+/// 每次都创建新的段
+pub const IPC_PRIVATE: i32 = 0;
+
+pub const IPC_RMID: i32 = 0;
+pub const IPC_SET: i32 = 1;
+pub const IPC_STAT: i32 = 2;
+pub const SHM_LOCK: i32 = 11;
+pub const SHM_UNLOCK: i32 = 12;
+/// libc在cmd中设置这个位，表示使用64位的结构体。x86_64上只有这一种结构体，忽略它
+const IPC_64: i32 = 0x100;
+
+/// 段的最小和最大大小
+pub const SHMMIN: usize = 1;
+pub const SHMMAX: usize = 1 << 32;
+/// 段的最大数量
+pub const SHMMNI: usize = 4096;
+
+bitflags! {
+    /// shmget的标志，低9位是段的访问权限
+    pub struct ShmGetFlags: u32 {
+        const IPC_CREAT = 0o1000;
+        const IPC_EXCL = 0o2000;
+        const SHM_HUGETLB = 0o4000;
+        const SHM_NORESERVE = 0o10000;
+    }
+
+    /// shmat的标志
+    pub struct ShmAtFlags: u32 {
+        const SHM_RDONLY = 0o10000;
+        const SHM_RND = 0o20000;
+        const SHM_REMAP = 0o40000;
+        const SHM_EXEC = 0o100000;
+    }
+}
+
+/// 与Linux的`struct ipc64_perm`一致
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+pub struct IpcPerm {
+    pub key: i32,
+    pub uid: u32,
+    pub gid: u32,
+    pub cuid: u32,
+    pub cgid: u32,
+    pub mode: u32,
+    pub seq: u16,
+    _pad: u16,
+    _unused: [u64; 2],
+}
+
+/// 与Linux的`struct shmid64_ds`一致
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+pub struct ShmidDs {
+    pub shm_perm: IpcPerm,
+    pub shm_segsz: usize,
+    pub shm_atime: i64,
+    pub shm_dtime: i64,
+    pub shm_ctime: i64,
+    pub shm_cpid: i32,
+    pub shm_lpid: i32,
+    pub shm_nattch: u64,
+    _unused: [u64; 2],
+}
+
+/// IPC_RMID之后，段被标记为删除，最后一个连接断开时从段表中移除
+const SHM_DEST: u32 = 0o1000;
+
+#[derive(Debug)]
+struct ShmSegment {
+    /// 段所在的文件，段的页面是它的页面缓存
+    inode: Arc<dyn IndexNode>,
+    inner: SpinLock<ShmidDs>,
+    /// 映射了这个段的文件映射
+    attaches: SpinLock<Vec<Weak<FileMapping>>>,
+}
+
+impl ShmSegment {
+    fn nattch(&self) -> u64 {
+        let mut attaches = self.attaches.lock();
+        attaches.retain(|m| m.strong_count() > 0);
+        return attaches.iter().map(|m| m.strong_count() as u64).sum();
+    }
+
+    fn stat(&self) -> ShmidDs {
+        let mut ds = *self.inner.lock();
+        ds.shm_nattch = self.nattch();
+        return ds;
+    }
+
+    /// 已被删除并且没有连接
+    fn dead(&self) -> bool {
+        return self.inner.lock().shm_perm.mode & SHM_DEST != 0 && self.nattch() == 0;
+    }
+
+    /// `mapping`是否映射了这个段
+    fn owns(&self, mapping: &FileMapping) -> bool {
+        return self
+            .inode
+            .page_cache()
+            .map(|c| Arc::ptr_eq(&c, mapping.cache()))
+            .unwrap_or(false);
+    }
+}
+
+#[derive(Debug)]
+struct ShmTable {
+    segments: BTreeMap<i32, Arc<ShmSegment>>,
+    /// 键到段的标识符，IPC_PRIVATE和已删除的段不在这里
+    keys: BTreeMap<i32, i32>,
+    next_id: i32,
+}
+
+impl ShmTable {
+    /// 移除已被删除并且没有连接的段
+    fn reap(&mut self) {
+        self.segments.retain(|_, seg| !seg.dead());
+    }
+
+    fn get(&mut self, shmid: i32) -> Result<Arc<ShmSegment>, SystemError> {
+        self.reap();
+        return self
+            .segments
+            .get(&shmid)
+            .cloned()
+            .ok_or(SystemError::EINVAL);
+    }
+
+    fn alloc_id(&mut self) -> i32 {
+        loop {
+            let id = self.next_id;
+            self.next_id = self.next_id.checked_add(1).unwrap_or(0);
+            if !self.segments.contains_key(&id) {
+                return id;
+            }
+        }
+    }
+}
+
+lazy_static! {
+    static ref SHM_TABLE: Mutex<ShmTable> = Mutex::new(ShmTable {
+        segments: BTreeMap::new(),
+        keys: BTreeMap::new(),
+        next_id: 0,
+    });
+    /// System V共享内存段所在的文件系统，它没有被挂载
+    static ref SYSV_SHM_FS: Arc<RamFS> = RamFS::new();
+    /// 挂载在/dev/shm的文件系统
+    static ref DEV_SHM_FS: Arc<RamFS> = RamFS::new();
+}
+
+/// 在/dev/shm挂载ramfs，供POSIX共享内存使用
+///
+/// 迁移根文件系统时devfs被重新挂载，它下面的挂载点会丢失，因此迁移之后需要再调用一次
+pub fn dev_shm_init() -> Result<(), SystemError> {
+    let dev = ROOT_INODE().find("dev")?;
+    let shm = match dev.find("shm") {
+        Ok(inode) => inode,
+        Err(SystemError::ENOENT) => {
+            dev.create("shm", FileType::Dir, ModeType::from_bits_truncate(0o1777))?
+        }
+        Err(e) => return Err(e),
+    };
+    shm.mount(DEV_SHM_FS.clone())?;
+    kinfo!("Mounted ramfs on /dev/shm");
+    return Ok(());
+}
+
+fn now() -> i64 {
+    return Instant::now().secs();
+}
+
+fn current_pid() -> i32 {
+    return ProcessManager::current_pcb().pid().data() as i32;
+}
+
+/// 创建一个大小为`size`字节、内容全为0的匿名共享内存文件（与Linux的shmem_zero_setup相同）
+///
+/// 用于以MAP_SHARED的方式映射/dev/zero：映射它的页面缓存之后，fork出的进程与父进程共享同一批物理页。
+/// 文件不在任何目录中，最后一个映射被解除时被释放
+pub fn shmem_zero_setup(size: usize) -> Result<Arc<dyn IndexNode>, SystemError> {
+    static NEXT_ID: AtomicUsize = AtomicUsize::new(0);
+    let root = SYSV_SHM_FS.root_inode();
+    let name = format!("dev-zero-{}", NEXT_ID.fetch_add(1, Ordering::Relaxed));
+    let inode = root.create(&name, FileType::File, ModeType::from_bits_truncate(0o600))?;
+    root.unlink(&name)?;
+    inode.resize(page_align_up(size))?;
+    return Ok(inode);
+}
+
+/// 创建标识符为`id`的段，大小为`size`字节
+fn new_segment(id: i32, key: i32, size: usize, mode: u32) -> Result<Arc<ShmSegment>, SystemError> {
+    let root = SYSV_SHM_FS.root_inode();
+    let name = format!("SYSV{:08x}-{}", key as u32, id);
+    let inode = root.create(&name, FileType::File, ModeType::from_bits_truncate(0o600))?;
+    // 段只通过标识符访问，文件不需要留在目录中
+    root.unlink(&name)?;
+    inode.resize(size)?;
+
+    let mut ds = ShmidDs::default();
+    ds.shm_perm.key = key;
+    ds.shm_perm.mode = mode & 0o777;
+    ds.shm_segsz = size;
+    ds.shm_ctime = now();
+    ds.shm_cpid = current_pid();
+    return Ok(Arc::new(ShmSegment {
+        inode,
+        inner: SpinLock::new(ds),
+        attaches: SpinLock::new(Vec::new()),
+    }));
+}
+
+impl Syscall {
+    /// 获取键为`key`的共享内存段的标识符，不存在并且指定了IPC_CREAT时创建它
+    ///
+    /// 段的页面是普通的4K页，不支持SHM_HUGETLB
+    pub fn shmget(key: i32, size: usize, shmflg: u32) -> Result<usize, SystemError> {
+        let flags = ShmGetFlags::from_bits_truncate(shmflg);
+        if flags.contains(ShmGetFlags::SHM_HUGETLB) {
+            return Err(SystemError::EOPNOTSUPP_OR_ENOTSUP);
+        }
+        let mut table = SHM_TABLE.lock();
+        table.reap();
+
+        if key != IPC_PRIVATE {
+            if let Some(id) = table.keys.get(&key).copied() {
+                if flags.contains(ShmGetFlags::IPC_CREAT | ShmGetFlags::IPC_EXCL) {
+                    return Err(SystemError::EEXIST);
+                }
+                let seg = table.get(id)?;
+                if size > seg.inner.lock().shm_segsz {
+                    return Err(SystemError::EINVAL);
+                }
+                return Ok(id as usize);
+            }
+            if !flags.contains(ShmGetFlags::IPC_CREAT) {
+                return Err(SystemError::ENOENT);
+            }
+        }
+
+        if size < SHMMIN || size > SHMMAX {
+            return Err(SystemError::EINVAL);
+        }
+        if table.segments.len() >= SHMMNI {
+            return Err(SystemError::ENOSPC);
+        }
+        let id = table.alloc_id();
+        let seg = new_segment(id, key, size, shmflg)?;
+        table.segments.insert(id, seg);
+        if key != IPC_PRIVATE {
+            table.keys.insert(key, id);
+        }
+        return Ok(id as usize);
+    }
+
+    /// 把共享内存段映射到当前进程的地址空间，返回映射的起始地址
+    ///
+    /// `shmaddr`为0时由内核选择地址，否则映射到`shmaddr`（SHM_RND时向下对齐到页）。
+    /// 不支持用SHM_REMAP覆盖已有的映射
+    pub fn shmat(shmid: i32, shmaddr: usize, shmflg: u32) -> Result<usize, SystemError> {
+        let flags = ShmAtFlags::from_bits_truncate(shmflg);
+        let seg = SHM_TABLE.lock().get(shmid)?;
+
+        let mut addr = shmaddr;
+        if addr & MMArch::PAGE_OFFSET_MASK != 0 {
+            if !flags.contains(ShmAtFlags::SHM_RND) {
+                return Err(SystemError::EINVAL);
+            }
+            addr &= !MMArch::PAGE_OFFSET_MASK;
+        }
+        let mut map_flags = MapFlags::MAP_SHARED;
+        if addr != 0 {
+            map_flags |= if flags.contains(ShmAtFlags::SHM_REMAP) {
+                MapFlags::MAP_FIXED
+            } else {
+                MapFlags::MAP_FIXED_NOREPLACE
+            };
+        }
+        let mut prot_flags = ProtFlags::PROT_READ;
+        if !flags.contains(ShmAtFlags::SHM_RDONLY) {
+            prot_flags |= ProtFlags::PROT_WRITE;
+        }
+        if flags.contains(ShmAtFlags::SHM_EXEC) {
+            prot_flags |= ProtFlags::PROT_EXEC;
+        }
+
+        let cache = seg.inode.page_cache().ok_or(SystemError::EINVAL)?;
+        let size = seg.inner.lock().shm_segsz;
+        let address_space = AddressSpace::current()?;
+        let mut guard = address_space.write();
+        let start = guard
+            .map_file(
+                VirtAddr::new(addr),
+                size,
+                prot_flags,
+                map_flags,
+                cache,
+                0,
+                true,
+                true,
+            )
+            .map_err(|e| match e {
+                SystemError::EEXIST => SystemError::EINVAL,
+                e => e,
+            })?
+            .virt_address();
+        let mapping = guard
+            .mappings
+            .contains(start)
+            .and_then(|vma| vma.lock().file_mapping().cloned())
+            .ok_or(SystemError::EFAULT)?;
+        drop(guard);
+
+        seg.attaches.lock().push(Arc::downgrade(&mapping));
+        let mut ds = seg.inner.lock();
+        ds.shm_atime = now();
+        ds.shm_lpid = current_pid();
+        return Ok(start.data());
+    }
+
+    /// 解除`shmaddr`处的共享内存段的映射，`shmaddr`必须是shmat返回的地址
+    pub fn shmdt(shmaddr: usize) -> Result<usize, SystemError> {
+        let vaddr = VirtAddr::new(shmaddr);
+        let address_space = AddressSpace::current()?;
+        let mapping = address_space
+            .read()
+            .mappings
+            .contains(vaddr)
+            .and_then(|vma| vma.lock().file_mapping().cloned())
+            .filter(|m| m.start() == vaddr)
+            .ok_or(SystemError::EINVAL)?;
+        let seg = SHM_TABLE
+            .lock()
+            .segments
+            .values()
+            .find(|seg| seg.owns(&mapping))
+            .cloned()
+            .ok_or(SystemError::EINVAL)?;
+        let size = page_align_up(seg.inner.lock().shm_segsz);
+
+        // 只解除属于这次连接的VMA，范围内被替换掉的部分不受影响
+        let mut guard = address_space.write();
+        let mut cur = vaddr;
+        while cur < vaddr + size {
+            let vma = match guard.mappings.contains(cur) {
+                Some(vma) => vma,
+                None => {
+                    cur += MMArch::PAGE_SIZE;
+                    continue;
+                }
+            };
+            let (region, same) = {
+                let vma = vma.lock();
+                let same = vma
+                    .file_mapping()
+                    .map(|m| Arc::ptr_eq(m, &mapping))
+                    .unwrap_or(false);
+                (*vma.region(), same)
+            };
+            if same {
+                guard.munmap(
+                    VirtPageFrame::new(region.start()),
+                    PageFrameCount::new(region.size() / MMArch::PAGE_SIZE),
+                )?;
+            }
+            cur = region.end();
+        }
+        drop(guard);
+        drop(mapping);
+
+        let mut ds = seg.inner.lock();
+        ds.shm_dtime = now();
+        ds.shm_lpid = current_pid();
+        return Ok(0);
+    }
+
+    /// 共享内存段的控制操作：IPC_STAT、IPC_SET、IPC_RMID。
+    ///
+    /// 段的页面不会被换出，SHM_LOCK和SHM_UNLOCK不需要做任何事情
+    pub fn shmctl(shmid: i32, cmd: i32, buf: *mut ShmidDs) -> Result<usize, SystemError> {
+        let mut table = SHM_TABLE.lock();
+        let seg = table.get(shmid)?;
+        match cmd & !IPC_64 {
+            IPC_STAT => {
+                let ds = seg.stat();
+                let mut writer = UserBufferWriter::new(buf, size_of::<ShmidDs>(), true)?;
+                writer.copy_one_to_user(&ds, 0)?;
+            }
+            IPC_SET => {
+                let reader = UserBufferReader::new(buf, size_of::<ShmidDs>(), true)?;
+                let new = *reader.read_one_from_user::<ShmidDs>(0)?;
+                let mut ds = seg.inner.lock();
+                ds.shm_perm.uid = new.shm_perm.uid;
+                ds.shm_perm.gid = new.shm_perm.gid;
+                ds.shm_perm.mode = (ds.shm_perm.mode & !0o777) | (new.shm_perm.mode & 0o777);
+                ds.shm_ctime = now();
+            }
+            IPC_RMID => {
+                let key = {
+                    let mut ds = seg.inner.lock();
+                    ds.shm_perm.mode |= SHM_DEST;
+                    ds.shm_ctime = now();
+                    // 被删除的段不能再通过键找到
+                    core::mem::replace(&mut ds.shm_perm.key, IPC_PRIVATE)
+                };
+                if table.keys.get(&key) == Some(&shmid) {
+                    table.keys.remove(&key);
+                }
+                table.reap();
+            }
+            SHM_LOCK | SHM_UNLOCK => {}
+            _ => return Err(SystemError::EINVAL),
+        }
+        return Ok(0);
+    }
+}
@@ -1,4 +1,4 @@
-use core::sync::atomic::compiler_fence;
+use core::sync::atomic::{compiler_fence, Ordering};
 
 use alloc::sync::Arc;
 
@@ -6,14 +6,14 @@ use crate::{
     arch::ipc::signal::{SigCode, SigFlags, SigSet, Signal},
     ipc::signal_types::SigactionType,
     kwarn,
-    libs::spinlock::SpinLockGuard,
-    process::{pid::PidType, Pid, ProcessControlBlock, ProcessFlags, ProcessManager},
+    process::{
+        pid::PidType, Pid, ProcessControlBlock, ProcessFlags, ProcessManager, ProcessSignalInfo,
+        ProcessState,
+    },
     syscall::SystemError,
 };
 
-use super::signal_types::{
-    SaHandlerType, SigInfo, SigType, Sigaction, SignalStruct, SIG_KERNEL_STOP_MASK,
-};
+use super::signal_types::{SaHandlerType, SigInfo, SigType, Sigaction, SIG_KERNEL_STOP_MASK};
 
 impl Signal {
     /// 向目标进程发送信号
@@ -82,28 +82,29 @@ impl Signal {
             //详见 https://opengrok.ringotek.cn/xref/linux-6.1.9/kernel/signal.c?r=&mo=32170&fi=1220#1226
         }
 
+        let kthread = pcb.flags().contains(ProcessFlags::KTHREAD);
+        // 快速路径：非实时信号不排队，目标已经有同一个信号在等待处理时，这次发送与它合并。
+        // 只需要原子地检查目标的待处理信号位图，不获取任何锁。
+        // 会影响其他待处理信号的信号（SIGCONT、停止信号）以及SIGKILL仍然走完整的流程
+        if !self.is_rt_signal()
+            && !kthread
+            && *self != Signal::SIGKILL
+            && *self != Signal::SIGCONT
+            && (self.into_sigset() & SIG_KERNEL_STOP_MASK).is_empty()
+            && pcb.sig_is_pending(self.into_sigset())
+        {
+            return Ok(0);
+        }
+
         if !self.prepare_sianal(pcb.clone(), force_send) {
             return Err(SystemError::EINVAL);
         }
         // kdebug!("force send={}", force_send);
-        let pcb_info = pcb.sig_info();
-        let pending = if matches!(pt, PidType::PID) {
-            pcb_info.sig_shared_pending()
-        } else {
-            pcb_info.sig_pending()
-        };
         compiler_fence(core::sync::atomic::Ordering::SeqCst);
         // 如果是kill或者目标pcb是内核线程，则无需获取sigqueue，直接发送信号即可
-        if matches!(self, Signal::SIGKILL) || pcb.flags().contains(ProcessFlags::KTHREAD) {
-            //避免死锁
-            drop(pcb_info);
+        if matches!(self, Signal::SIGKILL) || kthread {
             self.complete_signal(pcb.clone(), pt);
-        }
-        // 如果不是实时信号的话，同一时刻信号队列里只会有一个待处理的信号，如果重复接收就不做处理
-        else if !self.is_rt_signal() && pending.queue().find(self.clone()).0.is_some() {
-            return Ok(0);
         } else {
-            // TODO signalfd_notify 完善 signalfd 机制
             // 如果是其他信号，则加入到sigqueue内，然后complete_signal
             let new_sig_info = match info {
                 Some(siginfo) => {
@@ -120,12 +121,15 @@ impl Signal {
                     )
                 }
             };
+            let mut pcb_info = pcb.sig_info_mut();
+            // 如果不是实时信号的话，同一时刻信号队列里只会有一个待处理的信号，如果重复接收就不做处理。
+            // 快速路径的检查没有加锁，这里需要在锁内再检查一次
+            if !self.is_rt_signal() && pcb_info.sig_pending().signal().contains(self.into_sigset())
+            {
+                return Ok(0);
+            }
+            pcb_info.sig_pending_mut().queue_mut().q.push(new_sig_info);
             drop(pcb_info);
-            pcb.sig_info_mut()
-                .sig_pending_mut()
-                .queue_mut()
-                .q
-                .push(new_sig_info);
 
             if pt == PidType::PGID || pt == PidType::SID {}
             self.complete_signal(pcb.clone(), pt);
@@ -141,13 +145,19 @@ impl Signal {
     /// @param pt siginfo结构体中，pid字段代表的含义
     fn complete_signal(&self, pcb: Arc<ProcessControlBlock>, pt: PidType) {
         // kdebug!("complete_signal");
-        // todo: 将信号产生的消息通知到正在监听这个信号的进程（引入signalfd之后，在这里调用signalfd_notify)
-        // 将这个信号加到目标进程的sig_pending中
-        pcb.sig_info_mut()
+        // 将这个信号加到目标进程的sig_pending中，同时更新不加锁读取的位图
+        let mut pcb_info = pcb.sig_info_mut();
+        pcb_info
             .sig_pending_mut()
             .signal_mut()
-            .insert(self.clone().into());
+            .insert(self.into_sigset());
+        pcb.sig_pending_mask()
+            .fetch_or(self.into_sigset().bits(), Ordering::Release);
+        drop(pcb_info);
         compiler_fence(core::sync::atomic::Ordering::SeqCst);
+        // 通知在signalfd上等待的读者
+        pcb.signalfd_wait()
+            .wakeup_all(Some(ProcessState::Blocked(true)));
         // ===== 寻找需要wakeup的目标进程 =====
         // 备注：由于当前没有进程组的概念，每个进程只有1个对应的线程，因此不需要通知进程组内的每个进程。
         //      todo: 当引入进程组的概念后，需要完善这里，使得它能寻找一个目标进程来唤醒，接着执行信号处理的操作。
@@ -177,8 +187,7 @@ impl Signal {
         compiler_fence(core::sync::atomic::Ordering::SeqCst);
         // TODO: 到这里，信号已经被放置在共享的pending队列中，我们在这里把目标进程唤醒。
         if _target.is_some() {
-            let guard = pcb.sig_struct();
-            signal_wake_up(pcb.clone(), guard, *self == Signal::SIGKILL);
+            signal_wake_up(pcb.clone(), *self == Signal::SIGKILL);
         }
     }
 
@@ -208,12 +217,7 @@ impl Signal {
         // todo: 检查目标进程是否正在一个cpu上执行，如果是，则返回true，否则继续检查下一项
 
         // 检查目标进程是否有信号正在等待处理，如果是，则返回false，否则返回true
-        if pcb.sig_info().sig_pending().signal().bits() == 0 {
-            assert!(pcb.sig_info().sig_pending().queue().q.is_empty());
-            return true;
-        } else {
-            return false;
-        }
+        return !pcb.has_pending_signal();
     }
 
     /// @brief 判断signal的处理是否可能使得整个进程组退出
@@ -247,16 +251,17 @@ impl Signal {
         let flush: SigSet;
         if !(self.into_sigset() & SIG_KERNEL_STOP_MASK).is_empty() {
             flush = Signal::SIGCONT.into_sigset();
-            pcb.sig_info_mut()
-                .sig_shared_pending_mut()
-                .flush_by_mask(&flush);
+            let mut pcb_info = pcb.sig_info_mut();
+            pcb_info.sig_shared_pending_mut().flush_by_mask(&flush);
+            recalc_sigpending(&pcb, &pcb_info);
             // TODO 对每个子线程 flush mask
         } else if *self == Signal::SIGCONT {
             flush = SIG_KERNEL_STOP_MASK;
             assert!(!flush.is_empty());
-            pcb.sig_info_mut()
-                .sig_shared_pending_mut()
-                .flush_by_mask(&flush);
+            let mut pcb_info = pcb.sig_info_mut();
+            pcb_info.sig_shared_pending_mut().flush_by_mask(&flush);
+            recalc_sigpending(&pcb, &pcb_info);
+            drop(pcb_info);
             let _r = ProcessManager::wakeup_stop(&pcb);
             // TODO 对每个子线程 flush mask
             // 这里需要补充一段逻辑，详见https://opengrok.ringotek.cn/xref/linux-6.1.9/kernel/signal.c#952
@@ -277,10 +282,11 @@ impl Signal {
 /// ## 参数
 ///
 /// - `pcb` 要唤醒的进程pcb
-/// - `_guard` 信号结构体锁守卫，来保证信号结构体已上锁
 /// - `fatal` 表明这个信号是不是致命的(会导致进程退出)
+///
+/// 唤醒只依赖调度信息的锁，不需要持有目标进程的信号结构体的锁
 #[inline]
-fn signal_wake_up(pcb: Arc<ProcessControlBlock>, _guard: SpinLockGuard<SignalStruct>, fatal: bool) {
+fn signal_wake_up(pcb: Arc<ProcessControlBlock>, fatal: bool) {
     // 如果是 fatal 的话就唤醒 stop 和 block 的进程来响应，因为唤醒后就会终止
     // 如果不是 fatal 的就只唤醒 stop 的进程来响应
     // kdebug!("signal_wake_up");
@@ -322,9 +328,14 @@ fn signal_wake_up(pcb: Arc<ProcessControlBlock>, _guard: SpinLockGuard<SignalStr
     }
 }
 
-/// @brief 当一个进程具有多个线程之后，在这里需要重新计算线程的flag中的TIF_SIGPENDING位
-fn recalc_sigpending() {
-    // todo:
+/// 信号被取出或者丢弃之后，根据`pcb`的待处理信号重新计算不加锁读取的位图
+///
+/// 调用者需要持有`pcb`的sig_info的写锁，`siginfo`是锁内的数据。
+/// 当一个进程具有多个线程之后，在这里还需要重新计算每个线程的位图
+pub fn recalc_sigpending(pcb: &ProcessControlBlock, siginfo: &ProcessSignalInfo) {
+    let pending = siginfo.sig_pending().signal() | siginfo.sig_shared_pending().signal();
+    pcb.sig_pending_mask()
+        .store(pending.bits(), Ordering::Release);
 }
 
 /// @brief 刷新指定进程的sighand的sigaction，将满足条件的sigaction恢复为Default
@@ -409,7 +420,9 @@ pub(super) fn do_sigaction(
         if action.is_ignore() {
             let mut mask: SigSet = SigSet::from_bits_truncate(0);
             mask.insert(sig.into());
-            pcb.sig_info_mut().sig_pending_mut().flush_by_mask(&mask);
+            let mut pcb_info = pcb.sig_info_mut();
+            pcb_info.sig_pending_mut().flush_by_mask(&mask);
+            recalc_sigpending(&pcb, &pcb_info);
             // todo: 当有了多个线程后，在这里进行操作，把每个线程的sigqueue都进行刷新
         }
     }
@@ -438,7 +451,9 @@ pub fn set_current_sig_blocked(new_set: &mut SigSet) {
     // todo: 当一个进程有多个线程后，在这里需要设置每个线程的block字段，并且 retarget_shared_pending（虽然我还没搞明白linux这部分是干啥的）
 
     // 设置当前进程的sig blocked
-    *pcb.sig_info_mut().sig_block_mut() = *new_set;
-    recalc_sigpending();
+    let mut pcb_info = pcb.sig_info_mut();
+    *pcb_info.sig_block_mut() = *new_set;
+    recalc_sigpending(&pcb, &pcb_info);
+    drop(pcb_info);
     drop(guard);
 }
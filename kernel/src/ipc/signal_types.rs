@@ -267,10 +267,22 @@ pub struct SigInfo {
 }
 
 impl SigInfo {
+    pub fn sig_no(&self) -> i32 {
+        self.sig_no
+    }
+
     pub fn sig_code(&self) -> SigCode {
         self.sig_code
     }
 
+    pub fn errno(&self) -> i32 {
+        self.errno
+    }
+
+    pub fn sig_type(&self) -> SigType {
+        self.sig_type
+    }
+
     pub fn set_sig_type(&mut self, sig_type: SigType) {
         self.sig_type = sig_type;
     }
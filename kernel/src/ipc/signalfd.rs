@@ -0,0 +1,235 @@
+//! signalfd：通过文件描述符接收信号
+//!
+//! 读取signalfd会从当前进程的待处理信号中取出属于掩码的信号，每个信号以一个128字节的
+//! `struct signalfd_siginfo`返回；没有这样的信号时读取会阻塞（以非阻塞方式打开时返回EAGAIN）。
+//! 与Linux相同，读到的是读取者自己的信号，而不是创建者的信号，因此这些信号通常需要先用sigprocmask屏蔽，
+//! 以免它们被按照通常的方式处理。
+//!
+//! 信号到达时唤醒目标进程的[`ProcessControlBlock::signalfd_wait`]，poll和阻塞的读取在它上面等待
+
+use core::mem::size_of;
+
+use alloc::{string::String, sync::Arc, vec::Vec};
+
+use crate::{
+    arch::{
+        ipc::signal::{SigSet, Signal},
+        sched::sched,
+        CurrentIrqArch,
+    },
+    exception::InterruptArch,
+    filesystem::vfs::{
+        core::generate_inode_id, file::FileMode, poll::PollTable, syscall::ModeType,
+        FilePrivateData, FileSystem, FileType, IndexNode, Metadata, PollStatus,
+    },
+    ipc::signal::recalc_sigpending,
+    libs::spinlock::SpinLock,
+    process::{ProcessControlBlock, ProcessManager},
+    syscall::SystemError,
+    time::TimeSpec,
+};
+
+use super::signal_types::{SigInfo, SigType};
+
+/// 与Linux的`struct signalfd_siginfo`一致
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct SignalFdSigInfo {
+    pub ssi_signo: u32,
+    pub ssi_errno: i32,
+    pub ssi_code: i32,
+    pub ssi_pid: u32,
+    pub ssi_uid: u32,
+    pub ssi_fd: i32,
+    pub ssi_tid: u32,
+    pub ssi_band: u32,
+    pub ssi_overrun: u32,
+    pub ssi_trapno: u32,
+    pub ssi_status: i32,
+    pub ssi_int: i32,
+    pub ssi_ptr: u64,
+    pub ssi_utime: u64,
+    pub ssi_stime: u64,
+    pub ssi_addr: u64,
+    pub ssi_addr_lsb: u16,
+    _pad2: u16,
+    pub ssi_syscall: i32,
+    pub ssi_call_addr: u64,
+    pub ssi_arch: u32,
+    _pad: [u8; 28],
+}
+
+impl From<&SigInfo> for SignalFdSigInfo {
+    fn from(info: &SigInfo) -> Self {
+        let mut ssi: SignalFdSigInfo = unsafe { core::mem::zeroed() };
+        ssi.ssi_signo = info.sig_no() as u32;
+        ssi.ssi_errno = info.errno();
+        ssi.ssi_code = info.sig_code() as i32;
+        match info.sig_type() {
+            SigType::Kill(pid) => ssi.ssi_pid = pid.data() as u32,
+        }
+        return ssi;
+    }
+}
+
+/// signalfd的inode
+#[derive(Debug)]
+pub struct SignalFdInode {
+    /// 没有待处理的信号时，读取是否直接返回EAGAIN
+    nonblock: bool,
+    /// 要接收的信号
+    mask: SpinLock<SigSet>,
+    metadata: Metadata,
+}
+
+impl SignalFdInode {
+    pub fn new(mask: SigSet, nonblock: bool) -> Arc<Self> {
+        let metadata = Metadata {
+            dev_id: 0,
+            inode_id: generate_inode_id(),
+            size: 0,
+            blk_size: 0,
+            blocks: 0,
+            atime: TimeSpec::default(),
+            mtime: TimeSpec::default(),
+            ctime: TimeSpec::default(),
+            file_type: FileType::File,
+            mode: ModeType::from_bits_truncate(0o600),
+            nlinks: 1,
+            uid: 0,
+            gid: 0,
+            raw_dev: 0,
+        };
+        return Arc::new(Self {
+            nonblock,
+            mask: SpinLock::new(Self::sanitize(mask)),
+            metadata,
+        });
+    }
+
+    /// SIGKILL和SIGSTOP不能通过signalfd接收
+    fn sanitize(mask: SigSet) -> SigSet {
+        return mask - Signal::SIGKILL.into_sigset() - Signal::SIGSTOP.into_sigset();
+    }
+
+    /// 修改要接收的信号
+    pub fn set_mask(&self, mask: SigSet) {
+        *self.mask.lock_irqsave() = Self::sanitize(mask);
+    }
+
+    fn mask(&self) -> SigSet {
+        return *self.mask.lock_irqsave();
+    }
+
+    /// 从`pcb`的待处理信号中取出属于掩码的信号，最多`max`个
+    fn dequeue(&self, pcb: &ProcessControlBlock, max: usize) -> Vec<SignalFdSigInfo> {
+        let ignore = !self.mask();
+        let mut ret = Vec::new();
+        let mut info = pcb.sig_info_mut();
+        while ret.len() < max {
+            let (sig, siginfo) = info.dequeue_signal(&ignore);
+            if sig == Signal::INVALID {
+                break;
+            }
+            if let Some(siginfo) = siginfo {
+                ret.push(SignalFdSigInfo::from(&siginfo));
+            }
+        }
+        recalc_sigpending(pcb, &info);
+        return ret;
+    }
+}
+
+impl IndexNode for SignalFdInode {
+    fn open(&self, _data: &mut FilePrivateData, _mode: &FileMode) -> Result<(), SystemError> {
+        return Ok(());
+    }
+
+    fn close(&self, _data: &mut FilePrivateData) -> Result<(), SystemError> {
+        return Ok(());
+    }
+
+    /// 读取待处理的信号，`len`至少是一个`signalfd_siginfo`的大小
+    fn read_at(
+        &self,
+        _offset: usize,
+        len: usize,
+        buf: &mut [u8],
+        _data: &mut FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        const SSI_SIZE: usize = size_of::<SignalFdSigInfo>();
+        let max = len.min(buf.len()) / SSI_SIZE;
+        if max == 0 {
+            return Err(SystemError::EINVAL);
+        }
+        let pcb = ProcessManager::current_pcb();
+        loop {
+            let infos = self.dequeue(&pcb, max);
+            if !infos.is_empty() {
+                for (i, ssi) in infos.iter().enumerate() {
+                    let bytes = unsafe {
+                        core::slice::from_raw_parts(ssi as *const _ as *const u8, SSI_SIZE)
+                    };
+                    buf[i * SSI_SIZE..(i + 1) * SSI_SIZE].copy_from_slice(bytes);
+                }
+                return Ok(infos.len() * SSI_SIZE);
+            }
+            if self.nonblock {
+                return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
+            }
+
+            // 在sig_info的锁内检查并加入等待队列，信号的发送者在同一个锁内设置待处理位，因此不会错过唤醒
+            let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+            let info = pcb.sig_info_mut();
+            let pending = info.sig_pending().signal() | info.sig_shared_pending().signal();
+            if pending.intersects(self.mask()) {
+                continue;
+            }
+            // 有没有被屏蔽的信号，需要先处理它
+            if !(pending - *info.sig_block()).is_empty() {
+                return Err(SystemError::ERESTARTSYS);
+            }
+            unsafe { pcb.signalfd_wait().sleep_without_schedule() };
+            drop(info);
+            drop(irq_guard);
+            sched();
+        }
+    }
+
+    fn write_at(
+        &self,
+        _offset: usize,
+        _len: usize,
+        _buf: &[u8],
+        _data: &mut FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        return Err(SystemError::EINVAL);
+    }
+
+    fn poll(&self) -> Result<PollStatus, SystemError> {
+        if ProcessManager::current_pcb().sig_is_pending(self.mask()) {
+            return Ok(PollStatus::READ);
+        }
+        return Ok(PollStatus::empty());
+    }
+
+    fn poll_wait(&self, table: &mut PollTable) {
+        table.wait(ProcessManager::current_pcb().signalfd_wait());
+    }
+
+    fn metadata(&self) -> Result<Metadata, SystemError> {
+        return Ok(self.metadata.clone());
+    }
+
+    fn as_any_ref(&self) -> &dyn core::any::Any {
+        self
+    }
+
+    fn fs(&self) -> Arc<dyn FileSystem> {
+        todo!("signalfd is not in any filesystem")
+    }
+
+    fn list(&self) -> Result<Vec<String>, SystemError> {
+        return Err(SystemError::ENOTDIR);
+    }
+}
@@ -1,5 +1,6 @@
 use core::{
     ffi::{c_int, c_void},
+    mem::size_of,
     sync::atomic::compiler_fence,
 };
 
@@ -12,15 +13,20 @@ use crate::{
     kerror, kwarn,
     mm::VirtAddr,
     process::{Pid, ProcessManager},
-    syscall::{user_access::UserBufferWriter, Syscall, SystemError},
+    syscall::{
+        user_access::{UserBufferReader, UserBufferWriter},
+        Syscall, SystemError,
+    },
 };
 
 use super::{
+    eventfd::{EventFdInode, EFD_SEMAPHORE},
     pipe::{LockedPipeInode, PipeFsPrivateData},
     signal_types::{
         SaHandlerType, SigInfo, SigType, Sigaction, SigactionType, UserSigaction, USER_SIG_DFL,
         USER_SIG_ERR, USER_SIG_IGN,
     },
+    signalfd::SignalFdInode,
 };
 
 impl Syscall {
@@ -218,4 +224,72 @@ impl Syscall {
         }
         return retval.map(|_| 0);
     }
+
+    /// 创建一个eventfd，返回它的文件描述符
+    ///
+    /// `flags`可以包含EFD_SEMAPHORE、O_NONBLOCK和O_CLOEXEC（与EFD_NONBLOCK、EFD_CLOEXEC的值相同）
+    pub fn eventfd2(initval: u32, flags: u32) -> Result<usize, SystemError> {
+        let semaphore = flags & EFD_SEMAPHORE != 0;
+        let flags = FileMode::from_bits(flags & !EFD_SEMAPHORE).ok_or(SystemError::EINVAL)?;
+        if !(FileMode::O_NONBLOCK | FileMode::O_CLOEXEC).contains(flags) {
+            return Err(SystemError::EINVAL);
+        }
+        let inode = EventFdInode::new(initval, semaphore, flags.contains(FileMode::O_NONBLOCK));
+        let mut file = File::new(inode, FileMode::O_RDWR | (flags & FileMode::O_NONBLOCK))?;
+        if flags.contains(FileMode::O_CLOEXEC) {
+            file.set_close_on_exec(true);
+        }
+        let fd = ProcessManager::current_pcb()
+            .fd_table()
+            .write()
+            .alloc_fd(file, None)?;
+        return Ok(fd as usize);
+    }
+
+    /// 创建一个接收`mask`中的信号的signalfd，返回它的文件描述符。
+    /// `fd`不为-1时，修改这个已有的signalfd的掩码
+    ///
+    /// `flags`只能包含O_NONBLOCK和O_CLOEXEC（与SFD_NONBLOCK、SFD_CLOEXEC的值相同）
+    pub fn signalfd4(
+        fd: i32,
+        mask: *const SigSet,
+        sizemask: usize,
+        flags: u32,
+    ) -> Result<usize, SystemError> {
+        if sizemask != size_of::<SigSet>() {
+            return Err(SystemError::EINVAL);
+        }
+        let flags = FileMode::from_bits(flags).ok_or(SystemError::EINVAL)?;
+        if !(FileMode::O_NONBLOCK | FileMode::O_CLOEXEC).contains(flags) {
+            return Err(SystemError::EINVAL);
+        }
+        let reader = UserBufferReader::new(mask, size_of::<SigSet>(), true)?;
+        let mask = SigSet::from_bits_truncate(*reader.read_one_from_user::<u64>(0)?);
+
+        if fd != -1 {
+            let file = ProcessManager::current_pcb()
+                .fd_table()
+                .read()
+                .get_file_by_fd(fd)
+                .ok_or(SystemError::EBADF)?;
+            let inode = file.lock().inode();
+            inode
+                .as_any_ref()
+                .downcast_ref::<SignalFdInode>()
+                .ok_or(SystemError::EINVAL)?
+                .set_mask(mask);
+            return Ok(fd as usize);
+        }
+
+        let inode = SignalFdInode::new(mask, flags.contains(FileMode::O_NONBLOCK));
+        let mut file = File::new(inode, FileMode::O_RDONLY | (flags & FileMode::O_NONBLOCK))?;
+        if flags.contains(FileMode::O_CLOEXEC) {
+            file.set_close_on_exec(true);
+        }
+        let fd = ProcessManager::current_pcb()
+            .fd_table()
+            .write()
+            .alloc_fd(file, None)?;
+        return Ok(fd as usize);
+    }
 }
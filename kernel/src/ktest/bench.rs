@@ -0,0 +1,145 @@
+//! 内核微基准测试的框架
+//!
+//! 每个基准测试先执行若干次预热，然后重复执行并用TSC记录每一次的周期数，最后输出分位数。
+//! 输出的每一行都是`KBENCH`开头的、以空格分隔的`key=value`，便于脚本解析并与之前的结果比较，例如：
+//!
+//! ```text
+//! KBENCH name=kmalloc/64 unit=cycles reps=1000 batch=64 min=20 p50=22 p90=25 p99=60 max=812 mean=23
+//! ```
+//!
+//! 除了`name`、`unit`以外的值都是十进制整数；`batch`大于1时，每个样本是一批操作的平均值。
+
+use alloc::{format, string::String, vec::Vec};
+use core::arch::x86_64::{_mm_lfence, _rdtsc};
+
+/// 读取TSC。前后的lfence保证被测量的指令不会越过读取TSC的位置乱序执行
+#[inline(always)]
+pub fn bench_cycles() -> u64 {
+    unsafe {
+        _mm_lfence();
+        let t = _rdtsc();
+        _mm_lfence();
+        return t;
+    }
+}
+
+/// 一个基准测试
+#[derive(Debug)]
+pub struct Bench {
+    name: &'static str,
+    /// 名字的后缀（例如分配的大小）
+    arg: Option<usize>,
+    warmup: usize,
+    reps: usize,
+    batch: usize,
+}
+
+impl Bench {
+    pub fn new(name: &'static str) -> Self {
+        return Self {
+            name,
+            arg: None,
+            warmup: 16,
+            reps: 1000,
+            batch: 1,
+        };
+    }
+
+    /// 名字后缀，输出为`name/arg`
+    pub fn arg(mut self, arg: usize) -> Self {
+        self.arg = Some(arg);
+        return self;
+    }
+
+    /// 预热的次数，不计入结果
+    pub fn warmup(mut self, warmup: usize) -> Self {
+        self.warmup = warmup;
+        return self;
+    }
+
+    /// 样本的数量
+    pub fn reps(mut self, reps: usize) -> Self {
+        self.reps = reps.max(1);
+        return self;
+    }
+
+    /// 每个样本包含的操作次数。单次操作比读取TSC的开销还小时，应当成批测量
+    pub fn batch(mut self, batch: usize) -> Self {
+        self.batch = batch.max(1);
+        return self;
+    }
+
+    /// 测量`f`的执行时间并输出结果。每个样本调用`batch`次`f`
+    pub fn run<F: FnMut()>(&self, mut f: F) -> BenchStats {
+        return self.run_measured(|| {
+            let start = bench_cycles();
+            for _ in 0..self.batch {
+                f();
+            }
+            return bench_cycles() - start;
+        });
+    }
+
+    /// 由`f`自己测量并返回一个样本的周期数（用于排除每次的准备、清理工作）并输出结果
+    pub fn run_measured<F: FnMut() -> u64>(&self, mut f: F) -> BenchStats {
+        for _ in 0..self.warmup {
+            f();
+        }
+        let mut samples: Vec<u64> = Vec::with_capacity(self.reps);
+        for _ in 0..self.reps {
+            samples.push(f() / self.batch as u64);
+        }
+        let stats = BenchStats::from_samples(samples);
+        self.report(&stats);
+        return stats;
+    }
+
+    fn report(&self, stats: &BenchStats) {
+        // 一次输出一整行，避免和其他输出交错
+        let name = match self.arg {
+            Some(arg) => format!("{}/{}", self.name, arg),
+            None => String::from(self.name),
+        };
+        println!(
+            "KBENCH name={} unit=cycles reps={} batch={} min={} p50={} p90={} p99={} max={} mean={}",
+            name,
+            self.reps,
+            self.batch,
+            stats.min,
+            stats.p50,
+            stats.p90,
+            stats.p99,
+            stats.max,
+            stats.mean
+        );
+    }
+}
+
+/// 一个基准测试的统计结果（单位：TSC周期）
+#[derive(Debug, Clone, Copy)]
+pub struct BenchStats {
+    pub min: u64,
+    pub p50: u64,
+    pub p90: u64,
+    pub p99: u64,
+    pub max: u64,
+    pub mean: u64,
+}
+
+impl BenchStats {
+    pub fn from_samples(mut samples: Vec<u64>) -> Self {
+        samples.sort_unstable();
+        let n = samples.len();
+        // 最近秩法计算分位数
+        let pct = |p: usize| samples[((n * p + 99) / 100).clamp(1, n) - 1];
+        let sum: u128 = samples.iter().map(|s| *s as u128).sum();
+        return Self {
+            min: samples[0],
+            p50: pct(50),
+            p90: pct(90),
+            p99: pct(99),
+            max: samples[n - 1],
+            mean: (sum / n as u128) as u64,
+        };
+    }
+}
@@ -0,0 +1,38 @@
+//! 文件系统相关的基准测试：根文件系统（FAT32）上的打开、读取
+
+use alloc::vec;
+
+use crate::{
+    filesystem::vfs::{
+        core::ROOT_INODE,
+        file::{File, FileMode},
+    },
+    kwarn,
+};
+
+use super::bench::Bench;
+
+/// 被测试的文件，根文件系统上一定存在
+const BENCH_FILE: &str = "/bin/DragonReach";
+/// 每次读取的长度
+const READ_SIZE: usize = 4096;
+
+pub fn bench_fs() {
+    if ROOT_INODE().lookup(BENCH_FILE).is_err() {
+        kwarn!("kbench: {} not found, skip fs benchmarks", BENCH_FILE);
+        return;
+    }
+
+    // 路径查找并创建File对象
+    Bench::new("fat_open").run(|| {
+        let inode = ROOT_INODE().lookup(BENCH_FILE).unwrap();
+        File::new(inode, FileMode::O_RDONLY).ok();
+    });
+
+    let mut file = File::new(ROOT_INODE().lookup(BENCH_FILE).unwrap(), FileMode::O_RDONLY)
+        .expect("kbench: failed to open file");
+    let mut buf = vec![0u8; READ_SIZE];
+    Bench::new("fat_read").arg(READ_SIZE).run(|| {
+        file.pread(0, READ_SIZE, &mut buf).ok();
+    });
+}
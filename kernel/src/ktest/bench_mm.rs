@@ -0,0 +1,127 @@
+//! 内存管理相关的基准测试：堆分配器、buddy分配器、缺页异常
+
+use alloc::{
+    alloc::{alloc, dealloc},
+    vec::Vec,
+};
+use core::{alloc::Layout, hint::black_box};
+
+use crate::{
+    arch::MMArch,
+    kwarn,
+    mm::{
+        allocator::page_frame::{
+            allocate_page_frames, deallocate_page_frames, PageFrameCount, PhysPageFrame,
+        },
+        fault::{FaultFlags, PageFaultHandler},
+        syscall::{MapFlags, ProtFlags},
+        ucontext::AddressSpace,
+        MemoryManagementArch, VirtAddr,
+    },
+};
+
+use super::bench::{bench_cycles, Bench};
+
+/// 堆分配器测试的分配大小
+const KMALLOC_SIZES: [usize; 7] = [16, 64, 256, 1024, 4096, 16384, 65536];
+/// buddy分配器测试的最大阶数
+const BUDDY_MAX_ORDER: usize = 9;
+/// 缺页异常测试每个样本映射的页数
+const PAGE_FAULT_PAGES: usize = 256;
+
+pub fn bench_mm() {
+    bench_kmalloc();
+    bench_buddy();
+    bench_page_fault();
+}
+
+/// 分配并立即释放（命中缓存的路径）
+fn bench_kmalloc() {
+    for size in KMALLOC_SIZES {
+        let layout = Layout::from_size_align(size, 8).unwrap();
+        Bench::new("kmalloc_free")
+            .arg(size)
+            .batch(64)
+            .run(|| unsafe {
+                let ptr = alloc(layout);
+                dealloc(black_box(ptr), layout);
+            });
+    }
+
+    // 先连续分配一批，再全部释放，测量缓存耗尽之后的路径
+    for size in KMALLOC_SIZES {
+        let layout = Layout::from_size_align(size, 8).unwrap();
+        let mut ptrs: Vec<*mut u8> = Vec::with_capacity(64);
+        Bench::new("kmalloc_burst")
+            .arg(size)
+            .reps(200)
+            .run_measured(|| {
+                let start = bench_cycles();
+                for _ in 0..64 {
+                    ptrs.push(unsafe { alloc(layout) });
+                }
+                let cycles = bench_cycles() - start;
+                for ptr in ptrs.drain(..) {
+                    unsafe { dealloc(ptr, layout) };
+                }
+                return cycles / 64;
+            });
+    }
+}
+
+fn bench_buddy() {
+    for order in 0..=BUDDY_MAX_ORDER {
+        let count = PageFrameCount::new(1 << order);
+        Bench::new("buddy_alloc_free")
+            .arg(order)
+            .reps(500)
+            .run(|| unsafe {
+                if let Some((paddr, count)) = allocate_page_frames(count) {
+                    deallocate_page_frames(PhysPageFrame::new(paddr), count);
+                }
+            });
+    }
+}
+
+/// 匿名映射的首次写入缺页（分配清零的页并建立映射）
+fn bench_page_fault() {
+    let space = match AddressSpace::new(false) {
+        Ok(space) => space,
+        Err(e) => {
+            kwarn!("kbench: failed to create address space: {:?}", e);
+            return;
+        }
+    };
+    let len = PAGE_FAULT_PAGES * MMArch::PAGE_SIZE;
+    let flags = FaultFlags::FAULT_FLAG_WRITE | FaultFlags::FAULT_FLAG_USER;
+    Bench::new("page_fault_anon")
+        .warmup(1)
+        .reps(20)
+        .run_measured(|| {
+            let start_page = space
+                .write()
+                .map_anonymous(
+                    VirtAddr::new(0),
+                    len,
+                    ProtFlags::PROT_READ | ProtFlags::PROT_WRITE,
+                    MapFlags::MAP_PRIVATE | MapFlags::MAP_ANONYMOUS,
+                    false,
+                )
+                .expect("kbench: map_anonymous failed");
+            let start = start_page.virt_address();
+
+            let t0 = bench_cycles();
+            for i in 0..PAGE_FAULT_PAGES {
+                let vaddr = start + i * MMArch::PAGE_SIZE;
+                PageFaultHandler::handle_mm_fault_in(&space, vaddr, flags)
+                    .expect("kbench: page fault failed");
+            }
+            let cycles = bench_cycles() - t0;
+
+            space
+                .write()
+                .munmap(start_page, PageFrameCount::new(PAGE_FAULT_PAGES))
+                .ok();
+            return cycles / PAGE_FAULT_PAGES as u64;
+        });
+}
@@ -0,0 +1,194 @@
+//! 进程与调度相关的基准测试：上下文切换、管道往返、定时器插入、内核线程的创建与退出
+
+use alloc::{boxed::Box, string::String, sync::Arc};
+use core::hint::spin_loop;
+
+use crate::{
+    filesystem::vfs::{
+        file::{FileMode, FilePrivateData},
+        IndexNode,
+    },
+    ipc::pipe::LockedPipeInode,
+    kwarn,
+    libs::{spinlock::SpinLock, wait_queue::WaitQueue},
+    process::{
+        kthread::{KernelThreadClosure, KernelThreadMechanism},
+        ProcessControlBlock, ProcessManager,
+    },
+    syscall::SystemError,
+    time::timer::{next_n_ms_timer_jiffies, Timer, TimerFunction},
+};
+
+use super::bench::{bench_cycles, Bench};
+
+/// 通知管道往返测试的对端线程退出
+const PIPE_STOP_BYTE: u8 = 0xff;
+
+pub fn bench_sched() {
+    bench_context_switch();
+    bench_pipe_round_trip();
+    bench_timer();
+    bench_kthread();
+}
+
+/// 两个线程通过等待队列轮流唤醒对方
+#[derive(Debug)]
+struct PingPong {
+    /// 偶数：轮到测试线程；奇数：轮到对端线程
+    turn: SpinLock<u64>,
+    /// 测试线程在这里等待
+    ping: WaitQueue,
+    /// 对端线程在这里等待
+    pong: WaitQueue,
+}
+
+/// 每个样本是一次往返（两次上下文切换）的一半
+fn bench_context_switch() {
+    let pp = Arc::new(PingPong {
+        turn: SpinLock::new(0),
+        ping: WaitQueue::INIT,
+        pong: WaitQueue::INIT,
+    });
+
+    let peer_pp = pp.clone();
+    let peer = KernelThreadMechanism::create_and_run(
+        KernelThreadClosure::EmptyClosure((
+            Box::new(move || {
+                let current = ProcessManager::current_pcb();
+                loop {
+                    let mut turn = peer_pp.turn.lock_irqsave();
+                    while *turn % 2 == 0 {
+                        if KernelThreadMechanism::should_stop(&current) {
+                            return 0;
+                        }
+                        peer_pp.pong.sleep_uninterruptible_unlock_spinlock(turn);
+                        turn = peer_pp.turn.lock_irqsave();
+                    }
+                    *turn += 1;
+                    drop(turn);
+                    peer_pp.ping.wakeup_all(None);
+                }
+            }),
+            (),
+        )),
+        String::from("kbench_pong"),
+    );
+    let peer = match peer {
+        Some(peer) => peer,
+        None => {
+            kwarn!("kbench: failed to create kbench_pong");
+            return;
+        }
+    };
+
+    Bench::new("context_switch").run_measured(|| {
+        let start = bench_cycles();
+        *pp.turn.lock_irqsave() += 1;
+        pp.pong.wakeup_all(None);
+        let mut turn = pp.turn.lock_irqsave();
+        while *turn % 2 == 1 {
+            pp.ping.sleep_uninterruptible_unlock_spinlock(turn);
+            turn = pp.turn.lock_irqsave();
+        }
+        drop(turn);
+        return (bench_cycles() - start) / 2;
+    });
+
+    KernelThreadMechanism::stop(&peer).ok();
+}
+
+/// 通过两个管道在两个线程之间来回传递一个字节
+fn bench_pipe_round_trip() {
+    let to_peer = LockedPipeInode::new();
+    let from_peer = LockedPipeInode::new();
+    for pipe in [&to_peer, &from_peer] {
+        // 以只写方式打开会同时增加读者和写者的计数，读者不会因为没有写者而读到EOF
+        pipe.open(&mut FilePrivateData::default(), &FileMode::O_WRONLY)
+            .expect("kbench: failed to open pipe");
+    }
+
+    let (peer_rx, peer_tx) = (to_peer.clone(), from_peer.clone());
+    let peer = KernelThreadMechanism::create_and_run(
+        KernelThreadClosure::EmptyClosure((
+            Box::new(move || {
+                let mut byte = [0u8; 1];
+                loop {
+                    match peer_rx.read_bufs(&mut [&mut byte], false) {
+                        Ok(1) if byte[0] != PIPE_STOP_BYTE => {}
+                        _ => return 0,
+                    }
+                    if peer_tx.write_bufs(&[&byte], false).is_err() {
+                        return 0;
+                    }
+                }
+            }),
+            (),
+        )),
+        String::from("kbench_pipe"),
+    );
+    let peer = match peer {
+        Some(peer) => peer,
+        None => {
+            kwarn!("kbench: failed to create kbench_pipe");
+            return;
+        }
+    };
+
+    let mut byte = [0u8; 1];
+    Bench::new("pipe_round_trip").run(|| {
+        to_peer.write_bufs(&[&[1u8]], false).ok();
+        from_peer.read_bufs(&mut [&mut byte], false).ok();
+    });
+
+    to_peer.write_bufs(&[&[PIPE_STOP_BYTE]], false).ok();
+    wait_kthread_exit(&peer);
+}
+
+#[derive(Debug)]
+struct BenchTimerFunc;
+
+impl TimerFunction for BenchTimerFunc {
+    fn run(&mut self) -> Result<(), SystemError> {
+        return Ok(());
+    }
+}
+
+/// 插入一个很久之后才到期的定时器（插入后立即取消，取消不计入结果）
+fn bench_timer() {
+    Bench::new("timer_insert").run_measured(|| {
+        let timer = Timer::new(Box::new(BenchTimerFunc), next_n_ms_timer_jiffies(60 * 1000));
+        let start = bench_cycles();
+        timer.activate();
+        let cycles = bench_cycles() - start;
+        timer.cancel();
+        return cycles;
+    });
+}
+
+/// 创建一个立即退出的内核线程，并等待它退出
+///
+/// 内核线程的创建走的是与fork相同的路径（复制pcb、内核栈），
+/// 在这里用来衡量fork与进程退出的开销
+fn bench_kthread() {
+    Bench::new("kthread_create_exit")
+        .warmup(2)
+        .reps(50)
+        .run_measured(|| {
+            let start = bench_cycles();
+            let pcb = KernelThreadMechanism::create_and_run(
+                KernelThreadClosure::EmptyClosure((Box::new(|| 0), ())),
+                String::from("kbench_nop"),
+            );
+            if let Some(pcb) = pcb {
+                wait_kthread_exit(&pcb);
+            }
+            return bench_cycles() - start;
+        });
+}
+
+/// 忙等一个内核线程退出
+fn wait_kthread_exit(pcb: &Arc<ProcessControlBlock>) {
+    while !pcb.sched_info().state().is_exited() {
+        spin_loop();
+    }
+}
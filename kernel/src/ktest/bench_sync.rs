@@ -0,0 +1,76 @@
+//! 同步原语的基准测试：自旋锁、互斥锁（无竞争和多cpu竞争）
+
+use alloc::sync::Arc;
+use core::hint::black_box;
+
+use crate::{
+    driver::base::probe::ProbeGroup,
+    include::bindings::bindings::smp_get_total_cpu,
+    libs::{mutex::Mutex, spinlock::SpinLock},
+};
+
+use super::bench::{bench_cycles, Bench};
+
+/// 竞争测试中每个线程加锁的次数
+const CONTENDED_ITERS: usize = 10000;
+/// 竞争测试的最大线程数
+const CONTENDED_MAX_THREADS: usize = 8;
+
+pub fn bench_sync() {
+    let spinlock = SpinLock::new(0usize);
+    Bench::new("spinlock_uncontended").batch(256).run(|| {
+        *spinlock.lock() += 1;
+    });
+    Bench::new("spinlock_irqsave_uncontended")
+        .batch(256)
+        .run(|| {
+            *spinlock.lock_irqsave() += 1;
+        });
+
+    let mutex = Mutex::new(0usize);
+    Bench::new("mutex_uncontended").batch(256).run(|| {
+        *mutex.lock() += 1;
+    });
+    black_box((*spinlock.lock(), *mutex.lock()));
+
+    let nr_cpus = unsafe { smp_get_total_cpu() } as usize;
+    let threads = nr_cpus.clamp(2, CONTENDED_MAX_THREADS);
+
+    let spinlock = Arc::new(SpinLock::new(0usize));
+    Bench::new("spinlock_contended")
+        .arg(threads)
+        .warmup(1)
+        .reps(20)
+        .run_measured(|| {
+            contended(threads, &spinlock, |lock| {
+                *lock.lock() += 1;
+            })
+        });
+
+    let mutex = Arc::new(Mutex::new(0usize));
+    Bench::new("mutex_contended")
+        .arg(threads)
+        .warmup(1)
+        .reps(20)
+        .run_measured(|| {
+            contended(threads, &mutex, |lock| {
+                *lock.lock() += 1;
+            })
+        });
+}
+
+/// 在`threads`个线程中同时对`lock`执行`op`，返回平均每次操作的周期数
+fn contended<L: Send + Sync + 'static>(threads: usize, lock: &Arc<L>, op: fn(&L)) -> u64 {
+    let group = ProbeGroup::new();
+    let start = bench_cycles();
+    for _ in 0..threads {
+        let lock = lock.clone();
+        group.spawn(move || {
+            for _ in 0..CONTENDED_ITERS {
+                op(&lock);
+            }
+        });
+    }
+    group.wait();
+    return (bench_cycles() - start) / (threads * CONTENDED_ITERS) as u64;
+}
@@ -0,0 +1,24 @@
+//! 内核微基准测试
+//!
+//! 开启`kbench` feature之后，第一个内核线程在切换到用户态之前执行所有的基准测试，
+//! 结果的格式参见[`bench`]。
+
+use crate::{arch::driver::tsc::TSCManager, kinfo};
+
+mod bench;
+mod bench_fs;
+mod bench_mm;
+mod bench_sched;
+mod bench_sync;
+
+/// 执行所有的基准测试
+pub fn ktest_bench_run() {
+    kinfo!("kbench: start");
+    // 用于把周期数换算为时间
+    println!("KBENCH_INFO tsc_khz={}", TSCManager::tsc_khz());
+    bench_mm::bench_mm();
+    bench_sync::bench_sync();
+    bench_sched::bench_sched();
+    bench_fs::bench_fs();
+    kinfo!("kbench: done");
+}
@@ -40,14 +40,18 @@ mod arch;
 mod libs;
 #[macro_use]
 mod include;
+#[macro_use]
 mod debug;
 mod driver; // 如果driver依赖了libs，应该在libs后面导出
 mod exception;
 mod filesystem;
 mod init;
 mod ipc;
+#[cfg(feature = "kbench")]
+mod ktest;
 mod mm;
 mod net;
+mod perf;
 mod process;
 mod sched;
 mod smp;
@@ -75,6 +79,8 @@ extern crate x86;
 
 extern crate klog_types;
 
+use crate::debug::klog::kmsg::kmsg_panic_flush;
+use crate::driver::tty::serial::serial8250::serial8250_panic_flush;
 use crate::mm::allocator::kernel_allocator::KernelAllocator;
 
 use crate::process::ProcessManager;
@@ -95,6 +101,8 @@ pub static KERNEL_ALLOCATOR: KernelAllocator = KernelAllocator;
 #[panic_handler]
 #[no_mangle]
 pub fn panic(info: &PanicInfo) -> ! {
+    serial8250_panic_flush();
+    kmsg_panic_flush();
     kerror!("Kernel Panic Occurred.");
 
     match info.location() {
@@ -1,5 +1,5 @@
 use core::{
-    cmp::min,
+    cmp::{max, min},
     intrinsics::{likely, unlikely},
     ops::Range,
 };
@@ -8,10 +8,13 @@ use alloc::vec::Vec;
 use elf::{endian::AnyEndian, file::FileHeader, segment::ProgramHeader};
 
 use crate::{
-    arch::MMArch,
+    arch::{vdso::map_vdso, MMArch},
     driver::base::block::SeekFrom,
+    filesystem::vfs::{
+        file::{File, FileMode},
+        MAX_PATHLEN, ROOT_INODE,
+    },
     kerror,
-    libs::align::page_align_up,
     mm::{
         allocator::page_frame::{PageFrameCount, VirtPageFrame},
         syscall::{MapFlags, ProtFlags},
@@ -43,6 +46,11 @@ impl ElfLoader {
     /// 读取文件的缓冲区大小
     pub const FILE_READ_BUF_SIZE: usize = 512 * 1024;
 
+    /// 有解释器的位置无关可执行文件的加载地址（与Linux相同，约为用户地址空间的2/3处），
+    /// 解释器自身由mmap选择地址
+    #[cfg(target_arch = "x86_64")]
+    pub const ELF_ET_DYN_BASE: usize = 0x5555_5555_4000;
+
     pub const fn new() -> Self {
         Self
     }
@@ -65,8 +73,9 @@ impl ElfLoader {
 
         // 判断是否以可执行文件的形式加载
         if param.load_mode() == ExecLoadMode::Exec {
-            // 检查文件类型是否为可执行文件
-            if ElfType::from(ehdr.e_type) != ElfType::Executable {
+            // 检查文件类型是否为可执行文件（包括位置无关的可执行文件）
+            let elf_type = ElfType::from(ehdr.e_type);
+            if elf_type != ElfType::Executable && elf_type != ElfType::DSO {
                 return Err(ExecError::NotExecutable);
             }
         } else {
@@ -99,7 +108,7 @@ impl ElfLoader {
                 start,
                 end - start,
                 prot_flags,
-                MapFlags::MAP_ANONYMOUS | MapFlags::MAP_FIXED_NOREPLACE,
+                MapFlags::MAP_ANONYMOUS | MapFlags::MAP_FIXED_NOREPLACE | MapFlags::MAP_POPULATE,
                 false,
             );
             if r.is_err() {
@@ -151,7 +160,7 @@ impl ElfLoader {
     /// ## 参数
     ///
     /// - `user_vm_guard`：用户空间地址空间
-    /// - `param`：执行参数
+    /// - `file`：要加载的ELF文件（可执行文件或者它的解释器）
     /// - `phent`：ELF文件的ProgramHeader
     /// - `addr_to_map`：当前段应该被加载到的内存地址
     /// - `prot`：保护标志
@@ -164,7 +173,7 @@ impl ElfLoader {
     fn load_elf_segment(
         &self,
         user_vm_guard: &mut RwLockWriteGuard<'_, InnerAddressSpace>,
-        param: &mut ExecParam,
+        file: &mut File,
         phent: &ProgramHeader,
         mut addr_to_map: VirtAddr,
         prot: &ProtFlags,
@@ -200,13 +209,6 @@ impl ElfLoader {
             }
             err
         };
-        // 由于后面需要把ELF文件的内容加载到内存，因此暂时把当前段的权限设置为可写
-        let tmp_prot = if !prot.contains(ProtFlags::PROT_WRITE) {
-            *prot | ProtFlags::PROT_WRITE
-        } else {
-            *prot
-        };
-
         // 映射到的虚拟地址。请注意，这个虚拟地址是user_vm_guard这个地址空间的虚拟地址。不一定是当前进程地址空间的
         let map_addr: VirtAddr;
 
@@ -214,71 +216,154 @@ impl ElfLoader {
         // The _first_ mmap needs to know the full size, otherwise
         // randomization might put this image into an overlapping
         // position with the ELF binary image. (since size < total_size)
-        // So we first map the 'big' image - and unmap the remainder at
-        // the end. (which unmap is needed for ELF images with holes.)
+        // So we first reserve the 'big' image, and then map the segment
+        // at the start of it. (the remainder is left for the other segments)
         if total_size != 0 {
             let total_size = self.elf_page_align_up(VirtAddr::new(total_size)).data();
 
             // kdebug!("total_size={}", total_size);
 
-            map_addr = user_vm_guard
-                .map_anonymous(addr_to_map, total_size, tmp_prot, *map_flags, false)
+            let reserved = user_vm_guard
+                .map_anonymous(addr_to_map, total_size, *prot, *map_flags, false)
                 .map_err(map_err_handler)?
                 .virt_address();
-            // kdebug!("map ok: addr_to_map={:?}", addr_to_map);
-
-            let to_unmap = map_addr + map_size;
-            let to_unmap_size = total_size - map_size;
-
-            // kdebug!("to_unmap={:?}, to_unmap_size={}", to_unmap, to_unmap_size);
             user_vm_guard.munmap(
-                VirtPageFrame::new(to_unmap),
-                PageFrameCount::from_bytes(to_unmap_size).unwrap(),
+                VirtPageFrame::new(reserved),
+                PageFrameCount::from_bytes(total_size).unwrap(),
             )?;
 
-            // 加载文件到内存
-            self.do_load_file(
-                map_addr + beginning_page_offset,
+            map_addr = self.map_segment(
+                user_vm_guard,
+                file,
+                reserved,
+                map_size,
+                beginning_page_offset,
                 seg_in_file_size,
                 file_offset,
-                param,
+                prot,
+                &(*map_flags | MapFlags::MAP_FIXED_NOREPLACE),
             )?;
-            if tmp_prot != *prot {
-                user_vm_guard.mprotect(
-                    VirtPageFrame::new(map_addr),
-                    PageFrameCount::from_bytes(page_align_up(map_size)).unwrap(),
-                    *prot,
-                )?;
-            }
         } else {
             // kdebug!("total size = 0");
+            map_addr = self
+                .map_segment(
+                    user_vm_guard,
+                    file,
+                    addr_to_map,
+                    map_size,
+                    beginning_page_offset,
+                    seg_in_file_size,
+                    file_offset,
+                    prot,
+                    map_flags,
+                )
+                .map_err(map_err_handler)?;
+        }
+        // kdebug!("load_elf_segment OK: map_addr={:?}", map_addr);
+        return Ok((map_addr, true));
+    }
+
+    /// 把一个段映射到从`addr`（已经对齐到页）开始的`map_size`字节
+    ///
+    /// 完全由文件内容组成的页，以私有的方式映射文件的页面缓存，在第一次被访问时才读入并映射，被写入时才复制。
+    /// 段的最后一页如果只有一部分是文件内容（后面是bss），则映射匿名页，再把文件内容复制进去。
+    /// 文件不支持页面缓存时，整个段都映射为匿名页
+    ///
+    /// ## 参数
+    ///
+    /// - `beginning_page_offset`：段在第一页内的偏移量
+    /// - `seg_in_file_size`：段在文件中的大小
+    /// - `file_offset`：段在文件中的偏移量
+    ///
+    /// ## 返回值
+    ///
+    /// 返回映射的起始地址
+    #[allow(clippy::too_many_arguments)]
+    fn map_segment(
+        &self,
+        user_vm_guard: &mut RwLockWriteGuard<'_, InnerAddressSpace>,
+        file: &mut File,
+        addr: VirtAddr,
+        map_size: usize,
+        beginning_page_offset: usize,
+        seg_in_file_size: usize,
+        file_offset: usize,
+        prot: &ProtFlags,
+        map_flags: &MapFlags,
+    ) -> Result<VirtAddr, SystemError> {
+        if (file.metadata()?.size as usize) < file_offset + seg_in_file_size {
+            return Err(SystemError::ENOEXEC);
+        }
+
+        // 段在文件中的偏移量与它在页内的偏移量一致时，才能直接映射文件
+        let cache = file.inode().page_cache().filter(|_| {
+            file_offset >= beginning_page_offset
+                && self.elf_page_offset(VirtAddr::new(file_offset - beginning_page_offset)) == 0
+        });
+        // 从addr开始，完全由文件内容组成的页的大小
+        let file_map_size = match cache {
+            Some(_) => self
+                .elf_page_start(VirtAddr::new(beginning_page_offset + seg_in_file_size))
+                .data(),
+            None => 0,
+        };
 
+        let mut map_addr = addr;
+        // 文件映射的部分在加载期间不会被访问，留给缺页异常按需读入。
+        // 匿名的部分需要在持有地址空间的锁时复制文件内容（无法处理缺页异常），因此要立即建立映射
+        let mut tail_flags = *map_flags | MapFlags::MAP_POPULATE;
+        if file_map_size > 0 {
             map_addr = user_vm_guard
-                .map_anonymous(addr_to_map, map_size, tmp_prot, *map_flags, false)?
+                .map_file(
+                    addr,
+                    file_map_size,
+                    *prot,
+                    *map_flags,
+                    cache.unwrap(),
+                    file_offset - beginning_page_offset,
+                    false,
+                    false,
+                )?
                 .virt_address();
-            // kdebug!(
-            //     "map ok: addr_to_map={:?}, map_addr={map_addr:?},beginning_page_offset={beginning_page_offset:?}",
-            //     addr_to_map
-            // );
-
-            // 加载文件到内存
-            self.do_load_file(
-                map_addr + beginning_page_offset,
-                seg_in_file_size,
-                file_offset,
-                param,
-            )?;
+            // 剩余的部分必须紧跟在文件映射之后
+            tail_flags.insert(MapFlags::MAP_FIXED_NOREPLACE);
+        }
+        if file_map_size == map_size {
+            return Ok(map_addr);
+        }
 
-            if tmp_prot != *prot {
-                user_vm_guard.mprotect(
-                    VirtPageFrame::new(map_addr),
-                    PageFrameCount::from_bytes(page_align_up(map_size)).unwrap(),
-                    *prot,
-                )?;
-            }
+        // 由于后面需要把ELF文件的内容复制到内存，因此暂时把剩余部分的权限设置为可写
+        let tmp_prot = *prot | ProtFlags::PROT_WRITE;
+        let tail_size = map_size - file_map_size;
+        let tail_addr = user_vm_guard
+            .map_anonymous(
+                map_addr + file_map_size,
+                tail_size,
+                tmp_prot,
+                tail_flags,
+                false,
+            )?
+            .virt_address();
+        if file_map_size == 0 {
+            map_addr = tail_addr;
         }
-        // kdebug!("load_elf_segment OK: map_addr={:?}", map_addr);
-        return Ok((map_addr, true));
+
+        // 复制剩余部分中的文件内容
+        let load_start = max(beginning_page_offset, file_map_size);
+        self.do_load_file(
+            map_addr + load_start,
+            beginning_page_offset + seg_in_file_size - load_start,
+            file_offset + load_start - beginning_page_offset,
+            file,
+        )?;
+        if tmp_prot != *prot {
+            user_vm_guard.mprotect(
+                VirtPageFrame::new(tail_addr),
+                PageFrameCount::from_bytes(tail_size).unwrap(),
+                *prot,
+            )?;
+        }
+        return Ok(map_addr);
     }
 
     /// 加载ELF文件到用户空间
@@ -288,15 +373,14 @@ impl ElfLoader {
     /// - `vaddr`：要加载到的虚拟地址
     /// - `size`：要加载的大小
     /// - `offset_in_file`：在文件内的偏移量
-    /// - `param`：执行参数
+    /// - `file`：要加载的ELF文件
     fn do_load_file(
         &self,
         mut vaddr: VirtAddr,
         size: usize,
         offset_in_file: usize,
-        param: &mut ExecParam,
+        file: &mut File,
     ) -> Result<(), SystemError> {
-        let file = param.file_mut();
         if (file.metadata()?.size as usize) < offset_in_file + size {
             return Err(SystemError::ENOEXEC);
         }
@@ -331,6 +415,153 @@ impl ElfLoader {
         return Ok(());
     }
 
+    /// 所有PT_LOAD段占用的虚拟地址范围的大小（从第一个段所在的页开始）
+    fn total_mapping_size(&self, phdrs: &[ProgramHeader]) -> usize {
+        let mut loads = phdrs.iter().filter(|p| p.p_type == elf::abi::PT_LOAD);
+        let first = match loads.next() {
+            Some(first) => first,
+            None => return 0,
+        };
+        let last = loads.last().unwrap_or(first);
+        let start = self.elf_page_start(VirtAddr::new(first.p_vaddr as usize));
+        return ((last.p_vaddr + last.p_memsz) as usize).saturating_sub(start.data());
+    }
+
+    /// 打开PT_INTERP段指定的解释器（动态链接器），并读取它的文件头
+    ///
+    /// ## 参数
+    ///
+    /// - `file`：可执行文件
+    /// - `interp`：可执行文件的PT_INTERP段
+    fn open_interp(
+        &self,
+        file: &mut File,
+        interp: &ProgramHeader,
+    ) -> Result<(File, FileHeader<AnyEndian>), ExecError> {
+        // 段的内容是以'\0'结尾的解释器路径
+        let size = interp.p_filesz as usize;
+        if size < 2 || size > MAX_PATHLEN {
+            return Err(ExecError::NotExecutable);
+        }
+        let mut path = vec![0u8; size];
+        file.lseek(SeekFrom::SeekSet(interp.p_offset as i64))
+            .map_err(|_| ExecError::NotExecutable)?;
+        if file
+            .read(size, &mut path)
+            .map_err(|_| ExecError::NotExecutable)?
+            != size
+            || path[size - 1] != 0
+        {
+            return Err(ExecError::NotExecutable);
+        }
+        let path = core::str::from_utf8(&path[..size - 1]).map_err(|_| ExecError::NotExecutable)?;
+
+        let inode = ROOT_INODE()
+            .lookup(path)
+            .map_err(|e| ExecError::Other(format!("interpreter {}: {:?}", path, e)))?;
+        let mut interp_file =
+            File::new(inode, FileMode::O_RDONLY).map_err(|_| ExecError::PermissionDenied)?;
+        let mut head_buf = [0u8; 512];
+        interp_file
+            .read(head_buf.len(), &mut head_buf)
+            .map_err(|_| ExecError::NotExecutable)?;
+        let ehdr = Self::parse_ehdr(&head_buf).map_err(|_| ExecError::NotExecutable)?;
+
+        #[cfg(target_arch = "x86_64")]
+        if ehdr.class != elf::file::Class::ELF64
+            || ElfMachine::from(ehdr.e_machine) != ElfMachine::X86_64
+        {
+            return Err(ExecError::WrongArchitecture);
+        }
+        let elf_type = ElfType::from(ehdr.e_type);
+        if elf_type != ElfType::Executable && elf_type != ElfType::DSO {
+            return Err(ExecError::NotExecutable);
+        }
+        return Ok((interp_file, ehdr));
+    }
+
+    /// 加载解释器（动态链接器）到用户空间
+    ///
+    /// 参考Linux的load_elf_interp函数。解释器的段与可执行文件的段一样，从页面缓存映射，
+    /// 因此所有进程共享同一份动态链接器的代码（动态链接器再用mmap从页面缓存映射共享库）
+    ///
+    /// ## 返回值
+    ///
+    /// 返回(解释器的加载偏移量, 解释器的入口地址)
+    fn load_elf_interp(
+        &self,
+        user_vm_guard: &mut RwLockWriteGuard<'_, InnerAddressSpace>,
+        file: &mut File,
+        ehdr: &FileHeader<AnyEndian>,
+        phdrs: &[ProgramHeader],
+    ) -> Result<(VirtAddr, VirtAddr), SystemError> {
+        let elf_type = ElfType::from(ehdr.e_type);
+        // 第一个段映射时预留整个解释器的地址范围，其余的段固定在它之后
+        let mut total_size = self.total_mapping_size(phdrs);
+        if total_size == 0 {
+            return Err(SystemError::ENOEXEC);
+        }
+
+        let mut load_addr = 0usize;
+        let mut first = true;
+        let mut elf_bss = 0usize;
+        let mut last_bss = 0usize;
+        let mut bss_prot = ProtFlags::empty();
+        for phdr in phdrs.iter().filter(|p| p.p_type == elf::abi::PT_LOAD) {
+            let vaddr = phdr.p_vaddr as usize;
+            let prot = self.make_prot(phdr.p_flags, true, true);
+            let mut map_flags = MapFlags::MAP_PRIVATE;
+            if !first || elf_type == ElfType::Executable {
+                map_flags.insert(MapFlags::MAP_FIXED_NOREPLACE);
+            }
+
+            let (map_addr, _) = self.load_elf_segment(
+                user_vm_guard,
+                file,
+                phdr,
+                VirtAddr::new(load_addr + vaddr),
+                &prot,
+                &map_flags,
+                total_size,
+            )?;
+            total_size = 0;
+            if first && elf_type == ElfType::DSO {
+                load_addr = map_addr.data() - self.elf_page_start(VirtAddr::new(vaddr)).data();
+            }
+            first = false;
+
+            let start = load_addr + vaddr;
+            if !VirtAddr::new(start).check_user()
+                || phdr.p_filesz > phdr.p_memsz
+                || phdr.p_memsz > MMArch::USER_END_VADDR.data() as u64
+            {
+                return Err(SystemError::EINVAL);
+            }
+            elf_bss = max(elf_bss, start + phdr.p_filesz as usize);
+            if start + phdr.p_memsz as usize > last_bss {
+                last_bss = start + phdr.p_memsz as usize;
+                bss_prot = prot;
+            }
+        }
+
+        // 段的最后一页中文件内容之后的部分在映射匿名页时已经是0，这里只需要映射剩余的bss
+        let bss_start = self.elf_page_align_up(VirtAddr::new(elf_bss));
+        let bss_end = self.elf_page_align_up(VirtAddr::new(last_bss));
+        if bss_end > bss_start {
+            user_vm_guard.map_anonymous(
+                bss_start,
+                bss_end - bss_start,
+                bss_prot,
+                MapFlags::MAP_PRIVATE | MapFlags::MAP_ANONYMOUS | MapFlags::MAP_FIXED_NOREPLACE,
+                false,
+            )?;
+        }
+        return Ok((
+            VirtAddr::new(load_addr),
+            VirtAddr::new(load_addr + ehdr.e_entry as usize),
+        ));
+    }
+
     /// 创建auxv
     ///
     /// ## 参数
@@ -339,16 +570,24 @@ impl ElfLoader {
     /// - `entrypoint_vaddr`：程序入口地址
     /// - `phdr_vaddr`：程序头表地址
     /// - `elf_header`：ELF文件头
+    /// - `vdso_base`：vDSO镜像的地址
+    /// - `interp_base`：解释器的加载地址，没有解释器时为None
     fn create_auxv(
         &self,
         param: &mut ExecParam,
         entrypoint_vaddr: VirtAddr,
         phdr_vaddr: Option<VirtAddr>,
         ehdr: &elf::file::FileHeader<AnyEndian>,
+        vdso_base: Option<VirtAddr>,
+        interp_base: Option<VirtAddr>,
     ) -> Result<(), ExecError> {
         let phdr_vaddr = phdr_vaddr.unwrap_or(VirtAddr::new(0));
 
         let init_info = param.init_info_mut();
+        init_info.auxv.insert(
+            AtType::Base as u8,
+            interp_base.unwrap_or(VirtAddr::new(0)).data(),
+        );
         init_info
             .auxv
             .insert(AtType::PhEnt as u8, ehdr.e_phentsize as usize);
@@ -362,6 +601,11 @@ impl ElfLoader {
         init_info
             .auxv
             .insert(AtType::Entry as u8, entrypoint_vaddr.data());
+        if let Some(vdso_base) = vdso_base {
+            init_info
+                .auxv
+                .insert(AtType::SysInfoEhdr as u8, vdso_base.data());
+        }
 
         return Ok(());
     }
@@ -386,7 +630,7 @@ impl ElfLoader {
     ///
     /// ## 参数
     ///
-    /// - `param`：执行参数
+    /// - `file`：ELF文件
     /// - `ehdr`：文件头
     /// - `data_buf`：用于缓存SegmentTable的Vec。
     ///     这是因为SegmentTable的生命周期与data_buf一致。初始化这个Vec的大小为0即可。
@@ -395,7 +639,7 @@ impl ElfLoader {
     ///
     /// 这个函数由elf库的`elf::elf_bytes::find_phdrs`修改而来。
     fn parse_segments<'a>(
-        param: &mut ExecParam,
+        file: &mut File,
         ehdr: &FileHeader<AnyEndian>,
         data_buf: &'a mut Vec<u8>,
     ) -> Result<Option<elf::segment::SegmentTable<'a, AnyEndian>>, elf::ParseError> {
@@ -403,7 +647,6 @@ impl ElfLoader {
         if ehdr.e_phoff == 0 {
             return Ok(None);
         }
-        let file = param.file_mut();
         // If the number of segments is greater than or equal to PN_XNUM (0xffff),
         // e_phnum is set to PN_XNUM, and the actual number of program header table
         // entries is contained in the sh_info field of the section header at index 0.
@@ -494,16 +737,22 @@ impl BinaryLoader for ElfLoader {
 
         // todo: 增加对user stack上的内存是否具有可执行权限的处理（方法：寻找phdr里面的PT_GNU_STACK段）
 
-        // todo: 增加对动态链接的处理
-
         // kdebug!("to parse segments");
         // 加载ELF文件并映射到用户空间
         let mut phdr_buf = Vec::new();
-        let loadable_sections = Self::parse_segments(param, &ehdr, &mut phdr_buf)
-            .map_err(|_| ExecError::ParseError)?
-            .ok_or(ExecError::ParseError)?
-            .iter()
-            .filter(|seg| seg.p_type == elf::abi::PT_LOAD);
+        let phdrs: Vec<ProgramHeader> =
+            Self::parse_segments(param.file_mut(), &ehdr, &mut phdr_buf)
+                .map_err(|_| ExecError::ParseError)?
+                .ok_or(ExecError::ParseError)?
+                .iter()
+                .collect();
+        let loadable_sections = phdrs.iter().filter(|seg| seg.p_type == elf::abi::PT_LOAD);
+
+        // 动态链接的程序由PT_INTERP段指定解释器（动态链接器）
+        let mut interpreter = match phdrs.iter().find(|seg| seg.p_type == elf::abi::PT_INTERP) {
+            Some(interp) => Some(self.open_interp(param.file_mut(), interp)?),
+            None => None,
+        };
 
         // kdebug!("loadable_sections = {:?}", loadable_sections);
 
@@ -514,9 +763,10 @@ impl BinaryLoader for ElfLoader {
         let mut start_data: Option<VirtAddr> = None;
         let mut end_data: Option<VirtAddr> = None;
 
-        // 加载的时候的偏移量（这个偏移量在加载动态链接段的时候产生，由于还没有动态链接，因此暂时不可变。）
-        // 请不要删除load_bias! 以免到时候写动态链接的时候忘记了。
-        let load_bias = 0usize;
+        // 加载的时候的偏移量（只有位置无关的可执行文件不为0）
+        let mut load_bias = 0usize;
+        // 第一个段映射时需要预留的整个映像的大小（只有位置无关的可执行文件需要）
+        let mut total_size = 0usize;
         let mut bss_prot_flags = ProtFlags::empty();
         // 是否是第一个加载的段
         let mut first_pt_load = true;
@@ -548,8 +798,7 @@ impl BinaryLoader for ElfLoader {
             }
 
             // 生成ProtFlags.
-            // TODO: 当有了动态链接之后，需要根据情况设置这里的has_interpreter
-            let elf_prot_flags = self.make_prot(seg_to_load.p_flags, false, false);
+            let elf_prot_flags = self.make_prot(seg_to_load.p_flags, interpreter.is_some(), false);
 
             let mut elf_map_flags = MapFlags::MAP_PRIVATE;
 
@@ -565,22 +814,33 @@ impl BinaryLoader for ElfLoader {
                  */
                 elf_map_flags.insert(MapFlags::MAP_FIXED_NOREPLACE);
             } else if elf_type == ElfType::DSO {
-                // TODO: 支持动态链接
-                unimplemented!("DragonOS currently does not support dynamic linking!");
+                // 位置无关的可执行文件：有解释器时固定加载到ELF_ET_DYN_BASE，
+                // 否则（静态链接的PIE）由mmap选择地址
+                if interpreter.is_some() {
+                    load_bias = self
+                        .elf_page_start(VirtAddr::new(
+                            Self::ELF_ET_DYN_BASE.wrapping_sub(vaddr.data()),
+                        ))
+                        .data();
+                    elf_map_flags.insert(MapFlags::MAP_FIXED_NOREPLACE);
+                }
+                total_size = self.total_mapping_size(&phdrs);
+                if total_size == 0 {
+                    return Err(ExecError::InvalidParemeter);
+                }
             }
 
             // 加载这个段到用户空间
-            // todo: 引入动态链接后，这里的total_size要按照实际的填写，而不一定是0
 
             let e = self
                 .load_elf_segment(
                     &mut user_vm,
-                    param,
-                    &seg_to_load,
+                    param.file_mut(),
+                    seg_to_load,
                     vaddr + load_bias,
                     &elf_prot_flags,
                     &elf_map_flags,
-                    0,
+                    total_size,
                 )
                 .map_err(|e| match e {
                     SystemError::EFAULT => ExecError::BadAddress(None),
@@ -593,11 +853,15 @@ impl BinaryLoader for ElfLoader {
                 return Err(ExecError::BadAddress(Some(e.0)));
             }
 
+            total_size = 0;
             if first_pt_load {
                 first_pt_load = false;
                 if elf_type == ElfType::DSO {
-                    // todo: 在这里增加对load_bias和reloc_func_desc的更新代码
-                    todo!()
+                    // mmap选择的地址可能与期望的不同，以实际映射的地址为准
+                    load_bias += e.0.data()
+                        - self
+                            .elf_page_start(VirtAddr::new(load_bias) + vaddr.data())
+                            .data();
                 }
             }
 
@@ -696,10 +960,43 @@ impl BinaryLoader for ElfLoader {
             // kdebug!("elf_bss = {elf_bss:?}, elf_brk = {elf_brk:?}");
             return Err(ExecError::BadAddress(Some(elf_bss)));
         }
-        // todo: 动态链接：增加加载interpreter的代码
+
+        // 加载解释器，程序从解释器的入口开始执行，由它完成动态链接之后再跳转到程序的入口
+        let mut entrypoint = program_entrypoint;
+        let mut interp_base = None;
+        if let Some((interp_file, interp_ehdr)) = interpreter.as_mut() {
+            let mut interp_phdr_buf = Vec::new();
+            let interp_phdrs: Vec<ProgramHeader> =
+                Self::parse_segments(interp_file, interp_ehdr, &mut interp_phdr_buf)
+                    .map_err(|_| ExecError::ParseError)?
+                    .ok_or(ExecError::ParseError)?
+                    .iter()
+                    .collect();
+            let (base, entry) = self
+                .load_elf_interp(&mut user_vm, interp_file, interp_ehdr, &interp_phdrs)
+                .map_err(|e| match e {
+                    SystemError::EFAULT => ExecError::BadAddress(None),
+                    SystemError::ENOMEM => ExecError::OutOfMemory,
+                    _ => ExecError::Other(format!("load_elf_interp failed: {:?}", e)),
+                })?;
+            interp_base = Some(base);
+            entrypoint = entry;
+        }
+
+        let vdso_base = map_vdso(&mut user_vm).map_err(|e| match e {
+            SystemError::ENOMEM => ExecError::OutOfMemory,
+            _ => ExecError::Other(format!("map_vdso failed: {:?}", e)),
+        })?;
         // kdebug!("to create auxv");
 
-        self.create_auxv(param, program_entrypoint, phdr_vaddr, &ehdr)?;
+        self.create_auxv(
+            param,
+            program_entrypoint,
+            phdr_vaddr,
+            &ehdr,
+            vdso_base,
+            interp_base,
+        )?;
 
         // kdebug!("auxv create ok");
         user_vm.start_code = start_code.unwrap_or(VirtAddr::new(0));
@@ -707,7 +1004,7 @@ impl BinaryLoader for ElfLoader {
         user_vm.start_data = start_data.unwrap_or(VirtAddr::new(0));
         user_vm.end_data = end_data.unwrap_or(VirtAddr::new(0));
 
-        let result = BinaryLoaderResult::new(program_entrypoint);
+        let result = BinaryLoaderResult::new(entrypoint);
         // kdebug!("elf load OK!!!");
         return Ok(result);
     }
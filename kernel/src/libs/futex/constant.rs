@@ -52,3 +52,10 @@ pub const FUTEX_OWNER_DIED: u32 = 0x40000000;
 #[allow(dead_code)]
 pub const FUTEX_TID_MASK: u32 = 0x3fffffff;
 pub const FUTEX_BITSET_MATCH_ANY: u32 = 0xffffffff;
+
+/// futex_waitv一次最多等待的futex的数量
+pub const FUTEX_WAITV_MAX: u32 = 128;
+/// futex_waitv：futex变量的大小为32位（目前只支持这一种）
+pub const FUTEX2_SIZE_U32: u32 = 0x02;
+/// futex_waitv：进程私有的futex
+pub const FUTEX2_PRIVATE: u32 = FutexFlag::FUTEX_PRIVATE_FLAG.bits();
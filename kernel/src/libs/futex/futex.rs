@@ -1,47 +1,108 @@
 use alloc::{
     collections::LinkedList,
     sync::{Arc, Weak},
+    vec::Vec,
 };
 use core::hash::{Hash, Hasher};
-use core::{intrinsics::likely, sync::atomic::AtomicU64};
-use hashbrown::HashMap;
+use core::{
+    intrinsics::likely,
+    sync::atomic::{AtomicU32, AtomicU64, Ordering},
+};
 
 use crate::{
     arch::{sched::sched, CurrentIrqArch, MMArch},
     exception::InterruptArch,
     libs::spinlock::{SpinLock, SpinLockGuard},
     mm::{ucontext::AddressSpace, MemoryManagementArch, VirtAddr},
-    process::{ProcessControlBlock, ProcessManager},
+    process::{Pid, ProcessControlBlock, ProcessFlags, ProcessManager, ProcessState},
+    sched::{sched_pi_rank, SchedPolicy, SchedPriority},
     syscall::{user_access::UserBufferReader, SystemError},
     time::{
-        timer::{next_n_us_timer_jiffies, Timer, WakeUpHelper},
+        timer::{apply_timer_slack, next_n_us_timer_jiffies, Timer, WakeUpHelper},
         TimeSpec,
     },
 };
 
 use super::constant::*;
 
-static mut FUTEX_DATA: Option<FutexData> = None;
+/// futex哈希表的桶的数量
+const FUTEX_HASH_SIZE: usize = 256;
+
+/// futex哈希表
+///
+/// 哈希表的大小是固定的，每个桶有自己的锁，不同的futex落在不同的桶中时不会互相竞争。
+/// 不同的futex可能落在同一个桶中，因此桶里的每个等待者都记录了自己等待的futex的key
+static FUTEX_DATA: [FutexHashSlot; FUTEX_HASH_SIZE] =
+    [const { FutexHashSlot::new() }; FUTEX_HASH_SIZE];
 
-pub struct FutexData {
-    data: SpinLock<HashMap<FutexKey, FutexHashBucket>>,
+/// 按照缓存行对齐的桶，避免相邻的桶的锁发生伪共享
+#[repr(align(64))]
+struct FutexHashSlot {
+    bucket: SpinLock<FutexHashBucket>,
 }
 
-impl FutexData {
-    pub fn futex_map() -> SpinLockGuard<'static, HashMap<FutexKey, FutexHashBucket>> {
-        unsafe { FUTEX_DATA.as_ref().unwrap().data.lock() }
+impl FutexHashSlot {
+    const fn new() -> Self {
+        return Self {
+            bucket: SpinLock::new(FutexHashBucket {
+                chain: LinkedList::new(),
+                pi_chain: LinkedList::new(),
+            }),
+        };
     }
+}
 
-    pub fn try_remove(key: &FutexKey) -> Option<FutexHashBucket> {
-        unsafe {
-            let mut guard = FUTEX_DATA.as_ref().unwrap().data.lock();
-            if let Some(futex) = guard.get(key) {
-                if futex.chain.is_empty() {
-                    return guard.remove(key);
+pub struct FutexData;
+
+impl FutexData {
+    /// 获取key所在的桶的下标
+    fn bucket_index(key: &FutexKey) -> usize {
+        // FNV-1a
+        struct FnvHasher(u64);
+        impl Hasher for FnvHasher {
+            fn finish(&self) -> u64 {
+                return self.0;
+            }
+
+            fn write(&mut self, bytes: &[u8]) {
+                for b in bytes {
+                    self.0 = (self.0 ^ (*b as u64)).wrapping_mul(0x100000001b3);
                 }
             }
         }
-        None
+        let mut hasher = FnvHasher(0xcbf29ce484222325);
+        key.hash(&mut hasher);
+        return hasher.finish() as usize % FUTEX_HASH_SIZE;
+    }
+
+    /// 锁住key所在的桶
+    pub fn lock_bucket(key: &FutexKey) -> SpinLockGuard<'static, FutexHashBucket> {
+        return FUTEX_DATA[Self::bucket_index(key)].bucket.lock();
+    }
+
+    /// 锁住key1和key2所在的桶。两个key落在同一个桶中时，只返回一个守卫
+    ///
+    /// 按照桶的下标从小到大加锁，避免两个进程以相反的顺序加锁时死锁
+    pub fn lock_two_buckets(
+        key1: &FutexKey,
+        key2: &FutexKey,
+    ) -> (
+        SpinLockGuard<'static, FutexHashBucket>,
+        Option<SpinLockGuard<'static, FutexHashBucket>>,
+    ) {
+        let idx1 = Self::bucket_index(key1);
+        let idx2 = Self::bucket_index(key2);
+        if idx1 == idx2 {
+            return (FUTEX_DATA[idx1].bucket.lock(), None);
+        }
+        if idx1 < idx2 {
+            let guard1 = FUTEX_DATA[idx1].bucket.lock();
+            let guard2 = FUTEX_DATA[idx2].bucket.lock();
+            return (guard1, Some(guard2));
+        }
+        let guard2 = FUTEX_DATA[idx2].bucket.lock();
+        let guard1 = FUTEX_DATA[idx1].bucket.lock();
+        return (guard1, Some(guard2));
     }
 }
 
@@ -51,6 +112,8 @@ pub struct Futex;
 pub struct FutexHashBucket {
     // 该futex维护的等待队列
     chain: LinkedList<Arc<FutexObj>>,
+    // 等待PI futex的进程
+    pi_chain: LinkedList<Arc<FutexPiWaiter>>,
 }
 
 impl FutexHashBucket {
@@ -126,6 +189,21 @@ impl FutexHashBucket {
     pub fn remove(&mut self, futex: Arc<FutexObj>) {
         self.chain.drain_filter(|x| Arc::ptr_eq(x, &futex));
     }
+
+    /// 按照排队的顺序，取出最多nr个等待key的FutexObj
+    pub fn take(&mut self, key: &FutexKey, nr: usize) -> Vec<Arc<FutexObj>> {
+        let mut count = 0;
+        return self
+            .chain
+            .drain_filter(|x| {
+                if count < nr && x.key == *key {
+                    count += 1;
+                    return true;
+                }
+                return false;
+            })
+            .collect();
+    }
 }
 
 #[derive(Debug)]
@@ -133,7 +211,50 @@ pub struct FutexObj {
     pcb: Weak<ProcessControlBlock>,
     key: FutexKey,
     bitset: u32,
-    // TODO: 优先级继承
+}
+
+/// futex_waitv的参数中的一项（与Linux的`struct futex_waitv`一致）
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct FutexWaitv {
+    /// 期望的值
+    pub val: u64,
+    /// futex变量的用户空间地址
+    pub uaddr: u64,
+    /// FUTEX2_SIZE_U32，以及可选的FUTEX2_PRIVATE
+    pub flags: u32,
+    pub __reserved: u32,
+}
+
+/// 等待PI futex的进程
+#[derive(Debug)]
+pub struct FutexPiWaiter {
+    pcb: Weak<ProcessControlBlock>,
+    pid: Pid,
+    key: FutexKey,
+    /// 开始等待时的调度策略和优先级。解锁时，锁被交给优先级最高的等待者
+    policy: SchedPolicy,
+    priority: SchedPriority,
+}
+
+impl FutexHashBucket {
+    /// 等待key的、优先级最高的PI等待者（优先级相同时，先到先得）
+    fn pi_top_waiter(&self, key: &FutexKey) -> Option<Arc<FutexPiWaiter>> {
+        return self
+            .pi_chain
+            .iter()
+            .filter(|w| w.key == *key)
+            .min_by_key(|w| sched_pi_rank(w.policy, w.priority))
+            .cloned();
+    }
+
+    fn pi_remove(&mut self, waiter: &Arc<FutexPiWaiter>) -> bool {
+        return self
+            .pi_chain
+            .drain_filter(|x| Arc::ptr_eq(x, waiter))
+            .count()
+            != 0;
+    }
 }
 
 pub enum FutexAccess {
@@ -174,7 +295,7 @@ pub struct PrivateKey {
 }
 
 impl Hash for PrivateKey {
-    fn hash<H: ~const Hasher>(&self, state: &mut H) {
+    fn hash<H: [const] Hasher>(&self, state: &mut H) {
         self.address.hash(state);
     }
 }
@@ -198,13 +319,9 @@ impl PartialEq for PrivateKey {
 
 impl Futex {
     /// ### 初始化FUTEX_DATA
-    pub fn init() {
-        unsafe {
-            FUTEX_DATA = Some(FutexData {
-                data: SpinLock::new(HashMap::new()),
-            })
-        };
-    }
+    ///
+    /// 哈希表是静态分配的，不需要初始化
+    pub fn init() {}
 
     /// ### 让当前进程在指定futex上等待直到futex_wake显式唤醒
     pub fn futex_wait(
@@ -225,18 +342,7 @@ impl Futex {
             FutexAccess::FutexRead,
         )?;
 
-        let mut futex_map_guard = FutexData::futex_map();
-        let bucket = futex_map_guard.get_mut(&key);
-        let bucket_mut = match bucket {
-            Some(bucket) => bucket,
-            None => {
-                let bucket = FutexHashBucket {
-                    chain: LinkedList::new(),
-                };
-                futex_map_guard.insert(key.clone(), bucket);
-                futex_map_guard.get_mut(&key).unwrap()
-            }
-        };
+        let mut bucket_mut = FutexData::lock_bucket(&key);
 
         // 使用UserBuffer读取futex
         let user_reader =
@@ -267,7 +373,7 @@ impl Futex {
             let nsec = time.tv_nsec;
             let jiffies = next_n_us_timer_jiffies((nsec / 1000 + sec * 1_000_000) as u64);
 
-            let wake_up = Timer::new(wakeup_helper, jiffies);
+            let wake_up = Timer::new(wakeup_helper, apply_timer_slack(jiffies));
 
             wake_up.activate();
             timer = Some(wake_up);
@@ -285,34 +391,20 @@ impl Futex {
             e
         })?;
         drop(bucket_mut);
-        drop(futex_map_guard);
         drop(irq_guard);
         sched();
 
         // 被唤醒后的检查
-        let mut futex_map_guard = FutexData::futex_map();
-        let bucket = futex_map_guard.get_mut(&key);
-        let bucket_mut = match bucket {
-            // 如果该pcb不在链表里面了或者该链表已经被释放，就证明是正常的Wake操作
-            Some(bucket_mut) => {
-                if !bucket_mut.contains(&futex_q) {
-                    // 取消定时器任务
-                    if timer.is_some() {
-                        timer.unwrap().cancel();
-                    }
-                    return Ok(0);
-                }
-                // 非正常唤醒，返回交给下层
-                bucket_mut
+        let mut bucket_mut = FutexData::lock_bucket(&key);
+        // 如果该pcb不在链表里面了，就证明是正常的Wake操作
+        if !bucket_mut.contains(&futex_q) {
+            // 取消定时器任务
+            if timer.is_some() {
+                timer.unwrap().cancel();
             }
-            None => {
-                // 取消定时器任务
-                if timer.is_some() {
-                    timer.unwrap().cancel();
-                }
-                return Ok(0);
-            }
-        };
+            return Ok(0);
+        }
+        // 非正常唤醒，返回交给下层
 
         // 如果是超时唤醒，则返回错误
         if timer.is_some() {
@@ -358,8 +450,7 @@ impl Futex {
             flags.contains(FutexFlag::FLAGS_SHARED),
             FutexAccess::FutexRead,
         )?;
-        let mut binding = FutexData::futex_map();
-        let bucket_mut = binding.get_mut(&key).ok_or(SystemError::EINVAL)?;
+        let mut bucket_mut = FutexData::lock_bucket(&key);
 
         // 确保后面的唤醒操作是有意义的
         if bucket_mut.chain.is_empty() {
@@ -368,11 +459,6 @@ impl Futex {
         // 从队列中唤醒
         let count = bucket_mut.wake_up(key.clone(), Some(bitset), nr_wake)?;
 
-        drop(bucket_mut);
-        drop(binding);
-
-        FutexData::try_remove(&key);
-
         Ok(count)
     }
 
@@ -422,26 +508,19 @@ impl Futex {
             }
         }
 
-        let mut futex_data_guard = FutexData::futex_map();
         if !requeue_pi {
+            let (mut bucket_1_mut, mut bucket_2_mut) = FutexData::lock_two_buckets(&key1, &key2);
             // 唤醒nr_wake个进程
-            let bucket_1_mut = futex_data_guard.get_mut(&key1).ok_or(SystemError::EINVAL)?;
             let ret = bucket_1_mut.wake_up(key1.clone(), None, nr_wake as u32)?;
-            drop(bucket_1_mut);
-            // 将bucket1中最多nr_requeue个任务转移到bucket2
-            for _ in 0..nr_requeue {
-                let bucket_1_mut = futex_data_guard.get_mut(&key1).ok_or(SystemError::EINVAL)?;
-                let futex_q = bucket_1_mut.chain.pop_front();
-                match futex_q {
-                    Some(futex_q) => {
-                        let bucket_2_mut =
-                            futex_data_guard.get_mut(&key2).ok_or(SystemError::EINVAL)?;
-                        bucket_2_mut.chain.push_back(futex_q);
-                    }
-                    None => {
-                        break;
-                    }
-                }
+            // 将bucket1中等待key1的最多nr_requeue个任务转移到bucket2
+            let requeued = bucket_1_mut.take(&key1, nr_requeue as usize);
+            let bucket_2_mut = bucket_2_mut.as_deref_mut().unwrap_or(&mut *bucket_1_mut);
+            for futex_q in requeued {
+                bucket_2_mut.chain.push_back(Arc::new(FutexObj {
+                    pcb: futex_q.pcb.clone(),
+                    key: key2.clone(),
+                    bitset: futex_q.bitset,
+                }));
             }
 
             return Ok(ret);
@@ -471,8 +550,7 @@ impl Futex {
             FutexAccess::FutexWrite,
         )?;
 
-        let mut futex_data_guard = FutexData::futex_map();
-        let bucket1 = futex_data_guard.get_mut(&key1).ok_or(SystemError::EINVAL)?;
+        let (mut bucket1, mut bucket2) = FutexData::lock_two_buckets(&key1, &key2);
         let mut wake_count = 0;
 
         // 唤醒uaddr1中的进程
@@ -482,7 +560,7 @@ impl Futex {
             Ok(ret) => {
                 // 操作成功则唤醒uaddr2中的进程
                 if ret {
-                    let bucket2 = futex_data_guard.get_mut(&key2).ok_or(SystemError::EINVAL)?;
+                    let bucket2 = bucket2.as_deref_mut().unwrap_or(&mut *bucket1);
                     wake_count += bucket2.wake_up(key2, None, nr_wake2 as u32)?;
                 }
             }
@@ -495,6 +573,344 @@ impl Futex {
         Ok(wake_count)
     }
 
+    /// ### 同时在多个futex上等待，直到其中任意一个被唤醒（futex_waitv）
+    ///
+    /// 与futex_wait相同，先依次检查每个futex的值并在它的bucket上挂起，任意一个值不满足时放弃等待。
+    ///
+    /// ## 参数
+    ///
+    /// - `waiters`：要等待的futex，以及它们期望的值
+    /// - `timeout`：相对的超时时间
+    ///
+    /// ## 返回值
+    ///
+    /// 被唤醒的futex在`waiters`中的下标
+    pub fn futex_waitv(
+        waiters: &[FutexWaitv],
+        timeout: Option<TimeSpec>,
+    ) -> Result<usize, SystemError> {
+        let mut keys = Vec::with_capacity(waiters.len());
+        for w in waiters.iter() {
+            let uaddr = VirtAddr::new(w.uaddr as usize);
+            let shared = w.flags & FUTEX2_PRIVATE == 0;
+            keys.push(Self::get_futex_key(uaddr, shared, FutexAccess::FutexRead)?);
+        }
+
+        let pcb = ProcessManager::current_pcb();
+        let futex_qs: Vec<Arc<FutexObj>> = keys
+            .iter()
+            .map(|key| {
+                Arc::new(FutexObj {
+                    pcb: Arc::downgrade(&pcb),
+                    key: key.clone(),
+                    bitset: FUTEX_BITSET_MATCH_ANY,
+                })
+            })
+            .collect();
+
+        // 移除已经挂起的futex_q，返回被唤醒的futex的下标
+        let dequeue_all = |queued: usize| -> Option<usize> {
+            let mut woken = None;
+            for i in 0..queued {
+                let mut bucket_mut = FutexData::lock_bucket(&keys[i]);
+                if bucket_mut.contains(&futex_qs[i]) {
+                    bucket_mut.remove(futex_qs[i].clone());
+                } else if woken.is_none() {
+                    woken = Some(i);
+                }
+            }
+            return woken;
+        };
+
+        // 先把自己标记为睡眠状态，再依次挂起：在挂起之后、调度之前的唤醒不会被错过
+        let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+        ProcessManager::mark_sleep(true)?;
+        for (i, w) in waiters.iter().enumerate() {
+            let mut bucket_mut = FutexData::lock_bucket(&keys[i]);
+            let reader = UserBufferReader::new(
+                w.uaddr as usize as *const u32,
+                core::mem::size_of::<u32>(),
+                true,
+            );
+            let uval = reader.and_then(|r| r.read_one_from_user::<u32>(0).map(|v| *v));
+            match uval {
+                Ok(uval) if uval as u64 == w.val => {
+                    bucket_mut.chain.push_back(futex_qs[i].clone());
+                }
+                _ => {
+                    drop(bucket_mut);
+                    // 放弃等待，恢复为可运行状态
+                    pcb.sched_info_mut_irqsave()
+                        .set_state(ProcessState::Runnable);
+                    pcb.flags().remove(ProcessFlags::NEED_SCHEDULE);
+                    drop(irq_guard);
+                    if let Some(woken) = dequeue_all(i) {
+                        return Ok(woken);
+                    }
+                    return Err(uval.err().unwrap_or(SystemError::EAGAIN_OR_EWOULDBLOCK));
+                }
+            }
+        }
+        drop(irq_guard);
+
+        // 创建超时计时器任务
+        let mut timer = None;
+        if let Some(time) = timeout {
+            let wakeup_helper = WakeUpHelper::new(pcb.clone());
+            let jiffies =
+                next_n_us_timer_jiffies((time.tv_nsec / 1000 + time.tv_sec * 1_000_000) as u64);
+            let wake_up = Timer::new(wakeup_helper, apply_timer_slack(jiffies));
+            wake_up.activate();
+            timer = Some(wake_up);
+        }
+        sched();
+
+        let woken = dequeue_all(waiters.len());
+        let timed_out = timer.as_ref().map_or(false, |t| t.timeout());
+        if let Some(timer) = timer {
+            if !timed_out {
+                timer.cancel();
+            }
+        }
+        if let Some(woken) = woken {
+            return Ok(woken);
+        }
+        if timed_out {
+            return Err(SystemError::ETIMEDOUT);
+        }
+        // 被信号唤醒
+        return Err(SystemError::ERESTARTSYS);
+    }
+
+    /// ### 获取PI futex（FUTEX_LOCK_PI、FUTEX_TRYLOCK_PI）
+    ///
+    /// futex的值为持有者的tid，有进程在内核中等待时设置FUTEX_WAITERS位。
+    /// 等待期间，持有者以等待者中最高的优先级运行（不处理持有者本身也在等待另一个PI futex的链式继承）。
+    /// 解锁时，锁被直接交给优先级最高的等待者。
+    ///
+    /// `timeout`是从现在开始的相对时间（系统调用层已经把用户传入的绝对时间换算好）。
+    /// 已经超时时，如果不能立即获取锁，返回ETIMEDOUT
+    pub fn futex_lock_pi(
+        uaddr: VirtAddr,
+        flags: FutexFlag,
+        timeout: Option<TimeSpec>,
+        trylock: bool,
+    ) -> Result<usize, SystemError> {
+        let key = Self::get_futex_key(
+            uaddr,
+            flags.contains(FutexFlag::FLAGS_SHARED),
+            FutexAccess::FutexWrite,
+        )?;
+        let word = Self::futex_word(uaddr)?;
+        let pcb = ProcessManager::current_pcb();
+        let tid = pcb.pid().data() as u32;
+
+        let mut bucket_mut = FutexData::lock_bucket(&key);
+        let mut uval = word.load(Ordering::SeqCst);
+        let owner = loop {
+            let owner_tid = uval & FUTEX_TID_MASK;
+            if owner_tid == 0 {
+                // 锁是空闲的：直接获取。保留FUTEX_WAITERS位，让解锁的进程进入内核
+                let new = tid | (uval & FUTEX_WAITERS);
+                match word.compare_exchange(uval, new, Ordering::SeqCst, Ordering::SeqCst) {
+                    Ok(_) => return Ok(0),
+                    Err(v) => {
+                        uval = v;
+                        continue;
+                    }
+                }
+            }
+            if owner_tid == tid {
+                return Err(SystemError::EDEADLK);
+            }
+            if trylock {
+                return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
+            }
+            if timeout.is_some_and(|t| t.tv_sec == 0 && t.tv_nsec == 0) {
+                return Err(SystemError::ETIMEDOUT);
+            }
+            let owner =
+                ProcessManager::find(Pid::new(owner_tid as usize)).ok_or(SystemError::ESRCH)?;
+            // 设置FUTEX_WAITERS位，使得持有者解锁时进入内核
+            if uval & FUTEX_WAITERS == 0 {
+                if let Err(v) = word.compare_exchange(
+                    uval,
+                    uval | FUTEX_WAITERS,
+                    Ordering::SeqCst,
+                    Ordering::SeqCst,
+                ) {
+                    uval = v;
+                    continue;
+                }
+            }
+            break owner;
+        };
+
+        let (policy, priority) = {
+            let sched_info = pcb.sched_info();
+            (sched_info.policy(), sched_info.priority())
+        };
+        let waiter = Arc::new(FutexPiWaiter {
+            pcb: Arc::downgrade(&pcb),
+            pid: pcb.pid(),
+            key: key.clone(),
+            policy,
+            priority,
+        });
+
+        // 创建超时计时器任务
+        let mut timer = None;
+        if let Some(time) = timeout {
+            let wakeup_helper = WakeUpHelper::new(pcb.clone());
+            let jiffies =
+                next_n_us_timer_jiffies((time.tv_nsec / 1000 + time.tv_sec * 1_000_000) as u64);
+            let wake_up = Timer::new(wakeup_helper, apply_timer_slack(jiffies));
+            wake_up.activate();
+            timer = Some(wake_up);
+        }
+
+        let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+        bucket_mut.pi_chain.push_back(waiter.clone());
+        if let Err(e) = ProcessManager::mark_sleep(true) {
+            bucket_mut.pi_remove(&waiter);
+            return Err(e);
+        }
+        Self::pi_boost(&owner, &waiter);
+        drop(owner);
+        drop(bucket_mut);
+        drop(irq_guard);
+        sched();
+
+        // 被唤醒后的检查：解锁的进程把锁交给当前进程时，会把它从等待队列中删除
+        let mut bucket_mut = FutexData::lock_bucket(&key);
+        if !bucket_mut.pi_remove(&waiter) {
+            drop(bucket_mut);
+            if let Some(timer) = timer {
+                if !timer.timeout() {
+                    timer.cancel();
+                }
+            }
+            return Ok(0);
+        }
+
+        // 超时或者被信号唤醒：放弃等待，收回借给持有者的优先级
+        let owner_tid = word.load(Ordering::SeqCst) & FUTEX_TID_MASK;
+        if let Some(owner) = ProcessManager::find(Pid::new(owner_tid as usize)) {
+            Self::pi_unboost(&owner, waiter.pid);
+        }
+        drop(bucket_mut);
+        if let Some(timer) = timer {
+            if timer.timeout() {
+                return Err(SystemError::ETIMEDOUT);
+            }
+            timer.cancel();
+        }
+        return Err(SystemError::EINTR);
+    }
+
+    /// ### 释放PI futex（FUTEX_UNLOCK_PI）
+    ///
+    /// 恢复当前进程被提升之前的优先级，并把锁交给优先级最高的等待者
+    pub fn futex_unlock_pi(uaddr: VirtAddr, flags: FutexFlag) -> Result<usize, SystemError> {
+        let key = Self::get_futex_key(
+            uaddr,
+            flags.contains(FutexFlag::FLAGS_SHARED),
+            FutexAccess::FutexWrite,
+        )?;
+        let word = Self::futex_word(uaddr)?;
+        let pcb = ProcessManager::current_pcb();
+        let tid = pcb.pid().data() as u32;
+
+        let mut bucket_mut = FutexData::lock_bucket(&key);
+        let uval = word.load(Ordering::SeqCst);
+        if uval & FUTEX_TID_MASK != tid {
+            return Err(SystemError::EPERM);
+        }
+
+        // 等待这个锁的进程不再借给当前进程优先级
+        let waiters: Vec<Pid> = bucket_mut
+            .pi_chain
+            .iter()
+            .filter(|w| w.key == key)
+            .map(|w| w.pid)
+            .collect();
+        for pid in waiters.iter() {
+            Self::pi_unboost(&pcb, *pid);
+        }
+
+        let (top, next) = loop {
+            let top = match bucket_mut.pi_top_waiter(&key) {
+                Some(top) => top,
+                None => {
+                    // 没有等待者：释放锁
+                    word.compare_exchange(uval, 0, Ordering::SeqCst, Ordering::SeqCst)
+                        .map_err(|_| SystemError::EAGAIN_OR_EWOULDBLOCK)?;
+                    return Ok(0);
+                }
+            };
+            match top.pcb.upgrade() {
+                Some(next) => break (top, next),
+                // 已经退出的等待者不能获得锁
+                None => {
+                    bucket_mut.pi_remove(&top);
+                }
+            }
+        };
+
+        // 把锁交给等待者。如果还有其他等待者，保留FUTEX_WAITERS位
+        let remaining = bucket_mut
+            .pi_chain
+            .iter()
+            .any(|w| w.key == key && !Arc::ptr_eq(w, &top));
+        let new = top.pid.data() as u32 | if remaining { FUTEX_WAITERS } else { 0 };
+        word.compare_exchange(uval, new, Ordering::SeqCst, Ordering::SeqCst)
+            .map_err(|_| SystemError::EAGAIN_OR_EWOULDBLOCK)?;
+        bucket_mut.pi_remove(&top);
+
+        // 剩下的等待者把优先级借给新的持有者
+        let remaining: Vec<Arc<FutexPiWaiter>> = bucket_mut
+            .pi_chain
+            .iter()
+            .filter(|w| w.key == key)
+            .cloned()
+            .collect();
+        for waiter in remaining.iter() {
+            Self::pi_boost(&next, waiter);
+        }
+        ProcessManager::wakeup(&next)?;
+        drop(bucket_mut);
+        return Ok(0);
+    }
+
+    /// 优先级继承：把等待者的调度策略和优先级借给锁的持有者
+    fn pi_boost(owner: &Arc<ProcessControlBlock>, waiter: &FutexPiWaiter) {
+        let changed =
+            owner
+                .sched_info_mut_irqsave()
+                .pi_donate(waiter.pid, waiter.policy, waiter.priority);
+        // 与sched_setscheduler一样，在下一次时钟中断时按照新的优先级重新调度
+        if changed && owner.sched_info().on_cpu().is_some() {
+            owner.flags().insert(ProcessFlags::NEED_SCHEDULE);
+        }
+    }
+
+    /// 优先级继承：收回等待者借给锁的持有者的优先级
+    fn pi_unboost(owner: &Arc<ProcessControlBlock>, waiter: Pid) {
+        let changed = owner.sched_info_mut_irqsave().pi_revoke(waiter);
+        if changed && owner.sched_info().on_cpu().is_some() {
+            owner.flags().insert(ProcessFlags::NEED_SCHEDULE);
+        }
+    }
+
+    /// 校验用户空间的futex变量的地址，并以原子变量的形式访问它
+    fn futex_word(uaddr: VirtAddr) -> Result<&'static AtomicU32, SystemError> {
+        UserBufferReader::new(uaddr.as_ptr::<u32>(), core::mem::size_of::<u32>(), true)?;
+        if uaddr.data() & (core::mem::size_of::<u32>() - 1) != 0 {
+            return Err(SystemError::EINVAL);
+        }
+        return Ok(unsafe { &*(uaddr.data() as *const AtomicU32) });
+    }
+
     fn get_futex_key(
         uaddr: VirtAddr,
         fshared: bool,
@@ -1,10 +1,16 @@
 use crate::{
     mm::VirtAddr,
-    syscall::{Syscall, SystemError},
-    time::TimeSpec,
+    syscall::{user_access::UserBufferReader, Syscall, SystemError},
+    time::{
+        hrtimer::hrtimer_now, syscall::PosixClockID, timekeeping::getnstimeofday, TimeSpec,
+        NSEC_PER_SEC,
+    },
 };
 
-use super::{constant::*, futex::Futex};
+use super::{
+    constant::*,
+    futex::{Futex, FutexWaitv},
+};
 
 impl Syscall {
     pub fn do_futex(
@@ -80,17 +86,20 @@ impl Syscall {
                     val3 as i32,
                 );
             }
-            FutexArg::FUTEX_LOCK_PI => {
-                todo!()
-            }
-            FutexArg::FUTEX_LOCK_PI2 => {
-                todo!()
+            FutexArg::FUTEX_LOCK_PI | FutexArg::FUTEX_LOCK_PI2 => {
+                // 超时时间是绝对时间：FUTEX_LOCK_PI总是使用CLOCK_REALTIME，
+                // FUTEX_LOCK_PI2只有指定了FUTEX_CLOCK_REALTIME时才使用CLOCK_REALTIME，否则使用CLOCK_MONOTONIC
+                let realtime =
+                    cmd == FutexArg::FUTEX_LOCK_PI || flags.contains(FutexFlag::FLAGS_CLOCKRT);
+                let timeout =
+                    timeout.map(|deadline| Self::futex_deadline_to_rel(&deadline, realtime));
+                return Futex::futex_lock_pi(uaddr, flags, timeout, false);
             }
             FutexArg::FUTEX_UNLOCK_PI => {
-                todo!()
+                return Futex::futex_unlock_pi(uaddr, flags);
             }
             FutexArg::FUTEX_TRYLOCK_PI => {
-                todo!()
+                return Futex::futex_lock_pi(uaddr, flags, None, true);
             }
             FutexArg::FUTEX_WAIT_REQUEUE_PI => {
                 todo!()
@@ -103,4 +112,90 @@ impl Syscall {
             }
         }
     }
+
+    /// futex_waitv系统调用（与Linux一致）
+    ///
+    /// ## 参数
+    ///
+    /// - `waiters`：用户空间的`struct futex_waitv`数组
+    /// - `nr_futexes`：数组的长度，1~FUTEX_WAITV_MAX
+    /// - `flags`：保留，必须为0
+    /// - `timeout`：绝对的超时时间，为空指针时不会超时
+    /// - `clockid`：超时时间所用的时钟，CLOCK_MONOTONIC或者CLOCK_REALTIME
+    ///
+    /// ## 返回值
+    ///
+    /// 被唤醒的futex在数组中的下标
+    pub fn futex_waitv(
+        waiters: *const FutexWaitv,
+        nr_futexes: u32,
+        flags: u32,
+        timeout: *const TimeSpec,
+        clockid: i32,
+    ) -> Result<usize, SystemError> {
+        if flags != 0 || nr_futexes == 0 || nr_futexes > FUTEX_WAITV_MAX {
+            return Err(SystemError::EINVAL);
+        }
+
+        let mut rel_timeout = None;
+        if !timeout.is_null() {
+            let clockid = PosixClockID::try_from(clockid)?;
+            if clockid != PosixClockID::Monotonic && clockid != PosixClockID::Realtime {
+                return Err(SystemError::EINVAL);
+            }
+            let reader = UserBufferReader::new(timeout, core::mem::size_of::<TimeSpec>(), true)?;
+            let deadline = reader.read_one_from_user::<TimeSpec>(0)?;
+            rel_timeout = Some(Self::futex_deadline_to_rel(
+                deadline,
+                clockid == PosixClockID::Realtime,
+            ));
+        }
+
+        let reader = UserBufferReader::new(
+            waiters,
+            core::mem::size_of::<FutexWaitv>() * nr_futexes as usize,
+            true,
+        )?;
+        let waiters = reader.read_from_user::<FutexWaitv>(0)?;
+        for w in waiters.iter() {
+            if w.__reserved != 0
+                || w.flags & !(FUTEX2_SIZE_U32 | FUTEX2_PRIVATE) != 0
+                || w.flags & FUTEX2_SIZE_U32 == 0
+                || w.val > u32::MAX as u64
+            {
+                return Err(SystemError::EINVAL);
+            }
+            if w.uaddr as usize & (core::mem::size_of::<u32>() - 1) != 0 {
+                return Err(SystemError::EINVAL);
+            }
+            UserBufferReader::new(
+                w.uaddr as usize as *const u32,
+                core::mem::size_of::<u32>(),
+                true,
+            )?;
+        }
+
+        return Futex::futex_waitv(waiters, rel_timeout);
+    }
+
+    /// 把绝对的超时时间换算为从现在开始的相对时间，已经超时时返回0
+    ///
+    /// ## 参数
+    ///
+    /// - `deadline`：绝对的超时时间
+    /// - `realtime`：超时时间是否基于CLOCK_REALTIME，否则基于CLOCK_MONOTONIC
+    fn futex_deadline_to_rel(deadline: &TimeSpec, realtime: bool) -> TimeSpec {
+        let now_ns = if realtime {
+            let now = getnstimeofday();
+            now.tv_sec * NSEC_PER_SEC as i64 + now.tv_nsec
+        } else {
+            hrtimer_now() as i64
+        };
+        let deadline_ns = deadline.tv_sec * NSEC_PER_SEC as i64 + deadline.tv_nsec;
+        let ns = (deadline_ns - now_ns).max(0);
+        return TimeSpec {
+            tv_sec: ns / NSEC_PER_SEC as i64,
+            tv_nsec: ns % NSEC_PER_SEC as i64,
+        };
+    }
 }
@@ -1,26 +1,57 @@
 #![no_std]
 #![feature(core_intrinsics)]
 
+extern crate alloc;
+
+use core::cell::UnsafeCell;
+use core::hint::spin_loop;
 use core::intrinsics::unlikely;
 use core::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
 
+use alloc::vec::Vec;
+
 /// id分配器
 ///
-/// TODO: 当前只是为了简单实现功能，将来这里应使用类似linux的ida的方式去实现
+/// 与Linux的ida类似，用位图记录已经分配的id，释放的id可以被再次分配。
+/// 分配是循环的：从上一次分配的id之后开始查找空闲的id，到达上限之后回到起点，
+/// 因此刚被释放的id不会马上被复用（例如pid）。
+///
+/// 位图只覆盖到已经分配过的最大的id，随着分配按需增长
 #[derive(Debug)]
 pub struct IdAllocator {
-    current_id: AtomicUsize,
-    max_id: usize,
-    dead: AtomicBool,
+    /// 可以分配的最小的id
+    min_id: usize,
+    /// 可以分配的id的上限（不包含）
+    max_id: AtomicUsize,
+    lock: AtomicBool,
+    inner: UnsafeCell<InnerIdAllocator>,
 }
 
+#[derive(Debug)]
+struct InnerIdAllocator {
+    /// 第i位表示id `min_id + i` 是否已经被分配
+    bitmap: Vec<u64>,
+    /// 下一次从这个id开始查找
+    cursor: usize,
+    /// 已经分配的id的数量
+    used: usize,
+}
+
+unsafe impl Sync for IdAllocator {}
+unsafe impl Send for IdAllocator {}
+
 impl IdAllocator {
-    /// 创建一个新的id分配器
+    /// 创建一个新的id分配器，分配`[initial_id, max_id)`中的id
     pub const fn new(initial_id: usize, max_id: usize) -> Self {
         Self {
-            current_id: AtomicUsize::new(initial_id),
-            max_id,
-            dead: AtomicBool::new(false),
+            min_id: initial_id,
+            max_id: AtomicUsize::new(max_id),
+            lock: AtomicBool::new(false),
+            inner: UnsafeCell::new(InnerIdAllocator {
+                bitmap: Vec::new(),
+                cursor: initial_id,
+                used: 0,
+            }),
         }
     }
 
@@ -28,23 +59,96 @@ impl IdAllocator {
     ///
     /// ## 返回
     ///
-    /// 如果分配成功，返回Some(id)，否则返回None
+    /// 如果分配成功，返回Some(id)，否则（所有的id都已经被分配）返回None
     pub fn alloc(&self) -> Option<usize> {
-        if unlikely(self.dead.load(Ordering::SeqCst)) {
-            return None;
-        }
+        let max_id = self.max_id.load(Ordering::Relaxed);
+        return self.with_inner(|inner| {
+            if unlikely(inner.used >= max_id.saturating_sub(self.min_id)) {
+                return None;
+            }
+            let cursor = if inner.cursor >= max_id {
+                self.min_id
+            } else {
+                inner.cursor
+            };
+            let id = self
+                .find_free(inner, cursor, max_id)
+                .or_else(|| self.find_free(inner, self.min_id, cursor))?;
 
-        let ret = self.current_id.fetch_add(1, Ordering::SeqCst);
-        // 如果id溢出，panic
-        if ret == self.max_id {
-            self.dead.store(true, Ordering::SeqCst);
-            return None;
+            let bit = id - self.min_id;
+            let word = bit / 64;
+            if word >= inner.bitmap.len() {
+                inner.bitmap.resize(word + 1, 0);
+            }
+            inner.bitmap[word] |= 1 << (bit % 64);
+            inner.used += 1;
+            inner.cursor = id + 1;
+            return Some(id);
+        });
+    }
+
+    /// 释放一个id，它之后可以被再次分配
+    pub fn free(&self, id: usize) {
+        if unlikely(id < self.min_id) {
+            return;
         }
+        let bit = id - self.min_id;
+        self.with_inner(|inner| {
+            if let Some(word) = inner.bitmap.get_mut(bit / 64) {
+                let mask = 1 << (bit % 64);
+                if *word & mask != 0 {
+                    *word &= !mask;
+                    inner.used -= 1;
+                }
+            }
+        });
+    }
+
+    /// 修改id的上限（不包含）。已经分配的超出上限的id不受影响，它们被释放之后不会再被分配
+    pub fn set_max_id(&self, max_id: usize) {
+        self.max_id.store(max_id, Ordering::Relaxed);
+    }
 
-        return Some(ret);
+    /// id的上限（不包含）
+    pub fn max_id(&self) -> usize {
+        return self.max_id.load(Ordering::Relaxed);
     }
 
-    pub fn free(&self, _id: usize) {
-        // todo: free
+    /// 在`[start, end)`中查找第一个空闲的id
+    fn find_free(&self, inner: &InnerIdAllocator, start: usize, end: usize) -> Option<usize> {
+        let mut bit = start - self.min_id;
+        let end_bit = end - self.min_id;
+        while bit < end_bit {
+            let word = match inner.bitmap.get(bit / 64) {
+                Some(word) => *word,
+                // 位图之外的id都是空闲的
+                None => return Some(self.min_id + bit),
+            };
+            // 忽略word中start之前的位
+            let free = !(word | ((1u64 << (bit % 64)) - 1));
+            if free != 0 {
+                let found = (bit & !63) + free.trailing_zeros() as usize;
+                return if found < end_bit {
+                    Some(self.min_id + found)
+                } else {
+                    None
+                };
+            }
+            bit = (bit & !63) + 64;
+        }
+        return None;
+    }
+
+    fn with_inner<R, F: FnOnce(&mut InnerIdAllocator) -> R>(&self, f: F) -> R {
+        while self
+            .lock
+            .compare_exchange_weak(false, true, Ordering::Acquire, Ordering::Relaxed)
+            .is_err()
+        {
+            spin_loop();
+        }
+        let r = f(unsafe { &mut *self.inner.get() });
+        self.lock.store(false, Ordering::Release);
+        return r;
     }
 }
@@ -1,18 +1,6 @@
 #include <common/idr.h>
 #include <mm/slab.h>
 
-/**
- * @brief 更换两个idr_layer指针
- *
- * @param a
- * @param b
- */
-static void __swap(struct idr_layer **a, struct idr_layer **b)
-{
-    struct idr_layer *t = *a;
-    *a = *b, *b = t;
-}
-
 /**
  * @brief 初始化idr - 你需要保证函数调用之前 free_list指针 为空
  *
@@ -46,42 +34,24 @@ static void __move_to_free_list(struct idr *idp, struct idr_layer *p)
 }
 
 /**
- * @brief Get the free_idr_layer from free list object
+ * @brief 从free_list中取出一个空节点 (调用者需要持有idp->lock, 或者保证没有并发的访问)
  *
  * @param idp
- * @return void*
+ * @return void* (free_list为空时返回NULL)
  */
 static void *__get_from_free_list(struct idr *idp)
 {
-    if (idp->id_free_cnt == 0)
-    {
-        if (idr_preload(idp, 0) != 0)
-        {
-            kBUG("idr-module find a BUG: get free node fail.(Possible ENOMEM error)");
-            return NULL;
-        }
-    }
-
-    unsigned long flags;
-    spin_lock_irqsave(&idp->lock, flags);
-
-    // free_list还有节点
     struct idr_layer *item = idp->free_list;
-
-    if (item == NULL)
+    if (unlikely(item == NULL))
     {
-        BUG_ON(1);
+        kBUG("idr-module find a BUG: get free node fail.(free list is empty)");
+        return NULL;
     }
 
-    io_sfence();
-    idp->free_list = idp->free_list->ary[0];
-    io_sfence();
+    idp->free_list = item->ary[0];
     item->ary[0] = NULL; // 记得清空原来的数据
-    io_sfence();
     --(idp->id_free_cnt);
 
-    spin_unlock_irqrestore(&idp->lock, flags);
-
     return item;
 }
 
@@ -109,13 +79,44 @@ int idr_preload(struct idr *idp, gfp_t gfp_mask)
 }
 
 /**
- * @brief 释放一个layer的空间
+ * @brief 预分配足够一次写操作使用的节点, 然后获取idp->lock
+ *
+ * 写操作在持有锁的时候不能分配内存, 它最多使用IDR_FREE_MAX个节点。
+ * 预分配之后、加锁之前, 节点可能被其它写者用掉, 因此加锁之后需要再检查一次
+ *
+ * @param idp
+ * @param flags 保存中断状态
+ * @return int (0表示已经加锁; -ENOMEM表示内存空间不够, 此时没有加锁)
+ */
+static int __idr_lock_preloaded(struct idr *idp, unsigned long *flags)
+{
+    while (1)
+    {
+        if (idr_preload(idp, 0) != 0)
+            return -ENOMEM;
+
+        spin_lock_irqsave(&idp->lock, *flags);
+        if (idp->id_free_cnt >= IDR_FREE_MAX)
+            return 0;
+        spin_unlock_irqrestore(&idp->lock, *flags);
+    }
+}
+
+static void __idr_layer_free_rcu(void *p)
+{
+    kfree(p);
+}
+
+/**
+ * @brief 释放一个已经从树上摘下的layer的空间
+ *
+ * 读者可能还在访问这个节点, 因此在宽限期结束之后才真正释放
  *
  * @param p
  */
 static void __idr_layer_free(struct idr_layer *p)
 {
-    kfree(p);
+    call_rcu(__idr_layer_free_rcu, p);
 }
 
 /**
@@ -126,26 +127,28 @@ static void __idr_layer_free(struct idr_layer *p)
  */
 static int __idr_grow(struct idr *idp)
 {
-    struct idr_layer *new_node = __get_from_free_list(idp);
-    if (NULL == new_node)
+    struct idr_layer *new_top = __get_from_free_list(idp);
+    if (NULL == new_top)
         return -ENOMEM;
 
-    __swap(&new_node, &idp->top);
+    struct idr_layer *old_top = idp->top;
 
-    idp->top->ary[0] = new_node;
-    idp->top->layer = new_node ? (new_node->layer + 1) : 0; // 注意特判空指针
-    idp->top->bitmap = 0;
-    idp->top->full = 0; // clear
+    // 读者可能正在访问根节点: 先初始化好新的根节点, 再发布它
+    new_top->ary[0] = old_top;
+    new_top->layer = old_top ? (old_top->layer + 1) : 0; // 注意特判空指针
+    new_top->bitmap = 0;
+    new_top->full = 0; // clear
 
-    if (new_node != NULL) // 设置第0位 = 1, 同时维护树的大小
+    if (old_top != NULL) // 设置第0位 = 1, 同时维护树的大小
     {
-        idp->top->bitmap = 1;
+        new_top->bitmap = 1;
     }
-    if (new_node != NULL && new_node->full == IDR_FULL)
+    if (old_top != NULL && old_top->full == IDR_FULL)
     {
-        idp->top->full = 1; // 别忘了初始化 full
+        new_top->full = 1; // 别忘了初始化 full
     }
 
+    rcu_assign_pointer(idp->top, new_top);
     return 0;
 }
 
@@ -193,7 +196,7 @@ static int __idr_get_empty_slot(struct idr *idp, struct idr_layer **stk)
             cur_layer->full = 0;
             cur_layer->bitmap = 0;
 
-            stk[layer]->ary[pos] = cur_layer; // 最后别忘了记录儿子节点
+            rcu_assign_pointer(stk[layer]->ary[pos], cur_layer); // 最后别忘了记录儿子节点
         }
 
         --layer;
@@ -304,7 +307,7 @@ static __always_inline void __idr_erase_full(struct idr *idp, int id, struct idr
     int64_t layer_id = __id & IDR_MASK;
     if (mark == 0) // 叶子的某个插槽为空
     {
-        stk[0]->ary[layer_id] = NULL;
+        rcu_assign_pointer(stk[0]->ary[layer_id], NULL);
         stk[0]->bitmap ^= (1ull << layer_id);
     }
     if (mark != 2 && ((stk[0]->full >> layer_id) & 1))
@@ -318,7 +321,7 @@ static __always_inline void __idr_erase_full(struct idr *idp, int id, struct idr
 
         if (NULL == stk[layer - 1]->bitmap) // 儿子是空节点
         {
-            stk[layer]->ary[layer_id] = NULL;
+            rcu_assign_pointer(stk[layer]->ary[layer_id], NULL);
             stk[layer]->bitmap ^= (1ull << layer_id);
 
             if ((stk[layer]->full >> layer_id) & 1)
@@ -340,9 +343,9 @@ static __always_inline void __idr_erase_full(struct idr *idp, int id, struct idr
     while (idp->top != NULL && ((idp->top->bitmap <= 1 && idp->top->layer > 0) || // 一条链的情况
                                 (idp->top->layer == 0 && idp->top->bitmap == 0))) // 最后一个点的情况
     {
-        struct idr_layer *t = idp->top->layer ? idp->top->ary[0] : NULL;
-        __idr_layer_free(idp->top);
-        idp->top = t;
+        struct idr_layer *old_top = idp->top;
+        rcu_assign_pointer(idp->top, old_top->layer ? old_top->ary[0] : NULL);
+        __idr_layer_free(old_top);
     }
 }
 
@@ -365,13 +368,65 @@ static int __idr_get_new_above_int(struct idr *idp, void *ptr, int starting_id)
 
     if (id >= 0)
     {
-        stk[0]->ary[IDR_MASK & id] = ptr;
+        rcu_assign_pointer(stk[0]->ary[IDR_MASK & id], ptr);
         __idr_mark_full(idp, id, stk, 2);
     }
 
     return id;
 }
 
+/**
+ * @brief 提取指定id的路径, 路径上不存在的节点会被创建 (辅助函数)
+ *
+ * @param idp
+ * @param id
+ * @param stk 栈空间
+ * @return int (0表示成功; -EEXIST表示这个id已经被分配; -ENOMEM表示内存空间不够)
+ */
+static int __idr_get_slot_at(struct idr *idp, int id, struct idr_layer **stk)
+{
+    int64_t __id = (int64_t)id;
+
+    // 树的高度不足以容纳这个id时, 向上生长
+    while (NULL == idp->top || (__id >> ((idp->top->layer + 1ll) * IDR_BITS)) > 0)
+        if (__idr_grow(idp) != 0)
+            return -ENOMEM;
+
+    struct idr_layer *cur_layer = idp->top;
+    int layer = cur_layer->layer;
+    BUG_ON(layer + 1 >= 7);
+    stk[layer + 1] = NULL; // 标志为数组末尾
+
+    while (layer >= 0)
+    {
+        stk[layer] = cur_layer;
+        if (layer == 0)
+            break;
+
+        int64_t pos = (__id >> (layer * IDR_BITS)) & IDR_MASK;
+        cur_layer = cur_layer->ary[pos];
+        if (NULL == cur_layer)
+        {
+            // 初始化儿子节点, 然后再发布它
+            cur_layer = __get_from_free_list(idp);
+            if (NULL == cur_layer)
+                return -ENOMEM;
+            cur_layer->layer = layer - 1;
+            cur_layer->full = 0;
+            cur_layer->bitmap = 0;
+
+            rcu_assign_pointer(stk[layer]->ary[pos], cur_layer);
+        }
+
+        --layer;
+    }
+
+    if ((stk[0]->bitmap >> (__id & IDR_MASK)) & 1)
+        return -EEXIST;
+
+    return 0;
+}
+
 /**
  * @brief 从[0,INT_MAX]区间内返回一个最小的空闲ID
  *
@@ -382,13 +437,48 @@ static int __idr_get_new_above_int(struct idr *idp, void *ptr, int starting_id)
  */
 int idr_alloc(struct idr *idp, void *ptr, int *id)
 {
+    unsigned long flags;
+    if (__idr_lock_preloaded(idp, &flags) != 0)
+        return -ENOMEM;
+
     int rv = __idr_get_new_above_int(idp, ptr, 0);
+
+    spin_unlock_irqrestore(&idp->lock, flags);
     if (rv < 0)
         return rv; // error
     *id = rv;
     return 0;
 }
 
+/**
+ * @brief 将指定的id与ptr绑定
+ *
+ * @param idp
+ * @param ptr - id 所对应的指针
+ * @param id  - 要绑定的id
+ * @return int (0表示成功; -EEXIST表示这个id已经被分配; -EDOM表示id不合法; -ENOMEM表示内存空间不够)
+ */
+int idr_alloc_at(struct idr *idp, void *ptr, int id)
+{
+    if (unlikely(id < 0))
+        return -EDOM;
+
+    unsigned long flags;
+    if (__idr_lock_preloaded(idp, &flags) != 0)
+        return -ENOMEM;
+
+    struct idr_layer *stk[MAX_LEVEL + 1] = {0};
+    int rv = __idr_get_slot_at(idp, id, stk);
+    if (rv == 0)
+    {
+        rcu_assign_pointer(stk[0]->ary[IDR_MASK & id], ptr);
+        __idr_mark_full(idp, id, stk, 2);
+    }
+
+    spin_unlock_irqrestore(&idp->lock, flags);
+    return rv;
+}
+
 /**
  * @brief 删除一个id, 但是不释放对应的ptr指向的空间, 同时返回这个被删除id所对应的ptr
  *
@@ -400,17 +490,23 @@ int idr_alloc(struct idr *idp, void *ptr, int *id)
 void *idr_remove(struct idr *idp, int id)
 {
     int64_t __id = (int64_t)id;
-    if (unlikely(idp->top == NULL || __id < 0))
+    if (unlikely(__id < 0))
         return NULL;
 
-    struct idr_layer *stk[MAX_LEVEL + 1] = {0};
+    unsigned long flags;
+    spin_lock_irqsave(&idp->lock, flags);
 
-    if (0 == __idr_get_path(idp, __id, stk))
-        return NULL; // 找不到路径
+    void *ret = NULL;
+    struct idr_layer *stk[MAX_LEVEL + 1] = {0};
 
-    void *ret = stk[0]->ary[__id & IDR_MASK];
-    __idr_erase_full(idp, __id, stk, 0);
+    // 找不到路径时返回NULL
+    if (idp->top != NULL && __idr_get_path(idp, __id, stk) != 0)
+    {
+        ret = stk[0]->ary[__id & IDR_MASK];
+        __idr_erase_full(idp, __id, stk, 0);
+    }
 
+    spin_unlock_irqrestore(&idp->lock, flags);
     return ret;
 }
 
@@ -428,10 +524,11 @@ static void __idr_remove_all_with_free(struct idr *idp, bool free)
         return;
     }
 
-    int sz = sizeof(struct idr_layer);
     struct idr_layer *stk[MAX_LEVEL + 1] = {0};
 
+    // 先摘下整棵树, 之后开始的读者看到的是空的idr; 已经在树中的读者可能还在访问节点, 节点在宽限期结束之后才释放
     struct idr_layer *cur_layer = idp->top;
+    rcu_assign_pointer(idp->top, NULL);
     int layer = cur_layer->layer;
     BUG_ON(layer + 1 >= 7);
     stk[layer + 1] = NULL; // 标记数组结尾
@@ -465,7 +562,6 @@ static void __idr_remove_all_with_free(struct idr *idp, bool free)
             cur_layer = stk[layer]; // 出栈
         }
     }
-    idp->top = NULL;
 }
 
 /**
@@ -477,8 +573,9 @@ static void __idr_destroy_with_free(struct idr *idp)
     if (likely(idp->top))
         __idr_remove_all_with_free(idp, 1);
     idp->top = NULL;
+    // free_list中的节点从来没有被发布过, 可以直接释放
     while (idp->id_free_cnt)
-        __idr_layer_free(__get_from_free_list(idp));
+        kfree(__get_from_free_list(idp));
     idp->free_list = NULL;
 }
 
@@ -489,10 +586,13 @@ static void __idr_destroy_with_free(struct idr *idp)
  */
 void idr_remove_all(struct idr *idp)
 {
-    if (unlikely(NULL == idp->top))
-        return;
+    unsigned long flags;
+    spin_lock_irqsave(&idp->lock, flags);
 
-    __idr_remove_all_with_free(idp, 0);
+    if (likely(NULL != idp->top))
+        __idr_remove_all_with_free(idp, 0);
+
+    spin_unlock_irqrestore(&idp->lock, flags);
 }
 
 /**
@@ -504,13 +604,14 @@ void idr_destroy(struct idr *idp)
 {
     idr_remove_all(idp);
     idp->top = NULL;
+    // free_list中的节点从来没有被发布过, 可以直接释放
     while (idp->id_free_cnt)
-        __idr_layer_free(__get_from_free_list(idp));
+        kfree(__get_from_free_list(idp));
     idp->free_list = NULL;
 }
 
 /**
- * @brief 返回id对应的数据指针
+ * @brief 返回id对应的数据指针 (不加锁, 在RCU读临界区内遍历)
  *
  * @param idp
  * @param id
@@ -519,46 +620,43 @@ void idr_destroy(struct idr *idp)
 void *idr_find(struct idr *idp, int id)
 {
     int64_t __id = (int64_t)id;
-    if (unlikely(idp->top == NULL || __id < 0))
+    if (unlikely(__id < 0))
+        return NULL;
+
+    rcu_read_lock();
+    struct idr_layer *cur_layer = rcu_dereference(idp->top);
+    if (unlikely(cur_layer == NULL))
     {
-        // kwarn("idr-find: idp->top == NULL || id < 0.");
+        rcu_read_unlock();
         return NULL;
     }
 
-    struct idr_layer *cur_layer = idp->top;
-    int layer = cur_layer->layer; // 特判NULL
-    barrier();
+    int layer = cur_layer->layer;
     // 如果查询的ID的bit数量比layer*IDR_BITS还大, 直接返回NULL
     if ((__id >> ((layer + 1) * IDR_BITS)) > 0)
+    {
+        rcu_read_unlock();
         return NULL;
-    barrier();
-    barrier();
+    }
+
     int64_t layer_id = 0;
     while (layer >= 0 && cur_layer != NULL)
     {
-        barrier();
         layer_id = (__id >> (IDR_BITS * layer)) & IDR_MASK;
-        barrier();
-        cur_layer = cur_layer->ary[layer_id];
+        cur_layer = rcu_dereference(cur_layer->ary[layer_id]);
         --layer;
     }
+    rcu_read_unlock();
     return cur_layer;
 }
 
 /**
- * @brief  返回id大于 start_id 的数据指针(即非空闲id对应的指针), 如果没有则返回NULL; 可以传入nextid指针，获取下一个id;
- * 时间复杂度O(log_64(n)), 空间复杂度O(log_64(n)) 约为 6;
- *
- * @param idp
- * @param start_id
- * @param nextid
- * @return void* (如果分配,将返回该ID对应的数据指针; 否则返回NULL。注意，
- * 返回NULL不一定代表这ID不存在，有可能该ID就是与空指针绑定。)
+ * @brief idr_find_next_getid的实现 (调用者需要处于RCU读临界区内)
  */
-void *idr_find_next_getid(struct idr *idp, int64_t start_id, int *nextid)
+static void *__idr_find_next_getid(struct idr *idp, int64_t start_id, int *nextid)
 {
-    BUG_ON(nextid == NULL);
-    if (unlikely(idp->top == NULL))
+    struct idr_layer *cur_layer = rcu_dereference(idp->top);
+    if (unlikely(cur_layer == NULL))
     {
         *nextid = -1;
         return NULL;
@@ -577,7 +675,6 @@ void *idr_find_next_getid(struct idr *idp, int64_t start_id, int *nextid)
     // memset(state, 0, sizeof(state));
     // memset(pos_i, 0, sizeof(pos_i)); // 必须清空
 
-    struct idr_layer *cur_layer = idp->top;
     bool cur_state = false;
     bool init_flag = true;
     int layer = cur_layer->layer;
@@ -606,8 +703,8 @@ void *idr_find_next_getid(struct idr *idp, int64_t start_id, int *nextid)
             state[layer] = cur_state = true;
         }
 
-        BUG_ON(pos_i[layer] >= 64);
-        unsigned long t_bitmap = (cur_layer->bitmap >> pos_i[layer]);
+        // 最后一个儿子也已经搜索完毕时, pos_i会等于IDR_SIZE
+        unsigned long t_bitmap = pos_i[layer] < IDR_SIZE ? (cur_layer->bitmap >> pos_i[layer]) : 0;
         if (t_bitmap) // 进一步递归到儿子下面去
         {
             int64_t layer_id = __lowbit_id(t_bitmap) + pos_i[layer];
@@ -622,10 +719,19 @@ void *idr_find_next_getid(struct idr *idp, int64_t start_id, int *nextid)
             if (layer == 0)
             {
                 //  找到下一个id: nextid
-                return cur_layer->ary[layer_id];
+                return rcu_dereference(cur_layer->ary[layer_id]);
+            }
+
+            struct idr_layer *son = rcu_dereference(cur_layer->ary[layer_id]);
+            if (unlikely(son == NULL))
+            {
+                // 写者正在删除这棵子树(bitmap还没有更新), 跳过它
+                (*nextid) >>= IDR_BITS;
+                init_flag = false;
+                continue;
             }
 
-            cur_layer = cur_layer->ary[layer_id];
+            cur_layer = son;
             init_flag = true; // 儿子节点第一次入栈, 需要init
             --layer;
         }
@@ -643,6 +749,25 @@ void *idr_find_next_getid(struct idr *idp, int64_t start_id, int *nextid)
     return NULL; // 找不到
 }
 
+/**
+ * @brief  返回id大于 start_id 的数据指针(即非空闲id对应的指针), 如果没有则返回NULL; 可以传入nextid指针，获取下一个id;
+ * 时间复杂度O(log_64(n)), 空间复杂度O(log_64(n)) 约为 6;
+ *
+ * @param idp
+ * @param start_id
+ * @param nextid
+ * @return void* (如果分配,将返回该ID对应的数据指针; 否则返回NULL。注意，
+ * 返回NULL不一定代表这ID不存在，有可能该ID就是与空指针绑定。)
+ */
+void *idr_find_next_getid(struct idr *idp, int64_t start_id, int *nextid)
+{
+    BUG_ON(nextid == NULL);
+    rcu_read_lock();
+    void *ret = __idr_find_next_getid(idp, start_id, nextid);
+    rcu_read_unlock();
+    return ret;
+}
+
 /**
  * @brief 返回id大于 start_id 的数据指针(即非空闲id对应的指针), 如果没有则返回NULL
  *
@@ -678,21 +803,37 @@ int idr_replace_get_old(struct idr *idp, void *ptr, int id, void **old_ptr)
     }
     *old_ptr = NULL;
 
-    if (unlikely(idp->top == NULL || __id < 0))
+    if (unlikely(__id < 0))
         return -EDOM; // 参数错误
 
+    unsigned long flags;
+    spin_lock_irqsave(&idp->lock, flags);
+
+    int ret = 0;
     struct idr_layer *cur_layer = idp->top;
+    if (unlikely(cur_layer == NULL))
+    {
+        ret = -EDOM;
+        goto out;
+    }
+
     int64_t layer = cur_layer->layer;
     // 如果查询的ID的bit数量比layer*IDR_BITS还大, 直接返回NULL
     if ((__id >> ((layer + 1) * IDR_BITS)) > 0)
-        return -EDOM;
+    {
+        ret = -EDOM;
+        goto out;
+    }
 
     while (layer > 0)
     {
         int64_t layer_id = (__id >> (layer * IDR_BITS)) & IDR_MASK;
 
         if (unlikely(NULL == cur_layer->ary[layer_id]))
-            return -ENOMEM;
+        {
+            ret = -ENOMEM;
+            goto out;
+        }
 
         cur_layer = cur_layer->ary[layer_id];
         layer--;
@@ -700,9 +841,12 @@ int idr_replace_get_old(struct idr *idp, void *ptr, int id, void **old_ptr)
 
     __id &= IDR_MASK;
     *old_ptr = cur_layer->ary[__id];
-    cur_layer->ary[__id] = ptr;
+    // 读者读到新指针时, 新的数据已经初始化完毕; 旧的数据需要由调用者在宽限期结束之后再释放
+    rcu_assign_pointer(cur_layer->ary[__id], ptr);
 
-    return 0;
+out:;
+    spin_unlock_irqrestore(&idp->lock, flags);
+    return ret;
 }
 
 /**
@@ -734,10 +878,15 @@ int idr_replace(struct idr *idp, void *ptr, int id)
  */
 bool idr_empty(struct idr *idp)
 {
-    if (idp == NULL || idp->top == NULL || !idp->top->bitmap)
+    if (idp == NULL)
         return true;
 
-    return false;
+    rcu_read_lock();
+    struct idr_layer *top = rcu_dereference(idp->top);
+    bool empty = (top == NULL || !top->bitmap);
+    rcu_read_unlock();
+
+    return empty;
 }
 
 static bool __idr_cnt_pd(struct idr_layer *cur_layer, int layer_id)
@@ -752,26 +901,24 @@ static bool __idr_cnt_pd(struct idr_layer *cur_layer, int layer_id)
     return true;
 }
 
+/**
+ * @brief idr_count的实现 (调用者需要处于RCU读临界区内)
+ */
 static bool __idr_cnt(int layer, int id, struct idr_layer *cur_layer)
 {
     int64_t __id = (int64_t)id;
     while (layer >= 0) // 提取路径
     {
-        barrier();
+        // 写者可能正在删除这棵子树
+        if (unlikely(cur_layer == NULL))
+            return false;
 
         int64_t layer_id = (__id >> (layer * IDR_BITS)) & IDR_MASK;
 
-        barrier();
-
         if (__idr_cnt_pd(cur_layer, layer_id) == false)
             return false;
 
-        barrier();
-
-        barrier();
-        cur_layer = cur_layer->ary[layer_id];
-
-        barrier();
+        cur_layer = rcu_dereference(cur_layer->ary[layer_id]);
         --layer;
     }
     return true;
@@ -788,24 +935,23 @@ static bool __idr_cnt(int layer, int id, struct idr_layer *cur_layer)
 bool idr_count(struct idr *idp, int id)
 {
     int64_t __id = (int64_t)id;
-    barrier();
-    if (unlikely(idp == NULL || idp->top == NULL || __id < 0))
+    if (unlikely(idp == NULL || __id < 0))
         return false;
 
-    barrier();
-    struct idr_layer *cur_layer = idp->top;
-    barrier();
-    int layer = cur_layer->layer;
-
-    // 如果查询的ID的bit数量比 layer*IDR_BITS 还大, 直接返回false
-    if (unlikely((__id >> ((layer + 1ull) * IDR_BITS)) > 0))
+    rcu_read_lock();
+    bool ret = false;
+    struct idr_layer *cur_layer = rcu_dereference(idp->top);
+    if (likely(cur_layer != NULL))
     {
-        BUG_ON(1);
-        return false;
+        int layer = cur_layer->layer;
+
+        // 如果查询的ID的bit数量比 layer*IDR_BITS 还大, 直接返回false (树可能刚刚被其它写者缩小)
+        if ((__id >> ((layer + 1ull) * IDR_BITS)) == 0)
+            ret = __idr_cnt(layer, id, cur_layer);
     }
-    barrier();
+    rcu_read_unlock();
 
-    return __idr_cnt(layer, id, cur_layer);
+    return ret;
 }
 
 /********* ****************************************** ida - idr 函数实现分割线
@@ -821,13 +967,18 @@ void ida_init(struct ida *ida_p)
     idr_init(&ida_p->idr);
 }
 
+static void __ida_bitmap_free_rcu(void *bitmap)
+{
+    kfree(bitmap);
+}
+
 /**
- * @brief 释放bitmap空间
+ * @brief 释放一个已经从idr中删除的bitmap的空间 (ida_count可能还在读它, 在宽限期结束之后才释放)
  *
  */
 static void __ida_bitmap_free(struct ida_bitmap *bitmap)
 {
-    kfree(bitmap);
+    call_rcu(__ida_bitmap_free_rcu, bitmap);
 }
 
 /**
@@ -842,39 +993,36 @@ int ida_preload(struct ida *ida_p, gfp_t gfp_mask)
     if (idr_preload(&ida_p->idr, gfp_mask) != 0)
         return -ENOMEM;
 
-    spin_lock(&ida_p->idr.lock);
+    if (NULL != READ_ONCE(ida_p->free_list))
+        return 0;
+
+    // 在锁外分配, 加锁之后发现其它写者已经分配过了就释放掉
+    struct ida_bitmap *bitmap = kzalloc(sizeof(struct ida_bitmap), gfp_mask);
+    if (NULL == bitmap)
+        return -ENOMEM;
 
+    unsigned long flags;
+    spin_lock_irqsave(&ida_p->idr.lock, flags);
     if (NULL == ida_p->free_list)
     {
-        struct ida_bitmap *bitmap;
-        bitmap = kzalloc(sizeof(struct ida_bitmap), gfp_mask);
-        if (NULL == bitmap)
-        {
-            spin_unlock(&ida_p->idr.lock);
-            return -ENOMEM;
-        }
         ida_p->free_list = bitmap;
+        bitmap = NULL;
     }
+    spin_unlock_irqrestore(&ida_p->idr.lock, flags);
 
-    spin_unlock(&ida_p->idr.lock);
+    if (bitmap != NULL)
+        kfree(bitmap);
     return 0;
 }
 
 /**
- * @brief Get the ida bitmap object
+ * @brief 取出预分配的bitmap (调用者需要持有ida_p->idr.lock)
  *
  * @param ida_p
  * @return void*
  */
-static void *__get_ida_bitmap(struct ida *ida_p, gfp_t gfp_mask)
+static void *__get_ida_bitmap(struct ida *ida_p)
 {
-    if (NULL == ida_p->free_list)
-        if (ida_preload(ida_p, gfp_mask) < 0)
-        {
-            kBUG("error : no memory.");
-            return NULL;
-        }
-
     struct ida_bitmap *tmp = ida_p->free_list;
     ida_p->free_list = NULL;
     return tmp;
@@ -921,38 +1069,64 @@ int ida_alloc(struct ida *ida_p, int *p_id)
     BUG_ON(p_id == NULL);
     *p_id = -1;
 
-    struct idr_layer *stk[MAX_LEVEL + 1] = {0}; // 你可以选择memset(0)
+    // 持有锁的时候不能分配内存: 先预分配idr节点和bitmap, 加锁之后再检查一次
+    unsigned long flags;
+    while (1)
+    {
+        if (ida_preload(ida_p, 0) != 0)
+            return -ENOMEM;
 
-    // memset(stk, 0, sizeof(struct idr_layer *) * (MAX_LEVEL + 1));
+        spin_lock_irqsave(&ida_p->idr.lock, flags);
+        if (ida_p->idr.id_free_cnt >= IDR_FREE_MAX && ida_p->free_list != NULL)
+            break;
+        spin_unlock_irqrestore(&ida_p->idr.lock, flags);
+    }
+
+    int ret = 0;
+    struct idr_layer *stk[MAX_LEVEL + 1] = {0}; // 你可以选择memset(0)
 
-    io_sfence();
     int64_t idr_id = __idr_get_empty_slot(&ida_p->idr, stk);
 
     // 如果stk[0]=NULL,可能是idr内部出错/内存空间不够
     if (unlikely(NULL == stk[0]))
-        return -ENOMEM;
+    {
+        ret = -ENOMEM;
+        goto out;
+    }
 
     if (unlikely(idr_id < 0))
-        return idr_id;
+    {
+        ret = idr_id;
+        goto out;
+    }
 
     int64_t layer_id = idr_id & IDR_MASK;
 
+    // bitmap初始化为全0之后才发布
     if (NULL == stk[0]->ary[layer_id])
-        stk[0]->ary[layer_id] = __get_ida_bitmap(ida_p, 0);
+        rcu_assign_pointer(stk[0]->ary[layer_id], __get_ida_bitmap(ida_p));
 
     if (unlikely(NULL == stk[0]->ary[layer_id]))
-        return -ENOMEM;
+    {
+        ret = -ENOMEM;
+        goto out;
+    }
 
     struct ida_bitmap *bmp = (struct ida_bitmap *)stk[0]->ary[layer_id];
     int low_id = __get_id_from_bitmap(bmp);
 
     if (unlikely(low_id < 0))
-        return low_id;
+    {
+        ret = low_id;
+        goto out;
+    }
 
     *p_id = idr_id * IDA_BITMAP_BITS + low_id;
     __idr_mark_full(&ida_p->idr, idr_id, stk, (bmp->count == IDA_FULL ? 2 : 1));
 
-    return 0;
+out:;
+    spin_unlock_irqrestore(&ida_p->idr.lock, flags);
+    return ret;
 }
 
 /**
@@ -966,18 +1140,22 @@ int ida_alloc(struct ida *ida_p, int *p_id)
 bool ida_count(struct ida *ida_p, int id)
 {
     int64_t __id = (int64_t)id;
-    if (unlikely(NULL == ida_p || NULL == ida_p->idr.top || id < 0))
+    if (unlikely(NULL == ida_p || id < 0))
         return false;
 
     int idr_id = __id / IDA_BITMAP_BITS;
     int ary_id = (__id % IDA_BITMAP_BITS) / IDA_BMP_SIZE;
     int bmp_id = (__id % IDA_BITMAP_BITS) % IDA_BMP_SIZE;
 
+    // bitmap在宽限期结束之后才会被释放
+    rcu_read_lock();
+    bool ret = false;
     struct ida_bitmap *bmp = idr_find(&ida_p->idr, idr_id);
-    if (NULL == bmp)
-        return false;
+    if (NULL != bmp)
+        ret = ((READ_ONCE(bmp->bitmap[ary_id]) >> bmp_id) & 1);
+    rcu_read_unlock();
 
-    return ((bmp->bitmap[ary_id] >> bmp_id) & 1);
+    return ret;
 }
 
 /**
@@ -989,24 +1167,27 @@ bool ida_count(struct ida *ida_p, int id)
 void ida_remove(struct ida *ida_p, int id)
 {
     int64_t __id = (int64_t)id;
-    if (unlikely(NULL == ida_p || NULL == ida_p->idr.top || id < 0))
+    if (unlikely(NULL == ida_p || id < 0))
         return;
 
     int64_t idr_id = __id / IDA_BITMAP_BITS;
     int64_t ary_id = (__id % IDA_BITMAP_BITS) / IDA_BMP_SIZE;
     int64_t bmp_id = (__id % IDA_BITMAP_BITS) % IDA_BMP_SIZE;
 
+    unsigned long flags;
+    spin_lock_irqsave(&ida_p->idr.lock, flags);
+
     struct idr_layer *stk[MAX_LEVEL + 1] = {0};
     // memset(stk, 0, sizeof(struct idr_layer *) * (MAX_LEVEL + 1));
 
-    if (0 == __idr_get_path(&ida_p->idr, idr_id, stk))
-        return;
+    if (NULL == ida_p->idr.top || 0 == __idr_get_path(&ida_p->idr, idr_id, stk))
+        goto out;
 
     struct ida_bitmap *b_p = (struct ida_bitmap *)(stk[0]->ary[idr_id & IDR_MASK]);
 
     // 不存在这个ID 或者 b_p == NULL
     if (unlikely(NULL == b_p || 0 == ((b_p->bitmap[ary_id] >> bmp_id) & 1)))
-        return;
+        goto out;
 
     b_p->count--; // 更新了ida_count
     b_p->bitmap[ary_id] ^= (1ull << bmp_id);
@@ -1015,9 +1196,12 @@ void ida_remove(struct ida *ida_p, int id)
     if (0 == b_p->count)
     {
         __ida_bitmap_free(b_p);
-        if (stk[0])                                // stk[0] 有可能在 __idr_erase_full 里面已经kfree了
-            stk[0]->ary[idr_id & IDR_MASK] = NULL; // 记得设置为空
+        if (stk[0])                                                   // stk[0] 有可能在 __idr_erase_full 里面已经被释放了
+            rcu_assign_pointer(stk[0]->ary[idr_id & IDR_MASK], NULL); // 记得设置为空
     }
+
+out:;
+    spin_unlock_irqrestore(&ida_p->idr.lock, flags);
 }
 
 /**
@@ -1034,7 +1218,8 @@ void ida_destroy(struct ida *ida_p)
 
     __idr_destroy_with_free(&ida_p->idr);
     ida_p->idr.top = NULL;
-    __ida_bitmap_free(ida_p->free_list);
+    // 预分配的bitmap从来没有被发布过, 可以直接释放
+    kfree(ida_p->free_list);
     ida_p->free_list = NULL;
 }
 
@@ -1047,8 +1232,8 @@ void ida_destroy(struct ida *ida_p)
  */
 bool ida_empty(struct ida *ida_p)
 {
-    if (ida_p == NULL || ida_p->idr.top == NULL || !ida_p->idr.top->bitmap)
+    if (ida_p == NULL)
         return true;
 
-    return false;
+    return idr_empty(&ida_p->idr);
 }
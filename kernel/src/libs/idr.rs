@@ -0,0 +1,216 @@
+//! ID到对象的映射（对`libs/idr.c`的封装）
+//!
+//! 把非负的整数ID映射到`Arc<T>`，适用于按ID查找对象的热点路径（进程表、设备号等）。
+//!
+//! - 查找不加锁：在RCU读临界区内遍历基数树，不会与写者争抢同一个锁
+//! - 分配、插入、删除、替换之间由idr内部的自旋锁互斥，调用者不需要额外加锁
+//! - idr自己持有每个对象的一个引用。对象被删除或者被替换之后，这个引用在宽限期结束之后才被释放，
+//!   因此读者在读临界区内拿到的`&T`一直有效
+
+use core::{cell::UnsafeCell, ffi::c_void, marker::PhantomData, ptr::null_mut};
+
+use alloc::{sync::Arc, vec::Vec};
+
+use crate::{
+    include::bindings::bindings::{
+        idr, idr_alloc, idr_alloc_at, idr_destroy, idr_find, idr_find_next_getid, idr_init,
+        idr_remove, idr_replace_get_old,
+    },
+    syscall::SystemError,
+};
+
+use super::rcu::{call_rcu, rcu_read_lock, RcuReadGuard};
+
+/// 把旧对象的指针传给RCU回调函数
+struct IdrStale<T>(*const T);
+
+unsafe impl<T: Send + Sync> Send for IdrStale<T> {}
+
+pub struct Idr<T: Send + Sync + 'static> {
+    inner: UnsafeCell<idr>,
+    _marker: PhantomData<Arc<T>>,
+}
+
+unsafe impl<T: Send + Sync> Send for Idr<T> {}
+unsafe impl<T: Send + Sync> Sync for Idr<T> {}
+
+impl<T: Send + Sync + 'static> Idr<T> {
+    pub fn new() -> Self {
+        let mut inner: idr = unsafe { core::mem::zeroed() };
+        unsafe { idr_init(&mut inner) };
+        return Self {
+            inner: UnsafeCell::new(inner),
+            _marker: PhantomData,
+        };
+    }
+
+    #[inline(always)]
+    fn raw(&self) -> *mut idr {
+        return self.inner.get();
+    }
+
+    /// 把C函数返回的错误码转换为SystemError
+    fn errno(r: i32) -> SystemError {
+        return SystemError::from_posix_errno(r).unwrap_or(SystemError::EINVAL);
+    }
+
+    /// 分配最小的空闲ID，并与`value`绑定
+    pub fn alloc(&self, value: Arc<T>) -> Result<usize, SystemError> {
+        let ptr = Arc::into_raw(value) as *mut c_void;
+        let mut id: i32 = -1;
+        let r = unsafe { idr_alloc(self.raw(), ptr, &mut id) };
+        if r != 0 {
+            drop(unsafe { Arc::from_raw(ptr as *const T) });
+            return Err(Self::errno(r));
+        }
+        return Ok(id as usize);
+    }
+
+    /// 把指定的`id`与`value`绑定
+    ///
+    /// ## 返回值
+    ///
+    /// - `Err(SystemError::EEXIST)`：这个ID已经被分配
+    pub fn insert(&self, id: usize, value: Arc<T>) -> Result<(), SystemError> {
+        if id > i32::MAX as usize {
+            return Err(SystemError::EINVAL);
+        }
+        let ptr = Arc::into_raw(value) as *mut c_void;
+        let r = unsafe { idr_alloc_at(self.raw(), ptr, id as i32) };
+        if r != 0 {
+            drop(unsafe { Arc::from_raw(ptr as *const T) });
+            return Err(Self::errno(r));
+        }
+        return Ok(());
+    }
+
+    /// 在读临界区内访问`id`对应的对象
+    #[inline]
+    pub fn get<'a>(&'a self, id: usize, _guard: &'a RcuReadGuard) -> Option<&'a T> {
+        if id > i32::MAX as usize {
+            return None;
+        }
+        let ptr = unsafe { idr_find(self.raw(), id as i32) } as *const T;
+        return unsafe { ptr.as_ref() };
+    }
+
+    /// 获取`id`对应的对象的引用计数指针，可以在读临界区之外使用
+    pub fn get_arc(&self, id: usize) -> Option<Arc<T>> {
+        let guard = rcu_read_lock();
+        let obj = self.get(id, &guard)?;
+        // 宽限期结束之前，idr持有的引用不会被释放，因此可以安全地增加引用计数
+        unsafe {
+            let ptr = obj as *const T;
+            Arc::increment_strong_count(ptr);
+            return Some(Arc::from_raw(ptr));
+        }
+    }
+
+    /// idr持有的引用在宽限期结束之后释放
+    fn release_rcu(ptr: *const T) {
+        let stale = IdrStale(ptr);
+        call_rcu(move || {
+            let stale = stale;
+            drop(unsafe { Arc::from_raw(stale.0) });
+        });
+    }
+
+    /// 删除`id`，返回它对应的对象
+    pub fn remove(&self, id: usize) -> Option<Arc<T>> {
+        if id > i32::MAX as usize {
+            return None;
+        }
+        let ptr = unsafe { idr_remove(self.raw(), id as i32) } as *const T;
+        if ptr.is_null() {
+            return None;
+        }
+        let obj = unsafe {
+            Arc::increment_strong_count(ptr);
+            Arc::from_raw(ptr)
+        };
+        Self::release_rcu(ptr);
+        return Some(obj);
+    }
+
+    /// 用`value`替换`id`对应的对象，返回旧的对象
+    pub fn replace(&self, id: usize, value: Arc<T>) -> Result<Arc<T>, SystemError> {
+        if id > i32::MAX as usize {
+            return Err(SystemError::EINVAL);
+        }
+        let new = Arc::into_raw(value) as *mut c_void;
+        let mut old: *mut c_void = null_mut();
+        let r = unsafe { idr_replace_get_old(self.raw(), new, id as i32, &mut old) };
+        if r != 0 || old.is_null() {
+            if r == 0 {
+                // 这个ID原本没有绑定对象，恢复原状
+                let mut cur: *mut c_void = null_mut();
+                unsafe { idr_replace_get_old(self.raw(), null_mut(), id as i32, &mut cur) };
+            }
+            drop(unsafe { Arc::from_raw(new as *const T) });
+            return Err(if r != 0 {
+                Self::errno(r)
+            } else {
+                SystemError::ENOENT
+            });
+        }
+        let old = old as *const T;
+        let obj = unsafe {
+            Arc::increment_strong_count(old);
+            Arc::from_raw(old)
+        };
+        Self::release_rcu(old);
+        return Ok(obj);
+    }
+
+    /// 按照ID从小到大的顺序，在同一个读临界区内访问所有对象（`f`不能睡眠）
+    pub fn for_each<F: FnMut(usize, &T)>(&self, mut f: F) {
+        let _guard = rcu_read_lock();
+        let mut id: i32 = -1;
+        loop {
+            let mut next: i32 = -1;
+            let ptr = unsafe { idr_find_next_getid(self.raw(), id as i64, &mut next) } as *const T;
+            if next < 0 {
+                break;
+            }
+            if let Some(obj) = unsafe { ptr.as_ref() } {
+                f(next as usize, obj);
+            }
+            id = next;
+        }
+    }
+
+    /// 所有对象的ID以及引用计数指针
+    pub fn collect(&self) -> Vec<(usize, Arc<T>)> {
+        let mut v = Vec::new();
+        self.for_each(|id, obj| unsafe {
+            let ptr = obj as *const T;
+            Arc::increment_strong_count(ptr);
+            v.push((id, Arc::from_raw(ptr)));
+        });
+        return v;
+    }
+}
+
+impl<T: Send + Sync + 'static> Default for Idr<T> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<T: Send + Sync + 'static> Drop for Idr<T> {
+    fn drop(&mut self) {
+        // 能够被drop说明已经没有读者持有它的引用了
+        let mut ptrs = Vec::new();
+        self.for_each(|_, obj| ptrs.push(obj as *const T));
+        unsafe { idr_destroy(self.raw()) };
+        for ptr in ptrs {
+            drop(unsafe { Arc::from_raw(ptr) });
+        }
+    }
+}
+
+impl<T: Send + Sync + 'static> core::fmt::Debug for Idr<T> {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        f.debug_struct("Idr").finish_non_exhaustive()
+    }
+}
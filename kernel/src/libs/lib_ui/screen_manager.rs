@@ -1,6 +1,7 @@
 use core::{
     fmt::Debug,
     intrinsics::unlikely,
+    ops::Range,
     sync::atomic::{AtomicBool, AtomicU32, Ordering},
 };
 
@@ -27,6 +28,23 @@ pub static CURRENT_FRAMEWORK: RwLock<Option<Arc<dyn ScmUiFramework>>> = RwLock::
 /// 是否启用双缓冲
 pub static SCM_DOUBLE_BUFFER_ENABLED: AtomicBool = AtomicBool::new(false);
 
+/// 双缓冲区中被修改过、还没有刷新到显存的像素行的范围[start, end)
+static SCM_DIRTY_ROWS: SpinLock<Option<(u32, u32)>> = SpinLock::new(None);
+
+/// 标记双缓冲区中[start, end)像素行需要刷新到显存
+pub fn scm_mark_dirty(start: u32, end: u32) {
+    let mut dirty = SCM_DIRTY_ROWS.lock_irqsave();
+    *dirty = match *dirty {
+        Some((s, e)) => Some((s.min(start), e.max(end))),
+        None => Some((start, end)),
+    };
+}
+
+/// 取出需要刷新到显存的像素行范围，并清空它
+pub fn scm_take_dirty() -> Option<Range<u32>> {
+    return SCM_DIRTY_ROWS.lock_irqsave().take().map(|(s, e)| s..e);
+}
+
 bitflags! {
   pub struct ScmBufferFlag:u8 {
     // 帧缓冲区标志位
@@ -188,6 +206,9 @@ impl ScmBufferInfo {
                         double_buffer_guard.as_mut().copy_from_slice(x.as_ref());
                     }
                 };
+                drop(double_buffer_guard);
+                // 整个双缓冲区的内容都变了
+                scm_mark_dirty(0, self.height);
             }
         }
     }
@@ -21,7 +21,7 @@ use core::{
 
 use super::{
     screen_manager::{
-        scm_register, ScmBuffer, ScmBufferInfo, ScmFramworkType, ScmUiFramework,
+        scm_mark_dirty, scm_register, ScmBuffer, ScmBufferInfo, ScmFramworkType, ScmUiFramework,
         ScmUiFrameworkMetadata,
     },
     textui_no_alloc::no_init_textui_putchar_window,
@@ -276,11 +276,16 @@ pub struct TextuiCharChromatic {
 pub struct TextuiBuf<'a> {
     buf: Option<&'a mut [u32]>,
     guard: Option<SpinLockGuard<'a, Box<[u32]>>>,
+    /// 缓冲区的宽度（像素）
+    width: usize,
+    /// 修改过的像素行的范围[start, end)。写入的是双缓冲区时，drop时通知屏幕管理器把这些行刷新到显存
+    dirty: Option<(u32, u32)>,
 }
 
 impl TextuiBuf<'_> {
     pub fn new(buf: &mut ScmBufferInfo) -> TextuiBuf {
         let len = buf.buf_size() / 4;
+        let width = buf.width() as usize;
 
         match &buf.buf {
             ScmBuffer::DeviceBuffer(vaddr) => {
@@ -289,6 +294,8 @@ impl TextuiBuf<'_> {
                         core::slice::from_raw_parts_mut(vaddr.data() as *mut u32, len)
                     }),
                     guard: None,
+                    width,
+                    dirty: None,
                 };
             }
 
@@ -298,11 +305,39 @@ impl TextuiBuf<'_> {
                 return TextuiBuf {
                     buf: None,
                     guard: Some(guard),
+                    width,
+                    dirty: None,
                 };
             }
         }
     }
 
+    /// 写入字形的一行像素
+    ///
+    /// ## 参数
+    /// - index 这一行像素的起始位置
+    /// - row 这一行的像素
+    #[inline]
+    pub fn put_glyph_row(&mut self, index: usize, row: &[u32; TEXTUI_CHAR_WIDTH as usize]) {
+        self.buf_mut()[index..index + TEXTUI_CHAR_WIDTH as usize].copy_from_slice(row);
+    }
+
+    /// 标记[start, end)像素行被修改过
+    pub fn mark_dirty(&mut self, start: u32, end: u32) {
+        self.dirty = match self.dirty {
+            Some((s, e)) => Some((s.min(start), e.max(end))),
+            None => Some((start, end)),
+        };
+    }
+
+    /// 把[rows, total_rows)像素行整体上移rows行（一次memmove），空出的最后rows行保持原样，由调用者重新渲染
+    pub fn scroll_up(&mut self, rows: usize, total_rows: usize) {
+        let width = self.width;
+        self.buf_mut()
+            .copy_within(rows * width..total_rows * width, 0);
+        self.mark_dirty(0, total_rows as u32);
+    }
+
     pub fn buf_mut(&mut self) -> &mut [u32] {
         if let Some(buf) = &mut self.buf {
             return buf;
@@ -333,6 +368,14 @@ impl TextuiBuf<'_> {
     }
 }
 
+impl Drop for TextuiBuf<'_> {
+    fn drop(&mut self) {
+        if let (Some(_), Some((start, end))) = (&self.guard, self.dirty) {
+            scm_mark_dirty(start, end);
+        }
+    }
+}
+
 #[derive(Debug, Copy, Clone, Eq, PartialEq, PartialOrd, Ord, Hash)]
 pub struct Font([u8; 16]);
 impl Font {
@@ -369,33 +412,43 @@ impl TextuiCharChromatic {
         lineid: LineId,
         lineindex: LineIndex,
     ) -> Result<i32, SystemError> {
-        // 找到要渲染的字符的像素点数据
+        let mut _binding = textui_framework().metadata.read().buf_info();
 
-        let font: Font = Font::get_font(self.c.unwrap_or(' '));
+        let mut buf = TextuiBuf::new(&mut _binding);
+        self.render(&mut buf, lineid, lineindex);
 
-        let mut count = TextuiBuf::get_start_index_by_lineid_lineindex(lineid, lineindex);
+        return Ok(0);
+    }
 
-        let mut _binding = textui_framework().metadata.read().buf_info();
+    /// 将该字符对象输出到已经获取的缓冲区中
+    ///
+    /// 字形的每一行先在栈上展开成像素，再整行写入缓冲区
+    pub fn render(&self, buf: &mut TextuiBuf, lineid: LineId, lineindex: LineIndex) {
+        // 找到要渲染的字符的像素点数据
+        let font: Font = Font::get_font(self.c.unwrap_or(' '));
+        let frcolor: u32 = self.frcolor.into();
+        let bkcolor: u32 = self.bkcolor.into();
 
-        let mut buf = TextuiBuf::new(&mut _binding);
+        let x: u32 = <LineIndex as Into<u32>>::into(lineindex) * TEXTUI_CHAR_WIDTH;
+        let y: u32 = <LineId as Into<u32>>::into(lineid) * TEXTUI_CHAR_HEIGHT;
+        let mut index = buf.width * y as usize + x as usize;
 
         // 在缓冲区画出一个字体，每个字体有TEXTUI_CHAR_HEIGHT行，TEXTUI_CHAR_WIDTH列个像素点
-        for i in 0..TEXTUI_CHAR_HEIGHT {
-            let start = count;
-            for j in 0..TEXTUI_CHAR_WIDTH {
-                if font.is_frcolor(i as usize, j as usize) {
-                    // 字，显示前景色
-                    buf.put_color_in_pixel(self.frcolor.into(), count);
+        let mut row = [0u32; TEXTUI_CHAR_WIDTH as usize];
+        for i in 0..TEXTUI_CHAR_HEIGHT as usize {
+            // 与no_init_textui_render_chromatic相同：第j列对应字形的第(8-j)位
+            let bits = font.0[i] as u32;
+            for (j, pixel) in row.iter_mut().enumerate() {
+                *pixel = if bits & (0x100 >> j) != 0 {
+                    frcolor
                 } else {
-                    // 背景色
-                    buf.put_color_in_pixel(self.bkcolor.into(), count);
-                }
-                count += 1;
+                    bkcolor
+                };
             }
-            count = TextuiBuf::get_index_of_next_line(start);
+            buf.put_glyph_row(index, &row);
+            index += buf.width;
         }
-
-        return Ok(0);
+        buf.mark_dirty(y, y + TEXTUI_CHAR_HEIGHT);
     }
 
     pub fn no_init_textui_render_chromatic(&self, lineid: LineId, lineindex: LineIndex) {
@@ -577,14 +630,19 @@ impl TextuiWindow {
 
         // 将此窗口的某个虚拟行的连续n个字符对象往缓存区写入
         if self.flags.contains(WindowFlag::TEXTUI_CHROMATIC) {
+            let mut binding = textui_framework().metadata.read().buf_info();
+            let mut buf = TextuiBuf::new(&mut binding);
             let vline = &mut self.vlines[<LineId as Into<usize>>::into(vline_id)];
             let mut i = 0;
             let mut index = start;
 
             while i < count {
                 if let TextuiVline::Chromatic(vline) = vline {
-                    vline.chars[<LineIndex as Into<usize>>::into(index)]
-                        .textui_refresh_character(actual_line_id, index)?;
+                    vline.chars[<LineIndex as Into<usize>>::into(index)].render(
+                        &mut buf,
+                        actual_line_id,
+                        index,
+                    );
 
                     index = index + 1;
                 }
@@ -668,8 +726,8 @@ impl TextuiWindow {
                 self.top_vline = LineId::new(0);
             }
 
-            // 刷新所有行
-            self.textui_refresh_vlines(self.top_vline, actual_line_sum)?;
+            // 已经显示的行整体上移一行，只需要渲染新的最后一行
+            self.textui_scroll_up(actual_line_sum)?;
         } else {
             //换行说明上一行已经在缓冲区中，所以已经使用的虚拟行总数+1
             self.vlines_used += 1;
@@ -678,6 +736,18 @@ impl TextuiWindow {
         return Ok(0);
     }
 
+    /// 屏幕向上滚动一行：用一次memmove把第1行到最后一行的像素上移，然后渲染新的最后一行（即正在操作的虚拟行）
+    fn textui_scroll_up(&mut self, actual_line_sum: i32) -> Result<(), SystemError> {
+        let mut binding = textui_framework().metadata.read().buf_info();
+        let mut buf = TextuiBuf::new(&mut binding);
+        buf.scroll_up(
+            TEXTUI_CHAR_HEIGHT as usize,
+            actual_line_sum as usize * TEXTUI_CHAR_HEIGHT as usize,
+        );
+        drop(buf);
+        return self.textui_refresh_vline(self.vline_operating);
+    }
+
     /// 真正向窗口的缓冲区上输入字符的函数(位置为window.vline_operating，window.vline_operating.index)
     /// ## 参数
     /// - window
@@ -0,0 +1,431 @@
+//! 锁的竞争统计（需要启用`lockstat`特性）
+//!
+//! 以锁的种类和它保护的数据的类型作为锁的类别（例如`RwLock<HashMap<Pid, Arc<ProcessControlBlock>>>`的写者），
+//! 统计每个类别的加锁次数、竞争次数、等待时间的总和与最大值、持有时间的最大值，以及竞争最多的几个加锁位置。
+//!
+//! 加锁和放锁时只使用原子操作，不加锁、不分配内存。类别保存在一个固定大小的静态表中，
+//! 每个锁缓存自己的类别，只在第一次加锁时查表。
+//!
+//! 没有启用`lockstat`特性时，这里的类型都是零大小的，函数都是空的，不会影响锁的性能。
+//!
+//! `/proc/lock_stat`：读取得到按竞争次数排序的统计结果，写入`0`清空统计结果
+
+#[cfg(feature = "lockstat")]
+use core::{
+    fmt::Write,
+    panic::Location,
+    ptr::null_mut,
+    sync::atomic::{AtomicPtr, AtomicU32, AtomicU64, Ordering},
+};
+
+#[cfg(feature = "lockstat")]
+use alloc::vec::Vec;
+
+#[cfg(feature = "lockstat")]
+use crate::{
+    arch::{driver::tsc::TSCManager, CurrentTimeArch},
+    time::TimeArch,
+};
+use crate::{filesystem::vfs::seq_file::SeqBuf, syscall::SystemError};
+
+/// 锁的种类
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum LockKind {
+    Spin = 0,
+    Mutex = 1,
+    RwRead = 2,
+    /// RwLock的写者和upgrader
+    RwWrite = 3,
+}
+
+impl LockKind {
+    #[cfg(feature = "lockstat")]
+    const NAMES: [&'static str; 4] = ["spin", "mutex", "rw-read", "rw-write"];
+}
+
+/// 获得锁的位置。启用`lockstat`特性时，加锁函数带有`#[track_caller]`，这里是调用者的位置
+#[cfg(feature = "lockstat")]
+pub type LockSite = &'static Location<'static>;
+#[cfg(not(feature = "lockstat"))]
+pub type LockSite = ();
+
+/// 当前加锁操作的调用位置
+#[inline(always)]
+#[cfg_attr(feature = "lockstat", track_caller)]
+pub fn lock_site() -> LockSite {
+    #[cfg(feature = "lockstat")]
+    return Location::caller();
+}
+
+/// 锁缓存的类别，第一次加锁时查找
+#[derive(Debug)]
+pub struct LockClassCache {
+    #[cfg(feature = "lockstat")]
+    class: AtomicPtr<LockClass>,
+}
+
+impl LockClassCache {
+    pub const fn new() -> Self {
+        return Self {
+            #[cfg(feature = "lockstat")]
+            class: AtomicPtr::new(null_mut()),
+        };
+    }
+
+    /// 记录一次没有竞争的加锁
+    #[inline(always)]
+    pub fn acquired<T: ?Sized>(&self, kind: LockKind) -> LockHold {
+        #[cfg(feature = "lockstat")]
+        if let Some(class) = self.get::<T>(kind) {
+            class.acquisitions.fetch_add(1, Ordering::Relaxed);
+            return LockHold {
+                class: Some(class),
+                since: CurrentTimeArch::get_cycles() as u64,
+            };
+        }
+        let _ = kind;
+        return LockHold::NONE;
+    }
+
+    /// 记录一次有竞争的加锁：从`wait_start`开始等待，在`site`获得了锁
+    #[inline(always)]
+    pub fn contended<T: ?Sized>(
+        &self,
+        kind: LockKind,
+        wait_start: LockTime,
+        site: LockSite,
+    ) -> LockHold {
+        #[cfg(feature = "lockstat")]
+        if let Some(class) = self.get::<T>(kind) {
+            let now = CurrentTimeArch::get_cycles() as u64;
+            class.record_contention(now.saturating_sub(wait_start), site);
+            return LockHold {
+                class: Some(class),
+                since: now,
+            };
+        }
+        let _ = (kind, wait_start, site);
+        return LockHold::NONE;
+    }
+
+    #[cfg(feature = "lockstat")]
+    #[inline]
+    fn get<T: ?Sized>(&self, kind: LockKind) -> Option<&'static LockClass> {
+        let class = self.class.load(Ordering::Relaxed);
+        if !class.is_null() {
+            return Some(unsafe { &*class });
+        }
+        let class = lock_class_lookup(kind, core::any::type_name::<T>())?;
+        self.class
+            .store(class as *const _ as *mut LockClass, Ordering::Relaxed);
+        return Some(class);
+    }
+}
+
+/// 等待开始的时间
+#[cfg(feature = "lockstat")]
+pub type LockTime = u64;
+#[cfg(not(feature = "lockstat"))]
+pub type LockTime = ();
+
+/// 开始等待锁
+#[inline(always)]
+pub fn wait_start() -> LockTime {
+    #[cfg(feature = "lockstat")]
+    return CurrentTimeArch::get_cycles() as u64;
+}
+
+/// 保存在锁的守卫中，放锁时统计持有时间
+#[derive(Debug)]
+pub struct LockHold {
+    #[cfg(feature = "lockstat")]
+    class: Option<&'static LockClass>,
+    #[cfg(feature = "lockstat")]
+    since: u64,
+}
+
+impl LockHold {
+    /// 不统计持有时间（try_lock获得的锁，以及守卫之间的转换）
+    pub const NONE: Self = Self {
+        #[cfg(feature = "lockstat")]
+        class: None,
+        #[cfg(feature = "lockstat")]
+        since: 0,
+    };
+
+    /// 放锁。可以被调用多次，只有第一次有效
+    #[inline(always)]
+    pub fn release(&mut self) {
+        #[cfg(feature = "lockstat")]
+        if let Some(class) = self.class.take() {
+            let held = (CurrentTimeArch::get_cycles() as u64).saturating_sub(self.since);
+            class.hold_max.fetch_max(held, Ordering::Relaxed);
+        }
+    }
+}
+
+/// 每个类别记录的竞争最多的加锁位置的数量
+#[cfg(feature = "lockstat")]
+const LOCKSTAT_SITES: usize = 8;
+/// 类别表的大小（必须是2的幂）
+#[cfg(feature = "lockstat")]
+const LOCKSTAT_CLASSES: usize = 1024;
+
+#[cfg(feature = "lockstat")]
+const CLASS_EMPTY: u32 = 0;
+#[cfg(feature = "lockstat")]
+const CLASS_INIT: u32 = 1;
+#[cfg(feature = "lockstat")]
+const CLASS_READY: u32 = 2;
+
+/// 一个加锁位置上的竞争
+#[cfg(feature = "lockstat")]
+#[derive(Debug)]
+struct LockSiteStat {
+    site: AtomicPtr<Location<'static>>,
+    contentions: AtomicU64,
+    wait_total: AtomicU64,
+}
+
+/// 一个锁类别的统计信息
+#[cfg(feature = "lockstat")]
+#[derive(Debug)]
+pub struct LockClass {
+    state: AtomicU32,
+    kind: AtomicU32,
+    name: AtomicPtr<u8>,
+    name_len: AtomicU64,
+    acquisitions: AtomicU64,
+    contentions: AtomicU64,
+    wait_total: AtomicU64,
+    wait_max: AtomicU64,
+    hold_max: AtomicU64,
+    sites: [LockSiteStat; LOCKSTAT_SITES],
+    /// 没有位置可以记录的竞争次数
+    other_sites: AtomicU64,
+}
+
+#[cfg(feature = "lockstat")]
+impl LockClass {
+    const INIT: Self = {
+        const SITE: LockSiteStat = LockSiteStat {
+            site: AtomicPtr::new(null_mut()),
+            contentions: AtomicU64::new(0),
+            wait_total: AtomicU64::new(0),
+        };
+        Self {
+            state: AtomicU32::new(CLASS_EMPTY),
+            kind: AtomicU32::new(0),
+            name: AtomicPtr::new(null_mut()),
+            name_len: AtomicU64::new(0),
+            acquisitions: AtomicU64::new(0),
+            contentions: AtomicU64::new(0),
+            wait_total: AtomicU64::new(0),
+            wait_max: AtomicU64::new(0),
+            hold_max: AtomicU64::new(0),
+            sites: [SITE; LOCKSTAT_SITES],
+            other_sites: AtomicU64::new(0),
+        }
+    };
+
+    fn name(&self) -> &'static str {
+        let ptr = self.name.load(Ordering::Relaxed);
+        let len = self.name_len.load(Ordering::Relaxed) as usize;
+        return unsafe { core::str::from_utf8_unchecked(core::slice::from_raw_parts(ptr, len)) };
+    }
+
+    fn matches(&self, kind: LockKind, name: &str) -> bool {
+        return self.kind.load(Ordering::Relaxed) == kind as u32 && self.name() == name;
+    }
+
+    fn record_contention(&self, wait: u64, site: LockSite) {
+        self.acquisitions.fetch_add(1, Ordering::Relaxed);
+        self.contentions.fetch_add(1, Ordering::Relaxed);
+        self.wait_total.fetch_add(wait, Ordering::Relaxed);
+        self.wait_max.fetch_max(wait, Ordering::Relaxed);
+
+        let site = site as *const Location<'static> as *mut Location<'static>;
+        for s in self.sites.iter() {
+            let mut cur = s.site.load(Ordering::Acquire);
+            if cur.is_null() {
+                cur = match s.site.compare_exchange(
+                    null_mut(),
+                    site,
+                    Ordering::AcqRel,
+                    Ordering::Acquire,
+                ) {
+                    Ok(_) => site,
+                    Err(other) => other,
+                };
+            }
+            if cur == site {
+                s.contentions.fetch_add(1, Ordering::Relaxed);
+                s.wait_total.fetch_add(wait, Ordering::Relaxed);
+                return;
+            }
+        }
+        self.other_sites.fetch_add(1, Ordering::Relaxed);
+    }
+
+    fn reset(&self) {
+        self.acquisitions.store(0, Ordering::Relaxed);
+        self.contentions.store(0, Ordering::Relaxed);
+        self.wait_total.store(0, Ordering::Relaxed);
+        self.wait_max.store(0, Ordering::Relaxed);
+        self.hold_max.store(0, Ordering::Relaxed);
+        self.other_sites.store(0, Ordering::Relaxed);
+        for s in self.sites.iter() {
+            s.contentions.store(0, Ordering::Relaxed);
+            s.wait_total.store(0, Ordering::Relaxed);
+        }
+    }
+}
+
+#[cfg(feature = "lockstat")]
+static LOCK_CLASSES: [LockClass; LOCKSTAT_CLASSES] = [LockClass::INIT; LOCKSTAT_CLASSES];
+
+/// 类别表已满，没有被统计的锁类别的数量
+#[cfg(feature = "lockstat")]
+static LOCK_CLASSES_OVERFLOW: AtomicU64 = AtomicU64::new(0);
+
+/// 查找（不存在时创建）锁类别。类别表已满时返回None
+#[cfg(feature = "lockstat")]
+fn lock_class_lookup(kind: LockKind, name: &'static str) -> Option<&'static LockClass> {
+    // FNV-1a
+    let mut hash: u64 = 0xcbf29ce484222325 ^ kind as u64;
+    for b in name.bytes() {
+        hash = (hash ^ b as u64).wrapping_mul(0x100000001b3);
+    }
+    for i in 0..LOCKSTAT_CLASSES {
+        let class = &LOCK_CLASSES[(hash as usize + i) & (LOCKSTAT_CLASSES - 1)];
+        let mut state = class.state.load(Ordering::Acquire);
+        if state == CLASS_EMPTY {
+            match class.state.compare_exchange(
+                CLASS_EMPTY,
+                CLASS_INIT,
+                Ordering::Acquire,
+                Ordering::Acquire,
+            ) {
+                Ok(_) => {
+                    class.kind.store(kind as u32, Ordering::Relaxed);
+                    class
+                        .name
+                        .store(name.as_ptr() as *mut u8, Ordering::Relaxed);
+                    class.name_len.store(name.len() as u64, Ordering::Relaxed);
+                    class.state.store(CLASS_READY, Ordering::Release);
+                    return Some(class);
+                }
+                Err(s) => state = s,
+            }
+        }
+        // 另一个cpu正在填写这个类别
+        while state == CLASS_INIT {
+            core::hint::spin_loop();
+            state = class.state.load(Ordering::Acquire);
+        }
+        if class.matches(kind, name) {
+            return Some(class);
+        }
+    }
+    LOCK_CLASSES_OVERFLOW.fetch_add(1, Ordering::Relaxed);
+    return None;
+}
+
+/// 输出`/proc/lock_stat`
+pub fn lock_stat_show(s: &mut SeqBuf) -> Result<(), SystemError> {
+    #[cfg(not(feature = "lockstat"))]
+    s.push_str("lockstat is not enabled, rebuild the kernel with the `lockstat` feature\n");
+
+    #[cfg(feature = "lockstat")]
+    {
+        let khz = TSCManager::tsc_khz().max(1);
+        let ns = |cycles: u64| (cycles as u128 * 1_000_000 / khz as u128) as u64;
+
+        let mut classes: Vec<&LockClass> = LOCK_CLASSES
+            .iter()
+            .filter(|c| {
+                c.state.load(Ordering::Acquire) == CLASS_READY
+                    && c.acquisitions.load(Ordering::Relaxed) != 0
+            })
+            .collect();
+        classes.sort_by_key(|c| {
+            core::cmp::Reverse((
+                c.contentions.load(Ordering::Relaxed),
+                c.wait_total.load(Ordering::Relaxed),
+            ))
+        });
+
+        writeln!(
+            s,
+            "{:<8} {:>12} {:>12} {:>14} {:>12} {:>12} {:>12}  class",
+            "kind", "acquisitions", "contentions", "wait-total", "wait-max", "wait-avg", "hold-max"
+        )
+        .ok();
+        for c in classes.iter() {
+            let contentions = c.contentions.load(Ordering::Relaxed);
+            let wait_total = c.wait_total.load(Ordering::Relaxed);
+            writeln!(
+                s,
+                "{:<8} {:>12} {:>12} {:>14} {:>12} {:>12} {:>12}  {}",
+                LockKind::NAMES[c.kind.load(Ordering::Relaxed) as usize],
+                c.acquisitions.load(Ordering::Relaxed),
+                contentions,
+                ns(wait_total),
+                ns(c.wait_max.load(Ordering::Relaxed)),
+                ns(wait_total / contentions.max(1)),
+                ns(c.hold_max.load(Ordering::Relaxed)),
+                c.name()
+            )
+            .ok();
+
+            let mut sites: Vec<&LockSiteStat> = c
+                .sites
+                .iter()
+                .filter(|site| site.contentions.load(Ordering::Relaxed) != 0)
+                .collect();
+            sites.sort_by_key(|site| core::cmp::Reverse(site.contentions.load(Ordering::Relaxed)));
+            for site in sites {
+                let location = unsafe { &*site.site.load(Ordering::Acquire) };
+                writeln!(
+                    s,
+                    "{:<8} {:>12} {:>12} {:>14}    at {}",
+                    "",
+                    "",
+                    site.contentions.load(Ordering::Relaxed),
+                    ns(site.wait_total.load(Ordering::Relaxed)),
+                    location
+                )
+                .ok();
+            }
+            let other = c.other_sites.load(Ordering::Relaxed);
+            if other != 0 {
+                writeln!(s, "{:<8} {:>12} {:>12}    at other sites", "", "", other).ok();
+            }
+        }
+        let overflow = LOCK_CLASSES_OVERFLOW.load(Ordering::Relaxed);
+        if overflow != 0 {
+            writeln!(
+                s,
+                "# {} acquisitions of untracked classes (table full)",
+                overflow
+            )
+            .ok();
+        }
+    }
+    return Ok(());
+}
+
+/// 处理对`/proc/lock_stat`的写入：`0`清空统计结果
+pub fn lock_stat_store(buf: &[u8]) -> Result<(), SystemError> {
+    let s = core::str::from_utf8(buf).map_err(|_| SystemError::EINVAL)?;
+    let s = s.trim_matches(|c: char| c.is_whitespace() || c == '\0');
+    if s != "0" {
+        return Err(SystemError::EINVAL);
+    }
+    #[cfg(feature = "lockstat")]
+    {
+        LOCK_CLASSES.iter().for_each(|c| c.reset());
+        LOCK_CLASSES_OVERFLOW.store(0, Ordering::Relaxed);
+    }
+    return Ok(());
+}
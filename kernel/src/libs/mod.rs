@@ -3,21 +3,28 @@ pub mod atomic;
 pub mod casting;
 pub mod elf;
 pub mod ffi_convert;
+pub mod idr;
 #[macro_use]
 pub mod int_like;
 pub mod keyboard_parser;
 pub mod lazy_init;
 pub mod lib_ui;
 pub mod lock_free_flags;
+pub mod lockstat;
 pub mod mutex;
 pub mod notifier;
 pub mod once;
+pub mod percpu_rwlock;
 #[macro_use]
 pub mod printk;
+pub mod qspinlock;
 pub mod rbtree;
+pub mod rcu;
+pub mod ringbuf;
 #[macro_use]
 pub mod rwlock;
 pub mod semaphore;
+pub mod seqlock;
 pub mod spinlock;
 pub mod vec_cursor;
 #[macro_use]
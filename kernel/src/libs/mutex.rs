@@ -1,6 +1,9 @@
 use core::{
     cell::UnsafeCell,
+    hint::spin_loop,
+    intrinsics::unlikely,
     ops::{Deref, DerefMut},
+    sync::atomic::{AtomicU32, Ordering},
 };
 
 use alloc::{collections::LinkedList, sync::Arc};
@@ -9,11 +12,16 @@ use crate::{
     arch::{sched::sched, CurrentIrqArch},
     exception::InterruptArch,
     libs::spinlock::SpinLockGuard,
-    process::{Pid, ProcessControlBlock, ProcessManager},
+    process::{AtomicPid, Pid, ProcessControlBlock, ProcessFlags, ProcessManager},
+    sched::core::CPU_EXECUTING,
+    smp::core::smp_get_processor_id,
     syscall::SystemError,
 };
 
-use super::spinlock::SpinLock;
+use super::{
+    lockstat::{lock_site, wait_start, LockClassCache, LockHold, LockKind},
+    spinlock::SpinLock,
+};
 
 #[derive(Debug)]
 struct MutexInner {
@@ -31,17 +39,28 @@ pub struct Mutex<T> {
     data: UnsafeCell<T>,
     /// Mutex内部的信息
     inner: SpinLock<MutexInner>,
+    /// 持有锁的进程的pid（只在owner_cpu有效时有意义）
+    owner_pid: AtomicPid,
+    /// 持有锁的进程加锁时所在的cpu，未上锁时为[`Mutex::NO_OWNER`]
+    owner_cpu: AtomicU32,
+    /// 竞争统计的类别（启用lockstat特性时）
+    stat: LockClassCache,
 }
 
 /// @brief Mutex的守卫
 #[derive(Debug)]
 pub struct MutexGuard<'a, T: 'a> {
     lock: &'a Mutex<T>,
+    hold: LockHold,
 }
 
 unsafe impl<T> Sync for Mutex<T> where T: Send {}
 
 impl<T> Mutex<T> {
+    const NO_OWNER: u32 = u32::MAX;
+    /// 每次加锁时，乐观自旋等待（持有锁的进程正在运行时）的最大次数
+    const SPIN_MAX: usize = 2000;
+
     /// @brief 初始化一个新的Mutex对象
     #[allow(dead_code)]
     pub const fn new(value: T) -> Self {
@@ -51,6 +70,9 @@ impl<T> Mutex<T> {
                 is_locked: false,
                 wait_list: LinkedList::new(),
             }),
+            owner_pid: AtomicPid::new(Pid::new(0)),
+            owner_cpu: AtomicU32::new(Self::NO_OWNER),
+            stat: LockClassCache::new(),
         };
     }
 
@@ -58,11 +80,26 @@ impl<T> Mutex<T> {
     /// @return MutexGuard<T> 返回Mutex的守卫，您可以使用这个守卫来操作被保护的数据
     #[inline(always)]
     #[allow(dead_code)]
+    #[cfg_attr(feature = "lockstat", track_caller)]
     pub fn lock(&self) -> MutexGuard<T> {
+        let mut spin_budget = Self::SPIN_MAX;
+        // 第一次发现锁被占用的时间
+        let mut waited = None;
         loop {
             let mut inner: SpinLockGuard<MutexInner> = self.inner.lock();
             // 当前mutex已经上锁
             if inner.is_locked {
+                if waited.is_none() {
+                    waited = Some(wait_start());
+                }
+
+                // 持有锁的进程正在其他cpu上运行，它很可能很快就会放锁，先自旋等待，避免两次上下文切换
+                if spin_budget > 0 && self.owner_running() {
+                    drop(inner);
+                    self.spin_on_owner(&mut spin_budget);
+                    continue;
+                }
+
                 // 检查当前进程是否处于等待队列中,如果不在，就加到等待队列内
                 if self.check_pid_in_wait_list(&inner, ProcessManager::current_pcb().pid()) == false
                 {
@@ -75,13 +112,20 @@ impl<T> Mutex<T> {
             } else {
                 // 加锁成功
                 inner.is_locked = true;
+                self.set_owner();
                 drop(inner);
                 break;
             }
         }
 
+        let hold = match waited {
+            None => self.stat.acquired::<Self>(LockKind::Mutex),
+            Some(start) => self
+                .stat
+                .contended::<Self>(LockKind::Mutex, start, lock_site()),
+        };
         // 加锁成功，返回一个守卫
-        return MutexGuard { lock: self };
+        return MutexGuard { lock: self, hold };
     }
 
     /// @brief 尝试对Mutex加锁。如果加锁失败，不会将当前进程加入等待队列。
@@ -98,7 +142,52 @@ impl<T> Mutex<T> {
         } else {
             // 加锁成功
             inner.is_locked = true;
-            return Ok(MutexGuard { lock: self });
+            self.set_owner();
+            return Ok(MutexGuard {
+                lock: self,
+                hold: LockHold::NONE,
+            });
+        }
+    }
+
+    /// 记录当前进程为锁的持有者。调用者需要持有inner的锁
+    #[inline(always)]
+    fn set_owner(&self) {
+        // 进程管理初始化之前没有当前进程，不记录持有者（也就不会自旋）
+        if unlikely(!ProcessManager::initialized()) {
+            return;
+        }
+        self.owner_pid
+            .store(ProcessManager::current_pcb().pid(), Ordering::Relaxed);
+        self.owner_cpu
+            .store(smp_get_processor_id(), Ordering::Release);
+    }
+
+    /// 持有锁的进程是否正在其他cpu上运行
+    #[inline(always)]
+    fn owner_running(&self) -> bool {
+        let cpu = self.owner_cpu.load(Ordering::Acquire);
+        if cpu == Self::NO_OWNER || cpu == smp_get_processor_id() {
+            return false;
+        }
+        return CPU_EXECUTING.get(cpu) == self.owner_pid.load(Ordering::Relaxed);
+    }
+
+    /// 在持有锁的进程仍然在运行、并且锁没有被释放时自旋，最多自旋`budget`次
+    ///
+    /// 当前进程需要被调度时，立即停止自旋
+    fn spin_on_owner(&self, budget: &mut usize) {
+        let owner = self.owner_pid.load(Ordering::Relaxed);
+        let current = ProcessManager::current_pcb();
+        while *budget > 0 {
+            *budget -= 1;
+            if !self.owner_running()
+                || self.owner_pid.load(Ordering::Relaxed) != owner
+                || current.flags().contains(ProcessFlags::NEED_SCHEDULE)
+            {
+                return;
+            }
+            spin_loop();
         }
     }
 
@@ -119,6 +208,7 @@ impl<T> Mutex<T> {
         assert!(inner.is_locked);
         // 标记mutex已经解锁
         inner.is_locked = false;
+        self.owner_cpu.store(Self::NO_OWNER, Ordering::Release);
         if inner.wait_list.is_empty() {
             return;
         }
@@ -164,6 +254,7 @@ impl<T> DerefMut for MutexGuard<'_, T> {
 /// @brief 为MutexGuard实现Drop方法，那么，一旦守卫的生命周期结束，就会自动释放自旋锁，避免了忘记放锁的情况
 impl<T> Drop for MutexGuard<'_, T> {
     fn drop(&mut self) {
+        self.hold.release();
         self.lock.unlock();
     }
 }
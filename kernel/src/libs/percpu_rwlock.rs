@@ -0,0 +1,177 @@
+//! 每个cpu一个读者计数的读写锁（brlock）
+//!
+//! 读者只修改当前cpu的计数，不会与其他cpu上的读者争抢同一个缓存行，读的开销与cpu的数量无关；
+//! 写者需要设置写者标志，然后等待所有cpu的读者计数归零，开销很大。
+//! 因此只适用于读远多于写的数据，例如网卡列表、挂载点表。
+//!
+//! 与[`super::rwlock::RwLock`]一样，同一个cpu上不能嵌套获取读者守卫：有写者在等待时，内层的读者会一直等待外层的读者离开。
+
+#![allow(dead_code)]
+use core::{
+    cell::UnsafeCell,
+    hint::spin_loop,
+    ops::{Deref, DerefMut},
+    sync::atomic::{AtomicBool, AtomicUsize, Ordering},
+};
+
+use alloc::boxed::Box;
+
+use crate::{
+    arch::CurrentIrqArch,
+    exception::{InterruptArch, IrqFlagsGuard},
+    mm::percpu::PerCpu,
+    process::ProcessManager,
+    smp::core::smp_get_processor_id,
+};
+
+/// 按照缓存行对齐的读者计数
+#[derive(Debug)]
+#[repr(align(64))]
+struct ReaderCount(AtomicUsize);
+
+/// 每个cpu一个读者计数的读写锁
+#[derive(Debug)]
+pub struct PerCpuRwLock<T> {
+    /// 每个cpu的读者计数。放在堆上，避免锁本身占用过多的栈空间
+    readers: Box<[ReaderCount]>,
+    /// 是否有写者持有锁（或者正在等待读者离开）
+    writer: AtomicBool,
+    data: UnsafeCell<T>,
+}
+
+/// PerCpuRwLock的读者守卫
+pub struct PerCpuRwLockReadGuard<'a, T: 'a> {
+    lock: &'a PerCpuRwLock<T>,
+    /// 加锁时增加的是哪个cpu的计数
+    cpu_id: u32,
+    irq_guard: Option<IrqFlagsGuard>,
+}
+
+/// PerCpuRwLock的写者守卫
+pub struct PerCpuRwLockWriteGuard<'a, T: 'a> {
+    lock: &'a PerCpuRwLock<T>,
+    irq_guard: Option<IrqFlagsGuard>,
+}
+
+unsafe impl<T: Send> Send for PerCpuRwLock<T> {}
+unsafe impl<T: Send + Sync> Sync for PerCpuRwLock<T> {}
+
+impl<T> PerCpuRwLock<T> {
+    pub fn new(data: T) -> Self {
+        let readers = (0..PerCpu::MAX_CPU_NUM)
+            .map(|_| ReaderCount(AtomicUsize::new(0)))
+            .collect();
+        return Self {
+            readers,
+            writer: AtomicBool::new(false),
+            data: UnsafeCell::new(data),
+        };
+    }
+
+    /// 获得读者守卫
+    pub fn read(&self) -> PerCpuRwLockReadGuard<T> {
+        ProcessManager::preempt_disable();
+        let cpu_id = smp_get_processor_id();
+        let count = &self.readers[cpu_id as usize].0;
+        loop {
+            count.fetch_add(1, Ordering::SeqCst);
+            // 与写者的“设置标志、检查计数”配对：两者之中至少有一方能看到对方
+            if !self.writer.load(Ordering::SeqCst) {
+                break;
+            }
+            count.fetch_sub(1, Ordering::Release);
+            while self.writer.load(Ordering::Relaxed) {
+                spin_loop();
+            }
+        }
+        return PerCpuRwLockReadGuard {
+            lock: self,
+            cpu_id,
+            irq_guard: None,
+        };
+    }
+
+    /// 关中断，并获得读者守卫
+    pub fn read_irqsave(&self) -> PerCpuRwLockReadGuard<T> {
+        let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+        let mut guard = self.read();
+        guard.irq_guard = Some(irq_guard);
+        return guard;
+    }
+
+    /// 获得写者守卫
+    pub fn write(&self) -> PerCpuRwLockWriteGuard<T> {
+        ProcessManager::preempt_disable();
+        while self
+            .writer
+            .compare_exchange_weak(false, true, Ordering::SeqCst, Ordering::Relaxed)
+            .is_err()
+        {
+            spin_loop();
+        }
+        // 等待所有cpu上的读者离开
+        for count in self.readers.iter() {
+            while count.0.load(Ordering::SeqCst) != 0 {
+                spin_loop();
+            }
+        }
+        return PerCpuRwLockWriteGuard {
+            lock: self,
+            irq_guard: None,
+        };
+    }
+
+    /// 关中断，并获得写者守卫
+    pub fn write_irqsave(&self) -> PerCpuRwLockWriteGuard<T> {
+        let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+        let mut guard = self.write();
+        guard.irq_guard = Some(irq_guard);
+        return guard;
+    }
+}
+
+impl<T: Default> Default for PerCpuRwLock<T> {
+    fn default() -> Self {
+        Self::new(Default::default())
+    }
+}
+
+impl<T> Deref for PerCpuRwLockReadGuard<'_, T> {
+    type Target = T;
+
+    fn deref(&self) -> &Self::Target {
+        return unsafe { &*self.lock.data.get() };
+    }
+}
+
+impl<T> Deref for PerCpuRwLockWriteGuard<'_, T> {
+    type Target = T;
+
+    fn deref(&self) -> &Self::Target {
+        return unsafe { &*self.lock.data.get() };
+    }
+}
+
+impl<T> DerefMut for PerCpuRwLockWriteGuard<'_, T> {
+    fn deref_mut(&mut self) -> &mut Self::Target {
+        return unsafe { &mut *self.lock.data.get() };
+    }
+}
+
+impl<T> Drop for PerCpuRwLockReadGuard<'_, T> {
+    fn drop(&mut self) {
+        self.lock.readers[self.cpu_id as usize]
+            .0
+            .fetch_sub(1, Ordering::Release);
+        self.irq_guard.take();
+        ProcessManager::preempt_enable();
+    }
+}
+
+impl<T> Drop for PerCpuRwLockWriteGuard<'_, T> {
+    fn drop(&mut self) {
+        self.lock.writer.store(false, Ordering::Release);
+        self.irq_guard.take();
+        ProcessManager::preempt_enable();
+    }
+}
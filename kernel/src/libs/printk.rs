@@ -1,6 +1,8 @@
 use core::fmt::{self, Write};
 
-use super::lib_ui::textui::{textui_putstr, FontColor};
+use crate::debug::klog::kmsg::{KmsgWriter, LogLevel};
+
+use super::lib_ui::textui::FontColor;
 
 #[macro_export]
 macro_rules! print {
@@ -30,7 +32,7 @@ macro_rules! printk_color {
 #[macro_export]
 macro_rules! kdebug {
     ($($arg:tt)*) => {
-        $crate::libs::printk::PrintkWriter.__write_fmt(format_args!("[ DEBUG ] ({}:{})\t {}\n", file!(), line!(),format_args!($($arg)*)))
+        $crate::libs::printk::PrintkWriter.__write_fmt_level($crate::debug::klog::kmsg::LogLevel::DEBUG, format_args!("[ DEBUG ] ({}:{})\t {}\n", file!(), line!(),format_args!($($arg)*)))
 
     }
 }
@@ -38,50 +40,68 @@ macro_rules! kdebug {
 #[macro_export]
 macro_rules! kinfo {
     ($($arg:tt)*) => {
-        $crate::libs::printk::PrintkWriter.__write_fmt(format_args!("[ INFO ] ({}:{})\t {}\n", file!(), line!(),format_args!($($arg)*)))
+        $crate::libs::printk::PrintkWriter.__write_fmt_level($crate::debug::klog::kmsg::LogLevel::INFO, format_args!("[ INFO ] ({}:{})\t {}\n", file!(), line!(),format_args!($($arg)*)))
     }
 }
 
 #[macro_export]
 macro_rules! kwarn {
     ($($arg:tt)*) => {
-        $crate::libs::printk::PrintkWriter.__write_string_color($crate::libs::lib_ui::textui::FontColor::YELLOW, $crate::libs::lib_ui::textui::FontColor::BLACK, "[ WARN ] ");
-        $crate::libs::printk::PrintkWriter.__write_fmt(format_args!("({}:{})\t {}\n", file!(), line!(),format_args!($($arg)*)));
+        $crate::libs::printk::PrintkWriter.__write_string_color_level($crate::debug::klog::kmsg::LogLevel::WARNING, $crate::libs::lib_ui::textui::FontColor::YELLOW, $crate::libs::lib_ui::textui::FontColor::BLACK, "[ WARN ] ");
+        $crate::libs::printk::PrintkWriter.__write_fmt_level($crate::debug::klog::kmsg::LogLevel::WARNING, format_args!("({}:{})\t {}\n", file!(), line!(),format_args!($($arg)*)));
     }
 }
 
 #[macro_export]
 macro_rules! kerror {
     ($($arg:tt)*) => {
-        $crate::libs::printk::PrintkWriter.__write_string_color($crate::libs::lib_ui::textui::FontColor::RED, $crate::libs::lib_ui::textui::FontColor::BLACK, "[ ERROR ] ");
-        $crate::libs::printk::PrintkWriter.__write_fmt(format_args!("({}:{})\t {}\n", file!(), line!(),format_args!($($arg)*)));
+        $crate::libs::printk::PrintkWriter.__write_string_color_level($crate::debug::klog::kmsg::LogLevel::ERR, $crate::libs::lib_ui::textui::FontColor::RED, $crate::libs::lib_ui::textui::FontColor::BLACK, "[ ERROR ] ");
+        $crate::libs::printk::PrintkWriter.__write_fmt_level($crate::debug::klog::kmsg::LogLevel::ERR, format_args!("({}:{})\t {}\n", file!(), line!(),format_args!($($arg)*)));
     }
 }
 
 #[macro_export]
 macro_rules! kBUG {
     ($($arg:tt)*) => {
-        $crate::libs::printk::PrintkWriter.__write_string_color($crate::libs::lib_ui::textui::FontColor::RED, $crate::libs::lib_ui::textui::FontColor::BLACK, "[ BUG ] ");
-        $crate::libs::printk::PrintkWriter.__write_fmt(format_args!("({}:{})\t {}\n", file!(), line!(),format_args!($($arg)*)));
+        $crate::libs::printk::PrintkWriter.__write_string_color_level($crate::debug::klog::kmsg::LogLevel::CRIT, $crate::libs::lib_ui::textui::FontColor::RED, $crate::libs::lib_ui::textui::FontColor::BLACK, "[ BUG ] ");
+        $crate::libs::printk::PrintkWriter.__write_fmt_level($crate::debug::klog::kmsg::LogLevel::CRIT, format_args!("({}:{})\t {}\n", file!(), line!(),format_args!($($arg)*)));
     }
 }
 
+/// printk的输出：日志被写入kmsg，由kmsgd异步输出到控制台（见[`crate::debug::klog::kmsg`]）
 pub struct PrintkWriter;
 
 impl PrintkWriter {
     #[inline]
     pub fn __write_fmt(&mut self, args: fmt::Arguments) {
-        self.write_fmt(args).ok();
+        self.__write_fmt_level(LogLevel::DEFAULT, args);
+    }
+
+    /// 以指定的日志级别输出白底黑字的格式化字符串
+    pub fn __write_fmt_level(&mut self, level: LogLevel, args: fmt::Arguments) {
+        let mut writer = KmsgWriter::new(level, FontColor::WHITE, FontColor::BLACK);
+        writer.write_fmt(args).ok();
     }
 
     /// 并输出白底黑字
     /// @param str: 要写入的字符
     pub fn __write_string(&mut self, s: &str) {
-        textui_putstr(s, FontColor::WHITE, FontColor::BLACK).ok();
+        self.__write_string_color(FontColor::WHITE, FontColor::BLACK, s);
     }
 
     pub fn __write_string_color(&self, fr_color: FontColor, bk_color: FontColor, s: &str) {
-        textui_putstr(s, fr_color, bk_color).ok();
+        self.__write_string_color_level(LogLevel::DEFAULT, fr_color, bk_color, s);
+    }
+
+    pub fn __write_string_color_level(
+        &self,
+        level: LogLevel,
+        fr_color: FontColor,
+        bk_color: FontColor,
+        s: &str,
+    ) {
+        let mut writer = KmsgWriter::new(level, fr_color, bk_color);
+        writer.write_str(s).ok();
     }
 }
 
@@ -95,5 +115,5 @@ impl fmt::Write for PrintkWriter {
 
 #[doc(hidden)]
 pub fn __printk(args: fmt::Arguments) {
-    PrintkWriter.write_fmt(args).unwrap();
+    PrintkWriter.__write_fmt(args);
 }
@@ -0,0 +1,302 @@
+//! 排队自旋锁（MCS锁）
+//!
+//! [`super::spinlock::SpinLock`]的所有等待者都在同一个字上自旋，竞争激烈时这个缓存行会在cpu之间来回传递，
+//! 并且等待者获得锁的顺序是不确定的。
+//!
+//! [`QueuedSpinLock`]在没有竞争时与普通的自旋锁一样，只需要一次CAS。发生竞争时，等待者按照到达的顺序排队，
+//! 每个等待者只在自己的per-cpu的MCS节点上自旋，锁的持有者放锁时，由队首的等待者获得锁，并通知下一个等待者成为队首。
+//!
+//! 锁字的低8位表示锁是否被持有，其余的位保存队尾的节点的编号（0表示队列为空）。
+//! 每个cpu有[`MCS_NODES_PER_CPU`]个节点，使得在等待一个锁的过程中被中断时，中断处理函数仍然可以等待另一个锁。
+
+#![allow(dead_code)]
+use core::cell::UnsafeCell;
+use core::hint::spin_loop;
+use core::intrinsics::likely;
+use core::ops::{Deref, DerefMut};
+use core::ptr::null_mut;
+use core::sync::atomic::{AtomicBool, AtomicPtr, AtomicU32, AtomicUsize, Ordering};
+
+use crate::arch::CurrentIrqArch;
+use crate::exception::{InterruptArch, IrqFlagsGuard};
+use crate::mm::percpu::PerCpu;
+use crate::process::ProcessManager;
+use crate::smp::core::smp_get_processor_id;
+use crate::syscall::SystemError;
+
+/// 每个cpu的MCS节点的数量（普通上下文、软中断、硬中断、NMI）
+const MCS_NODES_PER_CPU: usize = 4;
+
+/// 锁字中表示锁被持有的位
+const LOCKED_MASK: u32 = 0xff;
+/// 队尾节点编号在锁字中的偏移
+const TAIL_SHIFT: u32 = 8;
+
+/// MCS队列中的一个节点
+#[derive(Debug)]
+#[repr(align(64))]
+struct McsNode {
+    /// 队列中的下一个节点
+    next: AtomicPtr<McsNode>,
+    /// 前一个节点把锁交给这个节点时，设置为true
+    locked: AtomicBool,
+}
+
+impl McsNode {
+    const fn new() -> Self {
+        return Self {
+            next: AtomicPtr::new(null_mut()),
+            locked: AtomicBool::new(false),
+        };
+    }
+}
+
+/// 每个cpu的MCS节点
+static MCS_NODES: [[McsNode; MCS_NODES_PER_CPU]; PerCpu::MAX_CPU_NUM] =
+    [const { [const { McsNode::new() }; MCS_NODES_PER_CPU] }; PerCpu::MAX_CPU_NUM];
+/// 每个cpu正在使用的MCS节点的数量
+static MCS_NESTING: [AtomicUsize; PerCpu::MAX_CPU_NUM] =
+    [const { AtomicUsize::new(0) }; PerCpu::MAX_CPU_NUM];
+
+/// 把cpu号和节点下标编码为锁字中的队尾编号（从1开始）
+#[inline(always)]
+fn encode_tail(cpu_id: u32, idx: usize) -> u32 {
+    return cpu_id * MCS_NODES_PER_CPU as u32 + idx as u32 + 1;
+}
+
+#[inline(always)]
+fn decode_tail(tail: u32) -> &'static McsNode {
+    let tail = (tail - 1) as usize;
+    return &MCS_NODES[tail / MCS_NODES_PER_CPU][tail % MCS_NODES_PER_CPU];
+}
+
+/// 实现了守卫的排队自旋锁，用于竞争激烈的全局数据结构
+///
+/// 接口与[`super::spinlock::SpinLock`]相同
+#[derive(Debug)]
+pub struct QueuedSpinLock<T> {
+    lock: AtomicU32,
+    /// 自旋锁保护的数据
+    data: UnsafeCell<T>,
+}
+
+/// QueuedSpinLock的守卫
+#[derive(Debug)]
+pub struct QueuedSpinLockGuard<'a, T: 'a> {
+    lock: &'a QueuedSpinLock<T>,
+    data: *mut T,
+    irq_flag: Option<IrqFlagsGuard>,
+}
+
+/// 向编译器保证，QueuedSpinLock在线程之间是安全的.
+/// 其中要求类型T实现了Send这个Trait
+unsafe impl<T> Sync for QueuedSpinLock<T> where T: Send {}
+
+impl<T> QueuedSpinLock<T> {
+    pub const fn new(value: T) -> Self {
+        return Self {
+            lock: AtomicU32::new(0),
+            data: UnsafeCell::new(value),
+        };
+    }
+
+    #[inline(always)]
+    pub fn lock(&self) -> QueuedSpinLockGuard<T> {
+        ProcessManager::preempt_disable();
+        self.inner_lock();
+        return QueuedSpinLockGuard {
+            lock: self,
+            data: self.data.get(),
+            irq_flag: None,
+        };
+    }
+
+    #[inline(always)]
+    pub fn lock_irqsave(&self) -> QueuedSpinLockGuard<T> {
+        let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+        ProcessManager::preempt_disable();
+        self.inner_lock();
+        return QueuedSpinLockGuard {
+            lock: self,
+            data: self.data.get(),
+            irq_flag: Some(irq_guard),
+        };
+    }
+
+    pub fn try_lock(&self) -> Result<QueuedSpinLockGuard<T>, SystemError> {
+        // 先增加自旋锁持有计数
+        ProcessManager::preempt_disable();
+        if self.inner_try_lock() {
+            return Ok(QueuedSpinLockGuard {
+                lock: self,
+                data: self.data.get(),
+                irq_flag: None,
+            });
+        }
+        // 如果加锁失败恢复自旋锁持有计数
+        ProcessManager::preempt_enable();
+        return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
+    }
+
+    pub fn try_lock_irqsave(&self) -> Result<QueuedSpinLockGuard<T>, SystemError> {
+        let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+        ProcessManager::preempt_disable();
+        if self.inner_try_lock() {
+            return Ok(QueuedSpinLockGuard {
+                lock: self,
+                data: self.data.get(),
+                irq_flag: Some(irq_guard),
+            });
+        }
+        ProcessManager::preempt_enable();
+        drop(irq_guard);
+        return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
+    }
+
+    /// 只有在锁空闲并且没有等待者时才能成功，不会插队
+    #[inline(always)]
+    fn inner_try_lock(&self) -> bool {
+        return self
+            .lock
+            .compare_exchange(0, 1, Ordering::Acquire, Ordering::Relaxed)
+            .is_ok();
+    }
+
+    #[inline(always)]
+    fn inner_lock(&self) {
+        if likely(self.inner_try_lock()) {
+            return;
+        }
+        self.lock_slowpath();
+    }
+
+    /// 加锁的慢速路径：在当前cpu的MCS节点上排队
+    #[inline(never)]
+    fn lock_slowpath(&self) {
+        let cpu_id = smp_get_processor_id();
+        let idx = MCS_NESTING[cpu_id as usize].fetch_add(1, Ordering::Relaxed);
+        assert!(
+            idx < MCS_NODES_PER_CPU,
+            "QueuedSpinLock: too many nested lock waiters"
+        );
+        let node = &MCS_NODES[cpu_id as usize][idx];
+        node.next.store(null_mut(), Ordering::Relaxed);
+        node.locked.store(false, Ordering::Relaxed);
+        let tail = encode_tail(cpu_id, idx);
+
+        // 把自己设置为队尾
+        let mut val = self.lock.load(Ordering::Relaxed);
+        loop {
+            // 在准备节点的过程中，锁可能已经被释放了
+            if val == 0 {
+                match self
+                    .lock
+                    .compare_exchange(0, 1, Ordering::Acquire, Ordering::Relaxed)
+                {
+                    Ok(_) => {
+                        MCS_NESTING[cpu_id as usize].fetch_sub(1, Ordering::Relaxed);
+                        return;
+                    }
+                    Err(v) => {
+                        val = v;
+                        continue;
+                    }
+                }
+            }
+            let new = (val & LOCKED_MASK) | (tail << TAIL_SHIFT);
+            match self
+                .lock
+                .compare_exchange_weak(val, new, Ordering::AcqRel, Ordering::Relaxed)
+            {
+                Ok(_) => break,
+                Err(v) => val = v,
+            }
+        }
+
+        // 如果队列中有前一个节点，就链接到它后面，并在自己的节点上自旋，直到成为队首
+        let prev_tail = val >> TAIL_SHIFT;
+        if prev_tail != 0 {
+            let prev = decode_tail(prev_tail);
+            prev.next
+                .store(node as *const McsNode as *mut McsNode, Ordering::Release);
+            while !node.locked.load(Ordering::Acquire) {
+                spin_loop();
+            }
+        }
+
+        // 成为队首之后，等待锁的持有者放锁。只有队首会在锁字上自旋
+        loop {
+            let val = self.lock.load(Ordering::Acquire);
+            if val & LOCKED_MASK != 0 {
+                spin_loop();
+                continue;
+            }
+
+            if val >> TAIL_SHIFT == tail {
+                // 自己是队列中唯一的节点：获得锁，同时清空队列
+                if self
+                    .lock
+                    .compare_exchange(val, 1, Ordering::Acquire, Ordering::Relaxed)
+                    .is_ok()
+                {
+                    break;
+                }
+                // 有新的节点加入了队列，重新检查
+                continue;
+            }
+
+            // 队列中还有其他节点。队列不为空时，只有队首能设置锁位，因此不需要CAS
+            self.lock.fetch_or(1, Ordering::Acquire);
+            // 等待下一个节点链接到自己后面，然后把队首的身份交给它
+            let mut next = node.next.load(Ordering::Acquire);
+            while next.is_null() {
+                spin_loop();
+                next = node.next.load(Ordering::Acquire);
+            }
+            unsafe { (*next).locked.store(true, Ordering::Release) };
+            break;
+        }
+
+        MCS_NESTING[cpu_id as usize].fetch_sub(1, Ordering::Relaxed);
+    }
+
+    /// 强制解锁，并且不更改preempt count
+    ///
+    /// ## Safety
+    ///
+    /// 由于这样做可能导致preempt count不正确，因此必须小心的手动维护好preempt count。
+    /// 如非必要，请不要使用这个函数。
+    pub unsafe fn force_unlock(&self) {
+        self.lock.fetch_and(!LOCKED_MASK, Ordering::Release);
+    }
+
+    fn unlock(&self) {
+        self.lock.fetch_and(!LOCKED_MASK, Ordering::Release);
+        ProcessManager::preempt_enable();
+    }
+}
+
+/// 实现Deref trait，支持通过获取QueuedSpinLockGuard来获取临界区数据的不可变引用
+impl<T> Deref for QueuedSpinLockGuard<'_, T> {
+    type Target = T;
+
+    fn deref(&self) -> &Self::Target {
+        return unsafe { &*self.data };
+    }
+}
+
+/// 实现DerefMut trait，支持通过获取QueuedSpinLockGuard来获取临界区数据的可变引用
+impl<T> DerefMut for QueuedSpinLockGuard<'_, T> {
+    fn deref_mut(&mut self) -> &mut Self::Target {
+        return unsafe { &mut *self.data };
+    }
+}
+
+/// 守卫的生命周期结束时，自动放锁，然后恢复中断状态
+impl<T> Drop for QueuedSpinLockGuard<'_, T> {
+    fn drop(&mut self) {
+        self.lock.unlock();
+        // restore irq
+        self.irq_flag.take();
+    }
+}
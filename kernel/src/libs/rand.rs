@@ -1,3 +1,19 @@
+//! 内核的随机数生成器
+//!
+//! 每个CPU有一个独立的ChaCha20生成器，第一次使用时用架构提供的熵源（RDSEED/RDRAND和TSC抖动）播种，
+//! 之后每生成一定数量的数据就重新混入新的熵。
+//!
+//! 生成器采用“快速密钥擦除”的方式：每次补充缓冲区时用当前密钥生成若干个块，其中第一个块的前32字节
+//! 立即替换掉当前密钥，其余的字节作为输出。因此即使生成器的状态在之后泄露，也无法推算出之前的输出。
+//!
+//! 大块的请求（例如用户程序一次读取较多的随机数）只在锁内取出一个临时密钥，之后在锁外直接把输出写到
+//! 目标缓冲区中，避免长时间持有锁，也避免在持有锁时访问用户内存。
+
+use crate::{
+    arch::rand::arch_entropy, libs::spinlock::SpinLock, mm::percpu::PerCpu,
+    sched::core::cond_resched, smp::core::smp_get_processor_id,
+};
+
 bitflags! {
     pub struct GRandFlags: u8{
         const GRND_NONBLOCK = 0x0001;
@@ -5,3 +21,172 @@ bitflags! {
         const GRND_INSECURE = 0x0004;
     }
 }
+
+/// ChaCha20一个块的字节数
+const CHACHA_BLOCK_SIZE: usize = 64;
+/// 每次补充缓冲区时生成的块数
+const RNG_REFILL_BLOCKS: usize = 4;
+/// 密钥的字节数
+const CHACHA_KEY_SIZE: usize = 32;
+/// 每次补充后可以输出的字节数（第一个块的前32字节用作新的密钥）
+const RNG_BUF_SIZE: usize = RNG_REFILL_BLOCKS * CHACHA_BLOCK_SIZE - CHACHA_KEY_SIZE;
+/// 补充多少次缓冲区之后重新混入熵
+const RNG_RESEED_INTERVAL: usize = 1 << 14;
+
+/// "expand 32-byte k"
+const CHACHA_CONSTANTS: [u32; 4] = [0x6170_7865, 0x3320_646e, 0x7962_2d32, 0x6b20_6574];
+
+#[inline(always)]
+fn quarter_round(s: &mut [u32; 16], a: usize, b: usize, c: usize, d: usize) {
+    s[a] = s[a].wrapping_add(s[b]);
+    s[d] = (s[d] ^ s[a]).rotate_left(16);
+    s[c] = s[c].wrapping_add(s[d]);
+    s[b] = (s[b] ^ s[c]).rotate_left(12);
+    s[a] = s[a].wrapping_add(s[b]);
+    s[d] = (s[d] ^ s[a]).rotate_left(8);
+    s[c] = s[c].wrapping_add(s[d]);
+    s[b] = (s[b] ^ s[c]).rotate_left(7);
+}
+
+/// 计算一个ChaCha20块，nonce固定为0
+fn chacha20_block(key: &[u32; 8], counter: u64, out: &mut [u8]) {
+    let mut init = [0u32; 16];
+    init[..4].copy_from_slice(&CHACHA_CONSTANTS);
+    init[4..12].copy_from_slice(key);
+    init[12] = counter as u32;
+    init[13] = (counter >> 32) as u32;
+
+    let mut s = init;
+    for _ in 0..10 {
+        quarter_round(&mut s, 0, 4, 8, 12);
+        quarter_round(&mut s, 1, 5, 9, 13);
+        quarter_round(&mut s, 2, 6, 10, 14);
+        quarter_round(&mut s, 3, 7, 11, 15);
+        quarter_round(&mut s, 0, 5, 10, 15);
+        quarter_round(&mut s, 1, 6, 11, 12);
+        quarter_round(&mut s, 2, 7, 8, 13);
+        quarter_round(&mut s, 3, 4, 9, 14);
+    }
+
+    for (i, chunk) in out.chunks_mut(4).enumerate() {
+        let word = s[i].wrapping_add(init[i]).to_le_bytes();
+        chunk.copy_from_slice(&word[..chunk.len()]);
+    }
+}
+
+fn key_from_bytes(bytes: &[u8]) -> [u32; 8] {
+    let mut key = [0u32; 8];
+    for (i, chunk) in bytes.chunks(4).take(8).enumerate() {
+        key[i] = u32::from_le_bytes(chunk.try_into().unwrap());
+    }
+    return key;
+}
+
+/// 用一次性的密钥生成任意长度的输出
+fn chacha20_fill(key: &[u32; 8], dest: &mut [u8]) {
+    for (counter, chunk) in dest.chunks_mut(CHACHA_BLOCK_SIZE).enumerate() {
+        chacha20_block(key, counter as u64, chunk);
+        // 每生成4KiB检查一次抢占，较大的getrandom请求不会长时间占用cpu
+        if counter % 64 == 63 {
+            cond_resched();
+        }
+    }
+}
+
+/// 一个CPU上的ChaCha20生成器
+struct ChaCha20Rng {
+    key: [u32; 8],
+    /// 尚未输出的随机字节
+    buf: [u8; RNG_BUF_SIZE],
+    /// buf中下一个未输出的字节
+    pos: usize,
+    /// 自上次混入熵以来补充缓冲区的次数
+    refills: usize,
+}
+
+impl ChaCha20Rng {
+    const fn new() -> Self {
+        return Self {
+            key: [0; 8],
+            buf: [0; RNG_BUF_SIZE],
+            pos: RNG_BUF_SIZE,
+            // 第一次使用时播种
+            refills: RNG_RESEED_INTERVAL,
+        };
+    }
+
+    /// 把新的熵混入密钥
+    fn reseed(&mut self) {
+        let mut entropy = [0u64; 4];
+        arch_entropy(&mut entropy);
+        for (i, e) in entropy.iter().enumerate() {
+            self.key[2 * i] ^= *e as u32;
+            self.key[2 * i + 1] ^= (*e >> 32) as u32;
+        }
+        self.refills = 0;
+    }
+
+    fn refill(&mut self) {
+        if self.refills >= RNG_RESEED_INTERVAL {
+            self.reseed();
+        }
+        let mut blocks = [0u8; RNG_REFILL_BLOCKS * CHACHA_BLOCK_SIZE];
+        chacha20_fill(&self.key, &mut blocks);
+        self.key = key_from_bytes(&blocks[..CHACHA_KEY_SIZE]);
+        self.buf.copy_from_slice(&blocks[CHACHA_KEY_SIZE..]);
+        blocks.fill(0);
+        self.pos = 0;
+        self.refills += 1;
+    }
+
+    /// 从缓冲区中取出随机字节，取出的字节随即被清零
+    fn fill(&mut self, dest: &mut [u8]) {
+        let mut done = 0;
+        while done < dest.len() {
+            if self.pos == RNG_BUF_SIZE {
+                self.refill();
+            }
+            let n = (dest.len() - done).min(RNG_BUF_SIZE - self.pos);
+            dest[done..done + n].copy_from_slice(&self.buf[self.pos..self.pos + n]);
+            self.buf[self.pos..self.pos + n].fill(0);
+            self.pos += n;
+            done += n;
+        }
+    }
+}
+
+static PER_CPU_RNG: [SpinLock<ChaCha20Rng>; PerCpu::MAX_CPU_NUM] =
+    [const { SpinLock::new(ChaCha20Rng::new()) }; PerCpu::MAX_CPU_NUM];
+
+fn with_cpu_rng<R>(f: impl FnOnce(&mut ChaCha20Rng) -> R) -> R {
+    let cpu = smp_get_processor_id() as usize;
+    let mut rng = PER_CPU_RNG[cpu].lock_irqsave();
+    return f(&mut rng);
+}
+
+/// 用随机字节填满`dest`
+///
+/// 较小的请求直接从当前CPU的缓冲区中取；较大的请求从生成器取出一个一次性的密钥，
+/// 然后在锁外直接生成到`dest`中。`dest`可以是用户空间的缓冲区
+pub fn get_random_bytes(dest: &mut [u8]) {
+    if dest.len() <= RNG_BUF_SIZE {
+        let mut tmp = [0u8; RNG_BUF_SIZE];
+        with_cpu_rng(|rng| rng.fill(&mut tmp[..dest.len()]));
+        dest.copy_from_slice(&tmp[..dest.len()]);
+        tmp.fill(0);
+        return;
+    }
+
+    let mut key_bytes = [0u8; CHACHA_KEY_SIZE];
+    with_cpu_rng(|rng| rng.fill(&mut key_bytes));
+    let key = key_from_bytes(&key_bytes);
+    key_bytes.fill(0);
+    chacha20_fill(&key, dest);
+}
+
+/// 获取一个随机的u64
+pub fn get_random_u64() -> u64 {
+    let mut bytes = [0u8; 8];
+    with_cpu_rng(|rng| rng.fill(&mut bytes));
+    return u64::from_ne_bytes(bytes);
+}
@@ -0,0 +1,343 @@
+//! RCU（Read-Copy-Update）
+//!
+//! 读者只需要关闭抢占（[`rcu_read_lock`]），不需要获取任何锁，也不会写入任何共享的缓存行；
+//! 写者复制一份新的数据并原子地发布它，然后通过[`call_rcu`]或者[`synchronize_rcu`]
+//! 等待一个宽限期（grace period）结束之后，再释放旧的数据。
+//!
+//! 由于读者不能在读临界区内被调度出去，一个cpu只要经过了一次静止状态（quiescent state）：
+//! 上下文切换、idle循环、或者时钟中断到来时当前进程的preempt count为0，就说明它在这之前开始的读临界区都已经结束了。
+//! 宽限期开始时，所有在线的cpu都需要报告一次静止状态，全部报告之后宽限期结束。
+//!
+//! 每个回调函数都记录了它需要等待的宽限期的编号，在宽限期结束之后，由所在的cpu在RCU软中断中执行。
+//! 停止了时钟中断的空闲cpu不会主动报告静止状态，宽限期开始时会通过IPI唤醒它们。
+
+#![allow(dead_code)]
+use core::{
+    ffi::c_void,
+    marker::PhantomData,
+    ptr::null_mut,
+    sync::atomic::{AtomicPtr, AtomicU64, AtomicUsize, Ordering},
+};
+
+use alloc::{boxed::Box, sync::Arc, vec::Vec};
+
+use crate::{
+    arch::CurrentIrqArch,
+    exception::{
+        softirq::{softirq_vectors, SoftirqNumber, SoftirqVec},
+        InterruptArch,
+    },
+    include::bindings::bindings::smp_get_total_cpu,
+    kinfo,
+    mm::percpu::PerCpu,
+    process::ProcessManager,
+    sched::{completion::Completion, isolation::tick_nohz_full_kick_all},
+    smp::{
+        core::smp_get_processor_id,
+        cpu::{AtomicCpuMask, CPU_MASK_WORDS},
+        kick_cpus,
+    },
+};
+
+use super::spinlock::SpinLock;
+
+/// 等待宽限期结束之后执行的回调函数
+type RcuCallback = Box<dyn FnOnce() + Send>;
+
+/// 宽限期的状态
+#[derive(Debug)]
+struct RcuGpState {
+    /// 已经结束的宽限期的数量
+    completed: u64,
+    /// 是否有宽限期正在进行（编号为`completed + 1`）
+    in_progress: bool,
+}
+
+static RCU_GP: SpinLock<RcuGpState> = SpinLock::new(RcuGpState {
+    completed: 0,
+    in_progress: false,
+});
+/// `RcuGpState::completed`的副本，读取时不需要加锁
+static RCU_COMPLETED: AtomicU64 = AtomicU64::new(0);
+/// 当前的宽限期中，还没有报告静止状态的cpu
+static RCU_QS_PENDING: AtomicCpuMask = AtomicCpuMask::new();
+/// 已经提交、但是还没有执行的回调函数的数量。不为0时，一个宽限期结束之后马上开始下一个
+static RCU_NR_CALLBACKS: AtomicUsize = AtomicUsize::new(0);
+
+/// 每个cpu上等待执行的回调函数，以及它们需要等待的宽限期的编号
+static RCU_CPU_CALLBACKS: [SpinLock<Vec<(u64, RcuCallback)>>; PerCpu::MAX_CPU_NUM] =
+    [const { SpinLock::new(Vec::new()) }; PerCpu::MAX_CPU_NUM];
+/// 每个cpu上的回调函数需要等待的最小的宽限期编号（`u64::MAX`表示没有回调函数）
+static RCU_CPU_NEXT_READY: [AtomicU64; PerCpu::MAX_CPU_NUM] =
+    [const { AtomicU64::new(u64::MAX) }; PerCpu::MAX_CPU_NUM];
+
+/// RCU读临界区的守卫。守卫存在期间，通过RCU读取到的数据不会被释放
+#[derive(Debug)]
+pub struct RcuReadGuard {
+    // 读临界区不能跨cpu，守卫不能被发送到其他线程
+    _not_send: PhantomData<*const ()>,
+}
+
+/// 进入RCU读临界区
+#[inline(always)]
+pub fn rcu_read_lock() -> RcuReadGuard {
+    ProcessManager::preempt_disable();
+    return RcuReadGuard {
+        _not_send: PhantomData,
+    };
+}
+
+impl Drop for RcuReadGuard {
+    #[inline(always)]
+    fn drop(&mut self) {
+        ProcessManager::preempt_enable();
+    }
+}
+
+/// 开始一个新的宽限期。调用者需要持有`RCU_GP`的锁，并且当前没有宽限期正在进行
+fn rcu_gp_start(gp: &mut RcuGpState) {
+    gp.in_progress = true;
+    let nr_cpus = unsafe { smp_get_total_cpu() } as usize;
+    RCU_QS_PENDING.fill(nr_cpus);
+    // 停止了时钟中断的空闲cpu需要被唤醒，才能在idle循环中报告静止状态
+    let this_cpu = smp_get_processor_id();
+    let mut idle = [0u64; CPU_MASK_WORDS];
+    for cpu in 0..nr_cpus as u32 {
+        if cpu != this_cpu && ProcessManager::cpu_in_nohz_idle(cpu) {
+            idle[cpu as usize / 64] |= 1 << (cpu % 64);
+        }
+    }
+    kick_cpus(&idle);
+    // 停止了时钟中断的nohz_full的cpu也需要恢复时钟中断，才能在时钟中断中报告静止状态
+    tick_nohz_full_kick_all();
+}
+
+/// 所有cpu都报告了静止状态：结束当前的宽限期
+fn rcu_gp_finish() {
+    let mut gp = RCU_GP.lock_irqsave();
+    // 多个cpu可能同时看到掩码被清空
+    if !gp.in_progress || !RCU_QS_PENDING.is_empty() {
+        return;
+    }
+    gp.completed += 1;
+    gp.in_progress = false;
+    RCU_COMPLETED.store(gp.completed, Ordering::SeqCst);
+    if RCU_NR_CALLBACKS.load(Ordering::SeqCst) != 0 {
+        rcu_gp_start(&mut gp);
+    }
+}
+
+/// 当前cpu经过了一次静止状态
+///
+/// 调用者需要保证当前cpu不处于RCU读临界区内（例如上下文切换时、idle循环中）
+pub fn rcu_note_qs() {
+    let cpu_id = smp_get_processor_id() as usize;
+    if !RCU_QS_PENDING.get(cpu_id) {
+        return;
+    }
+    RCU_QS_PENDING.clear(cpu_id);
+    if RCU_QS_PENDING.is_empty() {
+        rcu_gp_finish();
+    }
+}
+
+/// 时钟中断时调用：如果被打断的进程没有关闭抢占，它就不在读临界区内；
+/// 并且，如果当前cpu有可以执行的回调函数，触发RCU软中断
+pub fn rcu_tick() {
+    if ProcessManager::current().preempt_count() == 0 {
+        rcu_note_qs();
+    }
+    if rcu_callbacks_ready(smp_get_processor_id()) {
+        softirq_vectors().raise_softirq(SoftirqNumber::RCU);
+    }
+}
+
+#[inline(always)]
+fn rcu_callbacks_ready(cpu_id: u32) -> bool {
+    return RCU_CPU_NEXT_READY[cpu_id as usize].load(Ordering::Relaxed)
+        <= RCU_COMPLETED.load(Ordering::SeqCst);
+}
+
+/// 当前cpu是否还有等待执行的回调函数，或者还需要报告静止状态。此时不能停止时钟中断
+pub fn rcu_needs_cpu(cpu_id: u32) -> bool {
+    return RCU_CPU_NEXT_READY[cpu_id as usize].load(Ordering::Relaxed) != u64::MAX
+        || RCU_QS_PENDING.get(cpu_id as usize);
+}
+
+/// 在当前cpu上执行所有等待的宽限期已经结束的回调函数
+pub fn rcu_do_callbacks() {
+    let cpu_id = smp_get_processor_id() as usize;
+    let completed = RCU_COMPLETED.load(Ordering::SeqCst);
+    let ready: Vec<RcuCallback> = {
+        let mut list = RCU_CPU_CALLBACKS[cpu_id].lock_irqsave();
+        let mut ready = Vec::new();
+        let mut i = 0;
+        while i < list.len() {
+            if list[i].0 <= completed {
+                ready.push(list.swap_remove(i).1);
+            } else {
+                i += 1;
+            }
+        }
+        let next = list.iter().map(|(gp, _)| *gp).min().unwrap_or(u64::MAX);
+        RCU_CPU_NEXT_READY[cpu_id].store(next, Ordering::Relaxed);
+        ready
+    };
+    let nr = ready.len();
+    for f in ready {
+        f();
+    }
+    RCU_NR_CALLBACKS.fetch_sub(nr, Ordering::SeqCst);
+}
+
+/// 在当前的所有读临界区都结束之后，执行`f`
+///
+/// `f`在软中断上下文中执行，不能睡眠
+pub fn call_rcu<F: FnOnce() + Send + 'static>(f: F) {
+    let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+    let cpu_id = smp_get_processor_id() as usize;
+    RCU_NR_CALLBACKS.fetch_add(1, Ordering::SeqCst);
+    let target = {
+        let mut gp = RCU_GP.lock();
+        if gp.in_progress {
+            // 正在进行的宽限期可能在f被提交之前就开始了，需要等待下一个
+            gp.completed + 2
+        } else {
+            rcu_gp_start(&mut gp);
+            gp.completed + 1
+        }
+    };
+    let mut list = RCU_CPU_CALLBACKS[cpu_id].lock();
+    list.push((target, Box::new(f)));
+    RCU_CPU_NEXT_READY[cpu_id].fetch_min(target, Ordering::Relaxed);
+    drop(list);
+    drop(irq_guard);
+}
+
+/// 等待当前的所有读临界区结束。调用者会睡眠，不能在读临界区内或者关闭抢占时调用
+pub fn synchronize_rcu() {
+    // 进程管理初始化之前只有一个执行流，不存在并发的读者
+    if !ProcessManager::initialized() {
+        return;
+    }
+    let done = Arc::new(Completion::new());
+    let c = done.clone();
+    call_rcu(move || c.complete());
+    done.wait_for_completion().ok();
+}
+
+/// 通过RCU保护的`Arc<T>`指针
+///
+/// 读者在读临界区内直接访问当前发布的数据；写者用新的数据替换它，旧的数据在宽限期结束之后才被释放。
+/// 多个写者之间需要由调用者自行同步
+#[derive(Debug)]
+pub struct RcuCell<T: Send + Sync + 'static> {
+    ptr: AtomicPtr<T>,
+}
+
+/// 把旧数据的指针传给回调函数
+struct RcuStale<T>(*const T);
+
+unsafe impl<T: Send + Sync> Send for RcuStale<T> {}
+
+impl<T: Send + Sync + 'static> RcuCell<T> {
+    /// 创建一个没有发布任何数据的RcuCell
+    pub const fn empty() -> Self {
+        return Self {
+            ptr: AtomicPtr::new(null_mut()),
+        };
+    }
+
+    pub fn new(value: Arc<T>) -> Self {
+        return Self {
+            ptr: AtomicPtr::new(Arc::into_raw(value) as *mut T),
+        };
+    }
+
+    /// 在读临界区内访问当前发布的数据
+    #[inline(always)]
+    pub fn get<'a>(&'a self, _guard: &'a RcuReadGuard) -> Option<&'a T> {
+        let ptr = self.ptr.load(Ordering::Acquire);
+        return unsafe { ptr.as_ref() };
+    }
+
+    /// 获取当前发布的数据的引用计数指针，可以在读临界区之外使用
+    pub fn get_arc(&self) -> Option<Arc<T>> {
+        let _guard = rcu_read_lock();
+        let ptr = self.ptr.load(Ordering::Acquire);
+        if ptr.is_null() {
+            return None;
+        }
+        // 宽限期结束之前，旧的Arc不会被释放，因此可以安全地增加引用计数
+        unsafe {
+            Arc::increment_strong_count(ptr);
+            return Some(Arc::from_raw(ptr));
+        }
+    }
+
+    /// 发布新的数据。旧的数据在宽限期结束之后被释放
+    pub fn replace(&self, value: Option<Arc<T>>) {
+        let new = value.map_or(null_mut(), |v| Arc::into_raw(v) as *mut T);
+        let old = self.ptr.swap(new, Ordering::AcqRel);
+        if old.is_null() {
+            return;
+        }
+        let stale = RcuStale(old as *const T);
+        call_rcu(move || {
+            let stale = stale;
+            drop(unsafe { Arc::from_raw(stale.0) });
+        });
+    }
+}
+
+impl<T: Send + Sync + 'static> Drop for RcuCell<T> {
+    fn drop(&mut self) {
+        // 能够被drop说明已经没有读者持有它的引用了
+        let ptr = *self.ptr.get_mut();
+        if !ptr.is_null() {
+            drop(unsafe { Arc::from_raw(ptr) });
+        }
+    }
+}
+
+/// RCU软中断：执行宽限期已经结束的回调函数
+#[derive(Debug)]
+struct RcuSoftirq;
+
+impl SoftirqVec for RcuSoftirq {
+    fn run(&self) {
+        rcu_do_callbacks();
+    }
+}
+
+/// 初始化RCU（需要在软中断模块初始化完成之后调用）
+pub fn rcu_init() {
+    softirq_vectors()
+        .register_softirq(SoftirqNumber::RCU, Arc::new(RcuSoftirq))
+        .expect("Failed to register rcu softirq");
+    kinfo!("RCU initialized");
+}
+
+#[no_mangle]
+pub extern "C" fn rs_rcu_init() {
+    rcu_init();
+}
+
+/// 进入RCU读临界区（C代码使用，与[`rs_rcu_read_unlock`]成对调用）
+#[no_mangle]
+pub extern "C" fn rs_rcu_read_lock() {
+    ProcessManager::preempt_disable();
+}
+
+/// 退出RCU读临界区（C代码使用）
+#[no_mangle]
+pub extern "C" fn rs_rcu_read_unlock() {
+    ProcessManager::preempt_enable();
+}
+
+/// 在宽限期结束之后调用`func(data)`（C代码使用）
+#[no_mangle]
+pub extern "C" fn rs_call_rcu(func: extern "C" fn(*mut c_void), data: *mut c_void) {
+    let data = data as usize;
+    call_rcu(move || func(data as *mut c_void));
+}
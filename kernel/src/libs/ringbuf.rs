@@ -0,0 +1,398 @@
+//! 无锁环形缓冲区
+//!
+//! - [`SpscRing`]：单生产者、单消费者
+//! - [`MpscRing`]：多生产者、单消费者
+//!
+//! 两者都是容量固定（2的幂）的有界队列，元素按值复制（`T: Copy`）。缓冲区满时，写入失败（由调用者决定丢弃哪些数据），
+//! 不会覆盖还没有被读走的元素。
+//!
+//! 生产者和消费者之间不需要任何锁，也不需要关中断：生产者写入元素之后以Release语义发布新的写入位置（或者槽位的序号），
+//! 消费者以Acquire语义读取它；消费者读完元素之后以Release语义推进读取位置，生产者以Acquire语义读取它，
+//! 从而确定哪些槽位可以复用。`push_slice`/`pop_slice`一次复制多个元素，只发布一次位置。
+//!
+//! 请注意：
+//! - 同一时刻只能有一个消费者（`pop`、`pop_slice`、`peek_with`、`clear`）。有多个读者时，由调用者互斥
+//! - [`SpscRing`]同一时刻只能有一个生产者。生产者可能被嵌套的中断打断时，中断处理程序不能写入同一个缓冲区，
+//!   否则应当使用[`MpscRing`]
+//! - [`MpscRing`]的生产者先预留槽位，写入之后再逐个发布。较早预留槽位的生产者还没有发布时，
+//!   消费者暂时读不到之后的元素，但生产者之间不会互相等待
+
+#![allow(dead_code)]
+use core::{
+    cell::UnsafeCell,
+    fmt::Debug,
+    mem::MaybeUninit,
+    sync::atomic::{AtomicUsize, Ordering},
+};
+
+use alloc::{boxed::Box, vec::Vec};
+
+/// 把容量向上取整为2的幂（至少为1）
+fn ring_capacity(capacity: usize) -> usize {
+    return capacity.max(1).next_power_of_two();
+}
+
+/// 单生产者、单消费者的无锁环形缓冲区
+pub struct SpscRing<T: Copy> {
+    /// 下一个写入的位置（不回绕，与`mask`相与后才是下标），只由生产者修改
+    head: AtomicUsize,
+    /// 下一个读出的位置（不回绕），只由消费者修改
+    tail: AtomicUsize,
+    mask: usize,
+    slots: Box<[UnsafeCell<MaybeUninit<T>>]>,
+}
+
+unsafe impl<T: Copy + Send> Send for SpscRing<T> {}
+unsafe impl<T: Copy + Send> Sync for SpscRing<T> {}
+
+impl<T: Copy> SpscRing<T> {
+    /// 创建一个能容纳至少`capacity`个元素的缓冲区
+    pub fn new(capacity: usize) -> Self {
+        let capacity = ring_capacity(capacity);
+        let slots: Vec<UnsafeCell<MaybeUninit<T>>> = (0..capacity)
+            .map(|_| UnsafeCell::new(MaybeUninit::uninit()))
+            .collect();
+        return Self {
+            head: AtomicUsize::new(0),
+            tail: AtomicUsize::new(0),
+            mask: capacity - 1,
+            slots: slots.into_boxed_slice(),
+        };
+    }
+
+    #[inline(always)]
+    pub fn capacity(&self) -> usize {
+        return self.mask + 1;
+    }
+
+    /// 缓冲区中的元素数量（生产者、消费者以外的一方读取时只是近似值）
+    #[inline]
+    pub fn len(&self) -> usize {
+        // 先读tail：tail不会超过之后读到的head
+        let tail = self.tail.load(Ordering::Acquire);
+        let head = self.head.load(Ordering::Acquire);
+        return core::cmp::min(head.wrapping_sub(tail), self.capacity());
+    }
+
+    #[inline]
+    pub fn is_empty(&self) -> bool {
+        return self.len() == 0;
+    }
+
+    #[inline]
+    pub fn is_full(&self) -> bool {
+        return self.len() == self.capacity();
+    }
+
+    /// 写入一个元素（生产者）
+    ///
+    /// ## 返回值
+    ///
+    /// 缓冲区满时返回`Err(value)`
+    #[inline]
+    pub fn push(&self, value: T) -> Result<(), T> {
+        let head = self.head.load(Ordering::Relaxed);
+        let tail = self.tail.load(Ordering::Acquire);
+        if head.wrapping_sub(tail) >= self.capacity() {
+            return Err(value);
+        }
+        unsafe { (*self.slots[head & self.mask].get()).write(value) };
+        self.head.store(head.wrapping_add(1), Ordering::Release);
+        return Ok(());
+    }
+
+    /// 写入尽可能多的元素（生产者）
+    ///
+    /// ## 返回值
+    ///
+    /// 写入的元素数量。缓冲区放不下的元素没有被写入
+    pub fn push_slice(&self, data: &[T]) -> usize {
+        let head = self.head.load(Ordering::Relaxed);
+        let tail = self.tail.load(Ordering::Acquire);
+        let free = self.capacity() - head.wrapping_sub(tail);
+        let n = core::cmp::min(data.len(), free);
+        if n == 0 {
+            return 0;
+        }
+        unsafe { self.copy_in(head, &data[..n]) };
+        self.head.store(head.wrapping_add(n), Ordering::Release);
+        return n;
+    }
+
+    /// 读出最旧的元素（消费者）
+    #[inline]
+    pub fn pop(&self) -> Option<T> {
+        let tail = self.tail.load(Ordering::Relaxed);
+        if tail == self.head.load(Ordering::Acquire) {
+            return None;
+        }
+        let value = unsafe { (*self.slots[tail & self.mask].get()).assume_init() };
+        self.tail.store(tail.wrapping_add(1), Ordering::Release);
+        return Some(value);
+    }
+
+    /// 读出尽可能多的元素，填入`out`（消费者）
+    ///
+    /// ## 返回值
+    ///
+    /// 读出的元素数量
+    pub fn pop_slice(&self, out: &mut [T]) -> usize {
+        let tail = self.tail.load(Ordering::Relaxed);
+        let head = self.head.load(Ordering::Acquire);
+        let n = core::cmp::min(out.len(), head.wrapping_sub(tail));
+        if n == 0 {
+            return 0;
+        }
+        unsafe { self.copy_out(tail, &mut out[..n]) };
+        self.tail.store(tail.wrapping_add(n), Ordering::Release);
+        return n;
+    }
+
+    /// 在不读出的情况下访问最旧的元素（消费者）
+    #[inline]
+    pub fn peek_with<R>(&self, f: impl FnOnce(&T) -> R) -> Option<R> {
+        let tail = self.tail.load(Ordering::Relaxed);
+        if tail == self.head.load(Ordering::Acquire) {
+            return None;
+        }
+        return Some(f(unsafe {
+            (*self.slots[tail & self.mask].get()).assume_init_ref()
+        }));
+    }
+
+    /// 丢弃所有元素（消费者）
+    pub fn clear(&self) {
+        let head = self.head.load(Ordering::Acquire);
+        self.tail.store(head, Ordering::Release);
+    }
+
+    /// 把`data`复制到从`pos`开始的槽位（可能回绕到开头）
+    unsafe fn copy_in(&self, pos: usize, data: &[T]) {
+        let start = pos & self.mask;
+        let first = core::cmp::min(data.len(), self.capacity() - start);
+        let base = self.slots.as_ptr() as *mut T;
+        core::ptr::copy_nonoverlapping(data.as_ptr(), base.add(start), first);
+        core::ptr::copy_nonoverlapping(data.as_ptr().add(first), base, data.len() - first);
+    }
+
+    /// 把从`pos`开始的槽位复制到`out`（可能回绕到开头）
+    unsafe fn copy_out(&self, pos: usize, out: &mut [T]) {
+        let start = pos & self.mask;
+        let first = core::cmp::min(out.len(), self.capacity() - start);
+        let base = self.slots.as_ptr() as *const T;
+        core::ptr::copy_nonoverlapping(base.add(start), out.as_mut_ptr(), first);
+        core::ptr::copy_nonoverlapping(base, out.as_mut_ptr().add(first), out.len() - first);
+    }
+}
+
+impl<T: Copy> Debug for SpscRing<T> {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        f.debug_struct("SpscRing")
+            .field("capacity", &self.capacity())
+            .field("len", &self.len())
+            .finish()
+    }
+}
+
+/// [`MpscRing`]的一个槽位
+struct MpscSlot<T> {
+    /// 最后一次写入这个槽位的位置加一。等于`pos + 1`时，位置`pos`上的元素已经被发布
+    seq: AtomicUsize,
+    value: UnsafeCell<MaybeUninit<T>>,
+}
+
+/// 多生产者、单消费者的无锁环形缓冲区
+///
+/// 生产者通过CAS推进`head`预留槽位（一次可以预留多个），写入之后逐个槽位地发布；
+/// 消费者按照顺序检查槽位的序号，遇到还没有被发布的槽位就停下
+pub struct MpscRing<T: Copy> {
+    /// 下一个被预留的位置（不回绕）
+    head: AtomicUsize,
+    /// 下一个读出的位置（不回绕），只由消费者修改
+    tail: AtomicUsize,
+    mask: usize,
+    slots: Box<[MpscSlot<T>]>,
+}
+
+unsafe impl<T: Copy + Send> Send for MpscRing<T> {}
+unsafe impl<T: Copy + Send> Sync for MpscRing<T> {}
+
+impl<T: Copy> MpscRing<T> {
+    /// 创建一个能容纳至少`capacity`个元素的缓冲区
+    pub fn new(capacity: usize) -> Self {
+        let capacity = ring_capacity(capacity);
+        let slots: Vec<MpscSlot<T>> = (0..capacity)
+            .map(|_| MpscSlot {
+                seq: AtomicUsize::new(0),
+                value: UnsafeCell::new(MaybeUninit::uninit()),
+            })
+            .collect();
+        return Self {
+            head: AtomicUsize::new(0),
+            tail: AtomicUsize::new(0),
+            mask: capacity - 1,
+            slots: slots.into_boxed_slice(),
+        };
+    }
+
+    #[inline(always)]
+    pub fn capacity(&self) -> usize {
+        return self.mask + 1;
+    }
+
+    /// 已经被预留的槽位数量（包括还没有被发布的元素）
+    #[inline]
+    pub fn len(&self) -> usize {
+        let tail = self.tail.load(Ordering::Acquire);
+        let head = self.head.load(Ordering::Acquire);
+        return core::cmp::min(head.wrapping_sub(tail), self.capacity());
+    }
+
+    #[inline]
+    pub fn is_empty(&self) -> bool {
+        return self.len() == 0;
+    }
+
+    /// 预留最多`n`个连续的槽位
+    ///
+    /// ## 返回值
+    ///
+    /// (第一个槽位的位置, 预留的数量)
+    #[inline]
+    fn reserve(&self, n: usize) -> (usize, usize) {
+        let mut head = self.head.load(Ordering::Relaxed);
+        loop {
+            // tail的Acquire保证消费者已经读完了这些槽位中的旧元素
+            let tail = self.tail.load(Ordering::Acquire);
+            let free = self.capacity().saturating_sub(head.wrapping_sub(tail));
+            let cnt = core::cmp::min(n, free);
+            if cnt == 0 {
+                // 读到的head可能已经过时（其它生产者预留之后，消费者又读走了元素），重新读取后再判断
+                let h = self.head.load(Ordering::Relaxed);
+                if h == head {
+                    return (head, 0);
+                }
+                head = h;
+                continue;
+            }
+            match self.head.compare_exchange_weak(
+                head,
+                head.wrapping_add(cnt),
+                Ordering::Relaxed,
+                Ordering::Relaxed,
+            ) {
+                Ok(_) => return (head, cnt),
+                Err(h) => head = h,
+            }
+        }
+    }
+
+    /// 写入位置`pos`上的元素并发布它
+    #[inline(always)]
+    fn publish(&self, pos: usize, value: T) {
+        let slot = &self.slots[pos & self.mask];
+        unsafe { (*slot.value.get()).write(value) };
+        slot.seq.store(pos.wrapping_add(1), Ordering::Release);
+    }
+
+    /// 写入一个元素（任意多个生产者，可以在中断上下文中调用）
+    ///
+    /// ## 返回值
+    ///
+    /// 缓冲区满时返回`Err(value)`
+    #[inline]
+    pub fn push(&self, value: T) -> Result<(), T> {
+        let (pos, n) = self.reserve(1);
+        if n == 0 {
+            return Err(value);
+        }
+        self.publish(pos, value);
+        return Ok(());
+    }
+
+    /// 写入尽可能多的元素（任意多个生产者，可以在中断上下文中调用）
+    ///
+    /// 写入的元素在缓冲区中是连续的，不会与其它生产者的元素交错
+    ///
+    /// ## 返回值
+    ///
+    /// 写入的元素数量。缓冲区放不下的元素没有被写入
+    pub fn push_slice(&self, data: &[T]) -> usize {
+        let (pos, n) = self.reserve(data.len());
+        for (i, value) in data[..n].iter().enumerate() {
+            self.publish(pos.wrapping_add(i), *value);
+        }
+        return n;
+    }
+
+    /// 位置`pos`上的元素是否已经被发布
+    #[inline(always)]
+    fn published(&self, pos: usize) -> bool {
+        return self.slots[pos & self.mask].seq.load(Ordering::Acquire) == pos.wrapping_add(1);
+    }
+
+    /// 读出最旧的元素（消费者）
+    ///
+    /// 最旧的元素还没有被发布时返回`None`
+    #[inline]
+    pub fn pop(&self) -> Option<T> {
+        let tail = self.tail.load(Ordering::Relaxed);
+        if !self.published(tail) {
+            return None;
+        }
+        let value = unsafe { (*self.slots[tail & self.mask].value.get()).assume_init() };
+        self.tail.store(tail.wrapping_add(1), Ordering::Release);
+        return Some(value);
+    }
+
+    /// 读出尽可能多的已经被发布的元素，填入`out`（消费者）
+    ///
+    /// ## 返回值
+    ///
+    /// 读出的元素数量
+    pub fn pop_slice(&self, out: &mut [T]) -> usize {
+        let tail = self.tail.load(Ordering::Relaxed);
+        let mut n = 0;
+        while n < out.len() {
+            let pos = tail.wrapping_add(n);
+            if !self.published(pos) {
+                break;
+            }
+            out[n] = unsafe { (*self.slots[pos & self.mask].value.get()).assume_init() };
+            n += 1;
+        }
+        if n != 0 {
+            self.tail.store(tail.wrapping_add(n), Ordering::Release);
+        }
+        return n;
+    }
+
+    /// 在不读出的情况下访问最旧的元素（消费者）
+    #[inline]
+    pub fn peek_with<R>(&self, f: impl FnOnce(&T) -> R) -> Option<R> {
+        let tail = self.tail.load(Ordering::Relaxed);
+        if !self.published(tail) {
+            return None;
+        }
+        let slot = &self.slots[tail & self.mask];
+        return Some(f(unsafe { (*slot.value.get()).assume_init_ref() }));
+    }
+
+    /// 丢弃所有已经被发布的元素（消费者）
+    pub fn clear(&self) {
+        let mut tail = self.tail.load(Ordering::Relaxed);
+        while self.published(tail) {
+            tail = tail.wrapping_add(1);
+        }
+        self.tail.store(tail, Ordering::Release);
+    }
+}
+
+impl<T: Copy> Debug for MpscRing<T> {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        f.debug_struct("MpscRing")
+            .field("capacity", &self.capacity())
+            .field("len", &self.len())
+            .finish()
+    }
+}
@@ -14,10 +14,24 @@ use crate::{
     syscall::SystemError,
 };
 
+use super::{
+    lockstat::{lock_site, wait_start, LockClassCache, LockHold, LockKind},
+    qspinlock::QueuedSpinLock,
+};
+
 ///RwLock读写锁
+///
+/// 读者和写者先尝试直接获得锁。失败时，在`wait_lock`（排队自旋锁）上按照到达的顺序排队，只有队首在锁字上自旋。
+/// 写者排到队首之后会设置WAITING位，此后新的读者不能再直接获得锁，而是排在这个写者后面，使得写者不会被源源不断的读者饿死。
+///
+/// 关中断的调用者（包括中断上下文）不排队，只等待WRITER位被清除，
+/// 否则它可能在排队时等待被自己打断的、排在队首的写者，造成死锁。
+
+/// @brief READER位占据从右往左数第四个比特位
+const READER: u32 = 1 << 3;
 
-/// @brief READER位占据从右往左数第三个比特位
-const READER: u32 = 1 << 2;
+/// @brief WAITING位占据从右往左数第三个比特位，表示有写者在等待
+const WAITING: u32 = 1 << 2;
 
 /// @brief UPGRADED位占据从右到左数第二个比特位
 const UPGRADED: u32 = 1 << 1;
@@ -25,10 +39,10 @@ const UPGRADED: u32 = 1 << 1;
 /// @brief WRITER位占据最右边的比特位
 const WRITER: u32 = 1;
 
-const READER_BIT: u32 = 2;
+const READER_BIT: u32 = 3;
 
 /// @brief 读写锁的基本数据结构
-/// @param lock 32位原子变量,最右边的两位从左到右分别是UPGRADED,WRITER (标志位)
+/// @param lock 32位原子变量,最右边的三位从左到右分别是WAITING,UPGRADED,WRITER (标志位)
 ///             剩下的bit位存储READER数量(除了MSB)
 ///             对于标志位,0代表无, 1代表有
 ///             对于剩下的比特位表征READER的数量的多少
@@ -36,6 +50,12 @@ const READER_BIT: u32 = 2;
 #[derive(Debug)]
 pub struct RwLock<T> {
     lock: AtomicU32,
+    /// 获取锁失败的读者和写者在这里排队
+    wait_lock: QueuedSpinLock<()>,
+    /// 读者的竞争统计的类别（启用lockstat特性时）
+    read_stat: LockClassCache,
+    /// 写者和upgrader的竞争统计的类别
+    write_stat: LockClassCache,
     data: UnsafeCell<T>,
 }
 
@@ -45,6 +65,7 @@ pub struct RwLockReadGuard<'a, T: 'a> {
     data: *const T,
     lock: &'a AtomicU32,
     irq_guard: Option<IrqFlagsGuard>,
+    hold: LockHold,
 }
 
 /// @brief UPGRADED是介于READER和WRITER之间的一种锁,它可以升级为WRITER,
@@ -55,6 +76,7 @@ pub struct RwLockUpgradableGuard<'a, T: 'a> {
     data: *const T,
     inner: &'a RwLock<T>,
     irq_guard: Option<IrqFlagsGuard>,
+    hold: LockHold,
 }
 
 /// @brief WRITER守卫的数据结构
@@ -64,6 +86,7 @@ pub struct RwLockWriteGuard<'a, T: 'a> {
     data: *mut T,
     inner: &'a RwLock<T>,
     irq_guard: Option<IrqFlagsGuard>,
+    hold: LockHold,
 }
 
 unsafe impl<T: Send> Send for RwLock<T> {}
@@ -76,6 +99,9 @@ impl<T> RwLock<T> {
     pub const fn new(data: T) -> Self {
         return RwLock {
             lock: AtomicU32::new(0),
+            wait_lock: QueuedSpinLock::new(()),
+            read_stat: LockClassCache::new(),
+            write_stat: LockClassCache::new(),
             data: UnsafeCell::new(data),
         };
     }
@@ -137,9 +163,9 @@ impl<T> RwLock<T> {
             value = reader_value.unwrap();
         }
 
-        //判断有没有writer和upgrader
+        //判断有没有writer、upgrader和等待中的writer
         //注意, 若upgrader存在,已经存在的读者继续占有锁,但新读者不允许获得锁
-        if value & (WRITER | UPGRADED) != 0 {
+        if value & (WRITER | UPGRADED | WAITING) != 0 {
             self.lock.fetch_sub(READER, Ordering::Release);
             return None;
         } else {
@@ -147,6 +173,7 @@ impl<T> RwLock<T> {
                 data: unsafe { &*self.data.get() },
                 lock: &self.lock,
                 irq_guard: None,
+                hold: LockHold::NONE,
             });
         }
     }
@@ -154,26 +181,56 @@ impl<T> RwLock<T> {
     #[allow(dead_code)]
     #[inline]
     /// @brief 获得READER的守卫
+    #[cfg_attr(feature = "lockstat", track_caller)]
     pub fn read(&self) -> RwLockReadGuard<T> {
-        loop {
-            match self.try_read() {
-                Some(guard) => return guard,
-                None => spin_loop(),
-            }
-        } //忙等待
+        ProcessManager::preempt_disable();
+        if let Some(mut guard) = self.inner_try_read() {
+            guard.hold = self.read_stat.acquired::<Self>(LockKind::RwRead);
+            return guard;
+        }
+        let start = wait_start();
+        let mut guard = self.read_slowpath();
+        guard.hold = self
+            .read_stat
+            .contended::<Self>(LockKind::RwRead, start, lock_site());
+        return guard;
     }
 
+    #[cfg_attr(feature = "lockstat", track_caller)]
     pub fn read_irqsave(&self) -> RwLockReadGuard<T> {
+        let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+        let mut guard = self.read();
+        guard.irq_guard = Some(irq_guard);
+        return guard;
+    }
+
+    /// 获取READER守卫的慢速路径。调用者已经关闭了抢占
+    #[inline(never)]
+    fn read_slowpath(&self) -> RwLockReadGuard<T> {
+        let queued = if CurrentIrqArch::is_irq_enabled() {
+            Some(self.wait_lock.lock())
+        } else {
+            None
+        };
         loop {
-            let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
-            match self.try_read() {
-                Some(mut guard) => {
-                    guard.irq_guard = Some(irq_guard);
-                    return guard;
+            // 已经排到了队首（或者不排队）：不管是否有写者在等待，只要没有writer和upgrader就可以获得锁
+            if let Ok(value) = self.current_reader() {
+                if value & (WRITER | UPGRADED) == 0 {
+                    break;
                 }
-                None => spin_loop(),
+                self.lock.fetch_sub(READER, Ordering::Release);
+            }
+            while self.lock.load(Ordering::Relaxed) & (WRITER | UPGRADED) != 0 {
+                spin_loop();
             }
         }
+        drop(queued);
+        return RwLockReadGuard {
+            data: unsafe { &*self.data.get() },
+            lock: &self.lock,
+            irq_guard: None,
+            hold: LockHold::NONE,
+        };
     }
 
     #[allow(dead_code)]
@@ -218,6 +275,7 @@ impl<T> RwLock<T> {
                 data: unsafe { &mut *self.data.get() },
                 inner: self,
                 irq_guard: None,
+                hold: LockHold::NONE,
             });
         } else {
             return None;
@@ -227,29 +285,73 @@ impl<T> RwLock<T> {
     #[allow(dead_code)]
     #[inline]
     /// @brief 获得WRITER守卫
+    #[cfg_attr(feature = "lockstat", track_caller)]
     pub fn write(&self) -> RwLockWriteGuard<T> {
-        loop {
-            match self.try_write() {
-                Some(guard) => return guard,
-                None => spin_loop(),
-            }
+        ProcessManager::preempt_disable();
+        if let Some(mut guard) = self.inner_try_write() {
+            guard.hold = self.write_stat.acquired::<Self>(LockKind::RwWrite);
+            return guard;
         }
+        let start = wait_start();
+        let mut guard = self.write_slowpath();
+        guard.hold = self
+            .write_stat
+            .contended::<Self>(LockKind::RwWrite, start, lock_site());
+        return guard;
     }
 
     #[allow(dead_code)]
     #[inline]
     /// @brief 获取WRITER守卫并关中断
+    #[cfg_attr(feature = "lockstat", track_caller)]
     pub fn write_irqsave(&self) -> RwLockWriteGuard<T> {
-        loop {
-            let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
-            match self.try_write() {
-                Some(mut guard) => {
-                    guard.irq_guard = Some(irq_guard);
-                    return guard;
+        let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+        let mut guard = self.write();
+        guard.irq_guard = Some(irq_guard);
+        return guard;
+    }
+
+    /// 获取WRITER守卫的慢速路径。调用者已经关闭了抢占
+    #[inline(never)]
+    fn write_slowpath(&self) -> RwLockWriteGuard<T> {
+        if CurrentIrqArch::is_irq_enabled() {
+            let queued = self.wait_lock.lock();
+            // 排到了队首：阻止新的读者获得锁，然后等待已有的读者、upgrader和writer离开
+            self.lock.fetch_or(WAITING, Ordering::Relaxed);
+            while self
+                .lock
+                .compare_exchange_weak(WAITING, WRITER, Ordering::Acquire, Ordering::Relaxed)
+                .is_err()
+            {
+                spin_loop();
+            }
+            drop(queued);
+        } else {
+            // 不排队，但是仍然可以在排队的写者设置了WAITING位之后获得锁
+            loop {
+                let value = self.lock.load(Ordering::Relaxed);
+                if value & !WAITING == 0
+                    && self
+                        .lock
+                        .compare_exchange_weak(
+                            value,
+                            value | WRITER,
+                            Ordering::Acquire,
+                            Ordering::Relaxed,
+                        )
+                        .is_ok()
+                {
+                    break;
                 }
-                None => spin_loop(),
+                spin_loop();
             }
         }
+        return RwLockWriteGuard {
+            data: unsafe { &mut *self.data.get() },
+            inner: self,
+            irq_guard: None,
+            hold: LockHold::NONE,
+        };
     }
 
     #[allow(dead_code)]
@@ -287,6 +389,7 @@ impl<T> RwLock<T> {
                 inner: self,
                 data: unsafe { &mut *self.data.get() },
                 irq_guard: None,
+                hold: LockHold::NONE,
             });
         } else {
             return None;
@@ -296,36 +399,62 @@ impl<T> RwLock<T> {
     #[allow(dead_code)]
     #[inline]
     /// @brief 获得UPGRADER守卫
+    #[cfg_attr(feature = "lockstat", track_caller)]
     pub fn upgradeable_read(&self) -> RwLockUpgradableGuard<T> {
+        let mut waited = None;
         loop {
             match self.try_upgradeable_read() {
-                Some(guard) => return guard,
-                None => spin_loop(),
+                Some(mut guard) => {
+                    guard.hold = self.upgradeable_hold(waited);
+                    return guard;
+                }
+                None => {
+                    waited.get_or_insert_with(wait_start);
+                    spin_loop()
+                }
             }
         }
     }
 
     #[inline]
     /// @brief 获得UPGRADER守卫
+    #[cfg_attr(feature = "lockstat", track_caller)]
     pub fn upgradeable_read_irqsave(&self) -> RwLockUpgradableGuard<T> {
+        let mut waited = None;
         loop {
             let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
             match self.try_upgradeable_read() {
                 Some(mut guard) => {
                     guard.irq_guard = Some(irq_guard);
+                    guard.hold = self.upgradeable_hold(waited);
                     return guard;
                 }
-                None => spin_loop(),
+                None => {
+                    waited.get_or_insert_with(wait_start);
+                    spin_loop()
+                }
             }
         }
     }
 
+    /// 记录获得UPGRADER守卫时的竞争统计，`waited`是第一次获取失败的时间
+    #[inline(always)]
+    #[cfg_attr(feature = "lockstat", track_caller)]
+    fn upgradeable_hold(&self, waited: Option<super::lockstat::LockTime>) -> LockHold {
+        return match waited {
+            None => self.write_stat.acquired::<Self>(LockKind::RwWrite),
+            Some(start) => self
+                .write_stat
+                .contended::<Self>(LockKind::RwWrite, start, lock_site()),
+        };
+    }
+
     #[allow(dead_code)]
     #[inline]
     //extremely unsafe behavior
     /// @brief 强制减少READER数
     pub unsafe fn force_read_decrement(&self) {
-        debug_assert!(self.lock.load(Ordering::Relaxed) & !WRITER > 0);
+        debug_assert!(self.lock.load(Ordering::Relaxed) & !(WRITER | UPGRADED | WAITING) > 0);
         self.lock.fetch_sub(READER, Ordering::Release);
     }
 
@@ -334,7 +463,10 @@ impl<T> RwLock<T> {
     //extremely unsafe behavior
     /// @brief 强制给WRITER解锁
     pub unsafe fn force_write_unlock(&self) {
-        debug_assert_eq!(self.lock.load(Ordering::Relaxed) & !(WRITER | UPGRADED), 0);
+        debug_assert_eq!(
+            self.lock.load(Ordering::Relaxed) & !(WRITER | UPGRADED | WAITING),
+            0
+        );
         self.lock.fetch_and(!(WRITER | UPGRADED), Ordering::Release);
     }
 
@@ -379,9 +511,11 @@ impl<'rwlock, T> RwLockUpgradableGuard<'rwlock, T> {
     #[inline]
     /// @brief 尝试将UPGRADER守卫升级为WRITER守卫
     pub fn try_upgrade(mut self) -> Result<RwLockWriteGuard<'rwlock, T>, Self> {
+        // 保留WAITING位：等待中的写者正在等待这个upgrader离开
+        let waiting = self.inner.lock.load(Ordering::Relaxed) & WAITING;
         let res = self.inner.lock.compare_exchange(
-            UPGRADED,
-            WRITER,
+            UPGRADED | waiting,
+            WRITER | waiting,
             Ordering::Acquire,
             Ordering::Relaxed,
         );
@@ -390,12 +524,14 @@ impl<'rwlock, T> RwLockUpgradableGuard<'rwlock, T> {
         if res.is_ok() {
             let inner = self.inner;
             let irq_guard = self.irq_guard.take();
+            self.hold.release();
             mem::forget(self);
 
             Ok(RwLockWriteGuard {
                 data: unsafe { &mut *inner.data.get() },
                 inner,
                 irq_guard,
+                hold: LockHold::NONE,
             })
         } else {
             Err(self)
@@ -433,6 +569,7 @@ impl<'rwlock, T> RwLockUpgradableGuard<'rwlock, T> {
             data: unsafe { &*inner.data.get() },
             lock: &inner.lock,
             irq_guard,
+            hold: LockHold::NONE,
         }
     }
 
@@ -487,6 +624,7 @@ impl<'rwlock, T> RwLockWriteGuard<'rwlock, T> {
             data: unsafe { &*inner.data.get() },
             lock: &inner.lock,
             irq_guard,
+            hold: LockHold::NONE,
         };
     }
 
@@ -499,17 +637,22 @@ impl<'rwlock, T> RwLockWriteGuard<'rwlock, T> {
             WRITER
         );
 
-        self.inner.lock.store(UPGRADED, Ordering::Release);
+        // 同时翻转WRITER和UPGRADED位，保留WAITING位
+        self.inner
+            .lock
+            .fetch_xor(WRITER | UPGRADED, Ordering::Release);
 
         let inner = self.inner;
 
         let irq_guard = self.irq_guard.take();
+        self.hold.release();
         mem::forget(self);
 
         return RwLockUpgradableGuard {
             inner,
             data: unsafe { &*inner.data.get() },
             irq_guard,
+            hold: LockHold::NONE,
         };
     }
 }
@@ -546,7 +689,8 @@ impl<'rwlock, T> DerefMut for RwLockWriteGuard<'rwlock, T> {
 
 impl<'rwlock, T> Drop for RwLockReadGuard<'rwlock, T> {
     fn drop(&mut self) {
-        debug_assert!(self.lock.load(Ordering::Relaxed) & !(WRITER | UPGRADED) > 0);
+        self.hold.release();
+        debug_assert!(self.lock.load(Ordering::Relaxed) & !(WRITER | UPGRADED | WAITING) > 0);
         self.lock.fetch_sub(READER, Ordering::Release);
         ProcessManager::preempt_enable();
     }
@@ -554,6 +698,7 @@ impl<'rwlock, T> Drop for RwLockReadGuard<'rwlock, T> {
 
 impl<'rwlock, T> Drop for RwLockUpgradableGuard<'rwlock, T> {
     fn drop(&mut self) {
+        self.hold.release();
         debug_assert_eq!(
             self.inner.lock.load(Ordering::Relaxed) & (WRITER | UPGRADED),
             UPGRADED
@@ -566,6 +711,7 @@ impl<'rwlock, T> Drop for RwLockUpgradableGuard<'rwlock, T> {
 
 impl<'rwlock, T> Drop for RwLockWriteGuard<'rwlock, T> {
     fn drop(&mut self) {
+        self.hold.release();
         debug_assert_eq!(self.inner.lock.load(Ordering::Relaxed) & WRITER, WRITER);
         self.inner
             .lock
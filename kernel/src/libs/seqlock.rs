@@ -0,0 +1,137 @@
+//! 顺序锁（seqlock）
+//!
+//! 适用于读远多于写、并且数据可以按值复制的场景（例如时间）。
+//!
+//! 写者之间通过自旋锁互斥，写入前后各把序号加一，因此写入过程中序号为奇数。
+//! 读者不加任何锁、不修改任何共享的内存：先记下序号，复制数据，再检查序号是否变化，
+//! 如果序号为奇数或者发生了变化，说明读的过程中有写者，重新读取即可。
+//! 因此读者永远不会阻塞写者，也不会与写者争抢锁所在的缓存行。
+//!
+//! 请注意：
+//! - 读者可能会复制到不一致的数据（随后会被丢弃），因此`T`只能是不包含指针语义的`Copy`类型
+//! - 如果可能在中断上下文中读取，写者必须使用[`SeqLock::write_irqsave`]，
+//!   否则中断处理程序会在同一个cpu上一直等待被它打断的写者
+
+#![allow(dead_code)]
+use core::{
+    cell::UnsafeCell,
+    hint::spin_loop,
+    ops::{Deref, DerefMut},
+    sync::atomic::{fence, AtomicUsize, Ordering},
+};
+
+use super::spinlock::{SpinLock, SpinLockGuard};
+
+/// 顺序锁
+#[derive(Debug)]
+pub struct SeqLock<T> {
+    /// 序号，为奇数时表示有写者正在写入
+    seq: AtomicUsize,
+    /// 写者之间的互斥锁
+    lock: SpinLock<()>,
+    data: UnsafeCell<T>,
+}
+
+/// SeqLock的写者守卫。守卫被释放时，写入结束
+pub struct SeqLockWriteGuard<'a, T: 'a> {
+    seqlock: &'a SeqLock<T>,
+    _guard: SpinLockGuard<'a, ()>,
+}
+
+unsafe impl<T: Send> Send for SeqLock<T> {}
+unsafe impl<T: Send + Copy> Sync for SeqLock<T> {}
+
+impl<T> SeqLock<T> {
+    pub const fn new(data: T) -> Self {
+        return Self {
+            seq: AtomicUsize::new(0),
+            lock: SpinLock::new(()),
+            data: UnsafeCell::new(data),
+        };
+    }
+
+    /// 开始一次读取，返回读取开始时的序号（一定是偶数）
+    #[inline(always)]
+    pub fn read_begin(&self) -> usize {
+        loop {
+            let seq = self.seq.load(Ordering::Acquire);
+            if seq & 1 == 0 {
+                return seq;
+            }
+            spin_loop();
+        }
+    }
+
+    /// 检查从`read_begin`返回`start`以来，是否有写者写入过数据。返回true时需要重新读取
+    #[inline(always)]
+    pub fn read_retry(&self, start: usize) -> bool {
+        // 保证对数据的读取在重新读取序号之前完成
+        fence(Ordering::Acquire);
+        return self.seq.load(Ordering::Relaxed) != start;
+    }
+
+    /// 获得写者守卫
+    pub fn write(&self) -> SeqLockWriteGuard<T> {
+        let guard = self.lock.lock();
+        return self.begin_write(guard);
+    }
+
+    /// 关中断，并获得写者守卫
+    pub fn write_irqsave(&self) -> SeqLockWriteGuard<T> {
+        let guard = self.lock.lock_irqsave();
+        return self.begin_write(guard);
+    }
+
+    fn begin_write<'a>(&'a self, guard: SpinLockGuard<'a, ()>) -> SeqLockWriteGuard<'a, T> {
+        self.seq.fetch_add(1, Ordering::Relaxed);
+        // 保证序号的修改先于对数据的修改被其他cpu看到
+        fence(Ordering::Release);
+        return SeqLockWriteGuard {
+            seqlock: self,
+            _guard: guard,
+        };
+    }
+}
+
+impl<T: Copy> SeqLock<T> {
+    /// 读取数据的一个副本。有写者正在写入时，会自旋等待，然后重新读取
+    #[inline]
+    pub fn read(&self) -> T {
+        loop {
+            let seq = self.read_begin();
+            // 写者可能在同时修改数据，使用volatile读取，避免编译器假设数据不会变化
+            let data = unsafe { core::ptr::read_volatile(self.data.get()) };
+            if !self.read_retry(seq) {
+                return data;
+            }
+            spin_loop();
+        }
+    }
+}
+
+impl<T: Default> Default for SeqLock<T> {
+    fn default() -> Self {
+        Self::new(Default::default())
+    }
+}
+
+impl<T> Deref for SeqLockWriteGuard<'_, T> {
+    type Target = T;
+
+    fn deref(&self) -> &Self::Target {
+        return unsafe { &*self.seqlock.data.get() };
+    }
+}
+
+impl<T> DerefMut for SeqLockWriteGuard<'_, T> {
+    fn deref_mut(&mut self) -> &mut Self::Target {
+        return unsafe { &mut *self.seqlock.data.get() };
+    }
+}
+
+impl<T> Drop for SeqLockWriteGuard<'_, T> {
+    fn drop(&mut self) {
+        // 写入结束，序号重新变为偶数。之后自旋锁守卫才被释放
+        self.seqlock.seq.fetch_add(1, Ordering::Release);
+    }
+}
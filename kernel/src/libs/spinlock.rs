@@ -8,6 +8,7 @@ use core::sync::atomic::{AtomicBool, Ordering};
 
 use crate::arch::CurrentIrqArch;
 use crate::exception::{InterruptArch, IrqFlagsGuard};
+use crate::libs::lockstat::{lock_site, wait_start, LockClassCache, LockHold, LockKind};
 use crate::process::ProcessManager;
 use crate::syscall::SystemError;
 
@@ -16,6 +17,8 @@ use crate::syscall::SystemError;
 #[derive(Debug)]
 pub struct SpinLock<T> {
     lock: AtomicBool,
+    /// 竞争统计的类别（启用lockstat特性时）
+    stat: LockClassCache,
     /// 自旋锁保护的数据
     data: UnsafeCell<T>,
 }
@@ -29,6 +32,7 @@ pub struct SpinLockGuard<'a, T: 'a> {
     data: *mut T,
     irq_flag: Option<IrqFlagsGuard>,
     flags: SpinLockGuardFlags,
+    hold: LockHold,
 }
 
 impl<'a, T: 'a> SpinLockGuard<'a, T> {
@@ -63,38 +67,49 @@ impl<T> SpinLock<T> {
     pub const fn new(value: T) -> Self {
         return Self {
             lock: AtomicBool::new(false),
+            stat: LockClassCache::new(),
             data: UnsafeCell::new(value),
         };
     }
 
     #[inline(always)]
+    #[cfg_attr(feature = "lockstat", track_caller)]
     pub fn lock(&self) -> SpinLockGuard<T> {
-        loop {
-            let res = self.try_lock();
-            if res.is_ok() {
-                return res.unwrap();
-            }
-            spin_loop();
-        }
+        return self.lock_with(Self::try_lock);
     }
 
     /// 加锁，但是不更改preempt count
     #[inline(always)]
+    #[cfg_attr(feature = "lockstat", track_caller)]
     pub fn lock_no_preempt(&self) -> SpinLockGuard<T> {
-        loop {
-            if let Ok(guard) = self.try_lock_no_preempt() {
-                return guard;
-            }
-            spin_loop();
-        }
+        return self.lock_with(Self::try_lock_no_preempt);
     }
 
+    #[cfg_attr(feature = "lockstat", track_caller)]
     pub fn lock_irqsave(&self) -> SpinLockGuard<T> {
+        return self.lock_with(Self::try_lock_irqsave);
+    }
+
+    /// 反复调用`try_lock`直到加锁成功，并记录竞争统计
+    #[inline(always)]
+    #[cfg_attr(feature = "lockstat", track_caller)]
+    fn lock_with<'a>(
+        &'a self,
+        try_lock: fn(&'a Self) -> Result<SpinLockGuard<'a, T>, SystemError>,
+    ) -> SpinLockGuard<'a, T> {
+        if let Ok(mut guard) = try_lock(self) {
+            guard.hold = self.stat.acquired::<Self>(LockKind::Spin);
+            return guard;
+        }
+        let start = wait_start();
         loop {
-            if let Ok(guard) = self.try_lock_irqsave() {
+            spin_loop();
+            if let Ok(mut guard) = try_lock(self) {
+                guard.hold = self
+                    .stat
+                    .contended::<Self>(LockKind::Spin, start, lock_site());
                 return guard;
             }
-            spin_loop();
         }
     }
 
@@ -108,6 +123,7 @@ impl<T> SpinLock<T> {
                 data: unsafe { &mut *self.data.get() },
                 irq_flag: None,
                 flags: SpinLockGuardFlags::empty(),
+                hold: LockHold::NONE,
             });
         }
 
@@ -134,6 +150,7 @@ impl<T> SpinLock<T> {
                 data: unsafe { &mut *self.data.get() },
                 irq_flag: Some(irq_guard),
                 flags: SpinLockGuardFlags::empty(),
+                hold: LockHold::NONE,
             });
         }
         ProcessManager::preempt_enable();
@@ -148,6 +165,7 @@ impl<T> SpinLock<T> {
                 data: unsafe { &mut *self.data.get() },
                 irq_flag: None,
                 flags: SpinLockGuardFlags::NO_PREEMPT,
+                hold: LockHold::NONE,
             });
         }
         return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
@@ -188,6 +206,7 @@ impl<T> DerefMut for SpinLockGuard<'_, T> {
 /// @brief 为SpinLockGuard实现Drop方法，那么，一旦守卫的生命周期结束，就会自动释放自旋锁，避免了忘记放锁的情况
 impl<T> Drop for SpinLockGuard<'_, T> {
     fn drop(&mut self) {
+        self.hold.release();
         if self.flags.contains(SpinLockGuardFlags::NO_PREEMPT) {
             self.unlock_no_preempt();
         } else {
@@ -1,5 +1,5 @@
 #![allow(dead_code)]
-use core::intrinsics::unlikely;
+use core::{fmt::Debug, intrinsics::unlikely};
 
 use alloc::{collections::LinkedList, sync::Arc, vec::Vec};
 
@@ -15,10 +15,50 @@ use super::{
     spinlock::{SpinLock, SpinLockGuard},
 };
 
+/// 不区分事件的键：等待者关心所有的事件，唤醒者唤醒所有的等待者
+pub const WAIT_KEY_ANY: u64 = u64::MAX;
+
+/// 等待队列中的一项
+#[derive(Debug)]
+struct WaitEntry {
+    pcb: Arc<ProcessControlBlock>,
+    /// 是否是独占的等待者。每次唤醒只会唤醒有限个独占的等待者，避免惊群
+    exclusive: bool,
+    /// 等待者关心的事件的掩码。带键的唤醒只会唤醒掩码与键有交集的等待者
+    key: u64,
+}
+
+impl WaitEntry {
+    fn new(pcb: Arc<ProcessControlBlock>) -> Self {
+        return Self::with_key(pcb, false, WAIT_KEY_ANY);
+    }
+
+    fn with_key(pcb: Arc<ProcessControlBlock>, exclusive: bool, key: u64) -> Self {
+        return Self {
+            pcb,
+            exclusive,
+            key,
+        };
+    }
+}
+
+/// 等待队列被唤醒时执行的回调
+///
+/// 与进程不同，回调在被唤醒之后仍然留在队列中，直到调用[`WaitQueue::remove_callback`]。
+/// 例如epoll通过它在文件就绪时把文件加入就绪链表，而不需要有进程在文件的等待队列上睡眠。
+pub trait WaitQueueCallback: Send + Sync + Debug {
+    /// 等待队列以`key`被唤醒。
+    ///
+    /// 可能在中断上下文中、持有等待队列的锁的情况下执行，因此不能睡眠，也不能操作同一个等待队列
+    fn wake(&self, key: u64);
+}
+
 #[derive(Debug)]
 struct InnerWaitQueue {
     /// 等待队列的链表
-    wait_list: LinkedList<Arc<ProcessControlBlock>>,
+    wait_list: LinkedList<WaitEntry>,
+    /// 回调及其关心的事件的掩码
+    callbacks: Vec<(u64, Arc<dyn WaitQueueCallback>)>,
 }
 
 /// 被自旋锁保护的等待队列
@@ -46,7 +86,34 @@ impl WaitQueue {
         ProcessManager::mark_sleep(true).unwrap_or_else(|e| {
             panic!("sleep error: {:?}", e);
         });
-        guard.wait_list.push_back(ProcessManager::current_pcb());
+        guard
+            .wait_list
+            .push_back(WaitEntry::new(ProcessManager::current_pcb()));
+        drop(guard);
+        sched();
+    }
+
+    /// 让当前进程作为独占的等待者在等待队列上进行等待，并且，允许被信号打断。
+    ///
+    /// 适用于所有等待者都在等待同一个资源、只需要唤醒其中一个的场景（见[`WaitQueue::wakeup_one`]）
+    pub fn sleep_exclusive(&self) {
+        self.sleep_keyed(WAIT_KEY_ANY, true);
+    }
+
+    /// 让当前进程在等待队列上等待`key`中的事件，并且，允许被信号打断。
+    ///
+    /// 带键的唤醒（[`WaitQueue::wakeup_keyed`]）只会唤醒掩码与键有交集的等待者
+    pub fn sleep_keyed(&self, key: u64, exclusive: bool) {
+        self.before_sleep_check(0);
+        let mut guard: SpinLockGuard<InnerWaitQueue> = self.0.lock_irqsave();
+        ProcessManager::mark_sleep(true).unwrap_or_else(|e| {
+            panic!("sleep error: {:?}", e);
+        });
+        guard.wait_list.push_back(WaitEntry::with_key(
+            ProcessManager::current_pcb(),
+            exclusive,
+            key,
+        ));
         drop(guard);
         sched();
     }
@@ -63,7 +130,9 @@ impl WaitQueue {
             panic!("sleep error: {:?}", e);
         });
         drop(irq_guard);
-        guard.wait_list.push_back(ProcessManager::current_pcb());
+        guard
+            .wait_list
+            .push_back(WaitEntry::new(ProcessManager::current_pcb()));
         f();
 
         drop(guard);
@@ -92,7 +161,9 @@ impl WaitQueue {
         ProcessManager::mark_sleep(true).unwrap_or_else(|e| {
             panic!("sleep error: {:?}", e);
         });
-        guard.wait_list.push_back(ProcessManager::current_pcb());
+        guard
+            .wait_list
+            .push_back(WaitEntry::new(ProcessManager::current_pcb()));
         drop(guard);
     }
 
@@ -104,7 +175,9 @@ impl WaitQueue {
         ProcessManager::mark_sleep(false).unwrap_or_else(|e| {
             panic!("sleep error: {:?}", e);
         });
-        guard.wait_list.push_back(ProcessManager::current_pcb());
+        guard
+            .wait_list
+            .push_back(WaitEntry::new(ProcessManager::current_pcb()));
         drop(guard);
     }
     /// @brief 让当前进程在等待队列上进行等待，并且，不允许被信号打断
@@ -116,7 +189,9 @@ impl WaitQueue {
             panic!("sleep error: {:?}", e);
         });
         drop(irq_guard);
-        guard.wait_list.push_back(ProcessManager::current_pcb());
+        guard
+            .wait_list
+            .push_back(WaitEntry::new(ProcessManager::current_pcb()));
         drop(guard);
         sched();
     }
@@ -131,7 +206,9 @@ impl WaitQueue {
             panic!("sleep error: {:?}", e);
         });
         drop(irq_guard);
-        guard.wait_list.push_back(ProcessManager::current_pcb());
+        guard
+            .wait_list
+            .push_back(WaitEntry::new(ProcessManager::current_pcb()));
         drop(to_unlock);
         drop(guard);
         sched();
@@ -147,7 +224,9 @@ impl WaitQueue {
             panic!("sleep error: {:?}", e);
         });
         drop(irq_guard);
-        guard.wait_list.push_back(ProcessManager::current_pcb());
+        guard
+            .wait_list
+            .push_back(WaitEntry::new(ProcessManager::current_pcb()));
         drop(to_unlock);
         drop(guard);
         sched();
@@ -163,7 +242,9 @@ impl WaitQueue {
             panic!("sleep error: {:?}", e);
         });
         drop(irq_guard);
-        guard.wait_list.push_back(ProcessManager::current_pcb());
+        guard
+            .wait_list
+            .push_back(WaitEntry::new(ProcessManager::current_pcb()));
         drop(to_unlock);
         drop(guard);
         sched();
@@ -180,7 +261,9 @@ impl WaitQueue {
         });
         drop(irq_guard);
 
-        guard.wait_list.push_back(ProcessManager::current_pcb());
+        guard
+            .wait_list
+            .push_back(WaitEntry::new(ProcessManager::current_pcb()));
 
         drop(to_unlock);
         drop(guard);
@@ -196,66 +279,159 @@ impl WaitQueue {
     /// @return false 没有唤醒进程
     pub fn wakeup(&self, state: Option<ProcessState>) -> bool {
         let mut guard: SpinLockGuard<InnerWaitQueue> = self.0.lock();
+        guard.run_callbacks(WAIT_KEY_ANY);
         // 如果队列为空，则返回
         if guard.wait_list.is_empty() {
             return false;
         }
         // 如果队列头部的pcb的state与给定的state相与，结果不为0，则唤醒
         if let Some(state) = state {
-            if guard.wait_list.front().unwrap().sched_info().state() != state {
+            if guard.wait_list.front().unwrap().pcb.sched_info().state() != state {
                 return false;
             }
         }
         let to_wakeup = guard.wait_list.pop_front().unwrap();
-        let res = ProcessManager::wakeup(&to_wakeup).is_ok();
+        let res = ProcessManager::wakeup(&to_wakeup.pcb).is_ok();
         return res;
     }
 
-    /// @brief 唤醒在队列中，符合条件的所有进程。
+    /// 唤醒所有符合条件的非独占的等待者，以及最多一个独占的等待者
     ///
-    /// @param state 用于判断的state，如果一个进程与这个state相同，或者为None(表示不进行这个判断)，则唤醒这个进程。
-    pub fn wakeup_all(&self, state: Option<ProcessState>) {
+    /// ## 返回值
+    ///
+    /// 是否唤醒了至少一个进程
+    pub fn wakeup_one(&self, state: Option<ProcessState>) -> bool {
+        return self.wakeup_nr(1, WAIT_KEY_ANY, state) > 0;
+    }
+
+    /// 唤醒所有掩码与`key`有交集的非独占的等待者，以及最多一个这样的独占的等待者
+    ///
+    /// ## 返回值
+    ///
+    /// 被唤醒的进程的数量
+    pub fn wakeup_keyed(&self, key: u64, state: Option<ProcessState>) -> usize {
+        return self.wakeup_nr(1, key, state);
+    }
+
+    /// 唤醒在队列中符合条件的进程
+    ///
+    /// ## 参数
+    ///
+    /// - `nr_exclusive`：最多唤醒多少个独占的等待者。非独占的等待者不受这个限制
+    /// - `key`：只唤醒掩码与`key`有交集的等待者。[`WAIT_KEY_ANY`]表示不进行这个判断
+    /// - `state`：只唤醒state与之相同的进程。None表示不进行这个判断
+    ///
+    /// ## 返回值
+    ///
+    /// 被唤醒的进程的数量
+    pub fn wakeup_nr(&self, nr_exclusive: usize, key: u64, state: Option<ProcessState>) -> usize {
         let mut guard: SpinLockGuard<InnerWaitQueue> = self.0.lock_irqsave();
+        guard.run_callbacks(key);
         // 如果队列为空，则返回
         if guard.wait_list.is_empty() {
-            return;
+            return 0;
         }
 
-        let mut to_push_back: Vec<Arc<ProcessControlBlock>> = Vec::new();
-        // 如果队列头部的pcb的state与给定的state相与，结果不为0，则唤醒
-        while let Some(to_wakeup) = guard.wait_list.pop_front() {
-            let mut wake = false;
-            if let Some(state) = state {
-                if to_wakeup.sched_info().state() == state {
-                    wake = true;
-                }
-            } else {
-                wake = true;
+        let mut woken = 0;
+        let mut exclusive_woken = 0;
+        let mut to_push_back: Vec<WaitEntry> = Vec::new();
+        while let Some(entry) = guard.wait_list.pop_front() {
+            let wake = (entry.key & key) != 0
+                && (!entry.exclusive || exclusive_woken < nr_exclusive)
+                && state.map_or(true, |state| entry.pcb.sched_info().state() == state);
+            if !wake {
+                to_push_back.push(entry);
+                continue;
             }
 
-            if wake {
-                ProcessManager::wakeup(&to_wakeup).unwrap_or_else(|e| {
-                    kerror!("wakeup pid: {:?} error: {:?}", to_wakeup.pid(), e);
-                });
-                continue;
-            } else {
-                to_push_back.push(to_wakeup);
+            // 唤醒失败的进程（例如已经被信号唤醒）不计入独占的等待者的数量，以免丢失唤醒
+            match ProcessManager::wakeup(&entry.pcb) {
+                Ok(_) => {
+                    woken += 1;
+                    if entry.exclusive {
+                        exclusive_woken += 1;
+                    }
+                }
+                Err(e) => {
+                    kerror!("wakeup pid: {:?} error: {:?}", entry.pcb.pid(), e);
+                }
             }
         }
 
-        for to_wakeup in to_push_back {
-            guard.wait_list.push_back(to_wakeup);
+        for entry in to_push_back {
+            guard.wait_list.push_back(entry);
         }
+        return woken;
+    }
+
+    /// @brief 唤醒在队列中，符合条件的所有进程。
+    ///
+    /// @param state 用于判断的state，如果一个进程与这个state相同，或者为None(表示不进行这个判断)，则唤醒这个进程。
+    pub fn wakeup_all(&self, state: Option<ProcessState>) {
+        self.wakeup_nr(usize::MAX, WAIT_KEY_ANY, state);
+    }
+
+    /// 把进程加入等待队列，但是不改变它的状态，也不发起调度
+    ///
+    /// 用于同时在多个等待队列上等待（例如poll）：调用者需要自己标记睡眠、发起调度，
+    /// 并且在醒来之后用[`WaitQueue::remove_waiter`]把进程从没有唤醒它的等待队列中移除
+    pub fn add_waiter(&self, pcb: Arc<ProcessControlBlock>) {
+        self.0
+            .lock_irqsave()
+            .wait_list
+            .push_back(WaitEntry::new(pcb));
+    }
+
+    /// 把进程从等待队列中移除（如果它还在队列中）
+    pub fn remove_waiter(&self, pcb: &Arc<ProcessControlBlock>) {
+        let mut guard: SpinLockGuard<InnerWaitQueue> = self.0.lock_irqsave();
+        if guard.wait_list.is_empty() {
+            return;
+        }
+        let list = core::mem::take(&mut guard.wait_list);
+        guard.wait_list = list
+            .into_iter()
+            .filter(|entry| !Arc::ptr_eq(&entry.pcb, pcb))
+            .collect();
+    }
+
+    /// 注册一个回调，队列以与`key`有交集的键被唤醒时执行
+    pub fn add_callback(&self, key: u64, callback: Arc<dyn WaitQueueCallback>) {
+        self.0.lock_irqsave().callbacks.push((key, callback));
+    }
+
+    /// 移除通过[`WaitQueue::add_callback`]注册的回调
+    pub fn remove_callback(&self, callback: &Arc<dyn WaitQueueCallback>) {
+        let target = Arc::as_ptr(callback) as *const ();
+        self.0
+            .lock_irqsave()
+            .callbacks
+            .retain(|(_, cb)| Arc::as_ptr(cb) as *const () != target);
     }
 
     /// @brief 获得当前等待队列的大小
     pub fn len(&self) -> usize {
         return self.0.lock().wait_list.len();
     }
+
+    /// 是否有进程在等待，或者注册了唤醒回调
+    pub fn has_waiters(&self) -> bool {
+        let inner = self.0.lock_irqsave();
+        return !inner.wait_list.is_empty() || !inner.callbacks.is_empty();
+    }
 }
 
 impl InnerWaitQueue {
     pub const INIT: InnerWaitQueue = InnerWaitQueue {
         wait_list: LinkedList::new(),
+        callbacks: Vec::new(),
     };
+
+    fn run_callbacks(&self, key: u64) {
+        for (mask, callback) in self.callbacks.iter() {
+            if mask & key != 0 {
+                callback.wake(key);
+            }
+        }
+    }
 }
@@ -4,10 +4,12 @@
 /// @FilePath: /DragonOS/kernel/src/mm/allocator/buddy.rs
 /// @Description: 伙伴分配器
 use crate::arch::MMArch;
+use crate::libs::align::page_align_up;
 use crate::mm::allocator::bump::BumpAllocator;
 use crate::mm::allocator::page_frame::{FrameAllocator, PageFrameCount, PageFrameUsage};
+use crate::mm::numa::{self, MAX_NUMNODES};
 use crate::mm::{MemoryManagementArch, PhysAddr, PhysMemoryArea, VirtAddr};
-use crate::{kdebug, kwarn};
+use crate::{kdebug, kinfo, kwarn};
 use core::cmp::min;
 use core::fmt::Debug;
 use core::intrinsics::{likely, unlikely};
@@ -19,6 +21,75 @@ const MAX_ORDER: usize = 31;
 // 4KB
 const MIN_ORDER: usize = 12;
 
+/// 物理内存区域的数量
+pub const MAX_NR_ZONES: usize = 2;
+/// 空闲链表的组数：每个NUMA节点的每个区域各有一组
+const NR_ZONE_LISTS: usize = MAX_NR_ZONES * MAX_NUMNODES;
+/// DMA32区域的上界（4GiB）
+const DMA32_LIMIT: usize = 1 << 32;
+/// NORMAL区域的页帧数量与DMA32区域为其保留的页帧数量的比例
+const DMA32_RESERVE_RATIO: usize = 256;
+
+/// 物理内存区域
+///
+/// 由于伙伴块最大为2^(MAX_ORDER-1)字节，并且按照自身大小对齐，因此伙伴块一定不会跨越4GiB的边界，
+/// 一个伙伴块和它的伙伴总是属于同一个区域。
+///
+/// 每个NUMA节点都有自己的一组区域，节点的边界不一定按照伙伴块的大小对齐，因此属于不同节点的伙伴不会合并。
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord)]
+pub enum ZoneType {
+    /// 物理地址低于4GiB的内存，可以被只支持32位地址的设备访问
+    DMA32 = 0,
+    /// 其余的内存
+    Normal = 1,
+}
+
+impl ZoneType {
+    /// 获取物理地址所在的区域
+    #[inline(always)]
+    pub fn of(paddr: PhysAddr) -> Self {
+        if paddr.data() < DMA32_LIMIT {
+            return ZoneType::DMA32;
+        }
+        return ZoneType::Normal;
+    }
+
+    #[inline(always)]
+    fn index(&self) -> usize {
+        return *self as usize;
+    }
+
+    /// 从`self`开始，按照回退顺序（从高地址区域到低地址区域）排列的区域
+    pub fn fallback_list(&self) -> &'static [ZoneType] {
+        match self {
+            ZoneType::Normal => &[ZoneType::Normal, ZoneType::DMA32],
+            ZoneType::DMA32 => &[ZoneType::DMA32],
+        }
+    }
+}
+
+/// 一个物理内存区域的统计信息
+#[derive(Debug, Clone, Copy)]
+struct Zone {
+    /// 由buddy管理的页帧数量
+    managed: usize,
+    /// 空闲链表中的页帧数量
+    free: usize,
+    /// 水位线：从更高的区域回退到这个区域分配时，至少需要保留的空闲页帧数量，
+    /// 以免普通的分配耗尽了只有这个区域才能满足的内存（例如DMA32）
+    reserve: usize,
+}
+
+impl Zone {
+    const fn empty() -> Self {
+        return Self {
+            managed: 0,
+            free: 0,
+            reserve: 0,
+        };
+    }
+}
+
 /// 保存buddy算法中每一页存放的BuddyEntry的信息，占据每个页的起始位置
 #[derive(Debug)]
 pub struct PageList<A> {
@@ -57,16 +128,60 @@ impl<A> PageList<A> {
     }
 }
 
+/// 每个物理页帧的元数据
+///
+/// 如果一个页帧是某个空闲伙伴块的第一个页帧，那么它的元数据记录了这个伙伴块的阶数，
+/// 以及空闲链表中指向这个伙伴块的表项的物理地址。这样，在释放页面时，
+/// 就能以O(1)的时间判断伙伴块是否空闲，并且找到它在空闲链表中的位置。
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+#[repr(transparent)]
+struct FrameMeta(usize);
+
+impl FrameMeta {
+    /// 阶数存放在高8位，值为(order + 1)，为0表示当前页帧不是空闲伙伴块的首页
+    const ORDER_SHIFT: usize = 56;
+    const ADDR_MASK: usize = (1 << Self::ORDER_SHIFT) - 1;
+
+    const fn empty() -> Self {
+        Self(0)
+    }
+
+    fn new(entry_paddr: PhysAddr, order: usize) -> Self {
+        Self((entry_paddr.data() & Self::ADDR_MASK) | ((order + 1) << Self::ORDER_SHIFT))
+    }
+
+    /// 获取空闲伙伴块的阶数，如果当前页帧不是空闲伙伴块的首页，返回None
+    fn order(&self) -> Option<usize> {
+        let order = self.0 >> Self::ORDER_SHIFT;
+        if order == 0 {
+            return None;
+        }
+        return Some(order - 1);
+    }
+
+    /// 获取指向该伙伴块的表项的物理地址
+    fn entry_paddr(&self) -> PhysAddr {
+        PhysAddr::new(self.0 & Self::ADDR_MASK)
+    }
+}
+
 /// @brief: 用来表示 buddy 算法中的一个 buddy 块，整体存放在area的头部
 // 这种方式会出现对齐问题
 // #[repr(packed)]
 #[repr(C)]
 #[derive(Debug)]
 pub struct BuddyAllocator<A> {
-    // 存放每个阶的空闲“链表”的头部地址
-    free_area: [PhysAddr; (MAX_ORDER - MIN_ORDER) as usize],
+    // 存放每个节点的每个区域的每个阶的空闲“链表”的头部地址（下标为节点*MAX_NR_ZONES+区域），
+    // 没有内存的节点的链表头为空
+    free_area: [[PhysAddr; (MAX_ORDER - MIN_ORDER) as usize]; NR_ZONE_LISTS],
     /// 总页数
     total: PageFrameCount,
+    /// 页帧元数据数组的起始虚拟地址
+    frame_meta: VirtAddr,
+    /// 页帧元数据数组的长度（即它能描述的页帧数量）
+    frame_meta_len: usize,
+    /// 每个节点的每个区域的统计信息
+    zones: [Zone; NR_ZONE_LISTS],
     phantom: PhantomData<A>,
 }
 
@@ -81,11 +196,11 @@ impl<A: MemoryManagementArch> BuddyAllocator<A> {
         kdebug!("Free pages before init buddy: {:?}", initial_free_pages);
         kdebug!("Buddy entries: {}", Self::BUDDY_ENTRIES);
 
-        let mut free_area: [PhysAddr; (MAX_ORDER - MIN_ORDER) as usize] =
-            [PhysAddr::new(0); (MAX_ORDER - MIN_ORDER) as usize];
+        let mut free_area: [[PhysAddr; (MAX_ORDER - MIN_ORDER) as usize]; NR_ZONE_LISTS] =
+            [[PhysAddr::new(0); (MAX_ORDER - MIN_ORDER) as usize]; NR_ZONE_LISTS];
 
-        // Buddy初始占用的空间从bump分配
-        for f in free_area.iter_mut() {
+        // Buddy初始占用的空间从bump分配。此时还不知道NUMA拓扑，所有的内存都属于节点0
+        for f in free_area[..MAX_NR_ZONES].iter_mut().flatten() {
             let curr_page = bump_allocator.allocate_one();
             // 保存每个阶的空闲链表的头部地址
             *f = curr_page.unwrap();
@@ -96,9 +211,32 @@ impl<A: MemoryManagementArch> BuddyAllocator<A> {
             Self::write_page(*f, page_list);
         }
 
+        // 为每个物理页帧分配元数据（同样从bump分配）
+        let max_paddr = bump_allocator
+            .areas()
+            .iter()
+            .map(|area| area.area_end_aligned().data())
+            .max()
+            .unwrap_or(0);
+        let frame_meta_len = max_paddr >> A::PAGE_SHIFT;
+        let frame_meta_bytes = page_align_up(frame_meta_len * mem::size_of::<FrameMeta>());
+        let (frame_meta_paddr, _) = bump_allocator
+            .allocate(PageFrameCount::new(frame_meta_bytes >> A::PAGE_SHIFT))
+            .expect("BuddyAllocator: failed to allocate frame metadata");
+        let frame_meta = MMArch::phys_2_virt(frame_meta_paddr)?;
+        core::ptr::write_bytes(frame_meta.data() as *mut u8, 0, frame_meta_bytes);
+        kdebug!(
+            "Buddy frame metadata: {} frames, {} KB",
+            frame_meta_len,
+            frame_meta_bytes / 1024
+        );
+
         let mut allocator = Self {
             free_area,
             total: PageFrameCount::new(0),
+            frame_meta,
+            frame_meta_len,
+            zones: [Zone::empty(); NR_ZONE_LISTS],
             phantom: PhantomData,
         };
 
@@ -176,8 +314,230 @@ impl<A: MemoryManagementArch> BuddyAllocator<A> {
         kdebug!("Total pages to buddy: {:?}", total_pages_to_buddy);
         allocator.total = total_memory;
 
+        // 计算每个区域的水位线
+        for zone in allocator.zones.iter_mut() {
+            zone.managed = zone.free;
+        }
+        allocator.update_reserve();
+        let dma32 = ZoneType::DMA32.index();
+        let normal = ZoneType::Normal.index();
+        kdebug!(
+            "Buddy zones: DMA32 {} pages (reserve {}), NORMAL {} pages",
+            allocator.zones[dma32].managed,
+            allocator.zones[dma32].reserve,
+            allocator.zones[normal].managed
+        );
+
         Some(allocator)
     }
+
+    /// 物理地址所在的空闲链表组（节点和区域）的下标
+    #[inline(always)]
+    fn zone_index(paddr: PhysAddr) -> usize {
+        return numa::paddr_to_node(paddr) * MAX_NR_ZONES + ZoneType::of(paddr).index();
+    }
+
+    /// 计算每个节点的DMA32区域的水位线
+    fn update_reserve(&mut self) {
+        let normal_managed: usize = (0..MAX_NUMNODES)
+            .map(|node| self.zones[node * MAX_NR_ZONES + ZoneType::Normal.index()].managed)
+            .sum();
+        for node in 0..MAX_NUMNODES {
+            let dma32 = &mut self.zones[node * MAX_NR_ZONES + ZoneType::DMA32.index()];
+            dma32.reserve = min(normal_managed / DMA32_RESERVE_RATIO, dma32.managed / 4);
+        }
+    }
+
+    /// 把空闲块压入一个临时的单链表（链表的节点保存在空闲块自身的开头）
+    unsafe fn stash_push(stash: &mut PhysAddr, block: PhysAddr, order: usize) {
+        A::write(A::phys_2_virt(block).unwrap(), (*stash, order));
+        *stash = block;
+    }
+
+    /// 从临时的单链表中取出一个空闲块及其阶数
+    unsafe fn stash_pop(stash: &mut PhysAddr) -> Option<(PhysAddr, usize)> {
+        if stash.is_null() {
+            return None;
+        }
+        let block = *stash;
+        let (next, order): (PhysAddr, usize) = A::read(A::phys_2_virt(block).unwrap());
+        *stash = next;
+        return Some((block, order));
+    }
+
+    /// 为第`z`组空闲链表分配链表头（从临时链表中取页面）
+    unsafe fn init_free_area(&mut self, stash: &mut PhysAddr, z: usize) {
+        for i in 0..(MAX_ORDER - MIN_ORDER) {
+            let page = match Self::stash_pop(stash) {
+                Some((block, order)) => {
+                    // 只使用第一个页，其余的部分拆分为更小的块放回临时链表
+                    for o in MIN_ORDER..order {
+                        Self::stash_push(stash, block + (1 << o), o);
+                    }
+                    block
+                }
+                None => {
+                    self.buddy_alloc(PageFrameCount::new(1), ZoneType::Normal, 0, true)
+                        .expect("buddy: no memory for free area")
+                        .0
+                }
+            };
+            core::ptr::write_bytes(
+                A::phys_2_virt(page).unwrap().as_ptr::<u8>(),
+                0,
+                A::PAGE_SIZE,
+            );
+            Self::write_page(page, PageList::<A>::new(0, PhysAddr::new(0)));
+            self.free_area[z][i] = page;
+        }
+    }
+
+    /// 使NUMA节点的内存范围生效，并按照节点重新放置所有的空闲块
+    ///
+    /// buddy在解析ACPI表之前就已经建立，所有的空闲块都在节点0的链表中。这里先按照原来的划分取出所有的空闲块，
+    /// 然后调用`publish`使节点的内存范围生效，最后把这些块重新释放到各自节点的链表中（跨越节点边界的块会被拆分）。
+    ///
+    /// 只能在启动时、其他cpu还没有启动时调用
+    pub unsafe fn rebuild_numa_nodes(&mut self, publish: impl FnOnce()) {
+        let mut stash = PhysAddr::new(0);
+        // 取出块时变空的链表页会被归还，它可能与链表中的块合并到已经取空的更高阶，因此重复直到所有链表都为空
+        loop {
+            let mut taken = 0;
+            for z in 0..NR_ZONE_LISTS {
+                if self.free_area[z][0].is_null() {
+                    continue;
+                }
+                for order in (MIN_ORDER..MAX_ORDER).rev() {
+                    while let Some(block) = self.pop_front(order as u8, z) {
+                        Self::stash_push(&mut stash, block, order);
+                        taken += 1;
+                    }
+                }
+            }
+            if taken == 0 {
+                break;
+            }
+        }
+
+        publish();
+
+        while let Some((block, order)) = Self::stash_pop(&mut stash) {
+            if order > MIN_ORDER && numa::paddr_range_node(block, block + (1 << order)).is_none() {
+                Self::stash_push(&mut stash, block, order - 1);
+                Self::stash_push(&mut stash, block + (1 << (order - 1)), order - 1);
+                continue;
+            }
+            let z = Self::zone_index(block);
+            if self.free_area[z][0].is_null() {
+                self.init_free_area(&mut stash, z);
+            }
+            self.buddy_free(block, order as u8);
+        }
+
+        // 已分配的页帧不知道属于哪个节点，按照重建时的空闲页帧近似计算水位线
+        for zone in self.zones.iter_mut() {
+            zone.managed = zone.free;
+        }
+        self.update_reserve();
+        for node in 0..numa::nr_nodes() {
+            let dma32 = &self.zones[node * MAX_NR_ZONES + ZoneType::DMA32.index()];
+            let normal = &self.zones[node * MAX_NR_ZONES + ZoneType::Normal.index()];
+            kinfo!(
+                "Buddy node {}: DMA32 {} pages (reserve {}), NORMAL {} pages",
+                node,
+                dma32.free,
+                dma32.reserve,
+                normal.free
+            );
+        }
+    }
+    /// 获取空闲链表中的页帧数量
+    ///
+    /// 与[`FrameAllocator::usage`]不同，这个函数不需要遍历空闲链表
+    #[inline(always)]
+    pub fn free_pages(&self) -> usize {
+        return self.zones.iter().map(|z| z.free).sum();
+    }
+
+    /// 获取所有节点的指定区域的空闲链表中的页帧数量
+    #[allow(dead_code)]
+    #[inline(always)]
+    pub fn zone_free_pages(&self, zone: ZoneType) -> usize {
+        return (0..MAX_NUMNODES)
+            .map(|node| self.zones[node * MAX_NR_ZONES + zone.index()].free)
+            .sum();
+    }
+
+    /// 如果页帧属于某个空闲的伙伴块，返回这个伙伴块的起始地址和阶数
+    fn free_block_of(&self, paddr: PhysAddr) -> Option<(PhysAddr, usize)> {
+        for order in MIN_ORDER..MAX_ORDER {
+            let base = PhysAddr::new(paddr.data() & !((1 << order) - 1));
+            if self.frame_meta(base).order() == Some(order) {
+                return Some((base, order));
+            }
+        }
+        return None;
+    }
+
+    /// 统计从`base`开始的一段页帧中，哪些页帧是空闲的
+    ///
+    /// ## 参数
+    ///
+    /// - `base`：起始物理地址（页对齐）
+    /// - `bitmap`：输出参数，第i位为1表示第i个页帧是空闲的。页帧的数量为`bitmap.len() * 64`
+    pub fn free_frames_bitmap(&self, base: PhysAddr, bitmap: &mut [u64]) {
+        bitmap.iter_mut().for_each(|w| *w = 0);
+        let nr = bitmap.len() * 64;
+        let mut i = 0;
+        while i < nr {
+            let paddr = base + (i << A::PAGE_SHIFT);
+            match self.free_block_of(paddr) {
+                Some((block, order)) => {
+                    // 整个伙伴块都是空闲的，直接跳到它的结尾
+                    let end = (block.data() + (1 << order) - base.data()) >> A::PAGE_SHIFT;
+                    let end = min(end, nr);
+                    while i < end {
+                        bitmap[i / 64] |= 1 << (i % 64);
+                        i += 1;
+                    }
+                }
+                None => i += 1,
+            }
+        }
+    }
+
+    /// 任意节点的指定区域的空闲链表中，是否存在至少2^`page_order`个页帧的伙伴块
+    pub fn has_free_block(&self, page_order: usize, zone: ZoneType) -> bool {
+        return (0..MAX_NUMNODES)
+            .any(|node| self.has_free_block_in(page_order, node * MAX_NR_ZONES + zone.index()));
+    }
+
+    fn has_free_block_in(&self, page_order: usize, z: usize) -> bool {
+        let zone_free_area = &self.free_area[z];
+        if zone_free_area[0].is_null() {
+            return false;
+        }
+        for index in page_order..(MAX_ORDER - MIN_ORDER) {
+            let mut pagelist: PageList<A> = Self::read_page(zone_free_area[index]);
+            loop {
+                if pagelist.entry_num > 0 {
+                    return true;
+                }
+                if pagelist.next_page.is_null() {
+                    break;
+                }
+                pagelist = Self::read_page(pagelist.next_page);
+            }
+        }
+        return false;
+    }
+
+    /// 获取buddy能描述的页帧数量（即最大的物理页帧号+1）
+    #[inline(always)]
+    pub fn max_pfn(&self) -> usize {
+        return self.frame_meta_len;
+    }
+
     /// 获取第j个entry的虚拟地址，
     /// j从0开始计数
     pub fn entry_virt_addr(base_addr: PhysAddr, j: usize) -> VirtAddr {
@@ -200,6 +560,28 @@ impl<A: MemoryManagementArch> BuddyAllocator<A> {
         unsafe { A::write(virt_addr, page_list) };
     }
 
+    /// 获取以`block`开头的伙伴块的元数据
+    #[inline(always)]
+    fn frame_meta(&self, block: PhysAddr) -> FrameMeta {
+        let index = block.data() >> A::PAGE_SHIFT;
+        if unlikely(index >= self.frame_meta_len) {
+            return FrameMeta::empty();
+        }
+        return unsafe { A::read(self.frame_meta + index * mem::size_of::<FrameMeta>()) };
+    }
+
+    /// 设置以`block`开头的伙伴块的元数据
+    #[inline(always)]
+    fn set_frame_meta(&mut self, block: PhysAddr, meta: FrameMeta) {
+        let index = block.data() >> A::PAGE_SHIFT;
+        assert!(
+            index < self.frame_meta_len,
+            "buddy: frame {:?} out of metadata range",
+            block
+        );
+        unsafe { A::write(self.frame_meta + index * mem::size_of::<FrameMeta>(), meta) };
+    }
+
     /// 从order转换为free_area的下标
     ///
     /// # 参数
@@ -214,15 +596,16 @@ impl<A: MemoryManagementArch> BuddyAllocator<A> {
         (order as usize - MIN_ORDER) as usize
     }
 
-    /// 从空闲链表的开头，取出1个指定阶数的伙伴块，如果没有，则返回None
+    /// 从指定的一组空闲链表的开头，取出1个指定阶数的伙伴块，如果没有，则返回None
     ///
     /// ## 参数
     ///
     /// - `order` - 伙伴块的阶数
-    fn pop_front(&mut self, order: u8) -> Option<PhysAddr> {
+    /// - `z` - 空闲链表组（节点和区域）的下标
+    fn pop_front(&mut self, order: u8, z: usize) -> Option<PhysAddr> {
         let mut alloc_in_specific_order = |spec_order: u8| {
             // 先尝试在order阶的“空闲链表”的开头位置分配一个伙伴块
-            let mut page_list_addr = self.free_area[Self::order2index(spec_order)];
+            let mut page_list_addr = self.free_area[z][Self::order2index(spec_order)];
             let mut page_list: PageList<A> = Self::read_page(page_list_addr);
 
             // 循环删除头部的空闲链表页
@@ -235,7 +618,7 @@ impl<A: MemoryManagementArch> BuddyAllocator<A> {
 
                 if !next_page_list_addr.is_null() {
                     // 此时page_list已经没有空闲伙伴块了，又因为非唯一页，需要删除该page_list
-                    self.free_area[Self::order2index(spec_order)] = next_page_list_addr;
+                    self.free_area[z][Self::order2index(spec_order)] = next_page_list_addr;
                     drop(page_list);
                     // kdebug!("FREE: page_list_addr={:b}", page_list_addr.data());
                     unsafe {
@@ -243,7 +626,7 @@ impl<A: MemoryManagementArch> BuddyAllocator<A> {
                     }
                 }
                 // 由于buddy_free可能导致首部的链表页发生变化，因此需要重新读取
-                let next_page_list_addr = self.free_area[Self::order2index(spec_order)];
+                let next_page_list_addr = self.free_area[z][Self::order2index(spec_order)];
                 assert!(!next_page_list_addr.is_null());
                 page_list = Self::read_page(next_page_list_addr);
                 page_list_addr = next_page_list_addr;
@@ -264,6 +647,8 @@ impl<A: MemoryManagementArch> BuddyAllocator<A> {
                         PhysAddr::new(0),
                     )
                 };
+                self.set_frame_meta(entry, FrameMeta::empty());
+                self.zones[z].free -= 1 << (spec_order as usize - MIN_ORDER);
                 if entry.is_null() {
                     panic!(
                         "entry is null, entry={:?}, order={}, entry_num = {}",
@@ -280,7 +665,7 @@ impl<A: MemoryManagementArch> BuddyAllocator<A> {
                 if page_list.entry_num == 0 {
                     if !page_list.next_page.is_null() {
                         // 此时page_list已经没有空闲伙伴块了，又因为非唯一页，需要删除该page_list
-                        self.free_area[Self::order2index(spec_order)] = page_list.next_page;
+                        self.free_area[z][Self::order2index(spec_order)] = page_list.next_page;
                         drop(page_list);
                         unsafe { self.buddy_free(page_list_addr, MMArch::PAGE_SHIFT as u8) };
                     } else {
@@ -342,11 +727,20 @@ impl<A: MemoryManagementArch> BuddyAllocator<A> {
     /// ## 参数
     ///
     /// - `count`：需要分配的页面数
+    /// - `highest_zone`：允许使用的最高的区域，会按照从高到低的顺序尝试各个区域
+    /// - `node`：优先使用的NUMA节点，不够时按照距离由近到远尝试其他节点
+    /// - `ignore_reserve`：从更低的区域分配时，是否忽略它的水位线
     ///
     /// ## 返回值
     ///
     /// 返回分配的页面的物理地址和页面数
-    fn buddy_alloc(&mut self, count: PageFrameCount) -> Option<(PhysAddr, PageFrameCount)> {
+    fn buddy_alloc(
+        &mut self,
+        count: PageFrameCount,
+        highest_zone: ZoneType,
+        node: usize,
+        ignore_reserve: bool,
+    ) -> Option<(PhysAddr, PageFrameCount)> {
         assert!(count.data().is_power_of_two());
         // 计算需要分配的阶数
         let mut order = log2(count.data() as usize);
@@ -358,16 +752,41 @@ impl<A: MemoryManagementArch> BuddyAllocator<A> {
             return None;
         }
 
-        // kdebug!("buddy_alloc: order = {}", order);
-        // 获取该阶数的一个空闲页面
-        let free_addr = self.pop_front(order);
-        // kdebug!(
-        //     "buddy_alloc: order = {}, free_addr = {:?}",
-        //     order,
-        //     free_addr
-        // );
-        return free_addr
-            .map(|addr| (addr, PageFrameCount::new(1 << (order as usize - MIN_ORDER))));
+        let pages = 1 << (order as usize - MIN_ORDER);
+        for i in 0..numa::nr_nodes() {
+            let node = numa::node_fallback(node, i);
+            for zone in highest_zone.fallback_list() {
+                let zi = node * MAX_NR_ZONES + zone.index();
+                let z = &self.zones[zi];
+                if z.free < pages {
+                    continue;
+                }
+                // 回退到更低的区域时，不能让它的空闲页帧低于水位线
+                if *zone != highest_zone && !ignore_reserve && z.free - pages < z.reserve {
+                    continue;
+                }
+                // kdebug!("buddy_alloc: order = {}", order);
+                // 获取该阶数的一个空闲页面
+                if let Some(addr) = self.pop_front(order, zi) {
+                    return Some((addr, PageFrameCount::new(pages)));
+                }
+            }
+        }
+        return None;
+    }
+
+    /// 只从指定的区域及更低的区域中分配页面（例如为只支持32位地址的设备分配DMA内存）
+    ///
+    /// ## 参数
+    ///
+    /// - `count`：需要分配的页面数（必须是2的幂）
+    /// - `zone`：允许使用的最高的区域
+    pub unsafe fn allocate_in_zone(
+        &mut self,
+        count: PageFrameCount,
+        zone: ZoneType,
+    ) -> Option<(PhysAddr, PageFrameCount)> {
+        return self.buddy_alloc(count, zone, numa::numa_node_id(), false);
     }
 
     /// 释放一个块
@@ -379,6 +798,10 @@ impl<A: MemoryManagementArch> BuddyAllocator<A> {
     unsafe fn buddy_free(&mut self, mut base: PhysAddr, order: u8) {
         // kdebug!("buddy_free: base = {:?}, order = {}", base, order);
         let mut order = order as usize;
+        // 伙伴块与它的伙伴总是属于同一个区域，只与同一个节点的伙伴合并，因此合并不会改变链表组
+        let z = Self::zone_index(base);
+        // 与伙伴合并不会改变空闲页帧的数量，因此只需要在这里计数
+        self.zones[z].free += 1 << (order - MIN_ORDER);
 
         while order < MAX_ORDER {
             // 检测地址是否合法
@@ -394,38 +817,22 @@ impl<A: MemoryManagementArch> BuddyAllocator<A> {
             // 伙伴块的地址是base ^ (1 << order)
             let buddy_addr = PhysAddr::new(base.data() ^ (1 << order));
 
-            let first_page_list_paddr = self.free_area[Self::order2index(order as u8)];
-            let mut page_list_paddr = first_page_list_paddr;
-            let mut page_list: PageList<A> = Self::read_page(page_list_paddr);
-            let first_page_list = page_list.clone();
-
-            let mut buddy_entry_virt_vaddr = None;
-            let mut buddy_entry_page_list_paddr = None;
-            // 除非order是最大的，否则尝试查找伙伴块
-            if likely(order != MAX_ORDER - 1) {
-                'outer: loop {
-                    for i in 0..page_list.entry_num {
-                        let entry_virt_addr = Self::entry_virt_addr(page_list_paddr, i);
-                        let entry: PhysAddr = unsafe { A::read(entry_virt_addr) };
-                        if entry == buddy_addr {
-                            // 找到了伙伴块，记录该entry相关信息，然后退出查找
-                            buddy_entry_virt_vaddr = Some(entry_virt_addr);
-                            buddy_entry_page_list_paddr = Some(page_list_paddr);
-                            break 'outer;
-                        }
-                    }
-                    if page_list.next_page.is_null() {
-                        break;
-                    }
-                    page_list_paddr = page_list.next_page;
-                    page_list = Self::read_page(page_list_paddr);
+            let first_page_list_paddr = self.free_area[z][Self::order2index(order as u8)];
+            let first_page_list: PageList<A> = Self::read_page(first_page_list_paddr);
+
+            let mut buddy_entry_paddr = None;
+            // 除非order是最大的，否则通过页帧元数据查找伙伴块（O(1)）。不同节点的伙伴不合并
+            if likely(order != MAX_ORDER - 1) && Self::zone_index(buddy_addr) == z {
+                let meta = self.frame_meta(buddy_addr);
+                if meta.order() == Some(order) {
+                    buddy_entry_paddr = Some(meta.entry_paddr());
                 }
             }
 
             // 如果没有找到伙伴块
-            if buddy_entry_virt_vaddr.is_none() {
+            if buddy_entry_paddr.is_none() {
                 assert!(
-                    page_list.entry_num <= Self::BUDDY_ENTRIES,
+                    first_page_list.entry_num <= Self::BUDDY_ENTRIES,
                     "buddy_free: page_list.entry_num > Self::BUDDY_ENTRIES"
                 );
 
@@ -438,9 +845,14 @@ impl<A: MemoryManagementArch> BuddyAllocator<A> {
                         // 否则分配新的page_list
                         // 请注意，分配之后，有可能当前的entry_num会减1（伙伴块分裂），造成出现整个链表为null的entry数量为Self::BUDDY_ENTRIES+1的情况
                         // 但是不影响，我们在后面插入链表项的时候，会处理这种情况，检查链表中的第2个页是否有空位
-                        self.buddy_alloc(PageFrameCount::new(1))
-                            .expect("buddy_alloc failed: no enough memory")
-                            .0
+                        self.buddy_alloc(
+                            PageFrameCount::new(1),
+                            ZoneType::Normal,
+                            z / MAX_NR_ZONES,
+                            true,
+                        )
+                        .expect("buddy_alloc failed: no enough memory")
+                        .0
                     };
 
                     // 清空这个页面
@@ -454,16 +866,23 @@ impl<A: MemoryManagementArch> BuddyAllocator<A> {
                         1 << order,
                     );
                     assert!(
-                        first_page_list_paddr == self.free_area[Self::order2index(order as u8)]
+                        first_page_list_paddr == self.free_area[z][Self::order2index(order as u8)]
                     );
                     // 初始化新的page_list
                     let new_page_list = PageList::new(0, first_page_list_paddr);
                     Self::write_page(new_page_list_addr, new_page_list);
-                    self.free_area[Self::order2index(order as u8)] = new_page_list_addr;
+                    self.free_area[z][Self::order2index(order as u8)] = new_page_list_addr;
+
+                    // 要归还的块已经被用作链表页，不再作为空闲块放入链表。
+                    // 当这个链表页变空时，pop_front会把它归还给buddy
+                    if order == MIN_ORDER {
+                        self.zones[z].free -= 1;
+                        return;
+                    }
                 }
 
                 // 由于上面可能更新了第一个链表页，因此需要重新获取这个值
-                let first_page_list_paddr = self.free_area[Self::order2index(order as u8)];
+                let first_page_list_paddr = self.free_area[z][Self::order2index(order as u8)];
                 let first_page_list: PageList<A> = Self::read_page(first_page_list_paddr);
 
                 // 检查第二个page_list是否有空位
@@ -473,33 +892,39 @@ impl<A: MemoryManagementArch> BuddyAllocator<A> {
                     Some(Self::read_page::<PageList<A>>(first_page_list.next_page))
                 };
 
-                let (paddr, mut page_list) = if let Some(second) = second_page_list {
-                    // 第二个page_list有空位
-                    // 应当符合之前的假设：还有1个空位
-                    assert!(second.entry_num == Self::BUDDY_ENTRIES - 1);
-
-                    (first_page_list.next_page, second)
-                } else {
+                let (paddr, mut page_list) = match second_page_list {
+                    // 第二个page_list有空位（分配新链表页时发生了伙伴块分裂）
+                    Some(second) if second.entry_num < Self::BUDDY_ENTRIES => {
+                        (first_page_list.next_page, second)
+                    }
                     // 在第一个page list中分配
-                    (first_page_list_paddr, first_page_list)
+                    _ => (first_page_list_paddr, first_page_list),
                 };
 
                 // kdebug!("to write entry, page_list_base={paddr:?}, page_list.entry_num={}, value={base:?}", page_list.entry_num);
                 assert!(page_list.entry_num < Self::BUDDY_ENTRIES);
                 // 把要归还的块，写入到链表项中
                 unsafe { A::write(Self::entry_virt_addr(paddr, page_list.entry_num), base) }
+                self.set_frame_meta(
+                    base,
+                    FrameMeta::new(Self::entry_addr(paddr, page_list.entry_num), order),
+                );
                 page_list.entry_num += 1;
                 Self::write_page(paddr, page_list);
                 return;
             } else {
                 // 如果找到了伙伴块，合并，向上递归
 
+                // 伙伴块所在的表项的物理地址
+                let buddy_entry_paddr = buddy_entry_paddr.unwrap();
                 // 伙伴块所在的表项的虚拟地址
-                let buddy_entry_virt_addr = buddy_entry_virt_vaddr.unwrap();
-                // 伙伴块所在的page_list的物理地址
-                let buddy_entry_page_list_paddr = buddy_entry_page_list_paddr.unwrap();
+                let buddy_entry_virt_addr = unsafe { A::phys_2_virt(buddy_entry_paddr).unwrap() };
+                // 伙伴块所在的page_list的物理地址（链表页总是页对齐的）
+                let buddy_entry_page_list_paddr =
+                    PhysAddr::new(buddy_entry_paddr.data() & A::PAGE_MASK);
+                self.set_frame_meta(buddy_addr, FrameMeta::empty());
 
-                let mut page_list_paddr = self.free_area[Self::order2index(order as u8)];
+                let mut page_list_paddr = self.free_area[z][Self::order2index(order as u8)];
                 let mut page_list = Self::read_page::<PageList<A>>(page_list_paddr);
                 // 找第一个有空闲块的链表页。跳过空闲链表页。不进行回收的原因是担心出现死循环
                 while page_list.entry_num == 0 {
@@ -524,6 +949,7 @@ impl<A: MemoryManagementArch> BuddyAllocator<A> {
                     unsafe {
                         A::write(buddy_entry_virt_addr, entry);
                     }
+                    self.set_frame_meta(entry, FrameMeta::new(buddy_entry_paddr, order));
                     // 设置刚才那个entry为空
                     unsafe {
                         A::write(
@@ -553,6 +979,7 @@ impl<A: MemoryManagementArch> BuddyAllocator<A> {
                                 PhysAddr::new(0),
                             );
                         }
+                        self.set_frame_meta(last_entry, FrameMeta::new(buddy_entry_paddr, order));
                     } else {
                         unsafe {
                             A::write(
@@ -576,7 +1003,7 @@ impl<A: MemoryManagementArch> BuddyAllocator<A> {
 
 impl<A: MemoryManagementArch> FrameAllocator for BuddyAllocator<A> {
     unsafe fn allocate(&mut self, count: PageFrameCount) -> Option<(PhysAddr, PageFrameCount)> {
-        return self.buddy_alloc(count);
+        return self.buddy_alloc(count, ZoneType::Normal, numa::numa_node_id(), false);
     }
 
     /// 释放一个块
@@ -605,14 +1032,19 @@ impl<A: MemoryManagementArch> FrameAllocator for BuddyAllocator<A> {
 
     unsafe fn usage(&self) -> PageFrameUsage {
         let mut free_page_num: usize = 0;
-        for index in 0..(MAX_ORDER - MIN_ORDER) {
-            let mut pagelist: PageList<A> = Self::read_page(self.free_area[index]);
-            loop {
-                free_page_num += pagelist.entry_num << index;
-                if pagelist.next_page.is_null() {
-                    break;
+        for zone_free_area in self.free_area.iter() {
+            if zone_free_area[0].is_null() {
+                continue;
+            }
+            for index in 0..(MAX_ORDER - MIN_ORDER) {
+                let mut pagelist: PageList<A> = Self::read_page(zone_free_area[index]);
+                loop {
+                    free_page_num += pagelist.entry_num << index;
+                    if pagelist.next_page.is_null() {
+                        break;
+                    }
+                    pagelist = Self::read_page(pagelist.next_page);
                 }
-                pagelist = Self::read_page(pagelist.next_page);
             }
         }
         let free = PageFrameCount::new(free_page_num);
@@ -1,4 +1,4 @@
-use klog_types::AllocLogItem;
+use klog_types::{AllocLogItem, LogSource};
 
 use crate::{
     arch::mm::LockedFrameAllocator,
@@ -13,7 +13,11 @@ use core::{
     ptr::NonNull,
 };
 
-use super::page_frame::{FrameAllocator, PageFrameCount};
+use super::{
+    page_frame::{FrameAllocator, PageFrameCount},
+    slab::{SlabAllocator, SLAB_ALLOCATOR},
+    zeroed_pool::take_zeroed_page,
+};
 
 /// 类kmalloc的分配器应当实现的trait
 pub trait LocalAlloc {
@@ -54,11 +58,28 @@ impl KernelAllocator {
         let phy_addr = MMArch::virt_2_phys(VirtAddr::new(ptr as usize)).unwrap();
         LockedFrameAllocator.free(phy_addr, page_frame_count);
     }
+
+    /// 获取layout对应的分配来源（用于记录日志）
+    #[inline]
+    fn log_source(layout: &Layout) -> LogSource {
+        if SlabAllocator::size_class_index(layout).is_some() {
+            return LogSource::Slab;
+        } else {
+            return LogSource::Buddy;
+        }
+    }
 }
 
 /// 为内核SLAB分配器实现LocalAlloc的trait
 impl LocalAlloc for KernelAllocator {
     unsafe fn local_alloc(&self, layout: Layout) -> *mut u8 {
+        // 小内存块从slab分配，避免按页向上取整造成的浪费
+        if let Some(index) = SlabAllocator::size_class_index(&layout) {
+            return SLAB_ALLOCATOR
+                .allocate(index, layout)
+                .unwrap_or(core::ptr::null_mut() as *mut u8);
+        }
+
         return self
             .alloc_in_buddy(layout)
             .map(|x| x.as_mut_ptr() as *mut u8)
@@ -66,6 +87,25 @@ impl LocalAlloc for KernelAllocator {
     }
 
     unsafe fn local_alloc_zeroed(&self, layout: Layout) -> *mut u8 {
+        if let Some(index) = SlabAllocator::size_class_index(&layout) {
+            return SLAB_ALLOCATOR
+                .allocate(index, layout)
+                .map(|ptr| {
+                    core::ptr::write_bytes(ptr, 0, layout.size());
+                    ptr
+                })
+                .unwrap_or(core::ptr::null_mut() as *mut u8);
+        }
+
+        // 单个页帧优先从预先清零的页帧池中获取
+        if layout.size() <= MMArch::PAGE_SIZE && layout.align() <= MMArch::PAGE_SIZE {
+            if let Some(paddr) = take_zeroed_page() {
+                return MMArch::phys_2_virt(paddr)
+                    .map(|vaddr| vaddr.data() as *mut u8)
+                    .unwrap_or(core::ptr::null_mut() as *mut u8);
+            }
+        }
+
         return self
             .alloc_in_buddy(layout)
             .map(|x| {
@@ -77,6 +117,10 @@ impl LocalAlloc for KernelAllocator {
     }
 
     unsafe fn local_dealloc(&self, ptr: *mut u8, layout: Layout) {
+        if let Some(index) = SlabAllocator::size_class_index(&layout) {
+            SLAB_ALLOCATOR.free(index, ptr);
+            return;
+        }
         self.free_in_buddy(ptr, layout);
     }
 }
@@ -91,7 +135,7 @@ unsafe impl GlobalAlloc for KernelAllocator {
                 Some(r as usize),
                 None,
             )),
-            klog_types::LogSource::Buddy,
+            Self::log_source(&layout),
         );
 
         return r;
@@ -108,7 +152,7 @@ unsafe impl GlobalAlloc for KernelAllocator {
                 Some(r as usize),
                 None,
             )),
-            klog_types::LogSource::Buddy,
+            Self::log_source(&layout),
         );
 
         return r;
@@ -121,7 +165,7 @@ unsafe impl GlobalAlloc for KernelAllocator {
                 Some(ptr as usize),
                 None,
             )),
-            klog_types::LogSource::Buddy,
+            Self::log_source(&layout),
         );
 
         self.local_dealloc(ptr, layout);
@@ -5,7 +5,10 @@ use core::{
 
 use crate::{
     arch::{mm::LockedFrameAllocator, MMArch},
-    mm::{MemoryManagementArch, PhysAddr, VirtAddr},
+    mm::{
+        allocator::buddy::ZoneType, compaction::compact_memory, MemoryManagementArch, PhysAddr,
+        VirtAddr,
+    },
 };
 
 /// @brief 物理页帧的表示
@@ -327,6 +330,25 @@ pub unsafe fn allocate_page_frames(count: PageFrameCount) -> Option<(PhysAddr, P
     return Some(frame);
 }
 
+/// @brief 从全局的页帧分配器中分配连续count个物理地址低于4GiB的页帧（用于只支持32位地址的DMA）
+///
+/// 如果没有足够大的连续空闲块，会先进行一次内存规整再重试，因此不能在持有自旋锁时调用
+///
+/// @param count 请求分配的页帧数量（必须是2的n次幂）
+pub unsafe fn allocate_dma32_page_frames(
+    count: PageFrameCount,
+) -> Option<(PhysAddr, PageFrameCount)> {
+    if let Some(frame) = unsafe { LockedFrameAllocator.allocate_in_zone(count, ZoneType::DMA32) } {
+        return Some(frame);
+    }
+    if count.data() <= 1 || !compact_memory(count.data().trailing_zeros() as usize, ZoneType::DMA32)
+    {
+        return None;
+    }
+    let frame = unsafe { LockedFrameAllocator.allocate_in_zone(count, ZoneType::DMA32)? };
+    return Some(frame);
+}
+
 /// @brief 向全局页帧分配器释放连续count个页帧
 ///
 /// @param frame 要释放的第一个页帧
@@ -0,0 +1,174 @@
+//! 每个CPU的页帧缓存（per-cpu pages）
+//!
+//! 在全局的buddy分配器前面，为每个CPU缓存少量的低阶页帧。
+//! 分配和释放低阶页帧时，优先在本CPU的缓存中完成，只有在缓存为空或者已满时，
+//! 才会批量地从buddy分配器中补充或者归还页帧，从而减少对buddy全局锁的争用。
+
+use core::intrinsics::unlikely;
+
+use crate::mm::PhysAddr;
+
+use super::page_frame::{FrameAllocator, PageFrameCount};
+
+/// 缓存的最大阶数（包含）。阶数为n的页帧块包含2^n个页帧
+pub const PCP_MAX_ORDER: usize = 3;
+
+/// 每一阶的缓存链表最多能容纳的页帧块数量
+const PCP_HIGH: usize = 32;
+
+/// 每次从buddy补充、或者归还到buddy的页帧块数量
+const PCP_BATCH: usize = 8;
+
+/// 某一阶的缓存链表
+#[derive(Debug)]
+struct PerCpuPageList {
+    count: usize,
+    frames: [PhysAddr; PCP_HIGH],
+}
+
+impl PerCpuPageList {
+    const fn new() -> Self {
+        return Self {
+            count: 0,
+            frames: [PhysAddr::new(0); PCP_HIGH],
+        };
+    }
+
+    #[inline(always)]
+    fn pop(&mut self) -> Option<PhysAddr> {
+        if self.count == 0 {
+            return None;
+        }
+        self.count -= 1;
+        return Some(self.frames[self.count]);
+    }
+
+    #[inline(always)]
+    fn push(&mut self, paddr: PhysAddr) -> bool {
+        if self.count == PCP_HIGH {
+            return false;
+        }
+        self.frames[self.count] = paddr;
+        self.count += 1;
+        return true;
+    }
+}
+
+/// 单个CPU的页帧缓存
+#[derive(Debug)]
+pub struct PerCpuPages {
+    lists: [PerCpuPageList; PCP_MAX_ORDER + 1],
+}
+
+impl PerCpuPages {
+    pub const fn new() -> Self {
+        return Self {
+            lists: [
+                PerCpuPageList::new(),
+                PerCpuPageList::new(),
+                PerCpuPageList::new(),
+                PerCpuPageList::new(),
+            ],
+        };
+    }
+
+    /// 判断分配count个页帧的请求能否由per-cpu缓存处理
+    ///
+    /// ## 返回值
+    ///
+    /// 如果可以，返回对应的阶数，否则返回None
+    #[inline(always)]
+    pub fn order_of(count: PageFrameCount) -> Option<usize> {
+        let count = count.data();
+        if unlikely(count == 0 || !count.is_power_of_two()) {
+            return None;
+        }
+        let order = count.trailing_zeros() as usize;
+        if order > PCP_MAX_ORDER {
+            return None;
+        }
+        return Some(order);
+    }
+
+    /// 从缓存中分配一个阶数为order的页帧块。若缓存为空，则先从buddy批量补充
+    ///
+    /// ## 参数
+    ///
+    /// - `order`：页帧块的阶数
+    /// - `buddy`：用于补充缓存的分配器（调用者需要保证已经持有其锁）
+    pub unsafe fn allocate<A: FrameAllocator>(
+        &mut self,
+        order: usize,
+        buddy: &mut A,
+    ) -> Option<(PhysAddr, PageFrameCount)> {
+        let count = PageFrameCount::new(1 << order);
+        let list = &mut self.lists[order];
+        if list.count == 0 {
+            for _ in 0..PCP_BATCH {
+                if let Some((paddr, _)) = buddy.allocate(count) {
+                    list.push(paddr);
+                } else {
+                    break;
+                }
+            }
+        }
+
+        return list.pop().map(|paddr| (paddr, count));
+    }
+
+    /// 尝试直接从缓存中分配页帧块，不访问buddy
+    #[inline(always)]
+    pub fn try_allocate(&mut self, order: usize) -> Option<(PhysAddr, PageFrameCount)> {
+        return self.lists[order]
+            .pop()
+            .map(|paddr| (paddr, PageFrameCount::new(1 << order)));
+    }
+
+    /// 尝试把页帧块放入缓存中，不访问buddy
+    ///
+    /// ## 返回值
+    ///
+    /// 如果缓存已满，返回false
+    #[inline(always)]
+    pub fn try_free(&mut self, order: usize, paddr: PhysAddr) -> bool {
+        return self.lists[order].push(paddr);
+    }
+
+    /// 把页帧块放入缓存中。如果缓存已满，则先批量归还一部分页帧块给buddy
+    ///
+    /// ## 参数
+    ///
+    /// - `order`：页帧块的阶数
+    /// - `paddr`：页帧块的起始物理地址
+    /// - `buddy`：用于接收被归还的页帧块的分配器（调用者需要保证已经持有其锁）
+    pub unsafe fn free<A: FrameAllocator>(&mut self, order: usize, paddr: PhysAddr, buddy: &mut A) {
+        let count = PageFrameCount::new(1 << order);
+        let list = &mut self.lists[order];
+        if list.count == PCP_HIGH {
+            for _ in 0..PCP_BATCH {
+                let p = list.pop().unwrap();
+                buddy.free(p, count);
+            }
+        }
+        let ok = list.push(paddr);
+        assert!(ok);
+    }
+
+    /// 把缓存的所有页帧块归还给buddy
+    pub unsafe fn drain_all<A: FrameAllocator>(&mut self, buddy: &mut A) {
+        for (order, list) in self.lists.iter_mut().enumerate() {
+            while let Some(p) = list.pop() {
+                buddy.free(p, PageFrameCount::new(1 << order));
+            }
+        }
+    }
+
+    /// 获取当前缓存中的页帧总数
+    pub fn cached_pages(&self) -> PageFrameCount {
+        let mut total = 0;
+        for (order, list) in self.lists.iter().enumerate() {
+            total += list.count << order;
+        }
+        return PageFrameCount::new(total);
+    }
+}
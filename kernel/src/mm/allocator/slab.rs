@@ -1,7 +1,101 @@
-//! 当前slab分配器暂时不使用，等待后续完善后合并主线
+//! 内核slab分配器
+//!
+//! 小于等于2KiB的内存分配请求会按照2的幂向上取整到对应的大小类，
+//! 然后从该大小类的slab中分配。更大的请求仍然交给buddy分配器处理。
 #![allow(dead_code)]
 
-use core::alloc::Layout;
+use core::{alloc::Layout, intrinsics::unlikely};
+
+use crate::{
+    arch::MMArch,
+    libs::spinlock::SpinLock,
+    mm::{MemoryManagementArch, VirtAddr},
+};
+
+use super::page_frame::{allocate_page_frames, PageFrameCount};
+
+/// 全局的slab分配器
+pub static SLAB_ALLOCATOR: SlabAllocator = SlabAllocator::new();
+
+/// slab分配器的大小类（按照2的幂，从8B到2KiB）
+pub const SLAB_SIZE_CLASSES: [usize; 9] = [8, 16, 32, 64, 128, 256, 512, 1024, 2048];
+
+/// slab分配器能够处理的最大的内存块大小
+pub const SLAB_MAX_BLOCK_SIZE: usize = SLAB_SIZE_CLASSES[SLAB_SIZE_CLASSES.len() - 1];
+
+/// 由多个大小类的slab组成的分配器，每个大小类拥有独立的锁
+pub struct SlabAllocator {
+    slabs: [SpinLock<Slab>; SLAB_SIZE_CLASSES.len()],
+}
+
+impl SlabAllocator {
+    /// 每次扩充slab时，从buddy申请的页数
+    const GROW_PAGES: usize = 4;
+
+    pub const fn new() -> Self {
+        return Self {
+            slabs: [
+                SpinLock::new(Slab::new_empty(SLAB_SIZE_CLASSES[0])),
+                SpinLock::new(Slab::new_empty(SLAB_SIZE_CLASSES[1])),
+                SpinLock::new(Slab::new_empty(SLAB_SIZE_CLASSES[2])),
+                SpinLock::new(Slab::new_empty(SLAB_SIZE_CLASSES[3])),
+                SpinLock::new(Slab::new_empty(SLAB_SIZE_CLASSES[4])),
+                SpinLock::new(Slab::new_empty(SLAB_SIZE_CLASSES[5])),
+                SpinLock::new(Slab::new_empty(SLAB_SIZE_CLASSES[6])),
+                SpinLock::new(Slab::new_empty(SLAB_SIZE_CLASSES[7])),
+                SpinLock::new(Slab::new_empty(SLAB_SIZE_CLASSES[8])),
+            ],
+        };
+    }
+
+    /// 获取layout对应的大小类的下标
+    ///
+    /// ## 返回值
+    ///
+    /// - `Some(index)`：layout可以由slab分配
+    /// - `None`：layout太大（或者对齐要求太高），需要由buddy分配
+    #[inline]
+    pub fn size_class_index(layout: &Layout) -> Option<usize> {
+        // 由于slab页是按页对齐的，而块大小是2的幂，因此每个块都天然按照块大小对齐。
+        // 所以只要块大小不小于align，就能满足对齐要求
+        let size = core::cmp::max(layout.size(), layout.align());
+        if unlikely(size > SLAB_MAX_BLOCK_SIZE) {
+            return None;
+        }
+        let size = core::cmp::max(size, SLAB_SIZE_CLASSES[0]).next_power_of_two();
+        return Some((size.trailing_zeros() - SLAB_SIZE_CLASSES[0].trailing_zeros()) as usize);
+    }
+
+    /// 从slab中分配一个内存块
+    ///
+    /// ## 参数
+    ///
+    /// - `index`：大小类的下标（由`size_class_index`获得）
+    /// - `layout`：要分配的内存布局
+    ///
+    /// ## 返回值
+    ///
+    /// 分配得到的内存块的指针，如果内存不足则返回None
+    pub unsafe fn allocate(&self, index: usize, layout: Layout) -> Option<*mut u8> {
+        let mut slab = self.slabs[index].lock_irqsave();
+        if let Some(ptr) = slab.allocate(layout) {
+            return Some(ptr);
+        }
+
+        // 当前大小类的空闲块用完了，从buddy申请新的页来扩充slab
+        let (paddr, count) = allocate_page_frames(PageFrameCount::new(Self::GROW_PAGES))?;
+        let vaddr: VirtAddr = MMArch::phys_2_virt(paddr)?;
+        slab.grow(vaddr.data(), count.bytes());
+        return slab.allocate(layout);
+    }
+
+    /// 将内存块归还给对应大小类的slab
+    ///
+    /// 目前slab页不会归还给buddy分配器
+    pub unsafe fn free(&self, index: usize, ptr: *mut u8) {
+        self.slabs[index].lock_irqsave().free(ptr);
+    }
+}
 
 // 定义Slab，用来存放空闲块
 pub struct Slab {
@@ -22,6 +116,20 @@ impl Slab {
         };
     }
 
+    /// 创建一个空的slab，其中没有任何可用的block
+    pub const fn new_empty(block_size: usize) -> Slab {
+        return Slab {
+            block_size,
+            free_block_list: FreeBlockList::new_empty(),
+        };
+    }
+
+    /// 获取slab的block大小
+    #[inline]
+    pub fn block_size(&self) -> usize {
+        return self.block_size;
+    }
+
     /// @brief: 获取slab中可用的block数
     pub fn used_blocks(&self) -> usize {
         return self.free_block_list.len();
@@ -73,7 +181,7 @@ impl FreeBlockList {
         return new_list;
     }
 
-    fn new_empty() -> FreeBlockList {
+    const fn new_empty() -> FreeBlockList {
         return FreeBlockList { len: 0, head: None };
     }
 
@@ -0,0 +1,171 @@
+//! 预先清零的页帧池
+//!
+//! 缺页、mmap(MAP_POPULATE)、以及分配清零内存时，都需要一个已经清零的物理页。
+//! 为了把清零的开销从这些对延迟敏感的路径上移走，由一个后台内核线程在空闲时预先清零一批页帧，放入池中。
+//! 需要清零页的时候，优先从池中获取，只有池为空时，才同步地分配并清零。
+
+use alloc::{boxed::Box, string::ToString};
+
+use crate::{
+    arch::{mm::LockedFrameAllocator, MMArch},
+    kinfo,
+    libs::{spinlock::SpinLock, wait_queue::WaitQueue},
+    mm::{MemoryManagementArch, PhysAddr},
+    process::{
+        kthread::{KernelThreadClosure, KernelThreadMechanism},
+        ProcessManager,
+    },
+    sched::{core::cond_resched, SchedPolicy, SchedPriority},
+};
+
+use super::page_frame::FrameAllocator;
+
+/// 池的容量（高水位）
+const ZEROED_POOL_HIGH: usize = 256;
+/// 池中的页帧数量低于这个值时，唤醒清零线程
+const ZEROED_POOL_LOW: usize = 64;
+/// 清零线程每清零这么多个页帧，就检查一次是否需要让出CPU
+const ZEROING_BATCH: usize = 16;
+
+static ZEROED_PAGE_POOL: SpinLock<ZeroedPagePool> = SpinLock::new(ZeroedPagePool::new());
+
+/// 清零线程在这个等待队列上休眠。
+///
+/// 清零线程在持有池的锁时检查是否需要休眠，并且在加入等待队列之后才释放池的锁，
+/// 因此，在它检查之后取走页帧的分配者一定能在等待队列上找到它，不会丢失唤醒。
+static ZEROING_WAIT_QUEUE: WaitQueue = WaitQueue::INIT;
+
+#[derive(Debug)]
+struct ZeroedPagePool {
+    count: usize,
+    pages: [PhysAddr; ZEROED_POOL_HIGH],
+}
+
+impl ZeroedPagePool {
+    const fn new() -> Self {
+        return Self {
+            count: 0,
+            pages: [PhysAddr::new(0); ZEROED_POOL_HIGH],
+        };
+    }
+
+    #[inline(always)]
+    fn pop(&mut self) -> Option<PhysAddr> {
+        if self.count == 0 {
+            return None;
+        }
+        self.count -= 1;
+        return Some(self.pages[self.count]);
+    }
+
+    #[inline(always)]
+    fn push(&mut self, paddr: PhysAddr) -> bool {
+        if self.count == ZEROED_POOL_HIGH {
+            return false;
+        }
+        self.pages[self.count] = paddr;
+        self.count += 1;
+        return true;
+    }
+}
+
+/// 从池中取出一个已经清零的页帧（不会唤醒清零线程）
+///
+/// 这个函数可以在全局内存分配器中调用。
+///
+/// ## 返回值
+///
+/// 如果池为空，返回None
+#[inline]
+pub fn take_zeroed_page() -> Option<PhysAddr> {
+    return ZEROED_PAGE_POOL.lock_irqsave().pop();
+}
+
+/// 分配一个已经清零的页帧
+///
+/// 优先从池中获取，如果池为空，则同步地分配并清零。如果池中的页帧较少，则唤醒清零线程。
+///
+/// 请注意，不要在全局内存分配器、或者持有调度器相关的锁时调用这个函数。
+pub unsafe fn allocate_zeroed_page() -> Option<PhysAddr> {
+    let (paddr, remain) = {
+        let mut pool = ZEROED_PAGE_POOL.lock_irqsave();
+        (pool.pop(), pool.count)
+    };
+
+    if remain < ZEROED_POOL_LOW {
+        wakeup_zeroing_thread();
+    }
+
+    if let Some(paddr) = paddr {
+        return Some(paddr);
+    }
+
+    let paddr = LockedFrameAllocator.allocate_one()?;
+    MMArch::write_bytes(MMArch::phys_2_virt(paddr).unwrap(), 0, MMArch::PAGE_SIZE);
+    return Some(paddr);
+}
+
+fn wakeup_zeroing_thread() {
+    if ZEROING_WAIT_QUEUE.has_waiters() {
+        ZEROING_WAIT_QUEUE.wakeup(None);
+    }
+}
+
+/// 清零线程：在池中的页帧不足时，分配并清零页帧，补充到池中
+fn page_zeroing_thread() -> i32 {
+    loop {
+        let mut zeroed = 0;
+        let mut out_of_memory = false;
+        loop {
+            if ZEROED_PAGE_POOL.lock_irqsave().count >= ZEROED_POOL_HIGH {
+                break;
+            }
+
+            let paddr = match unsafe { LockedFrameAllocator.allocate_one() } {
+                Some(paddr) => paddr,
+                // 内存不足，不再占用更多的页帧
+                None => {
+                    out_of_memory = true;
+                    break;
+                }
+            };
+            unsafe {
+                MMArch::write_bytes(MMArch::phys_2_virt(paddr).unwrap(), 0, MMArch::PAGE_SIZE)
+            };
+
+            if !ZEROED_PAGE_POOL.lock_irqsave().push(paddr) {
+                unsafe { LockedFrameAllocator.free_one(paddr) };
+                break;
+            }
+
+            zeroed += 1;
+            if zeroed % ZEROING_BATCH == 0 {
+                cond_resched();
+            }
+        }
+
+        // 在池的锁的保护下检查并休眠：池中的页帧仍然不少于低水位（或者内存不足）时才休眠，
+        // 否则说明在补充期间又被取走了一批页帧，继续补充。
+        // 内存不足时，由下一次分配清零页帧的分配者唤醒本线程重试
+        let pool = ZEROED_PAGE_POOL.lock_irqsave();
+        if pool.count < ZEROED_POOL_LOW && !out_of_memory {
+            drop(pool);
+            continue;
+        }
+        ZEROING_WAIT_QUEUE.sleep_unlock_spinlock(pool);
+    }
+}
+
+/// 启动清零线程（需要在内核线程机制初始化完成之后调用）
+pub fn zeroed_page_pool_init() {
+    let closure = KernelThreadClosure::EmptyClosure((Box::new(page_zeroing_thread), ()));
+    let pcb = KernelThreadMechanism::create(closure, "kzerod".to_string())
+        .expect("Failed to create page zeroing thread");
+    // 清零是可以推迟的工作，只在CPU没有其他任务可以运行时进行
+    pcb.sched_info_mut_irqsave().set_policy(
+        SchedPolicy::IDLE,
+        SchedPriority::new(SchedPriority::DEFAULT).unwrap(),
+    );
+    ProcessManager::wakeup(&pcb).expect("Failed to wakeup page zeroing thread");
+    kinfo!("Page zeroing thread started.");
+}
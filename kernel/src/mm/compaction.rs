@@ -0,0 +1,257 @@
+//! 内存规整（compaction）
+//!
+//! 长时间运行之后，空闲页帧会被零散的已分配页面分隔开，即使空闲内存很多，高阶的分配也会失败。
+//! 规整会寻找一段按照目标阶数对齐的物理内存，如果其中已分配的页帧都是可以迁移的匿名页，
+//! 就把它们迁移到其他的页帧中，使得这段内存重新合并为一个完整的伙伴块。
+//!
+//! - 分配高阶的页帧失败时，可以通过[`compact_memory`]同步地进行规整，然后重试
+//! - kswapd会在空闲内存充足、但是没有大块连续内存时，在后台调用[`background_compaction`]
+//!
+//! 目前只有LRU中只被一个页表项映射的匿名页是可以迁移的。
+
+use core::sync::atomic::{AtomicUsize, Ordering};
+
+use alloc::vec::Vec;
+
+use crate::{
+    arch::{mm::LockedFrameAllocator, MMArch},
+    kdebug,
+};
+
+use super::{
+    allocator::{buddy::ZoneType, page_frame::PageFrameCount},
+    lru::{lru_lookup, lru_migrate},
+    page::{Flusher, PageMapCount},
+    MemoryManagementArch, PhysAddr,
+};
+
+/// 规整能够恢复的最大阶数（2^9个页帧，即2M，一个巨页的大小）
+pub const COMPACT_MAX_ORDER: usize = 9;
+/// 每次规整最多检查的候选区域的数量
+const COMPACT_SCAN_REGIONS: usize = 64;
+/// 后台规整的目标阶数
+const BACKGROUND_COMPACT_ORDER: usize = COMPACT_MAX_ORDER;
+/// 空闲页帧至少是目标块大小的多少倍时，才进行后台规整（空闲页帧不足时，规整无济于事）
+const BACKGROUND_FREE_RATIO: usize = 4;
+
+/// 下一次规整从哪个页帧号开始检查，使得连续的多次规整不会反复检查同一段内存
+static COMPACT_CURSOR: AtomicUsize = AtomicUsize::new(0);
+
+/// 一段按照目标阶数对齐的物理内存
+#[derive(Debug, Clone, Copy)]
+struct CompactRegion {
+    start: PhysAddr,
+    /// 页帧数量
+    pages: usize,
+}
+
+impl CompactRegion {
+    #[inline(always)]
+    fn contains(&self, paddr: PhysAddr) -> bool {
+        return paddr >= self.start && paddr < self.start + (self.pages << MMArch::PAGE_SHIFT);
+    }
+}
+
+/// 判断指定区域（及更低的区域）中是否存在至少2^`order`个页帧的空闲块
+fn has_free_block(order: usize, zone: ZoneType) -> bool {
+    return LockedFrameAllocator
+        .with_buddy(|buddy| {
+            zone.fallback_list()
+                .iter()
+                .any(|z| buddy.has_free_block(order, *z))
+        })
+        .unwrap_or(false);
+}
+
+/// 检查一个候选区域，返回其中需要迁移的页帧。如果区域中存在无法迁移的页帧，返回None
+fn isolate_region(region: &CompactRegion) -> Option<Vec<PhysAddr>> {
+    let mut bitmap = [0u64; (1 << COMPACT_MAX_ORDER) / 64];
+    let words = (region.pages + 63) / 64;
+    LockedFrameAllocator.with_buddy(|buddy| {
+        buddy.free_frames_bitmap(region.start, &mut bitmap[..words]);
+    })?;
+
+    let mut movable = Vec::new();
+    for i in 0..region.pages {
+        if bitmap[i / 64] & (1 << (i % 64)) != 0 {
+            continue;
+        }
+        let paddr = region.start + (i << MMArch::PAGE_SHIFT);
+        // 不在LRU中的页帧（内核使用的页面、页表等）无法迁移
+        lru_lookup(paddr)?;
+        if PageMapCount::get(paddr) > 1 {
+            return None;
+        }
+        movable.push(paddr);
+    }
+    return Some(movable);
+}
+
+/// 分配迁移的目标页帧。落在候选区域内的页帧会被暂时持有，规整结束后再一起释放
+fn alloc_target(region: &CompactRegion, held: &mut Vec<PhysAddr>) -> Option<PhysAddr> {
+    for _ in 0..region.pages {
+        let (paddr, _) = unsafe {
+            LockedFrameAllocator.allocate_in_zone(PageFrameCount::new(1), ZoneType::Normal)
+        }?;
+        if !region.contains(paddr) {
+            return Some(paddr);
+        }
+        held.push(paddr);
+    }
+    return None;
+}
+
+/// 把一个匿名页迁移到区域之外的页帧
+///
+/// ## 返回值
+///
+/// 迁移成功，返回true。页面正在被使用、或者已经不再被映射时，返回false
+fn migrate_anon_page(paddr: PhysAddr, region: &CompactRegion, held: &mut Vec<PhysAddr>) -> bool {
+    let (owner, vaddr) = match lru_lookup(paddr) {
+        Some(x) => x,
+        None => return false,
+    };
+    let space = match owner.upgrade() {
+        Some(space) => space,
+        None => return false,
+    };
+    // 与LRU的扫描相同，不等待正在被使用的地址空间
+    let mut guard = match space.try_write() {
+        Some(guard) => guard,
+        None => return false,
+    };
+    let flags = match guard.user_mapper.utable.translate(vaddr) {
+        Some((p, flags)) if p == paddr => flags,
+        _ => return false,
+    };
+    if PageMapCount::get(paddr) > 1 {
+        return false;
+    }
+    let new_paddr = match alloc_target(region, held) {
+        Some(p) => p,
+        None => return false,
+    };
+
+    // 先取消映射并刷新所有cpu上的TLB，保证拷贝期间页面的内容不会再被修改
+    let mut flusher = guard.tlb_flusher();
+    let mapper = &mut guard.user_mapper.utable;
+    let (_, _, flush) = unsafe { mapper.unmap_phys(vaddr, false) }.expect("page is not mapped");
+    flusher.consume(flush);
+    drop(flusher);
+
+    unsafe {
+        let src = MMArch::phys_2_virt(paddr).unwrap().data() as *const u8;
+        let dst = MMArch::phys_2_virt(new_paddr).unwrap().data() as *mut u8;
+        dst.copy_from_nonoverlapping(src, MMArch::PAGE_SIZE);
+        let flush = mapper
+            .map_phys(vaddr, new_paddr, flags)
+            .expect("Failed to map migrated page");
+        flush.flush();
+    }
+    drop(guard);
+
+    lru_migrate(paddr, new_paddr, &space, vaddr);
+    unsafe { LockedFrameAllocator.free_to_buddy(paddr, PageFrameCount::new(1)) };
+    return true;
+}
+
+/// 规整一个候选区域
+///
+/// ## 返回值
+///
+/// 如果区域中的所有页面都被迁移走了，返回true
+fn compact_region(region: &CompactRegion, movable: &[PhysAddr]) -> bool {
+    let mut held: Vec<PhysAddr> = Vec::new();
+    let mut ok = true;
+    for paddr in movable {
+        // 被暂时持有的页帧本来就是空闲的
+        if held.contains(paddr) {
+            continue;
+        }
+        if !migrate_anon_page(*paddr, region, &mut held) {
+            ok = false;
+            break;
+        }
+    }
+    // 释放之后，区域内的空闲页帧会与伙伴合并
+    for paddr in held {
+        unsafe { LockedFrameAllocator.free_to_buddy(paddr, PageFrameCount::new(1)) };
+    }
+    return ok;
+}
+
+/// 进行一次规整，尝试得到至少2^`order`个连续页帧的空闲块
+///
+/// 请注意，不要在全局内存分配器中、或者持有自旋锁时调用这个函数。
+///
+/// ## 参数
+///
+/// - `order`：需要的空闲块的阶数（以页帧为单位，不能超过[`COMPACT_MAX_ORDER`]）
+/// - `zone`：空闲块允许位于的最高的区域
+///
+/// ## 返回值
+///
+/// 如果规整之后存在满足要求的空闲块，返回true
+pub fn compact_memory(order: usize, zone: ZoneType) -> bool {
+    if order == 0 || order > COMPACT_MAX_ORDER {
+        return false;
+    }
+    // per-cpu缓存中的页帧对于buddy来说是已分配的，会阻止伙伴合并
+    LockedFrameAllocator.drain_per_cpu_pages();
+    if has_free_block(order, zone) {
+        return true;
+    }
+
+    let max_pfn = match LockedFrameAllocator.with_buddy(|buddy| buddy.max_pfn()) {
+        Some(x) => x,
+        None => return false,
+    };
+    let pages = 1 << order;
+    let nr_regions = max_pfn / pages;
+    if nr_regions == 0 {
+        return false;
+    }
+
+    let mut index = (COMPACT_CURSOR.load(Ordering::Relaxed) / pages) % nr_regions;
+    for _ in 0..core::cmp::min(COMPACT_SCAN_REGIONS, nr_regions) {
+        let region = CompactRegion {
+            start: PhysAddr::new((index * pages) << MMArch::PAGE_SHIFT),
+            pages,
+        };
+        index = (index + 1) % nr_regions;
+
+        if ZoneType::of(region.start) > zone {
+            continue;
+        }
+        let movable = match isolate_region(&region) {
+            Some(m) => m,
+            None => continue,
+        };
+        if compact_region(&region, &movable) && has_free_block(order, zone) {
+            kdebug!(
+                "compaction: order {} block at {:?}, migrated {} pages",
+                order,
+                region.start,
+                movable.len()
+            );
+            COMPACT_CURSOR.store(index * pages, Ordering::Relaxed);
+            return true;
+        }
+    }
+    COMPACT_CURSOR.store(index * pages, Ordering::Relaxed);
+    return has_free_block(order, zone);
+}
+
+/// 后台规整：空闲内存充足，但是没有巨页大小的空闲块时，进行一次规整
+///
+/// 由kswapd在每一轮回收之后调用
+pub fn background_compaction() {
+    let free = LockedFrameAllocator.get_usage().free().data();
+    if free < (1 << BACKGROUND_COMPACT_ORDER) * BACKGROUND_FREE_RATIO {
+        return;
+    }
+    if has_free_block(BACKGROUND_COMPACT_ORDER, ZoneType::Normal) {
+        return;
+    }
+    compact_memory(BACKGROUND_COMPACT_ORDER, ZoneType::Normal);
+}
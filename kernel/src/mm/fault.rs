@@ -0,0 +1,501 @@
+//! 与架构无关的缺页异常处理
+//!
+//! 各个架构的缺页异常入口在解析完错误码之后，调用这里的[`PageFaultHandler::handle_mm_fault`]
+//! 完成对用户地址空间的缺页处理。
+
+use core::intrinsics::unlikely;
+
+use alloc::sync::Arc;
+
+use crate::{
+    arch::{mm::HUGE_PAGE_2M_SIZE, MMArch},
+    filesystem::vfs::page_cache::FileMapping,
+    process::ProcessManager,
+    sched::psi::PsiResource,
+    syscall::SystemError,
+    time::timer::clock,
+};
+
+use super::{
+    allocator::{
+        page_frame::{
+            allocate_page_frames, deallocate_page_frames, FrameAllocator, PageFrameCount,
+            PhysPageFrame,
+        },
+        zeroed_pool::allocate_zeroed_page,
+    },
+    lru::{lru_add_anon, lru_del},
+    memcg::mem_cgroup_try_charge,
+    page::{Flusher, PageFlags, PageMapCount, ZeroPage},
+    reclaim::{try_to_free_pages, wakeup_kswapd},
+    rss::RssMember,
+    ucontext::{AddressSpace, InnerAddressSpace, LockedVMA, UserStack, VmFlags, VMA},
+    zram::zram_load,
+    MemoryManagementArch, PhysAddr, VirtAddr,
+};
+
+/// 匿名VMA至少有这么大时，才会在缺页时自动使用2M的巨页（设置了MADV_HUGEPAGE的VMA不受此限制）
+const HUGE_ANON_MIN_VMA_SIZE: usize = 8 * HUGE_PAGE_2M_SIZE;
+
+bitflags! {
+    /// 缺页异常的原因（与架构无关）
+    pub struct FaultFlags: u32 {
+        /// 由写操作引起
+        const FAULT_FLAG_WRITE = 1 << 0;
+        /// 发生在用户态
+        const FAULT_FLAG_USER = 1 << 1;
+        /// 由取指引起
+        const FAULT_FLAG_INSTRUCTION = 1 << 2;
+    }
+}
+
+pub struct PageFaultHandler;
+
+impl PageFaultHandler {
+    /// 处理用户地址空间内的缺页异常
+    ///
+    /// ## 参数
+    ///
+    /// - `address`：触发缺页异常的虚拟地址
+    /// - `flags`：缺页异常的原因
+    ///
+    /// ## 返回值
+    ///
+    /// - `Ok(())`：缺页异常已经被处理，可以返回到触发异常的指令重新执行
+    /// - `Err(SystemError)`：这是一次非法访问
+    pub fn handle_mm_fault(address: VirtAddr, flags: FaultFlags) -> Result<(), SystemError> {
+        let space: Arc<AddressSpace> = ProcessManager::current_pcb()
+            .basic()
+            .user_vm()
+            .ok_or(SystemError::EFAULT)?;
+        return Self::handle_mm_fault_in(&space, address, flags);
+    }
+
+    /// 处理指定的用户地址空间内的缺页异常（这个地址空间不必是当前进程的地址空间）
+    pub fn handle_mm_fault_in(
+        space: &Arc<AddressSpace>,
+        address: VirtAddr,
+        flags: FaultFlags,
+    ) -> Result<(), SystemError> {
+        if unlikely(!address.check_user()) {
+            return Err(SystemError::EFAULT);
+        }
+
+        tracepoint!(PageFault, address.data(), flags.bits());
+        // 任务组的内存用量达到限制时，先在组内回收页面（需要在锁住地址空间之前进行）
+        mem_cgroup_try_charge()?;
+        let mut guard = space.write();
+        let r = Self::do_fault(space, &mut guard, address, flags);
+        drop(guard);
+        // 空闲页帧较少时，让kswapd在后台回收内存
+        wakeup_kswapd();
+        return r;
+    }
+
+    fn do_fault(
+        owner: &Arc<AddressSpace>,
+        space: &mut InnerAddressSpace,
+        address: VirtAddr,
+        flags: FaultFlags,
+    ) -> Result<(), SystemError> {
+        let vma = match space.mappings.contains(address) {
+            Some(vma) => vma,
+            None => Self::expand_stack(space, address)?,
+        };
+        let (vma_flags, file, huge_start) = {
+            let guard = vma.lock();
+            let flags: PageFlags<MMArch> = guard.flags();
+            let file = guard.file_mapping().cloned();
+            let huge_start = if file.is_none() {
+                Self::huge_anon_start(&guard, address)
+            } else {
+                None
+            };
+            (flags, file, huge_start)
+        };
+
+        let is_write = flags.contains(FaultFlags::FAULT_FLAG_WRITE);
+        if unlikely(is_write && !vma_flags.has_write()) {
+            return Err(SystemError::EACCES);
+        }
+        if unlikely(flags.contains(FaultFlags::FAULT_FLAG_INSTRUCTION) && !vma_flags.has_execute())
+        {
+            return Err(SystemError::EACCES);
+        }
+
+        let page_vaddr = VirtAddr::new(address.data() & MMArch::PAGE_MASK);
+        match space.user_mapper.utable.translate(page_vaddr) {
+            Some((paddr, pte_flags)) => {
+                if is_write && !pte_flags.has_write() {
+                    if let Some(file) = file.filter(|f| f.is_cache_page(page_vaddr, paddr)) {
+                        return Self::do_file_wp_page(
+                            owner, space, &file, page_vaddr, paddr, vma_flags,
+                        );
+                    }
+                    return Self::do_wp_page(owner, space, page_vaddr, paddr, vma_flags);
+                }
+                // 页表项已经满足本次访问，可能是其他cpu已经处理了这个缺页异常，
+                // 只需要刷新本地的TLB即可
+                unsafe { MMArch::invalidate_page(page_vaddr) };
+                return Ok(());
+            }
+            None => {
+                if let Some(entry) = space.user_mapper.utable.swap_entry(page_vaddr) {
+                    return Self::do_swap_page(owner, space, page_vaddr, entry, vma_flags);
+                }
+                if let Some(file) = file {
+                    return Self::do_file_page(
+                        owner, space, &file, page_vaddr, vma_flags, is_write,
+                    );
+                }
+                if !is_write {
+                    return Self::do_zero_page(space, page_vaddr, vma_flags);
+                }
+                if let Some(huge_start) = huge_start {
+                    if Self::do_huge_anonymous_page(owner, space, huge_start, vma_flags) {
+                        return Ok(());
+                    }
+                }
+                return Self::do_anonymous_page(owner, space, page_vaddr, vma_flags);
+            }
+        }
+    }
+
+    /// 对从未被访问过的匿名页的读操作：只读地映射全局的零页
+    fn do_zero_page(
+        space: &mut InnerAddressSpace,
+        vaddr: VirtAddr,
+        vma_flags: PageFlags<MMArch>,
+    ) -> Result<(), SystemError> {
+        let mapper = &mut space.user_mapper.utable;
+        let flags = vma_flags.set_write(false);
+        let flush = unsafe { mapper.map_phys(vaddr, ZeroPage::paddr(), flags) }
+            .ok_or(SystemError::ENOMEM)?;
+        flush.flush();
+        return Ok(());
+    }
+
+    /// 文件映射中还没有被映射的页面：先只读地映射缓存页，写入时再按照写保护异常处理
+    fn do_file_page(
+        owner: &Arc<AddressSpace>,
+        space: &mut InnerAddressSpace,
+        file: &FileMapping,
+        vaddr: VirtAddr,
+        vma_flags: PageFlags<MMArch>,
+        is_write: bool,
+    ) -> Result<(), SystemError> {
+        Self::do_file_read_page(space, file, vaddr, vma_flags)?;
+        if !is_write {
+            return Ok(());
+        }
+        let (paddr, _) = space
+            .user_mapper
+            .utable
+            .translate(vaddr)
+            .ok_or(SystemError::EFAULT)?;
+        return Self::do_file_wp_page(owner, space, file, vaddr, paddr, vma_flags);
+    }
+
+    /// 只读地把文件映射中`vaddr`所在的页映射到它的缓存页（也用于MAP_POPULATE）
+    ///
+    /// ## 返回值
+    ///
+    /// 页面在文件末尾之后时，返回`EFAULT`
+    pub(super) fn do_file_read_page(
+        space: &mut InnerAddressSpace,
+        file: &FileMapping,
+        vaddr: VirtAddr,
+        vma_flags: PageFlags<MMArch>,
+    ) -> Result<(), SystemError> {
+        let paddr = file.map_page(vaddr)?;
+        let mapper = &mut space.user_mapper.utable;
+        match unsafe { mapper.map_phys(vaddr, paddr, vma_flags.set_write(false)) } {
+            Some(flush) => flush.flush(),
+            None => {
+                file.unmap_page(vaddr, paddr);
+                return Err(SystemError::ENOMEM);
+            }
+        }
+        space.rss.inc(RssMember::FilePages);
+        return Ok(());
+    }
+
+    /// 处理对文件映射中只读映射着的缓存页的写入
+    ///
+    /// 共享映射把页面标记为脏页，然后恢复写权限；私有映射复制一份匿名页，替换掉缓存页的映射
+    fn do_file_wp_page(
+        owner: &Arc<AddressSpace>,
+        space: &mut InnerAddressSpace,
+        file: &FileMapping,
+        vaddr: VirtAddr,
+        old_paddr: PhysAddr,
+        vma_flags: PageFlags<MMArch>,
+    ) -> Result<(), SystemError> {
+        if file.shared() {
+            file.mkwrite(vaddr);
+            let flush = unsafe { space.user_mapper.utable.remap(vaddr, vma_flags) }
+                .ok_or(SystemError::EFAULT)?;
+            flush.flush();
+            return Ok(());
+        }
+
+        // 其他cpu上可能还缓存着指向缓存页的TLB项，因此需要对所有使用这个地址空间的cpu进行刷新
+        let mut flusher = space.tlb_flusher();
+        let mapper = &mut space.user_mapper.utable;
+        let new_paddr =
+            Self::alloc_with_reclaim(|| unsafe { mapper.allocator_mut().allocate_one() })?;
+        unsafe {
+            let src = MMArch::phys_2_virt(old_paddr).unwrap().data() as *const u8;
+            let dst = MMArch::phys_2_virt(new_paddr).unwrap().data() as *mut u8;
+            dst.copy_from_nonoverlapping(src, MMArch::PAGE_SIZE);
+
+            let (_, _, flush) = mapper
+                .unmap_phys(vaddr, false)
+                .expect("File page is not mapped");
+            flush.ignore();
+            let flush = mapper
+                .map_phys(vaddr, new_paddr, vma_flags)
+                .expect("Failed to map COW page");
+            flusher.consume(flush);
+        }
+        drop(flusher);
+        lru_add_anon(new_paddr, owner, vaddr);
+        file.unmap_page(vaddr, old_paddr);
+        space.rss.dec(RssMember::FilePages);
+        space.rss.inc(RssMember::AnonPages);
+        return Ok(());
+    }
+
+    /// 换入一个被压缩保存的匿名页
+    ///
+    /// ## 参数
+    ///
+    /// - `vaddr`：页面的虚拟地址
+    /// - `swap_entry`：页表项中记录的交换条目
+    /// - `vma_flags`：页面所在VMA的标志位
+    fn do_swap_page(
+        owner: &Arc<AddressSpace>,
+        space: &mut InnerAddressSpace,
+        vaddr: VirtAddr,
+        swap_entry: usize,
+        vma_flags: PageFlags<MMArch>,
+    ) -> Result<(), SystemError> {
+        let mapper = &mut space.user_mapper.utable;
+        let paddr = Self::alloc_with_reclaim(|| unsafe { mapper.allocator_mut().allocate_one() })?;
+        if let Err(e) = zram_load(swap_entry, paddr) {
+            unsafe { mapper.allocator_mut().free_one(paddr) };
+            return Err(e);
+        }
+        unsafe {
+            // 交换条目的引用已经在解压缩后被释放，这里只需要清除页表项
+            mapper.take_swap_entry(vaddr);
+            match mapper.map_phys(vaddr, paddr, vma_flags) {
+                Some(flush) => flush.flush(),
+                None => {
+                    mapper.allocator_mut().free_one(paddr);
+                    return Err(SystemError::ENOMEM);
+                }
+            }
+        }
+        space.rss.dec(RssMember::SwapEntries);
+        space.rss.inc(RssMember::AnonPages);
+        lru_add_anon(paddr, owner, vaddr);
+        return Ok(());
+    }
+
+    /// 为按需分配的匿名页分配一个清零的物理页，并映射到页表
+    fn do_anonymous_page(
+        owner: &Arc<AddressSpace>,
+        space: &mut InnerAddressSpace,
+        vaddr: VirtAddr,
+        vma_flags: PageFlags<MMArch>,
+    ) -> Result<(), SystemError> {
+        let mapper = &mut space.user_mapper.utable;
+        unsafe {
+            let paddr = Self::alloc_with_reclaim(|| allocate_zeroed_page())?;
+            match mapper.map_phys(vaddr, paddr, vma_flags) {
+                Some(flush) => flush.flush(),
+                None => {
+                    mapper.allocator_mut().free_one(paddr);
+                    return Err(SystemError::ENOMEM);
+                }
+            }
+            lru_add_anon(paddr, owner, vaddr);
+        }
+        space.rss.inc(RssMember::AnonPages);
+        return Ok(());
+    }
+
+    /// 判断匿名VMA中`address`所在的2M范围能否使用巨页
+    ///
+    /// ## 返回值
+    ///
+    /// 如果能够使用巨页，返回这个范围的起始地址，否则返回None
+    fn huge_anon_start(vma: &VMA, address: VirtAddr) -> Option<VirtAddr> {
+        let vm_flags = vma.vm_flags();
+        if vm_flags.intersects(VmFlags::VM_NOHUGEPAGE | VmFlags::VM_SPECIAL) {
+            return None;
+        }
+        let region = vma.region();
+        if !vm_flags.contains(VmFlags::VM_HUGEPAGE) && region.size() < HUGE_ANON_MIN_VMA_SIZE {
+            return None;
+        }
+        let start = VirtAddr::new(address.data() & !(HUGE_PAGE_2M_SIZE - 1));
+        if start < region.start() || start.add(HUGE_PAGE_2M_SIZE) > region.end() {
+            return None;
+        }
+        return Some(start);
+    }
+
+    /// 对一个完全没有被映射过的2M范围的写操作：分配一个清零的巨页，映射整个范围
+    ///
+    /// 巨页由一个2M的伙伴块提供，它的每个4K页都像普通的匿名页一样计入RSS、加入LRU链表。
+    /// 之后对其中某个4K页的写时复制、换出、解除映射或者修改权限，都会先把巨页拆分成4K的页表项。
+    ///
+    /// ## 返回值
+    ///
+    /// 范围内已经有映射，或者没有空闲的2M伙伴块时，返回false，由调用者回退到4K的页面
+    fn do_huge_anonymous_page(
+        owner: &Arc<AddressSpace>,
+        space: &mut InnerAddressSpace,
+        start: VirtAddr,
+        vma_flags: PageFlags<MMArch>,
+    ) -> bool {
+        let mapper = &mut space.user_mapper.utable;
+        if !mapper.huge_entry_unused(start, 1) {
+            return false;
+        }
+        // 不为巨页进行直接回收或者规整：这里只是一个优化，失败时使用4K的页面即可
+        let count = PageFrameCount::new(HUGE_PAGE_2M_SIZE / MMArch::PAGE_SIZE);
+        let paddr = match unsafe { allocate_page_frames(count) } {
+            Some((paddr, _)) => paddr,
+            None => return false,
+        };
+        unsafe {
+            MMArch::write_bytes(MMArch::phys_2_virt(paddr).unwrap(), 0, HUGE_PAGE_2M_SIZE);
+            match mapper.map_huge_phys(start, paddr, vma_flags, 1) {
+                Some(flush) => flush.flush(),
+                None => {
+                    deallocate_page_frames(PhysPageFrame::new(paddr), count);
+                    return false;
+                }
+            }
+        }
+        for i in 0..count.data() {
+            let offset = i * MMArch::PAGE_SIZE;
+            lru_add_anon(paddr.add(offset), owner, start.add(offset));
+        }
+        space.rss.add(RssMember::AnonPages, count.data() as isize);
+        return true;
+    }
+
+    /// 分配页帧。如果分配失败，则进行一次直接回收，然后重试
+    fn alloc_with_reclaim(
+        mut alloc: impl FnMut() -> Option<PhysAddr>,
+    ) -> Result<PhysAddr, SystemError> {
+        if let Some(paddr) = alloc() {
+            return Ok(paddr);
+        }
+        // 直接回收的时间记为任务组的内存压力
+        let start = clock();
+        let freed = try_to_free_pages(1);
+        ProcessManager::current_pcb()
+            .sched_info()
+            .task_group()
+            .psi_account(PsiResource::Memory, clock().saturating_sub(start));
+        if freed == 0 {
+            return Err(SystemError::ENOMEM);
+        }
+        return alloc().ok_or(SystemError::ENOMEM);
+    }
+
+    /// 如果地址位于用户栈下方，并且扩展后不超过用户栈的最大大小，则扩展用户栈以包含这个地址
+    ///
+    /// ## 返回值
+    ///
+    /// 返回包含`address`的新的VMA
+    fn expand_stack(
+        space: &mut InnerAddressSpace,
+        address: VirtAddr,
+    ) -> Result<Arc<LockedVMA>, SystemError> {
+        let mut stack = space.user_stack.take().ok_or(SystemError::EFAULT)?;
+        let lowest = stack.lowest_address();
+        let r = if address < lowest && (lowest - address) <= UserStack::MAX_USER_STACK_SIZE {
+            let bytes = lowest - VirtAddr::new(address.data() & MMArch::PAGE_MASK);
+            stack.extend(space, bytes)
+        } else {
+            Err(SystemError::EFAULT)
+        };
+        space.user_stack = Some(stack);
+        r?;
+
+        return space.mappings.contains(address).ok_or(SystemError::EFAULT);
+    }
+
+    /// 处理对写时复制页面的写入
+    ///
+    /// ## 参数
+    ///
+    /// - `vaddr`：页面的虚拟地址
+    /// - `old_paddr`：当前映射的物理页
+    /// - `vma_flags`：页面所在VMA的标志位
+    fn do_wp_page(
+        owner: &Arc<AddressSpace>,
+        space: &mut InnerAddressSpace,
+        vaddr: VirtAddr,
+        old_paddr: PhysAddr,
+        vma_flags: PageFlags<MMArch>,
+    ) -> Result<(), SystemError> {
+        let mapper = &mut space.user_mapper.utable;
+        // 零页不能被写入，替换为新的清零的物理页
+        let is_zero_page = ZeroPage::is_zero_page(old_paddr);
+
+        // 当前地址空间是这个物理页唯一的映射者，直接恢复写权限即可
+        if !is_zero_page && PageMapCount::get(old_paddr) == 1 {
+            let flush = unsafe { mapper.remap(vaddr, vma_flags) }.ok_or(SystemError::EFAULT)?;
+            flush.flush();
+            return Ok(());
+        }
+
+        // 复制一份新的物理页，并替换掉原来的映射。
+        // 其他cpu上可能还缓存着指向旧物理页的TLB项，因此需要对所有使用这个地址空间的cpu进行刷新
+        let mut flusher = space.tlb_flusher();
+        let mapper = &mut space.user_mapper.utable;
+        let new_paddr = if is_zero_page {
+            Self::alloc_with_reclaim(|| unsafe { allocate_zeroed_page() })?
+        } else {
+            Self::alloc_with_reclaim(|| unsafe { mapper.allocator_mut().allocate_one() })?
+        };
+        unsafe {
+            if !is_zero_page {
+                let src = MMArch::phys_2_virt(old_paddr).unwrap().data() as *const u8;
+                let dst = MMArch::phys_2_virt(new_paddr).unwrap().data() as *mut u8;
+                dst.copy_from_nonoverlapping(src, MMArch::PAGE_SIZE);
+            }
+
+            let (_, _, flush) = mapper
+                .unmap_phys(vaddr, false)
+                .expect("COW page is not mapped");
+            flush.ignore();
+            let flush = mapper
+                .map_phys(vaddr, new_paddr, vma_flags)
+                .expect("Failed to map COW page");
+            flusher.consume(flush);
+        }
+        drop(flusher);
+        lru_add_anon(new_paddr, owner, vaddr);
+        // 写入零页时得到了新的匿名页；复制时只是把共享的匿名页换成了私有的
+        if is_zero_page {
+            space.rss.inc(RssMember::AnonPages);
+        }
+
+        if !is_zero_page && PageMapCount::dec(old_paddr) == 0 {
+            // 其他映射者在此期间已经释放了这个物理页
+            lru_del(old_paddr);
+            unsafe {
+                deallocate_page_frames(PhysPageFrame::new(old_paddr), PageFrameCount::new(1))
+            };
+        }
+        return Ok(());
+    }
+}
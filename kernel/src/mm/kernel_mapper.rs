@@ -1,12 +1,11 @@
 use super::{page::PageFlags, PageTableKind, PhysAddr, VirtAddr};
 use crate::{
     arch::{
-        mm::{LockedFrameAllocator, PageMapper},
+        mm::{LockedFrameAllocator, PageMapper, HUGE_PAGE_2M_SIZE},
         CurrentIrqArch,
     },
     exception::InterruptArch,
     libs::align::page_align_up,
-    mm::allocator::page_frame::PageFrameCount,
     mm::{MMArch, MemoryManagementArch},
     smp::core::smp_get_processor_id,
     syscall::SystemError,
@@ -107,18 +106,33 @@ impl KernelMapper {
             return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
         }
 
-        let count = PageFrameCount::new(page_align_up(size) / MMArch::PAGE_SIZE);
-        // kdebug!("kernel mapper: map_phys: vaddr: {vaddr:?}, paddr: {paddr:?}, count: {count:?}, flags: {flags:?}");
-
-        for _ in 0..count.data() {
-            let flusher = self.mapper.map_phys(vaddr, paddr, flags).unwrap();
+        let end = vaddr + page_align_up(size);
+        // kdebug!("kernel mapper: map_phys: vaddr: {vaddr:?}, paddr: {paddr:?}, size: {size}, flags: {flags:?}");
+
+        while vaddr < end {
+            // 虚拟地址和物理地址都按照2M对齐，并且剩余的空间足够大时，使用大页进行映射
+            let step = if vaddr.check_aligned(HUGE_PAGE_2M_SIZE)
+                && paddr.check_aligned(HUGE_PAGE_2M_SIZE)
+                && end - vaddr >= HUGE_PAGE_2M_SIZE
+            {
+                HUGE_PAGE_2M_SIZE
+            } else {
+                MMArch::PAGE_SIZE
+            };
+
+            let flusher = if step == HUGE_PAGE_2M_SIZE {
+                self.mapper.map_huge_phys(vaddr, paddr, flags, 1)
+            } else {
+                self.mapper.map_phys(vaddr, paddr, flags)
+            }
+            .unwrap();
 
             if flush {
                 flusher.flush();
             }
 
-            vaddr += MMArch::PAGE_SIZE;
-            paddr += MMArch::PAGE_SIZE;
+            vaddr += step;
+            paddr += step;
         }
         return Ok(());
     }
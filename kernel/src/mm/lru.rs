@@ -0,0 +1,507 @@
+//! 匿名页的LRU链表
+//!
+//! 缺页时分配的匿名页会被加入不活跃链表。回收时：
+//! - 活跃链表比不活跃链表长的时候，把活跃链表头部（最久之前被激活的）页面清除访问位，移动到不活跃链表
+//! - 扫描不活跃链表头部的页面：期间被访问过的页面被重新激活，没有被访问过的页面被回收
+//!
+//! 每个页帧的LRU状态记录在一个以物理地址为键的表中，同时记录了映射它的地址空间和虚拟地址，
+//! 回收时通过它们找到页表项。页帧被释放时通过[`lru_del`]从表中删除；
+//! 扫描时发现页帧已经不再被映射到原来的位置的，也会被删除。
+//!
+//! 被回收的匿名页会被压缩保存到zram（见[`super::zram`]），页表项中记录交换条目，再次访问时换入。
+//!
+//! 页帧在LRU中的期间，被记账到加入它的进程所在的任务组（见[`super::memcg`]）。
+
+use alloc::{
+    collections::VecDeque,
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+use hashbrown::HashMap;
+
+use crate::{
+    arch::MMArch, libs::spinlock::SpinLock, process::ProcessManager, sched::cgroup::TaskGroup,
+};
+
+use super::{
+    allocator::page_frame::{deallocate_page_frames, PageFrameCount, PhysPageFrame},
+    memcg::{mem_cgroup_charge, mem_cgroup_uncharge},
+    page::{Flusher, PageFlags, PageMapCount},
+    reclaim::Shrinker,
+    rss::RssMember,
+    ucontext::{AddressSpace, InnerAddressSpace},
+    zram::{zram_enabled, zram_free, zram_store},
+    PhysAddr, VirtAddr,
+};
+
+lazy_static! {
+    static ref PAGE_LRU: SpinLock<PageLru> = SpinLock::new(PageLru::new());
+}
+
+/// 页帧所在的LRU链表
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum LruList {
+    Active,
+    Inactive,
+    /// 页面已经被回收者从链表中取出，正在被扫描
+    Isolated,
+}
+
+#[derive(Debug)]
+struct LruPage {
+    /// 映射这个页帧的地址空间
+    owner: Weak<AddressSpace>,
+    /// 页帧在地址空间中的虚拟地址
+    vaddr: VirtAddr,
+    list: LruList,
+    /// 页帧被记账到的任务组
+    memcg: Arc<TaskGroup>,
+}
+
+impl Drop for LruPage {
+    fn drop(&mut self) {
+        mem_cgroup_uncharge(&self.memcg);
+    }
+}
+
+#[derive(Debug)]
+struct PageLru {
+    pages: HashMap<PhysAddr, LruPage>,
+    /// 链表中可能存在已经失效的项（页帧的状态与所在的链表不一致），取出时跳过即可
+    active: VecDeque<PhysAddr>,
+    inactive: VecDeque<PhysAddr>,
+    nr_active: usize,
+    nr_inactive: usize,
+}
+
+/// 被回收者从链表中取出的页面
+#[derive(Debug)]
+struct IsolatedPage {
+    paddr: PhysAddr,
+    owner: Weak<AddressSpace>,
+    vaddr: VirtAddr,
+}
+
+/// 扫描一个页面的结果
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum ScanResult {
+    /// 页面已经不再被映射到原来的位置，从LRU中删除
+    Gone,
+    /// 放入活跃链表
+    Activate,
+    /// 放入不活跃链表
+    Deactivate,
+    /// 页面已经被回收
+    Reclaimed,
+}
+
+impl PageLru {
+    fn new() -> Self {
+        return Self {
+            pages: HashMap::new(),
+            active: VecDeque::new(),
+            inactive: VecDeque::new(),
+            nr_active: 0,
+            nr_inactive: 0,
+        };
+    }
+
+    fn dec_count(&mut self, list: LruList) {
+        match list {
+            LruList::Active => self.nr_active -= 1,
+            LruList::Inactive => self.nr_inactive -= 1,
+            LruList::Isolated => {}
+        }
+    }
+
+    /// 把页帧放入指定的链表的尾部
+    fn put(&mut self, paddr: PhysAddr, list: LruList) {
+        match list {
+            LruList::Active => {
+                self.active.push_back(paddr);
+                self.nr_active += 1;
+            }
+            LruList::Inactive => {
+                self.inactive.push_back(paddr);
+                self.nr_inactive += 1;
+            }
+            LruList::Isolated => unreachable!(),
+        }
+    }
+
+    fn add(
+        &mut self,
+        paddr: PhysAddr,
+        owner: Weak<AddressSpace>,
+        vaddr: VirtAddr,
+        memcg: Arc<TaskGroup>,
+    ) {
+        mem_cgroup_charge(&memcg);
+        let old_list = match self.pages.get_mut(&paddr) {
+            Some(page) => {
+                // 页帧被释放后又被重新分配，更新它的映射信息
+                page.owner = owner;
+                page.vaddr = vaddr;
+                mem_cgroup_uncharge(&core::mem::replace(&mut page.memcg, memcg));
+                if page.list == LruList::Inactive {
+                    return;
+                }
+                let old = page.list;
+                page.list = LruList::Inactive;
+                Some(old)
+            }
+            None => {
+                self.pages.insert(
+                    paddr,
+                    LruPage {
+                        owner,
+                        vaddr,
+                        list: LruList::Inactive,
+                        memcg,
+                    },
+                );
+                None
+            }
+        };
+        if let Some(old) = old_list {
+            self.dec_count(old);
+        }
+        self.put(paddr, LruList::Inactive);
+    }
+
+    /// 从链表中取出最多`nr`个记账到`group`或者它的后代的页面，最多检查`nr_scan`个项
+    fn isolate_group(
+        &mut self,
+        from: LruList,
+        nr: usize,
+        nr_scan: usize,
+        group: &TaskGroup,
+    ) -> Vec<IsolatedPage> {
+        let mut result = Vec::with_capacity(nr);
+        let mut scanned = 0;
+        let pages = &mut self.pages;
+        let queue = match from {
+            LruList::Active => &mut self.active,
+            LruList::Inactive => &mut self.inactive,
+            LruList::Isolated => unreachable!(),
+        };
+        queue.retain(|paddr| {
+            if result.len() >= nr || scanned >= nr_scan {
+                return true;
+            }
+            scanned += 1;
+            let page = match pages.get_mut(paddr) {
+                Some(page) if page.list == from => page,
+                // 顺便删除已经失效的项
+                _ => return false,
+            };
+            if !page.memcg.is_descendant_of(group) {
+                return true;
+            }
+            page.list = LruList::Isolated;
+            result.push(IsolatedPage {
+                paddr: *paddr,
+                owner: page.owner.clone(),
+                vaddr: page.vaddr,
+            });
+            return false;
+        });
+        for _ in 0..result.len() {
+            self.dec_count(from);
+        }
+        return result;
+    }
+
+    /// 从链表的头部取出最多`nr`个页面
+    fn isolate(&mut self, from: LruList, nr: usize) -> Vec<IsolatedPage> {
+        let mut result = Vec::with_capacity(nr);
+        while result.len() < nr {
+            let paddr = match from {
+                LruList::Active => self.active.pop_front(),
+                LruList::Inactive => self.inactive.pop_front(),
+                LruList::Isolated => unreachable!(),
+            };
+            let paddr = match paddr {
+                Some(paddr) => paddr,
+                None => break,
+            };
+            let page = match self.pages.get_mut(&paddr) {
+                Some(page) if page.list == from => page,
+                // 已经失效的项
+                _ => continue,
+            };
+            page.list = LruList::Isolated;
+            result.push(IsolatedPage {
+                paddr,
+                owner: page.owner.clone(),
+                vaddr: page.vaddr,
+            });
+            self.dec_count(from);
+        }
+        return result;
+    }
+
+    /// 把扫描完的页面放回链表
+    fn putback(&mut self, page: &IsolatedPage, result: ScanResult) {
+        match self.pages.get_mut(&page.paddr) {
+            Some(p) if p.list == LruList::Isolated => {
+                let list = match result {
+                    ScanResult::Activate => LruList::Active,
+                    ScanResult::Deactivate => LruList::Inactive,
+                    ScanResult::Gone | ScanResult::Reclaimed => {
+                        self.pages.remove(&page.paddr);
+                        return;
+                    }
+                };
+                p.list = list;
+                self.put(page.paddr, list);
+            }
+            // 扫描期间，页帧被重新加入了LRU，以新的状态为准
+            _ => {}
+        }
+    }
+}
+
+/// 把缺页时新分配的匿名页加入LRU
+///
+/// ## 参数
+///
+/// - `paddr`：页帧的物理地址
+/// - `owner`：映射这个页帧的地址空间
+/// - `vaddr`：页帧在地址空间中的虚拟地址
+pub fn lru_add_anon(paddr: PhysAddr, owner: &Arc<AddressSpace>, vaddr: VirtAddr) {
+    let memcg = ProcessManager::current_pcb()
+        .sched_info()
+        .task_group()
+        .clone();
+    PAGE_LRU
+        .lock()
+        .add(paddr, Arc::downgrade(owner), vaddr, memcg);
+}
+
+/// 页帧的内容被迁移到新的页帧之后调用，新的页帧继承原来的页帧的LRU状态和记账
+pub fn lru_migrate(
+    old_paddr: PhysAddr,
+    new_paddr: PhysAddr,
+    owner: &Arc<AddressSpace>,
+    vaddr: VirtAddr,
+) {
+    let mut guard = PAGE_LRU.lock();
+    let memcg = match guard.pages.remove(&old_paddr) {
+        Some(page) => {
+            guard.dec_count(page.list);
+            page.memcg.clone()
+        }
+        None => ProcessManager::current_pcb()
+            .sched_info()
+            .task_group()
+            .clone(),
+    };
+    guard.add(new_paddr, Arc::downgrade(owner), vaddr, memcg);
+}
+
+/// 页帧被释放之前调用，把它从LRU中删除
+pub fn lru_del(paddr: PhysAddr) {
+    let mut guard = PAGE_LRU.lock();
+    if let Some(page) = guard.pages.remove(&paddr) {
+        // 链表中的项会在取出时被跳过
+        guard.dec_count(page.list);
+    }
+}
+
+/// 查找LRU中的页帧的映射信息（正在被扫描的页帧除外）
+///
+/// ## 返回值
+///
+/// (映射这个页帧的地址空间, 页帧在地址空间中的虚拟地址)
+pub fn lru_lookup(paddr: PhysAddr) -> Option<(Weak<AddressSpace>, VirtAddr)> {
+    let guard = PAGE_LRU.lock();
+    let page = guard.pages.get(&paddr)?;
+    if page.list == LruList::Isolated {
+        return None;
+    }
+    return Some((page.owner.clone(), page.vaddr));
+}
+
+/// 获取LRU链表中的页面数量
+///
+/// ## 返回值
+///
+/// (活跃链表中的页面数量, 不活跃链表中的页面数量)
+pub fn lru_count() -> (usize, usize) {
+    let guard = PAGE_LRU.lock();
+    return (guard.nr_active, guard.nr_inactive);
+}
+
+/// 扫描一个页面
+///
+/// ## 参数
+///
+/// - `page`：要扫描的页面
+/// - `inactive`：页面是否来自不活跃链表
+fn scan_page(page: &IsolatedPage, inactive: bool) -> ScanResult {
+    let space = match page.owner.upgrade() {
+        Some(space) => space,
+        None => return ScanResult::Gone,
+    };
+    // 地址空间正在被使用（例如正在处理缺页异常），先放回原来的链表
+    let mut guard = match space.try_write() {
+        Some(guard) => guard,
+        None if inactive => return ScanResult::Deactivate,
+        None => return ScanResult::Activate,
+    };
+
+    let mapper = &mut guard.user_mapper.utable;
+    let flags = match mapper.translate(page.vaddr) {
+        Some((paddr, flags)) if paddr == page.paddr => flags,
+        _ => return ScanResult::Gone,
+    };
+    let referenced = unsafe { mapper.test_and_clear_accessed(page.vaddr) }.unwrap_or(false);
+
+    if !inactive {
+        // 活跃链表中的页面，无论最近是否被访问过，都移动到不活跃链表，等待下一次检查
+        return ScanResult::Deactivate;
+    }
+    if referenced {
+        return ScanResult::Activate;
+    }
+    // 被写时复制共享的页面，无法只通过一个映射者回收
+    if PageMapCount::get(page.paddr) > 1 {
+        return ScanResult::Deactivate;
+    }
+    if reclaim_anon_page(&mut guard, page, flags) {
+        return ScanResult::Reclaimed;
+    }
+    return ScanResult::Deactivate;
+}
+
+/// 回收一个不活跃的匿名页：把它的内容压缩保存到zram，并在页表项中记录交换条目
+///
+/// ## 参数
+///
+/// - `space`：映射这个页面的地址空间
+/// - `page`：要回收的页面
+/// - `flags`：页面当前的页表项标志位
+///
+/// ## 返回值
+///
+/// 如果页帧已经被释放，返回true
+fn reclaim_anon_page(
+    space: &mut InnerAddressSpace,
+    page: &IsolatedPage,
+    flags: PageFlags<MMArch>,
+) -> bool {
+    if !zram_enabled() {
+        return false;
+    }
+
+    // 先取消映射并刷新所有cpu上的TLB，保证压缩期间页面的内容不会再被修改
+    let mut flusher = space.tlb_flusher();
+    let mapper = &mut space.user_mapper.utable;
+    let flush = match unsafe { mapper.unmap_phys(page.vaddr, false) } {
+        Some((_, _, flush)) => flush,
+        None => return false,
+    };
+    flusher.consume(flush);
+    drop(flusher);
+
+    let entry = match zram_store(page.paddr) {
+        Some(entry) => entry,
+        None => {
+            // 页面不适合被换出，恢复原来的映射
+            let flush = unsafe { mapper.map_phys(page.vaddr, page.paddr, flags) }
+                .expect("Failed to restore anonymous page mapping");
+            flush.flush();
+            return false;
+        }
+    };
+    if unsafe { mapper.set_swap_entry(page.vaddr, entry) }.is_none() {
+        zram_free(entry);
+        let flush = unsafe { mapper.map_phys(page.vaddr, page.paddr, flags) }
+            .expect("Failed to restore anonymous page mapping");
+        flush.flush();
+        return false;
+    }
+
+    PageMapCount::dec(page.paddr);
+    unsafe { deallocate_page_frames(PhysPageFrame::new(page.paddr), PageFrameCount::new(1)) };
+    space.rss.dec(RssMember::AnonPages);
+    space.rss.inc(RssMember::SwapEntries);
+    return true;
+}
+
+/// 扫描链表头部的最多`nr`个页面
+///
+/// ## 返回值
+///
+/// 返回被回收的页帧数量
+fn shrink_list(from: LruList, nr: usize) -> usize {
+    let pages = PAGE_LRU.lock().isolate(from, nr);
+    let inactive = from == LruList::Inactive;
+    let mut reclaimed = 0;
+    for page in pages.iter() {
+        let result = scan_page(page, inactive);
+        if result == ScanResult::Reclaimed {
+            reclaimed += 1;
+        }
+        PAGE_LRU.lock().putback(page, result);
+    }
+    return reclaimed;
+}
+
+/// 只在任务组`group`（包括它的后代）内回收最多`nr`个页面，见[`super::memcg`]
+///
+/// ## 返回值
+///
+/// 返回被回收的页帧数量
+pub fn lru_shrink_group(group: &TaskGroup, nr: usize) -> usize {
+    let nr_scan = nr * 4;
+    // 先把活跃链表中同样数量的页面移动到不活跃链表，使它们在下一次扫描时可以被回收
+    let pages = PAGE_LRU
+        .lock()
+        .isolate_group(LruList::Active, nr, nr_scan, group);
+    for page in pages.iter() {
+        let result = scan_page(page, false);
+        PAGE_LRU.lock().putback(page, result);
+    }
+
+    let pages = PAGE_LRU
+        .lock()
+        .isolate_group(LruList::Inactive, nr, nr_scan, group);
+    let mut reclaimed = 0;
+    for page in pages.iter() {
+        let result = scan_page(page, true);
+        if result == ScanResult::Reclaimed {
+            reclaimed += 1;
+        }
+        PAGE_LRU.lock().putback(page, result);
+    }
+    return reclaimed;
+}
+
+/// 匿名页LRU的shrinker
+#[derive(Debug)]
+pub struct AnonLruShrinker;
+
+impl Shrinker for AnonLruShrinker {
+    fn name(&self) -> &str {
+        return "anon_lru";
+    }
+
+    fn count_objects(&self) -> usize {
+        let (active, inactive) = lru_count();
+        return active + inactive;
+    }
+
+    fn scan_objects(&self, nr_to_scan: usize) -> usize {
+        // 保持不活跃链表不短于活跃链表
+        let (active, inactive) = lru_count();
+        if active > inactive {
+            shrink_list(
+                LruList::Active,
+                core::cmp::min(nr_to_scan, active - inactive),
+            );
+        }
+        return shrink_list(LruList::Inactive, nr_to_scan);
+    }
+}
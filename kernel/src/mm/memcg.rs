@@ -0,0 +1,151 @@
+//! 任务组的内存用量限制
+//!
+//! 缺页时新分配的匿名页在加入LRU（见[`super::lru::lru_add_anon`]）时，记账到当前进程所在的任务组
+//! 和它的所有祖先上，页面离开LRU（被释放、被回收）时撤销记账。因此任务组的内存用量是组内进程
+//! 拥有的匿名页的数量，不包括页缓存和内核内存。
+//!
+//! 缺页时，如果任务组或者它的某个祖先的用量已经达到限制，先只在这个组内回收页面（需要启用zram），
+//! 回收后仍然超出限制时，缺页失败并返回ENOMEM。等待回收的时间被记为任务组的内存压力。
+
+use core::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+
+use crate::{
+    arch::MMArch,
+    process::ProcessManager,
+    sched::{cgroup::TaskGroup, psi::PsiResource},
+    syscall::SystemError,
+    time::timer::clock,
+};
+
+use super::{lru::lru_shrink_group, MemoryManagementArch};
+
+/// 达到限制时，最多尝试回收的次数
+const MEMCG_RECLAIM_RETRIES: usize = 4;
+/// 每次至少扫描的页面数量
+const MEMCG_RECLAIM_BATCH: usize = 32;
+
+/// 一个任务组的内存用量（单位：页）
+#[derive(Debug)]
+pub struct MemCounter {
+    usage: AtomicUsize,
+    limit: AtomicUsize,
+    /// 用量的历史最大值
+    max_usage: AtomicUsize,
+    /// 由于达到限制而缺页失败的次数
+    failcnt: AtomicU64,
+}
+
+impl MemCounter {
+    pub const fn new() -> Self {
+        return Self {
+            usage: AtomicUsize::new(0),
+            limit: AtomicUsize::new(usize::MAX),
+            max_usage: AtomicUsize::new(0),
+            failcnt: AtomicU64::new(0),
+        };
+    }
+
+    #[inline(always)]
+    pub fn usage(&self) -> usize {
+        return self.usage.load(Ordering::Relaxed);
+    }
+
+    /// 限制，usize::MAX表示不限制
+    #[inline(always)]
+    pub fn limit(&self) -> usize {
+        return self.limit.load(Ordering::Relaxed);
+    }
+
+    pub fn max_usage(&self) -> usize {
+        return self.max_usage.load(Ordering::Relaxed);
+    }
+
+    pub fn failcnt(&self) -> u64 {
+        return self.failcnt.load(Ordering::Relaxed);
+    }
+
+    #[inline(always)]
+    fn over_limit(&self) -> bool {
+        return self.usage() >= self.limit();
+    }
+}
+
+/// 把一个页面记账到任务组和它的所有祖先上
+pub fn mem_cgroup_charge(group: &TaskGroup) {
+    for g in group.ancestors() {
+        let usage = g.mem.usage.fetch_add(1, Ordering::Relaxed) + 1;
+        g.mem.max_usage.fetch_max(usage, Ordering::Relaxed);
+    }
+}
+
+/// 撤销一个页面的记账
+pub fn mem_cgroup_uncharge(group: &TaskGroup) {
+    for g in group.ancestors() {
+        g.mem.usage.fetch_sub(1, Ordering::Relaxed);
+    }
+}
+
+/// 找到`group`和它的祖先中，离它最近的、用量已经达到限制的任务组
+fn mem_cgroup_over_limit(group: &TaskGroup) -> Option<&TaskGroup> {
+    return group.ancestors().find(|g| g.mem.over_limit());
+}
+
+/// 在`group`内回收页面，使它的用量低于`limit_pages`
+///
+/// 返回回收后的用量是否已经低于限制
+pub fn mem_cgroup_reclaim(group: &TaskGroup, limit_pages: usize) -> bool {
+    for _ in 0..MEMCG_RECLAIM_RETRIES {
+        let usage = group.mem.usage();
+        if usage < limit_pages {
+            return true;
+        }
+        lru_shrink_group(group, (usage + 1 - limit_pages).max(MEMCG_RECLAIM_BATCH));
+    }
+    return group.mem.usage() < limit_pages;
+}
+
+/// 设置任务组的内存用量限制（单位：字节，usize::MAX表示不限制）
+///
+/// 新的限制低于当前用量时，尽量回收组内的页面，但是不会失败
+pub fn mem_cgroup_set_limit(group: &TaskGroup, bytes: usize) {
+    let pages = if bytes == usize::MAX {
+        usize::MAX
+    } else {
+        bytes / MMArch::PAGE_SIZE
+    };
+    group.mem.limit.store(pages, Ordering::Relaxed);
+    if pages != usize::MAX {
+        mem_cgroup_reclaim(group, pages);
+    }
+}
+
+/// 缺页时，检查当前进程所在的任务组是否还可以分配新的页面
+///
+/// 请注意，调用者不能持有当前进程的地址空间的锁（回收组内的页面时需要获取它）
+pub fn mem_cgroup_try_charge() -> Result<(), SystemError> {
+    let group = ProcessManager::current_pcb()
+        .sched_info()
+        .task_group()
+        .clone();
+    if mem_cgroup_over_limit(&group).is_none() {
+        return Ok(());
+    }
+
+    let start = clock();
+    let mut over = mem_cgroup_over_limit(&group);
+    for _ in 0..MEMCG_RECLAIM_RETRIES {
+        let g = match over {
+            Some(g) => g,
+            None => break,
+        };
+        mem_cgroup_reclaim(g, g.mem.limit());
+        over = mem_cgroup_over_limit(&group);
+    }
+    group.psi_account(PsiResource::Memory, clock().saturating_sub(start));
+
+    if let Some(g) = over {
+        g.mem.failcnt.fetch_add(1, Ordering::Relaxed);
+        return Err(SystemError::ENOMEM);
+    }
+    return Ok(());
+}
@@ -1,4 +1,4 @@
-use crate::libs::spinlock::{SpinLock, SpinLockGuard};
+use crate::libs::spinlock::SpinLock;
 use crate::mm::kernel_mapper::KernelMapper;
 use crate::process::ProcessManager;
 use crate::syscall::SystemError;
@@ -8,10 +8,9 @@ use crate::{
     mm::{MMArch, MemoryManagementArch},
 };
 use crate::{kerror, kinfo, kwarn};
-use alloc::{collections::LinkedList, vec::Vec};
-use core::mem;
-use core::mem::MaybeUninit;
-use core::sync::atomic::{compiler_fence, AtomicBool, Ordering};
+use alloc::collections::BTreeSet;
+use core::cmp::min;
+use core::sync::atomic::{AtomicBool, Ordering};
 
 use super::page::PageFlags;
 use super::{PhysAddr, VirtAddr};
@@ -34,6 +33,8 @@ pub fn mmio_pool() -> &'static MmioBuddyMemPool {
     unsafe { __MMIO_POOL.as_ref().unwrap() }
 }
 
+#[allow(dead_code)]
+#[derive(Debug)]
 pub enum MmioResult {
     SUCCESS,
     EINVAL,
@@ -43,30 +44,25 @@ pub enum MmioResult {
 }
 
 /// @brief buddy内存池
+///
+/// 每一阶的空闲块按照地址保存在有序集合中：查找和删除伙伴块只需要O(log n)的时间，
+/// 释放时会立即与空闲的伙伴块合并，分配时总是取地址最低的空闲块，使得空闲空间尽量连续。
+/// 所有的阶共用一把锁，一次分配或释放只需要加锁一次。
 #[derive(Debug)]
 pub struct MmioBuddyMemPool {
     pool_start_addr: VirtAddr,
     pool_size: usize,
-    free_regions: [SpinLock<MmioFreeRegionList>; MMIO_BUDDY_REGION_COUNT as usize],
+    free_regions: SpinLock<[BTreeSet<VirtAddr>; MMIO_BUDDY_REGION_COUNT as usize]>,
 }
 
 impl MmioBuddyMemPool {
     fn new() -> Self {
-        let mut free_regions: [MaybeUninit<SpinLock<MmioFreeRegionList>>;
-            MMIO_BUDDY_REGION_COUNT as usize] = unsafe { MaybeUninit::uninit().assume_init() };
-        for i in 0..MMIO_BUDDY_REGION_COUNT {
-            free_regions[i as usize] = MaybeUninit::new(SpinLock::new(MmioFreeRegionList::new()));
-        }
-        let free_regions = unsafe {
-            mem::transmute::<_, [SpinLock<MmioFreeRegionList>; MMIO_BUDDY_REGION_COUNT as usize]>(
-                free_regions,
-            )
-        };
-
         let pool = MmioBuddyMemPool {
             pool_start_addr: MMIO_BASE,
             pool_size: MMIO_TOP - MMIO_BASE,
-            free_regions,
+            free_regions: SpinLock::new(
+                [(); MMIO_BUDDY_REGION_COUNT as usize].map(|_| BTreeSet::new()),
+            ),
         };
         kdebug!("MMIO buddy pool init: created");
 
@@ -74,7 +70,6 @@ impl MmioBuddyMemPool {
         let mut vaddr_base = MMIO_BASE;
         kdebug!("total 1G blocks: {cnt_1g_blocks}");
         for _i in 0..cnt_1g_blocks {
-            compiler_fence(Ordering::SeqCst);
             match pool.give_back_block(vaddr_base, PAGE_1G_SHIFT) {
                 Ok(_) => {
                     vaddr_base += PAGE_1G_SIZE;
@@ -88,237 +83,67 @@ impl MmioBuddyMemPool {
         return pool;
     }
 
-    /// @brief 创建新的地址区域结构体
-    ///
-    /// @param vaddr 虚拟地址
-    ///
-    /// @return 创建好的地址区域结构体
-    fn create_region(&self, vaddr: VirtAddr) -> MmioBuddyAddrRegion {
-        // kdebug!("create_region for vaddr: {vaddr:?}");
-
-        let region: MmioBuddyAddrRegion = MmioBuddyAddrRegion::new(vaddr);
-
-        // kdebug!("create_region for vaddr: {vaddr:?} OK!!!");
-        return region;
-    }
-
-    /// @brief 将内存块归还给buddy
+    /// @brief 将内存块归还给buddy，并与空闲的伙伴块合并
     ///
     /// @param vaddr 虚拟地址
     ///
     /// @param exp 内存空间的大小（2^exp）
     ///
-    /// @param list_guard 【exp】对应的链表
-    ///
     /// @return Ok(i32) 返回0
     ///
     /// @return Err(SystemError) 返回错误码
     fn give_back_block(&self, vaddr: VirtAddr, exp: u32) -> Result<i32, SystemError> {
+        if exp < MMIO_BUDDY_MIN_EXP || exp > MMIO_BUDDY_MAX_EXP {
+            return Err(SystemError::EINVAL);
+        }
         // 确保内存对齐，低位都要为0
         if (vaddr.data() & ((1 << exp) - 1)) != 0 {
             return Err(SystemError::EINVAL);
         }
-        let region: MmioBuddyAddrRegion = self.create_region(vaddr);
-        // 加入buddy
-        let mut list_guard = self.free_regions[exp2index(exp)].lock();
 
-        self.push_block(region, &mut list_guard);
+        let mut free_regions = self.free_regions.lock();
+        let mut vaddr = vaddr;
+        let mut exp = exp;
+        while exp < MMIO_BUDDY_MAX_EXP {
+            let buddy = self.calculate_block_vaddr(vaddr, exp);
+            if !free_regions[exp2index(exp)].remove(&buddy) {
+                break;
+            }
+            vaddr = min(vaddr, buddy);
+            exp += 1;
+        }
+        free_regions[exp2index(exp)].insert(vaddr);
         return Ok(0);
     }
 
-    /// @brief 将给定大小为2^{exp}的内存块一分为二，并插入内存块大小为2^{exp-1}的链表中
-    ///
-    /// @param region 要被分割的地址区域结构体（保证其已经从链表中取出）
-    ///
-    /// @param exp 要被分割的地址区域的大小的幂
-    ///
-    /// @param list_guard 【exp-1】对应的链表
-    fn split_block(
-        &self,
-        region: MmioBuddyAddrRegion,
-        exp: u32,
-        low_list_guard: &mut SpinLockGuard<MmioFreeRegionList>,
-    ) {
-        let vaddr = self.calculate_block_vaddr(region.vaddr, exp - 1);
-        let new_region: MmioBuddyAddrRegion = self.create_region(vaddr);
-        self.push_block(region, low_list_guard);
-        self.push_block(new_region, low_list_guard);
-    }
-
     /// @brief 从buddy中申请一块指定大小的内存区域
     ///
-    /// @param exp 要申请的内存块的大小的幂(2^exp)
+    /// 如果没有恰好符合要求的内存块，则把最小的、足够大的内存块逐级分裂
     ///
-    /// @param list_guard exp对应的链表
+    /// @param exp 要申请的内存块的大小的幂(2^exp)
     ///
-    /// @return Ok(MmioBuddyAddrRegion) 符合要求的内存区域。
+    /// @return Ok(VirtAddr) 符合要求的内存区域的起始地址。
     ///
     /// @return Err(MmioResult)
     /// - 没有满足要求的内存块时，返回ENOFOUND
     /// - 申请的内存块大小超过合法范围，返回WRONGEXP
-    /// - 调用函数出错时，返回出错函数对应错误码
-    fn query_addr_region(
-        &self,
-        exp: u32,
-        list_guard: &mut SpinLockGuard<MmioFreeRegionList>,
-    ) -> Result<MmioBuddyAddrRegion, MmioResult> {
+    fn query_addr_region(&self, exp: u32) -> Result<VirtAddr, MmioResult> {
         // 申请范围错误
         if exp < MMIO_BUDDY_MIN_EXP || exp > MMIO_BUDDY_MAX_EXP {
             kdebug!("query_addr_region: exp wrong");
             return Err(MmioResult::WRONGEXP);
         }
-        // 没有恰好符合要求的内存块
-        // 注意：exp对应的链表list_guard已上锁【注意避免死锁问题】
-        if list_guard.num_free == 0 {
-            // 找到最小符合申请范围的内存块
-            // 将大的内存块依次分成小块内存，直到能够满足exp大小，即将exp+1分成两块exp
-            for e in exp + 1..MMIO_BUDDY_MAX_EXP + 1 {
-                let pop_list: &mut SpinLockGuard<MmioFreeRegionList> =
-                    &mut self.free_regions[exp2index(e) as usize].lock();
-                if pop_list.num_free == 0 {
-                    continue;
-                }
 
-                for e2 in (exp + 1..e + 1).rev() {
-                    if e2 == e {
-                        match self.pop_block(pop_list) {
-                            Ok(region) => {
-                                if e2 != exp + 1 {
-                                    // 要将分裂后的内存块插入到更小的链表中
-                                    let low_list_guard: &mut SpinLockGuard<MmioFreeRegionList> =
-                                        &mut self.free_regions[exp2index(e2 - 1) as usize].lock();
-                                    self.split_block(region, e2, low_list_guard);
-                                } else {
-                                    // 由于exp对应的链表list_guard已经被锁住了 不能再加锁
-                                    // 所以直接将list_guard传入
-                                    self.split_block(region, e2, list_guard);
-                                }
-                            }
-                            Err(err) => {
-                                kdebug!("buddy_pop_region get wrong");
-                                return Err(err);
-                            }
-                        }
-                    } else {
-                        match self.pop_block(&mut self.free_regions[exp2index(e2) as usize].lock())
-                        {
-                            Ok(region) => {
-                                if e2 != exp + 1 {
-                                    // 要将分裂后的内存块插入到更小的链表中
-                                    let low_list_guard: &mut SpinLockGuard<MmioFreeRegionList> =
-                                        &mut self.free_regions[exp2index(e2 - 1) as usize].lock();
-                                    self.split_block(region, e2, low_list_guard);
-                                } else {
-                                    // 由于exp对应的链表list_guard已经被锁住了 不能再加锁
-                                    // 所以直接将list_guard传入
-                                    self.split_block(region, e2, list_guard);
-                                }
-                            }
-                            Err(err) => {
-                                kdebug!("buddy_pop_region get wrong");
-                                return Err(err);
-                            }
-                        }
-                    }
-                }
-                break;
-            }
-            // 判断是否获得了exp大小的内存块
-            if list_guard.num_free > 0 {
-                match self.pop_block(list_guard) {
-                    Ok(ret) => return Ok(ret),
-                    Err(err) => return Err(err),
-                }
-            }
-            // 拆分大内存块无法获得exp大小内存块
-            // 尝试用小内存块合成
-            // 即将两块exp合成一块exp+1
-
-            // TODO：修改下一个循环的冗余代码，请不要删除此处的注释
-            // let merge = |high_list_guard: &mut SpinLockGuard<MmioFreeRegionList>, exp: u32| {
-            //     if let Err(err) = self.merge_all_exp(
-            //         exp,
-            //         &mut self.free_regions[exp2index(exp) as usize].lock(),
-            //         high_list_guard,
-            //     ) {
-            //         return err;
-            //     } else {
-            //         return MmioResult::SUCCESS;
-            //     }
-            // };
-            for e in MMIO_BUDDY_MIN_EXP..exp {
-                if e != exp - 1 {
-                    match self.merge_all_exp(
-                        exp,
-                        &mut self.free_regions[exp2index(exp) as usize].lock(),
-                        &mut self.free_regions[exp2index(exp + 1)].lock(),
-                    ) {
-                        Ok(_) => continue,
-                        Err(err) => {
-                            kdebug!("merge_all_exp get wrong");
-                            return Err(err);
-                        }
-                    }
-                } else {
-                    match self.merge_all_exp(
-                        exp,
-                        &mut self.free_regions[exp2index(exp) as usize].lock(),
-                        list_guard,
-                    ) {
-                        Ok(_) => continue,
-                        Err(err) => {
-                            kdebug!("merge_all_exp get wrong");
-                            return Err(err);
-                        }
-                    }
-                }
-            }
-
-            //判断是否获得了exp大小的内存块
-            if list_guard.num_free > 0 {
-                match self.pop_block(list_guard) {
-                    Ok(ret) => return Ok(ret),
-                    Err(err) => return Err(err),
-                }
-            }
-            return Err(MmioResult::ENOFOUND);
-        } else {
-            match self.pop_block(list_guard) {
-                Ok(ret) => return Ok(ret),
-                Err(err) => return Err(err),
-            }
+        let mut free_regions = self.free_regions.lock();
+        let e = (exp..=MMIO_BUDDY_MAX_EXP)
+            .find(|e| !free_regions[exp2index(*e)].is_empty())
+            .ok_or(MmioResult::ENOFOUND)?;
+        let vaddr = free_regions[exp2index(e)].pop_first().unwrap();
+        // 把分裂出来的后一半放入低一阶的空闲集合
+        for e2 in (exp..e).rev() {
+            free_regions[exp2index(e2)].insert(vaddr + (1 << e2));
         }
-    }
-
-    /// @brief 对query_addr_region进行封装
-    ///
-    /// @param exp 内存区域的大小(2^exp)
-    ///
-    /// @return Ok(MmioBuddyAddrRegion)符合要求的内存块信息结构体。
-    /// @return Err(MmioResult) 没有满足要求的内存块时，返回__query_addr_region的错误码。
-    fn mmio_buddy_query_addr_region(&self, exp: u32) -> Result<MmioBuddyAddrRegion, MmioResult> {
-        let list_guard: &mut SpinLockGuard<MmioFreeRegionList> =
-            &mut self.free_regions[exp2index(exp)].lock();
-        match self.query_addr_region(exp, list_guard) {
-            Ok(ret) => return Ok(ret),
-            Err(err) => {
-                kdebug!("mmio_buddy_query_addr_region failed");
-                return Err(err);
-            }
-        }
-    }
-    /// @brief 往指定的地址空间链表中添加一个地址区域
-    ///
-    /// @param region 要被添加的地址结构体
-    ///
-    /// @param list_guard 目标链表
-    fn push_block(
-        &self,
-        region: MmioBuddyAddrRegion,
-        list_guard: &mut SpinLockGuard<MmioFreeRegionList>,
-    ) {
-        list_guard.list.push_back(region);
-        list_guard.num_free += 1;
+        return Ok(vaddr);
     }
 
     /// @brief 根据地址和内存块大小，计算伙伴块虚拟内存的地址
@@ -327,141 +152,6 @@ impl MmioBuddyMemPool {
         return VirtAddr::new(vaddr.data() ^ (1 << exp as usize));
     }
 
-    /// @brief 寻找并弹出指定内存块的伙伴块
-    ///
-    /// @param region 对应内存块的信息
-    ///
-    /// @param exp 内存块大小
-    ///
-    /// @param list_guard 【exp】对应的链表
-    ///
-    /// @return Ok(Box<MmioBuddyAddrRegion) 返回伙伴块的引用
-    /// @return Err(MmioResult)
-    /// - 当链表为空，返回ISEMPTY
-    /// - 没有找到伙伴块，返回ENOFOUND
-    fn pop_buddy_block(
-        &self,
-        vaddr: VirtAddr,
-        exp: u32,
-        list_guard: &mut SpinLockGuard<MmioFreeRegionList>,
-    ) -> Result<MmioBuddyAddrRegion, MmioResult> {
-        if list_guard.list.len() == 0 {
-            return Err(MmioResult::ISEMPTY);
-        } else {
-            //计算伙伴块的地址
-            let buddy_vaddr = self.calculate_block_vaddr(vaddr, exp);
-
-            // element 只会有一个元素
-            let mut element: Vec<MmioBuddyAddrRegion> = list_guard
-                .list
-                .drain_filter(|x| x.vaddr == buddy_vaddr)
-                .collect();
-            if element.len() == 1 {
-                list_guard.num_free -= 1;
-                return Ok(element.pop().unwrap());
-            }
-
-            //没有找到对应的伙伴块
-            return Err(MmioResult::ENOFOUND);
-        }
-    }
-
-    /// @brief 从指定空闲链表中取出内存区域
-    ///
-    /// @param list_guard 【exp】对应的链表
-    ///
-    /// @return Ok(MmioBuddyAddrRegion) 内存块信息结构体的引用。
-    ///
-    /// @return Err(MmioResult) 当链表为空，无法删除时，返回ISEMPTY
-    fn pop_block(
-        &self,
-        list_guard: &mut SpinLockGuard<MmioFreeRegionList>,
-    ) -> Result<MmioBuddyAddrRegion, MmioResult> {
-        if !list_guard.list.is_empty() {
-            list_guard.num_free -= 1;
-            return Ok(list_guard.list.pop_back().unwrap());
-        }
-        return Err(MmioResult::ISEMPTY);
-    }
-
-    /// @brief 合并所有2^{exp}大小的内存块
-    ///
-    /// @param exp 内存块大小的幂(2^exp)
-    ///
-    /// @param list_guard exp对应的链表
-    ///
-    /// @param high_list_guard exp+1对应的链表
-    ///
-    /// @return Ok(MmioResult) 合并成功返回SUCCESS
-    /// @return Err(MmioResult)
-    /// - 内存块过少，无法合并，返回EINVAL
-    /// - pop_buddy_block调用出错，返回其错误码
-    /// - merge_blocks调用出错，返回其错误码
-    fn merge_all_exp(
-        &self,
-        exp: u32,
-        list_guard: &mut SpinLockGuard<MmioFreeRegionList>,
-        high_list_guard: &mut SpinLockGuard<MmioFreeRegionList>,
-    ) -> Result<MmioResult, MmioResult> {
-        // 至少要两个内存块才能合并
-        if list_guard.num_free <= 1 {
-            return Err(MmioResult::EINVAL);
-        }
-        loop {
-            if list_guard.num_free <= 1 {
-                break;
-            }
-            // 获取内存块
-            let vaddr: VirtAddr = list_guard.list.back().unwrap().vaddr;
-            // 获取伙伴内存块
-            match self.pop_buddy_block(vaddr, exp, list_guard) {
-                Err(err) => {
-                    return Err(err);
-                }
-                Ok(buddy_region) => {
-                    let region: MmioBuddyAddrRegion = list_guard.list.pop_back().unwrap();
-                    let copy_region = region.clone();
-                    // 在两块内存都被取出之后才进行合并
-                    match self.merge_blocks(region, buddy_region, exp, high_list_guard) {
-                        Err(err) => {
-                            // 如果合并失败了要将取出来的元素放回去
-                            self.push_block(copy_region, list_guard);
-                            kdebug!("merge_all_exp: merge_blocks failed");
-                            return Err(err);
-                        }
-                        Ok(_) => continue,
-                    }
-                }
-            }
-        }
-        return Ok(MmioResult::SUCCESS);
-    }
-
-    /// @brief 合并两个【已经从链表中取出】的内存块
-    ///
-    /// @param region_1 第一个内存块
-    ///
-    /// @param region_2 第二个内存
-    ///
-    /// @return Ok(MmioResult) 成功返回SUCCESS
-    ///
-    /// @return Err(MmioResult) 两个内存块不是伙伴块,返回EINVAL
-    fn merge_blocks(
-        &self,
-        region_1: MmioBuddyAddrRegion,
-        region_2: MmioBuddyAddrRegion,
-        exp: u32,
-        high_list_guard: &mut SpinLockGuard<MmioFreeRegionList>,
-    ) -> Result<MmioResult, MmioResult> {
-        // 判断是否为伙伴块
-        if region_1.vaddr != self.calculate_block_vaddr(region_2.vaddr, exp) {
-            return Err(MmioResult::EINVAL);
-        }
-        // 将大的块放进下一级链表
-        self.push_block(region_1, high_list_guard);
-        return Ok(MmioResult::SUCCESS);
-    }
-
     /// @brief 创建一块mmio区域，并将vma绑定到initial_mm
     ///
     /// @param size mmio区域的大小（字节）
@@ -495,10 +185,9 @@ impl MmioBuddyMemPool {
             size_exp += 1;
             new_size = 1 << size_exp;
         }
-        match self.mmio_buddy_query_addr_region(size_exp) {
-            Ok(region) => {
-                let space_guard =
-                    unsafe { MMIOSpaceGuard::from_raw(region.vaddr, new_size, false) };
+        match self.query_addr_region(size_exp) {
+            Ok(vaddr) => {
+                let space_guard = unsafe { MMIOSpaceGuard::from_raw(vaddr, new_size, false) };
                 return Ok(space_guard);
             }
             Err(_) => {
@@ -531,30 +220,29 @@ impl MmioBuddyMemPool {
         // todo: 重构MMIO管理机制，创建类似全局的manager之类的，管理MMIO的空间？
 
         // 暂时认为传入的vaddr都是正确的
-        let page_count = length / MMArch::PAGE_SIZE;
         // 取消映射
         let mut bindings = KernelMapper::lock();
-        let mut kernel_mapper = bindings.as_mut();
-        if kernel_mapper.is_none() {
-            kwarn!("release_mmio: kernel_mapper is read only");
-            return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
-        }
+        let kernel_mapper = match bindings.as_mut() {
+            Some(mapper) => mapper,
+            None => {
+                kwarn!("release_mmio: kernel_mapper is read only");
+                return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
+            }
+        };
 
-        for i in 0..page_count {
-            unsafe {
-                let x: Option<(
-                    PhysAddr,
-                    PageFlags<MMArch>,
-                    crate::mm::page::PageFlush<MMArch>,
-                )> = kernel_mapper
-                    .as_mut()
-                    .unwrap()
-                    .unmap_phys(vaddr + i * MMArch::PAGE_SIZE, false);
-                if let Some((_, _, flush)) = x {
+        // 使用大页映射的部分，整个大页一次取消映射，不需要先拆分成小页
+        let end = vaddr + length;
+        let mut addr = vaddr;
+        while addr < end {
+            match unsafe { kernel_mapper.unmap_phys_block(addr) } {
+                Some((size, flush)) => {
                     flush.flush();
+                    addr += size;
                 }
-            };
+                None => addr += MMArch::PAGE_SIZE,
+            }
         }
+        drop(bindings);
 
         // 归还到buddy
         mmio_pool()
@@ -567,47 +255,6 @@ impl MmioBuddyMemPool {
     }
 }
 
-/// @brief mmio伙伴系统内部的地址区域结构体
-#[derive(Debug, Clone)]
-struct MmioBuddyAddrRegion {
-    vaddr: VirtAddr,
-}
-impl MmioBuddyAddrRegion {
-    pub fn new(vaddr: VirtAddr) -> Self {
-        return MmioBuddyAddrRegion { vaddr };
-    }
-
-    #[allow(dead_code)]
-    pub fn vaddr(&self) -> VirtAddr {
-        return self.vaddr;
-    }
-}
-
-/// @brief 空闲页数组结构体
-#[derive(Debug)]
-pub struct MmioFreeRegionList {
-    /// 存储mmio_buddy的地址链表
-    list: LinkedList<MmioBuddyAddrRegion>,
-    /// 空闲块的数量
-    num_free: i64,
-}
-impl MmioFreeRegionList {
-    #[allow(dead_code)]
-    fn new() -> Self {
-        return MmioFreeRegionList {
-            ..Default::default()
-        };
-    }
-}
-impl Default for MmioFreeRegionList {
-    fn default() -> Self {
-        MmioFreeRegionList {
-            list: Default::default(),
-            num_free: 0,
-        }
-    }
-}
-
 /// @brief 将内存对象大小的幂转换成内存池中的数组的下标
 ///
 /// @param exp内存大小
@@ -615,7 +262,7 @@ impl Default for MmioFreeRegionList {
 /// @return 内存池数组下标
 #[inline(always)]
 fn exp2index(exp: u32) -> usize {
-    return (exp - 12) as usize;
+    return (exp - MMIO_BUDDY_MIN_EXP) as usize;
 }
 
 #[derive(Debug)]
@@ -665,6 +312,28 @@ impl MMIOSpaceGuard {
     /// 传入的物理地址【一定要是设备的物理地址】。
     /// 如果物理地址是从内存分配器中分配的，那么会造成内存泄露。因为mmio_release的时候，只取消映射，不会释放内存。
     pub unsafe fn map_phys(&self, paddr: PhysAddr, length: usize) -> Result<(), SystemError> {
+        return self.map_phys_with_flags(paddr, length, PageFlags::mmio_flags());
+    }
+
+    /// 以写合并的方式将物理地址填写到虚拟地址空间中
+    ///
+    /// 用于帧缓冲区、预取的BAR等只写或者顺序写入的设备内存。写入之间没有顺序保证，
+    /// 需要保证顺序时（例如写入数据之后再通知设备），必须先执行写屏障
+    ///
+    /// ## Safety
+    ///
+    /// 同[`MMIOSpaceGuard::map_phys`]
+    #[allow(dead_code)]
+    pub unsafe fn map_phys_wc(&self, paddr: PhysAddr, length: usize) -> Result<(), SystemError> {
+        return self.map_phys_with_flags(paddr, length, PageFlags::wc_flags());
+    }
+
+    unsafe fn map_phys_with_flags(
+        &self,
+        paddr: PhysAddr,
+        length: usize,
+        flags: PageFlags<MMArch>,
+    ) -> Result<(), SystemError> {
         if length > self.size {
             return Err(SystemError::EINVAL);
         }
@@ -676,7 +345,6 @@ impl MMIOSpaceGuard {
             return Err(SystemError::EINVAL);
         }
 
-        let flags = PageFlags::mmio_flags();
         let mut kernel_mapper = KernelMapper::lock();
         let r = kernel_mapper.map_phys_with_size(self.vaddr, paddr, length, flags, true);
         return r;
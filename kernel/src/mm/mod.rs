@@ -19,13 +19,24 @@ use self::{
 
 pub mod allocator;
 pub mod c_adapter;
+pub mod compaction;
+pub mod fault;
 pub mod kernel_mapper;
+pub mod lru;
+pub mod memcg;
 pub mod mmio_buddy;
 pub mod no_init;
+pub mod numa;
 pub mod page;
 pub mod percpu;
+pub mod pin;
+pub mod reclaim;
+pub mod rss;
 pub mod syscall;
+pub mod task_mmu;
+pub mod tlb;
 pub mod ucontext;
+pub mod zram;
 
 /// 内核INIT进程的用户地址空间结构体（仅在process_init中初始化）
 static mut __INITIAL_PROCESS_ADDRESS_SPACE: Option<Arc<AddressSpace>> = None;
@@ -382,10 +393,21 @@ pub trait MemoryManagementArch: Clone + Copy + Debug {
     const ENTRY_FLAG_WRITE_THROUGH: usize;
     /// 页面项标记页面为cache disable的值
     const ENTRY_FLAG_CACHE_DISABLE: usize;
+    /// 页面项标记页面为write combining（写合并）的值
+    const ENTRY_FLAG_WRITE_COMBINING: usize;
     /// 标记当前页面不可执行的标志位（Execute disable）（也就是说，不能从这段内存里面获取处理器指令）
     const ENTRY_FLAG_NO_EXEC: usize;
     /// 标记当前页面可执行的标志位（Execute enable）
     const ENTRY_FLAG_EXEC: usize;
+    /// 标记页表项直接映射一个大页（而不是指向下一级页表）的标志位。仅在非最后一级页表中有效
+    const ENTRY_FLAG_HUGE_PAGE: usize;
+    /// 页面被访问过之后，由硬件置位的标志位
+    const ENTRY_FLAG_ACCESSED: usize;
+    /// 页面被写入过之后，由硬件置位的标志位
+    const ENTRY_FLAG_DIRTY: usize;
+    /// 标记一个不存在（present位为0）的页表项记录的是交换条目的标志位。
+    /// 请注意，这个标志位只对present位为0的页表项有意义
+    const ENTRY_FLAG_SWAP: usize;
 
     /// 虚拟地址与物理地址的偏移量
     const PHYS_OFFSET: usize;
@@ -449,7 +471,7 @@ pub trait MemoryManagementArch: Clone + Copy + Debug {
     /// @brief 刷新TLB中，关于指定虚拟地址的条目
     unsafe fn invalidate_page(address: VirtAddr);
 
-    /// @brief 刷新TLB中，所有的条目
+    /// @brief 刷新TLB中，当前地址空间的所有条目
     unsafe fn invalidate_all();
 
     /// @brief 获取顶级页表的物理地址
@@ -56,6 +56,21 @@ impl<MMA: MemoryManagementArch> FrameAllocator for PseudoAllocator<MMA> {
 ///
 /// 并且，内核引导文件必须以4K页为粒度，填写了前100M的内存映射关系。（具体以本文件开头的注释为准）
 pub unsafe fn pseudo_map_phys(vaddr: VirtAddr, paddr: PhysAddr, count: PageFrameCount) {
+    let flags: PageFlags<MMArch> = PageFlags::new().set_write(true).set_execute(true);
+    pseudo_map_phys_with_flags(vaddr, paddr, count, flags);
+}
+
+/// Use pseudo mapper to map physical memory to virtual memory, with the given page flags.
+///
+/// ## Safety
+///
+/// 同[`pseudo_map_phys`]
+pub unsafe fn pseudo_map_phys_with_flags(
+    vaddr: VirtAddr,
+    paddr: PhysAddr,
+    count: PageFrameCount,
+    flags: PageFlags<MMArch>,
+) {
     assert!(vaddr.check_aligned(MMArch::PAGE_SIZE));
     assert!(paddr.check_aligned(MMArch::PAGE_SIZE));
 
@@ -67,8 +82,6 @@ pub unsafe fn pseudo_map_phys(vaddr: VirtAddr, paddr: PhysAddr, count: PageFrame
         &mut pseudo_allocator,
     );
 
-    let flags: PageFlags<MMArch> = PageFlags::new().set_write(true).set_execute(true);
-
     for i in 0..count.data() {
         let vaddr = vaddr + i * MMArch::PAGE_SIZE;
         let paddr = paddr + i * MMArch::PAGE_SIZE;
@@ -0,0 +1,240 @@
+//! NUMA拓扑
+//!
+//! 启动时由架构相关的代码（x86_64上解析ACPI的SRAT/SLIT表）调用[`numa_register`]注册：
+//!
+//! - 每个节点包含的物理内存范围。buddy按照节点划分空闲链表，分配时优先使用当前cpu所在节点的内存，
+//!   不够时按照节点距离由近到远回退（见[`super::allocator::buddy`]）
+//! - 每个cpu所在的节点。负载均衡优先在同一个节点内迁移进程（见[`crate::sched::balance`]）
+//! - 节点之间的距离（SLIT的相对访问延迟，本地节点为10）
+//!
+//! 没有注册时（没有SRAT表，或者只有一个节点），所有的内存和cpu都属于节点0，以下的查询都只需要很少的开销。
+//! 拓扑只在启动时注册一次，之后只读，因此查询不需要加锁。
+
+use core::sync::atomic::{AtomicU8, AtomicUsize, Ordering};
+
+use alloc::vec::Vec;
+
+use crate::{
+    arch::mm::LockedFrameAllocator,
+    kinfo, kwarn,
+    libs::align::{page_align_down, page_align_up},
+    mm::percpu::PerCpu,
+    smp::core::smp_get_processor_id,
+};
+
+use super::PhysAddr;
+
+/// 支持的最大节点数量
+pub const MAX_NUMNODES: usize = 8;
+/// 最多记录的节点内存范围的数量
+const MAX_NODE_MEMBLKS: usize = 32;
+/// 本地节点的距离
+pub const LOCAL_DISTANCE: u8 = 10;
+/// 没有SLIT表时，远端节点的距离
+pub const REMOTE_DISTANCE: u8 = 20;
+
+/// 一段属于某个节点的物理内存
+#[derive(Debug)]
+struct NodeMemblk {
+    start: AtomicUsize,
+    end: AtomicUsize,
+    node: AtomicUsize,
+}
+
+/// 节点的数量
+static NR_NODES: AtomicUsize = AtomicUsize::new(1);
+/// 每个cpu所在的节点
+static CPU_TO_NODE: [AtomicU8; PerCpu::MAX_CPU_NUM] =
+    [const { AtomicU8::new(0) }; PerCpu::MAX_CPU_NUM];
+/// 节点之间的距离，为0表示使用默认值
+static NODE_DISTANCE: [[AtomicU8; MAX_NUMNODES]; MAX_NUMNODES] =
+    [const { [const { AtomicU8::new(0) }; MAX_NUMNODES] }; MAX_NUMNODES];
+/// 每个节点的回退顺序：按照距离由近到远排列的节点（第一个是它自己）
+static NODE_FALLBACK: [[AtomicU8; MAX_NUMNODES]; MAX_NUMNODES] =
+    [const { [const { AtomicU8::new(0) }; MAX_NUMNODES] }; MAX_NUMNODES];
+/// 节点的内存范围（按照起始地址排序）
+static NODE_MEMBLKS: [NodeMemblk; MAX_NODE_MEMBLKS] = [const {
+    NodeMemblk {
+        start: AtomicUsize::new(0),
+        end: AtomicUsize::new(0),
+        node: AtomicUsize::new(0),
+    }
+}; MAX_NODE_MEMBLKS];
+static NR_NODE_MEMBLKS: AtomicUsize = AtomicUsize::new(0);
+
+/// 固件描述的NUMA拓扑
+#[derive(Debug, Default)]
+pub struct NumaTopology {
+    /// 节点的数量（节点号为0..nr_nodes）
+    pub nr_nodes: usize,
+    /// (起始地址, 结束地址, 节点)
+    pub memblks: Vec<(PhysAddr, PhysAddr, usize)>,
+    /// (cpu, 节点)
+    pub cpus: Vec<(usize, usize)>,
+    /// nr_nodes*nr_nodes的距离矩阵，为空表示使用默认的距离
+    pub distance: Vec<u8>,
+}
+
+/// 节点的数量
+#[inline(always)]
+pub fn nr_nodes() -> usize {
+    return NR_NODES.load(Ordering::Relaxed);
+}
+
+/// cpu所在的节点
+#[inline(always)]
+pub fn cpu_to_node(cpu: usize) -> usize {
+    return CPU_TO_NODE[cpu].load(Ordering::Relaxed) as usize;
+}
+
+/// 当前cpu所在的节点
+#[inline(always)]
+pub fn numa_node_id() -> usize {
+    if nr_nodes() == 1 {
+        return 0;
+    }
+    return cpu_to_node(smp_get_processor_id() as usize);
+}
+
+/// 物理地址所在的节点。不属于任何节点的地址视为节点0
+#[inline]
+pub fn paddr_to_node(paddr: PhysAddr) -> usize {
+    let nr = NR_NODE_MEMBLKS.load(Ordering::Acquire);
+    for blk in NODE_MEMBLKS[..nr].iter() {
+        if paddr.data() < blk.start.load(Ordering::Relaxed) {
+            break;
+        }
+        if paddr.data() < blk.end.load(Ordering::Relaxed) {
+            return blk.node.load(Ordering::Relaxed);
+        }
+    }
+    return 0;
+}
+
+/// 如果[start, end)中的内存都属于同一个节点，返回这个节点
+pub fn paddr_range_node(start: PhysAddr, end: PhysAddr) -> Option<usize> {
+    let node = paddr_to_node(start);
+    let nr = NR_NODE_MEMBLKS.load(Ordering::Acquire);
+    let mut covered = 0;
+    for blk in NODE_MEMBLKS[..nr].iter() {
+        let s = blk.start.load(Ordering::Relaxed).max(start.data());
+        let e = blk.end.load(Ordering::Relaxed).min(end.data());
+        if s >= e {
+            continue;
+        }
+        if blk.node.load(Ordering::Relaxed) != node {
+            return None;
+        }
+        covered += e - s;
+    }
+    // 不属于任何节点的空洞视为节点0
+    if node != 0 && covered != end.data() - start.data() {
+        return None;
+    }
+    return Some(node);
+}
+
+/// 节点之间的距离
+pub fn node_distance(from: usize, to: usize) -> u8 {
+    let d = NODE_DISTANCE[from][to].load(Ordering::Relaxed);
+    if d != 0 {
+        return d;
+    }
+    return if from == to {
+        LOCAL_DISTANCE
+    } else {
+        REMOTE_DISTANCE
+    };
+}
+
+/// `node`的回退顺序中的第`i`个节点（`i`小于[`nr_nodes`]，第0个是`node`自己）
+#[inline(always)]
+pub fn node_fallback(node: usize, i: usize) -> usize {
+    if nr_nodes() == 1 {
+        return 0;
+    }
+    return NODE_FALLBACK[node][i].load(Ordering::Relaxed) as usize;
+}
+
+/// 注册NUMA拓扑（只能在启动时调用一次，此时其他cpu还没有启动）
+///
+/// 只有一个节点时不做任何事情
+pub fn numa_register(topo: &NumaTopology) {
+    if topo.nr_nodes <= 1 || topo.memblks.is_empty() {
+        return;
+    }
+    if topo.nr_nodes > MAX_NUMNODES {
+        kwarn!(
+            "numa: {} nodes found, only {} are supported, NUMA disabled",
+            topo.nr_nodes,
+            MAX_NUMNODES
+        );
+        return;
+    }
+    let nr = topo.nr_nodes;
+
+    for (cpu, node) in topo.cpus.iter() {
+        if *cpu < PerCpu::MAX_CPU_NUM && *node < nr {
+            CPU_TO_NODE[*cpu].store(*node as u8, Ordering::Relaxed);
+        }
+    }
+    if topo.distance.len() == nr * nr {
+        for from in 0..nr {
+            for to in 0..nr {
+                NODE_DISTANCE[from][to].store(topo.distance[from * nr + to], Ordering::Relaxed);
+            }
+        }
+    }
+    for node in 0..nr {
+        let mut order: Vec<usize> = (0..nr).collect();
+        // 稳定排序：距离相同的节点按照节点号排列，并且自己总是第一个
+        order.sort_by_key(|n| (*n != node, node_distance(node, *n)));
+        for (i, n) in order.iter().enumerate() {
+            NODE_FALLBACK[node][i].store(*n as u8, Ordering::Relaxed);
+        }
+    }
+
+    let mut memblks: Vec<(usize, usize, usize)> = topo
+        .memblks
+        .iter()
+        .filter(|(_, _, node)| *node < nr)
+        .map(|(start, end, node)| {
+            (
+                page_align_down(start.data()),
+                page_align_up(end.data()),
+                *node,
+            )
+        })
+        .filter(|(start, end, _)| start < end)
+        .collect();
+    memblks.sort_by_key(|(start, _, _)| *start);
+    if memblks.len() > MAX_NODE_MEMBLKS {
+        kwarn!(
+            "numa: too many memory affinity ranges ({}), only the first {} are used",
+            memblks.len(),
+            MAX_NODE_MEMBLKS
+        );
+        memblks.truncate(MAX_NODE_MEMBLKS);
+    }
+    for (i, (start, end, node)) in memblks.iter().enumerate() {
+        kinfo!("numa: node {} memory [{:#x}, {:#x})", node, start, end);
+        // 去掉与前一个范围重叠的部分，保证范围互不重叠
+        let start = if i > 0 {
+            (*start).max(memblks[i - 1].1).min(*end)
+        } else {
+            *start
+        };
+        NODE_MEMBLKS[i].start.store(start, Ordering::Relaxed);
+        NODE_MEMBLKS[i].end.store(*end, Ordering::Relaxed);
+        NODE_MEMBLKS[i].node.store(*node, Ordering::Relaxed);
+    }
+
+    // 节点的内存范围一旦生效，buddy就会按照节点来放置空闲块，因此需要在buddy的锁内生效并重建空闲链表
+    let nr_memblks = memblks.len();
+    LockedFrameAllocator.rebuild_numa_nodes(|| {
+        NR_NODE_MEMBLKS.store(nr_memblks, Ordering::Release);
+        NR_NODES.store(nr, Ordering::Release);
+    });
+
+    kinfo!("numa: {} nodes, {} memory ranges", nr, nr_memblks);
+}
@@ -3,13 +3,16 @@ use core::{
     marker::PhantomData,
     mem,
     ops::Add,
-    sync::atomic::{compiler_fence, Ordering},
+    sync::atomic::{compiler_fence, AtomicUsize, Ordering},
 };
 
+use hashbrown::HashMap;
+
 use crate::{
-    arch::{interrupt::ipi::send_ipi, MMArch},
+    arch::{interrupt::ipi::send_ipi, mm::LockedFrameAllocator, MMArch},
     exception::ipi::{IpiKind, IpiTarget},
     kerror, kwarn,
+    libs::spinlock::SpinLock,
 };
 
 use super::{
@@ -17,6 +20,81 @@ use super::{
     PhysAddr, VirtAddr,
 };
 
+lazy_static! {
+    /// 被多个页表项同时映射的物理页的映射计数（只记录映射计数大于1的物理页）
+    static ref PAGE_MAP_COUNT: SpinLock<HashMap<PhysAddr, usize>> = SpinLock::new(HashMap::new());
+    /// 全局共享的零页
+    static ref ZERO_PAGE: PhysAddr = unsafe {
+        let paddr = LockedFrameAllocator
+            .allocate_one()
+            .expect("Failed to allocate zero page");
+        MMArch::write_bytes(MMArch::phys_2_virt(paddr).unwrap(), 0, MMArch::PAGE_SIZE);
+        paddr
+    };
+}
+
+/// 全局共享的零页
+///
+/// 对从未被访问过的匿名页的读操作，会只读地映射这个零页，而不是分配新的物理页。
+/// 第一次写入时，写时复制会把它替换为新的清零的物理页。
+///
+/// 零页永远不会被释放，也不会被记录映射计数、加入LRU或者被换出。
+pub struct ZeroPage;
+
+impl ZeroPage {
+    /// 获取零页的物理地址
+    #[inline(always)]
+    pub fn paddr() -> PhysAddr {
+        return *ZERO_PAGE;
+    }
+
+    /// 判断物理地址是否是零页
+    #[inline(always)]
+    pub fn is_zero_page(paddr: PhysAddr) -> bool {
+        return paddr == *ZERO_PAGE;
+    }
+}
+
+/// 物理页的映射计数
+///
+/// 在写时复制的场景下，一个物理页可能同时被多个地址空间的页表项映射。
+/// 只被一个页表项映射的物理页不会被记录，因此大部分物理页不会产生额外的内存开销。
+pub struct PageMapCount;
+
+impl PageMapCount {
+    /// 获取物理页当前被多少个页表项映射
+    pub fn get(paddr: PhysAddr) -> usize {
+        return PAGE_MAP_COUNT
+            .lock_irqsave()
+            .get(&paddr)
+            .copied()
+            .unwrap_or(1);
+    }
+
+    /// 物理页新增了一个页表项映射
+    pub fn inc(paddr: PhysAddr) {
+        *PAGE_MAP_COUNT.lock_irqsave().entry(paddr).or_insert(1) += 1;
+    }
+
+    /// 物理页减少了一个页表项映射
+    ///
+    /// ## 返回值
+    ///
+    /// 返回剩余的映射数量。如果返回0，说明调用者是最后一个映射者，应当释放这个物理页
+    pub fn dec(paddr: PhysAddr) -> usize {
+        let mut guard = PAGE_MAP_COUNT.lock_irqsave();
+        if let Some(count) = guard.get_mut(&paddr) {
+            *count -= 1;
+            let remain = *count;
+            if remain <= 1 {
+                guard.remove(&paddr);
+            }
+            return remain;
+        }
+        return 0;
+    }
+}
+
 #[derive(Debug)]
 pub struct PageTable<Arch> {
     /// 当前页表表示的虚拟地址空间的起始地址
@@ -90,6 +168,12 @@ impl<Arch: MemoryManagementArch> PageTable<Arch> {
         }
     }
 
+    /// 获取当前页表的每个页表项所表示的虚拟内存空间的大小
+    #[inline(always)]
+    pub fn entry_size(&self) -> usize {
+        return 1 << (self.level * Arch::PAGE_ENTRY_SHIFT + Arch::PAGE_SHIFT);
+    }
+
     /// 获取当前页表的第i个页表项所在的虚拟地址（注意与entry_base进行区分）
     pub unsafe fn entry_virt(&self, i: usize) -> Option<VirtAddr> {
         if i < Arch::PAGE_ENTRY_NUM {
@@ -112,6 +196,34 @@ impl<Arch: MemoryManagementArch> PageTable<Arch> {
         return Some(());
     }
 
+    /// 原子地把第i个页表项从`current`替换为`new`
+    ///
+    /// ## 返回值
+    ///
+    /// - Some(Ok(())) 替换成功
+    /// - Some(Err(entry)) 页表项的值已经不是`current`，返回它当前的值
+    /// - None 如果i超出了页表项的范围
+    pub unsafe fn compare_exchange_entry(
+        &self,
+        i: usize,
+        current: PageEntry<Arch>,
+        new: PageEntry<Arch>,
+    ) -> Option<Result<(), PageEntry<Arch>>> {
+        let entry_virt = self.entry_virt(i)?;
+        let atomic = &*(entry_virt.data() as *const AtomicUsize);
+        return Some(
+            atomic
+                .compare_exchange(
+                    current.data(),
+                    new.data(),
+                    Ordering::SeqCst,
+                    Ordering::SeqCst,
+                )
+                .map(|_| ())
+                .map_err(PageEntry::new),
+        );
+    }
+
     /// 判断当前页表的第i个页表项是否已经填写了值
     ///
     /// ## 参数
@@ -149,11 +261,17 @@ impl<Arch: MemoryManagementArch> PageTable<Arch> {
     }
 
     /// 获取第i个页表项指向的下一级页表
+    ///
+    /// 如果第i个页表项映射的是一个大页，那么它没有下一级页表，返回None
     pub unsafe fn next_level_table(&self, index: usize) -> Option<Self> {
         if self.level == 0 {
             return None;
         }
 
+        if self.entry(index)?.huge() {
+            return None;
+        }
+
         // 返回下一级页表
         return Some(PageTable::new(
             self.entry_base(index)?,
@@ -221,6 +339,14 @@ impl<Arch: MemoryManagementArch> PageEntry<Arch> {
     pub fn present(&self) -> bool {
         return self.data & Arch::ENTRY_FLAG_PRESENT != 0;
     }
+
+    /// 当前页表项是否直接映射了一个大页
+    ///
+    /// 请注意，只有非最后一级页表中的页表项，这个判断才有意义
+    #[inline(always)]
+    pub fn huge(&self) -> bool {
+        return self.present() && (self.data & Arch::ENTRY_FLAG_HUGE_PAGE != 0);
+    }
 }
 
 /// 页表项的标志位
@@ -330,6 +456,18 @@ impl<Arch: MemoryManagementArch> PageFlags<Arch> {
         return self.has_flag(Arch::ENTRY_FLAG_PRESENT);
     }
 
+    /// 页面自从上次清除访问位之后，是否被访问过
+    #[inline(always)]
+    pub fn has_accessed(&self) -> bool {
+        return self.has_flag(Arch::ENTRY_FLAG_ACCESSED);
+    }
+
+    /// 页面自从被映射之后，是否被写入过
+    #[inline(always)]
+    pub fn has_dirty(&self) -> bool {
+        return self.has_flag(Arch::ENTRY_FLAG_DIRTY);
+    }
+
     /// 设置当前页表项的权限
     ///
     /// @param value 如果为true，那么将当前页表项的权限设置为用户态可访问
@@ -435,6 +573,37 @@ impl<Arch: MemoryManagementArch> PageFlags<Arch> {
         return self.has_flag(Arch::ENTRY_FLAG_WRITE_THROUGH);
     }
 
+    /// 设置当前页表项的写合并策略
+    ///
+    /// 写合并的页面不会被缓存，多次写入会被合并为整个缓存行的突发传输，写入之间没有顺序保证。
+    /// 适用于帧缓冲区等只写、顺序写入的设备内存
+    ///
+    /// ## 参数
+    ///
+    /// - value: 如果为true，那么将当前页表项的缓存策略设置为写合并，否则设置为默认的回写。
+    #[inline(always)]
+    pub fn set_page_write_combining(self, value: bool) -> Self {
+        return self
+            .update_flags(
+                Arch::ENTRY_FLAG_CACHE_DISABLE | Arch::ENTRY_FLAG_WRITE_THROUGH,
+                false,
+            )
+            .update_flags(Arch::ENTRY_FLAG_WRITE_COMBINING, value);
+    }
+
+    /// 获取当前页表项的写合并策略
+    ///
+    /// ## 返回值
+    ///
+    /// 如果当前页表项的缓存策略为写合并，那么返回true，否则返回false。
+    #[inline(always)]
+    pub fn has_page_write_combining(&self) -> bool {
+        let mask = Arch::ENTRY_FLAG_CACHE_DISABLE
+            | Arch::ENTRY_FLAG_WRITE_THROUGH
+            | Arch::ENTRY_FLAG_WRITE_COMBINING;
+        return self.data & mask == Arch::ENTRY_FLAG_WRITE_COMBINING;
+    }
+
     /// MMIO内存的页表项标志
     #[inline(always)]
     pub fn mmio_flags() -> Self {
@@ -445,6 +614,16 @@ impl<Arch: MemoryManagementArch> PageFlags<Arch> {
             .set_page_cache_disable(true)
             .set_page_write_through(true);
     }
+
+    /// 写合并的设备内存（帧缓冲区、预取的BAR等）的页表项标志
+    #[inline(always)]
+    pub fn wc_flags() -> Self {
+        return Self::new()
+            .set_user(false)
+            .set_write(true)
+            .set_execute(true)
+            .set_page_write_combining(true);
+    }
 }
 
 impl<Arch: MemoryManagementArch> fmt::Debug for PageFlags<Arch> {
@@ -591,6 +770,10 @@ impl<Arch: MemoryManagementArch, F: FrameAllocator> PageMapper<Arch, F> {
                 compiler_fence(Ordering::SeqCst);
                 return Some(PageFlush::new(virt));
             } else {
+                if table.entry(i)?.huge() {
+                    // 要映射的地址位于一个大页中，先把大页拆分成更小的页
+                    self.split_huge_entry(&table, i)?;
+                }
                 let next_table = table.next_level_table(i);
                 if let Some(next_table) = next_table {
                     table = next_table;
@@ -625,6 +808,145 @@ impl<Arch: MemoryManagementArch, F: FrameAllocator> PageMapper<Arch, F> {
         }
     }
 
+    /// 使用一个大页，把物理地址映射到指定的虚拟地址
+    ///
+    /// ## 参数
+    ///
+    /// - virt 虚拟地址，需要按照大页的大小对齐
+    /// - phys 物理地址，需要按照大页的大小对齐
+    /// - flags 页表项的flags
+    /// - level 大页所在的页表层级（例如在x86_64上，1表示2M的大页，2表示1G的大页）
+    ///
+    /// ## 返回值
+    ///
+    /// 如果映射成功，返回刷新器，否则返回None
+    pub unsafe fn map_huge_phys(
+        &mut self,
+        virt: VirtAddr,
+        phys: PhysAddr,
+        flags: PageFlags<Arch>,
+        level: usize,
+    ) -> Option<PageFlush<Arch>> {
+        assert!(level > 0 && level < Arch::PAGE_LEVELS - 1);
+        let huge_size = 1 << (level * Arch::PAGE_ENTRY_SHIFT + Arch::PAGE_SHIFT);
+        if !(virt.check_aligned(huge_size) && phys.check_aligned(huge_size)) {
+            kerror!(
+                "Try to map unaligned huge page: virt={:?}, phys={:?}",
+                virt,
+                phys
+            );
+            return None;
+        }
+        let virt = VirtAddr::new(virt.data() & (!Arch::PAGE_NEGATIVE_MASK));
+
+        let entry = PageEntry::new(phys.data() | flags.data() | Arch::ENTRY_FLAG_HUGE_PAGE);
+        let mut table = self.table();
+        loop {
+            let i = table.index_of(virt)?;
+            if table.level() == level {
+                if table.entry_mapped(i)? {
+                    // 不覆盖已有的映射（尤其是已有的下一级页表）
+                    kwarn!("Huge page {:?} already mapped", virt);
+                    return None;
+                }
+                compiler_fence(Ordering::SeqCst);
+                table.set_entry(i, entry);
+                compiler_fence(Ordering::SeqCst);
+                return Some(PageFlush::new(virt));
+            }
+
+            if table.entry(i)?.huge() {
+                self.split_huge_entry(&table, i)?;
+            }
+            table = match table.next_level_table(i) {
+                Some(next_table) => next_table,
+                None => {
+                    // 分配下一级页表
+                    let frame = self.frame_allocator.allocate_one()?;
+                    MMArch::write_bytes(MMArch::phys_2_virt(frame).unwrap(), 0, MMArch::PAGE_SIZE);
+                    let flags: PageFlags<MMArch> =
+                        PageFlags::new_page_table(virt.kind() == PageTableKind::User);
+                    table.set_entry(i, PageEntry::new(frame.data() | flags.data()));
+                    table.next_level_table(i)?
+                }
+            };
+        }
+    }
+
+    /// 把页表的第i个页表项所映射的大页，拆分成下一级页表中的512个更小的页
+    ///
+    /// 拆分前后，虚拟地址到物理地址的映射关系以及页面的权限都不会改变。
+    ///
+    /// 拆分期间，其他cpu仍然可能通过大页表项访问这个大页，并且设置它的访问位和脏位。
+    /// 因此，大页表项通过比较并交换被替换：如果它在填写子页表期间被修改了，就按照它最新的标志位重新填写，
+    /// 保证访问位和脏位不会丢失。这里不能先把大页表项清零：内核的线性映射在拆分期间仍然会被其他cpu访问。
+    ///
+    /// 页面的大小改变之后，TLB中可能同时缓存着大页和小页的表项，因此需要刷新TLB。
+    /// 这里刷新当前cpu上的大页表项；对大页中任意一个地址的刷新都会使整个大页表项失效，
+    /// 因此调用者对返回的[`PageFlush`]进行的刷新（或者TLB shootdown）会使其他cpu上的大页表项失效。
+    unsafe fn split_huge_entry(&mut self, table: &PageTable<Arch>, i: usize) -> Option<()> {
+        let mut entry = table.entry(i)?;
+        assert!(table.level() > 0 && entry.huge());
+
+        let frame = self.frame_allocator.allocate_one()?;
+        let subtable = PageTable::<Arch>::new(table.entry_base(i)?, frame, table.level() - 1);
+        let sub_size = subtable.entry_size();
+        let flags: PageFlags<Arch> = PageFlags::new_page_table(entry.flags().has_user());
+        let table_entry = PageEntry::new(frame.data() | flags.data());
+
+        loop {
+            let paddr = match entry.address() {
+                Ok(paddr) => paddr,
+                Err(_) => {
+                    self.frame_allocator.free_one(frame);
+                    return None;
+                }
+            };
+            let mut sub_flags = entry.flags().data();
+            if subtable.level() == 0 {
+                sub_flags &= !Arch::ENTRY_FLAG_HUGE_PAGE;
+            }
+            for k in 0..Arch::PAGE_ENTRY_NUM {
+                subtable.set_entry(k, PageEntry::new((paddr.data() + k * sub_size) | sub_flags));
+            }
+
+            compiler_fence(Ordering::SeqCst);
+            match table.compare_exchange_entry(i, entry, table_entry)? {
+                Ok(()) => break,
+                // 大页表项的访问位或者脏位被其他cpu设置了，按照最新的值重新填写子页表
+                Err(current) => entry = current,
+            }
+        }
+
+        // 页表中记录的地址去掉了符号扩展的高位，刷新TLB时需要使用规范的地址
+        let mut base = table.entry_base(i)?.data();
+        if base & (1 << (Arch::PAGE_ADDRESS_SHIFT - 1)) != 0 {
+            base |= Arch::PAGE_NEGATIVE_MASK;
+        }
+        Arch::invalidate_page(VirtAddr::new(base));
+        return Some(());
+    }
+
+    /// 如果虚拟地址位于某个大页中，那么逐级拆分这个大页，直到虚拟地址由最后一级页表映射
+    unsafe fn split_huge_pages(&mut self, virt: VirtAddr) {
+        let mut table = self.table();
+        while table.level() > 0 {
+            let i = match table.index_of(virt) {
+                Some(i) => i,
+                None => return,
+            };
+            if table.entry(i).map(|e| e.huge()).unwrap_or(false)
+                && self.split_huge_entry(&table, i).is_none()
+            {
+                return;
+            }
+            table = match table.next_level_table(i) {
+                Some(t) => t,
+                None => return,
+            };
+        }
+    }
+
     /// 将物理地址映射到具有线性偏移量的虚拟地址
     #[allow(dead_code)]
     pub unsafe fn map_linearly(
@@ -652,9 +974,14 @@ impl<Arch: MemoryManagementArch, F: FrameAllocator> PageMapper<Arch, F> {
         virt: VirtAddr,
         flags: PageFlags<Arch>,
     ) -> Option<PageFlush<Arch>> {
+        self.split_huge_pages(virt);
         return self
             .visit(virt, |p1, i| {
                 let mut entry = p1.entry(i)?;
+                // 没有映射物理页的页表项（包括交换条目）不能被修改标志位，否则会被错误地标记为存在
+                if !entry.present() {
+                    return None;
+                }
                 entry.set_flags(flags);
                 p1.set_entry(i, entry);
                 Some(PageFlush::new(virt))
@@ -662,6 +989,73 @@ impl<Arch: MemoryManagementArch, F: FrameAllocator> PageMapper<Arch, F> {
             .flatten();
     }
 
+    /// 获取虚拟地址对应的页表项中记录的交换条目
+    ///
+    /// ## 返回值
+    ///
+    /// 如果页表项记录的是一个交换条目，则返回它，否则返回None
+    pub fn swap_entry(&self, virt: VirtAddr) -> Option<usize> {
+        return self
+            .visit(virt, |p1, i| {
+                let entry = unsafe { p1.entry(i) }?;
+                if entry.present() || entry.data() & Arch::ENTRY_FLAG_SWAP == 0 {
+                    return None;
+                }
+                Some(entry.data() >> Arch::PAGE_SHIFT)
+            })
+            .flatten();
+    }
+
+    /// 把虚拟地址对应的页表项设置为交换条目（如果中间的页表不存在，则会创建它们）
+    ///
+    /// 调用者需要保证页表项原本没有映射物理页。交换条目不会被TLB缓存，因此不需要刷新TLB
+    pub unsafe fn set_swap_entry(&mut self, virt: VirtAddr, swap_entry: usize) -> Option<()> {
+        // 交换条目的present位为0，借用map_phys建立中间的页表并写入页表项
+        let data = swap_entry << Arch::PAGE_SHIFT;
+        if data & !Arch::PAGE_ADDRESS_MASK != 0 {
+            return None;
+        }
+        let flags = PageFlags::from_data(Arch::ENTRY_FLAG_SWAP);
+        return self
+            .map_phys(virt, PhysAddr::new(data), flags)
+            .map(|flush| flush.ignore());
+    }
+
+    /// 如果虚拟地址对应的页表项记录的是交换条目，则清除页表项，并返回这个交换条目
+    pub unsafe fn take_swap_entry(&mut self, virt: VirtAddr) -> Option<usize> {
+        let swap_entry = self.swap_entry(virt)?;
+        self.visit(virt, |p1, i| p1.set_entry(i, PageEntry::new(0)))
+            .flatten()?;
+        return Some(swap_entry);
+    }
+
+    /// 读取并清除页表项的访问位
+    ///
+    /// 清除访问位之后不会刷新TLB：TLB中缓存的表项只会让下一次访问位被置位的时间推迟，
+    /// 对于页面回收时判断页面的冷热来说是可以接受的。
+    /// 如果虚拟地址位于大页中，读取并清除的是整个大页的访问位。
+    ///
+    /// ## 返回值
+    ///
+    /// 如果虚拟地址没有被映射，返回None，否则返回清除之前访问位的值
+    pub unsafe fn test_and_clear_accessed(&mut self, virt: VirtAddr) -> Option<bool> {
+        return self
+            .visit_leaf(virt, |p1, i| {
+                let mut entry = p1.entry(i)?;
+                if !entry.present() {
+                    return None;
+                }
+                let flags = entry.flags();
+                if flags.has_accessed() {
+                    entry.set_flags(flags.update_flags(Arch::ENTRY_FLAG_ACCESSED, false));
+                    p1.set_entry(i, entry);
+                    return Some(true);
+                }
+                Some(false)
+            })
+            .flatten();
+    }
+
     /// 根据虚拟地址，查找页表，获取对应的物理地址和页表项的flags
     ///
     /// ## 参数
@@ -672,10 +1066,27 @@ impl<Arch: MemoryManagementArch, F: FrameAllocator> PageMapper<Arch, F> {
     ///
     /// 如果查找成功，返回物理地址和页表项的flags，否则返回None
     pub fn translate(&self, virt: VirtAddr) -> Option<(PhysAddr, PageFlags<Arch>)> {
-        let entry: PageEntry<Arch> = self.visit(virt, |p1, i| unsafe { p1.entry(i) })??;
-        let paddr = entry.address().ok()?;
-        let flags = entry.flags();
-        return Some((paddr, flags));
+        let mut table = self.table();
+        unsafe {
+            loop {
+                let i = table.index_of(virt)?;
+                let entry = table.entry(i)?;
+                if table.level() == 0 {
+                    let paddr = entry.address().ok()?;
+                    return Some((paddr, entry.flags()));
+                }
+
+                if entry.huge() {
+                    // 大页：返回虚拟地址所在的小页对应的物理地址
+                    let offset = virt.data() & (table.entry_size() - 1) & Arch::PAGE_MASK;
+                    let paddr = entry.address().ok()?.add(offset);
+                    let flags =
+                        PageFlags::from_data(entry.flags().data() & !Arch::ENTRY_FLAG_HUGE_PAGE);
+                    return Some((paddr, flags));
+                }
+                table = table.next_level_table(i)?;
+            }
+        }
     }
 
     /// 取消虚拟地址的映射，释放页面，并返回页表项刷新器
@@ -716,11 +1127,71 @@ impl<Arch: MemoryManagementArch, F: FrameAllocator> PageMapper<Arch, F> {
             return None;
         }
 
+        self.split_huge_pages(virt);
         let mut table = self.table();
         return unmap_phys_inner(virt, &mut table, unmap_parents, self.allocator_mut())
             .map(|(paddr, flags)| (paddr, flags, PageFlush::<Arch>::new(virt)));
     }
 
+    /// 取消虚拟地址所在的整个映射：如果虚拟地址位于大页的起始位置，则取消整个大页的映射，
+    /// 否则只取消一个页面的映射。不会释放物理页，也不会释放空闲的子页表
+    ///
+    /// ## 返回值
+    ///
+    /// 如果取消成功，返回被取消映射的字节数和页表项刷新器，否则返回None
+    pub unsafe fn unmap_phys_block(&mut self, virt: VirtAddr) -> Option<(usize, PageFlush<Arch>)> {
+        if !virt.check_aligned(Arch::PAGE_SIZE) {
+            kerror!("Try to unmap unaligned page: virt={:?}", virt);
+            return None;
+        }
+        let mut table = self.table();
+        loop {
+            let i = table.index_of(virt)?;
+            let entry = table.entry(i)?;
+            if table.level() == 0 || entry.huge() {
+                if table.level() > 0 && !virt.check_aligned(table.entry_size()) {
+                    // 只取消大页中的一部分：先拆分大页
+                    self.split_huge_entry(&table, i)?;
+                    table = table.next_level_table(i)?;
+                    continue;
+                }
+                if !entry.present() {
+                    return None;
+                }
+                table.set_entry(i, PageEntry::new(0));
+                return Some((table.entry_size(), PageFlush::new(virt)));
+            }
+            table = table.next_level_table(i)?;
+        }
+    }
+
+    /// 虚拟地址所在的、第`level`层页表中的页表项是否空闲
+    ///
+    /// 页表项空闲指的是：它既没有映射页面（包括大页），也没有指向下一级页表，也不是交换条目。
+    /// 这样的页表项可以直接用[`PageMapper::map_huge_phys`]映射一个大页。
+    /// 中间的页表不存在时，也认为页表项是空闲的。
+    pub fn huge_entry_unused(&self, virt: VirtAddr, level: usize) -> bool {
+        let mut table = self.table();
+        unsafe {
+            loop {
+                let i = match table.index_of(virt) {
+                    Some(i) => i,
+                    None => return false,
+                };
+                if table.level() == level {
+                    return table.entry_mapped(i) == Some(false);
+                }
+                if table.entry(i).map(|e| e.huge()).unwrap_or(false) {
+                    return false;
+                }
+                table = match table.next_level_table(i) {
+                    Some(t) => t,
+                    None => return true,
+                };
+            }
+        }
+    }
+
     /// 在页表中，访问虚拟地址对应的页表项，并调用传入的函数F
     fn visit<T>(
         &self,
@@ -739,6 +1210,24 @@ impl<Arch: MemoryManagementArch, F: FrameAllocator> PageMapper<Arch, F> {
             }
         }
     }
+
+    /// 与[`PageMapper::visit`]相同，但是如果虚拟地址位于大页中，访问的是映射这个大页的页表项
+    fn visit_leaf<T>(
+        &self,
+        virt: VirtAddr,
+        f: impl FnOnce(&mut PageTable<Arch>, usize) -> T,
+    ) -> Option<T> {
+        let mut table = self.table();
+        unsafe {
+            loop {
+                let i = table.index_of(virt)?;
+                if table.level() == 0 || table.entry(i)?.huge() {
+                    return Some(f(&mut table, i));
+                }
+                table = table.next_level_table(i)?;
+            }
+        }
+    }
 }
 
 /// 取消页面映射，返回被取消映射的页表项的：【物理地址】和【flags】
@@ -778,10 +1267,10 @@ unsafe fn unmap_phys_inner<Arch: MemoryManagementArch>(
     if unmap_parents {
         // 如果子页表已经没有映射的页面了，就取消子页表的映射
 
-        // 检查子页表中是否还有映射的页面
+        // 检查子页表中是否还有映射的页面（交换条目虽然不存在，但是仍然需要保留）
         let x = (0..Arch::PAGE_ENTRY_NUM)
             .map(|k| subtable.entry(k).expect("invalid page entry"))
-            .any(|e| e.present());
+            .any(|e| e.data() != 0);
         if !x {
             // 如果没有，就取消子页表的映射
             table.set_entry(i, PageEntry::new(0));
@@ -828,6 +1317,12 @@ impl<Arch: MemoryManagementArch> PageFlush<Arch> {
         unsafe { Arch::invalidate_page(self.virt) };
     }
 
+    /// 获取需要刷新的虚拟地址
+    #[inline(always)]
+    pub fn virt(&self) -> VirtAddr {
+        return self.virt;
+    }
+
     /// 忽略掉这个刷新器
     pub unsafe fn ignore(self) {
         mem::forget(self);
@@ -83,6 +83,16 @@ impl<T> PerCpuVar<T> {
         let cpu_id = smp_get_processor_id();
         &mut self.inner[cpu_id as usize]
     }
+
+    /// 获取指定CPU的变量
+    pub fn get_for(&self, cpu_id: u32) -> &T {
+        &self.inner[cpu_id as usize]
+    }
+
+    /// 遍历所有CPU的变量
+    pub fn iter(&self) -> core::slice::Iter<T> {
+        self.inner.iter()
+    }
 }
 
 /// PerCpu变量是线程安全的，因为每个CPU都有自己的变量。
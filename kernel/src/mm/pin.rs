@@ -0,0 +1,108 @@
+//! 固定用户缓冲区的物理页
+//!
+//! 设备直接对用户缓冲区进行DMA时，需要知道缓冲区每一页的物理地址，并且保证DMA期间这些物理页
+//! 不会被回收、迁移或者释放。
+//!
+//! 固定一个物理页的方式是为它增加一个映射计数（[`PageMapCount`]）：
+//! - 回收（见[`super::lru`]）和规整（见[`super::compaction`]）都会跳过映射计数大于1的页面
+//! - 进程在DMA期间解除了映射时，映射计数不会减到0，物理页由解除固定的一方释放
+//!
+//! 固定之前会先按照DMA的方向触发缺页，保证页面已经存在。设备会写入的页面还会先解除写时复制的共享，
+//! 保证设备写入的就是进程地址空间中的那一页。
+
+use alloc::vec::Vec;
+
+use crate::{arch::MMArch, syscall::SystemError};
+
+use super::{
+    allocator::page_frame::{deallocate_page_frames, PageFrameCount, PhysPageFrame},
+    fault::{FaultFlags, PageFaultHandler},
+    lru::lru_del,
+    page::{round_up_to_page_size, PageMapCount, ZeroPage},
+    ucontext::AddressSpace,
+    verify_area, MemoryManagementArch, PhysAddr, VirtAddr,
+};
+
+/// 一段被固定在内存中的用户缓冲区。析构时解除固定
+#[derive(Debug)]
+pub struct PinnedUserPages {
+    /// 缓冲区的起始地址在第一页中的偏移
+    offset: usize,
+    len: usize,
+    /// 缓冲区每一页的物理地址
+    pages: Vec<PhysAddr>,
+}
+
+impl PinnedUserPages {
+    /// 固定当前进程的用户缓冲区`[vaddr, vaddr + len)`
+    ///
+    /// ## 参数
+    ///
+    /// - `vaddr`：缓冲区的起始地址
+    /// - `len`：缓冲区的长度
+    /// - `writable`：设备是否会写入这个缓冲区
+    pub fn pin(vaddr: VirtAddr, len: usize, writable: bool) -> Result<Self, SystemError> {
+        verify_area(vaddr, len)?;
+        let space = AddressSpace::current()?;
+        let start = vaddr.data() & MMArch::PAGE_MASK;
+        let end = round_up_to_page_size(vaddr.data() + len);
+        let mut pinned = Self {
+            offset: vaddr.data() - start,
+            len,
+            pages: Vec::with_capacity((end - start) >> MMArch::PAGE_SHIFT),
+        };
+        let fault_flags = if writable {
+            FaultFlags::FAULT_FLAG_WRITE
+        } else {
+            FaultFlags::empty()
+        };
+
+        let mut page = start;
+        while page < end {
+            let page_vaddr = VirtAddr::new(page);
+            let guard = space.read();
+            let paddr = match guard.user_mapper.utable.translate(page_vaddr) {
+                Some((paddr, flags)) if !writable || flags.has_write() => paddr,
+                _ => {
+                    // 页面还不存在，或者需要先解除写时复制的共享。失败时，已经固定的页面随着pinned一起被解除固定
+                    drop(guard);
+                    PageFaultHandler::handle_mm_fault(page_vaddr, fault_flags)?;
+                    continue;
+                }
+            };
+            if !ZeroPage::is_zero_page(paddr) {
+                PageMapCount::inc(paddr);
+            }
+            drop(guard);
+            pinned.pages.push(paddr);
+            page += MMArch::PAGE_SIZE;
+        }
+        return Ok(pinned);
+    }
+
+    /// 获取缓冲区中第`offset`个字节的物理地址
+    pub fn paddr(&self, offset: usize) -> PhysAddr {
+        assert!(offset < self.len);
+        let offset = self.offset + offset;
+        return PhysAddr::new(
+            self.pages[offset >> MMArch::PAGE_SHIFT].data() + (offset & MMArch::PAGE_OFFSET_MASK),
+        );
+    }
+}
+
+impl Drop for PinnedUserPages {
+    fn drop(&mut self) {
+        for paddr in self.pages.iter() {
+            if ZeroPage::is_zero_page(*paddr) {
+                continue;
+            }
+            // 固定期间进程已经解除了映射，由这里释放物理页
+            if PageMapCount::dec(*paddr) == 0 {
+                lru_del(*paddr);
+                unsafe {
+                    deallocate_page_frames(PhysPageFrame::new(*paddr), PageFrameCount::new(1))
+                };
+            }
+        }
+    }
+}
@@ -0,0 +1,253 @@
+//! 内存回收
+//!
+//! 当空闲页帧低于水位线时，由后台的kswapd线程调用各个[`Shrinker`]回收内存，
+//! 直到空闲页帧重新回到高水位之上。分配页帧失败时，缺页处理等可以安全地等待的路径
+//! 还会通过[`try_to_free_pages`]同步地进行一次直接回收，然后重试分配。
+//!
+//! 页面缓存、dentry缓存、slab等以后加入的缓存，只需要实现[`Shrinker`]并注册，就能参与回收。
+//!
+//! kswapd每一轮检查之后，还会在需要时进行后台的内存规整（见[`super::compaction`]）。
+
+use core::{
+    fmt::Debug,
+    sync::atomic::{AtomicBool, AtomicUsize, Ordering},
+};
+
+use alloc::{boxed::Box, string::ToString, sync::Arc, vec::Vec};
+
+use crate::{
+    arch::mm::LockedFrameAllocator,
+    kinfo,
+    libs::{rwlock::RwLock, spinlock::SpinLock},
+    process::{
+        kthread::{KernelThreadClosure, KernelThreadMechanism},
+        ProcessControlBlock, ProcessManager,
+    },
+    sched::core::cond_resched,
+    time::timer::schedule_timeout,
+};
+
+use super::{compaction::background_compaction, lru::AnonLruShrinker};
+
+/// kswapd每一轮最多让每个shrinker扫描的对象数量
+const SHRINK_BATCH: usize = 128;
+/// 直接回收时，最多进行的轮数
+const DIRECT_RECLAIM_ROUNDS: usize = 4;
+/// kswapd的检查间隔（单位：jiffies，即微秒）
+const KSWAPD_INTERVAL: i64 = 100000;
+
+/// 可以回收内存的缓存需要实现的trait
+pub trait Shrinker: Send + Sync + Debug {
+    /// shrinker的名字，用于调试
+    fn name(&self) -> &str;
+
+    /// 返回当前可以被回收的对象数量（允许是估计值）
+    fn count_objects(&self) -> usize;
+
+    /// 扫描最多`nr_to_scan`个对象，并回收其中可以回收的
+    ///
+    /// 这个函数可能会在kswapd中调用，也可能在直接回收时调用。
+    /// 实现者不应该阻塞地等待其他锁，遇到被占用的锁时应当跳过对应的对象。
+    ///
+    /// ## 返回值
+    ///
+    /// 返回被释放的页帧数量
+    fn scan_objects(&self, nr_to_scan: usize) -> usize;
+}
+
+/// 空闲页帧的水位线（单位：页帧）
+#[derive(Debug, Clone, Copy)]
+pub struct Watermarks {
+    /// 最低水位，其他水位线以它为基准计算
+    pub min: usize,
+    /// 低于这个值时，唤醒kswapd
+    pub low: usize,
+    /// kswapd回收到这个值之后停止
+    pub high: usize,
+}
+
+impl Watermarks {
+    const fn empty() -> Self {
+        return Self {
+            min: 0,
+            low: 0,
+            high: 0,
+        };
+    }
+
+    /// 根据总的页帧数量计算水位线
+    fn new(total_pages: usize) -> Self {
+        // 保留约0.8%的内存（至少256K）作为min水位
+        let min = core::cmp::max(total_pages / 128, 64);
+        return Self {
+            min,
+            low: min + min / 4,
+            high: min + min / 2,
+        };
+    }
+}
+
+static WATERMARKS: SpinLock<Watermarks> = SpinLock::new(Watermarks::empty());
+/// buddy中的空闲页帧数量（由页帧分配器在访问buddy时更新，不包括per-cpu缓存中的页帧）
+static FREE_PAGES_HINT: AtomicUsize = AtomicUsize::new(usize::MAX);
+/// 低水位线的副本，使得检查水位时不需要加锁
+static LOW_WATERMARK: AtomicUsize = AtomicUsize::new(0);
+
+static SHRINKERS: RwLock<Vec<Arc<dyn Shrinker>>> = RwLock::new(Vec::new());
+/// 是否已经有回收者正在运行。同一时刻只允许一个回收者在运行，避免多个CPU同时扫描同一个LRU
+static RECLAIM_RUNNING: AtomicBool = AtomicBool::new(false);
+
+static mut KSWAPD_PCB: Option<Arc<ProcessControlBlock>> = None;
+/// kswapd是否正在休眠
+static KSWAPD_SLEEPING: AtomicBool = AtomicBool::new(false);
+
+/// 更新空闲页帧数量的提示值
+///
+/// 由页帧分配器在持有buddy的锁时调用，因此这个函数不能加锁，也不能唤醒进程
+#[inline(always)]
+pub fn set_free_pages_hint(free: usize) {
+    FREE_PAGES_HINT.store(free, Ordering::Relaxed);
+}
+
+/// 空闲页帧是否已经低于低水位线
+#[inline(always)]
+pub fn below_low_watermark() -> bool {
+    return FREE_PAGES_HINT.load(Ordering::Relaxed) < LOW_WATERMARK.load(Ordering::Relaxed);
+}
+
+/// 获取当前的水位线
+pub fn watermarks() -> Watermarks {
+    return *WATERMARKS.lock_irqsave();
+}
+
+/// 注册一个shrinker
+pub fn register_shrinker(shrinker: Arc<dyn Shrinker>) {
+    SHRINKERS.write().push(shrinker);
+}
+
+/// 注销一个shrinker
+#[allow(dead_code)]
+pub fn unregister_shrinker(shrinker: &Arc<dyn Shrinker>) {
+    SHRINKERS.write().retain(|s| !Arc::ptr_eq(s, shrinker));
+}
+
+/// 让所有的shrinker各扫描一批对象
+///
+/// ## 返回值
+///
+/// 返回被释放的页帧数量
+fn shrink_all(batch: usize) -> usize {
+    let shrinkers: Vec<Arc<dyn Shrinker>> = SHRINKERS.read().clone();
+    let mut freed = 0;
+    for shrinker in shrinkers.iter() {
+        let count = shrinker.count_objects();
+        if count == 0 {
+            continue;
+        }
+        freed += shrinker.scan_objects(core::cmp::min(count, batch));
+    }
+    return freed;
+}
+
+/// 尝试成为唯一的回收者
+#[inline(always)]
+fn reclaim_begin() -> bool {
+    return RECLAIM_RUNNING
+        .compare_exchange(false, true, Ordering::Acquire, Ordering::Relaxed)
+        .is_ok();
+}
+
+#[inline(always)]
+fn reclaim_end() {
+    RECLAIM_RUNNING.store(false, Ordering::Release);
+}
+
+/// 直接回收：同步地回收至少`nr_pages`个页帧
+///
+/// 请注意，不要在全局内存分配器中、或者持有自旋锁时调用这个函数。
+///
+/// ## 返回值
+///
+/// 返回被释放的页帧数量。如果已经有其他回收者正在运行，则不进行回收，返回0
+pub fn try_to_free_pages(nr_pages: usize) -> usize {
+    if !reclaim_begin() {
+        return 0;
+    }
+
+    let mut freed = 0;
+    for _ in 0..DIRECT_RECLAIM_ROUNDS {
+        let r = shrink_all(core::cmp::max(nr_pages, SHRINK_BATCH));
+        freed += r;
+        if r == 0 || freed >= nr_pages {
+            break;
+        }
+    }
+    reclaim_end();
+    return freed;
+}
+
+/// 如果空闲页帧低于低水位线，唤醒kswapd
+///
+/// 请注意，不要在全局内存分配器、或者持有调度器相关的锁时调用这个函数。
+pub fn wakeup_kswapd() {
+    if !below_low_watermark() || !KSWAPD_SLEEPING.load(Ordering::SeqCst) {
+        return;
+    }
+    if let Some(pcb) = unsafe { KSWAPD_PCB.as_ref() } {
+        ProcessManager::wakeup(pcb).ok();
+    }
+}
+
+/// kswapd：空闲页帧低于低水位线时，回收内存，直到空闲页帧高于高水位线
+fn kswapd_thread() -> i32 {
+    loop {
+        let marks = watermarks();
+        // 提示值不包括per-cpu缓存中的页帧，这里重新统计一次准确的值
+        let mut free = LockedFrameAllocator.get_usage().free().data();
+        if free < marks.low {
+            while free < marks.high {
+                // 有其他CPU正在进行直接回收
+                if !reclaim_begin() {
+                    break;
+                }
+                let freed = shrink_all(SHRINK_BATCH);
+                reclaim_end();
+                if freed == 0 {
+                    break;
+                }
+                cond_resched();
+                free = LockedFrameAllocator.get_usage().free().data();
+            }
+        }
+
+        // 空闲内存充足，但是内存碎片化时，在后台进行规整
+        background_compaction();
+
+        KSWAPD_SLEEPING.store(true, Ordering::SeqCst);
+        schedule_timeout(KSWAPD_INTERVAL).ok();
+        KSWAPD_SLEEPING.store(false, Ordering::SeqCst);
+    }
+}
+
+/// 初始化内存回收（需要在内核线程机制初始化完成之后调用）
+///
+/// 计算水位线，注册匿名页的LRU shrinker，并启动kswapd
+pub fn reclaim_init() {
+    let total = LockedFrameAllocator.get_usage().total().data();
+    let marks = Watermarks::new(total);
+    *WATERMARKS.lock_irqsave() = marks;
+    LOW_WATERMARK.store(marks.low, Ordering::Relaxed);
+
+    register_shrinker(Arc::new(AnonLruShrinker));
+
+    let closure = KernelThreadClosure::EmptyClosure((Box::new(kswapd_thread), ()));
+    let pcb = KernelThreadMechanism::create_and_run(closure, "kswapd".to_string())
+        .expect("Failed to create kswapd");
+    unsafe { KSWAPD_PCB = Some(pcb) };
+    kinfo!(
+        "kswapd started, watermarks: min={}, low={}, high={}",
+        marks.min,
+        marks.low,
+        marks.high
+    );
+}
@@ -0,0 +1,135 @@
+//! 地址空间的常驻内存（RSS）统计
+//!
+//! 每个地址空间分别统计映射着的匿名页、文件页（页面缓存中的页）的数量，以及被换出到zram的页面数量。
+//! 所有修改用户页表项的地方（缺页、fork、madvise、解除映射、回收）都会更新这些计数。
+//!
+//! 缺页等路径上频繁地修改计数，为了避免多个cpu同时修改同一个缓存行，修改先累积在每个cpu的增量上，
+//! 增量的绝对值超过[`RSS_BATCH`]时才合并到总数。因此总数是近似值（误差不超过cpu数量×批量），
+//! 需要精确值时（例如procfs）使用[`RssStat::get`]把所有cpu的增量加起来。
+//!
+//! 全局的零页以及特殊映射（vDSO等）中的页面不属于地址空间，不计入RSS。
+
+use core::sync::atomic::{AtomicIsize, AtomicUsize, Ordering};
+
+use alloc::vec::Vec;
+
+use crate::{
+    arch::CurrentIrqArch, exception::InterruptArch, include::bindings::bindings::smp_get_total_cpu,
+    smp::core::smp_get_processor_id,
+};
+
+/// 每个cpu上的增量超过这个值时，合并到总数
+const RSS_BATCH: isize = 64;
+
+/// RSS计数的类型
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum RssMember {
+    /// 映射着的文件页
+    FilePages = 0,
+    /// 映射着的匿名页（包括私有文件映射写时复制得到的页）
+    AnonPages = 1,
+    /// 被换出的匿名页
+    SwapEntries = 2,
+}
+
+const NR_RSS_MEMBERS: usize = 3;
+
+#[derive(Debug, Default)]
+struct RssDelta {
+    delta: [AtomicIsize; NR_RSS_MEMBERS],
+}
+
+#[derive(Debug)]
+pub struct RssStat {
+    count: [AtomicIsize; NR_RSS_MEMBERS],
+    /// 每个cpu上还没有合并到总数的增量（只由对应的cpu修改）
+    pcpu: Vec<RssDelta>,
+    /// 常驻页面数量（匿名页+文件页）的历史最大值（在合并时更新）
+    hiwater_rss: AtomicUsize,
+}
+
+impl RssStat {
+    pub fn new() -> Self {
+        let nr_cpus = unsafe { smp_get_total_cpu() } as usize;
+        let mut pcpu = Vec::with_capacity(nr_cpus);
+        pcpu.resize_with(nr_cpus, RssDelta::default);
+        return Self {
+            count: Default::default(),
+            pcpu,
+            hiwater_rss: AtomicUsize::new(0),
+        };
+    }
+
+    /// 修改计数（单位：页）
+    pub fn add(&self, member: RssMember, value: isize) {
+        let _guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+        let m = member as usize;
+        let cpu = match self.pcpu.get(smp_get_processor_id() as usize) {
+            Some(cpu) => cpu,
+            None => {
+                self.count[m].fetch_add(value, Ordering::Relaxed);
+                return;
+            }
+        };
+        // 只有当前cpu会修改自己的增量，因此不需要原子的读-改-写
+        let delta = cpu.delta[m].load(Ordering::Relaxed) + value;
+        if delta.abs() < RSS_BATCH {
+            cpu.delta[m].store(delta, Ordering::Relaxed);
+            return;
+        }
+        cpu.delta[m].store(0, Ordering::Relaxed);
+        self.count[m].fetch_add(delta, Ordering::Relaxed);
+        self.hiwater_rss
+            .fetch_max(self.rss_fast(), Ordering::Relaxed);
+    }
+
+    #[inline(always)]
+    pub fn inc(&self, member: RssMember) {
+        self.add(member, 1);
+    }
+
+    #[inline(always)]
+    pub fn dec(&self, member: RssMember) {
+        self.add(member, -1);
+    }
+
+    /// 近似值：只读取总数，不包括各个cpu上还没有合并的增量
+    #[inline(always)]
+    pub fn get_fast(&self, member: RssMember) -> usize {
+        return self.count[member as usize].load(Ordering::Relaxed).max(0) as usize;
+    }
+
+    /// 精确值：总数加上所有cpu上的增量
+    pub fn get(&self, member: RssMember) -> usize {
+        let m = member as usize;
+        let sum = self
+            .pcpu
+            .iter()
+            .fold(self.count[m].load(Ordering::Relaxed), |acc, cpu| {
+                acc + cpu.delta[m].load(Ordering::Relaxed)
+            });
+        return sum.max(0) as usize;
+    }
+
+    #[inline(always)]
+    fn rss_fast(&self) -> usize {
+        return self.get_fast(RssMember::FilePages) + self.get_fast(RssMember::AnonPages);
+    }
+
+    /// 常驻页面数量（匿名页+文件页）
+    pub fn rss(&self) -> usize {
+        return self.get(RssMember::FilePages) + self.get(RssMember::AnonPages);
+    }
+
+    /// 常驻页面数量的历史最大值
+    pub fn hiwater_rss(&self) -> usize {
+        let rss = self.rss();
+        return self.hiwater_rss.fetch_max(rss, Ordering::Relaxed).max(rss);
+    }
+}
+
+impl Default for RssStat {
+    fn default() -> Self {
+        Self::new()
+    }
+}
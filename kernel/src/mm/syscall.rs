@@ -1,19 +1,22 @@
 use core::intrinsics::unlikely;
 
-use alloc::sync::Arc;
+use alloc::{sync::Arc, vec::Vec};
+use num_traits::FromPrimitive;
 
 use crate::{
     arch::MMArch,
+    filesystem::vfs::file::FileMode,
     kerror,
     libs::align::{check_aligned, page_align_up},
     mm::MemoryManagementArch,
+    process::ProcessManager,
     syscall::{Syscall, SystemError},
 };
 
 use super::{
     allocator::page_frame::{PageFrameCount, VirtPageFrame},
     ucontext::{AddressSpace, DEFAULT_MMAP_MIN_ADDR},
-    verify_area, VirtAddr,
+    verify_area, VirtAddr, VirtRegion,
 };
 
 bitflags! {
@@ -66,6 +69,41 @@ bitflags! {
     }
 }
 
+bitflags! {
+    /// msync系统调用的标志
+    pub struct MsFlags: usize {
+        /// 只是请求写回，不等待写回完成
+        const MS_ASYNC = 1;
+        /// 使同一个文件的其他映射失效
+        const MS_INVALIDATE = 2;
+        /// 写回，并且等待写回完成
+        const MS_SYNC = 4;
+    }
+}
+
+/// madvise系统调用的建议
+///
+/// 参考：linux-6.1-rc5/include/uapi/asm-generic/mman-common.h
+#[derive(Debug, Clone, Copy, PartialEq, Eq, FromPrimitive)]
+pub enum MadvAdvice {
+    /// MADV_NORMAL 没有特殊的建议
+    Normal = 0,
+    /// MADV_RANDOM 将会随机访问
+    Random = 1,
+    /// MADV_SEQUENTIAL 将会顺序访问
+    Sequential = 2,
+    /// MADV_WILLNEED 很快就会访问，预先建立映射
+    WillNeed = 3,
+    /// MADV_DONTNEED 不再需要，释放物理页，再次访问时得到清零的页
+    DontNeed = 4,
+    /// MADV_FREE 物理页可以被释放（目前与MADV_DONTNEED的处理方式相同）
+    Free = 8,
+    /// MADV_HUGEPAGE 希望使用巨页
+    HugePage = 14,
+    /// MADV_NOHUGEPAGE 不希望使用巨页
+    NoHugePage = 15,
+}
+
 impl Syscall {
     pub fn brk(new_addr: VirtAddr) -> Result<VirtAddr, SystemError> {
         // kdebug!("brk: new_addr={:?}", new_addr);
@@ -107,8 +145,9 @@ impl Syscall {
     /// - `len`：映射的长度
     /// - `prot`：保护标志
     /// - `flags`：映射标志
-    /// - `fd`：文件描述符（暂时不支持）
-    /// - `offset`：文件偏移量 （暂时不支持）
+    /// - `fd`：文件描述符。支持页面缓存的普通文件映射到页面缓存，其他文件需要实现
+    ///   [`crate::filesystem::vfs::IndexNode::mmap`]（例如packet socket的收发包环）
+    /// - `offset`：文件偏移量
     ///
     /// ## 返回值
     ///
@@ -118,8 +157,8 @@ impl Syscall {
         len: usize,
         prot_flags: usize,
         map_flags: usize,
-        _fd: i32,
-        _offset: usize,
+        fd: i32,
+        offset: usize,
     ) -> Result<usize, SystemError> {
         let map_flags = MapFlags::from_bits_truncate(map_flags as u64);
         let prot_flags = ProtFlags::from_bits_truncate(prot_flags as u64);
@@ -133,10 +172,36 @@ impl Syscall {
             );
             return Err(SystemError::EINVAL);
         }
-        // 暂时不支持除匿名页以外的映射
         if !map_flags.contains(MapFlags::MAP_ANONYMOUS) {
-            kerror!("mmap: not support file mapping");
-            return Err(SystemError::EOPNOTSUPP_OR_ENOTSUP);
+            let file = ProcessManager::current_pcb()
+                .fd_table()
+                .read()
+                .get_file_by_fd(fd)
+                .ok_or(SystemError::EBADF)?;
+            let (inode, mode) = {
+                let guard = file.lock();
+                (guard.inode(), guard.mode())
+            };
+            // 没有页面缓存的文件，映射交给文件自己完成
+            let cache = match inode.page_cache() {
+                Some(cache) => cache,
+                None => return inode.mmap(start_vaddr, len, prot_flags, map_flags, offset),
+            };
+            if mode.accmode() == FileMode::O_WRONLY.bits() {
+                return Err(SystemError::EACCES);
+            }
+            let may_write = mode.accmode() == FileMode::O_RDWR.bits();
+            let start_page = AddressSpace::current()?.write().map_file(
+                start_vaddr,
+                len,
+                prot_flags,
+                map_flags,
+                cache,
+                offset,
+                may_write,
+                true,
+            )?;
+            return Ok(start_page.virt_address().data());
         }
 
         // 暂时不支持巨页映射
@@ -221,4 +286,87 @@ impl Syscall {
             .map_err(|_| SystemError::EINVAL)?;
         return Ok(0);
     }
+
+    /// ## msync系统调用
+    ///
+    /// 共享文件映射的修改由flusher线程定期写回，`MS_SYNC`时立即写回范围内的脏页，
+    /// `MS_ASYNC`和`MS_INVALIDATE`不需要做任何事情
+    ///
+    /// ## 参数
+    ///
+    /// - `start_vaddr`：起始地址(已经对齐到页)
+    /// - `len`：长度(已经对齐到页)
+    /// - `flags`：标志，参见[`MsFlags`]
+    ///
+    /// ## Errors
+    ///
+    /// - `ENOMEM`：范围内有没有被映射的地址
+    pub fn msync(start_vaddr: VirtAddr, len: usize, flags: usize) -> Result<usize, SystemError> {
+        let flags = MsFlags::from_bits(flags).ok_or(SystemError::EINVAL)?;
+        if flags.contains(MsFlags::MS_ASYNC | MsFlags::MS_SYNC) {
+            return Err(SystemError::EINVAL);
+        }
+        if unlikely(verify_area(start_vaddr, len).is_err()) {
+            return Err(SystemError::ENOMEM);
+        }
+        if len == 0 {
+            return Ok(0);
+        }
+
+        // 找出范围内的共享文件映射，释放地址空间的锁之后再写回
+        let region = VirtRegion::new(start_vaddr, len);
+        let mut to_sync = Vec::new();
+        let current_address_space: Arc<AddressSpace> = AddressSpace::current()?;
+        let guard = current_address_space.read();
+        let mut covered = 0;
+        for vma in guard.mappings.conflicts(region) {
+            let vma = vma.lock();
+            let intersection = vma.region().intersect(&region).unwrap();
+            covered += intersection.size();
+            if let Some(file) = vma.file_mapping() {
+                to_sync.push((file.clone(), intersection));
+            }
+        }
+        drop(guard);
+        if covered != len {
+            return Err(SystemError::ENOMEM);
+        }
+
+        if flags.contains(MsFlags::MS_SYNC) {
+            for (file, r) in to_sync {
+                file.sync(r.start(), r.size())?;
+            }
+        }
+        return Ok(0);
+    }
+
+    /// ## madvise系统调用
+    ///
+    /// ## 参数
+    ///
+    /// - `start_vaddr`：起始地址(已经对齐到页)
+    /// - `len`：长度(已经对齐到页)
+    /// - `advice`：建议，参见[`MadvAdvice`]
+    pub fn madvise(start_vaddr: VirtAddr, len: usize, advice: usize) -> Result<usize, SystemError> {
+        assert!(start_vaddr.check_aligned(MMArch::PAGE_SIZE));
+        assert!(check_aligned(len, MMArch::PAGE_SIZE));
+
+        let advice =
+            <MadvAdvice as FromPrimitive>::from_usize(advice).ok_or(SystemError::EINVAL)?;
+        if unlikely(verify_area(start_vaddr, len).is_err()) {
+            return Err(SystemError::EINVAL);
+        }
+        if len == 0 {
+            return Ok(0);
+        }
+
+        let current_address_space: Arc<AddressSpace> = AddressSpace::current()?;
+        let start_frame = VirtPageFrame::new(start_vaddr);
+        let page_count = PageFrameCount::new(len / MMArch::PAGE_SIZE);
+
+        current_address_space
+            .write()
+            .madvise(start_frame, page_count, advice)?;
+        return Ok(0);
+    }
 }
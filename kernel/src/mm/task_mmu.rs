@@ -0,0 +1,288 @@
+//! 进程地址空间的统计信息：`/proc/<pid>/maps`、`smaps`、`statm`，以及`status`中的内存部分
+//!
+//! maps和smaps每个VMA一条记录，读取时按照起始地址的顺序遍历VMA。smaps还会遍历VMA中每一页的页表项，
+//! 按照页面的类型（匿名页、文件页）、被多少个页表项映射着以及是否被写入过分类统计。
+
+use core::fmt::Write;
+
+use alloc::{string::String, sync::Arc};
+
+use crate::{
+    arch::MMArch,
+    filesystem::vfs::{
+        seq_file::{SeqBuf, SeqOperations},
+        IndexNode,
+    },
+    process::ProcessControlBlock,
+    syscall::SystemError,
+};
+
+use super::{
+    page::{PageMapCount, ZeroPage},
+    rss::RssMember,
+    ucontext::{AddressSpace, InnerAddressSpace, VmFlags, VMA},
+    MemoryManagementArch, VirtAddr,
+};
+
+/// 计算PSS时使用的定点数的小数位数（与Linux相同）
+const PSS_SHIFT: usize = 12;
+
+#[inline(always)]
+fn pages_to_kb(pages: usize) -> usize {
+    return pages * (MMArch::PAGE_SIZE >> 10);
+}
+
+/// 一个VMA中的页面统计（单位：字节）
+#[derive(Debug, Default)]
+struct VmaUsage {
+    resident: usize,
+    /// 按照映射者数量均分后的常驻内存，左移了PSS_SHIFT位
+    pss: u64,
+    shared_clean: usize,
+    shared_dirty: usize,
+    private_clean: usize,
+    private_dirty: usize,
+    anonymous: usize,
+    swap: usize,
+}
+
+impl VmaUsage {
+    fn account(&mut self, mapcount: usize, dirty: bool, anon: bool) {
+        let size = MMArch::PAGE_SIZE;
+        self.resident += size;
+        if anon {
+            self.anonymous += size;
+        }
+        let mapcount = mapcount.max(1);
+        self.pss += ((size as u64) << PSS_SHIFT) / mapcount as u64;
+        match (mapcount > 1, dirty) {
+            (true, true) => self.shared_dirty += size,
+            (true, false) => self.shared_clean += size,
+            (false, true) => self.private_dirty += size,
+            (false, false) => self.private_clean += size,
+        }
+    }
+}
+
+/// 遍历VMA中的所有页表项，统计页面的使用情况
+fn vma_usage(space: &InnerAddressSpace, vma: &VMA) -> VmaUsage {
+    let mut usage = VmaUsage::default();
+    // 特殊映射中的页面不属于这个地址空间（与RSS计数一致）
+    if vma.vm_flags().contains(VmFlags::VM_SPECIAL) {
+        return usage;
+    }
+    let mapper = &space.user_mapper.utable;
+    let file = vma.file_mapping();
+    for page in vma.pages() {
+        let vaddr = page.virt_address();
+        let (paddr, flags) = match mapper.translate(vaddr) {
+            Some(x) => x,
+            None => {
+                if mapper.swap_entry(vaddr).is_some() {
+                    usage.swap += MMArch::PAGE_SIZE;
+                }
+                continue;
+            }
+        };
+        if ZeroPage::is_zero_page(paddr) {
+            continue;
+        }
+        match file.filter(|f| f.is_cache_page(vaddr, paddr)) {
+            Some(f) => usage.account(f.page_mapcount(vaddr), flags.has_dirty(), false),
+            None => usage.account(PageMapCount::get(paddr), flags.has_dirty(), true),
+        }
+    }
+    return usage;
+}
+
+/// 被映射的文件的名字（没有保存文件的路径，只能通过父目录查找文件名）
+fn file_name(inode: &Arc<dyn IndexNode>) -> Option<String> {
+    let ino = inode.metadata().ok()?.inode_id;
+    let parent = inode.find("..").ok()?;
+    return parent.get_entry_name(ino).ok();
+}
+
+/// 输出maps中的一行
+fn show_map_vma(space: &InnerAddressSpace, vma: &VMA, s: &mut SeqBuf) {
+    let region = vma.region();
+    let flags = vma.flags();
+    let file = vma.file_mapping();
+    let shared = file.is_some_and(|f| f.shared());
+    let (offset, ino) = match file {
+        Some(f) => (
+            f.file_offset(region.start()),
+            f.inode().metadata().map_or(0, |m| m.inode_id.data()),
+        ),
+        None => (0, 0),
+    };
+    write!(
+        s,
+        "{:08x}-{:08x} r{}{}{} {:08x} 00:00 {:<10}",
+        region.start().data(),
+        region.end().data(),
+        if flags.has_write() { 'w' } else { '-' },
+        if flags.has_execute() { 'x' } else { '-' },
+        if shared { 's' } else { 'p' },
+        offset,
+        ino
+    )
+    .ok();
+
+    let name = if let Some(f) = file {
+        file_name(f.inode())
+    } else if space.vdso_base.data() != 0 && region.start() == space.vdso_base {
+        Some(String::from("[vdso]"))
+    } else if space.vdso_base.data() != 0 && region.end() == space.vdso_base {
+        Some(String::from("[vvar]"))
+    } else if region.start() >= space.brk_start && region.end() <= space.brk {
+        Some(String::from("[heap]"))
+    } else if space.user_stack.as_ref().is_some_and(|stack| {
+        region.start() >= stack.lowest_address() && region.end() <= stack.stack_bottom()
+    }) {
+        Some(String::from("[stack]"))
+    } else {
+        None
+    };
+    if let Some(name) = name {
+        write!(s, " {}", name).ok();
+    }
+    s.push('\n');
+}
+
+/// 输出smaps中一个VMA的统计信息
+fn show_smap_vma(space: &InnerAddressSpace, vma: &VMA, s: &mut SeqBuf) {
+    let usage = vma_usage(space, vma);
+    writeln!(s, "Size:           {:8} kB", vma.region().size() >> 10).ok();
+    writeln!(s, "Rss:            {:8} kB", usage.resident >> 10).ok();
+    writeln!(s, "Pss:            {:8} kB", usage.pss >> (PSS_SHIFT + 10)).ok();
+    writeln!(s, "Shared_Clean:   {:8} kB", usage.shared_clean >> 10).ok();
+    writeln!(s, "Shared_Dirty:   {:8} kB", usage.shared_dirty >> 10).ok();
+    writeln!(s, "Private_Clean:  {:8} kB", usage.private_clean >> 10).ok();
+    writeln!(s, "Private_Dirty:  {:8} kB", usage.private_dirty >> 10).ok();
+    writeln!(s, "Anonymous:      {:8} kB", usage.anonymous >> 10).ok();
+    writeln!(s, "Swap:           {:8} kB", usage.swap >> 10).ok();
+}
+
+/// `/proc/<pid>/maps`和`/proc/<pid>/smaps`，每个VMA一条记录
+#[derive(Debug)]
+pub struct MapsSeq {
+    space: Option<Arc<AddressSpace>>,
+    /// 是否输出smaps中的详细统计
+    detail: bool,
+}
+
+impl MapsSeq {
+    pub fn new(pcb: &ProcessControlBlock, detail: bool) -> Self {
+        return Self {
+            space: pcb.basic().user_vm(),
+            detail,
+        };
+    }
+}
+
+impl SeqOperations for MapsSeq {
+    /// VMA的起始地址
+    type Cursor = VirtAddr;
+
+    fn start(&self, pos: usize) -> Option<VirtAddr> {
+        let space = self.space.as_ref()?.read();
+        let vma = space.mappings.iter_vmas().nth(pos)?;
+        let start = vma.lock().region().start();
+        return Some(start);
+    }
+
+    fn show(&self, cursor: &VirtAddr, s: &mut SeqBuf) -> Result<(), SystemError> {
+        let space = match self.space.as_ref() {
+            Some(space) => space.read(),
+            None => return Ok(()),
+        };
+        // 两次读取之间VMA可能已经被解除映射
+        let vma = match space.mappings.contains(*cursor) {
+            Some(vma) => vma,
+            None => return Ok(()),
+        };
+        let guard = vma.lock();
+        show_map_vma(&space, &guard, s);
+        if self.detail {
+            show_smap_vma(&space, &guard, s);
+        }
+        return Ok(());
+    }
+}
+
+/// 地址空间中所有VMA的大小，以及其中可写的私有映射（数据段、堆、栈）的大小（单位：页）
+fn vm_sizes(space: &InnerAddressSpace) -> (usize, usize) {
+    let mut total = 0;
+    let mut data = 0;
+    for vma in space.mappings.iter_vmas() {
+        let guard = vma.lock();
+        let pages = guard.region().size() / MMArch::PAGE_SIZE;
+        total += pages;
+        let shared = guard.file_mapping().is_some_and(|f| f.shared());
+        if guard.flags().has_write() && !shared {
+            data += pages;
+        }
+    }
+    return (total, data);
+}
+
+/// 生成`/proc/<pid>/statm`的内容（单位：页）
+///
+/// size resident shared text lib data dt，其中shared是映射着的文件页，lib和dt总是0
+pub fn statm_show(pcb: &ProcessControlBlock, s: &mut SeqBuf) -> Result<(), SystemError> {
+    let vm = match pcb.basic().user_vm() {
+        Some(vm) => vm,
+        None => {
+            writeln!(s, "0 0 0 0 0 0 0").ok();
+            return Ok(());
+        }
+    };
+    let space = vm.read();
+    let (total, data) = vm_sizes(&space);
+    let text = (space.end_code - space.start_code) / MMArch::PAGE_SIZE;
+    writeln!(
+        s,
+        "{} {} {} {} 0 {} 0",
+        total,
+        space.rss.rss(),
+        space.rss.get(RssMember::FilePages),
+        text,
+        data
+    )
+    .ok();
+    return Ok(());
+}
+
+/// 生成`/proc/<pid>/status`中内存相关的几行
+pub fn task_mem_show(space: &InnerAddressSpace, s: &mut SeqBuf) {
+    let (total, data) = vm_sizes(space);
+    let rss = &space.rss;
+    write!(s, "\nVmSize:\t{} kB", pages_to_kb(total)).ok();
+    write!(s, "\nVmHWM:\t{} kB", pages_to_kb(rss.hiwater_rss())).ok();
+    write!(s, "\nVmRSS:\t{} kB", pages_to_kb(rss.rss())).ok();
+    write!(
+        s,
+        "\nRssAnon:\t{} kB",
+        pages_to_kb(rss.get(RssMember::AnonPages))
+    )
+    .ok();
+    write!(
+        s,
+        "\nRssFile:\t{} kB",
+        pages_to_kb(rss.get(RssMember::FilePages))
+    )
+    .ok();
+    write!(s, "\nVmData:\t{} kB", pages_to_kb(data)).ok();
+    write!(
+        s,
+        "\nVmExe:\t{} kB",
+        (space.end_code - space.start_code) >> 10
+    )
+    .ok();
+    write!(
+        s,
+        "\nVmSwap:\t{} kB",
+        pages_to_kb(rss.get(RssMember::SwapEntries))
+    )
+    .ok();
+}
@@ -0,0 +1,266 @@
+//! 跨CPU的TLB shootdown
+//!
+//! 修改用户地址空间的页表之后，除了刷新当前CPU的TLB，还需要刷新所有正在使用这个地址空间的CPU的TLB。
+//! 每个地址空间通过[`TlbState`]记录它在哪些CPU上处于活跃状态，[`TlbShootdownFlusher`]
+//! 收集一批需要刷新的页面，在刷新时只向这些CPU各发送一次IPI，并等待它们完成刷新。
+
+use core::{
+    hint::spin_loop,
+    ptr::null_mut,
+    sync::atomic::{compiler_fence, AtomicPtr, AtomicU64, Ordering},
+};
+
+use alloc::sync::Arc;
+
+use crate::{
+    arch::{interrupt::ipi::send_ipi_mask, mm::pcid, CurrentIrqArch, MMArch},
+    exception::{ipi::IpiKind, InterruptArch},
+    libs::spinlock::SpinLock,
+    smp::{core::smp_get_processor_id, cpu::AtomicCpuMask},
+};
+
+use super::{
+    page::{Flusher, PageFlush},
+    MemoryManagementArch, VirtAddr,
+};
+
+/// 一次shootdown最多逐页刷新的页面数量，超过这个数量之后，改为刷新整个TLB
+pub const TLB_SHOOTDOWN_MAX_PAGES: usize = 32;
+
+/// 同一时刻只允许一个shootdown请求在进行中
+static SHOOTDOWN_LOCK: SpinLock<()> = SpinLock::new(());
+/// 正在进行中的shootdown请求（仅在持有SHOOTDOWN_LOCK时有效）
+static SHOOTDOWN_REQUEST: AtomicPtr<TlbFlushBatch> = AtomicPtr::new(null_mut());
+/// 还没有完成刷新的CPU
+static SHOOTDOWN_PENDING: AtomicCpuMask = AtomicCpuMask::new();
+
+/// 用于分配地址空间的id
+static NEXT_CTX_ID: AtomicU64 = AtomicU64::new(1);
+
+/// 地址空间的TLB状态
+#[derive(Debug)]
+pub struct TlbState {
+    /// 地址空间的id，在整个系统运行期间唯一
+    ctx_id: u64,
+    /// TLB代数。每次需要刷新这个地址空间的TLB时加1，
+    /// 使得不在掩码中、但仍然缓存着这个地址空间的TLB条目的CPU（例如通过PCID）能够发现自己的条目已经过期
+    tlb_gen: AtomicU64,
+    /// 当前正在使用这个地址空间的CPU
+    active_cpus: AtomicCpuMask,
+}
+
+impl TlbState {
+    pub fn new() -> Self {
+        return Self {
+            ctx_id: NEXT_CTX_ID.fetch_add(1, Ordering::Relaxed),
+            tlb_gen: AtomicU64::new(1),
+            active_cpus: AtomicCpuMask::new(),
+        };
+    }
+
+    #[inline(always)]
+    pub fn ctx_id(&self) -> u64 {
+        return self.ctx_id;
+    }
+
+    #[inline(always)]
+    pub fn tlb_gen(&self) -> u64 {
+        return self.tlb_gen.load(Ordering::SeqCst);
+    }
+
+    #[inline(always)]
+    pub fn active_cpus(&self) -> &AtomicCpuMask {
+        return &self.active_cpus;
+    }
+}
+
+/// 一批需要刷新的页面
+#[derive(Debug)]
+struct TlbFlushBatch {
+    pages: [VirtAddr; TLB_SHOOTDOWN_MAX_PAGES],
+    count: usize,
+    /// 需要刷新的页面过多，改为刷新整个TLB
+    full: bool,
+    /// 所属地址空间的id
+    ctx_id: u64,
+    /// 本次刷新之前的TLB代数
+    old_gen: u64,
+    /// 本次刷新之后的TLB代数
+    new_gen: u64,
+}
+
+impl TlbFlushBatch {
+    const fn new(ctx_id: u64) -> Self {
+        return Self {
+            pages: [VirtAddr::new(0); TLB_SHOOTDOWN_MAX_PAGES],
+            count: 0,
+            full: false,
+            ctx_id,
+            old_gen: 0,
+            new_gen: 0,
+        };
+    }
+
+    #[inline(always)]
+    fn push(&mut self, vaddr: VirtAddr) {
+        if self.full {
+            return;
+        }
+        if self.count == TLB_SHOOTDOWN_MAX_PAGES {
+            self.full = true;
+            return;
+        }
+        self.pages[self.count] = vaddr;
+        self.count += 1;
+    }
+
+    #[inline(always)]
+    fn is_empty(&self) -> bool {
+        return !self.full && self.count == 0;
+    }
+
+    /// 在当前CPU上执行刷新
+    ///
+    /// 调用者需要保证已经关闭了中断
+    fn flush_local(&self, cpu: usize) {
+        unsafe {
+            if self.full {
+                // 只涉及用户地址，因此只需要刷新当前PCID
+                pcid::flush_current_context();
+            } else {
+                for vaddr in self.pages[..self.count].iter() {
+                    MMArch::invalidate_page(*vaddr);
+                }
+            }
+            pcid::note_context_flushed(cpu, self.ctx_id, self.old_gen, self.new_gen);
+        }
+    }
+}
+
+/// 刷新用户地址空间的刷新器
+///
+/// 它会收集被consume的页面，并在drop时：
+/// - 如果当前CPU正在使用这个地址空间，则刷新当前CPU的TLB
+/// - 向其他正在使用这个地址空间的CPU各发送一次IPI，并等待它们完成刷新
+#[derive(Debug)]
+pub struct TlbShootdownFlusher {
+    state: Arc<TlbState>,
+    batch: TlbFlushBatch,
+}
+
+impl TlbShootdownFlusher {
+    pub fn new(state: Arc<TlbState>) -> Self {
+        let ctx_id = state.ctx_id();
+        return Self {
+            state,
+            batch: TlbFlushBatch::new(ctx_id),
+        };
+    }
+
+    /// 要求刷新整个TLB
+    pub fn flush_all(&mut self) {
+        self.batch.full = true;
+    }
+}
+
+impl Flusher<MMArch> for TlbShootdownFlusher {
+    fn consume(&mut self, flush: PageFlush<MMArch>) {
+        self.batch.push(flush.virt());
+        unsafe { flush.ignore() };
+    }
+}
+
+impl Drop for TlbShootdownFlusher {
+    fn drop(&mut self) {
+        if self.batch.is_empty() {
+            return;
+        }
+
+        let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+        // 页表已经修改完毕，先增加TLB代数，再读取掩码。
+        // 这样，在此之后才加入掩码的CPU一定能看到新的代数
+        let old_gen = self.state.tlb_gen.fetch_add(1, Ordering::SeqCst);
+        self.batch.old_gen = old_gen;
+        self.batch.new_gen = old_gen + 1;
+
+        let cpu = smp_get_processor_id() as usize;
+        let mask = self.state.active_cpus();
+        if mask.get(cpu) {
+            self.batch.flush_local(cpu);
+        }
+
+        if mask.iter().any(|c| c != cpu) {
+            shootdown(mask, cpu, &mut self.batch);
+        }
+        drop(irq_guard);
+    }
+}
+
+/// 向mask中除了当前CPU以外的所有CPU发送刷新请求，并等待它们完成刷新
+///
+/// 调用者需要保证已经关闭了中断
+fn shootdown(mask: &AtomicCpuMask, current_cpu: usize, batch: &mut TlbFlushBatch) {
+    // 等待其他CPU的shootdown完成。等待的过程中，其他CPU可能正在等待当前CPU完成刷新，
+    // 因此需要处理发给当前CPU的请求，以免死锁
+    let guard = loop {
+        if let Ok(guard) = SHOOTDOWN_LOCK.try_lock() {
+            break guard;
+        }
+        handle_pending_shootdown(current_cpu);
+        spin_loop();
+    };
+
+    SHOOTDOWN_REQUEST.store(batch as *mut TlbFlushBatch, Ordering::SeqCst);
+    let mut targets = mask.words();
+    targets[current_cpu / 64] &= !(1 << (current_cpu % 64));
+    SHOOTDOWN_PENDING.store_words(&targets);
+    send_ipi_mask(IpiKind::FlushTLB, &targets);
+
+    while !SHOOTDOWN_PENDING.is_empty() {
+        spin_loop();
+    }
+    SHOOTDOWN_REQUEST.store(null_mut(), Ordering::SeqCst);
+    compiler_fence(Ordering::SeqCst);
+    drop(guard);
+}
+
+/// 如果有发给当前CPU的shootdown请求，则执行刷新
+///
+/// ## 返回值
+///
+/// 如果处理了请求，返回true
+fn handle_pending_shootdown(cpu: usize) -> bool {
+    if !SHOOTDOWN_PENDING.get(cpu) {
+        return false;
+    }
+    let req = SHOOTDOWN_REQUEST.load(Ordering::SeqCst);
+    if let Some(req) = unsafe { req.as_ref() } {
+        req.flush_local(cpu);
+    } else {
+        flush_unknown_context(cpu);
+    }
+    SHOOTDOWN_PENDING.clear(cpu);
+    return true;
+}
+
+/// TLB刷新IPI的处理函数（由C语言的IPI处理函数调用）
+#[no_mangle]
+pub extern "C" fn rs_tlb_shootdown_ipi_handler() {
+    let cpu = smp_get_processor_id() as usize;
+    if !handle_pending_shootdown(cpu) {
+        // 不是通过shootdown发来的刷新请求（例如InactiveFlusher）
+        flush_unknown_context(cpu);
+    }
+}
+
+/// 不知道是哪个地址空间需要刷新时，刷新当前PCID，并且让当前CPU上其他PCID在下次切换时被刷新
+///
+/// 只影响当前CPU，不会像修改内核映射那样使所有CPU上的PCID失效
+fn flush_unknown_context(cpu: usize) {
+    let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+    unsafe {
+        MMArch::invalidate_all();
+        pcid::forget_contexts(cpu);
+    }
+    drop(irq_guard);
+}
@@ -5,7 +5,7 @@ use core::{
     hash::Hasher,
     intrinsics::unlikely,
     ops::Add,
-    sync::atomic::{compiler_fence, Ordering},
+    sync::atomic::{compiler_fence, AtomicU32, Ordering},
 };
 
 use alloc::{
@@ -13,27 +13,39 @@ use alloc::{
     sync::{Arc, Weak},
     vec::Vec,
 };
-use hashbrown::HashSet;
 
 use crate::{
-    arch::{mm::PageMapper, CurrentIrqArch, MMArch},
+    arch::{
+        mm::{pcid, PageMapper},
+        CurrentIrqArch, MMArch,
+    },
     exception::InterruptArch,
+    filesystem::vfs::page_cache::{FileMapping, PageCache},
     libs::{
         align::page_align_up,
-        rwlock::{RwLock, RwLockWriteGuard},
+        rwlock::RwLock,
         spinlock::{SpinLock, SpinLockGuard},
     },
     process::ProcessManager,
+    smp::{core::smp_get_processor_id, cpu::AtomicCpuMask},
     syscall::SystemError,
 };
 
 use super::{
-    allocator::page_frame::{
-        deallocate_page_frames, PageFrameCount, PhysPageFrame, VirtPageFrame, VirtPageFrameIter,
+    allocator::{
+        page_frame::{
+            deallocate_page_frames, PageFrameCount, PhysPageFrame, VirtPageFrame, VirtPageFrameIter,
+        },
+        zeroed_pool::allocate_zeroed_page,
     },
-    page::{Flusher, InactiveFlusher, PageFlags, PageFlushAll},
-    syscall::{MapFlags, ProtFlags},
-    MemoryManagementArch, PageTableKind, VirtAddr, VirtRegion,
+    fault::PageFaultHandler,
+    lru::lru_del,
+    page::{Flusher, PageFlags, PageMapCount, ZeroPage},
+    rss::{RssMember, RssStat},
+    syscall::{MadvAdvice, MapFlags, ProtFlags},
+    tlb::{TlbShootdownFlusher, TlbState},
+    zram::{zram_dup, zram_free},
+    MemoryManagementArch, PageTableKind, PhysAddr, VirtAddr, VirtRegion,
 };
 
 /// MMAP_MIN_ADDR的默认值
@@ -52,17 +64,70 @@ pub const DEFAULT_MMAP_MIN_ADDR: usize = 65536;
 #[derive(Debug)]
 pub struct AddressSpace {
     inner: RwLock<InnerAddressSpace>,
+    /// 用户页表的顶级页表的物理地址（在地址空间的生命周期内不会改变）
+    table_paddr: PhysAddr,
+    /// 地址空间的TLB状态（与InnerAddressSpace共享，使得切换地址空间时不需要获取锁）
+    tlb_state: Arc<TlbState>,
+    /// 已经注册的membarrier命令，见[`crate::sched::membarrier`]
+    membarrier_state: AtomicU32,
 }
 
 impl AddressSpace {
     pub fn new(create_stack: bool) -> Result<Arc<Self>, SystemError> {
         let inner = InnerAddressSpace::new(create_stack)?;
+        let table_paddr = inner.user_mapper.utable.table().phys();
+        let tlb_state = inner.tlb_state.clone();
         let result = Self {
             inner: RwLock::new(inner),
+            table_paddr,
+            tlb_state,
+            membarrier_state: AtomicU32::new(0),
         };
         return Ok(Arc::new(result));
     }
 
+    /// 在当前CPU上切换到这个地址空间
+    ///
+    /// 这个函数不会获取地址空间的锁，因此可以在进程切换的过程中调用。
+    ///
+    /// ## 参数
+    ///
+    /// - `prev`：当前CPU上原本使用的地址空间
+    ///
+    /// ## Safety
+    ///
+    /// 调用者需要保证已经关闭了中断
+    pub unsafe fn activate(&self, prev: Option<&AddressSpace>) {
+        let cpu = smp_get_processor_id() as usize;
+        // 先加入掩码，再加载页表，保证在此之后对页表的修改都会通知到当前CPU
+        self.tlb_state.active_cpus().set(cpu);
+        compiler_fence(Ordering::SeqCst);
+        // 如果这个地址空间在当前CPU上还有有效的PCID，则切换时不会刷新TLB
+        pcid::switch_user_table(cpu, self.table_paddr, &self.tlb_state);
+        compiler_fence(Ordering::SeqCst);
+        if let Some(prev) = prev {
+            if !core::ptr::eq(prev, self) {
+                prev.tlb_state.active_cpus().clear(cpu);
+            }
+        }
+    }
+
+    /// 正在使用这个地址空间的cpu
+    #[inline(always)]
+    pub fn active_cpus(&self) -> &AtomicCpuMask {
+        return self.tlb_state.active_cpus();
+    }
+
+    /// 已经注册的membarrier命令
+    #[inline(always)]
+    pub fn membarrier_registrations(&self) -> u32 {
+        return self.membarrier_state.load(Ordering::Relaxed);
+    }
+
+    pub fn membarrier_register(&self, cmd: u32) {
+        self.membarrier_state.fetch_or(cmd, Ordering::SeqCst);
+    }
+
     /// 从pcb中获取当前进程的地址空间结构体的Arc指针
     pub fn current() -> Result<Arc<AddressSpace>, SystemError> {
         let vm = ProcessManager::current_pcb()
@@ -118,6 +183,15 @@ pub struct InnerAddressSpace {
     pub end_code: VirtAddr,
     pub start_data: VirtAddr,
     pub end_data: VirtAddr,
+
+    /// vDSO镜像的起始地址，没有映射vDSO时为0
+    pub vdso_base: VirtAddr,
+
+    /// 地址空间的TLB状态，用于向正在使用这个地址空间的CPU发送TLB shootdown
+    pub tlb_state: Arc<TlbState>,
+
+    /// 常驻内存统计
+    pub rss: RssStat,
 }
 
 impl InnerAddressSpace {
@@ -135,6 +209,9 @@ impl InnerAddressSpace {
             end_code: VirtAddr(0),
             start_data: VirtAddr(0),
             end_data: VirtAddr(0),
+            vdso_base: VirtAddr(0),
+            tlb_state: Arc::new(TlbState::new()),
+            rss: RssStat::new(),
         };
         if create_stack {
             // kdebug!("to create user stack.");
@@ -158,67 +235,83 @@ impl InnerAddressSpace {
         unsafe {
             new_guard.user_stack = Some(self.user_stack.as_ref().unwrap().clone_info_only());
         }
-        let _current_stack_size = self.user_stack.as_ref().unwrap().stack_size();
-
-        let current_mapper = &mut self.user_mapper.utable;
 
         // 拷贝空洞
         new_guard.mappings.vm_holes = self.mappings.vm_holes.clone();
+        new_guard.vdso_base = self.vdso_base;
 
-        for vma in self.mappings.vmas.iter() {
-            // TODO: 增加对VMA是否为文件映射的判断，如果是的话，就跳过
+        // 父进程的页表项会被修改为只读，因此需要刷新所有正在使用父进程地址空间的cpu上的TLB
+        let mut parent_flusher = self.tlb_flusher();
 
+        // 写时复制：子进程的页表项与父进程共享同一个物理页，并且都被设置为只读。
+        // 当任意一方写入时，再通过缺页异常复制物理页。
+        for vma in self.mappings.iter_vmas() {
             let vma_guard: SpinLockGuard<'_, VMA> = vma.lock();
-            let old_flags = vma_guard.flags();
-            let tmp_flags: PageFlags<MMArch> = PageFlags::new().set_write(true);
-
-            // 分配内存页并创建新的VMA
-            let new_vma = VMA::zeroed(
-                VirtPageFrame::new(vma_guard.region.start()),
-                PageFrameCount::new(vma_guard.region.size() / MMArch::PAGE_SIZE),
-                tmp_flags,
-                &mut new_guard.user_mapper.utable,
-                (),
-            )?;
-            new_guard.mappings.vmas.insert(new_vma.clone());
-            // kdebug!("new vma: {:x?}", new_vma);
-            let mut new_vma_guard = new_vma.lock();
-            for page in new_vma_guard.pages().map(|p| p.virt_address()) {
-                // kdebug!("page: {:x?}", page);
-                let current_frame = unsafe {
-                    MMArch::phys_2_virt(
-                        current_mapper
-                            .translate(page)
-                            .expect("VMA page not mapped")
-                            .0,
-                    )
+            let mut new_vma: VMA = unsafe { vma_guard.clone() };
+            new_vma.user_address_space = Some(Arc::downgrade(&new_addr_space));
+            let special = vma_guard.vm_flags().contains(VmFlags::VM_SPECIAL);
+            let file = vma_guard.file_mapping().cloned();
+            for page in vma_guard.pages().map(|p| p.virt_address()) {
+                let (paddr, flags) = match self.user_mapper.utable.translate(page) {
+                    Some(x) => x,
+                    None => {
+                        // 被换出的页面：子进程的页表项引用同一个交换条目
+                        if let Some(entry) = self.user_mapper.utable.swap_entry(page) {
+                            unsafe { new_guard.user_mapper.utable.set_swap_entry(page, entry) }
+                                .ok_or(SystemError::ENOMEM)?;
+                            zram_dup(entry);
+                            new_guard.rss.inc(RssMember::SwapEntries);
+                        }
+                        continue;
+                    }
+                };
+                // 共享的特殊页（只读）：直接映射同一个物理页
+                if special {
+                    let r = unsafe { new_guard.user_mapper.utable.map_phys(page, paddr, flags) }
+                        .ok_or(SystemError::ENOMEM)?;
+                    unsafe { r.ignore() };
+                    continue;
+                }
+                // 文件映射的缓存页：共享映射中父子进程共享同一个页，私有映射中它本来就是只读的
+                if let Some(file) = file.as_ref().filter(|f| f.is_cache_page(page, paddr)) {
+                    let r = unsafe { new_guard.user_mapper.utable.map_phys(page, paddr, flags) }
+                        .ok_or(SystemError::ENOMEM)?;
+                    unsafe { r.ignore() };
+                    file.dup_page(page);
+                    new_guard.rss.inc(RssMember::FilePages);
+                    continue;
                 }
-                .expect("Phys2Virt: vaddr overflow.")
-                .data() as *mut u8;
-
-                let new_frame = unsafe {
-                    MMArch::phys_2_virt(
-                        new_guard
-                            .user_mapper
-                            .utable
-                            .translate(page)
-                            .expect("VMA page not mapped")
-                            .0,
-                    )
+                let cow_flags = flags.set_write(false);
+                if flags.has_write() {
+                    let r = unsafe { self.user_mapper.utable.remap(page, cow_flags) }
+                        .expect("Failed to remap parent page as read-only");
+                    parent_flusher.consume(r);
                 }
-                .expect("Phys2Virt: vaddr overflow.")
-                .data() as *mut u8;
 
-                unsafe {
-                    // 拷贝数据
-                    new_frame.copy_from_nonoverlapping(current_frame, MMArch::PAGE_SIZE);
+                let r = unsafe {
+                    new_guard
+                        .user_mapper
+                        .utable
+                        .map_phys(page, paddr, cow_flags)
+                }
+                .ok_or(SystemError::ENOMEM)?;
+                // 新的地址空间还没有被加载，不需要刷新TLB
+                unsafe { r.ignore() };
+                // 零页不记录映射计数，也不计入RSS
+                if !ZeroPage::is_zero_page(paddr) {
+                    PageMapCount::inc(paddr);
+                    new_guard.rss.inc(RssMember::AnonPages);
                 }
             }
             drop(vma_guard);
 
-            new_vma_guard.remap(old_flags, &mut new_guard.user_mapper.utable, ())?;
-            drop(new_vma_guard);
+            let start = new_vma.region.start();
+            new_guard
+                .mappings
+                .vmas
+                .insert(start, LockedVMA::new(new_vma));
         }
+        drop(parent_flusher);
         drop(new_guard);
         drop(irq_guard);
         return Ok(new_addr_space);
@@ -230,6 +323,12 @@ impl InnerAddressSpace {
         return self.user_mapper.utable.is_current();
     }
 
+    /// 创建一个刷新器，用于刷新所有正在使用这个地址空间的CPU上的TLB
+    #[inline]
+    pub fn tlb_flusher(&self) -> TlbShootdownFlusher {
+        return TlbShootdownFlusher::new(self.tlb_state.clone());
+    }
+
     /// 进行匿名页映射
     ///
     /// ## 参数
@@ -237,7 +336,7 @@ impl InnerAddressSpace {
     /// - `start_vaddr`：映射的起始地址
     /// - `len`：映射的长度
     /// - `prot_flags`：保护标志
-    /// - `map_flags`：映射标志
+    /// - `map_flags`：映射标志。如果包含`MAP_POPULATE`，则立即分配并清零所有物理页，否则在缺页异常时才分配
     /// - `round_to_min`：是否将`start_vaddr`对齐到`mmap_min`，如果为`true`，则当`start_vaddr`不为0时，会对齐到`mmap_min`，否则仅向下对齐到页边界
     ///
     /// ## 返回
@@ -251,20 +350,6 @@ impl InnerAddressSpace {
         map_flags: MapFlags,
         round_to_min: bool,
     ) -> Result<VirtPageFrame, SystemError> {
-        // 用于对齐hint的函数
-        let round_hint_to_min = |hint: VirtAddr| {
-            // 先把hint向下对齐到页边界
-            let addr = hint.data() & (!MMArch::PAGE_OFFSET_MASK);
-            // kdebug!("map_anonymous: hint = {:?}, addr = {addr:#x}", hint);
-            // 如果hint不是0，且hint小于DEFAULT_MMAP_MIN_ADDR，则对齐到DEFAULT_MMAP_MIN_ADDR
-            if (addr != 0) && round_to_min && (addr < DEFAULT_MMAP_MIN_ADDR) {
-                Some(VirtAddr::new(page_align_up(DEFAULT_MMAP_MIN_ADDR)))
-            } else if addr == 0 {
-                None
-            } else {
-                Some(VirtAddr::new(addr))
-            }
-        };
         // kdebug!("map_anonymous: start_vaddr = {:?}", start_vaddr);
         // kdebug!("map_anonymous: len(no align) = {}", len);
 
@@ -272,19 +357,136 @@ impl InnerAddressSpace {
 
         // kdebug!("map_anonymous: len = {}", len);
 
+        let page_count = PageFrameCount::from_bytes(len).unwrap();
         let start_page: VirtPageFrame = self.mmap(
-            round_hint_to_min(start_vaddr),
-            PageFrameCount::from_bytes(len).unwrap(),
+            Self::round_hint(start_vaddr, round_to_min),
+            page_count,
             prot_flags,
             map_flags,
             move |page, count, flags, mapper, flusher| {
-                Ok(VMA::zeroed(page, count, flags, mapper, flusher)?)
+                if map_flags.contains(MapFlags::MAP_POPULATE) {
+                    Ok(VMA::zeroed(page, count, flags, mapper, flusher)?)
+                } else {
+                    // 只建立VMA，物理页在缺页异常时才分配
+                    Ok(VMA::lazy(page, count, flags))
+                }
+            },
+        )?;
+        if map_flags.contains(MapFlags::MAP_POPULATE) {
+            self.rss
+                .add(RssMember::AnonPages, page_count.data() as isize);
+        }
+
+        return Ok(start_page);
+    }
+
+    /// 对齐用户指定的映射地址
+    ///
+    /// 先把hint向下对齐到页边界。如果`round_to_min`为`true`，且hint不是0，但是小于`DEFAULT_MMAP_MIN_ADDR`，
+    /// 则对齐到`DEFAULT_MMAP_MIN_ADDR`。hint为0时返回None，由内核自动分配地址
+    fn round_hint(hint: VirtAddr, round_to_min: bool) -> Option<VirtAddr> {
+        let addr = hint.data() & (!MMArch::PAGE_OFFSET_MASK);
+        if (addr != 0) && round_to_min && (addr < DEFAULT_MMAP_MIN_ADDR) {
+            Some(VirtAddr::new(page_align_up(DEFAULT_MMAP_MIN_ADDR)))
+        } else if addr == 0 {
+            None
+        } else {
+            Some(VirtAddr::new(addr))
+        }
+    }
+
+    /// 进行文件映射
+    ///
+    /// ## 参数
+    ///
+    /// - `start_vaddr`：映射的起始地址
+    /// - `len`：映射的长度
+    /// - `prot_flags`：保护标志
+    /// - `map_flags`：映射标志。如果包含`MAP_POPULATE`，则立即读入文件内容并建立映射（文件末尾之后的页面除外），
+    ///   否则在缺页异常时才映射
+    /// - `cache`：文件的页面缓存
+    /// - `offset`：映射从文件中的哪个偏移量开始，需要对齐到页
+    /// - `may_write`：文件是否以可写的方式打开。只读打开的文件不能被可写地共享映射
+    /// - `round_to_min`：与[`InnerAddressSpace::map_anonymous`]相同
+    ///
+    /// ## 返回
+    ///
+    /// 返回映射的起始虚拟页帧
+    #[allow(clippy::too_many_arguments)]
+    pub fn map_file(
+        &mut self,
+        start_vaddr: VirtAddr,
+        len: usize,
+        prot_flags: ProtFlags,
+        map_flags: MapFlags,
+        cache: Arc<PageCache>,
+        offset: usize,
+        may_write: bool,
+        round_to_min: bool,
+    ) -> Result<VirtPageFrame, SystemError> {
+        if offset & MMArch::PAGE_OFFSET_MASK != 0 {
+            return Err(SystemError::EINVAL);
+        }
+        let shared = map_flags.contains(MapFlags::MAP_SHARED);
+        if shared && prot_flags.contains(ProtFlags::PROT_WRITE) && !may_write {
+            return Err(SystemError::EACCES);
+        }
+        let len = page_align_up(len);
+        let page_count = PageFrameCount::from_bytes(len).ok_or(SystemError::EINVAL)?;
+
+        let mut file: Option<Arc<FileMapping>> = None;
+        let start_page = self.mmap(
+            Self::round_hint(start_vaddr, round_to_min),
+            page_count,
+            prot_flags,
+            map_flags,
+            |page, count, flags, _mapper, _flusher| {
+                let mapping = FileMapping::new(
+                    cache,
+                    page.virt_address(),
+                    offset >> MMArch::PAGE_SHIFT,
+                    shared,
+                    may_write,
+                )?;
+                file = Some(mapping.clone());
+                Ok(VMA::file(page, count, flags, mapping))
             },
         )?;
 
+        if map_flags.contains(MapFlags::MAP_POPULATE) {
+            let file = file.unwrap();
+            if let Err(e) = self.populate_file(&file, start_page, len) {
+                self.munmap(start_page, page_count).ok();
+                return Err(e);
+            }
+        }
         return Ok(start_page);
     }
 
+    /// 读入文件映射中从`start_page`开始的`len`字节，并只读地映射它们（MAP_POPULATE）
+    fn populate_file(
+        &mut self,
+        file: &FileMapping,
+        start_page: VirtPageFrame,
+        len: usize,
+    ) -> Result<(), SystemError> {
+        let vma = self
+            .mappings
+            .contains(start_page.virt_address())
+            .ok_or(SystemError::EFAULT)?;
+        let vma_flags = vma.lock().flags();
+        file.prefetch(start_page.virt_address(), len)?;
+        for page in VirtRegion::new(start_page.virt_address(), len).pages() {
+            match PageFaultHandler::do_file_read_page(self, file, page.virt_address(), vma_flags) {
+                Ok(()) => {}
+                // 文件末尾之后的页面，在访问时才会失败
+                Err(SystemError::EFAULT) => break,
+                Err(e) => return Err(e),
+            }
+        }
+        return Ok(());
+    }
+
     /// 向进程的地址空间映射页面
     ///
     /// # 参数
@@ -340,14 +542,7 @@ impl InnerAddressSpace {
         // kdebug!("mmap: page: {:?}, region={region:?}", page.virt_address());
 
         compiler_fence(Ordering::SeqCst);
-        let (mut active, mut inactive);
-        let flusher = if self.is_current() {
-            active = PageFlushAll::new();
-            &mut active as &mut dyn Flusher<MMArch>
-        } else {
-            inactive = InactiveFlusher::new();
-            &mut inactive as &mut dyn Flusher<MMArch>
-        };
+        let mut flusher = self.tlb_flusher();
         compiler_fence(Ordering::SeqCst);
         // 映射页面，并将VMA插入到地址空间的VMA列表中
         self.mappings.insert_vma(map_func(
@@ -355,7 +550,7 @@ impl InnerAddressSpace {
             page_count,
             PageFlags::from_prot_flags(prot_flags, true),
             &mut self.user_mapper.utable,
-            flusher,
+            &mut flusher,
         )?);
 
         return Ok(page);
@@ -378,7 +573,7 @@ impl InnerAddressSpace {
         page_count: PageFrameCount,
     ) -> Result<(), SystemError> {
         let to_unmap = VirtRegion::new(start_page.virt_address(), page_count.bytes());
-        let mut flusher: PageFlushAll<MMArch> = PageFlushAll::new();
+        let mut flusher = self.tlb_flusher();
 
         let regions: Vec<Arc<LockedVMA>> = self.mappings.conflicts(to_unmap).collect::<Vec<_>>();
 
@@ -388,8 +583,6 @@ impl InnerAddressSpace {
             let intersection = r.lock().region().intersect(&to_unmap).unwrap();
             let (before, r, after) = r.extract(intersection).unwrap();
 
-            // TODO: 当引入后备页映射后，这里需要增加通知文件的逻辑
-
             if let Some(before) = before {
                 // 如果前面有VMA，则需要将前面的VMA重新插入到地址空间的VMA列表中
                 self.mappings.insert_vma(before);
@@ -400,11 +593,9 @@ impl InnerAddressSpace {
                 self.mappings.insert_vma(after);
             }
 
-            r.unmap(&mut self.user_mapper.utable, &mut flusher);
+            r.unmap(&mut self.user_mapper.utable, &self.rss, &mut flusher);
         }
 
-        // TODO: 当引入后备页映射后，这里需要增加通知文件的逻辑
-
         return Ok(());
     }
 
@@ -419,14 +610,7 @@ impl InnerAddressSpace {
         //     start_page,
         //     page_count
         // );
-        let (mut active, mut inactive);
-        let mut flusher = if self.is_current() {
-            active = PageFlushAll::new();
-            &mut active as &mut dyn Flusher<MMArch>
-        } else {
-            inactive = InactiveFlusher::new();
-            &mut inactive as &mut dyn Flusher<MMArch>
-        };
+        let mut flusher = self.tlb_flusher();
 
         let mapper = &mut self.user_mapper.utable;
         let region = VirtRegion::new(start_page.virt_address(), page_count.bytes());
@@ -471,6 +655,178 @@ impl InnerAddressSpace {
         return Ok(());
     }
 
+    /// 处理用户对一段地址范围的使用建议
+    ///
+    /// ## 参数
+    ///
+    /// - `start_page`：起始页帧
+    /// - `page_count`：页帧数量
+    /// - `advice`：建议
+    ///
+    /// ## Errors
+    ///
+    /// - `ENOMEM`：地址范围内没有任何映射
+    pub fn madvise(
+        &mut self,
+        start_page: VirtPageFrame,
+        page_count: PageFrameCount,
+        advice: MadvAdvice,
+    ) -> Result<(), SystemError> {
+        let region = VirtRegion::new(start_page.virt_address(), page_count.bytes());
+        let regions = self.mappings.conflicts(region).collect::<Vec<_>>();
+        if regions.is_empty() {
+            return Err(SystemError::ENOMEM);
+        }
+
+        match advice {
+            MadvAdvice::Normal | MadvAdvice::Random | MadvAdvice::Sequential => {}
+            MadvAdvice::DontNeed | MadvAdvice::Free => {
+                self.madvise_dontneed(&regions, &region);
+            }
+            MadvAdvice::WillNeed => {
+                self.madvise_willneed(&regions, &region)?;
+            }
+            MadvAdvice::HugePage | MadvAdvice::NoHugePage => {
+                let (set, clear) = if advice == MadvAdvice::HugePage {
+                    (VmFlags::VM_HUGEPAGE, VmFlags::VM_NOHUGEPAGE)
+                } else {
+                    (VmFlags::VM_NOHUGEPAGE, VmFlags::VM_HUGEPAGE)
+                };
+                // 建议只作用于指定的范围，因此需要在范围的边界处切分VMA
+                for r in regions {
+                    let r = r.lock().region;
+                    let r = self.mappings.remove_vma(&r).unwrap();
+                    let intersection = r.lock().region().intersect(&region).unwrap();
+                    let (before, r, after) =
+                        r.extract(intersection).expect("Failed to extract VMA");
+
+                    if let Some(before) = before {
+                        self.mappings.insert_vma(before);
+                    }
+                    if let Some(after) = after {
+                        self.mappings.insert_vma(after);
+                    }
+
+                    let mut r_guard = r.lock();
+                    let vm_flags = (r_guard.vm_flags() - clear) | set;
+                    r_guard.set_vm_flags(vm_flags);
+                    drop(r_guard);
+                    self.mappings.insert_vma(r);
+                }
+            }
+        }
+
+        return Ok(());
+    }
+
+    /// MADV_DONTNEED：释放范围内的物理页，并清除页表项，再次访问时会在缺页异常中得到清零的页
+    /// （文件映射再次访问时得到文件的内容）
+    fn madvise_dontneed(&mut self, vmas: &[Arc<LockedVMA>], region: &VirtRegion) {
+        let mut flusher = self.tlb_flusher();
+        let mapper = &mut self.user_mapper.utable;
+        let rss = &self.rss;
+        let mut to_free: Vec<PhysAddr> = Vec::new();
+
+        for vma in vmas {
+            let guard = vma.lock();
+            if guard.vm_flags().contains(VmFlags::VM_SPECIAL) {
+                continue;
+            }
+            let intersection = match guard.region().intersect(region) {
+                Some(x) => x,
+                None => continue,
+            };
+            let file = guard.file_mapping().cloned();
+            drop(guard);
+            for page in intersection.pages() {
+                if let Some(entry) = unsafe { mapper.take_swap_entry(page.virt_address()) } {
+                    zram_free(entry);
+                    rss.dec(RssMember::SwapEntries);
+                    continue;
+                }
+                let (paddr, _, flush) =
+                    match unsafe { mapper.unmap_phys(page.virt_address(), false) } {
+                        Some(x) => x,
+                        None => continue,
+                    };
+                flusher.consume(flush);
+                if file
+                    .as_ref()
+                    .is_some_and(|f| f.unmap_page(page.virt_address(), paddr))
+                {
+                    rss.dec(RssMember::FilePages);
+                    continue;
+                }
+                if ZeroPage::is_zero_page(paddr) {
+                    continue;
+                }
+                rss.dec(RssMember::AnonPages);
+                if PageMapCount::dec(paddr) == 0 {
+                    lru_del(paddr);
+                    to_free.push(paddr);
+                }
+            }
+        }
+
+        // 其他cpu上的TLB可能还引用着这些物理页，因此需要在刷新TLB之后再释放它们
+        drop(flusher);
+        for paddr in to_free {
+            unsafe { deallocate_page_frames(PhysPageFrame::new(paddr), PageFrameCount::new(1)) };
+        }
+    }
+
+    /// MADV_WILLNEED：为范围内还没有物理页的页面，预先分配清零的物理页并建立映射。
+    /// 文件映射只是异步地把文件内容读入页面缓存，页面仍然在缺页时映射
+    fn madvise_willneed(
+        &mut self,
+        vmas: &[Arc<LockedVMA>],
+        region: &VirtRegion,
+    ) -> Result<(), SystemError> {
+        let mapper = &mut self.user_mapper.utable;
+
+        for vma in vmas {
+            let guard = vma.lock();
+            let intersection = match guard.region().intersect(region) {
+                Some(x) => x,
+                None => continue,
+            };
+            let flags = guard.flags();
+            let file = guard.file_mapping().cloned();
+            drop(guard);
+
+            if let Some(file) = file {
+                file.willneed(intersection.start(), intersection.size())?;
+                continue;
+            }
+            for page in intersection.pages() {
+                // 已经映射的页面，以及被换出的页面（会在访问时换入）
+                if mapper.translate(page.virt_address()).is_some()
+                    || mapper.swap_entry(page.virt_address()).is_some()
+                {
+                    continue;
+                }
+                let paddr = unsafe { allocate_zeroed_page() }.ok_or(SystemError::ENOMEM)?;
+                match unsafe { mapper.map_phys(page.virt_address(), paddr, flags) } {
+                    // 原本没有映射，其他cpu上不会有对应的TLB项
+                    Some(flush) => {
+                        flush.flush();
+                        self.rss.inc(RssMember::AnonPages);
+                    }
+                    None => {
+                        unsafe {
+                            deallocate_page_frames(
+                                PhysPageFrame::new(paddr),
+                                PageFrameCount::new(1),
+                            )
+                        };
+                        return Err(SystemError::ENOMEM);
+                    }
+                }
+            }
+        }
+        return Ok(());
+    }
+
     /// 创建新的用户栈
     ///
     /// ## 参数
@@ -490,9 +846,9 @@ impl InnerAddressSpace {
 
     /// 取消用户空间内的所有映射
     pub unsafe fn unmap_all(&mut self) {
-        let mut flusher: PageFlushAll<MMArch> = PageFlushAll::new();
+        let mut flusher = self.tlb_flusher();
         for vma in self.mappings.iter_vmas() {
-            vma.unmap(&mut self.user_mapper.utable, &mut flusher);
+            vma.unmap(&mut self.user_mapper.utable, &self.rss, &mut flusher);
         }
     }
 
@@ -593,8 +949,10 @@ impl Drop for UserMapper {
 /// 用户空间映射信息
 #[derive(Debug)]
 pub struct UserMappings {
-    /// 当前用户空间的虚拟内存区域
-    vmas: HashSet<Arc<LockedVMA>>,
+    /// 当前用户空间的虚拟内存区域（按照起始地址排序）
+    ///
+    /// 由于VMA之间互不重叠，因此查找时只需要访问起始地址前后的少量VMA，而不必对每个VMA加锁
+    vmas: BTreeMap<VirtAddr, Arc<LockedVMA>>,
     /// 当前用户空间的VMA空洞
     vm_holes: BTreeMap<VirtAddr, usize>,
 }
@@ -602,7 +960,7 @@ pub struct UserMappings {
 impl UserMappings {
     pub fn new() -> Self {
         return Self {
-            vmas: HashSet::new(),
+            vmas: BTreeMap::new(),
             vm_holes: core::iter::once((VirtAddr::new(0), MMArch::USER_END_VADDR.data()))
                 .collect::<BTreeMap<_, _>>(),
         };
@@ -611,25 +969,32 @@ impl UserMappings {
     /// 判断当前进程的VMA内，是否有包含指定的虚拟地址的VMA。
     ///
     /// 如果有，返回包含指定虚拟地址的VMA的Arc指针，否则返回None。
-    #[allow(dead_code)]
     pub fn contains(&self, vaddr: VirtAddr) -> Option<Arc<LockedVMA>> {
-        for v in self.vmas.iter() {
-            let guard = v.lock();
-            if guard.region.contains(vaddr) {
-                return Some(v.clone());
-            }
+        // 只有起始地址小于等于vaddr的最后一个VMA，才有可能包含vaddr
+        let (_, v) = self.vmas.range(..=vaddr).next_back()?;
+        if v.lock().region.contains(vaddr) {
+            return Some(v.clone());
         }
         return None;
     }
 
     /// 获取当前进程的地址空间中，与给定虚拟地址范围有重叠的VMA的迭代器。
     pub fn conflicts(&self, request: VirtRegion) -> impl Iterator<Item = Arc<LockedVMA>> + '_ {
-        let r = self
+        // 起始地址在request之前的VMA中，只有最后一个可能与request重叠
+        let before = self
             .vmas
-            .iter()
-            .filter(move |v| !v.lock().region.intersect(&request).is_none())
-            .cloned();
-        return r;
+            .range(..request.start())
+            .next_back()
+            .filter(move |(_, v)| v.lock().region.end() > request.start())
+            .map(|(_, v)| v.clone());
+
+        // 起始地址在request范围内的VMA，一定与request重叠
+        let inside = self
+            .vmas
+            .range(request.start()..request.end())
+            .map(|(_, v)| v.clone());
+
+        return before.into_iter().chain(inside);
     }
 
     /// 在当前进程的地址空间中，寻找第一个符合条件的空闲的虚拟内存范围。
@@ -753,7 +1118,7 @@ impl UserMappings {
         assert!(self.conflicts(region).next().is_none());
         self.reserve_hole(&region);
 
-        self.vmas.insert(vma);
+        self.vmas.insert(region.start(), vma);
     }
 
     /// @brief 删除一个VMA，并把对应的地址空间加入空洞中。
@@ -765,19 +1130,19 @@ impl UserMappings {
     /// @return 如果成功删除了VMA，则返回被删除的VMA，否则返回None
     /// 如果没有可以删除的VMA，则不会执行删除操作，并报告失败。
     pub fn remove_vma(&mut self, region: &VirtRegion) -> Option<Arc<LockedVMA>> {
-        // 请注意，由于这里会对每个VMA加锁，因此性能很低
-        let vma: Arc<LockedVMA> = self
-            .vmas
-            .drain_filter(|vma| vma.lock().region == *region)
-            .next()?;
+        let vma = self.vmas.get(&region.start())?;
+        if vma.lock().region != *region {
+            return None;
+        }
+        let vma: Arc<LockedVMA> = self.vmas.remove(&region.start()).unwrap();
         self.unreserve_hole(region);
 
         return Some(vma);
     }
 
     /// @brief Get the iterator of all VMAs in this process.
-    pub fn iter_vmas(&self) -> hashbrown::hash_set::Iter<Arc<LockedVMA>> {
-        return self.vmas.iter();
+    pub fn iter_vmas(&self) -> alloc::collections::btree_map::Values<VirtAddr, Arc<LockedVMA>> {
+        return self.vmas.values();
     }
 }
 
@@ -807,6 +1172,31 @@ impl PartialEq for LockedVMA {
 
 impl Eq for LockedVMA {}
 
+/// 计算重新映射一个页面时，页表项实际应当使用的标志位
+///
+/// 如果页面正在被写时复制共享（包括映射的是零页），那么即使VMA可写，页表项也必须保持只读，
+/// 以便写入时能够触发缺页异常并复制物理页。
+///
+/// 文件映射中只读的页面同样保持只读：私有映射写入时需要复制缓存页，共享映射写入时需要标记脏页
+fn cow_aware_flags(
+    mapper: &PageMapper,
+    vaddr: VirtAddr,
+    flags: PageFlags<MMArch>,
+    file: Option<&Arc<FileMapping>>,
+) -> PageFlags<MMArch> {
+    if flags.has_write() {
+        if let Some((paddr, old_flags)) = mapper.translate(vaddr) {
+            if ZeroPage::is_zero_page(paddr) || PageMapCount::get(paddr) > 1 {
+                return flags.set_write(false);
+            }
+            if file.is_some() && !old_flags.has_write() {
+                return flags.set_write(false);
+            }
+        }
+    }
+    return flags;
+}
+
 #[allow(dead_code)]
 impl LockedVMA {
     pub fn new(vma: VMA) -> Arc<Self> {
@@ -835,38 +1225,64 @@ impl LockedVMA {
     ) -> Result<(), SystemError> {
         let mut guard = self.lock();
         assert!(guard.mapped);
+        let file = guard.file_mapping().cloned();
         for page in guard.region.pages() {
-            // 暂时要求所有的页帧都已经映射到页表
-            // TODO: 引入Lazy Mapping, 通过缺页中断来映射页帧，这里就不必要求所有的页帧都已经映射到页表了
-            let r = unsafe {
-                mapper
-                    .remap(page.virt_address(), flags)
-                    .expect("Failed to remap, beacuse of some page is not mapped")
-            };
-            flusher.consume(r);
+            // 还没有分配物理页的页面，会在缺页时按照VMA的新标志位进行映射
+            let page_flags = cow_aware_flags(mapper, page.virt_address(), flags, file.as_ref());
+            if let Some(r) = unsafe { mapper.remap(page.virt_address(), page_flags) } {
+                flusher.consume(r);
+            }
         }
         guard.flags = flags;
         return Ok(());
     }
 
-    pub fn unmap(&self, mapper: &mut PageMapper, mut flusher: impl Flusher<MMArch>) {
-        // todo: 如果当前vma与文件相关，完善文件相关的逻辑
-
+    pub fn unmap(&self, mapper: &mut PageMapper, rss: &RssStat, mut flusher: impl Flusher<MMArch>) {
         let mut guard = self.lock();
         assert!(guard.mapped);
+        let special = guard.vm_flags.contains(VmFlags::VM_SPECIAL);
+        let file = guard.file_mapping().cloned();
         for page in guard.region.pages() {
-            let (paddr, _, flush) = unsafe { mapper.unmap_phys(page.virt_address(), true) }
-                .expect("Failed to unmap, beacuse of some page is not mapped");
+            // 被换出的页面，只需要释放交换条目
+            if let Some(entry) = unsafe { mapper.take_swap_entry(page.virt_address()) } {
+                zram_free(entry);
+                rss.dec(RssMember::SwapEntries);
+                continue;
+            }
+            // 按需分配的VMA中，可能有一些页面从未被访问过，因此没有映射
+            let (paddr, _, flush) = match unsafe { mapper.unmap_phys(page.virt_address(), true) } {
+                Some(x) => x,
+                None => continue,
+            };
+            // 特殊页不属于这个地址空间，只需要取消映射
+            if special {
+                flusher.consume(flush);
+                continue;
+            }
+            // 文件映射的缓存页属于页面缓存，只需要通知文件映射
+            if file
+                .as_ref()
+                .is_some_and(|f| f.unmap_page(page.virt_address(), paddr))
+            {
+                rss.dec(RssMember::FilePages);
+                flusher.consume(flush);
+                continue;
+            }
 
             // todo: 获取物理页的anon_vma的守卫
 
             // todo: 从anon_vma中删除当前VMA
 
-            // todo: 如果物理页的anon_vma链表长度为0，则释放物理页.
-
-            // 目前由于还没有实现共享页，所以直接释放物理页也没问题。
-            // 但是在实现共享页之后，就不能直接释放物理页了，需要在anon_vma链表长度为0的时候才能释放物理页
-            unsafe { deallocate_page_frames(PhysPageFrame::new(paddr), PageFrameCount::new(1)) };
+            // 物理页可能因为写时复制而被多个地址空间共享，只有最后一个映射者才能释放物理页
+            if !ZeroPage::is_zero_page(paddr) {
+                rss.dec(RssMember::AnonPages);
+                if PageMapCount::dec(paddr) == 0 {
+                    lru_del(paddr);
+                    unsafe {
+                        deallocate_page_frames(PhysPageFrame::new(paddr), PageFrameCount::new(1))
+                    };
+                }
+            }
 
             flusher.consume(flush);
         }
@@ -937,6 +1353,18 @@ impl LockedVMA {
     }
 }
 
+bitflags! {
+    /// VMA的属性
+    pub struct VmFlags: u32 {
+        /// 用户希望这个VMA使用巨页（MADV_HUGEPAGE）
+        const VM_HUGEPAGE = 1 << 0;
+        /// 用户不希望这个VMA使用巨页（MADV_NOHUGEPAGE）
+        const VM_NOHUGEPAGE = 1 << 1;
+        /// VMA中的物理页不属于这个地址空间（例如vDSO），不会被释放、写时复制或者换出
+        const VM_SPECIAL = 1 << 2;
+    }
+}
+
 /// @brief 虚拟内存区域
 #[derive(Debug)]
 pub struct VMA {
@@ -944,13 +1372,15 @@ pub struct VMA {
     region: VirtRegion,
     /// VMA内的页帧的标志
     flags: PageFlags<MMArch>,
-    /// VMA内的页帧是否已经映射到页表
+    /// VMA是否已经建立映射（按需分配的VMA内，页帧可能在缺页时才映射到页表）
     mapped: bool,
     /// VMA所属的用户地址空间
     user_address_space: Option<Weak<AddressSpace>>,
     self_ref: Weak<LockedVMA>,
 
     provider: Provider,
+    /// VMA的属性（例如通过madvise设置的建议）
+    vm_flags: VmFlags,
 }
 
 impl core::hash::Hash for VMA {
@@ -962,9 +1392,15 @@ impl core::hash::Hash for VMA {
 }
 
 /// 描述不同类型的内存提供者或资源
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub enum Provider {
     Allocated, // TODO:其他
+    /// 物理页属于内核中的某个对象（例如packet socket的收发包环），VMA持有这个对象的引用。
+    /// 这样的VMA同时带有[`VmFlags::VM_SPECIAL`]：解除映射时不释放物理页，
+    /// 所有映射都被解除、对象本身也被释放之后，物理页才随着对象一起释放
+    Shared(Arc<dyn core::fmt::Debug + Send + Sync>),
+    /// 文件映射，页面在缺页时才映射到文件的缓存页（或者私有映射写时复制得到的匿名页）
+    File(Arc<FileMapping>),
 }
 
 #[allow(dead_code)]
@@ -985,7 +1421,8 @@ impl VMA {
             mapped: self.mapped,
             user_address_space: self.user_address_space.clone(),
             self_ref: self.self_ref.clone(),
-            provider: Provider::Allocated,
+            provider: self.provider.clone(),
+            vm_flags: self.vm_flags,
         };
     }
 
@@ -994,6 +1431,29 @@ impl VMA {
         return self.flags;
     }
 
+    #[inline(always)]
+    pub fn vm_flags(&self) -> VmFlags {
+        return self.vm_flags;
+    }
+
+    #[inline(always)]
+    pub fn set_provider(&mut self, provider: Provider) {
+        self.provider = provider;
+    }
+
+    /// 文件映射的VMA对应的文件映射
+    #[inline(always)]
+    pub fn file_mapping(&self) -> Option<&Arc<FileMapping>> {
+        return match &self.provider {
+            Provider::File(file) => Some(file),
+            _ => None,
+        };
+    }
+
+    pub fn set_vm_flags(&mut self, vm_flags: VmFlags) {
+        self.vm_flags = vm_flags;
+    }
+
     pub fn pages(&self) -> VirtPageFrameIter {
         return VirtPageFrameIter::new(
             VirtPageFrame::new(self.region.start()),
@@ -1008,17 +1468,14 @@ impl VMA {
         mut flusher: impl Flusher<MMArch>,
     ) -> Result<(), SystemError> {
         assert!(self.mapped);
+        let file = self.file_mapping().cloned();
         for page in self.region.pages() {
             // kdebug!("remap page {:?}", page.virt_address());
-            // 暂时要求所有的页帧都已经映射到页表
-            // TODO: 引入Lazy Mapping, 通过缺页中断来映射页帧，这里就不必要求所有的页帧都已经映射到页表了
-            let r = unsafe {
-                mapper
-                    .remap(page.virt_address(), flags)
-                    .expect("Failed to remap, beacuse of some page is not mapped")
-            };
-            // kdebug!("consume page {:?}", page.virt_address());
-            flusher.consume(r);
+            // 还没有分配物理页的页面，会在缺页时按照VMA的新标志位进行映射
+            let page_flags = cow_aware_flags(mapper, page.virt_address(), flags, file.as_ref());
+            if let Some(r) = unsafe { mapper.remap(page.virt_address(), page_flags) } {
+                flusher.consume(r);
+            }
             // kdebug!("remap page {:?} done", page.virt_address());
         }
         self.flags = flags;
@@ -1034,8 +1491,17 @@ impl VMA {
         let is_downgrade = (self.flags.has_write() || !prot_flags.contains(ProtFlags::PROT_WRITE))
             && (self.flags.has_execute() || !prot_flags.contains(ProtFlags::PROT_EXEC));
 
+        // 特殊页由多个地址空间共享，不能增加权限
+        if self.vm_flags.contains(VmFlags::VM_SPECIAL) {
+            return is_downgrade;
+        }
+
         match self.provider {
             Provider::Allocated { .. } => true,
+            // 文件以只读方式打开时，共享映射不能获得写权限
+            Provider::File(ref file) => {
+                !file.shared() || file.may_write() || !prot_flags.contains(ProtFlags::PROT_WRITE)
+            }
 
             #[allow(unreachable_patterns)]
             _ => is_downgrade,
@@ -1090,10 +1556,100 @@ impl VMA {
             user_address_space: None,
             self_ref: Weak::default(),
             provider: Provider::Allocated,
+            vm_flags: VmFlags::empty(),
         });
         return Ok(r);
     }
 
+    /// 把一组不一定连续的物理页帧依次映射到从`destination`开始的连续虚拟地址上
+    ///
+    /// 与[`VMA::physmap`]相同，返回的VMA不拥有这些物理页，调用者需要设置
+    /// [`VmFlags::VM_SPECIAL`]以及持有物理页的[`Provider::Shared`]
+    ///
+    /// @param frames 要映射的物理页帧
+    /// @param destination 要映射到的虚拟地址
+    /// @param flags 页面标志位
+    /// @param mapper 页表映射器
+    /// @param flusher 页表项刷新器
+    pub fn physmap_frames(
+        frames: &[PhysPageFrame],
+        destination: VirtPageFrame,
+        flags: PageFlags<MMArch>,
+        mapper: &mut PageMapper,
+        mut flusher: impl Flusher<MMArch>,
+    ) -> Result<Arc<LockedVMA>, SystemError> {
+        let mut cur_dest = destination;
+        for frame in frames {
+            let r =
+                unsafe { mapper.map_phys(cur_dest.virt_address(), frame.phys_address(), flags) }
+                    .expect("Failed to map phys, may be OOM error");
+            flusher.consume(r);
+            cur_dest = cur_dest.next();
+        }
+
+        let r: Arc<LockedVMA> = LockedVMA::new(VMA {
+            region: VirtRegion::new(destination.virt_address(), frames.len() * MMArch::PAGE_SIZE),
+            flags,
+            mapped: true,
+            user_address_space: None,
+            self_ref: Weak::default(),
+            provider: Provider::Allocated,
+            vm_flags: VmFlags::empty(),
+        });
+        return Ok(r);
+    }
+
+    /// 创建一个按需分配物理页的VMA
+    ///
+    /// 创建时不分配任何物理页，也不修改页表。VMA内的页面在第一次被访问时，
+    /// 由缺页异常处理函数分配并清零。
+    ///
+    /// @param destination 起始虚拟页帧
+    /// @param count VMA内的页帧数量
+    /// @param flags 页面标志位
+    ///
+    /// @return 返回新的虚拟内存区域
+    pub fn lazy(
+        destination: VirtPageFrame,
+        page_count: PageFrameCount,
+        flags: PageFlags<MMArch>,
+    ) -> Arc<LockedVMA> {
+        return LockedVMA::new(VMA {
+            region: VirtRegion::new(destination.virt_address(), page_count.bytes()),
+            flags,
+            mapped: true,
+            user_address_space: None,
+            self_ref: Weak::default(),
+            provider: Provider::Allocated,
+            vm_flags: VmFlags::empty(),
+        });
+    }
+
+    /// 创建一个文件映射的VMA
+    ///
+    /// 与[`VMA::lazy`]相同，创建时不映射任何页面，页面在第一次被访问时由缺页异常处理函数映射
+    ///
+    /// @param destination 起始虚拟页帧
+    /// @param count VMA内的页帧数量
+    /// @param flags 页面标志位
+    /// @param file 文件映射
+    pub fn file(
+        destination: VirtPageFrame,
+        page_count: PageFrameCount,
+        flags: PageFlags<MMArch>,
+        file: Arc<FileMapping>,
+    ) -> Arc<LockedVMA> {
+        return LockedVMA::new(VMA {
+            region: VirtRegion::new(destination.virt_address(), page_count.bytes()),
+            flags,
+            mapped: true,
+            user_address_space: None,
+            self_ref: Weak::default(),
+            provider: Provider::File(file),
+            vm_flags: VmFlags::empty(),
+        });
+    }
+
     /// 从页分配器中分配一些物理页，并把它们映射到指定的虚拟地址，然后创建VMA
     ///
     /// @param destination 要映射到的虚拟地址
@@ -1120,7 +1676,10 @@ impl VMA {
             //     "VMA::zeroed: cur_dest={cur_dest:?}, vaddr = {:?}",
             //     cur_dest.virt_address()
             // );
-            let r = unsafe { mapper.map(cur_dest.virt_address(), flags) }
+            // 优先使用预先清零的页帧，避免在这里同步地清零
+            let paddr = unsafe { allocate_zeroed_page() }
+                .expect("Failed to allocate zeroed page, may be OOM error");
+            let r = unsafe { mapper.map_phys(cur_dest.virt_address(), paddr, flags) }
                 .expect("Failed to map zero, may be OOM error");
             // todo: 将VMA加入到anon_vma中
             // todo: 增加OOM处理
@@ -1139,22 +1698,10 @@ impl VMA {
             user_address_space: None,
             self_ref: Weak::default(),
             provider: Provider::Allocated,
+            vm_flags: VmFlags::empty(),
         });
         drop(flusher);
         // kdebug!("VMA::zeroed: flusher dropped");
-
-        // 清空这些内存
-        let virt_iter: VirtPageFrameIter =
-            VirtPageFrameIter::new(destination, destination.add(page_count));
-        for frame in virt_iter {
-            let paddr = mapper.translate(frame.virt_address()).unwrap().0;
-
-            unsafe {
-                let vaddr = MMArch::phys_2_virt(paddr).unwrap();
-                MMArch::write_bytes(vaddr, 0, MMArch::PAGE_SIZE);
-            }
-        }
-        // kdebug!("VMA::zeroed: done");
         return Ok(r);
     }
 }
@@ -1203,6 +1750,8 @@ impl UserStack {
     pub const DEFAULT_USER_STACK_SIZE: usize = 8 * 1024 * 1024;
     /// 用户栈的保护页数量
     pub const GUARD_PAGES_NUM: usize = 4;
+    /// 用户栈通过缺页异常自动增长时，允许达到的最大大小（不包括保护页）
+    pub const MAX_USER_STACK_SIZE: usize = 64 * 1024 * 1024;
 
     /// 创建一个用户栈
     pub fn new(
@@ -1298,29 +1847,43 @@ impl UserStack {
     ///
     /// - **Ok(())** 扩展成功
     /// - **Err(SystemError)** 扩展失败
-    #[allow(dead_code)]
     pub fn extend(
         &mut self,
-        vm: &mut RwLockWriteGuard<InnerAddressSpace>,
+        vm: &mut InnerAddressSpace,
         mut bytes: usize,
     ) -> Result<(), SystemError> {
         let prot_flags = ProtFlags::PROT_READ | ProtFlags::PROT_WRITE | ProtFlags::PROT_EXEC;
-        let map_flags = MapFlags::MAP_PRIVATE | MapFlags::MAP_ANONYMOUS;
+        // 扩展的区域必须紧挨着原来的栈，如果已经被占用，则扩展失败
+        let map_flags =
+            MapFlags::MAP_PRIVATE | MapFlags::MAP_ANONYMOUS | MapFlags::MAP_FIXED_NOREPLACE;
 
         bytes = page_align_up(bytes);
-        self.mapped_size += bytes;
+        if self.stack_size() + bytes > Self::MAX_USER_STACK_SIZE {
+            return Err(SystemError::ENOMEM);
+        }
 
         vm.map_anonymous(
-            self.stack_bottom - self.mapped_size,
+            self.stack_bottom - self.mapped_size - bytes,
             bytes,
             prot_flags,
             map_flags,
             false,
         )?;
+        self.mapped_size += bytes;
 
         return Ok(());
     }
 
+    /// 获取栈底地址（用户栈的最高地址）
+    pub fn stack_bottom(&self) -> VirtAddr {
+        return self.stack_bottom;
+    }
+
+    /// 获取用户栈已经映射的区域的最低地址
+    pub fn lowest_address(&self) -> VirtAddr {
+        return self.stack_bottom - self.mapped_size;
+    }
+
     /// 获取栈顶地址
     ///
     /// 请注意，如果用户栈的栈顶地址发生变化，这个值可能不会实时更新！
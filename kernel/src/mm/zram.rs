@@ -0,0 +1,213 @@
+//! 基于内存压缩的交换后端（类似于Linux的zram）
+//!
+//! 回收匿名页时，把页面的内容用LZ4压缩之后保存在内核堆中（由slab分配），
+//! 并在页表项中记录交换条目（即槽的下标）。再次访问这个页面时，缺页处理函数解压缩到新的页帧中。
+//!
+//! - 全零的页面不保存任何数据
+//! - 压缩后仍然超过[`ZRAM_MAX_COMPRESSED`]的页面不会被换出，因为保存它们节省不了多少内存
+//! - fork之后，父子进程的页表项共享同一个槽，槽记录了引用计数
+
+use core::ffi::{c_char, c_void};
+
+use alloc::{boxed::Box, vec, vec::Vec};
+
+use crate::{
+    arch::{mm::LockedFrameAllocator, MMArch},
+    include::bindings::bindings::{
+        LZ4_compress_fast_extState, LZ4_decompress_safe, LZ4_sizeofState,
+    },
+    kinfo,
+    libs::spinlock::SpinLock,
+    syscall::SystemError,
+};
+
+use super::{MemoryManagementArch, PhysAddr};
+
+/// 压缩后的最大长度，超过这个长度的页面不会被换出
+const ZRAM_MAX_COMPRESSED: usize = MMArch::PAGE_SIZE * 3 / 4;
+/// 压缩数据最多占用的内存占总内存的比例（1/ZRAM_LIMIT_RATIO）
+const ZRAM_LIMIT_RATIO: usize = 4;
+
+static ZRAM: SpinLock<Option<Zram>> = SpinLock::new(None);
+
+#[derive(Debug)]
+struct ZramSlot {
+    /// 压缩后的数据，None表示这是一个全零的页面
+    data: Option<Box<[u8]>>,
+    /// 有多少个页表项引用了这个槽
+    refs: usize,
+}
+
+#[derive(Debug)]
+struct Zram {
+    slots: Vec<Option<ZramSlot>>,
+    /// 空闲的槽的下标
+    free_slots: Vec<usize>,
+    /// LZ4的压缩状态（约16K，不能放在内核栈上）
+    lz4_state: Vec<u64>,
+    /// 压缩时使用的缓冲区
+    buf: Vec<u8>,
+    /// 压缩数据占用的字节数
+    stored_bytes: usize,
+    /// 压缩数据最多占用的字节数
+    limit_bytes: usize,
+    /// 被换出的页面数量
+    nr_pages: usize,
+}
+
+impl Zram {
+    fn new(limit_bytes: usize) -> Self {
+        let state_size = unsafe { LZ4_sizeofState() } as usize;
+        return Self {
+            slots: Vec::new(),
+            free_slots: Vec::new(),
+            lz4_state: vec![0u64; (state_size + 7) / 8],
+            buf: vec![0u8; ZRAM_MAX_COMPRESSED],
+            stored_bytes: 0,
+            limit_bytes,
+            nr_pages: 0,
+        };
+    }
+
+    fn alloc_slot(&mut self, slot: ZramSlot) -> usize {
+        if let Some(index) = self.free_slots.pop() {
+            self.slots[index] = Some(slot);
+            return index;
+        }
+        self.slots.push(Some(slot));
+        return self.slots.len() - 1;
+    }
+
+    /// 压缩页帧的内容，保存到一个新的槽中
+    fn store(&mut self, paddr: PhysAddr) -> Option<usize> {
+        let src = unsafe {
+            core::slice::from_raw_parts(
+                MMArch::phys_2_virt(paddr)?.data() as *const u8,
+                MMArch::PAGE_SIZE,
+            )
+        };
+
+        let data = if src.iter().all(|b| *b == 0) {
+            None
+        } else {
+            let len = unsafe {
+                LZ4_compress_fast_extState(
+                    self.lz4_state.as_mut_ptr() as *mut c_void,
+                    src.as_ptr() as *const c_char,
+                    self.buf.as_mut_ptr() as *mut c_char,
+                    MMArch::PAGE_SIZE as i32,
+                    self.buf.len() as i32,
+                    1,
+                )
+            };
+            // 返回0表示压缩后的数据放不进缓冲区，即压缩率不够
+            if len <= 0 {
+                return None;
+            }
+            let len = len as usize;
+            if self.stored_bytes + len > self.limit_bytes {
+                return None;
+            }
+            self.stored_bytes += len;
+            Some(Box::from(&self.buf[..len]))
+        };
+
+        self.nr_pages += 1;
+        return Some(self.alloc_slot(ZramSlot { data, refs: 1 }));
+    }
+
+    /// 把槽中的数据解压缩到页帧中
+    fn load(&self, index: usize, paddr: PhysAddr) -> Result<(), SystemError> {
+        let slot = self
+            .slots
+            .get(index)
+            .and_then(|s| s.as_ref())
+            .ok_or(SystemError::EFAULT)?;
+        let dst = MMArch::phys_2_virt(paddr).ok_or(SystemError::EFAULT)?;
+        match &slot.data {
+            None => unsafe { MMArch::write_bytes(dst, 0, MMArch::PAGE_SIZE) },
+            Some(data) => {
+                let len = unsafe {
+                    LZ4_decompress_safe(
+                        data.as_ptr() as *const c_char,
+                        dst.data() as *mut c_char,
+                        data.len() as i32,
+                        MMArch::PAGE_SIZE as i32,
+                    )
+                };
+                if len as usize != MMArch::PAGE_SIZE {
+                    return Err(SystemError::EIO);
+                }
+            }
+        }
+        return Ok(());
+    }
+
+    /// 减少槽的引用计数，如果引用计数为0，则释放它
+    fn put(&mut self, index: usize) {
+        let slot = match self.slots.get_mut(index).and_then(|s| s.as_mut()) {
+            Some(slot) => slot,
+            None => return,
+        };
+        slot.refs -= 1;
+        if slot.refs > 0 {
+            return;
+        }
+        if let Some(slot) = self.slots[index].take() {
+            if let Some(data) = slot.data {
+                self.stored_bytes -= data.len();
+            }
+        }
+        self.nr_pages -= 1;
+        self.free_slots.push(index);
+    }
+}
+
+/// 初始化压缩交换后端
+pub fn zram_init() {
+    let total_bytes = LockedFrameAllocator.get_usage().total().bytes();
+    let limit = total_bytes / ZRAM_LIMIT_RATIO;
+    *ZRAM.lock() = Some(Zram::new(limit));
+    kinfo!("zram swap enabled, limit: {} KB", limit / 1024);
+}
+
+/// 压缩交换后端是否可用
+pub fn zram_enabled() -> bool {
+    return ZRAM.lock().is_some();
+}
+
+/// 把页帧的内容压缩保存
+///
+/// 调用者需要保证在压缩期间，页帧的内容不会被修改（即已经取消了所有的映射）
+///
+/// ## 返回值
+///
+/// 返回交换条目。如果页面不适合被换出，或者压缩数据已经达到了上限，返回None
+pub fn zram_store(paddr: PhysAddr) -> Option<usize> {
+    return ZRAM.lock().as_mut()?.store(paddr);
+}
+
+/// 把交换条目中的数据解压缩到页帧中，并释放页表项对这个交换条目的引用
+pub fn zram_load(swap_entry: usize, paddr: PhysAddr) -> Result<(), SystemError> {
+    let mut guard = ZRAM.lock();
+    let zram = guard.as_mut().ok_or(SystemError::EFAULT)?;
+    zram.load(swap_entry, paddr)?;
+    zram.put(swap_entry);
+    return Ok(());
+}
+
+/// 增加交换条目的引用计数（fork时，子进程的页表项也引用了这个交换条目）
+pub fn zram_dup(swap_entry: usize) {
+    if let Some(zram) = ZRAM.lock().as_mut() {
+        if let Some(slot) = zram.slots.get_mut(swap_entry).and_then(|s| s.as_mut()) {
+            slot.refs += 1;
+        }
+    }
+}
+
+/// 释放页表项对交换条目的引用（取消映射时调用）
+pub fn zram_free(swap_entry: usize) {
+    if let Some(zram) = ZRAM.lock().as_mut() {
+        zram.put(swap_entry);
+    }
+}
@@ -1,3 +1,4 @@
+use alloc::{string::String, vec::Vec};
 pub use smoltcp::wire::IpEndpoint;
 
 /// @brief 链路层端点
@@ -17,3 +18,15 @@ impl LinkLayerEndpoint {
         Self { interface }
     }
 }
+
+/// @brief Unix域socket的端点（地址）
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub enum UnixEndpoint {
+    /// 没有绑定地址
+    #[default]
+    Unnamed,
+    /// 文件系统中的路径
+    Path(String),
+    /// 抽象命名空间中的名字（sun_path以'\0'开头），不对应任何文件
+    Abstract(Vec<u8>),
+}
@@ -3,21 +3,35 @@ use core::{
     sync::atomic::AtomicUsize,
 };
 
-use alloc::{boxed::Box, collections::BTreeMap, sync::Arc};
+use alloc::{boxed::Box, collections::BTreeMap, sync::Arc, vec::Vec};
 
-use crate::{driver::net::NetDriver, kwarn, libs::rwlock::RwLock, syscall::SystemError};
-use smoltcp::wire::IpEndpoint;
+use crate::{
+    driver::net::NetDriver,
+    filesystem::vfs::{file::File, gather_bufs, iov_len, scatter_bufs},
+    kwarn,
+    libs::{percpu_rwlock::PerCpuRwLock, wait_queue::WaitQueue},
+    mm::{
+        syscall::{MapFlags, ProtFlags},
+        VirtAddr,
+    },
+    syscall::SystemError,
+};
+use smoltcp::{iface::SocketHandle, wire::IpEndpoint};
 
 use self::socket::SocketMetadata;
 
 pub mod endpoints;
 pub mod net_core;
+pub mod packet;
+pub mod rps;
 pub mod socket;
+pub mod stats;
 pub mod syscall;
+pub mod unix;
 
 lazy_static! {
-    /// @brief 所有网络接口的列表
-    pub static ref NET_DRIVERS: RwLock<BTreeMap<usize, Arc<dyn NetDriver>>> = RwLock::new(BTreeMap::new());
+    /// @brief 所有网络接口的列表（读多写少，每次轮询网卡都要读取）
+    pub static ref NET_DRIVERS: PerCpuRwLock<BTreeMap<usize, Arc<dyn NetDriver>>> = PerCpuRwLock::new(BTreeMap::new());
 }
 
 /// @brief 生成网络接口的id (全局自增)
@@ -59,6 +73,8 @@ pub enum Endpoint {
     LinkLayer(endpoints::LinkLayerEndpoint),
     /// 网络层端点
     Ip(Option<IpEndpoint>),
+    /// Unix域socket的端点
+    Unix(endpoints::UnixEndpoint),
     // todo: 增加NetLink机制后，增加NetLink端点
 }
 
@@ -79,6 +95,33 @@ pub trait Socket: Sync + Send + Debug {
     /// @return 返回写入的数据的长度
     fn write(&self, buf: &[u8], to: Option<Endpoint>) -> Result<usize, SystemError>;
 
+    /// @brief 从socket中把数据依次读入多个缓冲区（readv/recvmsg）
+    ///
+    /// 默认实现先读入临时缓冲区再分散到各个缓冲区，保证一次读出一个完整的数据报。
+    /// 字节流socket应该重写这个函数，把数据直接读入各个缓冲区
+    fn read_vectored(&self, bufs: &mut [&mut [u8]]) -> (Result<usize, SystemError>, Endpoint) {
+        if let [buf] = bufs {
+            return self.read(buf);
+        }
+        let mut tmp = vec![0u8; iov_len(bufs.iter().map(|b| &**b))];
+        let (r, endpoint) = self.read(&mut tmp);
+        if let Ok(len) = r {
+            scatter_bufs(bufs, &tmp[..len]);
+        }
+        return (r, endpoint);
+    }
+
+    /// @brief 把多个缓冲区中的数据依次写入socket（writev/sendmsg）
+    ///
+    /// 默认实现先把数据聚合到临时缓冲区，保证多个缓冲区作为一个数据报发送。
+    /// 字节流socket应该重写这个函数，直接发送各个缓冲区中的数据
+    fn write_vectored(&self, bufs: &[&[u8]], to: Option<Endpoint>) -> Result<usize, SystemError> {
+        if let [buf] = bufs {
+            return self.write(buf, to);
+        }
+        return self.write(&gather_bufs(bufs), to);
+    }
+
     /// @brief 对应于POSIX的connect函数，用于连接到指定的远程服务器端点
     ///
     /// It is used to establish a connection to a remote server.
@@ -160,6 +203,13 @@ pub trait Socket: Sync + Send + Debug {
         return (false, false, false);
     }
 
+    /// @brief 获取socket的等待队列，poll/select通过它等待socket就绪
+    ///
+    /// @return socket的状态变化时会被唤醒的等待队列，没有时返回None
+    fn wait_queue(&self) -> Option<Arc<WaitQueue>> {
+        return None;
+    }
+
     /// @brief socket的ioctl函数
     ///
     /// @param cmd ioctl命令
@@ -183,6 +233,67 @@ pub trait Socket: Sync + Send + Debug {
 
     fn box_clone(&self) -> Box<dyn Socket>;
 
+    /// @brief 一次接收多个数据报（recvmmsg）
+    ///
+    /// 等待到至少有一个数据报到达为止，之后只接收已经到达的数据报，不再等待
+    ///
+    /// @param bufs 每个数据报的接收缓冲区
+    ///
+    /// @return 按照顺序返回接收到的每个数据报的长度与来源，至少有一个
+    fn read_batch(&self, bufs: &mut [&mut [u8]]) -> Result<Vec<(usize, Endpoint)>, SystemError> {
+        if bufs.is_empty() {
+            return Ok(Vec::new());
+        }
+        let (n, endpoint) = self.read(&mut bufs[0]);
+        return Ok(vec![(n?, endpoint)]);
+    }
+
+    /// @brief 一次发送多个数据报（sendmmsg）
+    ///
+    /// @param msgs 每个数据报的内容与目的地址
+    ///
+    /// @return 成功发送的数据报的数量。第一个数据报就发送失败时返回错误码
+    fn write_batch(&self, msgs: &[(&[u8], Option<Endpoint>)]) -> Result<usize, SystemError> {
+        for (i, (buf, to)) in msgs.iter().enumerate() {
+            if let Err(e) = self.write(buf, to.clone()) {
+                if i == 0 {
+                    return Err(e);
+                }
+                return Ok(i);
+            }
+        }
+        return Ok(msgs.len());
+    }
+
+    /// @brief 接收数据，同时接收随数据一起通过SCM_RIGHTS传递过来的文件（recvmsg）
+    ///
+    /// @return (读取的数据的长度, 读取数据的端点, 传递过来的文件)
+    fn read_with_rights(
+        &self,
+        buf: &mut [u8],
+    ) -> (Result<usize, SystemError>, Endpoint, Vec<File>) {
+        let (r, endpoint) = self.read(buf);
+        return (r, endpoint, Vec::new());
+    }
+
+    /// @brief 发送数据，同时通过SCM_RIGHTS传递文件（sendmsg）。只有Unix域socket支持传递文件
+    fn write_with_rights(
+        &self,
+        buf: &[u8],
+        to: Option<Endpoint>,
+        rights: Vec<File>,
+    ) -> Result<usize, SystemError> {
+        if !rights.is_empty() {
+            return Err(SystemError::EOPNOTSUPP_OR_ENOTSUP);
+        }
+        return self.write(buf, to);
+    }
+
+    /// @brief 获取socket在smoltcp中的句柄，用于在端口记录表中区分绑定了同一个端口的socket
+    fn socket_handle(&self) -> Option<SocketHandle> {
+        return None;
+    }
+
     /// @brief 设置socket的选项
     ///
     /// @param level 选项的层次
@@ -191,7 +302,7 @@ pub trait Socket: Sync + Send + Debug {
     ///
     /// @return 返回设置是否成功, 如果不支持该选项，返回ENOSYS
     fn setsockopt(
-        &self,
+        &mut self,
         _level: usize,
         _optname: usize,
         _optval: &[u8],
@@ -199,6 +310,21 @@ pub trait Socket: Sync + Send + Debug {
         kwarn!("setsockopt is not implemented");
         return Ok(());
     }
+
+    /// @brief 把socket的共享内存区域（例如packet socket的收发包环）映射到当前进程的地址空间
+    ///
+    /// @return 成功：Ok(映射的起始地址)
+    ///         失败：Err(错误码)。不支持映射的socket返回ENODEV
+    fn mmap(
+        &self,
+        _start_vaddr: VirtAddr,
+        _len: usize,
+        _prot_flags: ProtFlags,
+        _map_flags: MapFlags,
+        _offset: usize,
+    ) -> Result<usize, SystemError> {
+        return Err(SystemError::ENODEV);
+    }
 }
 
 impl Clone for Box<dyn Socket> {
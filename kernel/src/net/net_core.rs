@@ -1,16 +1,24 @@
+use core::sync::atomic::{AtomicBool, AtomicU8, Ordering};
+
 use alloc::{boxed::Box, collections::BTreeMap, sync::Arc};
 use smoltcp::{socket::dhcpv4, wire};
 
 use crate::{
-    driver::net::NetDriver,
-    kdebug, kinfo, kwarn,
-    libs::rwlock::RwLockReadGuard,
+    driver::net::{loopback::LOOPBACK_IFACE, NetDriver},
+    exception::softirq::{softirq_vectors, SoftirqNumber, SoftirqVec},
+    init::bootstat::BootPhase,
+    kdebug, kerror, kinfo,
+    libs::percpu_rwlock::PerCpuRwLockReadGuard,
     net::NET_DRIVERS,
+    process::executor::{sleep_ms, spawn},
     syscall::SystemError,
-    time::timer::{next_n_ms_timer_jiffies, Timer, TimerFunction},
+    time::timer::{next_n_ms_timer_jiffies, next_n_us_timer_jiffies, Timer, TimerFunction},
 };
 
-use super::socket::{SOCKET_SET, SOCKET_WAITQUEUE};
+use super::{
+    rps::rps_schedule_rx,
+    socket::{socket_wakeup_ready, SOCKET_SET},
+};
 
 /// The network poll function, which will be called by timer.
 ///
@@ -28,8 +36,76 @@ impl TimerFunction for NetWorkPollFunc {
     }
 }
 
+/// NET_RX软中断没能获得SOCKET_SET的锁时，过多久再重试（单位：微秒）
+const NET_RX_RETRY_US: u64 = 500;
+/// 是否已经有一个重试NET_RX软中断的定时器
+static NET_RX_RETRY_PENDING: AtomicBool = AtomicBool::new(false);
+
+/// 网卡收包软中断
+///
+/// 网卡的中断处理函数只屏蔽收包中断，然后通过[`net_rx_schedule`]触发这个软中断，
+/// 由软中断轮询网卡、交给协议栈处理并唤醒等待的进程，网卡驱动在轮询结束时重新打开收包中断。
+/// 这样收包的延迟不再依赖于某个系统调用恰好轮询了网卡。
+///
+/// smoltcp的一次轮询会处理完网卡队列中所有的分组，因此每次软中断的处理量以网卡的收包队列的长度为上限。
+#[derive(Debug)]
+struct NetRxSoftirq;
+
+impl SoftirqVec for NetRxSoftirq {
+    fn run(&self) {
+        // 软中断可能打断了一个正持有SOCKET_SET的进程，因此只能尝试加锁，失败时稍后重试
+        if let Err(SystemError::EAGAIN_OR_EWOULDBLOCK) = poll_ifaces_try_lock_onetime() {
+            net_rx_retry_later();
+        }
+    }
+}
+
+#[derive(Debug)]
+struct NetRxRetryFunc;
+
+impl TimerFunction for NetRxRetryFunc {
+    fn run(&mut self) -> Result<(), SystemError> {
+        NET_RX_RETRY_PENDING.store(false, Ordering::Release);
+        net_rx_schedule();
+        return Ok(());
+    }
+}
+
+fn net_rx_retry_later() {
+    if NET_RX_RETRY_PENDING.swap(true, Ordering::AcqRel) {
+        return;
+    }
+    let timer = Timer::new(
+        Box::new(NetRxRetryFunc),
+        next_n_us_timer_jiffies(NET_RX_RETRY_US),
+    );
+    timer.activate();
+}
+
+/// 在网卡的中断处理函数中调用：触发NET_RX软中断
+///
+/// 软中断不一定在当前cpu上处理，见[`super::rps`]
+pub fn net_rx_schedule() {
+    rps_schedule_rx();
+}
+
 pub fn net_init() -> Result<(), SystemError> {
-    dhcp_query()?;
+    softirq_vectors()
+        .register_softirq(SoftirqNumber::NetRx, Arc::new(NetRxSoftirq))
+        .expect("Failed to register net rx softirq");
+
+    let net_face = NET_DRIVERS
+        .read()
+        .get(&0)
+        .ok_or(SystemError::ENODEV)?
+        .clone();
+    // DHCP需要等待服务器的应答，在异步任务中进行，不阻塞启动过程
+    spawn(async move {
+        let _phase = BootPhase::start("dhcp_query (async)");
+        if let Err(e) = dhcp_query(net_face).await {
+            kerror!("Failed to configure network by DHCP: {:?}", e);
+        }
+    });
     // Init poll timer function
     // let next_time = next_n_ms_timer_jiffies(5);
     // let timer = Timer::new(Box::new(NetWorkPollFunc), next_time);
@@ -37,13 +113,12 @@ pub fn net_init() -> Result<(), SystemError> {
     return Ok(());
 }
 
-fn dhcp_query() -> Result<(), SystemError> {
-    let binding = NET_DRIVERS.write();
-
-    let net_face = binding.get(&0).ok_or(SystemError::ENODEV)?.clone();
-
-    drop(binding);
+/// DHCP的最大尝试次数
+const DHCP_TRY_ROUND: u8 = 50;
+/// 两次尝试之间等待的时间（单位：毫秒）
+const DHCP_RETRY_MS: u64 = 100;
 
+async fn dhcp_query(net_face: Arc<dyn NetDriver>) -> Result<(), SystemError> {
     // Create sockets
     let mut dhcp_socket = dhcpv4::Socket::new();
 
@@ -55,8 +130,11 @@ fn dhcp_query() -> Result<(), SystemError> {
 
     let dhcp_handle = SOCKET_SET.lock().add(dhcp_socket);
 
-    const DHCP_TRY_ROUND: u8 = 10;
     for i in 0..DHCP_TRY_ROUND {
+        if i != 0 {
+            // 等待服务器的应答，期间不占用cpu
+            sleep_ms(DHCP_RETRY_MS).await;
+        }
         kdebug!("DHCP try round: {}", i);
         net_face.poll(&mut SOCKET_SET.lock()).ok();
         let mut binding = SOCKET_SET.lock();
@@ -116,33 +194,116 @@ fn dhcp_query() -> Result<(), SystemError> {
     return Err(SystemError::ETIMEDOUT);
 }
 
+/// 没有cpu在轮询网卡
+const POLL_IDLE: u8 = 0;
+/// 有cpu正在[`poll_ifaces`]中轮询网卡
+const POLL_RUNNING: u8 = 1;
+/// 轮询期间有其他cpu请求了轮询，正在轮询的cpu结束这一轮之后需要再轮询一次
+const POLL_AGAIN: u8 = 2;
+
+/// 网卡轮询的状态
+///
+/// 轮询网卡需要持有整个SOCKET_SET，同时有多个cpu请求轮询时，让它们依次轮询只会在锁上排队，
+/// 而后面的轮询几乎没有新的数据包可以处理。因此只让一个cpu轮询，其他cpu只留下一个“再轮询一次”的请求就返回，
+/// 由正在轮询的cpu在结束之前补上，这样请求不会丢失，等待的进程也会在那一轮之后被唤醒。
+static POLL_STATE: AtomicU8 = AtomicU8::new(POLL_IDLE);
+
+/// 如果有cpu正在轮询，请求它再轮询一次，返回true；没有cpu在轮询时返回false
+fn poll_piggyback() -> bool {
+    let mut state = POLL_STATE.load(Ordering::Acquire);
+    loop {
+        match state {
+            POLL_IDLE => return false,
+            POLL_AGAIN => return true,
+            _ => {}
+        }
+        match POLL_STATE.compare_exchange_weak(
+            POLL_RUNNING,
+            POLL_AGAIN,
+            Ordering::AcqRel,
+            Ordering::Acquire,
+        ) {
+            Ok(_) => return true,
+            Err(s) => state = s,
+        }
+    }
+}
+
+/// 尝试成为轮询者。返回false表示已经有cpu在轮询，并且已经请求它再轮询一次
+fn poll_begin() -> bool {
+    loop {
+        if poll_piggyback() {
+            return false;
+        }
+        if POLL_STATE
+            .compare_exchange(POLL_IDLE, POLL_RUNNING, Ordering::AcqRel, Ordering::Acquire)
+            .is_ok()
+        {
+            return true;
+        }
+    }
+}
+
+/// 结束一轮轮询。返回true表示这一轮期间有其他cpu请求了轮询，需要再轮询一次
+fn poll_end() -> bool {
+    if POLL_STATE
+        .compare_exchange(POLL_RUNNING, POLL_IDLE, Ordering::AcqRel, Ordering::Acquire)
+        .is_ok()
+    {
+        return false;
+    }
+    POLL_STATE.store(POLL_RUNNING, Ordering::Release);
+    return true;
+}
+
+/// 轮询环回接口和所有网卡，然后唤醒等待已经就绪的socket的进程
+///
+/// 环回接口必须最先轮询：它只能发出目的地址是本机的分组，其他分组会留到轮询网卡时发出。
+/// 如果先轮询网卡，发往127.0.0.1的分组会从网卡发出去
+fn poll_all(
+    drivers: &BTreeMap<usize, Arc<dyn NetDriver>>,
+    sockets: &mut smoltcp::iface::SocketSet<'static>,
+) {
+    LOOPBACK_IFACE.poll(sockets).ok();
+    for (_, iface) in drivers.iter() {
+        iface.poll(sockets).ok();
+    }
+    socket_wakeup_ready(sockets);
+}
+
+/// 对所有网卡进行轮询，并唤醒等待已经就绪的socket的进程
+///
+/// 已经有cpu在轮询时，不会等待，参见[`POLL_STATE`]
 pub fn poll_ifaces() {
-    let guard: RwLockReadGuard<BTreeMap<usize, Arc<dyn NetDriver>>> = NET_DRIVERS.read();
-    if guard.len() == 0 {
-        kwarn!("poll_ifaces: No net driver found!");
+    if !poll_begin() {
         return;
     }
-    let mut sockets = SOCKET_SET.lock();
-    for (_, iface) in guard.iter() {
-        iface.poll(&mut sockets).ok();
+    loop {
+        let guard: PerCpuRwLockReadGuard<BTreeMap<usize, Arc<dyn NetDriver>>> = NET_DRIVERS.read();
+        let mut sockets = SOCKET_SET.lock();
+        poll_all(&guard, &mut sockets);
+        drop(sockets);
+        drop(guard);
+
+        if !poll_end() {
+            return;
+        }
     }
-    SOCKET_WAITQUEUE.wakeup_all(None);
 }
 
 /// 对ifaces进行轮询，最多对SOCKET_SET尝试times次加锁。
 ///
+/// 已经有cpu在[`poll_ifaces`]中轮询时，只请求它再轮询一次，然后直接返回成功
+///
 /// @return 轮询成功，返回Ok(())
 /// @return 加锁超时，返回SystemError::EAGAIN_OR_EWOULDBLOCK
-/// @return 没有网卡，返回SystemError::ENODEV
 pub fn poll_ifaces_try_lock(times: u16) -> Result<(), SystemError> {
+    if poll_piggyback() {
+        return Ok(());
+    }
     let mut i = 0;
     while i < times {
-        let guard: RwLockReadGuard<BTreeMap<usize, Arc<dyn NetDriver>>> = NET_DRIVERS.read();
-        if guard.len() == 0 {
-            kwarn!("poll_ifaces: No net driver found!");
-            // 没有网卡，返回错误
-            return Err(SystemError::ENODEV);
-        }
+        let guard: PerCpuRwLockReadGuard<BTreeMap<usize, Arc<dyn NetDriver>>> = NET_DRIVERS.read();
         let sockets = SOCKET_SET.try_lock();
         // 加锁失败，继续尝试
         if sockets.is_err() {
@@ -151,10 +312,7 @@ pub fn poll_ifaces_try_lock(times: u16) -> Result<(), SystemError> {
         }
 
         let mut sockets = sockets.unwrap();
-        for (_, iface) in guard.iter() {
-            iface.poll(&mut sockets).ok();
-        }
-        SOCKET_WAITQUEUE.wakeup_all(None);
+        poll_all(&guard, &mut sockets);
         return Ok(());
     }
 
@@ -164,20 +322,16 @@ pub fn poll_ifaces_try_lock(times: u16) -> Result<(), SystemError> {
 
 /// 对ifaces进行轮询，最多对SOCKET_SET尝试一次加锁。
 ///
+/// 已经有cpu在[`poll_ifaces`]中轮询时（例如网卡中断打断了轮询者），只请求它再轮询一次，然后直接返回成功
+///
 /// @return 轮询成功，返回Ok(())
 /// @return 加锁超时，返回SystemError::EAGAIN_OR_EWOULDBLOCK
-/// @return 没有网卡，返回SystemError::ENODEV
 pub fn poll_ifaces_try_lock_onetime() -> Result<(), SystemError> {
-    let guard: RwLockReadGuard<BTreeMap<usize, Arc<dyn NetDriver>>> = NET_DRIVERS.read();
-    if guard.len() == 0 {
-        kwarn!("poll_ifaces: No net driver found!");
-        // 没有网卡，返回错误
-        return Err(SystemError::ENODEV);
+    if poll_piggyback() {
+        return Ok(());
     }
+    let guard: PerCpuRwLockReadGuard<BTreeMap<usize, Arc<dyn NetDriver>>> = NET_DRIVERS.read();
     let mut sockets = SOCKET_SET.try_lock()?;
-    for (_, iface) in guard.iter() {
-        iface.poll(&mut sockets).ok();
-    }
-    SOCKET_WAITQUEUE.wakeup_all(None);
+    poll_all(&guard, &mut sockets);
     return Ok(());
 }
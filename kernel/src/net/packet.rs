@@ -0,0 +1,1054 @@
+//! AF_PACKET socket，以及内存映射的收发包环（PACKET_RX_RING/PACKET_TX_RING，TPACKET_V3）
+//!
+//! 网卡驱动的收包路径经过[`PacketTap`]：以太网帧在交给smoltcp之前，直接从驱动的缓冲区复制到packet socket中。
+//! 设置了收包环的socket，帧被写入环中当前的块，块写满或者超时之后交给用户程序；用户程序处理完一个块，
+//! 把块的状态写回TP_STATUS_KERNEL即可归还，整个过程不需要系统调用。没有设置收包环的socket，帧放入接收队列，通过recvfrom读取。
+//!
+//! 发包环由用户程序填写帧，并把帧的状态设置为TP_STATUS_SEND_REQUEST，之后调用一次send，内核发出所有待发送的帧。
+//!
+//! 接口号（sll_ifindex）为网卡的id加1，0表示所有网卡。环回接口上的分组不经过这里。
+
+use core::{
+    cmp::min,
+    mem::size_of,
+    sync::atomic::{AtomicU32, AtomicUsize, Ordering},
+};
+
+use alloc::{
+    boxed::Box,
+    collections::VecDeque,
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+use num_traits::FromPrimitive;
+use smoltcp::phy;
+
+use crate::{
+    arch::{mm::LockedFrameAllocator, MMArch},
+    kwarn,
+    libs::{spinlock::SpinLock, wait_queue::WaitQueue},
+    mm::{
+        allocator::page_frame::{FrameAllocator, PageFrameCount, PhysPageFrame, VirtPageFrame},
+        syscall::{MapFlags, ProtFlags},
+        ucontext::{AddressSpace, Provider, VmFlags, DEFAULT_MMAP_MIN_ADDR, VMA},
+        MemoryManagementArch, PhysAddr, VirtAddr,
+    },
+    syscall::SystemError,
+    time::{
+        timekeeping::getnstimeofday,
+        timer::{next_n_us_timer_jiffies, Timer, TimerFunction},
+        Duration, Instant,
+    },
+};
+
+use super::{
+    endpoints::LinkLayerEndpoint,
+    socket::{
+        parse_socket_buf_size, set_socket_option_flag, AddressFamily, SocketMetadata,
+        SocketOptions, SocketType,
+    },
+    syscall::SockAddrLl,
+    Endpoint, Socket, NET_DRIVERS,
+};
+
+/// setsockopt中packet socket的选项所在的层次
+pub const SOL_PACKET: usize = 263;
+/// 接收所有协议的分组
+const ETH_P_ALL: u16 = 0x0003;
+/// 以太网头部的长度
+const ETH_HLEN: usize = 14;
+/// sll_hatype：以太网
+const ARPHRD_ETHER: u16 = 1;
+
+/// 没有设置收包环时，接收队列最多容纳的字节数
+const PACKET_QUEUE_BYTES: usize = 256 * 1024;
+/// 用户没有指定块的超时时间时使用的值
+const DEFAULT_RETIRE_TOV: Duration = Duration::from_millis(8);
+
+/// packet socket的选项（SOL_PACKET层次）
+#[allow(non_camel_case_types)]
+#[derive(Debug, Clone, Copy, FromPrimitive, PartialEq, Eq)]
+enum PacketSocketOption {
+    PACKET_RX_RING = 5,
+    PACKET_VERSION = 10,
+    PACKET_TX_RING = 13,
+}
+
+/// 环的格式
+const TPACKET_V3: u32 = 2;
+
+/// 块、帧的状态（参见include/uapi/linux/if_packet.h）
+const TP_STATUS_KERNEL: u32 = 0;
+const TP_STATUS_USER: u32 = 1 << 0;
+const TP_STATUS_BLK_TMO: u32 = 1 << 5;
+const TP_STATUS_AVAILABLE: u32 = 0;
+const TP_STATUS_SEND_REQUEST: u32 = 1 << 0;
+const TP_STATUS_SENDING: u32 = 1 << 1;
+const TP_STATUS_WRONG_FORMAT: u32 = 1 << 2;
+
+/// sll_pkttype
+const PACKET_HOST: u8 = 0;
+const PACKET_BROADCAST: u8 = 1;
+const PACKET_MULTICAST: u8 = 2;
+
+/// setsockopt(PACKET_RX_RING/PACKET_TX_RING)的参数
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+struct TpacketReq3 {
+    tp_block_size: u32,
+    tp_block_nr: u32,
+    tp_frame_size: u32,
+    tp_frame_nr: u32,
+    tp_retire_blk_tov: u32,
+    tp_sizeof_priv: u32,
+    tp_feature_req_word: u32,
+}
+
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+struct TpacketBdTs {
+    ts_sec: u32,
+    ts_nsec: u32,
+}
+
+/// 收包环中每个块开头的块描述符（struct tpacket_block_desc + struct tpacket_hdr_v1）
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+struct TpacketBlockDesc {
+    version: u32,
+    offset_to_priv: u32,
+    block_status: u32,
+    num_pkts: u32,
+    offset_to_first_pkt: u32,
+    blk_len: u32,
+    seq_num: u64,
+    ts_first_pkt: TpacketBdTs,
+    ts_last_pkt: TpacketBdTs,
+}
+
+/// 每个帧开头的帧头（struct tpacket3_hdr）
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+struct Tpacket3Hdr {
+    tp_next_offset: u32,
+    tp_sec: u32,
+    tp_nsec: u32,
+    tp_snaplen: u32,
+    tp_len: u32,
+    tp_status: u32,
+    tp_mac: u16,
+    tp_net: u16,
+    tp_rxhash: u32,
+    tp_vlan_tci: u32,
+    tp_vlan_tpid: u16,
+    tp_padding: u16,
+    tp_padding2: [u8; 8],
+}
+
+const fn tpacket_align(x: usize) -> usize {
+    return (x + 15) & !15;
+}
+
+const fn align8(x: usize) -> usize {
+    return (x + 7) & !7;
+}
+
+/// 块描述符中block_status的偏移量
+const BLK_STATUS_OFFSET: usize = 8;
+/// 帧头中tp_status的偏移量
+const FRAME_STATUS_OFFSET: usize = 20;
+/// 块描述符的长度
+const BLK_HDR_LEN: usize = align8(size_of::<TpacketBlockDesc>());
+/// 帧头之后的sockaddr_ll在帧内的偏移量
+const FRAME_SLL_OFFSET: usize = tpacket_align(size_of::<Tpacket3Hdr>());
+/// TPACKET3_HDRLEN：帧头加上sockaddr_ll
+const TPACKET3_HDRLEN: usize = FRAME_SLL_OFFSET + size_of::<SockAddrLl>();
+/// 收到的帧中网络层头部的偏移量（与Linux相同，至少为帧头之后再留出16字节）
+const RX_NET_OFFSET: usize = tpacket_align(TPACKET3_HDRLEN + 16);
+/// 收到的帧中以太网头部的偏移量
+const RX_MAC_OFFSET: usize = RX_NET_OFFSET - ETH_HLEN;
+/// 发包环中帧的数据的偏移量
+const TX_DATA_OFFSET: usize = TPACKET3_HDRLEN - size_of::<SockAddrLl>();
+
+lazy_static! {
+    /// 所有的packet socket，收包路径按顺序把帧交给它们
+    static ref PACKET_SOCKETS: SpinLock<Vec<Arc<PacketSocketInner>>> = SpinLock::new(Vec::new());
+}
+/// packet socket的数量。没有packet socket时，收包路径只需要读取这个值
+static PACKET_SOCKET_NR: AtomicUsize = AtomicUsize::new(0);
+
+/// 网卡`nic_id`对应的接口号
+#[inline]
+pub fn nic_ifindex(nic_id: usize) -> usize {
+    return nic_id + 1;
+}
+
+/// 网卡`nic_id`收到了以太网帧`frame`，交给所有匹配的packet socket
+pub fn packet_rx(nic_id: usize, frame: &[u8]) {
+    if PACKET_SOCKET_NR.load(Ordering::Relaxed) == 0 || frame.len() < ETH_HLEN {
+        return;
+    }
+    let ifindex = nic_ifindex(nic_id);
+    let sockets = PACKET_SOCKETS.lock_irqsave();
+    for socket in sockets.iter() {
+        if socket.accepts(ifindex, frame) {
+            socket.deliver(ifindex, frame);
+        }
+    }
+}
+
+/// 包裹网卡的smoltcp设备：收到的帧在交给smoltcp之前先经过[`packet_rx`]
+///
+/// 网卡驱动在poll的时候，用它包裹自己的设备传给smoltcp
+pub struct PacketTap<'a, D: phy::Device> {
+    inner: &'a mut D,
+    nic_id: usize,
+}
+
+impl<'a, D: phy::Device> PacketTap<'a, D> {
+    pub fn new(inner: &'a mut D, nic_id: usize) -> Self {
+        return Self { inner, nic_id };
+    }
+}
+
+pub struct PacketTapRxToken<T: phy::RxToken> {
+    inner: T,
+    nic_id: usize,
+}
+
+impl<T: phy::RxToken> phy::RxToken for PacketTapRxToken<T> {
+    fn consume<R, F>(self, f: F) -> R
+    where
+        F: FnOnce(&mut [u8]) -> R,
+    {
+        let nic_id = self.nic_id;
+        return self.inner.consume(|buffer| {
+            packet_rx(nic_id, buffer);
+            f(buffer)
+        });
+    }
+}
+
+impl<'a, D: phy::Device> phy::Device for PacketTap<'a, D> {
+    type RxToken<'b>
+        = PacketTapRxToken<D::RxToken<'b>>
+    where
+        Self: 'b;
+    type TxToken<'b>
+        = D::TxToken<'b>
+    where
+        Self: 'b;
+
+    fn receive(
+        &mut self,
+        timestamp: smoltcp::time::Instant,
+    ) -> Option<(Self::RxToken<'_>, Self::TxToken<'_>)> {
+        let nic_id = self.nic_id;
+        let (rx, tx) = self.inner.receive(timestamp)?;
+        return Some((PacketTapRxToken { inner: rx, nic_id }, tx));
+    }
+
+    fn transmit(&mut self, timestamp: smoltcp::time::Instant) -> Option<Self::TxToken<'_>> {
+        return self.inner.transmit(timestamp);
+    }
+
+    fn capabilities(&self) -> phy::DeviceCapabilities {
+        return self.inner.capabilities();
+    }
+}
+
+/// 收包环或者发包环。由若干个物理上连续的块组成，块内按照帧的大小划分为帧
+///
+/// 映射到用户空间的VMA持有环的引用，因此socket关闭之后，环仍然保留到所有的映射都被解除
+#[derive(Debug)]
+struct PacketRing {
+    /// 每个块的物理地址，以及分配到的页帧数量
+    blocks: Vec<(PhysAddr, PageFrameCount)>,
+    block_size: usize,
+    frame_size: usize,
+    frame_nr: usize,
+    /// 块的私有区域的大小（收包环）
+    sizeof_priv: usize,
+    /// 块的超时时间（收包环）：块中有分组、但是超过这个时间仍然没有写满时，也交给用户程序
+    retire_tov: Duration,
+}
+
+impl PacketRing {
+    fn new(req: &TpacketReq3) -> Result<Arc<Self>, SystemError> {
+        let block_size = req.tp_block_size as usize;
+        let block_nr = req.tp_block_nr as usize;
+        let frame_size = req.tp_frame_size as usize;
+        let frame_nr = req.tp_frame_nr as usize;
+        if block_size == 0
+            || block_size % MMArch::PAGE_SIZE != 0
+            || block_nr == 0
+            || frame_size < TPACKET3_HDRLEN
+            || frame_size % 16 != 0
+            || frame_size > block_size
+            || (block_size / frame_size) * block_nr != frame_nr
+            || align8(BLK_HDR_LEN) + align8(req.tp_sizeof_priv as usize) + RX_MAC_OFFSET
+                >= block_size
+        {
+            return Err(SystemError::EINVAL);
+        }
+
+        let mut ring = Self {
+            blocks: Vec::with_capacity(block_nr),
+            block_size,
+            frame_size,
+            frame_nr,
+            sizeof_priv: req.tp_sizeof_priv as usize,
+            retire_tov: match req.tp_retire_blk_tov {
+                0 => DEFAULT_RETIRE_TOV,
+                ms => Duration::from_millis(ms as u64),
+            },
+        };
+        let count = PageFrameCount::new(block_size / MMArch::PAGE_SIZE);
+        for _ in 0..block_nr {
+            // 分配失败时，已经分配的块随着ring一起释放
+            let block =
+                unsafe { LockedFrameAllocator.allocate(count) }.ok_or(SystemError::ENOMEM)?;
+            ring.blocks.push(block);
+            unsafe {
+                MMArch::write_bytes(MMArch::phys_2_virt(block.0).unwrap(), 0, block_size);
+            }
+        }
+        return Ok(Arc::new(ring));
+    }
+
+    #[inline]
+    fn size(&self) -> usize {
+        return self.blocks.len() * self.block_size;
+    }
+
+    /// 第`index`个块在内核中的地址
+    #[inline]
+    fn block(&self, index: usize) -> *mut u8 {
+        return unsafe { MMArch::phys_2_virt(self.blocks[index].0).unwrap().data() as *mut u8 };
+    }
+
+    /// 第`index`个帧在内核中的地址
+    #[inline]
+    fn frame(&self, index: usize) -> *mut u8 {
+        let frames_per_block = self.block_size / self.frame_size;
+        return unsafe {
+            self.block(index / frames_per_block)
+                .add((index % frames_per_block) * self.frame_size)
+        };
+    }
+
+    /// 收包环中第一个分组在块内的偏移量
+    #[inline]
+    fn first_pkt_offset(&self) -> usize {
+        return BLK_HDR_LEN + align8(self.sizeof_priv);
+    }
+
+    /// 第`index`个块的状态，与用户程序共享
+    #[inline]
+    fn block_status(&self, index: usize) -> &AtomicU32 {
+        return unsafe { &*(self.block(index).add(BLK_STATUS_OFFSET) as *const AtomicU32) };
+    }
+
+    /// 第`index`个帧的状态，与用户程序共享
+    #[inline]
+    fn frame_status(&self, index: usize) -> &AtomicU32 {
+        return unsafe { &*(self.frame(index).add(FRAME_STATUS_OFFSET) as *const AtomicU32) };
+    }
+
+    /// 把整个环映射到用户地址空间中从`vaddr`开始的位置，每个块对应一个VMA
+    fn map(self: &Arc<Self>, vaddr: VirtAddr, prot_flags: ProtFlags) -> Result<(), SystemError> {
+        let address_space = AddressSpace::current()?;
+        let mut vm = address_space.write();
+        for (i, &(paddr, _)) in self.blocks.iter().enumerate() {
+            let ring = self.clone();
+            let r = vm.mmap(
+                Some(vaddr + i * self.block_size),
+                PageFrameCount::new(self.block_size / MMArch::PAGE_SIZE),
+                prot_flags,
+                MapFlags::MAP_SHARED | MapFlags::MAP_FIXED_NOREPLACE,
+                move |page, count, flags, mapper, flusher| {
+                    let vma = VMA::physmap(
+                        PhysPageFrame::new(paddr),
+                        page,
+                        count,
+                        flags,
+                        mapper,
+                        flusher,
+                    )?;
+                    let mut guard = vma.lock();
+                    guard.set_vm_flags(VmFlags::VM_SPECIAL);
+                    guard.set_provider(Provider::Shared(ring));
+                    drop(guard);
+                    Ok(vma)
+                },
+            );
+            if let Err(e) = r {
+                if i > 0 {
+                    vm.munmap(
+                        VirtPageFrame::new(vaddr),
+                        PageFrameCount::new(i * self.block_size / MMArch::PAGE_SIZE),
+                    )
+                    .ok();
+                }
+                return Err(e);
+            }
+        }
+        return Ok(());
+    }
+}
+
+impl Drop for PacketRing {
+    fn drop(&mut self) {
+        for &(paddr, count) in self.blocks.iter() {
+            unsafe { LockedFrameAllocator.free(paddr, count) };
+        }
+    }
+}
+
+/// 收包环中内核正在填写的块
+#[derive(Debug)]
+struct RxBlockCursor {
+    block: usize,
+    /// 块头是否已经初始化
+    open: bool,
+    /// 下一个分组在块内的偏移量
+    offset: usize,
+    /// 上一个分组在块内的偏移量
+    last: usize,
+    num_pkts: u32,
+    seq: u64,
+    /// 块中第一个分组到达的时刻
+    first_at: Instant,
+}
+
+impl RxBlockCursor {
+    fn new() -> Self {
+        return Self {
+            block: 0,
+            open: false,
+            offset: 0,
+            last: 0,
+            num_pkts: 0,
+            seq: 0,
+            first_at: Instant::ZERO,
+        };
+    }
+}
+
+#[derive(Debug)]
+struct PacketState {
+    /// 绑定的接口号，0表示所有网卡
+    ifindex: usize,
+    version: u32,
+    rx_ring: Option<Arc<PacketRing>>,
+    rx_cursor: RxBlockCursor,
+    /// 是否已经有一个等待块超时的定时器
+    retire_timer_pending: bool,
+    tx_ring: Option<Arc<PacketRing>>,
+    /// 发包环中下一个要检查的帧
+    tx_cursor: usize,
+    /// 没有设置收包环时的接收队列：(接口号, 帧)
+    queue: VecDeque<(usize, Vec<u8>)>,
+    queue_bytes: usize,
+    queue_limit: usize,
+    /// 因为收包环或者接收队列已满而丢弃的分组数
+    drops: u64,
+}
+
+/// 一个packet socket的、被收包路径共享的部分
+#[derive(Debug)]
+struct PacketSocketInner {
+    /// 接收的协议（以太网类型，主机字节序），ETH_P_ALL表示所有协议，0表示不接收
+    protocol: u16,
+    state: SpinLock<PacketState>,
+    wait_queue: Arc<WaitQueue>,
+    self_ref: Weak<PacketSocketInner>,
+}
+
+impl PacketSocketInner {
+    fn accepts(&self, ifindex: usize, frame: &[u8]) -> bool {
+        let protocol = match self.protocol {
+            0 => return false,
+            ETH_P_ALL => true,
+            p => u16::from_be_bytes([frame[12], frame[13]]) == p,
+        };
+        if !protocol {
+            return false;
+        }
+        let bound = self.state.lock_irqsave().ifindex;
+        return bound == 0 || bound == ifindex;
+    }
+
+    fn deliver(&self, ifindex: usize, frame: &[u8]) {
+        let mut state = self.state.lock_irqsave();
+        let wakeup = match state.rx_ring.clone() {
+            Some(ring) => self.rx_ring_put(&mut state, &ring, ifindex, frame),
+            None => {
+                if state.queue_bytes + frame.len() > state.queue_limit {
+                    state.drops += 1;
+                    false
+                } else {
+                    state.queue_bytes += frame.len();
+                    state.queue.push_back((ifindex, frame.to_vec()));
+                    true
+                }
+            }
+        };
+        drop(state);
+        if wakeup {
+            self.wait_queue.wakeup_all(None);
+        }
+    }
+
+    /// 把帧写入收包环，返回是否有块交给了用户程序（或者帧进入了一个新的块）
+    fn rx_ring_put(
+        &self,
+        state: &mut PacketState,
+        ring: &Arc<PacketRing>,
+        ifindex: usize,
+        frame: &[u8],
+    ) -> bool {
+        let first_pkt = ring.first_pkt_offset();
+        let snaplen = min(frame.len(), ring.block_size - first_pkt - RX_MAC_OFFSET);
+        let total = align8(RX_MAC_OFFSET + snaplen);
+        let mut wakeup = false;
+
+        if state.rx_cursor.open && state.rx_cursor.offset + total > ring.block_size {
+            Self::close_block(state, ring, TP_STATUS_USER);
+            wakeup = true;
+        }
+        if !state.rx_cursor.open {
+            // 下一个块还没有被用户程序归还
+            if ring
+                .block_status(state.rx_cursor.block)
+                .load(Ordering::Acquire)
+                != TP_STATUS_KERNEL
+            {
+                state.drops += 1;
+                return wakeup;
+            }
+            Self::open_block(state, ring);
+        }
+
+        let now = getnstimeofday();
+        let cursor = &mut state.rx_cursor;
+        let hdr = Tpacket3Hdr {
+            tp_next_offset: total as u32,
+            tp_sec: now.tv_sec as u32,
+            tp_nsec: now.tv_nsec as u32,
+            tp_snaplen: snaplen as u32,
+            tp_len: frame.len() as u32,
+            tp_status: TP_STATUS_USER,
+            tp_mac: RX_MAC_OFFSET as u16,
+            tp_net: RX_NET_OFFSET as u16,
+            ..Default::default()
+        };
+        let sll = Self::sockaddr_ll(ifindex, frame);
+        unsafe {
+            let base = ring.block(cursor.block).add(cursor.offset);
+            core::ptr::write_volatile(base as *mut Tpacket3Hdr, hdr);
+            core::ptr::write_volatile(base.add(FRAME_SLL_OFFSET) as *mut SockAddrLl, sll);
+            core::ptr::copy_nonoverlapping(frame.as_ptr(), base.add(RX_MAC_OFFSET), snaplen);
+        }
+        if cursor.num_pkts == 0 {
+            cursor.first_at = Instant::now();
+            let desc = ring.block(cursor.block) as *mut TpacketBlockDesc;
+            unsafe {
+                (*desc).ts_first_pkt = TpacketBdTs {
+                    ts_sec: now.tv_sec as u32,
+                    ts_nsec: now.tv_nsec as u32,
+                };
+            }
+        }
+        cursor.last = cursor.offset;
+        cursor.offset += total;
+        cursor.num_pkts += 1;
+
+        if !state.retire_timer_pending {
+            state.retire_timer_pending = true;
+            let timer = Timer::new(
+                Box::new(PacketRetireFunc {
+                    socket: self.self_ref.clone(),
+                }),
+                next_n_us_timer_jiffies(ring.retire_tov.total_micros()),
+            );
+            timer.activate();
+        }
+        return wakeup;
+    }
+
+    fn open_block(state: &mut PacketState, ring: &PacketRing) {
+        let cursor = &mut state.rx_cursor;
+        cursor.seq += 1;
+        cursor.open = true;
+        cursor.offset = ring.first_pkt_offset();
+        cursor.last = cursor.offset;
+        cursor.num_pkts = 0;
+        let desc = TpacketBlockDesc {
+            version: TPACKET_V3,
+            offset_to_priv: BLK_HDR_LEN as u32,
+            block_status: TP_STATUS_KERNEL,
+            num_pkts: 0,
+            offset_to_first_pkt: cursor.offset as u32,
+            blk_len: cursor.offset as u32,
+            seq_num: cursor.seq,
+            ..Default::default()
+        };
+        unsafe {
+            core::ptr::write_volatile(ring.block(cursor.block) as *mut TpacketBlockDesc, desc)
+        };
+    }
+
+    /// 把当前的块交给用户程序，`status`为块的新状态
+    fn close_block(state: &mut PacketState, ring: &PacketRing, status: u32) {
+        let cursor = &mut state.rx_cursor;
+        let block = ring.block(cursor.block);
+        let now = getnstimeofday();
+        unsafe {
+            if cursor.num_pkts > 0 {
+                let last = block.add(cursor.last) as *mut Tpacket3Hdr;
+                (*last).tp_next_offset = 0;
+            }
+            let desc = block as *mut TpacketBlockDesc;
+            (*desc).num_pkts = cursor.num_pkts;
+            (*desc).blk_len = cursor.offset as u32;
+            (*desc).ts_last_pkt = TpacketBdTs {
+                ts_sec: now.tv_sec as u32,
+                ts_nsec: now.tv_nsec as u32,
+            };
+        }
+        ring.block_status(cursor.block)
+            .store(status, Ordering::Release);
+        cursor.open = false;
+        cursor.block = (cursor.block + 1) % ring.blocks.len();
+    }
+
+    /// 当前的块中有分组、并且已经超时的时候，把它交给用户程序。返回是否交出了块
+    fn retire_stale(state: &mut PacketState) -> bool {
+        let ring = match state.rx_ring.clone() {
+            Some(ring) => ring,
+            None => return false,
+        };
+        if !state.rx_cursor.open
+            || state.rx_cursor.num_pkts == 0
+            || Instant::now() - state.rx_cursor.first_at < ring.retire_tov
+        {
+            return false;
+        }
+        Self::close_block(state, &ring, TP_STATUS_USER | TP_STATUS_BLK_TMO);
+        return true;
+    }
+
+    fn sockaddr_ll(ifindex: usize, frame: &[u8]) -> SockAddrLl {
+        let dst = &frame[0..6];
+        let pkttype = if dst.iter().all(|&b| b == 0xff) {
+            PACKET_BROADCAST
+        } else if dst[0] & 1 != 0 {
+            PACKET_MULTICAST
+        } else {
+            PACKET_HOST
+        };
+        let mut sll_addr = [0u8; 8];
+        sll_addr[..6].copy_from_slice(&frame[6..12]);
+        return SockAddrLl {
+            sll_family: AddressFamily::Packet as u16,
+            sll_protocol: u16::from_ne_bytes([frame[12], frame[13]]),
+            sll_ifindex: ifindex as u32,
+            sll_hatype: ARPHRD_ETHER,
+            sll_pkttype: pkttype,
+            sll_halen: 6,
+            sll_addr,
+        };
+    }
+}
+
+/// 收包环的块超时之后，把它交给用户程序
+#[derive(Debug)]
+struct PacketRetireFunc {
+    socket: Weak<PacketSocketInner>,
+}
+
+impl TimerFunction for PacketRetireFunc {
+    fn run(&mut self) -> Result<(), SystemError> {
+        let socket = match self.socket.upgrade() {
+            Some(socket) => socket,
+            None => return Ok(()),
+        };
+        let mut state = socket.state.lock_irqsave();
+        state.retire_timer_pending = false;
+        let retired = PacketSocketInner::retire_stale(&mut state);
+        // 当前的块是在定时器设置之后才开始接收的，为它重新设置定时器
+        if let Some(ring) = state.rx_ring.clone() {
+            if state.rx_cursor.open && state.rx_cursor.num_pkts > 0 {
+                state.retire_timer_pending = true;
+                let elapsed = Instant::now() - state.rx_cursor.first_at;
+                let remain = ring.retire_tov - min(ring.retire_tov, elapsed);
+                let timer = Timer::new(
+                    Box::new(PacketRetireFunc {
+                        socket: self.socket.clone(),
+                    }),
+                    next_n_us_timer_jiffies(remain.total_micros().max(1)),
+                );
+                timer.activate();
+            }
+        }
+        drop(state);
+        if retired {
+            socket.wait_queue.wakeup_all(None);
+        }
+        return Ok(());
+    }
+}
+
+/// 在Drop时把socket从[`PACKET_SOCKETS`]中删除。socket的所有副本共享同一个PacketHandle
+#[derive(Debug)]
+struct PacketHandle(Arc<PacketSocketInner>);
+
+impl Drop for PacketHandle {
+    fn drop(&mut self) {
+        let mut sockets = PACKET_SOCKETS.lock_irqsave();
+        sockets.retain(|s| !Arc::ptr_eq(s, &self.0));
+        PACKET_SOCKET_NR.store(sockets.len(), Ordering::Relaxed);
+    }
+}
+
+/// @brief 表示AF_PACKET socket（SOCK_RAW）：收发完整的以太网帧
+///
+/// https://man7.org/linux/man-pages/man7/packet.7.html
+#[derive(Debug, Clone)]
+pub struct PacketSocket {
+    handle: Arc<PacketHandle>,
+    metadata: SocketMetadata,
+}
+
+impl PacketSocket {
+    /// @brief 创建一个packet socket
+    ///
+    /// @param protocol 接收的协议（网络字节序的以太网类型），与socket(2)的protocol参数相同
+    /// @param options socket的选项
+    pub fn new(protocol: u16, options: SocketOptions) -> Self {
+        let inner = Arc::new_cyclic(|self_ref| PacketSocketInner {
+            protocol: u16::from_be(protocol),
+            state: SpinLock::new(PacketState {
+                ifindex: 0,
+                version: 0,
+                rx_ring: None,
+                rx_cursor: RxBlockCursor::new(),
+                retire_timer_pending: false,
+                tx_ring: None,
+                tx_cursor: 0,
+                queue: VecDeque::new(),
+                queue_bytes: 0,
+                queue_limit: PACKET_QUEUE_BYTES,
+                drops: 0,
+            }),
+            wait_queue: Arc::new(WaitQueue::INIT),
+            self_ref: self_ref.clone(),
+        });
+        let mut sockets = PACKET_SOCKETS.lock_irqsave();
+        sockets.push(inner.clone());
+        PACKET_SOCKET_NR.store(sockets.len(), Ordering::Relaxed);
+        drop(sockets);
+
+        let metadata = SocketMetadata::new(
+            SocketType::PacketSocket,
+            PACKET_QUEUE_BYTES,
+            PACKET_QUEUE_BYTES,
+            0,
+            options,
+        );
+        return Self {
+            handle: Arc::new(PacketHandle(inner)),
+            metadata,
+        };
+    }
+
+    #[inline]
+    fn inner(&self) -> &Arc<PacketSocketInner> {
+        return &self.handle.0;
+    }
+
+    /// 通过接口`ifindex`发出一个帧
+    fn transmit(ifindex: usize, frame: &[u8]) -> Result<(), SystemError> {
+        if ifindex == 0 {
+            return Err(SystemError::ENXIO);
+        }
+        let driver = NET_DRIVERS
+            .read()
+            .get(&(ifindex - 1))
+            .cloned()
+            .ok_or(SystemError::ENXIO)?;
+        return driver.transmit_frame(frame);
+    }
+
+    /// 发出发包环中所有状态为TP_STATUS_SEND_REQUEST的帧，返回发出的字节数
+    fn flush_tx_ring(&self, ring: &PacketRing) -> Result<usize, SystemError> {
+        let mut state = self.inner().state.lock_irqsave();
+        let ifindex = state.ifindex;
+        let mut sent = 0;
+        for _ in 0..ring.frame_nr {
+            let index = state.tx_cursor;
+            let status = ring.frame_status(index);
+            if status.load(Ordering::Acquire) != TP_STATUS_SEND_REQUEST {
+                break;
+            }
+            status.store(TP_STATUS_SENDING, Ordering::Relaxed);
+            let hdr = unsafe { core::ptr::read_volatile(ring.frame(index) as *const Tpacket3Hdr) };
+            let len = hdr.tp_len as usize;
+            if len > ring.frame_size - TX_DATA_OFFSET || len < ETH_HLEN {
+                status.store(TP_STATUS_WRONG_FORMAT, Ordering::Release);
+                return Err(SystemError::EINVAL);
+            }
+            let frame =
+                unsafe { core::slice::from_raw_parts(ring.frame(index).add(TX_DATA_OFFSET), len) };
+            if let Err(e) = Self::transmit(ifindex, frame) {
+                // 发送失败的帧留在环中，用户程序可以再次调用send
+                status.store(TP_STATUS_SEND_REQUEST, Ordering::Release);
+                if sent == 0 {
+                    return Err(e);
+                }
+                break;
+            }
+            status.store(TP_STATUS_AVAILABLE, Ordering::Release);
+            sent += len;
+            state.tx_cursor = (index + 1) % ring.frame_nr;
+        }
+        return Ok(sent);
+    }
+
+    fn set_ring(&self, tx: bool, optval: &[u8]) -> Result<(), SystemError> {
+        if optval.len() < size_of::<TpacketReq3>() {
+            return Err(SystemError::EINVAL);
+        }
+        let req = unsafe { core::ptr::read_unaligned(optval.as_ptr() as *const TpacketReq3) };
+        let mut state = self.inner().state.lock_irqsave();
+        if state.version != TPACKET_V3 {
+            // 只支持TPACKET_V3格式的环
+            return Err(SystemError::EINVAL);
+        }
+        // 环已经被映射时不能替换：映射环的VMA持有它的引用
+        let old = if tx { &state.tx_ring } else { &state.rx_ring };
+        if old.as_ref().is_some_and(|r| Arc::strong_count(r) > 1) {
+            return Err(SystemError::EBUSY);
+        }
+        let ring = if req.tp_block_nr == 0 {
+            None
+        } else {
+            Some(PacketRing::new(&req)?)
+        };
+        if tx {
+            state.tx_ring = ring;
+            state.tx_cursor = 0;
+        } else {
+            state.rx_ring = ring;
+            state.rx_cursor = RxBlockCursor::new();
+        }
+        return Ok(());
+    }
+}
+
+impl Socket for PacketSocket {
+    fn read(&self, buf: &mut [u8]) -> (Result<usize, SystemError>, Endpoint) {
+        let inner = self.inner();
+        loop {
+            let mut state = inner.state.lock_irqsave();
+            if state.rx_ring.is_some() {
+                // 设置了收包环之后，分组都进入环中
+                return (
+                    Err(SystemError::EAGAIN_OR_EWOULDBLOCK),
+                    Endpoint::LinkLayer(LinkLayerEndpoint::new(0)),
+                );
+            }
+            if let Some((ifindex, frame)) = state.queue.pop_front() {
+                state.queue_bytes -= frame.len();
+                drop(state);
+                let len = min(buf.len(), frame.len());
+                buf[..len].copy_from_slice(&frame[..len]);
+                return (
+                    Ok(len),
+                    Endpoint::LinkLayer(LinkLayerEndpoint::new(ifindex)),
+                );
+            }
+            if !self.metadata.options.contains(SocketOptions::BLOCK) {
+                return (
+                    Err(SystemError::EAGAIN_OR_EWOULDBLOCK),
+                    Endpoint::LinkLayer(LinkLayerEndpoint::new(0)),
+                );
+            }
+            if crate::filesystem::vfs::poll::signal_pending() {
+                return (
+                    Err(SystemError::EINTR),
+                    Endpoint::LinkLayer(LinkLayerEndpoint::new(0)),
+                );
+            }
+            inner.wait_queue.sleep_unlock_spinlock(state);
+        }
+    }
+
+    /// 发送一个帧。设置了发包环时，`buf`被忽略，发出环中所有待发送的帧
+    fn write(&self, buf: &[u8], to: Option<Endpoint>) -> Result<usize, SystemError> {
+        let (ifindex, tx_ring) = {
+            let state = self.inner().state.lock_irqsave();
+            (state.ifindex, state.tx_ring.clone())
+        };
+        if let Some(ring) = tx_ring {
+            return self.flush_tx_ring(&ring);
+        }
+        let ifindex = match to {
+            Some(Endpoint::LinkLayer(endpoint)) if endpoint.interface != 0 => endpoint.interface,
+            _ => ifindex,
+        };
+        if buf.len() < ETH_HLEN {
+            return Err(SystemError::EINVAL);
+        }
+        Self::transmit(ifindex, buf)?;
+        return Ok(buf.len());
+    }
+
+    fn connect(&mut self, _endpoint: Endpoint) -> Result<(), SystemError> {
+        return Err(SystemError::EOPNOTSUPP_OR_ENOTSUP);
+    }
+
+    /// 绑定到一个网卡，之后只接收这个网卡上的帧，发送时默认使用这个网卡
+    fn bind(&mut self, endpoint: Endpoint) -> Result<(), SystemError> {
+        if let Endpoint::LinkLayer(endpoint) = endpoint {
+            if endpoint.interface != 0
+                && !NET_DRIVERS.read().contains_key(&(endpoint.interface - 1))
+            {
+                return Err(SystemError::ENODEV);
+            }
+            self.inner().state.lock_irqsave().ifindex = endpoint.interface;
+            return Ok(());
+        }
+        return Err(SystemError::EINVAL);
+    }
+
+    fn endpoint(&self) -> Option<Endpoint> {
+        let ifindex = self.inner().state.lock_irqsave().ifindex;
+        return Some(Endpoint::LinkLayer(LinkLayerEndpoint::new(ifindex)));
+    }
+
+    fn poll(&self) -> (bool, bool, bool) {
+        let mut state = self.inner().state.lock_irqsave();
+        if PacketSocketInner::retire_stale(&mut state) {
+            self.inner().wait_queue.wakeup_all(None);
+        }
+        let readable = match state.rx_ring.as_ref() {
+            // 与Linux相同：内核正在填写的块的前一个块已经交给了用户程序
+            Some(ring) => {
+                let nr = ring.blocks.len();
+                let prev = (state.rx_cursor.block + nr - 1) % nr;
+                ring.block_status(prev).load(Ordering::Acquire) & TP_STATUS_USER != 0
+            }
+            None => !state.queue.is_empty(),
+        };
+        let writable = match state.tx_ring.as_ref() {
+            Some(ring) => {
+                ring.frame_status(state.tx_cursor).load(Ordering::Acquire) == TP_STATUS_AVAILABLE
+            }
+            None => true,
+        };
+        return (readable, writable, false);
+    }
+
+    fn wait_queue(&self) -> Option<Arc<WaitQueue>> {
+        return Some(self.inner().wait_queue.clone());
+    }
+
+    fn metadata(&self) -> Result<SocketMetadata, SystemError> {
+        return Ok(self.metadata.clone());
+    }
+
+    fn box_clone(&self) -> Box<dyn Socket> {
+        return Box::new(self.clone());
+    }
+
+    fn setsockopt(
+        &mut self,
+        level: usize,
+        optname: usize,
+        optval: &[u8],
+    ) -> Result<(), SystemError> {
+        if level != SOL_PACKET {
+            if let Some((true, size)) = parse_socket_buf_size(level, optname, optval)? {
+                self.metadata.recv_buf_size = size;
+                self.inner().state.lock_irqsave().queue_limit = size;
+                return Ok(());
+            }
+            return set_socket_option_flag(&mut self.metadata.options, level, optname, optval);
+        }
+        match PacketSocketOption::from_usize(optname) {
+            Some(PacketSocketOption::PACKET_VERSION) => {
+                if optval.len() < size_of::<i32>() {
+                    return Err(SystemError::EINVAL);
+                }
+                let version = i32::from_ne_bytes([optval[0], optval[1], optval[2], optval[3]]);
+                let mut state = self.inner().state.lock_irqsave();
+                if state.rx_ring.is_some() || state.tx_ring.is_some() {
+                    return Err(SystemError::EBUSY);
+                }
+                if version as u32 != TPACKET_V3 {
+                    // 只支持TPACKET_V3
+                    return Err(SystemError::EINVAL);
+                }
+                state.version = TPACKET_V3;
+                return Ok(());
+            }
+            Some(PacketSocketOption::PACKET_RX_RING) => return self.set_ring(false, optval),
+            Some(PacketSocketOption::PACKET_TX_RING) => return self.set_ring(true, optval),
+            None => {
+                kwarn!("setsockopt: unsupported packet socket option {optname}");
+                return Err(SystemError::ENOPROTOOPT);
+            }
+        }
+    }
+
+    /// 映射收包环和发包环：收包环在前，发包环紧随其后，长度必须等于两个环的大小之和
+    fn mmap(
+        &self,
+        start_vaddr: VirtAddr,
+        len: usize,
+        prot_flags: ProtFlags,
+        map_flags: MapFlags,
+        offset: usize,
+    ) -> Result<usize, SystemError> {
+        let (rx_ring, tx_ring) = {
+            let state = self.inner().state.lock_irqsave();
+            (state.rx_ring.clone(), state.tx_ring.clone())
+        };
+        let rings: Vec<Arc<PacketRing>> = rx_ring.into_iter().chain(tx_ring).collect();
+        let total: usize = rings.iter().map(|r| r.size()).sum();
+        if rings.is_empty()
+            || offset != 0
+            || len != total
+            || !map_flags.contains(MapFlags::MAP_SHARED)
+        {
+            return Err(SystemError::EINVAL);
+        }
+
+        let region = AddressSpace::current()?.read().mappings.find_free_at(
+            VirtAddr::new(DEFAULT_MMAP_MIN_ADDR),
+            start_vaddr,
+            total,
+            map_flags,
+        )?;
+        let mut vaddr = region.start();
+        for ring in rings.iter() {
+            if let Err(e) = ring.map(vaddr, prot_flags) {
+                if vaddr != region.start() {
+                    let mapped = vaddr - region.start();
+                    AddressSpace::current()?
+                        .write()
+                        .munmap(
+                            VirtPageFrame::new(region.start()),
+                            PageFrameCount::new(mapped / MMArch::PAGE_SIZE),
+                        )
+                        .ok();
+                }
+                return Err(e);
+            }
+            vaddr += ring.size();
+        }
+        return Ok(region.start().data());
+    }
+}
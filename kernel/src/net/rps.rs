@@ -0,0 +1,174 @@
+//! 收包处理的软件分流（RPS/RFS）
+//!
+//! 网卡只有一个收包队列，收包软中断总是落在被网卡中断打断的cpu上。smoltcp的协议处理需要持有整个SOCKET_SET，
+//! 无法按流拆分到多个cpu上并行执行，因此这里在两个可以分流的位置上做调度：
+//!
+//! - 收包软中断（RPS）：网卡中断不在本地处理收包，而是把NET_RX软中断转到最近在读取socket的cpu上，
+//!   使协议处理、数据拷贝与消费数据的进程在同一个cpu上，并把负载从处理网卡中断的cpu上移走；
+//! - 就绪socket的唤醒（RFS）：协议处理结束后，每个socket的唤醒按照“最后一次在这个socket上等待的进程所在的cpu”
+//!   放入对应cpu的积压队列，每个cpu的积压队列通过一次远程调用批量执行。
+//!   唤醒（以及挂在等待队列上的epoll回调）因此在消费者所在的cpu上执行。
+//!
+//! 流到cpu的映射保存在一个按socket句柄散列的表中（类似Linux的rps_sock_flow_table），
+//! 进程在socket上等待时记录当前的cpu。
+
+use core::{
+    hash::{Hash, Hasher},
+    sync::atomic::{AtomicU32, Ordering},
+};
+
+use alloc::{sync::Arc, vec::Vec};
+use smoltcp::iface::SocketHandle;
+
+use crate::{
+    exception::softirq::{softirq_vectors, SoftirqNumber},
+    include::bindings::bindings::smp_get_total_cpu,
+    libs::wait_queue::WaitQueue,
+    mm::percpu::PerCpu,
+    smp::{call_function::smp_call_function_single, core::smp_get_processor_id},
+};
+
+/// 流表的大小（必须是2的幂）
+const RFS_TABLE_SIZE: usize = 256;
+
+/// 每个流（socket）最后一次被消费时所在的cpu，0表示没有记录，否则为cpu号+1
+static RFS_SOCK_CPU: [AtomicU32; RFS_TABLE_SIZE] = [const { AtomicU32::new(0) }; RFS_TABLE_SIZE];
+
+/// 每个cpu最近消费网络数据的次数（每次选择收包cpu时减半）
+static RFS_ACTIVITY: [AtomicU32; PerCpu::MAX_CPU_NUM] =
+    [const { AtomicU32::new(0) }; PerCpu::MAX_CPU_NUM];
+
+/// FNV-1a散列，用于把socket句柄映射到流表中
+struct FlowHasher(u64);
+
+impl Hasher for FlowHasher {
+    fn finish(&self) -> u64 {
+        return self.0;
+    }
+
+    fn write(&mut self, bytes: &[u8]) {
+        for b in bytes {
+            self.0 ^= *b as u64;
+            self.0 = self.0.wrapping_mul(0x100_0000_01b3);
+        }
+    }
+}
+
+fn flow_index(handle: SocketHandle) -> usize {
+    let mut hasher = FlowHasher(0xcbf2_9ce4_8422_2325);
+    handle.hash(&mut hasher);
+    return hasher.finish() as usize & (RFS_TABLE_SIZE - 1);
+}
+
+fn nr_cpus() -> usize {
+    return (unsafe { smp_get_total_cpu() } as usize).min(PerCpu::MAX_CPU_NUM);
+}
+
+/// 记录当前cpu正在消费handle对应的流（在进程等待socket时调用）
+pub fn rfs_record_flow(handle: SocketHandle) {
+    let cpu = smp_get_processor_id();
+    let entry = &RFS_SOCK_CPU[flow_index(handle)];
+    if entry.load(Ordering::Relaxed) != cpu + 1 {
+        entry.store(cpu + 1, Ordering::Relaxed);
+    }
+    RFS_ACTIVITY[cpu as usize].fetch_add(1, Ordering::Relaxed);
+}
+
+/// handle对应的流最后一次被消费时所在的cpu
+fn rfs_flow_cpu(handle: SocketHandle) -> Option<usize> {
+    let cpu = RFS_SOCK_CPU[flow_index(handle)].load(Ordering::Relaxed) as usize;
+    if cpu == 0 || cpu > nr_cpus() {
+        return None;
+    }
+    return Some(cpu - 1);
+}
+
+/// 选择处理收包软中断的cpu：最近消费网络数据最多的cpu。没有消费记录时，在当前cpu上处理
+fn rps_rx_cpu(current: usize) -> usize {
+    let mut target = current;
+    let mut best = 0;
+    for (cpu, activity) in RFS_ACTIVITY.iter().enumerate().take(nr_cpus()) {
+        let n = activity.load(Ordering::Relaxed);
+        if n > best {
+            best = n;
+            target = cpu;
+        }
+        if n != 0 {
+            // 衰减，使选择跟随消费者的迁移
+            activity.store(n / 2, Ordering::Relaxed);
+        }
+    }
+    return target;
+}
+
+/// 在网卡的中断处理函数中调用：触发NET_RX软中断，并按照RPS选择处理它的cpu
+pub fn rps_schedule_rx() {
+    let current = smp_get_processor_id() as usize;
+    let target = rps_rx_cpu(current);
+    if target == current
+        || smp_call_function_single(
+            target,
+            || softirq_vectors().raise_softirq(SoftirqNumber::NetRx),
+            false,
+        )
+        .is_err()
+    {
+        softirq_vectors().raise_softirq(SoftirqNumber::NetRx);
+    }
+}
+
+/// 一轮轮询中需要唤醒的socket，按照消费者所在的cpu分组
+pub struct RfsWakeupBatch {
+    current: usize,
+    /// (cpu, 这个cpu上需要唤醒的等待队列和事件)
+    remote: Vec<(usize, Vec<(Arc<WaitQueue>, u64)>)>,
+}
+
+impl RfsWakeupBatch {
+    pub fn new() -> Self {
+        return Self {
+            current: smp_get_processor_id() as usize,
+            remote: Vec::new(),
+        };
+    }
+
+    /// 唤醒handle对应的socket的等待队列上等待events的进程
+    ///
+    /// 消费者在当前cpu上（或者没有记录、没有人在等待）时立即唤醒，否则放入消费者所在cpu的积压队列
+    pub fn wakeup(&mut self, handle: SocketHandle, wait_queue: &Arc<WaitQueue>, events: u64) {
+        let cpu = match rfs_flow_cpu(handle) {
+            Some(cpu) if cpu != self.current && wait_queue.has_waiters() => cpu,
+            _ => {
+                wait_queue.wakeup_keyed(events, None);
+                return;
+            }
+        };
+        let item = (wait_queue.clone(), events);
+        match self.remote.iter_mut().find(|(c, _)| *c == cpu) {
+            Some((_, items)) => items.push(item),
+            None => self.remote.push((cpu, alloc::vec![item])),
+        }
+    }
+
+    /// 把积压的唤醒发送到各个cpu上执行，每个cpu一次远程调用
+    pub fn flush(self) {
+        for (cpu, items) in self.remote {
+            let items = Arc::new(items);
+            let remote = items.clone();
+            let sent = smp_call_function_single(
+                cpu,
+                move || {
+                    for (wait_queue, events) in remote.iter() {
+                        wait_queue.wakeup_keyed(*events, None);
+                    }
+                },
+                false,
+            );
+            if sent.is_err() {
+                for (wait_queue, events) in items.iter() {
+                    wait_queue.wakeup_keyed(*events, None);
+                }
+            }
+        }
+    }
+}
@@ -1,4 +1,6 @@
 #![allow(dead_code)]
+use core::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+
 use alloc::{boxed::Box, sync::Arc, vec::Vec};
 use hashbrown::HashMap;
 use smoltcp::{
@@ -9,114 +11,213 @@ use smoltcp::{
 
 use crate::{
     arch::rand::rand,
-    driver::net::NetDriver,
-    filesystem::vfs::{syscall::ModeType, FileType, IndexNode, Metadata, PollStatus},
+    driver::net::{loopback::LOOPBACK_IFACE, NetDriver},
+    filesystem::vfs::{
+        poll::PollTable, syscall::ModeType, FileType, IndexNode, Metadata, PollStatus,
+    },
     kerror, kwarn,
     libs::{
+        qspinlock::QueuedSpinLock,
         spinlock::{SpinLock, SpinLockGuard},
         wait_queue::WaitQueue,
     },
+    mm::{
+        percpu::{PerCpu, PerCpuVar},
+        syscall::{MapFlags, ProtFlags},
+        VirtAddr,
+    },
     syscall::SystemError,
+    time::{Duration, Instant},
 };
 
-use super::{net_core::poll_ifaces, Endpoint, Protocol, Socket, NET_DRIVERS};
+use super::{
+    net_core::poll_ifaces,
+    rps::{rfs_record_flow, RfsWakeupBatch},
+    stats::{snmp_inc, SnmpCounter},
+    syscall::PosixSocketOption,
+    Endpoint, Protocol, Socket, NET_DRIVERS,
+};
 
 lazy_static! {
     /// 所有socket的集合
-    /// TODO: 优化这里，自己实现SocketSet！！！现在这样的话，不管全局有多少个网卡，每个时间点都只会有1个进程能够访问socket
-    pub static ref SOCKET_SET: SpinLock<SocketSet<'static >> = SpinLock::new(SocketSet::new(vec![]));
-    pub static ref SOCKET_WAITQUEUE: WaitQueue = WaitQueue::INIT;
+    ///
+    /// smoltcp轮询网卡时只会把收到的数据包交给传入的SocketSet中的socket，因此不能把socket分散到多个集合中，
+    /// 否则发给其他集合中的socket的数据包会被丢弃。这个锁只在访问smoltcp的socket的时候短暂持有，
+    /// socket自身的状态由[`SocketInode`]的锁保护；轮询网卡的时候持有的时间最长，参见[`poll_ifaces`]
+    pub static ref SOCKET_SET: QueuedSpinLock<SocketSet<'static >> = QueuedSpinLock::new(SocketSet::new(vec![]));
+    /// 每个socket的等待队列。轮询网卡之后，只唤醒已经就绪的socket的等待队列
+    static ref SOCKET_WAITQUEUES: SpinLock<HashMap<SocketHandle, Arc<WaitQueue>>> = SpinLock::new(HashMap::new());
     /// 端口管理器
     pub static ref PORT_MANAGER: PortManager = PortManager::new();
 }
 
+/// 选择发往`addr`的分组所使用的接口：本机地址使用环回接口，其他地址使用0号网卡
+///
+/// TODO：考虑多网卡的情况，按照路由表选择网卡
+fn route_iface(addr: &wire::IpAddress) -> Result<Arc<dyn NetDriver>, SystemError> {
+    if addr.is_loopback() {
+        return Ok(LOOPBACK_IFACE.clone());
+    }
+    return NET_DRIVERS
+        .read()
+        .get(&0)
+        .cloned()
+        .ok_or(SystemError::ENETUNREACH);
+}
+
+/// 动态端口的范围（与Linux的默认值相同）
+const EPHEMERAL_PORT_MIN: u16 = 49152;
+const EPHEMERAL_PORT_MAX: u16 = 65535;
+const EPHEMERAL_PORT_COUNT: usize = (EPHEMERAL_PORT_MAX - EPHEMERAL_PORT_MIN) as usize + 1;
+
+/// 端口占用位图：每个端口一位，置位表示端口已经被绑定，或者已经作为动态端口分配给了某个socket
+///
+/// 分配动态端口时通过原子操作抢占空闲的位，不需要持有端口记录表的锁
+struct PortBitmap(Vec<AtomicU64>);
+
+impl PortBitmap {
+    fn new() -> Self {
+        return Self(
+            (0..(u16::MAX as usize + 1) / 64)
+                .map(|_| AtomicU64::new(0))
+                .collect(),
+        );
+    }
+
+    /// 抢占端口。端口原本空闲时返回true
+    #[inline]
+    fn claim(&self, port: u16) -> bool {
+        let mask = 1u64 << (port % 64);
+        return self.0[port as usize / 64].fetch_or(mask, Ordering::AcqRel) & mask == 0;
+    }
+
+    #[inline]
+    fn set(&self, port: u16) {
+        self.0[port as usize / 64].fetch_or(1u64 << (port % 64), Ordering::Release);
+    }
+
+    #[inline]
+    fn clear(&self, port: u16) {
+        self.0[port as usize / 64].fetch_and(!(1u64 << (port % 64)), Ordering::Release);
+    }
+}
+
 /// @brief TCP 和 UDP 的端口管理器。
 /// 如果 TCP/UDP 的 socket 绑定了某个端口，它会在对应的表中记录，以检测端口冲突。
+/// 所有绑定者都设置了SO_REUSEPORT时，多个socket可以绑定同一个端口
 pub struct PortManager {
     // TCP 端口记录表
-    tcp_port_table: SpinLock<HashMap<u16, Arc<GlobalSocketHandle>>>,
+    tcp_port_table: SpinLock<HashMap<u16, Vec<PortBinding>>>,
     // UDP 端口记录表
-    udp_port_table: SpinLock<HashMap<u16, Arc<GlobalSocketHandle>>>,
+    udp_port_table: SpinLock<HashMap<u16, Vec<PortBinding>>>,
+    /// TCP 端口占用位图，与记录表同步更新
+    tcp_port_bitmap: PortBitmap,
+    /// UDP 端口占用位图，与记录表同步更新
+    udp_port_bitmap: PortBitmap,
+    /// 每个cpu分配动态端口的游标。各个cpu从不同的随机位置开始，互不竞争
+    ephemeral_cursor: PerCpuVar<AtomicUsize>,
+}
+
+/// 端口记录表中的一个绑定者
+struct PortBinding {
+    handle: Arc<GlobalSocketHandle>,
+    /// 绑定时是否设置了SO_REUSEPORT
+    reuseport: bool,
 }
 
 impl PortManager {
     pub fn new() -> Self {
+        let cursors = (0..PerCpu::MAX_CPU_NUM)
+            .map(|_| AtomicUsize::new(rand() % EPHEMERAL_PORT_COUNT))
+            .collect();
         return Self {
             tcp_port_table: SpinLock::new(HashMap::new()),
             udp_port_table: SpinLock::new(HashMap::new()),
+            tcp_port_bitmap: PortBitmap::new(),
+            udp_port_bitmap: PortBitmap::new(),
+            ephemeral_cursor: PerCpuVar::new(cursors).unwrap(),
         };
     }
 
-    /// @brief 自动分配一个相对应协议中未被使用的PORT，如果动态端口均已被占用，返回错误码 EADDRINUSE
-    pub fn get_ephemeral_port(&self, socket_type: SocketType) -> Result<u16, SystemError> {
-        // TODO: selects non-conflict high port
-
-        static mut EPHEMERAL_PORT: u16 = 0;
-        unsafe {
-            if EPHEMERAL_PORT == 0 {
-                EPHEMERAL_PORT = (49152 + rand() % (65536 - 49152)) as u16;
-            }
-        }
-
-        let mut remaining = 65536 - 49152; // 剩余尝试分配端口次数
-        let mut port: u16;
-        while remaining > 0 {
-            unsafe {
-                if EPHEMERAL_PORT == 65535 {
-                    EPHEMERAL_PORT = 49152;
-                } else {
-                    EPHEMERAL_PORT = EPHEMERAL_PORT + 1;
-                }
-                port = EPHEMERAL_PORT;
+    fn bitmap(&self, socket_type: SocketType) -> &PortBitmap {
+        return match socket_type {
+            SocketType::UdpSocket => &self.udp_port_bitmap,
+            SocketType::TcpSocket => &self.tcp_port_bitmap,
+            SocketType::RawSocket | SocketType::UnixSocket | SocketType::PacketSocket => {
+                panic!("{socket_type:?} cann't get a port")
             }
+        };
+    }
 
-            // 使用 ListenTable 检查端口是否被占用
-            let listen_table_guard = match socket_type {
-                SocketType::UdpSocket => self.udp_port_table.lock(),
-                SocketType::TcpSocket => self.tcp_port_table.lock(),
-                SocketType::RawSocket => panic!("RawSocket cann't get a port"),
-            };
-            if let None = listen_table_guard.get(&port) {
-                drop(listen_table_guard);
+    /// @brief 自动分配一个相对应协议中未被使用的PORT，如果动态端口均已被占用，返回错误码 EADDRINUSE
+    ///
+    /// 分配到的端口在位图中被标记为占用，调用者随后需要用[`PortManager::bind_port`]绑定它。
+    /// 在动态端口没有用完的时候，期望只需要尝试常数次
+    pub fn get_ephemeral_port(&self, socket_type: SocketType) -> Result<u16, SystemError> {
+        let bitmap = self.bitmap(socket_type);
+        let cursor = self.ephemeral_cursor.get();
+        for _ in 0..EPHEMERAL_PORT_COUNT {
+            let offset = cursor.fetch_add(1, Ordering::Relaxed) % EPHEMERAL_PORT_COUNT;
+            let port = EPHEMERAL_PORT_MIN + offset as u16;
+            if bitmap.claim(port) {
                 return Ok(port);
             }
-            remaining -= 1;
         }
         return Err(SystemError::EADDRINUSE);
     }
 
     /// @brief 检测给定端口是否已被占用，如果未被占用则在 TCP/UDP 对应的表中记录
     ///
-    /// TODO: 增加支持端口复用的逻辑
+    /// @param reuseport 是否设置了SO_REUSEPORT。端口已被占用时，只有新旧绑定者都设置了它才能绑定成功
     pub fn bind_port(
         &self,
         socket_type: SocketType,
         port: u16,
         handle: Arc<GlobalSocketHandle>,
+        reuseport: bool,
     ) -> Result<(), SystemError> {
         if port > 0 {
             let mut listen_table_guard = match socket_type {
                 SocketType::UdpSocket => self.udp_port_table.lock(),
                 SocketType::TcpSocket => self.tcp_port_table.lock(),
-                SocketType::RawSocket => panic!("RawSocket cann't bind a port"),
-            };
-            match listen_table_guard.get(&port) {
-                Some(_) => return Err(SystemError::EADDRINUSE),
-                None => listen_table_guard.insert(port, handle),
+                SocketType::RawSocket | SocketType::UnixSocket | SocketType::PacketSocket => {
+                    panic!("{socket_type:?} cann't bind a port")
+                }
             };
+            let bindings = listen_table_guard.entry(port).or_insert_with(Vec::new);
+            if !bindings.is_empty() && !(reuseport && bindings.iter().all(|b| b.reuseport)) {
+                return Err(SystemError::EADDRINUSE);
+            }
+            bindings.push(PortBinding { handle, reuseport });
+            self.bitmap(socket_type).set(port);
             drop(listen_table_guard);
         }
         return Ok(());
     }
 
     /// @brief 在对应的端口记录表中将端口和 socket 解绑
-    pub fn unbind_port(&self, socket_type: SocketType, port: u16) -> Result<(), SystemError> {
+    ///
+    /// @param handle 绑定时使用的socket句柄，同一个端口的其他绑定者不受影响
+    pub fn unbind_port(
+        &self,
+        socket_type: SocketType,
+        port: u16,
+        handle: SocketHandle,
+    ) -> Result<(), SystemError> {
         let mut listen_table_guard = match socket_type {
             SocketType::UdpSocket => self.udp_port_table.lock(),
             SocketType::TcpSocket => self.tcp_port_table.lock(),
-            SocketType::RawSocket => return Ok(()),
+            SocketType::RawSocket | SocketType::UnixSocket | SocketType::PacketSocket => {
+                return Ok(())
+            }
         };
-        listen_table_guard.remove(&port);
+        if let Some(bindings) = listen_table_guard.get_mut(&port) {
+            bindings.retain(|b| b.handle.0 != handle);
+            if bindings.is_empty() {
+                listen_table_guard.remove(&port);
+                self.bitmap(socket_type).clear(port);
+            }
+        }
         drop(listen_table_guard);
         return Ok(());
     }
@@ -126,21 +227,178 @@ impl PortManager {
 // See: linux-5.19.10/include/uapi/asm-generic/socket.h#9
 pub const SOL_SOCKET: u8 = 1;
 
+/// SO_RCVBUF、SO_SNDBUF允许设置的缓冲区大小的范围，超出范围的值会被截断
+pub const SOCK_MIN_BUF_SIZE: usize = 4096;
+pub const SOCK_MAX_BUF_SIZE: usize = 4 * 1024 * 1024;
+
+/// 如果`optname`是SOL_SOCKET层次的SO_RCVBUF/SO_SNDBUF（或者对应的FORCE版本），
+/// 返回`(是否是接收缓冲区, 截断到合法范围之内的大小)`
+pub(super) fn parse_socket_buf_size(
+    level: usize,
+    optname: usize,
+    optval: &[u8],
+) -> Result<Option<(bool, usize)>, SystemError> {
+    if level as u8 != SOL_SOCKET {
+        return Ok(None);
+    }
+    let is_recv = match PosixSocketOption::try_from(optname as i32) {
+        Ok(PosixSocketOption::SO_RCVBUF) | Ok(PosixSocketOption::SO_RCVBUFFORCE) => true,
+        Ok(PosixSocketOption::SO_SNDBUF) | Ok(PosixSocketOption::SO_SNDBUFFORCE) => false,
+        _ => return Ok(None),
+    };
+    if optval.len() < core::mem::size_of::<i32>() {
+        return Err(SystemError::EINVAL);
+    }
+    let value = i32::from_ne_bytes([optval[0], optval[1], optval[2], optval[3]]);
+    let size = (value.max(0) as usize).clamp(SOCK_MIN_BUF_SIZE, SOCK_MAX_BUF_SIZE);
+    return Ok(Some((is_recv, size)));
+}
+
+/// 设置SOL_SOCKET层次中，由[`SocketOptions`]中的标志位表示的选项
+///
+/// 不支持的选项只打印警告，与[`Socket::setsockopt`]的默认实现相同
+pub(super) fn set_socket_option_flag(
+    options: &mut SocketOptions,
+    level: usize,
+    optname: usize,
+    optval: &[u8],
+) -> Result<(), SystemError> {
+    let flag = match PosixSocketOption::try_from(optname as i32) {
+        Ok(PosixSocketOption::SO_REUSEADDR) if level as u8 == SOL_SOCKET => {
+            SocketOptions::REUSEADDR
+        }
+        Ok(PosixSocketOption::SO_REUSEPORT) if level as u8 == SOL_SOCKET => {
+            SocketOptions::REUSEPORT
+        }
+        Ok(PosixSocketOption::SO_BROADCAST) if level as u8 == SOL_SOCKET => {
+            SocketOptions::BROADCAST
+        }
+        _ => {
+            kwarn!("setsockopt: unsupported option {optname} at level {level}");
+            return Ok(());
+        }
+    };
+    if optval.len() < core::mem::size_of::<i32>() {
+        return Err(SystemError::EINVAL);
+    }
+    let value = i32::from_ne_bytes([optval[0], optval[1], optval[2], optval[3]]);
+    options.set(flag, value != 0);
+    return Ok(());
+}
+
 /// @brief socket的句柄管理组件。
 /// 它在smoltcp的SocketHandle上封装了一层，增加更多的功能。
 /// 比如，在socket被关闭时，自动释放socket的资源，通知系统的其他组件。
 #[derive(Debug)]
-pub struct GlobalSocketHandle(SocketHandle);
+pub struct GlobalSocketHandle(SocketHandle, Arc<WaitQueue>);
 
 impl GlobalSocketHandle {
     pub fn new(handle: SocketHandle) -> Arc<Self> {
-        return Arc::new(Self(handle));
+        let wait_queue = Arc::new(WaitQueue::INIT);
+        SOCKET_WAITQUEUES
+            .lock_irqsave()
+            .insert(handle, wait_queue.clone());
+        return Arc::new(Self(handle, wait_queue));
+    }
+
+    /// 轮询网卡之后，改为唤醒`wait_queue`上的进程，而不是这个socket自己的等待队列
+    ///
+    /// 用于监听的socket池：池中任何一个socket建立了连接，都需要唤醒在监听socket上等待的进程
+    pub fn redirect_wakeup(&self, wait_queue: &Arc<WaitQueue>) {
+        SOCKET_WAITQUEUES
+            .lock_irqsave()
+            .insert(self.0, wait_queue.clone());
+    }
+
+    /// 恢复为唤醒这个socket自己的等待队列
+    pub fn restore_wakeup(&self) {
+        SOCKET_WAITQUEUES
+            .lock_irqsave()
+            .insert(self.0, self.1.clone());
+    }
+
+    /// 在这个socket的等待队列上等待`event`事件
+    pub fn wait(&self, event: SocketEvent) {
+        rfs_record_flow(self.0);
+        self.1.sleep_keyed(event.key(), false);
+    }
+
+    /// 这个socket的等待队列
+    pub fn wait_queue(&self) -> &Arc<WaitQueue> {
+        return &self.1;
+    }
+}
+
+/// socket的进程等待的事件
+#[derive(Debug, Clone, Copy)]
+#[repr(u32)]
+pub enum SocketEvent {
+    /// 有数据可以读取，或者连接已经关闭
+    In = 0,
+    /// 连接的状态发生了变化（connect、accept）
+    Conn = 1,
+}
+
+impl SocketEvent {
+    /// 等待这个事件的进程在socket的等待队列中的键
+    fn key(self) -> u64 {
+        return 1u64 << (self as u32);
     }
 }
 
+/// 计算socket已经就绪的事件的键的并集
+///
+/// 就绪的判断必须覆盖所有等待者退出等待循环的条件，否则会丢失唤醒
+fn socket_ready_events(socket: &smoltcp::socket::Socket) -> u64 {
+    let mut key = 0;
+    match socket {
+        smoltcp::socket::Socket::Raw(socket) => {
+            if socket.can_recv() {
+                key |= SocketEvent::In.key();
+            }
+        }
+        smoltcp::socket::Socket::Udp(socket) => {
+            if socket.can_recv() {
+                key |= SocketEvent::In.key();
+            }
+        }
+        smoltcp::socket::Socket::Tcp(socket) => {
+            if socket.can_recv() || !socket.may_recv() || !socket.is_active() {
+                key |= SocketEvent::In.key();
+            }
+            if !matches!(socket.state(), tcp::State::Listen | tcp::State::SynSent) {
+                key |= SocketEvent::Conn.key();
+            }
+        }
+        _ => {}
+    }
+    return key;
+}
+
+/// 轮询网卡之后调用：只唤醒等待已经就绪的socket的进程
+///
+/// 没有进程在等待的socket，唤醒只是检查一次空的等待队列
+///
+/// 消费者在其他cpu上的socket，唤醒被批量转到消费者所在的cpu上执行（RFS）
+pub fn socket_wakeup_ready(sockets: &SocketSet) {
+    let mut batch = RfsWakeupBatch::new();
+    let waitqueues = SOCKET_WAITQUEUES.lock_irqsave();
+    for (handle, socket) in sockets.iter() {
+        let events = socket_ready_events(socket);
+        if events == 0 {
+            continue;
+        }
+        if let Some(wait_queue) = waitqueues.get(&handle) {
+            batch.wakeup(handle, wait_queue, events);
+        }
+    }
+    drop(waitqueues);
+    batch.flush();
+}
+
 impl Clone for GlobalSocketHandle {
     fn clone(&self) -> Self {
-        Self(self.0)
+        Self(self.0, self.1.clone())
     }
 }
 
@@ -148,6 +406,7 @@ impl Drop for GlobalSocketHandle {
     fn drop(&mut self) {
         let mut socket_set_guard = SOCKET_SET.lock();
         socket_set_guard.remove(self.0); // 删除的时候，会发送一条FINISH的信息？
+        SOCKET_WAITQUEUES.lock_irqsave().remove(&self.0);
         drop(socket_set_guard);
         poll_ifaces();
     }
@@ -162,6 +421,10 @@ pub enum SocketType {
     TcpSocket,
     /// 用于Udp通信的 Socket
     UdpSocket,
+    /// Unix域socket
+    UnixSocket,
+    /// AF_PACKET socket
+    PacketSocket,
 }
 
 bitflags! {
@@ -178,6 +441,10 @@ bitflags! {
         const REUSEADDR = 1 << 3;
         /// 是否允许重用端口
         const REUSEPORT = 1 << 4;
+        /// 用户通过SO_RCVBUF设置了接收缓冲区的大小，不再自动调整
+        const RCVBUF_LOCK = 1 << 5;
+        /// 用户通过SO_SNDBUF设置了发送缓冲区的大小
+        const SNDBUF_LOCK = 1 << 6;
     }
 }
 
@@ -197,7 +464,7 @@ pub struct SocketMetadata {
 }
 
 impl SocketMetadata {
-    fn new(
+    pub fn new(
         socket_type: SocketType,
         send_buf_size: usize,
         recv_buf_size: usize,
@@ -307,7 +574,7 @@ impl Socket for RawSocket {
             }
             drop(socket);
             drop(socket_set_guard);
-            SOCKET_WAITQUEUE.sleep();
+            self.handle.wait(SocketEvent::In);
         }
     }
 
@@ -332,8 +599,7 @@ impl Socket for RawSocket {
                 let socket: &mut raw::Socket =
                     socket_set_guard.get_mut::<raw::Socket>(self.handle.0);
 
-                // 暴力解决方案：只考虑0号网卡。 TODO：考虑多网卡的情况！！！
-                let iface = NET_DRIVERS.read().get(&0).unwrap().clone();
+                let iface = route_iface(&endpoint.addr)?;
 
                 // 构造IP头
                 let ipv4_src_addr: Option<smoltcp::wire::Ipv4Address> =
@@ -372,10 +638,10 @@ impl Socket for RawSocket {
                     socket.send_slice(&buffer).unwrap();
 
                     drop(socket);
-
-                    iface.poll(&mut socket_set_guard).ok();
-
                     drop(socket_set_guard);
+                    drop(iface);
+
+                    poll_ifaces();
                     return Ok(len);
                 } else {
                     kwarn!("Unsupport Ip protocol type!");
@@ -399,6 +665,10 @@ impl Socket for RawSocket {
     fn box_clone(&self) -> alloc::boxed::Box<dyn Socket> {
         return Box::new(self.clone());
     }
+
+    fn wait_queue(&self) -> Option<Arc<WaitQueue>> {
+        return Some(self.handle.wait_queue().clone());
+    }
 }
 
 /// @brief 表示udp socket
@@ -426,15 +696,11 @@ impl UdpSocket {
     ///
     /// @return 返回创建的原始的socket
     pub fn new(options: SocketOptions) -> Self {
-        let tx_buffer = udp::PacketBuffer::new(
-            vec![udp::PacketMetadata::EMPTY; Self::DEFAULT_METADATA_BUF_SIZE],
-            vec![0; Self::DEFAULT_TX_BUF_SIZE],
-        );
-        let rx_buffer = udp::PacketBuffer::new(
-            vec![udp::PacketMetadata::EMPTY; Self::DEFAULT_METADATA_BUF_SIZE],
-            vec![0; Self::DEFAULT_RX_BUF_SIZE],
+        let socket = Self::new_smoltcp_socket(
+            Self::DEFAULT_RX_BUF_SIZE,
+            Self::DEFAULT_TX_BUF_SIZE,
+            Self::DEFAULT_METADATA_BUF_SIZE,
         );
-        let socket = udp::Socket::new(tx_buffer, rx_buffer);
 
         // 把socket添加到socket集合中，并得到socket的句柄
         let handle: Arc<GlobalSocketHandle> =
@@ -442,8 +708,8 @@ impl UdpSocket {
 
         let metadata = SocketMetadata::new(
             SocketType::UdpSocket,
-            Self::DEFAULT_RX_BUF_SIZE,
             Self::DEFAULT_TX_BUF_SIZE,
+            Self::DEFAULT_RX_BUF_SIZE,
             Self::DEFAULT_METADATA_BUF_SIZE,
             options,
         );
@@ -455,10 +721,55 @@ impl UdpSocket {
         };
     }
 
+    /// 创建一个收发缓冲区分别为`rx_size`、`tx_size`字节，最多容纳`metadata_size`个数据报的smoltcp socket
+    fn new_smoltcp_socket(
+        rx_size: usize,
+        tx_size: usize,
+        metadata_size: usize,
+    ) -> udp::Socket<'static> {
+        let rx_buffer = udp::PacketBuffer::new(
+            vec![udp::PacketMetadata::EMPTY; metadata_size],
+            vec![0; rx_size],
+        );
+        let tx_buffer = udp::PacketBuffer::new(
+            vec![udp::PacketMetadata::EMPTY; metadata_size],
+            vec![0; tx_size],
+        );
+        return udp::Socket::new(rx_buffer, tx_buffer);
+    }
+
+    /// 按照metadata中的大小重新分配收发缓冲区
+    ///
+    /// smoltcp的socket不能改变缓冲区的大小，因此创建一个新的socket替换原来的socket，并绑定到原来的端点。
+    /// 接收缓冲区中还有数据报的时候不替换，以免丢失数据，新的大小不会生效
+    fn resize_buffers(&self) {
+        poll_ifaces();
+        let mut sockets = SOCKET_SET.lock();
+        let socket = sockets.get_mut::<udp::Socket>(self.handle.0);
+        if socket.can_recv() {
+            return;
+        }
+        let endpoint = socket.endpoint();
+        let mut new_socket = Self::new_smoltcp_socket(
+            self.metadata.recv_buf_size,
+            self.metadata.send_buf_size,
+            self.metadata.metadata_buf_size,
+        );
+        if endpoint.port != 0 && new_socket.bind(endpoint).is_err() {
+            return;
+        }
+        *socket = new_socket;
+    }
+
     fn do_bind(&self, socket: &mut udp::Socket, endpoint: Endpoint) -> Result<(), SystemError> {
         if let Endpoint::Ip(Some(ip)) = endpoint {
             // 检测端口是否已被占用
-            PORT_MANAGER.bind_port(self.metadata.socket_type, ip.port, self.handle.clone())?;
+            PORT_MANAGER.bind_port(
+                self.metadata.socket_type,
+                ip.port,
+                self.handle.clone(),
+                self.metadata.options.contains(SocketOptions::REUSEPORT),
+            )?;
 
             let bind_res = if ip.addr.is_unspecified() {
                 socket.bind(ip.port)
@@ -474,37 +785,14 @@ impl UdpSocket {
             return Err(SystemError::EINVAL);
         };
     }
-}
-
-impl Socket for UdpSocket {
-    /// @brief 在read函数执行之前，请先bind到本地的指定端口
-    fn read(&self, buf: &mut [u8]) -> (Result<usize, SystemError>, Endpoint) {
-        loop {
-            // kdebug!("Wait22 to Read");
-            poll_ifaces();
-            let mut socket_set_guard = SOCKET_SET.lock();
-            let socket = socket_set_guard.get_mut::<udp::Socket>(self.handle.0);
-
-            // kdebug!("Wait to Read");
 
-            if socket.can_recv() {
-                if let Ok((size, remote_endpoint)) = socket.recv_slice(buf) {
-                    drop(socket);
-                    drop(socket_set_guard);
-                    poll_ifaces();
-                    return (Ok(size), Endpoint::Ip(Some(remote_endpoint)));
-                }
-            } else {
-                // 如果socket没有连接，则忙等
-                // return (Err(SystemError::ENOTCONN), Endpoint::Ip(None));
-            }
-            drop(socket);
-            drop(socket_set_guard);
-            SOCKET_WAITQUEUE.sleep();
-        }
-    }
-
-    fn write(&self, buf: &[u8], to: Option<super::Endpoint>) -> Result<usize, SystemError> {
+    /// 把一个数据报放入发送缓冲区，调用者需要持有SOCKET_SET的锁，之后再轮询网卡
+    fn do_send(
+        &self,
+        socket: &mut udp::Socket,
+        buf: &[u8],
+        to: Option<Endpoint>,
+    ) -> Result<usize, SystemError> {
         // kdebug!("udp to send: {:?}, len={}", to, buf.len());
         let remote_endpoint: &wire::IpEndpoint = {
             if let Some(Endpoint::Ip(Some(ref endpoint))) = to {
@@ -517,8 +805,6 @@ impl Socket for UdpSocket {
         };
         // kdebug!("udp write: remote = {:?}", remote_endpoint);
 
-        let mut socket_set_guard = SOCKET_SET.lock();
-        let socket = socket_set_guard.get_mut::<udp::Socket>(self.handle.0);
         // kdebug!("is open()={}", socket.is_open());
         // kdebug!("socket endpoint={:?}", socket.endpoint());
         if socket.endpoint().port == 0 {
@@ -545,21 +831,114 @@ impl Socket for UdpSocket {
             match socket.send_slice(&buf, *remote_endpoint) {
                 Ok(()) => {
                     // kdebug!("udp write: send ok");
-                    drop(socket);
-                    drop(socket_set_guard);
-                    poll_ifaces();
+                    snmp_inc(SnmpCounter::UdpOutDatagrams);
                     return Ok(buf.len());
                 }
                 Err(_) => {
                     // kdebug!("udp write: send err");
+                    snmp_inc(SnmpCounter::UdpSndbufErrors);
                     return Err(SystemError::ENOBUFS);
                 }
             }
         } else {
             // kdebug!("udp write: can not send");
+            snmp_inc(SnmpCounter::UdpSndbufErrors);
             return Err(SystemError::ENOBUFS);
         };
     }
+}
+
+impl Socket for UdpSocket {
+    /// @brief 在read函数执行之前，请先bind到本地的指定端口
+    fn read(&self, buf: &mut [u8]) -> (Result<usize, SystemError>, Endpoint) {
+        loop {
+            // kdebug!("Wait22 to Read");
+            poll_ifaces();
+            let mut socket_set_guard = SOCKET_SET.lock();
+            let socket = socket_set_guard.get_mut::<udp::Socket>(self.handle.0);
+
+            // kdebug!("Wait to Read");
+
+            if socket.can_recv() {
+                if let Ok((size, remote_endpoint)) = socket.recv_slice(buf) {
+                    drop(socket);
+                    drop(socket_set_guard);
+                    snmp_inc(SnmpCounter::UdpInDatagrams);
+                    poll_ifaces();
+                    return (Ok(size), Endpoint::Ip(Some(remote_endpoint)));
+                }
+            } else {
+                // 如果socket没有连接，则忙等
+                // return (Err(SystemError::ENOTCONN), Endpoint::Ip(None));
+            }
+            drop(socket);
+            drop(socket_set_guard);
+            self.handle.wait(SocketEvent::In);
+        }
+    }
+
+    fn write(&self, buf: &[u8], to: Option<super::Endpoint>) -> Result<usize, SystemError> {
+        let mut socket_set_guard = SOCKET_SET.lock();
+        let socket = socket_set_guard.get_mut::<udp::Socket>(self.handle.0);
+        let size = self.do_send(socket, buf, to)?;
+        drop(socket_set_guard);
+        poll_ifaces();
+        return Ok(size);
+    }
+
+    fn read_batch(&self, bufs: &mut [&mut [u8]]) -> Result<Vec<(usize, Endpoint)>, SystemError> {
+        if bufs.is_empty() {
+            return Ok(Vec::new());
+        }
+        loop {
+            poll_ifaces();
+            let mut socket_set_guard = SOCKET_SET.lock();
+            let socket = socket_set_guard.get_mut::<udp::Socket>(self.handle.0);
+
+            let mut received = Vec::new();
+            for buf in bufs.iter_mut() {
+                match socket.recv_slice(buf) {
+                    Ok((size, remote_endpoint)) => {
+                        snmp_inc(SnmpCounter::UdpInDatagrams);
+                        received.push((size, Endpoint::Ip(Some(remote_endpoint))))
+                    }
+                    Err(_) => break,
+                }
+            }
+            drop(socket_set_guard);
+            if !received.is_empty() {
+                poll_ifaces();
+                return Ok(received);
+            }
+            self.handle.wait(SocketEvent::In);
+        }
+    }
+
+    fn write_batch(&self, msgs: &[(&[u8], Option<Endpoint>)]) -> Result<usize, SystemError> {
+        // 所有数据报都放入发送缓冲区之后，才轮询一次网卡
+        let mut socket_set_guard = SOCKET_SET.lock();
+        let socket = socket_set_guard.get_mut::<udp::Socket>(self.handle.0);
+        let mut sent = 0;
+        let mut error = None;
+        for (buf, to) in msgs.iter() {
+            match self.do_send(socket, buf, to.clone()) {
+                Ok(_) => sent += 1,
+                Err(e) => {
+                    error = Some(e);
+                    break;
+                }
+            }
+        }
+        drop(socket_set_guard);
+        if sent > 0 {
+            poll_ifaces();
+            return Ok(sent);
+        }
+        return match error {
+            Some(e) => Err(e),
+            None => Ok(0),
+        };
+    }
 
     fn bind(&mut self, endpoint: Endpoint) -> Result<(), SystemError> {
         let mut sockets = SOCKET_SET.lock();
@@ -602,6 +981,32 @@ impl Socket for UdpSocket {
         return Box::new(self.clone());
     }
 
+    fn wait_queue(&self) -> Option<Arc<WaitQueue>> {
+        return Some(self.handle.wait_queue().clone());
+    }
+
+    fn socket_handle(&self) -> Option<SocketHandle> {
+        return Some(self.handle.0);
+    }
+
+    fn setsockopt(
+        &mut self,
+        level: usize,
+        optname: usize,
+        optval: &[u8],
+    ) -> Result<(), SystemError> {
+        if let Some((is_recv, size)) = parse_socket_buf_size(level, optname, optval)? {
+            if is_recv {
+                self.metadata.recv_buf_size = size;
+            } else {
+                self.metadata.send_buf_size = size;
+            }
+            self.resize_buffers();
+            return Ok(());
+        }
+        return set_socket_option_flag(&mut self.metadata.options, level, optname, optval);
+    }
+
     fn endpoint(&self) -> Option<Endpoint> {
         let sockets = SOCKET_SET.lock();
         let socket = sockets.get::<udp::Socket>(self.handle.0);
@@ -628,6 +1033,63 @@ impl Socket for UdpSocket {
     }
 }
 
+/// 没有设置SO_RCVBUF的TCP连接使用的接收缓冲区大小，由[`RecvBufAutoTune`]根据观测到的带宽时延积调大
+static TCP_RCVBUF_AUTOTUNE: AtomicUsize = AtomicUsize::new(TcpSocket::DEFAULT_RX_BUF_SIZE);
+
+/// TCP接收缓冲区的自动调整（参考Linux的tcp_rcv_space_adjust）
+///
+/// smoltcp在发送SYN时根据接收缓冲区的容量确定窗口扩大因子，连接建立之后缓冲区不能再扩大。
+/// 因此每经过一个RTT统计一次应用读走的字节数，超过缓冲区的一半时，说明连接的吞吐量受限于接收窗口，
+/// 把两倍于此的大小记录到[`TCP_RCVBUF_AUTOTUNE`]，之后建立的连接按照它分配接收缓冲区
+#[derive(Debug)]
+struct RecvBufAutoTune {
+    /// 握手用去的时间，作为RTT的估计值。为None时不调整（被动打开的连接、环回连接）
+    rtt: Option<Duration>,
+    /// 当前这个RTT中应用读走的字节数
+    copied: usize,
+    /// 当前这个RTT开始的时刻
+    stamp: Instant,
+}
+
+impl RecvBufAutoTune {
+    /// RTT估计值的下限，避免在RTT接近0的时候过于频繁地采样
+    const MIN_RTT: Duration = Duration::from_millis(10);
+
+    fn new() -> Self {
+        return Self {
+            rtt: None,
+            copied: 0,
+            stamp: Instant::now(),
+        };
+    }
+
+    /// 连接已经建立，握手用去了`rtt`，开始统计
+    fn start(&mut self, rtt: Duration) {
+        self.rtt = Some(rtt.max(Self::MIN_RTT));
+        self.copied = 0;
+        self.stamp = Instant::now();
+    }
+
+    /// 应用从容量为`capacity`的接收缓冲区中读走了`size`字节
+    fn on_read(&mut self, size: usize, capacity: usize) {
+        let rtt = match self.rtt {
+            Some(rtt) => rtt,
+            None => return,
+        };
+        self.copied += size;
+        let now = Instant::now();
+        if now - self.stamp < rtt {
+            return;
+        }
+        if self.copied * 2 >= capacity {
+            let target = (self.copied * 2).next_power_of_two().min(SOCK_MAX_BUF_SIZE);
+            TCP_RCVBUF_AUTOTUNE.fetch_max(target, Ordering::Relaxed);
+        }
+        self.copied = 0;
+        self.stamp = now;
+    }
+}
+
 /// @brief 表示 tcp socket
 ///
 /// https://man7.org/linux/man-pages/man7/tcp.7.html
@@ -636,7 +1098,16 @@ pub struct TcpSocket {
     handle: Arc<GlobalSocketHandle>,
     local_endpoint: Option<wire::IpEndpoint>, // save local endpoint for bind()
     is_listening: bool,
+    /// 监听时预先创建的、正在监听同一个端点的smoltcp socket（包括handle）
+    ///
+    /// smoltcp的一个监听socket只能接受一个连接，因此按照backlog创建多个。连接到达时由smoltcp直接完成握手，
+    /// 已经建立的连接留在池中等待accept取走，取走之后再补充一个新的监听socket
+    listen_handles: Vec<Arc<GlobalSocketHandle>>,
+    /// 监听时，池中的socket建立连接后唤醒这个等待队列上的进程
+    listen_wait_queue: Option<Arc<WaitQueue>>,
     metadata: SocketMetadata,
+    /// 接收缓冲区的自动调整
+    autotune: Arc<SpinLock<RecvBufAutoTune>>,
 }
 
 impl TcpSocket {
@@ -646,6 +1117,47 @@ impl TcpSocket {
     pub const DEFAULT_RX_BUF_SIZE: usize = 512 * 1024;
     /// 默认的接收缓冲区的大小 receive
     pub const DEFAULT_TX_BUF_SIZE: usize = 512 * 1024;
+    /// 每个监听者最多预先创建的监听socket的数量。池中的每个socket都带有完整的收发缓冲区，因此不能太大
+    pub const MAX_LISTEN_BACKLOG: usize = 8;
+
+    /// 把接收缓冲区中的数据依次读入多个缓冲区，某个缓冲区没有读满时停止
+    fn recv_vectored(
+        socket: &mut tcp::Socket,
+        bufs: &mut [&mut [u8]],
+    ) -> Result<usize, tcp::RecvError> {
+        let mut total = 0;
+        for buf in bufs.iter_mut() {
+            match socket.recv_slice(buf) {
+                Ok(n) => {
+                    total += n;
+                    if n < buf.len() {
+                        break;
+                    }
+                }
+                Err(e) if total == 0 => return Err(e),
+                Err(_) => break,
+            }
+        }
+        return Ok(total);
+    }
+
+    /// 把多个缓冲区中的数据依次放入发送缓冲区，发送缓冲区满时停止
+    fn send_vectored(socket: &mut tcp::Socket, bufs: &[&[u8]]) -> Result<usize, tcp::SendError> {
+        let mut total = 0;
+        for buf in bufs.iter() {
+            match socket.send_slice(buf) {
+                Ok(n) => {
+                    total += n;
+                    if n < buf.len() {
+                        break;
+                    }
+                }
+                Err(e) if total == 0 => return Err(e),
+                Err(_) => break,
+            }
+        }
+        return Ok(total);
+    }
 
     /// @brief 创建一个原始的socket
     ///
@@ -654,9 +1166,8 @@ impl TcpSocket {
     ///
     /// @return 返回创建的原始的socket
     pub fn new(options: SocketOptions) -> Self {
-        let tx_buffer = tcp::SocketBuffer::new(vec![0; Self::DEFAULT_TX_BUF_SIZE]);
-        let rx_buffer = tcp::SocketBuffer::new(vec![0; Self::DEFAULT_RX_BUF_SIZE]);
-        let socket = tcp::Socket::new(tx_buffer, rx_buffer);
+        let recv_buf_size = TCP_RCVBUF_AUTOTUNE.load(Ordering::Relaxed);
+        let socket = Self::new_smoltcp_socket(recv_buf_size, Self::DEFAULT_TX_BUF_SIZE);
 
         // 把socket添加到socket集合中，并得到socket的句柄
         let handle: Arc<GlobalSocketHandle> =
@@ -664,8 +1175,8 @@ impl TcpSocket {
 
         let metadata = SocketMetadata::new(
             SocketType::TcpSocket,
-            Self::DEFAULT_RX_BUF_SIZE,
             Self::DEFAULT_TX_BUF_SIZE,
+            recv_buf_size,
             Self::DEFAULT_METADATA_BUF_SIZE,
             options,
         );
@@ -674,9 +1185,73 @@ impl TcpSocket {
             handle,
             local_endpoint: None,
             is_listening: false,
+            listen_handles: Vec::new(),
+            listen_wait_queue: None,
             metadata,
+            autotune: Arc::new(SpinLock::new(RecvBufAutoTune::new())),
         };
     }
+
+    /// 创建一个收发缓冲区分别为`rx_size`、`tx_size`字节的smoltcp socket
+    ///
+    /// 接收缓冲区超过64KiB时，smoltcp会在握手时协商窗口扩大选项，使得通告的窗口能够覆盖整个缓冲区
+    fn new_smoltcp_socket(rx_size: usize, tx_size: usize) -> tcp::Socket<'static> {
+        let rx_buffer = tcp::SocketBuffer::new(vec![0; rx_size]);
+        let tx_buffer = tcp::SocketBuffer::new(vec![0; tx_size]);
+        return tcp::Socket::new(rx_buffer, tx_buffer);
+    }
+
+    /// 新建立的连接应当使用的接收缓冲区大小：用户设置过SO_RCVBUF时使用用户设置的值，否则使用自动调整的值
+    fn desired_recv_buf_size(&self) -> usize {
+        if self.metadata.options.contains(SocketOptions::RCVBUF_LOCK) {
+            return self.metadata.recv_buf_size;
+        }
+        return self
+            .metadata
+            .recv_buf_size
+            .max(TCP_RCVBUF_AUTOTUNE.load(Ordering::Relaxed));
+    }
+
+    /// 连接或者监听之前，按照当前应当使用的大小重新分配缓冲区
+    ///
+    /// 窗口扩大因子在握手时确定，之后不能再改变，因此只替换还没有打开的socket
+    fn refresh_buffers(&mut self, socket: &mut tcp::Socket<'static>) {
+        let recv_buf_size = self.desired_recv_buf_size();
+        if socket.state() != tcp::State::Closed
+            || (socket.recv_capacity() == recv_buf_size
+                && socket.send_capacity() == self.metadata.send_buf_size)
+        {
+            return;
+        }
+        *socket = Self::new_smoltcp_socket(recv_buf_size, self.metadata.send_buf_size);
+        self.metadata.recv_buf_size = recv_buf_size;
+    }
+
+    /// 创建一个新的监听`local_endpoint`的socket，加入监听socket池
+    fn new_listen_socket(
+        &self,
+        sockets: &mut SocketSet<'static>,
+        local_endpoint: wire::IpEndpoint,
+        wait_queue: &Arc<WaitQueue>,
+    ) -> Result<Arc<GlobalSocketHandle>, SystemError> {
+        let mut socket =
+            Self::new_smoltcp_socket(self.desired_recv_buf_size(), self.metadata.send_buf_size);
+        let listen_result = if local_endpoint.addr.is_unspecified() {
+            socket.listen(local_endpoint.port)
+        } else {
+            socket.listen(local_endpoint)
+        };
+        listen_result.map_err(|_| SystemError::EINVAL)?;
+        let handle = GlobalSocketHandle::new(sockets.add(socket));
+        handle.redirect_wakeup(wait_queue);
+        return Ok(handle);
+    }
+
+    /// 监听socket池中的socket是否已经可以被accept取走（连接已经建立，或者建立之后已经关闭）
+    fn is_acceptable(socket: &tcp::Socket) -> bool {
+        return !matches!(socket.state(), tcp::State::Listen | tcp::State::SynReceived);
+    }
+
     fn do_listen(
         &mut self,
         socket: &mut smoltcp::socket::tcp::Socket,
@@ -707,8 +1282,14 @@ impl TcpSocket {
 
 impl Socket for TcpSocket {
     fn read(&self, buf: &mut [u8]) -> (Result<usize, SystemError>, Endpoint) {
-        // kdebug!("tcp socket: read, buf len={}", buf.len());
+        return self.read_vectored(&mut [buf]);
+    }
+
+    fn write(&self, buf: &[u8], to: Option<super::Endpoint>) -> Result<usize, SystemError> {
+        return self.write_vectored(&[buf], to);
+    }
 
+    fn read_vectored(&self, bufs: &mut [&mut [u8]]) -> (Result<usize, SystemError>, Endpoint) {
         loop {
             poll_ifaces();
             let mut socket_set_guard = SOCKET_SET.lock();
@@ -721,7 +1302,7 @@ impl Socket for TcpSocket {
             }
 
             if socket.may_recv() {
-                let recv_res = socket.recv_slice(buf);
+                let recv_res = Self::recv_vectored(socket, bufs);
 
                 if let Ok(size) = recv_res {
                     if size > 0 {
@@ -730,9 +1311,11 @@ impl Socket for TcpSocket {
                         } else {
                             return (Err(SystemError::ENOTCONN), Endpoint::Ip(None));
                         };
+                        let capacity = socket.recv_capacity();
 
                         drop(socket);
                         drop(socket_set_guard);
+                        self.autotune.lock().on_read(size, capacity);
                         poll_ifaces();
                         return (Ok(size), Endpoint::Ip(Some(endpoint)));
                     }
@@ -753,17 +1336,21 @@ impl Socket for TcpSocket {
             }
             drop(socket);
             drop(socket_set_guard);
-            SOCKET_WAITQUEUE.sleep();
+            self.handle.wait(SocketEvent::In);
         }
     }
 
-    fn write(&self, buf: &[u8], _to: Option<super::Endpoint>) -> Result<usize, SystemError> {
+    fn write_vectored(
+        &self,
+        bufs: &[&[u8]],
+        _to: Option<super::Endpoint>,
+    ) -> Result<usize, SystemError> {
         let mut socket_set_guard = SOCKET_SET.lock();
         let socket = socket_set_guard.get_mut::<tcp::Socket>(self.handle.0);
 
         if socket.is_open() {
             if socket.can_send() {
-                match socket.send_slice(buf) {
+                match Self::send_vectored(socket, bufs) {
                     Ok(size) => {
                         drop(socket);
                         drop(socket_set_guard);
@@ -785,17 +1372,23 @@ impl Socket for TcpSocket {
 
     fn poll(&self) -> (bool, bool, bool) {
         let mut socket_set_guard = SOCKET_SET.lock();
+        if self.is_listening {
+            let input = self
+                .listen_handles
+                .iter()
+                .any(|handle| Self::is_acceptable(socket_set_guard.get::<tcp::Socket>(handle.0)));
+            return (input, false, false);
+        }
         let socket = socket_set_guard.get_mut::<tcp::Socket>(self.handle.0);
 
         let mut input = false;
         let mut output = false;
         let mut error = false;
-        if self.is_listening && socket.is_active() {
-            input = true;
-        } else if !socket.is_open() {
+        if !socket.is_open() {
             error = true;
         } else {
-            if socket.may_recv() {
+            // 有数据可读，或者对端已经关闭（读会立即返回）时可读
+            if socket.can_recv() || !socket.may_recv() {
                 input = true;
             }
             if socket.can_send() {
@@ -811,17 +1404,25 @@ impl Socket for TcpSocket {
         let socket = sockets.get_mut::<tcp::Socket>(self.handle.0);
 
         if let Endpoint::Ip(Some(ip)) = endpoint {
+            let iface = route_iface(&ip.addr)?;
+            self.refresh_buffers(socket);
             let temp_port = PORT_MANAGER.get_ephemeral_port(self.metadata.socket_type)?;
             // 检测端口是否被占用
-            PORT_MANAGER.bind_port(self.metadata.socket_type, temp_port, self.handle.clone())?;
+            PORT_MANAGER.bind_port(
+                self.metadata.socket_type,
+                temp_port,
+                self.handle.clone(),
+                false,
+            )?;
 
             // kdebug!("temp_port: {}", temp_port);
-            let iface: Arc<dyn NetDriver> = NET_DRIVERS.write().get(&0).unwrap().clone();
             let mut inner_iface = iface.inner_iface().lock();
             // kdebug!("to connect: {ip:?}");
 
+            let connect_start = Instant::now();
             match socket.connect(&mut inner_iface.context(), ip, temp_port) {
                 Ok(()) => {
+                    snmp_inc(SnmpCounter::TcpActiveOpens);
                     // avoid deadlock
                     drop(inner_iface);
                     drop(iface);
@@ -834,14 +1435,19 @@ impl Socket for TcpSocket {
 
                         match socket.state() {
                             tcp::State::Established => {
+                                // 环回连接没有值得调整的带宽时延积
+                                if !ip.addr.is_loopback() {
+                                    self.autotune.lock().start(Instant::now() - connect_start);
+                                }
                                 return Ok(());
                             }
                             tcp::State::SynSent => {
                                 drop(socket);
                                 drop(sockets);
-                                SOCKET_WAITQUEUE.sleep();
+                                self.handle.wait(SocketEvent::Conn);
                             }
                             _ => {
+                                snmp_inc(SnmpCounter::TcpAttemptFails);
                                 return Err(SystemError::ECONNREFUSED);
                             }
                         }
@@ -862,8 +1468,8 @@ impl Socket for TcpSocket {
 
     /// @brief tcp socket 监听 local_endpoint 端口
     ///
-    /// @param backlog 未处理的连接队列的最大长度. 由于smoltcp不支持backlog，所以这个参数目前无效
-    fn listen(&mut self, _backlog: usize) -> Result<(), SystemError> {
+    /// @param backlog 未处理的连接队列的最大长度，决定预先创建的监听socket的数量（最多MAX_LISTEN_BACKLOG个）
+    fn listen(&mut self, backlog: usize) -> Result<(), SystemError> {
         if self.is_listening {
             return Ok(());
         }
@@ -877,7 +1483,22 @@ impl Socket for TcpSocket {
             return Ok(());
         }
         // kdebug!("Tcp Socket  before listen, open={}", socket.is_open());
-        return self.do_listen(socket, local_endpoint);
+        self.refresh_buffers(socket);
+        self.do_listen(socket, local_endpoint)?;
+
+        let wait_queue = Arc::new(WaitQueue::INIT);
+        self.handle.redirect_wakeup(&wait_queue);
+        let mut listen_handles = vec![self.handle.clone()];
+        for _ in 1..backlog.clamp(1, Self::MAX_LISTEN_BACKLOG) {
+            listen_handles.push(self.new_listen_socket(
+                &mut sockets,
+                local_endpoint,
+                &wait_queue,
+            )?);
+        }
+        self.listen_handles = listen_handles;
+        self.listen_wait_queue = Some(wait_queue);
+        return Ok(());
     }
 
     fn bind(&mut self, endpoint: Endpoint) -> Result<(), SystemError> {
@@ -887,7 +1508,12 @@ impl Socket for TcpSocket {
             }
 
             // 检测端口是否已被占用
-            PORT_MANAGER.bind_port(self.metadata.socket_type, ip.port, self.handle.clone())?;
+            PORT_MANAGER.bind_port(
+                self.metadata.socket_type,
+                ip.port,
+                self.handle.clone(),
+                self.metadata.options.contains(SocketOptions::REUSEPORT),
+            )?;
 
             self.local_endpoint = Some(ip);
             self.is_listening = false;
@@ -905,69 +1531,82 @@ impl Socket for TcpSocket {
 
     fn accept(&mut self) -> Result<(Box<dyn Socket>, Endpoint), SystemError> {
         let endpoint = self.local_endpoint.ok_or(SystemError::EINVAL)?;
+        let wait_queue = self.listen_wait_queue.clone().ok_or(SystemError::EINVAL)?;
         loop {
             // kdebug!("tcp accept: poll_ifaces()");
             poll_ifaces();
 
             let mut sockets = SOCKET_SET.lock();
 
-            let socket = sockets.get_mut::<tcp::Socket>(self.handle.0);
-
-            if socket.is_active() {
-                // kdebug!("tcp accept: socket.is_active()");
-                let remote_ep = socket.remote_endpoint().ok_or(SystemError::ENOTCONN)?;
-                drop(socket);
-
-                let new_socket = {
-                    // Initialize the TCP socket's buffers.
-                    let rx_buffer = tcp::SocketBuffer::new(vec![0; Self::DEFAULT_RX_BUF_SIZE]);
-                    let tx_buffer = tcp::SocketBuffer::new(vec![0; Self::DEFAULT_TX_BUF_SIZE]);
-                    // The new TCP socket used for sending and receiving data.
-                    let mut tcp_socket = tcp::Socket::new(rx_buffer, tx_buffer);
-                    self.do_listen(&mut tcp_socket, endpoint)
-                        .expect("do_listen failed");
-
-                    // tcp_socket.listen(endpoint).unwrap();
-
-                    // 之所以把old_handle存入new_socket, 是因为当前时刻，smoltcp已经把old_handle对应的socket与远程的endpoint关联起来了
-                    // 因此需要再为当前的socket分配一个新的handle
-                    let new_handle = GlobalSocketHandle::new(sockets.add(tcp_socket));
-                    let old_handle = ::core::mem::replace(&mut self.handle, new_handle.clone());
-
+            let ready = self
+                .listen_handles
+                .iter()
+                .position(|handle| Self::is_acceptable(sockets.get::<tcp::Socket>(handle.0)));
+
+            if let Some(index) = ready {
+                snmp_inc(SnmpCounter::TcpPassiveOpens);
+                // 池中已经没有处于监听状态的socket：在这之前到达的连接请求都被smoltcp拒绝了
+                if self
+                    .listen_handles
+                    .iter()
+                    .all(|handle| Self::is_acceptable(sockets.get::<tcp::Socket>(handle.0)))
+                {
+                    snmp_inc(SnmpCounter::TcpListenOverflows);
+                }
+                let accepted = sockets.get::<tcp::Socket>(self.listen_handles[index].0);
+                let remote_ep = accepted.remote_endpoint();
+                let (recv_buf_size, send_buf_size) =
+                    (accepted.recv_capacity(), accepted.send_capacity());
+
+                // 已经建立的连接交给新的socket，在池中补充一个新的监听socket
+                let new_handle = self.new_listen_socket(&mut sockets, endpoint, &wait_queue)?;
+                let old_handle =
+                    ::core::mem::replace(&mut self.listen_handles[index], new_handle.clone());
+                old_handle.restore_wakeup();
+
+                if Arc::ptr_eq(&old_handle, &self.handle) {
+                    self.handle = new_handle.clone();
                     // 更新端口与 handle 的绑定
                     if let Some(Endpoint::Ip(Some(ip))) = self.endpoint() {
-                        PORT_MANAGER.unbind_port(self.metadata.socket_type, ip.port)?;
+                        PORT_MANAGER.unbind_port(
+                            self.metadata.socket_type,
+                            ip.port,
+                            old_handle.0,
+                        )?;
                         PORT_MANAGER.bind_port(
                             self.metadata.socket_type,
                             ip.port,
                             new_handle.clone(),
+                            self.metadata.options.contains(SocketOptions::REUSEPORT),
                         )?;
                     }
+                }
 
-                    let metadata = SocketMetadata::new(
-                        SocketType::TcpSocket,
-                        Self::DEFAULT_RX_BUF_SIZE,
-                        Self::DEFAULT_TX_BUF_SIZE,
-                        Self::DEFAULT_METADATA_BUF_SIZE,
-                        self.metadata.options,
-                    );
-
-                    Box::new(TcpSocket {
-                        handle: old_handle,
-                        local_endpoint: self.local_endpoint,
-                        is_listening: false,
-                        metadata,
-                    })
-                };
+                let metadata = SocketMetadata::new(
+                    SocketType::TcpSocket,
+                    send_buf_size,
+                    recv_buf_size,
+                    Self::DEFAULT_METADATA_BUF_SIZE,
+                    self.metadata.options,
+                );
+
+                let new_socket = Box::new(TcpSocket {
+                    handle: old_handle,
+                    local_endpoint: self.local_endpoint,
+                    is_listening: false,
+                    listen_handles: Vec::new(),
+                    listen_wait_queue: None,
+                    metadata,
+                    autotune: Arc::new(SpinLock::new(RecvBufAutoTune::new())),
+                });
                 // kdebug!("tcp accept: new socket: {:?}", new_socket);
                 drop(sockets);
                 poll_ifaces();
 
-                return Ok((new_socket, Endpoint::Ip(Some(remote_ep))));
+                return Ok((new_socket, Endpoint::Ip(remote_ep)));
             }
-            drop(socket);
             drop(sockets);
-            SOCKET_WAITQUEUE.sleep();
+            wait_queue.sleep_keyed(SocketEvent::Conn.key(), false);
         }
     }
 
@@ -998,6 +1637,40 @@ impl Socket for TcpSocket {
     fn box_clone(&self) -> alloc::boxed::Box<dyn Socket> {
         return Box::new(self.clone());
     }
+
+    fn socket_handle(&self) -> Option<SocketHandle> {
+        return Some(self.handle.0);
+    }
+
+    fn setsockopt(
+        &mut self,
+        level: usize,
+        optname: usize,
+        optval: &[u8],
+    ) -> Result<(), SystemError> {
+        if let Some((is_recv, size)) = parse_socket_buf_size(level, optname, optval)? {
+            if is_recv {
+                self.metadata.recv_buf_size = size;
+                self.metadata.options.insert(SocketOptions::RCVBUF_LOCK);
+            } else {
+                self.metadata.send_buf_size = size;
+                self.metadata.options.insert(SocketOptions::SNDBUF_LOCK);
+            }
+            // 已经连接或者正在监听的socket保留原来的缓冲区，之后accept得到的连接使用新的大小
+            let mut sockets = SOCKET_SET.lock();
+            let socket = sockets.get_mut::<tcp::Socket>(self.handle.0);
+            self.refresh_buffers(socket);
+            return Ok(());
+        }
+        return set_socket_option_flag(&mut self.metadata.options, level, optname, optval);
+    }
+
+    fn wait_queue(&self) -> Option<Arc<WaitQueue>> {
+        if let Some(wait_queue) = &self.listen_wait_queue {
+            return Some(wait_queue.clone());
+        }
+        return Some(self.handle.wait_queue().clone());
+    }
 }
 
 /// @brief 地址族的枚举
@@ -1164,8 +1837,10 @@ impl IndexNode for SocketInode {
         _data: &mut crate::filesystem::vfs::FilePrivateData,
     ) -> Result<(), SystemError> {
         let socket = self.0.lock();
-        if let Some(Endpoint::Ip(Some(ip))) = socket.endpoint() {
-            PORT_MANAGER.unbind_port(socket.metadata().unwrap().socket_type, ip.port)?;
+        if let (Some(Endpoint::Ip(Some(ip))), Some(handle)) =
+            (socket.endpoint(), socket.socket_handle())
+        {
+            PORT_MANAGER.unbind_port(socket.metadata().unwrap().socket_type, ip.port, handle)?;
         }
         return Ok(());
     }
@@ -1190,6 +1865,24 @@ impl IndexNode for SocketInode {
         return self.0.lock_no_preempt().write(&buf[0..len], None);
     }
 
+    fn read_vectored_at(
+        &self,
+        _offset: usize,
+        bufs: &mut [&mut [u8]],
+        _data: &mut crate::filesystem::vfs::FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        return self.0.lock_no_preempt().read_vectored(bufs).0;
+    }
+
+    fn write_vectored_at(
+        &self,
+        _offset: usize,
+        bufs: &[&[u8]],
+        _data: &mut crate::filesystem::vfs::FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        return self.0.lock_no_preempt().write_vectored(bufs, None);
+    }
+
     fn poll(&self) -> Result<crate::filesystem::vfs::PollStatus, SystemError> {
         let (read, write, error) = self.0.lock().poll();
         let mut result = PollStatus::empty();
@@ -1205,6 +1898,26 @@ impl IndexNode for SocketInode {
         return Ok(result);
     }
 
+    fn poll_wait(&self, table: &mut PollTable) {
+        if let Some(wait_queue) = self.0.lock().wait_queue() {
+            table.wait(&wait_queue);
+        }
+    }
+
+    fn mmap(
+        &self,
+        start_vaddr: VirtAddr,
+        len: usize,
+        prot_flags: ProtFlags,
+        map_flags: MapFlags,
+        offset: usize,
+    ) -> Result<usize, SystemError> {
+        return self
+            .0
+            .lock()
+            .mmap(start_vaddr, len, prot_flags, map_flags, offset);
+    }
+
     fn fs(&self) -> alloc::sync::Arc<dyn crate::filesystem::vfs::FileSystem> {
         todo!()
     }
@@ -0,0 +1,360 @@
+//! 网络的统计信息
+//!
+//! 网卡的计数器（[`NetDevStats`]）属于每个网卡，协议的计数器（[`SnmpCounter`]）是全局的。两者都按cpu分开，
+//! 每个cpu的计数器独占缓存行，更新时只需要一次没有竞争的原子加法；读取时把所有cpu的值加起来。
+//!
+//! 统计信息通过`/proc/net/dev`、`/proc/net/snmp`以及`/sys/class/net/<网卡>/statistics/`导出。
+//!
+//! 分组在哪里丢失可以这样区分：
+//! - 网卡：`rx_errors`（网卡报告的校验和错误）、`rx_fifo_errors`/`tx_fifo_errors`（收发包队列或者缓冲区池已满）
+//! - 协议栈：`/proc/net/snmp`中的`InCsumErrors`、`OutRsts`
+//! - socket：`SndbufErrors`，以及`TcpExt`中的`ListenOverflows`（accept队列已满）
+
+use core::sync::atomic::{AtomicU64, Ordering};
+
+use alloc::{boxed::Box, format, string::String, sync::Arc, vec::Vec};
+
+use crate::{
+    driver::net::{loopback::LOOPBACK_IFACE, NetDriver},
+    filesystem::vfs::seq_file::{SeqBuf, SeqOperations},
+    mm::percpu::PerCpu,
+    smp::core::smp_get_processor_id,
+    syscall::SystemError,
+};
+
+use super::NET_DRIVERS;
+
+/// 网卡的计数器
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum NetDevCounter {
+    RxPackets = 0,
+    RxBytes,
+    /// 网卡报告错误（例如校验和错误）的分组
+    RxErrors,
+    /// 驱动丢弃的分组
+    RxDropped,
+    /// 因为收包队列中没有可用的缓冲区而丢弃的分组
+    RxFifoErrors,
+    RxMulticast,
+    TxPackets,
+    TxBytes,
+    TxErrors,
+    TxDropped,
+    /// 因为发包队列已满而丢弃（或者没有发出）的分组
+    TxFifoErrors,
+}
+
+const NETDEV_COUNTER_NR: usize = NetDevCounter::TxFifoErrors as usize + 1;
+
+/// 一个cpu上的网卡计数器
+#[derive(Debug)]
+#[repr(align(64))]
+struct NetDevCpuStat([AtomicU64; NETDEV_COUNTER_NR]);
+
+/// 一个网卡的统计信息
+#[derive(Debug)]
+pub struct NetDevStats {
+    cpus: Box<[NetDevCpuStat]>,
+}
+
+impl NetDevStats {
+    pub fn new() -> Arc<Self> {
+        let cpus = (0..PerCpu::MAX_CPU_NUM)
+            .map(|_| NetDevCpuStat([const { AtomicU64::new(0) }; NETDEV_COUNTER_NR]))
+            .collect::<Vec<_>>()
+            .into_boxed_slice();
+        return Arc::new(Self { cpus });
+    }
+
+    #[inline(always)]
+    pub fn add(&self, counter: NetDevCounter, value: u64) {
+        self.cpus[smp_get_processor_id() as usize].0[counter as usize]
+            .fetch_add(value, Ordering::Relaxed);
+    }
+
+    #[inline(always)]
+    pub fn inc(&self, counter: NetDevCounter) {
+        self.add(counter, 1);
+    }
+
+    /// 收到了帧`frame`，同时更新协议的计数器
+    #[inline(always)]
+    pub fn rx(&self, frame: &[u8]) {
+        let stat = &self.cpus[smp_get_processor_id() as usize].0;
+        stat[NetDevCounter::RxPackets as usize].fetch_add(1, Ordering::Relaxed);
+        stat[NetDevCounter::RxBytes as usize].fetch_add(frame.len() as u64, Ordering::Relaxed);
+        if frame.first().is_some_and(|b| b & 1 != 0) {
+            stat[NetDevCounter::RxMulticast as usize].fetch_add(1, Ordering::Relaxed);
+        }
+        snmp_count_frame(frame, true);
+        tracepoint!(NetRx, frame.len(), frame_ethertype(frame));
+    }
+
+    /// 发出了帧`frame`，同时更新协议的计数器
+    #[inline(always)]
+    pub fn tx(&self, frame: &[u8]) {
+        let stat = &self.cpus[smp_get_processor_id() as usize].0;
+        stat[NetDevCounter::TxPackets as usize].fetch_add(1, Ordering::Relaxed);
+        stat[NetDevCounter::TxBytes as usize].fetch_add(frame.len() as u64, Ordering::Relaxed);
+        snmp_count_frame(frame, false);
+        tracepoint!(NetTx, frame.len(), frame_ethertype(frame));
+    }
+
+    /// 所有cpu上的计数器之和
+    pub fn get(&self, counter: NetDevCounter) -> u64 {
+        return self
+            .cpus
+            .iter()
+            .map(|stat| stat.0[counter as usize].load(Ordering::Relaxed))
+            .sum();
+    }
+}
+
+/// 以太网帧的类型字段（跟踪点使用），帧太短时为0
+fn frame_ethertype(frame: &[u8]) -> u16 {
+    return frame
+        .get(12..14)
+        .map(|t| u16::from_be_bytes([t[0], t[1]]))
+        .unwrap_or(0);
+}
+
+/// 协议的计数器，名字与`/proc/net/snmp`中的相同
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum SnmpCounter {
+    IpInReceives = 0,
+    /// 网卡报告IP头部校验和错误的分组
+    IpInHdrErrors,
+    IpOutRequests,
+    TcpActiveOpens,
+    TcpPassiveOpens,
+    TcpAttemptFails,
+    TcpInSegs,
+    TcpOutSegs,
+    TcpOutRsts,
+    TcpInCsumErrors,
+    /// accept时发现accept队列（预先创建的监听socket）已满，期间到达的连接请求被拒绝
+    TcpListenOverflows,
+    UdpInDatagrams,
+    UdpOutDatagrams,
+    UdpSndbufErrors,
+    UdpInCsumErrors,
+}
+
+const SNMP_COUNTER_NR: usize = SnmpCounter::UdpInCsumErrors as usize + 1;
+
+/// 一个cpu上的协议计数器
+#[derive(Debug)]
+#[repr(align(64))]
+struct SnmpCpuStat([AtomicU64; SNMP_COUNTER_NR]);
+
+static SNMP_STATS: [SnmpCpuStat; PerCpu::MAX_CPU_NUM] =
+    [const { SnmpCpuStat([const { AtomicU64::new(0) }; SNMP_COUNTER_NR]) }; PerCpu::MAX_CPU_NUM];
+
+#[inline(always)]
+pub fn snmp_inc(counter: SnmpCounter) {
+    SNMP_STATS[smp_get_processor_id() as usize].0[counter as usize].fetch_add(1, Ordering::Relaxed);
+}
+
+/// 所有cpu上的计数器之和
+pub fn snmp_get(counter: SnmpCounter) -> u64 {
+    return SNMP_STATS
+        .iter()
+        .map(|stat| stat.0[counter as usize].load(Ordering::Relaxed))
+        .sum();
+}
+
+const ETHERTYPE_IPV4: u16 = 0x0800;
+const ETHERTYPE_IPV6: u16 = 0x86dd;
+const IPPROTO_TCP: u8 = 6;
+const IPPROTO_UDP: u8 = 17;
+const TCP_FLAG_RST: u8 = 1 << 2;
+
+/// 以太网帧`frame`中IP分组的上层协议号，以及上层协议头部的偏移量
+#[inline]
+pub fn frame_l4_protocol(frame: &[u8]) -> Option<(u8, usize)> {
+    if frame.len() < 14 {
+        return None;
+    }
+    match u16::from_be_bytes([frame[12], frame[13]]) {
+        ETHERTYPE_IPV4 if frame.len() >= 14 + 20 => {
+            let ihl = (frame[14] & 0xf) as usize * 4;
+            return Some((frame[14 + 9], 14 + ihl));
+        }
+        // 不解析扩展头部
+        ETHERTYPE_IPV6 if frame.len() >= 14 + 40 => return Some((frame[14 + 6], 14 + 40)),
+        _ => return None,
+    }
+}
+
+/// 网卡收到了帧`frame`（`rx`为true）或者即将发出帧`frame`时，更新IP和TCP的计数器
+///
+/// 只读取几个头部字段，不检查校验和（由网卡或者smoltcp检查）
+#[inline]
+pub fn snmp_count_frame(frame: &[u8], rx: bool) {
+    let (protocol, l4_offset) = match frame_l4_protocol(frame) {
+        Some(x) => x,
+        None => return,
+    };
+    let stat = &SNMP_STATS[smp_get_processor_id() as usize].0;
+    let inc = |counter: SnmpCounter| stat[counter as usize].fetch_add(1, Ordering::Relaxed);
+    if rx {
+        inc(SnmpCounter::IpInReceives);
+    } else {
+        inc(SnmpCounter::IpOutRequests);
+    }
+    if protocol != IPPROTO_TCP {
+        return;
+    }
+    if rx {
+        inc(SnmpCounter::TcpInSegs);
+    } else {
+        inc(SnmpCounter::TcpOutSegs);
+        if frame
+            .get(l4_offset + 13)
+            .is_some_and(|flags| flags & TCP_FLAG_RST != 0)
+        {
+            inc(SnmpCounter::TcpOutRsts);
+        }
+    }
+}
+
+/// 网卡报告帧`frame`的TCP/UDP校验和错误时调用
+pub fn snmp_count_csum_error(frame: &[u8]) {
+    match frame_l4_protocol(frame) {
+        Some((IPPROTO_TCP, _)) => snmp_inc(SnmpCounter::TcpInCsumErrors),
+        Some((IPPROTO_UDP, _)) => snmp_inc(SnmpCounter::UdpInCsumErrors),
+        _ => {}
+    }
+}
+
+/// 所有网卡（包括环回接口）
+fn all_net_devices() -> Vec<Arc<dyn NetDriver>> {
+    let mut devices: Vec<Arc<dyn NetDriver>> = vec![LOOPBACK_IFACE.clone() as Arc<dyn NetDriver>];
+    devices.extend(NET_DRIVERS.read().values().cloned());
+    return devices;
+}
+
+/// 根据名字查找网卡（包括环回接口）
+pub fn net_device_by_name(name: &str) -> Option<Arc<dyn NetDriver>> {
+    return all_net_devices().into_iter().find(|dev| dev.name() == name);
+}
+
+/// `/proc/net/dev`：每个网卡一行，格式与Linux相同
+///
+/// 第0个记录是表头，之后每个记录是一个网卡。游标中带着开始遍历时所有网卡的快照，
+/// 因此前进到下一个网卡时不需要重新收集网卡
+#[derive(Debug)]
+pub struct NetDevSeq;
+
+impl SeqOperations for NetDevSeq {
+    type Cursor = (Arc<Vec<Arc<dyn NetDriver>>>, usize);
+
+    fn start(&self, pos: usize) -> Option<Self::Cursor> {
+        let devices = Arc::new(all_net_devices());
+        return if pos <= devices.len() {
+            Some((devices, pos))
+        } else {
+            None
+        };
+    }
+
+    fn next(&self, cursor: Self::Cursor, pos: usize) -> Option<Self::Cursor> {
+        let (devices, _) = cursor;
+        return if pos <= devices.len() {
+            Some((devices, pos))
+        } else {
+            None
+        };
+    }
+
+    fn show(&self, cursor: &Self::Cursor, s: &mut SeqBuf) -> Result<(), SystemError> {
+        use NetDevCounter::*;
+        let (devices, pos) = cursor;
+        if *pos == 0 {
+            s.push_str(
+                "Inter-|   Receive                                                |  Transmit\n \
+                 face |bytes    packets errs drop fifo frame compressed multicast|bytes    packets errs drop fifo colls carrier compressed\n",
+            );
+            return Ok(());
+        }
+        let dev = &devices[*pos - 1];
+        let stats = match dev.stats() {
+            Some(stats) => stats,
+            None => return Ok(()),
+        };
+        let get = |c| stats.get(c);
+        s.push_str(&format!(
+            "{:>6}: {:>7} {:>7} {:>4} {:>4} {:>4} {:>5} {:>10} {:>9} {:>8} {:>7} {:>4} {:>4} {:>4} {:>5} {:>7} {:>10}\n",
+            dev.name(),
+            get(RxBytes),
+            get(RxPackets),
+            get(RxErrors),
+            get(RxDropped),
+            get(RxFifoErrors),
+            0,
+            0,
+            get(RxMulticast),
+            get(TxBytes),
+            get(TxPackets),
+            get(TxErrors),
+            get(TxDropped),
+            get(TxFifoErrors),
+            0,
+            0,
+            0,
+        ));
+        return Ok(());
+    }
+}
+
+/// 生成`/proc/net/snmp`的内容
+///
+/// 与Linux相同，每个协议两行：第一行是字段名，第二行是对应的值。只列出本内核统计的字段，
+/// TCP的重传发生在smoltcp内部，没有可以统计的地方，因此没有RetransSegs
+pub fn snmp_show() -> String {
+    use SnmpCounter::*;
+    let line = |proto: &str, fields: &[(&str, u64)]| {
+        let mut names = format!("{proto}:");
+        let mut values = format!("{proto}:");
+        for (name, value) in fields {
+            names.push_str(&format!(" {name}"));
+            values.push_str(&format!(" {value}"));
+        }
+        return format!("{names}\n{values}\n");
+    };
+    let mut s = String::new();
+    s.push_str(&line(
+        "Ip",
+        &[
+            ("InReceives", snmp_get(IpInReceives)),
+            ("InHdrErrors", snmp_get(IpInHdrErrors)),
+            ("OutRequests", snmp_get(IpOutRequests)),
+        ],
+    ));
+    s.push_str(&line(
+        "Tcp",
+        &[
+            ("ActiveOpens", snmp_get(TcpActiveOpens)),
+            ("PassiveOpens", snmp_get(TcpPassiveOpens)),
+            ("AttemptFails", snmp_get(TcpAttemptFails)),
+            ("InSegs", snmp_get(TcpInSegs)),
+            ("OutSegs", snmp_get(TcpOutSegs)),
+            ("OutRsts", snmp_get(TcpOutRsts)),
+            ("InCsumErrors", snmp_get(TcpInCsumErrors)),
+        ],
+    ));
+    s.push_str(&line(
+        "Udp",
+        &[
+            ("InDatagrams", snmp_get(UdpInDatagrams)),
+            ("OutDatagrams", snmp_get(UdpOutDatagrams)),
+            ("SndbufErrors", snmp_get(UdpSndbufErrors)),
+            ("InCsumErrors", snmp_get(UdpInCsumErrors)),
+        ],
+    ));
+    s.push_str(&line(
+        "TcpExt",
+        &[("ListenOverflows", snmp_get(TcpListenOverflows))],
+    ));
+    return s;
+}
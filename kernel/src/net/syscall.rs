@@ -1,6 +1,6 @@
-use core::cmp::min;
+use core::{cmp::min, mem::size_of};
 
-use alloc::{boxed::Box, sync::Arc};
+use alloc::{boxed::Box, string::String, sync::Arc, vec::Vec};
 use num_traits::{FromPrimitive, ToPrimitive};
 use smoltcp::wire;
 
@@ -13,11 +13,17 @@ use crate::{
     libs::spinlock::SpinLockGuard,
     net::socket::{AddressFamily, SOL_SOCKET},
     process::ProcessManager,
-    syscall::{Syscall, SystemError},
+    syscall::{
+        user_access::{UserBufferReader, UserBufferWriter, UserSlice},
+        Syscall, SystemError,
+    },
 };
 
 use super::{
+    endpoints::{LinkLayerEndpoint, UnixEndpoint},
+    packet::PacketSocket,
     socket::{PosixSocketType, RawSocket, SocketInode, SocketOptions, TcpSocket, UdpSocket},
+    unix::{UnixSocket, SCM_MAX_FD},
     Endpoint, Protocol, ShutdownType, Socket,
 };
 
@@ -41,7 +47,10 @@ impl Syscall {
         // kdebug!("do_socket: address_family: {address_family:?}, socket_type: {socket_type:?}, protocol: {protocol}");
         // 根据地址族和socket类型创建socket
         let socket: Box<dyn Socket> = match address_family {
-            AddressFamily::Unix | AddressFamily::INet => match socket_type {
+            AddressFamily::Unix => {
+                Box::new(UnixSocket::new(socket_type, SocketOptions::default())?)
+            }
+            AddressFamily::INet => match socket_type {
                 PosixSocketType::Stream => Box::new(TcpSocket::new(SocketOptions::default())),
                 PosixSocketType::Datagram => Box::new(UdpSocket::new(SocketOptions::default())),
                 PosixSocketType::Raw => Box::new(RawSocket::new(
@@ -53,6 +62,12 @@ impl Syscall {
                     return Err(SystemError::EINVAL);
                 }
             },
+            AddressFamily::Packet => match socket_type {
+                PosixSocketType::Raw => {
+                    Box::new(PacketSocket::new(protocol as u16, SocketOptions::default()))
+                }
+                _ => return Err(SystemError::EINVAL),
+            },
             _ => {
                 // kdebug!("do_socket: EAFNOSUPPORT");
                 return Err(SystemError::EAFNOSUPPORT);
@@ -72,6 +87,59 @@ impl Syscall {
         return fd;
     }
 
+    /// @brief sys_socketpair系统调用的实际执行函数：创建一对互相连接的socket
+    ///
+    /// @param address_family 地址族，只支持AF_UNIX
+    /// @param socket_type socket类型，可以包含SOCK_NONBLOCK和SOCK_CLOEXEC
+    /// @param protocol 传输协议，只能为0
+    /// @param fds 返回两个文件描述符
+    pub fn socketpair(
+        address_family: usize,
+        socket_type: usize,
+        protocol: usize,
+        fds: *mut i32,
+    ) -> Result<usize, SystemError> {
+        let address_family = AddressFamily::try_from(address_family as u16)?;
+        if address_family != AddressFamily::Unix {
+            return Err(SystemError::EAFNOSUPPORT);
+        }
+        if protocol != 0 {
+            return Err(SystemError::EPROTONOSUPPORT);
+        }
+        let flags = socket_type as u32 & !0xf;
+        if (flags & (!(SOCK_CLOEXEC | SOCK_NONBLOCK)).bits()) != 0 {
+            return Err(SystemError::EINVAL);
+        }
+        let socket_type = PosixSocketType::try_from((socket_type & 0xf) as u8)?;
+        let mut writer = UserBufferWriter::new(fds, 2 * size_of::<i32>(), true)?;
+
+        let (a, b) = UnixSocket::new_pair(socket_type, SocketOptions::default())?;
+        let mut file_mode = FileMode::O_RDWR;
+        if flags & SOCK_NONBLOCK.bits() != 0 {
+            file_mode |= FileMode::O_NONBLOCK;
+        }
+        if flags & SOCK_CLOEXEC.bits() != 0 {
+            file_mode |= FileMode::O_CLOEXEC;
+        }
+        let file_a = File::new(SocketInode::new(Box::new(a)), file_mode)?;
+        let file_b = File::new(SocketInode::new(Box::new(b)), file_mode)?;
+
+        let binding = ProcessManager::current_pcb().fd_table();
+        let mut fd_table_guard = binding.write();
+        let fd_a = fd_table_guard.alloc_fd(file_a, None)?;
+        let fd_b = match fd_table_guard.alloc_fd(file_b, None) {
+            Ok(fd) => fd,
+            Err(e) => {
+                fd_table_guard.drop_fd(fd_a).ok();
+                return Err(e);
+            }
+        };
+        drop(fd_table_guard);
+
+        writer.copy_to_user(&[fd_a, fd_b], 0)?;
+        return Ok(0);
+    }
+
     /// @brief sys_setsockopt系统调用的实际执行函数
     ///
     /// @param fd 文件描述符
@@ -89,7 +157,7 @@ impl Syscall {
             .get_socket(fd as i32)
             .ok_or(SystemError::EBADF)?;
         // 获取内层的socket（真正的数据）
-        let socket: SpinLockGuard<Box<dyn Socket>> = socket_inode.inner();
+        let mut socket: SpinLockGuard<Box<dyn Socket>> = socket_inode.inner();
         return socket.setsockopt(level, optname, optval).map(|_| 0);
     }
 
@@ -265,6 +333,40 @@ impl Syscall {
         return Ok(n);
     }
 
+    /// @brief sys_sendmsg系统调用的实际执行函数
+    ///
+    /// 辅助数据中的SCM_RIGHTS把文件传递给接收者（只有Unix域socket支持）
+    ///
+    /// @param fd 文件描述符
+    /// @param msg MsgHdr
+    /// @param flags 标志，暂时未使用
+    ///
+    /// @return 成功返回发送的字节数，失败返回错误码
+    pub fn sendmsg(fd: usize, msg: &MsgHdr, _flags: u32) -> Result<usize, SystemError> {
+        let iovs = unsafe { IoVecs::from_user(msg.msg_iov, msg.msg_iovlen, false)? };
+        let endpoint = if msg.msg_name.is_null() {
+            None
+        } else {
+            Some(SockAddr::to_endpoint(
+                msg.msg_name,
+                msg.msg_namelen as usize,
+            )?)
+        };
+        let rights = read_scm_rights(msg)?;
+
+        let socket: Arc<SocketInode> = ProcessManager::current_pcb()
+            .get_socket(fd as i32)
+            .ok_or(SystemError::EBADF)?;
+        let socket = unsafe { socket.inner_no_preempt() };
+        if rights.is_empty() {
+            // 没有辅助数据时，各个缓冲区直接交给socket
+            let bufs: Vec<&[u8]> = iovs.iter().collect();
+            return socket.write_vectored(&bufs, endpoint);
+        }
+        let data = iovs.gather();
+        return socket.write_with_rights(&data, endpoint, rights);
+    }
+
     /// @brief sys_recvmsg系统调用的实际执行函数
     ///
     /// @param fd 文件描述符
@@ -281,15 +383,26 @@ impl Syscall {
             .ok_or(SystemError::EBADF)?;
         let socket = unsafe { socket.inner_no_preempt() };
 
-        let mut buf = iovs.new_buf(true);
-        // 从socket中读取数据
-        let (n, endpoint) = socket.read(&mut buf);
-        drop(socket);
+        let (n, endpoint) = if msg.msg_control.is_null() || msg.msg_controllen == 0 {
+            // 不接收辅助数据时，数据直接读入用户空间的iovecs
+            let mut bufs: Vec<&mut [u8]> = iovs.iter_mut().collect();
+            let (n, endpoint) = socket.read_vectored(&mut bufs);
+            drop(socket);
+            write_scm_rights(msg, Vec::new())?;
+            (n?, endpoint)
+        } else {
+            let mut buf = iovs.new_buf(true);
+            // 从socket中读取数据
+            let (n, endpoint, rights) = socket.read_with_rights(&mut buf);
+            drop(socket);
 
-        let n: usize = n?;
+            let n: usize = n?;
 
-        // 将数据写入用户空间的iovecs
-        iovs.scatter(&buf[..n]);
+            // 将数据写入用户空间的iovecs
+            iovs.scatter(&buf[..n]);
+            write_scm_rights(msg, rights)?;
+            (n, endpoint)
+        };
 
         let sockaddr_in = SockAddr::from(endpoint);
         unsafe {
@@ -298,6 +411,115 @@ impl Syscall {
         return Ok(n);
     }
 
+    /// @brief sys_recvmmsg系统调用的实际执行函数：一次接收多个数据报
+    ///
+    /// 等待到至少有一个数据报到达为止（相当于Linux的MSG_WAITFORONE），之后只接收已经到达的数据报
+    ///
+    /// @param fd 文件描述符
+    /// @param msgvec MMsgHdr数组
+    /// @param vlen 数组的长度
+    /// @param flags 标志，暂时未使用
+    ///
+    /// @return 成功返回接收的数据报的数量，失败返回错误码
+    pub fn recvmmsg(
+        fd: usize,
+        msgvec: *mut MMsgHdr,
+        vlen: usize,
+        _flags: u32,
+    ) -> Result<usize, SystemError> {
+        let vlen = min(vlen, UIO_MAXIOV);
+        if vlen == 0 {
+            return Ok(0);
+        }
+        let mut writer = UserBufferWriter::new(msgvec, vlen * size_of::<MMsgHdr>(), true)?;
+        let msgs = writer.buffer::<MMsgHdr>(0)?;
+
+        // 检查每个缓冲区地址是否合法，生成iovecs
+        let mut iovs = Vec::with_capacity(vlen);
+        for msg in msgs.iter() {
+            iovs.push(unsafe {
+                IoVecs::from_user(msg.msg_hdr.msg_iov, msg.msg_hdr.msg_iovlen, true)?
+            });
+        }
+        let mut bufs: Vec<Vec<u8>> = iovs.iter().map(|iov| iov.new_buf(true)).collect();
+
+        let socket: Arc<SocketInode> = ProcessManager::current_pcb()
+            .get_socket(fd as i32)
+            .ok_or(SystemError::EBADF)?;
+        let socket = unsafe { socket.inner_no_preempt() };
+        let received = {
+            let mut slices: Vec<&mut [u8]> = bufs.iter_mut().map(|b| b.as_mut_slice()).collect();
+            socket.read_batch(&mut slices)
+        };
+        drop(socket);
+        let received = received?;
+
+        for (i, (n, endpoint)) in received.iter().cloned().enumerate() {
+            iovs[i].scatter(&bufs[i][..n]);
+            let msg = &mut msgs[i];
+            msg.msg_len = n as u32;
+            let sockaddr_in = SockAddr::from(endpoint);
+            unsafe {
+                sockaddr_in.write_to_user(msg.msg_hdr.msg_name, &mut msg.msg_hdr.msg_namelen)?;
+            }
+        }
+        return Ok(received.len());
+    }
+
+    /// @brief sys_sendmmsg系统调用的实际执行函数：一次发送多个数据报
+    ///
+    /// @param fd 文件描述符
+    /// @param msgvec MMsgHdr数组，每个成功发送的数据报的长度会写入对应的msg_len
+    /// @param vlen 数组的长度
+    /// @param flags 标志，暂时未使用
+    ///
+    /// @return 成功返回发送的数据报的数量，失败返回错误码
+    pub fn sendmmsg(
+        fd: usize,
+        msgvec: *mut MMsgHdr,
+        vlen: usize,
+        _flags: u32,
+    ) -> Result<usize, SystemError> {
+        let vlen = min(vlen, UIO_MAXIOV);
+        if vlen == 0 {
+            return Ok(0);
+        }
+        let mut writer = UserBufferWriter::new(msgvec, vlen * size_of::<MMsgHdr>(), true)?;
+        let msgs = writer.buffer::<MMsgHdr>(0)?;
+
+        let mut datas = Vec::with_capacity(vlen);
+        for msg in msgs.iter() {
+            let iovs =
+                unsafe { IoVecs::from_user(msg.msg_hdr.msg_iov, msg.msg_hdr.msg_iovlen, false)? };
+            let endpoint = if msg.msg_hdr.msg_name.is_null() {
+                None
+            } else {
+                Some(SockAddr::to_endpoint(
+                    msg.msg_hdr.msg_name,
+                    msg.msg_hdr.msg_namelen as usize,
+                )?)
+            };
+            datas.push((iovs.gather(), endpoint));
+        }
+        let batch: Vec<(&[u8], Option<Endpoint>)> = datas
+            .iter()
+            .map(|(data, endpoint)| (data.as_slice(), endpoint.clone()))
+            .collect();
+
+        let socket: Arc<SocketInode> = ProcessManager::current_pcb()
+            .get_socket(fd as i32)
+            .ok_or(SystemError::EBADF)?;
+        let socket = unsafe { socket.inner_no_preempt() };
+        let sent = socket.write_batch(&batch);
+        drop(socket);
+        let sent = sent?;
+
+        for (msg, (data, _)) in msgs.iter_mut().zip(datas.iter()).take(sent) {
+            msg.msg_len = data.len() as u32;
+        }
+        return Ok(sent);
+    }
+
     /// @brief sys_listen系统调用的实际执行函数
     ///
     /// @param fd 文件描述符
@@ -550,6 +772,10 @@ impl SockAddr {
         }
 
         let addr = unsafe { addr.as_ref() }.ok_or(SystemError::EFAULT)?;
+        // Unix域socket的地址是变长的，由len决定
+        if unsafe { addr.family } == AddressFamily::Unix as u16 {
+            return Self::to_unix_endpoint(addr, len);
+        }
         if len < addr.len()? {
             return Err(SystemError::EINVAL);
         }
@@ -566,16 +792,15 @@ impl SockAddr {
                     return Ok(Endpoint::Ip(Some(wire::IpEndpoint::new(ip, port))));
                 }
                 AddressFamily::Packet => {
-                    // TODO: support packet socket
-                    return Err(SystemError::EINVAL);
+                    let addr_ll: SockAddrLl = addr.addr_ll;
+                    return Ok(Endpoint::LinkLayer(LinkLayerEndpoint::new(
+                        addr_ll.sll_ifindex as usize,
+                    )));
                 }
                 AddressFamily::Netlink => {
                     // TODO: support netlink socket
                     return Err(SystemError::EINVAL);
                 }
-                AddressFamily::Unix => {
-                    return Err(SystemError::EINVAL);
-                }
                 _ => {
                     return Err(SystemError::EINVAL);
                 }
@@ -583,13 +808,43 @@ impl SockAddr {
         }
     }
 
+    /// @brief 把长度为`len`的sockaddr_un转换为Endpoint
+    fn to_unix_endpoint(addr: &SockAddr, len: usize) -> Result<Endpoint, SystemError> {
+        let path_offset = size_of::<u16>();
+        if len < path_offset || len > size_of::<SockAddrUn>() {
+            return Err(SystemError::EINVAL);
+        }
+        let path = unsafe { &addr.addr_un.sun_path[..len - path_offset] };
+        if path.is_empty() {
+            return Ok(Endpoint::Unix(UnixEndpoint::Unnamed));
+        }
+        if path[0] == 0 {
+            return Ok(Endpoint::Unix(UnixEndpoint::Abstract(path[1..].to_vec())));
+        }
+        let end = path.iter().position(|&c| c == 0).unwrap_or(path.len());
+        let path = core::str::from_utf8(&path[..end]).map_err(|_| SystemError::EINVAL)?;
+        return Ok(Endpoint::Unix(UnixEndpoint::Path(String::from(path))));
+    }
+
     /// @brief 获取地址长度
     pub fn len(&self) -> Result<usize, SystemError> {
         let ret = match AddressFamily::try_from(unsafe { self.family })? {
             AddressFamily::INet => Ok(core::mem::size_of::<SockAddrIn>()),
             AddressFamily::Packet => Ok(core::mem::size_of::<SockAddrLl>()),
             AddressFamily::Netlink => Ok(core::mem::size_of::<SockAddrNl>()),
-            AddressFamily::Unix => Err(SystemError::EINVAL),
+            AddressFamily::Unix => {
+                let path = unsafe { &self.addr_un.sun_path };
+                let path_len = if path[0] != 0 {
+                    // 路径，包括结尾的'\0'
+                    path.iter()
+                        .position(|&c| c == 0)
+                        .map_or(path.len(), |n| n + 1)
+                } else {
+                    // 抽象的名字，以及没有绑定地址的socket
+                    path.iter().rposition(|&c| c != 0).map_or(0, |n| n + 1)
+                };
+                Ok(size_of::<u16>() + path_len)
+            }
             _ => Err(SystemError::EINVAL),
         };
 
@@ -611,24 +866,19 @@ impl SockAddr {
         if addr.is_null() || addr_len.is_null() {
             return Ok(0);
         }
-        // 检查用户传入的地址是否合法
-        if !verify_area(
-            addr as usize as u64,
-            core::mem::size_of::<SockAddr>() as u64,
-        ) || !verify_area(addr_len as usize as u64, core::mem::size_of::<u32>() as u64)
-        {
-            return Err(SystemError::EFAULT);
-        }
+        // 检查用户传入的地址是否合法（每个地址只检查一次）
+        let name = UserSlice::new_array(addr as *const SockAddr, 1)?;
+        let name_len = UserSlice::new_array(addr_len as *const u32, 1)?;
 
-        let to_write = min(self.len()?, *addr_len as usize);
+        let len = self.len()?;
+        let to_write = min(len, name_len.read_one::<u32>(0)? as usize);
         if to_write > 0 {
-            let buf = core::slice::from_raw_parts_mut(addr as *mut u8, to_write);
-            buf.copy_from_slice(core::slice::from_raw_parts(
-                self as *const SockAddr as *const u8,
-                to_write,
-            ));
+            name.write(
+                0,
+                core::slice::from_raw_parts(self as *const SockAddr as *const u8, to_write),
+            )?;
         }
-        *addr_len = self.len()? as u32;
+        name_len.write_one(0, &(len as u32))?;
         return Ok(to_write);
     }
 }
@@ -665,6 +915,26 @@ impl From<Endpoint> for SockAddr {
                 }
             }
 
+            Endpoint::Unix(unix_endpoint) => {
+                let mut addr_un = SockAddrUn {
+                    sun_family: AddressFamily::Unix as u16,
+                    sun_path: [0; 108],
+                };
+                match unix_endpoint {
+                    UnixEndpoint::Unnamed => {}
+                    UnixEndpoint::Path(path) => {
+                        let n = min(path.len(), addr_un.sun_path.len() - 1);
+                        addr_un.sun_path[..n].copy_from_slice(&path.as_bytes()[..n]);
+                    }
+                    UnixEndpoint::Abstract(name) => {
+                        let n = min(name.len(), addr_un.sun_path.len() - 1);
+                        addr_un.sun_path[1..n + 1].copy_from_slice(&name[..n]);
+                    }
+                }
+
+                return SockAddr { addr_un };
+            }
+
             Endpoint::LinkLayer(link_endpoint) => {
                 let addr_ll = SockAddrLl {
                     sll_family: AddressFamily::Packet as u16,
@@ -704,6 +974,132 @@ pub struct MsgHdr {
     pub msg_flags: u32,
 }
 
+/// recvmmsg/sendmmsg使用的消息头
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct MMsgHdr {
+    pub msg_hdr: MsgHdr,
+    /// 接收或者发送的字节数
+    pub msg_len: u32,
+}
+
+/// recvmmsg/sendmmsg一次最多处理的消息数量（与Linux相同）
+pub const UIO_MAXIOV: usize = 1024;
+
+/// 辅助数据的头部，后面跟着按照usize对齐的数据
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct CMsgHdr {
+    /// 包括头部在内的长度
+    pub cmsg_len: usize,
+    pub cmsg_level: i32,
+    pub cmsg_type: i32,
+}
+
+/// 辅助数据的类型：传递文件描述符
+pub const SCM_RIGHTS: i32 = 1;
+/// recvmsg返回的标志：辅助数据的缓冲区太小，部分辅助数据被丢弃
+pub const MSG_CTRUNC: u32 = 0x8;
+
+#[inline]
+const fn cmsg_align(len: usize) -> usize {
+    return (len + size_of::<usize>() - 1) & !(size_of::<usize>() - 1);
+}
+
+/// 从sendmsg的辅助数据中取出SCM_RIGHTS要传递的文件
+///
+/// 每个文件描述符都复制一份打开的文件（与dup相同），因此发送之后关闭文件描述符不影响接收者
+fn read_scm_rights(msg: &MsgHdr) -> Result<Vec<File>, SystemError> {
+    let mut rights = Vec::new();
+    if msg.msg_control.is_null() || msg.msg_controllen == 0 {
+        return Ok(rights);
+    }
+    let reader = UserBufferReader::new(msg.msg_control, msg.msg_controllen, true)?;
+    let control = reader.read_from_user::<u8>(0)?;
+    let header_len = size_of::<CMsgHdr>();
+    let fd_table = ProcessManager::current_pcb().fd_table();
+
+    let mut offset = 0;
+    while offset + header_len <= control.len() {
+        let header =
+            unsafe { core::ptr::read_unaligned(control[offset..].as_ptr() as *const CMsgHdr) };
+        if header.cmsg_len < header_len || offset + header.cmsg_len > control.len() {
+            return Err(SystemError::EINVAL);
+        }
+        if header.cmsg_level == SOL_SOCKET as i32 && header.cmsg_type == SCM_RIGHTS {
+            let data = &control[offset + header_len..offset + header.cmsg_len];
+            for fd in data.chunks_exact(size_of::<i32>()) {
+                if rights.len() >= SCM_MAX_FD {
+                    return Err(SystemError::EINVAL);
+                }
+                let fd = i32::from_ne_bytes([fd[0], fd[1], fd[2], fd[3]]);
+                let file = fd_table
+                    .read()
+                    .get_file_by_fd(fd)
+                    .ok_or(SystemError::EBADF)?;
+                let file = file.lock().try_clone().ok_or(SystemError::EBADF)?;
+                rights.push(file);
+            }
+        }
+        offset += cmsg_align(header.cmsg_len);
+    }
+    return Ok(rights);
+}
+
+/// 把recvmsg收到的文件加入当前进程的文件描述符表，并把文件描述符作为SCM_RIGHTS写入辅助数据
+///
+/// 辅助数据的缓冲区放不下的文件会被关闭，并设置MSG_CTRUNC
+fn write_scm_rights(msg: &mut MsgHdr, rights: Vec<File>) -> Result<(), SystemError> {
+    let header_len = size_of::<CMsgHdr>();
+    let capacity = if msg.msg_control.is_null() {
+        0
+    } else {
+        msg.msg_controllen.saturating_sub(header_len) / size_of::<i32>()
+    };
+    msg.msg_controllen = 0;
+    if rights.is_empty() {
+        return Ok(());
+    }
+
+    let mut fds: Vec<i32> = Vec::new();
+    let mut truncated = false;
+    let fd_table = ProcessManager::current_pcb().fd_table();
+    for file in rights {
+        if fds.len() >= capacity {
+            truncated = true;
+            continue;
+        }
+        match fd_table.write().alloc_fd(file, None) {
+            Ok(fd) => fds.push(fd),
+            Err(_) => truncated = true,
+        }
+    }
+    if truncated {
+        msg.msg_flags |= MSG_CTRUNC;
+    }
+    if fds.is_empty() {
+        return Ok(());
+    }
+
+    let cmsg_len = header_len + fds.len() * size_of::<i32>();
+    let header = CMsgHdr {
+        cmsg_len,
+        cmsg_level: SOL_SOCKET as i32,
+        cmsg_type: SCM_RIGHTS,
+    };
+    let mut control: Vec<u8> = Vec::with_capacity(cmsg_len);
+    control.extend_from_slice(unsafe {
+        core::slice::from_raw_parts(&header as *const CMsgHdr as *const u8, header_len)
+    });
+    for fd in fds.iter() {
+        control.extend_from_slice(&fd.to_ne_bytes());
+    }
+    let mut writer = UserBufferWriter::new(msg.msg_control, cmsg_len, true)?;
+    writer.copy_to_user(&control, 0)?;
+    msg.msg_controllen = cmsg_len;
+    return Ok(());
+}
+
 #[derive(Debug, Clone, Copy, FromPrimitive, ToPrimitive, PartialEq, Eq)]
 pub enum PosixIpProtocol {
     /// Dummy protocol for TCP.
@@ -0,0 +1,794 @@
+//! Unix域socket（AF_UNIX）
+//!
+//! 本机进程之间通信不需要经过协议栈：发送者直接把数据放入接收者的接收队列，接收者从队列中复制到自己的缓冲区。
+//! 支持SOCK_STREAM、SOCK_DGRAM和SOCK_SEQPACKET，地址可以是文件系统中的路径，也可以是抽象命名空间中的名字。
+//!
+//! 通过SCM_RIGHTS传递的文件在消息中以[`File`]的形式存放，接收时加入接收者的文件描述符表。
+//! 注意：socket通过SCM_RIGHTS把自己传递给自己、又没有被接收时，这个socket不会被释放（Linux通过垃圾回收处理这种情况）
+
+use core::cmp::min;
+
+use alloc::{
+    boxed::Box,
+    collections::VecDeque,
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+use hashbrown::HashMap;
+
+use crate::{
+    filesystem::vfs::{
+        fcntl::AtFlags,
+        file::File,
+        poll::signal_pending,
+        syscall::ModeType,
+        utils::{rsplit_path, user_path_at},
+        FileType, IndexNode, VFS_MAX_FOLLOW_SYMLINK_TIMES,
+    },
+    libs::{spinlock::SpinLock, wait_queue::WaitQueue},
+    process::ProcessManager,
+    syscall::SystemError,
+};
+
+use super::{
+    endpoints::UnixEndpoint,
+    socket::{PosixSocketType, SocketMetadata, SocketOptions, SocketType},
+    Endpoint, ShutdownType, Socket,
+};
+
+/// 每个Unix域socket的接收队列最多容纳的字节数
+pub const UNIX_BUF_SIZE: usize = 208 * 1024;
+/// listen的最大等待连接数（与Linux的SOMAXCONN相同）
+const UNIX_MAX_BACKLOG: usize = 4096;
+/// 一条消息最多可以通过SCM_RIGHTS传递的文件数（与Linux的SCM_MAX_FD相同）
+pub const SCM_MAX_FD: usize = 253;
+
+lazy_static! {
+    /// 所有已经绑定了地址的Unix域socket
+    static ref UNIX_BINDINGS: SpinLock<HashMap<UnixBindKey, Weak<UnixEnd>>> = SpinLock::new(HashMap::new());
+}
+
+/// 绑定表的键
+///
+/// 路径地址以路径对应的文件区分：相对路径、符号链接都能找到同一个socket，删除文件之后也可以在同一个路径上重新绑定
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
+enum UnixBindKey {
+    /// (dev_id, inode_id)
+    Inode(usize, usize),
+    Abstract(Vec<u8>),
+}
+
+impl UnixBindKey {
+    fn from_inode(inode: &Arc<dyn IndexNode>) -> Result<Self, SystemError> {
+        let metadata = inode.metadata()?;
+        return Ok(Self::Inode(metadata.dev_id, metadata.inode_id.data()));
+    }
+}
+
+/// 在文件系统中创建`path`对应的socket文件，返回它在绑定表中的键
+fn create_socket_file(path: &str) -> Result<UnixBindKey, SystemError> {
+    let (begin, path) = user_path_at(
+        &ProcessManager::current_pcb(),
+        AtFlags::AT_FDCWD.bits(),
+        path,
+    )?;
+    if begin
+        .lookup_follow_symlink(&path, VFS_MAX_FOLLOW_SYMLINK_TIMES)
+        .is_ok()
+    {
+        return Err(SystemError::EADDRINUSE);
+    }
+    let (filename, parent_path) = rsplit_path(&path);
+    let parent =
+        begin.lookup_follow_symlink(parent_path.unwrap_or("/"), VFS_MAX_FOLLOW_SYMLINK_TIMES)?;
+    let inode = parent.create(
+        filename,
+        FileType::Socket,
+        ModeType::S_IFSOCK | ModeType::S_IRWXUGO,
+    )?;
+    return UnixBindKey::from_inode(&inode);
+}
+
+/// 查找绑定在`addr`上的socket
+fn lookup_end(
+    addr: &UnixEndpoint,
+    socket_type: PosixSocketType,
+) -> Result<Arc<UnixEnd>, SystemError> {
+    let key = match addr {
+        UnixEndpoint::Path(path) => {
+            let (begin, path) = user_path_at(
+                &ProcessManager::current_pcb(),
+                AtFlags::AT_FDCWD.bits(),
+                path,
+            )?;
+            let inode = begin.lookup_follow_symlink(&path, VFS_MAX_FOLLOW_SYMLINK_TIMES)?;
+            if inode.metadata()?.file_type != FileType::Socket {
+                return Err(SystemError::ECONNREFUSED);
+            }
+            UnixBindKey::from_inode(&inode)?
+        }
+        UnixEndpoint::Abstract(name) => UnixBindKey::Abstract(name.clone()),
+        UnixEndpoint::Unnamed => return Err(SystemError::EINVAL),
+    };
+    let end = UNIX_BINDINGS
+        .lock()
+        .get(&key)
+        .and_then(|end| end.upgrade())
+        .ok_or(SystemError::ECONNREFUSED)?;
+    if end.socket_type != socket_type {
+        return Err(SystemError::EPROTOTYPE);
+    }
+    return Ok(end);
+}
+
+/// 在socket之间传递的一条消息
+#[derive(Debug)]
+struct UnixMessage {
+    data: Vec<u8>,
+    /// 已经读取的字节数（只有流式socket会读取消息的一部分）
+    consumed: usize,
+    /// 发送者的地址
+    from: UnixEndpoint,
+    /// 通过SCM_RIGHTS传递的文件
+    rights: Vec<File>,
+}
+
+/// 监听中的socket的连接队列
+#[derive(Debug)]
+struct UnixListenQueue {
+    backlog: usize,
+    /// 已经建立、还没有被accept的连接。存放的是服务端一侧的端点
+    pending: VecDeque<Arc<UnixEnd>>,
+}
+
+#[derive(Debug, Default)]
+struct UnixState {
+    /// 绑定的地址
+    addr: UnixEndpoint,
+    bind_key: Option<UnixBindKey>,
+    /// 流式和seqpacket socket：连接的另一端；数据报socket：connect指定的默认目的地址
+    peer: Option<Weak<UnixEnd>>,
+    /// 是否已经连接
+    connected: bool,
+    /// 接收队列
+    recv: VecDeque<UnixMessage>,
+    /// 接收队列中还没有读取的字节数
+    recv_bytes: usize,
+    /// 不会再收到数据：对端已经关闭或者shutdown了写方向，或者本端shutdown了读方向
+    recv_shutdown: bool,
+    /// 本端shutdown了写方向
+    send_shutdown: bool,
+    /// 端点已经关闭，不能再向它发送数据
+    closed: bool,
+    listener: Option<UnixListenQueue>,
+}
+
+/// Unix域socket的一个端点
+///
+/// 锁的规则：同一时刻最多持有一个端点的`state`锁，因此两个端点互相发送数据不会死锁
+#[derive(Debug)]
+pub struct UnixEnd {
+    socket_type: PosixSocketType,
+    state: SpinLock<UnixState>,
+    /// 接收队列有数据、有空间、有新的连接或者状态变化时唤醒
+    wait_queue: Arc<WaitQueue>,
+}
+
+impl UnixEnd {
+    fn new(socket_type: PosixSocketType) -> Arc<Self> {
+        return Arc::new(Self {
+            socket_type,
+            state: SpinLock::new(UnixState::default()),
+            wait_queue: Arc::new(WaitQueue::INIT),
+        });
+    }
+
+    #[inline]
+    fn is_connection_oriented(&self) -> bool {
+        return self.socket_type != PosixSocketType::Datagram;
+    }
+
+    #[inline]
+    fn wakeup(&self) {
+        self.wait_queue.wakeup_all(None);
+    }
+
+    fn peer(&self) -> Option<Arc<UnixEnd>> {
+        return self
+            .state
+            .lock()
+            .peer
+            .as_ref()
+            .and_then(|peer| peer.upgrade());
+    }
+
+    fn addr(&self) -> UnixEndpoint {
+        return self.state.lock().addr.clone();
+    }
+
+    /// 接收队列是否还有空间（对于已经关闭的端点，发送会立即失败，也视为可写）
+    fn writable(&self) -> bool {
+        let state = self.state.lock();
+        return state.closed || state.recv_shutdown || state.recv_bytes < UNIX_BUF_SIZE;
+    }
+
+    fn bind(self: &Arc<Self>, addr: UnixEndpoint) -> Result<(), SystemError> {
+        if self.state.lock().addr != UnixEndpoint::Unnamed {
+            return Err(SystemError::EINVAL);
+        }
+        let key = match &addr {
+            UnixEndpoint::Path(path) => create_socket_file(path)?,
+            UnixEndpoint::Abstract(name) => UnixBindKey::Abstract(name.clone()),
+            UnixEndpoint::Unnamed => return Err(SystemError::EINVAL),
+        };
+
+        let mut bindings = UNIX_BINDINGS.lock();
+        if bindings.get(&key).and_then(|end| end.upgrade()).is_some() {
+            return Err(SystemError::EADDRINUSE);
+        }
+        bindings.insert(key.clone(), Arc::downgrade(self));
+        drop(bindings);
+
+        let mut state = self.state.lock();
+        state.addr = addr;
+        state.bind_key = Some(key);
+        return Ok(());
+    }
+
+    fn listen(&self, backlog: usize) -> Result<(), SystemError> {
+        if !self.is_connection_oriented() {
+            return Err(SystemError::EOPNOTSUPP_OR_ENOTSUP);
+        }
+        let backlog = backlog.clamp(1, UNIX_MAX_BACKLOG);
+        let mut state = self.state.lock();
+        if state.bind_key.is_none() || state.connected {
+            return Err(SystemError::EINVAL);
+        }
+        match state.listener.as_mut() {
+            Some(listener) => listener.backlog = backlog,
+            None => {
+                state.listener = Some(UnixListenQueue {
+                    backlog,
+                    pending: VecDeque::new(),
+                })
+            }
+        }
+        return Ok(());
+    }
+
+    /// 连接到绑定在`addr`上的socket
+    ///
+    /// 流式和seqpacket socket：在对方的连接队列中放入一个新的端点，与本端互为对端；
+    /// 数据报socket：只设置默认的目的地址
+    fn connect(self: &Arc<Self>, addr: &UnixEndpoint) -> Result<(), SystemError> {
+        let target = lookup_end(addr, self.socket_type)?;
+        if !self.is_connection_oriented() {
+            let mut state = self.state.lock();
+            state.peer = Some(Arc::downgrade(&target));
+            state.connected = true;
+            return Ok(());
+        }
+
+        {
+            let state = self.state.lock();
+            if state.connected {
+                return Err(SystemError::EISCONN);
+            }
+            if state.listener.is_some() {
+                return Err(SystemError::EINVAL);
+            }
+        }
+
+        let server = UnixEnd::new(self.socket_type);
+        {
+            let mut server_state = server.state.lock();
+            server_state.addr = target.addr();
+            server_state.peer = Some(Arc::downgrade(self));
+            server_state.connected = true;
+        }
+        {
+            let mut state = self.state.lock();
+            state.peer = Some(Arc::downgrade(&server));
+            state.connected = true;
+        }
+
+        let r = loop {
+            let mut target_state = target.state.lock();
+            if target_state.closed {
+                break Err(SystemError::ECONNREFUSED);
+            }
+            let listener = match target_state.listener.as_mut() {
+                Some(listener) => listener,
+                None => break Err(SystemError::ECONNREFUSED),
+            };
+            if listener.pending.len() < listener.backlog {
+                listener.pending.push_back(server.clone());
+                drop(target_state);
+                target.wakeup();
+                break Ok(());
+            }
+            if signal_pending() {
+                break Err(SystemError::EINTR);
+            }
+            target.wait_queue.sleep_unlock_spinlock(target_state);
+        };
+
+        if r.is_err() {
+            let mut state = self.state.lock();
+            state.peer = None;
+            state.connected = false;
+        }
+        return r;
+    }
+
+    /// 取出一个已经建立的连接，返回服务端一侧的端点
+    fn accept(&self) -> Result<Arc<UnixEnd>, SystemError> {
+        let mut state = self.state.lock();
+        loop {
+            let listener = state.listener.as_mut().ok_or(SystemError::EINVAL)?;
+            if let Some(end) = listener.pending.pop_front() {
+                drop(state);
+                // 唤醒等待连接队列空间的进程
+                self.wakeup();
+                return Ok(end);
+            }
+            if signal_pending() {
+                return Err(SystemError::EINTR);
+            }
+            self.wait_queue.sleep_unlock_spinlock(state);
+            state = self.state.lock();
+        }
+    }
+
+    /// 确定发送的目标端点
+    fn send_target(&self, to: Option<&UnixEndpoint>) -> Result<Arc<UnixEnd>, SystemError> {
+        let state = self.state.lock();
+        if state.send_shutdown {
+            return Err(SystemError::EPIPE);
+        }
+        if !self.is_connection_oriented() {
+            if let Some(addr) = to {
+                drop(state);
+                return lookup_end(addr, self.socket_type);
+            }
+        }
+        if !state.connected {
+            return Err(SystemError::ENOTCONN);
+        }
+        let peer = state.peer.as_ref().and_then(|peer| peer.upgrade());
+        return match peer {
+            Some(peer) => Ok(peer),
+            None if self.is_connection_oriented() => Err(SystemError::EPIPE),
+            None => Err(SystemError::ECONNREFUSED),
+        };
+    }
+
+    /// 发送数据，`rights`随数据一起传递给接收者
+    fn send(
+        &self,
+        buf: &[u8],
+        to: Option<&UnixEndpoint>,
+        rights: Vec<File>,
+    ) -> Result<usize, SystemError> {
+        let target = self.send_target(to)?;
+        let from = self.addr();
+        if self.socket_type == PosixSocketType::Stream {
+            return self.send_stream(&target, buf, from, rights);
+        }
+        return self.send_packet(&target, buf, from, rights);
+    }
+
+    /// 发送一条完整的消息（数据报和seqpacket）。接收队列没有足够的空间时等待
+    fn send_packet(
+        &self,
+        target: &Arc<UnixEnd>,
+        buf: &[u8],
+        from: UnixEndpoint,
+        rights: Vec<File>,
+    ) -> Result<usize, SystemError> {
+        if buf.len() > UNIX_BUF_SIZE {
+            return Err(SystemError::EMSGSIZE);
+        }
+        let mut target_state = target.state.lock();
+        loop {
+            if target_state.closed || target_state.recv_shutdown {
+                if self.is_connection_oriented() {
+                    return Err(SystemError::EPIPE);
+                }
+                return Err(SystemError::ECONNREFUSED);
+            }
+            if target_state.recv_bytes + buf.len() <= UNIX_BUF_SIZE {
+                break;
+            }
+            if signal_pending() {
+                return Err(SystemError::EINTR);
+            }
+            target.wait_queue.sleep_unlock_spinlock(target_state);
+            target_state = target.state.lock();
+        }
+        target_state.recv_bytes += buf.len();
+        target_state.recv.push_back(UnixMessage {
+            data: buf.to_vec(),
+            consumed: 0,
+            from,
+            rights,
+        });
+        drop(target_state);
+        target.wakeup();
+        return Ok(buf.len());
+    }
+
+    /// 发送字节流。接收队列满了的时候等待，直到所有数据都放入接收队列；`rights`随第一段数据传递
+    fn send_stream(
+        &self,
+        target: &Arc<UnixEnd>,
+        buf: &[u8],
+        from: UnixEndpoint,
+        mut rights: Vec<File>,
+    ) -> Result<usize, SystemError> {
+        let mut written = 0;
+        while written < buf.len() {
+            let mut target_state = target.state.lock();
+            if target_state.closed || target_state.recv_shutdown {
+                if written > 0 {
+                    return Ok(written);
+                }
+                return Err(SystemError::EPIPE);
+            }
+            let room = UNIX_BUF_SIZE.saturating_sub(target_state.recv_bytes);
+            if room == 0 {
+                if signal_pending() {
+                    if written > 0 {
+                        return Ok(written);
+                    }
+                    return Err(SystemError::EINTR);
+                }
+                target.wait_queue.sleep_unlock_spinlock(target_state);
+                continue;
+            }
+
+            let n = min(room, buf.len() - written);
+            target_state.recv_bytes += n;
+            target_state.recv.push_back(UnixMessage {
+                data: buf[written..written + n].to_vec(),
+                consumed: 0,
+                from: from.clone(),
+                rights: core::mem::take(&mut rights),
+            });
+            drop(target_state);
+            target.wakeup();
+            written += n;
+        }
+        return Ok(written);
+    }
+
+    /// 接收数据。接收队列为空时等待，直到有数据或者不会再有数据为止
+    ///
+    /// @return (读取的字节数, 发送者的地址, 随数据传递过来的文件)
+    fn recv(&self, buf: &mut [u8]) -> Result<(usize, UnixEndpoint, Vec<File>), SystemError> {
+        let mut guard = self.state.lock();
+        loop {
+            if !guard.recv.is_empty() {
+                break;
+            }
+            if guard.recv_shutdown {
+                return Ok((0, UnixEndpoint::Unnamed, Vec::new()));
+            }
+            if self.is_connection_oriented() && !guard.connected {
+                return Err(SystemError::ENOTCONN);
+            }
+            if signal_pending() {
+                return Err(SystemError::EINTR);
+            }
+            self.wait_queue.sleep_unlock_spinlock(guard);
+            guard = self.state.lock();
+        }
+
+        let state = &mut *guard;
+        let mut copied = 0;
+        let mut from = UnixEndpoint::Unnamed;
+        let mut rights = Vec::new();
+        if self.socket_type == PosixSocketType::Stream {
+            // 字节流可以跨越多条消息读取，但是传递文件的消息只能从它的第一个字节开始读取
+            while copied < buf.len() {
+                let msg = match state.recv.front_mut() {
+                    Some(msg) => msg,
+                    None => break,
+                };
+                if !msg.rights.is_empty() && copied > 0 {
+                    break;
+                }
+                if copied == 0 {
+                    from = msg.from.clone();
+                }
+                let has_rights = !msg.rights.is_empty();
+                rights.append(&mut msg.rights);
+
+                let n = min(buf.len() - copied, msg.data.len() - msg.consumed);
+                buf[copied..copied + n].copy_from_slice(&msg.data[msg.consumed..msg.consumed + n]);
+                copied += n;
+                msg.consumed += n;
+                state.recv_bytes -= n;
+                if msg.consumed == msg.data.len() {
+                    state.recv.pop_front();
+                }
+                if has_rights {
+                    break;
+                }
+            }
+        } else {
+            // 数据报和seqpacket每次读取一条消息，缓冲区放不下的部分被丢弃
+            let msg = state.recv.pop_front().unwrap();
+            state.recv_bytes -= msg.data.len();
+            copied = min(buf.len(), msg.data.len());
+            buf[..copied].copy_from_slice(&msg.data[..copied]);
+            from = msg.from;
+            rights = msg.rights;
+        }
+        let peer = state.peer.as_ref().and_then(|peer| peer.upgrade());
+        drop(guard);
+
+        // 唤醒等待接收队列空间的发送者，以及在对端上等待可写的进程
+        self.wakeup();
+        if let Some(peer) = peer {
+            peer.wakeup();
+        }
+        return Ok((copied, from, rights));
+    }
+
+    fn shutdown(&self, how: ShutdownType) -> Result<(), SystemError> {
+        let (shut_rd, shut_wr) = match how {
+            ShutdownType::ShutRd => (true, false),
+            ShutdownType::ShutWr => (false, true),
+            ShutdownType::ShutRdwr => (true, true),
+        };
+        let mut state = self.state.lock();
+        if self.is_connection_oriented() && !state.connected {
+            return Err(SystemError::ENOTCONN);
+        }
+        state.recv_shutdown |= shut_rd;
+        state.send_shutdown |= shut_wr;
+        let peer = state.peer.as_ref().and_then(|peer| peer.upgrade());
+        drop(state);
+        self.wakeup();
+
+        if let Some(peer) = peer.filter(|_| self.is_connection_oriented()) {
+            let mut peer_state = peer.state.lock();
+            peer_state.send_shutdown |= shut_rd;
+            peer_state.recv_shutdown |= shut_wr;
+            drop(peer_state);
+            peer.wakeup();
+        }
+        return Ok(());
+    }
+
+    fn poll(&self) -> (bool, bool, bool) {
+        let state = self.state.lock();
+        let readable = !state.recv.is_empty()
+            || state.recv_shutdown
+            || state
+                .listener
+                .as_ref()
+                .map_or(false, |listener| !listener.pending.is_empty());
+        let connected = state.connected;
+        let send_shutdown = state.send_shutdown;
+        let peer = state.peer.as_ref().map(|peer| peer.upgrade());
+        drop(state);
+
+        let writable = match peer {
+            _ if send_shutdown => true,
+            Some(Some(peer)) => peer.writable(),
+            // 对端已经被释放，写入会立即失败
+            Some(None) => true,
+            None => !self.is_connection_oriented(),
+        };
+        return (
+            readable,
+            writable && (connected || !self.is_connection_oriented()),
+            false,
+        );
+    }
+
+    /// 关闭端点：从绑定表中移除，通知对端，断开还没有被accept的连接
+    fn close(&self) {
+        let mut state = self.state.lock();
+        state.closed = true;
+        state.recv_shutdown = true;
+        state.send_shutdown = true;
+        let peer = state.peer.take().and_then(|peer| peer.upgrade());
+        let bind_key = state.bind_key.take();
+        let pending = state.listener.take().map(|listener| listener.pending);
+        // 队列中的文件在释放锁之后再关闭
+        let recv = core::mem::take(&mut state.recv);
+        state.recv_bytes = 0;
+        drop(state);
+        self.wakeup();
+
+        if let Some(key) = bind_key {
+            let mut bindings = UNIX_BINDINGS.lock();
+            let is_self = bindings
+                .get(&key)
+                .map_or(false, |end| core::ptr::eq(end.as_ptr(), self));
+            if is_self {
+                bindings.remove(&key);
+            }
+        }
+
+        if let Some(peer) = peer.filter(|_| self.is_connection_oriented()) {
+            let mut peer_state = peer.state.lock();
+            peer_state.recv_shutdown = true;
+            peer_state.send_shutdown = true;
+            drop(peer_state);
+            peer.wakeup();
+        }
+
+        if let Some(pending) = pending {
+            for end in pending {
+                end.close();
+            }
+        }
+        drop(recv);
+    }
+}
+
+/// Unix域socket端点的所有者
+///
+/// socket被复制（[`Socket::box_clone`]）时共享同一个所有者，最后一个所有者被释放时关闭端点
+#[derive(Debug)]
+struct UnixEndHandle(Arc<UnixEnd>);
+
+impl Drop for UnixEndHandle {
+    fn drop(&mut self) {
+        self.0.close();
+    }
+}
+
+/// @brief Unix域socket
+///
+/// ref: https://man7.org/linux/man-pages/man7/unix.7.html
+#[derive(Debug, Clone)]
+pub struct UnixSocket {
+    handle: Arc<UnixEndHandle>,
+    metadata: SocketMetadata,
+}
+
+impl UnixSocket {
+    /// @brief 创建一个Unix域socket
+    ///
+    /// @param socket_type socket类型，支持Stream、Datagram和SeqPacket
+    /// @param options socket的选项
+    pub fn new(socket_type: PosixSocketType, options: SocketOptions) -> Result<Self, SystemError> {
+        match socket_type {
+            PosixSocketType::Stream | PosixSocketType::Datagram | PosixSocketType::SeqPacket => {}
+            _ => return Err(SystemError::ESOCKTNOSUPPORT),
+        }
+        return Ok(Self::from_end(UnixEnd::new(socket_type), options));
+    }
+
+    /// @brief 创建一对互相连接的Unix域socket（socketpair）
+    pub fn new_pair(
+        socket_type: PosixSocketType,
+        options: SocketOptions,
+    ) -> Result<(Self, Self), SystemError> {
+        let a = Self::new(socket_type, options)?;
+        let b = Self::new(socket_type, options)?;
+        for (end, peer) in [(a.end(), b.end()), (b.end(), a.end())] {
+            let mut state = end.state.lock();
+            state.peer = Some(Arc::downgrade(peer));
+            state.connected = true;
+        }
+        return Ok((a, b));
+    }
+
+    fn from_end(end: Arc<UnixEnd>, options: SocketOptions) -> Self {
+        let metadata = SocketMetadata::new(
+            SocketType::UnixSocket,
+            UNIX_BUF_SIZE,
+            UNIX_BUF_SIZE,
+            0,
+            options,
+        );
+        return Self {
+            handle: Arc::new(UnixEndHandle(end)),
+            metadata,
+        };
+    }
+
+    #[inline]
+    fn end(&self) -> &Arc<UnixEnd> {
+        return &self.handle.0;
+    }
+}
+
+/// 取出Unix域socket的地址
+fn unix_endpoint(endpoint: Option<Endpoint>) -> Result<Option<UnixEndpoint>, SystemError> {
+    return match endpoint {
+        None => Ok(None),
+        Some(Endpoint::Unix(addr)) => Ok(Some(addr)),
+        Some(_) => Err(SystemError::EINVAL),
+    };
+}
+
+impl Socket for UnixSocket {
+    fn read(&self, buf: &mut [u8]) -> (Result<usize, SystemError>, Endpoint) {
+        // 没有通过recvmsg接收的文件直接关闭
+        let (r, endpoint, _) = self.read_with_rights(buf);
+        return (r, endpoint);
+    }
+
+    fn write(&self, buf: &[u8], to: Option<Endpoint>) -> Result<usize, SystemError> {
+        return self.write_with_rights(buf, to, Vec::new());
+    }
+
+    fn read_with_rights(
+        &self,
+        buf: &mut [u8],
+    ) -> (Result<usize, SystemError>, Endpoint, Vec<File>) {
+        return match self.end().recv(buf) {
+            Ok((n, from, rights)) => (Ok(n), Endpoint::Unix(from), rights),
+            Err(e) => (Err(e), Endpoint::Unix(UnixEndpoint::Unnamed), Vec::new()),
+        };
+    }
+
+    fn write_with_rights(
+        &self,
+        buf: &[u8],
+        to: Option<Endpoint>,
+        rights: Vec<File>,
+    ) -> Result<usize, SystemError> {
+        let to = unix_endpoint(to)?;
+        return self.end().send(buf, to.as_ref(), rights);
+    }
+
+    fn connect(&mut self, endpoint: Endpoint) -> Result<(), SystemError> {
+        let addr = unix_endpoint(Some(endpoint))?.unwrap();
+        return self.end().connect(&addr);
+    }
+
+    fn bind(&mut self, endpoint: Endpoint) -> Result<(), SystemError> {
+        let addr = unix_endpoint(Some(endpoint))?.unwrap();
+        return self.end().bind(addr);
+    }
+
+    fn shutdown(&self, how: ShutdownType) -> Result<(), SystemError> {
+        return self.end().shutdown(how);
+    }
+
+    fn listen(&mut self, backlog: usize) -> Result<(), SystemError> {
+        return self.end().listen(backlog);
+    }
+
+    fn accept(&mut self) -> Result<(Box<dyn Socket>, Endpoint), SystemError> {
+        let end = self.end().accept()?;
+        let remote = end
+            .peer()
+            .map(|peer| peer.addr())
+            .unwrap_or(UnixEndpoint::Unnamed);
+        let socket = Self::from_end(end, self.metadata.options);
+        return Ok((Box::new(socket), Endpoint::Unix(remote)));
+    }
+
+    fn endpoint(&self) -> Option<Endpoint> {
+        return Some(Endpoint::Unix(self.end().addr()));
+    }
+
+    fn peer_endpoint(&self) -> Option<Endpoint> {
+        return self.end().peer().map(|peer| Endpoint::Unix(peer.addr()));
+    }
+
+    fn poll(&self) -> (bool, bool, bool) {
+        return self.end().poll();
+    }
+
+    fn wait_queue(&self) -> Option<Arc<WaitQueue>> {
+        return Some(self.end().wait_queue.clone());
+    }
+
+    fn metadata(&self) -> Result<SocketMetadata, SystemError> {
+        return Ok(self.metadata.clone());
+    }
+
+    fn box_clone(&self) -> Box<dyn Socket> {
+        return Box::new(self.clone());
+    }
+}
@@ -0,0 +1,1041 @@
+//! 性能事件：perf_event_open的一个子集
+//!
+//! 支持的功能：
+//!
+//! - 事件类型：`PERF_TYPE_HARDWARE`（cycles、instructions、cache-references、cache-misses、
+//!   branch-instructions、branch-misses）和`PERF_TYPE_RAW`（事件选择寄存器的事件号和umask）
+//! - 只支持统计整个cpu的事件（pid为-1，cpu为非负数），不支持跟随进程的事件、事件组和继承。
+//!   每个cpu同时打开的事件数不超过PMU的通用计数器数量，不会分时复用计数器
+//! - 计数：read()得到事件发生的次数，read_format支持`TOTAL_TIME_ENABLED`、`TOTAL_TIME_RUNNING`、`ID`
+//! - 采样：每发生sample_period次事件记录一次采样，写入通过mmap与用户程序共享的环形缓冲区
+//!   （第0页是`struct perf_event_mmap_page`，之后是2^n页数据），记录的格式与Linux相同。
+//!   sample_type支持`IP`、`TID`、`TIME`、`CALLCHAIN`、`ID`、`CPU`、`PERIOD`、`IDENTIFIER`。
+//!   指定sample_freq时，按照TSC的频率把它换算成固定的采样周期，不会动态调整
+//!
+//! 计数器溢出时产生NMI，采样在NMI中直接写入环形缓冲区（只使用原子变量，不加锁）。
+//! 唤醒等待数据的读者需要加锁，因此推迟到这个cpu的下一次时钟中断中进行
+
+use core::{
+    mem::size_of,
+    ptr::null_mut,
+    sync::atomic::{AtomicBool, AtomicPtr, AtomicU32, AtomicU64, AtomicUsize, Ordering},
+};
+
+use alloc::{
+    string::String,
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+
+use crate::{
+    arch::{
+        driver::tsc::TSCManager,
+        interrupt::TrapFrame,
+        pmu::{
+            pmu_ack_overflow, pmu_counter_read, pmu_counter_start, pmu_counter_stop,
+            pmu_counter_write, pmu_lvt_unmask, PmuInfo, PMU_MAX_COUNTERS,
+        },
+        CurrentIrqArch, CurrentTimeArch, MMArch,
+    },
+    debug::traceback::{unwind_kernel, unwind_user},
+    exception::InterruptArch,
+    filesystem::vfs::{
+        core::generate_inode_id, file::FileMode, page_cache::PageCache, poll::PollTable,
+        syscall::ModeType, FilePrivateData, FileSystem, FileType, IndexNode, Metadata, PollStatus,
+    },
+    libs::{lazy_init::Lazy, mutex::Mutex, spinlock::SpinLock, wait_queue::WaitQueue},
+    mm::{
+        percpu::PerCpu,
+        syscall::{MapFlags, ProtFlags},
+        ucontext::AddressSpace,
+        MemoryManagementArch, VirtAddr,
+    },
+    process::{workqueue::system_wq, workqueue::Work, ProcessManager},
+    smp::core::smp_get_processor_id,
+    syscall::{
+        user_access::{UserBufferReader, UserBufferWriter},
+        SystemError,
+    },
+    time::{TimeArch, TimeSpec},
+};
+
+pub mod syscall;
+
+const PAGE_SIZE: usize = MMArch::PAGE_SIZE;
+
+pub const PERF_TYPE_HARDWARE: u32 = 0;
+pub const PERF_TYPE_RAW: u32 = 4;
+
+/// 第一版perf_event_attr的大小
+pub const PERF_ATTR_SIZE_VER0: u32 = 64;
+
+/// 调用栈最多记录的地址数（不含上下文标记）
+const PERF_MAX_STACK_DEPTH: usize = 64;
+/// 调用栈中，之后的地址属于内核
+const PERF_CONTEXT_KERNEL: u64 = -128i64 as u64;
+/// 调用栈中，之后的地址属于用户程序
+const PERF_CONTEXT_USER: u64 = -512i64 as u64;
+
+const PERF_RECORD_LOST: u32 = 2;
+const PERF_RECORD_SAMPLE: u32 = 9;
+const PERF_RECORD_MISC_KERNEL: u16 = 1;
+const PERF_RECORD_MISC_USER: u16 = 2;
+
+/// sample_freq的上限
+const PERF_MAX_SAMPLE_FREQ: u64 = 100000;
+
+pub const PERF_EVENT_IOC_ENABLE: u32 = 0x2400;
+pub const PERF_EVENT_IOC_DISABLE: u32 = 0x2401;
+pub const PERF_EVENT_IOC_RESET: u32 = 0x2403;
+pub const PERF_EVENT_IOC_PERIOD: u32 = 0x4008_2404;
+pub const PERF_EVENT_IOC_ID: u32 = 0x8008_2407;
+
+// struct perf_event_mmap_page中各个字段的偏移量
+const MMAP_PAGE_CAPABILITIES: usize = 40;
+const MMAP_PAGE_PMC_WIDTH: usize = 48;
+const MMAP_PAGE_SIZE: usize = 72;
+const MMAP_PAGE_DATA_HEAD: usize = 1024;
+const MMAP_PAGE_DATA_TAIL: usize = 1032;
+const MMAP_PAGE_DATA_OFFSET: usize = 1040;
+const MMAP_PAGE_DATA_SIZE: usize = 1048;
+/// cap_bit0_is_deprecated：用户程序应当使用后面的能力位
+const MMAP_CAP_BIT0_IS_DEPRECATED: u64 = 1 << 1;
+/// perf_event_mmap_page中__reserved之前的部分的大小
+const MMAP_PAGE_USED_SIZE: u32 = 96;
+
+bitflags! {
+    /// perf_event_attr中的标志位
+    pub struct PerfAttrFlags: u64 {
+        const DISABLED = 1 << 0;
+        const INHERIT = 1 << 1;
+        const PINNED = 1 << 2;
+        const EXCLUSIVE = 1 << 3;
+        const EXCLUDE_USER = 1 << 4;
+        const EXCLUDE_KERNEL = 1 << 5;
+        const EXCLUDE_HV = 1 << 6;
+        const EXCLUDE_IDLE = 1 << 7;
+        const MMAP = 1 << 8;
+        const COMM = 1 << 9;
+        const FREQ = 1 << 10;
+        const INHERIT_STAT = 1 << 11;
+        const ENABLE_ON_EXEC = 1 << 12;
+        const TASK = 1 << 13;
+        const WATERMARK = 1 << 14;
+        const PRECISE_IP = 3 << 15;
+        const MMAP_DATA = 1 << 17;
+        const SAMPLE_ID_ALL = 1 << 18;
+        const EXCLUDE_HOST = 1 << 19;
+        const EXCLUDE_GUEST = 1 << 20;
+        const EXCLUDE_CALLCHAIN_KERNEL = 1 << 21;
+        const EXCLUDE_CALLCHAIN_USER = 1 << 22;
+        const MMAP2 = 1 << 23;
+        const COMM_EXEC = 1 << 24;
+        const USE_CLOCKID = 1 << 25;
+        const CONTEXT_SWITCH = 1 << 26;
+        const WRITE_BACKWARD = 1 << 27;
+    }
+
+    pub struct PerfSampleType: u64 {
+        const IP = 1 << 0;
+        const TID = 1 << 1;
+        const TIME = 1 << 2;
+        const ADDR = 1 << 3;
+        const READ = 1 << 4;
+        const CALLCHAIN = 1 << 5;
+        const ID = 1 << 6;
+        const CPU = 1 << 7;
+        const PERIOD = 1 << 8;
+        const STREAM_ID = 1 << 9;
+        const RAW = 1 << 10;
+        const IDENTIFIER = 1 << 16;
+    }
+
+    pub struct PerfReadFormat: u64 {
+        const TOTAL_TIME_ENABLED = 1 << 0;
+        const TOTAL_TIME_RUNNING = 1 << 1;
+        const ID = 1 << 2;
+        const GROUP = 1 << 3;
+        const LOST = 1 << 4;
+    }
+}
+
+impl PerfAttrFlags {
+    /// 被接受、但是对整个cpu的事件没有影响（或者不产生对应的记录）的标志
+    const IGNORED: Self = Self::from_bits_truncate(
+        Self::INHERIT.bits
+            | Self::PINNED.bits
+            | Self::EXCLUSIVE.bits
+            | Self::EXCLUDE_HV.bits
+            | Self::EXCLUDE_IDLE.bits
+            | Self::MMAP.bits
+            | Self::COMM.bits
+            | Self::INHERIT_STAT.bits
+            | Self::ENABLE_ON_EXEC.bits
+            | Self::TASK.bits
+            | Self::MMAP_DATA.bits
+            | Self::EXCLUDE_HOST.bits
+            | Self::EXCLUDE_GUEST.bits
+            | Self::MMAP2.bits
+            | Self::COMM_EXEC.bits,
+    );
+    /// 支持的标志
+    const SUPPORTED: Self = Self::from_bits_truncate(
+        Self::IGNORED.bits
+            | Self::DISABLED.bits
+            | Self::EXCLUDE_USER.bits
+            | Self::EXCLUDE_KERNEL.bits
+            | Self::FREQ.bits
+            | Self::WATERMARK.bits
+            | Self::SAMPLE_ID_ALL.bits
+            | Self::EXCLUDE_CALLCHAIN_KERNEL.bits
+            | Self::EXCLUDE_CALLCHAIN_USER.bits,
+    );
+}
+
+impl PerfSampleType {
+    const SUPPORTED: Self = Self::from_bits_truncate(
+        Self::IP.bits
+            | Self::TID.bits
+            | Self::TIME.bits
+            | Self::CALLCHAIN.bits
+            | Self::ID.bits
+            | Self::CPU.bits
+            | Self::PERIOD.bits
+            | Self::IDENTIFIER.bits,
+    );
+}
+
+/// struct perf_event_attr（PERF_ATTR_SIZE_VER8）
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+pub struct PerfEventAttr {
+    pub type_: u32,
+    pub size: u32,
+    pub config: u64,
+    /// sample_period或者sample_freq（带有FREQ标志时）
+    pub sample_period: u64,
+    pub sample_type: u64,
+    pub read_format: u64,
+    pub flags: u64,
+    /// wakeup_events或者wakeup_watermark（带有WATERMARK标志时）
+    pub wakeup_events: u32,
+    pub bp_type: u32,
+    pub config1: u64,
+    pub config2: u64,
+    pub branch_sample_type: u64,
+    pub sample_regs_user: u64,
+    pub sample_stack_user: u32,
+    pub clockid: i32,
+    pub sample_regs_intr: u64,
+    pub aux_watermark: u32,
+    pub sample_max_stack: u16,
+    pub __reserved_2: u16,
+    pub aux_sample_size: u32,
+    pub __reserved_3: u32,
+    pub sig_data: u64,
+    pub config3: u64,
+}
+
+impl PerfEventAttr {
+    #[inline]
+    fn flags(&self) -> PerfAttrFlags {
+        return PerfAttrFlags::from_bits_truncate(self.flags);
+    }
+
+    #[inline]
+    fn sample_type(&self) -> PerfSampleType {
+        return PerfSampleType::from_bits_truncate(self.sample_type);
+    }
+
+    #[inline]
+    fn read_format(&self) -> PerfReadFormat {
+        return PerfReadFormat::from_bits_truncate(self.read_format);
+    }
+}
+
+/// 每个cpu上占用各个计数器的事件
+///
+/// 只在这个cpu上（关中断时）被修改，NMI和时钟中断只会在同一个cpu上读取，因此不需要锁。
+/// 非空的指针持有事件的一个引用计数（`Arc::into_raw`）
+struct PmuCpu {
+    events: [AtomicPtr<PerfEvent>; PMU_MAX_COUNTERS],
+    /// 正在计数的事件数
+    active: AtomicU32,
+}
+
+static PMU_CPUS: [PmuCpu; PerCpu::MAX_CPU_NUM] = {
+    const NULL: AtomicPtr<PerfEvent> = AtomicPtr::new(null_mut());
+    const CPU: PmuCpu = PmuCpu {
+        events: [NULL; PMU_MAX_COUNTERS],
+        active: AtomicU32::new(0),
+    };
+    [CPU; PerCpu::MAX_CPU_NUM]
+};
+
+/// 所有cpu上正在计数的事件数，为0时时钟中断不需要检查
+static PERF_ACTIVE_EVENTS: AtomicUsize = AtomicUsize::new(0);
+
+/// 事件的ID（PERF_SAMPLE_ID、PERF_EVENT_IOC_ID）
+static PERF_NEXT_ID: AtomicU64 = AtomicU64::new(1);
+
+/// perf使用的时钟（纳秒），由TSC换算得到，可以在NMI中读取
+fn perf_clock() -> u64 {
+    let khz = TSCManager::tsc_khz().max(1);
+    return (CurrentTimeArch::get_cycles() as u128 * 1_000_000 / khz as u128) as u64;
+}
+
+/// 在`cpu`上（关中断）执行`f`，等待它执行完成并返回它的结果
+///
+/// 通过绑定在这个cpu上的工作队列执行，调用者可能会睡眠
+fn perf_call_on<R, F>(cpu: u32, f: F) -> R
+where
+    R: Send + 'static,
+    F: Fn() -> R + Send + Sync + 'static,
+{
+    let call: Arc<PerfCall<R>> = Arc::new(PerfCall {
+        result: SpinLock::new(None),
+        wait_queue: WaitQueue::INIT,
+    });
+    let c = call.clone();
+    let work = Work::new(move || {
+        let r = {
+            let _irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+            debug_assert_eq!(smp_get_processor_id(), cpu);
+            f()
+        };
+        *c.result.lock_irqsave() = Some(r);
+        c.wait_queue.wakeup_all(None);
+    });
+    system_wq().queue_work_on(Some(cpu), &work);
+
+    let mut guard = call.result.lock_irqsave();
+    loop {
+        if let Some(r) = guard.take() {
+            return r;
+        }
+        call.wait_queue.sleep_uninterruptible_unlock_spinlock(guard);
+        guard = call.result.lock_irqsave();
+    }
+}
+
+#[derive(Debug)]
+struct PerfCall<R> {
+    result: SpinLock<Option<R>>,
+    wait_queue: WaitQueue,
+}
+
+/// 与用户程序共享的环形缓冲区
+///
+/// 第0页是控制页，之后的页保存记录。页面保存在一个没有后备存储的页面缓存中，内核通过页面的虚拟地址访问
+#[derive(Debug)]
+struct PerfRing {
+    pages: Vec<VirtAddr>,
+    /// 数据区的大小（2的幂）
+    data_size: usize,
+    /// 内核写入的位置。只有事件所在的cpu会写入（在NMI中），与用户程序看到的data_head相同
+    head: AtomicU64,
+    /// 上一次唤醒读者时的head
+    wakeup_head: AtomicU64,
+    /// 上一次唤醒读者之后写入的采样数
+    wakeup_count: AtomicU32,
+    /// 由于缓冲区已满而丢弃、还没有报告给用户程序的采样数
+    lost: AtomicU64,
+    /// 写入了这么多字节之后唤醒读者
+    watermark: u64,
+    /// 写入了这么多个采样之后唤醒读者（0表示按照`watermark`）
+    wakeup_events: u32,
+}
+
+impl PerfRing {
+    fn new(cache: &PageCache, nr_pages: usize, attr: &PerfEventAttr) -> Result<Self, SystemError> {
+        let mut pages = Vec::with_capacity(nr_pages);
+        for i in 0..nr_pages {
+            pages.push(cache.page_vaddr(i)?);
+        }
+        let data_size = (nr_pages - 1) * PAGE_SIZE;
+        let (watermark, wakeup_events) = if attr.flags().contains(PerfAttrFlags::WATERMARK) {
+            match attr.wakeup_events as usize {
+                0 => (data_size / 2, 0),
+                w => (w.min(data_size), 0),
+            }
+        } else {
+            (data_size / 2, attr.wakeup_events)
+        };
+        let ring = Self {
+            pages,
+            data_size,
+            head: AtomicU64::new(0),
+            wakeup_head: AtomicU64::new(0),
+            wakeup_count: AtomicU32::new(0),
+            lost: AtomicU64::new(0),
+            watermark: watermark as u64,
+            wakeup_events,
+        };
+        unsafe {
+            *ring.ctrl::<u64>(MMAP_PAGE_CAPABILITIES) = MMAP_CAP_BIT0_IS_DEPRECATED;
+            *ring.ctrl::<u32>(MMAP_PAGE_SIZE) = MMAP_PAGE_USED_SIZE;
+            *ring.ctrl::<u64>(MMAP_PAGE_DATA_OFFSET) = PAGE_SIZE as u64;
+            *ring.ctrl::<u64>(MMAP_PAGE_DATA_SIZE) = data_size as u64;
+        }
+        return Ok(ring);
+    }
+
+    /// 控制页中偏移量为`offset`的字段
+    #[inline]
+    fn ctrl<T>(&self, offset: usize) -> *mut T {
+        return (self.pages[0].data() + offset) as *mut T;
+    }
+
+    #[inline]
+    fn data_head(&self) -> &AtomicU64 {
+        return unsafe { &*self.ctrl::<AtomicU64>(MMAP_PAGE_DATA_HEAD) };
+    }
+
+    #[inline]
+    fn data_tail(&self) -> &AtomicU64 {
+        return unsafe { &*self.ctrl::<AtomicU64>(MMAP_PAGE_DATA_TAIL) };
+    }
+
+    /// 缓冲区中是否有用户程序还没有读取的数据
+    fn readable(&self) -> bool {
+        return self.head.load(Ordering::Acquire) != self.data_tail().load(Ordering::Acquire);
+    }
+
+    /// 把`record`写入数据区中`pos`处（可能绕回数据区的开头）
+    fn copy_in(&self, mut pos: usize, record: &[u64]) {
+        let mut src =
+            unsafe { core::slice::from_raw_parts(record.as_ptr() as *const u8, record.len() * 8) };
+        while !src.is_empty() {
+            let off = pos & (self.data_size - 1);
+            let page = self.pages[1 + off / PAGE_SIZE];
+            let in_page = off % PAGE_SIZE;
+            let n = src.len().min(PAGE_SIZE - in_page);
+            unsafe {
+                core::ptr::copy_nonoverlapping(src.as_ptr(), (page.data() + in_page) as *mut u8, n)
+            };
+            src = &src[n..];
+            pos += n;
+        }
+    }
+
+    /// 写入一条记录。缓冲区剩余的空间不够时丢弃它
+    ///
+    /// 只能由事件所在的cpu调用（NMI中，或者计数器停止时）
+    fn output(&self, record: &[u64]) -> bool {
+        let head = self.head.load(Ordering::Relaxed);
+        // 与用户程序更新data_tail之前的读取配对
+        let tail = self.data_tail().load(Ordering::Acquire);
+        let size = (record.len() * 8) as u64;
+        if head.wrapping_sub(tail) + size > self.data_size as u64 {
+            return false;
+        }
+        self.copy_in(head as usize, record);
+        self.head.store(head + size, Ordering::Release);
+        self.data_head().store(head + size, Ordering::Release);
+        return true;
+    }
+
+    /// 写入了一个采样之后调用，返回是否需要唤醒读者
+    fn should_wakeup(&self) -> bool {
+        if self.wakeup_events != 0 {
+            return self.wakeup_count.fetch_add(1, Ordering::Relaxed) + 1 >= self.wakeup_events;
+        }
+        let head = self.head.load(Ordering::Relaxed);
+        return head - self.wakeup_head.load(Ordering::Relaxed) >= self.watermark;
+    }
+
+    fn wakeup_done(&self) {
+        self.wakeup_count.store(0, Ordering::Relaxed);
+        self.wakeup_head
+            .store(self.head.load(Ordering::Relaxed), Ordering::Relaxed);
+    }
+}
+
+/// 一条记录，在栈上构造
+struct PerfRecord {
+    words: [u64; 16 + PERF_MAX_STACK_DEPTH],
+    len: usize,
+}
+
+impl PerfRecord {
+    fn new(type_: u32, misc: u16) -> Self {
+        let mut r = Self {
+            words: [0; 16 + PERF_MAX_STACK_DEPTH],
+            len: 1,
+        };
+        r.words[0] = type_ as u64 | (misc as u64) << 32;
+        return r;
+    }
+
+    #[inline]
+    fn push(&mut self, word: u64) {
+        self.words[self.len] = word;
+        self.len += 1;
+    }
+
+    /// 填写记录头部中的大小，返回整条记录
+    fn finish(&mut self) -> &[u64] {
+        self.words[0] |= ((self.len * 8) as u64) << 48;
+        return &self.words[..self.len];
+    }
+}
+
+#[derive(Debug)]
+struct PerfEventState {
+    /// 正在使用的计数器
+    counter: Option<usize>,
+    /// 事件被打开的总时间（不含正在计数的这一段）
+    time_enabled: u64,
+    /// 正在计数的这一段的开始时间
+    enabled_at: u64,
+}
+
+/// 一个性能事件，对应perf_event_open返回的文件描述符
+#[derive(Debug)]
+pub struct PerfEvent {
+    attr: PerfEventAttr,
+    id: u64,
+    cpu: u32,
+    /// 事件选择寄存器的值（不含使能位和中断位）
+    evtsel: u64,
+    /// 计数器每次溢出之前的事件数。计数时为计数器可以表示的最大值的一半，只用于累计溢出的次数
+    period: AtomicU64,
+    sampling: bool,
+    counter_mask: u64,
+    /// 已经溢出的计数器累计的事件数
+    count: AtomicU64,
+    state: SpinLock<PerfEventState>,
+    /// 环形缓冲区，第一次mmap时创建
+    ring: Lazy<PerfRing>,
+    ring_lock: Mutex<()>,
+    cache: Arc<PageCache>,
+    wait_queue: Arc<WaitQueue>,
+    /// NMI中写入了数据，需要在时钟中断中唤醒读者
+    wakeup_pending: AtomicBool,
+    /// 打开这个事件的文件的数量
+    nopen: AtomicUsize,
+    metadata: Metadata,
+    self_ref: Weak<PerfEvent>,
+}
+
+impl PerfEvent {
+    /// 创建一个在`cpu`上计数的事件。事件处于停止状态，由调用者调用[`PerfEvent::enable`]
+    fn new(
+        attr: PerfEventAttr,
+        cpu: u32,
+        info: &PmuInfo,
+        evtsel: u64,
+    ) -> Result<Arc<Self>, SystemError> {
+        let max_period = 1u64 << (info.counter_width - 1);
+        let flags = attr.flags();
+        let (sampling, period) = if attr.sample_period == 0 {
+            (false, max_period)
+        } else if flags.contains(PerfAttrFlags::FREQ) {
+            if attr.sample_period > PERF_MAX_SAMPLE_FREQ {
+                return Err(SystemError::EINVAL);
+            }
+            // 以TSC的频率近似事件发生的频率
+            let hz = TSCManager::tsc_khz().max(1) * 1000;
+            (true, (hz / attr.sample_period).clamp(1, max_period - 1))
+        } else {
+            (true, attr.sample_period.min(max_period - 1))
+        };
+
+        let metadata = Metadata {
+            dev_id: 0,
+            inode_id: generate_inode_id(),
+            size: 0,
+            blk_size: 0,
+            blocks: 0,
+            atime: TimeSpec::default(),
+            mtime: TimeSpec::default(),
+            ctime: TimeSpec::default(),
+            file_type: FileType::File,
+            mode: ModeType::from_bits_truncate(0o600),
+            nlinks: 1,
+            uid: 0,
+            gid: 0,
+            raw_dev: 0,
+        };
+        let event = Arc::new_cyclic(|self_ref: &Weak<PerfEvent>| {
+            let backend: Weak<dyn IndexNode> = self_ref.clone();
+            Self {
+                attr,
+                id: PERF_NEXT_ID.fetch_add(1, Ordering::Relaxed),
+                cpu,
+                evtsel,
+                period: AtomicU64::new(period),
+                sampling,
+                counter_mask: info.counter_mask(),
+                count: AtomicU64::new(0),
+                state: SpinLock::new(PerfEventState {
+                    counter: None,
+                    time_enabled: 0,
+                    enabled_at: 0,
+                }),
+                ring: Lazy::new(),
+                ring_lock: Mutex::new(()),
+                cache: PageCache::new_memory(backend),
+                wait_queue: Arc::new(WaitQueue::INIT),
+                wakeup_pending: AtomicBool::new(false),
+                nopen: AtomicUsize::new(0),
+                metadata,
+                self_ref: self_ref.clone(),
+            }
+        });
+        return Ok(event);
+    }
+
+    /// 计数器的初值：再发生`period`次事件时溢出
+    #[inline]
+    fn start_value(&self, period: u64) -> u64 {
+        return period.wrapping_neg() & self.counter_mask;
+    }
+
+    /// 开始计数
+    pub fn enable(self: &Arc<Self>) -> Result<(), SystemError> {
+        let event = self.clone();
+        return perf_call_on(self.cpu, move || event.enable_local());
+    }
+
+    /// 停止计数
+    pub fn disable(self: &Arc<Self>) {
+        let event = self.clone();
+        perf_call_on(self.cpu, move || event.disable_local());
+    }
+
+    /// 在事件所在的cpu上调用，中断已经关闭
+    fn enable_local(self: &Arc<Self>) -> Result<(), SystemError> {
+        let mut state = self.state.lock();
+        if state.counter.is_some() {
+            return Ok(());
+        }
+        let slots = &PMU_CPUS[self.cpu as usize];
+        let nr_counters = crate::arch::pmu::pmu_info()
+            .ok_or(SystemError::ENODEV)?
+            .nr_counters;
+        let idx = (0..nr_counters)
+            .find(|i| slots.events[*i].load(Ordering::Relaxed).is_null())
+            .ok_or(SystemError::EBUSY)?;
+
+        slots.events[idx].store(Arc::into_raw(self.clone()) as *mut _, Ordering::Release);
+        slots.active.fetch_add(1, Ordering::Relaxed);
+        PERF_ACTIVE_EVENTS.fetch_add(1, Ordering::Relaxed);
+        state.counter = Some(idx);
+        state.enabled_at = perf_clock();
+
+        pmu_lvt_unmask();
+        let period = self.period.load(Ordering::Relaxed);
+        pmu_counter_start(idx, self.evtsel, self.start_value(period));
+        return Ok(());
+    }
+
+    /// 在事件所在的cpu上调用，中断已经关闭
+    fn disable_local(self: &Arc<Self>) {
+        let mut state = self.state.lock();
+        let idx = match state.counter.take() {
+            Some(idx) => idx,
+            None => return,
+        };
+        let value = pmu_counter_stop(idx);
+        let period = self.period.load(Ordering::Relaxed);
+        let elapsed = value.wrapping_sub(self.start_value(period)) & self.counter_mask;
+        self.count.fetch_add(elapsed, Ordering::Relaxed);
+        state.time_enabled += perf_clock() - state.enabled_at;
+
+        let slots = &PMU_CPUS[self.cpu as usize];
+        let ptr = slots.events[idx].swap(null_mut(), Ordering::AcqRel);
+        slots.active.fetch_sub(1, Ordering::Relaxed);
+        PERF_ACTIVE_EVENTS.fetch_sub(1, Ordering::Relaxed);
+        drop(state);
+        // 调用者持有另一个引用，这里不会释放事件本身
+        drop(unsafe { Arc::from_raw(ptr as *const PerfEvent) });
+    }
+
+    /// 在事件所在的cpu上调用，中断已经关闭：读取事件发生的次数
+    fn read_local(&self) -> u64 {
+        let state = self.state.lock();
+        let mut count = self.count.load(Ordering::Relaxed);
+        if let Some(idx) = state.counter {
+            let period = self.period.load(Ordering::Relaxed);
+            count +=
+                pmu_counter_read(idx).wrapping_sub(self.start_value(period)) & self.counter_mask;
+        }
+        return count;
+    }
+
+    /// 在事件所在的cpu上调用，中断已经关闭：把计数清零
+    fn reset_local(&self) {
+        let state = self.state.lock();
+        self.count.store(0, Ordering::Relaxed);
+        if let Some(idx) = state.counter {
+            let period = self.period.load(Ordering::Relaxed);
+            pmu_counter_write(idx, self.start_value(period));
+        }
+    }
+
+    /// 事件被打开的总时间
+    fn time_enabled(&self) -> u64 {
+        let state = self.state.lock_irqsave();
+        return match state.counter {
+            Some(_) => state.time_enabled + (perf_clock() - state.enabled_at),
+            None => state.time_enabled,
+        };
+    }
+
+    /// 计数器溢出（NMI中调用）
+    fn overflow(&self, idx: usize, regs: &TrapFrame) {
+        let period = self.period.load(Ordering::Relaxed);
+        pmu_counter_write(idx, self.start_value(period));
+        self.count.fetch_add(period, Ordering::Relaxed);
+        if self.sampling {
+            self.sample(regs, period);
+        }
+    }
+
+    /// 记录一次采样（NMI中调用）
+    fn sample(&self, regs: &TrapFrame, period: u64) {
+        let ring = match self.ring.try_get() {
+            Some(ring) => ring,
+            None => return,
+        };
+        let sample_type = self.attr.sample_type();
+        let misc = if regs.from_user() {
+            PERF_RECORD_MISC_USER
+        } else {
+            PERF_RECORD_MISC_KERNEL
+        };
+        let mut record = PerfRecord::new(PERF_RECORD_SAMPLE, misc);
+        if sample_type.contains(PerfSampleType::IDENTIFIER) {
+            record.push(self.id);
+        }
+        if sample_type.contains(PerfSampleType::IP) {
+            record.push(regs.rip);
+        }
+        if sample_type.contains(PerfSampleType::TID) {
+            record.push(Self::current_tid());
+        }
+        if sample_type.contains(PerfSampleType::TIME) {
+            record.push(perf_clock());
+        }
+        if sample_type.contains(PerfSampleType::ID) {
+            record.push(self.id);
+        }
+        if sample_type.contains(PerfSampleType::CPU) {
+            record.push(self.cpu as u64);
+        }
+        if sample_type.contains(PerfSampleType::PERIOD) {
+            record.push(period);
+        }
+        if sample_type.contains(PerfSampleType::CALLCHAIN) {
+            self.callchain(regs, &mut record);
+        }
+
+        // 先报告之前丢弃的采样
+        let lost = ring.lost.load(Ordering::Relaxed);
+        if lost != 0 {
+            let mut lost_record = PerfRecord::new(PERF_RECORD_LOST, 0);
+            lost_record.push(self.id);
+            lost_record.push(lost);
+            self.push_sample_id(&mut lost_record);
+            if !ring.output(lost_record.finish()) {
+                ring.lost.fetch_add(1, Ordering::Relaxed);
+                return;
+            }
+            ring.lost.store(0, Ordering::Relaxed);
+        }
+        if !ring.output(record.finish()) {
+            ring.lost.fetch_add(1, Ordering::Relaxed);
+            return;
+        }
+        if ring.should_wakeup() {
+            self.wakeup_pending.store(true, Ordering::Release);
+        }
+    }
+
+    /// 采样时的pid和tid（struct { u32 pid; u32 tid; }）
+    fn current_tid() -> u64 {
+        if !ProcessManager::initialized() {
+            return 0;
+        }
+        let pcb = ProcessManager::current_pcb();
+        return pcb.tgid().data() as u64 | (pcb.pid().data() as u64) << 32;
+    }
+
+    /// 带有SAMPLE_ID_ALL标志时，其他记录的末尾也需要附加采样的标识字段
+    fn push_sample_id(&self, record: &mut PerfRecord) {
+        if !self.attr.flags().contains(PerfAttrFlags::SAMPLE_ID_ALL) {
+            return;
+        }
+        let sample_type = self.attr.sample_type();
+        if sample_type.contains(PerfSampleType::TID) {
+            record.push(Self::current_tid());
+        }
+        if sample_type.contains(PerfSampleType::TIME) {
+            record.push(perf_clock());
+        }
+        if sample_type.contains(PerfSampleType::ID) {
+            record.push(self.id);
+        }
+        if sample_type.contains(PerfSampleType::CPU) {
+            record.push(self.cpu as u64);
+        }
+        if sample_type.contains(PerfSampleType::IDENTIFIER) {
+            record.push(self.id);
+        }
+    }
+
+    /// 写入调用栈：地址的数量，之后是内核和用户程序的调用栈（各自以上下文标记开头）
+    fn callchain(&self, regs: &TrapFrame, record: &mut PerfRecord) {
+        let flags = self.attr.flags();
+        let max = match self.attr.sample_max_stack as usize {
+            0 => PERF_MAX_STACK_DEPTH,
+            n => n.min(PERF_MAX_STACK_DEPTH),
+        };
+        let nr_pos = record.len;
+        record.push(0);
+        let mut ips = [0u64; PERF_MAX_STACK_DEPTH];
+        let mut total = 0;
+        if !flags.contains(PerfAttrFlags::EXCLUDE_CALLCHAIN_KERNEL) {
+            let n = unwind_kernel(regs, &mut ips[..max]);
+            if n > 0 {
+                record.push(PERF_CONTEXT_KERNEL);
+                ips[..n].iter().for_each(|ip| record.push(*ip));
+                total += n;
+            }
+        }
+        if !flags.contains(PerfAttrFlags::EXCLUDE_CALLCHAIN_USER) && total < max {
+            let n = unwind_user(regs, &mut ips[..max - total]);
+            if n > 0 {
+                record.push(PERF_CONTEXT_USER);
+                ips[..n].iter().for_each(|ip| record.push(*ip));
+            }
+        }
+        record.words[nr_pos] = (record.len - nr_pos - 1) as u64;
+    }
+
+    /// 时钟中断中调用：唤醒等待数据的读者
+    fn wakeup_if_pending(&self) {
+        if self.wakeup_pending.swap(false, Ordering::Acquire) {
+            if let Some(ring) = self.ring.try_get() {
+                ring.wakeup_done();
+            }
+            self.wait_queue.wakeup_all(None);
+        }
+    }
+
+    /// 创建（第一次映射时）或者获取有`nr_pages`页（包括控制页）的环形缓冲区
+    fn ring_init(&self, nr_pages: usize) -> Result<&PerfRing, SystemError> {
+        let _guard = self.ring_lock.lock();
+        if let Some(ring) = self.ring.try_get() {
+            if ring.pages.len() != nr_pages {
+                return Err(SystemError::EINVAL);
+            }
+            return Ok(ring);
+        }
+        let ring = PerfRing::new(&self.cache, nr_pages, &self.attr)?;
+        unsafe { *ring.ctrl::<u16>(MMAP_PAGE_PMC_WIDTH) = self.counter_mask.count_ones() as u16 };
+        self.ring.init(ring);
+        return Ok(self.ring.get());
+    }
+
+    fn ioctl_id(&self, data: usize) -> Result<usize, SystemError> {
+        let mut writer = UserBufferWriter::new(data as *mut u64, size_of::<u64>(), true)?;
+        writer.copy_one_to_user(&self.id, 0)?;
+        return Ok(0);
+    }
+}
+
+impl IndexNode for PerfEvent {
+    fn open(&self, _data: &mut FilePrivateData, _mode: &FileMode) -> Result<(), SystemError> {
+        self.nopen.fetch_add(1, Ordering::SeqCst);
+        return Ok(());
+    }
+
+    /// 最后一个文件被关闭时，停止计数并释放计数器
+    fn close(&self, _data: &mut FilePrivateData) -> Result<(), SystemError> {
+        if self.nopen.fetch_sub(1, Ordering::SeqCst) != 1 {
+            return Ok(());
+        }
+        if let Some(event) = self.self_ref.upgrade() {
+            event.disable();
+        }
+        return Ok(());
+    }
+
+    /// 读取事件发生的次数（struct read_format）
+    fn read_at(
+        &self,
+        _offset: usize,
+        len: usize,
+        buf: &mut [u8],
+        _data: &mut FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        let format = self.attr.read_format();
+        let mut values: Vec<u64> = Vec::with_capacity(4);
+        let event = self.self_ref.upgrade().ok_or(SystemError::EBADF)?;
+        let count = perf_call_on(self.cpu, move || event.read_local());
+        values.push(count);
+        let time = self.time_enabled();
+        if format.contains(PerfReadFormat::TOTAL_TIME_ENABLED) {
+            values.push(time);
+        }
+        // 计数器不会被分时复用，运行的时间就是打开的时间
+        if format.contains(PerfReadFormat::TOTAL_TIME_RUNNING) {
+            values.push(time);
+        }
+        if format.contains(PerfReadFormat::ID) {
+            values.push(self.id);
+        }
+
+        let size = values.len() * size_of::<u64>();
+        if len < size || buf.len() < size {
+            return Err(SystemError::ENOSPC);
+        }
+        for (i, v) in values.iter().enumerate() {
+            buf[i * 8..(i + 1) * 8].copy_from_slice(&v.to_ne_bytes());
+        }
+        return Ok(size);
+    }
+
+    fn write_at(
+        &self,
+        _offset: usize,
+        _len: usize,
+        _buf: &[u8],
+        _data: &mut FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        return Err(SystemError::EINVAL);
+    }
+
+    fn ioctl(&self, cmd: u32, data: usize) -> Result<usize, SystemError> {
+        let event = self.self_ref.upgrade().ok_or(SystemError::EBADF)?;
+        match cmd {
+            PERF_EVENT_IOC_ENABLE => event.enable()?,
+            PERF_EVENT_IOC_DISABLE => event.disable(),
+            PERF_EVENT_IOC_RESET => perf_call_on(self.cpu, move || event.reset_local()),
+            PERF_EVENT_IOC_PERIOD => {
+                if !self.sampling {
+                    return Err(SystemError::EINVAL);
+                }
+                let reader = UserBufferReader::new(data as *const u64, size_of::<u64>(), true)?;
+                let period = *reader.read_one_from_user::<u64>(0)?;
+                if period == 0 || self.attr.flags().contains(PerfAttrFlags::FREQ) {
+                    return Err(SystemError::EINVAL);
+                }
+                let max_period = (self.counter_mask >> 1) + 1;
+                // 新的周期从下一次溢出开始生效
+                self.period
+                    .store(period.min(max_period - 1), Ordering::Relaxed);
+            }
+            PERF_EVENT_IOC_ID => return self.ioctl_id(data),
+            _ => return Err(SystemError::ENOTTY),
+        }
+        return Ok(0);
+    }
+
+    /// 缓冲区中有还没有读取的数据时可读
+    fn poll(&self) -> Result<PollStatus, SystemError> {
+        if let Some(ring) = self.ring.try_get() {
+            if ring.readable() {
+                return Ok(PollStatus::READ);
+            }
+        }
+        return Ok(PollStatus::empty());
+    }
+
+    fn poll_wait(&self, table: &mut PollTable) {
+        table.wait(&self.wait_queue);
+    }
+
+    /// 映射环形缓冲区：长度为1页控制页加上2^n页数据，偏移量为0
+    fn mmap(
+        &self,
+        start_vaddr: VirtAddr,
+        len: usize,
+        prot_flags: ProtFlags,
+        map_flags: MapFlags,
+        offset: usize,
+    ) -> Result<usize, SystemError> {
+        if !self.sampling
+            || !map_flags.contains(MapFlags::MAP_SHARED)
+            || !prot_flags.contains(ProtFlags::PROT_WRITE)
+            || offset != 0
+            || len % PAGE_SIZE != 0
+        {
+            return Err(SystemError::EINVAL);
+        }
+        let nr_pages = len / PAGE_SIZE;
+        if nr_pages < 2 || !(nr_pages - 1).is_power_of_two() {
+            return Err(SystemError::EINVAL);
+        }
+        self.ring_init(nr_pages)?;
+        let start_page = AddressSpace::current()?.write().map_file(
+            start_vaddr,
+            len,
+            prot_flags,
+            map_flags,
+            self.cache.clone(),
+            0,
+            true,
+            true,
+        )?;
+        return Ok(start_page.virt_address().data());
+    }
+
+    fn metadata(&self) -> Result<Metadata, SystemError> {
+        return Ok(self.metadata.clone());
+    }
+
+    fn as_any_ref(&self) -> &dyn core::any::Any {
+        self
+    }
+
+    fn fs(&self) -> Arc<dyn FileSystem> {
+        todo!("perf events are not in any filesystem")
+    }
+
+    fn list(&self) -> Result<Vec<String>, SystemError> {
+        return Err(SystemError::ENOTDIR);
+    }
+}
+
+/// 处理PMU产生的NMI（由do_nmi调用）
+///
+/// ## 返回值
+///
+/// 当前cpu上有事件正在计数时返回true，表示NMI已经被处理
+#[no_mangle]
+unsafe extern "C" fn rs_perf_nmi(regs: *const TrapFrame) -> bool {
+    let cpu = smp_get_processor_id() as usize;
+    let slots = &PMU_CPUS[cpu];
+    if slots.active.load(Ordering::Relaxed) == 0 {
+        return false;
+    }
+    let regs = &*regs;
+    let mut status = pmu_ack_overflow();
+    while status != 0 {
+        let idx = status.trailing_zeros() as usize;
+        status &= status - 1;
+        let ptr = slots.events[idx].load(Ordering::Acquire);
+        if !ptr.is_null() {
+            (*ptr).overflow(idx, regs);
+        }
+    }
+    pmu_lvt_unmask();
+    return true;
+}
+
+/// 时钟中断中调用：唤醒当前cpu上在NMI中写入了数据的事件的读者
+pub fn perf_tick() {
+    if PERF_ACTIVE_EVENTS.load(Ordering::Relaxed) == 0 {
+        return;
+    }
+    let slots = &PMU_CPUS[smp_get_processor_id() as usize];
+    for slot in slots.events.iter() {
+        let ptr = slot.load(Ordering::Acquire);
+        if !ptr.is_null() {
+            unsafe { (*ptr).wakeup_if_pending() };
+        }
+    }
+}
@@ -0,0 +1,136 @@
+use core::mem::size_of;
+
+use crate::{
+    arch::{
+        pmu::{pmu_hw_event, pmu_info, EVTSEL_OS, EVTSEL_RAW_MASK, EVTSEL_USR},
+        MMArch,
+    },
+    filesystem::vfs::file::{File, FileMode},
+    include::bindings::bindings::smp_get_total_cpu,
+    mm::MemoryManagementArch,
+    process::ProcessManager,
+    syscall::{user_access::UserBufferReader, Syscall, SystemError},
+};
+
+use super::{
+    PerfAttrFlags, PerfEvent, PerfEventAttr, PerfReadFormat, PerfSampleType, PERF_ATTR_SIZE_VER0,
+    PERF_TYPE_HARDWARE, PERF_TYPE_RAW,
+};
+
+bitflags! {
+    pub struct PerfEventOpenFlags: usize {
+        const PERF_FLAG_FD_NO_GROUP = 1 << 0;
+        const PERF_FLAG_FD_OUTPUT = 1 << 1;
+        const PERF_FLAG_PID_CGROUP = 1 << 2;
+        const PERF_FLAG_FD_CLOEXEC = 1 << 3;
+    }
+}
+
+/// 从用户空间读取perf_event_attr
+///
+/// 用户程序的结构体比内核的短时，缺少的字段为0；比内核的长时，多出来的部分必须全为0，否则返回E2BIG
+fn read_perf_event_attr(uattr: *const PerfEventAttr) -> Result<PerfEventAttr, SystemError> {
+    let reader = UserBufferReader::new(uattr as *const u8, 8, true)?;
+    let size = match *reader.read_one_from_user::<u32>(4)? {
+        0 => PERF_ATTR_SIZE_VER0,
+        size => size,
+    } as usize;
+    if size < PERF_ATTR_SIZE_VER0 as usize || size > MMArch::PAGE_SIZE {
+        return Err(SystemError::E2BIG);
+    }
+
+    let reader = UserBufferReader::new(uattr as *const u8, size, true)?;
+    let bytes = reader.read_from_user::<u8>(0)?;
+    let known = size.min(size_of::<PerfEventAttr>());
+    if bytes[known..].iter().any(|b| *b != 0) {
+        return Err(SystemError::E2BIG);
+    }
+    let mut attr = PerfEventAttr::default();
+    unsafe {
+        core::ptr::copy_nonoverlapping(
+            bytes.as_ptr(),
+            &mut attr as *mut PerfEventAttr as *mut u8,
+            known,
+        )
+    };
+    attr.size = size as u32;
+    return Ok(attr);
+}
+
+impl Syscall {
+    /// 打开一个性能事件，返回它的文件描述符
+    ///
+    /// 只支持统计整个cpu的事件：`pid`必须为-1，`cpu`必须是一个存在的cpu，`group_fd`必须为-1
+    pub fn perf_event_open(
+        uattr: *const PerfEventAttr,
+        pid: i32,
+        cpu: i32,
+        group_fd: i32,
+        flags: usize,
+    ) -> Result<usize, SystemError> {
+        let flags = PerfEventOpenFlags::from_bits(flags).ok_or(SystemError::EINVAL)?;
+        if !(PerfEventOpenFlags::PERF_FLAG_FD_NO_GROUP | PerfEventOpenFlags::PERF_FLAG_FD_CLOEXEC)
+            .contains(flags)
+        {
+            return Err(SystemError::EINVAL);
+        }
+        let attr = read_perf_event_attr(uattr)?;
+
+        let attr_flags = PerfAttrFlags::from_bits(attr.flags).ok_or(SystemError::EINVAL)?;
+        if attr_flags.intersects(PerfAttrFlags::PRECISE_IP) {
+            return Err(SystemError::EOPNOTSUPP_OR_ENOTSUP);
+        }
+        if !PerfAttrFlags::SUPPORTED.contains(attr_flags) {
+            return Err(SystemError::EINVAL);
+        }
+        let sample_type = PerfSampleType::from_bits(attr.sample_type).ok_or(SystemError::EINVAL)?;
+        if !PerfSampleType::SUPPORTED.contains(sample_type) {
+            return Err(SystemError::EINVAL);
+        }
+        let read_format = PerfReadFormat::from_bits(attr.read_format).ok_or(SystemError::EINVAL)?;
+        if read_format.intersects(PerfReadFormat::GROUP | PerfReadFormat::LOST) {
+            return Err(SystemError::EINVAL);
+        }
+
+        // 不支持跟随进程的事件和事件组
+        if pid != -1 || cpu < 0 || group_fd != -1 {
+            return Err(SystemError::EINVAL);
+        }
+        if cpu as u32 >= unsafe { smp_get_total_cpu() } {
+            return Err(SystemError::ENODEV);
+        }
+
+        let info = pmu_info().ok_or(SystemError::ENODEV)?;
+        let mut evtsel = match attr.type_ {
+            PERF_TYPE_HARDWARE => pmu_hw_event(&info, attr.config).ok_or(SystemError::ENOENT)?,
+            PERF_TYPE_RAW => {
+                if attr.config & !EVTSEL_RAW_MASK != 0 {
+                    return Err(SystemError::EINVAL);
+                }
+                attr.config
+            }
+            _ => return Err(SystemError::ENOENT),
+        };
+        if !attr_flags.contains(PerfAttrFlags::EXCLUDE_USER) {
+            evtsel |= EVTSEL_USR;
+        }
+        if !attr_flags.contains(PerfAttrFlags::EXCLUDE_KERNEL) {
+            evtsel |= EVTSEL_OS;
+        }
+
+        let event = PerfEvent::new(attr, cpu as u32, &info, evtsel)?;
+        // 先创建文件，启动失败时由文件的关闭释放计数器
+        let mut file = File::new(event.clone(), FileMode::O_RDWR)?;
+        if !attr_flags.contains(PerfAttrFlags::DISABLED) {
+            event.enable()?;
+        }
+        if flags.contains(PerfEventOpenFlags::PERF_FLAG_FD_CLOEXEC) {
+            file.set_close_on_exec(true);
+        }
+        let fd = ProcessManager::current_pcb()
+            .fd_table()
+            .write()
+            .alloc_fd(file, None)?;
+        return Ok(fd as usize);
+    }
+}
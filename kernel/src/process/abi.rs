@@ -49,6 +49,8 @@ pub enum AtType {
     ExecFn,
     /// Minimal stack size for signal delivery.
     MinSigStackSize,
+    /// Address of the vDSO image.
+    SysInfoEhdr = 33,
 }
 
 impl TryFrom<u32> for AtType {
@@ -79,6 +81,7 @@ impl TryFrom<u32> for AtType {
             25 => Ok(AtType::Random),
             26 => Ok(AtType::HwCap2),
             31 => Ok(AtType::ExecFn),
+            33 => Ok(AtType::SysInfoEhdr),
             51 => Ok(AtType::MinSigStackSize),
             _ => Err("Invalid value for AtType"),
         }
@@ -98,3 +101,8 @@ bitflags! {
         const WCLONE = 0x80000000;
     }
 }
+
+/// prctl的选项：设置当前线程的定时器松弛量（单位：纳秒），为0时恢复默认值
+pub const PR_SET_TIMERSLACK: usize = 29;
+/// prctl的选项：获取当前线程的定时器松弛量（单位：纳秒）
+pub const PR_GET_TIMERSLACK: usize = 30;
@@ -39,7 +39,7 @@ pub extern "C" fn rs_current_pcb_preempt_count() -> u32 {
     if unsafe { !__PROCESS_MANAGEMENT_INIT_DONE } {
         return 0;
     }
-    return ProcessManager::current_pcb().preempt_count() as u32;
+    return ProcessManager::current().preempt_count() as u32;
 }
 
 #[no_mangle]
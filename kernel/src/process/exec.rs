@@ -6,7 +6,7 @@ use crate::{
     driver::base::block::SeekFrom,
     filesystem::vfs::{
         file::{File, FileMode},
-        ROOT_INODE,
+        FileType, ROOT_INODE,
     },
     libs::elf::ELF_LOADER,
     mm::{
@@ -157,32 +157,45 @@ impl<'a> ExecParam<'a> {
     }
 }
 
-/// ## 加载二进制文件
-pub fn load_binary_file(param: &mut ExecParam) -> Result<BinaryLoaderResult, SystemError> {
+/// 打开二进制文件，读取文件头部，找到支持它的格式的加载器
+fn probe_binary_file(
+    param: &mut ExecParam,
+    head_buf: &mut [u8; 512],
+) -> Result<&'static dyn BinaryLoader, SystemError> {
     let inode = ROOT_INODE().lookup(param.file_path)?;
+    if inode.metadata()?.file_type != FileType::File {
+        return Err(SystemError::EACCES);
+    }
 
     // 读取文件头部，用于判断文件类型
     let file = File::new(inode, FileMode::O_RDONLY)?;
     param.file = Some(file);
-    let mut head_buf = [0u8; 512];
     param.file_mut().lseek(SeekFrom::SeekSet(0))?;
-    let _bytes = param.file_mut().read(512, &mut head_buf)?;
+    let _bytes = param.file_mut().read(512, head_buf)?;
     // kdebug!("load_binary_file: read {} bytes", _bytes);
 
-    let mut loader = None;
     for bl in BINARY_LOADERS.iter() {
-        let probe_result = bl.probe(param, &head_buf);
-        if probe_result.is_ok() {
-            loader = Some(bl);
-            break;
+        if bl.probe(param, head_buf).is_ok() {
+            return Ok(*bl);
         }
     }
-    // kdebug!("load_binary_file: loader: {:?}", loader);
-    if loader.is_none() {
-        return Err(SystemError::ENOEXEC);
-    }
+    return Err(SystemError::ENOEXEC);
+}
 
-    let loader: &&dyn BinaryLoader = loader.unwrap();
+/// 检查文件能否被exec：文件存在、是普通文件，并且有加载器支持它的格式
+///
+/// 用于在创建新进程之前就报告错误（例如posix_spawn），`vm`只用于探测，不会被修改
+pub fn check_binary_file(path: &str, vm: Arc<AddressSpace>) -> Result<(), SystemError> {
+    let mut param = ExecParam::new(path, vm, ExecParamFlags::EXEC);
+    probe_binary_file(&mut param, &mut [0u8; 512])?;
+    return Ok(());
+}
+
+/// ## 加载二进制文件
+pub fn load_binary_file(param: &mut ExecParam) -> Result<BinaryLoaderResult, SystemError> {
+    let mut head_buf = [0u8; 512];
+    let loader = probe_binary_file(param, &mut head_buf)?;
+    // kdebug!("load_binary_file: loader: {:?}", loader);
     assert!(param.vm().is_current());
     // kdebug!("load_binary_file: to load with param: {:?}", param);
 
@@ -0,0 +1,503 @@
+//! 内核中的异步任务执行器
+//!
+//! 驱动、文件系统中由多个步骤组成的操作（提交命令后等待中断、补充virtio队列、DHCP的重试等）
+//! 可以写成`async`函数，交给执行器运行：任务在等待时不占用内核线程，因此大量同时进行的操作
+//! 不需要每个操作一个线程，也不需要在循环中忙等。
+//!
+//! - 每个cpu有一个执行器线程（`kasync/N`），只运行被放到这个cpu上的任务，同一个任务不会被并发地poll
+//! - 任务被唤醒时放回它所在的cpu的运行队列。唤醒可以来自中断上下文
+//! - 叶子future把已有的等待机制转换为`Waker`的唤醒：[`wait_event`]等待[`WaitQueue`]上的条件
+//!   （中断处理函数唤醒等待队列即可唤醒任务），[`sleep_ms`]等待定时器，
+//!   [`crate::sched::completion::Completion::wait_async`]等待completion
+//!
+//! 任务的poll在执行器线程中以可抢占的方式执行，但是不应该睡眠（例如等待互斥锁、同步地等待IO），
+//! 否则同一个cpu上的其他任务都要等它。非异步的代码可以用[`block_on`]同步地运行一个future，
+//! 或者用[`JoinHandle::join`]等待一个任务的结果。
+
+use core::{
+    future::Future,
+    pin::Pin,
+    sync::atomic::{AtomicBool, AtomicUsize, Ordering},
+    task::{Context, Poll, Waker},
+};
+
+use alloc::{boxed::Box, collections::VecDeque, sync::Arc, task::Wake, vec::Vec};
+
+use crate::{
+    arch::{sched::sched, CurrentIrqArch},
+    exception::InterruptArch,
+    include::bindings::bindings::smp_get_total_cpu,
+    kinfo,
+    libs::{
+        spinlock::SpinLock,
+        wait_queue::{WaitQueue, WaitQueueCallback, WAIT_KEY_ANY},
+    },
+    mm::percpu::PerCpu,
+    sched::core::cond_resched,
+    smp::{core::smp_get_processor_id, cpu::CPU_MASK_WORDS},
+    syscall::SystemError,
+    time::timer::{next_n_ms_timer_jiffies, Timer, TimerFunction},
+};
+
+use super::{
+    kthread::{KernelThreadClosure, KernelThreadMechanism},
+    ProcessControlBlock, ProcessManager,
+};
+
+lazy_static! {
+    /// 每个cpu的执行器
+    static ref EXECUTORS: Vec<Executor> = {
+        let mut executors = Vec::with_capacity(PerCpu::MAX_CPU_NUM);
+        for _ in 0..PerCpu::MAX_CPU_NUM {
+            executors.push(Executor::new());
+        }
+        executors
+    };
+}
+
+type BoxFuture = Pin<Box<dyn Future<Output = ()> + Send>>;
+
+/// 一个异步任务
+struct Task {
+    /// 任务的future，正在被poll或者已经完成时为None
+    future: SpinLock<Option<BoxFuture>>,
+    /// 任务所在的cpu
+    cpu: usize,
+    /// 是否已经在运行队列中
+    queued: AtomicBool,
+}
+
+impl Task {
+    /// 把任务放入运行队列（已经在队列中时不做任何事情）
+    fn schedule(self: &Arc<Self>) {
+        if self.queued.swap(true, Ordering::AcqRel) {
+            return;
+        }
+        EXECUTORS[self.cpu].push(self.clone());
+    }
+}
+
+impl Wake for Task {
+    fn wake(self: Arc<Self>) {
+        self.schedule();
+    }
+
+    fn wake_by_ref(self: &Arc<Self>) {
+        self.schedule();
+    }
+}
+
+/// 一个cpu的执行器
+struct Executor {
+    runqueue: SpinLock<VecDeque<Arc<Task>>>,
+    /// 执行器线程在运行队列为空时在这里等待
+    idle_wait: WaitQueue,
+    /// 还没有完成的任务的数量
+    nr_tasks: AtomicUsize,
+}
+
+impl Executor {
+    fn new() -> Self {
+        return Self {
+            runqueue: SpinLock::new(VecDeque::new()),
+            idle_wait: WaitQueue::INIT,
+            nr_tasks: AtomicUsize::new(0),
+        };
+    }
+
+    /// 可以在中断上下文中调用
+    fn push(&self, task: Arc<Task>) {
+        self.runqueue.lock_irqsave().push_back(task);
+        self.idle_wait.wakeup(None);
+    }
+
+    /// 运行一个任务，直到它完成或者需要等待
+    fn run_task(&self, task: Arc<Task>) {
+        // 先清除queued，poll的过程中被唤醒时会再次放入队列
+        task.queued.store(false, Ordering::Release);
+        let future = task.future.lock_irqsave().take();
+        let mut future = match future {
+            Some(f) => f,
+            None => return,
+        };
+
+        let waker = Waker::from(task.clone());
+        let mut cx = Context::from_waker(&waker);
+        match future.as_mut().poll(&mut cx) {
+            Poll::Ready(()) => {
+                self.nr_tasks.fetch_sub(1, Ordering::Relaxed);
+            }
+            Poll::Pending => {
+                *task.future.lock_irqsave() = Some(future);
+            }
+        }
+    }
+}
+
+/// 执行器线程的主循环
+fn executor_thread(cpu: usize) -> i32 {
+    let executor = &EXECUTORS[cpu];
+    loop {
+        let mut runqueue = executor.runqueue.lock_irqsave();
+        let task = match runqueue.pop_front() {
+            Some(task) => task,
+            None => {
+                executor
+                    .idle_wait
+                    .sleep_uninterruptible_unlock_spinlock(runqueue);
+                continue;
+            }
+        };
+        drop(runqueue);
+
+        executor.run_task(task);
+        cond_resched();
+    }
+}
+
+/// 在当前cpu上运行一个异步任务
+pub fn spawn<F>(future: F) -> JoinHandle<F::Output>
+where
+    F: Future + Send + 'static,
+    F::Output: Send + 'static,
+{
+    return spawn_on(smp_get_processor_id() as usize, future);
+}
+
+/// 在指定的cpu上运行一个异步任务
+///
+/// 任务总是在这个cpu上被poll，例如可以放在设备的中断被分发到的cpu上
+pub fn spawn_on<F>(cpu: usize, future: F) -> JoinHandle<F::Output>
+where
+    F: Future + Send + 'static,
+    F::Output: Send + 'static,
+{
+    let state = Arc::new(JoinState {
+        result: SpinLock::new(None),
+        wait: WaitQueue::INIT,
+    });
+    let task_state = state.clone();
+    let task = Arc::new(Task {
+        future: SpinLock::new(Some(Box::pin(async move {
+            let output = future.await;
+            *task_state.result.lock_irqsave() = Some(output);
+            task_state.wait.wakeup_all(None);
+        }))),
+        cpu,
+        queued: AtomicBool::new(false),
+    });
+    EXECUTORS[cpu].nr_tasks.fetch_add(1, Ordering::Relaxed);
+    task.schedule();
+    return JoinHandle { state, waker: None };
+}
+
+#[derive(Debug)]
+struct JoinState<T> {
+    result: SpinLock<Option<T>>,
+    wait: WaitQueue,
+}
+
+/// 异步任务的结果
+///
+/// 可以在异步任务中`.await`，也可以在普通的内核线程中用[`JoinHandle::join`]等待。
+/// 丢弃JoinHandle不会取消任务
+#[derive(Debug)]
+pub struct JoinHandle<T> {
+    state: Arc<JoinState<T>>,
+    waker: Option<Arc<WaitQueueWaker>>,
+}
+
+impl<T> JoinHandle<T> {
+    /// 任务是否已经完成
+    pub fn is_finished(&self) -> bool {
+        return self.state.result.lock_irqsave().is_some();
+    }
+
+    /// 睡眠，直到任务完成，返回它的结果
+    pub fn join(self) -> T {
+        loop {
+            let mut result = self.state.result.lock_irqsave();
+            if let Some(r) = result.take() {
+                return r;
+            }
+            self.state
+                .wait
+                .sleep_uninterruptible_unlock_spinlock(result);
+        }
+    }
+}
+
+impl<T> Future for JoinHandle<T> {
+    type Output = T;
+
+    fn poll(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<T> {
+        let this = self.get_mut();
+        if let Some(r) = this.state.result.lock_irqsave().take() {
+            return Poll::Ready(r);
+        }
+        WaitQueueWaker::arm(&mut this.waker, &this.state.wait, WAIT_KEY_ANY, cx.waker());
+        // 注册之后再检查一次，避免错过在第一次检查之后发生的唤醒
+        if let Some(r) = this.state.result.lock_irqsave().take() {
+            return Poll::Ready(r);
+        }
+        return Poll::Pending;
+    }
+}
+
+impl<T> Drop for JoinHandle<T> {
+    fn drop(&mut self) {
+        WaitQueueWaker::disarm(&mut self.waker, &self.state.wait);
+    }
+}
+
+/// 把等待队列的唤醒转换为`Waker`的唤醒
+///
+/// 作为回调注册在等待队列上，等待队列被唤醒时（可能在中断上下文中）唤醒最近一次poll时的Waker
+#[derive(Debug)]
+pub struct WaitQueueWaker {
+    waker: SpinLock<Option<Waker>>,
+}
+
+impl WaitQueueCallback for WaitQueueWaker {
+    fn wake(&self, _key: u64) {
+        let waker = self.waker.lock_irqsave().take();
+        if let Some(waker) = waker {
+            waker.wake();
+        }
+    }
+}
+
+impl WaitQueueWaker {
+    /// 在等待队列上注册（或者更新）`waker`
+    ///
+    /// `slot`保存注册的回调，第一次调用时创建，之后只更新其中的Waker
+    pub fn arm(slot: &mut Option<Arc<Self>>, wq: &WaitQueue, key: u64, waker: &Waker) {
+        match slot {
+            Some(cb) => {
+                *cb.waker.lock_irqsave() = Some(waker.clone());
+            }
+            None => {
+                let cb = Arc::new(Self {
+                    waker: SpinLock::new(Some(waker.clone())),
+                });
+                wq.add_callback(key, cb.clone());
+                *slot = Some(cb);
+            }
+        }
+    }
+
+    /// 从等待队列上移除通过[`WaitQueueWaker::arm`]注册的回调
+    pub fn disarm(slot: &mut Option<Arc<Self>>, wq: &WaitQueue) {
+        if let Some(cb) = slot.take() {
+            let cb: Arc<dyn WaitQueueCallback> = cb;
+            wq.remove_callback(&cb);
+        }
+    }
+}
+
+/// 等待`cond`成立的future，见[`wait_event`]
+pub struct WaitEvent<'a, F: FnMut() -> bool + Unpin> {
+    wq: &'a WaitQueue,
+    key: u64,
+    cond: F,
+    waker: Option<Arc<WaitQueueWaker>>,
+}
+
+/// 等待`cond`成立：每次`wq`以与`key`有交集的键被唤醒时，重新检查`cond`
+///
+/// 与[`WaitQueue::sleep`]的用法相同，修改条件的一方需要在修改之后唤醒`wq`
+pub fn wait_event<F: FnMut() -> bool + Unpin>(wq: &WaitQueue, key: u64, cond: F) -> WaitEvent<F> {
+    return WaitEvent {
+        wq,
+        key,
+        cond,
+        waker: None,
+    };
+}
+
+impl<'a, F: FnMut() -> bool + Unpin> Future for WaitEvent<'a, F> {
+    type Output = ();
+
+    fn poll(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<()> {
+        let this = self.get_mut();
+        if (this.cond)() {
+            WaitQueueWaker::disarm(&mut this.waker, this.wq);
+            return Poll::Ready(());
+        }
+        WaitQueueWaker::arm(&mut this.waker, this.wq, this.key, cx.waker());
+        // 注册之后再检查一次，避免错过在第一次检查之后发生的唤醒
+        if (this.cond)() {
+            WaitQueueWaker::disarm(&mut this.waker, this.wq);
+            return Poll::Ready(());
+        }
+        return Poll::Pending;
+    }
+}
+
+impl<'a, F: FnMut() -> bool + Unpin> Drop for WaitEvent<'a, F> {
+    fn drop(&mut self) {
+        WaitQueueWaker::disarm(&mut self.waker, self.wq);
+    }
+}
+
+#[derive(Debug)]
+struct SleepState {
+    expired: AtomicBool,
+    waker: SpinLock<Option<Waker>>,
+}
+
+#[derive(Debug)]
+struct SleepTimerFunc(Arc<SleepState>);
+
+impl TimerFunction for SleepTimerFunc {
+    fn run(&mut self) -> Result<(), SystemError> {
+        self.0.expired.store(true, Ordering::Release);
+        let waker = self.0.waker.lock_irqsave().take();
+        if let Some(waker) = waker {
+            waker.wake();
+        }
+        return Ok(());
+    }
+}
+
+/// 等待一段时间的future，见[`sleep_ms`]
+#[derive(Debug)]
+pub struct Sleep {
+    expire_jiffies: u64,
+    state: Arc<SleepState>,
+    timer: Option<Arc<Timer>>,
+}
+
+/// 等待`ms`毫秒（定时器在第一次poll时启动）
+pub fn sleep_ms(ms: u64) -> Sleep {
+    return Sleep {
+        expire_jiffies: next_n_ms_timer_jiffies(ms),
+        state: Arc::new(SleepState {
+            expired: AtomicBool::new(false),
+            waker: SpinLock::new(None),
+        }),
+        timer: None,
+    };
+}
+
+impl Future for Sleep {
+    type Output = ();
+
+    fn poll(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<()> {
+        let this = self.get_mut();
+        if this.state.expired.load(Ordering::Acquire) {
+            return Poll::Ready(());
+        }
+        *this.state.waker.lock_irqsave() = Some(cx.waker().clone());
+        if this.timer.is_none() {
+            let timer = Timer::new(
+                Box::new(SleepTimerFunc(this.state.clone())),
+                this.expire_jiffies,
+            );
+            timer.activate();
+            this.timer = Some(timer);
+        }
+        if this.state.expired.load(Ordering::Acquire) {
+            return Poll::Ready(());
+        }
+        return Poll::Pending;
+    }
+}
+
+impl Drop for Sleep {
+    fn drop(&mut self) {
+        if let Some(timer) = self.timer.take() {
+            if !self.state.expired.load(Ordering::Acquire) {
+                timer.cancel();
+            }
+        }
+    }
+}
+
+/// 让出执行器，让同一个cpu上的其他任务先运行
+pub fn yield_now() -> YieldNow {
+    return YieldNow { yielded: false };
+}
+
+#[derive(Debug)]
+pub struct YieldNow {
+    yielded: bool,
+}
+
+impl Future for YieldNow {
+    type Output = ();
+
+    fn poll(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<()> {
+        let this = self.get_mut();
+        if this.yielded {
+            return Poll::Ready(());
+        }
+        this.yielded = true;
+        cx.waker().wake_by_ref();
+        return Poll::Pending;
+    }
+}
+
+/// 唤醒[`block_on`]中睡眠的进程
+struct ThreadWaker {
+    pcb: Arc<ProcessControlBlock>,
+    notified: AtomicBool,
+}
+
+impl Wake for ThreadWaker {
+    fn wake(self: Arc<Self>) {
+        self.wake_by_ref();
+    }
+
+    fn wake_by_ref(self: &Arc<Self>) {
+        self.notified.store(true, Ordering::Release);
+        ProcessManager::wakeup(&self.pcb).ok();
+    }
+}
+
+/// 在当前进程中运行`future`，直到它完成（等待时睡眠）
+///
+/// 用于在非异步的代码中使用异步的接口，不能在执行器的任务中调用
+pub fn block_on<F: Future>(future: F) -> F::Output {
+    let mut future = Box::pin(future);
+    let thread_waker = Arc::new(ThreadWaker {
+        pcb: ProcessManager::current_pcb(),
+        notified: AtomicBool::new(false),
+    });
+    let waker = Waker::from(thread_waker.clone());
+    let mut cx = Context::from_waker(&waker);
+    loop {
+        if let Poll::Ready(r) = future.as_mut().poll(&mut cx) {
+            return r;
+        }
+
+        // 先标记睡眠再检查通知：之后的唤醒会把进程重新变为可运行的
+        let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+        ProcessManager::mark_sleep(false).ok();
+        if thread_waker.notified.swap(false, Ordering::AcqRel) {
+            ProcessManager::cancel_sleep();
+            drop(irq_guard);
+            continue;
+        }
+        drop(irq_guard);
+        sched();
+        thread_waker.notified.store(false, Ordering::Release);
+    }
+}
+
+/// 为每个cpu创建执行器线程（需要在内核线程机制初始化完成之后调用）
+///
+/// 在此之前提交的任务会在线程启动后运行
+pub fn executor_init() {
+    let nr_cpus = unsafe { smp_get_total_cpu() } as usize;
+    for cpu in 0..nr_cpus {
+        let closure = KernelThreadClosure::UsizeClosure((Box::new(executor_thread), cpu));
+        let pcb = KernelThreadMechanism::create(closure, format!("kasync/{}", cpu))
+            .unwrap_or_else(|| panic!("Failed to create executor thread for cpu {}", cpu));
+        let mut words = [0u64; CPU_MASK_WORDS];
+        words[cpu / 64] |= 1 << (cpu % 64);
+        pcb.sched_info().cpus_allowed().store_words(&words);
+        ProcessManager::wakeup(&pcb).ok();
+    }
+    kinfo!("async executor initialized");
+}
@@ -13,8 +13,10 @@ use crate::{
 };
 
 use super::{
-    abi::WaitOption, pid::PidType, resource::RUsage, Pid, ProcessControlBlock, ProcessManager,
-    ProcessState,
+    abi::WaitOption,
+    pid::PidType,
+    resource::{RUsage, RUsageWho},
+    Pid, ProcessControlBlock, ProcessManager, ProcessState,
 };
 
 /// 内核wait4时的参数
@@ -119,12 +121,7 @@ fn do_wait(kwo: &mut KernelWaitOption) -> Result<usize, SystemError> {
 
             if !kwo.options.contains(WaitOption::WNOHANG) {
                 retval = Err(SystemError::ERESTARTSYS);
-                if ProcessManager::current_pcb()
-                    .sig_info_irqsave()
-                    .sig_pending()
-                    .has_pending()
-                    == false
-                {
+                if !ProcessManager::current_pcb().has_pending_signal() {
                     // todo: 增加子进程退出的回调后，这里可以直接等待在自身的child_wait等待队列上。
                     continue;
                 } else {
@@ -155,6 +152,7 @@ fn do_wait(kwo: &mut KernelWaitOption) -> Result<usize, SystemError> {
                 let pcb = ProcessManager::find(*pid).ok_or(SystemError::ECHILD)?;
                 if pcb.sched_info().state().is_exited() {
                     kwo.ret_status = pcb.sched_info().state().exit_code().unwrap() as i32;
+                    reap_child_cputime(&pcb, kwo);
                     drop(pcb);
                     unsafe { ProcessManager::release(pid.clone()) };
                     return Ok(pid.clone().into());
@@ -174,6 +172,18 @@ fn do_wait(kwo: &mut KernelWaitOption) -> Result<usize, SystemError> {
     return retval;
 }
 
+/// 回收子进程时，返回它的资源使用情况，并把它的时间加到当前进程上
+fn reap_child_cputime(child: &ProcessControlBlock, kwo: &mut KernelWaitOption) {
+    if let Some(rusage) = &mut kwo.ret_rusage {
+        if let Some(r) = child.get_rusage(RUsageWho::RUsageBoth) {
+            **rusage = r;
+        }
+    }
+    ProcessManager::current_pcb()
+        .cputime()
+        .reap_child(child.cputime());
+}
+
 fn do_waitpid(
     child_pcb: Arc<ProcessControlBlock>,
     kwo: &mut KernelWaitOption,
@@ -241,6 +251,7 @@ fn do_waitpid(
             }
 
             kwo.ret_status = status as i32;
+            reap_child_cputime(&child_pcb, kwo);
 
             drop(child_pcb);
             // kdebug!("wait4: to release {pid:?}");
@@ -156,7 +156,7 @@ impl ProcessManager {
         let current_pcb = ProcessManager::current_pcb();
         let new_kstack = KernelStack::new()?;
         let name = current_pcb.basic().name().to_string();
-        let pcb = ProcessControlBlock::new(name, new_kstack);
+        let pcb = ProcessControlBlock::new(name, new_kstack)?;
 
         let mut args = KernelCloneArgs::new();
         args.flags = clone_flags;
@@ -190,10 +190,11 @@ impl ProcessManager {
         clone_flags: &CloneFlags,
         new_pcb: &Arc<ProcessControlBlock>,
     ) -> Result<(), SystemError> {
-        if clone_flags.contains(CloneFlags::CLONE_VM) {
+        *new_pcb.flags.get_mut() = ProcessManager::current_pcb().flags().clone();
+        new_pcb.flags().remove(ProcessFlags::VFORK);
+        if clone_flags.contains(CloneFlags::CLONE_VFORK) {
             new_pcb.flags().insert(ProcessFlags::VFORK);
         }
-        *new_pcb.flags.get_mut() = ProcessManager::current_pcb().flags().clone();
         return Ok(());
     }
 
@@ -349,7 +350,7 @@ impl ProcessManager {
         drop(guard);
 
         // 为内核线程设置WorkerPrivate
-        if current_pcb.flags().contains(ProcessFlags::KTHREAD) {
+        if current_pcb.flags().contains(ProcessFlags::KTHREAD) || clone_args.kthread {
             *pcb.worker_private() =
                 Some(WorkerPrivate::KernelThread(KernelThreadPcbPrivate::new()));
         }
@@ -382,6 +383,33 @@ impl ProcessManager {
                 current_pcb.pid(), pcb.pid(), e
             )
         });
+        // 子进程先以内核线程的身份开始执行（例如posix_spawn创建的进程，在内核中完成exec）
+        if clone_args.kthread {
+            pcb.flags().insert(ProcessFlags::KTHREAD);
+        }
+
+        // 子进程继承调度策略、cpu亲和性、定时器松弛量和任务组
+        let (policy, priority, timer_slack_ns, task_group) = {
+            let sched_info = current_pcb.sched_info();
+            (
+                sched_info.policy(),
+                sched_info.priority(),
+                sched_info.timer_slack_ns(),
+                sched_info.task_group().clone(),
+            )
+        };
+        pcb.sched_info_mut().set_policy(policy, priority);
+        pcb.sched_info_mut().set_task_group(task_group);
+        pcb.sched_info()
+            .cpus_allowed()
+            .store_words(&current_pcb.sched_info().cpus_allowed().words());
+        pcb.sched_info().set_timer_slack_ns(timer_slack_ns);
+
+        // 子进程继承rseq的注册（共享地址空间的线程需要自己注册），并在第一次返回用户态时写入cpu号
+        if !clone_flags.contains(CloneFlags::CLONE_VM) && current_pcb.rseq().registered() {
+            pcb.rseq().inherit_from(current_pcb.rseq());
+            pcb.flags().insert(ProcessFlags::RSEQ_RESUME);
+        }
 
         // 拷贝用户地址空间
         Self::copy_mm(&clone_flags, &current_pcb, &pcb).unwrap_or_else(|e| {
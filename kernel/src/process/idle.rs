@@ -1,20 +1,78 @@
 use core::{
+    hint::spin_loop,
     intrinsics::unlikely,
-    sync::atomic::{AtomicBool, Ordering},
+    sync::atomic::{fence, AtomicBool, AtomicU32, AtomicU64, AtomicU8, Ordering},
 };
 
 use alloc::{sync::Arc, vec::Vec};
 
 use crate::{
+    arch::{
+        cpu::{cpu_has_mwait, cpu_monitor, cpu_sti_mwait},
+        driver::apic::apic_timer::{apic_timer_restart_tick, apic_timer_stop_tick},
+        sched::sched,
+        CurrentIrqArch,
+    },
+    exception::InterruptArch,
+    libs::rcu::{rcu_needs_cpu, rcu_note_qs},
     mm::{percpu::PerCpu, VirtAddr, INITIAL_PROCESS_ADDRESS_SPACE},
     process::KernelStack,
-    smp::core::smp_get_processor_id,
+    sched::{balance::sched_load_nohz_exit, rq::this_rq},
+    smp::{core::smp_get_processor_id, kick_cpu},
+    time::{
+        clocksource::HZ, hrtimer::hrtimer_next_expire_us, timer::clock,
+        timer::timer_get_first_expire,
+    },
 };
 
 use super::{ProcessControlBlock, ProcessManager};
 
 static mut __IDLE_PCB: Option<Vec<Arc<ProcessControlBlock>>> = None;
 
+/// 时钟中断的间隔（单位：jiffies，即微秒）
+const TICK_JIFFIES: u64 = 1000000 / HZ;
+/// NO_HZ idle期间，最多多长时间不产生时钟中断（单位：jiffies）
+const NOHZ_MAX_IDLE_JIFFIES: u64 = 1000000;
+
+/// 每个cpu是否正处于停止了时钟中断的空闲状态
+static NOHZ_IDLE: [AtomicBool; PerCpu::MAX_CPU_NUM] =
+    [const { AtomicBool::new(false) }; PerCpu::MAX_CPU_NUM];
+/// 每个cpu停止时钟中断的时间
+static NOHZ_IDLE_SINCE: [AtomicU64; PerCpu::MAX_CPU_NUM] =
+    [const { AtomicU64::new(0) }; PerCpu::MAX_CPU_NUM];
+
+/// 运行队列为空时，进入MWAIT/HLT之前先轮询的次数。很快就有进程被唤醒时，可以免去睡眠和唤醒的开销
+const IDLE_POLL_LOOPS: usize = 2000;
+
+/// cpu不处于空闲等待
+const IDLE_RUNNING: u8 = 0;
+/// cpu正在轮询、或者通过MWAIT监视唤醒标志，唤醒者写入唤醒标志即可，不需要发送IPI
+const IDLE_POLLING: u8 = 1;
+/// cpu执行了hlt，只有中断能够唤醒它
+const IDLE_HALTED: u8 = 2;
+
+/// 空闲的cpu的唤醒标志
+///
+/// 每个cpu独占一个缓存行：MWAIT监视的是整个缓存行，其他数据的写入会造成不必要的唤醒
+#[derive(Debug)]
+#[repr(align(64))]
+struct IdleWake {
+    /// 非0表示有进程被加入了运行队列
+    need_resched: AtomicU32,
+    /// cpu的空闲等待方式（`IDLE_RUNNING`/`IDLE_POLLING`/`IDLE_HALTED`）
+    mode: AtomicU8,
+}
+
+static IDLE_WAKE: [IdleWake; PerCpu::MAX_CPU_NUM] = [const {
+    IdleWake {
+        need_resched: AtomicU32::new(0),
+        mode: AtomicU8::new(IDLE_RUNNING),
+    }
+}; PerCpu::MAX_CPU_NUM];
+
+/// 是否使用MWAIT等待（在初始化idle进程时检测）
+static MWAIT_USABLE: AtomicBool = AtomicBool::new(false);
+
 impl ProcessManager {
     /// 初始化每个核的idle进程
     pub fn init_idle() {
@@ -64,6 +122,7 @@ impl ProcessManager {
         unsafe {
             __IDLE_PCB = Some(v);
         }
+        MWAIT_USABLE.store(cpu_has_mwait(), Ordering::Relaxed);
     }
 
     /// 获取当前的栈指针
@@ -78,4 +137,162 @@ impl ProcessManager {
     pub fn idle_pcb() -> &'static Vec<Arc<ProcessControlBlock>> {
         unsafe { __IDLE_PCB.as_ref().unwrap() }
     }
+
+    /// cpu是否正处于停止了时钟中断的空闲状态
+    #[inline(always)]
+    pub fn cpu_in_nohz_idle(cpu_id: u32) -> bool {
+        return NOHZ_IDLE[cpu_id as usize].load(Ordering::SeqCst);
+    }
+
+    /// 进入NO_HZ idle：停止当前cpu的周期性时钟中断，只在下一个定时器到期时产生一次中断
+    ///
+    /// 请注意，调用者需要关中断
+    fn nohz_idle_enter() {
+        let cpu_id = smp_get_processor_id() as usize;
+        // 还有RCU回调函数等待执行，或者还需要报告静止状态时，需要时钟中断来推进宽限期
+        if rcu_needs_cpu(cpu_id as u32) {
+            return;
+        }
+        let now = clock();
+        let delta = match timer_get_first_expire() {
+            Ok(0) => NOHZ_MAX_IDLE_JIFFIES,
+            Ok(expire) => expire.saturating_sub(now),
+            // 无法确定下一个定时器的到期时间，保持周期性的时钟中断
+            Err(_) => return,
+        };
+        // 高精度定时器的到期时间以微秒为单位，与jiffies相同
+        let delta = delta.min(hrtimer_next_expire_us().unwrap_or(u64::MAX));
+        // 间隔太短，停止时钟中断节省不了什么
+        if delta < 2 * TICK_JIFFIES {
+            return;
+        }
+        apic_timer_stop_tick(delta.min(NOHZ_MAX_IDLE_JIFFIES));
+        NOHZ_IDLE_SINCE[cpu_id].store(now, Ordering::Relaxed);
+        NOHZ_IDLE[cpu_id].store(true, Ordering::SeqCst);
+        // 与rcu_gp_start()配对：要么新的宽限期看到了这个cpu停止了时钟中断，要么这里看到了新的宽限期
+        if rcu_needs_cpu(cpu_id as u32) {
+            Self::nohz_idle_exit();
+        }
+    }
+
+    /// 退出NO_HZ idle，恢复当前cpu的周期性时钟中断。如果当前cpu不处于NO_HZ idle，则什么也不做
+    ///
+    /// 请注意，调用者需要关中断
+    fn nohz_idle_exit() {
+        let cpu_id = smp_get_processor_id();
+        if !NOHZ_IDLE[cpu_id as usize].swap(false, Ordering::SeqCst) {
+            return;
+        }
+        apic_timer_restart_tick();
+        let idle = clock().saturating_sub(NOHZ_IDLE_SINCE[cpu_id as usize].load(Ordering::Relaxed));
+        sched_load_nohz_exit(cpu_id, idle / TICK_JIFFIES);
+    }
+
+    /// 向`cpu_id`的运行队列加入进程之后，唤醒这个cpu（如果它正在空闲等待）
+    ///
+    /// 轮询或者MWAIT中的cpu只需要写入唤醒标志；执行了hlt的cpu才需要通过IPI唤醒。
+    pub fn wake_idle_cpu(cpu_id: u32) {
+        if cpu_id == smp_get_processor_id() {
+            return;
+        }
+        let wake = &IDLE_WAKE[cpu_id as usize];
+        // 与idle_wait()配对：要么空闲的cpu看到了新加入的进程，要么这里看到了它的等待方式
+        fence(Ordering::SeqCst);
+        match wake.mode.load(Ordering::Relaxed) {
+            IDLE_POLLING => wake.need_resched.store(1, Ordering::Release),
+            IDLE_HALTED => {
+                kick_cpu(cpu_id).ok();
+            }
+            // 刚刚结束空闲等待的cpu会在开中断之前检查运行队列
+            _ => {}
+        }
+    }
+
+    /// 当前cpu是否有需要运行的进程
+    #[inline(always)]
+    fn idle_should_wake(wake: &IdleWake) -> bool {
+        return wake.need_resched.load(Ordering::Acquire) != 0 || this_rq().nr_running() != 0;
+    }
+
+    /// 设置当前cpu的空闲等待方式，然后检查是否已经有进程需要运行
+    #[inline(always)]
+    fn idle_set_mode(wake: &IdleWake, mode: u8) -> bool {
+        wake.mode.store(mode, Ordering::Relaxed);
+        // 与wake_idle_cpu()配对
+        fence(Ordering::SeqCst);
+        return Self::idle_should_wake(wake);
+    }
+
+    /// 结束当前cpu的空闲等待
+    ///
+    /// 请注意，调用者需要关中断
+    pub fn idle_exit() {
+        let wake = &IDLE_WAKE[smp_get_processor_id() as usize];
+        wake.mode.store(IDLE_RUNNING, Ordering::Relaxed);
+        wake.need_resched.store(0, Ordering::Relaxed);
+        Self::nohz_idle_exit();
+    }
+
+    /// 运行队列为空时的等待：先短暂地轮询，然后通过MWAIT（不支持时使用HLT）睡眠
+    ///
+    /// 请注意，调用者需要关中断。返回时，中断仍然是关闭的
+    fn idle_wait() {
+        let wake = &IDLE_WAKE[smp_get_processor_id() as usize];
+        if Self::idle_set_mode(wake, IDLE_POLLING) {
+            return;
+        }
+
+        // 轮询期间允许中断（例如时钟中断）到来
+        unsafe { CurrentIrqArch::interrupt_enable() };
+        for _ in 0..IDLE_POLL_LOOPS {
+            if Self::idle_should_wake(wake) {
+                break;
+            }
+            spin_loop();
+        }
+        unsafe { CurrentIrqArch::interrupt_disable() };
+        if Self::idle_should_wake(wake) {
+            return;
+        }
+
+        Self::nohz_idle_enter();
+        if MWAIT_USABLE.load(Ordering::Relaxed) {
+            // 轮询期间，中断处理程序可能把idle进程调度出去过，需要重新设置等待方式
+            if !Self::idle_set_mode(wake, IDLE_POLLING) {
+                unsafe { cpu_monitor(&wake.need_resched as *const AtomicU32 as *const u8) };
+                // 设置监视之前被写入的唤醒标志不会唤醒MWAIT，需要再检查一次
+                if !Self::idle_should_wake(wake) {
+                    unsafe { cpu_sti_mwait() };
+                }
+            }
+        } else if !Self::idle_set_mode(wake, IDLE_HALTED) {
+            // 开中断与hlt之间不能有中断到来，否则唤醒它的中断会被错过
+            #[cfg(target_arch = "x86_64")]
+            unsafe {
+                core::arch::asm!("sti", "hlt")
+            };
+        }
+        unsafe { CurrentIrqArch::interrupt_disable() };
+    }
+
+    /// idle进程的主循环
+    pub fn idle_loop() -> ! {
+        loop {
+            unsafe { CurrentIrqArch::interrupt_disable() };
+            rcu_note_qs();
+            if this_rq().nr_running() == 0 {
+                Self::idle_wait();
+                Self::idle_exit();
+            }
+            unsafe { CurrentIrqArch::interrupt_enable() };
+            if this_rq().nr_running() != 0 {
+                sched();
+            }
+        }
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn rs_idle_loop() -> ! {
+    ProcessManager::idle_loop();
 }
@@ -4,32 +4,83 @@ use alloc::string::String;
 
 use crate::{
     arch::process::arch_switch_to_user,
+    debug::klog::kmsg::kmsg_init,
     driver::{
-        disk::ahci::ahci_init, net::e1000e::e1000e::e1000e_init, virtio::virtio::virtio_probe,
+        base::probe::ProbeGroup,
+        disk::{ahci::ahci_init, nvme::nvme_init},
+        net::e1000e::e1000e::e1000e_init,
+        virtio::virtio::virtio_probe,
     },
-    filesystem::vfs::core::mount_root_fs,
-    kdebug, kerror,
+    exception::{irqbalance::irqbalance_init, softirq::ksoftirqd_init},
+    filesystem::vfs::{
+        core::{mount_root_fs, ROOT_INODE},
+        page_cache::page_cache_init,
+    },
+    init::{
+        bootstat::{boot_phase, boot_report},
+        initramfs::populate_rootfs,
+    },
+    kdebug, kerror, kinfo,
+    mm::{allocator::zeroed_pool::zeroed_page_pool_init, reclaim::reclaim_init, zram::zram_init},
     net::net_core::net_init,
-    process::{kthread::KernelThreadMechanism, process::stdio_init},
+    process::{
+        executor::executor_init, kthread::KernelThreadMechanism, process::stdio_init,
+        workqueue::workqueue_init,
+    },
 };
 
+/// init程序的路径
+const INIT_PATH: &str = "/bin/DragonReach";
+
 pub fn initial_kernel_thread() -> i32 {
     KernelThreadMechanism::init_stage2();
+    workqueue_init();
+    executor_init();
+    ksoftirqd_init();
+    kmsg_init();
+    zeroed_page_pool_init();
+    zram_init();
+    reclaim_init();
+    irqbalance_init();
+    page_cache_init();
     // 由于目前加锁，速度过慢，所以先不开启双缓冲
     // scm_enable_double_buffer().expect("Failed to enable double buffer");
     stdio_init().expect("Failed to initialize stdio");
 
-    ahci_init().expect("Failed to initialize AHCI");
+    // initramfs中带有init程序时，使用它作为根文件系统
+    let initramfs_root = boot_phase("populate_rootfs", || {
+        populate_rootfs() != 0 && ROOT_INODE().lookup(INIT_PATH).is_ok()
+    });
 
-    mount_root_fs().expect("Failed to mount root fs");
+    // 网卡的探测与存储设备的探测、根文件系统的挂载并行执行，网络初始化之前等待它完成
+    let nic_probes = ProbeGroup::new();
+    nic_probes.spawn(|| boot_phase("e1000e_init (parallel)", e1000e_init));
 
-    virtio_probe();
-    e1000e_init();
-    net_init().unwrap_or_else(|err| {
+    boot_phase("ahci_init", || {
+        ahci_init().expect("Failed to initialize AHCI")
+    });
+    // 根文件系统可能位于virtio-blk磁盘或者NVMe磁盘上
+    boot_phase("virtio_probe", virtio_probe);
+    boot_phase("nvme_init", nvme_init);
+
+    if initramfs_root {
+        kinfo!("Using initramfs as root fs");
+    } else {
+        boot_phase("mount_root_fs", || {
+            mount_root_fs().expect("Failed to mount root fs")
+        });
+    }
+
+    boot_phase("nic_probes.wait", || nic_probes.wait());
+    boot_phase("net_init", net_init).unwrap_or_else(|err| {
         kerror!("Failed to initialize network: {:?}", err);
     });
 
+    #[cfg(feature = "kbench")]
+    crate::ktest::ktest_bench_run();
+
     kdebug!("initial kernel thread done.");
+    boot_report();
 
     switch_to_user();
 
@@ -38,8 +89,8 @@ pub fn initial_kernel_thread() -> i32 {
 
 /// 切换到用户态
 fn switch_to_user() {
-    let path = String::from("/bin/DragonReach");
-    let argv = vec![String::from("/bin/DragonReach")];
+    let path = String::from(INIT_PATH);
+    let argv = vec![String::from(INIT_PATH)];
     let envp = vec![String::from("PATH=/")];
 
     unsafe { arch_switch_to_user(path, argv, envp) };
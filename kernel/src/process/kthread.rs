@@ -17,6 +17,7 @@ use crate::{
     kdebug, kinfo,
     libs::{once::Once, spinlock::SpinLock},
     process::{ProcessManager, ProcessState},
+    smp::cpu::CPU_MASK_WORDS,
     syscall::SystemError,
 };
 
@@ -297,6 +298,16 @@ impl KernelThreadMechanism {
         });
     }
 
+    /// 设置之后创建的内核线程默认允许运行的cpu
+    ///
+    /// 内核线程由kthreadd创建，继承它的cpu亲和性，因此只需要修改kthreadd的亲和性。
+    /// 已经创建的内核线程不受影响；绑定cpu的内核线程（例如ksoftirqd）会在创建之后另外设置亲和性
+    pub fn set_default_affinity(words: &[u64; CPU_MASK_WORDS]) {
+        if let Some(pcb) = unsafe { KTHREAD_DAEMON_PCB.as_ref() } {
+            pcb.sched_info().cpus_allowed().store_words(words);
+        }
+    }
+
     /// 创建一个新的内核线程
     ///
     /// ## 参数
@@ -3,7 +3,9 @@ use core::{
     hint::spin_loop,
     intrinsics::{likely, unlikely},
     mem::ManuallyDrop,
-    sync::atomic::{compiler_fence, AtomicBool, AtomicI32, AtomicIsize, AtomicUsize, Ordering},
+    sync::atomic::{
+        compiler_fence, AtomicBool, AtomicI32, AtomicIsize, AtomicU64, AtomicUsize, Ordering,
+    },
 };
 
 use alloc::{
@@ -11,7 +13,7 @@ use alloc::{
     sync::{Arc, Weak},
     vec::Vec,
 };
-use hashbrown::HashMap;
+use ida::IdAllocator;
 
 use crate::{
     arch::{
@@ -20,6 +22,7 @@ use crate::{
         sched::sched,
         CurrentIrqArch,
     },
+    driver::base::block::request_queue::BlkPlugState,
     exception::InterruptArch,
     filesystem::{
         procfs::procfs_unregister_pid,
@@ -34,6 +37,7 @@ use crate::{
             constant::{FutexFlag, FUTEX_BITSET_MATCH_ANY},
             futex::Futex,
         },
+        idr::Idr,
         lock_free_flags::LockFreeFlags,
         rwlock::{RwLock, RwLockReadGuard, RwLockUpgradableGuard, RwLockWriteGuard},
         spinlock::{SpinLock, SpinLockGuard},
@@ -42,19 +46,30 @@ use crate::{
     mm::{percpu::PerCpuVar, set_INITIAL_PROCESS_ADDRESS_SPACE, ucontext::AddressSpace, VirtAddr},
     net::socket::SocketInode,
     sched::{
+        cgroup::{root_task_group, TaskGroup},
         completion::Completion,
         core::{sched_enqueue, CPU_EXECUTING},
+        isolation::{housekeeping_mask, isolation_init},
+        sched_pi_rank,
+        stats::TaskSchedStat,
         SchedPolicy, SchedPriority,
     },
-    smp::kick_cpu,
-    syscall::{user_access::clear_user, Syscall, SystemError},
+    smp::{cpu::AtomicCpuMask, kick_cpu},
+    syscall::{
+        trace::{syscall_trace_release, SyscallTraceRing},
+        user_access::clear_user,
+        Syscall, SystemError,
+    },
+    time::{posix_timer::PosixTimers, timer::DEFAULT_TIMER_SLACK_NS},
 };
 
-use self::kthread::WorkerPrivate;
+use self::{kthread::WorkerPrivate, rseq::RseqState};
+use crate::sched::cputime::TaskCputime;
 
 pub mod abi;
 pub mod c_adapter;
 pub mod exec;
+pub mod executor;
 pub mod exit;
 pub mod fork;
 pub mod idle;
@@ -63,10 +78,24 @@ pub mod kthread;
 pub mod pid;
 pub mod process;
 pub mod resource;
+pub mod rseq;
+pub mod spawn;
 pub mod syscall;
+pub mod workqueue;
+
+/// 默认的pid上限（不包含），与Linux相同
+pub const PID_MAX_DEFAULT: usize = 0x8000;
 
-/// 系统中所有进程的pcb
-static ALL_PROCESS: SpinLock<Option<HashMap<Pid, Arc<ProcessControlBlock>>>> = SpinLock::new(None);
+/// pid分配器。释放的pid会被循环地复用，使pid保持在一个较小的范围内
+static PID_ALLOCATOR: IdAllocator = IdAllocator::new(1, PID_MAX_DEFAULT);
+
+lazy_static! {
+    /// 系统中所有进程的pcb，以pid为下标。
+    ///
+    /// 查找进程远比创建、回收进程频繁：查找在RCU读临界区内进行，不需要加锁，
+    /// 只有fork和exit需要获取idr内部的锁
+    static ref ALL_PROCESS: Idr<ProcessControlBlock> = Idr::new();
+}
 
 pub static mut SWITCH_RESULT: Option<PerCpuVar<SwitchResult>> = None;
 
@@ -111,7 +140,6 @@ impl ProcessManager {
             compiler_fence(Ordering::SeqCst);
         };
 
-        ALL_PROCESS.lock().replace(HashMap::new());
         Self::arch_init();
         kdebug!("process arch init done.");
         Self::init_idle();
@@ -139,11 +167,28 @@ impl ProcessManager {
         return ProcessControlBlock::arch_current_pcb();
     }
 
+    /// 借用当前进程的pcb，不增加引用计数
+    ///
+    /// 与`current_pcb`不同，这里不会对pcb的引用计数进行原子操作，适合在加锁、解锁等热路径上使用。
+    /// 返回的引用不能被发送到其他进程，需要长期持有pcb时请使用`current_pcb`
+    #[inline(always)]
+    pub fn current() -> CurrentPcb {
+        if unlikely(unsafe { !__PROCESS_MANAGEMENT_INIT_DONE }) {
+            kerror!("unsafe__PROCESS_MANAGEMENT_INIT_DONE == false");
+            loop {
+                spin_loop();
+            }
+        }
+        return CurrentPcb {
+            ptr: ProcessControlBlock::arch_current_pcb_ptr(),
+        };
+    }
+
     /// 增加当前进程的锁持有计数
     #[inline(always)]
     pub fn preempt_disable() {
         if likely(unsafe { __PROCESS_MANAGEMENT_INIT_DONE }) {
-            ProcessManager::current_pcb().preempt_disable();
+            ProcessManager::current().preempt_disable();
         }
     }
 
@@ -151,7 +196,7 @@ impl ProcessManager {
     #[inline(always)]
     pub fn preempt_enable() {
         if likely(unsafe { __PROCESS_MANAGEMENT_INIT_DONE }) {
-            ProcessManager::current_pcb().preempt_enable();
+            ProcessManager::current().preempt_enable();
         }
     }
 
@@ -165,7 +210,7 @@ impl ProcessManager {
     ///
     /// 如果找到了对应的进程，那么返回该进程的pcb，否则返回None
     pub fn find(pid: Pid) -> Option<Arc<ProcessControlBlock>> {
-        return ALL_PROCESS.lock().as_ref()?.get(&pid).cloned();
+        return ALL_PROCESS.get_arc(pid.data());
     }
 
     /// 向系统中添加一个进程的pcb
@@ -178,11 +223,14 @@ impl ProcessManager {
     ///
     /// 无
     pub fn add_pcb(pcb: Arc<ProcessControlBlock>) {
-        ALL_PROCESS
-            .lock()
-            .as_mut()
-            .unwrap()
-            .insert(pcb.pid(), pcb.clone());
+        let pid = pcb.pid();
+        if let Err(e) = ALL_PROCESS.insert(pid.data(), pcb) {
+            kerror!(
+                "add_pcb: failed to add pid {:?} to process table: {:?}",
+                pid,
+                e
+            );
+        }
     }
 
     /// 唤醒一个进程
@@ -197,6 +245,7 @@ impl ProcessManager {
                 // avoid deadlock
                 drop(writer);
 
+                tracepoint!(SchedWakeup, pcb.pid().data(), 0);
                 sched_enqueue(pcb.clone(), true);
                 return Ok(());
             } else if state.is_exited() {
@@ -263,6 +312,27 @@ impl ProcessManager {
         return Err(SystemError::EINTR);
     }
 
+    /// 撤销[`ProcessManager::mark_sleep`]：当前进程在发起调度之前发现已经不需要睡眠了
+    ///
+    /// ## 注意
+    ///
+    /// - 进入当前函数之前，不能持有sched_info的锁
+    /// - 进入当前函数之前，必须关闭中断
+    pub fn cancel_sleep() {
+        assert_eq!(
+            CurrentIrqArch::is_irq_enabled(),
+            false,
+            "interrupt must be disabled before enter ProcessManager::cancel_sleep()"
+        );
+
+        let pcb = ProcessManager::current_pcb();
+        let mut writer = pcb.sched_info_mut_irqsave();
+        // 可能已经被其他cpu唤醒了
+        if writer.state().is_blocked() {
+            writer.set_state(ProcessState::Runnable);
+        }
+    }
+
     /// 标志当前进程为停止状态，但是发起调度的工作，应该由调用者完成
     ///
     /// ## 注意
@@ -330,7 +400,7 @@ impl ProcessManager {
         pcb.wait_queue.wakeup(Some(ProcessState::Blocked(true)));
 
         // 进行进程退出后的工作
-        let thread = pcb.thread.write();
+        let mut thread = pcb.thread.write();
         if let Some(addr) = thread.set_child_tid {
             unsafe { clear_user(addr, core::mem::size_of::<i32>()).expect("clear tid failed") };
         }
@@ -343,11 +413,11 @@ impl ProcessManager {
             unsafe { clear_user(addr, core::mem::size_of::<i32>()).expect("clear tid failed") };
         }
 
-        // 如果是vfork出来的进程，则需要处理completion
-        if thread.vfork_done.is_some() {
-            thread.vfork_done.as_ref().unwrap().complete_all();
-        }
         drop(thread);
+        // 如果是vfork出来的进程，则需要唤醒等待的父进程
+        Self::vfork_release(&pcb);
+        // 进程退出后，它的POSIX定时器不能再发出信号
+        pcb.posix_timers().lock_irqsave().clear();
         unsafe { pcb.basic_mut().set_user_vm(None) };
         drop(pcb);
         ProcessManager::exit_notify();
@@ -357,6 +427,15 @@ impl ProcessManager {
         loop {}
     }
 
+    /// vfork出来的进程不再使用父进程的地址空间（exec或者退出时调用），唤醒等待它的父进程
+    pub fn vfork_release(pcb: &Arc<ProcessControlBlock>) {
+        let vfork_done = pcb.thread.write().vfork_done.take();
+        if let Some(vfork_done) = vfork_done {
+            pcb.flags().remove(ProcessFlags::VFORK);
+            vfork_done.complete_all();
+        }
+    }
+
     pub unsafe fn release(pid: Pid) {
         let pcb = ProcessManager::find(pid);
         if !pcb.is_none() {
@@ -374,7 +453,7 @@ impl ProcessManager {
             //     panic!()
             // }
 
-            ALL_PROCESS.lock().as_mut().unwrap().remove(&pid);
+            ALL_PROCESS.remove(pid.data());
         }
     }
 
@@ -517,6 +596,29 @@ bitflags! {
         const SIGNALED = 1 << 6;
         /// 进程需要迁移到其他cpu上
         const NEED_MIGRATE = 1 << 7;
+        /// 进程是正在执行work的绑定cpu的worker，睡眠时需要通知工作队列
+        const WQ_WORKER = 1 << 8;
+        /// 进程的系统调用正在被跟踪，见[`crate::syscall::trace`]
+        const SYSCALL_TRACE = 1 << 9;
+        /// 进程注册了rseq，并且在返回用户态之前需要检查临界区、更新cpu号，见[`rseq`]
+        const RSEQ_RESUME = 1 << 10;
+    }
+}
+
+/// 对当前进程pcb的借用（见[`ProcessManager::current`]）
+///
+/// 只包含一个裸指针，不持有引用计数。它不能跨进程传递（不实现Send/Sync），
+/// 因此在持有它的代码运行期间，pcb所在的内核栈（以及pcb本身）一定不会被释放
+pub struct CurrentPcb {
+    ptr: *const ProcessControlBlock,
+}
+
+impl core::ops::Deref for CurrentPcb {
+    type Target = ProcessControlBlock;
+
+    #[inline(always)]
+    fn deref(&self) -> &Self::Target {
+        return unsafe { &*self.ptr };
     }
 }
 
@@ -533,6 +635,8 @@ pub struct ProcessControlBlock {
 
     flags: LockFreeFlags<ProcessFlags>,
     worker_private: SpinLock<Option<WorkerPrivate>>,
+    /// 进程塞住的块设备请求队列
+    blk_plug: SpinLock<BlkPlugState>,
     /// 进程的内核栈
     kernel_stack: RwLock<KernelStack>,
 
@@ -545,8 +649,13 @@ pub struct ProcessControlBlock {
     arch_info: SpinLock<ArchPCBInfo>,
     /// 与信号处理相关的信息(似乎可以是无锁的)
     sig_info: RwLock<ProcessSignalInfo>,
+    /// 待处理信号的位图（sig_info中sig_pending与sig_shared_pending的并集）的副本，不加锁就可以读取。
+    /// 只在持有sig_info的写锁时修改，见[`crate::ipc::signal::recalc_sigpending`]
+    sig_pending_mask: AtomicU64,
     /// 信号处理结构体
     sig_struct: SpinLock<SignalStruct>,
+    /// 在signalfd上等待这个进程的信号的读者，有信号到达时被唤醒
+    signalfd_wait: Arc<WaitQueue>,
     /// 退出信号S
     exit_signal: AtomicSignal,
 
@@ -563,6 +672,18 @@ pub struct ProcessControlBlock {
 
     /// 线程信息
     thread: RwLock<ThreadInfo>,
+
+    /// 进程的POSIX定时器（只使用线程组leader的）
+    posix_timers: SpinLock<PosixTimers>,
+
+    /// 系统调用跟踪的环形缓冲区，第一次打开跟踪时创建
+    syscall_trace: SpinLock<Option<Arc<SyscallTraceRing>>>,
+
+    /// 注册的rseq
+    rseq: RseqState,
+
+    /// 用户态、内核态时间
+    cputime: TaskCputime,
 }
 
 impl ProcessControlBlock {
@@ -576,7 +697,7 @@ impl ProcessControlBlock {
     /// ## 返回值
     ///
     /// 返回一个新的pcb
-    pub fn new(name: String, kstack: KernelStack) -> Arc<Self> {
+    pub fn new(name: String, kstack: KernelStack) -> Result<Arc<Self>, SystemError> {
         return Self::do_create_pcb(name, kstack, false);
     }
 
@@ -585,15 +706,19 @@ impl ProcessControlBlock {
     /// 请注意，这个函数只能在进程管理初始化的时候调用。
     pub fn new_idle(cpu_id: u32, kstack: KernelStack) -> Arc<Self> {
         let name = format!("idle-{}", cpu_id);
-        return Self::do_create_pcb(name, kstack, true);
+        return Self::do_create_pcb(name, kstack, true).unwrap();
     }
 
-    fn do_create_pcb(name: String, kstack: KernelStack, is_idle: bool) -> Arc<Self> {
+    fn do_create_pcb(
+        name: String,
+        kstack: KernelStack,
+        is_idle: bool,
+    ) -> Result<Arc<Self>, SystemError> {
         let (pid, ppid, cwd) = if is_idle {
             (Pid(0), Pid(0), "/".to_string())
         } else {
             (
-                Self::generate_pid(),
+                Self::generate_pid()?,
                 ProcessManager::current_pcb().pid(),
                 ProcessManager::current_pcb().basic().cwd(),
             )
@@ -619,16 +744,23 @@ impl ProcessControlBlock {
             kernel_stack: RwLock::new(kstack),
             syscall_stack: RwLock::new(KernelStack::new().unwrap()),
             worker_private: SpinLock::new(None),
+            blk_plug: SpinLock::new(BlkPlugState::default()),
             sched_info,
             arch_info,
             sig_info: RwLock::new(ProcessSignalInfo::default()),
+            sig_pending_mask: AtomicU64::new(0),
             sig_struct: SpinLock::new(SignalStruct::default()),
+            signalfd_wait: Arc::new(WaitQueue::INIT),
             exit_signal: AtomicSignal::new(Signal::SIGCHLD),
             parent_pcb: RwLock::new(ppcb.clone()),
             real_parent_pcb: RwLock::new(ppcb),
             children: RwLock::new(Vec::new()),
             wait_queue: WaitQueue::INIT,
             thread: RwLock::new(ThreadInfo::new()),
+            posix_timers: SpinLock::new(PosixTimers::default()),
+            syscall_trace: SpinLock::new(None),
+            rseq: RseqState::default(),
+            cputime: TaskCputime::default(),
         };
 
         // 初始化系统调用栈
@@ -661,32 +793,43 @@ impl ProcessControlBlock {
             }
         }
 
-        return pcb;
+        return Ok(pcb);
     }
 
-    /// 生成一个新的pid
+    /// 分配一个新的pid。所有的pid都已经被使用时返回EAGAIN
     #[inline(always)]
-    fn generate_pid() -> Pid {
-        static NEXT_PID: AtomicPid = AtomicPid::new(Pid(1));
-        return NEXT_PID.fetch_add(Pid(1), Ordering::SeqCst);
+    fn generate_pid() -> Result<Pid, SystemError> {
+        // 关中断，避免持有分配器的锁时被抢占，或者被中断中释放pcb的操作打断
+        let _irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+        return PID_ALLOCATOR
+            .alloc()
+            .map(Pid::new)
+            .ok_or(SystemError::EAGAIN_OR_EWOULDBLOCK);
     }
 
     /// 返回当前进程的锁持有计数
     #[inline(always)]
     pub fn preempt_count(&self) -> usize {
-        return self.preempt_count.load(Ordering::SeqCst);
+        return self.preempt_count.load(Ordering::Relaxed);
     }
 
     /// 增加当前进程的锁持有计数
+    ///
+    /// 计数只会被进程自己（以及打断它的中断处理程序）修改，而中断处理程序对计数的修改总是成对的，
+    /// 因此这里用普通的读写代替带lock前缀的原子加减
     #[inline(always)]
     pub fn preempt_disable(&self) {
-        self.preempt_count.fetch_add(1, Ordering::SeqCst);
+        let count = self.preempt_count.load(Ordering::Relaxed);
+        self.preempt_count.store(count + 1, Ordering::Relaxed);
+        compiler_fence(Ordering::SeqCst);
     }
 
     /// 减少当前进程的锁持有计数
     #[inline(always)]
     pub fn preempt_enable(&self) {
-        self.preempt_count.fetch_sub(1, Ordering::SeqCst);
+        compiler_fence(Ordering::SeqCst);
+        let count = self.preempt_count.load(Ordering::Relaxed);
+        self.preempt_count.store(count - 1, Ordering::Relaxed);
     }
 
     #[inline(always)]
@@ -785,6 +928,11 @@ impl ProcessControlBlock {
         return self.worker_private.lock();
     }
 
+    #[inline(always)]
+    pub fn blk_plug(&self) -> SpinLockGuard<BlkPlugState> {
+        return self.blk_plug.lock();
+    }
+
     #[inline(always)]
     pub fn pid(&self) -> Pid {
         return self.pid;
@@ -859,6 +1007,27 @@ impl ProcessControlBlock {
         self.sig_info.read()
     }
 
+    /// 是否有待处理的信号（包括被屏蔽的信号）。不需要获取sig_info的锁
+    #[inline(always)]
+    pub fn has_pending_signal(&self) -> bool {
+        return self.sig_pending_mask.load(Ordering::Acquire) != 0;
+    }
+
+    /// `sig`中是否有信号正在等待处理。不需要获取sig_info的锁
+    #[inline(always)]
+    pub fn sig_is_pending(&self, sig: SigSet) -> bool {
+        return self.sig_pending_mask.load(Ordering::Acquire) & sig.bits() != 0;
+    }
+
+    pub(crate) fn sig_pending_mask(&self) -> &AtomicU64 {
+        &self.sig_pending_mask
+    }
+
+    #[inline(always)]
+    pub fn signalfd_wait(&self) -> &Arc<WaitQueue> {
+        return &self.signalfd_wait;
+    }
+
     pub fn sig_info_irqsave(&self) -> RwLockReadGuard<ProcessSignalInfo> {
         self.sig_info.read_irqsave()
     }
@@ -891,6 +1060,26 @@ impl ProcessControlBlock {
         self.sig_struct.lock()
     }
 
+    #[inline(always)]
+    pub fn posix_timers(&self) -> &SpinLock<PosixTimers> {
+        return &self.posix_timers;
+    }
+
+    #[inline(always)]
+    pub fn syscall_trace(&self) -> &SpinLock<Option<Arc<SyscallTraceRing>>> {
+        return &self.syscall_trace;
+    }
+
+    #[inline(always)]
+    pub fn rseq(&self) -> &RseqState {
+        return &self.rseq;
+    }
+
+    #[inline(always)]
+    pub fn cputime(&self) -> &TaskCputime {
+        return &self.cputime;
+    }
+
     pub fn try_sig_struct_irq(&self, times: u8) -> Option<SpinLockGuard<SignalStruct>> {
         for _ in 0..times {
             if let Ok(r) = self.sig_struct.try_lock_irqsave() {
@@ -911,10 +1100,17 @@ impl Drop for ProcessControlBlock {
         // 在ProcFS中,解除进程的注册
         procfs_unregister_pid(self.pid())
             .unwrap_or_else(|e| panic!("procfs_unregister_pid failed: error: {e:?}"));
+        syscall_trace_release(self);
 
         if let Some(ppcb) = self.parent_pcb.read().upgrade() {
             ppcb.children.write().drain_filter(|pid| *pid == self.pid());
         }
+
+        // pcb被释放之后，它的pid才能被复用（idle进程的pid 0不是分配得到的）
+        if self.pid != Pid(0) {
+            let _irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+            PID_ALLOCATOR.free(self.pid.data());
+        }
     }
 }
 
@@ -1044,6 +1240,20 @@ pub struct ProcessSchedulerInfo {
     virtual_runtime: AtomicIsize,
     /// 由实时调度器管理的时间片
     rt_time_slice: AtomicIsize,
+    /// 进程最近一次被切换出cpu的时间（单位：jiffies），用于判断它的缓存是否还是热的
+    last_ran: AtomicU64,
+    /// 允许进程运行的cpu
+    cpus_allowed: AtomicCpuMask,
+    /// 调度统计信息
+    sched_stat: TaskSchedStat,
+    /// 优先级继承：阻塞在这个进程持有的PI futex上的进程，以及它们的调度策略和优先级
+    pi_donors: Vec<(Pid, SchedPolicy, SchedPriority)>,
+    /// 优先级继承：被提升优先级之前的调度策略和优先级（没有被提升时为None）
+    pi_base: Option<(SchedPolicy, SchedPriority)>,
+    /// 定时器松弛量（单位：纳秒）：进程的定时器允许被推迟这么久，以便与其他定时器合并
+    timer_slack_ns: AtomicU64,
+    /// 进程所在的任务组
+    task_group: Arc<TaskGroup>,
 }
 
 impl ProcessSchedulerInfo {
@@ -1052,15 +1262,26 @@ impl ProcessSchedulerInfo {
             Some(cpu_id) => cpu_id as i32,
             None => -1,
         };
-        return RwLock::new(Self {
+        let info = RwLock::new(Self {
             on_cpu: AtomicI32::new(cpu_id),
             migrate_to: AtomicI32::new(-1),
             state: ProcessState::Blocked(false),
             sched_policy: SchedPolicy::CFS,
             virtual_runtime: AtomicIsize::new(0),
             rt_time_slice: AtomicIsize::new(0),
-            priority: SchedPriority::new(100).unwrap(),
+            last_ran: AtomicU64::new(0),
+            cpus_allowed: AtomicCpuMask::new(),
+            sched_stat: TaskSchedStat::default(),
+            pi_donors: Vec::new(),
+            pi_base: None,
+            timer_slack_ns: AtomicU64::new(DEFAULT_TIMER_SLACK_NS),
+            priority: SchedPriority::new(SchedPriority::DEFAULT).unwrap(),
+            task_group: root_task_group(),
         });
+        info.read().task_group.task_attach();
+        // 默认允许在所有没有被隔离的cpu上运行
+        info.read().cpus_allowed.store_words(&housekeeping_mask());
+        return info;
     }
 
     pub fn on_cpu(&self) -> Option<u32> {
@@ -1109,6 +1330,71 @@ impl ProcessSchedulerInfo {
         return self.sched_policy;
     }
 
+    pub fn set_policy(&mut self, policy: SchedPolicy, priority: SchedPriority) {
+        if self.pi_base.is_some() {
+            // 优先级被临时提升时，修改的是提升之前的值
+            self.pi_base = Some((policy, priority));
+            self.pi_update();
+            return;
+        }
+        self.sched_policy = policy;
+        self.priority = priority;
+    }
+
+    /// 优先级继承：`donor`阻塞在这个进程持有的PI futex上，
+    /// 如果它的优先级更高，这个进程就以它的调度策略和优先级运行，直到释放锁
+    ///
+    /// 返回这个进程的调度策略或者优先级是否发生了变化
+    pub fn pi_donate(&mut self, donor: Pid, policy: SchedPolicy, priority: SchedPriority) -> bool {
+        self.pi_donors.retain(|(pid, _, _)| *pid != donor);
+        self.pi_donors.push((donor, policy, priority));
+        return self.pi_update();
+    }
+
+    /// 优先级继承：`donor`不再等待这个进程持有的锁
+    ///
+    /// 返回这个进程的调度策略或者优先级是否发生了变化
+    pub fn pi_revoke(&mut self, donor: Pid) -> bool {
+        let len = self.pi_donors.len();
+        self.pi_donors.retain(|(pid, _, _)| *pid != donor);
+        if self.pi_donors.len() == len {
+            return false;
+        }
+        return self.pi_update();
+    }
+
+    /// 根据等待者中优先级最高的一个，重新计算进程的调度策略和优先级
+    fn pi_update(&mut self) -> bool {
+        let base = self.pi_base.unwrap_or((self.sched_policy, self.priority));
+        let best = self
+            .pi_donors
+            .iter()
+            .min_by_key(|(_, policy, priority)| sched_pi_rank(*policy, *priority))
+            .copied();
+        let (policy, priority) = match best {
+            Some((_, policy, priority))
+                if sched_pi_rank(policy, priority) < sched_pi_rank(base.0, base.1) =>
+            {
+                self.pi_base = Some(base);
+                // 从CFS进程继承的是nice值，不继承SCHED_BATCH的行为
+                let policy = if policy.is_fair() {
+                    SchedPolicy::CFS
+                } else {
+                    policy
+                };
+                (policy, priority)
+            }
+            _ => {
+                self.pi_base = None;
+                base
+            }
+        };
+        let changed = policy != self.sched_policy || priority != self.priority;
+        self.sched_policy = policy;
+        self.priority = priority;
+        return changed;
+    }
+
     pub fn virtual_runtime(&self) -> isize {
         return self.virtual_runtime.load(Ordering::SeqCst);
     }
@@ -1136,6 +1422,60 @@ impl ProcessSchedulerInfo {
     pub fn priority(&self) -> SchedPriority {
         return self.priority;
     }
+
+    pub fn last_ran(&self) -> u64 {
+        return self.last_ran.load(Ordering::SeqCst);
+    }
+
+    pub fn set_last_ran(&self, jiffies: u64) {
+        self.last_ran.store(jiffies, Ordering::SeqCst);
+    }
+
+    /// 定时器松弛量（单位：纳秒）
+    pub fn timer_slack_ns(&self) -> u64 {
+        return self.timer_slack_ns.load(Ordering::Relaxed);
+    }
+
+    pub fn set_timer_slack_ns(&self, slack_ns: u64) {
+        self.timer_slack_ns.store(slack_ns, Ordering::Relaxed);
+    }
+
+    /// 允许进程运行的cpu
+    #[inline(always)]
+    pub fn cpus_allowed(&self) -> &AtomicCpuMask {
+        return &self.cpus_allowed;
+    }
+
+    /// 调度统计信息
+    #[inline(always)]
+    pub fn sched_stat(&self) -> &TaskSchedStat {
+        return &self.sched_stat;
+    }
+
+    /// 进程是否允许在指定的cpu上运行
+    #[inline(always)]
+    pub fn cpu_allowed(&self, cpu_id: u32) -> bool {
+        return self.cpus_allowed.get(cpu_id as usize);
+    }
+
+    /// 进程所在的任务组
+    #[inline(always)]
+    pub fn task_group(&self) -> &Arc<TaskGroup> {
+        return &self.task_group;
+    }
+
+    /// 把进程移动到另一个任务组。已经记账的内存仍然属于原来的任务组
+    pub fn set_task_group(&mut self, group: Arc<TaskGroup>) {
+        group.task_attach();
+        let old = core::mem::replace(&mut self.task_group, group);
+        old.task_detach();
+    }
+}
+
+impl Drop for ProcessSchedulerInfo {
+    fn drop(&mut self) {
+        self.task_group.task_detach();
+    }
 }
 
 #[derive(Debug, Clone)]
@@ -1150,10 +1490,12 @@ impl KernelStack {
     pub const ALIGN: usize = 0x4000;
 
     pub fn new() -> Result<Self, SystemError> {
+        let stack = match KERNEL_STACK_POOL.lock_irqsave().pop() {
+            Some(stack) => stack,
+            None => AlignedBox::<[u8; KernelStack::SIZE], { KernelStack::ALIGN }>::new_zeroed()?,
+        };
         return Ok(Self {
-            stack: Some(
-                AlignedBox::<[u8; KernelStack::SIZE], { KernelStack::ALIGN }>::new_zeroed()?,
-            ),
+            stack: Some(stack),
             can_be_freed: true,
         });
     }
@@ -1244,20 +1586,86 @@ impl KernelStack {
 impl Drop for KernelStack {
     fn drop(&mut self) {
         if !self.stack.is_none() {
-            let pcb_ptr: Weak<ProcessControlBlock> = unsafe {
-                Weak::from_raw(self.stack.as_ref().unwrap().as_ptr() as *const ProcessControlBlock)
-            };
-            drop(pcb_ptr);
+            unsafe { self.clear_pcb(false) };
         }
         // 如果该内核栈不可以被释放，那么，这里就forget，不调用AlignedBox的drop函数
         if !self.can_be_freed {
             let bx = self.stack.take();
             core::mem::forget(bx);
+        } else if let Some(stack) = self.stack.take() {
+            // 内核栈最低地址处的pcb指针已经被清空，可以直接放回缓存池中复用
+            // 缓存池已满时，在释放锁之后再释放这个内核栈
+            let r = KERNEL_STACK_POOL.lock_irqsave().push(stack);
+            drop(r);
+        }
+    }
+}
+
+type KernelStackBox = AlignedBox<[u8; KernelStack::SIZE], { KernelStack::ALIGN }>;
+
+/// 空闲内核栈的缓存池
+///
+/// 创建进程和内核线程时，每个pcb都需要两个内核栈。进程退出后，它的内核栈会被放回这里，
+/// 下次创建进程时直接复用，省去了分配并清零16K内存的开销，并且复用的内核栈大概率还在缓存中。
+static KERNEL_STACK_POOL: SpinLock<KernelStackPool> = SpinLock::new(KernelStackPool::new());
+
+#[derive(Debug)]
+struct KernelStackPool {
+    count: usize,
+    stacks: [Option<KernelStackBox>; KernelStackPool::CAPACITY],
+}
+
+impl KernelStackPool {
+    /// 缓存池最多缓存的内核栈数量
+    const CAPACITY: usize = 32;
+    /// 初始化时预先分配的内核栈数量
+    const PREALLOC: usize = 8;
+
+    const fn new() -> Self {
+        return Self {
+            count: 0,
+            stacks: [const { None }; KernelStackPool::CAPACITY],
+        };
+    }
+
+    fn pop(&mut self) -> Option<KernelStackBox> {
+        if self.count == 0 {
+            return None;
+        }
+        self.count -= 1;
+        return self.stacks[self.count].take();
+    }
+
+    /// 把内核栈放回缓存池
+    ///
+    /// 调用者需要保证内核栈最低地址处的pcb指针为null。如果缓存池已满，则返回这个内核栈
+    fn push(&mut self, stack: KernelStackBox) -> Result<(), KernelStackBox> {
+        if self.count == Self::CAPACITY {
+            return Err(stack);
+        }
+        self.stacks[self.count] = Some(stack);
+        self.count += 1;
+        return Ok(());
+    }
+
+    /// 预先分配一些内核栈，放入缓存池
+    fn prealloc() {
+        for _ in 0..Self::PREALLOC {
+            let stack = match KernelStackBox::new_zeroed() {
+                Ok(stack) => stack,
+                Err(_) => break,
+            };
+            if KERNEL_STACK_POOL.lock_irqsave().push(stack).is_err() {
+                break;
+            }
         }
     }
 }
 
 pub fn process_init() {
+    // 第一个进程的cpu亲和性取决于被隔离的cpu
+    isolation_init();
+    KernelStackPool::prealloc();
     ProcessManager::init();
 }
 
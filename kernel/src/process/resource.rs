@@ -1,16 +1,33 @@
 use num_traits::FromPrimitive;
 
-use crate::{syscall::SystemError, time::TimeSpec};
+use crate::{sched::cputime::task_cputime, syscall::SystemError, time::NSEC_PER_SEC};
 
 use super::ProcessControlBlock;
 
+/// rusage中的时间（`struct timeval`，x86_64上两个字段都是64位）
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+#[repr(C)]
+pub struct RUsageTimeval {
+    pub tv_sec: i64,
+    pub tv_usec: i64,
+}
+
+impl RUsageTimeval {
+    pub fn from_ns(ns: u64) -> Self {
+        return Self {
+            tv_sec: (ns / NSEC_PER_SEC as u64) as i64,
+            tv_usec: ((ns % NSEC_PER_SEC as u64) / 1000) as i64,
+        };
+    }
+}
+
 #[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
 #[repr(C)]
 pub struct RUsage {
     /// User time used
-    pub ru_utime: TimeSpec,
+    pub ru_utime: RUsageTimeval,
     /// System time used
-    pub ru_stime: TimeSpec,
+    pub ru_stime: RUsageTimeval,
 
     // 以下是linux的rusage结构体扩展
     /// Maximum resident set size
@@ -83,6 +100,13 @@ pub struct RLimit64 {
     pub rlim_max: u64,
 }
 
+/// RLIMIT_NOFILE的默认软限制
+pub const INR_OPEN_CUR: u64 = 1024;
+/// RLIMIT_NOFILE的默认硬限制
+pub const INR_OPEN_MAX: u64 = 4096;
+/// RLIMIT_NOFILE的硬限制能够设置的最大值
+pub const NR_OPEN: u64 = 1024 * 1024;
+
 /// Resource limit IDs
 ///
 /// ## Note
@@ -139,11 +163,21 @@ impl TryFrom<usize> for RLimitID {
 impl ProcessControlBlock {
     /// 获取进程资源使用情况
     ///
-    /// ## TODO
-    ///
-    /// 当前函数尚未实现，只是返回了一个默认的RUsage结构体
-    pub fn get_rusage(&self, _who: RUsageWho) -> Option<RUsage> {
-        let rusage = RUsage::default();
+    /// 目前只统计了用户态、内核态时间（见[`crate::sched::cputime`]）。
+    /// 由于没有线程组，RUSAGE_SELF与RUSAGE_THREAD相同
+    pub fn get_rusage(&self, who: RUsageWho) -> Option<RUsage> {
+        let t = task_cputime(self);
+        let (utime, stime) = match who {
+            RUsageWho::RUsageSelf | RUsageWho::RusageThread => (t.utime, t.stime),
+            RUsageWho::RUsageChildren => (t.cutime, t.cstime),
+            RUsageWho::RUsageBoth => (t.utime + t.cutime, t.stime + t.cstime),
+        };
+
+        let rusage = RUsage {
+            ru_utime: RUsageTimeval::from_ns(utime),
+            ru_stime: RUsageTimeval::from_ns(stime),
+            ..Default::default()
+        };
 
         Some(rusage)
     }
@@ -0,0 +1,283 @@
+//! 可重启序列（rseq）
+//!
+//! 进程通过rseq系统调用注册一个`struct rseq`（布局与Linux的ABI相同），之后内核在它返回用户态之前，
+//! 如果它在上次返回用户态之后被抢占（包括被迁移到其他cpu）或者正在处理信号，就：
+//!
+//! - 检查`rseq_cs`指向的临界区描述符，如果被打断的位置位于临界区内，把返回地址改为临界区的abort_ip
+//! - 把当前的cpu号写入`cpu_id_start`和`cpu_id`，把节点号写入`node_id`
+//!
+//! 用户程序因此可以不使用原子指令，仅依靠“临界区的最后一条指令提交修改”来更新每cpu的数据：
+//! 只要临界区没有执行完就被打断，它就会从abort_ip重新开始。
+//!
+//! 需要检查的进程带有[`ProcessFlags::RSEQ_RESUME`]标志。这个内核没有统一的“返回用户态”的工作循环，
+//! 因此检查位于系统调用的返回路径，以及中断、异常的返回路径（do_signal）。
+
+use core::{
+    intrinsics::likely,
+    mem::size_of,
+    sync::atomic::{AtomicU32, AtomicUsize, Ordering},
+};
+
+use crate::{
+    arch::{interrupt::TrapFrame, ipc::signal::Signal, CurrentIrqArch},
+    exception::InterruptArch,
+    mm::numa::cpu_to_node,
+    smp::core::smp_get_processor_id,
+    syscall::{
+        user_access::{UserBufferReader, UserBufferWriter},
+        Syscall, SystemError,
+    },
+};
+
+use super::{ProcessControlBlock, ProcessFlags, ProcessManager};
+
+/// `struct rseq`的大小，同时也是它的对齐要求
+const RSEQ_AREA_SIZE: u32 = 32;
+/// 注销已经注册的rseq
+const RSEQ_FLAG_UNREGISTER: u32 = 1;
+/// 没有注册rseq时，`cpu_id`字段的值
+const RSEQ_CPU_ID_UNINITIALIZED: u32 = u32::MAX;
+
+/// `struct rseq`中各个字段的偏移量
+const RSEQ_CPU_ID_START_OFFSET: usize = 0;
+const RSEQ_CPU_ID_OFFSET: usize = 4;
+const RSEQ_CS_OFFSET: usize = 8;
+const RSEQ_NODE_ID_OFFSET: usize = 20;
+const RSEQ_MM_CID_OFFSET: usize = 24;
+
+/// 临界区描述符（`struct rseq_cs`）
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+struct RseqCs {
+    version: u32,
+    flags: u32,
+    start_ip: u64,
+    post_commit_offset: u64,
+    abort_ip: u64,
+}
+
+/// 进程注册的rseq
+#[derive(Debug, Default)]
+pub struct RseqState {
+    /// 用户空间中的`struct rseq`的地址，为0表示没有注册
+    area: AtomicUsize,
+    len: AtomicU32,
+    /// abort_ip之前的4个字节必须等于这个签名，防止把任意地址当作abort_ip
+    sig: AtomicU32,
+}
+
+impl RseqState {
+    #[inline(always)]
+    pub fn area(&self) -> usize {
+        return self.area.load(Ordering::Relaxed);
+    }
+
+    #[inline(always)]
+    pub fn registered(&self) -> bool {
+        return self.area() != 0;
+    }
+
+    fn set(&self, area: usize, len: u32, sig: u32) {
+        self.len.store(len, Ordering::Relaxed);
+        self.sig.store(sig, Ordering::Relaxed);
+        self.area.store(area, Ordering::Relaxed);
+    }
+
+    fn clear(&self) {
+        self.set(0, 0, 0);
+    }
+
+    /// fork时复制父进程的注册（共享地址空间的线程不会继承）
+    pub fn inherit_from(&self, parent: &RseqState) {
+        self.set(
+            parent.area(),
+            parent.len.load(Ordering::Relaxed),
+            parent.sig.load(Ordering::Relaxed),
+        );
+    }
+
+    /// exec时注销（新的地址空间中，原来的地址已经没有意义）
+    pub fn on_exec(&self) {
+        self.clear();
+    }
+}
+
+impl Syscall {
+    /// 注册或者注销当前线程的rseq（与Linux的rseq兼容）
+    ///
+    /// ## 参数
+    ///
+    /// - `rseq`：用户空间中的`struct rseq`的地址，需要按照32字节对齐
+    /// - `len`：`struct rseq`的大小，只支持32
+    /// - `flags`：为0表示注册，为RSEQ_FLAG_UNREGISTER表示注销
+    /// - `sig`：abort_ip之前的签名，注销时需要与注册时相同
+    ///
+    /// ## 返回值
+    ///
+    /// 已经注册时再次注册，返回EBUSY；注销时签名不一致，返回EPERM
+    pub fn rseq(rseq: usize, len: u32, flags: u32, sig: u32) -> Result<usize, SystemError> {
+        let pcb = ProcessManager::current_pcb();
+        let state = pcb.rseq();
+
+        if flags & RSEQ_FLAG_UNREGISTER != 0 {
+            if flags & !RSEQ_FLAG_UNREGISTER != 0 {
+                return Err(SystemError::EINVAL);
+            }
+            if !state.registered()
+                || state.area() != rseq
+                || state.len.load(Ordering::Relaxed) != len
+            {
+                return Err(SystemError::EINVAL);
+            }
+            if state.sig.load(Ordering::Relaxed) != sig {
+                return Err(SystemError::EPERM);
+            }
+            rseq_reset_cpu_id(rseq)?;
+            state.clear();
+            return Ok(0);
+        }
+
+        if flags != 0 {
+            return Err(SystemError::EINVAL);
+        }
+        if state.registered() {
+            if state.area() != rseq || state.len.load(Ordering::Relaxed) != len {
+                return Err(SystemError::EINVAL);
+            }
+            if state.sig.load(Ordering::Relaxed) != sig {
+                return Err(SystemError::EPERM);
+            }
+            return Err(SystemError::EBUSY);
+        }
+        if rseq & (RSEQ_AREA_SIZE as usize - 1) != 0 || len != RSEQ_AREA_SIZE {
+            return Err(SystemError::EINVAL);
+        }
+        // 检查这段用户内存是否可以访问
+        UserBufferWriter::new(rseq as *mut u8, len as usize, true)?;
+
+        state.set(rseq, len, sig);
+        // 在返回用户态之前写入cpu号
+        pcb.flags().insert(ProcessFlags::RSEQ_RESUME);
+        return Ok(0);
+    }
+}
+
+/// 进程被切换出去时调用（需要关中断）
+#[inline(always)]
+pub fn rseq_preempt(pcb: &ProcessControlBlock) {
+    if pcb.rseq().registered() {
+        pcb.flags().insert(ProcessFlags::RSEQ_RESUME);
+    }
+}
+
+/// 返回用户态之前调用（需要关中断，返回时仍然是关中断的）
+///
+/// 访问用户内存时可能缺页，因此处理时需要开中断。处理完毕后重新关中断并再次检查标志位，
+/// 避免在开中断期间被抢占、迁移之后，带着过期的cpu号返回用户态。
+pub fn rseq_exit_to_user(frame: &mut TrapFrame) {
+    loop {
+        let pcb = ProcessManager::current_pcb();
+        if likely(!pcb.flags().contains(ProcessFlags::RSEQ_RESUME)) {
+            return;
+        }
+        pcb.flags().remove(ProcessFlags::RSEQ_RESUME);
+        drop(pcb);
+
+        unsafe { CurrentIrqArch::interrupt_enable() };
+        rseq_handle_notify_resume(frame);
+        unsafe { CurrentIrqArch::interrupt_disable() };
+    }
+}
+
+/// 为用户态的信号处理函数设置栈帧之前调用
+///
+/// 信号处理函数返回后会回到栈帧中保存的地址，因此需要在设置栈帧之前中止被打断的临界区
+pub fn rseq_signal_deliver(frame: &mut TrapFrame) {
+    rseq_handle_notify_resume(frame);
+}
+
+fn rseq_handle_notify_resume(frame: &mut TrapFrame) {
+    let pcb = ProcessManager::current_pcb();
+    let state = pcb.rseq();
+    if !state.registered() {
+        return;
+    }
+
+    let r = rseq_ip_fixup(state, frame).and_then(|_| rseq_update_cpu_id(state.area()));
+    if r.is_err() {
+        // 用户程序提供了非法的struct rseq或者临界区描述符
+        let _ = Syscall::kill(pcb.pid(), Signal::SIGSEGV as i32);
+    }
+}
+
+/// 如果被打断的位置位于临界区内，把返回地址改为abort_ip
+fn rseq_ip_fixup(state: &RseqState, frame: &mut TrapFrame) -> Result<(), SystemError> {
+    let area = state.area();
+    let cs_ptr: u64 = get_user(area + RSEQ_CS_OFFSET)?;
+    if cs_ptr == 0 {
+        return Ok(());
+    }
+
+    let cs: RseqCs = get_user(cs_ptr as usize)?;
+    let end_ip = cs
+        .start_ip
+        .checked_add(cs.post_commit_offset)
+        .ok_or(SystemError::EINVAL)?;
+    // abort_ip不能位于临界区内，否则中止后会再次进入临界区
+    if cs.version != 0 || (cs.abort_ip >= cs.start_ip && cs.abort_ip < end_ip) {
+        return Err(SystemError::EINVAL);
+    }
+
+    let ip = frame.rip;
+    if ip < cs.start_ip || ip >= end_ip {
+        // 已经离开了临界区，清除描述符，下次不需要再读取它
+        return put_user(area + RSEQ_CS_OFFSET, 0u64);
+    }
+
+    let sig: u32 = get_user(
+        cs.abort_ip
+            .checked_sub(size_of::<u32>() as u64)
+            .ok_or(SystemError::EINVAL)? as usize,
+    )?;
+    if sig != state.sig.load(Ordering::Relaxed) {
+        return Err(SystemError::EINVAL);
+    }
+
+    put_user(area + RSEQ_CS_OFFSET, 0u64)?;
+    frame.rip = cs.abort_ip;
+    return Ok(());
+}
+
+/// 把当前的cpu号和节点号写入用户空间
+fn rseq_update_cpu_id(area: usize) -> Result<(), SystemError> {
+    let cpu = smp_get_processor_id();
+    let node = cpu_to_node(cpu as usize) as u32;
+    put_user(area + RSEQ_CPU_ID_START_OFFSET, cpu)?;
+    put_user(area + RSEQ_CPU_ID_OFFSET, cpu)?;
+    put_user(area + RSEQ_NODE_ID_OFFSET, node)?;
+    // 没有实现按照地址空间分配的并发id，使用cpu号（同样满足“同一时刻各不相同”）
+    put_user(area + RSEQ_MM_CID_OFFSET, cpu)?;
+    return Ok(());
+}
+
+/// 注销时，把cpu号恢复为未注册的状态
+fn rseq_reset_cpu_id(area: usize) -> Result<(), SystemError> {
+    put_user(area + RSEQ_CPU_ID_START_OFFSET, 0u32)?;
+    put_user(area + RSEQ_CPU_ID_OFFSET, RSEQ_CPU_ID_UNINITIALIZED)?;
+    put_user(area + RSEQ_NODE_ID_OFFSET, 0u32)?;
+    put_user(area + RSEQ_MM_CID_OFFSET, 0u32)?;
+    return Ok(());
+}
+
+fn get_user<T: Copy + Default>(addr: usize) -> Result<T, SystemError> {
+    let reader = UserBufferReader::new(addr as *const T, size_of::<T>(), true)?;
+    let mut val = T::default();
+    reader.copy_one_from_user(&mut val, 0)?;
+    return Ok(val);
+}
+
+fn put_user<T: Copy>(addr: usize, val: T) -> Result<(), SystemError> {
+    let mut writer = UserBufferWriter::new(addr as *mut T, size_of::<T>(), true)?;
+    writer.copy_one_to_user(&val, 0)?;
+    return Ok(());
+}
@@ -0,0 +1,236 @@
+//! posix_spawn：直接从可执行文件创建新进程
+//!
+//! fork+exec需要先复制父进程的文件描述符表、地址空间，然后在exec时丢弃它们。
+//! spawn在父进程中准备好子进程的文件描述符表（执行file actions），然后让子进程以内核线程的身份开始执行，
+//! 在内核中直接exec目标程序，不会回到父进程的用户代码中，因此不需要复制父进程的地址空间。
+
+use alloc::{boxed::Box, string::String, sync::Arc, vec::Vec};
+
+use crate::{
+    arch::{
+        ipc::signal::{SigSet, Signal},
+        process::arch_switch_to_user,
+    },
+    filesystem::{
+        procfs::procfs_register_pid,
+        vfs::{
+            file::{FileDescriptorVec, FileMode},
+            open::open_file,
+            syscall::ModeType,
+        },
+    },
+    libs::rwlock::RwLock,
+    syscall::{Syscall, SystemError},
+};
+
+use super::{
+    exec::check_binary_file,
+    fork::{CloneFlags, KernelCloneArgs},
+    kthread::{KernelThreadClosure, KernelThreadCreateInfo, KernelThreadMechanism},
+    KernelStack, Pid, ProcessControlBlock, ProcessManager,
+};
+
+/// file action：关闭文件描述符`fd`
+pub const POSIX_SPAWN_CLOSE: u32 = 0;
+/// file action：把`src_fd`复制到`fd`
+pub const POSIX_SPAWN_DUP2: u32 = 1;
+/// file action：以`oflag`、`mode`打开`path`，放到`fd`
+pub const POSIX_SPAWN_OPEN: u32 = 2;
+
+bitflags! {
+    /// posix_spawnattr_t中的标志（与glibc的取值相同）
+    pub struct PosixSpawnFlags: u32 {
+        const POSIX_SPAWN_RESETIDS = 0x01;
+        const POSIX_SPAWN_SETPGROUP = 0x02;
+        const POSIX_SPAWN_SETSIGDEF = 0x04;
+        const POSIX_SPAWN_SETSIGMASK = 0x08;
+        const POSIX_SPAWN_SETSCHEDPARAM = 0x10;
+        const POSIX_SPAWN_SETSCHEDULER = 0x20;
+        const POSIX_SPAWN_USEVFORK = 0x40;
+        const POSIX_SPAWN_SETSID = 0x80;
+    }
+}
+
+/// 用户传入的一个file action，按顺序作用在子进程的文件描述符表上
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct PosixSpawnFileAction {
+    /// POSIX_SPAWN_CLOSE、POSIX_SPAWN_DUP2或者POSIX_SPAWN_OPEN
+    pub action: u32,
+    /// 要操作的文件描述符
+    pub fd: i32,
+    /// dup2的源文件描述符
+    pub src_fd: i32,
+    /// open的打开标志
+    pub oflag: u32,
+    /// open的权限
+    pub mode: u32,
+    pub _pad: u32,
+    /// open的路径
+    pub path: *const u8,
+}
+
+/// 用户传入的spawn属性
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct PosixSpawnAttr {
+    pub flags: u32,
+    pub pgroup: i32,
+    pub sigdefault: u64,
+    pub sigmask: u64,
+}
+
+/// 子进程exec时需要的参数，由子进程取回所有权
+struct SpawnExec {
+    path: String,
+    argv: Vec<String>,
+    envp: Vec<String>,
+}
+
+/// 已经从用户空间复制到内核中的file action
+#[derive(Debug)]
+pub enum SpawnFileAction {
+    Close(i32),
+    Dup2 {
+        src_fd: i32,
+        fd: i32,
+    },
+    Open {
+        fd: i32,
+        path: String,
+        flags: FileMode,
+        mode: ModeType,
+    },
+}
+
+impl SpawnFileAction {
+    /// 在子进程的文件描述符表上执行这个action
+    fn apply(&self, fd_table: &RwLock<FileDescriptorVec>) -> Result<(), SystemError> {
+        match self {
+            Self::Close(fd) => {
+                fd_table.write().drop_fd(*fd)?;
+            }
+            Self::Dup2 { src_fd, fd } => {
+                Syscall::do_dup2(*src_fd, *fd, &mut fd_table.write())?;
+            }
+            Self::Open {
+                fd,
+                path,
+                flags,
+                mode,
+            } => {
+                if !FileDescriptorVec::validate_fd(*fd) {
+                    return Err(SystemError::EBADF);
+                }
+                let file = open_file(path, *flags, *mode)?;
+                let mut guard = fd_table.write();
+                if guard.get_file_by_fd(*fd).is_some() {
+                    guard.drop_fd(*fd)?;
+                }
+                guard.alloc_fd(file, Some(*fd))?;
+            }
+        }
+        return Ok(());
+    }
+}
+
+impl ProcessManager {
+    /// 创建一个执行`path`的新进程
+    ///
+    /// 子进程的文件描述符表是父进程的表去掉设置了FD_CLOEXEC的文件描述符，再依次执行`actions`。
+    /// 文件描述符表在复制时共享同一张表，只有需要修改时才会被复制。
+    /// 子进程不复制父进程的地址空间，它在内核中直接exec目标程序。
+    ///
+    /// ## 返回值
+    ///
+    /// 子进程的pid。文件不存在、不可执行，以及file action失败时返回错误，此时不会创建子进程
+    pub fn spawn(
+        path: String,
+        argv: Vec<String>,
+        envp: Vec<String>,
+        actions: &[SpawnFileAction],
+        sigmask: Option<SigSet>,
+    ) -> Result<Pid, SystemError> {
+        let current_pcb = ProcessManager::current_pcb();
+        let vm = current_pcb.basic().user_vm().ok_or(SystemError::EINVAL)?;
+        check_binary_file(&path, vm)?;
+
+        let fd_table = Arc::new(RwLock::new(current_pcb.fd_table().read().clone()));
+        fd_table.write().close_on_exec();
+        for action in actions {
+            action.apply(&fd_table)?;
+        }
+
+        let name = ProcessControlBlock::generate_name(&path, &argv);
+        let exec = Box::into_raw(Box::new(SpawnExec { path, argv, envp }));
+        let info = KernelThreadCreateInfo::new(
+            KernelThreadClosure::UsizeClosure((Box::new(spawn_bootstrap), exec as usize)),
+            name.clone(),
+        );
+        info.set_to_mark_sleep(false)?;
+
+        let pcb = Self::spawn_pcb(&current_pcb, &info, name).map_err(|e| {
+            // 子进程不会执行，回收exec的参数
+            drop(unsafe { Box::from_raw(exec) });
+            e
+        })?;
+
+        pcb.basic_mut().set_fd_table(Some(fd_table));
+        if let Some(mut sigmask) = sigmask {
+            sigmask.remove(
+                SigSet::from(Signal::SIGKILL.into()) | SigSet::from(Signal::SIGSTOP.into()),
+            );
+            *pcb.sig_info_mut().sig_block_mut() = sigmask;
+        }
+
+        ProcessManager::add_pcb(pcb.clone());
+        // 向procfs注册进程
+        procfs_register_pid(pcb.pid()).unwrap_or_else(|e| {
+            panic!(
+                "spawn: Failed to register pid to procfs, pid: [{:?}]. Error: {:?}",
+                pcb.pid(),
+                e
+            )
+        });
+        ProcessManager::wakeup(&pcb).unwrap_or_else(|e| {
+            panic!(
+                "spawn: Failed to wakeup new process, pid: [{:?}]. Error: {:?}",
+                pcb.pid(),
+                e
+            )
+        });
+
+        return Ok(pcb.pid());
+    }
+
+    /// 创建spawn的子进程的pcb：与父进程共享地址空间（exec时才替换），从内核线程的引导流程开始执行
+    fn spawn_pcb(
+        current_pcb: &Arc<ProcessControlBlock>,
+        info: &Arc<KernelThreadCreateInfo>,
+        name: String,
+    ) -> Result<Arc<ProcessControlBlock>, SystemError> {
+        let pcb = ProcessControlBlock::new(name, KernelStack::new()?)?;
+
+        let create_info = KernelThreadCreateInfo::generate_unsafe_arc_ptr(info.clone());
+        let mut frame = KernelThreadMechanism::bootstrap_trapframe(create_info);
+
+        let mut args = KernelCloneArgs::new();
+        args.flags = CloneFlags::CLONE_VM;
+        args.exit_signal = Signal::SIGCHLD;
+        args.kthread = true;
+        Self::copy_process(current_pcb, &pcb, args, &mut frame).map_err(|e| {
+            // 子进程不会执行，减少create_info的引用计数
+            unsafe { KernelThreadCreateInfo::parse_unsafe_arc_ptr(create_info) };
+            e
+        })?;
+
+        return Ok(pcb);
+    }
+}
+
+/// spawn的子进程在内核中执行的第一个函数：取回exec的参数，切换到用户态执行目标程序
+fn spawn_bootstrap(exec: usize) -> i32 {
+    let exec = unsafe { Box::from_raw(exec as *mut SpawnExec) };
+    let SpawnExec { path, argv, envp } = *exec;
+    unsafe { arch_switch_to_user(path, argv, envp) };
+}
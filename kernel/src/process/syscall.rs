@@ -7,26 +7,37 @@ use alloc::{
 };
 
 use super::{
-    abi::WaitOption,
+    abi::{WaitOption, PR_GET_TIMERSLACK, PR_SET_TIMERSLACK},
     exit::kernel_wait4,
     fork::{CloneFlags, KernelCloneArgs},
     resource::{RLimit64, RLimitID, RUsage, RUsageWho},
+    spawn::{
+        PosixSpawnAttr, PosixSpawnFileAction, PosixSpawnFlags, SpawnFileAction, POSIX_SPAWN_CLOSE,
+        POSIX_SPAWN_DUP2, POSIX_SPAWN_OPEN,
+    },
     KernelStack, Pid, ProcessManager,
 };
 use crate::{
-    arch::{interrupt::TrapFrame, MMArch},
+    arch::{
+        interrupt::TrapFrame,
+        ipc::signal::{SigSet, Signal},
+        MMArch,
+    },
     filesystem::{
         procfs::procfs_register_pid,
-        vfs::{file::FileDescriptorVec, MAX_PATHLEN},
+        vfs::{file::FileMode, syscall::ModeType, MAX_PATHLEN},
     },
     include::bindings::bindings::verify_area,
     mm::{ucontext::UserStack, MemoryManagementArch, VirtAddr},
     process::ProcessControlBlock,
     sched::completion::Completion,
     syscall::{
-        user_access::{check_and_clone_cstr, check_and_clone_cstr_array, UserBufferWriter},
+        user_access::{
+            check_and_clone_cstr, check_and_clone_cstr_array, UserBufferReader, UserBufferWriter,
+        },
         Syscall, SystemError,
     },
+    time::timer::DEFAULT_TIMER_SLACK_NS,
 };
 
 impl Syscall {
@@ -35,17 +46,13 @@ impl Syscall {
         return r;
     }
 
+    /// vfork：子进程借用父进程的地址空间（不复制页表），父进程一直等待到子进程exec或者退出，
+    /// 因此无论父进程的地址空间有多大，创建子进程的开销都很小
     pub fn vfork(frame: &mut TrapFrame) -> Result<usize, SystemError> {
-        // 由于Linux vfork需要保证子进程先运行（除非子进程调用execve或者exit），
-        // 而我们目前没有实现这个特性，所以暂时使用fork代替vfork（linux文档表示这样也是也可以的）
-        Self::fork(frame)
-
-        // 下面是以前的实现，除非我们实现了子进程先运行的特性，否则不要使用，不然会导致父进程数据损坏
-        // ProcessManager::fork(
-        //     frame,
-        //     CloneFlags::CLONE_VM | CloneFlags::CLONE_FS | CloneFlags::CLONE_SIGNAL,
-        // )
-        // .map(|pid| pid.into())
+        let mut args = KernelCloneArgs::new();
+        args.flags = CloneFlags::CLONE_VM | CloneFlags::CLONE_VFORK;
+        args.exit_signal = Signal::SIGCHLD;
+        return Self::clone(frame, args);
     }
 
     pub fn execve(
@@ -97,6 +104,79 @@ impl Syscall {
         return Ok(());
     }
 
+    /// 创建一个执行`path`的新进程（posix_spawn）
+    ///
+    /// ## 参数
+    ///
+    /// - `actions`、`nr_actions`：按顺序作用在子进程文件描述符表上的file action数组
+    /// - `attr`：spawn属性，可以为空
+    ///
+    /// ## 返回值
+    ///
+    /// 子进程的pid
+    pub fn posix_spawn(
+        path: *const u8,
+        argv: *const *const u8,
+        envp: *const *const u8,
+        actions: *const PosixSpawnFileAction,
+        nr_actions: usize,
+        attr: *const PosixSpawnAttr,
+    ) -> Result<usize, SystemError> {
+        if path.is_null() {
+            return Err(SystemError::EINVAL);
+        }
+        let path: String = check_and_clone_cstr(path, Some(MAX_PATHLEN))?;
+        let argv: Vec<String> = check_and_clone_cstr_array(argv)?;
+        let envp: Vec<String> = check_and_clone_cstr_array(envp)?;
+
+        let mut file_actions = Vec::with_capacity(nr_actions);
+        if nr_actions != 0 {
+            let reader = UserBufferReader::new(
+                actions,
+                nr_actions * core::mem::size_of::<PosixSpawnFileAction>(),
+                true,
+            )?;
+            for action in reader.read_from_user::<PosixSpawnFileAction>(0)? {
+                let action = match action.action {
+                    POSIX_SPAWN_CLOSE => SpawnFileAction::Close(action.fd),
+                    POSIX_SPAWN_DUP2 => SpawnFileAction::Dup2 {
+                        src_fd: action.src_fd,
+                        fd: action.fd,
+                    },
+                    POSIX_SPAWN_OPEN => SpawnFileAction::Open {
+                        fd: action.fd,
+                        path: check_and_clone_cstr(action.path, Some(MAX_PATHLEN))?,
+                        flags: FileMode::from_bits_truncate(action.oflag),
+                        mode: ModeType::from_bits_truncate(action.mode),
+                    },
+                    _ => return Err(SystemError::EINVAL),
+                };
+                file_actions.push(action);
+            }
+        }
+
+        let mut sigmask = None;
+        if !attr.is_null() {
+            let reader = UserBufferReader::new(attr, core::mem::size_of::<PosixSpawnAttr>(), true)?;
+            let attr = *reader.read_one_from_user::<PosixSpawnAttr>(0)?;
+            let flags = PosixSpawnFlags::from_bits(attr.flags).ok_or(SystemError::EINVAL)?;
+            // 子进程的信号处理函数总是默认值，没有用户和进程组的概念，因此只支持设置屏蔽的信号
+            let supported = PosixSpawnFlags::POSIX_SPAWN_RESETIDS
+                | PosixSpawnFlags::POSIX_SPAWN_SETSIGDEF
+                | PosixSpawnFlags::POSIX_SPAWN_SETSIGMASK
+                | PosixSpawnFlags::POSIX_SPAWN_USEVFORK;
+            if !supported.contains(flags) {
+                return Err(SystemError::EINVAL);
+            }
+            if flags.contains(PosixSpawnFlags::POSIX_SPAWN_SETSIGMASK) {
+                sigmask = Some(SigSet::from_bits_truncate(attr.sigmask));
+            }
+        }
+
+        return ProcessManager::spawn(path, argv, envp, &file_actions, sigmask)
+            .map(|pid| pid.into());
+    }
+
     pub fn wait4(
         pid: i64,
         wstatus: *mut i32,
@@ -188,7 +268,7 @@ impl Syscall {
         let current_pcb = ProcessManager::current_pcb();
         let new_kstack = KernelStack::new()?;
         let name = current_pcb.basic().name().to_string();
-        let pcb = ProcessControlBlock::new(name, new_kstack);
+        let pcb = ProcessControlBlock::new(name, new_kstack)?;
         // 克隆pcb
         ProcessManager::copy_process(&current_pcb, &pcb, clone_args, current_trapframe)?;
         ProcessManager::add_pcb(pcb.clone());
@@ -222,8 +302,9 @@ impl Syscall {
         });
 
         if flags.contains(CloneFlags::CLONE_VFORK) {
-            // 等待子进程结束或者exec;
-            vfork.wait_for_completion_interruptible()?;
+            // 等待子进程结束或者exec。子进程可能正在使用父进程的地址空间（包括用户栈），
+            // 在此之前父进程不能返回用户态，因此等待不能被信号打断
+            vfork.wait_for_completion()?;
         }
 
         return Ok(pcb.pid().0);
@@ -279,7 +360,7 @@ impl Syscall {
 
     /// # 设置资源限制
     ///
-    /// TODO: 目前暂时不支持设置资源限制，只提供读取默认值的功能
+    /// TODO: 目前只支持设置RLIMIT_NOFILE，其他资源只提供读取默认值的功能
     ///
     /// ## 参数
     ///
@@ -296,7 +377,7 @@ impl Syscall {
     pub fn prlimit64(
         _pid: Pid,
         resource: usize,
-        _new_limit: *const RLimit64,
+        new_limit: *const RLimit64,
         old_limit: *mut RLimit64,
     ) -> Result<usize, SystemError> {
         let resource = RLimitID::try_from(resource)?;
@@ -321,10 +402,18 @@ impl Syscall {
             }
 
             RLimitID::Nofile => {
+                // 文件描述符的数量限制保存在文件描述符表中
+                let fd_table = ProcessManager::current_pcb().fd_table();
+                let mut fd_table_guard = fd_table.write();
+                let old = fd_table_guard.rlimit_nofile();
+                if !new_limit.is_null() {
+                    let reader =
+                        UserBufferReader::new(new_limit, core::mem::size_of::<RLimit64>(), true)?;
+                    fd_table_guard.set_rlimit_nofile(*reader.read_one_from_user::<RLimit64>(0)?)?;
+                }
+                drop(fd_table_guard);
                 if let Some(mut writer) = writer {
-                    let mut rlimit = writer.buffer::<RLimit64>(0).unwrap()[0];
-                    rlimit.rlim_cur = FileDescriptorVec::PROCESS_MAX_FD as u64;
-                    rlimit.rlim_max = FileDescriptorVec::PROCESS_MAX_FD as u64;
+                    writer.copy_one_to_user(&old, 0)?;
                 }
                 return Ok(0);
             }
@@ -343,4 +432,39 @@ impl Syscall {
             }
         }
     }
+
+    /// # 对当前线程进行控制
+    ///
+    /// 目前只支持`PR_SET_TIMERSLACK`和`PR_GET_TIMERSLACK`：
+    /// 定时器松弛量越大，进程的休眠、超时就越可能被推迟并与其他定时器合并，换取更少的唤醒次数
+    ///
+    /// ## 参数
+    ///
+    /// - `option`：选项
+    /// - `arg2`：选项的参数
+    ///
+    /// ## 返回值
+    ///
+    /// - `PR_GET_TIMERSLACK`：定时器松弛量（单位：纳秒）
+    /// - 其他选项：成功时返回0
+    pub fn prctl(option: usize, arg2: usize) -> Result<usize, SystemError> {
+        let pcb = ProcessManager::current_pcb();
+        match option {
+            PR_SET_TIMERSLACK => {
+                let slack_ns = if arg2 == 0 {
+                    DEFAULT_TIMER_SLACK_NS
+                } else {
+                    arg2 as u64
+                };
+                pcb.sched_info().set_timer_slack_ns(slack_ns);
+                return Ok(0);
+            }
+            PR_GET_TIMERSLACK => {
+                return Ok(pcb.sched_info().timer_slack_ns() as usize);
+            }
+            _ => {
+                return Err(SystemError::EINVAL);
+            }
+        }
+    }
 }
@@ -0,0 +1,510 @@
+//! 工作队列：把需要推迟执行的工作交给内核线程（worker）执行
+//!
+//! 驱动、文件系统等模块不需要为推迟执行的工作（回写、回收、网络处理、设备探测等）创建自己的内核线程，
+//! 而是把[`Work`]放入[`WorkQueue`]，由worker pool中的worker执行它。
+//!
+//! 每个cpu有一个绑定在这个cpu上的worker pool，另外还有一个不绑定cpu的pool：
+//!
+//! - 绑定cpu的pool是并发管理的：通常只有一个worker在执行work，它在执行work的过程中睡眠时（例如等待IO），
+//!   调度器通知pool唤醒另一个worker接着执行后面的work。因此一个work阻塞不会让其他work一直等待，
+//!   同时也不会有多个worker在同一个cpu上互相抢占
+//! - 不绑定cpu的pool不限制并发，适合执行时间较长的work
+//!
+//! pool总是保留一个空闲的worker，用于接替睡眠的worker；空闲的worker过多时，多余的worker会退出。
+//! 需要延迟一段时间再执行的work（[`DelayedWork`]）由定时器到期后放入队列。
+
+use core::{
+    fmt::Debug,
+    sync::atomic::{AtomicBool, AtomicUsize, Ordering},
+};
+
+use alloc::{
+    boxed::Box,
+    collections::VecDeque,
+    string::{String, ToString},
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+
+use crate::{
+    include::bindings::bindings::smp_get_total_cpu,
+    kinfo,
+    libs::{spinlock::SpinLock, wait_queue::WaitQueue},
+    mm::percpu::PerCpu,
+    smp::{core::smp_get_processor_id, cpu::CPU_MASK_WORDS},
+    syscall::SystemError,
+    time::timer::{next_n_ms_timer_jiffies, Timer, TimerFunction},
+};
+
+use super::{
+    kthread::{KernelThreadClosure, KernelThreadMechanism},
+    ProcessFlags, ProcessManager,
+};
+
+/// 每个pool中最多的worker数量
+const MAX_WORKERS_PER_POOL: usize = 32;
+/// 每个pool中最多保留的空闲worker数量
+const MAX_IDLE_WORKERS: usize = 2;
+/// 工作队列默认的max_active
+const WQ_DFL_ACTIVE: usize = 256;
+/// 不绑定cpu的pool的下标（在所有cpu的pool之后）
+const UNBOUND_POOL: usize = PerCpu::MAX_CPU_NUM;
+
+lazy_static! {
+    /// 所有的worker pool，前`PerCpu::MAX_CPU_NUM`个绑定在对应的cpu上，最后一个不绑定cpu
+    static ref WORKER_POOLS: Vec<WorkerPool> = {
+        let mut pools = Vec::with_capacity(PerCpu::MAX_CPU_NUM + 1);
+        for cpu in 0..PerCpu::MAX_CPU_NUM {
+            pools.push(WorkerPool::new(cpu, Some(cpu as u32)));
+        }
+        pools.push(WorkerPool::new(UNBOUND_POOL, None));
+        pools
+    };
+    static ref SYSTEM_WQ: Arc<WorkQueue> =
+        WorkQueue::new("events", WorkQueueFlags::empty(), 0);
+    static ref SYSTEM_UNBOUND_WQ: Arc<WorkQueue> =
+        WorkQueue::new("events_unbound", WorkQueueFlags::WQ_UNBOUND, 0);
+}
+
+bitflags! {
+    pub struct WorkQueueFlags: u32 {
+        /// work由不绑定cpu的pool执行
+        const WQ_UNBOUND = 1 << 1;
+    }
+}
+
+/// 需要推迟执行的工作
+///
+/// 同一个work在执行之前只会在队列中出现一次：重复放入队列的请求会被忽略。
+/// work开始执行之后，可以再次被放入队列（包括在它自己的函数中）
+pub struct Work {
+    func: Box<dyn Fn() + Send + Sync>,
+    /// 是否已经在队列中（或者在定时器中）等待执行
+    pending: AtomicBool,
+}
+
+impl Debug for Work {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        f.debug_struct("Work")
+            .field("pending", &self.pending)
+            .finish()
+    }
+}
+
+impl Work {
+    pub fn new<F: Fn() + Send + Sync + 'static>(func: F) -> Arc<Self> {
+        return Arc::new(Self {
+            func: Box::new(func),
+            pending: AtomicBool::new(false),
+        });
+    }
+
+    /// work是否正在等待执行
+    pub fn is_pending(&self) -> bool {
+        return self.pending.load(Ordering::SeqCst);
+    }
+
+    /// 把work标记为等待执行。已经在等待执行时返回false
+    fn try_set_pending(&self) -> bool {
+        return !self.pending.swap(true, Ordering::SeqCst);
+    }
+}
+
+/// 延迟一段时间之后才放入队列的work
+#[derive(Debug)]
+pub struct DelayedWork {
+    work: Arc<Work>,
+    /// 还没有到期的定时器
+    timer: SpinLock<Option<Arc<Timer>>>,
+}
+
+impl DelayedWork {
+    pub fn new<F: Fn() + Send + Sync + 'static>(func: F) -> Arc<Self> {
+        return Arc::new(Self {
+            work: Work::new(func),
+            timer: SpinLock::new(None),
+        });
+    }
+
+    pub fn work(&self) -> &Arc<Work> {
+        return &self.work;
+    }
+
+    /// 取消还没有到期的延迟执行
+    ///
+    /// ## 返回值
+    ///
+    /// 是否取消成功。定时器已经到期（work已经在队列中或者已经执行）时返回false
+    pub fn cancel(&self) -> bool {
+        let timer = self.timer.lock_irqsave().take();
+        if let Some(timer) = timer {
+            if timer.cancel() {
+                self.work.pending.store(false, Ordering::SeqCst);
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+/// 延迟work的定时器到期时，把work放入队列
+#[derive(Debug)]
+struct DelayedWorkTimer {
+    wq: Arc<WorkQueue>,
+    dwork: Arc<DelayedWork>,
+}
+
+impl TimerFunction for DelayedWorkTimer {
+    fn run(&mut self) -> Result<(), SystemError> {
+        self.dwork.timer.lock_irqsave().take();
+        self.wq.insert_work(self.dwork.work.clone(), None);
+        return Ok(());
+    }
+}
+
+/// 工作队列
+///
+/// 同一个工作队列中同时在执行（或者在pool中等待执行）的work最多有max_active个，超出的work在工作队列中等待。
+/// max_active为1的工作队列按照放入的顺序逐个执行work
+#[derive(Debug)]
+pub struct WorkQueue {
+    name: String,
+    flags: WorkQueueFlags,
+    max_active: usize,
+    inner: SpinLock<InnerWorkQueue>,
+    /// 等待工作队列中所有的work执行完成
+    flush_wait: WaitQueue,
+    self_ref: Weak<WorkQueue>,
+}
+
+#[derive(Debug)]
+struct InnerWorkQueue {
+    /// 已经交给pool的work的数量
+    nr_active: usize,
+    /// 超出max_active的work，以及它们要交给的pool
+    inactive: VecDeque<(Arc<Work>, usize)>,
+}
+
+impl WorkQueue {
+    /// 创建一个工作队列
+    ///
+    /// ## 参数
+    ///
+    /// - `max_active`：同时交给pool的work的最大数量，为0时使用默认值
+    pub fn new(name: &str, flags: WorkQueueFlags, max_active: usize) -> Arc<Self> {
+        let max_active = if max_active == 0 {
+            WQ_DFL_ACTIVE
+        } else {
+            max_active
+        };
+        return Arc::new_cyclic(|self_ref| Self {
+            name: name.to_string(),
+            flags,
+            max_active,
+            inner: SpinLock::new(InnerWorkQueue {
+                nr_active: 0,
+                inactive: VecDeque::new(),
+            }),
+            flush_wait: WaitQueue::INIT,
+            self_ref: self_ref.clone(),
+        });
+    }
+
+    pub fn name(&self) -> &str {
+        return &self.name;
+    }
+
+    /// 把work放入队列，由当前cpu的pool（不绑定cpu的工作队列则是不绑定cpu的pool）执行
+    ///
+    /// ## 返回值
+    ///
+    /// work已经在等待执行时返回false
+    pub fn queue_work(&self, work: &Arc<Work>) -> bool {
+        return self.queue_work_on(None, work);
+    }
+
+    /// 把work放入队列，由`cpu`的pool执行。`cpu`为None时使用当前cpu；不绑定cpu的工作队列忽略`cpu`
+    pub fn queue_work_on(&self, cpu: Option<u32>, work: &Arc<Work>) -> bool {
+        if !work.try_set_pending() {
+            return false;
+        }
+        self.insert_work(work.clone(), cpu);
+        return true;
+    }
+
+    /// `delay_ms`毫秒之后把work放入队列
+    ///
+    /// ## 返回值
+    ///
+    /// work已经在等待执行（包括还在等待定时器到期）时返回false
+    pub fn queue_delayed_work(&self, dwork: &Arc<DelayedWork>, delay_ms: u64) -> bool {
+        if !dwork.work.try_set_pending() {
+            return false;
+        }
+        if delay_ms == 0 {
+            self.insert_work(dwork.work.clone(), None);
+            return true;
+        }
+        let timer = Timer::new(
+            Box::new(DelayedWorkTimer {
+                wq: self.self_ref.upgrade().unwrap(),
+                dwork: dwork.clone(),
+            }),
+            next_n_ms_timer_jiffies(delay_ms),
+        );
+        *dwork.timer.lock_irqsave() = Some(timer.clone());
+        timer.activate();
+        return true;
+    }
+
+    /// 等待在调用之前放入队列的work全部执行完成（还在等待定时器到期的延迟work除外）
+    ///
+    /// 不能在这个工作队列的work中调用，否则会死锁
+    pub fn flush(&self) {
+        loop {
+            let inner = self.inner.lock_irqsave();
+            if inner.nr_active == 0 {
+                return;
+            }
+            self.flush_wait.sleep_uninterruptible_unlock_spinlock(inner);
+        }
+    }
+
+    fn pool_index(&self, cpu: Option<u32>) -> usize {
+        if self.flags.contains(WorkQueueFlags::WQ_UNBOUND) {
+            return UNBOUND_POOL;
+        }
+        let current = smp_get_processor_id();
+        let cpu = cpu.unwrap_or(current);
+        if cpu < unsafe { smp_get_total_cpu() } {
+            return cpu as usize;
+        }
+        return current as usize;
+    }
+
+    fn insert_work(&self, work: Arc<Work>, cpu: Option<u32>) {
+        let pool = self.pool_index(cpu);
+        let mut inner = self.inner.lock_irqsave();
+        if inner.nr_active >= self.max_active {
+            inner.inactive.push_back((work, pool));
+            return;
+        }
+        inner.nr_active += 1;
+        drop(inner);
+        WORKER_POOLS[pool].insert(work, self.self_ref.upgrade().unwrap());
+    }
+
+    /// 这个工作队列的一个work执行完成，把一个等待中的work交给pool
+    fn work_done(&self) {
+        let mut inner = self.inner.lock_irqsave();
+        if let Some((work, pool)) = inner.inactive.pop_front() {
+            drop(inner);
+            WORKER_POOLS[pool].insert(work, self.self_ref.upgrade().unwrap());
+            return;
+        }
+        inner.nr_active -= 1;
+        let idle = inner.nr_active == 0;
+        drop(inner);
+        if idle {
+            self.flush_wait.wakeup_all(None);
+        }
+    }
+}
+
+/// 一组执行work的worker
+#[derive(Debug)]
+struct WorkerPool {
+    id: usize,
+    /// 绑定的cpu。不绑定cpu的pool为None
+    cpu: Option<u32>,
+    inner: SpinLock<InnerWorkerPool>,
+    /// 正在执行work并且没有睡眠的worker的数量（只在绑定cpu的pool中统计）
+    nr_running: AtomicUsize,
+    /// worklist的长度，可以不加锁读取
+    nr_pending: AtomicUsize,
+    /// 空闲的worker在这里等待
+    idle_wait: WaitQueue,
+}
+
+#[derive(Debug)]
+struct InnerWorkerPool {
+    worklist: VecDeque<(Arc<Work>, Arc<WorkQueue>)>,
+    nr_workers: usize,
+    /// 空闲的worker的数量（包括正在创建的worker）
+    nr_idle: usize,
+}
+
+impl WorkerPool {
+    fn new(id: usize, cpu: Option<u32>) -> Self {
+        return Self {
+            id,
+            cpu,
+            inner: SpinLock::new(InnerWorkerPool {
+                worklist: VecDeque::new(),
+                nr_workers: 0,
+                nr_idle: 0,
+            }),
+            nr_running: AtomicUsize::new(0),
+            nr_pending: AtomicUsize::new(0),
+            idle_wait: WaitQueue::INIT,
+        };
+    }
+
+    fn insert(&self, work: Arc<Work>, wq: Arc<WorkQueue>) {
+        let mut inner = self.inner.lock_irqsave();
+        inner.worklist.push_back((work, wq));
+        self.nr_pending.fetch_add(1, Ordering::SeqCst);
+        let wake = inner.nr_idle > 0 && self.need_more_worker();
+        drop(inner);
+        if wake {
+            self.idle_wait.wakeup(None);
+        }
+    }
+
+    /// 是否需要再有一个worker开始执行work：有等待的work，并且（绑定cpu的pool中）没有正在运行的worker
+    fn need_more_worker(&self) -> bool {
+        return self.nr_pending.load(Ordering::SeqCst) > 0
+            && (self.cpu.is_none() || self.nr_running.load(Ordering::SeqCst) == 0);
+    }
+
+    /// 创建一个新的worker。调用者需要事先把它计入nr_workers和nr_idle
+    fn create_worker(&self) -> bool {
+        let closure = KernelThreadClosure::UsizeClosure((Box::new(worker_thread), self.id));
+        let name = match self.cpu {
+            Some(cpu) => format!("kworker/{}", cpu),
+            None => "kworker/u".to_string(),
+        };
+        let pcb = match KernelThreadMechanism::create(closure, name) {
+            Some(pcb) => pcb,
+            None => return false,
+        };
+        if let Some(cpu) = self.cpu {
+            let mut words = [0u64; CPU_MASK_WORDS];
+            words[cpu as usize / 64] |= 1 << (cpu % 64);
+            pcb.sched_info().cpus_allowed().store_words(&words);
+        }
+        ProcessManager::wakeup(&pcb).ok();
+        return true;
+    }
+
+    /// 创建一个新的worker（可以在任何内核线程中调用）
+    fn start_worker(&self) -> bool {
+        let mut inner = self.inner.lock_irqsave();
+        if inner.nr_workers >= MAX_WORKERS_PER_POOL {
+            return false;
+        }
+        inner.nr_workers += 1;
+        inner.nr_idle += 1;
+        drop(inner);
+        if !self.create_worker() {
+            let mut inner = self.inner.lock_irqsave();
+            inner.nr_workers -= 1;
+            inner.nr_idle -= 1;
+            return false;
+        }
+        return true;
+    }
+}
+
+/// worker的主循环
+fn worker_thread(pool_id: usize) -> i32 {
+    let pool = &WORKER_POOLS[pool_id];
+    let pcb = ProcessManager::current_pcb();
+    // 创建者已经把这个worker计入空闲的worker
+    pool.inner.lock_irqsave().nr_idle -= 1;
+
+    loop {
+        let mut inner = pool.inner.lock_irqsave();
+        if !pool.need_more_worker() {
+            if inner.nr_idle >= MAX_IDLE_WORKERS {
+                inner.nr_workers -= 1;
+                return 0;
+            }
+            inner.nr_idle += 1;
+            pool.idle_wait.sleep_uninterruptible_unlock_spinlock(inner);
+            pool.inner.lock_irqsave().nr_idle -= 1;
+            continue;
+        }
+
+        // 保证pool中有一个空闲的worker，在当前worker睡眠时接替它
+        if inner.nr_idle == 0 && inner.nr_workers < MAX_WORKERS_PER_POOL {
+            drop(inner);
+            pool.start_worker();
+            inner = pool.inner.lock_irqsave();
+        }
+
+        let (work, wq) = match inner.worklist.pop_front() {
+            Some(w) => w,
+            None => continue,
+        };
+        pool.nr_pending.fetch_sub(1, Ordering::SeqCst);
+        drop(inner);
+
+        // 先清除pending，work可以在执行的过程中再次被放入队列
+        work.pending.store(false, Ordering::SeqCst);
+        if pool.cpu.is_some() {
+            pool.nr_running.fetch_add(1, Ordering::SeqCst);
+            pcb.flags().insert(ProcessFlags::WQ_WORKER);
+        }
+        (work.func)();
+        if pool.cpu.is_some() {
+            pcb.flags().remove(ProcessFlags::WQ_WORKER);
+            pool.nr_running.fetch_sub(1, Ordering::SeqCst);
+        }
+        drop(work);
+        wq.work_done();
+    }
+}
+
+/// 绑定cpu的worker在执行work的过程中睡眠（由调度器在切换之前调用）
+///
+/// 如果pool中没有其他正在运行的worker，而还有work在等待，唤醒一个空闲的worker执行它们
+pub fn wq_worker_sleeping(cpu: u32) {
+    let pool = &WORKER_POOLS[cpu as usize];
+    if pool.nr_running.fetch_sub(1, Ordering::SeqCst) == 1
+        && pool.nr_pending.load(Ordering::SeqCst) > 0
+    {
+        pool.idle_wait.wakeup(None);
+    }
+}
+
+/// 睡眠的worker重新开始运行（由调度器在切换回来之后调用）
+pub fn wq_worker_running(cpu: u32) {
+    WORKER_POOLS[cpu as usize]
+        .nr_running
+        .fetch_add(1, Ordering::SeqCst);
+}
+
+/// 系统默认的工作队列（绑定cpu）
+pub fn system_wq() -> &'static Arc<WorkQueue> {
+    return &SYSTEM_WQ;
+}
+
+/// 系统默认的不绑定cpu的工作队列
+pub fn system_unbound_wq() -> &'static Arc<WorkQueue> {
+    return &SYSTEM_UNBOUND_WQ;
+}
+
+/// 把work放入系统默认的工作队列
+pub fn schedule_work(work: &Arc<Work>) -> bool {
+    return system_wq().queue_work(work);
+}
+
+/// `delay_ms`毫秒之后把work放入系统默认的工作队列
+pub fn schedule_delayed_work(dwork: &Arc<DelayedWork>, delay_ms: u64) -> bool {
+    return system_wq().queue_delayed_work(dwork, delay_ms);
+}
+
+/// 为每个cpu的pool和不绑定cpu的pool创建第一个worker（需要在内核线程机制初始化完成之后调用）
+pub fn workqueue_init() {
+    let nr_cpus = unsafe { smp_get_total_cpu() } as usize;
+    for pool in WORKER_POOLS[..nr_cpus]
+        .iter()
+        .chain(core::iter::once(&WORKER_POOLS[UNBOUND_POOL]))
+    {
+        if !pool.start_worker() {
+            panic!("Failed to create worker for pool {}", pool.id);
+        }
+    }
+    kinfo!("workqueue initialized");
+}
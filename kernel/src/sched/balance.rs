@@ -0,0 +1,360 @@
+//! 多核负载均衡
+//!
+//! cpu的负载是最近一段时间内可运行进程数量的指数衰减平均值（而不是某一时刻的队列长度），
+//! 每次时钟中断时由[`sched_load_tick`]更新。
+//!
+//! - 每隔[`BALANCE_INTERVAL`]个时钟中断，cpu会触发负载均衡软中断，从负载最重的cpu的CFS队列中拉取进程
+//! - cpu的运行队列为空、即将运行IDLE进程时，[`idle_balance`]会立即从其他cpu窃取一个进程（实时进程优先）
+//! - 进程被唤醒时，[`select_task_cpu`]为它选择cpu：优先留在空闲的、或者缓存还是热的原来的cpu上，
+//!   其次考虑唤醒者所在的cpu（生产者/消费者之间共享缓存），最后才是其他空闲的cpu
+//!
+//! 以上所有的迁移都只会把进程放到它的cpu亲和性允许的cpu上。被隔离的cpu（见[`super::isolation`]）
+//! 不参与负载均衡，只有亲和性只允许这些cpu的进程才会被放到它们上面。
+//!
+//! 在NUMA机器上（见[`crate::mm::numa`]），进程的内存分配在它运行的节点上，迁移到其他节点之后访问内存的延迟更高，
+//! 因此各种迁移都优先在同一个节点内进行：只有负载差距超过[`NUMA_IMBALANCE_MARGIN`]时才会跨节点拉取进程，
+//! 寻找空闲cpu时先找同一个节点的cpu，唤醒者所在的cpu也只在与原来的cpu属于同一个节点时才会被考虑。
+
+use core::sync::atomic::{AtomicUsize, Ordering};
+
+use alloc::{sync::Arc, vec::Vec};
+
+use crate::{
+    exception::softirq::{softirq_vectors, SoftirqNumber, SoftirqVec},
+    include::bindings::bindings::smp_get_total_cpu,
+    kinfo,
+    mm::{
+        numa::{cpu_to_node, nr_nodes},
+        percpu::PerCpu,
+    },
+    process::{Pid, ProcessControlBlock, ProcessFlags, ProcessManager},
+    smp::core::smp_get_processor_id,
+    time::timer::clock,
+};
+
+use super::{
+    core::CPU_EXECUTING,
+    isolation::cpu_is_isolated,
+    rq::{cpu_rq, double_lock, this_rq},
+    stats::sched_stat_migrate,
+};
+
+/// 一个一直处于可运行状态的进程贡献的负载
+pub const LOAD_SCALE: usize = 1024;
+/// 衰减的速度：每个时钟中断保留(LOAD_DECAY-1)/LOAD_DECAY的历史负载（HZ=250时，时间常数约为32ms）
+const LOAD_DECAY: usize = 8;
+/// 周期性负载均衡的间隔（单位：时钟中断的次数）
+const BALANCE_INTERVAL: usize = 16;
+/// 负载差距超过这个值时才进行迁移，避免进程在负载相近的cpu之间来回迁移
+pub const BALANCE_MARGIN: usize = LOAD_SCALE / 2;
+/// 跨节点迁移时额外要求的负载差距
+const NUMA_IMBALANCE_MARGIN: usize = LOAD_SCALE;
+/// 每次负载均衡最多迁移的进程数量
+const BALANCE_MAX_MOVE: usize = 4;
+/// 迁移的代价（单位：jiffies）：进程离开cpu的时间比这个短时，认为它的缓存还是热的
+const MIGRATION_COST: u64 = 500;
+
+#[derive(Debug)]
+struct CpuLoad {
+    /// 衰减平均负载
+    load_avg: AtomicUsize,
+    /// 时钟中断的计数，用于决定何时进行周期性负载均衡
+    ticks: AtomicUsize,
+}
+
+lazy_static! {
+    static ref CPU_LOADS: Vec<CpuLoad> = {
+        let mut loads = Vec::with_capacity(PerCpu::MAX_CPU_NUM);
+        for _ in 0..PerCpu::MAX_CPU_NUM {
+            loads.push(CpuLoad {
+                load_avg: AtomicUsize::new(0),
+                ticks: AtomicUsize::new(0),
+            });
+        }
+        loads
+    };
+}
+
+/// 获取cpu的衰减平均负载（一个一直可运行的进程的负载为[`LOAD_SCALE`]）
+#[inline(always)]
+pub fn cpu_load(cpu_id: u32) -> usize {
+    return CPU_LOADS[cpu_id as usize].load_avg.load(Ordering::Relaxed);
+}
+
+#[inline(always)]
+fn total_cpus() -> u32 {
+    return unsafe { smp_get_total_cpu() };
+}
+
+/// 在时钟中断中更新当前cpu的负载，并在需要时触发负载均衡软中断
+///
+/// 请注意，该函数只能被时钟中断处理程序调用
+pub fn sched_load_tick() {
+    let cpu_id = smp_get_processor_id();
+    let queued = this_rq().nr_running();
+    let running = if ProcessManager::current_pcb().pid().into() == 0 {
+        0
+    } else {
+        1
+    };
+
+    let load = &CPU_LOADS[cpu_id as usize];
+    let sample = (queued + running) * LOAD_SCALE;
+    let old = load.load_avg.load(Ordering::Relaxed);
+    load.load_avg.store(
+        (old * (LOAD_DECAY - 1) + sample) / LOAD_DECAY,
+        Ordering::Relaxed,
+    );
+
+    // 错开各个cpu进行负载均衡的时机
+    let ticks = load.ticks.fetch_add(1, Ordering::Relaxed);
+    if (ticks + cpu_id as usize) % BALANCE_INTERVAL == 0 && !cpu_is_isolated(cpu_id) {
+        softirq_vectors().raise_softirq(SoftirqNumber::SchedBalance);
+    }
+}
+
+/// cpu结束NO_HZ idle时调用：补上停止时钟中断期间错过的衰减
+///
+/// ## 参数
+///
+/// - `cpu_id`：结束NO_HZ idle的cpu
+/// - `ticks`：错过的时钟中断的次数
+pub fn sched_load_nohz_exit(cpu_id: u32, ticks: u64) {
+    let load = &CPU_LOADS[cpu_id as usize].load_avg;
+    // 衰减了足够多次之后，负载已经接近0
+    if ticks >= 64 {
+        load.store(0, Ordering::Relaxed);
+        return;
+    }
+    let mut value = load.load(Ordering::Relaxed);
+    for _ in 0..ticks {
+        value = value * (LOAD_DECAY - 1) / LOAD_DECAY;
+    }
+    load.store(value, Ordering::Relaxed);
+}
+
+/// 两个cpu是否属于同一个NUMA节点
+#[inline(always)]
+fn same_node(a: u32, b: u32) -> bool {
+    return nr_nodes() == 1 || cpu_to_node(a as usize) == cpu_to_node(b as usize);
+}
+
+/// 找到除了`this_cpu`以外负载最重的、没有被隔离的cpu
+///
+/// ## 参数
+///
+/// - `local`：为true时只考虑与`this_cpu`属于同一个节点的cpu，否则只考虑其他节点的cpu
+fn find_busiest_cpu(this_cpu: u32, local: bool) -> Option<(u32, usize)> {
+    let mut busiest: Option<(u32, usize)> = None;
+    for cpu_id in 0..total_cpus() {
+        if cpu_id == this_cpu || cpu_is_isolated(cpu_id) || same_node(cpu_id, this_cpu) != local {
+            continue;
+        }
+        let load = cpu_load(cpu_id);
+        if busiest.map_or(true, |(_, l)| load > l) {
+            busiest = Some((cpu_id, load));
+        }
+    }
+    return busiest;
+}
+
+/// cpu是否空闲：正在运行IDLE进程，并且运行队列为空
+fn cpu_is_idle(cpu_id: u32) -> bool {
+    return CPU_EXECUTING.get(cpu_id) == Pid::new(0) && cpu_rq(cpu_id).nr_running() == 0;
+}
+
+/// 从`target`开始，找到一个允许`pcb`运行的、没有被隔离的空闲cpu（优先选择与`target`属于同一个节点的cpu）
+fn find_idle_cpu(pcb: &ProcessControlBlock, target: u32) -> Option<u32> {
+    let cpu_num = total_cpus();
+    let sched_info = pcb.sched_info();
+    let idle = |cpu_id: &u32| {
+        sched_info.cpu_allowed(*cpu_id) && !cpu_is_isolated(*cpu_id) && cpu_is_idle(*cpu_id)
+    };
+    let mut candidates = (0..cpu_num).map(|i| (target + i) % cpu_num);
+    if nr_nodes() == 1 {
+        return candidates.find(idle);
+    }
+    return candidates
+        .clone()
+        .find(|cpu_id| same_node(*cpu_id, target) && idle(cpu_id))
+        .or_else(|| candidates.find(idle));
+}
+
+/// 找到允许`pcb`运行的、负载最轻的cpu（优先选择没有被隔离的cpu，负载相同时优先选择当前节点的cpu）
+fn find_idlest_cpu(pcb: &ProcessControlBlock) -> u32 {
+    let sched_info = pcb.sched_info();
+    let this_cpu = smp_get_processor_id();
+    return (0..total_cpus())
+        .filter(|cpu_id| sched_info.cpu_allowed(*cpu_id))
+        .min_by_key(|cpu_id| {
+            (
+                cpu_is_isolated(*cpu_id),
+                cpu_load(*cpu_id),
+                !same_node(*cpu_id, this_cpu),
+            )
+        })
+        .unwrap_or(0);
+}
+
+/// 进程刚刚离开cpu不久，缓存中的数据还没有被换出
+fn task_cache_hot(pcb: &ProcessControlBlock) -> bool {
+    return clock().saturating_sub(pcb.sched_info().last_ran()) < MIGRATION_COST;
+}
+
+/// 为被唤醒（或者新创建）的进程选择运行的cpu
+///
+/// ## 参数
+///
+/// - `pcb`：被唤醒的进程
+///
+/// ## 返回值
+///
+/// 返回进程应当被放入的运行队列所在的cpu（一定是进程的cpu亲和性允许的cpu）
+pub fn select_task_cpu(pcb: &ProcessControlBlock) -> u32 {
+    let prev_cpu = match pcb.sched_info().on_cpu() {
+        Some(cpu_id) if pcb.sched_info().cpu_allowed(cpu_id) => cpu_id,
+        _ => return find_idlest_cpu(pcb),
+    };
+    if cpu_is_idle(prev_cpu) || task_cache_hot(pcb) {
+        return prev_cpu;
+    }
+
+    // 唤醒者所在的cpu不比原来的cpu忙的时候，选择唤醒者所在的cpu，使得两者共享缓存。
+    // 进程的内存在原来的节点上，因此不把它拉到其他节点
+    let waker_cpu = smp_get_processor_id();
+    let target = if waker_cpu != prev_cpu
+        && pcb.sched_info().cpu_allowed(waker_cpu)
+        && !cpu_is_isolated(waker_cpu)
+        && same_node(waker_cpu, prev_cpu)
+        && cpu_load(waker_cpu) + BALANCE_MARGIN <= cpu_load(prev_cpu)
+    {
+        waker_cpu
+    } else {
+        prev_cpu
+    };
+    if cpu_is_idle(target) {
+        return target;
+    }
+    return find_idle_cpu(pcb, target).unwrap_or(target);
+}
+
+/// 把进程从`src_cpu`的运行队列迁移到`dst_cpu`的运行队列（只迁移允许在`dst_cpu`上运行的进程）
+///
+/// ## 参数
+///
+/// - `nr`：最多迁移的CFS进程数量
+/// - `pull_rt`：是否优先迁移一个实时进程。迁移了实时进程时，不再迁移CFS进程
+///
+/// ## 返回值
+///
+/// 返回被迁移的进程数量
+fn migrate_tasks(src_cpu: u32, dst_cpu: u32, nr: usize, pull_rt: bool) -> usize {
+    let mut guard = double_lock(cpu_rq(dst_cpu), cpu_rq(src_cpu));
+    let (dst, src) = guard.get();
+    let executing = CPU_EXECUTING.get(src_cpu);
+
+    if pull_rt {
+        if let Some(pcb) = src.rt.pop_migratable(executing, dst_cpu) {
+            pcb.sched_info().set_on_cpu(Some(dst_cpu));
+            sched_stat_migrate(dst_cpu, &pcb);
+            dst.rt.enqueue(pcb);
+            return 1;
+        }
+    }
+
+    let mut moved = 0;
+    while moved < core::cmp::min(nr, BALANCE_MAX_MOVE) {
+        let pcb = match src.cfs.pop_migratable(executing, dst_cpu) {
+            Some(pcb) => pcb,
+            None => break,
+        };
+        pcb.sched_info().set_on_cpu(Some(dst_cpu));
+        sched_stat_migrate(dst_cpu, &pcb);
+        dst.cfs.enqueue_reset_vruntime(pcb);
+        moved += 1;
+    }
+    return moved;
+}
+
+/// 迁移了进程之后，如果当前cpu正在运行IDLE进程，让它尽快被调度出去
+pub(super) fn kick_idle() {
+    let current = ProcessManager::current_pcb();
+    if current.pid().into() == 0 {
+        current.flags().insert(ProcessFlags::NEED_SCHEDULE);
+    }
+}
+
+/// 周期性负载均衡：从负载最重的cpu的CFS队列中拉取进程到当前cpu
+///
+/// 先在当前节点内寻找，节点内已经均衡时，才考虑从其他节点拉取进程
+fn rebalance(this_cpu: u32) {
+    let this_load = cpu_load(this_cpu);
+    // 负载差距不到一个进程时，迁移只会让两个cpu互换角色
+    let imbalanced = |busiest: &(u32, usize), margin: usize| {
+        busiest.1 > this_load + LOAD_SCALE + margin && cpu_rq(busiest.0).nr_running() != 0
+    };
+    let busiest = find_busiest_cpu(this_cpu, true)
+        .filter(|b| imbalanced(b, BALANCE_MARGIN))
+        .or_else(|| {
+            find_busiest_cpu(this_cpu, false)
+                .filter(|b| imbalanced(b, BALANCE_MARGIN + NUMA_IMBALANCE_MARGIN))
+        });
+    let (busiest, busiest_load) = match busiest {
+        Some(x) => x,
+        None => return,
+    };
+    // 迁移之后，两个cpu的负载应当大致相等
+    let nr = (busiest_load - this_load) / (2 * LOAD_SCALE);
+    if migrate_tasks(busiest, this_cpu, nr.max(1), false) > 0 {
+        kick_idle();
+    }
+}
+
+/// 当前cpu的运行队列为空时，立即从其他cpu窃取一个进程
+///
+/// 请注意，进入该函数之前，需要关中断，并且不能持有任何运行队列的锁
+///
+/// ## 返回值
+///
+/// 如果窃取到了进程，返回true
+pub fn idle_balance(this_cpu: u32) -> bool {
+    if cpu_is_isolated(this_cpu) {
+        return false;
+    }
+    // 选择等待运行的进程最多的cpu。同一个节点内有可以窃取的进程时，不从其他节点窃取
+    let busiest = (0..total_cpus())
+        .filter(|cpu_id| *cpu_id != this_cpu && !cpu_is_isolated(*cpu_id))
+        .map(|cpu_id| (cpu_id, cpu_rq(cpu_id).nr_running()))
+        .max_by_key(|(cpu_id, nr)| (*nr > 0 && same_node(*cpu_id, this_cpu), *nr));
+    let busiest = match busiest {
+        Some((cpu_id, nr)) if nr > 0 => cpu_id,
+        _ => return false,
+    };
+    // 实时进程等待的代价更大，优先窃取
+    return migrate_tasks(busiest, this_cpu, 1, true) > 0;
+}
+
+/// 负载均衡软中断
+#[derive(Debug)]
+struct SchedBalanceSoftirq;
+
+impl SoftirqVec for SchedBalanceSoftirq {
+    fn run(&self) {
+        rebalance(smp_get_processor_id());
+    }
+}
+
+/// 初始化负载均衡（需要在软中断模块初始化完成之后调用）
+pub fn sched_balance_init() {
+    // 避免在时钟中断中第一次访问时才分配内存
+    lazy_static::initialize(&CPU_LOADS);
+    softirq_vectors()
+        .register_softirq(SoftirqNumber::SchedBalance, Arc::new(SchedBalanceSoftirq))
+        .expect("Failed to register sched balance softirq");
+    kinfo!("Sched load balance initialized");
+}
+
+#[no_mangle]
+pub extern "C" fn rs_sched_balance_init() {
+    sched_balance_init();
+}
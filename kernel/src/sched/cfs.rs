@@ -1,242 +1,425 @@
 use core::sync::atomic::compiler_fence;
 
-use alloc::{boxed::Box, sync::Arc, vec::Vec};
+use alloc::{sync::Arc, vec::Vec};
 
 use crate::{
     arch::CurrentIrqArch,
     exception::InterruptArch,
-    include::bindings::bindings::MAX_CPU_NUM,
-    kBUG,
-    libs::{
-        rbtree::RBTree,
-        rwlock::RwLockReadGuard,
-        spinlock::{SpinLock, SpinLockGuard},
-    },
+    libs::{rbtree::RBTree, rwlock::RwLockReadGuard},
     process::{
-        ProcessControlBlock, ProcessFlags, ProcessManager, ProcessSchedulerInfo, ProcessState,
+        Pid, ProcessControlBlock, ProcessFlags, ProcessManager, ProcessSchedulerInfo, ProcessState,
     },
-    smp::core::smp_get_processor_id,
-};
-
-use super::{
-    core::{sched_enqueue, Scheduler},
-    SchedPriority,
+    time::clocksource::HZ,
 };
 
-/// 声明全局的cfs调度器实例
-pub static mut CFS_SCHEDULER_PTR: Option<Box<SchedulerCFS>> = None;
-
-/// @brief 获取cfs调度器实例的可变引用
-#[inline]
-pub fn __get_cfs_scheduler() -> &'static mut SchedulerCFS {
-    return unsafe { CFS_SCHEDULER_PTR.as_mut().unwrap() };
-}
-
-/// @brief 初始化cfs调度器
-pub unsafe fn sched_cfs_init() {
-    if CFS_SCHEDULER_PTR.is_none() {
-        CFS_SCHEDULER_PTR = Some(Box::new(SchedulerCFS::new()));
-    } else {
-        kBUG!("Try to init CFS Scheduler twice.");
-        panic!("Try to init CFS Scheduler twice.");
+use super::{core::Scheduler, rq::RunQueueInner, SchedPolicy, SchedPriority};
+
+/// nice值为0的进程的权重
+pub const NICE_0_LOAD: u64 = 1024;
+/// SCHED_IDLE进程的权重
+const WEIGHT_IDLEPRIO: u64 = 3;
+
+/// nice值（-20~19）到权重的映射。nice值每增加1，进程得到的cpu时间大约减少10%（权重大约除以1.25）
+#[rustfmt::skip]
+const NICE_TO_WEIGHT: [u64; 40] = [
+    88761, 71755, 56483, 46273, 36291, // -20 ~ -16
+    29154, 23254, 18705, 14949, 11916, // -15 ~ -11
+    9548, 7620, 6100, 4904, 3906,      // -10 ~ -6
+    3121, 2501, 1991, 1586, 1277,      // -5 ~ -1
+    1024, 820, 655, 526, 423,          // 0 ~ 4
+    335, 272, 215, 172, 137,           // 5 ~ 9
+    110, 87, 70, 56, 45,               // 10 ~ 14
+    36, 29, 23, 18, 15,                // 15 ~ 19
+];
+
+/// 进程在CFS中的权重
+pub fn task_weight(sched_info: &ProcessSchedulerInfo) -> u64 {
+    match sched_info.policy() {
+        SchedPolicy::IDLE => return WEIGHT_IDLEPRIO,
+        SchedPolicy::CFS | SchedPolicy::BATCH => {
+            let nice = sched_info.priority().nice();
+            return NICE_TO_WEIGHT[(nice - SchedPriority::MIN_NICE) as usize];
+        }
+        _ => return NICE_0_LOAD,
     }
 }
 
-/// @brief CFS队列（per-cpu的）
+/// @brief CFS队列（per-cpu的，由所在的运行队列的锁保护）
+///
+/// SCHED_IDLE的进程放在单独的队列中，只有普通队列为空时才会被选中
 #[derive(Debug)]
-struct CFSQueue {
+pub struct CfsRunQueue {
     /// 当前cpu上执行的进程剩余的时间片
     cpu_exec_proc_jiffies: i64,
-    /// 自旋锁保护的队列
-    locked_queue: SpinLock<RBTree<i64, Arc<ProcessControlBlock>>>,
-    /// 当前核心的队列专属的IDLE进程的pcb
-    idle_pcb: Arc<ProcessControlBlock>,
+    /// 按照虚拟运行时间排序的进程（SCHED_NORMAL和SCHED_BATCH）
+    queue: RBTree<i64, Arc<ProcessControlBlock>>,
+    /// 按照虚拟运行时间排序的SCHED_IDLE进程
+    idle_queue: RBTree<i64, Arc<ProcessControlBlock>>,
+    /// 单调递增的最小虚拟运行时间，新加入（被唤醒、被迁移）的进程以它为基准放置
+    min_vruntime: i64,
+    /// 队列中的进程的权重之和
+    load_weight: u64,
+    /// 所在的任务组用完了cpu带宽而被限流的进程（见[`super::cgroup`]），不计入队列的长度
+    throttled: Vec<Arc<ProcessControlBlock>>,
 }
 
-impl CFSQueue {
-    pub fn new(idle_pcb: Arc<ProcessControlBlock>) -> CFSQueue {
-        CFSQueue {
+impl CfsRunQueue {
+    /// 寻找可以迁移的进程时，最多检查的进程数量
+    const MIGRATE_SCAN_MAX: usize = 8;
+
+    pub fn new() -> CfsRunQueue {
+        CfsRunQueue {
             cpu_exec_proc_jiffies: 0,
-            locked_queue: SpinLock::new(RBTree::new()),
-            idle_pcb: idle_pcb,
+            queue: RBTree::new(),
+            idle_queue: RBTree::new(),
+            min_vruntime: 0,
+            load_weight: 0,
+            throttled: Vec::new(),
+        }
+    }
+
+    /// 进程所属的队列
+    #[inline(always)]
+    fn queue_of(
+        &mut self,
+        pcb: &ProcessControlBlock,
+    ) -> &mut RBTree<i64, Arc<ProcessControlBlock>> {
+        if pcb.sched_info().policy() == SchedPolicy::IDLE {
+            return &mut self.idle_queue;
+        }
+        return &mut self.queue;
+    }
+
+    /// 进程离开队列时，更新队列的权重之和
+    fn account_dequeue(&mut self, pcb: &ProcessControlBlock) {
+        // 进程在队列中时，nice值可能被修改过，因此队列为空时直接清零，避免误差累积
+        if self.len() == 0 {
+            self.load_weight = 0;
+        } else {
+            self.load_weight = self
+                .load_weight
+                .saturating_sub(task_weight(&pcb.sched_info()));
         }
     }
 
     /// @brief 将pcb加入队列
     pub fn enqueue(&mut self, pcb: Arc<ProcessControlBlock>) {
-        let mut queue = self.locked_queue.lock_irqsave();
-
         // 如果进程是IDLE进程，那么就不加入队列
         if pcb.pid().into() == 0 {
             return;
         }
 
-        queue.insert(pcb.sched_info().virtual_runtime() as i64, pcb.clone());
+        let (vruntime, weight) = {
+            let sched_info = pcb.sched_info();
+            (
+                sched_info.virtual_runtime() as i64,
+                task_weight(&sched_info),
+            )
+        };
+        self.load_weight += weight;
+        self.queue_of(&pcb).insert(vruntime, pcb.clone());
     }
 
-    /// @brief 将pcb从调度队列中弹出,若队列为空，则返回IDLE进程的pcb
-    pub fn dequeue(&mut self) -> Arc<ProcessControlBlock> {
-        let res: Arc<ProcessControlBlock>;
-        let mut queue = self.locked_queue.lock_irqsave();
-        if !queue.is_empty() {
-            // 队列不为空，返回下一个要执行的pcb
-            res = queue.pop_first().unwrap().1;
-        } else {
-            // 如果队列为空，则返回IDLE进程的pcb
-            res = self.idle_pcb.clone();
+    /// @brief 将新加入（被唤醒、被迁移、新创建）的进程加入队列，并且以队列的最小虚拟运行时间为基准放置它
+    ///
+    /// - 睡眠了很久的进程，虚拟运行时间最多比基准小[`SchedulerCFS::SLEEPER_CREDIT`]，
+    ///   使得它能尽快运行，但是不能长时间独占cpu
+    /// - 从其他cpu迁移来的进程，虚拟运行时间是以原来cpu的队列为基准的，最多比这个cpu的基准大一个调度周期
+    pub fn enqueue_reset_vruntime(&mut self, pcb: Arc<ProcessControlBlock>) {
+        let min_vruntime = self.min_vruntime as isize;
+        let vruntime = pcb.sched_info().virtual_runtime().clamp(
+            min_vruntime - SchedulerCFS::SLEEPER_CREDIT,
+            min_vruntime + SchedulerCFS::SCHED_LATENCY,
+        );
+        pcb.sched_info().set_virtual_runtime(vruntime);
+        self.enqueue(pcb);
+    }
+
+    /// @brief 将pcb从调度队列中弹出，普通队列优先。若队列为空，则返回None
+    pub fn dequeue(&mut self) -> Option<Arc<ProcessControlBlock>> {
+        let pcb = self
+            .queue
+            .pop_first()
+            .or_else(|| self.idle_queue.pop_first())
+            .map(|(_, pcb)| pcb)?;
+        self.account_dequeue(&pcb);
+        self.update_min_vruntime(Some(pcb.sched_info().virtual_runtime() as i64));
+        return Some(pcb);
+    }
+
+    /// @brief 获取cfs队列的最小虚拟运行时间（单调递增）
+    #[inline(always)]
+    pub fn min_vruntime(&self) -> i64 {
+        return self.min_vruntime;
+    }
+
+    /// 更新最小虚拟运行时间：取正在运行的进程与队列中最左侧的进程之间较小的那个，并且不会减小
+    ///
+    /// - `curr`：正在运行的CFS进程的虚拟运行时间
+    pub fn update_min_vruntime(&mut self, curr: Option<i64>) {
+        let leftmost = self.queue.get_first().map(|(vruntime, _)| *vruntime);
+        let candidate = match (curr, leftmost) {
+            (Some(c), Some(l)) => c.min(l),
+            (Some(c), None) => c,
+            (None, Some(l)) => l,
+            (None, None) => return,
+        };
+        self.min_vruntime = self.min_vruntime.max(candidate);
+    }
+
+    /// 队列中的进程的权重之和
+    #[inline(always)]
+    pub fn load_weight(&self) -> u64 {
+        return self.load_weight;
+    }
+
+    /// 获取运行队列的长度
+    #[inline(always)]
+    pub fn len(&self) -> usize {
+        return self.queue.len() + self.idle_queue.len();
+    }
+
+    /// 队列中是否有SCHED_IDLE以外的进程
+    #[inline(always)]
+    pub fn has_normal(&self) -> bool {
+        return !self.queue.is_empty();
+    }
+
+    /// 取出一个可以被迁移到`dst_cpu`的进程
+    ///
+    /// 优先选择虚拟运行时间最大的进程（它们最晚才会被调度，缓存也最冷）。每个队列最多检查
+    /// [`CfsRunQueue::MIGRATE_SCAN_MAX`]个进程。
+    ///
+    /// ## 参数
+    ///
+    /// - `executing`：正在这个cpu上运行的进程。时间片耗尽的进程会在切换之前被重新加入队列，
+    ///   此时它的上下文还没有保存，不能被迁移
+    /// - `dst_cpu`：迁移的目标cpu，进程的cpu亲和性需要允许它在这个cpu上运行
+    pub fn pop_migratable(
+        &mut self,
+        executing: Pid,
+        dst_cpu: u32,
+    ) -> Option<Arc<ProcessControlBlock>> {
+        let pcb = Self::pop_migratable_from(&mut self.queue, executing, dst_cpu)
+            .or_else(|| Self::pop_migratable_from(&mut self.idle_queue, executing, dst_cpu))?;
+        self.account_dequeue(&pcb);
+        return Some(pcb);
+    }
+
+    fn pop_migratable_from(
+        queue: &mut RBTree<i64, Arc<ProcessControlBlock>>,
+        executing: Pid,
+        dst_cpu: u32,
+    ) -> Option<Arc<ProcessControlBlock>> {
+        let mut skipped = Vec::new();
+        let mut result = None;
+        while skipped.len() < Self::MIGRATE_SCAN_MAX {
+            let (vruntime, pcb) = match queue.pop_last() {
+                Some(x) => x,
+                None => break,
+            };
+            if pcb.pid() != executing && pcb.sched_info().cpu_allowed(dst_cpu) {
+                result = Some(pcb);
+                break;
+            }
+            skipped.push((vruntime, pcb));
+        }
+        for (vruntime, pcb) in skipped {
+            queue.insert(vruntime, pcb);
         }
-        return res;
+        return result;
     }
 
-    /// @brief 获取cfs队列的最小运行时间
+    /// 如果进程所在的任务组被限流，把它暂存在限流列表中并返回true
     ///
-    /// @return Option<i64> 如果队列不为空，那么返回队列中，最小的虚拟运行时间；否则返回None
-    pub fn min_vruntime(
-        queue: &SpinLockGuard<RBTree<i64, Arc<ProcessControlBlock>>>,
-    ) -> Option<i64> {
-        if !queue.is_empty() {
-            return Some(queue.get_first().unwrap().1.sched_info().virtual_runtime() as i64);
-        } else {
-            return None;
+    /// - `cpu_id`：这个队列所在的cpu
+    pub fn throttle(&mut self, pcb: &Arc<ProcessControlBlock>, cpu_id: u32) -> bool {
+        if pcb.pid().into() == 0 {
+            return false;
         }
+        let group = pcb.sched_info().task_group().clone();
+        if !group.throttled() || !group.throttle_on(cpu_id) {
+            return false;
+        }
+        self.throttled.push(pcb.clone());
+        return true;
     }
-    /// 获取运行队列的长度
-    pub fn get_cfs_queue_size(
-        queue: &SpinLockGuard<RBTree<i64, Arc<ProcessControlBlock>>>,
-    ) -> usize {
-        return queue.len();
+
+    /// 取出限流列表中所有的进程
+    pub fn take_throttled(&mut self) -> Vec<Arc<ProcessControlBlock>> {
+        return core::mem::take(&mut self.throttled);
+    }
+
+    /// 时钟中断到来时，减少当前进程剩余的时间片
+    ///
+    /// ## 返回值
+    ///
+    /// 如果时间片已经耗尽，返回true
+    pub fn tick(&mut self) -> bool {
+        self.cpu_exec_proc_jiffies -= 1;
+        return self.cpu_exec_proc_jiffies <= 0;
     }
 }
 
 /// @brief CFS调度器类
-pub struct SchedulerCFS {
-    cpu_queue: Vec<&'static mut CFSQueue>,
-}
+#[derive(Debug)]
+pub struct SchedulerCFS;
 
 impl SchedulerCFS {
-    pub fn new() -> SchedulerCFS {
-        // 暂时手动指定核心数目
-        // todo: 从cpu模块来获取核心的数目
-        let mut result = SchedulerCFS {
-            cpu_queue: Default::default(),
-        };
-
-        // 为每个cpu核心创建队列，进程重构后可以直接初始化Idle_pcb？
-        for i in 0..MAX_CPU_NUM {
-            let idle_pcb = ProcessManager::idle_pcb()[i as usize].clone();
-            result
-                .cpu_queue
-                .push(Box::leak(Box::new(CFSQueue::new(idle_pcb))));
+    /// 调度周期（单位：时钟中断的次数）：队列中的所有进程按照权重分配这段时间
+    const SLICE_JIFFIES: i64 = 10;
+    /// SCHED_BATCH进程的时间片是普通进程的多少倍。批处理进程不在意延迟，更长的时间片减少了上下文切换
+    const BATCH_SLICE_SCALE: i64 = 4;
+    /// 一次时钟中断对应的运行时间（单位：微秒）。虚拟运行时间以微秒为单位
+    const TICK_VRUNTIME: isize = (1000000 / HZ) as isize;
+    /// 调度周期对应的虚拟运行时间
+    pub const SCHED_LATENCY: isize = Self::SLICE_JIFFIES as isize * Self::TICK_VRUNTIME;
+    /// 被唤醒的进程的虚拟运行时间最多比队列的基准小这么多
+    pub const SLEEPER_CREDIT: isize = Self::SCHED_LATENCY / 2;
+    /// 被唤醒的进程的虚拟运行时间比当前进程小这么多时，抢占当前进程
+    const WAKEUP_GRANULARITY: isize = Self::TICK_VRUNTIME / 4;
+
+    /// 把实际运行时间换算为虚拟运行时间：权重越大，虚拟运行时间增长得越慢
+    #[inline(always)]
+    fn calc_delta_fair(delta: isize, weight: u64) -> isize {
+        if weight == NICE_0_LOAD {
+            return delta;
         }
-
-        return result;
+        return (delta as u64 * NICE_0_LOAD / weight.max(1)) as isize;
     }
 
     /// @brief 更新这个cpu上，这个进程的可执行时间。
+    ///
+    /// 调度周期按照进程的权重在队列中的所有进程（包括这个进程）之间分配，至少为一次时钟中断
     #[inline]
-    fn update_cpu_exec_proc_jiffies(
-        _priority: SchedPriority,
-        cfs_queue: &mut CFSQueue,
-    ) -> &mut CFSQueue {
-        // todo: 引入调度周期以及所有进程的优先权进行计算，然后设置分配给进程的可执行时间
-        cfs_queue.cpu_exec_proc_jiffies = 10;
-
-        return cfs_queue;
+    fn update_cpu_exec_proc_jiffies(pcb: &ProcessControlBlock, cfs_queue: &mut CfsRunQueue) {
+        let sched_info = pcb.sched_info();
+        let weight = task_weight(&sched_info);
+        let total = weight + cfs_queue.load_weight();
+        let mut slice = ((Self::SLICE_JIFFIES as u64 * weight + total / 2) / total).max(1) as i64;
+        if sched_info.policy() == SchedPolicy::BATCH {
+            slice *= Self::BATCH_SLICE_SCALE;
+        }
+        cfs_queue.cpu_exec_proc_jiffies = slice;
+    }
+
+    /// 进程是否只能在没有其他CFS进程可以运行时才运行（SCHED_IDLE进程和IDLE进程）
+    #[inline(always)]
+    fn is_idle_class(pcb: &ProcessControlBlock) -> bool {
+        return pcb.pid().into() == 0 || pcb.sched_info().policy() == SchedPolicy::IDLE;
     }
 
     /// @brief 时钟中断到来时，由sched的core模块中的函数，调用本函数，更新CFS进程的可执行时间
+    ///
+    /// - `rq`：当前cpu的运行队列（已经加锁）
     pub fn timer_update_jiffies(
-        &mut self,
+        rq: &mut RunQueueInner,
         sched_info_guard: &RwLockReadGuard<'_, ProcessSchedulerInfo>,
     ) {
-        let current_cpu_queue: &mut CFSQueue = self.cpu_queue[smp_get_processor_id() as usize];
-        // todo: 引入调度周期以及所有进程的优先权进行计算，然后设置进程的可执行时间
-
-        let mut queue = None;
-        for _ in 0..10 {
-            if let Ok(q) = current_cpu_queue.locked_queue.try_lock() {
-                queue = Some(q);
-                break;
-            }
-        }
-        if queue.is_none() {
-            return;
-        }
-        let queue = queue.unwrap();
-        // 更新进程的剩余可执行时间
-        current_cpu_queue.cpu_exec_proc_jiffies -= 1;
-        // 时间片耗尽，标记需要被调度
-        if current_cpu_queue.cpu_exec_proc_jiffies <= 0 {
+        // 更新进程的剩余可执行时间，时间片耗尽，标记需要被调度
+        let expired = rq.cfs.tick();
+        // SCHED_IDLE进程一旦有其他进程可以运行，就让出cpu
+        let yield_idle = sched_info_guard.policy() == SchedPolicy::IDLE && rq.cfs.has_normal();
+        if expired || yield_idle {
             ProcessManager::current_pcb()
                 .flags()
                 .insert(ProcessFlags::NEED_SCHEDULE);
         }
-        drop(queue);
 
-        // 更新当前进程的虚拟运行时间
-        sched_info_guard.increase_virtual_runtime(1);
-    }
+        // 从任务组的cpu带宽中扣除运行时间，用完时尽快让出cpu
+        if sched_info_guard
+            .task_group()
+            .charge_runtime(Self::TICK_VRUNTIME as u64)
+        {
+            ProcessManager::current_pcb()
+                .flags()
+                .insert(ProcessFlags::NEED_SCHEDULE);
+        }
 
-    /// @brief 将进程加入cpu的cfs调度队列，并且重设其虚拟运行时间为当前队列的最小值
-    pub fn enqueue_reset_vruntime(&mut self, pcb: Arc<ProcessControlBlock>) {
-        let cpu_queue = &mut self.cpu_queue[pcb.sched_info().on_cpu().unwrap() as usize];
-        let queue = cpu_queue.locked_queue.lock();
-        if queue.len() > 0 {
-            pcb.sched_info()
-                .set_virtual_runtime(CFSQueue::min_vruntime(&queue).unwrap_or(0) as isize)
+        // 按照权重更新当前进程的虚拟运行时间
+        let delta = Self::calc_delta_fair(Self::TICK_VRUNTIME, task_weight(sched_info_guard));
+        sched_info_guard.increase_virtual_runtime(delta);
+        // SCHED_IDLE进程的虚拟运行时间增长得非常快，不能作为队列的基准
+        if sched_info_guard.policy() != SchedPolicy::IDLE
+            && ProcessManager::current_pcb().pid().into() != 0
+        {
+            rq.cfs
+                .update_min_vruntime(Some(sched_info_guard.virtual_runtime() as i64));
         }
-        drop(queue);
-        cpu_queue.enqueue(pcb);
     }
 
-    /// @brief 设置cpu的队列的IDLE进程的pcb
-    #[allow(dead_code)]
-    pub fn set_cpu_idle(&mut self, cpu_id: usize, pcb: Arc<ProcessControlBlock>) {
-        // kdebug!("set cpu idle: id={}", cpu_id);
-        self.cpu_queue[cpu_id].idle_pcb = pcb;
-    }
-    /// 获取某个cpu的运行队列中的进程数
-    pub fn get_cfs_queue_len(&mut self, cpu_id: u32) -> usize {
-        let queue = self.cpu_queue[cpu_id as usize].locked_queue.lock();
-        return CFSQueue::get_cfs_queue_size(&queue);
+    /// 被唤醒的进程加入当前cpu的运行队列之后，判断是否需要抢占当前进程
+    ///
+    /// 只有SCHED_NORMAL的进程会抢占其他进程；SCHED_IDLE的进程会被任何其他进程抢占
+    pub fn check_preempt_wakeup(pcb: &ProcessControlBlock) {
+        let current = ProcessManager::current_pcb();
+        if current.pid() == pcb.pid() || !current.sched_info().policy().is_fair() {
+            return;
+        }
+        let preempt = match pcb.sched_info().policy() {
+            SchedPolicy::CFS => {
+                Self::is_idle_class(&current)
+                    || current.sched_info().virtual_runtime()
+                        > pcb.sched_info().virtual_runtime() + Self::WAKEUP_GRANULARITY
+            }
+            SchedPolicy::BATCH => current.sched_info().policy() == SchedPolicy::IDLE,
+            _ => false,
+        };
+        if preempt {
+            current.flags().insert(ProcessFlags::NEED_SCHEDULE);
+        }
     }
 }
 
 impl Scheduler for SchedulerCFS {
     /// @brief 在当前cpu上进行调度。
     /// 请注意，进入该函数之前，需要关中断
-    fn sched(&mut self) -> Option<Arc<ProcessControlBlock>> {
+    fn sched(&self, rq: &mut RunQueueInner) -> Option<Arc<ProcessControlBlock>> {
         assert!(CurrentIrqArch::is_irq_enabled() == false);
 
-        ProcessManager::current_pcb()
-            .flags()
-            .remove(ProcessFlags::NEED_SCHEDULE);
-
-        let current_cpu_id = smp_get_processor_id() as usize;
+        let current = ProcessManager::current_pcb();
+        current.flags().remove(ProcessFlags::NEED_SCHEDULE);
 
-        let current_cpu_queue: &mut CFSQueue = self.cpu_queue[current_cpu_id];
-
-        let proc: Arc<ProcessControlBlock> = current_cpu_queue.dequeue();
+        let cpu_id = rq.cpu_id();
+        // 跳过被限流的进程。如果队列为空，则切换到IDLE进程
+        let proc: Arc<ProcessControlBlock> = loop {
+            match rq.cfs.dequeue() {
+                Some(pcb) if rq.cfs.throttle(&pcb, cpu_id) => continue,
+                Some(pcb) => break pcb,
+                None => break rq.idle_pcb.clone(),
+            }
+        };
 
         compiler_fence(core::sync::atomic::Ordering::SeqCst);
+        let runnable = current.sched_info().state() == ProcessState::Runnable;
+        // 用完了任务组的cpu带宽的当前进程，不再放回运行队列
+        let current_throttled = runnable
+            && current.sched_info().policy().is_fair()
+            && rq.cfs.throttle(&current, cpu_id);
+        // SCHED_IDLE进程总是让位于其他进程，其他进程也不会被SCHED_IDLE进程抢占；
+        // 同一类的进程之间，比较虚拟运行时间
+        let should_switch = if !runnable || current_throttled {
+            true
+        } else {
+            match (Self::is_idle_class(&current), Self::is_idle_class(&proc)) {
+                (true, false) => true,
+                (false, true) if proc.pid().into() != 0 => false,
+                _ => current.sched_info().virtual_runtime() >= proc.sched_info().virtual_runtime(),
+            }
+        };
+
         // 如果当前不是running态，或者当前进程的虚拟运行时间大于等于下一个进程的，那就需要切换。
-        if (ProcessManager::current_pcb().sched_info().state() != ProcessState::Runnable)
-            || (ProcessManager::current_pcb().sched_info().virtual_runtime()
-                >= proc.sched_info().virtual_runtime())
-        {
+        if should_switch {
             compiler_fence(core::sync::atomic::Ordering::SeqCst);
             // 本次切换由于时间片到期引发，则再次加入就绪队列，否则交由其它功能模块进行管理
-            if ProcessManager::current_pcb().sched_info().state() == ProcessState::Runnable {
-                sched_enqueue(ProcessManager::current_pcb(), false);
+            if runnable && !current_throttled {
+                rq.enqueue_task(current.clone(), false);
                 compiler_fence(core::sync::atomic::Ordering::SeqCst);
             }
             compiler_fence(core::sync::atomic::Ordering::SeqCst);
             // 设置进程可以执行的时间
-            if current_cpu_queue.cpu_exec_proc_jiffies <= 0 {
-                SchedulerCFS::update_cpu_exec_proc_jiffies(
-                    proc.sched_info().priority(),
-                    current_cpu_queue,
-                );
+            if rq.cfs.cpu_exec_proc_jiffies <= 0 {
+                SchedulerCFS::update_cpu_exec_proc_jiffies(&proc, &mut rq.cfs);
             }
 
             compiler_fence(core::sync::atomic::Ordering::SeqCst);
@@ -247,16 +430,12 @@ impl Scheduler for SchedulerCFS {
 
             // 设置进程可以执行的时间
             compiler_fence(core::sync::atomic::Ordering::SeqCst);
-            if current_cpu_queue.cpu_exec_proc_jiffies <= 0 {
-                SchedulerCFS::update_cpu_exec_proc_jiffies(
-                    ProcessManager::current_pcb().sched_info().priority(),
-                    current_cpu_queue,
-                );
-                // kdebug!("cpu:{:?}",current_cpu_id);
+            if rq.cfs.cpu_exec_proc_jiffies <= 0 {
+                SchedulerCFS::update_cpu_exec_proc_jiffies(&current, &mut rq.cfs);
             }
 
             compiler_fence(core::sync::atomic::Ordering::SeqCst);
-            sched_enqueue(proc, false);
+            rq.enqueue_task(proc, false);
             compiler_fence(core::sync::atomic::Ordering::SeqCst);
         }
         compiler_fence(core::sync::atomic::Ordering::SeqCst);
@@ -264,9 +443,7 @@ impl Scheduler for SchedulerCFS {
         return None;
     }
 
-    fn enqueue(&mut self, pcb: Arc<ProcessControlBlock>) {
-        let cpu_queue = &mut self.cpu_queue[pcb.sched_info().on_cpu().unwrap() as usize];
-
-        cpu_queue.enqueue(pcb);
+    fn enqueue(&self, rq: &mut RunQueueInner, pcb: Arc<ProcessControlBlock>) {
+        rq.cfs.enqueue(pcb);
     }
 }
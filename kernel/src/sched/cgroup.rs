@@ -0,0 +1,446 @@
+//! 任务组：按组限制cpu带宽和内存用量
+//!
+//! 任务组组成一棵以根组`/`为根的树，每个进程属于一个任务组（默认继承父进程的任务组）。
+//! 每个任务组可以设置：
+//!
+//! - cpu带宽（cpu.max）：每个周期（period）内，组内的CFS进程在所有cpu上最多运行quota微秒。
+//!   时钟中断把当前进程的运行时间记到它的任务组和所有祖先上，某个组用完了本周期的配额时被限流，
+//!   组内的进程在被调度出去时不再进入运行队列，而是暂存在cpu的CFS队列的限流列表中，
+//!   直到周期定时器补充配额，再由被记录的cpu把它们放回运行队列。没有进程运行的周期里，定时器会停止。
+//! - 内存用量限制（memory.max），见[`crate::mm::memcg`]
+//!
+//! 同时统计每个组的cpu和内存压力，见[`super::psi`]。
+//!
+//! 任务组通过`/proc/taskgroups`管理（Linux通过cgroupfs管理，这里没有实现cgroup文件系统）。
+//! 读取时列出所有任务组的状态；写入以下命令之一：
+//!
+//! - `mkdir <path>`：创建任务组，例如`mkdir /batch`
+//! - `rmdir <path>`：删除没有进程和子组的任务组
+//! - `<path> cpu.max <quota|max> [period]`：设置cpu带宽（单位：微秒）
+//! - `<path> memory.max <bytes|max>`：设置内存用量限制
+//! - `<path> attach <pid>`：把进程移动到任务组
+
+use core::sync::atomic::{AtomicBool, AtomicI64, AtomicU64, AtomicUsize, Ordering};
+
+use alloc::{
+    boxed::Box,
+    format,
+    string::{String, ToString},
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+
+use crate::{
+    filesystem::vfs::seq_file::SeqBuf,
+    libs::{rwlock::RwLock, spinlock::SpinLock},
+    mm::memcg::{mem_cgroup_set_limit, MemCounter},
+    process::{Pid, ProcessControlBlock, ProcessManager},
+    smp::{call_function::smp_call_function_single, cpu::AtomicCpuMask},
+    syscall::SystemError,
+    time::timer::{clock, next_n_us_timer_jiffies, Timer, TimerFunction},
+};
+
+use super::{
+    balance::kick_idle,
+    psi::{PsiGroup, PsiResource},
+    rq::this_rq,
+};
+
+/// 默认的cpu带宽周期（单位：微秒）
+const DEFAULT_CFS_PERIOD_US: u64 = 100_000;
+/// cpu带宽周期和配额的取值范围（单位：微秒）
+const MIN_CFS_PERIOD_US: u64 = 1_000;
+const MAX_CFS_PERIOD_US: u64 = 1_000_000;
+const MIN_CFS_QUOTA_US: i64 = 1_000;
+
+lazy_static! {
+    /// 根任务组。它不能被限制，也不能被删除
+    static ref ROOT_TASK_GROUP: Arc<TaskGroup> = TaskGroup::new(String::from("/"), None);
+    /// 所有的任务组（按照创建的顺序，第一个是根任务组）
+    static ref TASK_GROUPS: RwLock<Vec<Arc<TaskGroup>>> =
+        RwLock::new(alloc::vec![ROOT_TASK_GROUP.clone()]);
+}
+
+/// cpu带宽的周期状态（由锁保护）
+#[derive(Debug)]
+struct CfsBandwidth {
+    /// 本周期剩余的运行时间（单位：微秒）
+    runtime: i64,
+    /// 周期定时器是否在运行
+    timer_active: bool,
+    /// 被限流的时刻
+    throttle_start: u64,
+    /// 经过的周期数
+    nr_periods: u64,
+    /// 被限流的次数
+    nr_throttled: u64,
+    /// 被限流的时间之和（单位：微秒）
+    throttled_time: u64,
+}
+
+/// 任务组
+#[derive(Debug)]
+pub struct TaskGroup {
+    self_ref: Weak<TaskGroup>,
+    path: String,
+    parent: Option<Arc<TaskGroup>>,
+    /// 组内的进程数量（不包括子组）
+    nr_tasks: AtomicUsize,
+    /// 每个周期的配额（单位：微秒），-1表示不限制
+    quota_us: AtomicI64,
+    period_us: AtomicU64,
+    /// 本周期的配额是否已经用完
+    throttled: AtomicBool,
+    /// 可能有被限流的进程在等待的cpu
+    throttled_cpus: AtomicCpuMask,
+    bandwidth: SpinLock<CfsBandwidth>,
+    pub mem: MemCounter,
+    psi: PsiGroup,
+}
+
+impl TaskGroup {
+    fn new(path: String, parent: Option<Arc<TaskGroup>>) -> Arc<Self> {
+        return Arc::new_cyclic(|self_ref| Self {
+            self_ref: self_ref.clone(),
+            path,
+            parent,
+            nr_tasks: AtomicUsize::new(0),
+            quota_us: AtomicI64::new(-1),
+            period_us: AtomicU64::new(DEFAULT_CFS_PERIOD_US),
+            throttled: AtomicBool::new(false),
+            throttled_cpus: AtomicCpuMask::new(),
+            bandwidth: SpinLock::new(CfsBandwidth {
+                runtime: 0,
+                timer_active: false,
+                throttle_start: 0,
+                nr_periods: 0,
+                nr_throttled: 0,
+                throttled_time: 0,
+            }),
+            mem: MemCounter::new(),
+            psi: PsiGroup::new(),
+        });
+    }
+
+    pub fn path(&self) -> &str {
+        return &self.path;
+    }
+
+    /// 这个任务组和它的所有祖先（由近到远）
+    pub fn ancestors(&self) -> impl Iterator<Item = &TaskGroup> {
+        return core::iter::successors(Some(self), |g| g.parent.as_deref());
+    }
+
+    /// 这个任务组是否是`other`或者`other`的后代
+    pub fn is_descendant_of(&self, other: &TaskGroup) -> bool {
+        return self.ancestors().any(|g| core::ptr::eq(g, other));
+    }
+
+    /// 进程加入这个任务组
+    pub fn task_attach(&self) {
+        self.nr_tasks.fetch_add(1, Ordering::Relaxed);
+    }
+
+    /// 进程离开这个任务组（被移动到其他组，或者退出）
+    pub fn task_detach(&self) {
+        self.nr_tasks.fetch_sub(1, Ordering::Relaxed);
+    }
+
+    /// 把停顿时间记到这个任务组和它的所有祖先上
+    pub fn psi_account(&self, res: PsiResource, delta: u64) {
+        if delta == 0 {
+            return;
+        }
+        for g in self.ancestors() {
+            g.psi.account(res, delta);
+        }
+    }
+
+    /// 这个任务组或者它的某个祖先是否被限流
+    #[inline]
+    pub fn throttled(&self) -> bool {
+        return self.ancestors().any(|g| g.throttled.load(Ordering::SeqCst));
+    }
+
+    /// 组内的进程在`cpu`上运行了`delta`微秒，从这个组和所有祖先的配额中扣除
+    ///
+    /// 请注意，只能在时钟中断中调用
+    ///
+    /// ## 返回值
+    ///
+    /// 如果某个组因此被限流，返回true
+    pub fn charge_runtime(&self, delta: u64) -> bool {
+        let mut throttled = false;
+        for g in self.ancestors() {
+            let quota = g.quota_us.load(Ordering::Relaxed);
+            if quota < 0 {
+                continue;
+            }
+            let mut bw = g.bandwidth.lock_irqsave();
+            if !bw.timer_active {
+                bw.timer_active = true;
+                bw.runtime = quota;
+                g.start_period_timer();
+            }
+            bw.runtime -= delta as i64;
+            if bw.runtime <= 0 && !g.throttled.load(Ordering::SeqCst) {
+                g.throttled.store(true, Ordering::SeqCst);
+                bw.nr_throttled += 1;
+                bw.throttle_start = clock();
+            }
+            throttled |= g.throttled.load(Ordering::SeqCst);
+        }
+        return throttled;
+    }
+
+    /// 在`cpu`上暂存了一个被限流的进程，记录下来，以便补充配额时通知这个cpu
+    ///
+    /// 返回进程是否仍然被限流。先记录cpu再检查，保证与[`TaskGroup::refill_runtime`]并发时，
+    /// 要么这里看到限流已经解除，要么补充配额时看到这个cpu
+    pub fn throttle_on(&self, cpu: u32) -> bool {
+        for g in self.ancestors() {
+            g.throttled_cpus.set(cpu as usize);
+        }
+        return self.throttled();
+    }
+
+    fn start_period_timer(&self) {
+        let timer = Timer::new(
+            Box::new(CfsPeriodTimer {
+                group: self.self_ref.clone(),
+            }),
+            next_n_us_timer_jiffies(self.period_us.load(Ordering::Relaxed)),
+        );
+        timer.activate();
+    }
+
+    /// 周期结束，补充配额
+    fn refill_runtime(&self) {
+        let quota = self.quota_us.load(Ordering::Relaxed);
+        let mut bw = self.bandwidth.lock_irqsave();
+        bw.nr_periods += 1;
+        // 整个周期都没有进程运行，停止定时器，直到组内的进程再次运行
+        let idle = quota < 0 || (bw.runtime >= quota && !self.throttled.load(Ordering::SeqCst));
+        bw.runtime = quota;
+        let was_throttled = self.throttled.swap(false, Ordering::SeqCst);
+        if was_throttled {
+            bw.throttled_time += clock().saturating_sub(bw.throttle_start);
+        }
+        if idle {
+            bw.timer_active = false;
+        } else {
+            self.start_period_timer();
+        }
+        drop(bw);
+
+        if was_throttled {
+            self.kick_throttled_cpus();
+        }
+    }
+
+    /// 通知可能有这个组的进程被限流的cpu，把不再被限流的进程放回运行队列
+    fn kick_throttled_cpus(&self) {
+        let cpus: Vec<usize> = self.throttled_cpus.iter().collect();
+        for cpu in cpus {
+            self.throttled_cpus.clear(cpu);
+            smp_call_function_single(cpu, cfs_unthrottle_local, false).ok();
+        }
+    }
+
+    /// 设置cpu带宽。`quota_us`为负数表示不限制
+    fn set_cpu_max(&self, quota_us: i64, period_us: u64) {
+        let mut bw = self.bandwidth.lock_irqsave();
+        self.period_us.store(period_us, Ordering::Relaxed);
+        self.quota_us.store(quota_us, Ordering::Relaxed);
+        bw.runtime = quota_us;
+        let was_throttled = self.throttled.swap(false, Ordering::SeqCst);
+        if was_throttled {
+            bw.throttled_time += clock().saturating_sub(bw.throttle_start);
+        }
+        drop(bw);
+        if was_throttled {
+            self.kick_throttled_cpus();
+        }
+    }
+}
+
+/// cpu带宽的周期定时器
+#[derive(Debug)]
+struct CfsPeriodTimer {
+    group: Weak<TaskGroup>,
+}
+
+impl TimerFunction for CfsPeriodTimer {
+    fn run(&mut self) -> Result<(), SystemError> {
+        if let Some(group) = self.group.upgrade() {
+            group.refill_runtime();
+        }
+        return Ok(());
+    }
+}
+
+/// 把当前cpu上不再被限流的进程放回运行队列
+fn cfs_unthrottle_local() {
+    let mut rq = this_rq().lock_irqsave();
+    let moved = rq.cfs_unthrottle();
+    drop(rq);
+    if moved {
+        kick_idle();
+    }
+}
+
+/// 根任务组
+pub fn root_task_group() -> Arc<TaskGroup> {
+    return ROOT_TASK_GROUP.clone();
+}
+
+fn find_task_group(path: &str) -> Option<Arc<TaskGroup>> {
+    return TASK_GROUPS.read().iter().find(|g| g.path == path).cloned();
+}
+
+/// 把进程移动到任务组
+pub fn task_group_attach(pcb: &Arc<ProcessControlBlock>, group: Arc<TaskGroup>) {
+    pcb.sched_info_mut().set_task_group(group);
+}
+
+fn task_group_mkdir(path: &str) -> Result<(), SystemError> {
+    let (parent_path, name) = match path.rsplit_once('/') {
+        Some(("", name)) => ("/", name),
+        Some(x) => x,
+        None => return Err(SystemError::EINVAL),
+    };
+    if name.is_empty() || name == "." || name == ".." {
+        return Err(SystemError::EINVAL);
+    }
+    let parent = find_task_group(parent_path).ok_or(SystemError::ENOENT)?;
+    let mut groups = TASK_GROUPS.write();
+    if groups.iter().any(|g| g.path == path) {
+        return Err(SystemError::EEXIST);
+    }
+    groups.push(TaskGroup::new(path.to_string(), Some(parent)));
+    return Ok(());
+}
+
+fn task_group_rmdir(path: &str) -> Result<(), SystemError> {
+    let mut groups = TASK_GROUPS.write();
+    let idx = groups
+        .iter()
+        .position(|g| g.path == path)
+        .ok_or(SystemError::ENOENT)?;
+    let group = groups[idx].clone();
+    if group.parent.is_none() {
+        return Err(SystemError::EPERM);
+    }
+    let has_children = groups
+        .iter()
+        .any(|g| g.parent.as_ref().map_or(false, |p| Arc::ptr_eq(p, &group)));
+    if has_children || group.nr_tasks.load(Ordering::Relaxed) != 0 {
+        return Err(SystemError::EBUSY);
+    }
+    groups.remove(idx);
+    drop(groups);
+    // 停止周期定时器，并放出可能还在等待的进程
+    group.set_cpu_max(-1, DEFAULT_CFS_PERIOD_US);
+    return Ok(());
+}
+
+/// `/proc/taskgroups`：所有任务组的状态
+pub fn task_groups_show(s: &mut SeqBuf) -> Result<(), SystemError> {
+    let groups = TASK_GROUPS.read().clone();
+    for g in groups.iter() {
+        let quota = g.quota_us.load(Ordering::Relaxed);
+        let period = g.period_us.load(Ordering::Relaxed);
+        let (nr_periods, nr_throttled, throttled_time) = {
+            let bw = g.bandwidth.lock_irqsave();
+            (bw.nr_periods, bw.nr_throttled, bw.throttled_time)
+        };
+        let limit = g.mem.limit();
+        let page_size = crate::arch::MMArch::PAGE_SIZE;
+        s.push_str(&format!("{}\n", g.path));
+        s.push_str(&format!("  tasks {}\n", g.nr_tasks.load(Ordering::Relaxed)));
+        if quota < 0 {
+            s.push_str(&format!("  cpu.max max {}\n", period));
+        } else {
+            s.push_str(&format!("  cpu.max {} {}\n", quota, period));
+        }
+        s.push_str(&format!(
+            "  cpu.stat nr_periods={} nr_throttled={} throttled_usec={}\n",
+            nr_periods, nr_throttled, throttled_time
+        ));
+        s.push_str(&format!("  memory.current {}\n", g.mem.usage() * page_size));
+        if limit == usize::MAX {
+            s.push_str("  memory.max max\n");
+        } else {
+            s.push_str(&format!("  memory.max {}\n", limit * page_size));
+        }
+        s.push_str(&format!(
+            "  memory.peak {}\n  memory.failcnt {}\n",
+            g.mem.max_usage() * page_size,
+            g.mem.failcnt()
+        ));
+        s.push_str(&format!(
+            "  cpu.pressure {}\n",
+            g.psi.show(PsiResource::Cpu)
+        ));
+        s.push_str(&format!(
+            "  memory.pressure {}\n",
+            g.psi.show(PsiResource::Memory)
+        ));
+    }
+    return Ok(());
+}
+
+/// 写入`/proc/taskgroups`：执行一条管理命令（见模块的文档）
+pub fn task_groups_store(buf: &[u8]) -> Result<(), SystemError> {
+    let s = core::str::from_utf8(buf).map_err(|_| SystemError::EINVAL)?;
+    let args: Vec<&str> = s
+        .trim_matches(|c: char| c.is_whitespace() || c == '\0')
+        .split_whitespace()
+        .collect();
+    match args.as_slice() {
+        ["mkdir", path] => return task_group_mkdir(path),
+        ["rmdir", path] => return task_group_rmdir(path),
+        [path, "cpu.max", quota, rest @ ..] if rest.len() <= 1 => {
+            let group = find_task_group(path).ok_or(SystemError::ENOENT)?;
+            if group.parent.is_none() {
+                return Err(SystemError::EINVAL);
+            }
+            let period = match rest.first() {
+                Some(p) => p.parse::<u64>().map_err(|_| SystemError::EINVAL)?,
+                None => group.period_us.load(Ordering::Relaxed),
+            };
+            let quota = match *quota {
+                "max" => -1,
+                q => q.parse::<i64>().map_err(|_| SystemError::EINVAL)?,
+            };
+            if !(MIN_CFS_PERIOD_US..=MAX_CFS_PERIOD_US).contains(&period)
+                || (quota >= 0 && quota < MIN_CFS_QUOTA_US)
+                || quota < -1
+            {
+                return Err(SystemError::EINVAL);
+            }
+            group.set_cpu_max(quota, period);
+            return Ok(());
+        }
+        [path, "memory.max", bytes] => {
+            let group = find_task_group(path).ok_or(SystemError::ENOENT)?;
+            if group.parent.is_none() {
+                return Err(SystemError::EINVAL);
+            }
+            let bytes = match *bytes {
+                "max" => usize::MAX,
+                b => b.parse::<usize>().map_err(|_| SystemError::EINVAL)?,
+            };
+            mem_cgroup_set_limit(&group, bytes);
+            return Ok(());
+        }
+        [path, "attach", pid] => {
+            let group = find_task_group(path).ok_or(SystemError::ENOENT)?;
+            let pid = pid.parse::<usize>().map_err(|_| SystemError::EINVAL)?;
+            let pcb = ProcessManager::find(Pid::new(pid)).ok_or(SystemError::ESRCH)?;
+            task_group_attach(&pcb, group);
+            return Ok(());
+        }
+        _ => return Err(SystemError::EINVAL),
+    }
+}
@@ -1,6 +1,18 @@
 #![allow(dead_code)]
+use core::{
+    future::Future,
+    pin::Pin,
+    task::{Context, Poll},
+};
+
+use alloc::sync::Arc;
+
 use crate::{
-    libs::{spinlock::SpinLock, wait_queue::WaitQueue},
+    libs::{
+        spinlock::SpinLock,
+        wait_queue::{WaitQueue, WAIT_KEY_ANY},
+    },
+    process::executor::WaitQueueWaker,
     syscall::SystemError,
     time::timer::schedule_timeout,
 };
@@ -86,6 +98,17 @@ impl Completion {
         self.do_wait_for_common(timeout, true)
     }
 
+    /// 在异步任务中等待completion（见[`crate::process::executor`]）
+    ///
+    /// 与[`Completion::wait_for_completion`]相同，完成时消耗一个done。
+    /// 中断处理函数调用[`Completion::complete`]即可唤醒等待的任务
+    pub fn wait_async(&self) -> CompletionFuture {
+        return CompletionFuture {
+            completion: self,
+            waker: None,
+        };
+    }
+
     /// @brief 唤醒一个wait_queue中的节点
     pub fn complete(&self) {
         let mut inner = self.inner.lock_irqsave();
@@ -137,6 +160,41 @@ impl Completion {
         // 脱离生命周期，自动释放guard
     }
 }
+/// 等待completion的future，见[`Completion::wait_async`]
+#[derive(Debug)]
+pub struct CompletionFuture<'a> {
+    completion: &'a Completion,
+    waker: Option<Arc<WaitQueueWaker>>,
+}
+
+impl<'a> Future for CompletionFuture<'a> {
+    type Output = ();
+
+    fn poll(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<()> {
+        let this = self.get_mut();
+        // complete()在持有inner的锁时唤醒等待队列，因此在锁内检查并注册不会错过唤醒
+        let mut inner = this.completion.inner.lock_irqsave();
+        if inner.done != 0 {
+            if inner.done != COMPLETE_ALL {
+                inner.done -= 1;
+            }
+            WaitQueueWaker::disarm(&mut this.waker, &inner.wait_queue);
+            return Poll::Ready(());
+        }
+        WaitQueueWaker::arm(&mut this.waker, &inner.wait_queue, WAIT_KEY_ANY, cx.waker());
+        return Poll::Pending;
+    }
+}
+
+impl<'a> Drop for CompletionFuture<'a> {
+    fn drop(&mut self) {
+        if self.waker.is_some() {
+            let inner = self.completion.inner.lock_irqsave();
+            WaitQueueWaker::disarm(&mut self.waker, &inner.wait_queue);
+        }
+    }
+}
+
 #[derive(Debug)]
 pub struct InnerCompletion {
     done: u32,
@@ -6,16 +6,23 @@ use core::{
 use alloc::{sync::Arc, vec::Vec};
 
 use crate::{
-    include::bindings::bindings::smp_get_total_cpu,
+    arch::{sched::sched, CurrentIrqArch},
+    exception::InterruptArch,
     kinfo,
+    libs::rcu::rcu_tick,
     mm::percpu::PerCpu,
+    perf::perf_tick,
     process::{AtomicPid, Pid, ProcessControlBlock, ProcessFlags, ProcessManager, ProcessState},
     smp::core::smp_get_processor_id,
 };
 
-use super::rt::{sched_rt_init, SchedulerRT, __get_rt_scheduler};
 use super::{
-    cfs::{sched_cfs_init, SchedulerCFS, __get_cfs_scheduler},
+    balance::{cpu_load, idle_balance, sched_load_tick, select_task_cpu},
+    cfs::SchedulerCFS,
+    isolation::{tick_nohz_full_kick, tick_nohz_full_restart},
+    rq::{cpu_rq, rq_init, this_rq, RunQueueInner},
+    rt::SchedulerRT,
+    stats::{sched_stat_enqueue, sched_stat_migrate},
     SchedPolicy,
 };
 
@@ -49,58 +56,48 @@ impl CpuExecuting {
     }
 }
 
-// 获取某个cpu的负载情况，返回当前负载，cpu_id 是获取负载的cpu的id
-// TODO:将获取负载情况调整为最近一段时间运行进程的数量
+/// 获取某个cpu的负载情况，cpu_id 是获取负载的cpu的id
+///
+/// 返回最近一段时间内可运行进程数量的衰减平均值（一个一直可运行的进程的负载为[`super::balance::LOAD_SCALE`]）
 pub fn get_cpu_loads(cpu_id: u32) -> u32 {
-    let cfs_scheduler = __get_cfs_scheduler();
-    let rt_scheduler = __get_rt_scheduler();
-    let len_cfs = cfs_scheduler.get_cfs_queue_len(cpu_id as u32);
-    let len_rt = rt_scheduler.rt_queue_len(cpu_id as u32);
-    // let load_rt = rt_scheduler.get_load_list_len(cpu_id);
-    // kdebug!("this cpu_id {} is load rt {}", cpu_id, load_rt);
-
-    return (len_rt + len_cfs) as u32;
+    return cpu_load(cpu_id) as u32;
 }
-// 负载均衡
+
+/// 负载均衡：为被唤醒的进程选择运行的cpu（见[`select_task_cpu`]）
 pub fn loads_balance(pcb: Arc<ProcessControlBlock>) {
-    // 对pcb的迁移情况进行调整
-    // 获取总的CPU数量
-    let cpu_num = unsafe { smp_get_total_cpu() };
-    // 获取当前负载最小的CPU的id
-    let mut min_loads_cpu_id = smp_get_processor_id();
-    let mut min_loads = get_cpu_loads(smp_get_processor_id());
-    for cpu_id in 0..cpu_num {
-        let tmp_cpu_loads = get_cpu_loads(cpu_id);
-        if min_loads - tmp_cpu_loads > 0 {
-            min_loads_cpu_id = cpu_id;
-            min_loads = tmp_cpu_loads;
+    let pcb_cpu = pcb.sched_info().on_cpu();
+    // 时间片耗尽后被重新加入队列的进程，还在原来的cpu上运行，不能迁移
+    if let Some(cpu_id) = pcb_cpu {
+        if CPU_EXECUTING.get(cpu_id) == pcb.pid() {
+            return;
         }
     }
 
-    let pcb_cpu = pcb.sched_info().on_cpu();
-    // 将当前pcb迁移到负载最小的CPU
+    let target_cpu_id = select_task_cpu(&pcb);
+    // 将当前pcb迁移到选出的CPU
     // 如果当前pcb的PF_NEED_MIGRATE已经置位，则不进行迁移操作
     if pcb_cpu.is_none()
-        || (min_loads_cpu_id != pcb_cpu.unwrap()
-            && !pcb.flags().contains(ProcessFlags::NEED_MIGRATE))
+        || (target_cpu_id != pcb_cpu.unwrap() && !pcb.flags().contains(ProcessFlags::NEED_MIGRATE))
     {
         pcb.flags().insert(ProcessFlags::NEED_MIGRATE);
-        pcb.sched_info().set_migrate_to(Some(min_loads_cpu_id));
+        pcb.sched_info().set_migrate_to(Some(target_cpu_id));
         // kdebug!("set migrating, pcb:{:?}", pcb);
     }
 }
 /// @brief 具体的调度器应当实现的trait
 pub trait Scheduler {
     /// @brief 使用该调度器发起调度的时候，要调用的函数
-    fn sched(&mut self) -> Option<Arc<ProcessControlBlock>>;
+    ///
+    /// - `rq`：当前cpu的运行队列（已经加锁）
+    fn sched(&self, rq: &mut RunQueueInner) -> Option<Arc<ProcessControlBlock>>;
 
-    /// @brief 将pcb加入这个调度器的调度队列
-    fn enqueue(&mut self, pcb: Arc<ProcessControlBlock>);
+    /// @brief 将pcb加入这个调度器在运行队列`rq`中的队列
+    fn enqueue(&self, rq: &mut RunQueueInner, pcb: Arc<ProcessControlBlock>);
 }
 
 pub fn do_sched() -> Option<Arc<ProcessControlBlock>> {
     // 当前进程持有锁，不切换，避免死锁
-    if ProcessManager::current_pcb().preempt_count() != 0 {
+    if ProcessManager::current().preempt_count() != 0 {
         let binding = ProcessManager::current_pcb();
         let guard = binding.sched_info_try_upgradeable_irqsave(5);
         if unlikely(guard.is_none()) {
@@ -129,23 +126,25 @@ pub fn do_sched() -> Option<Arc<ProcessControlBlock>> {
     }
 
     compiler_fence(core::sync::atomic::Ordering::SeqCst);
-    let cfs_scheduler: &mut SchedulerCFS = __get_cfs_scheduler();
-    let rt_scheduler: &mut SchedulerRT = __get_rt_scheduler();
-    compiler_fence(core::sync::atomic::Ordering::SeqCst);
+    let rq = this_rq();
+    // 此时上一次切换出去的进程已经保存了上下文，可以迁移
+    sched_migrate_pending();
 
-    let next: Arc<ProcessControlBlock>;
-    match rt_scheduler.pick_next_task_rt(smp_get_processor_id()) {
-        Some(p) => {
-            next = p;
-            // 将pick的进程放回原处
-            rt_scheduler.enqueue_front(next);
+    // 当前cpu即将空闲时，先从其他cpu窃取进程（需要在锁住当前cpu的运行队列之前进行）
+    let current = ProcessManager::current_pcb();
+    if (current.pid().into() == 0 || current.sched_info().state() != ProcessState::Runnable)
+        && rq.nr_running() == 0
+    {
+        idle_balance(rq.cpu_id());
+    }
+    drop(current);
 
-            return rt_scheduler.sched();
-        }
-        None => {
-            return cfs_scheduler.sched();
-        }
+    let mut guard = rq.lock_irqsave();
+    compiler_fence(core::sync::atomic::Ordering::SeqCst);
+    if guard.rt.len() > 0 {
+        return SchedulerRT.sched(&mut guard);
     }
+    return SchedulerCFS.sched(&mut guard);
 }
 
 /// @brief 将进程加入调度队列
@@ -157,8 +156,6 @@ pub fn sched_enqueue(pcb: Arc<ProcessControlBlock>, mut reset_time: bool) {
     if pcb.sched_info().state() != ProcessState::Runnable {
         return;
     }
-    let cfs_scheduler = __get_cfs_scheduler();
-    let rt_scheduler = __get_rt_scheduler();
     // 除了IDLE以外的进程，都进行负载均衡
     if pcb.pid().into() > 0 {
         loads_balance(pcb.clone());
@@ -167,21 +164,51 @@ pub fn sched_enqueue(pcb: Arc<ProcessControlBlock>, mut reset_time: bool) {
     if pcb.flags().contains(ProcessFlags::NEED_MIGRATE) {
         // kdebug!("migrating pcb:{:?}", pcb);
         pcb.flags().remove(ProcessFlags::NEED_MIGRATE);
-        pcb.sched_info().set_on_cpu(pcb.sched_info().migrate_to());
+        let prev_cpu = pcb.sched_info().on_cpu();
+        let migrate_to = pcb.sched_info().migrate_to();
+        pcb.sched_info().set_on_cpu(migrate_to);
+        if let (Some(prev_cpu), Some(dst_cpu)) = (prev_cpu, migrate_to) {
+            if prev_cpu != dst_cpu {
+                sched_stat_migrate(dst_cpu, &pcb);
+            }
+        }
         reset_time = true;
     }
 
-    assert!(pcb.sched_info().on_cpu().is_some());
+    let cpu_id = pcb.sched_info().on_cpu().expect("pcb is not on any cpu");
+    sched_stat_enqueue(cpu_id, &pcb, cpu_id == smp_get_processor_id());
+    cpu_rq(cpu_id)
+        .lock_irqsave()
+        .enqueue_task(pcb.clone(), reset_time);
 
-    match pcb.sched_info().policy() {
-        SchedPolicy::CFS => {
-            if reset_time {
-                cfs_scheduler.enqueue_reset_vruntime(pcb.clone());
-            } else {
-                cfs_scheduler.enqueue(pcb.clone());
-            }
+    if cpu_id == smp_get_processor_id() {
+        // 被唤醒的进程可能需要抢占当前进程
+        if pcb.sched_info().policy().is_fair() {
+            SchedulerCFS::check_preempt_wakeup(&pcb);
         }
-        SchedPolicy::FIFO | SchedPolicy::RR => rt_scheduler.enqueue(pcb.clone()),
+        // 有两个可运行的进程了，需要时钟中断来轮转时间片
+        tick_nohz_full_restart();
+    } else {
+        // 目标cpu可能正在空闲等待，需要唤醒它
+        ProcessManager::wake_idle_cpu(cpu_id);
+        tick_nohz_full_kick(cpu_id);
+    }
+}
+
+/// 把当前cpu上等待迁移的进程放入允许它们运行的cpu的运行队列
+///
+/// 请注意，只能在等待迁移的进程都已经完成了上下文切换之后调用（例如切换到下一个进程之后），
+/// 并且不能持有任何运行队列的锁
+pub fn sched_migrate_pending() {
+    let rq = this_rq();
+    if !rq.has_migrate_pending() {
+        return;
+    }
+    let pending = core::mem::take(&mut rq.lock_irqsave().migrate_pending);
+    for pcb in pending {
+        // 之前选出的迁移目标可能也不再被允许，重新选择
+        pcb.flags().remove(ProcessFlags::NEED_MIGRATE);
+        sched_enqueue(pcb, false);
     }
 }
 
@@ -190,16 +217,17 @@ pub fn sched_enqueue(pcb: Arc<ProcessControlBlock>, mut reset_time: bool) {
 #[no_mangle]
 pub extern "C" fn sched_init() {
     kinfo!("Initializing schedulers...");
-    unsafe {
-        sched_cfs_init();
-        sched_rt_init();
-    }
+    rq_init();
     kinfo!("Schedulers initialized");
 }
 
 /// @brief 当时钟中断到达时，更新时间片
 /// 请注意，该函数只能被时钟中断处理程序调用
 pub extern "C" fn sched_update_jiffies() {
+    sched_load_tick();
+    rcu_tick();
+    perf_tick();
+
     let binding = ProcessManager::current_pcb();
     let guard = binding.try_sched_info(10);
     if unlikely(guard.is_none()) {
@@ -208,11 +236,50 @@ pub extern "C" fn sched_update_jiffies() {
     let guard = guard.unwrap();
     let policy = guard.policy();
     match policy {
-        SchedPolicy::CFS => {
-            __get_cfs_scheduler().timer_update_jiffies(&guard);
+        SchedPolicy::CFS | SchedPolicy::BATCH | SchedPolicy::IDLE => {
+            // 运行队列正在被修改时，本次不更新
+            let mut rq = None;
+            for _ in 0..10 {
+                rq = this_rq().try_lock_irqsave();
+                if rq.is_some() {
+                    break;
+                }
+            }
+            if let Some(mut rq) = rq {
+                SchedulerCFS::timer_update_jiffies(&mut rq, &guard);
+            }
         }
         SchedPolicy::FIFO | SchedPolicy::RR => {
-            __get_rt_scheduler().timer_update_jiffies();
+            SchedulerRT::timer_update_jiffies();
         }
     }
 }
+
+/// 可能长时间运行的内核循环中的抢占点
+///
+/// 如果当前进程需要被调度（时钟中断用完了时间片，或者唤醒了优先级更高的进程），并且此时允许抢占
+/// （没有持有自旋锁、没有关中断），则主动让出cpu；否则什么也不做，因此可以放在任何循环中
+#[inline]
+pub fn cond_resched() {
+    if unlikely(!ProcessManager::initialized()) {
+        return;
+    }
+    let current = ProcessManager::current();
+    if !current.flags().contains(ProcessFlags::NEED_SCHEDULE)
+        || current.preempt_count() != 0
+        || !CurrentIrqArch::is_irq_enabled()
+    {
+        return;
+    }
+    drop(current);
+    sched();
+}
+
+/// 中断返回时是否对任何中断都检查抢占（见Cargo的`preempt_full`特性）
+///
+/// 不启用时，只在时钟中断返回时抢占；启用后，其他中断（例如磁盘、网卡中断唤醒了实时进程）返回时
+/// 也会立即切换到需要运行的进程，唤醒延迟不再受时钟中断的间隔限制
+#[no_mangle]
+pub extern "C" fn rs_preempt_full() -> bool {
+    return cfg!(feature = "preempt_full");
+}
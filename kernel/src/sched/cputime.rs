@@ -0,0 +1,277 @@
+//! 进程和cpu的时间统计
+//!
+//! 每个cpu记录它当前所处的上下文（用户态、内核态、软中断、硬中断、空闲）和进入这个上下文时的TSC。
+//! 进出内核（系统调用、缺页异常）、中断、软中断以及上下文切换时，把上一段时间记到之前的上下文上：
+//! 记到cpu的统计信息中（通过`/proc/stat`导出），如果是用户态或者内核态，同时记到当前进程上。
+//! 因此进程的时间不包括它被中断打断的时间，并且不依赖时钟中断的采样（停止了时钟中断的cpu上也是准确的）。
+//!
+//! 进程被切换出去时保存它所处的上下文，切换回来时恢复：例如在中断返回用户态之前被抢占的进程，
+//! 切换回来之后仍然处于用户态。
+//!
+//! 时间以TSC周期为单位记录，读取时换算为纳秒。
+
+use core::sync::atomic::{AtomicU64, AtomicU8, Ordering};
+
+use alloc::string::String;
+
+use crate::{
+    arch::{driver::tsc::TSCManager, CurrentIrqArch, CurrentTimeArch},
+    exception::InterruptArch,
+    mm::percpu::PerCpu,
+    process::{Pid, ProcessControlBlock, ProcessManager},
+    smp::core::smp_get_processor_id,
+    time::{TimeArch, NSEC_PER_SEC},
+};
+
+use super::core::CPU_EXECUTING;
+
+/// 用户程序看到的时钟频率（`sysconf(_SC_CLK_TCK)`），times和procfs中的时间以它为单位
+pub const USER_HZ: u64 = 100;
+
+/// cpu所处的上下文
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[repr(u8)]
+pub enum CpuTimeContext {
+    System = 0,
+    User = 1,
+    Softirq = 2,
+    Irq = 3,
+    Idle = 4,
+}
+
+const NR_CPUTIME_CONTEXTS: usize = 5;
+
+impl From<u8> for CpuTimeContext {
+    fn from(value: u8) -> Self {
+        match value {
+            1 => CpuTimeContext::User,
+            2 => CpuTimeContext::Softirq,
+            3 => CpuTimeContext::Irq,
+            4 => CpuTimeContext::Idle,
+            _ => CpuTimeContext::System,
+        }
+    }
+}
+
+/// 一个cpu的时间统计
+#[derive(Debug)]
+#[repr(align(64))]
+struct CpuCputime {
+    /// 进入当前上下文时的TSC
+    last: AtomicU64,
+    /// 当前上下文
+    ctx: AtomicU8,
+    /// 各个上下文的时间之和（TSC周期）
+    stat: [AtomicU64; NR_CPUTIME_CONTEXTS],
+}
+
+impl CpuCputime {
+    const fn new() -> Self {
+        const ZERO: AtomicU64 = AtomicU64::new(0);
+        return Self {
+            last: AtomicU64::new(0),
+            ctx: AtomicU8::new(CpuTimeContext::System as u8),
+            stat: [ZERO; NR_CPUTIME_CONTEXTS],
+        };
+    }
+}
+
+static CPU_CPUTIME: [CpuCputime; PerCpu::MAX_CPU_NUM] =
+    [const { CpuCputime::new() }; PerCpu::MAX_CPU_NUM];
+
+/// 一个进程的时间统计
+#[derive(Debug, Default)]
+pub struct TaskCputime {
+    /// 用户态时间（TSC周期）
+    utime: AtomicU64,
+    /// 内核态时间（TSC周期）
+    stime: AtomicU64,
+    /// 已经被回收的子进程（以及它们回收的子进程）的用户态、内核态时间之和
+    cutime: AtomicU64,
+    cstime: AtomicU64,
+    /// 被切换出去时所处的上下文（新进程从内核态开始运行）
+    ctx: AtomicU8,
+}
+
+/// 以纳秒为单位的进程时间
+#[derive(Debug, Clone, Copy, Default)]
+pub struct CputimeNs {
+    pub utime: u64,
+    pub stime: u64,
+    pub cutime: u64,
+    pub cstime: u64,
+}
+
+impl CputimeNs {
+    #[inline]
+    pub fn total(&self) -> u64 {
+        return self.utime + self.stime;
+    }
+}
+
+impl TaskCputime {
+    /// 回收子进程时，把子进程的时间加到父进程上
+    pub fn reap_child(&self, child: &TaskCputime) {
+        let utime = child.utime.load(Ordering::Relaxed) + child.cutime.load(Ordering::Relaxed);
+        let stime = child.stime.load(Ordering::Relaxed) + child.cstime.load(Ordering::Relaxed);
+        self.cutime.fetch_add(utime, Ordering::Relaxed);
+        self.cstime.fetch_add(stime, Ordering::Relaxed);
+    }
+}
+
+/// TSC周期数换算为纳秒
+#[inline]
+pub fn cycles_to_ns(cycles: u64) -> u64 {
+    let khz = TSCManager::tsc_khz();
+    if khz == 0 {
+        return 0;
+    }
+    return (cycles as u128 * 1_000_000 / khz as u128) as u64;
+}
+
+/// 纳秒换算为`USER_HZ`的时钟滴答数
+#[inline]
+pub fn ns_to_clock_t(ns: u64) -> u64 {
+    return ns / (NSEC_PER_SEC as u64 / USER_HZ);
+}
+
+/// 当前cpu从进入当前上下文到`now`经过的TSC周期数（还没有开始统计时为0）
+#[inline(always)]
+fn elapsed(cpu: &CpuCputime, now: u64) -> u64 {
+    let last = cpu.last.load(Ordering::Relaxed);
+    if last == 0 {
+        return 0;
+    }
+    return now.saturating_sub(last);
+}
+
+/// 把当前cpu从上次切换以来的时间记到之前的上下文上（需要关中断）
+///
+/// `task`：当前进程，为None时从当前cpu获取
+#[inline(always)]
+fn account(cpu: &CpuCputime, task: Option<&ProcessControlBlock>, now: u64) -> CpuTimeContext {
+    let ctx = CpuTimeContext::from(cpu.ctx.load(Ordering::Relaxed));
+    let delta = elapsed(cpu, now);
+    cpu.last.store(now, Ordering::Relaxed);
+    cpu.stat[ctx as usize].fetch_add(delta, Ordering::Relaxed);
+
+    let counter = |t: &TaskCputime| match ctx {
+        CpuTimeContext::User => t.utime.fetch_add(delta, Ordering::Relaxed),
+        _ => t.stime.fetch_add(delta, Ordering::Relaxed),
+    };
+    if matches!(ctx, CpuTimeContext::User | CpuTimeContext::System) {
+        match task {
+            Some(task) => {
+                counter(task.cputime());
+            }
+            None => {
+                if ProcessManager::initialized() {
+                    counter(ProcessManager::current_pcb().cputime());
+                }
+            }
+        }
+    }
+    return ctx;
+}
+
+/// 当前cpu切换到上下文`ctx`，返回之前的上下文
+///
+/// 在进出内核、中断、软中断的路径上调用，返回值用于退出时恢复之前的上下文
+#[inline]
+pub fn cputime_switch(ctx: CpuTimeContext) -> CpuTimeContext {
+    let _guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+    let cpu = &CPU_CPUTIME[smp_get_processor_id() as usize];
+    let prev = account(cpu, None, CurrentTimeArch::get_cycles() as u64);
+    cpu.ctx.store(ctx as u8, Ordering::Relaxed);
+    return prev;
+}
+
+/// 在`cpu_id`上从`prev`切换到`next`之前调用（需要关中断）
+pub fn cputime_task_switch(cpu_id: u32, prev: &ProcessControlBlock, next: &ProcessControlBlock) {
+    let cpu = &CPU_CPUTIME[cpu_id as usize];
+    let ctx = account(cpu, Some(prev), CurrentTimeArch::get_cycles() as u64);
+    // 进程只可能在内核态（或者即将从中断返回用户态时）被切换出去
+    let saved = match ctx {
+        CpuTimeContext::User => CpuTimeContext::User,
+        _ => CpuTimeContext::System,
+    };
+    prev.cputime().ctx.store(saved as u8, Ordering::Relaxed);
+    let next_ctx = if next.pid() == Pid::new(0) {
+        CpuTimeContext::Idle
+    } else {
+        CpuTimeContext::from(next.cputime().ctx.load(Ordering::Relaxed))
+    };
+    cpu.ctx.store(next_ctx as u8, Ordering::Relaxed);
+}
+
+/// 中断处理开始时调用（由do_IRQ调用），返回之前的上下文
+#[no_mangle]
+extern "C" fn rs_cputime_irq_enter() -> u8 {
+    return cputime_switch(CpuTimeContext::Irq) as u8;
+}
+
+/// 中断处理结束时调用（由do_IRQ调用），恢复之前的上下文
+#[no_mangle]
+extern "C" fn rs_cputime_irq_exit(prev: u8) {
+    cputime_switch(CpuTimeContext::from(prev));
+}
+
+/// 获取进程的时间（纳秒）
+///
+/// 进程正在运行时，加上它在当前上下文中已经运行的时间
+pub fn task_cputime(pcb: &ProcessControlBlock) -> CputimeNs {
+    let t = pcb.cputime();
+    let mut utime = t.utime.load(Ordering::Relaxed);
+    let mut stime = t.stime.load(Ordering::Relaxed);
+
+    let on_cpu = pcb.sched_info().on_cpu();
+    let _guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+    if let Some(cpu_id) = on_cpu {
+        if CPU_EXECUTING.get(cpu_id) == pcb.pid() {
+            // 不同cpu的TSC是同步的，可以直接用当前cpu的TSC计算
+            let cpu = &CPU_CPUTIME[cpu_id as usize];
+            let delta = elapsed(cpu, CurrentTimeArch::get_cycles() as u64);
+            match CpuTimeContext::from(cpu.ctx.load(Ordering::Relaxed)) {
+                CpuTimeContext::User => utime += delta,
+                CpuTimeContext::System => stime += delta,
+                _ => {}
+            }
+        }
+    }
+
+    return CputimeNs {
+        utime: cycles_to_ns(utime),
+        stime: cycles_to_ns(stime),
+        cutime: cycles_to_ns(t.cutime.load(Ordering::Relaxed)),
+        cstime: cycles_to_ns(t.cstime.load(Ordering::Relaxed)),
+    };
+}
+
+/// 获取cpu在各个上下文中的时间（纳秒），按照[`CpuTimeContext`]的顺序
+pub fn cpu_cputime(cpu_id: usize) -> [u64; NR_CPUTIME_CONTEXTS] {
+    let cpu = &CPU_CPUTIME[cpu_id];
+    let mut stat = [0; NR_CPUTIME_CONTEXTS];
+    for (i, v) in stat.iter_mut().enumerate() {
+        *v = cpu.stat[i].load(Ordering::Relaxed);
+    }
+    // 加上当前上下文中已经经过的时间（只读，不修改统计信息）
+    let delta = elapsed(cpu, CurrentTimeArch::get_cycles() as u64);
+    stat[cpu.ctx.load(Ordering::Relaxed) as usize % NR_CPUTIME_CONTEXTS] += delta;
+    return stat.map(cycles_to_ns);
+}
+
+/// 生成`/proc/stat`中一行cpu的统计信息（单位：`USER_HZ`）
+///
+/// 格式与Linux相同：user nice system idle iowait irq softirq steal guest guest_nice
+pub fn cpu_stat_line(name: &str, stat: &[u64; NR_CPUTIME_CONTEXTS]) -> String {
+    let t = |ctx: CpuTimeContext| ns_to_clock_t(stat[ctx as usize]);
+    return alloc::format!(
+        "{} {} 0 {} {} 0 {} {} 0 0 0\n",
+        name,
+        t(CpuTimeContext::User),
+        t(CpuTimeContext::System),
+        t(CpuTimeContext::Idle),
+        t(CpuTimeContext::Irq),
+        t(CpuTimeContext::Softirq)
+    );
+}
@@ -0,0 +1,360 @@
+//! CPU隔离与完全无时钟中断（nohz_full）的cpu
+//!
+//! 对延迟敏感的进程（例如轮询网卡的收包线程）需要独占一些cpu，不受内核的任何打扰。
+//! 这些cpu可以在启动时通过内核命令行（`isolcpus=1-3`、`nohz_full=2,3`）指定，
+//! 也可以在运行时写入`/proc/isolated_cpus`、`/proc/nohz_full`修改（格式相同，写入空字符串表示清空）。
+//!
+//! 被隔离的cpu（isolcpus和nohz_full的并集）：
+//! - 不参与负载均衡：不会从其他cpu拉取进程，它上面的进程也不会被迁移走，被唤醒的进程只有在
+//!   亲和性只允许这些cpu时才会被放到它们上面。进程默认的cpu亲和性也不包括它们，
+//!   需要通过sched_setaffinity显式地把进程绑定上去；
+//! - 之后创建的、不绑定cpu的内核线程（包括不绑定cpu的工作队列的worker）不会在它们上面运行；
+//! - 外部中断默认不投递到它们上面，已经投递过去的中断会被迁移走（显式设置的smp_affinity除外）。
+//!
+//! nohz_full的cpu只运行一个进程，并且近期没有定时器到期、不需要推进RCU宽限期时，
+//! 完全停止时钟中断（最长[`NOHZ_FULL_MAX_JIFFIES`]产生一次）。有新的进程加入运行队列、
+//! 在这个cpu上启动了更早到期的定时器、或者新的宽限期需要它报告静止状态时，恢复周期性的时钟中断。
+//!
+//! cpu 0负责全局的计时（HPET中断更新jiffies），不能被隔离。
+
+use core::{
+    fmt::Write,
+    sync::atomic::{AtomicBool, Ordering},
+};
+
+use alloc::string::String;
+
+use crate::{
+    arch::{
+        driver::apic::apic_timer::{apic_timer_restart_tick, apic_timer_stop_tick},
+        setup::boot_cmdline,
+        CurrentIrqArch,
+    },
+    exception::{
+        irqdesc::{irq_affinity_isolate, mask_test},
+        InterruptArch,
+    },
+    filesystem::vfs::seq_file::SeqBuf,
+    kinfo, kwarn,
+    libs::rcu::rcu_needs_cpu,
+    mm::percpu::PerCpu,
+    process::{kthread::KernelThreadMechanism, ProcessFlags, ProcessManager},
+    smp::{
+        call_function::{smp_call_function_many, smp_call_function_single},
+        core::smp_get_processor_id,
+        cpu::{AtomicCpuMask, CPU_MASK_WORDS},
+    },
+    syscall::SystemError,
+    time::{
+        clocksource::HZ,
+        hrtimer::{hrtimer_next_expire_us, hrtimer_programmed},
+        timer::{clock, timer_get_first_expire},
+    },
+};
+
+use super::rq::this_rq;
+
+/// 时钟中断的间隔（单位：jiffies，即微秒）
+const TICK_JIFFIES: u64 = 1000000 / HZ;
+/// nohz_full的cpu停止时钟中断之后，最多多长时间产生一次时钟中断（单位：jiffies）
+const NOHZ_FULL_MAX_JIFFIES: u64 = 1000000;
+
+/// 被隔离的cpu（isolcpus）
+static ISOLATED_CPUS: AtomicCpuMask = AtomicCpuMask::new();
+/// nohz_full的cpu
+static NOHZ_FULL_CPUS: AtomicCpuMask = AtomicCpuMask::new();
+/// 是否有nohz_full的cpu。没有时，定时器和调度器的热路径上不需要做任何检查
+static NOHZ_FULL_ENABLED: AtomicBool = AtomicBool::new(false);
+/// 每个nohz_full的cpu是否正在运行进程、并且停止了时钟中断
+static TICK_STOPPED: [AtomicBool; PerCpu::MAX_CPU_NUM] =
+    [const { AtomicBool::new(false) }; PerCpu::MAX_CPU_NUM];
+
+/// cpu是否被隔离（isolcpus或者nohz_full）
+#[inline]
+pub fn cpu_is_isolated(cpu_id: u32) -> bool {
+    return ISOLATED_CPUS.get(cpu_id as usize) || NOHZ_FULL_CPUS.get(cpu_id as usize);
+}
+
+/// 被隔离的cpu（isolcpus和nohz_full的并集）
+fn isolated_mask() -> [u64; CPU_MASK_WORDS] {
+    let mut mask = ISOLATED_CPUS.words();
+    let nohz_full = NOHZ_FULL_CPUS.words();
+    for i in 0..CPU_MASK_WORDS {
+        mask[i] |= nohz_full[i];
+    }
+    return mask;
+}
+
+/// 没有被隔离的cpu，内核的后台工作在这些cpu上执行。进程默认的cpu亲和性也是这个掩码
+pub fn housekeeping_mask() -> [u64; CPU_MASK_WORDS] {
+    let isolated = isolated_mask();
+    let mut mask = [u64::MAX; CPU_MASK_WORDS];
+    for i in 0..CPU_MASK_WORDS {
+        mask[i] &= !isolated[i];
+    }
+    if PerCpu::MAX_CPU_NUM % 64 != 0 {
+        mask[CPU_MASK_WORDS - 1] &= (1 << (PerCpu::MAX_CPU_NUM % 64)) - 1;
+    }
+    return mask;
+}
+
+/// nohz_full的cpu是否正在运行进程、并且停止了时钟中断
+#[inline(always)]
+pub fn cpu_tick_stopped(cpu_id: u32) -> bool {
+    return TICK_STOPPED[cpu_id as usize].load(Ordering::SeqCst);
+}
+
+/// 解析形如`1-3,5`的cpu列表
+fn parse_cpu_list(s: &str) -> Result<[u64; CPU_MASK_WORDS], SystemError> {
+    let mut mask = [0u64; CPU_MASK_WORDS];
+    for part in s.split(',') {
+        let part = part.trim();
+        if part.is_empty() {
+            continue;
+        }
+        let parse = |n: &str| n.trim().parse::<usize>().map_err(|_| SystemError::EINVAL);
+        let (start, end) = match part.split_once('-') {
+            Some((a, b)) => (parse(a)?, parse(b)?),
+            None => (parse(part)?, parse(part)?),
+        };
+        if start > end || end >= PerCpu::MAX_CPU_NUM {
+            return Err(SystemError::EINVAL);
+        }
+        for cpu in start..=end {
+            mask[cpu / 64] |= 1 << (cpu % 64);
+        }
+    }
+    // cpu 0负责全局的计时
+    if mask_test(&mask, 0) {
+        return Err(SystemError::EINVAL);
+    }
+    return Ok(mask);
+}
+
+/// 把cpu掩码格式化为形如`1-3,5`的cpu列表
+fn format_cpu_list(mask: &[u64; CPU_MASK_WORDS]) -> String {
+    let mut s = String::new();
+    let mut cpu = 0;
+    while cpu < PerCpu::MAX_CPU_NUM {
+        if !mask_test(mask, cpu) {
+            cpu += 1;
+            continue;
+        }
+        let start = cpu;
+        while mask_test(mask, cpu + 1) {
+            cpu += 1;
+        }
+        if !s.is_empty() {
+            s.push(',');
+        }
+        if start == cpu {
+            write!(s, "{}", start).ok();
+        } else {
+            write!(s, "{}-{}", start, cpu).ok();
+        }
+        cpu += 1;
+    }
+    s.push('\n');
+    return s;
+}
+
+/// 设置nohz_full的cpu，不再是nohz_full的cpu立即恢复周期性的时钟中断
+fn set_nohz_full(mask: &[u64; CPU_MASK_WORDS]) {
+    let old = NOHZ_FULL_CPUS.words();
+    NOHZ_FULL_CPUS.store_words(mask);
+    let mut removed = [0u64; CPU_MASK_WORDS];
+    for i in 0..CPU_MASK_WORDS {
+        removed[i] = old[i] & !mask[i];
+    }
+    tick_nohz_full_kick_mask(&removed);
+    tick_nohz_full_restart();
+    NOHZ_FULL_ENABLED.store(!NOHZ_FULL_CPUS.is_empty(), Ordering::SeqCst);
+}
+
+/// 隔离的cpu改变之后，更新中断的亲和性和之后创建的内核线程的亲和性
+///
+/// 不再被隔离的cpu不会自动恢复为中断允许投递的cpu，需要时请通过smp_affinity设置
+fn isolation_apply() {
+    irq_affinity_isolate(&isolated_mask());
+    KernelThreadMechanism::set_default_affinity(&housekeeping_mask());
+}
+
+/// 从内核命令行中读取`isolcpus=`和`nohz_full=`（需要在创建第一个进程之前调用）
+///
+/// 与Linux兼容，`isolcpus=`中cpu列表之前的标志（例如`domain,managed_irq,`）会被忽略
+pub fn isolation_init() {
+    let cmdline = boot_cmdline();
+    for arg in cmdline.split_whitespace() {
+        let (key, value) = match arg.split_once('=') {
+            Some(kv) => kv,
+            None => continue,
+        };
+        if key != "isolcpus" && key != "nohz_full" {
+            continue;
+        }
+        let list = value
+            .split(',')
+            .filter(|part| part.starts_with(|c: char| c.is_ascii_digit()))
+            .collect::<alloc::vec::Vec<_>>()
+            .join(",");
+        let mask = match parse_cpu_list(&list) {
+            Ok(mask) => mask,
+            Err(_) => {
+                kwarn!("Invalid cpu list in boot option: {}", arg);
+                continue;
+            }
+        };
+        if key == "isolcpus" {
+            ISOLATED_CPUS.store_words(&mask);
+        } else {
+            set_nohz_full(&mask);
+        }
+    }
+    if !ISOLATED_CPUS.is_empty() || !NOHZ_FULL_CPUS.is_empty() {
+        kinfo!(
+            "CPU isolation: isolcpus={} nohz_full={}",
+            format_cpu_list(&ISOLATED_CPUS.words()).trim_end(),
+            format_cpu_list(&NOHZ_FULL_CPUS.words()).trim_end()
+        );
+    }
+}
+
+fn parse_proc_write(buf: &[u8]) -> Result<[u64; CPU_MASK_WORDS], SystemError> {
+    let s = core::str::from_utf8(buf).map_err(|_| SystemError::EINVAL)?;
+    return parse_cpu_list(s.trim_matches(|c: char| c.is_whitespace() || c == '\0'));
+}
+
+/// `/proc/isolated_cpus`：被隔离的cpu
+pub fn isolated_cpus_show(s: &mut SeqBuf) -> Result<(), SystemError> {
+    s.push_str(&format_cpu_list(&ISOLATED_CPUS.words()));
+    return Ok(());
+}
+
+/// 写入`/proc/isolated_cpus`：设置被隔离的cpu
+pub fn isolated_cpus_store(buf: &[u8]) -> Result<(), SystemError> {
+    let mask = parse_proc_write(buf)?;
+    ISOLATED_CPUS.store_words(&mask);
+    isolation_apply();
+    return Ok(());
+}
+
+/// `/proc/nohz_full`：nohz_full的cpu
+pub fn nohz_full_show(s: &mut SeqBuf) -> Result<(), SystemError> {
+    s.push_str(&format_cpu_list(&NOHZ_FULL_CPUS.words()));
+    return Ok(());
+}
+
+/// 写入`/proc/nohz_full`：设置nohz_full的cpu（它们同时也被隔离）
+pub fn nohz_full_store(buf: &[u8]) -> Result<(), SystemError> {
+    let mask = parse_proc_write(buf)?;
+    set_nohz_full(&mask);
+    isolation_apply();
+    return Ok(());
+}
+
+/// 尝试停止当前cpu的时钟中断
+///
+/// 请注意，调用者需要关中断
+fn tick_nohz_full_try_stop(cpu_id: u32) -> bool {
+    let current = ProcessManager::current();
+    // idle进程由NO_HZ idle负责停止时钟中断
+    if current.pid().into() == 0 || current.flags().contains(ProcessFlags::NEED_SCHEDULE) {
+        return false;
+    }
+    drop(current);
+    // 还有其他进程在等待运行时，需要时钟中断来轮转时间片
+    if this_rq().nr_running() != 0 || rcu_needs_cpu(cpu_id) {
+        return false;
+    }
+    let now = clock();
+    let delta = match timer_get_first_expire() {
+        Ok(0) => NOHZ_FULL_MAX_JIFFIES,
+        Ok(expire) => expire.saturating_sub(now),
+        Err(_) => return false,
+    };
+    let delta = delta.min(hrtimer_next_expire_us().unwrap_or(u64::MAX));
+    if delta < 2 * TICK_JIFFIES {
+        return false;
+    }
+    apic_timer_stop_tick(delta.min(NOHZ_FULL_MAX_JIFFIES));
+    TICK_STOPPED[cpu_id as usize].store(true, Ordering::SeqCst);
+    // 与rcu_gp_start()配对：要么新的宽限期看到了这个cpu停止了时钟中断，要么这里看到了新的宽限期
+    if rcu_needs_cpu(cpu_id) {
+        tick_nohz_full_restart();
+    }
+    return true;
+}
+
+/// 在时钟中断（包括停止时钟中断期间唯一的那次中断）的最后调用：
+/// 如果当前cpu是nohz_full的cpu，并且满足条件，停止时钟中断；否则恢复周期性的时钟中断
+///
+/// 请注意，该函数只能被时钟中断处理程序调用
+pub fn tick_nohz_full_tick() {
+    if !NOHZ_FULL_ENABLED.load(Ordering::Relaxed) {
+        return;
+    }
+    let cpu_id = smp_get_processor_id();
+    if !NOHZ_FULL_CPUS.get(cpu_id as usize) {
+        return;
+    }
+    let was_stopped = TICK_STOPPED[cpu_id as usize].swap(false, Ordering::SeqCst);
+    if tick_nohz_full_try_stop(cpu_id) {
+        return;
+    }
+    // 一次性的中断已经到期。高精度定时器设置了APIC定时器时，由它负责恢复
+    if was_stopped && !hrtimer_programmed(cpu_id) {
+        apic_timer_restart_tick();
+    }
+}
+
+/// 如果当前cpu停止了时钟中断，恢复周期性的时钟中断
+pub fn tick_nohz_full_restart() {
+    if !NOHZ_FULL_ENABLED.load(Ordering::Relaxed) {
+        return;
+    }
+    let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+    let cpu_id = smp_get_processor_id();
+    if TICK_STOPPED[cpu_id as usize].swap(false, Ordering::SeqCst) && !hrtimer_programmed(cpu_id) {
+        apic_timer_restart_tick();
+    }
+    drop(irq_guard);
+}
+
+/// 让停止了时钟中断的`cpu_id`恢复周期性的时钟中断（例如向它的运行队列加入了进程之后）
+pub fn tick_nohz_full_kick(cpu_id: u32) {
+    if !NOHZ_FULL_ENABLED.load(Ordering::Relaxed) || !cpu_tick_stopped(cpu_id) {
+        return;
+    }
+    smp_call_function_single(cpu_id as usize, tick_nohz_full_restart, false).ok();
+}
+
+/// 让所有停止了时钟中断的nohz_full的cpu（当前cpu除外）恢复周期性的时钟中断
+///
+/// 用于开始新的宽限期时，使它们能够在时钟中断中报告静止状态
+pub fn tick_nohz_full_kick_all() {
+    if !NOHZ_FULL_ENABLED.load(Ordering::Relaxed) {
+        return;
+    }
+    tick_nohz_full_kick_mask(&NOHZ_FULL_CPUS.words());
+}
+
+/// 让`mask`中停止了时钟中断的cpu（当前cpu除外）恢复周期性的时钟中断
+pub fn tick_nohz_full_kick_mask(mask: &[u64; CPU_MASK_WORDS]) {
+    if !NOHZ_FULL_ENABLED.load(Ordering::Relaxed) {
+        return;
+    }
+    let mut stopped = [0u64; CPU_MASK_WORDS];
+    for (i, word) in mask.iter().enumerate() {
+        let mut word = *word;
+        while word != 0 {
+            let cpu = i * 64 + word.trailing_zeros() as usize;
+            word &= word - 1;
+            if cpu_tick_stopped(cpu as u32) {
+                stopped[i] |= 1 << (cpu % 64);
+            }
+        }
+    }
+    if stopped.iter().any(|w| *w != 0) {
+        smp_call_function_many(&stopped, tick_nohz_full_restart, false);
+    }
+}
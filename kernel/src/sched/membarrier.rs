@@ -0,0 +1,188 @@
+//! membarrier系统调用
+//!
+//! 让用户程序中频繁执行的一方（例如rseq的临界区、用户态RCU的读者）只使用编译器屏障，
+//! 而由很少执行的一方调用membarrier，保证在它返回之前，其他线程都已经执行过一次完整的内存屏障：
+//!
+//! - GLOBAL：等待一个RCU宽限期，此时所有cpu都已经经过了静止状态
+//! - 带EXPEDITED的命令：向正在运行相关线程的cpu发送IPI，在IPI处理函数中执行内存屏障。
+//!   PRIVATE命令只通知正在使用当前地址空间的cpu（即地址空间的TLB状态中记录的cpu），
+//!   GLOBAL命令通知所有正在运行用户进程的cpu
+//! - PRIVATE_EXPEDITED_RSEQ：同时中止这些cpu上的线程正在执行的rseq临界区（见[`crate::process::rseq`]）
+//!
+//! 除了GLOBAL以外，使用之前需要先注册（与Linux相同），注册状态保存在地址空间中。
+//! x86_64上从IPI返回时的iretq本身就是串行化指令，因此SYNC_CORE命令与PRIVATE_EXPEDITED相同。
+
+use core::sync::atomic::{fence, Ordering};
+
+use alloc::sync::Arc;
+
+use crate::{
+    include::bindings::bindings::smp_get_total_cpu,
+    libs::rcu::synchronize_rcu,
+    mm::ucontext::AddressSpace,
+    process::{rseq::rseq_preempt, Pid, ProcessManager},
+    smp::{
+        call_function::{smp_call_function_many, smp_call_function_single},
+        cpu::CPU_MASK_WORDS,
+    },
+    syscall::{Syscall, SystemError},
+};
+
+use super::core::CPU_EXECUTING;
+
+const MEMBARRIER_CMD_QUERY: u32 = 0;
+const MEMBARRIER_CMD_GLOBAL: u32 = 1 << 0;
+const MEMBARRIER_CMD_GLOBAL_EXPEDITED: u32 = 1 << 1;
+const MEMBARRIER_CMD_REGISTER_GLOBAL_EXPEDITED: u32 = 1 << 2;
+const MEMBARRIER_CMD_PRIVATE_EXPEDITED: u32 = 1 << 3;
+const MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED: u32 = 1 << 4;
+const MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE: u32 = 1 << 5;
+const MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_SYNC_CORE: u32 = 1 << 6;
+const MEMBARRIER_CMD_PRIVATE_EXPEDITED_RSEQ: u32 = 1 << 7;
+const MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_RSEQ: u32 = 1 << 8;
+const MEMBARRIER_CMD_GET_REGISTRATIONS: u32 = 1 << 9;
+
+/// 只对`cpu_id`指定的cpu执行（只能用于PRIVATE_EXPEDITED_RSEQ）
+const MEMBARRIER_CMD_FLAG_CPU: u32 = 1 << 0;
+
+/// 支持的所有命令（QUERY的返回值）
+const MEMBARRIER_CMD_BITMASK: u32 = MEMBARRIER_CMD_GLOBAL
+    | MEMBARRIER_CMD_GLOBAL_EXPEDITED
+    | MEMBARRIER_CMD_REGISTER_GLOBAL_EXPEDITED
+    | MEMBARRIER_CMD_PRIVATE_EXPEDITED
+    | MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED
+    | MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE
+    | MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_SYNC_CORE
+    | MEMBARRIER_CMD_PRIVATE_EXPEDITED_RSEQ
+    | MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_RSEQ
+    | MEMBARRIER_CMD_GET_REGISTRATIONS;
+
+impl Syscall {
+    /// 在其他线程上执行内存屏障（与Linux的membarrier兼容）
+    ///
+    /// ## 参数
+    ///
+    /// - `cmd`：命令（MEMBARRIER_CMD_*中的一个）
+    /// - `flags`：0或者MEMBARRIER_CMD_FLAG_CPU
+    /// - `cpu_id`：flags为MEMBARRIER_CMD_FLAG_CPU时，目标cpu
+    ///
+    /// ## 返回值
+    ///
+    /// QUERY返回支持的命令，GET_REGISTRATIONS返回地址空间已经注册的命令，其余命令成功时返回0。
+    /// 执行PRIVATE命令之前没有注册，返回EPERM
+    pub fn membarrier(cmd: u32, flags: u32, cpu_id: u32) -> Result<usize, SystemError> {
+        match cmd {
+            MEMBARRIER_CMD_PRIVATE_EXPEDITED_RSEQ => {
+                if flags & !MEMBARRIER_CMD_FLAG_CPU != 0 {
+                    return Err(SystemError::EINVAL);
+                }
+            }
+            _ => {
+                if flags != 0 {
+                    return Err(SystemError::EINVAL);
+                }
+            }
+        }
+
+        match cmd {
+            MEMBARRIER_CMD_QUERY => return Ok(MEMBARRIER_CMD_BITMASK as usize),
+            MEMBARRIER_CMD_GLOBAL => {
+                synchronize_rcu();
+                return Ok(0);
+            }
+            MEMBARRIER_CMD_GLOBAL_EXPEDITED => {
+                membarrier_global_expedited();
+                return Ok(0);
+            }
+            MEMBARRIER_CMD_REGISTER_GLOBAL_EXPEDITED
+            | MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED
+            | MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_SYNC_CORE
+            | MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_RSEQ => {
+                current_mm()?.membarrier_register(cmd);
+                return Ok(0);
+            }
+            MEMBARRIER_CMD_GET_REGISTRATIONS => {
+                return Ok(current_mm()?.membarrier_registrations() as usize);
+            }
+            MEMBARRIER_CMD_PRIVATE_EXPEDITED
+            | MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE
+            | MEMBARRIER_CMD_PRIVATE_EXPEDITED_RSEQ => {
+                // 每个PRIVATE命令都有对应的注册命令，它的位是命令的位左移一位
+                let mm = current_mm()?;
+                if mm.membarrier_registrations() & (cmd << 1) == 0 {
+                    return Err(SystemError::EPERM);
+                }
+                let cpu = if flags & MEMBARRIER_CMD_FLAG_CPU != 0 {
+                    if cpu_id >= unsafe { smp_get_total_cpu() } {
+                        return Err(SystemError::EINVAL);
+                    }
+                    Some(cpu_id as usize)
+                } else {
+                    None
+                };
+                membarrier_private_expedited(
+                    &mm,
+                    cmd == MEMBARRIER_CMD_PRIVATE_EXPEDITED_RSEQ,
+                    cpu,
+                );
+                return Ok(0);
+            }
+            _ => return Err(SystemError::EINVAL),
+        }
+    }
+}
+
+fn current_mm() -> Result<Arc<AddressSpace>, SystemError> {
+    return ProcessManager::current_pcb()
+        .basic()
+        .user_vm()
+        .ok_or(SystemError::EINVAL);
+}
+
+/// IPI处理函数：执行内存屏障
+fn ipi_mb() {
+    fence(Ordering::SeqCst);
+}
+
+/// IPI处理函数：执行内存屏障，并且让当前进程在返回用户态之前检查rseq临界区
+fn ipi_rseq() {
+    fence(Ordering::SeqCst);
+    rseq_preempt(&ProcessManager::current_pcb());
+}
+
+/// 通知所有正在运行用户进程的cpu
+///
+/// 没有逐个检查这些进程的地址空间是否注册了GLOBAL_EXPEDITED（需要获取它们的锁），
+/// 多通知一些cpu不影响正确性
+fn membarrier_global_expedited() {
+    // 保证调用者在此之前的访存，对IPI之后的其他cpu可见
+    fence(Ordering::SeqCst);
+    let mut mask = [0u64; CPU_MASK_WORDS];
+    for cpu in 0..unsafe { smp_get_total_cpu() } {
+        if CPU_EXECUTING.get(cpu) != Pid::new(0) {
+            mask[cpu as usize / 64] |= 1 << (cpu % 64);
+        }
+    }
+    smp_call_function_many(&mask, ipi_mb, true);
+    fence(Ordering::SeqCst);
+}
+
+/// 通知正在使用`mm`的cpu（或者只通知`cpu`）
+///
+/// 地址空间的TLB状态中记录的cpu包括了所有正在运行这个地址空间中的线程的cpu，
+/// 被通知的cpu上运行的可能是其他进程，此时它们只会多执行一次屏障，或者多更新一次rseq的cpu号
+fn membarrier_private_expedited(mm: &AddressSpace, rseq: bool, cpu: Option<usize>) {
+    let func = if rseq { ipi_rseq } else { ipi_mb };
+    fence(Ordering::SeqCst);
+    match cpu {
+        Some(cpu) => {
+            if mm.active_cpus().get(cpu) {
+                smp_call_function_single(cpu, func, true).ok();
+            }
+        }
+        None => {
+            smp_call_function_many(&mm.active_cpus().words(), func, true);
+        }
+    }
+    fence(Ordering::SeqCst);
+}
@@ -1,7 +1,15 @@
+pub mod balance;
 pub mod cfs;
+pub mod cgroup;
 pub mod completion;
 pub mod core;
+pub mod cputime;
+pub mod isolation;
+pub mod membarrier;
+pub mod psi;
+pub mod rq;
 pub mod rt;
+pub mod stats;
 pub mod syscall;
 
 /// 调度策略
@@ -14,6 +22,41 @@ pub enum SchedPolicy {
     FIFO,
     /// 轮转调度
     RR,
+    /// 批处理：由CFS调度，时间片更长，并且被唤醒时不抢占当前进程
+    BATCH,
+    /// 最低优先级：由CFS调度，只有在没有其他CFS进程可以运行时才会运行
+    IDLE,
+}
+
+impl SchedPolicy {
+    /// 这个策略是否由CFS调度器调度
+    #[inline(always)]
+    pub fn is_fair(&self) -> bool {
+        return matches!(self, Self::CFS | Self::BATCH | Self::IDLE);
+    }
+
+    /// 从POSIX的调度策略编号（SCHED_NORMAL、SCHED_FIFO等）转换而来
+    pub fn from_posix(policy: usize) -> Option<Self> {
+        match policy {
+            0 => Some(Self::CFS),
+            1 => Some(Self::FIFO),
+            2 => Some(Self::RR),
+            3 => Some(Self::BATCH),
+            5 => Some(Self::IDLE),
+            _ => None,
+        }
+    }
+
+    /// 转换为POSIX的调度策略编号
+    pub fn to_posix(&self) -> usize {
+        match self {
+            Self::CFS => 0,
+            Self::FIFO => 1,
+            Self::RR => 2,
+            Self::BATCH => 3,
+            Self::IDLE => 5,
+        }
+    }
 }
 
 /// 调度优先级
@@ -23,6 +66,10 @@ pub struct SchedPriority(i32);
 impl SchedPriority {
     const MIN: i32 = 0;
     const MAX: i32 = 139;
+    /// CFS进程的默认优先级（nice值为0，比所有实时进程的优先级都低）
+    pub const DEFAULT: i32 = 120;
+    pub const MIN_NICE: i32 = -20;
+    pub const MAX_NICE: i32 = 19;
 
     /// 创建一个新的调度优先级
     pub const fn new(priority: i32) -> Option<Self> {
@@ -41,4 +88,24 @@ impl SchedPriority {
     pub fn data(&self) -> i32 {
         self.0
     }
+
+    /// 由nice值得到CFS进程的优先级（超出范围的nice值会被截断）
+    pub fn from_nice(nice: i32) -> Self {
+        return Self(Self::DEFAULT + nice.clamp(Self::MIN_NICE, Self::MAX_NICE));
+    }
+
+    /// CFS进程的nice值
+    pub fn nice(&self) -> i32 {
+        return (self.0 - Self::DEFAULT).clamp(Self::MIN_NICE, Self::MAX_NICE);
+    }
+}
+
+/// 优先级继承时比较两个进程的优先级：数值越小越优先
+///
+/// 实时进程的优先级（0~99）总是高于CFS进程（100~139），SCHED_IDLE的进程低于所有其他进程
+pub fn sched_pi_rank(policy: SchedPolicy, priority: SchedPriority) -> i32 {
+    if policy == SchedPolicy::IDLE {
+        return SchedPriority::MAX + 1;
+    }
+    return priority.data();
 }
@@ -0,0 +1,117 @@
+//! 任务组的压力统计（PSI风格）
+//!
+//! 每个任务组记录组内的进程因为两种资源而停顿的时间：
+//! - cpu：进程可以运行，但是在运行队列中等待（包括任务组用完cpu带宽而被限流的时间）
+//! - memory：进程在缺页时等待回收内存
+//!
+//! 停顿时间会累加到任务组和它的所有祖先上，通过`/proc/taskgroups`导出，格式与Linux的`cpu.pressure`
+//! 和`memory.pressure`中的`some`行相同。
+//!
+//! 与Linux的区别：total是组内所有进程停顿时间之和，而不是“至少有一个进程停顿”的时间，因此多个进程同时等待时
+//! 会被重复计算，换算出的百分比被截断为100%。平均值不是由定时器周期性更新的，而是在读取时按照经过的周期数
+//! 补上衰减，假设两次读取之间的停顿是均匀分布的。
+
+use core::sync::atomic::{AtomicU64, Ordering};
+
+use alloc::{format, string::String};
+
+use crate::{libs::spinlock::SpinLock, time::timer::clock};
+
+/// 更新平均值的周期（单位：微秒）
+const PSI_PERIOD_US: u64 = 2_000_000;
+/// 每个周期，10s、60s、300s的平均值的衰减系数（千分比，即exp(-2/10)、exp(-2/60)、exp(-2/300)）
+const PSI_DECAY: [u64; 3] = [819, 967, 993];
+/// 补上衰减时最多计算的周期数，之后的平均值已经与这段时间的百分比没有区别
+const PSI_MAX_DECAY_PERIODS: u64 = 1000;
+/// 百分比的定点数表示：100%对应的值
+const PSI_FULL: u64 = 100_000;
+
+/// 被统计的资源
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum PsiResource {
+    Cpu = 0,
+    Memory = 1,
+}
+
+/// 一种资源的停顿时间的平均值
+#[derive(Debug)]
+struct PsiAvgs {
+    /// 10s、60s、300s的平均值（100%对应[`PSI_FULL`]）
+    avg: [u64; 3],
+    /// 上次更新时的停顿时间之和
+    last_total: u64,
+    /// 上次更新的时间
+    last_update: u64,
+}
+
+impl PsiAvgs {
+    const fn new() -> Self {
+        return Self {
+            avg: [0; 3],
+            last_total: 0,
+            last_update: 0,
+        };
+    }
+
+    fn update(&mut self, total: u64, now: u64) {
+        if self.last_update == 0 {
+            self.last_update = now;
+            self.last_total = total;
+            return;
+        }
+        let periods = now.saturating_sub(self.last_update) / PSI_PERIOD_US;
+        if periods == 0 {
+            return;
+        }
+        let stall = total.saturating_sub(self.last_total);
+        let pct = (stall * PSI_FULL / (periods * PSI_PERIOD_US)).min(PSI_FULL);
+        for _ in 0..periods.min(PSI_MAX_DECAY_PERIODS) {
+            for (avg, decay) in self.avg.iter_mut().zip(PSI_DECAY.iter()) {
+                *avg = (*avg * decay + pct * (1000 - decay)) / 1000;
+            }
+        }
+        self.last_update += periods * PSI_PERIOD_US;
+        self.last_total = total;
+    }
+}
+
+/// 一个任务组的压力统计
+#[derive(Debug)]
+pub struct PsiGroup {
+    /// 每种资源的停顿时间之和（单位：微秒）
+    total: [AtomicU64; 2],
+    avgs: SpinLock<[PsiAvgs; 2]>,
+}
+
+impl PsiGroup {
+    pub const fn new() -> Self {
+        return Self {
+            total: [AtomicU64::new(0), AtomicU64::new(0)],
+            avgs: SpinLock::new([PsiAvgs::new(), PsiAvgs::new()]),
+        };
+    }
+
+    /// 记录`delta`微秒的停顿
+    #[inline(always)]
+    pub fn account(&self, res: PsiResource, delta: u64) {
+        self.total[res as usize].fetch_add(delta, Ordering::Relaxed);
+    }
+
+    /// 格式化为`some avg10=.. avg60=.. avg300=.. total=..`
+    pub fn show(&self, res: PsiResource) -> String {
+        let total = self.total[res as usize].load(Ordering::Relaxed);
+        let avg = {
+            let mut avgs = self.avgs.lock_irqsave();
+            avgs[res as usize].update(total, clock());
+            avgs[res as usize].avg
+        };
+        let pct = |v: u64| format!("{}.{:02}", v / 1000, v % 1000 / 10);
+        return format!(
+            "some avg10={} avg60={} avg300={} total={}",
+            pct(avg[0]),
+            pct(avg[1]),
+            pct(avg[2]),
+            total
+        );
+    }
+}
@@ -0,0 +1,245 @@
+//! per-cpu的运行队列
+//!
+//! 每个cpu有一个[`RunQueue`]，同时保存CFS和实时进程的运行队列，由同一把锁保护。
+//! 除了迁移进程以外，cpu只访问自己的运行队列；其他cpu只会读取运行队列中的进程数量（不需要加锁）。
+//!
+//! 不允许在这个cpu上运行的进程（例如修改了cpu亲和性的、正在运行的进程）被切换出去时，
+//! 不会进入这个cpu的队列，而是暂存在等待迁移的列表中，上下文切换完成之后再由[`super::core::sched_migrate_pending`]
+//! 放入允许的cpu的运行队列。
+//!
+//! 需要同时持有两个运行队列的锁时（迁移进程），必须使用[`double_lock`]，
+//! 它按照cpu号从小到大的顺序加锁，避免两个cpu互相等待对方的锁。
+
+use core::{
+    ops::{Deref, DerefMut},
+    sync::atomic::{AtomicBool, AtomicUsize, Ordering},
+};
+
+use alloc::{sync::Arc, vec::Vec};
+
+use crate::{
+    libs::{
+        lazy_init::Lazy,
+        spinlock::{SpinLock, SpinLockGuard},
+    },
+    mm::percpu::{PerCpu, PerCpuVar},
+    process::{ProcessControlBlock, ProcessManager},
+    smp::core::smp_get_processor_id,
+};
+
+use super::{cfs::CfsRunQueue, rt::RtRunQueue, SchedPolicy};
+
+static RUN_QUEUES: Lazy<PerCpuVar<RunQueue>> = PerCpuVar::define_lazy();
+
+/// 一个cpu的运行队列
+///
+/// 按照缓存行对齐，使得各个cpu的运行队列不会共享缓存行
+#[derive(Debug)]
+#[repr(align(64))]
+pub struct RunQueue {
+    cpu_id: u32,
+    inner: SpinLock<RunQueueInner>,
+    /// 队列中的进程数量（不包括正在运行的进程）的副本，使得其他cpu读取时不需要加锁
+    nr_running: AtomicUsize,
+    /// 等待迁移的列表是否不为空（副本）
+    has_migrate_pending: AtomicBool,
+}
+
+/// 由运行队列的锁保护的数据
+#[derive(Debug)]
+pub struct RunQueueInner {
+    cpu_id: u32,
+    pub cfs: CfsRunQueue,
+    pub rt: RtRunQueue,
+    /// 当前cpu的IDLE进程的pcb
+    pub idle_pcb: Arc<ProcessControlBlock>,
+    /// 不允许在这个cpu上运行，等待上下文切换完成之后被迁移到其他cpu的进程
+    pub migrate_pending: Vec<Arc<ProcessControlBlock>>,
+}
+
+impl RunQueueInner {
+    #[inline(always)]
+    pub fn cpu_id(&self) -> u32 {
+        return self.cpu_id;
+    }
+
+    /// 队列中的进程数量（不包括正在运行的进程）
+    #[inline(always)]
+    pub fn nr_running(&self) -> usize {
+        return self.cfs.len() + self.rt.len();
+    }
+
+    /// 按照进程的调度策略，将pcb加入这个运行队列
+    ///
+    /// ## 参数
+    ///
+    /// - `pcb`：要加入队列的进程
+    /// - `reset_time`：是否重置虚拟运行时间
+    pub fn enqueue_task(&mut self, pcb: Arc<ProcessControlBlock>, reset_time: bool) {
+        if !pcb.sched_info().cpu_allowed(self.cpu_id) {
+            self.migrate_pending.push(pcb);
+            return;
+        }
+        match pcb.sched_info().policy() {
+            SchedPolicy::CFS | SchedPolicy::BATCH | SchedPolicy::IDLE => {
+                if reset_time {
+                    self.cfs.enqueue_reset_vruntime(pcb);
+                } else {
+                    self.cfs.enqueue(pcb);
+                }
+            }
+            SchedPolicy::FIFO | SchedPolicy::RR => self.rt.enqueue(pcb),
+        }
+    }
+
+    /// 任务组补充了cpu带宽之后，把这个cpu上不再被限流的进程放回运行队列
+    ///
+    /// 返回是否有进程被放回
+    pub fn cfs_unthrottle(&mut self) -> bool {
+        let mut moved = false;
+        for pcb in self.cfs.take_throttled() {
+            if self.cfs.throttle(&pcb, self.cpu_id) {
+                continue;
+            }
+            self.enqueue_task(pcb, false);
+            moved = true;
+        }
+        return moved;
+    }
+}
+
+/// 运行队列的锁的守卫。释放锁之前，更新运行队列中的进程数量的副本
+pub struct RunQueueGuard<'a> {
+    rq: &'a RunQueue,
+    inner: SpinLockGuard<'a, RunQueueInner>,
+}
+
+impl Deref for RunQueueGuard<'_> {
+    type Target = RunQueueInner;
+
+    fn deref(&self) -> &Self::Target {
+        return &self.inner;
+    }
+}
+
+impl DerefMut for RunQueueGuard<'_> {
+    fn deref_mut(&mut self) -> &mut Self::Target {
+        return &mut self.inner;
+    }
+}
+
+impl Drop for RunQueueGuard<'_> {
+    fn drop(&mut self) {
+        self.rq
+            .nr_running
+            .store(self.inner.nr_running(), Ordering::Relaxed);
+        self.rq
+            .has_migrate_pending
+            .store(!self.inner.migrate_pending.is_empty(), Ordering::Relaxed);
+    }
+}
+
+impl RunQueue {
+    fn new(cpu_id: u32, idle_pcb: Arc<ProcessControlBlock>) -> Self {
+        return Self {
+            cpu_id,
+            inner: SpinLock::new(RunQueueInner {
+                cpu_id,
+                cfs: CfsRunQueue::new(),
+                rt: RtRunQueue::new(),
+                idle_pcb,
+                migrate_pending: Vec::new(),
+            }),
+            nr_running: AtomicUsize::new(0),
+            has_migrate_pending: AtomicBool::new(false),
+        };
+    }
+
+    #[inline(always)]
+    pub fn cpu_id(&self) -> u32 {
+        return self.cpu_id;
+    }
+
+    /// 队列中的进程数量（不包括正在运行的进程）。不需要加锁，但是可能是稍微过时的值
+    #[inline(always)]
+    pub fn nr_running(&self) -> usize {
+        return self.nr_running.load(Ordering::Relaxed);
+    }
+
+    /// 是否有等待迁移到其他cpu的进程。不需要加锁，但是可能是稍微过时的值
+    #[inline(always)]
+    pub fn has_migrate_pending(&self) -> bool {
+        return self.has_migrate_pending.load(Ordering::Relaxed);
+    }
+
+    /// 关中断并加锁
+    pub fn lock_irqsave(&self) -> RunQueueGuard {
+        return RunQueueGuard {
+            rq: self,
+            inner: self.inner.lock_irqsave(),
+        };
+    }
+
+    /// 尝试关中断并加锁，锁被占用时返回None
+    pub fn try_lock_irqsave(&self) -> Option<RunQueueGuard> {
+        return Some(RunQueueGuard {
+            rq: self,
+            inner: self.inner.try_lock_irqsave().ok()?,
+        });
+    }
+}
+
+/// 同时持有两个运行队列的锁。释放时，按照与加锁相反的顺序释放
+pub struct DoubleRunQueueGuard<'a> {
+    // 结构体的字段按照声明的顺序被释放
+    second: RunQueueGuard<'a>,
+    first: RunQueueGuard<'a>,
+    /// 第一个参数对应的是不是second
+    swapped: bool,
+}
+
+impl<'a> DoubleRunQueueGuard<'a> {
+    /// 按照传给[`double_lock`]的参数的顺序，返回两个运行队列
+    pub fn get(&mut self) -> (&mut RunQueueInner, &mut RunQueueInner) {
+        if self.swapped {
+            return (&mut *self.second, &mut *self.first);
+        }
+        return (&mut *self.first, &mut *self.second);
+    }
+}
+
+/// 按照cpu号从小到大的顺序，关中断并锁住两个不同的运行队列
+pub fn double_lock<'a>(a: &'a RunQueue, b: &'a RunQueue) -> DoubleRunQueueGuard<'a> {
+    assert!(a.cpu_id != b.cpu_id, "double_lock(): same run queue");
+    let swapped = a.cpu_id > b.cpu_id;
+    let (low, high) = if swapped { (b, a) } else { (a, b) };
+    let first = low.lock_irqsave();
+    let second = high.lock_irqsave();
+    return DoubleRunQueueGuard {
+        second,
+        first,
+        swapped,
+    };
+}
+
+/// 获取指定cpu的运行队列
+#[inline(always)]
+pub fn cpu_rq(cpu_id: u32) -> &'static RunQueue {
+    return RUN_QUEUES.get().get_for(cpu_id);
+}
+
+/// 获取当前cpu的运行队列
+#[inline(always)]
+pub fn this_rq() -> &'static RunQueue {
+    return cpu_rq(smp_get_processor_id());
+}
+
+/// 初始化所有cpu的运行队列（需要在idle进程创建之后调用）
+pub fn rq_init() {
+    let idle_pcbs = ProcessManager::idle_pcb();
+    let mut queues = Vec::with_capacity(PerCpu::MAX_CPU_NUM);
+    for cpu_id in 0..PerCpu::MAX_CPU_NUM {
+        queues.push(RunQueue::new(cpu_id as u32, idle_pcbs[cpu_id].clone()));
+    }
+    RUN_QUEUES.init(PerCpuVar::new(queues).expect("Failed to create run queues"));
+}
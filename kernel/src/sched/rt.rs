@@ -1,181 +1,149 @@
 use core::sync::atomic::compiler_fence;
 
-use alloc::{boxed::Box, collections::LinkedList, sync::Arc, vec::Vec};
-
-use crate::{
-    arch::cpu::current_cpu_id,
-    include::bindings::bindings::MAX_CPU_NUM,
-    kBUG, kdebug,
-    libs::spinlock::SpinLock,
-    process::{ProcessControlBlock, ProcessFlags, ProcessManager},
-};
-
-use super::{
-    core::{sched_enqueue, Scheduler},
-    SchedPolicy,
-};
-
-/// 声明全局的rt调度器实例
-pub static mut RT_SCHEDULER_PTR: Option<Box<SchedulerRT>> = None;
-
-/// @brief 获取rt调度器实例的可变引用
-#[inline]
-pub fn __get_rt_scheduler() -> &'static mut SchedulerRT {
-    return unsafe { RT_SCHEDULER_PTR.as_mut().unwrap() };
-}
+use alloc::{collections::LinkedList, sync::Arc, vec::Vec};
 
-/// @brief 初始化rt调度器
-pub unsafe fn sched_rt_init() {
-    kdebug!("rt scheduler init");
-    if RT_SCHEDULER_PTR.is_none() {
-        RT_SCHEDULER_PTR = Some(Box::new(SchedulerRT::new()));
-    } else {
-        kBUG!("Try to init RT Scheduler twice.");
-        panic!("Try to init RT Scheduler twice.");
-    }
-}
-/// @brief RT队列（per-cpu的）
+use crate::process::{Pid, ProcessControlBlock, ProcessFlags, ProcessManager};
+
+use super::{core::Scheduler, rq::RunQueueInner, SchedPolicy};
+
+/// @brief RT队列（per-cpu的，由所在的运行队列的锁保护）
+///
+/// 每个优先级有一个双向队列，并且用位图记录哪些优先级的队列不为空，
+/// 使得挑选下一个进程的时间与优先级的数量无关
 #[derive(Debug)]
-struct RTQueue {
-    /// 加锁保护的存储进程的双向队列
-    locked_queue: SpinLock<LinkedList<Arc<ProcessControlBlock>>>,
+pub struct RtRunQueue {
+    queues: Vec<LinkedList<Arc<ProcessControlBlock>>>,
+    /// 第i位为1表示优先级为i的队列不为空
+    bitmap: u128,
+    /// 所有优先级的队列中的进程数量之和
+    nr_running: usize,
 }
 
-impl RTQueue {
-    pub fn new() -> RTQueue {
-        RTQueue {
-            locked_queue: SpinLock::new(LinkedList::new()),
+impl RtRunQueue {
+    pub fn new() -> RtRunQueue {
+        let mut queues = Vec::with_capacity(SchedulerRT::MAX_RT_PRIO as usize);
+        // 每个CPU有MAX_RT_PRIO个优先级队列
+        for _ in 0..SchedulerRT::MAX_RT_PRIO {
+            queues.push(LinkedList::new());
+        }
+        RtRunQueue {
+            queues,
+            bitmap: 0,
+            nr_running: 0,
         }
     }
-    /// @brief 将pcb加入队列
-    pub fn enqueue(&mut self, pcb: Arc<ProcessControlBlock>) {
-        let mut queue = self.locked_queue.lock_irqsave();
 
+    /// 从优先级为`priority`的队列的头部取出一个进程
+    fn pop_front_at(&mut self, priority: usize) -> Option<Arc<ProcessControlBlock>> {
+        let queue = &mut self.queues[priority];
+        let pcb = queue.pop_front()?;
+        if queue.is_empty() {
+            self.bitmap &= !(1u128 << priority);
+        }
+        self.nr_running -= 1;
+        return Some(pcb);
+    }
+
+    /// @brief 将pcb加入其优先级对应的队列的尾部
+    pub fn enqueue(&mut self, pcb: Arc<ProcessControlBlock>) {
         // 如果进程是IDLE进程，那么就不加入队列
         if pcb.pid().into() == 0 {
             return;
         }
-        queue.push_back(pcb);
+        let priority = pcb.sched_info().priority().data() as usize;
+        self.queues[priority].push_back(pcb);
+        self.bitmap |= 1u128 << priority;
+        self.nr_running += 1;
     }
 
-    /// @brief 将pcb从调度队列头部取出,若队列为空，则返回None
-    pub fn dequeue(&mut self) -> Option<Arc<ProcessControlBlock>> {
-        let res: Option<Arc<ProcessControlBlock>>;
-        let mut queue = self.locked_queue.lock_irqsave();
-        if queue.len() > 0 {
-            // 队列不为空，返回下一个要执行的pcb
-            res = Some(queue.pop_front().unwrap());
-        } else {
-            // 如果队列为空，则返回None
-            res = None;
-        }
-        return res;
-    }
+    /// @brief 将pcb加入其优先级对应的队列的头部
     pub fn enqueue_front(&mut self, pcb: Arc<ProcessControlBlock>) {
-        let mut queue = self.locked_queue.lock_irqsave();
-
         // 如果进程是IDLE进程，那么就不加入队列
         if pcb.pid().into() == 0 {
             return;
         }
-        queue.push_front(pcb);
-    }
-    pub fn get_rt_queue_size(&mut self) -> usize {
-        let queue = self.locked_queue.lock();
-        return queue.len();
+        let priority = pcb.sched_info().priority().data() as usize;
+        self.queues[priority].push_front(pcb);
+        self.bitmap |= 1u128 << priority;
+        self.nr_running += 1;
     }
-}
-
-/// @brief RT调度器类
-pub struct SchedulerRT {
-    cpu_queue: Vec<Vec<&'static mut RTQueue>>,
-    load_list: Vec<&'static mut LinkedList<u64>>,
-}
 
-impl SchedulerRT {
-    const RR_TIMESLICE: isize = 100;
-    const MAX_RT_PRIO: isize = 100;
-
-    pub fn new() -> SchedulerRT {
-        // 暂时手动指定核心数目
-        // todo: 从cpu模块来获取核心的数目
-        let mut result = SchedulerRT {
-            cpu_queue: Default::default(),
-            load_list: Default::default(),
-        };
-
-        // 为每个cpu核心创建队列
-        for cpu_id in 0..MAX_CPU_NUM {
-            result.cpu_queue.push(Vec::new());
-            // 每个CPU有MAX_RT_PRIO个优先级队列
-            for _ in 0..SchedulerRT::MAX_RT_PRIO {
-                result.cpu_queue[cpu_id as usize].push(Box::leak(Box::new(RTQueue::new())));
-            }
+    /// @brief 挑选下一个可执行的rt进程，并将它从队列中取出
+    pub fn pick_next_task_rt(&mut self) -> Option<Arc<ProcessControlBlock>> {
+        if self.bitmap == 0 {
+            return None;
         }
-        // 为每个cpu核心创建负载统计队列
-        for _ in 0..MAX_CPU_NUM {
-            result
-                .load_list
-                .push(Box::leak(Box::new(LinkedList::new())));
-        }
-        return result;
+        // 数值越小，优先级越高
+        let priority = self.bitmap.trailing_zeros() as usize;
+        return self.pop_front_at(priority);
     }
 
-    /// @brief 挑选下一个可执行的rt进程
-    pub fn pick_next_task_rt(&mut self, cpu_id: u32) -> Option<Arc<ProcessControlBlock>> {
-        // 循环查找，直到找到
-        // 这里应该是优先级数量，而不是CPU数量，需要修改
-        for i in 0..SchedulerRT::MAX_RT_PRIO {
-            let cpu_queue_i: &mut RTQueue = self.cpu_queue[cpu_id as usize][i as usize];
-            let proc: Option<Arc<ProcessControlBlock>> = cpu_queue_i.dequeue();
-            if proc.is_some() {
-                return proc;
-            }
-        }
-        // return 一个空值
-        None
+    /// 获取队列中的进程数
+    #[inline(always)]
+    pub fn len(&self) -> usize {
+        return self.nr_running;
     }
 
-    pub fn rt_queue_len(&mut self, cpu_id: u32) -> usize {
-        let mut sum = 0;
-        for prio in 0..SchedulerRT::MAX_RT_PRIO {
-            sum += self.cpu_queue[cpu_id as usize][prio as usize].get_rt_queue_size();
+    /// 取出优先级最高的、可以被迁移到`dst_cpu`的进程
+    ///
+    /// - `executing`：正在这个cpu上运行的进程，它还没有保存上下文，不能被迁移
+    /// - `dst_cpu`：迁移的目标cpu，进程的cpu亲和性需要允许它在这个cpu上运行
+    pub fn pop_migratable(
+        &mut self,
+        executing: Pid,
+        dst_cpu: u32,
+    ) -> Option<Arc<ProcessControlBlock>> {
+        let mut bitmap = self.bitmap;
+        while bitmap != 0 {
+            let priority = bitmap.trailing_zeros() as usize;
+            bitmap &= bitmap - 1;
+            let index = self.queues[priority]
+                .iter()
+                .position(|pcb| pcb.pid() != executing && pcb.sched_info().cpu_allowed(dst_cpu));
+            if let Some(index) = index {
+                let queue = &mut self.queues[priority];
+                let mut tail = queue.split_off(index);
+                queue.append(&mut tail.split_off(1));
+                let pcb = tail.pop_front().unwrap();
+                if queue.is_empty() {
+                    self.bitmap &= !(1u128 << priority);
+                }
+                self.nr_running -= 1;
+                return Some(pcb);
+            }
         }
-        return sum as usize;
-    }
-
-    #[allow(dead_code)]
-    #[inline]
-    pub fn load_list_len(&mut self, cpu_id: u32) -> usize {
-        return self.load_list[cpu_id as usize].len();
+        return None;
     }
+}
 
-    pub fn enqueue_front(&mut self, pcb: Arc<ProcessControlBlock>) {
-        let cpu_id = current_cpu_id() as usize;
-        let priority = pcb.sched_info().priority().data() as usize;
+/// @brief RT调度器类
+#[derive(Debug)]
+pub struct SchedulerRT;
 
-        self.cpu_queue[cpu_id][priority].enqueue_front(pcb);
-    }
+impl SchedulerRT {
+    const RR_TIMESLICE: isize = 100;
+    /// 不能超过[`RtRunQueue`]的位图的位数
+    pub const MAX_RT_PRIO: isize = 100;
 
-    pub fn timer_update_jiffies(&self) {
+    pub fn timer_update_jiffies() {
         ProcessManager::current_pcb()
             .sched_info()
             .increase_rt_time_slice(-1);
     }
 }
 
+const _: () = assert!(SchedulerRT::MAX_RT_PRIO as u32 <= u128::BITS);
+
 impl Scheduler for SchedulerRT {
     /// @brief 在当前cpu上进行调度。
     /// 请注意，进入该函数之前，需要关中断
-    fn sched(&mut self) -> Option<Arc<ProcessControlBlock>> {
+    fn sched(&self, rq: &mut RunQueueInner) -> Option<Arc<ProcessControlBlock>> {
         ProcessManager::current_pcb()
             .flags()
             .remove(ProcessFlags::NEED_SCHEDULE);
         // 正常流程下，这里一定是会pick到next的pcb的，如果是None的话，要抛出错误
-        let cpu_id = current_cpu_id();
         let proc: Arc<ProcessControlBlock> =
-            self.pick_next_task_rt(cpu_id).expect("No RT process found");
-        let priority = proc.sched_info().priority();
+            rq.rt.pick_next_task_rt().expect("No RT process found");
         let policy = proc.sched_info().policy();
         match policy {
             // 如果是fifo策略，则可以一直占有cpu直到有优先级更高的任务就绪(即使优先级相同也不行)或者主动放弃(等待资源)
@@ -184,10 +152,10 @@ impl Scheduler for SchedulerRT {
                 if proc.sched_info().priority()
                     <= ProcessManager::current_pcb().sched_info().priority()
                 {
-                    sched_enqueue(proc, false);
+                    rq.enqueue_task(proc, false);
                 } else {
                     // 将当前的进程加进队列
-                    sched_enqueue(ProcessManager::current_pcb(), false);
+                    rq.enqueue_task(ProcessManager::current_pcb(), false);
                     compiler_fence(core::sync::atomic::Ordering::SeqCst);
                     return Some(proc);
                 }
@@ -204,19 +172,19 @@ impl Scheduler for SchedulerRT {
                         proc.sched_info()
                             .set_rt_time_slice(SchedulerRT::RR_TIMESLICE as isize);
                         proc.flags().insert(ProcessFlags::NEED_SCHEDULE);
-                        sched_enqueue(proc, false);
+                        rq.enqueue_task(proc, false);
                     }
                     // 目标进程时间片未耗尽，切换到目标进程
                     else {
                         // 将当前进程加进队列
-                        sched_enqueue(ProcessManager::current_pcb(), false);
+                        rq.enqueue_task(ProcessManager::current_pcb(), false);
                         compiler_fence(core::sync::atomic::Ordering::SeqCst);
                         return Some(proc);
                     }
                 }
                 // curr优先级更大，说明一定是实时进程，将所选进程入队列，此时需要入队首
                 else {
-                    self.cpu_queue[cpu_id as usize][priority.data() as usize].enqueue_front(proc);
+                    rq.rt.enqueue_front(proc);
                 }
             }
             _ => panic!("unsupported schedule policy"),
@@ -224,10 +192,7 @@ impl Scheduler for SchedulerRT {
         return None;
     }
 
-    fn enqueue(&mut self, pcb: Arc<ProcessControlBlock>) {
-        let cpu_id = pcb.sched_info().on_cpu().unwrap();
-        let cpu_queue = &mut self.cpu_queue[cpu_id as usize];
-        let priority = pcb.sched_info().priority().data() as usize;
-        cpu_queue[priority].enqueue(pcb);
+    fn enqueue(&self, rq: &mut RunQueueInner, pcb: Arc<ProcessControlBlock>) {
+        rq.rt.enqueue(pcb);
     }
 }
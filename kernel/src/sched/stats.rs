@@ -0,0 +1,293 @@
+//! 调度器的统计信息
+//!
+//! 所有的计数器都是原子变量，只在上下文切换、唤醒、迁移的路径上做几次加法，开销很小。
+//! 统计信息通过`/proc/schedstat`（每个cpu）和`/proc/<pid>/sched`（每个进程）导出。
+//!
+//! 时间的单位都是微秒（jiffies），导出时换算为纳秒。
+
+use core::sync::atomic::{AtomicU64, Ordering};
+
+use alloc::{format, string::String};
+
+use crate::{
+    arch::driver::tsc::TSCManager,
+    filesystem::vfs::seq_file::{SeqBuf, SeqOperations},
+    mm::percpu::PerCpu,
+    process::{ProcessControlBlock, ProcessState},
+    syscall::SystemError,
+    time::timer::clock,
+};
+
+use super::{cfs::task_weight, core::CPU_EXECUTING, psi::PsiResource, rq::cpu_rq};
+
+/// 一个cpu的调度统计信息
+#[derive(Debug)]
+#[repr(align(64))]
+pub struct CpuSchedStat {
+    /// 进入调度器的次数
+    sched_count: AtomicU64,
+    /// 切换到IDLE进程的次数
+    sched_goidle: AtomicU64,
+    /// 把进程加入这个cpu的运行队列的次数
+    ttwu_count: AtomicU64,
+    /// 其中，由这个cpu自己加入的次数
+    ttwu_local: AtomicU64,
+    /// 在这个cpu上运行的进程（不包括IDLE进程）的运行时间之和
+    run_time: AtomicU64,
+    /// 进程在这个cpu的运行队列中等待的时间之和
+    run_delay: AtomicU64,
+    /// 上下文切换的次数
+    nr_switches: AtomicU64,
+    /// 迁移到这个cpu的进程的数量
+    nr_migrations: AtomicU64,
+    /// 在do_sched()中花费的cpu周期数
+    sched_cycles: AtomicU64,
+}
+
+impl CpuSchedStat {
+    const fn new() -> Self {
+        return Self {
+            sched_count: AtomicU64::new(0),
+            sched_goidle: AtomicU64::new(0),
+            ttwu_count: AtomicU64::new(0),
+            ttwu_local: AtomicU64::new(0),
+            run_time: AtomicU64::new(0),
+            run_delay: AtomicU64::new(0),
+            nr_switches: AtomicU64::new(0),
+            nr_migrations: AtomicU64::new(0),
+            sched_cycles: AtomicU64::new(0),
+        };
+    }
+}
+
+static CPU_SCHED_STATS: [CpuSchedStat; PerCpu::MAX_CPU_NUM] =
+    [const { CpuSchedStat::new() }; PerCpu::MAX_CPU_NUM];
+
+#[inline(always)]
+fn cpu_stat(cpu_id: u32) -> &'static CpuSchedStat {
+    return &CPU_SCHED_STATS[cpu_id as usize];
+}
+
+/// 一个进程的调度统计信息
+#[derive(Debug, Default)]
+pub struct TaskSchedStat {
+    /// 最近一次开始运行的时间
+    exec_start: AtomicU64,
+    /// 运行时间之和
+    sum_exec_runtime: AtomicU64,
+    /// 开始在运行队列中等待的时间，0表示没有在等待
+    wait_start: AtomicU64,
+    /// 在运行队列中等待的时间之和
+    wait_sum: AtomicU64,
+    /// 在运行队列中等待的次数
+    wait_count: AtomicU64,
+    /// 主动让出cpu（睡眠、退出）的次数
+    nr_voluntary_switches: AtomicU64,
+    /// 被抢占的次数
+    nr_involuntary_switches: AtomicU64,
+    /// 被迁移到其他cpu的次数
+    nr_migrations: AtomicU64,
+    /// 被唤醒的次数
+    nr_wakeups: AtomicU64,
+}
+
+impl TaskSchedStat {
+    /// 进程开始在运行队列中等待
+    #[inline(always)]
+    fn start_wait(&self, now: u64) {
+        self.wait_start
+            .compare_exchange(0, now, Ordering::Relaxed, Ordering::Relaxed)
+            .ok();
+    }
+
+    /// 进程的运行时间之和。`running`：进程是否正在运行（加上本次已经运行的时间）
+    pub fn sum_exec_runtime(&self, running: bool) -> u64 {
+        let sum = self.sum_exec_runtime.load(Ordering::Relaxed);
+        if running {
+            return sum + clock().saturating_sub(self.exec_start.load(Ordering::Relaxed));
+        }
+        return sum;
+    }
+}
+
+/// 进入调度器时调用
+#[inline(always)]
+pub fn sched_stat_schedule(cpu_id: u32, cycles: u64) {
+    let stat = cpu_stat(cpu_id);
+    stat.sched_count.fetch_add(1, Ordering::Relaxed);
+    stat.sched_cycles.fetch_add(cycles, Ordering::Relaxed);
+}
+
+/// 在`cpu_id`上从`prev`切换到`next`之前调用
+pub fn sched_stat_switch(cpu_id: u32, prev: &ProcessControlBlock, next: &ProcessControlBlock) {
+    let now = clock();
+    let stat = cpu_stat(cpu_id);
+    stat.nr_switches.fetch_add(1, Ordering::Relaxed);
+
+    let prev_info = prev.sched_info();
+    let prev_stat = prev_info.sched_stat();
+    let delta = now.saturating_sub(prev_stat.exec_start.load(Ordering::Relaxed));
+    prev_stat
+        .sum_exec_runtime
+        .fetch_add(delta, Ordering::Relaxed);
+    if prev.pid().into() != 0 {
+        stat.run_time.fetch_add(delta, Ordering::Relaxed);
+    }
+    // 被抢占的进程仍然是可运行的，会在运行队列中等待
+    if prev_info.state() == ProcessState::Runnable {
+        prev_stat
+            .nr_involuntary_switches
+            .fetch_add(1, Ordering::Relaxed);
+        prev_stat.start_wait(now);
+    } else {
+        prev_stat
+            .nr_voluntary_switches
+            .fetch_add(1, Ordering::Relaxed);
+    }
+    drop(prev_info);
+
+    if next.pid().into() == 0 {
+        stat.sched_goidle.fetch_add(1, Ordering::Relaxed);
+    }
+    let next_info = next.sched_info();
+    let next_stat = next_info.sched_stat();
+    next_stat.exec_start.store(now, Ordering::Relaxed);
+    let wait_start = next_stat.wait_start.swap(0, Ordering::Relaxed);
+    if wait_start != 0 {
+        let wait = now.saturating_sub(wait_start);
+        next_stat.wait_sum.fetch_add(wait, Ordering::Relaxed);
+        next_stat.wait_count.fetch_add(1, Ordering::Relaxed);
+        stat.run_delay.fetch_add(wait, Ordering::Relaxed);
+        next_info.task_group().psi_account(PsiResource::Cpu, wait);
+    }
+}
+
+/// 进程（被唤醒、新创建或者被迁移之后）被加入`cpu_id`的运行队列时调用
+///
+/// - `local`：是否是由`cpu_id`自己加入的
+pub fn sched_stat_enqueue(cpu_id: u32, pcb: &ProcessControlBlock, local: bool) {
+    let stat = cpu_stat(cpu_id);
+    stat.ttwu_count.fetch_add(1, Ordering::Relaxed);
+    if local {
+        stat.ttwu_local.fetch_add(1, Ordering::Relaxed);
+    }
+    let info = pcb.sched_info();
+    info.sched_stat().nr_wakeups.fetch_add(1, Ordering::Relaxed);
+    info.sched_stat().start_wait(clock());
+}
+
+/// 进程被迁移到`dst_cpu`时调用
+pub fn sched_stat_migrate(dst_cpu: u32, pcb: &ProcessControlBlock) {
+    cpu_stat(dst_cpu)
+        .nr_migrations
+        .fetch_add(1, Ordering::Relaxed);
+    pcb.sched_info()
+        .sched_stat()
+        .nr_migrations
+        .fetch_add(1, Ordering::Relaxed);
+}
+
+/// `/proc/schedstat`
+///
+/// 每个cpu一行，字段依次为：cpu编号、两个保留为0的字段（与Linux的版本15兼容）、进入调度器的次数、
+/// 切换到IDLE进程的次数、加入运行队列的次数、其中本地加入的次数、运行时间（ns）、等待时间（ns）、
+/// 上下文切换的次数。之后是本内核额外的字段：当前运行队列中的进程数、迁入的进程数、在调度器中花费的时间（ns）
+///
+/// 第0个记录是版本和时间戳，第n+1个记录是cpu n
+#[derive(Debug)]
+pub struct SchedstatSeq {
+    pub nr_cpus: u32,
+}
+
+impl SeqOperations for SchedstatSeq {
+    type Cursor = usize;
+
+    fn start(&self, pos: usize) -> Option<usize> {
+        return if pos <= self.nr_cpus as usize {
+            Some(pos)
+        } else {
+            None
+        };
+    }
+
+    fn show(&self, pos: &usize, s: &mut SeqBuf) -> Result<(), SystemError> {
+        if *pos == 0 {
+            s.push_str(&format!("version 15\ntimestamp {}\n", clock()));
+            return Ok(());
+        }
+        let cpu_id = (*pos - 1) as u32;
+        let tsc_khz = TSCManager::tsc_khz();
+        let stat = cpu_stat(cpu_id);
+        let load = |c: &AtomicU64| c.load(Ordering::Relaxed);
+        let sched_ns = if tsc_khz != 0 {
+            load(&stat.sched_cycles) * 1_000_000 / tsc_khz
+        } else {
+            0
+        };
+        s.push_str(&format!(
+            "cpu{} 0 0 {} {} {} {} {} {} {} {} {} {}\n",
+            cpu_id,
+            load(&stat.sched_count),
+            load(&stat.sched_goidle),
+            load(&stat.ttwu_count),
+            load(&stat.ttwu_local),
+            load(&stat.run_time) * 1000,
+            load(&stat.run_delay) * 1000,
+            load(&stat.nr_switches),
+            cpu_rq(cpu_id).nr_running(),
+            load(&stat.nr_migrations),
+            sched_ns,
+        ));
+        return Ok(());
+    }
+}
+
+/// 把微秒表示为Linux的`/proc/<pid>/sched`中使用的毫秒格式
+fn fmt_ms(us: u64) -> String {
+    return format!("{}.{:03}", us / 1000, us % 1000);
+}
+
+/// 生成`/proc/<pid>/sched`的内容
+pub fn task_sched_show(pcb: &ProcessControlBlock) -> String {
+    let info = pcb.sched_info();
+    let stat = info.sched_stat();
+    let load = |c: &AtomicU64| c.load(Ordering::Relaxed);
+    let running = info
+        .on_cpu()
+        .map_or(false, |cpu_id| CPU_EXECUTING.get(cpu_id) == pcb.pid());
+
+    let mut s = format!(
+        "{} ({}, #threads: 1)\n{}\n",
+        pcb.basic().name(),
+        pcb.pid().into(),
+        "-".repeat(59)
+    );
+    let mut line = |key: &str, value: String| {
+        s.push_str(&format!("{:<45}:{:>21}\n", key, value));
+    };
+    line("se.exec_start", fmt_ms(load(&stat.exec_start)));
+    line("se.vruntime", fmt_ms(info.virtual_runtime().max(0) as u64));
+    line(
+        "se.sum_exec_runtime",
+        fmt_ms(stat.sum_exec_runtime(running)),
+    );
+    line("se.nr_migrations", format!("{}", load(&stat.nr_migrations)));
+    line("se.statistics.wait_sum", fmt_ms(load(&stat.wait_sum)));
+    line(
+        "se.statistics.wait_count",
+        format!("{}", load(&stat.wait_count)),
+    );
+    line(
+        "se.statistics.nr_wakeups",
+        format!("{}", load(&stat.nr_wakeups)),
+    );
+    let voluntary = load(&stat.nr_voluntary_switches);
+    let involuntary = load(&stat.nr_involuntary_switches);
+    line("nr_switches", format!("{}", voluntary + involuntary));
+    line("nr_voluntary_switches", format!("{}", voluntary));
+    line("nr_involuntary_switches", format!("{}", involuntary));
+    line("se.load.weight", format!("{}", task_weight(&info)));
+    line("policy", format!("{}", info.policy().to_posix()));
+    line("prio", format!("{}", info.priority().data()));
+    return s;
+}
@@ -1,12 +1,34 @@
+use alloc::sync::Arc;
+
 use crate::{
-    arch::CurrentIrqArch,
+    arch::{sched::sched, CurrentIrqArch, CurrentTimeArch},
     exception::InterruptArch,
-    process::ProcessManager,
-    smp::core::smp_get_processor_id,
-    syscall::{Syscall, SystemError},
+    include::bindings::bindings::smp_get_total_cpu,
+    libs::rcu::rcu_note_qs,
+    mm::numa::cpu_to_node,
+    process::{
+        rseq::rseq_preempt,
+        workqueue::{wq_worker_running, wq_worker_sleeping},
+        Pid, ProcessControlBlock, ProcessFlags, ProcessManager,
+    },
+    smp::{core::smp_get_processor_id, cpu::CPU_MASK_WORDS},
+    syscall::{
+        user_access::{UserBufferReader, UserBufferWriter},
+        Syscall, SystemError,
+    },
+    time::{timer::clock, TimeArch},
+};
+
+use super::{
+    core::{do_sched, sched_migrate_pending, CPU_EXECUTING},
+    cputime::cputime_task_switch,
+    rt::SchedulerRT,
+    stats::{sched_stat_schedule, sched_stat_switch},
+    SchedPolicy, SchedPriority,
 };
 
-use super::core::{do_sched, CPU_EXECUTING};
+/// getpriority/setpriority的目标是一个进程
+const PRIO_PROCESS: usize = 0;
 
 impl Syscall {
     /// @brief 让系统立即运行调度器的系统调用
@@ -19,19 +41,271 @@ impl Syscall {
         if from_user {
             return Err(SystemError::EPERM);
         }
+        // 正在执行work的worker即将睡眠，让工作队列唤醒另一个worker执行后面的work
+        let wq_worker = {
+            let current_pcb = ProcessManager::current_pcb();
+            let sleeping = current_pcb.flags().contains(ProcessFlags::WQ_WORKER)
+                && current_pcb.sched_info().state().is_blocked();
+            if sleeping {
+                wq_worker_sleeping(smp_get_processor_id());
+            }
+            sleeping
+        };
+
         // 根据调度结果统一进行切换
+        let start = CurrentTimeArch::get_cycles();
         let pcb = do_sched();
+        let cpu_id = smp_get_processor_id();
+        sched_stat_schedule(
+            cpu_id,
+            CurrentTimeArch::get_cycles().wrapping_sub(start) as u64,
+        );
 
         if pcb.is_some() {
             let next_pcb = pcb.unwrap();
             let current_pcb = ProcessManager::current_pcb();
 
             if current_pcb.pid() != next_pcb.pid() {
-                CPU_EXECUTING.set(smp_get_processor_id(), next_pcb.pid());
+                // idle进程可能在空闲等待（甚至停止了时钟中断）时被中断处理程序调度出去
+                ProcessManager::idle_exit();
+                // 读临界区内不允许被调度出去，因此这是一个静止状态
+                if current_pcb.preempt_count() == 0 {
+                    rcu_note_qs();
+                }
+                current_pcb.sched_info().set_last_ran(clock());
+                sched_stat_switch(cpu_id, &current_pcb, &next_pcb);
+                cputime_task_switch(cpu_id, &current_pcb, &next_pcb);
+                rseq_preempt(&current_pcb);
+                CPU_EXECUTING.set(cpu_id, next_pcb.pid());
+                tracepoint!(SchedSwitch, current_pcb.pid().data(), next_pcb.pid().data());
                 unsafe { ProcessManager::switch_process(current_pcb, next_pcb) };
+                // 现在运行的是被切换回来的进程，之前被切换出去的进程已经保存了上下文
+                sched_migrate_pending();
             }
         }
+        if wq_worker {
+            wq_worker_running(smp_get_processor_id());
+        }
         drop(irq_guard);
         return Ok(0);
     }
+
+    /// 设置进程的cpu亲和性（与Linux的sched_setaffinity兼容）
+    ///
+    /// ## 参数
+    ///
+    /// - `pid`：目标进程的pid，为0时表示当前进程
+    /// - `len`：用户缓冲区的长度（单位：字节）
+    /// - `user_mask`：cpu掩码，第i个字节的第j位对应第i*8+j个cpu。超出系统cpu数量的位会被忽略
+    ///
+    /// ## 返回值
+    ///
+    /// 成功时返回0。掩码中没有系统中存在的cpu时，返回EINVAL
+    pub fn sched_setaffinity(
+        pid: Pid,
+        len: usize,
+        user_mask: *const u8,
+        from_user: bool,
+    ) -> Result<usize, SystemError> {
+        let pcb = Self::sched_target(pid)?;
+
+        let mut words = [0u64; CPU_MASK_WORDS];
+        let len = len.min(core::mem::size_of_val(&words));
+        let reader = UserBufferReader::new(user_mask, len, from_user)?;
+        for (i, byte) in reader.read_from_user::<u8>(0)?.iter().enumerate() {
+            words[i / 8] |= (*byte as u64) << ((i % 8) * 8);
+        }
+        // 只保留系统中存在的cpu
+        let nr_cpus = unsafe { smp_get_total_cpu() } as usize;
+        for (i, word) in words.iter_mut().enumerate() {
+            let valid = nr_cpus.saturating_sub(i * 64);
+            if valid < 64 {
+                *word &= (1u64 << valid) - 1;
+            }
+        }
+        if words.iter().all(|w| *w == 0) {
+            return Err(SystemError::EINVAL);
+        }
+        pcb.sched_info().cpus_allowed().store_words(&words);
+
+        // 进程正在不允许的cpu上运行时，让它尽快被调度出去，它会在切换完成之后被迁移到允许的cpu上。
+        // 在队列中等待的进程，会在下一次被唤醒或者被负载均衡时迁移
+        let on_cpu = pcb.sched_info().on_cpu();
+        if let Some(cpu_id) = on_cpu {
+            if !pcb.sched_info().cpu_allowed(cpu_id) {
+                if Arc::ptr_eq(&pcb, &ProcessManager::current_pcb()) {
+                    sched();
+                } else {
+                    pcb.flags().insert(ProcessFlags::NEED_SCHEDULE);
+                }
+            }
+        }
+        return Ok(0);
+    }
+
+    /// 获取进程的cpu亲和性（与Linux的sched_getaffinity兼容）
+    ///
+    /// ## 参数
+    ///
+    /// - `pid`：目标进程的pid，为0时表示当前进程
+    /// - `len`：用户缓冲区的长度（单位：字节），需要能容纳系统中所有的cpu，并且是8的倍数
+    /// - `user_mask`：用于存放cpu掩码的用户缓冲区
+    ///
+    /// ## 返回值
+    ///
+    /// 成功时返回写入用户缓冲区的字节数
+    pub fn sched_getaffinity(
+        pid: Pid,
+        len: usize,
+        user_mask: *mut u8,
+        from_user: bool,
+    ) -> Result<usize, SystemError> {
+        let nr_cpus = unsafe { smp_get_total_cpu() } as usize;
+        if len * 8 < nr_cpus || len % core::mem::size_of::<u64>() != 0 {
+            return Err(SystemError::EINVAL);
+        }
+        let pcb = Self::sched_target(pid)?;
+
+        let words = pcb.sched_info().cpus_allowed().words();
+        let mut bytes = [0u8; CPU_MASK_WORDS * 8];
+        for (i, word) in words.iter().enumerate() {
+            bytes[i * 8..(i + 1) * 8].copy_from_slice(&word.to_le_bytes());
+        }
+        // 与设置时一样，不报告系统中不存在的cpu
+        for cpu_id in nr_cpus..bytes.len() * 8 {
+            bytes[cpu_id / 8] &= !(1 << (cpu_id % 8));
+        }
+
+        let len = len.min(bytes.len());
+        let mut writer = UserBufferWriter::new(user_mask, len, from_user)?;
+        writer.copy_to_user(&bytes[..len], 0)?;
+        return Ok(len);
+    }
+
+    /// 获取当前进程正在运行的cpu（与Linux的getcpu兼容）
+    ///
+    /// 使用vDSO时，支持rdtscp的cpu上不会执行这个系统调用
+    ///
+    /// ## 参数
+    ///
+    /// - `cpu`：传出参数，cpu号
+    /// - `node`：传出参数，NUMA节点号
+    pub fn getcpu(cpu: *mut u32, node: *mut u32) -> Result<usize, SystemError> {
+        let cpu_id = smp_get_processor_id();
+        if !cpu.is_null() {
+            let mut writer = UserBufferWriter::new(cpu, core::mem::size_of::<u32>(), true)?;
+            writer.copy_one_to_user(&cpu_id, 0)?;
+        }
+        if !node.is_null() {
+            let mut writer = UserBufferWriter::new(node, core::mem::size_of::<u32>(), true)?;
+            writer.copy_one_to_user(&(cpu_to_node(cpu_id as usize) as u32), 0)?;
+        }
+        return Ok(0);
+    }
+
+    /// 查找调度相关的系统调用的目标进程（pid为0时表示当前进程）
+    fn sched_target(pid: Pid) -> Result<Arc<ProcessControlBlock>, SystemError> {
+        if pid.into() == 0 {
+            return Ok(ProcessManager::current_pcb());
+        }
+        return ProcessManager::find(pid).ok_or(SystemError::ESRCH);
+    }
+
+    /// 设置进程的调度策略（与Linux的sched_setscheduler兼容）
+    ///
+    /// ## 参数
+    ///
+    /// - `pid`：目标进程的pid，为0时表示当前进程
+    /// - `policy`：调度策略（SCHED_NORMAL、SCHED_FIFO、SCHED_RR、SCHED_BATCH、SCHED_IDLE）
+    /// - `param`：指向`struct sched_param`的指针。实时策略的优先级为1~99（越大越优先），其他策略必须为0
+    pub fn sched_setscheduler(
+        pid: Pid,
+        policy: usize,
+        param: *const i32,
+        from_user: bool,
+    ) -> Result<usize, SystemError> {
+        let policy = SchedPolicy::from_posix(policy).ok_or(SystemError::EINVAL)?;
+        if param.is_null() {
+            return Err(SystemError::EINVAL);
+        }
+        let reader = UserBufferReader::new(param, core::mem::size_of::<i32>(), from_user)?;
+        let sched_priority = *reader.read_one_from_user::<i32>(0)?;
+
+        let pcb = Self::sched_target(pid)?;
+        let priority = if policy.is_fair() {
+            if sched_priority != 0 {
+                return Err(SystemError::EINVAL);
+            }
+            // 在CFS的策略之间切换时，保留nice值
+            let sched_info = pcb.sched_info();
+            if sched_info.policy().is_fair() {
+                sched_info.priority().data()
+            } else {
+                SchedPriority::DEFAULT
+            }
+        } else {
+            let max = SchedulerRT::MAX_RT_PRIO as i32 - 1;
+            if sched_priority < 1 || sched_priority > max {
+                return Err(SystemError::EINVAL);
+            }
+            // 内核中实时进程的优先级数值越小越优先
+            max - sched_priority
+        };
+        let priority = SchedPriority::new(priority).ok_or(SystemError::EINVAL)?;
+
+        pcb.sched_info_mut_irqsave().set_policy(policy, priority);
+        // 在下一次时钟中断时按照新的策略重新调度
+        if pcb.sched_info().on_cpu().is_some() {
+            pcb.flags().insert(ProcessFlags::NEED_SCHEDULE);
+        }
+        return Ok(0);
+    }
+
+    /// 获取进程的调度策略（与Linux的sched_getscheduler兼容）
+    ///
+    /// - `pid`：目标进程的pid，为0时表示当前进程
+    pub fn sched_getscheduler(pid: Pid) -> Result<usize, SystemError> {
+        let pcb = Self::sched_target(pid)?;
+        return Ok(pcb.sched_info().policy().to_posix());
+    }
+
+    /// 获取进程的nice值（与Linux的getpriority系统调用兼容）
+    ///
+    /// ## 参数
+    ///
+    /// - `which`：目前只支持PRIO_PROCESS
+    /// - `who`：目标进程的pid，为0时表示当前进程
+    ///
+    /// ## 返回值
+    ///
+    /// 为了避免返回负数，返回`20 - nice`（1~40），由C库转换为nice值
+    pub fn getpriority(which: usize, who: Pid) -> Result<usize, SystemError> {
+        if which != PRIO_PROCESS {
+            return Err(SystemError::EINVAL);
+        }
+        let pcb = Self::sched_target(who)?;
+        let nice = pcb.sched_info().priority().nice();
+        return Ok((20 - nice) as usize);
+    }
+
+    /// 设置进程的nice值（与Linux的setpriority系统调用兼容，C库的nice()也通过它实现）
+    ///
+    /// ## 参数
+    ///
+    /// - `which`：目前只支持PRIO_PROCESS
+    /// - `who`：目标进程的pid，为0时表示当前进程
+    /// - `nice`：新的nice值，超出-20~19的部分会被截断
+    pub fn setpriority(which: usize, who: Pid, nice: i32) -> Result<usize, SystemError> {
+        if which != PRIO_PROCESS {
+            return Err(SystemError::EINVAL);
+        }
+        let pcb = Self::sched_target(who)?;
+        let mut sched_info = pcb.sched_info_mut_irqsave();
+        // 实时进程的优先级由sched_setscheduler设置
+        let policy = sched_info.policy();
+        if policy.is_fair() {
+            sched_info.set_policy(policy, SchedPriority::from_nice(nice));
+        }
+        return Ok(0);
+    }
 }
@@ -0,0 +1,219 @@
+//! 在其他CPU上执行函数（smp_call_function）
+//!
+//! 每个CPU有一个无锁的请求队列（单链表栈）。发送方把请求压入目标CPU的队列，
+//! 只有当队列原本为空时才需要发送IPI：队列非空说明目标CPU已经有一个未处理的IPI，
+//! 它会在处理时把新压入的请求一并取走。因此一批请求只需要一次IPI。
+//!
+//! 目标CPU在IPI处理函数中一次性取走整个队列，按压入的顺序执行。
+
+use core::{
+    hint::spin_loop,
+    ptr::null_mut,
+    sync::atomic::{AtomicPtr, AtomicUsize, Ordering},
+};
+
+use alloc::{boxed::Box, sync::Arc};
+
+use crate::{
+    arch::{interrupt::ipi::send_ipi_mask, CurrentIrqArch},
+    exception::{ipi::IpiKind, InterruptArch},
+    include::bindings::bindings::smp_get_total_cpu,
+    mm::percpu::PerCpu,
+    syscall::SystemError,
+};
+
+use super::{core::smp_get_processor_id, cpu::CPU_MASK_WORDS};
+
+/// 一次远程调用请求（在所有目标CPU之间共享）
+struct CallData {
+    func: Box<dyn Fn() + Send + Sync>,
+    /// 尚未执行完毕的CPU数量
+    pending: AtomicUsize,
+}
+
+/// 队列中的一个节点
+struct CallNode {
+    next: *mut CallNode,
+    data: Arc<CallData>,
+}
+
+/// 每个CPU的请求队列（栈顶指针）
+static CALL_QUEUE: [AtomicPtr<CallNode>; PerCpu::MAX_CPU_NUM] =
+    [const { AtomicPtr::new(null_mut()) }; PerCpu::MAX_CPU_NUM];
+
+/// 把请求压入cpu的队列
+///
+/// ## 返回值
+///
+/// 如果队列原本为空（需要发送IPI），返回true
+fn enqueue(cpu: usize, data: &Arc<CallData>) -> bool {
+    let node = Box::into_raw(Box::new(CallNode {
+        next: null_mut(),
+        data: data.clone(),
+    }));
+    let queue = &CALL_QUEUE[cpu];
+    let mut head = queue.load(Ordering::Relaxed);
+    loop {
+        unsafe { (*node).next = head };
+        match queue.compare_exchange_weak(head, node, Ordering::Release, Ordering::Relaxed) {
+            Ok(_) => return head.is_null(),
+            Err(h) => head = h,
+        }
+    }
+}
+
+/// 执行当前CPU队列中的所有请求
+///
+/// 调用者需要保证已经关闭了中断
+fn flush_call_queue(cpu: usize) {
+    let mut head = CALL_QUEUE[cpu].swap(null_mut(), Ordering::Acquire);
+    if head.is_null() {
+        return;
+    }
+
+    // 队列是后进先出的，先反转为压入的顺序
+    let mut list: *mut CallNode = null_mut();
+    while !head.is_null() {
+        let next = unsafe { (*head).next };
+        unsafe { (*head).next = list };
+        list = head;
+        head = next;
+    }
+
+    while !list.is_null() {
+        let node = unsafe { Box::from_raw(list) };
+        list = node.next;
+        (node.data.func)();
+        node.data.pending.fetch_sub(1, Ordering::Release);
+    }
+}
+
+/// 在当前CPU上执行func（关中断）
+fn call_local(func: &(dyn Fn() + Send + Sync)) {
+    let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+    func();
+    drop(irq_guard);
+}
+
+/// 等待请求在所有目标CPU上执行完毕
+///
+/// 其他CPU可能也在等待当前CPU执行它们的请求（例如当前CPU关着中断时），
+/// 因此等待的过程中需要处理发给当前CPU的请求，以免死锁
+fn wait_for(data: &CallData) {
+    while data.pending.load(Ordering::Acquire) != 0 {
+        let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+        flush_call_queue(smp_get_processor_id() as usize);
+        drop(irq_guard);
+        spin_loop();
+    }
+}
+
+/// 在指定的CPU上执行func
+///
+/// func在目标CPU的中断上下文中执行（关中断），不能睡眠。如果cpu就是当前CPU，则直接在本地执行。
+///
+/// ## 参数
+///
+/// - `cpu` 目标CPU
+/// - `func` 要执行的函数
+/// - `wait` 是否等待func执行完毕
+pub fn smp_call_function_single(
+    cpu: usize,
+    func: impl Fn() + Send + Sync + 'static,
+    wait: bool,
+) -> Result<(), SystemError> {
+    if cpu >= unsafe { smp_get_total_cpu() } as usize {
+        return Err(SystemError::EINVAL);
+    }
+
+    // 关中断，避免在入队的过程中被迁移到其他CPU上
+    let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+    if cpu == smp_get_processor_id() as usize {
+        func();
+        drop(irq_guard);
+        return Ok(());
+    }
+
+    let data = Arc::new(CallData {
+        func: Box::new(func),
+        pending: AtomicUsize::new(1),
+    });
+    if enqueue(cpu, &data) {
+        let mut target = [0u64; CPU_MASK_WORDS];
+        target[cpu / 64] = 1 << (cpu % 64);
+        send_ipi_mask(IpiKind::CallFunction, &target);
+    }
+    drop(irq_guard);
+
+    if wait {
+        wait_for(&data);
+    }
+    return Ok(());
+}
+
+/// 在mask中除当前CPU以外的所有CPU上执行func
+///
+/// 请求被压入每个目标CPU的队列，所有需要通知的CPU合并为一次IPI发送。
+/// func在目标CPU的中断上下文中执行（关中断），不能睡眠。
+///
+/// ## 参数
+///
+/// - `mask` 目标CPU的掩码（第i个字的第j位对应第i*64+j个CPU）
+/// - `func` 要执行的函数
+/// - `wait` 是否等待func在所有目标CPU上执行完毕
+pub fn smp_call_function_many(
+    mask: &[u64; CPU_MASK_WORDS],
+    func: impl Fn() + Send + Sync + 'static,
+    wait: bool,
+) {
+    let nr_cpus = unsafe { smp_get_total_cpu() } as usize;
+    // 关中断，避免在入队的过程中被迁移到其他CPU上
+    let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+    let this_cpu = smp_get_processor_id() as usize;
+
+    let mut targets = [0u64; CPU_MASK_WORDS];
+    let mut count = 0;
+    for cpu in 0..nr_cpus {
+        if cpu != this_cpu && (mask[cpu / 64] & (1 << (cpu % 64))) != 0 {
+            targets[cpu / 64] |= 1 << (cpu % 64);
+            count += 1;
+        }
+    }
+    if count == 0 {
+        drop(irq_guard);
+        return;
+    }
+
+    let data = Arc::new(CallData {
+        func: Box::new(func),
+        pending: AtomicUsize::new(count),
+    });
+
+    // 只通知队列原本为空的CPU，其余的CPU已经有未处理的IPI
+    let mut need_ipi = [0u64; CPU_MASK_WORDS];
+    for cpu in 0..nr_cpus {
+        if (targets[cpu / 64] & (1 << (cpu % 64))) != 0 && enqueue(cpu, &data) {
+            need_ipi[cpu / 64] |= 1 << (cpu % 64);
+        }
+    }
+    send_ipi_mask(IpiKind::CallFunction, &need_ipi);
+    drop(irq_guard);
+
+    if wait {
+        wait_for(&data);
+    }
+}
+
+/// 在所有CPU（包括当前CPU）上执行func
+pub fn on_each_cpu(func: impl Fn() + Send + Sync + 'static, wait: bool) {
+    let func = Arc::new(func);
+    let remote = func.clone();
+    smp_call_function_many(&[u64::MAX; CPU_MASK_WORDS], move || remote(), wait);
+    call_local(&*func);
+}
+
+/// 远程调用IPI的处理函数（由C语言的IPI处理函数调用）
+#[no_mangle]
+pub extern "C" fn rs_smp_call_function_ipi_handler() {
+    flush_call_queue(smp_get_processor_id() as usize);
+}
@@ -1 +1,91 @@
+use core::sync::atomic::{AtomicU64, Ordering};
+
+use crate::mm::percpu::PerCpu;
+
 mod c_adapter;
+
+/// CPU掩码所需的64位字的数量
+pub const CPU_MASK_WORDS: usize = (PerCpu::MAX_CPU_NUM + 63) / 64;
+
+/// 可以被多个CPU并发修改的CPU掩码
+#[derive(Debug)]
+pub struct AtomicCpuMask {
+    bits: [AtomicU64; CPU_MASK_WORDS],
+}
+
+impl AtomicCpuMask {
+    pub const fn new() -> Self {
+        const ZERO: AtomicU64 = AtomicU64::new(0);
+        return Self {
+            bits: [ZERO; CPU_MASK_WORDS],
+        };
+    }
+
+    /// 把指定的CPU加入掩码
+    #[inline(always)]
+    pub fn set(&self, cpu: usize) {
+        self.bits[cpu / 64].fetch_or(1 << (cpu % 64), Ordering::SeqCst);
+    }
+
+    /// 把指定的CPU从掩码中移除
+    #[inline(always)]
+    pub fn clear(&self, cpu: usize) {
+        self.bits[cpu / 64].fetch_and(!(1 << (cpu % 64)), Ordering::SeqCst);
+    }
+
+    /// 判断指定的CPU是否在掩码中
+    #[inline(always)]
+    pub fn get(&self, cpu: usize) -> bool {
+        return self.bits[cpu / 64].load(Ordering::SeqCst) & (1 << (cpu % 64)) != 0;
+    }
+
+    /// 把掩码设置为包含前`nr_cpus`个CPU
+    pub fn fill(&self, nr_cpus: usize) {
+        for (i, w) in self.bits.iter().enumerate() {
+            let word = match nr_cpus.saturating_sub(i * 64) {
+                0 => 0,
+                n if n >= 64 => u64::MAX,
+                n => (1u64 << n) - 1,
+            };
+            w.store(word, Ordering::SeqCst);
+        }
+    }
+
+    /// 获取掩码的副本（第i个字的第j位对应第i*64+j个CPU）
+    pub fn words(&self) -> [u64; CPU_MASK_WORDS] {
+        let mut words = [0u64; CPU_MASK_WORDS];
+        for (i, w) in self.bits.iter().enumerate() {
+            words[i] = w.load(Ordering::SeqCst);
+        }
+        return words;
+    }
+
+    /// 用`words`替换掩码的内容
+    pub fn store_words(&self, words: &[u64; CPU_MASK_WORDS]) {
+        for (i, w) in self.bits.iter().enumerate() {
+            w.store(words[i], Ordering::SeqCst);
+        }
+    }
+
+    /// 判断掩码是否为空
+    pub fn is_empty(&self) -> bool {
+        return self.bits.iter().all(|w| w.load(Ordering::SeqCst) == 0);
+    }
+
+    /// 遍历掩码中的所有CPU
+    ///
+    /// 请注意，遍历过程中掩码可能被其他CPU修改，因此得到的只是某个时刻的近似结果
+    pub fn iter(&self) -> impl Iterator<Item = usize> + '_ {
+        return self.bits.iter().enumerate().flat_map(|(i, w)| {
+            let mut word = w.load(Ordering::SeqCst);
+            core::iter::from_fn(move || {
+                if word == 0 {
+                    return None;
+                }
+                let bit = word.trailing_zeros() as usize;
+                word &= word - 1;
+                return Some(i * 64 + bit);
+            })
+        });
+    }
+}
@@ -1,10 +1,13 @@
 use crate::{
-    arch::interrupt::ipi::send_ipi,
+    arch::interrupt::ipi::{send_ipi, send_ipi_mask},
     exception::ipi::{IpiKind, IpiTarget},
     syscall::SystemError,
 };
 
+use self::cpu::CPU_MASK_WORDS;
+
 pub mod c_adapter;
+pub mod call_function;
 pub mod core;
 pub mod cpu;
 
@@ -14,3 +17,8 @@ pub fn kick_cpu(cpu_id: u32) -> Result<(), SystemError> {
     send_ipi(IpiKind::KickCpu, IpiTarget::Specified(cpu_id as usize));
     return Ok(());
 }
+
+/// 唤醒掩码中除当前CPU以外的所有CPU，尽量用一次（或每个cluster一次）IPI完成
+pub fn kick_cpus(mask: &[u64; CPU_MASK_WORDS]) {
+    send_ipi_mask(IpiKind::KickCpu, mask);
+}
@@ -20,12 +20,13 @@
 
 static void __smp_kick_cpu_handler(uint64_t irq_num, uint64_t param, struct pt_regs *regs);
 static void __smp__flush_tlb_ipi_handler(uint64_t irq_num, uint64_t param, struct pt_regs *regs);
-
-static spinlock_t multi_core_starting_lock = {1}; // 多核启动锁
+static void __smp_call_function_ipi_handler(uint64_t irq_num, uint64_t param, struct pt_regs *regs);
+extern void rs_tlb_shootdown_ipi_handler();
+extern void rs_smp_call_function_ipi_handler();
 
 static uint32_t total_processor_num = 0;
-static int current_starting_cpu = 0;
 
+// 已经启动的核心数（包括BSP）。AP并行启动，使用原子操作更新
 int num_cpu_started = 1;
 
 extern void smp_ap_start();
@@ -33,10 +34,13 @@ extern uint64_t rs_get_idle_stack_top(uint32_t cpu_id);
 extern int rs_ipi_send_smp_startup(uint32_t apic_id);
 extern void rs_ipi_send_smp_init();
 extern void rs_init_syscall_64();
+extern void rs_idle_loop();
 
 // 在head.S中定义的，APU启动时，要加载的页表
 // 由于内存管理模块初始化的时候，重置了页表，因此我们要把当前的页表传给APU
 extern uint64_t __APU_START_CR3;
+// 在head.S中定义的，以APIC ID为下标的AP启动栈。多个AP同时执行head.S中的代码，每个AP必须使用自己的栈
+extern uint64_t __APU_BOOT_STACK[256];
 
 struct X86CpuInfo
 {
@@ -51,10 +55,10 @@ static struct X86CpuInfo __cpu_info[MAX_SUPPORTED_PROCESSOR_NUM] = {0};
 // kick cpu 功能所使用的中断向量号
 #define KICK_CPU_IRQ_NUM 0xc8
 #define FLUSH_TLB_IRQ_NUM 0xc9
+#define CALL_FUNCTION_IRQ_NUM 0xca
 
 void smp_init()
 {
-    spin_init(&multi_core_starting_lock); // 初始化多核启动锁
     // 设置多核启动时，要加载的页表
     __APU_START_CR3 = (uint64_t)get_CR3();
 
@@ -79,6 +83,7 @@ void smp_init()
     // 注册接收kick_cpu功能的处理函数。（向量号200）
     ipi_regiserIPI(KICK_CPU_IRQ_NUM, NULL, &__smp_kick_cpu_handler, NULL, NULL, "IPI kick cpu");
     ipi_regiserIPI(FLUSH_TLB_IRQ_NUM, NULL, &__smp__flush_tlb_ipi_handler, NULL, NULL, "IPI flush tlb");
+    ipi_regiserIPI(CALL_FUNCTION_IRQ_NUM, NULL, &__smp_call_function_ipi_handler, NULL, NULL, "IPI call function");
 
     int core_to_start = 0;
     // total_processor_num = 3;
@@ -95,7 +100,7 @@ void smp_init()
             // --total_processor_num;
             continue;
         }
-        if (__cpu_info[i].can_boot == false)
+        if (__cpu_info[i].can_boot == false || __cpu_info[i].apic_id >= 256)
         {
             // --total_processor_num;
             kdebug("processor %d cannot be enabled.", __cpu_info[i].core_id);
@@ -104,14 +109,14 @@ void smp_init()
         ++core_to_start;
         // continue;
         io_mfence();
-        spin_lock_no_preempt(&multi_core_starting_lock);
-        current_starting_cpu = __cpu_info[i].apic_id;
-        io_mfence();
-        // 为每个AP处理器分配栈空间
-        cpu_core_info[current_starting_cpu].stack_start = (uint64_t)rs_get_idle_stack_top(current_starting_cpu);
+        uint32_t apic_id = __cpu_info[i].apic_id;
+        // 为每个AP处理器分配栈空间。AP从启动到切换到idle进程的栈之前，使用的也是这个栈
+        cpu_core_info[apic_id].stack_start = (uint64_t)rs_get_idle_stack_top(apic_id);
+        __APU_BOOT_STACK[apic_id] = cpu_core_info[apic_id].stack_start;
 
         io_mfence();
 
+        // 不等待上一个AP完成初始化，所有的AP并行启动
         kdebug("core %d, to send start up", __cpu_info[i].apic_id);
         // 连续发送两次start-up IPI
 
@@ -125,7 +130,8 @@ void smp_init()
         io_mfence();
     }
     io_mfence();
-    while (num_cpu_started != (core_to_start + 1))
+    // 等待所有的AP完成启动
+    while (__atomic_load_n(&num_cpu_started, __ATOMIC_ACQUIRE) != (core_to_start + 1))
         pause();
 
     kinfo("Cleaning page table remapping...\n");
@@ -143,9 +149,9 @@ void smp_init()
 void smp_ap_start_stage2()
 {
 
-    ksuccess("AP core %d successfully started!", current_starting_cpu);
+    ksuccess("AP core %d successfully started!", rs_current_cpu_id());
     io_mfence();
-    ++num_cpu_started;
+    __atomic_add_fetch(&num_cpu_started, 1, __ATOMIC_RELEASE);
     io_mfence();
 
     rs_apic_init_ap();
@@ -155,7 +161,6 @@ void smp_ap_start_stage2()
     barrier();
 
     io_mfence();
-    spin_unlock_no_preempt(&multi_core_starting_lock);
 
     rs_init_syscall_64();
     
@@ -165,11 +170,7 @@ void smp_ap_start_stage2()
     sti();
     sched();
 
-    while (1)
-    {
-        // kdebug("123");
-        hlt();
-    }
+    rs_idle_loop();
 
     while (1)
     {
@@ -195,9 +196,14 @@ static void __smp_kick_cpu_handler(uint64_t irq_num, uint64_t param, struct pt_r
 
 static void __smp__flush_tlb_ipi_handler(uint64_t irq_num, uint64_t param, struct pt_regs *regs)
 {
-    if (user_mode(regs))
-        return;
-    flush_tlb();
+    // 无论中断发生在用户态还是内核态，都需要刷新TLB
+    rs_tlb_shootdown_ipi_handler();
+}
+
+static void __smp_call_function_ipi_handler(uint64_t irq_num, uint64_t param, struct pt_regs *regs)
+{
+    // 无论中断发生在用户态还是内核态，都需要执行其他CPU发来的请求
+    rs_smp_call_function_ipi_handler();
 }
 
 /**
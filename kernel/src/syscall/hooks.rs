@@ -0,0 +1,68 @@
+//! 系统调用的进入、退出钩子（需要启用`syscall_hooks`特性）
+//!
+//! 钩子用于系统调用的跟踪、统计以及过滤：进入钩子返回错误时，系统调用不会被执行，直接返回这个错误。
+//! 不启用这个特性时，分发路径上不会有任何额外的开销。
+
+use core::{
+    fmt::Debug,
+    sync::atomic::{AtomicBool, Ordering},
+};
+
+use alloc::{sync::Arc, vec::Vec};
+
+use crate::libs::rwlock::RwLock;
+
+use super::SystemError;
+
+pub trait SyscallHook: Debug + Send + Sync {
+    /// 系统调用执行之前调用
+    ///
+    /// ## 返回值
+    ///
+    /// 返回错误时，系统调用不会被执行，直接返回这个错误
+    fn on_enter(&self, _nr: usize, _args: &[usize]) -> Result<(), SystemError> {
+        return Ok(());
+    }
+
+    /// 系统调用执行之后调用
+    fn on_exit(&self, _nr: usize, _args: &[usize], _ret: &Result<usize, SystemError>) {}
+}
+
+static SYSCALL_HOOKS: RwLock<Vec<Arc<dyn SyscallHook>>> = RwLock::new(Vec::new());
+/// 是否注册了钩子。没有钩子时，不需要获取锁
+static HOOKS_ENABLED: AtomicBool = AtomicBool::new(false);
+
+/// 注册一个系统调用钩子
+pub fn register_syscall_hook(hook: Arc<dyn SyscallHook>) {
+    let mut hooks = SYSCALL_HOOKS.write_irqsave();
+    hooks.push(hook);
+    HOOKS_ENABLED.store(true, Ordering::SeqCst);
+}
+
+/// 注销一个系统调用钩子
+pub fn unregister_syscall_hook(hook: &Arc<dyn SyscallHook>) {
+    let mut hooks = SYSCALL_HOOKS.write_irqsave();
+    hooks.retain(|h| !Arc::ptr_eq(h, hook));
+    HOOKS_ENABLED.store(!hooks.is_empty(), Ordering::SeqCst);
+}
+
+#[inline(always)]
+pub(super) fn syscall_enter(nr: usize, args: &[usize]) -> Result<(), SystemError> {
+    if !HOOKS_ENABLED.load(Ordering::Relaxed) {
+        return Ok(());
+    }
+    for hook in SYSCALL_HOOKS.read_irqsave().iter() {
+        hook.on_enter(nr, args)?;
+    }
+    return Ok(());
+}
+
+#[inline(always)]
+pub(super) fn syscall_exit(nr: usize, args: &[usize], ret: &Result<usize, SystemError>) {
+    if !HOOKS_ENABLED.load(Ordering::Relaxed) {
+        return;
+    }
+    for hook in SYSCALL_HOOKS.read_irqsave().iter() {
+        hook.on_exit(nr, args, ret);
+    }
+}
@@ -1,5 +1,6 @@
 use core::{
     ffi::{c_char, c_int, c_void, CStr},
+    intrinsics::unlikely,
     sync::atomic::{AtomicBool, Ordering},
 };
 
@@ -9,42 +10,61 @@ use crate::{
         SYS_FCHMODAT, SYS_LSTAT, SYS_OPENAT, SYS_PRLIMIT64, SYS_READV, SYS_SYSINFO, SYS_UMASK,
         SYS_UNLINK,
     },
-    libs::{futex::constant::FutexFlag, rand::GRandFlags},
+    libs::{
+        futex::{constant::FutexFlag, futex::FutexWaitv},
+        rand::GRandFlags,
+    },
     process::{
         fork::KernelCloneArgs,
         resource::{RLimit64, RUsage},
+        spawn::{PosixSpawnAttr, PosixSpawnFileAction},
     },
 };
 
 use num_traits::{FromPrimitive, ToPrimitive};
 
 use crate::{
-    arch::{cpu::cpu_reset, interrupt::TrapFrame, MMArch},
+    arch::{cpu::cpu_reset, interrupt::TrapFrame, ipc::signal::SigSet, CurrentTimeArch, MMArch},
+    debug::klog::kmsg::do_syslog,
     driver::base::{block::SeekFrom, device::DeviceNumber},
-    filesystem::vfs::{
-        fcntl::FcntlCommand,
-        file::FileMode,
-        syscall::{ModeType, PosixKstat, SEEK_CUR, SEEK_END, SEEK_MAX, SEEK_SET},
-        MAX_PATHLEN,
+    filesystem::{
+        epoll::EPollEvent,
+        io_uring::IoUringParams,
+        vfs::{
+            fcntl::FcntlCommand,
+            file::FileMode,
+            poll::PollFd,
+            syscall::{ModeType, PosixKstat, SEEK_CUR, SEEK_END, SEEK_MAX, SEEK_SET},
+            MAX_PATHLEN,
+        },
     },
     include::bindings::bindings::{PAGE_2M_SIZE, PAGE_4K_SIZE},
-    kinfo,
+    ipc::{mqueue::MqAttr, shm::ShmidDs},
+    kinfo, kwarn,
     libs::align::page_align_up,
     mm::{verify_area, MemoryManagementArch, VirtAddr},
     net::syscall::SockAddr,
-    process::{fork::CloneFlags, Pid},
+    perf::PerfEventAttr,
+    process::{fork::CloneFlags, Pid, ProcessManager},
     time::{
-        syscall::{PosixTimeZone, PosixTimeval},
-        TimeSpec,
+        posix_timer::{ItimerSpec, SigEvent},
+        syscall::{PosixTimeZone, PosixTimeval, Tms},
+        TimeArch, TimeSpec,
     },
 };
 
 use self::{
     misc::SysInfo,
-    user_access::{UserBufferReader, UserBufferWriter},
+    table::SyscallTable,
+    user_access::{user_ref, user_ref_mut, user_str, UserBufferReader, UserBufferWriter},
 };
 
+#[cfg(feature = "syscall_hooks")]
+pub mod hooks;
 pub mod misc;
+pub mod stats;
+pub mod table;
+pub mod trace;
 pub mod user_access;
 
 #[repr(i32)]
@@ -369,8 +389,13 @@ pub const SYS_IOCTL: usize = 16;
 
 pub const SYS_WRITEV: usize = 20;
 pub const SYS_PIPE: usize = 22;
+pub const SYS_SELECT: usize = 23;
 
+pub const SYS_MSYNC: usize = 26;
 pub const SYS_MADVISE: usize = 28;
+pub const SYS_SHMGET: usize = 29;
+pub const SYS_SHMAT: usize = 30;
+pub const SYS_SHMCTL: usize = 31;
 
 pub const SYS_DUP: usize = 32;
 pub const SYS_DUP2: usize = 33;
@@ -378,13 +403,14 @@ pub const SYS_DUP2: usize = 33;
 pub const SYS_NANOSLEEP: usize = 35;
 
 pub const SYS_GETPID: usize = 39;
+pub const SYS_SENDFILE: usize = 40;
 
 pub const SYS_SOCKET: usize = 41;
 pub const SYS_CONNECT: usize = 42;
 pub const SYS_ACCEPT: usize = 43;
 pub const SYS_SENDTO: usize = 44;
 pub const SYS_RECVFROM: usize = 45;
-
+pub const SYS_SENDMSG: usize = 46;
 pub const SYS_RECVMSG: usize = 47;
 pub const SYS_SHUTDOWN: usize = 48;
 pub const SYS_BIND: usize = 49;
@@ -403,7 +429,11 @@ pub const SYS_EXIT: usize = 60;
 pub const SYS_WAIT4: usize = 61;
 pub const SYS_KILL: usize = 62;
 
+pub const SYS_SHMDT: usize = 67;
+
 pub const SYS_FCNTL: usize = 72;
+pub const SYS_FSYNC: usize = 74;
+pub const SYS_FDATASYNC: usize = 75;
 
 pub const SYS_FTRUNCATE: usize = 77;
 pub const SYS_GET_DENTS: usize = 78;
@@ -418,6 +448,7 @@ pub const SYS_READLINK: usize = 89;
 
 pub const SYS_GETTIMEOFDAY: usize = 96;
 pub const SYS_GETRUSAGE: usize = 98;
+pub const SYS_TIMES: usize = 100;
 
 pub const SYS_GETUID: usize = 102;
 pub const SYS_SYSLOG: usize = 103;
@@ -431,9 +462,15 @@ pub const SYS_GETEGID: usize = 108;
 pub const SYS_GETPPID: usize = 110;
 pub const SYS_GETPGID: usize = 121;
 
+pub const SYS_GETPRIORITY: usize = 140;
+pub const SYS_SETPRIORITY: usize = 141;
+pub const SYS_SCHED_SETSCHEDULER: usize = 144;
+pub const SYS_SCHED_GETSCHEDULER: usize = 145;
+
 pub const SYS_SIGALTSTACK: usize = 131;
 pub const SYS_MKNOD: usize = 133;
 
+pub const SYS_PRCTL: usize = 157;
 pub const SYS_ARCH_PRCTL: usize = 158;
 
 pub const SYS_REBOOT: usize = 169;
@@ -445,34 +482,253 @@ pub const SYS_TKILL: usize = 200;
 
 #[allow(dead_code)]
 pub const SYS_FUTEX: usize = 202;
+pub const SYS_SCHED_SETAFFINITY: usize = 203;
+pub const SYS_SCHED_GETAFFINITY: usize = 204;
+
+pub const SYS_EPOLL_CREATE: usize = 213;
 
 pub const SYS_GET_DENTS_64: usize = 217;
 #[allow(dead_code)]
 pub const SYS_SET_TID_ADDR: usize = 218;
 
+pub const SYS_FADVISE64: usize = 221;
+
+pub const SYS_TIMER_CREATE: usize = 222;
+pub const SYS_TIMER_SETTIME: usize = 223;
+pub const SYS_TIMER_GETTIME: usize = 224;
+pub const SYS_TIMER_GETOVERRUN: usize = 225;
+pub const SYS_TIMER_DELETE: usize = 226;
+
 pub const SYS_EXIT_GROUP: usize = 231;
+pub const SYS_EPOLL_WAIT: usize = 232;
+pub const SYS_EPOLL_CTL: usize = 233;
+
+pub const SYS_MQ_OPEN: usize = 240;
+pub const SYS_MQ_UNLINK: usize = 241;
+pub const SYS_MQ_TIMEDSEND: usize = 242;
+pub const SYS_MQ_TIMEDRECEIVE: usize = 243;
+pub const SYS_MQ_NOTIFY: usize = 244;
+pub const SYS_MQ_GETSETATTR: usize = 245;
 
 pub const SYS_UNLINK_AT: usize = 263;
 
 pub const SYS_READLINK_AT: usize = 267;
 
+pub const SYS_PSELECT6: usize = 270;
+pub const SYS_PPOLL: usize = 271;
+
+pub const SYS_SPLICE: usize = 275;
+
+pub const SYS_SYNC_FILE_RANGE: usize = 277;
+pub const SYS_VMSPLICE: usize = 278;
+
+pub const SYS_EPOLL_PWAIT: usize = 281;
+
+pub const SYS_TIMERFD_CREATE: usize = 283;
+
+pub const SYS_FALLOCATE: usize = 285;
+pub const SYS_TIMERFD_SETTIME: usize = 286;
+pub const SYS_TIMERFD_GETTIME: usize = 287;
+
 pub const SYS_ACCEPT4: usize = 288;
+pub const SYS_SIGNALFD4: usize = 289;
+pub const SYS_EVENTFD2: usize = 290;
+
+pub const SYS_EPOLL_CREATE1: usize = 291;
 
 pub const SYS_PIPE2: usize = 293;
 
+pub const SYS_PREADV: usize = 295;
+pub const SYS_PWRITEV: usize = 296;
+
+pub const SYS_PERF_EVENT_OPEN: usize = 298;
+
+pub const SYS_RECVMMSG: usize = 299;
+
+pub const SYS_SENDMMSG: usize = 307;
+
+pub const SYS_GETCPU: usize = 309;
+
 #[allow(dead_code)]
 pub const SYS_GET_RANDOM: usize = 318;
 
+pub const SYS_MEMBARRIER: usize = 324;
+
+pub const SYS_RSEQ: usize = 334;
+
+pub const SYS_IO_URING_SETUP: usize = 425;
+pub const SYS_IO_URING_ENTER: usize = 426;
+
+pub const SYS_FUTEX_WAITV: usize = 449;
+
 // 与linux不一致的调用，在linux基础上累加
 pub const SYS_PUT_STRING: usize = 100000;
 pub const SYS_SBRK: usize = 100001;
 /// todo: 该系统调用与Linux不一致，将来需要删除该系统调用！！！ 删的时候记得改C版本的libc
 pub const SYS_CLOCK: usize = 100002;
 pub const SYS_SCHED: usize = 100003;
+pub const SYS_POSIX_SPAWN: usize = 100004;
 
 #[derive(Debug)]
 pub struct Syscall;
 
+/// 系统调用表，在编译期根据系统调用号构建
+static SYSCALL_TABLE: SyscallTable = SyscallTable::new(&[
+    (SYS_PUT_STRING, Syscall::sys_put_string),
+    (SYS_OPEN, Syscall::sys_open),
+    (SYS_OPENAT, Syscall::sys_openat),
+    (SYS_CLOSE, Syscall::sys_close),
+    (SYS_READ, Syscall::sys_read),
+    (SYS_WRITE, Syscall::sys_write),
+    (SYS_LSEEK, Syscall::sys_lseek),
+    (SYS_IOCTL, Syscall::sys_ioctl),
+    (SYS_FORK, Syscall::sys_fork),
+    (SYS_VFORK, Syscall::sys_vfork),
+    (SYS_BRK, Syscall::sys_brk),
+    (SYS_SBRK, Syscall::sys_sbrk),
+    (SYS_REBOOT, Syscall::sys_reboot),
+    (SYS_CHDIR, Syscall::sys_chdir),
+    (SYS_GET_DENTS, Syscall::sys_get_dents),
+    (SYS_GET_DENTS_64, Syscall::sys_get_dents),
+    (SYS_EXECVE, Syscall::sys_execve),
+    (SYS_WAIT4, Syscall::sys_wait4),
+    (SYS_EXIT, Syscall::sys_exit),
+    (SYS_MKDIR, Syscall::sys_mkdir),
+    (SYS_NANOSLEEP, Syscall::sys_nanosleep),
+    (SYS_CLOCK, Syscall::sys_clock),
+    (SYS_PIPE, Syscall::sys_pipe),
+    (SYS_PIPE2, Syscall::sys_pipe2),
+    (SYS_UNLINK_AT, Syscall::sys_unlink_at),
+    (SYS_UNLINK, Syscall::sys_unlink),
+    (SYS_KILL, Syscall::sys_kill),
+    (SYS_SIGACTION, Syscall::sys_sigaction),
+    (SYS_RT_SIGRETURN, Syscall::sys_rt_sigreturn),
+    (SYS_GETPID, Syscall::sys_getpid),
+    (SYS_SCHED, Syscall::sys_sched),
+    (SYS_POSIX_SPAWN, Syscall::sys_posix_spawn),
+    (SYS_GETPRIORITY, Syscall::sys_getpriority),
+    (SYS_SETPRIORITY, Syscall::sys_setpriority),
+    (SYS_SCHED_SETSCHEDULER, Syscall::sys_sched_setscheduler),
+    (SYS_SCHED_GETSCHEDULER, Syscall::sys_sched_getscheduler),
+    (SYS_SCHED_SETAFFINITY, Syscall::sys_sched_setaffinity),
+    (SYS_SCHED_GETAFFINITY, Syscall::sys_sched_getaffinity),
+    (SYS_GETCPU, Syscall::sys_getcpu),
+    (SYS_RSEQ, Syscall::sys_rseq),
+    (SYS_MEMBARRIER, Syscall::sys_membarrier),
+    (SYS_DUP, Syscall::sys_dup),
+    (SYS_DUP2, Syscall::sys_dup2),
+    (SYS_SOCKET, Syscall::sys_socket),
+    (SYS_SETSOCKOPT, Syscall::sys_setsockopt),
+    (SYS_GETSOCKOPT, Syscall::sys_getsockopt),
+    (SYS_CONNECT, Syscall::sys_connect),
+    (SYS_BIND, Syscall::sys_bind),
+    (SYS_SENDTO, Syscall::sys_sendto),
+    (SYS_RECVFROM, Syscall::sys_recvfrom),
+    (SYS_RECVMSG, Syscall::sys_recvmsg),
+    (SYS_SENDMSG, Syscall::sys_sendmsg),
+    (SYS_RECVMMSG, Syscall::sys_recvmmsg),
+    (SYS_SENDMMSG, Syscall::sys_sendmmsg),
+    (SYS_LISTEN, Syscall::sys_listen),
+    (SYS_SHUTDOWN, Syscall::sys_shutdown),
+    (SYS_ACCEPT, Syscall::sys_accept),
+    (SYS_ACCEPT4, Syscall::sys_accept4),
+    (SYS_GETSOCKNAME, Syscall::sys_getsockname),
+    (SYS_GETPEERNAME, Syscall::sys_getpeername),
+    (SYS_GETTIMEOFDAY, Syscall::sys_gettimeofday),
+    (SYS_MMAP, Syscall::sys_mmap),
+    (SYS_MUNMAP, Syscall::sys_munmap),
+    (SYS_MPROTECT, Syscall::sys_mprotect),
+    (SYS_GETCWD, Syscall::sys_getcwd),
+    (SYS_GETPGID, Syscall::sys_getpgid),
+    (SYS_GETPPID, Syscall::sys_getppid),
+    (SYS_FSTAT, Syscall::sys_fstat),
+    (SYS_FCNTL, Syscall::sys_fcntl),
+    (SYS_FTRUNCATE, Syscall::sys_ftruncate),
+    (SYS_FSYNC, Syscall::sys_fsync),
+    (SYS_FDATASYNC, Syscall::sys_fdatasync),
+    (SYS_SYNC_FILE_RANGE, Syscall::sys_sync_file_range),
+    (SYS_FADVISE64, Syscall::sys_fadvise64),
+    (SYS_FALLOCATE, Syscall::sys_fallocate),
+    (SYS_MKNOD, Syscall::sys_mknod),
+    (SYS_CLONE, Syscall::sys_clone),
+    (SYS_FUTEX, Syscall::sys_futex),
+    (SYS_FUTEX_WAITV, Syscall::sys_futex_waitv),
+    (SYS_READV, Syscall::sys_readv),
+    (SYS_WRITEV, Syscall::sys_writev),
+    (SYS_PREADV, Syscall::sys_preadv),
+    (SYS_PWRITEV, Syscall::sys_pwritev),
+    (SYS_PRCTL, Syscall::sys_prctl),
+    (SYS_ARCH_PRCTL, Syscall::sys_arch_prctl),
+    (SYS_SET_TID_ADDR, Syscall::sys_set_tid_addr),
+    (SYS_GET_RANDOM, Syscall::sys_get_random),
+    (SYS_SOCKET_PAIR, Syscall::sys_socket_pair),
+    (SYS_POLL, Syscall::sys_poll),
+    (SYS_EPOLL_CREATE, Syscall::sys_epoll_create),
+    (SYS_EPOLL_CREATE1, Syscall::sys_epoll_create1),
+    (SYS_EPOLL_CTL, Syscall::sys_epoll_ctl),
+    (SYS_EPOLL_WAIT, Syscall::sys_epoll_wait),
+    (SYS_EPOLL_PWAIT, Syscall::sys_epoll_pwait),
+    (SYS_IO_URING_SETUP, Syscall::sys_io_uring_setup),
+    (SYS_IO_URING_ENTER, Syscall::sys_io_uring_enter),
+    (SYS_PERF_EVENT_OPEN, Syscall::sys_perf_event_open),
+    (SYS_PPOLL, Syscall::sys_ppoll),
+    (SYS_SENDFILE, Syscall::sys_sendfile),
+    (SYS_SPLICE, Syscall::sys_splice),
+    (SYS_VMSPLICE, Syscall::sys_vmsplice),
+    (SYS_SELECT, Syscall::sys_select),
+    (SYS_PSELECT6, Syscall::sys_pselect6),
+    (SYS_RT_SIGPROCMASK, Syscall::sys_rt_sigprocmask),
+    (SYS_TKILL, Syscall::sys_tkill),
+    (SYS_SIGALTSTACK, Syscall::sys_sigaltstack),
+    (SYS_EXIT_GROUP, Syscall::sys_exit_group),
+    (SYS_MSYNC, Syscall::sys_msync),
+    (SYS_MADVISE, Syscall::sys_madvise),
+    (SYS_SHMGET, Syscall::sys_shmget),
+    (SYS_SHMAT, Syscall::sys_shmat),
+    (SYS_SHMDT, Syscall::sys_shmdt),
+    (SYS_SHMCTL, Syscall::sys_shmctl),
+    (SYS_MQ_OPEN, Syscall::sys_mq_open),
+    (SYS_MQ_UNLINK, Syscall::sys_mq_unlink),
+    (SYS_MQ_TIMEDSEND, Syscall::sys_mq_timedsend),
+    (SYS_MQ_TIMEDRECEIVE, Syscall::sys_mq_timedreceive),
+    (SYS_MQ_NOTIFY, Syscall::sys_mq_notify),
+    (SYS_MQ_GETSETATTR, Syscall::sys_mq_getsetattr),
+    (SYS_GETTID, Syscall::sys_gettid),
+    (SYS_GETUID, Syscall::sys_getuid),
+    (SYS_SYSLOG, Syscall::sys_syslog),
+    (SYS_GETGID, Syscall::sys_getgid),
+    (SYS_SETUID, Syscall::sys_setuid),
+    (SYS_SETGID, Syscall::sys_setgid),
+    (SYS_GETEUID, Syscall::sys_geteuid),
+    (SYS_GETEGID, Syscall::sys_getegid),
+    (SYS_GETRUSAGE, Syscall::sys_getrusage),
+    (SYS_TIMES, Syscall::sys_times),
+    (SYS_READLINK, Syscall::sys_readlink),
+    (SYS_READLINK_AT, Syscall::sys_readlink_at),
+    (SYS_PRLIMIT64, Syscall::sys_prlimit64),
+    (SYS_ACCESS, Syscall::sys_access),
+    (SYS_FACCESSAT, Syscall::sys_faccessat),
+    (SYS_FACCESSAT2, Syscall::sys_faccessat2),
+    (SYS_CLOCK_GETTIME, Syscall::sys_clock_gettime),
+    (SYS_TIMER_CREATE, Syscall::sys_timer_create),
+    (SYS_TIMER_SETTIME, Syscall::sys_timer_settime),
+    (SYS_TIMER_GETTIME, Syscall::sys_timer_gettime),
+    (SYS_TIMER_GETOVERRUN, Syscall::sys_timer_getoverrun),
+    (SYS_TIMER_DELETE, Syscall::sys_timer_delete),
+    (SYS_TIMERFD_CREATE, Syscall::sys_timerfd_create),
+    (SYS_TIMERFD_SETTIME, Syscall::sys_timerfd_settime),
+    (SYS_TIMERFD_GETTIME, Syscall::sys_timerfd_gettime),
+    (SYS_EVENTFD2, Syscall::sys_eventfd2),
+    (SYS_SIGNALFD4, Syscall::sys_signalfd4),
+    (SYS_SYSINFO, Syscall::sys_sysinfo),
+    (SYS_UMASK, Syscall::sys_umask),
+    (SYS_CHMOD, Syscall::sys_chmod),
+    (SYS_FCHMOD, Syscall::sys_fchmod),
+    (SYS_FCHMODAT, Syscall::sys_fchmodat),
+    (SYS_STAT, Syscall::sys_stat),
+    (SYS_LSTAT, Syscall::sys_lstat),
+]);
+
 extern "C" {
     fn do_put_string(s: *const u8, front_color: u32, back_color: u32) -> usize;
 }
@@ -497,824 +753,1306 @@ impl Syscall {
     }
     /// @brief 系统调用分发器，用于分发系统调用。
     ///
-    /// 这个函数内，需要根据系统调用号，调用对应的系统调用处理函数。
-    /// 并且，对于用户态传入的指针参数，需要在本函数内进行越界检查，防止访问到内核空间。
+    /// 根据系统调用号，在系统调用表中找到对应的处理函数（`sys_*`）并调用它。
+    /// 处理函数负责解码参数：对于用户态传入的指针参数，需要进行越界检查，防止访问到内核空间。
+    ///
+    /// 启用`syscall_hooks`特性时，在系统调用执行前后调用注册的钩子（见[`hooks`]）。
+    /// 打开系统调用统计（见[`stats`]）或者当前进程正在被跟踪（见[`trace`]）时，记录系统调用的耗时
     pub fn handle(
         syscall_num: usize,
         args: &[usize],
         frame: &mut TrapFrame,
     ) -> Result<usize, SystemError> {
-        let r = match syscall_num {
-            SYS_PUT_STRING => {
-                Self::put_string(args[0] as *const u8, args[1] as u32, args[2] as u32)
-            }
-            SYS_OPEN => {
-                let path: &CStr = unsafe { CStr::from_ptr(args[0] as *const c_char) };
-                let path: Result<&str, core::str::Utf8Error> = path.to_str();
-                let res = if path.is_err() {
-                    Err(SystemError::EINVAL)
-                } else {
-                    let path: &str = path.unwrap();
-
-                    let flags = args[1];
-                    let mode = args[2];
-
-                    let open_flags: FileMode = FileMode::from_bits_truncate(flags as u32);
-                    let mode = ModeType::from_bits(mode as u32).ok_or(SystemError::EINVAL)?;
-                    Self::open(path, open_flags, mode, true)
-                };
-                res
+        let handler = match SYSCALL_TABLE.get(syscall_num) {
+            Some(handler) => handler,
+            None => {
+                kwarn!(
+                    "Unsupported syscall ID: {}, pid: {:?}",
+                    syscall_num,
+                    ProcessManager::current_pcb().pid()
+                );
+                return Err(SystemError::ENOSYS);
             }
+        };
 
-            SYS_OPENAT => {
-                let dirfd = args[0] as i32;
-                let path: &CStr = unsafe { CStr::from_ptr(args[1] as *const c_char) };
-                let flags = args[2];
-                let mode = args[3];
-
-                let path: Result<&str, core::str::Utf8Error> = path.to_str();
-                let res = if path.is_err() {
-                    Err(SystemError::EINVAL)
-                } else {
-                    let path: &str = path.unwrap();
-
-                    let open_flags: FileMode =
-                        FileMode::from_bits(flags as u32).ok_or(SystemError::EINVAL)?;
-                    let mode = ModeType::from_bits(mode as u32).ok_or(SystemError::EINVAL)?;
-                    Self::openat(dirfd, path, open_flags, mode, true)
-                };
-                res
-            }
-            SYS_CLOSE => {
-                let fd = args[0];
+        #[cfg(feature = "syscall_hooks")]
+        hooks::syscall_enter(syscall_num, args)?;
 
-                let res = Self::close(fd);
+        // 统计和跟踪都关闭时，只有两次分支判断的开销
+        let traced = trace::current_traced();
+        let start = if unlikely(traced || stats::syscall_stats_enabled()) {
+            Some(CurrentTimeArch::get_cycles() as u64)
+        } else {
+            None
+        };
 
-                res
-            }
-            SYS_READ => {
-                let fd = args[0] as i32;
-                let buf_vaddr = args[1];
-                let len = args[2];
-                let from_user = frame.from_user();
-                let mut user_buffer_writer =
-                    UserBufferWriter::new(buf_vaddr as *mut u8, len, from_user)?;
-
-                let user_buf = user_buffer_writer.buffer(0)?;
-                let res = Self::read(fd, user_buf);
-                res
-            }
-            SYS_WRITE => {
-                let fd = args[0] as i32;
-                let buf_vaddr = args[1];
-                let len = args[2];
-                let from_user = frame.from_user();
-                let user_buffer_reader =
-                    UserBufferReader::new(buf_vaddr as *const u8, len, from_user)?;
-
-                let user_buf = user_buffer_reader.read_from_user(0)?;
-                let res = Self::write(fd, user_buf);
-                res
+        tracepoint!(
+            SyscallEnter,
+            syscall_num,
+            args.first().copied().unwrap_or(0)
+        );
+        let r = handler(args, frame);
+        tracepoint!(
+            SyscallExit,
+            syscall_num,
+            match &r {
+                Ok(v) => *v as u64,
+                Err(e) => e.to_posix_errno() as i64 as u64,
+            }
+        );
+
+        if let Some(start) = start {
+            let cycles = (CurrentTimeArch::get_cycles() as u64).wrapping_sub(start);
+            stats::syscall_stats_record(syscall_num, cycles);
+            if traced {
+                trace::syscall_trace_record(syscall_num, args, &r, start, cycles);
             }
+        }
 
-            SYS_LSEEK => {
-                let fd = args[0] as i32;
-                let offset = args[1] as i64;
-                let whence = args[2] as u32;
+        #[cfg(feature = "syscall_hooks")]
+        hooks::syscall_exit(syscall_num, args, &r);
 
-                let w = match whence {
-                    SEEK_SET => Ok(SeekFrom::SeekSet(offset)),
-                    SEEK_CUR => Ok(SeekFrom::SeekCurrent(offset)),
-                    SEEK_END => Ok(SeekFrom::SeekEnd(offset)),
-                    SEEK_MAX => Ok(SeekFrom::SeekEnd(0)),
-                    _ => Err(SystemError::EINVAL),
-                }?;
+        return r;
+    }
 
-                Self::lseek(fd, w)
-            }
-            SYS_IOCTL => {
-                let fd = args[0];
-                let cmd = args[1];
-                let data = args[2];
-                Self::ioctl(fd, cmd as u32, data)
-            }
+    fn sys_put_string(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        Self::put_string(args[0] as *const u8, args[1] as u32, args[2] as u32)
+    }
 
-            SYS_FORK => Self::fork(frame),
-            SYS_VFORK => Self::vfork(frame),
+    fn sys_open(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let path = user_str(args[0])?;
+        let open_flags = FileMode::from_bits_truncate(args[1] as u32);
+        let mode = ModeType::from_bits(args[2] as u32).ok_or(SystemError::EINVAL)?;
+        return Self::open(path, open_flags, mode, true);
+    }
 
-            SYS_BRK => {
-                let new_brk = VirtAddr::new(args[0]);
-                Self::brk(new_brk).map(|vaddr| vaddr.data())
-            }
+    fn sys_openat(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let dirfd = args[0] as i32;
+        let path = user_str(args[1])?;
+        let open_flags = FileMode::from_bits(args[2] as u32).ok_or(SystemError::EINVAL)?;
+        let mode = ModeType::from_bits(args[3] as u32).ok_or(SystemError::EINVAL)?;
+        return Self::openat(dirfd, path, open_flags, mode, true);
+    }
 
-            SYS_SBRK => {
-                let increment = args[0] as isize;
-                Self::sbrk(increment).map(|vaddr: VirtAddr| vaddr.data())
-            }
+    fn sys_close(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let fd = args[0];
 
-            SYS_REBOOT => Self::reboot(),
-
-            SYS_CHDIR => {
-                // Closure for checking arguments
-                let chdir_check = |arg0: usize| {
-                    if arg0 == 0 {
-                        return Err(SystemError::EFAULT);
-                    }
-                    let path_ptr = arg0 as *const c_char;
-                    let virt_addr = VirtAddr::new(path_ptr as usize);
-                    // 权限校验
-                    if path_ptr.is_null()
-                        || (frame.from_user()
-                            && verify_area(virt_addr, PAGE_2M_SIZE as usize).is_err())
-                    {
-                        return Err(SystemError::EINVAL);
-                    }
-                    let dest_path: &CStr = unsafe { CStr::from_ptr(path_ptr) };
-                    let dest_path: &str = dest_path.to_str().map_err(|_| SystemError::EINVAL)?;
-                    if dest_path.len() == 0 {
-                        return Err(SystemError::EINVAL);
-                    } else if dest_path.len() > MAX_PATHLEN as usize {
-                        return Err(SystemError::ENAMETOOLONG);
-                    }
-
-                    return Ok(dest_path);
-                };
-
-                let r = chdir_check(args[0])?;
-                Self::chdir(r)
-            }
+        let res = Self::close(fd);
 
-            SYS_GET_DENTS | SYS_GET_DENTS_64 => {
-                let fd = args[0] as i32;
-
-                let buf_vaddr = args[1];
-                let len = args[2];
-                let virt_addr: VirtAddr = VirtAddr::new(buf_vaddr);
-                // 判断缓冲区是否来自用户态，进行权限校验
-                let res = if frame.from_user() && verify_area(virt_addr, len as usize).is_err() {
-                    // 来自用户态，而buffer在内核态，这样的操作不被允许
-                    Err(SystemError::EPERM)
-                } else if buf_vaddr == 0 {
-                    Err(SystemError::EFAULT)
-                } else {
-                    let buf: &mut [u8] = unsafe {
-                        core::slice::from_raw_parts_mut::<'static, u8>(buf_vaddr as *mut u8, len)
-                    };
-                    Self::getdents(fd, buf)
-                };
-
-                res
-            }
+        res
+    }
 
-            SYS_EXECVE => {
-                let path_ptr = args[0];
-                let argv_ptr = args[1];
-                let env_ptr = args[2];
-                let virt_path_ptr = VirtAddr::new(path_ptr);
-                let virt_argv_ptr = VirtAddr::new(argv_ptr);
-                let virt_env_ptr = VirtAddr::new(env_ptr);
-                // 权限校验
-                if frame.from_user()
-                    && (verify_area(virt_path_ptr, MAX_PATHLEN as usize).is_err()
-                        || verify_area(virt_argv_ptr, PAGE_4K_SIZE as usize).is_err())
-                    || verify_area(virt_env_ptr, PAGE_4K_SIZE as usize).is_err()
-                {
-                    Err(SystemError::EFAULT)
-                } else {
-                    Self::execve(
-                        path_ptr as *const u8,
-                        argv_ptr as *const *const u8,
-                        env_ptr as *const *const u8,
-                        frame,
-                    )
-                    .map(|_| 0)
-                }
-            }
-            SYS_WAIT4 => {
-                let pid = args[0] as i32;
-                let wstatus = args[1] as *mut i32;
-                let options = args[2] as c_int;
-                let rusage = args[3] as *mut c_void;
-                // 权限校验
-                // todo: 引入rusage之后，更正以下权限校验代码中，rusage的大小
-                Self::wait4(pid.into(), wstatus, options, rusage)
-            }
+    fn sys_read(args: &[usize], frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let fd = args[0] as i32;
+        let buf_vaddr = args[1];
+        let len = args[2];
+        let from_user = frame.from_user();
+        let mut user_buffer_writer = UserBufferWriter::new(buf_vaddr as *mut u8, len, from_user)?;
 
-            SYS_EXIT => {
-                let exit_code = args[0];
-                Self::exit(exit_code)
-            }
-            SYS_MKDIR => {
-                let path_ptr = args[0] as *const c_char;
-                let mode = args[1];
-                let virt_path_ptr = VirtAddr::new(path_ptr as usize);
-                let security_check = || {
-                    if path_ptr.is_null()
-                        || (frame.from_user()
-                            && verify_area(virt_path_ptr, PAGE_2M_SIZE as usize).is_err())
-                    {
-                        return Err(SystemError::EINVAL);
-                    }
-                    let path: &CStr = unsafe { CStr::from_ptr(path_ptr) };
-                    let path: &str = path.to_str().map_err(|_| SystemError::EINVAL)?.trim();
-
-                    if path == "" {
-                        return Err(SystemError::EINVAL);
-                    }
-                    return Ok(path);
-                };
-
-                let path = security_check();
-                if path.is_err() {
-                    Err(path.unwrap_err())
-                } else {
-                    Self::mkdir(path.unwrap(), mode)
-                }
-            }
+        let user_buf = user_buffer_writer.buffer(0)?;
+        let res = Self::read(fd, user_buf);
+        res
+    }
 
-            SYS_NANOSLEEP => {
-                let req = args[0] as *const TimeSpec;
-                let rem = args[1] as *mut TimeSpec;
-                let virt_req = VirtAddr::new(req as usize);
-                let virt_rem = VirtAddr::new(rem as usize);
-                if frame.from_user()
-                    && (verify_area(virt_req, core::mem::size_of::<TimeSpec>() as usize).is_err()
-                        || verify_area(virt_rem, core::mem::size_of::<TimeSpec>() as usize)
-                            .is_err())
-                {
-                    Err(SystemError::EFAULT)
-                } else {
-                    Self::nanosleep(req, rem)
-                }
-            }
+    fn sys_write(args: &[usize], frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let fd = args[0] as i32;
+        let buf_vaddr = args[1];
+        let len = args[2];
+        let from_user = frame.from_user();
+        let user_buffer_reader = UserBufferReader::new(buf_vaddr as *const u8, len, from_user)?;
 
-            SYS_CLOCK => Self::clock(),
-            SYS_PIPE => {
-                let pipefd: *mut i32 = args[0] as *mut c_int;
-                if pipefd.is_null() {
-                    Err(SystemError::EFAULT)
-                } else {
-                    Self::pipe2(pipefd, FileMode::empty())
-                }
-            }
-            SYS_PIPE2 => {
-                let pipefd: *mut i32 = args[0] as *mut c_int;
-                let arg1 = args[1];
-                if pipefd.is_null() {
-                    Err(SystemError::EFAULT)
-                } else {
-                    let flags = FileMode::from_bits_truncate(arg1 as u32);
-                    Self::pipe2(pipefd, flags)
-                }
-            }
+        let user_buf = user_buffer_reader.read_from_user(0)?;
+        let res = Self::write(fd, user_buf);
+        res
+    }
 
-            SYS_UNLINK_AT => {
-                let dirfd = args[0] as i32;
-                let pathname = args[1] as *const c_char;
-                let flags = args[2] as u32;
-                let virt_pathname = VirtAddr::new(pathname as usize);
-                if frame.from_user() && verify_area(virt_pathname, PAGE_4K_SIZE as usize).is_err() {
-                    Err(SystemError::EFAULT)
-                } else if pathname.is_null() {
-                    Err(SystemError::EFAULT)
-                } else {
-                    let get_path = || {
-                        let pathname: &CStr = unsafe { CStr::from_ptr(pathname) };
-
-                        let pathname: &str = pathname.to_str().map_err(|_| SystemError::EINVAL)?;
-                        if pathname.len() >= MAX_PATHLEN {
-                            return Err(SystemError::ENAMETOOLONG);
-                        }
-                        return Ok(pathname.trim());
-                    };
-                    let pathname = get_path();
-                    if pathname.is_err() {
-                        Err(pathname.unwrap_err())
-                    } else {
-                        // kdebug!("sys unlinkat: dirfd: {}, pathname: {}", dirfd, pathname.as_ref().unwrap());
-                        Self::unlinkat(dirfd, pathname.unwrap(), flags)
-                    }
-                }
-            }
+    fn sys_lseek(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let fd = args[0] as i32;
+        let offset = args[1] as i64;
+        let whence = args[2] as u32;
 
-            SYS_UNLINK => {
-                let pathname = args[0] as *const u8;
-                Self::unlink(pathname)
-            }
-            SYS_KILL => {
-                let pid = Pid::new(args[0]);
-                let sig = args[1] as c_int;
-                // kdebug!("KILL SYSCALL RECEIVED");
-                Self::kill(pid, sig)
-            }
+        let w = match whence {
+            SEEK_SET => Ok(SeekFrom::SeekSet(offset)),
+            SEEK_CUR => Ok(SeekFrom::SeekCurrent(offset)),
+            SEEK_END => Ok(SeekFrom::SeekEnd(offset)),
+            SEEK_MAX => Ok(SeekFrom::SeekEnd(0)),
+            _ => Err(SystemError::EINVAL),
+        }?;
 
-            SYS_SIGACTION => {
-                let sig = args[0] as c_int;
-                let act = args[1];
-                let old_act = args[2];
-                Self::sigaction(sig, act, old_act, frame.from_user())
-            }
+        Self::lseek(fd, w)
+    }
 
-            SYS_RT_SIGRETURN => {
-                // 由于目前signal机制的实现，与x86_64强关联，因此暂时在arch/x86_64/syscall.rs中调用
-                // todo: 未来需要将signal机制与平台解耦
-                todo!()
-            }
+    fn sys_ioctl(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let fd = args[0];
+        let cmd = args[1];
+        let data = args[2];
+        Self::ioctl(fd, cmd as u32, data)
+    }
 
-            SYS_GETPID => Self::getpid().map(|pid| pid.into()),
+    fn sys_fork(_args: &[usize], frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::fork(frame);
+    }
 
-            SYS_SCHED => Self::sched(frame.from_user()),
-            SYS_DUP => {
-                let oldfd: i32 = args[0] as c_int;
-                Self::dup(oldfd)
-            }
-            SYS_DUP2 => {
-                let oldfd: i32 = args[0] as c_int;
-                let newfd: i32 = args[1] as c_int;
-                Self::dup2(oldfd, newfd)
-            }
+    fn sys_vfork(_args: &[usize], frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::vfork(frame);
+    }
 
-            SYS_SOCKET => Self::socket(args[0], args[1], args[2]),
-            SYS_SETSOCKOPT => {
-                let optval = args[3] as *const u8;
-                let optlen = args[4] as usize;
-                let virt_optval = VirtAddr::new(optval as usize);
-                // 验证optval的地址是否合法
-                if verify_area(virt_optval, optlen as usize).is_err() {
-                    // 地址空间超出了用户空间的范围，不合法
-                    Err(SystemError::EFAULT)
-                } else {
-                    let data: &[u8] = unsafe { core::slice::from_raw_parts(optval, optlen) };
-                    Self::setsockopt(args[0], args[1], args[2], data)
-                }
-            }
-            SYS_GETSOCKOPT => {
-                let optval = args[3] as *mut u8;
-                let optlen = args[4] as *mut usize;
-                let virt_optval = VirtAddr::new(optval as usize);
-                let virt_optlen = VirtAddr::new(optlen as usize);
-                let security_check = || {
-                    // 验证optval的地址是否合法
-                    if verify_area(virt_optval, PAGE_4K_SIZE as usize).is_err() {
-                        // 地址空间超出了用户空间的范围，不合法
-                        return Err(SystemError::EFAULT);
-                    }
-
-                    // 验证optlen的地址是否合法
-                    if verify_area(virt_optlen, core::mem::size_of::<u32>() as usize).is_err() {
-                        // 地址空间超出了用户空间的范围，不合法
-                        return Err(SystemError::EFAULT);
-                    }
-                    return Ok(());
-                };
-                let r = security_check();
-                if r.is_err() {
-                    Err(r.unwrap_err())
-                } else {
-                    Self::getsockopt(args[0], args[1], args[2], optval, optlen as *mut u32)
-                }
-            }
+    fn sys_brk(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let new_brk = VirtAddr::new(args[0]);
+        Self::brk(new_brk).map(|vaddr| vaddr.data())
+    }
 
-            SYS_CONNECT => {
-                let addr = args[1] as *const SockAddr;
-                let addrlen = args[2] as usize;
-                let virt_addr = VirtAddr::new(addr as usize);
-                // 验证addr的地址是否合法
-                if verify_area(virt_addr, addrlen as usize).is_err() {
-                    // 地址空间超出了用户空间的范围，不合法
-                    Err(SystemError::EFAULT)
-                } else {
-                    Self::connect(args[0], addr, addrlen)
-                }
-            }
-            SYS_BIND => {
-                let addr = args[1] as *const SockAddr;
-                let addrlen = args[2] as usize;
-                let virt_addr = VirtAddr::new(addr as usize);
-                // 验证addr的地址是否合法
-                if verify_area(virt_addr, addrlen as usize).is_err() {
-                    // 地址空间超出了用户空间的范围，不合法
-                    Err(SystemError::EFAULT)
-                } else {
-                    Self::bind(args[0], addr, addrlen)
-                }
-            }
+    fn sys_sbrk(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let increment = args[0] as isize;
+        Self::sbrk(increment).map(|vaddr: VirtAddr| vaddr.data())
+    }
 
-            SYS_SENDTO => {
-                let buf = args[1] as *const u8;
-                let len = args[2] as usize;
-                let flags = args[3] as u32;
-                let addr = args[4] as *const SockAddr;
-                let addrlen = args[5] as usize;
-                let virt_buf = VirtAddr::new(buf as usize);
-                let virt_addr = VirtAddr::new(addr as usize);
-                // 验证buf的地址是否合法
-                if verify_area(virt_buf, len as usize).is_err() {
-                    // 地址空间超出了用户空间的范围，不合法
-                    Err(SystemError::EFAULT)
-                } else if verify_area(virt_addr, addrlen as usize).is_err() {
-                    // 地址空间超出了用户空间的范围，不合法
-                    Err(SystemError::EFAULT)
-                } else {
-                    let data: &[u8] = unsafe { core::slice::from_raw_parts(buf, len) };
-                    Self::sendto(args[0], data, flags, addr, addrlen)
-                }
-            }
+    fn sys_reboot(_args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::reboot();
+    }
 
-            SYS_RECVFROM => {
-                let buf = args[1] as *mut u8;
-                let len = args[2] as usize;
-                let flags = args[3] as u32;
-                let addr = args[4] as *mut SockAddr;
-                let addrlen = args[5] as *mut usize;
-                let virt_buf = VirtAddr::new(buf as usize);
-                let virt_addrlen = VirtAddr::new(addrlen as usize);
-                let virt_addr = VirtAddr::new(addr as usize);
-                let security_check = || {
-                    // 验证buf的地址是否合法
-                    if verify_area(virt_buf, len as usize).is_err() {
-                        // 地址空间超出了用户空间的范围，不合法
-                        return Err(SystemError::EFAULT);
-                    }
-
-                    // 验证addrlen的地址是否合法
-                    if verify_area(virt_addrlen, core::mem::size_of::<u32>() as usize).is_err() {
-                        // 地址空间超出了用户空间的范围，不合法
-                        return Err(SystemError::EFAULT);
-                    }
-
-                    if verify_area(virt_addr, core::mem::size_of::<SockAddr>() as usize).is_err() {
-                        // 地址空间超出了用户空间的范围，不合法
-                        return Err(SystemError::EFAULT);
-                    }
-                    return Ok(());
-                };
-                let r = security_check();
-                if r.is_err() {
-                    Err(r.unwrap_err())
-                } else {
-                    let buf = unsafe { core::slice::from_raw_parts_mut(buf, len) };
-                    Self::recvfrom(args[0], buf, flags, addr, addrlen as *mut u32)
-                }
-            }
+    fn sys_chdir(args: &[usize], frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        // Closure for checking arguments
+        let chdir_check = |arg0: usize| {
+            if arg0 == 0 {
+                return Err(SystemError::EFAULT);
+            }
+            let path_ptr = arg0 as *const c_char;
+            let virt_addr = VirtAddr::new(path_ptr as usize);
+            // 权限校验
+            if path_ptr.is_null()
+                || (frame.from_user() && verify_area(virt_addr, PAGE_2M_SIZE as usize).is_err())
+            {
+                return Err(SystemError::EINVAL);
+            }
+            let dest_path: &CStr = unsafe { CStr::from_ptr(path_ptr) };
+            let dest_path: &str = dest_path.to_str().map_err(|_| SystemError::EINVAL)?;
+            if dest_path.len() == 0 {
+                return Err(SystemError::EINVAL);
+            } else if dest_path.len() > MAX_PATHLEN as usize {
+                return Err(SystemError::ENAMETOOLONG);
+            }
+
+            return Ok(dest_path);
+        };
 
-            SYS_RECVMSG => {
-                let msg = args[1] as *mut crate::net::syscall::MsgHdr;
-                let flags = args[2] as u32;
-                match UserBufferWriter::new(
-                    msg,
-                    core::mem::size_of::<crate::net::syscall::MsgHdr>(),
-                    true,
-                ) {
-                    Err(e) => Err(e),
-                    Ok(mut user_buffer_writer) => {
-                        match user_buffer_writer.buffer::<crate::net::syscall::MsgHdr>(0) {
-                            Err(e) => Err(e),
-                            Ok(buffer) => {
-                                let msg = &mut buffer[0];
-                                Self::recvmsg(args[0], msg, flags)
-                            }
-                        }
-                    }
-                }
-            }
+        let r = chdir_check(args[0])?;
+        Self::chdir(r)
+    }
 
-            SYS_LISTEN => Self::listen(args[0], args[1]),
-            SYS_SHUTDOWN => Self::shutdown(args[0], args[1]),
-            SYS_ACCEPT => Self::accept(args[0], args[1] as *mut SockAddr, args[2] as *mut u32),
-            SYS_ACCEPT4 => Self::accept4(
-                args[0],
-                args[1] as *mut SockAddr,
-                args[2] as *mut u32,
-                args[3] as u32,
-            ),
-            SYS_GETSOCKNAME => {
-                Self::getsockname(args[0], args[1] as *mut SockAddr, args[2] as *mut u32)
-            }
-            SYS_GETPEERNAME => {
-                Self::getpeername(args[0], args[1] as *mut SockAddr, args[2] as *mut u32)
-            }
-            SYS_GETTIMEOFDAY => {
-                let timeval = args[0] as *mut PosixTimeval;
-                let timezone_ptr = args[1] as *mut PosixTimeZone;
-                Self::gettimeofday(timeval, timezone_ptr)
-            }
-            SYS_MMAP => {
-                let len = page_align_up(args[1]);
-                let virt_addr = VirtAddr::new(args[0] as usize);
-                if verify_area(virt_addr, len as usize).is_err() {
-                    Err(SystemError::EFAULT)
-                } else {
-                    Self::mmap(
-                        VirtAddr::new(args[0]),
-                        len,
-                        args[2],
-                        args[3],
-                        args[4] as i32,
-                        args[5],
-                    )
-                }
-            }
-            SYS_MUNMAP => {
-                let addr = args[0];
-                let len = page_align_up(args[1]);
-                if addr & (MMArch::PAGE_SIZE - 1) != 0 {
-                    // The addr argument is not a multiple of the page size
-                    Err(SystemError::EINVAL)
-                } else {
-                    Self::munmap(VirtAddr::new(addr), len)
-                }
-            }
-            SYS_MPROTECT => {
-                let addr = args[0];
-                let len = page_align_up(args[1]);
-                if addr & (MMArch::PAGE_SIZE - 1) != 0 {
-                    // The addr argument is not a multiple of the page size
-                    Err(SystemError::EINVAL)
-                } else {
-                    Self::mprotect(VirtAddr::new(addr), len, args[2])
-                }
+    fn sys_get_dents(args: &[usize], frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let fd = args[0] as i32;
+
+        let buf_vaddr = args[1];
+        let len = args[2];
+        let virt_addr: VirtAddr = VirtAddr::new(buf_vaddr);
+        // 判断缓冲区是否来自用户态，进行权限校验
+        let res = if frame.from_user() && verify_area(virt_addr, len as usize).is_err() {
+            // 来自用户态，而buffer在内核态，这样的操作不被允许
+            Err(SystemError::EPERM)
+        } else if buf_vaddr == 0 {
+            Err(SystemError::EFAULT)
+        } else {
+            let buf: &mut [u8] = unsafe {
+                core::slice::from_raw_parts_mut::<'static, u8>(buf_vaddr as *mut u8, len)
+            };
+            Self::getdents(fd, buf)
+        };
+
+        res
+    }
+
+    fn sys_execve(args: &[usize], frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let path_ptr = args[0];
+        let argv_ptr = args[1];
+        let env_ptr = args[2];
+        let virt_path_ptr = VirtAddr::new(path_ptr);
+        let virt_argv_ptr = VirtAddr::new(argv_ptr);
+        let virt_env_ptr = VirtAddr::new(env_ptr);
+        // 权限校验
+        if frame.from_user()
+            && (verify_area(virt_path_ptr, MAX_PATHLEN as usize).is_err()
+                || verify_area(virt_argv_ptr, PAGE_4K_SIZE as usize).is_err())
+            || verify_area(virt_env_ptr, PAGE_4K_SIZE as usize).is_err()
+        {
+            Err(SystemError::EFAULT)
+        } else {
+            Self::execve(
+                path_ptr as *const u8,
+                argv_ptr as *const *const u8,
+                env_ptr as *const *const u8,
+                frame,
+            )
+            .map(|_| 0)
+        }
+    }
+
+    fn sys_wait4(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let pid = args[0] as i32;
+        let wstatus = args[1] as *mut i32;
+        let options = args[2] as c_int;
+        let rusage = args[3] as *mut c_void;
+        // 权限校验
+        // todo: 引入rusage之后，更正以下权限校验代码中，rusage的大小
+        Self::wait4(pid.into(), wstatus, options, rusage)
+    }
+
+    fn sys_exit(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let exit_code = args[0];
+        Self::exit(exit_code)
+    }
+
+    fn sys_mkdir(args: &[usize], frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let path_ptr = args[0] as *const c_char;
+        let mode = args[1];
+        let virt_path_ptr = VirtAddr::new(path_ptr as usize);
+        let security_check = || {
+            if path_ptr.is_null()
+                || (frame.from_user() && verify_area(virt_path_ptr, PAGE_2M_SIZE as usize).is_err())
+            {
+                return Err(SystemError::EINVAL);
             }
+            let path: &CStr = unsafe { CStr::from_ptr(path_ptr) };
+            let path: &str = path.to_str().map_err(|_| SystemError::EINVAL)?.trim();
 
-            SYS_GETCWD => {
-                let buf = args[0] as *mut u8;
-                let size = args[1] as usize;
-                let security_check = || {
-                    verify_area(VirtAddr::new(buf as usize), size)?;
-                    return Ok(());
-                };
-                let r = security_check();
-                if r.is_err() {
-                    Err(r.unwrap_err())
-                } else {
-                    let buf = unsafe { core::slice::from_raw_parts_mut(buf, size) };
-                    Self::getcwd(buf).map(|ptr| ptr.data())
-                }
+            if path == "" {
+                return Err(SystemError::EINVAL);
             }
+            return Ok(path);
+        };
+
+        let path = security_check();
+        if path.is_err() {
+            Err(path.unwrap_err())
+        } else {
+            Self::mkdir(path.unwrap(), mode)
+        }
+    }
+
+    fn sys_nanosleep(args: &[usize], frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let req = args[0] as *const TimeSpec;
+        let rem = args[1] as *mut TimeSpec;
+        let virt_req = VirtAddr::new(req as usize);
+        let virt_rem = VirtAddr::new(rem as usize);
+        if frame.from_user()
+            && (verify_area(virt_req, core::mem::size_of::<TimeSpec>() as usize).is_err()
+                || verify_area(virt_rem, core::mem::size_of::<TimeSpec>() as usize).is_err())
+        {
+            Err(SystemError::EFAULT)
+        } else {
+            Self::nanosleep(req, rem)
+        }
+    }
+
+    fn sys_clock(_args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::clock();
+    }
 
-            SYS_GETPGID => Self::getpgid(Pid::new(args[0])).map(|pid| pid.into()),
-
-            SYS_GETPPID => Self::getppid().map(|pid| pid.into()),
-            SYS_FSTAT => {
-                let fd = args[0] as i32;
-                let kstat = args[1] as *mut PosixKstat;
-                let vaddr = VirtAddr::new(kstat as usize);
-                // FIXME 由于c中的verify_area与rust中的verify_area重名，所以在引入时加了前缀区分
-                // TODO 应该将用了c版本的verify_area都改为rust的verify_area
-                match verify_area(vaddr, core::mem::size_of::<PosixKstat>()) {
-                    Ok(_) => Self::fstat(fd, kstat),
-                    Err(e) => Err(e),
+    fn sys_pipe(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let pipefd: *mut i32 = args[0] as *mut c_int;
+        if pipefd.is_null() {
+            Err(SystemError::EFAULT)
+        } else {
+            Self::pipe2(pipefd, FileMode::empty())
+        }
+    }
+
+    fn sys_pipe2(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let pipefd: *mut i32 = args[0] as *mut c_int;
+        let arg1 = args[1];
+        if pipefd.is_null() {
+            Err(SystemError::EFAULT)
+        } else {
+            let flags = FileMode::from_bits_truncate(arg1 as u32);
+            Self::pipe2(pipefd, flags)
+        }
+    }
+
+    fn sys_unlink_at(args: &[usize], frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let dirfd = args[0] as i32;
+        let pathname = args[1] as *const c_char;
+        let flags = args[2] as u32;
+        let virt_pathname = VirtAddr::new(pathname as usize);
+        if frame.from_user() && verify_area(virt_pathname, PAGE_4K_SIZE as usize).is_err() {
+            Err(SystemError::EFAULT)
+        } else if pathname.is_null() {
+            Err(SystemError::EFAULT)
+        } else {
+            let get_path = || {
+                let pathname: &CStr = unsafe { CStr::from_ptr(pathname) };
+
+                let pathname: &str = pathname.to_str().map_err(|_| SystemError::EINVAL)?;
+                if pathname.len() >= MAX_PATHLEN {
+                    return Err(SystemError::ENAMETOOLONG);
                 }
+                return Ok(pathname.trim());
+            };
+            let pathname = get_path();
+            if pathname.is_err() {
+                Err(pathname.unwrap_err())
+            } else {
+                // kdebug!("sys unlinkat: dirfd: {}, pathname: {}", dirfd, pathname.as_ref().unwrap());
+                Self::unlinkat(dirfd, pathname.unwrap(), flags)
             }
+        }
+    }
 
-            SYS_FCNTL => {
-                let fd = args[0] as i32;
-                let cmd: Option<FcntlCommand> =
-                    <FcntlCommand as FromPrimitive>::from_u32(args[1] as u32);
-                let arg = args[2] as i32;
-                let res = if let Some(cmd) = cmd {
-                    Self::fcntl(fd, cmd, arg)
-                } else {
-                    Err(SystemError::EINVAL)
-                };
-
-                // kdebug!("FCNTL: fd: {}, cmd: {:?}, arg: {}, res: {:?}", fd, cmd, arg, res);
-                res
-            }
+    fn sys_unlink(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let pathname = args[0] as *const u8;
+        Self::unlink(pathname)
+    }
 
-            SYS_FTRUNCATE => {
-                let fd = args[0] as i32;
-                let len = args[1] as usize;
-                let res = Self::ftruncate(fd, len);
-                // kdebug!("FTRUNCATE: fd: {}, len: {}, res: {:?}", fd, len, res);
-                res
-            }
+    fn sys_kill(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let pid = Pid::new(args[0]);
+        let sig = args[1] as c_int;
+        // kdebug!("KILL SYSCALL RECEIVED");
+        Self::kill(pid, sig)
+    }
 
-            SYS_MKNOD => {
-                let path = args[0];
-                let flags = args[1];
-                let dev_t = args[2];
-                let flags: ModeType = ModeType::from_bits_truncate(flags as u32);
-                Self::mknod(path as *const i8, flags, DeviceNumber::from(dev_t))
-            }
+    fn sys_sigaction(args: &[usize], frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let sig = args[0] as c_int;
+        let act = args[1];
+        let old_act = args[2];
+        Self::sigaction(sig, act, old_act, frame.from_user())
+    }
 
-            SYS_CLONE => {
-                let parent_tid = VirtAddr::new(args[2]);
-                let child_tid = VirtAddr::new(args[3]);
-
-                // 地址校验
-                verify_area(parent_tid, core::mem::size_of::<i32>())?;
-                verify_area(child_tid, core::mem::size_of::<i32>())?;
-
-                let mut clone_args = KernelCloneArgs::new();
-                clone_args.flags = CloneFlags::from_bits_truncate(args[0] as u64);
-                clone_args.stack = args[1];
-                clone_args.parent_tid = parent_tid;
-                clone_args.child_tid = child_tid;
-                clone_args.tls = args[4];
-                Self::clone(frame, clone_args)
-            }
+    fn sys_rt_sigreturn(_args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        // 由于目前signal机制的实现，与x86_64强关联，因此暂时在arch/x86_64/syscall.rs中调用
+        // todo: 未来需要将signal机制与平台解耦
+        todo!()
+    }
 
-            SYS_FUTEX => {
-                let uaddr = VirtAddr::new(args[0]);
-                let operation = FutexFlag::from_bits(args[1] as u32).ok_or(SystemError::ENOSYS)?;
-                let val = args[2] as u32;
-                let utime = args[3];
-                let uaddr2 = VirtAddr::new(args[4]);
-                let val3 = args[5] as u32;
-
-                verify_area(uaddr, core::mem::size_of::<u32>())?;
-                verify_area(uaddr2, core::mem::size_of::<u32>())?;
-
-                let mut timespec = None;
-                if utime != 0 && operation.contains(FutexFlag::FLAGS_HAS_TIMEOUT) {
-                    let reader = UserBufferReader::new(
-                        utime as *const TimeSpec,
-                        core::mem::size_of::<TimeSpec>(),
-                        true,
-                    )?;
-
-                    timespec = Some(reader.read_one_from_user::<TimeSpec>(0)?.clone());
-                }
+    fn sys_getpid(_args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::getpid().map(|pid| pid.into());
+    }
 
-                Self::do_futex(uaddr, operation, val, timespec, uaddr2, utime as u32, val3)
-            }
+    fn sys_sched(_args: &[usize], frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::sched(frame.from_user());
+    }
 
-            SYS_READV => Self::readv(args[0] as i32, args[1], args[2]),
-            SYS_WRITEV => Self::writev(args[0] as i32, args[1], args[2]),
-
-            SYS_ARCH_PRCTL => Self::arch_prctl(args[0], args[1]),
-
-            SYS_SET_TID_ADDR => Self::set_tid_address(args[0]),
-
-            SYS_STAT | SYS_LSTAT => {
-                let path: &CStr = unsafe { CStr::from_ptr(args[0] as *const c_char) };
-                let path: Result<&str, core::str::Utf8Error> = path.to_str();
-                let res = if path.is_err() {
-                    Err(SystemError::EINVAL)
-                } else {
-                    let path: &str = path.unwrap();
-                    let kstat = args[1] as *mut PosixKstat;
-                    let vaddr = VirtAddr::new(kstat as usize);
-                    match verify_area(vaddr, core::mem::size_of::<PosixKstat>()) {
-                        Ok(_) => {
-                            if syscall_num == SYS_STAT {
-                                Self::stat(path, kstat)
-                            } else {
-                                Self::lstat(path, kstat)
-                            }
-                        }
-                        Err(e) => Err(e),
-                    }
-                };
-
-                res
-            }
+    fn sys_posix_spawn(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::posix_spawn(
+            args[0] as *const u8,
+            args[1] as *const *const u8,
+            args[2] as *const *const u8,
+            args[3] as *const PosixSpawnFileAction,
+            args[4],
+            args[5] as *const PosixSpawnAttr,
+        );
+    }
 
-            // 目前为了适配musl-libc,以下系统调用先这样写着
-            SYS_GET_RANDOM => {
-                let flags = GRandFlags::from_bits(args[2] as u8).ok_or(SystemError::EINVAL)?;
-                Self::get_random(args[0] as *mut u8, args[1], flags)
-            }
+    fn sys_getpriority(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::getpriority(args[0], Pid::new(args[1]));
+    }
 
-            SYS_SOCKET_PAIR => {
-                unimplemented!()
-            }
+    fn sys_setpriority(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::setpriority(args[0], Pid::new(args[1]), args[2] as i32);
+    }
 
-            SYS_POLL => {
-                kwarn!("SYS_POLL has not yet been implemented");
-                Ok(0)
-            }
+    fn sys_sched_setscheduler(args: &[usize], frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let pid = Pid::new(args[0]);
+        let policy = args[1];
+        let param = args[2] as *const i32;
+        Self::sched_setscheduler(pid, policy, param, frame.from_user())
+    }
 
-            SYS_RT_SIGPROCMASK => {
-                kwarn!("SYS_RT_SIGPROCMASK has not yet been implemented");
-                Ok(0)
-            }
+    fn sys_sched_getscheduler(
+        args: &[usize],
+        _frame: &mut TrapFrame,
+    ) -> Result<usize, SystemError> {
+        return Self::sched_getscheduler(Pid::new(args[0]));
+    }
 
-            SYS_TKILL => {
-                kwarn!("SYS_TKILL has not yet been implemented");
-                Ok(0)
-            }
+    fn sys_sched_setaffinity(args: &[usize], frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let pid = Pid::new(args[0]);
+        let len = args[1];
+        let user_mask = args[2] as *const u8;
+        Self::sched_setaffinity(pid, len, user_mask, frame.from_user())
+    }
 
-            SYS_SIGALTSTACK => {
-                kwarn!("SYS_SIGALTSTACK has not yet been implemented");
-                Ok(0)
-            }
+    fn sys_sched_getaffinity(args: &[usize], frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let pid = Pid::new(args[0]);
+        let len = args[1];
+        let user_mask = args[2] as *mut u8;
+        Self::sched_getaffinity(pid, len, user_mask, frame.from_user())
+    }
 
-            SYS_EXIT_GROUP => {
-                kwarn!("SYS_EXIT_GROUP has not yet been implemented");
-                Ok(0)
-            }
+    fn sys_getcpu(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::getcpu(args[0] as *mut u32, args[1] as *mut u32);
+    }
 
-            SYS_MADVISE => {
-                kwarn!("SYS_MADVISE has not yet been implemented");
-                Ok(0)
-            }
-            SYS_GETTID => Self::gettid().map(|tid| tid.into()),
-            SYS_GETUID => Self::getuid().map(|uid| uid.into()),
-            SYS_SYSLOG => {
-                kwarn!("SYS_SYSLOG has not yet been implemented");
-                Ok(0)
-            }
-            SYS_GETGID => Self::getgid().map(|gid| gid.into()),
-            SYS_SETUID => {
-                kwarn!("SYS_SETUID has not yet been implemented");
-                Ok(0)
-            }
-            SYS_SETGID => {
-                kwarn!("SYS_SETGID has not yet been implemented");
-                Ok(0)
-            }
-            SYS_GETEUID => Self::geteuid().map(|euid| euid.into()),
-            SYS_GETEGID => Self::getegid().map(|egid| egid.into()),
-            SYS_GETRUSAGE => {
-                let who = args[0] as c_int;
-                let rusage = args[1] as *mut RUsage;
-                Self::get_rusage(who, rusage)
-            }
+    fn sys_rseq(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::rseq(args[0], args[1] as u32, args[2] as u32, args[3] as u32);
+    }
 
-            SYS_READLINK => {
-                let path = args[0] as *const u8;
-                let buf = args[1] as *mut u8;
-                let bufsiz = args[2] as usize;
-                Self::readlink(path, buf, bufsiz)
-            }
+    fn sys_membarrier(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::membarrier(args[0] as u32, args[1] as u32, args[2] as u32);
+    }
 
-            SYS_READLINK_AT => {
-                let dirfd = args[0] as i32;
-                let pathname = args[1] as *const u8;
-                let buf = args[2] as *mut u8;
-                let bufsiz = args[3] as usize;
-                Self::readlink_at(dirfd, pathname, buf, bufsiz)
-            }
+    fn sys_dup(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let oldfd: i32 = args[0] as c_int;
+        Self::dup(oldfd)
+    }
 
-            SYS_PRLIMIT64 => {
-                let pid = args[0];
-                let pid = Pid::new(pid);
-                let resource = args[1];
-                let new_limit = args[2] as *const RLimit64;
-                let old_limit = args[3] as *mut RLimit64;
+    fn sys_dup2(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let oldfd: i32 = args[0] as c_int;
+        let newfd: i32 = args[1] as c_int;
+        Self::dup2(oldfd, newfd)
+    }
 
-                Self::prlimit64(pid, resource, new_limit, old_limit)
-            }
+    fn sys_socket(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::socket(args[0], args[1], args[2]);
+    }
 
-            SYS_ACCESS => {
-                let pathname = args[0] as *const u8;
-                let mode = args[1] as u32;
-                Self::access(pathname, mode)
-            }
+    fn sys_setsockopt(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let optval = args[3] as *const u8;
+        let optlen = args[4] as usize;
+        let virt_optval = VirtAddr::new(optval as usize);
+        // 验证optval的地址是否合法
+        if verify_area(virt_optval, optlen as usize).is_err() {
+            // 地址空间超出了用户空间的范围，不合法
+            Err(SystemError::EFAULT)
+        } else {
+            let data: &[u8] = unsafe { core::slice::from_raw_parts(optval, optlen) };
+            Self::setsockopt(args[0], args[1], args[2], data)
+        }
+    }
 
-            SYS_FACCESSAT => {
-                let dirfd = args[0] as i32;
-                let pathname = args[1] as *const u8;
-                let mode = args[2] as u32;
-                Self::faccessat2(dirfd, pathname, mode, 0)
+    fn sys_getsockopt(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let optval = args[3] as *mut u8;
+        let optlen = args[4] as *mut usize;
+        let virt_optval = VirtAddr::new(optval as usize);
+        let virt_optlen = VirtAddr::new(optlen as usize);
+        let security_check = || {
+            // 验证optval的地址是否合法
+            if verify_area(virt_optval, PAGE_4K_SIZE as usize).is_err() {
+                // 地址空间超出了用户空间的范围，不合法
+                return Err(SystemError::EFAULT);
             }
 
-            SYS_FACCESSAT2 => {
-                let dirfd = args[0] as i32;
-                let pathname = args[1] as *const u8;
-                let mode = args[2] as u32;
-                let flags = args[3] as u32;
-                Self::faccessat2(dirfd, pathname, mode, flags)
+            // 验证optlen的地址是否合法
+            if verify_area(virt_optlen, core::mem::size_of::<u32>() as usize).is_err() {
+                // 地址空间超出了用户空间的范围，不合法
+                return Err(SystemError::EFAULT);
             }
+            return Ok(());
+        };
+        let r = security_check();
+        if r.is_err() {
+            Err(r.unwrap_err())
+        } else {
+            Self::getsockopt(args[0], args[1], args[2], optval, optlen as *mut u32)
+        }
+    }
 
-            SYS_CLOCK_GETTIME => {
-                let clockid = args[0] as i32;
-                let timespec = args[1] as *mut TimeSpec;
-                Self::clock_gettime(clockid, timespec)
-            }
+    fn sys_connect(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let addr = args[1] as *const SockAddr;
+        let addrlen = args[2] as usize;
+        let virt_addr = VirtAddr::new(addr as usize);
+        // 验证addr的地址是否合法
+        if verify_area(virt_addr, addrlen as usize).is_err() {
+            // 地址空间超出了用户空间的范围，不合法
+            Err(SystemError::EFAULT)
+        } else {
+            Self::connect(args[0], addr, addrlen)
+        }
+    }
 
-            SYS_SYSINFO => {
-                let info = args[0] as *mut SysInfo;
-                Self::sysinfo(info)
-            }
+    fn sys_bind(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let addr = args[1] as *const SockAddr;
+        let addrlen = args[2] as usize;
+        let virt_addr = VirtAddr::new(addr as usize);
+        // 验证addr的地址是否合法
+        if verify_area(virt_addr, addrlen as usize).is_err() {
+            // 地址空间超出了用户空间的范围，不合法
+            Err(SystemError::EFAULT)
+        } else {
+            Self::bind(args[0], addr, addrlen)
+        }
+    }
 
-            SYS_UMASK => {
-                let mask = args[0] as u32;
-                Self::umask(mask)
-            }
+    fn sys_sendto(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let buf = args[1] as *const u8;
+        let len = args[2] as usize;
+        let flags = args[3] as u32;
+        let addr = args[4] as *const SockAddr;
+        let addrlen = args[5] as usize;
+        let virt_buf = VirtAddr::new(buf as usize);
+        let virt_addr = VirtAddr::new(addr as usize);
+        // 验证buf的地址是否合法
+        if verify_area(virt_buf, len as usize).is_err() {
+            // 地址空间超出了用户空间的范围，不合法
+            Err(SystemError::EFAULT)
+        } else if verify_area(virt_addr, addrlen as usize).is_err() {
+            // 地址空间超出了用户空间的范围，不合法
+            Err(SystemError::EFAULT)
+        } else {
+            let data: &[u8] = unsafe { core::slice::from_raw_parts(buf, len) };
+            Self::sendto(args[0], data, flags, addr, addrlen)
+        }
+    }
 
-            SYS_CHMOD => {
-                let pathname = args[0] as *const u8;
-                let mode = args[1] as u32;
-                Self::chmod(pathname, mode)
-            }
-            SYS_FCHMOD => {
-                let fd = args[0] as i32;
-                let mode = args[1] as u32;
-                Self::fchmod(fd, mode)
-            }
-            SYS_FCHMODAT => {
-                let dirfd = args[0] as i32;
-                let pathname = args[1] as *const u8;
-                let mode = args[2] as u32;
-                Self::fchmodat(dirfd, pathname, mode)
-            }
+    fn sys_recvfrom(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let buf = args[1] as *mut u8;
+        let len = args[2] as usize;
+        let flags = args[3] as u32;
+        let addr = args[4] as *mut SockAddr;
+        let addrlen = args[5] as *mut usize;
+        let virt_buf = VirtAddr::new(buf as usize);
+        let virt_addrlen = VirtAddr::new(addrlen as usize);
+        let virt_addr = VirtAddr::new(addr as usize);
+        let security_check = || {
+            // 验证buf的地址是否合法
+            if verify_area(virt_buf, len as usize).is_err() {
+                // 地址空间超出了用户空间的范围，不合法
+                return Err(SystemError::EFAULT);
+            }
+
+            // 验证addrlen的地址是否合法
+            if verify_area(virt_addrlen, core::mem::size_of::<u32>() as usize).is_err() {
+                // 地址空间超出了用户空间的范围，不合法
+                return Err(SystemError::EFAULT);
+            }
+
+            if verify_area(virt_addr, core::mem::size_of::<SockAddr>() as usize).is_err() {
+                // 地址空间超出了用户空间的范围，不合法
+                return Err(SystemError::EFAULT);
+            }
+            return Ok(());
+        };
+        let r = security_check();
+        if r.is_err() {
+            Err(r.unwrap_err())
+        } else {
+            let buf = unsafe { core::slice::from_raw_parts_mut(buf, len) };
+            Self::recvfrom(args[0], buf, flags, addr, addrlen as *mut u32)
+        }
+    }
+
+    fn sys_recvmsg(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let msg = user_ref_mut::<crate::net::syscall::MsgHdr>(args[1])?;
+        return Self::recvmsg(args[0], msg, args[2] as u32);
+    }
+
+    fn sys_sendmsg(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let msg = user_ref::<crate::net::syscall::MsgHdr>(args[1])?;
+        return Self::sendmsg(args[0], msg, args[2] as u32);
+    }
+
+    fn sys_stat(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let path = user_str(args[0])?;
+        let kstat = args[1] as *mut PosixKstat;
+        verify_area(
+            VirtAddr::new(kstat as usize),
+            core::mem::size_of::<PosixKstat>(),
+        )?;
+        return Self::stat(path, kstat);
+    }
+
+    fn sys_lstat(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let path = user_str(args[0])?;
+        let kstat = args[1] as *mut PosixKstat;
+        verify_area(
+            VirtAddr::new(kstat as usize),
+            core::mem::size_of::<PosixKstat>(),
+        )?;
+        return Self::lstat(path, kstat);
+    }
+
+    fn sys_recvmmsg(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::recvmmsg(
+            args[0],
+            args[1] as *mut crate::net::syscall::MMsgHdr,
+            args[2],
+            args[3] as u32,
+        );
+    }
+
+    fn sys_sendmmsg(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::sendmmsg(
+            args[0],
+            args[1] as *mut crate::net::syscall::MMsgHdr,
+            args[2],
+            args[3] as u32,
+        );
+    }
+
+    fn sys_listen(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::listen(args[0], args[1]);
+    }
 
-            _ => panic!("Unsupported syscall ID: {}", syscall_num),
+    fn sys_shutdown(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::shutdown(args[0], args[1]);
+    }
+
+    fn sys_accept(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::accept(args[0], args[1] as *mut SockAddr, args[2] as *mut u32);
+    }
+
+    fn sys_accept4(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::accept4(
+            args[0],
+            args[1] as *mut SockAddr,
+            args[2] as *mut u32,
+            args[3] as u32,
+        );
+    }
+
+    fn sys_getsockname(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        Self::getsockname(args[0], args[1] as *mut SockAddr, args[2] as *mut u32)
+    }
+
+    fn sys_getpeername(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        Self::getpeername(args[0], args[1] as *mut SockAddr, args[2] as *mut u32)
+    }
+
+    fn sys_gettimeofday(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let timeval = args[0] as *mut PosixTimeval;
+        let timezone_ptr = args[1] as *mut PosixTimeZone;
+        Self::gettimeofday(timeval, timezone_ptr)
+    }
+
+    fn sys_mmap(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let len = page_align_up(args[1]);
+        let virt_addr = VirtAddr::new(args[0] as usize);
+        if verify_area(virt_addr, len as usize).is_err() {
+            Err(SystemError::EFAULT)
+        } else {
+            Self::mmap(
+                VirtAddr::new(args[0]),
+                len,
+                args[2],
+                args[3],
+                args[4] as i32,
+                args[5],
+            )
+        }
+    }
+
+    fn sys_munmap(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let addr = args[0];
+        let len = page_align_up(args[1]);
+        if addr & (MMArch::PAGE_SIZE - 1) != 0 {
+            // The addr argument is not a multiple of the page size
+            Err(SystemError::EINVAL)
+        } else {
+            Self::munmap(VirtAddr::new(addr), len)
+        }
+    }
+
+    fn sys_mprotect(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let addr = args[0];
+        let len = page_align_up(args[1]);
+        if addr & (MMArch::PAGE_SIZE - 1) != 0 {
+            // The addr argument is not a multiple of the page size
+            Err(SystemError::EINVAL)
+        } else {
+            Self::mprotect(VirtAddr::new(addr), len, args[2])
+        }
+    }
+
+    fn sys_getcwd(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let buf = args[0] as *mut u8;
+        let size = args[1] as usize;
+        let security_check = || {
+            verify_area(VirtAddr::new(buf as usize), size)?;
+            return Ok(());
         };
-        return r;
+        let r = security_check();
+        if r.is_err() {
+            Err(r.unwrap_err())
+        } else {
+            let buf = unsafe { core::slice::from_raw_parts_mut(buf, size) };
+            Self::getcwd(buf).map(|ptr| ptr.data())
+        }
+    }
+
+    fn sys_getpgid(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::getpgid(Pid::new(args[0])).map(|pid| pid.into());
+    }
+
+    fn sys_getppid(_args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::getppid().map(|pid| pid.into());
+    }
+
+    fn sys_fstat(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let fd = args[0] as i32;
+        let kstat = args[1] as *mut PosixKstat;
+        let vaddr = VirtAddr::new(kstat as usize);
+        // FIXME 由于c中的verify_area与rust中的verify_area重名，所以在引入时加了前缀区分
+        // TODO 应该将用了c版本的verify_area都改为rust的verify_area
+        match verify_area(vaddr, core::mem::size_of::<PosixKstat>()) {
+            Ok(_) => Self::fstat(fd, kstat),
+            Err(e) => Err(e),
+        }
+    }
+
+    fn sys_fcntl(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let fd = args[0] as i32;
+        let cmd: Option<FcntlCommand> = <FcntlCommand as FromPrimitive>::from_u32(args[1] as u32);
+        let arg = args[2] as i32;
+        let res = if let Some(cmd) = cmd {
+            Self::fcntl(fd, cmd, arg)
+        } else {
+            Err(SystemError::EINVAL)
+        };
+
+        // kdebug!("FCNTL: fd: {}, cmd: {:?}, arg: {}, res: {:?}", fd, cmd, arg, res);
+        res
+    }
+
+    fn sys_ftruncate(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let fd = args[0] as i32;
+        let len = args[1] as usize;
+        let res = Self::ftruncate(fd, len);
+        // kdebug!("FTRUNCATE: fd: {}, len: {}, res: {:?}", fd, len, res);
+        res
+    }
+
+    fn sys_fsync(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::fsync(args[0] as i32, false);
+    }
+
+    fn sys_fdatasync(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::fsync(args[0] as i32, true);
+    }
+
+    fn sys_sync_file_range(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::sync_file_range(
+            args[0] as i32,
+            args[1] as i64,
+            args[2] as i64,
+            args[3] as u32,
+        );
+    }
+
+    fn sys_fadvise64(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let fd = args[0] as i32;
+        let offset = args[1] as i64;
+        let len = args[2] as i64;
+        Self::fadvise64(fd, offset, len, args[3])
+    }
+
+    fn sys_fallocate(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let fd = args[0] as i32;
+        let mode = args[1] as u32;
+        let offset = args[2] as i64;
+        let len = args[3] as i64;
+        Self::fallocate(fd, mode, offset, len)
+    }
+
+    fn sys_mknod(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let path = args[0];
+        let flags = args[1];
+        let dev_t = args[2];
+        let flags: ModeType = ModeType::from_bits_truncate(flags as u32);
+        Self::mknod(path as *const i8, flags, DeviceNumber::from(dev_t))
+    }
+
+    fn sys_clone(args: &[usize], frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let parent_tid = VirtAddr::new(args[2]);
+        let child_tid = VirtAddr::new(args[3]);
+
+        // 地址校验
+        verify_area(parent_tid, core::mem::size_of::<i32>())?;
+        verify_area(child_tid, core::mem::size_of::<i32>())?;
+
+        let mut clone_args = KernelCloneArgs::new();
+        clone_args.flags = CloneFlags::from_bits_truncate(args[0] as u64);
+        clone_args.stack = args[1];
+        clone_args.parent_tid = parent_tid;
+        clone_args.child_tid = child_tid;
+        clone_args.tls = args[4];
+        Self::clone(frame, clone_args)
+    }
+
+    fn sys_futex(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let uaddr = VirtAddr::new(args[0]);
+        let operation = FutexFlag::from_bits(args[1] as u32).ok_or(SystemError::ENOSYS)?;
+        let val = args[2] as u32;
+        let utime = args[3];
+        let uaddr2 = VirtAddr::new(args[4]);
+        let val3 = args[5] as u32;
+
+        verify_area(uaddr, core::mem::size_of::<u32>())?;
+        verify_area(uaddr2, core::mem::size_of::<u32>())?;
+
+        let mut timespec = None;
+        if utime != 0 && operation.contains(FutexFlag::FLAGS_HAS_TIMEOUT) {
+            let reader = UserBufferReader::new(
+                utime as *const TimeSpec,
+                core::mem::size_of::<TimeSpec>(),
+                true,
+            )?;
+
+            timespec = Some(reader.read_one_from_user::<TimeSpec>(0)?.clone());
+        }
+
+        Self::do_futex(uaddr, operation, val, timespec, uaddr2, utime as u32, val3)
+    }
+
+    fn sys_futex_waitv(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::futex_waitv(
+            args[0] as *const FutexWaitv,
+            args[1] as u32,
+            args[2] as u32,
+            args[3] as *const TimeSpec,
+            args[4] as i32,
+        );
+    }
+
+    fn sys_readv(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::readv(args[0] as i32, args[1], args[2]);
+    }
+
+    fn sys_writev(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::writev(args[0] as i32, args[1], args[2]);
+    }
+
+    fn sys_preadv(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::preadv(args[0] as i32, args[1], args[2], args[3] as i64);
+    }
+
+    fn sys_pwritev(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::pwritev(args[0] as i32, args[1], args[2], args[3] as i64);
+    }
+
+    fn sys_prctl(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::prctl(args[0], args[1]);
+    }
+
+    fn sys_arch_prctl(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::arch_prctl(args[0], args[1]);
+    }
+
+    fn sys_set_tid_addr(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::set_tid_address(args[0]);
+    }
+
+    // 目前为了适配musl-libc,以下系统调用先这样写着
+    fn sys_get_random(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let flags = GRandFlags::from_bits(args[2] as u8).ok_or(SystemError::EINVAL)?;
+        Self::get_random(args[0] as *mut u8, args[1], flags)
+    }
+
+    fn sys_socket_pair(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::socketpair(args[0], args[1], args[2], args[3] as *mut i32);
+    }
+
+    fn sys_poll(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::poll(args[0] as *mut PollFd, args[1] as u32, args[2] as i32);
+    }
+
+    fn sys_epoll_create(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::epoll_create(args[0] as i32);
+    }
+
+    fn sys_epoll_create1(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::epoll_create1(args[0] as u32);
+    }
+
+    fn sys_epoll_ctl(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::epoll_ctl(
+            args[0] as i32,
+            args[1] as i32,
+            args[2] as i32,
+            args[3] as *const EPollEvent,
+        );
+    }
+
+    fn sys_epoll_wait(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::epoll_wait(
+            args[0] as i32,
+            args[1] as *mut EPollEvent,
+            args[2] as i32,
+            args[3] as i32,
+        );
+    }
+
+    fn sys_epoll_pwait(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::epoll_pwait(
+            args[0] as i32,
+            args[1] as *mut EPollEvent,
+            args[2] as i32,
+            args[3] as i32,
+            args[4] as *const SigSet,
+            args[5],
+        );
+    }
+
+    fn sys_io_uring_setup(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        Self::io_uring_setup(args[0] as u32, args[1] as *mut IoUringParams)
+    }
+
+    fn sys_io_uring_enter(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::io_uring_enter(
+            args[0] as i32,
+            args[1] as u32,
+            args[2] as u32,
+            args[3] as u32,
+            args[4] as *const SigSet,
+            args[5],
+        );
+    }
+
+    fn sys_perf_event_open(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::perf_event_open(
+            args[0] as *const PerfEventAttr,
+            args[1] as i32,
+            args[2] as i32,
+            args[3] as i32,
+            args[4],
+        );
+    }
+
+    fn sys_ppoll(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::ppoll(
+            args[0] as *mut PollFd,
+            args[1] as u32,
+            args[2] as *const TimeSpec,
+            args[3] as *const SigSet,
+            args[4],
+        );
+    }
+
+    fn sys_sendfile(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        Self::sendfile(args[0] as i32, args[1] as i32, args[2] as *mut i64, args[3])
+    }
+
+    fn sys_splice(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::splice(
+            args[0] as i32,
+            args[1] as *mut i64,
+            args[2] as i32,
+            args[3] as *mut i64,
+            args[4],
+            args[5] as u32,
+        );
+    }
+
+    fn sys_vmsplice(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::vmsplice(args[0] as i32, args[1], args[2], args[3] as u32);
+    }
+
+    fn sys_select(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::select(
+            args[0] as i32,
+            args[1] as *mut u64,
+            args[2] as *mut u64,
+            args[3] as *mut u64,
+            args[4] as *mut PosixTimeval,
+        );
+    }
+
+    fn sys_pselect6(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::pselect6(
+            args[0] as i32,
+            args[1] as *mut u64,
+            args[2] as *mut u64,
+            args[3] as *mut u64,
+            args[4] as *const TimeSpec,
+            args[5] as *const [usize; 2],
+        );
+    }
+
+    fn sys_rt_sigprocmask(_args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        kwarn!("SYS_RT_SIGPROCMASK has not yet been implemented");
+        Ok(0)
+    }
+
+    fn sys_tkill(_args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        kwarn!("SYS_TKILL has not yet been implemented");
+        Ok(0)
+    }
+
+    fn sys_sigaltstack(_args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        kwarn!("SYS_SIGALTSTACK has not yet been implemented");
+        Ok(0)
+    }
+
+    fn sys_exit_group(_args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        kwarn!("SYS_EXIT_GROUP has not yet been implemented");
+        Ok(0)
+    }
+
+    fn sys_msync(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let addr = args[0];
+        let len = page_align_up(args[1]);
+        if addr & (MMArch::PAGE_SIZE - 1) != 0 {
+            Err(SystemError::EINVAL)
+        } else {
+            Self::msync(VirtAddr::new(addr), len, args[2])
+        }
+    }
+
+    fn sys_madvise(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let addr = args[0];
+        let len = page_align_up(args[1]);
+        if addr & (MMArch::PAGE_SIZE - 1) != 0 {
+            Err(SystemError::EINVAL)
+        } else {
+            Self::madvise(VirtAddr::new(addr), len, args[2])
+        }
+    }
+
+    fn sys_shmget(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::shmget(args[0] as i32, args[1], args[2] as u32);
+    }
+
+    fn sys_shmat(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::shmat(args[0] as i32, args[1], args[2] as u32);
+    }
+
+    fn sys_shmdt(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::shmdt(args[0]);
+    }
+
+    fn sys_shmctl(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::shmctl(args[0] as i32, args[1] as i32, args[2] as *mut ShmidDs);
+    }
+
+    fn sys_mq_open(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::mq_open(
+            args[0] as *const u8,
+            args[1] as u32,
+            args[2] as u32,
+            args[3] as *const MqAttr,
+        );
+    }
+
+    fn sys_mq_unlink(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::mq_unlink(args[0] as *const u8);
+    }
+
+    fn sys_mq_timedsend(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::mq_timedsend(
+            args[0] as i32,
+            args[1] as *const u8,
+            args[2],
+            args[3] as u32,
+            args[4] as *const TimeSpec,
+        );
+    }
+
+    fn sys_mq_timedreceive(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::mq_timedreceive(
+            args[0] as i32,
+            args[1] as *mut u8,
+            args[2],
+            args[3] as *mut u32,
+            args[4] as *const TimeSpec,
+        );
+    }
+
+    fn sys_mq_notify(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::mq_notify(args[0] as i32, args[1] as *const SigEvent);
+    }
+
+    fn sys_mq_getsetattr(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::mq_getsetattr(
+            args[0] as i32,
+            args[1] as *const MqAttr,
+            args[2] as *mut MqAttr,
+        );
+    }
+
+    fn sys_gettid(_args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::gettid().map(|tid| tid.into());
+    }
+
+    fn sys_getuid(_args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::getuid().map(|uid| uid.into());
+    }
+
+    fn sys_syslog(args: &[usize], frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let action = args[0];
+        let len = args[2];
+        let mut buf = [0u8; 0];
+        let mut user_buffer_writer;
+        // 只有读取操作使用缓冲区，其余操作的第三个参数是控制台的日志级别
+        let buf = if (2..=4).contains(&action) {
+            if (len as isize) < 0 {
+                return Err(SystemError::EINVAL);
+            }
+            user_buffer_writer = UserBufferWriter::new(args[1] as *mut u8, len, frame.from_user())?;
+            user_buffer_writer.buffer::<u8>(0)?
+        } else {
+            &mut buf[..]
+        };
+        return do_syslog(action, buf, len);
+    }
+
+    fn sys_getgid(_args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::getgid().map(|gid| gid.into());
+    }
+
+    fn sys_setuid(_args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        kwarn!("SYS_SETUID has not yet been implemented");
+        Ok(0)
+    }
+
+    fn sys_setgid(_args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        kwarn!("SYS_SETGID has not yet been implemented");
+        Ok(0)
+    }
+
+    fn sys_geteuid(_args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::geteuid().map(|euid| euid.into());
+    }
+
+    fn sys_getegid(_args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::getegid().map(|egid| egid.into());
+    }
+
+    fn sys_getrusage(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let who = args[0] as c_int;
+        let rusage = args[1] as *mut RUsage;
+        Self::get_rusage(who, rusage)
+    }
+
+    fn sys_times(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let buf = args[0] as *mut Tms;
+        Self::times(buf)
+    }
+
+    fn sys_readlink(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let path = args[0] as *const u8;
+        let buf = args[1] as *mut u8;
+        let bufsiz = args[2] as usize;
+        Self::readlink(path, buf, bufsiz)
+    }
+
+    fn sys_readlink_at(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let dirfd = args[0] as i32;
+        let pathname = args[1] as *const u8;
+        let buf = args[2] as *mut u8;
+        let bufsiz = args[3] as usize;
+        Self::readlink_at(dirfd, pathname, buf, bufsiz)
+    }
+
+    fn sys_prlimit64(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let pid = args[0];
+        let pid = Pid::new(pid);
+        let resource = args[1];
+        let new_limit = args[2] as *const RLimit64;
+        let old_limit = args[3] as *mut RLimit64;
+
+        Self::prlimit64(pid, resource, new_limit, old_limit)
+    }
+
+    fn sys_access(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let pathname = args[0] as *const u8;
+        let mode = args[1] as u32;
+        Self::access(pathname, mode)
+    }
+
+    fn sys_faccessat(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let dirfd = args[0] as i32;
+        let pathname = args[1] as *const u8;
+        let mode = args[2] as u32;
+        Self::faccessat2(dirfd, pathname, mode, 0)
+    }
+
+    fn sys_faccessat2(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let dirfd = args[0] as i32;
+        let pathname = args[1] as *const u8;
+        let mode = args[2] as u32;
+        let flags = args[3] as u32;
+        Self::faccessat2(dirfd, pathname, mode, flags)
+    }
+
+    fn sys_clock_gettime(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let clockid = args[0] as i32;
+        let timespec = args[1] as *mut TimeSpec;
+        Self::clock_gettime(clockid, timespec)
+    }
+
+    fn sys_timer_create(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::timer_create(
+            args[0] as i32,
+            args[1] as *const SigEvent,
+            args[2] as *mut i32,
+        );
+    }
+
+    fn sys_timer_settime(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::timer_settime(
+            args[0] as i32,
+            args[1] as i32,
+            args[2] as *const ItimerSpec,
+            args[3] as *mut ItimerSpec,
+        );
+    }
+
+    fn sys_timer_gettime(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::timer_gettime(args[0] as i32, args[1] as *mut ItimerSpec);
+    }
+
+    fn sys_timer_getoverrun(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::timer_getoverrun(args[0] as i32);
+    }
+
+    fn sys_timer_delete(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::timer_delete(args[0] as i32);
+    }
+
+    fn sys_eventfd2(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::eventfd2(args[0] as u32, args[1] as u32);
+    }
+
+    fn sys_signalfd4(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::signalfd4(
+            args[0] as i32,
+            args[1] as *const SigSet,
+            args[2],
+            args[3] as u32,
+        );
+    }
+
+    fn sys_timerfd_create(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::timerfd_create(args[0] as i32, args[1] as u32);
+    }
+
+    fn sys_timerfd_settime(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        return Self::timerfd_settime(
+            args[0] as i32,
+            args[1] as i32,
+            args[2] as *const ItimerSpec,
+            args[3] as *mut ItimerSpec,
+        );
+    }
+
+    fn sys_timerfd_gettime(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        Self::timerfd_gettime(args[0] as i32, args[1] as *mut ItimerSpec)
+    }
+
+    fn sys_sysinfo(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let info = args[0] as *mut SysInfo;
+        Self::sysinfo(info)
+    }
+
+    fn sys_umask(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let mask = args[0] as u32;
+        Self::umask(mask)
+    }
+
+    fn sys_chmod(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let pathname = args[0] as *const u8;
+        let mode = args[1] as u32;
+        Self::chmod(pathname, mode)
+    }
+
+    fn sys_fchmod(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let fd = args[0] as i32;
+        let mode = args[1] as u32;
+        Self::fchmod(fd, mode)
+    }
+
+    fn sys_fchmodat(args: &[usize], _frame: &mut TrapFrame) -> Result<usize, SystemError> {
+        let dirfd = args[0] as i32;
+        let pathname = args[1] as *const u8;
+        let mode = args[2] as u32;
+        Self::fchmodat(dirfd, pathname, mode)
     }
 
     pub fn put_string(
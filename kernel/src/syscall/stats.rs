@@ -0,0 +1,218 @@
+//! 系统调用的统计：每个系统调用的次数、总耗时以及耗时的分布
+//!
+//! 在[`Syscall::handle`](super::Syscall::handle)的入口和出口读取TSC，把耗时（cycles）累加到当前cpu的计数器上，
+//! 并且按耗时的log2分桶计数。每个cpu的计数器在第一次打开统计时分配，读取时把所有cpu的计数器相加。
+//!
+//! 统计默认关闭，关闭时只有一次分支判断的开销。通过`/proc/syscall_stats`读取统计结果，
+//! 写入`1`/`0`打开/关闭统计，写入`reset`清空统计。
+
+use core::{
+    alloc::Layout,
+    fmt::Write,
+    ptr::null_mut,
+    sync::atomic::{AtomicBool, AtomicPtr, AtomicU64, Ordering},
+};
+
+use crate::{
+    filesystem::vfs::seq_file::{SeqBuf, SeqOperations},
+    include::bindings::bindings::smp_get_total_cpu,
+    libs::spinlock::SpinLock,
+    mm::percpu::PerCpu,
+    smp::core::smp_get_processor_id,
+};
+
+use super::{
+    table::{slot_syscall_nr, syscall_slot, NR_SYSCALL_SLOTS},
+    SystemError,
+};
+
+/// 耗时分布的桶数。第i个桶记录耗时在`[2^i, 2^(i+1))`个cycle之间的调用，最后一个桶包含更长的耗时
+pub const SYSCALL_HIST_BUCKETS: usize = 32;
+
+/// 一个系统调用在一个cpu上的统计
+#[derive(Debug)]
+struct SyscallStat {
+    count: AtomicU64,
+    cycles: AtomicU64,
+    hist: [AtomicU64; SYSCALL_HIST_BUCKETS],
+}
+
+/// 一个cpu上所有系统调用的统计
+///
+/// 全零就是合法的初始状态，因此直接分配清零的内存，避免在栈上构造这个很大的结构体
+#[derive(Debug)]
+struct CpuSyscallStats {
+    stats: [SyscallStat; NR_SYSCALL_SLOTS],
+}
+
+static CPU_SYSCALL_STATS: [AtomicPtr<CpuSyscallStats>; PerCpu::MAX_CPU_NUM] =
+    [const { AtomicPtr::new(null_mut()) }; PerCpu::MAX_CPU_NUM];
+
+static SYSCALL_STATS_ENABLED: AtomicBool = AtomicBool::new(false);
+
+/// 串行化计数器的分配
+static SYSCALL_STATS_ALLOC_LOCK: SpinLock<()> = SpinLock::new(());
+
+fn nr_cpus() -> usize {
+    return (unsafe { smp_get_total_cpu() } as usize).clamp(1, PerCpu::MAX_CPU_NUM);
+}
+
+/// 是否正在统计系统调用
+#[inline(always)]
+pub fn syscall_stats_enabled() -> bool {
+    return SYSCALL_STATS_ENABLED.load(Ordering::Relaxed);
+}
+
+/// 打开或者关闭系统调用的统计
+pub fn syscall_stats_set_enabled(enabled: bool) {
+    if enabled {
+        let _guard = SYSCALL_STATS_ALLOC_LOCK.lock_irqsave();
+        for cpu in 0..nr_cpus() {
+            if !CPU_SYSCALL_STATS[cpu].load(Ordering::Acquire).is_null() {
+                continue;
+            }
+            let ptr = unsafe { alloc::alloc::alloc_zeroed(Layout::new::<CpuSyscallStats>()) };
+            if ptr.is_null() {
+                return;
+            }
+            CPU_SYSCALL_STATS[cpu].store(ptr as *mut CpuSyscallStats, Ordering::Release);
+        }
+    }
+    SYSCALL_STATS_ENABLED.store(enabled, Ordering::Relaxed);
+}
+
+/// 记录一次系统调用的耗时
+///
+/// 只修改当前cpu的计数器。计数器是原子变量，因此系统调用执行期间发生迁移也不会丢失计数
+#[inline(always)]
+pub(super) fn syscall_stats_record(nr: usize, cycles: u64) {
+    let slot = match syscall_slot(nr) {
+        Some(slot) => slot,
+        None => return,
+    };
+    let cpu = smp_get_processor_id() as usize;
+    let stats = CPU_SYSCALL_STATS[cpu].load(Ordering::Acquire);
+    if stats.is_null() {
+        return;
+    }
+    let stat = unsafe { &(*stats).stats[slot] };
+    stat.count.fetch_add(1, Ordering::Relaxed);
+    stat.cycles.fetch_add(cycles, Ordering::Relaxed);
+    stat.hist[hist_bucket(cycles)].fetch_add(1, Ordering::Relaxed);
+}
+
+#[inline(always)]
+fn hist_bucket(cycles: u64) -> usize {
+    let log2 = 63 - (cycles | 1).leading_zeros() as usize;
+    return core::cmp::min(log2, SYSCALL_HIST_BUCKETS - 1);
+}
+
+/// 清空所有cpu上的统计
+pub fn syscall_stats_reset() {
+    for cpu in 0..PerCpu::MAX_CPU_NUM {
+        let stats = CPU_SYSCALL_STATS[cpu].load(Ordering::Acquire);
+        if stats.is_null() {
+            continue;
+        }
+        for stat in unsafe { (*stats).stats.iter() } {
+            stat.count.store(0, Ordering::Relaxed);
+            stat.cycles.store(0, Ordering::Relaxed);
+            for bucket in stat.hist.iter() {
+                bucket.store(0, Ordering::Relaxed);
+            }
+        }
+    }
+}
+
+/// 把所有cpu上一个系统调用的统计相加
+fn syscall_stat_sum(slot: usize) -> (u64, u64, [u64; SYSCALL_HIST_BUCKETS]) {
+    let mut count = 0;
+    let mut cycles = 0;
+    let mut hist = [0u64; SYSCALL_HIST_BUCKETS];
+    for cpu in 0..PerCpu::MAX_CPU_NUM {
+        let stats = CPU_SYSCALL_STATS[cpu].load(Ordering::Acquire);
+        if stats.is_null() {
+            continue;
+        }
+        let stat = unsafe { &(*stats).stats[slot] };
+        count += stat.count.load(Ordering::Relaxed);
+        cycles += stat.cycles.load(Ordering::Relaxed);
+        for (sum, bucket) in hist.iter_mut().zip(stat.hist.iter()) {
+            *sum += bucket.load(Ordering::Relaxed);
+        }
+    }
+    return (count, cycles, hist);
+}
+
+/// 处理对`/proc/syscall_stats`的写入
+pub fn syscall_stats_store(buf: &[u8]) -> Result<(), SystemError> {
+    let s = core::str::from_utf8(buf).map_err(|_| SystemError::EINVAL)?;
+    match s.trim_matches(|c: char| c.is_whitespace() || c == '\0') {
+        "1" => syscall_stats_set_enabled(true),
+        "0" => syscall_stats_set_enabled(false),
+        "reset" => syscall_stats_reset(),
+        _ => return Err(SystemError::EINVAL),
+    }
+    return Ok(());
+}
+
+/// `/proc/syscall_stats`：每个系统调用的次数、总耗时、平均耗时，以及耗时的分布
+///
+/// 第0个记录是表头，第n+1个记录是第n个槽位的系统调用。没有被调用过的系统调用不输出。
+/// 耗时分布的每一项为`k:n`，表示有n次调用的耗时在`[2^k, 2^(k+1))`个cycle之间
+#[derive(Debug)]
+pub struct SyscallStatsSeq;
+
+impl SeqOperations for SyscallStatsSeq {
+    type Cursor = usize;
+
+    fn start(&self, pos: usize) -> Option<usize> {
+        return if pos <= NR_SYSCALL_SLOTS {
+            Some(pos)
+        } else {
+            None
+        };
+    }
+
+    fn show(&self, pos: &usize, s: &mut SeqBuf) -> Result<(), SystemError> {
+        if *pos == 0 {
+            writeln!(
+                s,
+                "{:>7} {:>12} {:>16} {:>10}  histogram(log2 cycles:calls){}",
+                "syscall",
+                "calls",
+                "cycles",
+                "avg",
+                if syscall_stats_enabled() {
+                    ""
+                } else {
+                    " [disabled]"
+                }
+            )
+            .ok();
+            return Ok(());
+        }
+
+        let slot = *pos - 1;
+        let (count, cycles, hist) = syscall_stat_sum(slot);
+        if count == 0 {
+            return Ok(());
+        }
+        write!(
+            s,
+            "{:>7} {:>12} {:>16} {:>10} ",
+            slot_syscall_nr(slot),
+            count,
+            cycles,
+            cycles / count
+        )
+        .ok();
+        for (bucket, n) in hist.iter().enumerate() {
+            if *n != 0 {
+                write!(s, " {}:{}", bucket, n).ok();
+            }
+        }
+        s.push('\n');
+        return Ok(());
+    }
+}
@@ -93,3 +93,4 @@
 /// 删的时候记得改C版本的libc
 #define SYS_CLOCK 100002
 #define SYS_SCHED 100003
+#define SYS_POSIX_SPAWN 100004
@@ -0,0 +1,95 @@
+//! 系统调用表
+//!
+//! 系统调用号到处理函数的映射在编译期构建成数组，分发时直接以系统调用号为下标查表，
+//! 开销与系统调用号无关。
+
+use crate::arch::interrupt::TrapFrame;
+
+use super::SystemError;
+
+/// 系统调用的处理函数：从原始参数中解码出各个参数，然后执行系统调用
+pub type SyscallHandler = fn(&[usize], &mut TrapFrame) -> Result<usize, SystemError>;
+
+/// 与Linux兼容的系统调用号的上限（不包含）
+const NR_SYSCALLS: usize = 512;
+/// DragonOS特有的系统调用号的起始值
+const DRAGONOS_SYSCALL_BASE: usize = 100000;
+/// DragonOS特有的系统调用的数量上限
+const NR_DRAGONOS_SYSCALLS: usize = 16;
+
+/// 系统调用的槽位数：Linux兼容的系统调用号在前，DragonOS特有的系统调用号在后
+pub const NR_SYSCALL_SLOTS: usize = NR_SYSCALLS + NR_DRAGONOS_SYSCALLS;
+
+/// 系统调用号对应的槽位，用于按系统调用号索引的统计数组
+#[inline(always)]
+pub fn syscall_slot(nr: usize) -> Option<usize> {
+    if nr < NR_SYSCALLS {
+        return Some(nr);
+    }
+    let idx = nr.wrapping_sub(DRAGONOS_SYSCALL_BASE);
+    if idx < NR_DRAGONOS_SYSCALLS {
+        return Some(NR_SYSCALLS + idx);
+    }
+    return None;
+}
+
+/// 槽位对应的系统调用号
+pub fn slot_syscall_nr(slot: usize) -> usize {
+    if slot < NR_SYSCALLS {
+        return slot;
+    }
+    return DRAGONOS_SYSCALL_BASE + slot - NR_SYSCALLS;
+}
+
+#[derive(Debug)]
+pub struct SyscallTable {
+    linux: [Option<SyscallHandler>; NR_SYSCALLS],
+    dragonos: [Option<SyscallHandler>; NR_DRAGONOS_SYSCALLS],
+}
+
+impl SyscallTable {
+    /// 根据(系统调用号, 处理函数)的列表构建系统调用表
+    ///
+    /// 系统调用号超出范围或者重复时，编译失败
+    pub const fn new(entries: &[(usize, SyscallHandler)]) -> Self {
+        let mut table = Self {
+            linux: [None; NR_SYSCALLS],
+            dragonos: [None; NR_DRAGONOS_SYSCALLS],
+        };
+        let mut i = 0;
+        while i < entries.len() {
+            let (nr, handler) = entries[i];
+            if nr < NR_SYSCALLS {
+                if table.linux[nr].is_some() {
+                    panic!("duplicate syscall number");
+                }
+                table.linux[nr] = Some(handler);
+            } else if nr >= DRAGONOS_SYSCALL_BASE
+                && nr - DRAGONOS_SYSCALL_BASE < NR_DRAGONOS_SYSCALLS
+            {
+                let idx = nr - DRAGONOS_SYSCALL_BASE;
+                if table.dragonos[idx].is_some() {
+                    panic!("duplicate syscall number");
+                }
+                table.dragonos[idx] = Some(handler);
+            } else {
+                panic!("syscall number out of range");
+            }
+            i += 1;
+        }
+        return table;
+    }
+
+    /// 查找系统调用号对应的处理函数
+    #[inline(always)]
+    pub fn get(&self, nr: usize) -> Option<SyscallHandler> {
+        if nr < NR_SYSCALLS {
+            return self.linux[nr];
+        }
+        return self
+            .dragonos
+            .get(nr.wrapping_sub(DRAGONOS_SYSCALL_BASE))
+            .copied()
+            .flatten();
+    }
+}
@@ -0,0 +1,229 @@
+//! 系统调用跟踪（类似strace的事件流）
+//!
+//! 被跟踪的进程的每个系统调用在返回时生成一个事件（系统调用号、参数、返回值、开始时刻以及耗时），
+//! 写入这个进程的环形缓冲区。缓冲区满时丢弃最旧的事件，并记录丢弃的数量。
+//!
+//! 向`/proc/<pid>/syscall_trace`写入`1`/`0`打开/关闭对这个进程的跟踪。读取这个文件会取走缓冲区中的事件，
+//! 每个事件只能被读到一次。
+
+use core::{
+    fmt::Write,
+    sync::atomic::{AtomicUsize, Ordering},
+};
+
+use alloc::{collections::VecDeque, sync::Arc};
+
+use crate::{
+    filesystem::vfs::seq_file::{SeqBuf, SeqOperations},
+    libs::spinlock::SpinLock,
+    process::{Pid, ProcessControlBlock, ProcessFlags, ProcessManager},
+};
+
+use super::SystemError;
+
+/// 每个进程的环形缓冲区能保存的事件数
+pub const SYSCALL_TRACE_RING_SIZE: usize = 1024;
+
+/// 记录的系统调用参数的个数
+const SYSCALL_TRACE_ARGS: usize = 6;
+
+/// 正在被跟踪的进程数。为0时，系统调用的出口不需要检查当前进程
+static NR_TRACED_TASKS: AtomicUsize = AtomicUsize::new(0);
+
+/// 一次系统调用
+#[derive(Debug, Clone, Copy)]
+pub struct SyscallEvent {
+    pub nr: usize,
+    pub args: [usize; SYSCALL_TRACE_ARGS],
+    /// 返回值，出错时为负的错误码
+    pub ret: isize,
+    /// 进入系统调用时的TSC
+    pub start: u64,
+    /// 耗时（cycles）
+    pub cycles: u64,
+}
+
+/// 进程的系统调用事件的环形缓冲区
+#[derive(Debug)]
+pub struct SyscallTraceRing {
+    inner: SpinLock<InnerSyscallTraceRing>,
+}
+
+#[derive(Debug)]
+struct InnerSyscallTraceRing {
+    events: VecDeque<SyscallEvent>,
+    /// 上一次读取之后，因为缓冲区满而被丢弃的事件数
+    lost: u64,
+}
+
+impl SyscallTraceRing {
+    pub fn new() -> Arc<Self> {
+        return Arc::new(Self {
+            inner: SpinLock::new(InnerSyscallTraceRing {
+                events: VecDeque::with_capacity(SYSCALL_TRACE_RING_SIZE),
+                lost: 0,
+            }),
+        });
+    }
+
+    fn push(&self, event: SyscallEvent) {
+        let mut inner = self.inner.lock_irqsave();
+        if inner.events.len() >= SYSCALL_TRACE_RING_SIZE {
+            inner.events.pop_front();
+            inner.lost += 1;
+        }
+        inner.events.push_back(event);
+    }
+
+    /// 取走最旧的一条记录。有事件被丢弃时，先返回丢弃的数量
+    fn pop(&self) -> Option<SyscallTraceRecord> {
+        let mut inner = self.inner.lock_irqsave();
+        if inner.lost != 0 {
+            let lost = inner.lost;
+            inner.lost = 0;
+            return Some(SyscallTraceRecord::Lost(lost));
+        }
+        return inner.events.pop_front().map(SyscallTraceRecord::Event);
+    }
+}
+
+/// 是否有进程正在被跟踪
+#[inline(always)]
+pub fn syscall_trace_active() -> bool {
+    return NR_TRACED_TASKS.load(Ordering::Relaxed) != 0;
+}
+
+/// 当前进程是否正在被跟踪
+#[inline(always)]
+pub(super) fn current_traced() -> bool {
+    if !syscall_trace_active() {
+        return false;
+    }
+    return ProcessManager::current_pcb()
+        .flags()
+        .contains(ProcessFlags::SYSCALL_TRACE);
+}
+
+/// 把当前进程的一次系统调用写入它的环形缓冲区
+pub(super) fn syscall_trace_record(
+    nr: usize,
+    args: &[usize],
+    ret: &Result<usize, SystemError>,
+    start: u64,
+    cycles: u64,
+) {
+    let pcb = ProcessManager::current_pcb();
+    let ring = pcb.syscall_trace().lock_irqsave().clone();
+    let ring = match ring {
+        Some(ring) => ring,
+        None => return,
+    };
+
+    let mut event = SyscallEvent {
+        nr,
+        args: [0; SYSCALL_TRACE_ARGS],
+        ret: match ret {
+            Ok(r) => *r as isize,
+            Err(e) => e.to_posix_errno() as isize,
+        },
+        start,
+        cycles,
+    };
+    let n = core::cmp::min(args.len(), SYSCALL_TRACE_ARGS);
+    event.args[..n].copy_from_slice(&args[..n]);
+    ring.push(event);
+}
+
+/// 打开或者关闭对进程的跟踪
+///
+/// 关闭跟踪时保留环形缓冲区，还没有被读走的事件仍然可以读取
+pub fn syscall_trace_set(pcb: &Arc<ProcessControlBlock>, enabled: bool) {
+    let mut ring = pcb.syscall_trace().lock_irqsave();
+    let traced = pcb.flags().contains(ProcessFlags::SYSCALL_TRACE);
+    if enabled == traced {
+        return;
+    }
+    if enabled {
+        if ring.is_none() {
+            *ring = Some(SyscallTraceRing::new());
+        }
+        pcb.flags().insert(ProcessFlags::SYSCALL_TRACE);
+        NR_TRACED_TASKS.fetch_add(1, Ordering::Relaxed);
+    } else {
+        pcb.flags().remove(ProcessFlags::SYSCALL_TRACE);
+        NR_TRACED_TASKS.fetch_sub(1, Ordering::Relaxed);
+    }
+}
+
+/// 进程被释放时调用，维护被跟踪的进程数
+pub fn syscall_trace_release(pcb: &ProcessControlBlock) {
+    if pcb.flags().contains(ProcessFlags::SYSCALL_TRACE) {
+        pcb.flags().remove(ProcessFlags::SYSCALL_TRACE);
+        NR_TRACED_TASKS.fetch_sub(1, Ordering::Relaxed);
+    }
+}
+
+/// 处理对`/proc/<pid>/syscall_trace`的写入
+pub fn syscall_trace_store(pid: Pid, buf: &[u8]) -> Result<(), SystemError> {
+    let s = core::str::from_utf8(buf).map_err(|_| SystemError::EINVAL)?;
+    let enabled = match s.trim_matches(|c: char| c.is_whitespace() || c == '\0') {
+        "1" => true,
+        "0" => false,
+        _ => return Err(SystemError::EINVAL),
+    };
+    let pcb = ProcessManager::find(pid).ok_or(SystemError::ESRCH)?;
+    syscall_trace_set(&pcb, enabled);
+    return Ok(());
+}
+
+/// 从环形缓冲区中取出的一条记录
+#[derive(Debug)]
+pub enum SyscallTraceRecord {
+    /// 被丢弃的事件数
+    Lost(u64),
+    Event(SyscallEvent),
+}
+
+/// `/proc/<pid>/syscall_trace`：进程的系统调用事件，每行一个
+///
+/// 格式为`<开始时刻的TSC> <系统调用号>(<参数>...) = <返回值> <<耗时的cycles>>`。
+/// 每个记录都从缓冲区中取走最旧的事件，因此读取的偏移量没有意义
+#[derive(Debug)]
+pub struct SyscallTraceSeq {
+    ring: Option<Arc<SyscallTraceRing>>,
+}
+
+impl SyscallTraceSeq {
+    pub fn new(pcb: &ProcessControlBlock) -> Self {
+        return Self {
+            ring: pcb.syscall_trace().lock_irqsave().clone(),
+        };
+    }
+}
+
+impl SeqOperations for SyscallTraceSeq {
+    type Cursor = SyscallTraceRecord;
+
+    fn start(&self, _pos: usize) -> Option<SyscallTraceRecord> {
+        return self.ring.as_ref()?.pop();
+    }
+
+    fn show(&self, record: &SyscallTraceRecord, s: &mut SeqBuf) -> Result<(), SystemError> {
+        match record {
+            SyscallTraceRecord::Lost(lost) => {
+                writeln!(s, "... {} events lost", lost).ok();
+            }
+            SyscallTraceRecord::Event(event) => {
+                write!(s, "{} {}(", event.start, event.nr).ok();
+                for (i, arg) in event.args.iter().enumerate() {
+                    if i != 0 {
+                        s.push_str(", ");
+                    }
+                    write!(s, "{:#x}", arg).ok();
+                }
+                writeln!(s, ") = {} <{}>", event.ret, event.cycles).ok();
+            }
+        }
+        return Ok(());
+    }
+}
@@ -1,13 +1,18 @@
 //! 这个文件用于放置一些内核态访问用户态数据的函数
 
 use core::{
-    mem::size_of,
+    ffi::{c_char, CStr},
+    intrinsics::unlikely,
+    mem::{size_of, MaybeUninit},
     slice::{from_raw_parts, from_raw_parts_mut},
 };
 
 use alloc::{string::String, vec::Vec};
 
-use crate::mm::{verify_area, VirtAddr};
+use crate::{
+    arch::mm::usercopy::{clear_user_generic, copy_user_generic},
+    mm::{verify_area, VirtAddr},
+};
 
 use super::SystemError;
 
@@ -26,32 +31,160 @@ use super::SystemError;
 ///
 /// - `EFAULT`：目标地址不合法
 pub unsafe fn clear_user(dest: VirtAddr, len: usize) -> Result<usize, SystemError> {
-    verify_area(dest, len).map_err(|_| SystemError::EFAULT)?;
-
-    let p = dest.data() as *mut u8;
-    // 清空用户空间的数据
-    p.write_bytes(0, len);
-    return Ok(len);
+    return UserSlice::new(dest, len)?.clear();
 }
 
+/// 从内核空间拷贝数据到用户空间
+///
+/// ## 错误
+///
+/// - `EFAULT`：目标地址不合法，或者目标地址范围内有无法访问的页面
 pub unsafe fn copy_to_user(dest: VirtAddr, src: &[u8]) -> Result<usize, SystemError> {
-    verify_area(dest, src.len()).map_err(|_| SystemError::EFAULT)?;
-
-    let p = dest.data() as *mut u8;
-    // 拷贝数据
-    p.copy_from_nonoverlapping(src.as_ptr(), src.len());
-    return Ok(src.len());
+    return UserSlice::new(dest, src.len())?.write(0, src);
 }
 
 /// 从用户空间拷贝数据到内核空间
+///
+/// ## 错误
+///
+/// - `EFAULT`：源地址不合法，或者源地址范围内有无法访问的页面
 pub unsafe fn copy_from_user(dst: &mut [u8], src: VirtAddr) -> Result<usize, SystemError> {
-    verify_area(src, dst.len()).map_err(|_| SystemError::EFAULT)?;
+    return UserSlice::new(src, dst.len())?.read(0, dst);
+}
+
+/// 已经检查过地址范围的用户空间缓冲区
+///
+/// 构造时只调用一次`verify_area`，之后对它（以及它的子范围）的读写不再重复检查，
+/// 直接通过usercopy的拷贝函数访问用户空间：拷贝期间临时允许访问用户页面（SMAP），
+/// 遇到无法访问的页面时由异常表修复，返回`EFAULT`。
+///
+/// 一个系统调用需要多次访问同一个缓冲区时（例如先读出结构体，再写回其中的字段），
+/// 应当构造一次UserSlice，然后反复使用它。
+#[derive(Debug, Clone, Copy)]
+pub struct UserSlice {
+    addr: VirtAddr,
+    len: usize,
+}
+
+impl UserSlice {
+    /// 检查`[addr, addr + len)`是否都在用户空间中，并构造UserSlice
+    ///
+    /// ## 错误
+    ///
+    /// - `EFAULT`：地址范围不合法
+    pub fn new(addr: VirtAddr, len: usize) -> Result<Self, SystemError> {
+        verify_area(addr, len).map_err(|_| SystemError::EFAULT)?;
+        return Ok(Self { addr, len });
+    }
+
+    /// 指向用户空间中一个`T`类型的值（或者`count`个连续的值）的UserSlice
+    pub fn new_array<T>(addr: *const T, count: usize) -> Result<Self, SystemError> {
+        let len = count
+            .checked_mul(size_of::<T>())
+            .ok_or(SystemError::EFAULT)?;
+        return Self::new(VirtAddr::new(addr as usize), len);
+    }
+
+    #[inline]
+    pub fn addr(&self) -> VirtAddr {
+        return self.addr;
+    }
+
+    #[inline]
+    pub fn len(&self) -> usize {
+        return self.len;
+    }
+
+    #[inline]
+    pub fn is_empty(&self) -> bool {
+        return self.len == 0;
+    }
+
+    /// 取`[offset, offset + len)`范围内的子缓冲区。子缓冲区在原来的范围内，不需要重新检查
+    ///
+    /// ## 错误
+    ///
+    /// - `EFAULT`：子范围超出了原来的范围
+    pub fn subslice(&self, offset: usize, len: usize) -> Result<Self, SystemError> {
+        let end = offset.checked_add(len).ok_or(SystemError::EFAULT)?;
+        if unlikely(end > self.len) {
+            return Err(SystemError::EFAULT);
+        }
+        return Ok(Self {
+            addr: self.addr + offset,
+            len,
+        });
+    }
+
+    /// 从缓冲区的offset处读取`dst.len()`个字节
+    ///
+    /// ## 错误
+    ///
+    /// - `EFAULT`：超出了缓冲区的范围，或者范围内有无法访问的页面
+    pub fn read(&self, offset: usize, dst: &mut [u8]) -> Result<usize, SystemError> {
+        let src = self.subslice(offset, dst.len())?;
+        if unlikely(
+            unsafe { copy_user_generic(dst.as_mut_ptr(), src.addr.data() as *const u8, dst.len()) }
+                != 0,
+        ) {
+            return Err(SystemError::EFAULT);
+        }
+        return Ok(dst.len());
+    }
+
+    /// 把src写入缓冲区的offset处
+    ///
+    /// ## 错误
+    ///
+    /// - `EFAULT`：超出了缓冲区的范围，或者范围内有无法访问的页面
+    pub fn write(&self, offset: usize, src: &[u8]) -> Result<usize, SystemError> {
+        let dst = self.subslice(offset, src.len())?;
+        if unlikely(
+            unsafe { copy_user_generic(dst.addr.data() as *mut u8, src.as_ptr(), src.len()) } != 0,
+        ) {
+            return Err(SystemError::EFAULT);
+        }
+        return Ok(src.len());
+    }
 
-    let src: &[u8] = core::slice::from_raw_parts(src.data() as *const u8, dst.len());
-    // 拷贝数据
-    dst.copy_from_slice(&src);
+    /// 清空整个缓冲区
+    ///
+    /// ## 错误
+    ///
+    /// - `EFAULT`：范围内有无法访问的页面
+    pub fn clear(&self) -> Result<usize, SystemError> {
+        // 清空的过程中遇到未映射的地址时，会提前结束
+        if unlikely(unsafe { clear_user_generic(self.addr.data() as *mut u8, self.len) } != 0) {
+            return Err(SystemError::EFAULT);
+        }
+        return Ok(self.len);
+    }
+
+    /// 从缓冲区的offset处读取一个`T`类型的值
+    pub fn read_one<T: Copy>(&self, offset: usize) -> Result<T, SystemError> {
+        let mut val = MaybeUninit::<T>::uninit();
+        let dst = unsafe { from_raw_parts_mut(val.as_mut_ptr() as *mut u8, size_of::<T>()) };
+        self.read(offset, dst)?;
+        return Ok(unsafe { val.assume_init() });
+    }
+
+    /// 把一个`T`类型的值写入缓冲区的offset处
+    pub fn write_one<T: Copy>(&self, offset: usize, val: &T) -> Result<(), SystemError> {
+        let src = unsafe { from_raw_parts(val as *const T as *const u8, size_of::<T>()) };
+        self.write(offset, src)?;
+        return Ok(());
+    }
 
-    return Ok(dst.len());
+    /// 把整个缓冲区读取为`T`类型的数组（缓冲区末尾不足一个`T`的部分被忽略）
+    pub fn read_array<T: Copy>(&self) -> Result<Vec<T>, SystemError> {
+        let count = self.len / size_of::<T>();
+        let mut vec: Vec<T> = Vec::with_capacity(count);
+        let dst =
+            unsafe { from_raw_parts_mut(vec.as_mut_ptr() as *mut u8, count * size_of::<T>()) };
+        self.read(0, dst)?;
+        unsafe { vec.set_len(count) };
+        return Ok(vec);
+    }
 }
 
 /// 检查并从用户态拷贝一个 C 字符串。
@@ -144,6 +277,36 @@ pub fn check_and_clone_cstr_array(user: *const *const u8) -> Result<Vec<String>,
     }
 }
 
+/// 把系统调用参数解释为用户态的 C 字符串（不拷贝）
+///
+/// ## 错误
+///
+/// - `EINVAL`：字符串不是合法的UTF-8
+pub fn user_str<'a>(addr: usize) -> Result<&'a str, SystemError> {
+    let s: &CStr = unsafe { CStr::from_ptr(addr as *const c_char) };
+    return s.to_str().map_err(|_| SystemError::EINVAL);
+}
+
+/// 把系统调用参数解释为指向用户态结构体的引用（不拷贝）
+///
+/// ## 错误
+///
+/// - `EFAULT`：用户态地址不合法
+pub fn user_ref<'a, T>(addr: usize) -> Result<&'a T, SystemError> {
+    verify_area(VirtAddr::new(addr), size_of::<T>()).map_err(|_| SystemError::EFAULT)?;
+    return Ok(unsafe { &*(addr as *const T) });
+}
+
+/// 把系统调用参数解释为指向用户态结构体的可变引用（不拷贝）
+///
+/// ## 错误
+///
+/// - `EFAULT`：用户态地址不合法
+pub fn user_ref_mut<'a, T>(addr: usize) -> Result<&'a mut T, SystemError> {
+    verify_area(VirtAddr::new(addr), size_of::<T>()).map_err(|_| SystemError::EFAULT)?;
+    return Ok(unsafe { &mut *(addr as *mut T) });
+}
+
 #[derive(Debug)]
 pub struct UserBufferWriter<'a> {
     buffer: &'a mut [u8],
@@ -14,6 +14,7 @@ use crate::{
 
 use super::{
     jiffies::clocksource_default_clock,
+    timekeeping::timekeeper,
     timer::{clock, Timer, TimerFunction},
     NSEC_PER_SEC,
 };
@@ -41,8 +42,8 @@ pub static mut FINISHED_BOOTING: AtomicBool = AtomicBool::new(false);
 /// Interval: 0.5sec Threshold: 0.0625s
 /// 系统节拍率
 pub const HZ: u64 = 250;
-/// watchdog检查间隔
-pub const WATCHDOG_INTERVAL: u64 = HZ >> 1;
+/// watchdog检查间隔（单位：jiffies，即微秒）
+pub const WATCHDOG_INTERVAL: u64 = 500_000;
 /// 最大能接受的误差大小
 pub const WATCHDOG_THRESHOLD: u32 = NSEC_PER_SEC >> 4;
 
@@ -146,7 +147,7 @@ impl ClocksouceWatchdog {
         }
         // 生成一个定时器
         let wd_timer_func: Box<WatchdogTimerFunc> = Box::new(WatchdogTimerFunc {});
-        self.timer_expires += clock() + WATCHDOG_INTERVAL;
+        self.timer_expires = clock() + WATCHDOG_INTERVAL;
         self.last_check = self.watchdog.as_ref().unwrap().clone().read();
         let wd_timer = Timer::new(wd_timer_func, self.timer_expires);
         wd_timer.activate();
@@ -250,7 +251,7 @@ impl dyn Clocksource {
         let cs_data_guard = self.clocksource_data();
         let max_nsecs: u64;
         let mut max_cycles: u64;
-        max_cycles = (1 << (63 - (log2(cs_data_guard.mult) + 1))) as u64;
+        max_cycles = 1u64 << (63 - (log2(cs_data_guard.mult) + 1));
         max_cycles = max_cycles.min(cs_data_guard.mask.bits);
         max_nsecs = clocksource_cyc2ns(
             CycleNum(max_cycles),
@@ -610,6 +611,38 @@ impl ClocksourceData {
     }
 }
 
+/// # 计算把频率为`from`（单位：Hz）的计数换算为频率为`to`的计数时使用的mult和shift
+///
+/// 换算方式为`(cycles * mult) >> shift`。在保证`maxsec`秒以内的计数与mult相乘不会溢出的前提下，
+/// 选择尽可能大的shift，以获得尽可能高的精度。
+///
+/// 参考 https://opengrok.ringotek.cn/xref/linux-6.1.9/kernel/time/clocksource.c#47
+///
+/// ## 返回值
+///
+/// * `(mult, shift)`
+pub fn clocks_calc_mult_shift(from: u64, to: u64, maxsec: u32) -> (u32, u32) {
+    // 计算maxsec秒内的计数需要占用多少位，剩下的位留给mult
+    let mut tmp = (maxsec as u64 * from) >> 32;
+    let mut sftacc: u32 = 32;
+    while tmp != 0 {
+        tmp >>= 1;
+        sftacc -= 1;
+    }
+
+    // 找到mult不超过sftacc位的最大的shift
+    let mut sft = 32;
+    while sft > 0 {
+        tmp = (to << sft) + from / 2;
+        tmp /= from;
+        if (tmp >> sftacc) == 0 {
+            break;
+        }
+        sft -= 1;
+    }
+    return (tmp as u32, sft);
+}
+
 ///  converts clocksource cycles to nanoseconds
 ///
 pub fn clocksource_cyc2ns(cycles: CycleNum, mult: u32, shift: u32) -> u64 {
@@ -672,7 +705,7 @@ pub fn clocksource_watchdog() -> Result<(), SystemError> {
     );
     cs_watchdog.last_check = CycleNum(cur_wd_nowclock);
     drop(cs_watchdog);
-    let watchdog_list = &mut WATCHDOG_LIST.lock();
+    let watchdog_list = WATCHDOG_LIST.lock();
     for cs in watchdog_list.iter() {
         let mut cs_data = cs.clocksource_data();
         // 判断时钟源是否已经被标记为不稳定
@@ -712,7 +745,7 @@ pub fn clocksource_watchdog() -> Result<(), SystemError> {
         cs.update_clocksource_data(cs_data.clone())?;
         if cs_dev_nsec.abs_diff(wd_dev_nsec) > WATCHDOG_THRESHOLD.into() {
             // 误差过大，标记为unstable
-            cs.set_unstable((cs_dev_nsec - wd_dev_nsec).try_into().unwrap())?;
+            cs.set_unstable(cs_dev_nsec as i64 - wd_dev_nsec as i64)?;
             continue;
         }
 
@@ -733,7 +766,12 @@ pub fn clocksource_watchdog() -> Result<(), SystemError> {
             cs.update_clocksource_data(cs_data)?;
             // TODO 通知tick机制 切换为高精度模式
         }
-        let mut cs_watchdog = CLOCKSOUCE_WATCHDOG.lock();
+    }
+    drop(watchdog_list);
+
+    // 每一轮检查都要重新设置定时器（包括只记录了起点、还没有比较的时钟源）
+    let mut cs_watchdog = CLOCKSOUCE_WATCHDOG.lock();
+    if cs_watchdog.is_running {
         // FIXME 需要保证所有cpu时间统一
         cs_watchdog.timer_expires += WATCHDOG_INTERVAL;
         //创建定时器执行watchdog
@@ -790,9 +828,11 @@ pub fn clocksource_resume_watchdog() {
 }
 
 /// # 根据精度选择最优的时钟源，或者接受用户指定的时间源
+///
+/// 在clocksource模块加载完成之前不切换时钟源，加载完成之后才注册的时钟源（例如TSC）在注册时被选中
 pub fn clocksource_select() {
     let list_guard = CLOCKSOURCE_LIST.lock();
-    if unsafe { FINISHED_BOOTING.load(Ordering::Relaxed) } || list_guard.is_empty() {
+    if unsafe { !FINISHED_BOOTING.load(Ordering::Relaxed) } || list_guard.is_empty() {
         return;
     }
     let mut best = list_guard.front().unwrap().clone();
@@ -815,8 +855,11 @@ pub fn clocksource_select() {
         if cur_clocksource.clocksource_data().name.ne(best_name) {
             kinfo!("Switching to the clocksource {:?}\n", best_name);
             drop(cur_clocksource);
-            CUR_CLOCKSOURCE.lock().replace(best);
-            // TODO 通知timerkeeping 切换了时间源
+            CUR_CLOCKSOURCE.lock().replace(best.clone());
+            drop(override_name);
+            drop(list_guard);
+            // 通知timekeeping切换了时间源
+            timekeeper().timekeeper_setup_internals(best);
         }
     } else {
         // 当前时钟源为空
@@ -829,9 +872,12 @@ pub fn clocksource_select() {
 pub fn clocksource_boot_finish() {
     let mut cur_clocksource = CUR_CLOCKSOURCE.lock();
     cur_clocksource.replace(clocksource_default_clock());
+    drop(cur_clocksource);
     unsafe { FINISHED_BOOTING.store(true, Ordering::Relaxed) };
     // 清除不稳定的时钟源
     clocksource_watchdog_kthread();
+    // 从已经注册的时钟源中选择最好的
+    clocksource_select();
     kdebug!("clocksource_boot_finish");
 }
 
@@ -0,0 +1,257 @@
+//! 高精度定时器（hrtimer）
+//!
+//! [`super::timer::Timer`]的精度是时间轮的刻度（亚毫秒级，在AP上还要取决于时钟中断），不适合微秒级的定时。
+//! 高精度定时器以纳秒为单位，时间来源于TSC。每个cpu有一棵按照到期时间排序的红黑树，
+//! 最早的定时器在一个时钟周期之内到期时，把本地APIC定时器设置为在它到期时产生一次中断
+//! （支持时使用TSC-Deadline模式，否则使用one-shot模式），处理完之后再恢复周期性的时钟中断。
+//!
+//! 定时器函数在硬中断上下文中执行，不能睡眠，也不应该执行耗时的操作（例如只唤醒一个进程）。
+//!
+//! 定时器可以有一个到期的范围`[soft_expires, expires]`：只按照最晚的时刻`expires`设置APIC定时器，
+//! 但是在这之前因为其他定时器或者时钟中断而处理队列时，已经进入范围的定时器会被一起触发，减少中断的次数。
+
+use core::{
+    intrinsics::unlikely,
+    sync::atomic::{AtomicBool, AtomicU32, AtomicU64, Ordering},
+};
+
+use alloc::{boxed::Box, sync::Arc, vec::Vec};
+
+use crate::{
+    arch::{
+        driver::{
+            apic::apic_timer::{apic_timer_restart_tick, apic_timer_stop_tick},
+            tsc::TSCManager,
+        },
+        CurrentIrqArch, CurrentTimeArch,
+    },
+    exception::InterruptArch,
+    kerror,
+    libs::{rbtree::RBTree, spinlock::SpinLock},
+    mm::percpu::PerCpu,
+    process::ProcessManager,
+    sched::isolation::{cpu_tick_stopped, tick_nohz_full_restart},
+    smp::core::smp_get_processor_id,
+};
+
+use super::{
+    clocksource::HZ,
+    timer::{clock, TimerFunction},
+    TimeArch,
+};
+
+/// 时钟中断的间隔（单位：纳秒）
+const TICK_NSEC: u64 = 1_000_000_000 / HZ;
+/// 定时器不在任何cpu的队列中
+const HRTIMER_CPU_NONE: u32 = u32::MAX;
+
+/// 按照（到期时间，序号）排序的定时器
+struct HrTimerQueue {
+    tree: RBTree<(u64, u64), Arc<HrTimer>>,
+}
+
+/// 红黑树中的裸指针只会在队列的锁的保护下访问
+unsafe impl Send for HrTimerQueue {}
+
+/// 每个cpu的定时器队列。第一次在这个cpu上启动定时器时才初始化
+static HRTIMER_QUEUES: [SpinLock<Option<HrTimerQueue>>; PerCpu::MAX_CPU_NUM] =
+    [const { SpinLock::new(None) }; PerCpu::MAX_CPU_NUM];
+/// 每个cpu上最早的到期时间（u64::MAX表示没有定时器），时钟中断中读取时不需要加锁
+static HRTIMER_NEXT: [AtomicU64; PerCpu::MAX_CPU_NUM] =
+    [const { AtomicU64::new(u64::MAX) }; PerCpu::MAX_CPU_NUM];
+/// 每个cpu的本地APIC定时器是否被设置为在定时器到期时触发（此时周期性的时钟中断被暂停了）
+static HRTIMER_PROGRAMMED: [AtomicBool; PerCpu::MAX_CPU_NUM] =
+    [const { AtomicBool::new(false) }; PerCpu::MAX_CPU_NUM];
+/// 用于区分到期时间相同的定时器
+static HRTIMER_SEQ: AtomicU64 = AtomicU64::new(0);
+
+/// 当前的单调时间（单位：纳秒）
+///
+/// TSC还没有校准时，退化为jiffies的精度
+pub fn hrtimer_now() -> u64 {
+    let tsc_khz = TSCManager::tsc_khz();
+    if unlikely(tsc_khz == 0) {
+        return clock() * 1000;
+    }
+    let cycles = CurrentTimeArch::get_cycles() as u128;
+    return (cycles * 1_000_000 / tsc_khz as u128) as u64;
+}
+
+/// 高精度定时器
+#[derive(Debug)]
+pub struct HrTimer {
+    /// 最早可以触发的时间（单位：纳秒，与hrtimer_now()相同的时间基准）
+    soft_expires: u64,
+    /// 最晚必须触发的时间（单位：纳秒），队列按照它排序
+    expires: u64,
+    /// 在队列中的序号
+    seq: AtomicU64,
+    /// 所在的cpu的队列，不在队列中时为HRTIMER_CPU_NONE。只在所在的队列的锁的保护下修改
+    cpu: AtomicU32,
+    /// 是否已经触发
+    triggered: AtomicBool,
+    timer_func: SpinLock<Box<dyn TimerFunction>>,
+}
+
+impl HrTimer {
+    /// 创建一个在`expires`（单位：纳秒，参见[`hrtimer_now`]）到期的定时器
+    pub fn new(timer_func: Box<dyn TimerFunction>, expires: u64) -> Arc<Self> {
+        return Self::new_range(timer_func, expires, 0);
+    }
+
+    /// 创建一个在`expires`到`expires + delta_ns`之间的任意时刻触发的定时器
+    pub fn new_range(timer_func: Box<dyn TimerFunction>, expires: u64, delta_ns: u64) -> Arc<Self> {
+        return Arc::new(Self {
+            soft_expires: expires,
+            expires: expires.saturating_add(delta_ns),
+            seq: AtomicU64::new(0),
+            cpu: AtomicU32::new(HRTIMER_CPU_NONE),
+            triggered: AtomicBool::new(false),
+            timer_func: SpinLock::new(timer_func),
+        });
+    }
+
+    /// 创建一个在`delta_ns`纳秒之后到期的定时器
+    #[allow(dead_code)]
+    pub fn new_after(timer_func: Box<dyn TimerFunction>, delta_ns: u64) -> Arc<Self> {
+        return Self::new(timer_func, hrtimer_now().saturating_add(delta_ns));
+    }
+
+    /// 到期时间（单位：纳秒）。设置了到期范围时，为范围的起点
+    pub fn expires(&self) -> u64 {
+        return self.soft_expires;
+    }
+
+    /// 把定时器加入当前cpu的队列
+    pub fn start(self: &Arc<Self>) {
+        let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+        let cpu_id = smp_get_processor_id();
+        let mut queue_guard = HRTIMER_QUEUES[cpu_id as usize].lock();
+        let queue = queue_guard.get_or_insert_with(|| HrTimerQueue {
+            tree: RBTree::new(),
+        });
+        let seq = HRTIMER_SEQ.fetch_add(1, Ordering::Relaxed);
+        self.seq.store(seq, Ordering::Relaxed);
+        self.cpu.store(cpu_id, Ordering::SeqCst);
+        queue.tree.insert((self.expires, seq), self.clone());
+        let next = HRTIMER_NEXT[cpu_id as usize].load(Ordering::SeqCst);
+        if self.expires < next {
+            HRTIMER_NEXT[cpu_id as usize].store(self.expires, Ordering::SeqCst);
+            // 停止时钟中断时只考虑了当时最早的定时器
+            tick_nohz_full_restart();
+            hrtimer_reprogram(cpu_id, self.expires);
+        }
+        drop(queue_guard);
+        drop(irq_guard);
+    }
+
+    /// 取消定时器。返回定时器是否还在队列中（即取消之前还没有触发）
+    pub fn cancel(&self) -> bool {
+        let cpu_id = self.cpu.load(Ordering::SeqCst);
+        if cpu_id == HRTIMER_CPU_NONE {
+            return false;
+        }
+        let mut queue_guard = HRTIMER_QUEUES[cpu_id as usize].lock_irqsave();
+        // 加锁之前，定时器可能已经被取出了
+        if self.cpu.load(Ordering::SeqCst) == HRTIMER_CPU_NONE {
+            return false;
+        }
+        let queue = queue_guard.as_mut().unwrap();
+        queue
+            .tree
+            .remove(&(self.expires, self.seq.load(Ordering::Relaxed)));
+        self.cpu.store(HRTIMER_CPU_NONE, Ordering::SeqCst);
+        // 不更新HRTIMER_NEXT：它只是一个下界，下一次中断时会重新计算
+        return true;
+    }
+
+    /// 定时器是否已经触发
+    pub fn timeout(&self) -> bool {
+        return self.triggered.load(Ordering::SeqCst);
+    }
+
+    fn run(&self) {
+        self.triggered.store(true, Ordering::SeqCst);
+        let r = self.timer_func.lock_irqsave().run();
+        if unlikely(r.is_err()) {
+            kerror!(
+                "Failed to run hrtimer function: {self:?} {:?}",
+                r.err().unwrap()
+            );
+        }
+    }
+}
+
+/// 根据最早的到期时间设置当前cpu的本地APIC定时器
+///
+/// 在一个时钟周期之内到期时，改为在到期时产生一次中断；否则恢复周期性的时钟中断
+/// （处于NO_HZ idle、或者nohz_full的cpu停止了时钟中断时，由它们负责恢复）。
+///
+/// 请注意，调用者需要关中断
+fn hrtimer_reprogram(cpu_id: u32, next: u64) {
+    let now = hrtimer_now();
+    if next < now.saturating_add(TICK_NSEC) {
+        let delta_us = (next.saturating_sub(now) + 999) / 1000;
+        apic_timer_stop_tick(delta_us.max(1));
+        HRTIMER_PROGRAMMED[cpu_id as usize].store(true, Ordering::SeqCst);
+    } else if HRTIMER_PROGRAMMED[cpu_id as usize].swap(false, Ordering::SeqCst)
+        && !ProcessManager::cpu_in_nohz_idle(cpu_id)
+        && !cpu_tick_stopped(cpu_id)
+    {
+        apic_timer_restart_tick();
+    }
+}
+
+/// 本地APIC定时器中断时调用：执行当前cpu上所有到期的定时器，然后重新设置APIC定时器
+pub fn hrtimer_interrupt() {
+    let cpu_id = smp_get_processor_id();
+    let next = HRTIMER_NEXT[cpu_id as usize].load(Ordering::SeqCst);
+    let programmed = HRTIMER_PROGRAMMED[cpu_id as usize].load(Ordering::SeqCst);
+    // 快速路径：最早的定时器在一个时钟周期之后才到期
+    if !programmed && next >= hrtimer_now().saturating_add(TICK_NSEC) {
+        return;
+    }
+
+    let mut expired = Vec::new();
+    let mut queue_guard = HRTIMER_QUEUES[cpu_id as usize].lock_irqsave();
+    let now = hrtimer_now();
+    let mut next = u64::MAX;
+    if let Some(queue) = queue_guard.as_mut() {
+        while let Some((&(expires, _), timer)) = queue.tree.get_first() {
+            // 队列按照范围的终点排序，遇到第一个还没有进入范围的定时器就停止
+            if timer.soft_expires > now {
+                next = expires;
+                break;
+            }
+            let (_, timer) = queue.tree.pop_first().unwrap();
+            timer.cpu.store(HRTIMER_CPU_NONE, Ordering::SeqCst);
+            expired.push(timer);
+        }
+    }
+    HRTIMER_NEXT[cpu_id as usize].store(next, Ordering::SeqCst);
+    drop(queue_guard);
+
+    // 定时器函数可能会重新启动定时器，因此需要在放锁之后执行
+    for timer in expired {
+        timer.run();
+    }
+
+    let _irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+    let next = HRTIMER_NEXT[cpu_id as usize].load(Ordering::SeqCst);
+    hrtimer_reprogram(cpu_id, next);
+}
+
+/// cpu的本地APIC定时器是否正被设置为在高精度定时器到期时触发
+#[inline(always)]
+pub fn hrtimer_programmed(cpu_id: u32) -> bool {
+    return HRTIMER_PROGRAMMED[cpu_id as usize].load(Ordering::SeqCst);
+}
+
+/// 当前cpu上最早的高精度定时器还有多久到期（单位：微秒），没有定时器时返回None
+pub fn hrtimer_next_expire_us() -> Option<u64> {
+    let next = HRTIMER_NEXT[smp_get_processor_id() as usize].load(Ordering::SeqCst);
+    if next == u64::MAX {
+        return None;
+    }
+    return Some(next.saturating_sub(hrtimer_now()) / 1000);
+}
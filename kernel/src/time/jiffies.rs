@@ -8,7 +8,7 @@ use crate::{kerror, kinfo, libs::spinlock::SpinLock, syscall::SystemError};
 use super::{
     clocksource::{Clocksource, ClocksourceData, ClocksourceFlags, ClocksourceMask, CycleNum, HZ},
     timer::clock,
-    NSEC_PER_SEC,
+    NSEC_PER_SEC, USEC_PER_SEC,
 };
 lazy_static! {
     pub static ref DEFAULT_CLOCK: Arc<ClocksourceJiffies> = ClocksourceJiffies::new();
@@ -66,7 +66,8 @@ impl ClocksourceJiffies {
             name: "jiffies".to_string(),
             rating: 1,
             mask: ClocksourceMask::new(0xffffffff),
-            mult: NSEC_PER_JIFFY << JIFFIES_SHIFT,
+            // clock()的单位是微秒
+            mult: (NSEC_PER_SEC / USEC_PER_SEC) << JIFFIES_SHIFT,
             shift: JIFFIES_SHIFT,
             max_idle_ns: Default::default(),
             flags: ClocksourceFlags::new(0),
@@ -3,13 +3,16 @@ use core::{fmt, ops};
 use self::timekeep::ktime_get_real_ns;
 
 pub mod clocksource;
+pub mod hrtimer;
 pub mod jiffies;
+pub mod posix_timer;
 pub mod sleep;
 pub mod syscall;
 pub mod timeconv;
 pub mod timekeep;
 pub mod timekeeping;
 pub mod timer;
+pub mod timerfd;
 /* Time structures. (Partitially taken from smoltcp)
 
 The `time` module contains structures used to represent both
@@ -0,0 +1,369 @@
+//! POSIX间隔定时器（timer_create、timer_settime等系统调用）
+//!
+//! 定时器属于进程（线程组），保存在线程组的组长的pcb中，子进程不继承。到期时向进程
+//! （或者`SIGEV_THREAD_ID`指定的线程）发送信号。发送信号需要获取目标进程的信号相关的锁，
+//! 不适合在硬中断上下文中执行，因此定时器基于时间轮的[`Timer`]实现（在软中断中执行），精度为时间轮的刻度。
+
+use core::intrinsics::unlikely;
+
+use alloc::{
+    boxed::Box,
+    sync::{Arc, Weak},
+};
+use hashbrown::HashMap;
+
+use crate::{
+    arch::ipc::signal::{SigCode, Signal},
+    ipc::signal_types::{SigInfo, SigType},
+    libs::spinlock::SpinLock,
+    process::{Pid, ProcessControlBlock, ProcessManager},
+    syscall::SystemError,
+};
+
+use super::{
+    hrtimer::hrtimer_now,
+    syscall::PosixClockID,
+    timekeeping::getnstimeofday,
+    timer::{clock, Timer, TimerFunction},
+    TimeSpec, NSEC_PER_SEC,
+};
+
+/// 到期时发送信号
+pub const SIGEV_SIGNAL: i32 = 0;
+/// 到期时不通知
+pub const SIGEV_NONE: i32 = 1;
+/// 到期时由用户态的库创建线程执行回调。对内核来说与SIGEV_SIGNAL相同
+pub const SIGEV_THREAD: i32 = 2;
+/// 到期时向指定的线程发送信号
+pub const SIGEV_THREAD_ID: i32 = 4;
+
+/// timer_settime的flags：`it_value`是绝对时间
+pub const TIMER_ABSTIME: i32 = 1;
+
+/// 每个进程最多可以创建的定时器的数量
+const POSIX_TIMER_MAX: usize = 1024;
+
+/// 定时器的设置：第一次到期的时间和之后的周期
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct ItimerSpec {
+    pub it_interval: TimeSpec,
+    pub it_value: TimeSpec,
+}
+
+/// 用户态传入的`struct sigevent`（64字节）
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct SigEvent {
+    pub sigev_value: u64,
+    pub sigev_signo: i32,
+    pub sigev_notify: i32,
+    /// SIGEV_THREAD_ID时，接收信号的线程
+    pub sigev_notify_thread_id: i32,
+    _pad: [i32; 11],
+}
+
+/// 把TimeSpec转换为纳秒，并检查它是否合法
+pub fn timespec_to_ns(ts: &TimeSpec) -> Result<u64, SystemError> {
+    if ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= NSEC_PER_SEC as i64 {
+        return Err(SystemError::EINVAL);
+    }
+    return Ok((ts.tv_sec as u64)
+        .saturating_mul(NSEC_PER_SEC as u64)
+        .saturating_add(ts.tv_nsec as u64));
+}
+
+pub fn ns_to_timespec(ns: u64) -> TimeSpec {
+    return TimeSpec {
+        tv_sec: (ns / NSEC_PER_SEC as u64) as i64,
+        tv_nsec: (ns % NSEC_PER_SEC as u64) as i64,
+    };
+}
+
+/// 检查定时器能否使用这个时钟
+pub fn check_timer_clock(clock_id: i32) -> Result<PosixClockID, SystemError> {
+    let clock = PosixClockID::try_from(clock_id)?;
+    match clock {
+        PosixClockID::Realtime | PosixClockID::Monotonic | PosixClockID::Boottime => {
+            return Ok(clock);
+        }
+        _ => return Err(SystemError::EINVAL),
+    }
+}
+
+/// 把时钟`clock`上的绝对时间`abs_ns`换算为单调时间（与[`hrtimer_now`]相同的时间基准）
+pub fn clock_to_monotonic(clock: PosixClockID, abs_ns: u64) -> u64 {
+    let now = hrtimer_now();
+    if clock == PosixClockID::Realtime {
+        let real_now = timespec_to_ns(&getnstimeofday()).unwrap_or(0);
+        return now.saturating_add(abs_ns.saturating_sub(real_now));
+    }
+    return abs_ns;
+}
+
+/// 根据设置计算第一次到期的单调时间，`it_value`为0时返回0（表示停止定时器）
+pub fn itimer_first_expire(
+    clock: PosixClockID,
+    value: &ItimerSpec,
+    abs: bool,
+) -> Result<(u64, u64), SystemError> {
+    let interval = timespec_to_ns(&value.it_interval)?;
+    let first = timespec_to_ns(&value.it_value)?;
+    if first == 0 {
+        return Ok((0, interval));
+    }
+    let expires = if abs {
+        clock_to_monotonic(clock, first)
+    } else {
+        hrtimer_now().saturating_add(first)
+    };
+    // 到期时间为0表示停止，因此至少为1
+    return Ok((expires.max(1), interval));
+}
+
+/// 周期性的定时器在`now`被处理时，计算错过的到期次数和下一次到期的时间
+pub fn itimer_forward(expires: u64, interval: u64, now: u64) -> (u64, u64) {
+    if now < expires {
+        return (0, expires);
+    }
+    let missed = (now - expires) / interval;
+    return (missed, expires + (missed + 1) * interval);
+}
+
+/// POSIX间隔定时器
+#[derive(Debug)]
+pub struct PosixTimer {
+    id: i32,
+    clock: PosixClockID,
+    /// 通知方式（SIGEV_*）
+    notify: i32,
+    signal: Signal,
+    /// 接收信号的线程
+    target: Pid,
+    inner: SpinLock<InnerPosixTimer>,
+    self_ref: Weak<PosixTimer>,
+}
+
+#[derive(Debug)]
+struct InnerPosixTimer {
+    /// 下一次到期的单调时间（单位：纳秒），为0表示定时器没有启动
+    expires: u64,
+    /// 周期（单位：纳秒），为0表示只触发一次
+    interval: u64,
+    /// 时间轮中的定时器
+    timer: Option<Arc<Timer>>,
+    /// 最近一次到期时错过的到期次数
+    overrun: i32,
+    /// 每次重新设置定时器时加一，用于丢弃已经被取出、但是还没有执行的旧的回调
+    generation: u64,
+}
+
+impl PosixTimer {
+    fn new(id: i32, clock: PosixClockID, notify: i32, signal: Signal, target: Pid) -> Arc<Self> {
+        return Arc::new_cyclic(|self_ref| Self {
+            id,
+            clock,
+            notify,
+            signal,
+            target,
+            inner: SpinLock::new(InnerPosixTimer {
+                expires: 0,
+                interval: 0,
+                timer: None,
+                overrun: 0,
+                generation: 0,
+            }),
+            self_ref: self_ref.clone(),
+        });
+    }
+
+    #[allow(dead_code)]
+    pub fn id(&self) -> i32 {
+        return self.id;
+    }
+
+    /// 把定时器加入时间轮，在`inner.expires`到期
+    fn arm(&self, inner: &mut InnerPosixTimer) {
+        // jiffies的单位是微秒，向上取整，保证不会提前到期
+        let delta_us = (inner.expires.saturating_sub(hrtimer_now()) + 999) / 1000;
+        let func = Box::new(PosixTimerFunc {
+            timer: self.self_ref.clone(),
+            generation: inner.generation,
+        });
+        let timer = Timer::new(func, clock() + delta_us);
+        timer.activate();
+        inner.timer = Some(timer);
+    }
+
+    fn disarm(inner: &mut InnerPosixTimer) {
+        inner.generation += 1;
+        inner.expires = 0;
+        inner.overrun = 0;
+        if let Some(timer) = inner.timer.take() {
+            timer.cancel();
+        }
+    }
+
+    /// 设置定时器，返回之前的设置
+    pub fn set(&self, value: &ItimerSpec, abs: bool) -> Result<ItimerSpec, SystemError> {
+        let (expires, interval) = itimer_first_expire(self.clock, value, abs)?;
+        let mut inner = self.inner.lock_irqsave();
+        let old = Self::get_locked(&inner);
+        Self::disarm(&mut inner);
+        inner.interval = interval;
+        if expires != 0 {
+            inner.expires = expires;
+            self.arm(&mut inner);
+        }
+        return Ok(old);
+    }
+
+    /// 获取定时器的剩余时间和周期
+    pub fn get(&self) -> ItimerSpec {
+        return Self::get_locked(&self.inner.lock_irqsave());
+    }
+
+    fn get_locked(inner: &InnerPosixTimer) -> ItimerSpec {
+        let remaining = if inner.expires == 0 {
+            0
+        } else {
+            // 已经到期但是还没有处理时，返回最小的非0值，表示定时器仍在运行
+            inner.expires.saturating_sub(hrtimer_now()).max(1)
+        };
+        return ItimerSpec {
+            it_interval: ns_to_timespec(inner.interval),
+            it_value: ns_to_timespec(remaining),
+        };
+    }
+
+    pub fn overrun(&self) -> i32 {
+        return self.inner.lock_irqsave().overrun;
+    }
+
+    /// 定时器到期
+    fn expire(&self, generation: u64) {
+        let mut inner = self.inner.lock_irqsave();
+        if inner.generation != generation || inner.expires == 0 {
+            return;
+        }
+        inner.timer = None;
+        if inner.interval != 0 {
+            let (missed, next) = itimer_forward(inner.expires, inner.interval, hrtimer_now());
+            inner.overrun = missed.min(i32::MAX as u64) as i32;
+            inner.expires = next;
+            self.arm(&mut inner);
+        } else {
+            inner.overrun = 0;
+            inner.expires = 0;
+        }
+        drop(inner);
+
+        if self.notify == SIGEV_NONE {
+            return;
+        }
+        let mut info = SigInfo::new(self.signal, 0, SigCode::Timer, SigType::Kill(Pid::new(0)));
+        if unlikely(
+            self.signal.send_signal_info(Some(&mut info), self.target) == Err(SystemError::ESRCH),
+        ) {
+            // 接收信号的线程已经退出，停止定时器
+            Self::disarm(&mut self.inner.lock_irqsave());
+        }
+    }
+}
+
+/// 时间轮中的定时器到期时执行的函数
+#[derive(Debug)]
+struct PosixTimerFunc {
+    timer: Weak<PosixTimer>,
+    generation: u64,
+}
+
+impl TimerFunction for PosixTimerFunc {
+    fn run(&mut self) -> Result<(), SystemError> {
+        if let Some(timer) = self.timer.upgrade() {
+            timer.expire(self.generation);
+        }
+        return Ok(());
+    }
+}
+
+/// 进程的POSIX定时器表
+#[derive(Debug, Default)]
+pub struct PosixTimers {
+    timers: HashMap<i32, Arc<PosixTimer>>,
+    next_id: i32,
+}
+
+impl PosixTimers {
+    /// 创建一个定时器，返回它的id
+    pub fn create(
+        &mut self,
+        clock: PosixClockID,
+        event: Option<&SigEvent>,
+        leader: &Arc<ProcessControlBlock>,
+    ) -> Result<i32, SystemError> {
+        if self.timers.len() >= POSIX_TIMER_MAX {
+            return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
+        }
+        let (notify, signal, target) = match event {
+            // 没有指定sigevent时，到期时向进程发送SIGALRM
+            None => (SIGEV_SIGNAL, Signal::SIGALRM, leader.pid()),
+            Some(event) => {
+                let target = match event.sigev_notify {
+                    SIGEV_NONE | SIGEV_SIGNAL | SIGEV_THREAD => leader.pid(),
+                    SIGEV_THREAD_ID => {
+                        // 只能指定同一个线程组中的线程
+                        let tid = Pid::new(event.sigev_notify_thread_id as usize);
+                        let pcb = ProcessManager::find(tid).ok_or(SystemError::EINVAL)?;
+                        if pcb.tgid() != leader.tgid() {
+                            return Err(SystemError::EINVAL);
+                        }
+                        tid
+                    }
+                    _ => return Err(SystemError::EINVAL),
+                };
+                let signal = if event.sigev_notify == SIGEV_NONE {
+                    Signal::SIGALRM
+                } else {
+                    if event.sigev_signo <= 0 {
+                        return Err(SystemError::EINVAL);
+                    }
+                    let signal = Signal::from(event.sigev_signo);
+                    if !signal.is_valid() {
+                        return Err(SystemError::EINVAL);
+                    }
+                    signal
+                };
+                (event.sigev_notify & !SIGEV_THREAD_ID, signal, target)
+            }
+        };
+
+        // 找到一个没有被使用的id
+        while self.timers.contains_key(&self.next_id) {
+            self.next_id = self.next_id.wrapping_add(1).max(0);
+        }
+        let id = self.next_id;
+        self.next_id = self.next_id.wrapping_add(1).max(0);
+        self.timers
+            .insert(id, PosixTimer::new(id, clock, notify, signal, target));
+        return Ok(id);
+    }
+
+    pub fn get(&self, id: i32) -> Result<Arc<PosixTimer>, SystemError> {
+        return self.timers.get(&id).cloned().ok_or(SystemError::EINVAL);
+    }
+
+    /// 删除定时器，删除之后它不会再到期
+    pub fn delete(&mut self, id: i32) -> Result<(), SystemError> {
+        let timer = self.timers.remove(&id).ok_or(SystemError::EINVAL)?;
+        PosixTimer::disarm(&mut timer.inner.lock_irqsave());
+        return Ok(());
+    }
+
+    /// 删除所有定时器（进程退出时调用）
+    pub fn clear(&mut self) {
+        for (_, timer) in self.timers.drain() {
+            PosixTimer::disarm(&mut timer.inner.lock_irqsave());
+        }
+    }
+}
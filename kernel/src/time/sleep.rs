@@ -1,17 +1,16 @@
-use core::{arch::x86_64::_rdtsc, hint::spin_loop};
-
 use alloc::{boxed::Box, sync::Arc};
 
 use crate::{
     arch::{sched::sched, CurrentIrqArch},
     exception::InterruptArch,
-    include::bindings::bindings::{useconds_t, Cpu_tsc_freq},
+    include::bindings::bindings::useconds_t,
     process::ProcessManager,
     syscall::SystemError,
 };
 
 use super::{
-    timer::{next_n_us_timer_jiffies, Timer, WakeUpHelper},
+    hrtimer::{hrtimer_now, HrTimer},
+    timer::{current_timer_slack_ns, WakeUpHelper},
     TimeSpec,
 };
 
@@ -23,43 +22,41 @@ use super::{
 ///
 /// @return Err(SystemError) 错误码
 pub fn nanosleep(sleep_time: TimeSpec) -> Result<TimeSpec, SystemError> {
-    if sleep_time.tv_nsec < 0 || sleep_time.tv_nsec >= 1000000000 {
+    if sleep_time.tv_nsec < 0 || sleep_time.tv_nsec >= 1000000000 || sleep_time.tv_sec < 0 {
         return Err(SystemError::EINVAL);
     }
-    // 对于小于500us的时间，使用spin/rdtsc来进行定时
-
-    if sleep_time.tv_nsec < 500000 {
-        let expired_tsc: u64 =
-            unsafe { _rdtsc() + (sleep_time.tv_nsec as u64 * Cpu_tsc_freq) / 1000000000 };
-        while unsafe { _rdtsc() } < expired_tsc {
-            spin_loop()
-        }
+    let sleep_ns = sleep_time.tv_sec as u64 * 1_000_000_000 + sleep_time.tv_nsec as u64;
+    if sleep_ns == 0 {
         return Ok(TimeSpec {
             tv_sec: 0,
             tv_nsec: 0,
         });
     }
-    // 创建定时器
+
+    // 使用高精度定时器，使得亚毫秒级的休眠也不需要忙等。
+    // 允许在进程的定时器松弛量之内推迟唤醒，与其他定时器合并
     let handler: Box<WakeUpHelper> = WakeUpHelper::new(ProcessManager::current_pcb());
-    let timer: Arc<Timer> = Timer::new(
+    let timer: Arc<HrTimer> = HrTimer::new_range(
         handler,
-        next_n_us_timer_jiffies((sleep_time.tv_nsec / 1000) as u64),
+        hrtimer_now().saturating_add(sleep_ns),
+        current_timer_slack_ns(),
     );
 
     let irq_guard: crate::exception::IrqFlagsGuard =
         unsafe { CurrentIrqArch::save_and_disable_irq() };
     ProcessManager::mark_sleep(true).ok();
-    timer.activate();
+    timer.start();
 
     drop(irq_guard);
 
     sched();
 
-    // TODO: 增加信号唤醒的功能后，返回正确的剩余时间
-
+    // 被提前唤醒（例如被信号唤醒）时，返回剩余的时间
+    timer.cancel();
+    let remaining = timer.expires().saturating_sub(hrtimer_now());
     return Ok(TimeSpec {
-        tv_sec: 0,
-        tv_nsec: 0,
+        tv_sec: (remaining / 1_000_000_000) as i64,
+        tv_nsec: (remaining % 1_000_000_000) as i64,
     });
 }
 
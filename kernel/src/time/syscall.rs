@@ -5,12 +5,25 @@ use core::{
 
 use num_traits::FromPrimitive;
 
+use alloc::sync::Arc;
+
 use crate::{
-    syscall::{user_access::UserBufferWriter, Syscall, SystemError},
-    time::{sleep::nanosleep, TimeSpec},
+    filesystem::vfs::file::{File, FileMode},
+    process::{ProcessControlBlock, ProcessManager},
+    sched::cputime::{ns_to_clock_t, task_cputime},
+    syscall::{
+        user_access::{UserBufferReader, UserBufferWriter},
+        Syscall, SystemError,
+    },
+    time::{hrtimer::hrtimer_now, sleep::nanosleep, TimeSpec},
 };
 
-use super::timekeeping::do_gettimeofday;
+use super::{
+    posix_timer::{check_timer_clock, ns_to_timespec, ItimerSpec, SigEvent, TIMER_ABSTIME},
+    timekeeping::{do_gettimeofday, getnstimeofday},
+    timerfd::TimerFdInode,
+    NSEC_PER_SEC,
+};
 
 pub type PosixTimeT = c_longlong;
 pub type PosixSusecondsT = c_int;
@@ -22,6 +35,16 @@ pub struct PosixTimeval {
     pub tv_usec: PosixSusecondsT,
 }
 
+/// times系统调用返回的进程时间（单位：`USER_HZ`）
+#[repr(C)]
+#[derive(Default, Debug, Copy, Clone)]
+pub struct Tms {
+    pub tms_utime: i64,
+    pub tms_stime: i64,
+    pub tms_cutime: i64,
+    pub tms_cstime: i64,
+}
+
 #[repr(C)]
 #[derive(Default, Debug, Copy, Clone)]
 /// 当前时区信息
@@ -133,21 +156,228 @@ impl Syscall {
         return Ok(0);
     }
 
+    /// 获取指定时钟的时间
+    ///
+    /// 单调时钟与vDSO使用相同的时间基准（[`hrtimer_now`]），使得vDSO回退到系统调用时，结果仍然是一致的
     pub fn clock_gettime(clock_id: c_int, tp: *mut TimeSpec) -> Result<usize, SystemError> {
         let clock_id = PosixClockID::try_from(clock_id)?;
-        if clock_id != PosixClockID::Realtime {
-            kwarn!("clock_gettime: currently only support Realtime clock, but got {:?}. Defaultly return realtime!!!\n", clock_id);
-        }
         if tp.is_null() {
             return Err(SystemError::EFAULT);
         }
         let mut tp_buf =
             UserBufferWriter::new::<TimeSpec>(tp, core::mem::size_of::<TimeSpec>(), true)?;
 
-        let posix_time = do_gettimeofday();
+        let time = match clock_id {
+            PosixClockID::Monotonic
+            | PosixClockID::MonotonicRaw
+            | PosixClockID::MonotonicCoarse
+            | PosixClockID::Boottime => {
+                let ns = hrtimer_now();
+                TimeSpec {
+                    tv_sec: (ns / NSEC_PER_SEC as u64) as i64,
+                    tv_nsec: (ns % NSEC_PER_SEC as u64) as i64,
+                }
+            }
+            PosixClockID::Realtime | PosixClockID::RealtimeCoarse => getnstimeofday(),
+            // 没有线程组，进程的cpu时间就是当前线程的cpu时间
+            PosixClockID::ProcessCPUTimeID | PosixClockID::ThreadCPUTimeID => {
+                ns_to_timespec(task_cputime(&ProcessManager::current_pcb()).total())
+            }
+            _ => {
+                kwarn!(
+                    "clock_gettime: currently not support {:?}. Defaultly return realtime!!!\n",
+                    clock_id
+                );
+                getnstimeofday()
+            }
+        };
+
+        tp_buf.copy_one_to_user(&time, 0)?;
+
+        return Ok(0);
+    }
+
+    /// 获取当前进程及其已经回收的子进程的cpu时间
+    ///
+    /// ## 返回值
+    ///
+    /// 系统启动以来经过的时钟滴答数（单位：`USER_HZ`）。`buf`为空时只返回滴答数
+    pub fn times(buf: *mut Tms) -> Result<usize, SystemError> {
+        if !buf.is_null() {
+            let t = task_cputime(&ProcessManager::current_pcb());
+            let tms = Tms {
+                tms_utime: ns_to_clock_t(t.utime) as i64,
+                tms_stime: ns_to_clock_t(t.stime) as i64,
+                tms_cutime: ns_to_clock_t(t.cutime) as i64,
+                tms_cstime: ns_to_clock_t(t.cstime) as i64,
+            };
+            let mut writer = UserBufferWriter::new(buf, core::mem::size_of::<Tms>(), true)?;
+            writer.copy_one_to_user(&tms, 0)?;
+        }
+        return Ok(ns_to_clock_t(hrtimer_now()) as usize);
+    }
+
+    /// 创建一个POSIX定时器，把它的id写入`timer_id`
+    ///
+    /// `event`为空时，定时器到期时向进程发送SIGALRM
+    pub fn timer_create(
+        clock_id: c_int,
+        event: *const SigEvent,
+        timer_id: *mut i32,
+    ) -> Result<usize, SystemError> {
+        let clock = check_timer_clock(clock_id)?;
+        let event = if event.is_null() {
+            None
+        } else {
+            let reader = UserBufferReader::new(event, core::mem::size_of::<SigEvent>(), true)?;
+            Some(*reader.read_one_from_user::<SigEvent>(0)?)
+        };
+        let mut writer = UserBufferWriter::new(timer_id, core::mem::size_of::<i32>(), true)?;
+
+        let leader = posix_timer_leader();
+        let id = leader
+            .posix_timers()
+            .lock_irqsave()
+            .create(clock, event.as_ref(), &leader)?;
+        // 写入用户空间时可能会缺页，不能持有自旋锁
+        if let Err(e) = writer.copy_one_to_user(&id, 0) {
+            leader.posix_timers().lock_irqsave().delete(id).ok();
+            return Err(e);
+        }
+        return Ok(0);
+    }
+
+    /// 设置POSIX定时器。`old_value`不为空时，写入之前的设置
+    pub fn timer_settime(
+        timer_id: i32,
+        flags: c_int,
+        new_value: *const ItimerSpec,
+        old_value: *mut ItimerSpec,
+    ) -> Result<usize, SystemError> {
+        let value = read_itimerspec(new_value)?;
+        let timer = posix_timer_leader()
+            .posix_timers()
+            .lock_irqsave()
+            .get(timer_id)?;
+        let old = timer.set(&value, flags & TIMER_ABSTIME != 0)?;
+        write_itimerspec(old_value, &old)?;
+        return Ok(0);
+    }
 
-        tp_buf.copy_one_to_user(&posix_time, 0)?;
+    /// 获取POSIX定时器的剩余时间和周期
+    pub fn timer_gettime(timer_id: i32, value: *mut ItimerSpec) -> Result<usize, SystemError> {
+        if value.is_null() {
+            return Err(SystemError::EFAULT);
+        }
+        let timer = posix_timer_leader()
+            .posix_timers()
+            .lock_irqsave()
+            .get(timer_id)?;
+        write_itimerspec(value, &timer.get())?;
+        return Ok(0);
+    }
+
+    /// 获取POSIX定时器上一次发送信号时错过的到期次数
+    pub fn timer_getoverrun(timer_id: i32) -> Result<usize, SystemError> {
+        let timer = posix_timer_leader()
+            .posix_timers()
+            .lock_irqsave()
+            .get(timer_id)?;
+        return Ok(timer.overrun() as usize);
+    }
 
+    /// 删除POSIX定时器
+    pub fn timer_delete(timer_id: i32) -> Result<usize, SystemError> {
+        posix_timer_leader()
+            .posix_timers()
+            .lock_irqsave()
+            .delete(timer_id)?;
         return Ok(0);
     }
+
+    /// 创建一个timerfd，返回它的文件描述符
+    ///
+    /// `flags`只能包含O_NONBLOCK和O_CLOEXEC（与TFD_NONBLOCK、TFD_CLOEXEC的值相同）
+    pub fn timerfd_create(clock_id: c_int, flags: u32) -> Result<usize, SystemError> {
+        let flags = FileMode::from_bits(flags).ok_or(SystemError::EINVAL)?;
+        if !(FileMode::O_NONBLOCK | FileMode::O_CLOEXEC).contains(flags) {
+            return Err(SystemError::EINVAL);
+        }
+        let clock = check_timer_clock(clock_id)?;
+        let inode = TimerFdInode::new(clock, flags.contains(FileMode::O_NONBLOCK));
+        let mut file = File::new(inode, FileMode::O_RDONLY | (flags & FileMode::O_NONBLOCK))?;
+        if flags.contains(FileMode::O_CLOEXEC) {
+            file.set_close_on_exec(true);
+        }
+        let fd = ProcessManager::current_pcb()
+            .fd_table()
+            .write()
+            .alloc_fd(file, None)?;
+        return Ok(fd as usize);
+    }
+
+    /// 设置timerfd的定时器。`old_value`不为空时，写入之前的设置
+    pub fn timerfd_settime(
+        fd: i32,
+        flags: c_int,
+        new_value: *const ItimerSpec,
+        old_value: *mut ItimerSpec,
+    ) -> Result<usize, SystemError> {
+        let value = read_itimerspec(new_value)?;
+        let old = with_timerfd(fd, |timerfd| timerfd.set(&value, flags))?;
+        write_itimerspec(old_value, &old)?;
+        return Ok(0);
+    }
+
+    /// 获取timerfd的定时器的剩余时间和周期
+    pub fn timerfd_gettime(fd: i32, value: *mut ItimerSpec) -> Result<usize, SystemError> {
+        if value.is_null() {
+            return Err(SystemError::EFAULT);
+        }
+        let cur = with_timerfd(fd, |timerfd| Ok(timerfd.get()))?;
+        write_itimerspec(value, &cur)?;
+        return Ok(0);
+    }
+}
+
+/// POSIX定时器属于整个线程组，保存在组长的pcb中
+fn posix_timer_leader() -> Arc<ProcessControlBlock> {
+    let current = ProcessManager::current_pcb();
+    return ProcessManager::find(current.tgid()).unwrap_or(current);
+}
+
+fn read_itimerspec(value: *const ItimerSpec) -> Result<ItimerSpec, SystemError> {
+    if value.is_null() {
+        return Err(SystemError::EFAULT);
+    }
+    let reader = UserBufferReader::new(value, core::mem::size_of::<ItimerSpec>(), true)?;
+    return Ok(*reader.read_one_from_user::<ItimerSpec>(0)?);
+}
+
+/// 把`value`写到用户空间的`dst`，`dst`为空时什么也不做
+fn write_itimerspec(dst: *mut ItimerSpec, value: &ItimerSpec) -> Result<(), SystemError> {
+    if dst.is_null() {
+        return Ok(());
+    }
+    let mut writer = UserBufferWriter::new(dst, core::mem::size_of::<ItimerSpec>(), true)?;
+    writer.copy_one_to_user(value, 0)?;
+    return Ok(());
+}
+
+/// 对文件描述符`fd`对应的timerfd执行`f`。`fd`不是timerfd时返回EINVAL
+fn with_timerfd<T>(
+    fd: i32,
+    f: impl FnOnce(&TimerFdInode) -> Result<T, SystemError>,
+) -> Result<T, SystemError> {
+    let file = ProcessManager::current_pcb()
+        .fd_table()
+        .read()
+        .get_file_by_fd(fd)
+        .ok_or(SystemError::EBADF)?;
+    let inode = file.lock().inode();
+    let timerfd = inode
+        .as_any_ref()
+        .downcast_ref::<TimerFdInode>()
+        .ok_or(SystemError::EINVAL)?;
+    return f(timerfd);
 }
@@ -2,10 +2,13 @@ use alloc::sync::Arc;
 use core::sync::atomic::{compiler_fence, AtomicBool, AtomicI64, Ordering};
 
 use crate::{
-    arch::CurrentIrqArch,
+    arch::{
+        vdso::{vdso_sync_wall_time, vdso_update_time},
+        CurrentIrqArch,
+    },
     exception::InterruptArch,
     kdebug, kinfo,
-    libs::rwlock::RwLock,
+    libs::{rwlock::RwLock, seqlock::SeqLock},
     time::{jiffies::clocksource_default_clock, timekeep::ktime_get_real_ns, TimeSpec},
 };
 
@@ -31,13 +34,18 @@ static __ADDED_SEC: AtomicI64 = AtomicI64::new(0);
 static mut __TIMEKEEPER: Option<Timekeeper> = None;
 
 #[derive(Debug)]
-pub struct Timekeeper(RwLock<TimekeeperData>);
+pub struct Timekeeper {
+    /// 计时数据。只在时钟中断、初始化等少数地方写入，读者不加锁
+    data: SeqLock<TimekeeperData>,
+    /// 用于计时的当前时钟源。只在切换时钟源时修改
+    ///
+    /// 顺序锁的读者可能读到不一致的数据，不能从中克隆Arc，因此时钟源单独保存
+    clock: RwLock<Option<Arc<dyn Clocksource>>>,
+}
 
 #[allow(dead_code)]
-#[derive(Debug)]
+#[derive(Debug, Clone, Copy)]
 pub struct TimekeeperData {
-    /// 用于计时的当前时钟源。
-    clock: Option<Arc<dyn Clocksource>>,
     /// 当前时钟源的移位值。
     shift: i32,
     /// 一个NTP间隔中的时钟周期数。
@@ -64,7 +72,6 @@ pub struct TimekeeperData {
 impl TimekeeperData {
     pub fn new() -> Self {
         Self {
-            clock: None,
             shift: Default::default(),
             cycle_interval: CycleNum(0),
             xtime_interval: Default::default(),
@@ -100,25 +107,29 @@ impl Timekeeper {
     ///
     /// * 'clock' - 指定的时钟实际类型。初始为ClocksourceJiffies
     pub fn timekeeper_setup_internals(&self, clock: Arc<dyn Clocksource>) {
-        let mut timekeeper = self.0.write();
         // 更新clock
         let mut clock_data = clock.clocksource_data();
         clock_data.watchdog_last = clock.read();
         if clock.update_clocksource_data(clock_data).is_err() {
             kdebug!("timekeeper_setup_internals:update_clocksource_data run failed");
         }
-        timekeeper.clock.replace(clock.clone());
+        self.clock.write_irqsave().replace(clock.clone());
+        let mut timekeeper = self.data.write_irqsave();
 
         let clock_data = clock.clocksource_data();
         let mut temp = NTP_INTERVAL_LENGTH << clock_data.shift;
         let ntpinterval = temp;
         temp += (clock_data.mult / 2) as u64;
-        // do div
+        // 一个NTP间隔对应的时钟周期数（四舍五入）
+        temp /= clock_data.mult as u64;
+        if temp == 0 {
+            temp = 1;
+        }
 
         timekeeper.cycle_interval = CycleNum(temp);
         timekeeper.xtime_interval = temp * clock_data.mult as u64;
-        // 这里可能存在下界溢出问题，debug模式下会报错panic
-        timekeeper.xtime_remainder = (ntpinterval - timekeeper.xtime_interval) as i64;
+        // 四舍五入之后，xtime_interval可能比ntpinterval大
+        timekeeper.xtime_remainder = ntpinterval as i64 - timekeeper.xtime_interval as i64;
         timekeeper.raw_interval = (timekeeper.xtime_interval >> clock_data.shift) as i64;
         timekeeper.xtime_nsec = 0;
         timekeeper.shift = clock_data.shift as i32;
@@ -132,8 +143,7 @@ impl Timekeeper {
     /// # 获取当前时钟源距离上次检测走过的纳秒数
     #[allow(dead_code)]
     pub fn tk_get_ns(&self) -> u64 {
-        let timekeeper = self.0.read();
-        let clock = timekeeper.clock.clone().unwrap();
+        let clock = self.clock.read().clone().unwrap();
         let clock_now = clock.read();
         let clcok_data = clock.clocksource_data();
         let clock_delta = clock_now.div(clcok_data.watchdog_last).data() & clcok_data.mask.bits();
@@ -147,7 +157,12 @@ pub fn timekeeper() -> &'static Timekeeper {
 }
 
 pub fn timekeeper_init() {
-    unsafe { __TIMEKEEPER = Some(Timekeeper(RwLock::new(TimekeeperData::new()))) };
+    unsafe {
+        __TIMEKEEPER = Some(Timekeeper {
+            data: SeqLock::new(TimekeeperData::new()),
+            clock: RwLock::new(None),
+        })
+    };
 }
 
 /// # 获取1970.1.1至今的UTC时间戳(最小单位:nsec)
@@ -159,24 +174,19 @@ pub fn getnstimeofday() -> TimeSpec {
     // kdebug!("enter getnstimeofday");
 
     // let mut nsecs: u64 = 0;0
-    let mut _xtime = TimeSpec {
-        tv_nsec: 0,
-        tv_sec: 0,
-    };
-    loop {
-        match timekeeper().0.try_read() {
-            None => continue,
-            Some(tk) => {
-                _xtime = tk.xtime;
-                drop(tk);
-                // nsecs = timekeeper().tk_get_ns();
-                // TODO 不同架构可能需要加上不同的偏移量
-                break;
-            }
+    // xtime与__ADDED_SEC需要一起读取：同步时间时，两者在同一个写者临界区内被修改
+    let tk = timekeeper();
+    let (mut _xtime, sec) = loop {
+        let seq = tk.data.read_begin();
+        let xtime = tk.data.read().xtime;
+        let sec = __ADDED_SEC.load(Ordering::SeqCst);
+        if !tk.data.read_retry(seq) {
+            break (xtime, sec);
         }
-    }
+    };
+    // nsecs = timekeeper().tk_get_ns();
+    // TODO 不同架构可能需要加上不同的偏移量
     // xtime.tv_nsec += nsecs as i64;
-    let sec = __ADDED_SEC.load(Ordering::SeqCst);
     _xtime.tv_sec += sec;
     while _xtime.tv_nsec >= NSEC_PER_SEC.into() {
         _xtime.tv_nsec -= NSEC_PER_SEC as i64;
@@ -215,7 +225,7 @@ pub fn timekeeping_init() {
         .expect("clocksource_default_clock enable failed");
     timekeeper().timekeeper_setup_internals(clock);
     // 暂时不支持其他架构平台对时间的设置 所以使用x86平台对应值初始化
-    let mut timekeeper = timekeeper().0.write();
+    let mut timekeeper = timekeeper().data.write_irqsave();
     timekeeper.xtime.tv_nsec = ktime_get_real_ns();
 
     // 初始化wall time到monotonic的时间
@@ -230,6 +240,7 @@ pub fn timekeeping_init() {
 
     __ADDED_USEC.store(0, Ordering::SeqCst);
     __ADDED_SEC.store(0, Ordering::SeqCst);
+    drop(timekeeper);
 
     drop(irq_guard);
     kinfo!("timekeeping_init successfully");
@@ -284,14 +295,13 @@ pub fn update_wall_time() {
                 .is_ok()
                 || retry == 0
             {
-                // 同步时间
-                // 我感觉这里会出问题：多个读者不退出的话，写者就无法写入
-                // 然后这里会超时，导致在中断返回之后，会不断的进入这个中断，最终爆栈。
-                let mut timekeeper = timekeeper().0.write_irqsave();
+                // 同步时间。读者不加锁，写者不需要等待读者离开
+                let mut timekeeper = timekeeper().data.write_irqsave();
                 timekeeper.xtime.tv_nsec = ktime_get_real_ns();
                 timekeeper.xtime.tv_sec = 0;
                 __ADDED_SEC.store(0, Ordering::SeqCst);
                 drop(timekeeper);
+                vdso_sync_wall_time(getnstimeofday());
                 break;
             }
             retry -= 1;
@@ -300,6 +310,7 @@ pub fn update_wall_time() {
         }
     }
     // TODO 需要检查是否更新时间源
+    vdso_update_time();
     compiler_fence(Ordering::SeqCst);
     drop(irq_guard);
     compiler_fence(Ordering::SeqCst);
@@ -1,13 +1,13 @@
 use core::{
     fmt::Debug,
     intrinsics::unlikely,
-    sync::atomic::{compiler_fence, AtomicBool, AtomicU64, Ordering},
+    sync::atomic::{compiler_fence, AtomicU64, Ordering},
 };
 
 use alloc::{
     boxed::Box,
-    collections::LinkedList,
     sync::{Arc, Weak},
+    vec::Vec,
 };
 
 use crate::{
@@ -18,18 +18,270 @@ use crate::{
     },
     kerror, kinfo,
     libs::spinlock::SpinLock,
+    mm::percpu::PerCpu,
     process::{ProcessControlBlock, ProcessManager},
+    sched::{isolation::tick_nohz_full_restart, SchedPolicy},
+    smp::core::smp_get_processor_id,
     syscall::SystemError,
 };
 
 use super::timekeeping::update_wall_time;
 
 const MAX_TIMEOUT: i64 = i64::MAX;
-const TIMER_RUN_CYCLE_THRESHOLD: usize = 20;
 static TIMER_JIFFIES: AtomicU64 = AtomicU64::new(0);
 
-lazy_static! {
-    pub static ref TIMER_LIST: SpinLock<LinkedList<Arc<Timer>>> = SpinLock::new(LinkedList::new());
+/// 时间轮的最小刻度为`1 << WHEEL_GRAN_SHIFT`个jiffies（512微秒，与HPET中断的间隔相当）
+const WHEEL_GRAN_SHIFT: u32 = 9;
+/// 第一层时间轮的槽数的位数
+const TVR_BITS: u32 = 8;
+/// 其余各层时间轮的槽数的位数
+const TVN_BITS: u32 = 6;
+const TVR_SIZE: usize = 1 << TVR_BITS;
+const TVN_SIZE: usize = 1 << TVN_BITS;
+const TVR_MASK: u64 = TVR_SIZE as u64 - 1;
+const TVN_MASK: u64 = TVN_SIZE as u64 - 1;
+/// 除第一层以外的时间轮的层数
+const TVN_LEVELS: usize = 4;
+/// 时间轮能表示的最远的到期时间（单位：刻度）
+const WHEEL_MAX_OFFSET: u64 = (1 << (TVR_BITS + TVN_BITS * TVN_LEVELS as u32)) - 1;
+/// 定时器不在任何时间轮中
+const TIMER_POS_NONE: u64 = u64::MAX;
+/// 进程默认的定时器松弛量（单位：纳秒），与Linux相同
+pub const DEFAULT_TIMER_SLACK_NS: u64 = 50_000;
+
+/// 每个cpu的时间轮。第一次在这个cpu上激活定时器时才分配
+static TIMER_WHEELS: [SpinLock<Option<TimerWheel>>; PerCpu::MAX_CPU_NUM] =
+    [const { SpinLock::new(None) }; PerCpu::MAX_CPU_NUM];
+/// 每个cpu的时间轮中最早的到期时间的下界（单位：jiffies，u64::MAX表示没有定时器），读取时不需要加锁
+static TIMER_NEXT_EXPIRE: [AtomicU64; PerCpu::MAX_CPU_NUM] =
+    [const { AtomicU64::new(u64::MAX) }; PerCpu::MAX_CPU_NUM];
+
+/// 时间轮的一个槽：到期时间（单位：jiffies）和定时器
+type TimerSlot = Vec<(u64, Arc<Timer>)>;
+
+/// 分层的时间轮（与早期的Linux相同）
+///
+/// 第一层有256个槽，每个槽对应一个刻度；之后每一层有64个槽，每个槽对应上一层转一圈的时间。
+/// 插入和取消定时器都只需要访问一个槽。时间轮每转过第一层的一圈，就把下一层的一个槽中的定时器
+/// 重新分配（cascade）到上一层。
+///
+/// 每一层都有一个位图记录哪些槽非空，查找最早的到期时间时只需要查找位图，
+/// 并且只遍历找到的槽中的定时器（参考Linux的`__next_timer_interrupt`）。
+struct TimerWheel {
+    /// 时间轮当前的刻度：到期时间在这之前的定时器都已经处理过了
+    clk: u64,
+    /// 第一层，TVR_SIZE个槽
+    tv1: Vec<TimerSlot>,
+    /// 其余TVN_LEVELS层，每层TVN_SIZE个槽
+    tvn: Vec<Vec<TimerSlot>>,
+    /// 第一层中非空的槽的位图
+    tv1_bitmap: [u64; TVR_SIZE / 64],
+    /// 其余各层中非空的槽的位图
+    tvn_bitmap: [u64; TVN_LEVELS],
+    /// 时间轮中的定时器的数量
+    nr_timers: usize,
+}
+
+impl TimerWheel {
+    fn new() -> Self {
+        return Self {
+            clk: 0,
+            tv1: (0..TVR_SIZE).map(|_| Vec::new()).collect(),
+            tvn: (0..TVN_LEVELS)
+                .map(|_| (0..TVN_SIZE).map(|_| Vec::new()).collect())
+                .collect(),
+            tv1_bitmap: [0; TVR_SIZE / 64],
+            tvn_bitmap: [0; TVN_LEVELS],
+            nr_timers: 0,
+        };
+    }
+
+    /// 把jiffies换算为刻度。到期时间向上取整，保证定时器不会提前触发
+    #[inline(always)]
+    fn expire_to_clk(expire_jiffies: u64) -> u64 {
+        return (expire_jiffies + (1 << WHEEL_GRAN_SHIFT) - 1) >> WHEEL_GRAN_SHIFT;
+    }
+
+    /// 把定时器放入它的到期时间对应的槽中，返回槽的位置（层数，槽号）
+    fn enqueue(&mut self, expire_jiffies: u64, timer: Arc<Timer>) -> (usize, usize) {
+        let expires = Self::expire_to_clk(expire_jiffies).max(self.clk);
+        let offset = (expires - self.clk).min(WHEEL_MAX_OFFSET);
+        let expires = self.clk + offset;
+        let pos = if offset < TVR_SIZE as u64 {
+            (0, (expires & TVR_MASK) as usize)
+        } else {
+            let mut level = 1;
+            while offset >= 1 << (TVR_BITS + TVN_BITS * level as u32) {
+                level += 1;
+            }
+            let shift = TVR_BITS + TVN_BITS * (level as u32 - 1);
+            (level, ((expires >> shift) & TVN_MASK) as usize)
+        };
+        self.slot(pos).push((expire_jiffies, timer));
+        *self.bitmap_word(pos) |= 1 << (pos.1 % 64);
+        return pos;
+    }
+
+    /// 槽`(level, index)`在位图中所在的字
+    #[inline(always)]
+    fn bitmap_word(&mut self, (level, index): (usize, usize)) -> &mut u64 {
+        if level == 0 {
+            return &mut self.tv1_bitmap[index / 64];
+        }
+        return &mut self.tvn_bitmap[level - 1];
+    }
+
+    /// 取出一个槽中的所有定时器
+    #[inline(always)]
+    fn take_slot(&mut self, pos: (usize, usize)) -> TimerSlot {
+        *self.bitmap_word(pos) &= !(1 << (pos.1 % 64));
+        return core::mem::take(self.slot(pos));
+    }
+
+    /// 从槽`pos`中删除定时器`timer`，返回是否找到了它
+    fn remove(&mut self, pos: (usize, usize), timer: *const Timer) -> bool {
+        let slot = self.slot(pos);
+        let i = match slot.iter().position(|(_, t)| Arc::as_ptr(t) == timer) {
+            Some(i) => i,
+            None => return false,
+        };
+        slot.swap_remove(i);
+        if slot.is_empty() {
+            *self.bitmap_word(pos) &= !(1 << (pos.1 % 64));
+        }
+        self.nr_timers -= 1;
+        return true;
+    }
+
+    #[inline(always)]
+    fn slot(&mut self, (level, index): (usize, usize)) -> &mut TimerSlot {
+        if level == 0 {
+            return &mut self.tv1[index];
+        }
+        return &mut self.tvn[level - 1][index];
+    }
+
+    /// 把第`level`层（从1开始）的当前槽中的定时器重新分配到更低的层，返回当前槽号
+    fn cascade(&mut self, cpu_id: u32, level: usize) -> usize {
+        let shift = TVR_BITS + TVN_BITS * (level as u32 - 1);
+        let index = ((self.clk >> shift) & TVN_MASK) as usize;
+        let timers = self.take_slot((level, index));
+        for (expire, timer) in timers {
+            let pos = self.enqueue(expire, timer.clone());
+            timer.set_pos(cpu_id, pos);
+        }
+        return index;
+    }
+
+    /// 推进时间轮，取出所有到期的定时器
+    fn expire(&mut self, cpu_id: u32, now: u64, expired: &mut Vec<Arc<Timer>>) {
+        let now_clk = now >> WHEEL_GRAN_SHIFT;
+        while self.clk <= now_clk {
+            // 没有定时器时，直接跳到当前的刻度（例如cpu长时间处于NO_HZ idle之后）
+            if self.nr_timers == 0 {
+                self.clk = now_clk + 1;
+                break;
+            }
+            let index = (self.clk & TVR_MASK) as usize;
+            if index == 0 {
+                let mut level = 1;
+                while level <= TVN_LEVELS && self.cascade(cpu_id, level) == 0 {
+                    level += 1;
+                }
+            }
+            for (_, timer) in self.take_slot((0, index)) {
+                timer.pos.store(TIMER_POS_NONE, Ordering::SeqCst);
+                self.nr_timers -= 1;
+                expired.push(timer);
+            }
+            self.clk += 1;
+        }
+    }
+
+    /// 时间轮中最早的到期时间（单位：jiffies）
+    ///
+    /// 每一层中的槽按照从当前槽开始的顺序，对应的时间依次增加，因此只需要找到每一层中
+    /// 第一个非空的槽。如果找到的槽在这一层转完当前这一圈之前，并且更高一层的当前槽已经
+    /// 重新分配过了，那么更高的层中的定时器都不会更早到期，可以直接返回。
+    fn next_expire(&self) -> u64 {
+        if self.nr_timers == 0 {
+            return u64::MAX;
+        }
+
+        let mut next = u64::MAX;
+        // 第一层中，尚未处理的槽从当前刻度对应的槽开始
+        let start = (self.clk & TVR_MASK) as usize;
+        if let Some((index, wrapped)) = Self::find_slot_from(&self.tv1_bitmap, start) {
+            next = Self::slot_next_expire(&self.tv1[index]);
+            if !wrapped && !self.cascade_pending(1) {
+                return next;
+            }
+        }
+
+        for level in 1..=TVN_LEVELS {
+            // 其余各层中，当前槽已经被重新分配过了（除非下一个刻度才重新分配它），从下一个槽开始
+            let shift = TVR_BITS + TVN_BITS * (level as u32 - 1);
+            let mut start = ((self.clk >> shift) & TVN_MASK) as usize;
+            if !self.cascade_pending(level) {
+                start += 1;
+            }
+            let bitmap = core::slice::from_ref(&self.tvn_bitmap[level - 1]);
+            if let Some((index, wrapped)) = Self::find_slot_from(bitmap, start) {
+                next = next.min(Self::slot_next_expire(&self.tvn[level - 1][index]));
+                if !wrapped && (level == TVN_LEVELS || !self.cascade_pending(level + 1)) {
+                    break;
+                }
+            }
+        }
+        return next;
+    }
+
+    /// 第`level`层（从1开始）的当前槽是否还没有被重新分配（时间轮处理下一个刻度时才会重新分配它）
+    #[inline(always)]
+    fn cascade_pending(&self, level: usize) -> bool {
+        let shift = TVR_BITS + TVN_BITS * (level as u32 - 1);
+        return self.clk & ((1 << shift) - 1) == 0;
+    }
+
+    /// 从第`start`个槽开始（到达末尾后回到开头）查找第一个非空的槽
+    ///
+    /// ## 返回值
+    ///
+    /// 槽号，以及查找时是否回到了开头
+    fn find_slot_from(bitmap: &[u64], start: usize) -> Option<(usize, bool)> {
+        if let Some(index) = Self::find_next_bit(bitmap, start) {
+            return Some((index, false));
+        }
+        return Self::find_next_bit(bitmap, 0).map(|index| (index, true));
+    }
+
+    /// 查找位图中第一个不小于`start`的置位的位
+    fn find_next_bit(bitmap: &[u64], start: usize) -> Option<usize> {
+        let mut word = start / 64;
+        if word >= bitmap.len() {
+            return None;
+        }
+        let mut bits = bitmap[word] & (!0u64 << (start % 64));
+        loop {
+            if bits != 0 {
+                return Some(word * 64 + bits.trailing_zeros() as usize);
+            }
+            word += 1;
+            if word == bitmap.len() {
+                return None;
+            }
+            bits = bitmap[word];
+        }
+    }
+
+    #[inline(always)]
+    fn slot_next_expire(slot: &TimerSlot) -> u64 {
+        return slot
+            .iter()
+            .map(|(expire, _)| *expire)
+            .min()
+            .unwrap_or(u64::MAX);
+    }
 }
 
 /// 定时器要执行的函数的特征
@@ -57,7 +309,12 @@ impl TimerFunction for WakeUpHelper {
 }
 
 #[derive(Debug)]
-pub struct Timer(SpinLock<InnerTimer>);
+pub struct Timer {
+    inner: SpinLock<InnerTimer>,
+    /// 定时器在时间轮中的位置（所在的cpu、层数、槽号），不在时间轮中时为TIMER_POS_NONE。
+    /// 只在所在的cpu的时间轮的锁的保护下修改
+    pos: AtomicU64,
+}
 
 impl Timer {
     /// @brief 创建一个定时器（单位：ms）
@@ -68,52 +325,55 @@ impl Timer {
     ///
     /// @return 定时器结构体
     pub fn new(timer_func: Box<dyn TimerFunction>, expire_jiffies: u64) -> Arc<Self> {
-        let result: Arc<Timer> = Arc::new(Timer(SpinLock::new(InnerTimer {
-            expire_jiffies,
-            timer_func,
-            self_ref: Weak::default(),
-            triggered: false,
-        })));
-
-        result.0.lock().self_ref = Arc::downgrade(&result);
+        let result: Arc<Timer> = Arc::new(Timer {
+            inner: SpinLock::new(InnerTimer {
+                expire_jiffies,
+                timer_func,
+                self_ref: Weak::default(),
+                triggered: false,
+            }),
+            pos: AtomicU64::new(TIMER_POS_NONE),
+        });
+
+        result.inner.lock().self_ref = Arc::downgrade(&result);
 
         return result;
     }
 
-    /// @brief 将定时器插入到定时器链表中
+    /// @brief 将定时器插入到当前cpu的时间轮中
     pub fn activate(&self) {
-        let inner_guard = self.0.lock();
-        let timer_list = &mut TIMER_LIST.lock();
-
-        // 链表为空，则直接插入
-        if timer_list.is_empty() {
-            // FIXME push_timer
-
-            timer_list.push_back(inner_guard.self_ref.upgrade().unwrap());
-
-            drop(inner_guard);
-            drop(timer_list);
-            compiler_fence(Ordering::SeqCst);
+        let inner_guard = self.inner.lock_irqsave();
+        let expire_jiffies = inner_guard.expire_jiffies;
+        let timer = inner_guard.self_ref.upgrade().unwrap();
+        drop(inner_guard);
 
-            return;
+        let cpu_id = smp_get_processor_id();
+        let mut wheel_guard = TIMER_WHEELS[cpu_id as usize].lock_irqsave();
+        let wheel = wheel_guard.get_or_insert_with(TimerWheel::new);
+        // 时间轮为空时，它的刻度可能已经落后了很多，直接对齐到当前时间
+        if wheel.nr_timers == 0 {
+            wheel.clk = clock() >> WHEEL_GRAN_SHIFT;
         }
-        let mut split_pos: usize = 0;
-        for (pos, elt) in timer_list.iter().enumerate() {
-            if elt.0.lock().expire_jiffies > inner_guard.expire_jiffies {
-                split_pos = pos;
-                break;
-            }
+        let pos = wheel.enqueue(expire_jiffies, timer);
+        wheel.nr_timers += 1;
+        self.set_pos(cpu_id, pos);
+        let next = TIMER_NEXT_EXPIRE[cpu_id as usize].fetch_min(expire_jiffies, Ordering::SeqCst);
+        drop(wheel_guard);
+        // nohz_full的cpu停止时钟中断时，没有考虑到这个更早到期的定时器
+        if expire_jiffies < next {
+            tick_nohz_full_restart();
         }
-        let mut temp_list: LinkedList<Arc<Timer>> = timer_list.split_off(split_pos);
-        timer_list.push_back(inner_guard.self_ref.upgrade().unwrap());
-        timer_list.append(&mut temp_list);
-        drop(inner_guard);
-        drop(timer_list);
+    }
+
+    #[inline(always)]
+    fn set_pos(&self, cpu_id: u32, (level, index): (usize, usize)) {
+        let pos = ((cpu_id as u64) << 32) | ((level as u64) << 16) | index as u64;
+        self.pos.store(pos, Ordering::SeqCst);
     }
 
     #[inline]
     fn run(&self) {
-        let mut timer = self.0.lock();
+        let mut timer = self.inner.lock_irqsave();
         timer.triggered = true;
         let r = timer.timer_func.run();
         if unlikely(r.is_err()) {
@@ -126,15 +386,39 @@ impl Timer {
 
     /// ## 判断定时器是否已经触发
     pub fn timeout(&self) -> bool {
-        self.0.lock().triggered
+        self.inner.lock_irqsave().triggered
     }
 
     /// ## 取消定时器任务
+    ///
+    /// 返回定时器是否还在时间轮中（即取消之前还没有触发）
     pub fn cancel(&self) -> bool {
-        TIMER_LIST
-            .lock()
-            .drain_filter(|x| Arc::<Timer>::as_ptr(&x) == self as *const Timer);
-        true
+        loop {
+            let pos = self.pos.load(Ordering::SeqCst);
+            if pos == TIMER_POS_NONE {
+                return false;
+            }
+            // 在加锁之前，定时器可能已经触发，并且被重新激活到其他cpu的时间轮中，
+            // 因此加锁之后需要确认它仍然在这个cpu的时间轮中，否则重试
+            let cpu_id = (pos >> 32) as usize;
+            let mut wheel_guard = TIMER_WHEELS[cpu_id].lock_irqsave();
+            let pos = self.pos.load(Ordering::SeqCst);
+            if pos == TIMER_POS_NONE {
+                return false;
+            }
+            if (pos >> 32) as usize != cpu_id {
+                continue;
+            }
+            let wheel = wheel_guard.as_mut().unwrap();
+            let removed = wheel.remove(
+                (((pos >> 16) & 0xffff) as usize, (pos & 0xffff) as usize),
+                self as *const Timer,
+            );
+            if removed {
+                self.pos.store(TIMER_POS_NONE, Ordering::SeqCst);
+            }
+            return removed;
+        }
     }
 }
 
@@ -152,75 +436,42 @@ pub struct InnerTimer {
 }
 
 #[derive(Debug)]
-pub struct DoTimerSoftirq {
-    running: AtomicBool,
-}
+pub struct DoTimerSoftirq;
 
 impl DoTimerSoftirq {
     pub fn new() -> Self {
-        return DoTimerSoftirq {
-            running: AtomicBool::new(false),
-        };
-    }
-
-    fn set_run(&self) -> bool {
-        let x = self
-            .running
-            .compare_exchange(false, true, Ordering::Acquire, Ordering::Relaxed);
-        if x.is_ok() {
-            return true;
-        } else {
-            return false;
-        }
-    }
-
-    fn clear_run(&self) {
-        self.running.store(false, Ordering::Release);
+        return DoTimerSoftirq;
     }
 }
+
 impl SoftirqVec for DoTimerSoftirq {
     fn run(&self) {
-        if self.set_run() == false {
-            return;
-        }
-        // 最多只处理TIMER_RUN_CYCLE_THRESHOLD个计时器
-        for _ in 0..TIMER_RUN_CYCLE_THRESHOLD {
-            // kdebug!("DoTimerSoftirq run");
-            let timer_list = TIMER_LIST.try_lock();
-            if timer_list.is_err() {
-                continue;
-            }
-            let mut timer_list = timer_list.unwrap();
+        run_local_timers();
+    }
+}
 
-            if timer_list.is_empty() {
-                break;
-            }
+/// 执行当前cpu的时间轮中所有到期的定时器
+fn run_local_timers() {
+    let cpu_id = smp_get_processor_id();
+    let mut expired = Vec::new();
+    let mut wheel_guard = TIMER_WHEELS[cpu_id as usize].lock_irqsave();
+    if let Some(wheel) = wheel_guard.as_mut() {
+        wheel.expire(cpu_id, clock(), &mut expired);
+        TIMER_NEXT_EXPIRE[cpu_id as usize].store(wheel.next_expire(), Ordering::SeqCst);
+    }
+    drop(wheel_guard);
 
-            let timer_list_front = timer_list.pop_front().unwrap();
-            // kdebug!("to lock timer_list_front");
-            let mut timer_list_front_guard = None;
-            for _ in 0..10 {
-                let x = timer_list_front.0.try_lock();
-                if x.is_err() {
-                    continue;
-                }
-                timer_list_front_guard = Some(x.unwrap());
-            }
-            if timer_list_front_guard.is_none() {
-                continue;
-            }
-            let timer_list_front_guard = timer_list_front_guard.unwrap();
-            if timer_list_front_guard.expire_jiffies > TIMER_JIFFIES.load(Ordering::SeqCst) {
-                drop(timer_list_front_guard);
-                timer_list.push_front(timer_list_front);
-                break;
-            }
-            drop(timer_list_front_guard);
-            drop(timer_list);
-            timer_list_front.run();
-        }
+    // 定时器函数可能会重新激活定时器，因此需要在放锁之后执行
+    for timer in expired {
+        timer.run();
+    }
+}
 
-        self.clear_run();
+/// 时钟中断时调用：如果当前cpu的时间轮中有到期的定时器，触发定时器软中断
+pub fn timer_tick() {
+    let cpu_id = smp_get_processor_id() as usize;
+    if TIMER_NEXT_EXPIRE[cpu_id].load(Ordering::SeqCst) <= clock() {
+        softirq_vectors().raise_softirq(SoftirqNumber::TIMER);
     }
 }
 
@@ -243,6 +494,37 @@ pub fn next_n_us_timer_jiffies(expire_us: u64) -> u64 {
     return TIMER_JIFFIES.load(Ordering::SeqCst) + (expire_us);
 }
 
+/// 当前进程的定时器松弛量（单位：纳秒）
+///
+/// 实时进程对唤醒的时刻很敏感，不允许推迟它们的定时器
+pub fn current_timer_slack_ns() -> u64 {
+    let pcb = ProcessManager::current_pcb();
+    let sched_info = pcb.sched_info();
+    if matches!(sched_info.policy(), SchedPolicy::FIFO | SchedPolicy::RR) {
+        return 0;
+    }
+    return sched_info.timer_slack_ns();
+}
+
+/// 在当前进程的定时器松弛量允许的范围内推迟到期时间（单位：jiffies），使到期时间相近的定时器合并到同一时刻触发
+///
+/// 与Linux的apply_slack()相同：在`[expire_jiffies, expire_jiffies + slack]`中选取低位连续为0的位数最多的时刻，
+/// 这样不同进程的定时器即使到期时间略有不同，也会落在时间轮的同一个槽中，由一次软中断一起处理。
+pub fn apply_timer_slack(expire_jiffies: u64) -> u64 {
+    // jiffies的单位是微秒
+    let slack = current_timer_slack_ns() / 1000;
+    if slack == 0 {
+        return expire_jiffies;
+    }
+    let limit = expire_jiffies.saturating_add(slack);
+    let mask = expire_jiffies ^ limit;
+    if mask == 0 {
+        return expire_jiffies;
+    }
+    let bit = 63 - mask.leading_zeros();
+    return limit & !((1u64 << bit) - 1);
+}
+
 /// @brief 让pcb休眠timeout个jiffies
 ///
 /// @param timeout 需要休眠的时间(单位：jiffies)
@@ -266,7 +548,7 @@ pub fn schedule_timeout(mut timeout: i64) -> Result<i64, SystemError> {
         timeout += TIMER_JIFFIES.load(Ordering::SeqCst) as i64;
         let timer = Timer::new(
             WakeUpHelper::new(ProcessManager::current_pcb()),
-            timeout as u64,
+            apply_timer_slack(timeout as u64),
         );
         ProcessManager::mark_sleep(true).ok();
         timer.activate();
@@ -284,26 +566,13 @@ pub fn schedule_timeout(mut timeout: i64) -> Result<i64, SystemError> {
     }
 }
 
+/// 获取当前cpu上最早到期的定时器的到期时间（的下界），没有定时器时返回0
 pub fn timer_get_first_expire() -> Result<u64, SystemError> {
-    // FIXME
-    // kdebug!("rs_timer_get_first_expire,timer_jif = {:?}", TIMER_JIFFIES);
-    for _ in 0..10 {
-        match TIMER_LIST.try_lock_irqsave() {
-            Ok(timer_list) => {
-                // kdebug!("rs_timer_get_first_expire TIMER_LIST lock successfully");
-                if timer_list.is_empty() {
-                    // kdebug!("timer_list is empty");
-                    return Ok(0);
-                } else {
-                    // kdebug!("timer_list not empty");
-                    return Ok(timer_list.front().unwrap().0.lock().expire_jiffies);
-                }
-            }
-            // 加锁失败返回啥？？
-            Err(_) => continue,
-        }
+    let expire = TIMER_NEXT_EXPIRE[smp_get_processor_id() as usize].load(Ordering::SeqCst);
+    if expire == u64::MAX {
+        return Ok(0);
     }
-    return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
+    return Ok(expire);
 }
 
 /// 更新系统时间片
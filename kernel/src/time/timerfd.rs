@@ -0,0 +1,273 @@
+//! timerfd：以文件描述符的形式提供的定时器
+//!
+//! 定时器每到期一次，计数就加一。读取时返回这段时间内的到期次数（8字节的u64），并把计数清零；
+//! 计数为0时读取会阻塞（或者以非阻塞方式打开时返回EAGAIN），poll在计数不为0时报告可读。
+//! 因此可以与其他文件描述符一起在事件循环中等待。
+//!
+//! 定时器基于[`HrTimer`]实现，到期时只修改计数、唤醒读者，可以在硬中断上下文中执行。
+
+use alloc::{
+    boxed::Box,
+    string::String,
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+
+use crate::{
+    arch::{sched::sched, CurrentIrqArch},
+    exception::InterruptArch,
+    filesystem::vfs::{
+        core::generate_inode_id, file::FileMode, poll::PollTable, syscall::ModeType,
+        FilePrivateData, FileSystem, FileType, IndexNode, Metadata, PollStatus,
+    },
+    libs::{spinlock::SpinLock, wait_queue::WaitQueue},
+    process::{ProcessManager, ProcessState},
+    syscall::SystemError,
+};
+
+use super::{
+    hrtimer::{hrtimer_now, HrTimer},
+    posix_timer::{itimer_first_expire, itimer_forward, ns_to_timespec, ItimerSpec},
+    syscall::PosixClockID,
+    timer::TimerFunction,
+    TimeSpec,
+};
+
+/// timerfd_settime的flags：`it_value`是绝对时间
+pub const TFD_TIMER_ABSTIME: i32 = 1;
+/// timerfd_settime的flags：实时时钟被修改时取消定时器（目前不支持修改实时时钟，因此忽略）
+pub const TFD_TIMER_CANCEL_ON_SET: i32 = 2;
+
+/// timerfd的inode
+#[derive(Debug)]
+pub struct TimerFdInode {
+    clock: PosixClockID,
+    /// 计数为0时，读取是否直接返回EAGAIN
+    nonblock: bool,
+    inner: SpinLock<InnerTimerFd>,
+    /// 等待定时器到期的读者
+    wait_queue: Arc<WaitQueue>,
+    metadata: Metadata,
+    self_ref: Weak<TimerFdInode>,
+}
+
+#[derive(Debug)]
+struct InnerTimerFd {
+    /// 下一次到期的单调时间（单位：纳秒），为0表示定时器没有启动
+    expires: u64,
+    /// 周期（单位：纳秒），为0表示只触发一次
+    interval: u64,
+    timer: Option<Arc<HrTimer>>,
+    /// 上次读取以来到期的次数
+    ticks: u64,
+    /// 每次重新设置定时器时加一，用于丢弃旧的回调
+    generation: u64,
+}
+
+impl TimerFdInode {
+    pub fn new(clock: PosixClockID, nonblock: bool) -> Arc<Self> {
+        let metadata = Metadata {
+            dev_id: 0,
+            inode_id: generate_inode_id(),
+            size: 0,
+            blk_size: 0,
+            blocks: 0,
+            atime: TimeSpec::default(),
+            mtime: TimeSpec::default(),
+            ctime: TimeSpec::default(),
+            file_type: FileType::File,
+            mode: ModeType::from_bits_truncate(0o600),
+            nlinks: 1,
+            uid: 0,
+            gid: 0,
+            raw_dev: 0,
+        };
+        return Arc::new_cyclic(|self_ref| Self {
+            clock,
+            nonblock,
+            inner: SpinLock::new(InnerTimerFd {
+                expires: 0,
+                interval: 0,
+                timer: None,
+                ticks: 0,
+                generation: 0,
+            }),
+            wait_queue: Arc::new(WaitQueue::INIT),
+            metadata,
+            self_ref: self_ref.clone(),
+        });
+    }
+
+    fn arm(&self, inner: &mut InnerTimerFd) {
+        let func = Box::new(TimerFdFunc {
+            inode: self.self_ref.clone(),
+            generation: inner.generation,
+        });
+        let timer = HrTimer::new(func, inner.expires);
+        timer.start();
+        inner.timer = Some(timer);
+    }
+
+    fn disarm(inner: &mut InnerTimerFd) {
+        inner.generation += 1;
+        inner.expires = 0;
+        if let Some(timer) = inner.timer.take() {
+            timer.cancel();
+        }
+    }
+
+    /// 设置定时器，返回之前的设置。到期计数被清零
+    pub fn set(&self, value: &ItimerSpec, flags: i32) -> Result<ItimerSpec, SystemError> {
+        if flags & !(TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET) != 0 {
+            return Err(SystemError::EINVAL);
+        }
+        let (expires, interval) =
+            itimer_first_expire(self.clock, value, flags & TFD_TIMER_ABSTIME != 0)?;
+        let mut inner = self.inner.lock_irqsave();
+        let old = Self::get_locked(&inner);
+        Self::disarm(&mut inner);
+        inner.ticks = 0;
+        inner.interval = interval;
+        if expires != 0 {
+            inner.expires = expires;
+            self.arm(&mut inner);
+        }
+        return Ok(old);
+    }
+
+    /// 获取定时器的剩余时间和周期
+    pub fn get(&self) -> ItimerSpec {
+        return Self::get_locked(&self.inner.lock_irqsave());
+    }
+
+    fn get_locked(inner: &InnerTimerFd) -> ItimerSpec {
+        let remaining = if inner.expires == 0 {
+            0
+        } else {
+            inner.expires.saturating_sub(hrtimer_now()).max(1)
+        };
+        return ItimerSpec {
+            it_interval: ns_to_timespec(inner.interval),
+            it_value: ns_to_timespec(remaining),
+        };
+    }
+
+    /// 定时器到期（在硬中断上下文中执行）
+    fn expire(&self, generation: u64) {
+        let mut inner = self.inner.lock_irqsave();
+        if inner.generation != generation || inner.expires == 0 {
+            return;
+        }
+        inner.timer = None;
+        if inner.interval != 0 {
+            let (missed, next) = itimer_forward(inner.expires, inner.interval, hrtimer_now());
+            inner.ticks = inner.ticks.saturating_add(missed + 1);
+            inner.expires = next;
+            self.arm(&mut inner);
+        } else {
+            inner.ticks = inner.ticks.saturating_add(1);
+            inner.expires = 0;
+        }
+        drop(inner);
+        self.wait_queue
+            .wakeup_all(Some(ProcessState::Blocked(true)));
+    }
+}
+
+/// 高精度定时器到期时执行的函数
+#[derive(Debug)]
+struct TimerFdFunc {
+    inode: Weak<TimerFdInode>,
+    generation: u64,
+}
+
+impl TimerFunction for TimerFdFunc {
+    fn run(&mut self) -> Result<(), SystemError> {
+        if let Some(inode) = self.inode.upgrade() {
+            inode.expire(self.generation);
+        }
+        return Ok(());
+    }
+}
+
+impl IndexNode for TimerFdInode {
+    fn open(&self, _data: &mut FilePrivateData, _mode: &FileMode) -> Result<(), SystemError> {
+        return Ok(());
+    }
+
+    fn close(&self, _data: &mut FilePrivateData) -> Result<(), SystemError> {
+        Self::disarm(&mut self.inner.lock_irqsave());
+        return Ok(());
+    }
+
+    /// 读取上次读取以来的到期次数
+    fn read_at(
+        &self,
+        _offset: usize,
+        len: usize,
+        buf: &mut [u8],
+        _data: &mut FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        if len < core::mem::size_of::<u64>() || buf.len() < len {
+            return Err(SystemError::EINVAL);
+        }
+        loop {
+            // 到期的回调在硬中断中执行，因此需要关中断之后再检查计数并睡眠，避免错过唤醒
+            let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+            let mut inner = self.inner.lock();
+            if inner.ticks != 0 {
+                let ticks = core::mem::take(&mut inner.ticks);
+                buf[..core::mem::size_of::<u64>()].copy_from_slice(&ticks.to_ne_bytes());
+                return Ok(core::mem::size_of::<u64>());
+            }
+            if self.nonblock {
+                return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
+            }
+            unsafe { self.wait_queue.sleep_without_schedule() };
+            drop(inner);
+            drop(irq_guard);
+            sched();
+
+            if ProcessManager::current_pcb().has_pending_signal() {
+                return Err(SystemError::ERESTARTSYS);
+            }
+        }
+    }
+
+    fn write_at(
+        &self,
+        _offset: usize,
+        _len: usize,
+        _buf: &[u8],
+        _data: &mut FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        return Err(SystemError::EINVAL);
+    }
+
+    fn poll(&self) -> Result<PollStatus, SystemError> {
+        if self.inner.lock_irqsave().ticks != 0 {
+            return Ok(PollStatus::READ);
+        }
+        return Ok(PollStatus::empty());
+    }
+
+    fn poll_wait(&self, table: &mut PollTable) {
+        table.wait(&self.wait_queue);
+    }
+
+    fn metadata(&self) -> Result<Metadata, SystemError> {
+        return Ok(self.metadata.clone());
+    }
+
+    fn as_any_ref(&self) -> &dyn core::any::Any {
+        self
+    }
+
+    fn fs(&self) -> Arc<dyn FileSystem> {
+        todo!("timerfd is not in any filesystem")
+    }
+
+    fn list(&self) -> Result<Vec<String>, SystemError> {
+        return Err(SystemError::ENOTDIR);
+    }
+}
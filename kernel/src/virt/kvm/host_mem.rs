@@ -108,7 +108,7 @@ fn __gfn_to_memslot(slots: KvmMemorySlots, gfn: u64) -> Option<KvmMemorySlot> {
     return None;
 }
 
-fn __gfn_to_hva(slot: KvmMemorySlot, gfn: u64) -> u64 {
+pub fn __gfn_to_hva(slot: KvmMemorySlot, gfn: u64) -> u64 {
     return slot.userspace_addr + (gfn - slot.base_gfn) * (PAGE_SIZE as u64);
 }
 fn __gfn_to_hva_many(
@@ -185,6 +185,28 @@ pub fn __gfn_to_pfn(
     return Ok(pfn);
 }
 
+/// 如果从`hva`开始的`npages`个页面（`npages`是2的幂）映射在一段连续、并且按`npages`个页面对齐的物理内存上，
+/// 返回这段物理内存的起始pfn，否则返回None
+///
+/// 与`hva_to_pfn`不同，这里只查询已有的映射，不会为没有映射的页面分配内存
+pub fn hva_range_to_pfn(hva: u64, npages: u64) -> Option<u64> {
+    let mapper = KernelMapper::lock();
+    let mapper = mapper.as_ref();
+    let (base, _) = mapper.translate(VirtAddr::new(hva as usize))?;
+    let base_pfn = base.data() as u64 >> PAGE_SHIFT;
+    if base_pfn & (npages - 1) != 0 {
+        return None;
+    }
+    for i in 1..npages {
+        let hva = VirtAddr::new((hva + i * PAGE_SIZE as u64) as usize);
+        let (hpa, _) = mapper.translate(hva)?;
+        if hpa.data() as u64 >> PAGE_SHIFT != base_pfn + i {
+            return None;
+        }
+    }
+    return Some(base_pfn);
+}
+
 pub fn kvm_vcpu_gfn_to_memslot(vcpu: &mut dyn Vcpu, gfn: u64) -> Option<KvmMemorySlot> {
     return __gfn_to_memslot(kvm_vcpu_memslots(vcpu), gfn);
 }
@@ -6,7 +6,7 @@ use crate::filesystem::vfs::{
     IndexNode, Metadata, PollStatus,
 };
 use crate::mm::VirtAddr;
-use crate::syscall::user_access::copy_from_user;
+use crate::syscall::user_access::{copy_from_user, copy_to_user};
 use crate::virt::kvm::vcpu::Vcpu;
 use crate::virt::kvm::vm;
 use crate::{filesystem, kdebug};
@@ -21,6 +21,10 @@ use alloc::{
 pub const KVM_RUN: u32 = 0x00;
 // pub const KVM_GET_REGS: u32 = 0x01;
 pub const KVM_SET_REGS: u32 = 0x02;
+/// 获取vcpu按退出原因分类的VM退出次数和处理花费的周期数，参数指向一个`[VmxExitStat; VMX_EXIT_REASON_NUM]`数组
+pub const KVM_GET_EXIT_STATS: u32 = 0x03;
+/// 向vcpu注入一个外部中断，参数指向中断向量号（u32），会唤醒在HLT上睡眠的vcpu
+pub const KVM_INTERRUPT: u32 = 0x04;
 
 // pub const GUEST_STACK_SIZE:usize = 1024;
 // pub const HOST_STACK_SIZE:usize = 0x1000 * 6;
@@ -182,6 +186,39 @@ impl IndexNode for LockedVcpuInode {
 
                 Ok(0)
             }
+            KVM_GET_EXIT_STATS => {
+                let vcpu = vm(0).unwrap().vcpu[0].clone();
+                let stats = vcpu.lock().exit_stats.snapshot();
+                unsafe {
+                    copy_to_user(
+                        VirtAddr::new(data),
+                        core::slice::from_raw_parts(
+                            stats.as_ptr() as *const u8,
+                            core::mem::size_of_val(&stats),
+                        ),
+                    )?;
+                }
+                Ok(0)
+            }
+            KVM_INTERRUPT => {
+                let mut irq: u32 = 0;
+                unsafe {
+                    copy_from_user(
+                        core::slice::from_raw_parts_mut(
+                            (&mut irq as *mut u32) as *mut u8,
+                            core::mem::size_of::<u32>(),
+                        ),
+                        VirtAddr::new(data),
+                    )?;
+                }
+                if irq > u8::MAX as u32 {
+                    return Err(SystemError::EINVAL);
+                }
+                let vcpu = vm(0).unwrap().vcpu[0].clone();
+                let halt = vcpu.lock().halt.clone();
+                halt.kick(irq as u8);
+                Ok(0)
+            }
             _ => {
                 kdebug!("kvm_cpu ioctl");
                 Ok(usize::MAX)
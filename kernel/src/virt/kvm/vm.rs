@@ -23,6 +23,8 @@ pub struct Vm {
     // memory config
     pub nr_mem_slots: u32, /* Number of memory slots in each address space */
     pub memslots: [KvmMemorySlots; KVM_ADDRESS_SPACE_NUM],
+    /// 是否在vcpu加载EPT页表时预先映射全部内存，而不是等guest访问时逐页映射
+    pub prefault: bool,
     // arch related config
     pub arch: KVMArch,
 }
@@ -37,6 +39,7 @@ impl Vm {
             vcpu,
             nr_mem_slots: KVM_MEM_SLOTS_NUM,
             memslots: [KvmMemorySlots::default(); KVM_ADDRESS_SPACE_NUM],
+            prefault: false,
             arch: Default::default(),
         };
         Ok(instance)
@@ -32,6 +32,8 @@ pub const KVM_GET_DIRTY_LOG: u32 = 0x02;
 pub const KVM_IRQFD: u32 = 0x03;
 pub const KVM_IOEVENTFD: u32 = 0x04;
 pub const KVM_IRQ_LINE_STATUS: u32 = 0x05;
+/// 设置是否预先映射虚拟机的全部内存，参数不为0时开启
+pub const KVM_SET_PREFAULT: u32 = 0x06;
 
 //  #[derive(Debug)]
 //  pub struct InodeInfo {
@@ -172,6 +174,12 @@ impl IndexNode for LockedVmInode {
                 update_vm(0, current_vm);
                 Ok(0)
             }
+            KVM_SET_PREFAULT => {
+                let mut current_vm = vm(0).unwrap();
+                current_vm.prefault = data != 0;
+                update_vm(0, current_vm);
+                Ok(0)
+            }
             KVM_GET_DIRTY_LOG | KVM_IRQFD | KVM_IOEVENTFD | KVM_IRQ_LINE_STATUS => {
                 Err(SystemError::EOPNOTSUPP_OR_ENOTSUP)
             }
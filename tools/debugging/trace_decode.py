@@ -0,0 +1,118 @@
+# 解析DragonOS的/proc/trace，按时间顺序输出所有cpu上的事件
+#
+# 用法：
+#   (DragonOS) echo sched,irq > /proc/trace
+#   (DragonOS) ...运行要观察的程序...
+#   (DragonOS) cat /proc/trace > /trace.bin
+#   (主机)     python3 tools/debugging/trace_decode.py trace.bin
+#
+# 文件格式见kernel/crates/klog_types/src/lib.rs中的TraceFileHeader
+import argparse
+import heapq
+import struct
+import sys
+
+TRACE_MAGIC = 0x43525444
+TRACE_VERSION = 1
+
+FILE_HEADER = struct.Struct('<IHHIIQ')
+CPU_HEADER = struct.Struct('<IIQ')
+RECORD = struct.Struct('<QHHIQQ')
+
+CLASS_NAMES = ['sched', 'irq', 'softirq', 'mm', 'block', 'net', 'syscall']
+
+BLOCK_WRITE = 1 << 63
+
+
+def fmt_block(a0, a1):
+    op = 'W' if a1 & BLOCK_WRITE else 'R'
+    return 'lba=%d count=%d %s' % (a0, a1 & ~BLOCK_WRITE, op)
+
+
+def fmt_ret(a0, a1):
+    ret = a1 - (1 << 64) if a1 & (1 << 63) else a1
+    return 'nr=%d ret=%d' % (a0, ret)
+
+
+# 事件号 -> (名字, 参数的格式化函数)
+EVENTS = {
+    1: ('sched_switch', lambda a0, a1: 'prev=%d next=%d' % (a0, a1)),
+    2: ('sched_wakeup', lambda a0, a1: 'pid=%d' % a0),
+    3: ('irq_entry', lambda a0, a1: 'vector=%d' % a0),
+    4: ('irq_exit', lambda a0, a1: 'vector=%d' % a0),
+    5: ('softirq_entry', lambda a0, a1: 'nr=%d' % a0),
+    6: ('softirq_exit', lambda a0, a1: 'nr=%d' % a0),
+    7: ('page_fault', lambda a0, a1: 'addr=%#x flags=%#x' % (a0, a1)),
+    8: ('block_rq_issue', fmt_block),
+    9: ('block_rq_complete', fmt_block),
+    10: ('net_rx', lambda a0, a1: 'len=%d ethertype=%#06x' % (a0, a1)),
+    11: ('net_tx', lambda a0, a1: 'len=%d ethertype=%#06x' % (a0, a1)),
+    12: ('syscall_enter', lambda a0, a1: 'nr=%d arg0=%#x' % (a0, a1)),
+    13: ('syscall_exit', fmt_ret),
+}
+
+
+def parse(data):
+    if len(data) < FILE_HEADER.size:
+        sys.exit('trace file is too short')
+    magic, version, record_size, nr_cpus, enabled, tsc_khz = FILE_HEADER.unpack_from(
+        data, 0)
+    if magic != TRACE_MAGIC:
+        sys.exit('bad magic: %#x' % magic)
+    if version != TRACE_VERSION or record_size != RECORD.size:
+        sys.exit('unsupported trace version %d (record size %d)' %
+                 (version, record_size))
+
+    off = FILE_HEADER.size
+    cpus = []
+    for _ in range(nr_cpus):
+        if off + CPU_HEADER.size > len(data):
+            break
+        cpu, nr_records, lost = CPU_HEADER.unpack_from(data, off)
+        off += CPU_HEADER.size
+        records = []
+        for _ in range(nr_records):
+            if off + RECORD.size > len(data):
+                break
+            records.append(RECORD.unpack_from(data, off))
+            off += RECORD.size
+        cpus.append((cpu, lost, records))
+    return enabled, tsc_khz, cpus
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Decode the binary trace read from /proc/trace of DragonOS')
+    parser.add_argument('file', type=str, help='trace file')
+    parser.add_argument('--cpu', type=int, default=None,
+                        help='only show events on this cpu')
+    args = parser.parse_args()
+
+    with open(args.file, 'rb') as f:
+        data = f.read()
+    enabled, tsc_khz, cpus = parse(data)
+
+    classes = [n for i, n in enumerate(CLASS_NAMES) if enabled & (1 << i)]
+    print('# enabled: %s' % (','.join(classes) if classes else 'none'))
+    for cpu, lost, records in cpus:
+        print('# cpu %d: %d records, %d lost' % (cpu, len(records), lost))
+
+    streams = [records for cpu, _, records in cpus
+               if args.cpu is None or cpu == args.cpu]
+    # 每个cpu的记录已经按时间排好序，归并即可
+    merged = list(heapq.merge(*streams, key=lambda r: r[0]))
+    if not merged:
+        return
+    base = merged[0][0]
+    for time, event, cpu, pid, a0, a1 in merged:
+        if tsc_khz:
+            ts = '%.6f' % ((time - base) / tsc_khz / 1000.0)
+        else:
+            ts = '%d' % (time - base)
+        name, fmt = EVENTS.get(event, ('unknown_%d' % event,
+                                      lambda a0, a1: '%#x %#x' % (a0, a1)))
+        print('%14s [%03d] %6d %-18s %s' % (ts, cpu, pid, name, fmt(a0, a1)))
+
+
+if __name__ == '__main__':
+    main()
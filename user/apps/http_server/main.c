@@ -1,22 +1,75 @@
 #include <arpa/inet.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #define PORT 12580
 #define MAX_REQUEST_SIZE 1500
-#define MAX_RESPONSE_SIZE 1500
+#define MAX_HEADER_SIZE 512
 // 网页根目录
 #define WEB_ROOT "/wwwroot/First-WebPage-On-DragonOS"
 #define EXIT_CODE 1
-#define min(a, b) ((a) < (b) ? (a) : (b))
 
 #define DEFAULT_PAGE "/index.html"
 
+// 默认的工作进程数量，可以通过第一个命令行参数修改
+#define DEFAULT_WORKERS 4
+#define MAX_WORKERS 64
+// listen的backlog
+#define LISTEN_BACKLOG 1024
+// 每个工作进程最多同时处理的连接数（按文件描述符索引）
+#define MAX_CONNS 4096
+#define MAX_EVENTS 256
+// 每次sendfile最多发送的字节数，避免一个大文件长时间占用事件循环
+#define SENDFILE_CHUNK (1 << 20)
+
+#define BODY_400 "<html><body><h1>400 Bad Request</h1><p>DragonOS Http Server</p></body></html>"
+#define BODY_403 "<html><body><h1>403 Forbidden</h1><p>DragonOS Http Server</p></body></html>"
+#define BODY_404 "<html><body><h1>404 Not Found</h1><p>DragonOS Http Server</p></body></html>"
+#define BODY_501 "<html><body><h1>501 Not Implemented</h1><p>DragonOS Http Server</p></body></html>"
+
+/**
+ * @brief 一个客户端连接的状态
+ *
+ * 连接在读取请求和发送响应两个阶段之间切换。响应由头部（以及错误页面的正文）和可选的文件组成，
+ * 头部用writev发送，文件用sendfile发送。发送不完时等待EPOLLOUT，发送完后如果保持连接，
+ * 就继续处理缓冲区中流水线发来的下一个请求
+ */
+struct conn
+{
+    int fd;
+    // 已收到、还未处理的请求数据
+    char req[MAX_REQUEST_SIZE];
+    size_t req_len;
+    // 待发送的响应头部
+    char header[MAX_HEADER_SIZE];
+    size_t header_len;
+    size_t header_off;
+    // 待发送的正文：错误页面是静态字符串，普通文件通过sendfile发送
+    const char *body;
+    size_t body_len;
+    size_t body_off;
+    int file_fd;
+    off_t file_off;
+    size_t file_remaining;
+    // 响应发送完之后是否保持连接
+    int keep_alive;
+    // 正在发送响应
+    int sending;
+};
+
+static struct conn *conns[MAX_CONNS];
+static int epfd;
+
 int security_check(char *path)
 {
     // 检查路径是否包含 ..
@@ -27,173 +80,378 @@ int security_check(char *path)
     return 1;
 }
 
-ssize_t send_response(int sockfd, char *response)
+static const char *content_type_of(const char *path)
 {
-    return write(sockfd, response, strlen(response));
-}
-
-void send_header(int sockfd, int content_length, char *path)
-{
-    char buffer[MAX_RESPONSE_SIZE];
-    // 获取文件类型
-    char *content_type;
     if (strstr(path, ".html"))
     {
-        content_type = "text/html";
+        return "text/html";
     }
     else if (strstr(path, ".css"))
     {
-        content_type = "text/css";
+        return "text/css";
     }
     else if (strstr(path, ".js"))
     {
-        content_type = "application/javascript";
+        return "application/javascript";
     }
     else if (strstr(path, ".png"))
     {
-        content_type = "image/png";
+        return "image/png";
     }
     else if (strstr(path, ".jpg"))
     {
-        content_type = "image/jpeg";
+        return "image/jpeg";
     }
     else if (strstr(path, ".gif"))
     {
-        content_type = "image/gif";
+        return "image/gif";
     }
-    else
-    {
-        content_type = "text/plain;charset=utf-8";
-    }
-    sprintf(buffer, "HTTP/1.1 200 OK\nContent-Type: %s\nContent-Length: %d\n\n", content_type, content_length);
-    send_response(sockfd, buffer);
+    return "text/plain;charset=utf-8";
 }
 
-void send_file(int sockfd, char *path)
+static int set_nonblock(int fd)
 {
-    printf("send_file: path: %s\n", path);
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0)
+        return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
 
-    int fd = open(path, 0);
-    if (fd == -1)
-    {
-        send_response(
-            sockfd,
-            "HTTP/1.1 404 Not Found\nContent-Type: text/html\n\n<html><body><h1>404 Not Found</h1><p>DragonOS Http Server</p></body></html>");
-        return;
-    }
+static int epoll_update(int fd, int op, uint32_t events)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    return epoll_ctl(epfd, op, fd, &ev);
+}
 
-    int content_length = lseek(fd, 0, SEEK_END);
-    int remaining = content_length;
-    printf("send_file: content_length: %d\n", content_length);
-    lseek(fd, 0, SEEK_SET);
-    send_header(sockfd, content_length, path);
+static void conn_close(struct conn *c)
+{
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    if (c->file_fd >= 0)
+        close(c->file_fd);
+    close(c->fd);
+    conns[c->fd] = NULL;
+    free(c);
+}
 
-    char buffer[1048576];
-    int readSize;
-    while (remaining)
-    {
-        // 由于磁盘IO耗时较长，所以每次读取1MB，然后再分批发送
-        int to_read = min(1048576, remaining);
-        readSize = read(fd, &buffer, to_read);
+static void set_header(struct conn *c, const char *status, const char *content_type, size_t content_length)
+{
+    c->header_len = snprintf(c->header, MAX_HEADER_SIZE,
+                             "HTTP/1.1 %s\r\nServer: DragonOS\r\nContent-Type: %s\r\nContent-Length: %lu\r\n"
+                             "Connection: %s\r\n\r\n",
+                             status, content_type, (unsigned long)content_length,
+                             c->keep_alive ? "keep-alive" : "close");
+    c->header_off = 0;
+    c->sending = 1;
+}
 
-        remaining -= readSize;
-        void *p = buffer;
-        while (readSize > 0)
-        {
-            int wsize = write(sockfd, p, min(readSize, MAX_RESPONSE_SIZE));
-            if (wsize <= 0)
-            {
-                printf("send_file failed: wsize: %d\n", wsize);
-                close(fd);
-                return;
-            }
-            p += wsize;
-            readSize -= wsize;
-        }
+static void prepare_error(struct conn *c, const char *status, const char *body)
+{
+    c->body = body;
+    c->body_len = strlen(body);
+    c->body_off = 0;
+    set_header(c, status, "text/html", c->body_len);
+}
+
+static void prepare_file(struct conn *c, char *path)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        if (fd >= 0)
+            close(fd);
+        prepare_error(c, "404 Not Found", BODY_404);
+        return;
     }
+    c->file_fd = fd;
+    c->file_off = 0;
+    c->file_remaining = st.st_size;
+    set_header(c, "200 OK", content_type_of(path), st.st_size);
+}
 
-    close(fd);
+/**
+ * @brief 判断请求头部（已转换为小写）中是否存在给定的Connection取值
+ */
+static int connection_is(const char *headers, const char *value)
+{
+    const char *p = strstr(headers, "\nconnection:");
+    if (p == NULL)
+        return 0;
+    p += strlen("\nconnection:");
+    while (*p == ' ')
+        p++;
+    return strncmp(p, value, strlen(value)) == 0;
 }
 
-void handle_request(int sockfd, char *request)
+/**
+ * @brief 处理一个完整的请求，准备好要发送的响应
+ *
+ * @param request 以'\0'结尾的请求头部
+ */
+static void handle_request(struct conn *c, char *request)
 {
     char *method, *url, *http_version;
-    char path[MAX_REQUEST_SIZE];
+    char path[MAX_REQUEST_SIZE + sizeof(WEB_ROOT) + sizeof(DEFAULT_PAGE)];
+
+    char *headers = strstr(request, "\r\n");
+    if (headers != NULL)
+    {
+        *headers = '\0';
+        headers++;
+        for (char *p = headers; *p; p++)
+        {
+            if (*p >= 'A' && *p <= 'Z')
+                *p += 'a' - 'A';
+        }
+    }
 
     method = strtok(request, " ");
     url = strtok(NULL, " ");
-    http_version = strtok(NULL, "\r\n");
-    
-    printf("handle_request: method: %s, url: %s, http_version: %s\n", method, url, http_version);
+    http_version = strtok(NULL, " ");
+
     // 检查空指针等异常情况
-    if (method == NULL || url == NULL || http_version == NULL)
+    if (method == NULL || url == NULL || http_version == NULL || strlen(url) == 0)
     {
-        send_response(sockfd, "HTTP/1.1 400 Bad Request\nContent-Type: text/html\n\n<html><body><h1>400 Bad "
-                              "Request</h1><p>DragonOS Http Server</p></body></html>");
+        c->keep_alive = 0;
+        prepare_error(c, "400 Bad Request", BODY_400);
         return;
     }
-    // 检查url是否为空
-    if (strlen(url) == 0)
+
+    // HTTP/1.1默认保持连接，HTTP/1.0默认关闭连接
+    if (strcmp(http_version, "HTTP/1.1") == 0)
+        c->keep_alive = headers == NULL || !connection_is(headers, "close");
+    else
+        c->keep_alive = headers != NULL && connection_is(headers, "keep-alive");
+
+    if (strcmp(method, "GET") != 0)
     {
-        send_response(sockfd, "HTTP/1.1 400 Bad Request\nContent-Type: text/html\n\n<html><body><h1>400 Bad "
-                              "Request</h1><p>DragonOS Http Server</p></body></html>");
+        prepare_error(c, "501 Not Implemented", BODY_501);
         return;
     }
-    int default_page = 0;
+
     if (url[strlen(url) - 1] == '/')
     {
-        default_page = 1;
+        sprintf(path, "%s%s%s", WEB_ROOT, url, DEFAULT_PAGE);
+    }
+    else
+    {
+        sprintf(path, "%s%s", WEB_ROOT, url);
+    }
+    if (!security_check(path))
+    {
+        prepare_error(c, "403 Forbidden", BODY_403);
+        return;
     }
+    prepare_file(c, path);
+}
 
-    if (strcmp(method, "GET") == 0)
+/**
+ * @brief 尽可能多地发送响应
+ *
+ * @return 1：响应已发送完；0：socket缓冲区已满，需要等待EPOLLOUT；-1：连接出错
+ */
+static int send_response(struct conn *c)
+{
+    while (c->header_off < c->header_len || c->body_off < c->body_len)
     {
-        if (default_page)
+        struct iovec iov[2];
+        int iovcnt = 0;
+        if (c->header_off < c->header_len)
+        {
+            iov[iovcnt].iov_base = c->header + c->header_off;
+            iov[iovcnt].iov_len = c->header_len - c->header_off;
+            iovcnt++;
+        }
+        if (c->body_off < c->body_len)
         {
-            sprintf(path, "%s%s%s", WEB_ROOT, url, DEFAULT_PAGE);
+            iov[iovcnt].iov_base = (void *)(c->body + c->body_off);
+            iov[iovcnt].iov_len = c->body_len - c->body_off;
+            iovcnt++;
+        }
+        ssize_t n = writev(c->fd, iov, iovcnt);
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+
+        size_t header_left = c->header_len - c->header_off;
+        if ((size_t)n <= header_left)
+        {
+            c->header_off += n;
         }
         else
         {
-            sprintf(path, "%s%s", WEB_ROOT, url);
+            c->header_off = c->header_len;
+            c->body_off += n - header_left;
         }
-        if (!security_check(path))
+    }
+
+    while (c->file_remaining > 0)
+    {
+        size_t count = c->file_remaining < SENDFILE_CHUNK ? c->file_remaining : SENDFILE_CHUNK;
+        ssize_t n = sendfile(c->fd, c->file_fd, &c->file_off, count);
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        if (n == 0)
+            return -1;
+        c->file_remaining -= n;
+    }
+
+    if (c->file_fd >= 0)
+    {
+        close(c->file_fd);
+        c->file_fd = -1;
+    }
+    c->body = NULL;
+    c->body_len = c->body_off = 0;
+    c->sending = 0;
+    return 1;
+}
+
+/**
+ * @brief 处理缓冲区中所有完整的请求，直到缓冲区中没有完整的请求或者响应没能一次发送完
+ */
+static void process_requests(struct conn *c)
+{
+    while (!c->sending)
+    {
+        c->req[c->req_len] = '\0';
+        char *end = strstr(c->req, "\r\n\r\n");
+        if (end == NULL)
         {
-            send_response(
-                sockfd,
-                "HTTP/1.1 403 Forbidden\nContent-Type: text/html\n\n<html><body><h1>403 Forbidden</h1><p>DragonOS Http Server</p></body></html>");
+            if (c->req_len == MAX_REQUEST_SIZE - 1)
+            {
+                // 请求头部太长
+                c->keep_alive = 0;
+                c->req_len = 0;
+                prepare_error(c, "400 Bad Request", BODY_400);
+                break;
+            }
             return;
         }
-        send_file(sockfd, path);
+        end[2] = '\0';
+        size_t consumed = end + 4 - c->req;
+        handle_request(c, c->req);
+        c->req_len -= consumed;
+        memmove(c->req, c->req + consumed, c->req_len);
     }
-    else
+
+    int ret = send_response(c);
+    if (ret < 0 || (ret == 1 && !c->keep_alive))
     {
-        send_response(sockfd, "HTTP/1.1 501 Not Implemented\nContent-Type: text/html\n\n<html><body><h1>501 Not "
-                              "Implemented</h1><p>DragonOS Http Server</p></body></html>");
+        conn_close(c);
+        return;
+    }
+    if (ret == 0)
+    {
+        // 等待socket可写后继续发送，在此期间不再读取新的请求
+        epoll_update(c->fd, EPOLL_CTL_MOD, EPOLLOUT);
+        return;
     }
+    epoll_update(c->fd, EPOLL_CTL_MOD, EPOLLIN);
+    // 流水线中可能还有已经收到的请求
+    if (c->req_len > 0)
+        process_requests(c);
 }
 
-int main(int argc, char const *argv[])
+static void on_readable(struct conn *c)
 {
-    int server_fd, new_socket, valread;
+    while (1)
+    {
+        ssize_t n = read(c->fd, c->req + c->req_len, MAX_REQUEST_SIZE - 1 - c->req_len);
+        if (n == 0)
+        {
+            conn_close(c);
+            return;
+        }
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            conn_close(c);
+            return;
+        }
+        c->req_len += n;
+        if (c->req_len == MAX_REQUEST_SIZE - 1)
+            break;
+    }
+    process_requests(c);
+}
+
+static void on_writable(struct conn *c)
+{
+    int ret = send_response(c);
+    if (ret < 0 || (ret == 1 && !c->keep_alive))
+    {
+        conn_close(c);
+        return;
+    }
+    if (ret == 1)
+    {
+        epoll_update(c->fd, EPOLL_CTL_MOD, EPOLLIN);
+        if (c->req_len > 0)
+            process_requests(c);
+    }
+}
+
+static void accept_all(int server_fd)
+{
+    while (1)
+    {
+        int fd = accept(server_fd, NULL, NULL);
+        if (fd < 0)
+            return;
+        if (fd >= MAX_CONNS || set_nonblock(fd) < 0)
+        {
+            close(fd);
+            continue;
+        }
+        struct conn *c = malloc(sizeof(struct conn));
+        if (c == NULL)
+        {
+            close(fd);
+            continue;
+        }
+        memset(c, 0, sizeof(struct conn));
+        c->fd = fd;
+        c->file_fd = -1;
+        if (epoll_update(fd, EPOLL_CTL_ADD, EPOLLIN) < 0)
+        {
+            close(fd);
+            free(c);
+            continue;
+        }
+        conns[fd] = c;
+    }
+}
+
+/**
+ * @brief 创建监听socket。每个工作进程都有自己的监听socket，通过SO_REUSEPORT绑定到同一个端口
+ */
+static int create_server_socket(void)
+{
+    int server_fd;
     struct sockaddr_in address;
-    int addrlen = sizeof(address);
-    char buffer[MAX_REQUEST_SIZE] = {0};
     int opt = 1;
 
     // 创建socket
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0)
+    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
     {
         perror("socket failed");
         exit(EXIT_CODE);
     }
 
-    // 设置socket选项，允许地址重用
-    // if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt)))
-    // {
-    //     perror("setsockopt failed");
-    //     exit(EXIT_CODE);
-    // }
+    // 设置socket选项，允许地址和端口重用
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) ||
+        setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)))
+    {
+        perror("setsockopt failed");
+        exit(EXIT_CODE);
+    }
 
     // 设置地址和端口
+    memset(&address, 0, sizeof(address));
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
     address.sin_port = htons(PORT);
@@ -206,33 +464,96 @@ int main(int argc, char const *argv[])
     }
 
     // 监听socket
-    if (listen(server_fd, 3) < 0)
+    if (listen(server_fd, LISTEN_BACKLOG) < 0)
     {
         perror("listen failed");
         exit(EXIT_CODE);
     }
 
-    while (1)
+    if (set_nonblock(server_fd) < 0)
+    {
+        perror("fcntl failed");
+        exit(EXIT_CODE);
+    }
+    return server_fd;
+}
+
+/**
+ * @brief 工作进程的事件循环
+ */
+static void worker_loop(void)
+{
+    struct epoll_event events[MAX_EVENTS];
+    int server_fd = create_server_socket();
+
+    if ((epfd = epoll_create1(0)) < 0)
     {
-        printf("Waiting for a client...\n");
+        perror("epoll_create1 failed");
+        exit(EXIT_CODE);
+    }
+    if (epoll_update(server_fd, EPOLL_CTL_ADD, EPOLLIN) < 0)
+    {
+        perror("epoll_ctl failed");
+        exit(EXIT_CODE);
+    }
 
-        // 等待并接受客户端连接
-        if ((new_socket = accept(server_fd, (struct sockaddr *)&address, (socklen_t *)&addrlen)) < 0)
+    while (1)
+    {
+        int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (n < 0)
         {
-            perror("accept failed");
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait failed");
             exit(EXIT_CODE);
         }
+        for (int i = 0; i < n; i++)
+        {
+            int fd = events[i].data.fd;
+            if (fd == server_fd)
+            {
+                accept_all(server_fd);
+                continue;
+            }
+            struct conn *c = conns[fd];
+            if (c == NULL)
+                continue;
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+                conn_close(c);
+            else if (c->sending)
+                on_writable(c);
+            else
+                on_readable(c);
+        }
+    }
+}
 
-        // 接收客户端消息
-        valread = read(new_socket, buffer, MAX_REQUEST_SIZE);
-        printf("%s\n", buffer);
-
-        // 处理请求
-        handle_request(new_socket, buffer);
+int main(int argc, char const *argv[])
+{
+    int workers = DEFAULT_WORKERS;
+    if (argc > 1)
+        workers = atoi(argv[1]);
+    if (workers < 1 || workers > MAX_WORKERS)
+        workers = DEFAULT_WORKERS;
 
-        // 关闭客户端连接
-        close(new_socket);
+    printf("http_server: listening on port %d with %d workers\n", PORT, workers);
+    for (int i = 0; i < workers; i++)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            perror("fork failed");
+            exit(EXIT_CODE);
+        }
+        if (pid == 0)
+        {
+            worker_loop();
+            exit(0);
+        }
     }
 
+    // 主进程只等待工作进程退出
+    while (wait(NULL) > 0)
+        ;
     return 0;
-}
\ No newline at end of file
+}
@@ -6,6 +6,7 @@
 #include <fcntl.h>
 #include <libsystem/syscall.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -337,14 +338,10 @@ int shell_cmd_cat(int argc, char **argv)
         printf("ERROR: Cannot open file: %s, fd=%d\n", file_path, fd);
         return -1;
     }
-    // 获取文件总大小
-    int file_size = lseek(fd, 0, SEEK_END);
-    // 将文件指针切换回文件起始位置
-    lseek(fd, 0, SEEK_SET);
-
     char *buf = (char *)malloc(512);
 
-    while (file_size > 0)
+    // 一直读到文件末尾。procfs等文件的大小为0，内容在读取时才生成，不能根据文件大小判断是否读完
+    while (1)
     {
         memset(buf, 0, 512);
         int l = read(fd, buf, 511);
@@ -357,7 +354,6 @@ int shell_cmd_cat(int argc, char **argv)
             break;
         buf[l] = '\0';
 
-        file_size -= l;
         printf("%s", buf);
     }
     close(fd);
@@ -509,39 +505,33 @@ int shell_cmd_rm(int argc, char **argv)
  */
 int shell_cmd_exec(int argc, char **argv)
 {
-    pid_t pid = fork();
     int retval = 0;
-    // printf("  pid=%d  \n",pid);
+    int path_len = 0;
+    char *file_path = get_target_filepath(argv[1], &path_len);
 
-    if (pid == 0)
+    char **real_argv = NULL;
+    if (argc > 1)
     {
-
-        // 子进程
-        int path_len = 0;
-        char *file_path = get_target_filepath(argv[1], &path_len);
-        // printf("before execv, path=%s, argc=%d\n", file_path, argc);
-
-        char **real_argv = NULL;
-        if (argc > 1)
-        {
-            real_argv = &argv[1];
-        }
-        execv(file_path, real_argv);
-        // printf("after execv, path=%s, argc=%d\n", file_path, argc);
-        free(argv);
-        free(file_path);
-
-        exit(-1);
+        real_argv = &argv[1];
     }
-    else
+    // 由内核直接创建执行目标程序的子进程，不需要先fork出shell的副本
+    pid_t pid = 0;
+    int err = posix_spawn(&pid, file_path, NULL, NULL, real_argv, NULL);
+    free(file_path);
+    if (err != 0)
     {
-        // 如果不指定后台运行,则等待退出
-        if (strcmp(argv[argc - 1], "&") != 0)
-            waitpid(pid, &retval, 0);
-        else
-            printf("[1] %d\n", pid); // 输出子进程的pid
+        printf("Failed to exec %s, error=%d\n", argv[1], err);
         free(argv);
+        return -err;
     }
+
+    // 如果不指定后台运行,则等待退出
+    if (strcmp(argv[argc - 1], "&") != 0)
+        waitpid(pid, &retval, 0);
+    else
+        printf("[1] %d\n", pid); // 输出子进程的pid
+    free(argv);
+    return retval;
 }
 
 int shell_cmd_about(int argc, char **argv)
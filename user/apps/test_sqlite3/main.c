@@ -1,9 +1,19 @@
 // This is a test program for sqlite3.
 // We take it from rcore-os/arceos, thanks to @rcore-os community.
+//
+// Run without arguments for the functional test, or with "bench" for the benchmark:
+//     test_sqlite3 bench [-n inserts] [-t rows_per_txn] [-q queries]
+//                        [-j delete|wal] [-m mmap_size] [-s off|normal|full]
 #include <sqlite3.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_DB "bench.sqlite"
 
 int callback(void *NotUsed, int argc, char **argv, char **azColName)
 {
@@ -89,10 +99,219 @@ void file()
     sqlite3_close(db);
 }
 
-int main()
+struct bench_config
+{
+    int inserts;
+    int rows_per_txn;
+    int queries;
+    const char *journal_mode;
+    long mmap_size;
+    const char *synchronous;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char *name, uint64_t value, const char *unit)
+{
+    printf("sqlite_bench: %-24s %12lu %s\n", name, (unsigned long)value, unit);
+}
+
+/**
+ * @brief 输出吞吐量和延迟的百分位数
+ *
+ * @param lat 每次操作的延迟（纳秒），会被排序
+ * @param ops 所有样本包含的操作总数，用于计算吞吐量
+ */
+static void report_latency(const char *name, uint64_t *lat, int n, int ops)
+{
+    char key[64];
+    uint64_t total = 0;
+    for (int i = 0; i < n; i++)
+        total += lat[i];
+    qsort(lat, n, sizeof(uint64_t), cmp_u64);
+
+    sprintf(key, "%s_ops", name);
+    report(key, total ? (uint64_t)ops * 1000000000ULL / total : 0, "ops/s");
+    sprintf(key, "%s_p50", name);
+    report(key, lat[n / 2] / 1000, "us");
+    sprintf(key, "%s_p90", name);
+    report(key, lat[n * 90 / 100] / 1000, "us");
+    sprintf(key, "%s_p99", name);
+    report(key, lat[n * 99 / 100] / 1000, "us");
+    sprintf(key, "%s_max", name);
+    report(key, lat[n - 1] / 1000, "us");
+}
+
+static int bench_exec(sqlite3 *db, const char *sql)
+{
+    char *errmsg = NULL;
+    if (sqlite3_exec(db, sql, NULL, NULL, &errmsg) != SQLITE_OK)
+    {
+        printf("sqlite exec error: %s: %s\n", sql, errmsg);
+        sqlite3_free(errmsg);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 插入cfg->inserts行，每cfg->rows_per_txn行一个事务，记录每个事务（包括提交时的fsync）的延迟
+ */
+static int bench_insert(sqlite3 *db, const struct bench_config *cfg)
+{
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, "insert into kv (k, v) values (?, ?)", -1, &stmt, NULL) != SQLITE_OK)
+        return -1;
+
+    int txns = (cfg->inserts + cfg->rows_per_txn - 1) / cfg->rows_per_txn;
+    uint64_t *lat = malloc(sizeof(uint64_t) * txns);
+    char value[100];
+    memset(value, 'v', sizeof(value));
+
+    int key = 0;
+    for (int t = 0; t < txns; t++)
+    {
+        uint64_t start = now_ns();
+        bench_exec(db, "begin");
+        for (int i = 0; i < cfg->rows_per_txn && key < cfg->inserts; i++, key++)
+        {
+            sqlite3_bind_int(stmt, 1, key);
+            sqlite3_bind_blob(stmt, 2, value, sizeof(value), SQLITE_STATIC);
+            if (sqlite3_step(stmt) != SQLITE_DONE)
+                printf("sqlite insert error: %s\n", sqlite3_errmsg(db));
+            sqlite3_reset(stmt);
+        }
+        bench_exec(db, "commit");
+        lat[t] = now_ns() - start;
+    }
+    sqlite3_finalize(stmt);
+
+    report_latency("insert_txn", lat, txns, cfg->inserts);
+    free(lat);
+    return 0;
+}
+
+/**
+ * @brief 按随机的主键查询cfg->queries次，记录每次查询的延迟
+ */
+static int bench_query(sqlite3 *db, const struct bench_config *cfg)
+{
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, "select v from kv where k = ?", -1, &stmt, NULL) != SQLITE_OK)
+        return -1;
+
+    uint64_t *lat = malloc(sizeof(uint64_t) * cfg->queries);
+    // 固定的种子使每次运行的访问序列相同
+    uint32_t seed = 12345;
+    int misses = 0;
+    for (int i = 0; i < cfg->queries; i++)
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        uint64_t start = now_ns();
+        sqlite3_bind_int(stmt, 1, seed % cfg->inserts);
+        if (sqlite3_step(stmt) != SQLITE_ROW)
+            misses++;
+        sqlite3_reset(stmt);
+        lat[i] = now_ns() - start;
+    }
+    sqlite3_finalize(stmt);
+    if (misses)
+        printf("sqlite_bench: %d queries found no row\n", misses);
+
+    report_latency("point_query", lat, cfg->queries, cfg->queries);
+    free(lat);
+    return 0;
+}
+
+static int bench(int argc, char *argv[])
+{
+    struct bench_config cfg = {
+        .inserts = 10000,
+        .rows_per_txn = 100,
+        .queries = 10000,
+        .journal_mode = "delete",
+        .mmap_size = 0,
+        .synchronous = "full",
+    };
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "-n") == 0)
+            cfg.inserts = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-t") == 0)
+            cfg.rows_per_txn = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-q") == 0)
+            cfg.queries = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-j") == 0)
+            cfg.journal_mode = argv[i + 1];
+        else if (strcmp(argv[i], "-m") == 0)
+            cfg.mmap_size = atol(argv[i + 1]);
+        else if (strcmp(argv[i], "-s") == 0)
+            cfg.synchronous = argv[i + 1];
+        else
+        {
+            printf("unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (cfg.inserts <= 0 || cfg.rows_per_txn <= 0 || cfg.queries <= 0)
+    {
+        printf("inserts, rows per transaction and queries must be positive\n");
+        return 1;
+    }
+
+    printf("sqlite_bench: inserts=%d rows_per_txn=%d queries=%d journal_mode=%s mmap_size=%ld synchronous=%s\n",
+           cfg.inserts, cfg.rows_per_txn, cfg.queries, cfg.journal_mode, cfg.mmap_size, cfg.synchronous);
+
+    // 每次都从空数据库开始
+    unlink(BENCH_DB);
+    unlink(BENCH_DB "-journal");
+    unlink(BENCH_DB "-wal");
+    unlink(BENCH_DB "-shm");
+
+    sqlite3 *db;
+    if (sqlite3_open(BENCH_DB, &db) != SQLITE_OK)
+    {
+        printf("sqlite open %s error\n", BENCH_DB);
+        return 1;
+    }
+
+    char sql[128];
+    sprintf(sql, "pragma journal_mode=%s", cfg.journal_mode);
+    int ret = bench_exec(db, sql);
+    sprintf(sql, "pragma mmap_size=%ld", cfg.mmap_size);
+    ret |= bench_exec(db, sql);
+    sprintf(sql, "pragma synchronous=%s", cfg.synchronous);
+    ret |= bench_exec(db, sql);
+    ret |= bench_exec(db, "create table kv(k INTEGER PRIMARY KEY, v BLOB)");
+    if (ret == 0)
+        ret = bench_insert(db, &cfg);
+    if (ret == 0)
+        ret = bench_query(db, &cfg);
+
+    sqlite3_close(db);
+    return ret ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
 {
     printf("sqlite version: %s\n", sqlite3_libversion());
 
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+        return bench(argc, argv);
+
     memory();
     file();
     return 0;
@@ -0,0 +1,477 @@
+/**
+ * @file main.c
+ * @brief 系统级性能基准测试
+ *
+ * 参考lmbench和unixbench，测量系统调用、进程创建、IPC、上下文切换、缺页、文件和网络的性能，
+ * 用于跟踪各个版本的DragonOS的性能变化。
+ *
+ * 每项测试输出一行，格式固定为：
+ *     sysbench: <测试名> <数值> <单位>
+ * 便于用脚本提取和比较。
+ *
+ * 用法：test_sysbench [测试名...]，不带参数时运行所有测试
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SELF_PATH "/bin/test_sysbench"
+// 文件测试使用的目录
+#define BENCH_DIR "/sysbench_tmp"
+#define TCP_PORT 12581
+
+#define PAGE_SIZE 4096
+#define IO_CHUNK 65536
+// 带宽测试传输的数据量
+#define BW_TOTAL (64 << 20)
+// 文件读取测试的文件大小
+#define FILE_SIZE (16 << 20)
+#define MMAP_SIZE (64 << 20)
+
+static char io_buf[IO_CHUNK];
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void report(const char *name, double value, const char *unit)
+{
+    printf("sysbench: %-20s %14.3f %s\n", name, value, unit);
+}
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+static void wait_child(pid_t pid)
+{
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        ;
+}
+
+static void write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n <= 0)
+            die("write");
+        buf += n;
+        len -= n;
+    }
+}
+
+static void read_all(int fd, char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = read(fd, buf, len);
+        if (n <= 0)
+            die("read");
+        buf += n;
+        len -= n;
+    }
+}
+
+/* ======== 系统调用与进程 ======== */
+
+static void bench_null_syscall(void)
+{
+    const int iters = 200000;
+    uint64_t start = now_ns();
+    for (int i = 0; i < iters; i++)
+        syscall(SYS_getppid);
+    report("null_syscall", (double)(now_ns() - start) / iters, "ns");
+}
+
+static void bench_fork_exit(void)
+{
+    const int iters = 200;
+    uint64_t start = now_ns();
+    for (int i = 0; i < iters; i++)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+            die("fork");
+        if (pid == 0)
+            _exit(0);
+        wait_child(pid);
+    }
+    report("fork_exit", (double)(now_ns() - start) / iters / 1000, "us");
+}
+
+static void bench_fork_exec(void)
+{
+    const int iters = 100;
+    uint64_t start = now_ns();
+    for (int i = 0; i < iters; i++)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+            die("fork");
+        if (pid == 0)
+        {
+            char *argv[] = {SELF_PATH, "--exit", NULL};
+            execv(SELF_PATH, argv);
+            _exit(127);
+        }
+        wait_child(pid);
+    }
+    report("fork_exec", (double)(now_ns() - start) / iters / 1000, "us");
+}
+
+/* ======== IPC ======== */
+
+/**
+ * @brief 在父子进程之间来回传递1个字节，测量往返延迟
+ *
+ * @param parent_fd 父进程：{写端, 读端}
+ * @param child_fd 子进程：{读端, 写端}
+ */
+static void ping_pong(const char *name, int parent_fd[2], int child_fd[2])
+{
+    const int iters = 20000;
+    char c = 0;
+    pid_t pid = fork();
+    if (pid < 0)
+        die("fork");
+    if (pid == 0)
+    {
+        for (int i = 0; i < iters; i++)
+        {
+            read_all(child_fd[0], &c, 1);
+            write_all(child_fd[1], &c, 1);
+        }
+        _exit(0);
+    }
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < iters; i++)
+    {
+        write_all(parent_fd[0], &c, 1);
+        read_all(parent_fd[1], &c, 1);
+    }
+    report(name, (double)(now_ns() - start) / iters / 1000, "us");
+    wait_child(pid);
+}
+
+/**
+ * @brief 子进程向wfd写入BW_TOTAL字节，父进程从rfd读取，测量带宽
+ */
+static void stream_bw(const char *name, int rfd, int wfd)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+        die("fork");
+    if (pid == 0)
+    {
+        close(rfd);
+        for (size_t sent = 0; sent < BW_TOTAL; sent += IO_CHUNK)
+            write_all(wfd, io_buf, IO_CHUNK);
+        _exit(0);
+    }
+    close(wfd);
+
+    uint64_t start = now_ns();
+    size_t total = 0;
+    while (total < BW_TOTAL)
+    {
+        ssize_t n = read(rfd, io_buf, IO_CHUNK);
+        if (n <= 0)
+            die("read");
+        total += n;
+    }
+    double secs = (double)(now_ns() - start) / 1e9;
+    report(name, total / secs / (1 << 20), "MB/s");
+    close(rfd);
+    wait_child(pid);
+}
+
+static void bench_pipe_lat(void)
+{
+    int p1[2], p2[2];
+    if (pipe(p1) || pipe(p2))
+        die("pipe");
+    // p1由父进程写给子进程，p2由子进程写给父进程
+    int parent_fd[2] = {p1[1], p2[0]};
+    int child_fd[2] = {p1[0], p2[1]};
+    ping_pong("pipe_lat", parent_fd, child_fd);
+    close(p1[0]);
+    close(p1[1]);
+    close(p2[0]);
+    close(p2[1]);
+}
+
+static void bench_pipe_bw(void)
+{
+    int p[2];
+    if (pipe(p))
+        die("pipe");
+    stream_bw("pipe_bw", p[0], p[1]);
+}
+
+static void bench_unix_lat(void)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+        die("socketpair");
+    // socketpair的两端都可读写，父进程使用sv[0]，子进程使用sv[1]
+    int parent_fd[2] = {sv[0], sv[0]};
+    int child_fd[2] = {sv[1], sv[1]};
+    ping_pong("unix_lat", parent_fd, child_fd);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+static void bench_unix_bw(void)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+        die("socketpair");
+    stream_bw("unix_bw", sv[0], sv[1]);
+}
+
+static long futex(volatile int *uaddr, int op, int val)
+{
+    return syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+/**
+ * @brief 两个进程通过共享内存中的futex轮流运行，测量一次上下文切换的时间
+ */
+static void bench_ctx_switch(void)
+{
+    const int iters = 20000;
+    volatile int *turn = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (turn == MAP_FAILED)
+        die("mmap");
+    *turn = 0;
+
+    pid_t pid = fork();
+    if (pid < 0)
+        die("fork");
+    if (pid == 0)
+    {
+        for (int i = 0; i < iters; i++)
+        {
+            while (__atomic_load_n(turn, __ATOMIC_ACQUIRE) != 1)
+                futex(turn, FUTEX_WAIT, 0);
+            __atomic_store_n(turn, 0, __ATOMIC_RELEASE);
+            futex(turn, FUTEX_WAKE, 1);
+        }
+        _exit(0);
+    }
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < iters; i++)
+    {
+        __atomic_store_n(turn, 1, __ATOMIC_RELEASE);
+        futex(turn, FUTEX_WAKE, 1);
+        while (__atomic_load_n(turn, __ATOMIC_ACQUIRE) != 0)
+            futex(turn, FUTEX_WAIT, 1);
+    }
+    // 每轮往返包含两次切换
+    report("ctx_switch_futex", (double)(now_ns() - start) / iters / 2 / 1000, "us");
+    wait_child(pid);
+    munmap((void *)turn, PAGE_SIZE);
+}
+
+/* ======== 内存 ======== */
+
+static void bench_page_fault(void)
+{
+    const size_t pages = MMAP_SIZE / PAGE_SIZE;
+    uint64_t start = now_ns();
+    char *p = mmap(NULL, MMAP_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        die("mmap");
+    for (size_t i = 0; i < pages; i++)
+        p[i * PAGE_SIZE] = 1;
+    munmap(p, MMAP_SIZE);
+    report("page_fault", (double)(now_ns() - start) / pages, "ns");
+}
+
+/* ======== 文件 ======== */
+
+static void bench_file_create_delete(void)
+{
+    const int iters = 1000;
+    char path[64];
+    mkdir(BENCH_DIR, 0755);
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < iters; i++)
+    {
+        sprintf(path, BENCH_DIR "/f%d", i);
+        int fd = open(path, O_CREAT | O_RDWR, 0644);
+        if (fd < 0)
+            die("open");
+        close(fd);
+    }
+    for (int i = 0; i < iters; i++)
+    {
+        sprintf(path, BENCH_DIR "/f%d", i);
+        if (unlink(path))
+            die("unlink");
+    }
+    report("file_create_delete", iters / ((double)(now_ns() - start) / 1e9), "ops/s");
+}
+
+static void bench_file_read(void)
+{
+    const char *path = BENCH_DIR "/data";
+    mkdir(BENCH_DIR, 0755);
+    int fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0)
+        die("open");
+    for (size_t off = 0; off < FILE_SIZE; off += IO_CHUNK)
+        write_all(fd, io_buf, IO_CHUNK);
+    fsync(fd);
+
+    uint64_t start = now_ns();
+    lseek(fd, 0, SEEK_SET);
+    for (size_t off = 0; off < FILE_SIZE; off += IO_CHUNK)
+        read_all(fd, io_buf, IO_CHUNK);
+    double secs = (double)(now_ns() - start) / 1e9;
+    report("file_seq_read", FILE_SIZE / secs / (1 << 20), "MB/s");
+
+    // 随机读取4K块，使用固定的种子使每次运行的访问序列相同
+    const int iters = 4096;
+    const size_t blocks = FILE_SIZE / PAGE_SIZE;
+    uint32_t seed = 12345;
+    start = now_ns();
+    for (int i = 0; i < iters; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        off_t off = (off_t)((seed >> 8) % blocks) * PAGE_SIZE;
+        if (pread(fd, io_buf, PAGE_SIZE, off) != PAGE_SIZE)
+            die("pread");
+    }
+    report("file_rand_read", iters / ((double)(now_ns() - start) / 1e9), "ops/s");
+
+    close(fd);
+    unlink(path);
+}
+
+/* ======== 网络 ======== */
+
+static void bench_tcp_bw(void)
+{
+    struct sockaddr_in addr;
+    int opt = 1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(TCP_PORT);
+
+    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_fd < 0)
+        die("socket");
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (bind(server_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        die("bind");
+    if (listen(server_fd, 1) < 0)
+        die("listen");
+
+    pid_t pid = fork();
+    if (pid < 0)
+        die("fork");
+    if (pid == 0)
+    {
+        close(server_fd);
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+            die("connect");
+        for (size_t sent = 0; sent < BW_TOTAL; sent += IO_CHUNK)
+            write_all(fd, io_buf, IO_CHUNK);
+        close(fd);
+        _exit(0);
+    }
+
+    int fd = accept(server_fd, NULL, NULL);
+    if (fd < 0)
+        die("accept");
+    uint64_t start = now_ns();
+    size_t total = 0;
+    while (total < BW_TOTAL)
+    {
+        ssize_t n = read(fd, io_buf, IO_CHUNK);
+        if (n <= 0)
+            die("read");
+        total += n;
+    }
+    double secs = (double)(now_ns() - start) / 1e9;
+    report("tcp_bw", total / secs / (1 << 20), "MB/s");
+    close(fd);
+    close(server_fd);
+    wait_child(pid);
+}
+
+struct bench
+{
+    const char *name;
+    void (*func)(void);
+};
+
+static const struct bench benches[] = {
+    {"null_syscall", bench_null_syscall},
+    {"fork_exit", bench_fork_exit},
+    {"fork_exec", bench_fork_exec},
+    {"pipe_lat", bench_pipe_lat},
+    {"pipe_bw", bench_pipe_bw},
+    {"unix_lat", bench_unix_lat},
+    {"unix_bw", bench_unix_bw},
+    {"ctx_switch_futex", bench_ctx_switch},
+    {"page_fault", bench_page_fault},
+    {"file_create_delete", bench_file_create_delete},
+    {"file_read", bench_file_read},
+    {"tcp_bw", bench_tcp_bw},
+};
+
+#define NR_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+int main(int argc, char const *argv[])
+{
+    // fork_exec测试中被执行的子进程
+    if (argc > 1 && strcmp(argv[1], "--exit") == 0)
+        return 0;
+
+    // 输出被重定向时也要按顺序输出，避免与子进程的输出交错
+    setvbuf(stdout, NULL, _IONBF, 0);
+    memset(io_buf, 'x', sizeof(io_buf));
+
+    for (size_t i = 0; i < NR_BENCHES; i++)
+    {
+        if (argc > 1)
+        {
+            int selected = 0;
+            for (int j = 1; j < argc; j++)
+                selected |= strcmp(argv[j], benches[i].name) == 0;
+            if (!selected)
+                continue;
+        }
+        benches[i].func();
+    }
+    rmdir(BENCH_DIR);
+    return 0;
+}
@@ -28,7 +28,7 @@ struct DIR *opendir(const char *path)
     // printf("dirp = %#018lx", dirp);
     memset(dirp, 0, sizeof(struct DIR));
     dirp->fd = fd;
-    dirp->buf_len = DIR_BUF_SIZE;
+    dirp->buf_len = 0;
     dirp->buf_pos = 0;
 
     return dirp;
@@ -66,13 +66,17 @@ int64_t getdents(int fd, struct dirent *dirent, long count)
  */
 struct dirent *readdir(struct DIR *dir)
 {
-    // printf("dir->buf = %#018lx\n", (dir->buf));
-    memset((dir->buf), 0, DIR_BUF_SIZE);
-    // printf("memeset_ok\n");
-    int len = getdents(dir->fd, (struct dirent *)dir->buf, DIR_BUF_SIZE);
-    // printf("len=%d\n", len);
-    if (len > 0)
-        return (struct dirent *)dir->buf;
-    else
-        return NULL;
+    // 缓冲区中的目录项已经取完，通过getdents一次读入缓冲区放得下的所有目录项
+    if (dir->buf_pos >= dir->buf_len)
+    {
+        int len = getdents(dir->fd, (struct dirent *)dir->buf, DIR_BUF_SIZE);
+        if (len <= 0)
+            return NULL;
+        dir->buf_len = len;
+        dir->buf_pos = 0;
+    }
+
+    struct dirent *ent = (struct dirent *)(dir->buf + dir->buf_pos);
+    dir->buf_pos += ent->d_reclen;
+    return ent;
 }
\ No newline at end of file
@@ -56,7 +56,7 @@ extern  "C"  {
 
 #define DT_MAX		(S_DT_MASK + 1) /* 16 */
 
-#define DIR_BUF_SIZE 256
+#define DIR_BUF_SIZE 4096
 
 /**
  * @brief 文件夹结构体
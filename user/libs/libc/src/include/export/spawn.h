@@ -0,0 +1,85 @@
+#pragma once
+#include <signal.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+
+// posix_spawnattr_t的标志
+#define POSIX_SPAWN_RESETIDS 0x01
+#define POSIX_SPAWN_SETSIGDEF 0x04
+#define POSIX_SPAWN_SETSIGMASK 0x08
+#define POSIX_SPAWN_USEVFORK 0x40
+
+// file action的类型（与内核一致）
+#define __POSIX_SPAWN_CLOSE 0
+#define __POSIX_SPAWN_DUP2 1
+#define __POSIX_SPAWN_OPEN 2
+
+/**
+ * @brief 一个file action，内存布局与内核一致
+ *
+ */
+struct __posix_spawn_file_action
+{
+    uint32_t action;
+    int32_t fd;
+    int32_t src_fd;
+    uint32_t oflag;
+    uint32_t mode;
+    uint32_t __pad;
+    const char *path;
+};
+
+typedef struct
+{
+    int count;
+    int capacity;
+    struct __posix_spawn_file_action *actions;
+} posix_spawn_file_actions_t;
+
+/**
+ * @brief spawn属性，内存布局与内核一致
+ *
+ */
+typedef struct
+{
+    uint32_t flags;
+    int32_t pgroup;
+    sigset_t sigdefault;
+    sigset_t sigmask;
+} posix_spawnattr_t;
+
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t *file_actions);
+int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t *file_actions);
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t *file_actions, int fd);
+int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t *file_actions, int fd, int newfd);
+int posix_spawn_file_actions_addopen(posix_spawn_file_actions_t *file_actions, int fd, const char *path, int oflag,
+                                     mode_t mode);
+
+int posix_spawnattr_init(posix_spawnattr_t *attr);
+int posix_spawnattr_destroy(posix_spawnattr_t *attr);
+int posix_spawnattr_setflags(posix_spawnattr_t *attr, short flags);
+int posix_spawnattr_setsigmask(posix_spawnattr_t *attr, const sigset_t *sigmask);
+int posix_spawnattr_setsigdefault(posix_spawnattr_t *attr, const sigset_t *sigdefault);
+
+/**
+ * @brief 创建一个执行path的新进程。子进程不复制父进程的地址空间，由内核直接加载目标程序
+ *
+ * @param pid 用于返回子进程的pid，可以为NULL
+ * @param path 可执行文件的路径
+ * @param file_actions 按顺序作用在子进程的文件描述符上的操作，可以为NULL
+ * @param attrp spawn属性，可以为NULL
+ * @param argv 参数列表
+ * @param envp 环境变量列表
+ * @return int 成功返回0，失败返回错误码
+ */
+int posix_spawn(pid_t *pid, const char *path, const posix_spawn_file_actions_t *file_actions,
+                const posix_spawnattr_t *attrp, char *const argv[], char *const envp[]);
+
+#if defined(__cplusplus)
+} /* extern "C" */
+#endif
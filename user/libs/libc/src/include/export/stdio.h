@@ -28,8 +28,22 @@ extern  "C"  {
    end of the file.  */
 #define EOF (-1)
 
-typedef struct {
-    int fd;  // 文件描述符
+/* setvbuf的缓冲模式 */
+#define _IOFBF 0 /* 全缓冲 */
+#define _IOLBF 1 /* 行缓冲 */
+#define _IONBF 2 /* 无缓冲 */
+
+/* 流的默认缓冲区大小 */
+#define BUFSIZ 4096
+
+typedef struct __FILE {
+    int fd;              // 文件描述符
+    int flags;           // 流的状态，见stdio.c中的__F_*
+    int buf_mode;        // 缓冲模式：_IOFBF、_IOLBF或_IONBF
+    char *buf;           // 写缓冲区，在第一次写入时才分配
+    size_t buf_size;     // 缓冲区的大小
+    size_t buf_len;      // 缓冲区中还未写出的字节数
+    struct __FILE *next; // 所有打开的流组成的链表，用于fflush(NULL)
 } FILE;
 
 extern FILE* stdin;
@@ -51,7 +65,13 @@ int sprintf(char *buf, const char *fmt, ...);
 int vsprintf(char *buf, const char *fmt, va_list args);
 
 int fflush(FILE *stream);
+int setvbuf(FILE *restrict stream, char *restrict buf, int mode, size_t size);
+void setbuf(FILE *restrict stream, char *restrict buf);
 int fprintf(FILE *restrict stream, const char *restrict format, ...);
+int vfprintf(FILE *restrict stream, const char *restrict format, va_list args);
+size_t fwrite(const void *restrict ptr, size_t size, size_t nmemb, FILE *restrict stream);
+int fputc(int c, FILE *stream);
+int fputs(const char *restrict s, FILE *restrict stream);
 int ferror(FILE *stream);
 FILE *fopen(const char *restrict pathname, const char *restrict mode);
 int fclose(FILE *stream);
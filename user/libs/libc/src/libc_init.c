@@ -5,14 +5,10 @@ FILE *stdin;
 FILE *stdout;
 FILE *stderr;
 
+extern void __stdio_init(void);
+
 void _libc_init()
 {
-    // 初始化标准流对应的文件描述符
-    stdin = malloc(sizeof(FILE));
-    stdout = malloc(sizeof(FILE));
-    stderr = malloc(sizeof(FILE));
-
-    stdin->fd = 0;
-    stdout->fd = 1;
-    stderr->fd = 2;
+    // 初始化标准流
+    __stdio_init();
 }
\ No newline at end of file
@@ -6,261 +6,350 @@
 #include <stdio.h>
 
 #define PAGE_4K_SHIFT 12
-#define PAGE_2M_SHIFT 21
-#define PAGE_1G_SHIFT 30
-#define PAGE_GDT_SHIFT 39
 
 // 不同大小的页的容量
 #define PAGE_4K_SIZE (1UL << PAGE_4K_SHIFT)
-#define PAGE_2M_SIZE (1UL << PAGE_2M_SHIFT)
-#define PAGE_1G_SIZE (1UL << PAGE_1G_SHIFT)
 
 // 屏蔽低于x的数值
 #define PAGE_4K_MASK (~(PAGE_4K_SIZE - 1))
-#define PAGE_2M_MASK (~(PAGE_2M_SIZE - 1))
-
-// 将addr按照x的上边界对齐
-#define PAGE_4K_ALIGN(addr) (((unsigned long)(addr) + PAGE_4K_SIZE - 1) & PAGE_4K_MASK)
-#define PAGE_2M_ALIGN(addr) (((unsigned long)(addr) + PAGE_2M_SIZE - 1) & PAGE_2M_MASK)
 
 #define ALIGN_UP16(x) (((x) + 15) & ~15)
 #define PAGE_ALIGN_UP(x) (((x) + PAGE_4K_SIZE - 1) & PAGE_4K_MASK)
 
+// mmap/madvise的参数
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+#define MAP_PRIVATE 0x02
+#define MAP_ANONYMOUS 0x20
+#define MADV_DONTNEED 4
+
+/*
+ * 内存分配分为三类：
+ *  - 小块（用户请求不超过MALLOC_SMALL_MAX）：按16字节划分大小类别，每个类别一个bin
+ *  - 中块（不超过MALLOC_MEDIUM_MAX）：按2的幂划分大小类别，每个类别一个bin
+ *  - 大块：直接使用mmap分配，free时munmap
+ *
+ * 每个bin是一个单向的空闲链表，分配和释放都只需要在链表头部操作。
+ * 释放较大的中块时，用madvise(MADV_DONTNEED)把其中整页的物理内存还给内核，块本身仍留在bin中
+ *
+ * 为了让多个线程（clone(CLONE_VM|CLONE_THREAD)）同时分配，小块和中块由多个arena缓存：
+ *  - 线程根据自己的栈地址选择一个arena，用trylock加锁，arena被占用时换下一个，
+ *    因此每个线程通常独占一个arena，锁几乎不会竞争
+ *  - arena的bin为空时，从中央缓存批量取一批（MALLOC_BATCH_SIZE字节）块，中央缓存也为空时再从堆（sbrk）中切出；
+ *    arena的bin中的块超过两批时，把一批还给中央缓存
+ *  - 块记录分配它的arena，其他线程释放时，如果那个arena正被使用，就用CAS把块挂到它的远程释放链表上，
+ *    不需要等待锁；arena的bin为空时先收回远程释放的块
+ */
+#define MALLOC_SMALL_MAX 512
+#define MALLOC_SMALL_BINS (MALLOC_SMALL_MAX / 16)
+#define MALLOC_MEDIUM_MIN_SHIFT 10
+#define MALLOC_MEDIUM_MAX_SHIFT 16
+#define MALLOC_MEDIUM_MAX (1UL << MALLOC_MEDIUM_MAX_SHIFT)
+#define MALLOC_MEDIUM_BINS (MALLOC_MEDIUM_MAX_SHIFT - MALLOC_MEDIUM_MIN_SHIFT + 1)
+#define MALLOC_BIN_NUM (MALLOC_SMALL_BINS + MALLOC_MEDIUM_BINS)
+// 由mmap分配的块的bin号
+#define MALLOC_BIN_MMAP ((uint32_t)-1)
+
+// arena的数量
+#define MALLOC_ARENA_NUM 8
+// arena与中央缓存之间一次转移的块的总大小
+#define MALLOC_BATCH_SIZE (64UL << 10)
+// 释放的块的数据区不小于这个大小时，才把其中的整页还给内核
+#define MALLOC_TRIM_THRESHOLD (16UL << 10)
+
 /**
- * @brief 显式链表的结点
+ * @brief 块的头部，紧挨在返回给用户的指针之前
  *
  */
 typedef struct malloc_mem_chunk_t
 {
-    uint64_t length;                 // 整个块所占用的内存区域的大小
-    struct malloc_mem_chunk_t *prev; // 上一个结点的指针
-    struct malloc_mem_chunk_t *next; // 下一个结点的指针
+    uint64_t length; // 整个块所占用的内存区域的大小（包括头部）
+    uint32_t bin;    // 块所属的bin
+    uint32_t arena;  // 分配这个块的arena
 } malloc_mem_chunk_t;
 
+/**
+ * @brief 空闲块的数据区的开头，用来把块串在bin的空闲链表上
+ *
+ */
+typedef struct malloc_free_node_t
+{
+    struct malloc_free_node_t *next;
+} malloc_free_node_t;
+
+/**
+ * @brief 一个大小类别的空闲链表
+ *
+ */
+typedef struct malloc_bin_t
+{
+    malloc_free_node_t *head;
+    uint64_t count; // 链表中块的数量
+} malloc_bin_t;
+
+/**
+ * @brief 线程使用的分配缓存
+ *
+ */
+typedef struct malloc_arena_t
+{
+    int lock;
+    malloc_bin_t bins[MALLOC_BIN_NUM];
+    malloc_free_node_t *remote_free; // 其他线程释放的块，通过CAS无锁地插入
+} malloc_arena_t;
+
 static uint64_t brk_base_addr = 0;    // 堆区域的内存基地址
 static uint64_t brk_max_addr = 0;     // 堆区域的内存最大地址
 static uint64_t brk_managed_addr = 0; // 堆区域已经被管理的地址
 
-// 空闲链表
-//  按start_addr升序排序
-static malloc_mem_chunk_t *malloc_free_list = NULL;
-static malloc_mem_chunk_t *malloc_free_list_end = NULL; // 空闲链表的末尾结点
+static malloc_arena_t malloc_arenas[MALLOC_ARENA_NUM];
+
+// 中央缓存，它的锁同时保护堆区域
+static int central_lock = 0;
+static malloc_bin_t central_bins[MALLOC_BIN_NUM];
+
+static inline int malloc_trylock(int *lock)
+{
+    return __atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE) == 0;
+}
+
+static inline void malloc_lock(int *lock)
+{
+    while (!malloc_trylock(lock))
+    {
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED))
+            __builtin_ia32_pause();
+    }
+}
 
-static uint64_t count_last_free_size = 0; // 统计距离上一次回收内存，已经free了多少内存
+static inline void malloc_unlock(int *lock)
+{
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
 
 /**
- * @brief 将块插入空闲链表
+ * @brief 计算用户请求的大小对应的bin
  *
- * @param ck 待插入的块
+ * @param size 用户请求的大小
+ * @return uint32_t bin号，超过中块上限时返回MALLOC_BIN_MMAP
  */
-static void malloc_insert_free_list(malloc_mem_chunk_t *ck);
+static inline uint32_t malloc_size_to_bin(uint64_t size)
+{
+    if (size <= MALLOC_SMALL_MAX)
+        return size == 0 ? 0 : (size - 1) >> 4;
+    if (size > MALLOC_MEDIUM_MAX)
+        return MALLOC_BIN_MMAP;
+    // 向上取到2的幂
+    uint64_t shift = 64 - __builtin_clzl(size - 1);
+    return MALLOC_SMALL_BINS + shift - MALLOC_MEDIUM_MIN_SHIFT;
+}
 
 /**
- * @brief 当堆顶空闲空间大于2个页的空间的时候，释放1个页
+ * @brief 获取bin中的块的大小（包括头部）
  *
+ * @param bin bin号
+ * @return uint64_t
  */
-static void release_brk();
+static inline uint64_t malloc_bin_chunk_size(uint32_t bin)
+{
+    if (bin < MALLOC_SMALL_BINS)
+        return ((bin + 1) << 4) + sizeof(malloc_mem_chunk_t);
+    return (1UL << (bin - MALLOC_SMALL_BINS + MALLOC_MEDIUM_MIN_SHIFT)) + sizeof(malloc_mem_chunk_t);
+}
 
 /**
- * @brief 在链表中检索符合要求的空闲块（best fit）
+ * @brief 获取arena与中央缓存之间一次转移的块数
  *
- * @param size 块的大小
- * @return malloc_mem_chunk_t*
+ * @param bin bin号
+ * @return uint64_t
  */
-static malloc_mem_chunk_t *malloc_query_free_chunk_bf(uint64_t size)
+static inline uint64_t malloc_bin_batch(uint32_t bin)
 {
-    // 在满足best fit的前提下，尽可能的使分配的内存在低地址
-    //  使得总的堆内存可以更快被释放
+    uint64_t count = MALLOC_BATCH_SIZE / malloc_bin_chunk_size(bin);
+    return count == 0 ? 1 : count;
+}
 
-    if (malloc_free_list == NULL)
+/**
+ * @brief 从堆中切出一段内存，堆空间不足时用sbrk扩容。需要持有central_lock
+ *
+ * @param size 内存大小（16字节对齐）
+ * @return void* 成功时返回内存的起始地址，失败返回NULL
+ */
+static void *malloc_heap_alloc(uint64_t size)
+{
+    if (brk_base_addr == 0) // 第一次调用，需要初始化
     {
-        return NULL;
+        brk_base_addr = ALIGN_UP16((uint64_t)sbrk(0));
+        brk_managed_addr = brk_base_addr;
+        brk_max_addr = (uint64_t)sbrk(0);
     }
-    malloc_mem_chunk_t *ptr = malloc_free_list;
-    malloc_mem_chunk_t *best = NULL;
-    // printf("query size=%d", size);
-    while (ptr != NULL)
-    {
-        // printf("ptr->length=%#010lx\n", ptr->length);
-        if (ptr->length == size)
-        {
-            best = ptr;
-            break;
-        }
 
-        if (ptr->length > size)
+    if (brk_max_addr < brk_managed_addr + size) // 现有堆空间不足
+    {
+        if (sbrk(PAGE_ALIGN_UP(brk_managed_addr + size - brk_max_addr)) == (void *)(-1))
         {
-            if (best == NULL)
-                best = ptr;
-            else if (best->length > ptr->length)
-                best = ptr;
+            put_string("malloc_heap_alloc(): no_mem\n", COLOR_YELLOW, COLOR_BLACK);
+            return NULL;
         }
-        ptr = ptr->next;
+        brk_max_addr = (uint64_t)sbrk(0);
     }
 
-    return best;
+    void *ret = (void *)brk_managed_addr;
+    brk_managed_addr += size;
+    return ret;
 }
 
 /**
- * @brief 在链表中检索符合要求的空闲块（first fit）
+ * @brief 从链表头部取下最多count个块
  *
- * @param size
- * @return malloc_mem_chunk_t*
+ * @param bin 链表
+ * @param count 块数
+ * @return malloc_free_node_t* 取下的块组成的链表
  */
-static malloc_mem_chunk_t *malloc_query_free_chunk_ff(uint64_t size)
+static malloc_free_node_t *malloc_bin_take(malloc_bin_t *bin, uint64_t count)
 {
-    if (malloc_free_list == NULL)
-        return NULL;
-    malloc_mem_chunk_t *ptr = malloc_free_list;
-
-    while (ptr)
+    malloc_free_node_t *head = bin->head;
+    malloc_free_node_t *tail = head;
+    uint64_t n = 1;
+    while (n < count && tail->next != NULL)
     {
-        if (ptr->length >= size)
-        {
-            return ptr;
-        }
-        ptr = ptr->next;
+        tail = tail->next;
+        ++n;
     }
+    bin->head = tail->next;
+    bin->count -= n;
+    tail->next = NULL;
+    return head;
+}
 
-    return NULL;
+/**
+ * @brief 把块插入链表头部
+ *
+ * @param bin 链表
+ * @param node 块
+ */
+static inline void malloc_bin_push(malloc_bin_t *bin, malloc_free_node_t *node)
+{
+    node->next = bin->head;
+    bin->head = node;
+    ++bin->count;
 }
 
 /**
- * @brief 扩容malloc管理的内存区域
+ * @brief arena的bin为空时，从中央缓存取一批块，中央缓存也为空时从堆中切出
  *
- * @param size 扩大的内存大小
+ * @param arena arena（已加锁）
+ * @param bin bin号
+ * @return int 成功返回0，内存不足返回-ENOMEM
  */
-static int malloc_enlarge(int64_t size)
+static int malloc_refill_bin(malloc_arena_t *arena, uint32_t bin)
 {
-    if (brk_base_addr == 0) // 第一次调用，需要初始化
+    uint64_t batch = malloc_bin_batch(bin);
+    malloc_lock(&central_lock);
+    if (central_bins[bin].head != NULL)
     {
-        brk_base_addr = sbrk(0);
-        // printf("brk_base_addr=%#018lx\n", brk_base_addr);
-        brk_managed_addr = brk_base_addr;
-        brk_max_addr = sbrk(0);
+        uint64_t before = central_bins[bin].count;
+        arena->bins[bin].head = malloc_bin_take(&central_bins[bin], batch);
+        arena->bins[bin].count = before - central_bins[bin].count;
+        malloc_unlock(&central_lock);
+        return 0;
     }
 
-    int64_t free_space = brk_max_addr - brk_managed_addr;
-    // printf("size=%ld\tfree_space=%ld\n", size, free_space);
-    if (free_space < size) // 现有堆空间不足
+    uint64_t chunk_size = malloc_bin_chunk_size(bin);
+    uint64_t base = (uint64_t)malloc_heap_alloc(chunk_size * batch);
+    malloc_unlock(&central_lock);
+    if (base == 0)
+        return -ENOMEM;
+
+    // 倒序插入，使得先分配出去的块位于低地址
+    for (uint64_t i = batch; i > 0; --i)
     {
-        if (sbrk(PAGE_ALIGN_UP(size - free_space)) != (void *)(-1))
-            brk_max_addr = sbrk((0));
-        else
-        {
-            put_string("malloc_enlarge(): no_mem\n", COLOR_YELLOW, COLOR_BLACK);
-            return -ENOMEM;
-        }
+        malloc_mem_chunk_t *ck = (malloc_mem_chunk_t *)(base + (i - 1) * chunk_size);
+        ck->length = chunk_size;
+        ck->bin = bin;
+        malloc_bin_push(&arena->bins[bin], (malloc_free_node_t *)(ck + 1));
+    }
+    return 0;
+}
 
-        // printf("brk max addr = %#018lx\n", brk_max_addr);
+/**
+ * @brief 收回其他线程释放到arena的块
+ *
+ * @param arena arena（已加锁）
+ */
+static void malloc_drain_remote(malloc_arena_t *arena)
+{
+    malloc_free_node_t *node = __atomic_exchange_n(&arena->remote_free, NULL, __ATOMIC_ACQUIRE);
+    while (node != NULL)
+    {
+        malloc_free_node_t *next = node->next;
+        malloc_mem_chunk_t *ck = (malloc_mem_chunk_t *)node - 1;
+        malloc_bin_push(&arena->bins[ck->bin], node);
+        node = next;
     }
+}
 
-    // 扩展管理的堆空间
-    // 在新分配的内存的底部放置header
-    malloc_mem_chunk_t *new_ck = (malloc_mem_chunk_t *)brk_managed_addr;
-    memset(new_ck, 0, sizeof(malloc_mem_chunk_t));
-    new_ck->length = brk_max_addr - brk_managed_addr;
-    // printf("new_ck->start_addr=%#018lx\tbrk_max_addr=%#018lx\tbrk_managed_addr=%#018lx\n", (uint64_t)new_ck, brk_max_addr, brk_managed_addr);
-    new_ck->prev = NULL;
-    new_ck->next = NULL;
-    brk_managed_addr = brk_max_addr;
+/**
+ * @brief arena的bin中缓存的块过多时，把一批块还给中央缓存
+ *
+ * @param arena arena（已加锁）
+ * @param bin bin号
+ */
+static void malloc_flush_bin(malloc_arena_t *arena, uint32_t bin)
+{
+    uint64_t batch = malloc_bin_batch(bin);
+    if (arena->bins[bin].count <= 2 * batch)
+        return;
 
-    malloc_insert_free_list(new_ck);
+    malloc_free_node_t *head = malloc_bin_take(&arena->bins[bin], batch);
+    malloc_free_node_t *tail = head;
+    while (tail->next != NULL)
+        tail = tail->next;
 
-    return 0;
+    malloc_lock(&central_lock);
+    tail->next = central_bins[bin].head;
+    central_bins[bin].head = head;
+    central_bins[bin].count += batch;
+    malloc_unlock(&central_lock);
 }
 
 /**
- * @brief 合并空闲块
+ * @brief 为当前线程选择一个arena并加锁
  *
+ * @return malloc_arena_t* 已加锁的arena
  */
-static void malloc_merge_free_chunk()
+static malloc_arena_t *malloc_lock_arena()
 {
-    if (malloc_free_list == NULL)
-        return;
-    malloc_mem_chunk_t *ptr = malloc_free_list->next;
-    while (ptr != NULL)
+    // 不同线程的栈位于不同的地址，用栈地址选择起始的arena
+    uint64_t start = ((uint64_t)__builtin_frame_address(0) >> 16) % MALLOC_ARENA_NUM;
+    for (uint64_t i = 0; i < MALLOC_ARENA_NUM; ++i)
     {
-        // 内存块连续
-        if (((uint64_t)(ptr->prev) + ptr->prev->length == (uint64_t)ptr))
-        {
-            // printf("merged %#018lx  and %#018lx\n", (uint64_t)ptr, (uint64_t)(ptr->prev));
-            // 将ptr与前面的空闲块合并
-            ptr->prev->length += ptr->length;
-            ptr->prev->next = ptr->next;
-            if (ptr->next == NULL)
-                malloc_free_list_end = ptr->prev;
-            else
-                ptr->next->prev = ptr->prev;
-            // 由于内存组成结构的原因，不需要free掉header
-            ptr = ptr->prev;
-        }
-        ptr = ptr->next;
+        malloc_arena_t *arena = &malloc_arenas[(start + i) % MALLOC_ARENA_NUM];
+        if (malloc_trylock(&arena->lock))
+            return arena;
     }
+    malloc_lock(&malloc_arenas[start].lock);
+    return &malloc_arenas[start];
 }
 
 /**
- * @brief 将块插入空闲链表
+ * @brief 使用mmap分配大块内存
  *
- * @param ck 待插入的块
+ * @param size 用户请求的大小
+ * @return void* 内存空间的指针，失败返回NULL
  */
-static void malloc_insert_free_list(malloc_mem_chunk_t *ck)
+static void *malloc_mmap(uint64_t size)
 {
-    if (malloc_free_list == NULL) // 空闲链表为空
-    {
-        malloc_free_list = ck;
-        malloc_free_list_end = ck;
-        ck->prev = ck->next = NULL;
-        return;
-    }
-    else
-    {
+    uint64_t length = PAGE_ALIGN_UP(size + sizeof(malloc_mem_chunk_t));
+    long addr = syscall_invoke(SYS_MMAP, 0, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                               (uint64_t)-1, 0);
+    if (addr < 0)
+        return NULL;
 
-        malloc_mem_chunk_t *ptr = malloc_free_list;
-        while (ptr != NULL)
-        {
-            if ((uint64_t)ptr < (uint64_t)ck)
-            {
-                if (ptr->next == NULL) // 当前是最后一个项
-                {
-                    ptr->next = ck;
-                    ck->next = NULL;
-                    ck->prev = ptr;
-                    malloc_free_list_end = ck;
-                    break;
-                }
-                else if ((uint64_t)(ptr->next) > (uint64_t)ck)
-                {
-                    ck->prev = ptr;
-                    ck->next = ptr->next;
-                    ptr->next = ck;
-                    ck->next->prev = ck;
-                    break;
-                }
-            }
-            else // 在ptr之前插入
-            {
-
-                if (ptr->prev == NULL) // 是第一个项
-                {
-                    malloc_free_list = ck;
-                    ck->prev = NULL;
-                    ck->next = ptr;
-                    ptr->prev = ck;
-                    break;
-                }
-                else
-                {
-                    ck->prev = ptr->prev;
-                    ck->next = ptr;
-                    ck->prev->next = ck;
-                    ptr->prev = ck;
-                    break;
-                }
-            }
-            ptr = ptr->next;
-        }
-    }
+    malloc_mem_chunk_t *ck = (malloc_mem_chunk_t *)addr;
+    ck->length = length;
+    ck->bin = MALLOC_BIN_MMAP;
+    return (void *)(ck + 1);
 }
 
 /**
@@ -269,126 +358,80 @@ static void malloc_insert_free_list(malloc_mem_chunk_t *ck)
  * @param size 内存大小
  * @return void* 内存空间的指针
  *
- * 分配内存的时候，结点的prev next指针所占用的空间被当做空闲空间分配出去
+ * 返回的指针按16字节对齐
  */
 void *malloc(ssize_t size)
 {
-    // printf("malloc\n");
-    // 计算需要分配的块的大小
-    if (size + sizeof(uint64_t) <= sizeof(malloc_mem_chunk_t))
-        size = sizeof(malloc_mem_chunk_t);
-    else
-        size += sizeof(uint64_t);
-
-    // 采用best fit
-    malloc_mem_chunk_t *ck = malloc_query_free_chunk_bf(size);
+    if (size < 0)
+        return (void *)-ENOMEM;
 
-    if (ck == NULL) // 没有空闲块
+    uint32_t bin = malloc_size_to_bin(size);
+    if (bin == MALLOC_BIN_MMAP)
     {
-
-        // printf("no free blocks\n");
-        // 尝试合并空闲块
-        malloc_merge_free_chunk();
-        ck = malloc_query_free_chunk_bf(size);
-
-        // 找到了合适的块
-        if (ck)
-            goto found;
-
-        // printf("before enlarge\n");
-        // 找不到合适的块，扩容堆区域
-        if (malloc_enlarge(size) == -ENOMEM)
-            return (void *)-ENOMEM; // 内存不足
-
-        malloc_merge_free_chunk(); // 扩容后运行合并，否则会导致碎片
-
-        // 扩容后再次尝试获取
-
-        ck = malloc_query_free_chunk_bf(size);
+        void *ptr = malloc_mmap(size);
+        return ptr == NULL ? (void *)-ENOMEM : ptr;
     }
-found:;
 
-    // printf("ck = %#018lx\n", (uint64_t)ck);
-    if (ck == NULL)
-        return (void *)-ENOMEM;
-    // printf("ck->prev=%#018lx ck->next=%#018lx\n", ck->prev, ck->next);
-    // 分配空闲块
-    // 从空闲链表取出
-    if (ck->prev == NULL) // 当前是链表的第一个块
+    malloc_arena_t *arena = malloc_lock_arena();
+    if (arena->bins[bin].head == NULL)
+        malloc_drain_remote(arena);
+    if (arena->bins[bin].head == NULL && malloc_refill_bin(arena, bin) != 0)
     {
-        malloc_free_list = ck->next;
+        malloc_unlock(&arena->lock);
+        return (void *)-ENOMEM; // 内存不足
     }
-    else
-        ck->prev->next = ck->next;
 
-    if (ck->next != NULL) // 当前不是最后一个块
-        ck->next->prev = ck->prev;
-    else
-        malloc_free_list_end = ck->prev;
+    malloc_free_node_t *node = arena->bins[bin].head;
+    arena->bins[bin].head = node->next;
+    --arena->bins[bin].count;
+    malloc_unlock(&arena->lock);
 
-    // 当前块剩余的空间还能容纳多一个结点的空间，则分裂当前块
-    if ((int64_t)(ck->length) - size > sizeof(malloc_mem_chunk_t))
-    {
-        // printf("seperate\n");
-        malloc_mem_chunk_t *new_ck = (malloc_mem_chunk_t *)(((uint64_t)ck) + size);
-        new_ck->length = ck->length - size;
-        new_ck->prev = new_ck->next = NULL;
-        // printf("new_ck=%#018lx, new_ck->length=%#010lx\n", (uint64_t)new_ck, new_ck->length);
-        ck->length = size;
-        malloc_insert_free_list(new_ck);
-    }
-    // printf("malloc done: %#018lx, length=%#018lx\n", ((uint64_t)ck + sizeof(uint64_t)), ck->length);
-    // 此时链表结点的指针的空间被分配出去
-    return (void *)((uint64_t)ck + sizeof(uint64_t));
+    malloc_mem_chunk_t *ck = (malloc_mem_chunk_t *)node - 1;
+    ck->arena = arena - malloc_arenas;
+    return (void *)node;
 }
 
 /**
- * @brief 当堆顶空闲空间大于2个页的空间的时候，释放1个页
+ * @brief 释放一块堆内存
  *
+ * @param ptr 堆内存的指针
  */
-static void release_brk()
+void free(void *ptr)
 {
-    // 先检测最顶上的块
-    // 由于块按照开始地址排列，因此找最后一个块
-    if (malloc_free_list_end == NULL)
+    if (ptr == NULL)
+        return;
+
+    malloc_mem_chunk_t *ck = (malloc_mem_chunk_t *)ptr - 1;
+    if (ck->bin == MALLOC_BIN_MMAP)
     {
-        printf("release(): free list end is null. \n");
+        syscall_invoke(SYS_MUNMAP, (uint64_t)ck, ck->length, 0, 0, 0, 0);
         return;
     }
-    if ((uint64_t)malloc_free_list_end + malloc_free_list_end->length == brk_max_addr && (uint64_t)malloc_free_list_end <= brk_max_addr - (PAGE_2M_SIZE << 1))
+
+    // 把数据区中除了链表结点所在页之外的整页还给内核，再次访问时会得到清零的页
+    if (ck->length - sizeof(malloc_mem_chunk_t) >= MALLOC_TRIM_THRESHOLD)
     {
-        int64_t delta = ((brk_max_addr - (uint64_t)malloc_free_list_end) & PAGE_2M_MASK) - PAGE_2M_SIZE;
-        // printf("(brk_max_addr - (uint64_t)malloc_free_list_end) & PAGE_2M_MASK=%#018lx\n ", (brk_max_addr - (uint64_t)malloc_free_list_end) & PAGE_2M_MASK);
-        // printf("PAGE_2M_SIZE=%#018lx\n", PAGE_2M_SIZE);
-        // printf("tdfghgbdfggkmfn=%#018lx\n ", (brk_max_addr - (uint64_t)malloc_free_list_end) & PAGE_2M_MASK - PAGE_2M_SIZE);
-        // printf("delta=%#018lx\n ", delta);
-        if (delta <= 0) // 不用释放内存
-            return;
-        sbrk(-delta);
-        brk_max_addr = sbrk(0);
-        brk_managed_addr = brk_max_addr;
-
-        malloc_free_list_end->length = brk_max_addr - (uint64_t)malloc_free_list_end;
+        uint64_t start = PAGE_ALIGN_UP((uint64_t)ptr + sizeof(malloc_free_node_t));
+        uint64_t end = ((uint64_t)ck + ck->length) & PAGE_4K_MASK;
+        if (end > start)
+            syscall_invoke(SYS_MADVISE, start, end - start, MADV_DONTNEED, 0, 0, 0);
     }
-}
-/**
- * @brief 释放一块堆内存
- *
- * @param ptr 堆内存的指针
- */
-void free(void *ptr)
-{
-    // 找到结点（此时prev和next都处于未初始化的状态）
-    malloc_mem_chunk_t *ck = (malloc_mem_chunk_t *)((uint64_t)ptr - sizeof(uint64_t));
-    // printf("free(): addr = %#018lx\t len=%#018lx\n", (uint64_t)ck, ck->length);
-    count_last_free_size += ck->length;
-
-    malloc_insert_free_list(ck);
 
-    if (count_last_free_size > PAGE_2M_SIZE)
+    malloc_free_node_t *node = (malloc_free_node_t *)ptr;
+    malloc_arena_t *arena = &malloc_arenas[ck->arena];
+    if (malloc_trylock(&arena->lock))
     {
-        count_last_free_size = 0;
-        malloc_merge_free_chunk();
-        release_brk();
+        malloc_bin_push(&arena->bins[ck->bin], node);
+        malloc_flush_bin(arena, ck->bin);
+        malloc_unlock(&arena->lock);
+        return;
     }
+
+    // arena正被其他线程使用，无锁地挂到它的远程释放链表上
+    malloc_free_node_t *old = __atomic_load_n(&arena->remote_free, __ATOMIC_RELAXED);
+    do
+    {
+        node->next = old;
+    } while (!__atomic_compare_exchange_n(&arena->remote_free, &old, node, 1, __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
 }
@@ -35,6 +35,8 @@ static int skip_and_atoi(const char **s)
  */
 int64_t put_string(char *str, uint64_t front_color, uint64_t bg_color)
 {
+    // put_string绕过了stdout，先写出stdout中的内容，保持输出的顺序
+    fflush(stdout);
     return syscall_invoke(SYS_PUT_STRING, (uint64_t)str, front_color, bg_color, 0, 0, 0);
 }
 
@@ -47,8 +49,8 @@ int printf(const char *fmt, ...)
 
     count = vsprintf(buf, fmt, args);
     va_end(args);
-    // put_string(buf, COLOR_WHITE, COLOR_BLACK);
-    write(1, buf, count);
+    if (fwrite(buf, 1, count, stdout) != (size_t)count)
+        return -1;
     return count;
 }
 
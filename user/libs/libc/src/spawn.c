@@ -0,0 +1,145 @@
+#include <errno.h>
+#include <libsystem/syscall.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t *file_actions)
+{
+    memset(file_actions, 0, sizeof(posix_spawn_file_actions_t));
+    return 0;
+}
+
+int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t *file_actions)
+{
+    for (int i = 0; i < file_actions->count; ++i)
+        free((void *)file_actions->actions[i].path);
+    free(file_actions->actions);
+    memset(file_actions, 0, sizeof(posix_spawn_file_actions_t));
+    return 0;
+}
+
+/**
+ * @brief 在file actions的末尾添加一项
+ *
+ * @return struct __posix_spawn_file_action* 新添加的项，内存不足时返回NULL
+ */
+static struct __posix_spawn_file_action *__add_file_action(posix_spawn_file_actions_t *file_actions)
+{
+    if (file_actions->count == file_actions->capacity)
+    {
+        int capacity = file_actions->capacity == 0 ? 8 : file_actions->capacity * 2;
+        struct __posix_spawn_file_action *actions =
+            malloc(capacity * sizeof(struct __posix_spawn_file_action));
+        if (actions == NULL)
+            return NULL;
+        if (file_actions->count != 0)
+            memcpy(actions, file_actions->actions, file_actions->count * sizeof(struct __posix_spawn_file_action));
+        free(file_actions->actions);
+        file_actions->actions = actions;
+        file_actions->capacity = capacity;
+    }
+    struct __posix_spawn_file_action *action = &file_actions->actions[file_actions->count++];
+    memset(action, 0, sizeof(struct __posix_spawn_file_action));
+    return action;
+}
+
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t *file_actions, int fd)
+{
+    if (fd < 0)
+        return EBADF;
+    struct __posix_spawn_file_action *action = __add_file_action(file_actions);
+    if (action == NULL)
+        return ENOMEM;
+    action->action = __POSIX_SPAWN_CLOSE;
+    action->fd = fd;
+    return 0;
+}
+
+int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t *file_actions, int fd, int newfd)
+{
+    if (fd < 0 || newfd < 0)
+        return EBADF;
+    struct __posix_spawn_file_action *action = __add_file_action(file_actions);
+    if (action == NULL)
+        return ENOMEM;
+    action->action = __POSIX_SPAWN_DUP2;
+    action->src_fd = fd;
+    action->fd = newfd;
+    return 0;
+}
+
+int posix_spawn_file_actions_addopen(posix_spawn_file_actions_t *file_actions, int fd, const char *path, int oflag,
+                                     mode_t mode)
+{
+    if (fd < 0)
+        return EBADF;
+    // 复制路径，调用者可以在posix_spawn之前释放它
+    char *path_copy = malloc(strlen(path) + 1);
+    if (path_copy == NULL)
+        return ENOMEM;
+    strcpy(path_copy, path);
+    struct __posix_spawn_file_action *action = __add_file_action(file_actions);
+    if (action == NULL)
+    {
+        free(path_copy);
+        return ENOMEM;
+    }
+    action->action = __POSIX_SPAWN_OPEN;
+    action->fd = fd;
+    action->oflag = oflag;
+    action->mode = mode;
+    action->path = path_copy;
+    return 0;
+}
+
+int posix_spawnattr_init(posix_spawnattr_t *attr)
+{
+    memset(attr, 0, sizeof(posix_spawnattr_t));
+    return 0;
+}
+
+int posix_spawnattr_destroy(posix_spawnattr_t *attr)
+{
+    return 0;
+}
+
+int posix_spawnattr_setflags(posix_spawnattr_t *attr, short flags)
+{
+    attr->flags = (uint16_t)flags;
+    return 0;
+}
+
+int posix_spawnattr_setsigmask(posix_spawnattr_t *attr, const sigset_t *sigmask)
+{
+    attr->sigmask = *sigmask;
+    return 0;
+}
+
+int posix_spawnattr_setsigdefault(posix_spawnattr_t *attr, const sigset_t *sigdefault)
+{
+    attr->sigdefault = *sigdefault;
+    return 0;
+}
+
+int posix_spawn(pid_t *pid, const char *path, const posix_spawn_file_actions_t *file_actions,
+                const posix_spawnattr_t *attrp, char *const argv[], char *const envp[])
+{
+    if (path == NULL)
+        return ENOENT;
+
+    uint64_t actions = 0, nr_actions = 0;
+    if (file_actions != NULL)
+    {
+        actions = (uint64_t)file_actions->actions;
+        nr_actions = file_actions->count;
+    }
+
+    long retval = syscall_invoke(SYS_POSIX_SPAWN, (uint64_t)path, (uint64_t)argv, (uint64_t)envp, actions,
+                                 nr_actions, (uint64_t)attrp);
+    if (retval < 0)
+        return -retval;
+    if (pid != NULL)
+        *pid = retval;
+    return 0;
+}
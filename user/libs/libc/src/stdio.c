@@ -1,32 +1,203 @@
+#include <errno.h>
 #include <fcntl.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-int fprintf(FILE *restrict stream, const char *restrict format, ...)
+#define __F_ERR 1     // 写入出错
+#define __F_OWNBUF 2  // 缓冲区由libc分配，需要由libc释放
+
+// fprintf格式化时使用的缓冲区大小
+#define __FPRINTF_BUFSIZE (65536 * 2)
+
+// 所有打开的流
+static FILE *__stdio_head = NULL;
+
+static void __stdio_link(FILE *stream)
 {
-    const int bufsize = 65536 * 2;
-    char *buf = malloc(bufsize);
-    memset(buf, 0, bufsize);
-    va_list args;
+    stream->next = __stdio_head;
+    __stdio_head = stream;
+}
 
-    va_start(args, format);
-    vsprintf(buf, format, args);
-    va_end(args);
+static void __stdio_unlink(FILE *stream)
+{
+    for (FILE **p = &__stdio_head; *p != NULL; p = &(*p)->next)
+    {
+        if (*p == stream)
+        {
+            *p = stream->next;
+            break;
+        }
+    }
+}
 
-    int len = strlen(buf);
-    if (len > bufsize - 1)
+static FILE *__stdio_new(int fd, int buf_mode)
+{
+    FILE *stream = malloc(sizeof(FILE));
+    memset(stream, 0, sizeof(FILE));
+    stream->fd = fd;
+    stream->buf_mode = buf_mode;
+    __stdio_link(stream);
+    return stream;
+}
+
+/**
+ * @brief 初始化标准流
+ *
+ * 内核没有提供判断文件描述符是否为终端的接口，而0~2号文件描述符总是从控制台继承而来，
+ * 因此把stdout当作终端，使用行缓冲；stderr不缓冲，以便出错信息能立即输出
+ */
+void __stdio_init(void)
+{
+    stdin = __stdio_new(0, _IOLBF);
+    stdout = __stdio_new(1, _IOLBF);
+    stderr = __stdio_new(2, _IONBF);
+}
+
+/**
+ * @brief 把一段数据完整地写入文件描述符
+ *
+ * @return 成功返回0，失败返回-1
+ */
+static int __stdio_write_all(FILE *stream, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t ret = write(stream->fd, data, len);
+        if (ret <= 0)
+        {
+            stream->flags |= __F_ERR;
+            return -1;
+        }
+        data += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+/**
+ * @brief 写出流的缓冲区中的数据
+ */
+static int __stdio_flush(FILE *stream)
+{
+    if (stream->buf_len == 0)
+        return 0;
+    size_t len = stream->buf_len;
+    stream->buf_len = 0;
+    if (__stdio_write_all(stream, stream->buf, len))
+        return EOF;
+    return 0;
+}
+
+/**
+ * @brief 在第一次写入时分配缓冲区。分配失败时退化为无缓冲
+ */
+static void __stdio_setup_buf(FILE *stream)
+{
+    if (stream->buf != NULL || stream->buf_mode == _IONBF)
+        return;
+    if (stream->buf_size == 0)
+        stream->buf_size = BUFSIZ;
+    char *buf = malloc(stream->buf_size);
+    if (buf == NULL || buf == (void *)-ENOMEM)
+    {
+        stream->buf_mode = _IONBF;
+        stream->buf_size = 0;
+        return;
+    }
+    stream->buf = buf;
+    stream->flags |= __F_OWNBUF;
+}
+
+/**
+ * @brief 写入一段数据：数据能放进缓冲区时只做拷贝，放不下的大块数据在写出缓冲区后直接写入
+ *
+ * @return 成功返回0，失败返回-1
+ */
+static int __stdio_write(FILE *stream, const char *data, size_t len)
+{
+    __stdio_setup_buf(stream);
+    if (stream->buf_mode == _IONBF)
+        return __stdio_write_all(stream, data, len);
+
+    if (len > stream->buf_size - stream->buf_len)
+    {
+        if (__stdio_flush(stream))
+            return -1;
+        if (len >= stream->buf_size)
+            return __stdio_write_all(stream, data, len);
+    }
+    memcpy(stream->buf + stream->buf_len, data, len);
+    stream->buf_len += len;
+
+    if (stream->buf_mode == _IOLBF)
     {
-        len = bufsize - 1;
-        buf[bufsize - 1] = 0;
+        for (size_t i = 0; i < len; ++i)
+        {
+            if (data[i] == '\n')
+                return __stdio_flush(stream) ? -1 : 0;
+        }
     }
-    write(stream->fd, buf, len);
+    return 0;
+}
+
+size_t fwrite(const void *restrict ptr, size_t size, size_t nmemb, FILE *restrict stream)
+{
+    size_t len = size * nmemb;
+    if (len == 0)
+        return 0;
+    if (__stdio_write(stream, ptr, len))
+        return 0;
+    return nmemb;
+}
+
+int fputc(int c, FILE *stream)
+{
+    char ch = (char)c;
+    if (__stdio_write(stream, &ch, 1))
+        return EOF;
+    return (unsigned char)ch;
+}
+
+int fputs(const char *restrict s, FILE *restrict stream)
+{
+    if (__stdio_write(stream, s, strlen(s)))
+        return EOF;
+    return 0;
+}
+
+int vfprintf(FILE *restrict stream, const char *restrict format, va_list args)
+{
+    char *buf = malloc(__FPRINTF_BUFSIZE);
+    if (buf == NULL || buf == (void *)-ENOMEM)
+        return -1;
+    memset(buf, 0, __FPRINTF_BUFSIZE);
+
+    vsprintf(buf, format, args);
+    int len = strlen(buf);
+    if (len > __FPRINTF_BUFSIZE - 1)
+        len = __FPRINTF_BUFSIZE - 1;
+    int retval = __stdio_write(stream, buf, len) ? -1 : len;
     free(buf);
+    return retval;
+}
+
+int fprintf(FILE *restrict stream, const char *restrict format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    int retval = vfprintf(stream, format, args);
+    va_end(args);
+    return retval;
 }
 
 int getchar(void)
 {
+    // 读取输入之前先输出提示符等还留在缓冲区中的内容
+    fflush(stdout);
     unsigned int c;
     read(0, &c, 1);
     return c;
@@ -34,31 +205,84 @@ int getchar(void)
 
 int puts(const char *s)
 {
-    return put_string(s, COLOR_WHITE, COLOR_BLACK);
+    if (fputs(s, stdout) == EOF || fputc('\n', stdout) == EOF)
+        return EOF;
+    return 0;
 }
 
 int putchar(int c)
 {
-    return printf("%c", (char)c);
+    return fputc(c, stdout);
 }
 
-int fflush(FILE *stream)
+/**
+ * @brief 设置流的缓冲方式，需要在对流进行任何读写之前调用
+ *
+ * @param buf 由调用者提供的缓冲区，为NULL时由libc分配
+ * @param mode _IOFBF、_IOLBF或_IONBF
+ * @param size 缓冲区的大小，为0时使用BUFSIZ
+ */
+int setvbuf(FILE *restrict stream, char *restrict buf, int mode, size_t size)
 {
+    if (mode != _IOFBF && mode != _IOLBF && mode != _IONBF)
+        return -1;
+    __stdio_flush(stream);
+    if (stream->flags & __F_OWNBUF)
+        free(stream->buf);
+    stream->flags &= ~__F_OWNBUF;
+    stream->buf_mode = mode;
+    stream->buf = NULL;
+    stream->buf_size = 0;
+    if (mode == _IONBF)
+        return 0;
+
+    stream->buf_size = size ? size : BUFSIZ;
+    // 调用者提供的缓冲区由调用者负责释放
+    if (buf != NULL)
+        stream->buf = buf;
     return 0;
 }
 
+void setbuf(FILE *restrict stream, char *restrict buf)
+{
+    setvbuf(stream, buf, buf ? _IOFBF : _IONBF, BUFSIZ);
+}
+
+/**
+ * @brief 写出流的缓冲区。stream为NULL时写出所有打开的流
+ */
+int fflush(FILE *stream)
+{
+    if (stream != NULL)
+        return __stdio_flush(stream);
+
+    int retval = 0;
+    for (FILE *p = __stdio_head; p != NULL; p = p->next)
+    {
+        if (__stdio_flush(p))
+            retval = EOF;
+    }
+    return retval;
+}
+
 int ferror(FILE *stream)
 {
-    return 0;
+    return stream->flags & __F_ERR;
 }
 
 int fclose(FILE *stream)
 {
+    __stdio_flush(stream);
     int retval = close(stream->fd);
     if (retval)
         return retval;
     if (stream->fd >= 3)
+    {
+        __stdio_unlink(stream);
+        if (stream->flags & __F_OWNBUF)
+            free(stream->buf);
         free(stream);
+    }
 
     return 0;
 }
@@ -67,8 +291,8 @@ int fclose(FILE *stream)
 // 请注意，这个函数的实现，没有遵照posix，行为也与Linux的不一致，请在将来用Rust重构时改变它，以使得它的行为与Linux的一致。
 FILE *fopen(const char *restrict pathname, const char *restrict mode)
 {
-    FILE *stream = malloc(sizeof(FILE));
-    memset(stream, 0, sizeof(FILE));
+    // 普通文件使用全缓冲
+    FILE *stream = __stdio_new(-1, _IOFBF);
     int o_flags = 0;
 
     if (strcmp(mode, "r") == 0)
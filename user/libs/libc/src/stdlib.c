@@ -1,4 +1,6 @@
 #include <ctype.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <libsystem/syscall.h>
@@ -56,6 +58,7 @@ int atoi(const char *str)
  */
 void exit(int status)
 {
+    fflush(NULL);
     _fini();
     syscall_invoke(SYS_EXIT, status, 0, 0, 0, 0, 0);
 }
@@ -19,6 +19,8 @@
 #define SYS_RT_SIGRETURN 15
 #define SYS_IOCTL 16
 
+#define SYS_MADVISE 28
+
 #define SYS_DUP 32
 #define SYS_DUP2 33
 
@@ -87,6 +89,7 @@
 /// todo: 该系统调用与Linux不一致，将来需要删除该系统调用！！！ 删的时候记得改C版本的libc
 #define SYS_CLOCK 100002
 #define SYS_SCHED 100003
+#define SYS_POSIX_SPAWN 100004
 
 /**
  * @brief 用户态系统调用函数